@@ -0,0 +1,1600 @@
+//
+//  gensio - A library for abstracting stream I/O
+//  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+//
+//  SPDX-License-Identifier: LGPL-2.1-only
+
+// This library provides a gensio_os_funcs object that runs on an Asio
+// io_context.  It can be used if you have a project based on Asio
+// that you want to integrate gensio into.
+//
+// fd handlers are waits on a posix::stream_descriptor, timers are
+// steady_timers, and runners are posted to the io_context.  So all
+// gensio callbacks are run by whatever threads are running the
+// io_context, there is no separate gensio loop.  The handlers for an
+// iod are run through a strand, so they don't run concurrently with
+// each other.  Asio objects are not safe to use from multiple threads
+// at once, so every use of one is done with the owning object's lock
+// held.
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <asio.hpp>
+
+#include <gensio/gensio_asio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_err.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_osops.h>
+#include <gensio/argvutils.h>
+extern "C" {
+#include <gensio/gensio_osops_addrinfo.h>
+#include <gensio/gensio_osops_stdsock.h>
+}
+
+struct gensio_data
+{
+    struct gensio_memtrack *mtrack;
+    unsigned int refcount;
+    struct gensio_os_proc_data *pdata;
+
+    asio::io_context *ctx;
+};
+
+static void *
+gensio_asio_zalloc(struct gensio_os_funcs *f, gensiods size)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(f->user_data);
+
+    return gensio_i_zalloc(d->mtrack, size);
+}
+
+static void
+gensio_asio_free(struct gensio_os_funcs *f, void *data)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(f->user_data);
+
+    gensio_i_free(d->mtrack, data);
+}
+
+// The objects below have C++ members, so they are constructed in
+// memory from the os funcs allocator to keep the memory tracking.
+template <class T, class... Args>
+static T *
+asio_new(struct gensio_os_funcs *o, Args&&... args)
+{
+    void *mem = o->zalloc(o, sizeof(T));
+
+    if (!mem)
+	return NULL;
+    try {
+	return new (mem) T(std::forward<Args>(args)...);
+    } catch (...) {
+	o->free(o, mem);
+	return NULL;
+    }
+}
+
+template <class T>
+static void
+asio_delete(struct gensio_os_funcs *o, T *p)
+{
+    p->~T();
+    o->free(o, p);
+}
+
+static asio::io_context &
+asio_ctx(struct gensio_os_funcs *o)
+{
+    return *static_cast<struct gensio_data *>(o->user_data)->ctx;
+}
+
+struct gensio_lock {
+    struct gensio_os_funcs *f = NULL;
+    std::mutex mutex;
+};
+
+static struct gensio_lock *
+gensio_asio_alloc_lock(struct gensio_os_funcs *f)
+{
+    struct gensio_lock *lock = asio_new<struct gensio_lock>(f);
+
+    if (lock)
+	lock->f = f;
+    return lock;
+}
+
+static void
+gensio_asio_free_lock(struct gensio_lock *lock)
+{
+    asio_delete(lock->f, lock);
+}
+
+static void
+gensio_asio_lock(struct gensio_lock *lock)
+{
+    lock->mutex.lock();
+}
+
+static void
+gensio_asio_unlock(struct gensio_lock *lock)
+{
+    lock->mutex.unlock();
+}
+
+enum { ASIO_WAIT_READ, ASIO_WAIT_WRITE, ASIO_WAIT_EXCEPT, ASIO_NR_WAITS };
+
+static const asio::posix::descriptor_base::wait_type
+asio_wait_types[ASIO_NR_WAITS] = {
+    asio::posix::descriptor_base::wait_read,
+    asio::posix::descriptor_base::wait_write,
+    asio::posix::descriptor_base::wait_error
+};
+
+typedef void (*asio_iod_handler)(struct gensio_iod *iod, void *cb_data);
+
+struct gensio_iod_asio : public gensio_iod {
+    gensio_iod_asio(asio::io_context &ctx)
+	: sd(ctx), strand(asio::make_strand(ctx)) { }
+
+    std::mutex lock;
+
+    asio::posix::stream_descriptor sd;
+    asio::strand<asio::io_context::executor_type> strand;
+
+    // Handlers the user has enabled, and waits outstanding in asio.
+    bool enabled[ASIO_NR_WAITS] = { };
+    bool pending[ASIO_NR_WAITS] = { };
+
+    bool in_clear = false;
+
+    // Freed once nothing is pending.
+    bool released = false;
+
+    int orig_fd = -1;
+    int fd = -1;
+    enum gensio_iod_type type = GENSIO_IOD_SOCKET;
+    void *sockinfo = NULL;
+    bool handlers_set = false;
+    bool is_stdio = false;
+    void *cb_data = NULL;
+    asio_iod_handler handlers[ASIO_NR_WAITS] = { };
+    asio_iod_handler cleared_handler = NULL;
+
+    struct stdio_mode *mode = NULL;
+
+    struct gensio_unix_termios *termios = NULL;
+
+    // For GENSIO_IOD_FILE
+    struct gensio_runner *runner = NULL;
+    bool in_handler = false;
+
+    // For GENSIO_IOD_PTY
+    const char **argv = NULL;
+    const char **env = NULL;
+    char *start_dir = NULL;
+    int pid = -1;
+};
+
+static struct gensio_iod_asio *
+i_to_asio(struct gensio_iod *iiod)
+{
+    return static_cast<struct gensio_iod_asio *>(iiod);
+}
+
+static bool
+asio_iod_idle(struct gensio_iod_asio *iod)
+{
+    unsigned int i;
+
+    for (i = 0; i < ASIO_NR_WAITS; i++) {
+	if (iod->pending[i])
+	    return false;
+    }
+    return true;
+}
+
+static void
+asio_iod_free(struct gensio_iod_asio *iod)
+{
+    struct gensio_os_funcs *o = iod->f;
+
+    if (iod->type == GENSIO_IOD_FILE)
+	o->free_runner(iod->runner);
+    if (iod->type == GENSIO_IOD_PTY) {
+	if (iod->argv)
+	    gensio_argv_free(o, iod->argv);
+	if (iod->env)
+	    gensio_argv_free(o, iod->env);
+	if (iod->start_dir)
+	    o->free(o, iod->start_dir);
+    }
+    asio_delete(o, iod);
+}
+
+// Once no waits are outstanding, finish a clear or a free.  Call with
+// the lock held, it may be released.  The iod may be gone on return.
+static void
+asio_iod_check_idle(struct gensio_iod_asio *iod,
+		    std::unique_lock<std::mutex> &l)
+{
+    if (!asio_iod_idle(iod))
+	return;
+
+    if (iod->released) {
+	l.unlock();
+	l.release();
+	asio_iod_free(iod);
+	return;
+    }
+
+    if (iod->in_clear) {
+	iod->in_clear = false;
+	iod->handlers_set = false;
+	for (auto &h : iod->handlers)
+	    h = NULL;
+	l.unlock();
+	if (iod->cleared_handler)
+	    iod->cleared_handler(iod, iod->cb_data);
+	l.lock();
+    }
+}
+
+static void asio_iod_wait_done(struct gensio_iod_asio *iod, int which,
+			       const asio::error_code &ec);
+
+// Start a wait if one is wanted and not already there.  Call with the
+// iod lock held.
+static void
+asio_iod_start_wait(struct gensio_iod_asio *iod, int which)
+{
+    if (iod->pending[which] || !iod->enabled[which] || iod->in_clear ||
+		iod->released)
+	return;
+
+    iod->pending[which] = true;
+    iod->sd.async_wait(asio_wait_types[which],
+		       asio::bind_executor(iod->strand,
+			   [iod, which](const asio::error_code &ec) {
+			       asio_iod_wait_done(iod, which, ec);
+			   }));
+}
+
+static void
+asio_iod_wait_done(struct gensio_iod_asio *iod, int which,
+		   const asio::error_code &ec)
+{
+    std::unique_lock<std::mutex> l(iod->lock);
+    asio_iod_handler handler = NULL;
+
+    iod->pending[which] = false;
+    // On an error other than a cancel, let the handler find it in the I/O.
+    if (ec != asio::error::operation_aborted && iod->enabled[which] &&
+		!iod->in_clear && !iod->released)
+	handler = iod->handlers[which];
+    if (handler) {
+	l.unlock();
+	handler(iod, iod->cb_data);
+	l.lock();
+    }
+
+    // Waits are one-shot, so re-arm if it's still enabled.
+    asio_iod_start_wait(iod, which);
+    asio_iod_check_idle(iod, l);
+}
+
+static int
+gensio_asio_set_fd_handlers(struct gensio_iod *iiod,
+			    void *cb_data,
+			    void (*read_handler)(struct gensio_iod *iod,
+						 void *cb_data),
+			    void (*write_handler)(struct gensio_iod *iod,
+						  void *cb_data),
+			    void (*except_handler)(struct gensio_iod *iod,
+						   void *cb_data),
+			    void (*cleared_handler)(struct gensio_iod *iod,
+						    void *cb_data))
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    std::lock_guard<std::mutex> l(iod->lock);
+
+    if (iod->handlers_set)
+	return GE_INUSE;
+
+    iod->handlers_set = true;
+
+    iod->cb_data = cb_data;
+    iod->handlers[ASIO_WAIT_READ] = read_handler;
+    iod->handlers[ASIO_WAIT_WRITE] = write_handler;
+    iod->handlers[ASIO_WAIT_EXCEPT] = except_handler;
+    iod->cleared_handler = cleared_handler;
+
+    return 0;
+}
+
+static void
+gensio_asio_clear_fd_handlers(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    std::lock_guard<std::mutex> l(iod->lock);
+
+    if (!iod->handlers_set || iod->in_clear)
+	return;
+    iod->in_clear = true;
+    for (auto &e : iod->enabled)
+	e = false;
+
+    if (iod->type == GENSIO_IOD_FILE) {
+	// If the runner is pending it reports the clear.
+	if (iod->in_handler)
+	    return;
+    } else if (!asio_iod_idle(iod)) {
+	// The last wait to finish reports the clear.
+	iod->sd.cancel();
+	return;
+    }
+
+    asio::post(iod->strand, [iod]() {
+	std::unique_lock<std::mutex> l(iod->lock);
+
+	asio_iod_check_idle(iod, l);
+    });
+}
+
+static void
+gensio_asio_clear_fd_handlers_norpt(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    std::lock_guard<std::mutex> l(iod->lock);
+
+    for (auto e : iod->enabled)
+	assert(!e);
+    iod->handlers_set = false;
+}
+
+static void
+file_runner(struct gensio_runner *r, void *cb_data)
+{
+    struct gensio_iod_asio *iod = static_cast<struct gensio_iod_asio *>(cb_data);
+    std::unique_lock<std::mutex> l(iod->lock);
+    bool *rd = &iod->enabled[ASIO_WAIT_READ];
+    bool *wr = &iod->enabled[ASIO_WAIT_WRITE];
+
+    while (*rd || *wr) {
+	if (*rd) {
+	    l.unlock();
+	    iod->handlers[ASIO_WAIT_READ](iod, iod->cb_data);
+	    l.lock();
+	}
+	if (*wr) {
+	    l.unlock();
+	    iod->handlers[ASIO_WAIT_WRITE](iod, iod->cb_data);
+	    l.lock();
+	}
+    }
+    iod->in_handler = false;
+    if (iod->in_clear) {
+	iod->in_clear = false;
+	iod->handlers_set = false;
+	l.unlock();
+	iod->cleared_handler(iod, iod->cb_data);
+    }
+}
+
+static void
+asio_iod_set_enabled(struct gensio_iod *iiod, int which, bool enable)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    std::lock_guard<std::mutex> l(iod->lock);
+
+    if (iod->type == GENSIO_IOD_FILE) {
+	if (which == ASIO_WAIT_EXCEPT || iod->enabled[which] == enable ||
+		iod->in_clear)
+	    return;
+	iod->enabled[which] = enable;
+	if (enable && !iod->in_handler) {
+	    iod->f->run(iod->runner);
+	    iod->in_handler = true;
+	}
+	return;
+    }
+
+    // A disable leaves any wait in place, it's ignored when it finishes.
+    iod->enabled[which] = enable;
+    if (enable)
+	asio_iod_start_wait(iod, which);
+}
+
+static void
+gensio_asio_set_read_handler(struct gensio_iod *iiod, bool enable)
+{
+    asio_iod_set_enabled(iiod, ASIO_WAIT_READ, enable);
+}
+
+static void
+gensio_asio_set_write_handler(struct gensio_iod *iiod, bool enable)
+{
+    asio_iod_set_enabled(iiod, ASIO_WAIT_WRITE, enable);
+}
+
+static void
+gensio_asio_set_except_handler(struct gensio_iod *iiod, bool enable)
+{
+    asio_iod_set_enabled(iiod, ASIO_WAIT_EXCEPT, enable);
+}
+
+typedef void (*asio_timer_handler)(struct gensio_timer *t, void *cb_data);
+
+struct gensio_timer
+{
+    gensio_timer(asio::io_context &ctx) : timer(ctx) { }
+
+    struct gensio_os_funcs *o = NULL;
+
+    asio_timer_handler handler = NULL;
+    void *cb_data = NULL;
+
+    std::mutex lock;
+
+    asio::steady_timer timer;
+
+    // Waits outstanding in asio, and which start the current one is.
+    unsigned int pending = 0;
+    unsigned int gen = 0;
+
+    enum {
+	  ASIO_TIMER_FREE,
+	  ASIO_TIMER_IN_STOP,
+	  ASIO_TIMER_STOPPED,
+	  ASIO_TIMER_RUNNING
+    } state = ASIO_TIMER_STOPPED;
+
+    asio_timer_handler done_handler = NULL;
+    void *done_cb_data = NULL;
+};
+
+static struct gensio_timer *
+gensio_asio_alloc_timer(struct gensio_os_funcs *o,
+			void (*handler)(struct gensio_timer *t,
+					void *cb_data),
+			void *cb_data)
+{
+    struct gensio_timer *t = asio_new<struct gensio_timer>(o, asio_ctx(o));
+
+    if (!t)
+	return NULL;
+
+    t->o = o;
+    t->handler = handler;
+    t->cb_data = cb_data;
+
+    return t;
+}
+
+static void
+gensio_asio_timer_done(struct gensio_timer *t, unsigned int gen)
+{
+    std::unique_lock<std::mutex> l(t->lock);
+    asio_timer_handler handler = NULL;
+    void *cb_data = NULL;
+
+    t->pending--;
+    if (t->state == gensio_timer::ASIO_TIMER_FREE) {
+	if (t->pending == 0) {
+	    l.unlock();
+	    l.release();
+	    asio_delete(t->o, t);
+	}
+	return;
+    }
+
+    // Every wait finishes exactly once, whether it timed out or was
+    // cancelled.  Only the one from the last start matters.
+    if (gen != t->gen)
+	return;
+    if (t->state == gensio_timer::ASIO_TIMER_RUNNING) {
+	handler = t->handler;
+	cb_data = t->cb_data;
+	t->state = gensio_timer::ASIO_TIMER_STOPPED;
+    } else if (t->state == gensio_timer::ASIO_TIMER_IN_STOP) {
+	handler = t->done_handler;
+	cb_data = t->done_cb_data;
+	t->done_handler = NULL;
+	t->state = gensio_timer::ASIO_TIMER_STOPPED;
+    }
+    l.unlock();
+
+    if (handler)
+	handler(t, cb_data);
+}
+
+static void
+gensio_asio_free_timer(struct gensio_timer *t)
+{
+    std::unique_lock<std::mutex> l(t->lock);
+
+    assert(t->state != gensio_timer::ASIO_TIMER_FREE);
+    t->state = gensio_timer::ASIO_TIMER_FREE;
+    if (t->pending) {
+	// The last wait to finish frees it.
+	t->timer.cancel();
+	return;
+    }
+    l.unlock();
+    l.release();
+    asio_delete(t->o, t);
+}
+
+static int
+gensio_asio_start_timer_at(struct gensio_timer *t,
+			   asio::steady_timer::time_point when)
+{
+    std::lock_guard<std::mutex> l(t->lock);
+    unsigned int gen;
+
+    assert(t->state != gensio_timer::ASIO_TIMER_FREE);
+    if (t->state != gensio_timer::ASIO_TIMER_STOPPED)
+	return GE_INUSE;
+
+    t->done_handler = NULL;
+    t->state = gensio_timer::ASIO_TIMER_RUNNING;
+    gen = ++t->gen;
+    t->pending++;
+    t->timer.expires_at(when);
+    t->timer.async_wait([t, gen](const asio::error_code &ec) {
+	gensio_asio_timer_done(t, gen);
+    });
+
+    return 0;
+}
+
+static int
+gensio_asio_start_timer(struct gensio_timer *t, gensio_time *timeout)
+{
+    return gensio_asio_start_timer_at(t, asio::steady_timer::clock_type::now()
+				      + std::chrono::seconds(timeout->secs)
+				      + std::chrono::nanoseconds(timeout->nsecs));
+}
+
+static int
+gensio_asio_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
+{
+    asio::steady_timer::time_point when;
+
+    // Monotonic time here is the steady clock, see get_monotonic_time.
+    when += std::chrono::duration_cast<asio::steady_timer::duration>(
+			std::chrono::seconds(timeout->secs) +
+			std::chrono::nanoseconds(timeout->nsecs));
+    return gensio_asio_start_timer_at(t, when);
+}
+
+static int
+gensio_asio_stop_timer(struct gensio_timer *t)
+{
+    std::lock_guard<std::mutex> l(t->lock);
+
+    assert(t->state != gensio_timer::ASIO_TIMER_FREE);
+    if (t->state != gensio_timer::ASIO_TIMER_RUNNING)
+	return GE_TIMEDOUT;
+    t->state = gensio_timer::ASIO_TIMER_STOPPED;
+    t->timer.cancel();
+    return 0;
+}
+
+static int
+gensio_asio_stop_timer_with_done(struct gensio_timer *t,
+				 void (*done_handler)(struct gensio_timer *t,
+						      void *cb_data),
+				 void *cb_data)
+{
+    std::lock_guard<std::mutex> l(t->lock);
+
+    if (t->state == gensio_timer::ASIO_TIMER_IN_STOP)
+	return GE_INUSE;
+    if (t->state != gensio_timer::ASIO_TIMER_RUNNING)
+	return GE_TIMEDOUT;
+
+    // The done handler is called when the wait finishes.
+    t->state = gensio_timer::ASIO_TIMER_IN_STOP;
+    t->done_handler = done_handler;
+    t->done_cb_data = cb_data;
+    t->timer.cancel();
+    return 0;
+}
+
+struct gensio_runner
+{
+    struct gensio_os_funcs *o = NULL;
+
+    void (*handler)(struct gensio_runner *r, void *cb_data) = NULL;
+    void *cb_data = NULL;
+    bool freed = false;
+    bool in_use = false;
+
+    std::mutex lock;
+};
+
+static void
+gensio_asio_runner_handler(struct gensio_runner *r)
+{
+    std::unique_lock<std::mutex> l(r->lock);
+    void (*handler)(struct gensio_runner *r, void *cb_data);
+    void *cb_data;
+
+    if (r->freed) {
+	l.unlock();
+	l.release();
+	asio_delete(r->o, r);
+	return;
+    }
+    handler = r->handler;
+    cb_data = r->cb_data;
+    r->in_use = false;
+    l.unlock();
+
+    handler(r, cb_data);
+}
+
+static struct gensio_runner *
+gensio_asio_alloc_runner(struct gensio_os_funcs *o,
+			 void (*handler)(struct gensio_runner *r,
+					 void *cb_data),
+			 void *cb_data)
+{
+    struct gensio_runner *r = asio_new<struct gensio_runner>(o);
+
+    if (!r)
+	return NULL;
+
+    r->o = o;
+    r->handler = handler;
+    r->cb_data = cb_data;
+
+    return r;
+}
+
+static void
+gensio_asio_free_runner(struct gensio_runner *r)
+{
+    std::unique_lock<std::mutex> l(r->lock);
+
+    if (r->in_use) {
+	r->freed = true;
+	return;
+    }
+    l.unlock();
+    l.release();
+    asio_delete(r->o, r);
+}
+
+static int
+gensio_asio_run(struct gensio_runner *r)
+{
+    std::lock_guard<std::mutex> l(r->lock);
+
+    if (r->in_use)
+	return GE_INUSE;
+    r->in_use = true;
+    asio::post(asio_ctx(r->o), [r]() { gensio_asio_runner_handler(r); });
+    return 0;
+}
+
+struct gensio_waiter
+{
+    struct gensio_os_funcs *o = NULL;
+
+    unsigned int count = 0;
+
+    // Waiters that are running the io_context themselves.
+    unsigned int driving = 0;
+
+    std::mutex lock;
+    std::condition_variable cond;
+};
+
+static struct gensio_waiter *
+gensio_asio_alloc_waiter(struct gensio_os_funcs *o)
+{
+    struct gensio_waiter *w = asio_new<struct gensio_waiter>(o);
+
+    if (w)
+	w->o = o;
+    return w;
+}
+
+static void
+gensio_asio_free_waiter(struct gensio_waiter *w)
+{
+    asio_delete(w->o, w);
+}
+
+// Don't let a driving waiter sit in the io_context for longer than
+// this.  A wake is posted to the io_context to get a driving waiter
+// out of it, but if other threads are running it one of them may get
+// the wake instead.
+#define ASIO_MAX_DRIVE std::chrono::milliseconds(100)
+
+static int
+gensio_asio_wait_intr_sigmask(struct gensio_waiter *w, unsigned int count,
+			      gensio_time *timeout,
+			      struct gensio_os_proc_data *proc_data)
+{
+    asio::io_context &ctx = asio_ctx(w->o);
+    std::chrono::steady_clock::time_point end;
+    std::chrono::steady_clock::duration left;
+    std::unique_lock<std::mutex> l(w->lock, std::defer_lock);
+    bool drive = !ctx.get_executor().running_in_this_thread();
+    int rv = 0;
+    sigset_t origmask;
+
+    if (proc_data) {
+	pthread_sigmask(SIG_SETMASK,
+			gensio_os_proc_unix_get_wait_sigset(proc_data),
+			&origmask);
+    }
+    if (timeout)
+	end = std::chrono::steady_clock::now()
+	    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::seconds(timeout->secs) +
+			std::chrono::nanoseconds(timeout->nsecs));
+
+    if (drive) {
+	// Not in a handler, so run the io_context here until woken.
+	// Keep it from running out of work while doing that.
+	auto work = asio::make_work_guard(ctx);
+
+	l.lock();
+	w->driving++;
+	while (count > w->count) {
+	    left = ASIO_MAX_DRIVE;
+	    if (timeout) {
+		if (std::chrono::steady_clock::now() >= end)
+		    break;
+		if (end - std::chrono::steady_clock::now() < left)
+		    left = end - std::chrono::steady_clock::now();
+	    }
+	    l.unlock();
+	    if (ctx.stopped())
+		ctx.restart();
+	    ctx.run_one_for(left);
+	    l.lock();
+	}
+	w->driving--;
+    } else {
+	// In a handler, other threads running the io_context wake us.
+	l.lock();
+	while (count > w->count) {
+	    if (!timeout)
+		w->cond.wait(l);
+	    else if (w->cond.wait_until(l, end) == std::cv_status::timeout)
+		break;
+	}
+    }
+    if (count > w->count)
+	rv = GE_TIMEDOUT;
+    else
+	w->count -= count;
+    l.unlock();
+
+    if (timeout) {
+	left = end - std::chrono::steady_clock::now();
+	if (left.count() > 0) {
+	    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+
+	    timeout->secs = ns.count() / 1000000000;
+	    timeout->nsecs = ns.count() % 1000000000;
+	} else {
+	    timeout->secs = 0;
+	    timeout->nsecs = 0;
+	}
+    }
+
+    if (proc_data) {
+	pthread_sigmask(SIG_SETMASK, &origmask, NULL);
+	gensio_os_proc_check_handlers(proc_data);
+    }
+
+    return rv;
+}
+
+static int
+gensio_asio_wait(struct gensio_waiter *w, unsigned int count,
+		 gensio_time *timeout)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(w->o->user_data);
+    int rv = GE_INTERRUPTED;
+
+    while (rv == GE_INTERRUPTED)
+	rv = gensio_asio_wait_intr_sigmask(w, count, timeout, d->pdata);
+
+    return rv;
+}
+
+static int
+gensio_asio_wait_intr(struct gensio_waiter *w, unsigned int count,
+		      gensio_time *timeout)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(w->o->user_data);
+
+    return gensio_asio_wait_intr_sigmask(w, count, timeout, d->pdata);
+}
+
+static void
+gensio_asio_wake(struct gensio_waiter *w)
+{
+    std::lock_guard<std::mutex> l(w->lock);
+
+    w->count += 1;
+    w->cond.notify_all();
+    // Get a driving waiter out of the io_context to see this.
+    if (w->driving)
+	asio::post(asio_ctx(w->o), []() { });
+}
+
+static int
+gensio_asio_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
+		    intptr_t ofd, struct gensio_iod **riod)
+{
+    struct gensio_iod_asio *iod = NULL;
+    bool closefd = false;
+    int err = GE_NOMEM, fd = ofd;
+
+    if (type == GENSIO_IOD_CONSOLE) {
+       if (fd == 0)
+           fd = open("/dev/tty", O_RDONLY);
+       else if (fd == 1)
+           fd = open("/dev/tty", O_WRONLY);
+       else
+           return GE_INVAL;
+       if (fd == -1)
+           return gensio_os_err_to_err(o, errno);
+       closefd = true;
+    } else if (type == GENSIO_IOD_PTY) {
+	err = gensio_unix_pty_alloc(o, &fd);
+	if (err)
+	    return err;
+	closefd = true;
+    }
+
+    iod = asio_new<struct gensio_iod_asio>(o, asio_ctx(o));
+    if (!iod) {
+	err = GE_NOMEM;
+	goto out_err;
+    }
+
+    iod->f = o;
+    iod->fd = fd;
+    iod->orig_fd = ofd;
+    if (type == GENSIO_IOD_STDIO) {
+	struct stat statb;
+
+	iod->is_stdio = true;
+
+	err = fstat(fd, &statb);
+	if (err == -1) {
+	    err = gensio_os_err_to_err(o, errno);
+	    goto out_err;
+	}
+	switch (statb.st_mode & S_IFMT) {
+	case S_IFREG: type = GENSIO_IOD_FILE; break;
+	case S_IFCHR: type = GENSIO_IOD_DEV; break;
+	case S_IFIFO: type = GENSIO_IOD_PIPE; break;
+	case S_IFSOCK: type = GENSIO_IOD_SOCKET; break;
+	default:
+	    err = GE_INVAL;
+	    goto out_err;
+	}
+    }
+    iod->type = type;
+
+    if (type == GENSIO_IOD_FILE) {
+	iod->runner = o->alloc_runner(o, file_runner, iod);
+	if (!iod->runner) {
+	    err = GE_NOMEM;
+	    goto out_err;
+	}
+    } else {
+	asio::error_code ec;
+
+	iod->sd.assign(fd, ec);
+	if (ec) {
+	    err = gensio_os_err_to_err(o, ec.value());
+	    goto out_err;
+	}
+    }
+
+    *riod = iod;
+
+    return 0;
+ out_err:
+    if (iod) {
+	if (iod->sd.is_open())
+	    iod->sd.release();
+	asio_delete(o, iod);
+    }
+    if (closefd)
+	close(fd);
+    return err;
+}
+
+// Stop asio from using the fd.  Outstanding waits finish as cancelled.
+// Call with the iod lock held.
+static void
+asio_iod_release_fd(struct gensio_iod_asio *iod)
+{
+    if (iod->sd.is_open())
+	iod->sd.release();
+}
+
+static void
+gensio_asio_release_iod(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    std::unique_lock<std::mutex> l(iod->lock);
+
+    assert(!iod->handlers_set);
+    iod->released = true;
+    asio_iod_release_fd(iod);
+    asio_iod_check_idle(iod, l);
+}
+
+static int
+gensio_asio_iod_get_type(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    return iod->type;
+}
+
+static int
+gensio_asio_iod_get_fd(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    return iod->fd;
+}
+
+static int
+gensio_asio_pty_control(struct gensio_iod_asio *iod, int op, bool get,
+			intptr_t val)
+{
+    struct gensio_os_funcs *o = iod->f;
+    int err = 0;
+    const char **nargv;
+
+    if (get) {
+	if (op == GENSIO_IOD_CONTROL_PID) {
+	    if (iod->pid == -1)
+		return GE_NOTREADY;
+	    *((intptr_t *) val) = iod->pid;
+	    return 0;
+	}
+	return GE_NOTSUP;
+    }
+
+    switch (op) {
+    case GENSIO_IOD_CONTROL_ARGV:
+	err = gensio_argv_copy(o, (const char **) val, NULL, &nargv);
+	if (err)
+	    return err;
+	if (iod->argv)
+	    gensio_argv_free(o, iod->argv);
+	iod->argv = nargv;
+	return 0;
+
+    case GENSIO_IOD_CONTROL_ENV:
+	err = gensio_argv_copy(o, (const char **) val, NULL, &nargv);
+	if (err)
+	    return err;
+	if (iod->env)
+	    gensio_argv_free(o, iod->env);
+	iod->env = nargv;
+	return 0;
+
+    case GENSIO_IOD_CONTROL_START:
+	return gensio_unix_pty_start(o, iod->fd, iod->argv,
+				     iod->env, iod->start_dir, &iod->pid);
+
+    case GENSIO_IOD_CONTROL_STOP:
+	if (iod->fd != -1) {
+	    {
+		std::lock_guard<std::mutex> l(iod->lock);
+
+		asio_iod_release_fd(iod);
+	    }
+	    close(iod->fd);
+	    iod->fd = -1;
+	}
+	return 0;
+
+    case GENSIO_IOD_CONTROL_WIN_SIZE: {
+	struct winsize win;
+	struct gensio_winsize *gwin = (struct gensio_winsize *) val;
+
+	win.ws_row = gwin->ws_row;
+	win.ws_col = gwin->ws_col;
+	win.ws_xpixel = gwin->ws_xpixel;
+	win.ws_ypixel = gwin->ws_ypixel;
+	if (ioctl(iod->fd, TIOCSWINSZ, &win) == -1)
+	    err = gensio_os_err_to_err(o, errno);
+	return err;
+    }
+
+    case GENSIO_IOD_CONTROL_START_DIR: {
+	char *dir = (char *) val;
+
+	if (dir) {
+	    dir = gensio_strdup(o, dir);
+	    if (!dir)
+		return GE_NOMEM;
+	}
+
+	if (iod->start_dir)
+	    o->free(o, iod->start_dir);
+	iod->start_dir = dir;
+	return 0;
+    }
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+gensio_asio_iod_control(struct gensio_iod *iiod, int op, bool get,
+			intptr_t val)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    if (iod->type == GENSIO_IOD_SOCKET) {
+	if (op != GENSIO_IOD_CONTROL_SOCKINFO)
+	    return GE_NOTSUP;
+
+	if (get)
+	    *((void **) val) = iod->sockinfo;
+	else
+	    iod->sockinfo = (void *) val;
+
+	return 0;
+    }
+
+    if (iod->type == GENSIO_IOD_PTY)
+	return gensio_asio_pty_control(iod, op, get, val);
+
+    if (iod->type != GENSIO_IOD_DEV)
+	return GE_NOTSUP;
+
+    return gensio_unix_termios_control(iiod->f, op, get, val, &iod->termios,
+				       iod->fd);
+}
+
+static int
+gensio_asio_set_non_blocking(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    if (iod->type == GENSIO_IOD_FILE)
+	return 0;
+
+    return gensio_unix_do_nonblock(iiod->f, iod->fd, &iod->mode);
+}
+
+static int
+gensio_asio_close(struct gensio_iod **iodp)
+{
+    struct gensio_iod *iiod = *iodp;
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    struct gensio_os_funcs *o = iiod->f;
+    int err = 0;
+
+    assert(iodp);
+    assert(!iod->handlers_set);
+
+    if (iod->type != GENSIO_IOD_FILE) {
+	gensio_unix_cleanup_termios(o, &iod->termios, iod->fd);
+	gensio_unix_do_cleanup_nonblock(o, iod->fd, &iod->mode);
+    }
+
+    // Asio has to be done with the fd before it is closed.
+    {
+	std::lock_guard<std::mutex> l(iod->lock);
+
+	asio_iod_release_fd(iod);
+    }
+
+    if (iod->type == GENSIO_IOD_SOCKET) {
+	err = o->close_socket(iiod, false, false);
+    } else if (!iod->is_stdio) {
+	if (iod->fd != -1) {
+	    err = close(iod->fd);
+	    if (err == -1)
+		err = gensio_os_err_to_err(o, errno);
+#ifdef ENABLE_INTERNAL_TRACE
+	/* Close should never fail, but don't crash in production builds. */
+	    assert(err == 0);
+#endif
+	}
+    }
+    o->release_iod(iiod);
+    *iodp = NULL;
+
+    return err;
+}
+
+#define ERRHANDLE()			\
+do {								\
+    int err = 0;						\
+    if (rv < 0) {						\
+	if (errno == EINTR)					\
+	    goto retry;						\
+	if (errno == EWOULDBLOCK || errno == EAGAIN)		\
+	    rv = 0; /* Handle like a zero-byte write. */	\
+	else {							\
+	    err = errno;					\
+	    assert(err);					\
+	}							\
+    } else if (rv == 0) {					\
+	err = EPIPE;						\
+    }								\
+    if (!err && rcount)						\
+	*rcount = rv;						\
+    rv = gensio_os_err_to_err(o, err);				\
+} while(0)
+
+static int
+gensio_asio_write(struct gensio_iod *iiod, const struct gensio_sg *sg,
+		  gensiods sglen, gensiods *rcount)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    struct gensio_os_funcs *o = iiod->f;
+    ssize_t rv;
+
+    if (sglen == 0) {
+	if (rcount)
+	    *rcount = 0;
+	return 0;
+    }
+ retry:
+    rv = writev(iod->fd, (struct iovec *) sg, sglen);
+    ERRHANDLE();
+    return rv;
+}
+
+static int
+gensio_asio_read(struct gensio_iod *iiod, void *buf, gensiods buflen,
+		 gensiods *rcount)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+    struct gensio_os_funcs *o = iiod->f;
+    ssize_t rv;
+
+    if (buflen == 0) {
+	if (rcount)
+	    *rcount = 0;
+	return 0;
+    }
+ retry:
+    rv = read(iod->fd, buf, buflen);
+    ERRHANDLE();
+    return rv;
+}
+
+static bool
+gensio_asio_is_regfile(struct gensio_os_funcs *o, intptr_t fd)
+{
+    int err;
+    struct stat statb;
+
+    err = fstat(fd, &statb);
+    if (err == -1)
+	return false;
+
+    return (statb.st_mode & S_IFMT) == S_IFREG;
+}
+
+static int
+gensio_asio_bufcount(struct gensio_iod *iiod, int whichbuf, gensiods *count)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    return gensio_unix_get_bufcount(iiod->f, iod->fd, whichbuf, count);
+}
+
+static void
+gensio_asio_flush(struct gensio_iod *iiod, int whichbuf)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    gensio_unix_do_flush(iiod->f, iod->fd, whichbuf);
+}
+
+static int
+gensio_asio_makeraw(struct gensio_iod *iiod)
+{
+    struct gensio_iod_asio *iod = i_to_asio(iiod);
+
+    if (iod->orig_fd == 1 || iod->orig_fd == 2 || iod->type == GENSIO_IOD_FILE)
+	/* Only set this for stdin or other files. */
+	return 0;
+
+    return gensio_unix_setup_termios(iiod->f, iod->fd, &iod->termios);
+}
+
+static int
+gensio_asio_open_dev(struct gensio_os_funcs *o, const char *iname,
+		     int options, struct gensio_iod **riod)
+{
+    int flags, fd, err;
+
+    flags = O_NONBLOCK | O_NOCTTY;
+    if (options & (GENSIO_OPEN_OPTION_READABLE | GENSIO_OPEN_OPTION_WRITEABLE))
+	flags |= O_RDWR;
+    else if (options & GENSIO_OPEN_OPTION_READABLE)
+	flags |= O_RDONLY;
+    else if (options & GENSIO_OPEN_OPTION_WRITEABLE)
+	flags |= O_WRONLY;
+
+    fd = open(iname, flags);
+    if (fd == -1)
+	return gensio_os_err_to_err(o, errno);
+    err = o->add_iod(o, GENSIO_IOD_DEV, fd, riod);
+    if (err)
+	close(fd);
+    return err;
+}
+
+static void
+generic_close(intptr_t fd)
+{
+    close(fd);
+}
+
+static int
+gensio_asio_exec_subprog(struct gensio_os_funcs *o,
+			 const char *argv[], const char **env,
+			 const char *start_dir,
+			 unsigned int flags,
+			 intptr_t *rpid,
+			 struct gensio_iod **rstdin,
+			 struct gensio_iod **rstdout,
+			 struct gensio_iod **rstderr)
+{
+    int err;
+    struct gensio_iod *stdiniod = NULL, *stdoutiod = NULL, *stderriod = NULL;
+    intptr_t infd = -1, outfd = -1, errfd = -1;
+    intptr_t pid = -1;
+
+    int uinfd = -1, uoutfd = -1, uerrfd = -1;
+    int upid = -1;
+
+    err = gensio_unix_do_exec(o, argv, env, start_dir, flags, &upid, &uinfd,
+			      &uoutfd, rstderr ? &uerrfd : NULL);
+    if (err)
+	return err;
+    infd = uinfd;
+    outfd = uoutfd;
+    errfd = uerrfd;
+    pid = upid;
+
+    err = o->add_iod(o, GENSIO_IOD_PIPE, infd, &stdiniod);
+    if (err)
+	goto out_err;
+    infd = -1;
+    err = o->add_iod(o, GENSIO_IOD_PIPE, outfd, &stdoutiod);
+    if (err)
+	goto out_err;
+    outfd = -1;
+    err = o->set_non_blocking(stdiniod);
+    if (err)
+	goto out_err;
+    err = o->set_non_blocking(stdoutiod);
+    if (err)
+	goto out_err;
+
+    if (rstderr) {
+	err = o->add_iod(o, GENSIO_IOD_PIPE, errfd, &stderriod);
+	if (err)
+	    goto out_err;
+	errfd = -1;
+	err = o->set_non_blocking(stderriod);
+	if (err)
+	    goto out_err;
+    }
+
+    *rpid = pid;
+    *rstdin = stdiniod;
+    *rstdout = stdoutiod;
+    if (rstderr)
+	*rstderr = stderriod;
+    return 0;
+
+ out_err:
+    if (stderriod)
+	o->close(&stderriod);
+    else if (errfd != -1)
+	generic_close(errfd);
+    if (stdiniod)
+	o->close(&stdiniod);
+    else if (infd != -1)
+	generic_close(infd);
+    if (stdoutiod)
+	o->close(&stdoutiod);
+    else if (outfd != -1)
+	generic_close(outfd);
+    return err;
+}
+
+static int
+gensio_asio_kill_subprog(struct gensio_os_funcs *o, intptr_t pid, bool force)
+{
+    int rv;
+
+    rv = kill(pid, force ? SIGKILL : SIGTERM);
+    if (rv < 0)
+	return gensio_os_err_to_err(o, errno);
+    return 0;
+}
+
+static int
+gensio_asio_wait_subprog(struct gensio_os_funcs *o, intptr_t pid,
+			 int *retcode)
+{
+    pid_t rv;
+
+    rv = waitpid(pid, retcode, WNOHANG);
+    if (rv < 0)
+	return gensio_os_err_to_err(o, errno);
+
+    if (rv == 0)
+	return GE_INPROGRESS;
+
+    return 0;
+}
+
+static int
+gensio_asio_service(struct gensio_os_funcs *o, gensio_time *timeout)
+{
+    asio::io_context &ctx = asio_ctx(o);
+    auto work = asio::make_work_guard(ctx);
+    std::size_t count;
+
+    // A handler can't run the io_context it is called from.
+    if (ctx.get_executor().running_in_this_thread())
+	return GE_NOTSUP;
+
+    if (ctx.stopped())
+	ctx.restart();
+    if (timeout) {
+	auto start = std::chrono::steady_clock::now();
+	auto len = std::chrono::seconds(timeout->secs)
+	    + std::chrono::nanoseconds(timeout->nsecs);
+	std::chrono::nanoseconds left;
+
+	count = ctx.run_one_for(len);
+	left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			len - (std::chrono::steady_clock::now() - start));
+	if (left.count() > 0) {
+	    timeout->secs = left.count() / 1000000000;
+	    timeout->nsecs = left.count() % 1000000000;
+	} else {
+	    timeout->secs = 0;
+	    timeout->nsecs = 0;
+	}
+    } else {
+	count = ctx.run_one();
+    }
+
+    return count ? 0 : GE_TIMEDOUT;
+}
+
+static struct gensio_os_funcs *
+gensio_asio_get_funcs(struct gensio_os_funcs *f)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(f->user_data);
+
+    d->refcount++;
+    return f;
+}
+
+static void
+gensio_asio_free_funcs(struct gensio_os_funcs *f)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(f->user_data);
+
+    assert(d->refcount > 0);
+    if (d->refcount > 1) {
+	d->refcount--;
+	return;
+    }
+    gensio_memtrack_cleanup(d->mtrack);
+    free(d);
+    free(f);
+}
+
+static std::mutex once_lock;
+
+static void
+gensio_asio_call_once(struct gensio_os_funcs *f, struct gensio_once *once,
+		      void (*func)(void *cb_data), void *cb_data)
+{
+    if (once->called)
+	return;
+    std::lock_guard<std::mutex> l(once_lock);
+    if (!once->called) {
+	once->called = true;
+	func(cb_data);
+    }
+}
+
+static void
+gensio_asio_get_monotonic_time(struct gensio_os_funcs *f, gensio_time *time)
+{
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	asio::steady_timer::clock_type::now().time_since_epoch()).count();
+
+    time->secs = now / 1000000000;
+    time->nsecs = now % 1000000000;
+}
+
+static int
+gensio_asio_handle_fork(struct gensio_os_funcs *f)
+{
+    try {
+	asio_ctx(f).notify_fork(asio::io_context::fork_child);
+    } catch (...) {
+	return GE_OSERR;
+    }
+    return 0;
+}
+
+static int
+gensio_asio_get_random(struct gensio_os_funcs *o, void *data, unsigned int len)
+{
+    unsigned char *p = static_cast<unsigned char *>(data);
+    int fd;
+    int rv;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1)
+	return gensio_os_err_to_err(o, errno);
+
+    while (len > 0) {
+	rv = read(fd, p, len);
+	if (rv < 0) {
+	    rv = errno;
+	    goto out;
+	}
+	len -= rv;
+	p += rv;
+    }
+
+    rv = 0;
+
+ out:
+    close(fd);
+    return gensio_os_err_to_err(o, rv);
+}
+
+static int
+gensio_asio_control(struct gensio_os_funcs *o, int func, void *data,
+		    gensiods *datalen)
+{
+    struct gensio_data *d = static_cast<struct gensio_data *>(o->user_data);
+
+    switch (func) {
+    case GENSIO_CONTROL_SET_PROC_DATA:
+	d->pdata = static_cast<struct gensio_os_proc_data *>(data);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_asio_funcs_alloc(asio::io_context &ctx, struct gensio_os_funcs **ro)
+{
+    struct gensio_data *d;
+    struct gensio_os_funcs *o;
+    int err;
+
+    o = static_cast<struct gensio_os_funcs *>(malloc(sizeof(*o)));
+    if (!o)
+	return GE_NOMEM;
+    memset(o, 0, sizeof(*o));
+
+    d = static_cast<struct gensio_data *>(malloc(sizeof(*d)));
+    if (!d) {
+	free(o);
+	return GE_NOMEM;
+    }
+    memset(d, 0, sizeof(*d));
+    d->refcount = 1;
+    d->ctx = &ctx;
+
+    o->user_data = d;
+    d->mtrack = gensio_memtrack_alloc();
+
+    o->zalloc = gensio_asio_zalloc;
+    o->free = gensio_asio_free;
+    o->alloc_lock = gensio_asio_alloc_lock;
+    o->free_lock = gensio_asio_free_lock;
+    o->lock = gensio_asio_lock;
+    o->unlock = gensio_asio_unlock;
+    o->set_fd_handlers = gensio_asio_set_fd_handlers;
+    o->clear_fd_handlers = gensio_asio_clear_fd_handlers;
+    o->clear_fd_handlers_norpt = gensio_asio_clear_fd_handlers_norpt;
+    o->set_read_handler = gensio_asio_set_read_handler;
+    o->set_write_handler = gensio_asio_set_write_handler;
+    o->set_except_handler = gensio_asio_set_except_handler;
+    o->alloc_timer = gensio_asio_alloc_timer;
+    o->free_timer = gensio_asio_free_timer;
+    o->start_timer = gensio_asio_start_timer;
+    o->start_timer_abs = gensio_asio_start_timer_abs;
+    o->stop_timer = gensio_asio_stop_timer;
+    o->stop_timer_with_done = gensio_asio_stop_timer_with_done;
+    o->alloc_runner = gensio_asio_alloc_runner;
+    o->free_runner = gensio_asio_free_runner;
+    o->run = gensio_asio_run;
+    o->alloc_waiter = gensio_asio_alloc_waiter;
+    o->free_waiter = gensio_asio_free_waiter;
+    o->wait = gensio_asio_wait;
+    o->wait_intr = gensio_asio_wait_intr;
+    o->wait_intr_sigmask = gensio_asio_wait_intr_sigmask;
+    o->wake = gensio_asio_wake;
+    o->service = gensio_asio_service;
+    o->get_funcs = gensio_asio_get_funcs;
+    o->free_funcs = gensio_asio_free_funcs;
+    o->call_once = gensio_asio_call_once;
+    o->get_monotonic_time = gensio_asio_get_monotonic_time;
+    o->handle_fork = gensio_asio_handle_fork;
+    o->add_iod = gensio_asio_add_iod;
+    o->release_iod = gensio_asio_release_iod;
+    o->iod_get_type = gensio_asio_iod_get_type;
+    o->iod_get_fd = gensio_asio_iod_get_fd;
+
+    o->set_non_blocking = gensio_asio_set_non_blocking;
+    o->close = gensio_asio_close;
+    o->graceful_close = gensio_asio_close;
+    o->write = gensio_asio_write;
+    o->read = gensio_asio_read;
+    o->is_regfile = gensio_asio_is_regfile;
+    o->bufcount = gensio_asio_bufcount;
+    o->flush = gensio_asio_flush;
+    o->makeraw = gensio_asio_makeraw;
+    o->open_dev = gensio_asio_open_dev;
+    o->exec_subprog = gensio_asio_exec_subprog;
+    o->kill_subprog = gensio_asio_kill_subprog;
+    o->wait_subprog = gensio_asio_wait_subprog;
+    o->get_random = gensio_asio_get_random;
+    o->iod_control = gensio_asio_iod_control;
+    o->control = gensio_asio_control;
+
+    gensio_addr_addrinfo_set_os_funcs(o);
+    err = gensio_stdsock_set_os_funcs(o);
+    if (err) {
+	free(o);
+	free(d);
+	return err;
+    }
+
+    *ro = o;
+    return 0;
+}
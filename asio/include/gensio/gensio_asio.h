@@ -0,0 +1,23 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIO_ASIO_H
+#define GENSIO_ASIO_H
+
+#include <asio.hpp>
+#include <gensio/gensio_asio_dllvisibility.h>
+#include <gensio/gensio_types.h>
+
+/*
+ * Allocate an os funcs that runs on the given Asio io_context.  All
+ * gensio callbacks are run by the threads running the io_context.
+ * The io_context must outlive the os funcs.
+ */
+extern "C" GENSIOASIO_DLL_PUBLIC
+int gensio_asio_funcs_alloc(asio::io_context &ctx, struct gensio_os_funcs **o);
+
+#endif /* GENSIO_ASIO_H */
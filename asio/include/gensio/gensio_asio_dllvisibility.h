@@ -0,0 +1,39 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIOASIO_DLLVISIBILITY
+#define GENSIOASIO_DLLVISIBILITY
+
+#if defined GENSIO_LINK_STATIC
+  #define GENSIOASIO_DLL_PUBLIC
+  #define GENSIOASIO_DLL_LOCAL
+#elif defined _WIN32 || defined __CYGWIN__
+  #ifdef BUILDING_GENSIOASIO_DLL
+    #ifdef __GNUC__
+      #define GENSIOASIO_DLL_PUBLIC __attribute__ ((dllexport))
+    #else
+      #define GENSIOASIO_DLL_PUBLIC __declspec(dllexport) // Note: actually gcc seems to also supports this syntax.
+    #endif
+  #else
+    #ifdef __GNUC__
+      #define GENSIOASIO_DLL_PUBLIC __attribute__ ((dllimport))
+    #else
+      #define GENSIOASIO_DLL_PUBLIC __declspec(dllimport) // Note: actually gcc seems to also supports this syntax.
+    #endif
+  #endif
+  #define GENSIOASIO_DLL_LOCAL
+#else
+  #if __GNUC__ >= 4
+    #define GENSIOASIO_DLL_PUBLIC __attribute__ ((visibility ("default")))
+    #define GENSIOASIO_DLL_LOCAL  __attribute__ ((visibility ("hidden")))
+  #else
+    #define GENSIOASIO_DLL_PUBLIC
+    #define GENSIOASIO_DLL_LOCAL
+  #endif
+#endif
+
+#endif /* GENSIOASIO_DLLVISIBILITY */
@@ -5,6 +5,7 @@
 //  SPDX-License-Identifier: LGPL-2.1-only
 
 #include <map>
+#include <mutex>
 #include <gensio/gensio>
 #include <string.h>
 #include <stdarg.h>
@@ -18,7 +19,116 @@ namespace gensios {
 	return GE_NOTSUP;
     }
 
-    struct gensio_cpp_data {
+    // A cache of freed wrapper objects.  Every accepted connection
+    // and new channel allocates a Gensio for each gensio in its
+    // stack, plus the data below, and frees them all when it goes
+    // away.  Keep some of each size around so that churn reuses
+    // memory instead of going to the heap every time.
+    class Wrapper_Pool {
+    public:
+	void *alloc(size_t size)
+	{
+	    {
+		std::lock_guard<std::mutex> l(lock);
+		struct bucket *b = find(size, false);
+
+		if (b && b->free) {
+		    struct entry *e = b->free;
+
+		    b->free = e->next;
+		    b->count--;
+		    return e;
+		}
+	    }
+	    return ::operator new(size);
+	}
+
+	void release(void *p, size_t size)
+	{
+	    if (size >= sizeof(struct entry)) {
+		std::lock_guard<std::mutex> l(lock);
+		struct bucket *b = find(size, true);
+
+		if (b && b->count < max_cached) {
+		    struct entry *e = static_cast<struct entry *>(p);
+
+		    e->next = b->free;
+		    b->free = e;
+		    b->count++;
+		    return;
+		}
+	    }
+	    ::operator delete(p);
+	}
+
+    private:
+	struct entry {
+	    struct entry *next;
+	};
+
+	struct bucket {
+	    size_t size = 0;
+	    struct entry *free = NULL;
+	    unsigned int count = 0;
+	};
+
+	// Only a few sizes are ever used, one per wrapper class.
+	static const unsigned int nr_buckets = 8;
+	static const unsigned int max_cached = 64;
+
+	std::mutex lock;
+	struct bucket buckets[nr_buckets];
+
+	struct bucket *find(size_t size, bool add)
+	{
+	    unsigned int i;
+
+	    for (i = 0; i < nr_buckets; i++) {
+		if (buckets[i].size == size)
+		    return &buckets[i];
+		if (buckets[i].size == 0) {
+		    if (!add)
+			return NULL;
+		    buckets[i].size = size;
+		    return &buckets[i];
+		}
+	    }
+	    return NULL;
+	}
+    };
+
+    // Never destroyed, wrappers may be freed during static destruction.
+    static Wrapper_Pool &wrapper_pool()
+    {
+	static Wrapper_Pool *pool = new Wrapper_Pool;
+
+	return *pool;
+    }
+
+    // Internal per-gensio objects come from the pool, too.
+    struct Pool_Allocated {
+	static void *operator new(size_t size)
+	{
+	    return wrapper_pool().alloc(size);
+	}
+
+	static void operator delete(void *p, size_t size)
+	{
+	    wrapper_pool().release(p, size);
+	}
+    };
+
+    void *Gensio::operator new(size_t size)
+    {
+	return wrapper_pool().alloc(size);
+    }
+
+    void Gensio::operator delete(void *p, size_t size)
+    {
+	wrapper_pool().release(p, size);
+    }
+
+    struct gensio_cpp_data : public Pool_Allocated {
 	struct gensio_frdata frdata;
 	Gensio *g;
     };
@@ -27,7 +137,7 @@ namespace gensios {
 			 class Event *cb);
 
     class GENSIOCPP_DLL_PUBLIC Main_Raw_Event_Handler:
-	public Raw_Event_Handler {
+	public Raw_Event_Handler, public Pool_Allocated {
     public:
 	Main_Raw_Event_Handler() { }
 	int handle(Gensio *g, struct gensio *io,
@@ -490,7 +600,7 @@ namespace gensios {
 	return count;
     }
 
-    gensiods Gensio::write(const std::vector<unsigned char> data,
+    gensiods Gensio::write(const std::vector<unsigned char> &data,
 			   const char *const *auxdata)
     {
 	return write(data.data(), (gensiods) data.size(), auxdata);
@@ -528,7 +638,7 @@ namespace gensios {
 	return 0;
     }
 
-    int Gensio::write_s(gensiods *count, std::vector<unsigned char> data,
+    int Gensio::write_s(gensiods *count, const std::vector<unsigned char> &data,
 			gensio_time *timeout, bool intr)
     {
 	return write_s(count, data.data(), (gensiods) data.size(), timeout, intr);
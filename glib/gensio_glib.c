@@ -30,6 +30,13 @@
  * If performance is important, it might be better to put glib on top
  * of gensio os funcs with g_main_context_set_poll_func().  I leave
  * that as an exercise to the reader.
+ *
+ * Or use gensio_glib_funcs_alloc_workers().  That creates a pool of
+ * worker threads, each running its own GMainContext, and the I/O
+ * watches for each iod are put on one of those contexts round-robin.
+ * So I/O for different iods is handled concurrently in the workers
+ * without going through the default context or the handoff above.
+ * Timers, runners and waiters still use the default context.
  */
 
 #include "config.h"
@@ -63,6 +70,14 @@
 #include <sys/ioctl.h>
 #endif
 
+/* A worker thread running its own main context for iods. */
+struct gensio_glib_worker
+{
+    GMainContext *ctx;
+    GMainLoop *loop;
+    GThread *thread;
+};
+
 struct gensio_data
 {
     GMutex lock;
@@ -77,6 +92,11 @@ struct gensio_data
     struct gensio_memtrack *mtrack;
 
     struct gensio_os_proc_data *pdata;
+
+    /* See gensio_glib_funcs_alloc_workers(), nr_workers is 0 if unused. */
+    unsigned int nr_workers;
+    unsigned int next_worker;
+    struct gensio_glib_worker *workers;
 };
 
 static void *
@@ -150,6 +170,9 @@ struct gensio_iod_glib {
 
     GIOChannel *chan;
 
+    /* The worker context the watches go on, NULL for the default. */
+    GMainContext *ctx;
+
     guint read_id;
     guint write_id;
     guint except_id;
@@ -277,6 +300,38 @@ glib_cleared_handler(gpointer data)
     g_idle_add(glib_real_cleared_handler, data);
 }
 
+static guint
+glib_add_watch(struct gensio_iod_glib *iod, GIOCondition cond, GIOFunc func)
+{
+    GSource *s;
+    guint id;
+
+    if (!iod->ctx)
+	return g_io_add_watch_full(iod->chan, 0, cond, func, iod,
+				   glib_cleared_handler);
+
+    s = g_io_create_watch(iod->chan, cond);
+    g_source_set_callback(s, (GSourceFunc) func, iod, glib_cleared_handler);
+    id = g_source_attach(s, iod->ctx);
+    g_source_unref(s);
+    return id;
+}
+
+/* g_source_remove() only works on the default context. */
+static void
+glib_remove_watch(struct gensio_iod_glib *iod, guint id)
+{
+    GSource *s;
+
+    if (!iod->ctx) {
+	g_source_remove(id);
+	return;
+    }
+    s = g_main_context_find_source_by_id(iod->ctx, id);
+    if (s)
+	g_source_destroy(s);
+}
+
 static int
 gensio_glib_set_fd_handlers(struct gensio_iod *iiod,
 			    void *cb_data,
@@ -324,15 +379,15 @@ gensio_glib_clear_fd_handlers(struct gensio_iod *iiod)
 	goto out_unlock;
     }
     if (iod->read_id) {
-	g_source_remove(iod->read_id);
+	glib_remove_watch(iod, iod->read_id);
 	iod->read_id = 0;
     }
     if (iod->write_id) {
-	g_source_remove(iod->write_id);
+	glib_remove_watch(iod, iod->write_id);
 	iod->write_id = 0;
     }
     if (iod->except_id) {
-	g_source_remove(iod->except_id);
+	glib_remove_watch(iod, iod->except_id);
 	iod->except_id = 0;
     }
     iod->in_clear = true;
@@ -405,12 +460,10 @@ gensio_glib_set_read_handler(struct gensio_iod *iiod, bool enable)
 	    iod->in_handler = true;
 	}
     } else if (iod->read_id && !enable) {
-	g_source_remove(iod->read_id);
+	glib_remove_watch(iod, iod->read_id);
 	iod->read_id = 0;
     } else if (!iod->read_id && enable) {
-	iod->read_id = g_io_add_watch_full(iod->chan, 0, G_IO_IN,
-					   glib_read_handler, iod,
-					   glib_cleared_handler);
+	iod->read_id = glib_add_watch(iod, G_IO_IN, glib_read_handler);
 	assert(iod->read_id);
 	iod->clear_count++;
     }
@@ -434,12 +487,10 @@ gensio_glib_set_write_handler(struct gensio_iod *iiod, bool enable)
 	    iod->in_handler = true;
 	}
     } else if (iod->write_id && !enable) {
-	g_source_remove(iod->write_id);
+	glib_remove_watch(iod, iod->write_id);
 	iod->write_id = 0;
     } else if (!iod->write_id && enable) {
-	iod->write_id = g_io_add_watch_full(iod->chan, 0, G_IO_OUT,
-					    glib_write_handler, iod,
-					    glib_cleared_handler);
+	iod->write_id = glib_add_watch(iod, G_IO_OUT, glib_write_handler);
 	assert(iod->write_id);
 	iod->clear_count++;
     }
@@ -457,13 +508,11 @@ gensio_glib_set_except_handler(struct gensio_iod *iiod, bool enable)
 
     g_mutex_lock(&iod->lock);
     if (iod->except_id && !enable) {
-	g_source_remove(iod->except_id);
+	glib_remove_watch(iod, iod->except_id);
 	iod->except_id = 0;
     } else if (!iod->except_id && enable) {
-	iod->except_id = g_io_add_watch_full(iod->chan, 0,
-					     G_IO_PRI | G_IO_ERR | G_IO_HUP,
-					     glib_except_handler, iod,
-					     glib_cleared_handler);
+	iod->except_id = glib_add_watch(iod, G_IO_PRI | G_IO_ERR | G_IO_HUP,
+					glib_except_handler);
 	assert(iod->except_id);
 	iod->clear_count++;
     }
@@ -1097,6 +1146,7 @@ static int
 gensio_glib_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
 		    intptr_t ofd, struct gensio_iod **riod)
 {
+    struct gensio_data *d = o->user_data;
     struct gensio_iod_glib *iod;
     bool closefd = false;
     int err = GE_NOMEM;
@@ -1187,6 +1237,13 @@ gensio_glib_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
     g_io_channel_set_encoding(iod->chan, NULL, NULL);
     g_io_channel_set_buffered(iod->chan, FALSE);
 
+    if (d->nr_workers) {
+	g_mutex_lock(&d->lock);
+	iod->ctx = d->workers[d->next_worker].ctx;
+	d->next_worker = (d->next_worker + 1) % d->nr_workers;
+	g_mutex_unlock(&d->lock);
+    }
+
  out:
     g_mutex_init(&iod->lock);
     *riod = &iod->r;
@@ -1904,6 +1961,71 @@ gensio_glib_get_funcs(struct gensio_os_funcs *f)
     return f;
 }
 
+static gpointer
+gensio_glib_worker_thread(gpointer data)
+{
+    struct gensio_glib_worker *w = data;
+    /* w may be freed before we return if the last free is from here. */
+    GMainContext *ctx = w->ctx;
+    GMainLoop *loop = w->loop;
+
+    g_main_context_push_thread_default(ctx);
+    g_main_loop_run(loop);
+    g_main_context_pop_thread_default(ctx);
+    return NULL;
+}
+
+static void
+gensio_glib_stop_workers(struct gensio_data *d)
+{
+    struct gensio_glib_worker *w;
+    unsigned int i;
+
+    for (i = 0; i < d->nr_workers; i++) {
+	w = &d->workers[i];
+	if (w->thread) {
+	    g_main_loop_quit(w->loop);
+	    /* Can't join ourself if the last free is from a worker. */
+	    if (w->thread == g_thread_self())
+		g_thread_unref(w->thread);
+	    else
+		g_thread_join(w->thread);
+	}
+	if (w->loop)
+	    g_main_loop_unref(w->loop);
+	if (w->ctx)
+	    g_main_context_unref(w->ctx);
+    }
+    free(d->workers);
+    d->workers = NULL;
+    d->nr_workers = 0;
+}
+
+static int
+gensio_glib_start_workers(struct gensio_data *d, unsigned int nr_workers)
+{
+    struct gensio_glib_worker *w;
+    unsigned int i;
+
+    d->workers = calloc(nr_workers, sizeof(*d->workers));
+    if (!d->workers)
+	return GE_NOMEM;
+    d->nr_workers = nr_workers;
+
+    for (i = 0; i < nr_workers; i++) {
+	w = &d->workers[i];
+	w->ctx = g_main_context_new();
+	w->loop = g_main_loop_new(w->ctx, FALSE);
+	w->thread = g_thread_try_new("gensio-glib", gensio_glib_worker_thread,
+				     w, NULL);
+	if (!w->thread) {
+	    gensio_glib_stop_workers(d);
+	    return GE_NOMEM;
+	}
+    }
+    return 0;
+}
+
 static void
 gensio_glib_free_funcs(struct gensio_os_funcs *f)
 {
@@ -1918,6 +2040,7 @@ gensio_glib_free_funcs(struct gensio_os_funcs *f)
     }
     g_mutex_unlock(&d->lock);
 
+    gensio_glib_stop_workers(d);
     gensio_stdsock_cleanup(f);
     gensio_memtrack_cleanup(d->mtrack);
     g_cond_clear(&d->cond);
@@ -1999,6 +2122,13 @@ gensio_glib_control(struct gensio_os_funcs *o, int func, void *data,
 
 int
 gensio_glib_funcs_alloc(struct gensio_os_funcs **ro)
+{
+    return gensio_glib_funcs_alloc_workers(ro, 0);
+}
+
+int
+gensio_glib_funcs_alloc_workers(struct gensio_os_funcs **ro,
+				unsigned int nr_workers)
 {
     struct gensio_data *d;
     struct gensio_os_funcs *o;
@@ -2086,6 +2216,16 @@ gensio_glib_funcs_alloc(struct gensio_os_funcs **ro)
 	return err;
     }
 
+    if (nr_workers) {
+	err = gensio_glib_start_workers(d, nr_workers);
+	if (err) {
+	    gensio_stdsock_cleanup(o);
+	    free(o);
+	    free(d);
+	    return err;
+	}
+    }
+
     *ro = o;
     return 0;
 }
@@ -21,6 +21,15 @@ extern "C" {
 GENSIOGLIB_DLL_PUBLIC
 int gensio_glib_funcs_alloc(struct gensio_os_funcs **o);
 
+/*
+ * Like the above, but start nr_workers threads, each running its own
+ * GMainContext, and spread the I/O for iods across them so it can be
+ * handled concurrently.  nr_workers of zero is the same as the above.
+ */
+GENSIOGLIB_DLL_PUBLIC
+int gensio_glib_funcs_alloc_workers(struct gensio_os_funcs **o,
+				    unsigned int nr_workers);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,12 +11,13 @@
 #include <gensio/gensio_glib.h>
 #include <gensio/gensio_swig.h>
 
-struct gensio_os_funcs *alloc_glib_os_funcs(swig_cb *log_handler)
+struct gensio_os_funcs *alloc_glib_os_funcs_workers(swig_cb *log_handler,
+						    unsigned int nr_workers)
 {
     struct gensio_os_funcs *o;
     int err;
 
-    err = gensio_glib_funcs_alloc(&o);
+    err = gensio_glib_funcs_alloc_workers(&o, nr_workers);
     if (err) {
 	fprintf(stderr, "Unable to allocate gensio os funcs: %s, giving up\n",
 		gensio_err_to_str(err));
@@ -33,6 +34,11 @@ struct gensio_os_funcs *alloc_glib_os_funcs(swig_cb *log_handler)
     return o;
 }
 
+struct gensio_os_funcs *alloc_glib_os_funcs(swig_cb *log_handler)
+{
+    return alloc_glib_os_funcs_workers(log_handler, 0);
+}
+
 %}
 
 %nodefaultctor gensio_os_funcs;
@@ -47,3 +53,6 @@ struct gensio_os_funcs { };
 
 %newobject alloc_glib_os_funcs;
 struct gensio_os_funcs *alloc_glib_os_funcs(swig_cb *log_handler);
+%newobject alloc_glib_os_funcs_workers;
+struct gensio_os_funcs *alloc_glib_os_funcs_workers(swig_cb *log_handler,
+						    unsigned int nr_workers);
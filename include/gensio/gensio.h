@@ -107,6 +107,24 @@ int str_to_gensio_child(struct gensio *child, const char *str,
 			gensio_event cb, void *user_data,
 			struct gensio **gensio);
 
+/*
+ * Parse a gensio string once into a template that can allocate many
+ * gensios without reparsing the string.
+ */
+struct gensio_template;
+
+GENSIO_DLL_PUBLIC
+int str_to_gensio_template(const char *str, struct gensio_os_funcs *o,
+			   struct gensio_template **tmpl);
+
+GENSIO_DLL_PUBLIC
+int gensio_template_alloc(struct gensio_template *tmpl,
+			  gensio_event cb, void *user_data,
+			  struct gensio **gensio);
+
+GENSIO_DLL_PUBLIC
+void gensio_template_free(struct gensio_template *tmpl);
+
 GENSIO_DLL_PUBLIC
 void gensio_set_callback(struct gensio *io, gensio_event cb, void *user_data);
 
@@ -161,6 +179,23 @@ int gensio_close(struct gensio *io, gensio_done close_done, void *close_data);
 GENSIO_DLL_PUBLIC
 int gensio_close_s(struct gensio *io);
 
+/*
+ * Close count gensios, calling close_done once when they are all
+ * closed.  If free_ios is true, each gensio is freed when its close
+ * completes (or right away if it was already closed), so the caller
+ * must not touch them after this.  The ios array is not used after
+ * this returns.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_close_multiple(struct gensio_os_funcs *o,
+			  struct gensio **ios, gensiods count, bool free_ios,
+			  gensio_multi_done close_done, void *close_data);
+
+GENSIO_DLL_PUBLIC
+int gensio_close_multiple_s(struct gensio_os_funcs *o,
+			    struct gensio **ios, gensiods count,
+			    bool free_ios);
+
 GENSIO_DLL_PUBLIC
 void gensio_disable(struct gensio *io);
 
@@ -225,6 +260,65 @@ GENSIO_DLL_PUBLIC
 int gensio_write_s_intr(struct gensio *io, gensiods *count,
 			const void *data, gensiods datalen,
 			gensio_time *timeout);
+GENSIO_DLL_PUBLIC
+int gensio_read_sv(struct gensio *io, gensiods *count,
+		   const struct gensio_sg *sg, gensiods sglen,
+		   gensiods *msglens, gensio_time *timeout);
+GENSIO_DLL_PUBLIC
+int gensio_write_sv(struct gensio *io, gensiods *count,
+		    const struct gensio_sg *sg, gensiods sglen,
+		    gensio_time *timeout);
+
+/*
+ * Zero-copy reads.  From inside a GENSIO_EVENT_READ callback, instead
+ * of consuming or copying the data, the user may take ownership of
+ * the buffer it is in.  buf and buflen must be exactly what was
+ * passed to the read callback.  All the data is then considered
+ * consumed, whatever is returned in *buflen, and the gensio reads
+ * into a new buffer.  The data stays valid until the last reference
+ * is released with gensio_rbuf_deref(), which may be done from any
+ * thread, even after the gensio is freed.
+ *
+ * Returns GE_NOTSUP if the data cannot be lent, generally because a
+ * filter copied it into its own buffer.  The data must then be
+ * handled as usual.
+ */
+struct gensio_rbuf;
+
+GENSIO_DLL_PUBLIC
+int gensio_take_read_buf(struct gensio *io,
+			 const unsigned char *buf, gensiods buflen,
+			 struct gensio_rbuf **rbuf);
+GENSIO_DLL_PUBLIC
+unsigned char *gensio_rbuf_data(struct gensio_rbuf *rbuf);
+GENSIO_DLL_PUBLIC
+gensiods gensio_rbuf_len(struct gensio_rbuf *rbuf);
+GENSIO_DLL_PUBLIC
+void gensio_rbuf_ref(struct gensio_rbuf *rbuf);
+GENSIO_DLL_PUBLIC
+void gensio_rbuf_deref(struct gensio_rbuf *rbuf);
+
+/*
+ * Write by reference.  The buffer is queued on the gensio without
+ * copying it and written from write ready events, done is called
+ * when all of it has been accepted by the gensio (or with an error
+ * if the gensio fails or is closed first), and the buffer must stay
+ * valid until then.  Buffers are written in order.  If the bytes
+ * queued and not yet accepted would go over the max set with
+ * gensio_write_ref_set_max(), GE_INUSE is returned (GE_TOOBIG if
+ * the buffer is bigger than the max), wait for a done and try again.
+ * Don't mix this with gensio_write() while buffers are queued.
+ */
+typedef void (*gensio_write_done)(struct gensio *io, int err,
+				  void *done_data);
+
+GENSIO_DLL_PUBLIC
+int gensio_write_ref(struct gensio *io, const void *buf, gensiods buflen,
+		     gensio_write_done done, void *done_data);
+GENSIO_DLL_PUBLIC
+void gensio_write_ref_set_max(struct gensio *io, gensiods max);
+GENSIO_DLL_PUBLIC
+gensiods gensio_write_ref_inflight(struct gensio *io);
 
 /*
  * Increment the gensio's refcount.  Internally there are situations
@@ -541,6 +635,41 @@ int gensio_check_keyfloat(const char *str, const char *key, float *rfl);
 GENSIO_DLL_PUBLIC
 gensiods gensio_num_alloced(void);
 
+/*
+ * Counters for each gensio type in the process.  alloced and freed
+ * are always kept.  reads and read_bytes count read events and the
+ * bytes the user took from them, writes and write_bytes count writes
+ * and the bytes accepted, these are only counted while metrics are
+ * enabled.  Each layer of a stack is counted under its own type.
+ */
+struct gensio_type_metrics {
+    const char *type_name;
+    gensiods alloced;
+    gensiods freed;
+    gensiods reads;
+    gensiods read_bytes;
+    gensiods writes;
+    gensiods write_bytes;
+    struct gensio_type_metrics *next; /* Internal use. */
+};
+
+/*
+ * Turn counting of the data metrics on or off.  Enables are counted,
+ * counting stops when every enable has been matched by a disable.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_metrics_enable(bool enable);
+
+/*
+ * Call cb with a copy of the counters for each type that has had a
+ * gensio allocated.  Stops and returns the value if cb returns
+ * non-zero.  This doesn't lock any gensio.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_metrics_iterate(int (*cb)(const struct gensio_type_metrics *m,
+				     void *cb_data),
+			   void *cb_data);
+
 /*
  * Generic functions for dumping buffer data to stdio
  */
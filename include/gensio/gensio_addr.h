@@ -39,6 +39,9 @@ struct gensio_addr_funcs {
 				 int family, int flags);
     void (*addr_getaddr)(const struct gensio_addr *addr,
 			 void *oaddr, gensiods *rlen);
+    /* Optional, may be NULL. */
+    unsigned int (*addr_hash)(const struct gensio_addr *addr,
+			      bool hash_ports);
 };
 
 /*
@@ -156,6 +159,17 @@ bool gensio_addr_equal(const struct gensio_addr *a1,
 		       const struct gensio_addr *a2,
 		       bool compare_ports, bool compare_all);
 
+/*
+ * Return a hash of the current address in addr.  Addresses that
+ * compare equal with gensio_addr_equal() (with compare_all false)
+ * return the same hash.  If hash_ports is false, the port is not
+ * included, use this with compare_ports false.  Address types that
+ * do not support hashing always return 0.
+ */
+GENSIOOSH_DLL_PUBLIC
+unsigned int gensio_addr_hash(const struct gensio_addr *addr,
+			      bool hash_ports);
+
 /*
  * Create a new address structure with the same addresses.
  */
@@ -262,6 +262,32 @@ bool gensio_filter_ll_write_queued(struct gensio_filter *filter);
 GENSIO_DLL_PUBLIC
 void gensio_filter_io_err(struct gensio_filter *filter, int err);
 
+/*
+ * Can the filter currently take data from the lower layer?  If not
+ * implemented (returns GE_NOTSUP), assumes true.  If false, the
+ * lower layer's read is disabled until the filter calls
+ * GENSIO_FILTER_CB_INPUT_READY or a timeout happens.  This can be used
+ * by a filter that paces its input.
+ *
+ * &val => data (pointer to a bool)
+ */
+#define GENSIO_FILTER_FUNC_LL_CAN_READ		19
+GENSIO_DLL_PUBLIC
+bool gensio_filter_ll_can_read(struct gensio_filter *filter);
+
+/*
+ * Allocate a channel from the filter, for filters that can split
+ * their data into separate channels.  Returns GE_NOTSUP if the filter
+ * can't, then the base gensio tries the ll.
+ *
+ * data => data
+ */
+#define GENSIO_FILTER_FUNC_ALLOC_CHANNEL	20
+struct gensio_func_alloc_channel_data;
+GENSIO_DLL_PUBLIC
+int gensio_filter_alloc_channel(struct gensio_filter *filter,
+				struct gensio_func_alloc_channel_data *data);
+
 typedef int (*gensio_filter_func)(struct gensio_filter *filter, int op,
 				  void *func, void *data,
 				  gensiods *count, void *buf,
@@ -392,6 +418,31 @@ int gensio_ll_control(struct gensio_ll *ll, bool get, int option, char *data,
 GENSIO_DLL_PUBLIC
 void gensio_ll_disable(struct gensio_ll *ll);
 
+/*
+ * Allocate a channel from the ll, for lls that can split their data
+ * into separate channels.  Returns GE_NOTSUP if the ll can't.  The
+ * base gensio passes gensio_alloc_channel() calls here.
+ *
+ * data => buf
+ */
+#define GENSIO_LL_FUNC_ALLOC_CHANNEL		13
+struct gensio_func_alloc_channel_data;
+GENSIO_DLL_PUBLIC
+int gensio_ll_alloc_channel(struct gensio_ll *ll,
+			    struct gensio_func_alloc_channel_data *data);
+
+/*
+ * For an ll that runs over a child gensio, take the child out of the
+ * ll and return it, so the ll can be freed without freeing the child.
+ * Returns GE_NOTSUP if the ll doesn't have a child.  If child is
+ * NULL, just check if the child could be detached.
+ *
+ * &child => buf
+ */
+#define GENSIO_LL_FUNC_DETACH_CHILD		14
+GENSIO_DLL_PUBLIC
+int gensio_ll_detach_child(struct gensio_ll *ll, struct gensio **child);
+
 typedef int (*gensio_ll_func)(struct gensio_ll *ll, int op,
 			      gensiods *count,
 			      void *buf, const void *cbuf,
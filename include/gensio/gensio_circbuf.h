@@ -86,6 +86,18 @@ void gensio_circbuf_sg_write(struct gensio_circbuf *c,
 			     const struct gensio_sg *sg, gensiods sglen,
 			     gensiods *rcount);
 
+/*
+ * Fill in sg with the data currently in the buffer without removing
+ * it, suitable for passing to gensio_write_sg().  sg must have room
+ * for two entries, one is used if the data does not wrap or the
+ * buffer is mirrored.  The number of entries used is returned in
+ * sglen.  Call gensio_circbuf_data_removed() with the amount
+ * actually written.
+ */
+GENSIOOSH_DLL_PUBLIC
+void gensio_circbuf_sg_read(struct gensio_circbuf *c,
+			    struct gensio_sg *sg, gensiods *sglen);
+
 /*
  * Read data from a scatter-gather buffer.  The number of bytes
  * returned is put into rcount.
@@ -99,6 +111,35 @@ GENSIOOSH_DLL_PUBLIC
 struct gensio_circbuf *gensio_circbuf_alloc(struct gensio_os_funcs *o,
 					    gensiods size);
 
+/*
+ * Allocate a circbuf whose memory is mapped twice back to back, so
+ * gensio_circbuf_next_read_area() and gensio_circbuf_next_write_area()
+ * always return everything available in one piece.  size must be a
+ * multiple of the page size.  If the platform can't do this, or size
+ * is not usable, a normal circbuf is returned instead; use
+ * gensio_circbuf_is_mirrored() to tell.
+ */
+GENSIOOSH_DLL_PUBLIC
+struct gensio_circbuf *gensio_circbuf_alloc_mirrored(struct gensio_os_funcs *o,
+						     gensiods size);
+
+/* Return true if the circbuf was allocated mirrored. */
+GENSIOOSH_DLL_PUBLIC
+bool gensio_circbuf_is_mirrored(struct gensio_circbuf *c);
+
+/*
+ * Allocate raw mirrored memory, size bytes mapped twice so that
+ * buf[i] and buf[i + size] are the same byte.  For users that keep
+ * their own ring indexes.  Returns NULL if not available or size is
+ * not a multiple of the page size.  Free with gensio_mirror_buf_free()
+ * passing the same size.
+ */
+GENSIOOSH_DLL_PUBLIC
+void *gensio_mirror_buf_alloc(struct gensio_os_funcs *o, gensiods size);
+GENSIOOSH_DLL_PUBLIC
+void gensio_mirror_buf_free(struct gensio_os_funcs *o, void *buf,
+			    gensiods size);
+
 /* Free an allocated circbuf. */
 GENSIOOSH_DLL_PUBLIC
 void gensio_circbuf_free(struct gensio_circbuf *c);
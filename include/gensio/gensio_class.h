@@ -114,6 +114,49 @@ void gensio_data_free(struct gensio *io);
 GENSIO_DLL_PUBLIC
 void *gensio_get_gensio_data(struct gensio *io);
 
+/*
+ * Setup arenas.  Between gensio_setup_scope_start() and
+ * gensio_setup_scope_end() on a thread, gensio_setup_zalloc() takes
+ * small allocations from an arena shared by everything allocated in
+ * the scope, so a connection's setup is a few chunks instead of many
+ * small mallocs.  The arena is returned in *arena (NULL if the memory
+ * came from o->zalloc()), pass it to gensio_setup_free().  The arena
+ * is freed when everything allocated from it has been freed.  Scopes
+ * nest, the outermost one decides the arena, join is an arena to add
+ * to (from gensio_get_arena()) or NULL to start a new one.  Only use
+ * it for memory that lives as long as the connection.
+ *
+ * str_to_gensio() and the base accepters put setup in a scope, the
+ * gensio, base, filter and ll structures use these.
+ */
+struct gensio_arena;
+
+GENSIO_DLL_PUBLIC
+void gensio_setup_scope_start(struct gensio_os_funcs *o,
+			      struct gensio_arena *join);
+GENSIO_DLL_PUBLIC
+void gensio_setup_scope_end(void);
+GENSIO_DLL_PUBLIC
+void *gensio_setup_zalloc(struct gensio_os_funcs *o, gensiods size,
+			  struct gensio_arena **arena);
+GENSIO_DLL_PUBLIC
+void gensio_setup_free(struct gensio_os_funcs *o, struct gensio_arena *arena,
+		       void *data);
+GENSIO_DLL_PUBLIC
+struct gensio_arena *gensio_get_arena(struct gensio *io);
+
+/*
+ * For fusing the layers of a stack.  gensio_can_absorb() returns true
+ * if io is implemented by func, has only one reference, and has no
+ * classes, frdata or sync I/O attached, so its parent can take over
+ * its implementation and free it.  gensio_set_child() changes the
+ * child the parent reports.
+ */
+GENSIO_DLL_PUBLIC
+bool gensio_can_absorb(struct gensio *io, gensio_func func);
+GENSIO_DLL_PUBLIC
+void gensio_set_child(struct gensio *io, struct gensio *child);
+
 GENSIO_DLL_PUBLIC
 int gensio_call_func(struct gensio *io, int func, gensiods *count,
 		     const void *cbuf, gensiods buflen, void *buf,
@@ -142,6 +185,28 @@ int gensio_cb(struct gensio *io, int event, int err,
 	      unsigned char *buf, gensiods *buflen,
 	      const char *const *auxdata);
 
+/*
+ * Passed in data for GENSIO_CONTROL_TAKE_READ_BUF.  buf and buflen
+ * are what was passed to the user's read callback, the gensio that
+ * owns that buffer sets rbuf to a buffer wrapping the data.  See
+ * gensio_take_read_buf().
+ */
+struct gensio_take_read_buf {
+    const unsigned char *buf;
+    gensiods buflen;
+    struct gensio_rbuf *rbuf;
+};
+
+/*
+ * Allocate a read buffer to lend to the user.  mem is memory
+ * allocated with gensio_os_buf_alloc() that will be freed when the last
+ * reference goes away, data and len are the user's data in mem.
+ */
+GENSIO_DLL_PUBLIC
+struct gensio_rbuf *gensio_rbuf_alloc(struct gensio_os_funcs *o,
+				      unsigned char *mem,
+				      unsigned char *data, gensiods len);
+
 /*
  * Add and get the classdata for a gensio.
  */
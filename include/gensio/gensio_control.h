@@ -51,6 +51,19 @@
 #define GENSIO_CONTROL_IN_FORMAT		42u
 #define GENSIO_CONTROL_OUT_FORMAT		43u
 #define GENSIO_CONTROL_DRAIN_COUNT		44u
+#define GENSIO_CONTROL_TAKE_READ_BUF		45u
+#define GENSIO_CONTROL_RAW_FD			46u
+#define GENSIO_CONTROL_CONN_STATS		47u
+#define GENSIO_CONTROL_STATS			48u
+#define GENSIO_CONTROL_IN_LATENCY		49u
+#define GENSIO_CONTROL_OUT_LATENCY		50u
+#define GENSIO_CONTROL_HANDOFF			51u
+#define GENSIO_CONTROL_ZEROCOPY_DONE		52u
+#define GENSIO_CONTROL_INLINE_EVENTS		53u
+#define GENSIO_CONTROL_MEM			54u
+#define GENSIO_CONTROL_FUSE			55u
+#define GENSIO_CONTROL_EARLY_DATA		56u
+#define GENSIO_CONTROL_WRITE_LATENCY		57u
 
 #define GENSIO_ACC_CONTROL_LADDR	1u
 #define GENSIO_ACC_CONTROL_LPORT	2u
@@ -60,4 +73,21 @@
  */
 #define GENSIO_ACC_CONTROL_TCPDNAME	3u
 
+/*
+ * Get remote address lookup statistics for the UDP accepter.
+ */
+#define GENSIO_ACC_CONTROL_LOOKUP_STATS	4u
+
+/*
+ * Re-read the key, certificate and CA files for the ssl accepter.
+ */
+#define GENSIO_ACC_CONTROL_RELOAD_CERTS	5u
+
+/*
+ * Get/set the maximum number of open connections and the maximum
+ * number accepted per second for accepters.  0 means no limit.
+ */
+#define GENSIO_ACC_CONTROL_MAXCONN	6u
+#define GENSIO_ACC_CONTROL_ACCEPTRATE	7u
+
 #endif /* GENSIO_CONTROL_H */
@@ -19,6 +19,16 @@ enum gensio_ll_close_state {
 struct gensio_iod;
 
 struct gensio_fd_ll_ops {
+    /*
+     * Start the open.  Return 0 if the open is complete, GE_INPROGRESS
+     * with *iod set if the open is waiting on the iod (a connect in
+     * progress, for instance).  If this returns GE_INPROGRESS and
+     * leaves *iod NULL, the open is waiting on something else, like
+     * an address lookup.  When that is done the sub-gensio must call
+     * gensio_fd_ll_open_continue() exactly once, and sub_open will be
+     * called again.  It may return GE_INPROGRESS without an iod
+     * again if it has something else to wait on.
+     */
     int (*sub_open)(void *handler_data, struct gensio_iod **iod);
 
     int (*check_open)(void *handler_data, struct gensio_iod *iod);
@@ -51,6 +61,13 @@ struct gensio_fd_ll_ops {
     int (*write)(void *handler_data, struct gensio_iod *iod, gensiods *count,
 		 const struct gensio_sg *sg, gensiods sglen,
 		 const char *const *auxdata);
+
+    /*
+     * Handle gensio_alloc_channel() for the gensio, optional.  Return
+     * GE_NOTSUP if channels aren't supported.
+     */
+    int (*alloc_channel)(void *handler_data,
+			 struct gensio_func_alloc_channel_data *data);
 };
 
 GENSIO_DLL_PUBLIC
@@ -78,9 +95,69 @@ void gensio_fd_ll_handle_incoming(struct gensio_ll *ll,
 				  const char **auxdata,
 				  void *cb_data);
 
+/*
+ * Called after sub_open returned GE_INPROGRESS without an iod, when
+ * the thing the open was waiting on is done.  This must be called
+ * exactly once for each such return, even if the gensio was closed
+ * in the meantime; the ll and its handler data will not be freed
+ * until it is.  This may call the open done callback and free the
+ * ll, so don't hold any locks the free or callbacks might need.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_fd_ll_open_continue(struct gensio_ll *ll);
+
 GENSIO_DLL_PUBLIC
 void *gensio_fd_ll_get_handler_data(struct gensio_ll *ll);
 
+/*
+ * Set the most reads done each time the fd is readable.  The ll keeps
+ * reading as long as each read fills the buffer and the user takes
+ * all the data, so a fast stream doesn't go back to the selector for
+ * every buffer.  Zero is treated as one, which is the default.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_fd_ll_set_read_budget(struct gensio_ll *ll, unsigned int budget);
+
+/*
+ * Use an adaptive read buffer.  The buffer starts at min bytes and
+ * doubles when a read fills it, up to the max_read_size the ll was
+ * allocated with, and shrinks back toward min when reads only use a
+ * little of it.  It is freed when a read doesn't fill it and all the
+ * data has been taken, so an idle ll doesn't hold a buffer, and it is
+ * counted against the os funcs' read buffer budget, see
+ * GENSIO_CONTROL_READBUF_BUDGET_SET_CONFIG.  This must be called
+ * before anything is read.  A min of zero is treated as one, and it
+ * does nothing if min is not less than max_read_size.
+ */
+GENSIO_DLL_PUBLIC
+void gensio_fd_ll_set_readbuf_min(struct gensio_ll *ll, gensiods min);
+
+/*
+ * Coalesce short reads.  A read that gets less than bytes is held
+ * and later reads are added to it until it has bytes, the buffer is
+ * full, or time passes since the first held read, then it all goes
+ * to the user at once.  This cuts down on the number of tiny reads
+ * from something that writes a little at a time, at the cost of up
+ * to time of latency.  bytes is limited to max_read_size and zero
+ * turns coalescing off, the default.  This does not work with
+ * gensio_fd_ll_set_readbuf_min() or reads that return auxdata, and
+ * must be called before anything is read.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_fd_ll_set_read_coalesce(struct gensio_ll *ll, gensiods bytes,
+				   gensio_time *time);
+
+/*
+ * Mark the ll low priority.  While the os funcs is overloaded and
+ * GENSIO_OVERLOAD_THROTTLE_READS is set (see
+ * GENSIO_CONTROL_OVERLOAD_SET_CONFIG), a low priority ll stops
+ * reading and looks again after the overload recheck time, so its
+ * data stays in the kernel and doesn't add to the load.  Not low
+ * priority is the default.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_fd_ll_set_lowprio(struct gensio_ll *ll, bool lowprio);
+
 GENSIO_DLL_PUBLIC
 struct gensio_ll *fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 				     struct gensio_iod *iod,
@@ -116,9 +116,44 @@ struct gensio_opensocks
 #define GENSIO_OPENSOCK_NODELAY		(1 << 4)
 #define GENSIO_SET_OPENSOCK_NODELAY	(1 << 5)
 
+/*
+ * TCP fast open.  On a connecting socket this sends the first write
+ * in the SYN once the kernel has a cookie for the server.  For
+ * open_listen_sockets() this lets the listening socket accept data in
+ * the SYN.  Returns GE_NOTSUP if the OS doesn't support it.
+ */
+#define GENSIO_OPENSOCK_FASTOPEN	(1 << 6)
+#define GENSIO_SET_OPENSOCK_FASTOPEN	(1 << 7)
+
+/*
+ * For open_listen_sockets() only.  Open this many sockets (up to 255)
+ * with SO_REUSEPORT for each address, all bound to the same port, so
+ * the kernel spreads incoming connections over them.  The copies of
+ * an address are consecutive in the returned array.  Returns
+ * GE_NOTSUP if the OS doesn't have SO_REUSEPORT.
+ */
+#define GENSIO_OPENSOCK_REUSEPORT(n)	(((n) & 0xff) << 8)
+#define GENSIO_OPENSOCK_GET_REUSEPORT(f) (((f) >> 8) & 0xff)
+
+/*
+ * For open_listen_sockets() with GENSIO_OPENSOCK_FASTOPEN, the most
+ * fast open connections (up to 65535) that may be pending before the
+ * full handshake is done.  Zero uses the default of 256.
+ */
+#define GENSIO_OPENSOCK_FASTOPEN_QLEN(n)	(((n) & 0xffff) << 16)
+#define GENSIO_OPENSOCK_GET_FASTOPEN_QLEN(f) (((f) >> 16) & 0xffff)
+
 /* For recv and send */
 #define GENSIO_MSG_OOB 1
 
+/*
+ * For send on TCP sockets with GENSIO_SOCKCTL_SET_ZEROCOPY on.  The
+ * kernel uses the data in place instead of copying it, it must not
+ * be changed until GENSIO_SOCKCTL_GET_ZEROCOPY_DONE reports the send
+ * done.  Ignored where it is not supported.
+ */
+#define GENSIO_MSG_ZEROCOPY 2
+
 /******************************************************************
  * For sock_control()
  */
@@ -182,6 +217,172 @@ struct gensio_opensocks
 #define GENSIO_SOCKCTL_SET_EXTRAINFO	10
 #define GENSIO_SOCKCTL_GET_EXTRAINFO	11
 
+/*
+ * For UDP sockets, receive or send multiple packets in one call.
+ * data points to an array of struct gensio_sockctl_mmsg and datalen
+ * points to the number of entries in the array.  On return *datalen
+ * is set to the number of packets received or sent, a receive that
+ * would block returns zero packets.
+ *
+ * For receive, buf and buflen give the buffer for each packet, len
+ * is set to the packet length, and addr must be allocated with
+ * addr_alloc_recvfrom() and is filled in with the source address.
+ * For send, buf and len give the packet and addr is the destination.
+ *
+ * Returns GE_NOTSUP if this is not supported on the platform (or on
+ * receive if extrainfo is enabled), the caller should fall back to
+ * recvfrom and sendto.
+ */
+#define GENSIO_SOCKCTL_RECVMMSG		12
+#define GENSIO_SOCKCTL_SENDMMSG		13
+
+struct gensio_sockctl_mmsg {
+    void *buf;
+    gensiods buflen;
+    gensiods len;
+    struct gensio_addr *addr;
+};
+
+/*
+ * For TCP and UDP sockets, turn receive timestamps on or off, data
+ * points to an unsigned int that is 1 or 0.  When on, recv() and
+ * recvfrom() save the time the kernel received the data, and the
+ * time the NIC received it if the interface has hardware
+ * timestamping turned on.  GET_RX_TIMESTAMP returns the timestamps
+ * from the most recent recv() or recvfrom() on the socket, data
+ * points to a struct gensio_sockctl_timestamp.  Returns GE_NOTSUP if
+ * the platform does not support this (it uses SO_TIMESTAMPING, so
+ * only Linux for now).  Receive timestamps are not supported with
+ * GENSIO_SOCKCTL_RECVMMSG.
+ */
+#define GENSIO_SOCKCTL_SET_TIMESTAMPS	14
+#define GENSIO_SOCKCTL_GET_RX_TIMESTAMP	15
+
+struct gensio_sockctl_timestamp {
+    bool sw_valid;	/* sw is the kernel receive time. */
+    bool hw_valid;	/* hw is the raw NIC receive time. */
+    gensio_time sw;
+    gensio_time hw;
+};
+
+/*
+ * For UDP sockets, send a buffer as a number of packets with one
+ * system call using segmentation offload (UDP_SEGMENT, Linux only).
+ * data points to a struct gensio_sockctl_seg and datalen should
+ * point to a gensiods with sizeof(struct gensio_sockctl_seg) in it.
+ * buf and len give the data, it is sent to addr as packets of
+ * segsize bytes, the last one may be shorter.  sent is set to len if
+ * the data was sent, or 0 if the send would block.  Returns
+ * GE_NOTSUP if not supported on the platform, the caller should fall
+ * back to sending the packets one at a time.
+ */
+#define GENSIO_SOCKCTL_SENDSEG		16
+
+struct gensio_sockctl_seg {
+    const void *buf;
+    gensiods len;
+    gensiods segsize;
+    struct gensio_addr *addr;
+    gensiods sent;
+};
+
+/*
+ * For UDP sockets, turn receive offload (UDP_GRO, Linux only) on or
+ * off.  data points to an unsigned int that is 1 or 0.  When on, a
+ * single recvfrom() may return a number of packets from the same
+ * source back to back, GET_RX_SEGSIZE returns the size of each packet
+ * in the last recvfrom() (the last one may be shorter), or 0 if it
+ * was a single packet.  data points to a gensiods for that.  The
+ * buffer passed to recvfrom() should be 65536 bytes with this on, or
+ * packets may be lost.  Returns GE_NOTSUP if the platform does not
+ * support this.  Not supported with GENSIO_SOCKCTL_RECVMMSG.
+ */
+#define GENSIO_SOCKCTL_SET_GRO		17
+#define GENSIO_SOCKCTL_GET_RX_SEGSIZE	18
+
+/*
+ * Pass a connected TCP or unix socket to another process over a unix
+ * socket with SCM_RIGHTS (Unix-like systems only).  data points to a
+ * struct gensio_sockctl_fdmsg, datalen is not used and should be
+ * NULL.  The iod this is called on is the unix socket.
+ *
+ * For send, iod is the socket to pass and buf and len give some data
+ * (at least one byte) to send with it.  The socket stays open in this
+ * process, close it when done with it.
+ *
+ * For receive, buf and len give a buffer for the data, len is set to
+ * the amount received.  iod is set to a new iod for the socket that
+ * came with the data, set up like one returned by accept(), or NULL
+ * if no socket came with it.  family is set to the socket's address
+ * family.  Returns GE_NODATA if nothing is waiting (or for send, if
+ * the unix socket is full) and GE_REMCLOSE if the other end has
+ * closed.
+ */
+#define GENSIO_SOCKCTL_SEND_FD		19
+#define GENSIO_SOCKCTL_RECV_FD		20
+
+struct gensio_sockctl_fdmsg {
+    void *buf;
+    gensiods len;
+    struct gensio_iod *iod;
+    int family;
+};
+
+/*
+ * Zero copy sends on a TCP socket (Linux only).  SET_ZEROCOPY turns
+ * it on, data is a pointer to an unsigned int, datalen points to
+ * sizeof(unsigned int).  Returns GE_NOTSUP if the OS can't do it.
+ *
+ * Each send with GENSIO_MSG_ZEROCOPY that sends some data is given
+ * the next number, starting at zero.  GET_ZEROCOPY_DONE returns a
+ * range of those that the kernel is done with, from lo to hi
+ * inclusive.  copied is set if the kernel copied the data anyway.
+ * data points to a struct gensio_sockctl_zcdone, datalen points to
+ * its size.  Returns GE_NODATA if nothing is done.  Call it until it
+ * returns GE_NODATA when the socket reports an exception.
+ */
+#define GENSIO_SOCKCTL_SET_ZEROCOPY		21
+#define GENSIO_SOCKCTL_GET_ZEROCOPY_DONE	22
+
+struct gensio_sockctl_zcdone {
+    uint32_t lo;
+    uint32_t hi;
+    bool copied;
+};
+
+/*
+ * Get the CPU that last handled incoming packets for the socket
+ * (SO_INCOMING_CPU, Linux only).  data points to an unsigned int,
+ * datalen points to sizeof(unsigned int).  Returns GE_NODATA if no
+ * packets have come in yet, GE_NOTSUP if the OS doesn't have it.
+ */
+#define GENSIO_SOCKCTL_GET_INCOMING_CPU		23
+
+/*
+ * Set TCP_NOTSENT_LOWAT on a TCP socket, so it only reports being
+ * writable when there are fewer than this many bytes not yet sent in
+ * the socket.  data points to an unsigned int, datalen points to
+ * sizeof(unsigned int).  Returns GE_NOTSUP if the OS doesn't have it.
+ */
+#define GENSIO_SOCKCTL_SET_NOTSENT_LOWAT	24
+
+/*
+ * Set the socket receive buffer size (SO_RCVBUF).  If the process is
+ * allowed to, the system limit is ignored (SO_RCVBUFFORCE on Linux).
+ * data points to an unsigned int, datalen points to
+ * sizeof(unsigned int).
+ */
+#define GENSIO_SOCKCTL_SET_RCVBUF		25
+
+/*
+ * Set whether the socket receives multicasts for all groups joined on
+ * the system (the default) or only the ones joined on this socket
+ * (IP_MULTICAST_ALL, Linux only).  data points to an unsigned int, 1
+ * for all groups, 0 for only this socket's groups.  datalen points to
+ * sizeof(unsigned int).  Returns GE_NOTSUP if the OS doesn't have it.
+ */
+#define GENSIO_SOCKCTL_SET_MCAST_ALL		26
+
 /******************************************************************
  * For iod_control()
  */
@@ -280,6 +481,98 @@ struct gensio_winsize {
 /* For ptys, will cd to this directory at startup. */
 #define GENSIO_IOD_CONTROL_START_DIR 28
 
+/*
+ * With sharded os funcs, put the iod's handlers on this shard (modulo
+ * the number of shards) instead of the least loaded one.  Must be
+ * set before the handlers are set.  -1 means any shard.  Get returns
+ * the shard the handlers are on, or the requested shard if they are
+ * not set, val is a pointer to an intptr_t for get.  Returns
+ * GE_NOTSUP if the os funcs are not sharded.
+ */
+#define GENSIO_IOD_CONTROL_SHARD	29
+
+/*
+ * For serial devices, block until one of the modem control lines
+ * (CTS, DSR, RI, CD) changes.  This is meant to be called from a
+ * thread that can block, not from a handler.  On get, val is a
+ * pointer to an int that receives the new modemstate as with
+ * GENSIO_IOD_CONTROL_MODEMSTATE, or zero to not fetch it.  Setting val
+ * to a non-zero value stops the wait and any future waits with
+ * GE_INTERRUPTED, setting it to zero allows waiting again.  The stop
+ * may race with a wait that is just starting, so the stopper should
+ * repeat it until the waiter is done.  Returns GE_NOTSUP if the
+ * device or OS can't do this, the user should poll the modemstate in
+ * that case.
+ */
+#define GENSIO_IOD_CONTROL_MODEMSTATE_WAIT 30
+
+/*
+ * For serial devices, get/set low latency mode as an int, bool.  This
+ * tells the driver to hand received characters up right away and sets
+ * the UART receive FIFO trigger to its lowest level where that can be
+ * done.  The original settings are restored when the device is
+ * closed.  Returns GE_NOTSUP if the device or OS can't do this.
+ */
+#define GENSIO_IOD_CONTROL_LOW_LATENCY	31
+
+/*
+ * Set the iod's handlers edge triggered, val is ignored.  The iod is
+ * only registered with the OS once, turning the handlers on and off
+ * becomes cheap, and the read and write handlers are called on every
+ * event, enabled or not.  The user must keep track of whether the iod
+ * is readable or writable and do I/O until it gets nothing before
+ * waiting for another call.  Must be done right after setting the
+ * handlers and before enabling any, it lasts until the handlers are
+ * cleared.  Get returns whether it is set as an int, val is a
+ * pointer to an int.  Returns GE_NOTSUP if the OS handler can't do
+ * this, on Unix it needs epoll and GENSIO_SEL_EPOLL_EDGE set in the
+ * environment.
+ */
+#define GENSIO_IOD_CONTROL_EDGE		32
+
+/*
+ * With sharded os funcs, while this is set to non-zero, timers and
+ * runners allocated by the calling thread go on the iod's shard (the
+ * one from GENSIO_IOD_CONTROL_SHARD if handlers are not yet set)
+ * instead of the thread's own.  Set it to zero when done.  This keeps
+ * everything for a connection on one shard.  Set only.  Returns
+ * GE_INVAL if the iod has no shard yet, GE_NOTSUP if the os funcs are
+ * not sharded.
+ */
+#define GENSIO_IOD_CONTROL_ALLOC_SHARD	34
+
+/*
+ * For serial devices, get/set an exclusive lock on the device as an
+ * int, bool.  On Unix this takes a flock() on the device (without
+ * waiting) and sets TIOCEXCL so other opens of the tty fail.  This
+ * is much cheaper than UUCP lock files and goes away by itself if the
+ * process dies.  Returns GE_INUSE if another open of the device holds
+ * the lock.  The lock is dropped when the device is closed.  On
+ * Windows serial ports are always opened exclusive, so this does
+ * nothing there.
+ */
+#define GENSIO_IOD_CONTROL_EXCL_LOCK	33
+
+/*
+ * For pipes, get/set the size of the kernel's pipe buffer in bytes
+ * as an int.  The kernel may round the size up.  On Linux this uses
+ * F_SETPIPE_SZ, and an unprivileged process can't go over
+ * /proc/sys/fs/pipe-max-size.  Returns GE_NOTSUP if the system can't
+ * change it.
+ */
+#define GENSIO_IOD_CONTROL_PIPE_SIZE	35
+
+/*
+ * Set the iod high priority if val is non-zero.  When it is ready at
+ * the same time as other iods, its handlers are called first, so
+ * control traffic doesn't wait behind bulk data.  Must be done after
+ * the handlers are set, it lasts until they are cleared.  Get returns
+ * the setting as an int, val is a pointer to an int.  Returns
+ * GE_NOTSUP if the os handler can't do this.  On Unix it only has an
+ * effect with epoll.
+ */
+#define GENSIO_IOD_CONTROL_PRIORITY	36
+
 /*
  * These are for communication between the socket code and the iod, so
  * the socket code can store information in the IOD.  It's only for
@@ -306,6 +599,341 @@ struct gensio_winsize {
  */
 #define GENSIO_CONTROL_SET_PROC_DATA	10001
 
+/*
+ * Get statistics for the I/O buffer pool.  data points to a struct
+ * gensio_bufpool_stats, datalen must point to its size.  Returns
+ * GE_NOTSUP if the os handler doesn't have a buffer pool.
+ */
+#define GENSIO_CONTROL_BUFPOOL_STATS	10002
+
+struct gensio_bufpool_stats {
+    gensiods hits;	/* Allocations satisfied from free buffers. */
+    gensiods misses;	/* Allocations that had to call malloc. */
+    gensiods oversize;	/* Allocations too large for the pool. */
+    gensiods free;	/* Free buffers currently held by the pool. */
+};
+
+/*
+ * Configure the cache of network address lookups.  Lookups done
+ * when connecting (not listening) are kept for the given time so
+ * that opening many gensios to the same host doesn't do a DNS lookup
+ * for each one.  data points to a struct gensio_addrcache_config,
+ * datalen must point to its size.  A zero ttl (the default) disables
+ * the cache.  Setting the config flushes the cache.  Returns
+ * GE_NOTSUP if the os handler doesn't have an address cache.
+ */
+#define GENSIO_CONTROL_ADDRCACHE_SET_CONFIG	10003
+#define GENSIO_CONTROL_ADDRCACHE_GET_CONFIG	10004
+
+struct gensio_addrcache_config {
+    gensio_time ttl;		/* How long to keep a good lookup. */
+    gensio_time neg_ttl;	/* How long to keep "no such name", 0 = off. */
+    unsigned int max_entries;	/* Zero means the default of 256. */
+};
+
+/*
+ * Get statistics for the address cache.  data points to a struct
+ * gensio_addrcache_stats, datalen must point to its size.
+ */
+#define GENSIO_CONTROL_ADDRCACHE_STATS		10005
+
+struct gensio_addrcache_stats {
+    gensiods hits;	/* Lookups answered from the cache. */
+    gensiods neg_hits;	/* Failed lookups answered from the cache. */
+    gensiods misses;	/* Lookups that had to ask the resolver. */
+    gensiods expired;	/* Entries found but too old to use. */
+    gensiods entries;	/* Entries currently in the cache. */
+};
+
+/* Throw away everything in the address cache.  data is ignored. */
+#define GENSIO_CONTROL_ADDRCACHE_FLUSH		10006
+
+/*
+ * Configure busy polling.  When a thread in service would block, it
+ * first polls without blocking for up to spin, trading CPU for lower
+ * wakeup latency.  data points to a struct gensio_busy_poll_config,
+ * datalen must point to its size.  A zero spin (the default) turns
+ * it off.  Returns GE_NOTSUP if the os handler can't busy poll.
+ */
+#define GENSIO_CONTROL_BUSY_POLL_SET_CONFIG	10007
+#define GENSIO_CONTROL_BUSY_POLL_GET_CONFIG	10008
+
+struct gensio_busy_poll_config {
+    gensio_time spin;		/* How long to poll before blocking. */
+};
+
+/*
+ * Get busy polling statistics.  data points to a struct
+ * gensio_busy_poll_stats, datalen must point to its size.
+ */
+#define GENSIO_CONTROL_BUSY_POLL_STATS		10009
+
+struct gensio_busy_poll_stats {
+    gensiods spin_hits;	/* Waits where something came in while polling. */
+    gensiods sleeps;	/* Waits that had to block after polling. */
+};
+
+/*
+ * Set the default timer slack.  Timers started with start_timer or
+ * start_timer_abs may then go off up to this much late, so that
+ * timers expiring close together are run in one wakeup instead of
+ * each waking the process, like the Linux timer_slack.  data points
+ * to a struct gensio_timer_slack_config, datalen must point to its
+ * size.  Zero (the default) runs timers at their exact time.  It
+ * only affects timers started after it is set.  Returns GE_NOTSUP if
+ * the os handler doesn't do timer slack.
+ */
+#define GENSIO_CONTROL_TIMER_SLACK_SET_CONFIG	10010
+#define GENSIO_CONTROL_TIMER_SLACK_GET_CONFIG	10011
+
+struct gensio_timer_slack_config {
+    gensio_time slack;		/* How late a timer may be run. */
+};
+
+/*
+ * Set a limit on the memory used by adaptive read buffers, see
+ * gensio_fd_ll_set_readbuf_min().  Those buffers only grow while the
+ * total of all of them on the os funcs stays under the budget, but
+ * they can always get their minimum size.  data points to a struct
+ * gensio_readbuf_budget_config, datalen must point to its size.  A
+ * budget of zero (the default) is no limit.  in_use is the memory
+ * currently used by adaptive read buffers, it is ignored on a set.
+ * Returns GE_NOTSUP if the os handler doesn't do this.
+ */
+#define GENSIO_CONTROL_READBUF_BUDGET_SET_CONFIG	10012
+#define GENSIO_CONTROL_READBUF_BUDGET_GET_CONFIG	10013
+
+struct gensio_readbuf_budget_config {
+    gensiods budget;		/* Max total size of adaptive buffers. */
+    gensiods in_use;		/* Current total size, get only. */
+};
+
+/*
+ * Get a file descriptor and timeout so the os handler can be run from
+ * another event loop (like Python's asyncio) instead of from
+ * gensio_os_funcs_service() or waiters.  data points to a struct
+ * gensio_poll_info, datalen must point to its size.  fd becomes
+ * readable when there is I/O to handle, timeout is how long until
+ * there are timers or deferred operations to run.  When either
+ * happens, call gensio_os_funcs_service() with a zero timeout until
+ * it returns GE_TIMEDOUT, then get the poll info again.  Anything
+ * else that starts gensio operations outside of a callback should
+ * also get the poll info again when it's done, the timeout may have
+ * changed.  This is for use from the single thread running the other
+ * loop.  Returns GE_NOTSUP if the os handler can't do this.
+ */
+#define GENSIO_CONTROL_POLL_INFO	10014
+
+struct gensio_poll_info {
+    int fd;			/* Poll this for readability. */
+    gensio_time timeout;	/* Service again after this long. */
+};
+
+/*
+ * Declare that the os funcs will only ever be used from one thread.
+ * Locks allocated after this don't do anything, which takes the mutex
+ * operations off the data path of every layer.  With internal tracing
+ * enabled, they still check that they are not locked twice or
+ * unlocked when not held.  Do this right after allocating the os
+ * funcs; it can't be undone.  data and datalen are ignored.  Returns
+ * GE_INVAL on sharded os funcs, GE_NOTSUP if the os handler can't do
+ * this.
+ */
+#define GENSIO_CONTROL_SINGLE_THREAD	10015
+
+/*
+ * Allocation accounting.  When enabled, every zalloc and buf_alloc is
+ * counted, by the address it was called from and separately when it
+ * is done on the data path (in a write or while read data is being
+ * delivered), to check that passing data doesn't allocate.  Setting
+ * the config clears the counts.  data points to a struct
+ * gensio_alloc_stats_config or struct gensio_alloc_stats, datalen
+ * must point to its size.  Only the first
+ * GENSIO_ALLOC_STATS_MAX_SITES call sites are kept, allocations from
+ * others are only counted in other_site_allocs.  Returns GE_NOTSUP
+ * if the os handler doesn't do this.
+ */
+#define GENSIO_CONTROL_ALLOC_STATS_SET_CONFIG	10016
+#define GENSIO_CONTROL_ALLOC_STATS		10017
+
+struct gensio_alloc_stats_config {
+    bool enable;
+};
+
+#define GENSIO_ALLOC_STATS_MAX_SITES	64
+
+struct gensio_alloc_site {
+    void *site;			/* Return address of the allocation call. */
+    gensiods allocs;
+    gensiods bytes;
+    gensiods datapath_allocs;
+};
+
+struct gensio_alloc_stats {
+    gensiods allocs;
+    gensiods frees;
+    gensiods bytes;
+    gensiods datapath_allocs;
+    gensiods datapath_bytes;
+    gensiods other_site_allocs;
+    unsigned int nr_sites;
+    struct gensio_alloc_site sites[GENSIO_ALLOC_STATS_MAX_SITES];
+};
+
+/*
+ * Event loop statistics, to see where latency comes from.  A wakeup
+ * is a wait for I/O that returned events, the dispatch latency is the
+ * time from the wait returning to the fd's handler being called, so
+ * it grows when handlers before it in the same wakeup take long.
+ * Timer lateness is how long after its expiry a timer's handler ran.
+ * max_handler_time is the longest single fd, timer or runner
+ * handler.  Collecting takes clock reads around every handler, so it
+ * is off by default; setting the config clears the statistics.  On
+ * sharded os funcs the counts and totals are summed and the maximums
+ * are the largest of all the shards.  data points to a struct
+ * gensio_loop_stats_config or struct gensio_loop_stats, datalen must
+ * point to its size.  Returns GE_NOTSUP if the os handler doesn't do
+ * this.
+ */
+#define GENSIO_CONTROL_LOOP_STATS_SET_CONFIG	10018
+#define GENSIO_CONTROL_LOOP_STATS		10019
+
+struct gensio_loop_stats_config {
+    bool enable;
+};
+
+struct gensio_loop_stats {
+    gensiods wakeups;
+    gensiods fds_dispatched;
+    gensiods max_fds_per_wakeup;
+    gensiods timers_fired;
+    gensiods runners_run;
+    gensio_time total_dispatch_latency;
+    gensio_time max_dispatch_latency;
+    gensio_time max_handler_time;
+    gensio_time total_timer_late;
+    gensio_time max_timer_late;
+};
+
+/*
+ * Lock contention profiling, to find which layer limits scaling on
+ * multiple threads.  Locks are grouped into classes by the address
+ * they were allocated from (use addr2line or a debugger to find the
+ * function), so each layer's locks and the selector's fd and timer
+ * locks show up separately.  For each class it reports how many
+ * times it was locked, how many of those found it already held, the
+ * time spent waiting for it, and how long it was held.  Profiling
+ * reads the clock on every lock and unlock, it is off by default and
+ * setting the config clears the counts.  The profile is for the whole
+ * process, not just these os funcs.  Only the first
+ * GENSIO_LOCK_PROFILE_MAX_CLASSES classes are kept.  data points to
+ * a struct gensio_lock_profile_config or struct gensio_lock_profile,
+ * datalen must point to its size.  Returns GE_NOTSUP if the os
+ * handler doesn't do this.
+ */
+#define GENSIO_CONTROL_LOCK_PROFILE_SET_CONFIG	10020
+#define GENSIO_CONTROL_LOCK_PROFILE		10021
+
+struct gensio_lock_profile_config {
+    bool enable;
+};
+
+#define GENSIO_LOCK_PROFILE_MAX_CLASSES	64
+
+struct gensio_lock_class_stats {
+    void *site;			/* Return address of the lock allocation. */
+    gensiods locks;
+    gensiods contended;		/* Locks that had to wait. */
+    gensio_time total_wait;
+    gensio_time max_wait;
+    gensio_time total_hold;
+    gensio_time max_hold;
+};
+
+struct gensio_lock_profile {
+    gensiods other_class_locks;	/* Locks of classes that didn't fit. */
+    unsigned int nr_classes;
+    struct gensio_lock_class_stats classes[GENSIO_LOCK_PROFILE_MAX_CLASSES];
+};
+
+/*
+ * Set a runner high priority.  When it is run, it goes ahead of the
+ * normal runners waiting to run.  This is for small control work
+ * (keepalives, acks, modem state) that should not wait behind bulk
+ * data.  data points to a struct gensio_runner_priority, datalen
+ * must point to its size.  Returns GE_NOTSUP if the os handler
+ * doesn't do this.
+ */
+#define GENSIO_CONTROL_RUNNER_PRIORITY	10022
+
+struct gensio_runner_priority {
+    struct gensio_runner *runner;
+    bool high;
+};
+
+/*
+ * Back the I/O buffer pool with a region of 2MB huge pages, to cut
+ * TLB misses when a lot of buffer memory is in use.  data points to
+ * a struct gensio_bufpool_hugepage_config, datalen must point to its
+ * size.  size is rounded up to 2MB.  Explicit huge pages
+ * (MAP_HUGETLB) are used if the system has them reserved, otherwise
+ * normal pages are mapped and transparent huge pages requested.
+ * Pool buffers are carved from the region as needed, when it is used
+ * up buffers come from malloc again.  Oversize buffers always come
+ * from malloc.  The region can only be set once, setting a different
+ * size after that returns GE_INUSE.  A size of 0 stops carving
+ * buffers from it.  Returns GE_NOTSUP if the os handler can't do
+ * this.
+ *
+ * GET_CONFIG fills in the current size (0 if off), whether explicit
+ * huge pages are used, the size mapped, and how much has been carved
+ * into buffers.
+ */
+#define GENSIO_CONTROL_BUFPOOL_HUGEPAGE_SET_CONFIG	10023
+#define GENSIO_CONTROL_BUFPOOL_HUGEPAGE_GET_CONFIG	10024
+
+struct gensio_bufpool_hugepage_config {
+    gensiods size;
+    bool hugetlb;	/* Get only. */
+    gensiods mapped;	/* Get only. */
+    gensiods carved;	/* Get only. */
+};
+
+/*
+ * Protect the process when consumers can't keep up.  The os funcs is
+ * overloaded when the memory in I/O buffers (from buf_alloc, which
+ * holds read data, queued mux and relpkt packets and the like) goes
+ * over limit, and stays overloaded until it drops under resume.
+ * While overloaded the policies set in policies are applied:
+ *
+ * GENSIO_OVERLOAD_PAUSE_ACCEPTS - Accepters stop taking new
+ *   connections, they stay in the listen backlog.
+ *
+ * GENSIO_OVERLOAD_THROTTLE_READS - Low priority gensios (the lowprio
+ *   option of the tcp and unix gensios) stop reading.
+ *
+ * Anything paused looks again after recheck.  data points to a struct
+ * gensio_overload_config, datalen must point to its size.  A limit
+ * of zero (the default) turns this off, a resume of zero is 3/4 of
+ * the limit, a zero recheck is 100ms.  in_use and overloaded are the
+ * current state, they are ignored on a set.  Returns GE_NOTSUP if
+ * the os handler doesn't do this.
+ */
+#define GENSIO_CONTROL_OVERLOAD_SET_CONFIG	10025
+#define GENSIO_CONTROL_OVERLOAD_GET_CONFIG	10026
+
+#define GENSIO_OVERLOAD_PAUSE_ACCEPTS	(1 << 0)
+#define GENSIO_OVERLOAD_THROTTLE_READS	(1 << 1)
+
+struct gensio_overload_config {
+    gensiods limit;
+    gensiods resume;
+    unsigned int policies;
+    gensio_time recheck;
+    gensiods in_use;	/* Get only. */
+    bool overloaded;	/* Get only. */
+};
+
 struct gensio_os_funcs {
     /* For use by the code doing the os function translation. */
     void *user_data;
@@ -820,8 +1448,92 @@ struct gensio_os_funcs {
      */
     int (*control)(struct gensio_os_funcs *o, int func, void *data,
 		   gensiods *datalen);
+
+    /****** I/O Buffers ******/
+    /*
+     * Allocate and free buffers for I/O data, like the read and write
+     * buffers of a gensio.  Unlike zalloc(), the memory is not
+     * zeroed.  These are for buffers that come and go with
+     * connections, so they can be recycled quickly.  They may be
+     * NULL, use gensio_os_buf_alloc() and gensio_os_buf_free(), which
+     * fall back to zalloc() and free().
+     */
+    void *(*buf_alloc)(struct gensio_os_funcs *f, gensiods size);
+    void (*buf_free)(struct gensio_os_funcs *f, void *buf);
+
+    /*
+     * Like start_timer, but the timer may go off up to slack late so
+     * it can be run with other timers, see
+     * GENSIO_CONTROL_TIMER_SLACK_SET_CONFIG.  A NULL slack uses the
+     * default slack, a zero slack is exact.  May be NULL, use
+     * gensio_os_funcs_start_timer_slack(), which falls back to
+     * start_timer.
+     */
+    int (*start_timer_slack)(struct gensio_timer *timer, gensio_time *timeout,
+			     gensio_time *slack);
+
+    /*
+     * Account for adaptive read buffers against the read buffer
+     * budget, see GENSIO_CONTROL_READBUF_BUDGET_SET_CONFIG.
+     * readbuf_reserve returns the size the caller may allocate, which
+     * is size if it fits in the budget, otherwise size halved until it
+     * fits, but never less than min.  readbuf_release gives back what
+     * was reserved.  They may be NULL, use gensio_os_readbuf_reserve()
+     * and gensio_os_readbuf_release(), which have no limit then.
+     */
+    gensiods (*readbuf_reserve)(struct gensio_os_funcs *f, gensiods size,
+				gensiods min);
+    void (*readbuf_release)(struct gensio_os_funcs *f, gensiods size);
+
+    /*
+     * Like get_monotonic_time, but may return a time cached by the
+     * event loop when it last woke up instead of reading the clock,
+     * so it is cheap to call many times in a handler.  It may be a
+     * little behind the real time, use get_monotonic_time for
+     * anything that needs to be precise.  May be NULL, use
+     * gensio_os_funcs_get_loop_time(), which falls back to
+     * get_monotonic_time.
+     */
+    void (*get_loop_time)(struct gensio_os_funcs *f, gensio_time *time);
+
+    /*
+     * Return true if the os funcs is overloaded and the given
+     * GENSIO_OVERLOAD_xxx policy is set, see
+     * GENSIO_CONTROL_OVERLOAD_SET_CONFIG.  If so, recheck is set to
+     * how long to wait before asking again.  May be NULL, use
+     * gensio_os_overloaded(), which returns false then.
+     */
+    bool (*overloaded)(struct gensio_os_funcs *f, unsigned int policy,
+		       gensio_time *recheck);
 };
 
+/*
+ * Allocate and free I/O buffers with the os handler's buf_alloc and
+ * buf_free, or with zalloc and free if it doesn't have them.
+ */
+GENSIOOSH_DLL_PUBLIC
+void *gensio_os_buf_alloc(struct gensio_os_funcs *o, gensiods size);
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_buf_free(struct gensio_os_funcs *o, void *buf);
+
+/*
+ * Reserve and release adaptive read buffer memory with the os
+ * handler's readbuf_reserve and readbuf_release, or with no limit if
+ * it doesn't have them.
+ */
+GENSIOOSH_DLL_PUBLIC
+gensiods gensio_os_readbuf_reserve(struct gensio_os_funcs *o, gensiods size,
+				   gensiods min);
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_readbuf_release(struct gensio_os_funcs *o, gensiods size);
+
+/*
+ * Check the os handler's overloaded, false if it doesn't have one.
+ */
+GENSIOOSH_DLL_PUBLIC
+bool gensio_os_overloaded(struct gensio_os_funcs *o, unsigned int policy,
+			  gensio_time *recheck);
+
 /*
  * Called from os handlers, check for any handlers that may need to be
  * called.
@@ -53,6 +53,26 @@ int gensio_os_new_thread(struct gensio_os_funcs *o,
 GENSIOOSH_DLL_PUBLIC
 int gensio_os_wait_thread(struct gensio_thread *thread_id);
 
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_thread_set_cpu(struct gensio_thread *thread_id,
+			     unsigned int cpu);
+
+/*
+ * A set of threads that service the os funcs until stopped.  If cpus
+ * is not NULL, thread i is pinned to cpus[i % nr_cpus].
+ */
+struct gensio_os_thread_pool;
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_thread_pool_start(struct gensio_os_funcs *o,
+				unsigned int nr_threads,
+				const unsigned int *cpus,
+				unsigned int nr_cpus,
+				struct gensio_os_thread_pool **pool);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_thread_pool_stop(struct gensio_os_thread_pool *pool);
+
 GENSIOOSH_DLL_PUBLIC
 void *gensio_os_funcs_zalloc(struct gensio_os_funcs *o, gensiods len);
 
@@ -78,6 +98,10 @@ GENSIOOSH_DLL_PUBLIC
 void gensio_os_funcs_get_monotonic_time(struct gensio_os_funcs *o,
 					gensio_time *time);
 
+GENSIOOSH_DLL_PUBLIC
+void gensio_os_funcs_get_loop_time(struct gensio_os_funcs *o,
+				   gensio_time *time);
+
 GENSIOOSH_DLL_PUBLIC
 struct gensio_timer *gensio_os_funcs_alloc_timer(struct gensio_os_funcs *o,
 				    void (*handler)(struct gensio_timer *t,
@@ -98,6 +122,12 @@ int gensio_os_funcs_start_timer_abs(struct gensio_os_funcs *o,
 				    struct gensio_timer *timer,
 				    gensio_time *timeout);
 
+GENSIOOSH_DLL_PUBLIC
+int gensio_os_funcs_start_timer_slack(struct gensio_os_funcs *o,
+				      struct gensio_timer *timer,
+				      gensio_time *timeout,
+				      gensio_time *slack);
+
 GENSIOOSH_DLL_PUBLIC
 int gensio_os_funcs_stop_timer(struct gensio_os_funcs *o,
 			       struct gensio_timer *timer);
@@ -39,7 +39,8 @@ int gensio_os_scan_netaddr(struct gensio_os_funcs *o, const char *str,
 
 /*
  * Call o->open_listen_sockets() then set the I/O handlers with the
- * given data.
+ * given data.  With GENSIO_OPENSOCK_REUSEPORT(n), copy i of each
+ * address is put on shard i if the os funcs are sharded.
  */
 GENSIOOSH_DLL_PUBLIC
 int gensio_os_open_listen_sockets(struct gensio_os_funcs *o,
@@ -264,6 +265,123 @@ void *gensio_i_zalloc(struct gensio_memtrack *m, unsigned int size);
 GENSIOOSH_DLL_PUBLIC
 void gensio_i_free(struct gensio_memtrack *m, void *data);
 
+/*
+ * A pool of I/O buffers, for OS handlers to implement buf_alloc and
+ * buf_free.  Buffers are kept in power of two sized bins from 512
+ * bytes to 64K with a small per-thread cache of free buffers, larger
+ * buffers are passed to malloc.  If a memtrack is passed in, all
+ * buffers are passed through to it so memory tracking still works.
+ */
+struct gensio_bufpool;
+
+GENSIOOSH_DLL_PUBLIC
+struct gensio_bufpool *gensio_bufpool_alloc(struct gensio_memtrack *mtrack);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_bufpool_free(struct gensio_bufpool *p);
+
+GENSIOOSH_DLL_PUBLIC
+void *gensio_bufpool_get(struct gensio_bufpool *p, gensiods size);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_bufpool_put(struct gensio_bufpool *p, void *buf);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_bufpool_get_stats(struct gensio_bufpool *p,
+			      struct gensio_bufpool_stats *stats);
+
+/*
+ * The bytes in buffers currently handed out by the pool, rounded up
+ * to the bin size.  Buffers passed through to a memtrack are not
+ * counted.
+ */
+GENSIOOSH_DLL_PUBLIC
+gensiods gensio_bufpool_in_use(struct gensio_bufpool *p);
+
+/*
+ * Map size bytes (rounded up to 2MB) of huge pages for the pool to
+ * carve bin buffers from, see GENSIO_CONTROL_BUFPOOL_HUGEPAGE_SET_CONFIG.
+ * A size of 0 stops carving, the region stays mapped until the pool
+ * is freed since buffers from it may be in use.
+ */
+GENSIOOSH_DLL_PUBLIC
+int gensio_bufpool_set_hugepages(struct gensio_bufpool *p, gensiods size);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_bufpool_get_hugepages(struct gensio_bufpool *p,
+				  struct gensio_bufpool_hugepage_config *c);
+
+/*
+ * A cache of address lookups for OS handlers to put in front of
+ * addr_scan_ips.  scan is the function that does the real lookup.
+ * The OS handler's control function should pass the
+ * GENSIO_CONTROL_ADDRCACHE_xxx controls to gensio_addrcache_control().
+ */
+struct gensio_addrcache;
+
+typedef int (*gensio_addrcache_scan)(struct gensio_os_funcs *o,
+				     const char *str, bool listen,
+				     int ifamily, int protocol,
+				     bool *is_port_set, bool scan_port,
+				     struct gensio_addr **raddr);
+
+GENSIOOSH_DLL_PUBLIC
+struct gensio_addrcache *gensio_addrcache_alloc(struct gensio_os_funcs *o,
+						gensio_addrcache_scan scan);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_addrcache_free(struct gensio_addrcache *c);
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_addrcache_scan_ips(struct gensio_addrcache *c,
+			      struct gensio_os_funcs *o, const char *str,
+			      bool listen, int ifamily, int protocol,
+			      bool *is_port_set, bool scan_port,
+			      struct gensio_addr **raddr);
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_addrcache_control(struct gensio_addrcache *c, int func,
+			     void *data, gensiods *datalen);
+
+/*
+ * Allocation accounting for OS handlers, call alloced and freed from
+ * the handler's allocation functions and pass the
+ * GENSIO_CONTROL_ALLOC_STATS_xxx controls to
+ * gensio_allocstats_control().  The gensio code marks the data path
+ * with gensio_alloc_datapath_enter() and gensio_alloc_datapath_exit().
+ */
+struct gensio_allocstats;
+
+GENSIOOSH_DLL_PUBLIC
+struct gensio_allocstats *gensio_allocstats_alloc(void);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_allocstats_free(struct gensio_allocstats *s);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_allocstats_alloced(struct gensio_allocstats *s, void *site,
+			       gensiods size);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_allocstats_freed(struct gensio_allocstats *s);
+
+/*
+ * For allocation wrappers, the next allocation on this thread is
+ * counted for site instead of the wrapper.
+ */
+GENSIOOSH_DLL_PUBLIC
+void gensio_allocstats_set_caller(void *site);
+
+GENSIOOSH_DLL_PUBLIC
+int gensio_allocstats_control(struct gensio_allocstats *s, int func,
+			      void *data, gensiods *datalen);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_alloc_datapath_enter(void);
+
+GENSIOOSH_DLL_PUBLIC
+void gensio_alloc_datapath_exit(void);
+
 /* For testing, do not use in normal code. */
 GENSIOOSH_DLL_PUBLIC
 void gensio_osfunc_exit(int rv);
@@ -70,6 +70,11 @@ typedef void (*gensio_done_err)(struct gensio *io, int err, void *open_data);
  */
 typedef void (*gensio_acc_done)(struct gensio_accepter *acc, void *cb_data);
 
+/*
+ * Callback for closing a set of gensios, see gensio_close_multiple().
+ */
+typedef void (*gensio_multi_done)(struct gensio_os_funcs *o, void *cb_data);
+
 enum gensio_log_levels {
     GENSIO_LOG_FATAL,
     GENSIO_LOG_ERR,
@@ -32,6 +32,39 @@ GENSIO_DLL_PUBLIC
 int gensio_unix_funcs_alloc(struct selector_s *sel, int wake_sig,
 			    struct gensio_os_funcs **ro);
 
+/*
+ * Allocate an os funcs with nr_shards independent selectors, each
+ * with its own epoll fd, timer heap and runner queue.  Each thread
+ * that calls service or wait is bound to one shard (the one with the
+ * fewest threads at the time) and only handles events from that
+ * shard.  File descriptors are put on the shard with the fewest file
+ * descriptors, timers and runners on the shard of the thread that
+ * allocates them (or spread round-robin from unbound threads).
+ *
+ * This keeps threads from contending on a single selector, but you
+ * must have at least nr_shards threads continuously servicing the os
+ * funcs, or some events will never be handled.  The selectors are
+ * freed when the os funcs are freed.
+ *
+ * Returns GE_NOTSUP if threads are not available, GE_INVAL if
+ * nr_shards is zero.  A nr_shards of 1 is the same as
+ * gensio_unix_funcs_alloc(NULL, wake_sig, ro).
+ */
+GENSIO_DLL_PUBLIC
+int gensio_unix_funcs_alloc_sharded(unsigned int nr_shards, int wake_sig,
+				    struct gensio_os_funcs **ro);
+
+/*
+ * Bind the calling thread to shard number shardnum (modulo the number
+ * of shards) of sharded os funcs, instead of letting the first service
+ * or wait pick one.  If the thread is already bound, it is moved.
+ * Don't call this from a handler.  Returns GE_NOTSUP if the os funcs
+ * are not sharded unix os funcs.
+ */
+GENSIO_DLL_PUBLIC
+int gensio_unix_funcs_bind_shard(struct gensio_os_funcs *o,
+				 unsigned int shardnum);
+
 #ifdef __cplusplus
 }
 #endif
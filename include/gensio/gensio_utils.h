@@ -40,6 +40,18 @@ uint16_t gensio_buf_to_u16(unsigned char *data);
 GENSIOOSH_DLL_PUBLIC
 void gensio_u16_to_buf(unsigned char *data, uint16_t v);
 
+/*
+ * CRC16 helpers.  These update *crc with the CRC of the len bytes at
+ * buf, so they can be called in pieces.  gensio_crc16_ccitt() is the
+ * reflected CCITT CRC used by HDLC and AX.25 (the caller does the
+ * 0xffff initial value and final xor), gensio_crc16() is the
+ * non-reflected CCITT polynomial (0x1021).
+ */
+GENSIOOSH_DLL_PUBLIC
+void gensio_crc16_ccitt(const unsigned char *buf, gensiods len, uint16_t *crc);
+GENSIOOSH_DLL_PUBLIC
+void gensio_crc16(const unsigned char *buf, gensiods len, uint16_t *crc);
+
 /*
  * A helper function, very useful for raddr handling.  Do an
  * snprintf() at buf + *pos, writing to up to buf + len.  If *pos > len,
@@ -53,6 +53,22 @@ struct selector_s;
  *
  * Note that this function will block wake_sig in the calling thread, and you
  * must have it blocked on all threads.
+ *
+ * On Linux, if GENSIO_SEL_IO_URING is set to a non-zero value in the
+ * environment, io_uring is used to poll the file descriptors instead
+ * of epoll.  This lets the selector rearm file descriptors and wait
+ * for events in a single system call.  If io_uring is not available
+ * it falls back to epoll.
+ *
+ * If GENSIO_SEL_TIMER_WHEEL is set to a non-zero value in the
+ * environment, timers are kept in a hierarchical timing wheel with
+ * millisecond slots instead of a heap.  Starting and stopping a timer
+ * is then constant time, which helps when there are many timers that
+ * are mostly stopped before they go off.  Timers still expire at the
+ * requested time, not rounded to a slot.
+ *
+ * If GENSIO_SEL_EPOLL_EDGE is set to a non-zero value in the
+ * environment and epoll is in use, sel_set_fd_edge() is allowed.
  */
 typedef struct sel_lock_s sel_lock_t;
 SEL_DLL_PUBLIC
@@ -114,6 +130,29 @@ void sel_set_fd_write_handler(struct selector_s *sel, int fd, int state);
 SEL_DLL_PUBLIC
 void sel_set_fd_except_handler(struct selector_s *sel, int fd, int state);
 
+/* Register the fd edge triggered.  It is only registered once, the
+   enables above don't make any system calls, and the read, write,
+   and except handlers are called for every event whether they are
+   enabled or not.  The user must keep track of readiness itself and
+   do I/O until it gets EAGAIN before waiting for the next event.  A
+   HUP goes to the read and write handlers, an error goes to all
+   three.  This should be done right after setting the handlers,
+   before enabling anything, and it is undone when the handlers are
+   cleared or replaced.  Only available with epoll, and only if
+   GENSIO_SEL_EPOLL_EDGE is set in the environment when the selector
+   is allocated, returns ENOSYS otherwise. */
+SEL_DLL_PUBLIC
+int sel_set_fd_edge(struct selector_s *sel, int fd);
+
+/* If prio is non-zero, when the fd has an event at the same time as
+   other fds, its handlers are called first.  This keeps control
+   traffic from waiting behind bulk data in the same wakeup.  It is
+   undone when the handlers are cleared or replaced.  Only has an
+   effect with epoll, the other methods accept it but handle fds in
+   their normal order.  Returns EBADF if the fd has no handlers. */
+SEL_DLL_PUBLIC
+int sel_set_fd_priority(struct selector_s *sel, int fd, int prio);
+
 struct sel_timer_s;
 typedef struct sel_timer_s sel_timer_t;
 
@@ -134,6 +173,17 @@ SEL_DLL_PUBLIC
 int sel_start_timer(sel_timer_t    *timer,
 		    struct timeval *timeout);
 
+/*
+ * Like sel_start_timer(), but the timer may go off up to slack late
+ * so it can be handled with other timers in one wakeup.  slack of
+ * NULL uses the selector's default slack, see sel_set_timer_slack(),
+ * which is what sel_start_timer() uses.  A zero slack is exact.
+ */
+SEL_DLL_PUBLIC
+int sel_start_timer_slack(sel_timer_t    *timer,
+			  struct timeval *timeout,
+			  struct timeval *slack);
+
 SEL_DLL_PUBLIC
 int sel_stop_timer(sel_timer_t *timer);
 
@@ -150,6 +200,18 @@ int sel_stop_timer_with_done(sel_timer_t *timer,
 SEL_DLL_PUBLIC
 void sel_get_monotonic_time(struct timeval *tv);
 
+/*
+ * Like sel_get_monotonic_time(), but return the time the selector
+ * last woke up to handle timers or file descriptors instead of
+ * reading the clock.  All handlers in one dispatch round see the
+ * same time.  It may be behind the real time by however long the
+ * handlers have run, and outside of handlers it may be behind by
+ * the time the selector was waiting, so don't use it to start
+ * timers.
+ */
+SEL_DLL_PUBLIC
+void sel_get_loop_time(struct selector_s *sel, struct timeval *tv);
+
 typedef struct sel_runner_s sel_runner_t;
 typedef void (*sel_runner_func_t)(sel_runner_t *runner, void *cb_data);
 SEL_DLL_PUBLIC
@@ -159,6 +221,14 @@ int sel_free_runner(sel_runner_t *runner);
 SEL_DLL_PUBLIC
 int sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data);
 
+/*
+ * If prio is non-zero, the runner is high priority.  When it is run,
+ * it goes ahead of any normal runners waiting to run.  Meant for
+ * small control work that should not wait behind bulk data.
+ */
+SEL_DLL_PUBLIC
+void sel_runner_set_priority(sel_runner_t *runner, int prio);
+
 /* For multi-threaded programs, you will need to wake the selector
    thread if you add a timer to the top of the heap or change the fd
    mask.  This code should send a signal to the thread that calls
@@ -224,6 +294,73 @@ SEL_DLL_PUBLIC
 void sel_wake_one(struct selector_s *sel, long thread_id, sel_send_sig_cb killer,
 		  void *cb_data);
 
+/*
+ * Busy polling.  If spin is not zero, a thread waiting in the
+ * selector polls the file descriptors without blocking for up to
+ * that long before it blocks, trading CPU for lower wakeup latency.
+ * Set spin to zero to turn it off (the default).  hits counts the
+ * waits where something came in while spinning, sleeps counts the
+ * ones that had to block after spinning.
+ */
+SEL_DLL_PUBLIC
+void sel_set_busy_poll(struct selector_s *sel, struct timeval *spin);
+SEL_DLL_PUBLIC
+void sel_get_busy_poll(struct selector_s *sel, struct timeval *spin,
+		       unsigned long *hits, unsigned long *sleeps);
+
+/*
+ * Set the default timer slack.  Timers started without their own
+ * slack have their timeout pushed out to the next multiple of this
+ * on the monotonic clock, so timers that expire close together are
+ * run together and wake the selector less often.  Zero (the default)
+ * runs timers at exactly their timeout.  This only affects timers
+ * started after it is set.
+ */
+SEL_DLL_PUBLIC
+void sel_set_timer_slack(struct selector_s *sel, struct timeval *slack);
+SEL_DLL_PUBLIC
+void sel_get_timer_slack(struct selector_s *sel, struct timeval *slack);
+
+/*
+ * Event loop statistics.  sel_set_stats() turns collecting them on
+ * or off and clears them, they are off by default since the handler
+ * times take clock reads.  A wakeup is a wait that returned file
+ * descriptors to handle, the dispatch latency is the time from the
+ * wait returning to the fd handler being called, and timer lateness
+ * is how long after its time a timer ran.  A long handler shows up
+ * in max_handler_time and in the latencies of everything after it.
+ */
+struct sel_stats {
+    unsigned long wakeups;
+    unsigned long fds_dispatched;	/* fd handler calls. */
+    unsigned long max_fds_per_wakeup;	/* Most fd events from one wait. */
+    unsigned long timers_fired;
+    unsigned long runners_run;
+    struct timeval total_dispatch_latency;
+    struct timeval max_dispatch_latency;
+    struct timeval max_handler_time;	/* Longest fd, timer or runner. */
+    struct timeval total_timer_late;
+    struct timeval max_timer_late;
+};
+
+SEL_DLL_PUBLIC
+void sel_set_stats(struct selector_s *sel, int enable);
+SEL_DLL_PUBLIC
+void sel_get_stats(struct selector_s *sel, struct sel_stats *stats);
+
+/*
+ * Get what another event loop needs to run this selector.  fd becomes
+ * readable when there are file descriptors to handle, and timeout is
+ * set to how long until there are timers or runners to handle.  When
+ * either happens, call sel_select() with a zero timeout until it
+ * returns 0, then get the info again, since handling things may
+ * change the timeout.  Only works with epoll, returns ENOSYS
+ * otherwise (including when io_uring is in use).
+ */
+SEL_DLL_PUBLIC
+int sel_get_poll_info(struct selector_s *sel, int *fd,
+		      struct timeval *timeout);
+
 /*
  * If you fork and expect to use the selector in the forked process,
  * you *must* call this function in the forked process or you may
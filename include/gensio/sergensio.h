@@ -200,6 +200,45 @@ int sergensio_flush(struct sergensio *sio, unsigned int val);
 GENSIO_DLL_PUBLIC
 int sergensio_send_break(struct sergensio *sio);
 
+/*
+ * Set a group of serial parameters with one request.  Each op is one
+ * of the settings below (the same as calling sergensio_baud(), etc.)
+ * with the value to set.  On a remote port (telnet) the settings are
+ * sent together.  done is called once after all the settings have
+ * completed, with err and rval filled in for each op.  The err passed
+ * to done is the first error of the ops, or zero.  The ops array must
+ * remain valid until done is called.
+ *
+ * If this returns an error, done is not called.  Ops that were
+ * already started still complete.
+ */
+#define SERGENSIO_BATCH_BAUD		1
+#define SERGENSIO_BATCH_DATASIZE	2
+#define SERGENSIO_BATCH_PARITY		3
+#define SERGENSIO_BATCH_STOPBITS	4
+#define SERGENSIO_BATCH_FLOWCONTROL	5
+#define SERGENSIO_BATCH_IFLOWCONTROL	6
+#define SERGENSIO_BATCH_SBREAK		7
+#define SERGENSIO_BATCH_DTR		8
+#define SERGENSIO_BATCH_RTS		9
+struct sergensio_batch_op {
+    int op;
+    unsigned int val;
+
+    /* Set when the op completes. */
+    int err;
+    unsigned int rval;
+};
+
+typedef void (*sergensio_batch_done)(struct sergensio *sio, int err,
+				     struct sergensio_batch_op *ops,
+				     unsigned int nops, void *cb_data);
+
+GENSIO_DLL_PUBLIC
+int sergensio_batch(struct sergensio *sio,
+		    struct sergensio_batch_op *ops, unsigned int nops,
+		    sergensio_batch_done done, void *cb_data);
+
 /*
  * Return the user data supplied in the alloc function.
  */
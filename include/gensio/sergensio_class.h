@@ -31,6 +31,13 @@
 #define SERGENSIO_FUNC_CTS			16
 #define SERGENSIO_FUNC_DCD_DSR			17
 #define SERGENSIO_FUNC_RI			18
+/*
+ * Bracket the operations of a sergensio_batch() call.  A sergensio
+ * may use these to send the operations together, if it doesn't
+ * support them it should return GE_NOTSUP.
+ */
+#define SERGENSIO_FUNC_BATCH_START		19
+#define SERGENSIO_FUNC_BATCH_END		20
 
 typedef int (*sergensio_func)(struct sergensio *sio, int op, int val, char *buf,
 			      void *done, void *cb_data);
@@ -0,0 +1,40 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Static tracepoints (USDT probes) for the data path, for use with
+ * bpftrace, perf, systemtap, etc.  The provider is "gensio".  When
+ * nothing is attached a probe is a single nop plus making its
+ * arguments available, so these are left in all builds that have
+ * sys/sdt.h.  Without it they compile to nothing.
+ *
+ * Arguments should be values already at hand and have no side
+ * effects, they are not evaluated if probes are compiled out.
+ */
+
+#ifndef GENSIO_PROBES_H
+#define GENSIO_PROBES_H
+
+#if defined(HAVE_SYS_SDT_H) && !defined(GENSIO_NO_PROBES)
+#include <sys/sdt.h>
+
+#define GENSIO_PROBE0(name) DTRACE_PROBE(gensio, name)
+#define GENSIO_PROBE1(name, a1) DTRACE_PROBE1(gensio, name, a1)
+#define GENSIO_PROBE2(name, a1, a2) DTRACE_PROBE2(gensio, name, a1, a2)
+#define GENSIO_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(gensio, name, a1, a2, a3)
+#define GENSIO_PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(gensio, name, a1, a2, a3, a4)
+#else
+#define GENSIO_PROBE0(name) do { } while (0)
+#define GENSIO_PROBE1(name, a1) do { } while (0)
+#define GENSIO_PROBE2(name, a1, a2) do { } while (0)
+#define GENSIO_PROBE3(name, a1, a2, a3) do { } while (0)
+#define GENSIO_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#endif
+
+#endif /* GENSIO_PROBES_H */
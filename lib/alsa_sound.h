@@ -16,6 +16,22 @@ struct alsa_info {
     struct gensio_iod **iods;
     unsigned int nrfds;
     struct gensio_timer *close_timer;
+
+    /*
+     * With mmap access we try to turn off the period interrupts and
+     * check the PCM from a timer instead, like pulseaudio's timer
+     * scheduling.  If the device can't do that, tsched is false and
+     * the poll fds are used as normal.
+     */
+    bool mmap;
+    bool tsched;
+    bool tsched_run; /* The timer is started. */
+    bool tsched_closing; /* Waiting for the timer to stop for a close. */
+    struct gensio_timer *tsched_timer;
+
+    /* The period and buffer size the hardware actually gave us. */
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t buffer_size;
 };
 
 static void
@@ -28,6 +44,12 @@ gensio_sound_alsa_api_close_dev(struct sound_info *si)
     if (!a)
 	return;
 
+    if (a->tsched_run) {
+	o->stop_timer(a->tsched_timer);
+	a->tsched_run = false;
+    }
+    a->tsched_closing = false;
+
     for (i = 0; a->iods && i < a->nrfds; i++) {
 	if (!a->iods[i])
 	    continue;
@@ -126,7 +148,8 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
     struct alsa_info *a = si->pinfo;
     snd_pcm_hw_params_t *params;
     snd_pcm_uframes_t frsize;
-    int err;
+    snd_pcm_access_t access;
+    int err, dir = 0;
 
     snd_pcm_hw_params_alloca(&params);
 
@@ -146,8 +169,11 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
 	goto out_err;
     }
 
-    err = snd_pcm_hw_params_set_access(a->pcm, params,
-				       SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (a->mmap)
+	access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+    else
+	access = SND_PCM_ACCESS_RW_INTERLEAVED;
+    err = snd_pcm_hw_params_set_access(a->pcm, params, access);
     if (err < 0) {
 	gensio_log(o, GENSIO_LOG_INFO,
 		   "alsa error from snd_pcm_hw_params_set_access: %s\n",
@@ -207,6 +233,21 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
 	goto out_err;
     }
 
+    /*
+     * A period is one buffer of user data, and we have num_bufs of
+     * them in the hardware buffer.  Small values here give low
+     * latency.
+     */
+    frsize = si->bufsize;
+    err = snd_pcm_hw_params_set_period_size_near(a->pcm, params, &frsize,
+						 &dir);
+    if (err < 0) {
+	gensio_log(o, GENSIO_LOG_INFO,
+		"alsa error from snd_pcm_hw_params_set_period_size_near: %s\n",
+		snd_strerror(err));
+	goto out_err;
+    }
+
     frsize = si->bufsize * si->num_bufs;
     err = snd_pcm_hw_params_set_buffer_size_near(a->pcm, params, &frsize);
     if (err < 0) {
@@ -216,23 +257,12 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
 	goto out_err;
     }
 
-#if 0
-    {
-	/* Period time, in usecs.  Do u64 arithmetic to avoid overflow. */
-	uint64_t lperiod_time = (si->bufsize * 1000000ULL) / si->samplerate;
-	unsigned int period_time = lperiod_time;
-	int dir;
-
-	err = snd_pcm_hw_params_set_period_time_near(a->pcm, params,
-						     &period_time, &dir);
-	if (err < 0) {
-	    gensio_log(o, GENSIO_LOG_INFO,
-		"alsa error from snd_pcm_hw_params_ser_period_time_near: %s\n",
-		snd_strerror(err));
-	    goto out_err;
-	}
+    a->tsched = false;
+    if (a->mmap) {
+	err = snd_pcm_hw_params_set_period_wakeup(a->pcm, params, 0);
+	if (err == 0)
+	    a->tsched = true;
     }
-#endif
 
     /* write the parameters to device */
     err = snd_pcm_hw_params(a->pcm, params);
@@ -243,6 +273,9 @@ gensio_sound_alsa_set_hwparams(struct sound_info *si)
 	goto out_err;
     }
 
+    snd_pcm_hw_params_get_period_size(params, &a->period_size, &dir);
+    snd_pcm_hw_params_get_buffer_size(params, &a->buffer_size);
+
     return 0;
  out_err:
     return GE_OSERR;
@@ -355,20 +388,21 @@ gensio_sound_alsa_do_read(struct sound_info *si)
 {
     struct alsa_info *a = si->pinfo;
     struct sound_ll *soundll = si->soundll;
-    int rv;
+    unsigned char *buf;
+    snd_pcm_sframes_t rv;
 
     gensio_sound_alsa_check_xrun_recovery(si, 0);
     if (soundll->err)
 	return;
 
-    if (si->cnv.enabled) {
-	rv = snd_pcm_readi(a->pcm,
-			   si->cnv.buf + (si->len * si->cnv.pframesize),
-			   si->bufsize - si->len);
-    } else {
-	rv = snd_pcm_readi(a->pcm, si->buf + (si->len * si->framesize),
-			   si->bufsize - si->len);
-    }
+    if (si->cnv.enabled)
+	buf = si->cnv.buf + (si->len * si->cnv.pframesize);
+    else
+	buf = si->buf + (si->len * si->framesize);
+    if (a->mmap)
+	rv = snd_pcm_mmap_readi(a->pcm, buf, si->bufsize - si->len);
+    else
+	rv = snd_pcm_readi(a->pcm, buf, si->bufsize - si->len);
 
     if (rv < 0) {
 	if (rv == -EAGAIN || rv == -EBUSY)
@@ -378,17 +412,93 @@ gensio_sound_alsa_do_read(struct sound_info *si)
 	si->len += rv;
 	assert(si->len <= si->bufsize);
 	if (si->len == si->bufsize) {
-	    if (si->cnv.enabled) {
-		const unsigned char *ibuf = si->cnv.buf;
-		unsigned char *obuf = si->buf;
-		gensiods i;
+	    if (si->cnv.enabled)
+		si->cnv.convin_block(si->cnv.buf, si->buf,
+				     si->bufsize * si->chans, &si->cnv);
+	    si->ready = true;
+	}
+    }
+}
 
-		for (i = 0; i < si->bufsize * si->chans; i++)
-		    si->cnv.convin(&ibuf, &obuf, &si->cnv);
-	    }
+static void
+gensio_sound_alsa_close_one(struct sound_ll *soundll)
+{
+    soundll->nr_waiting_close--;
+    if (soundll->nr_waiting_close == 0) {
+	soundll->do_close_now = true;
+	gensio_sound_sched_deferred_op(soundll);
+    }
+}
+
+static void
+gensio_sound_alsa_tsched_start(struct sound_info *si)
+{
+    struct gensio_os_funcs *o = si->soundll->o;
+    struct alsa_info *a = si->pinfo;
+    gensio_time timeout;
+    uint64_t period_time;
+
+    /* Check twice a period so we are never a whole period late. */
+    period_time = ((uint64_t) a->period_size * GENSIO_NSECS_IN_SEC /
+		   si->samplerate / 2);
+    timeout.secs = period_time / GENSIO_NSECS_IN_SEC;
+    timeout.nsecs = period_time % GENSIO_NSECS_IN_SEC;
+    assert(o->start_timer(a->tsched_timer, &timeout) == 0);
+}
+
+static void
+gensio_sound_alsa_tsched_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct sound_info *si = cb_data;
+    struct alsa_info *a = si->pinfo;
+    struct sound_ll *soundll = si->soundll;
+    snd_pcm_sframes_t avail;
+
+    gensio_sound_ll_lock(soundll);
+    if (!a->tsched_run)
+	goto out;
+
+    if (si->is_input) {
+    restart:
+	if (soundll->in.ready || soundll->err)
+	    gensio_sound_ll_check_read(soundll);
+	if (a->tsched_run && !soundll->in.ready && !soundll->err) {
+	    gensio_sound_alsa_do_read(&soundll->in);
+	    if (soundll->in.ready || soundll->err)
+		goto restart;
+	}
+    } else if (soundll->write_enabled) {
+	avail = snd_pcm_avail_update(a->pcm);
+	if (avail < 0 || (snd_pcm_uframes_t) avail >= si->bufsize) {
 	    si->ready = true;
+	    gensio_sound_ll_check_write(soundll);
 	}
     }
+
+ out:
+    /* check_read/check_write drop the lock, a close may have come in. */
+    if (a->tsched_run) {
+	gensio_sound_alsa_tsched_start(si);
+    } else if (a->tsched_closing) {
+	a->tsched_closing = false;
+	gensio_sound_alsa_close_one(soundll);
+    }
+    gensio_sound_ll_unlock(soundll);
+}
+
+static void
+gensio_sound_alsa_tsched_stopped(struct gensio_timer *t, void *cb_data)
+{
+    struct sound_info *si = cb_data;
+    struct alsa_info *a = si->pinfo;
+    struct sound_ll *soundll = si->soundll;
+
+    gensio_sound_ll_lock(soundll);
+    if (a->tsched_closing) {
+	a->tsched_closing = false;
+	gensio_sound_alsa_close_one(soundll);
+    }
+    gensio_sound_ll_unlock(soundll);
 }
 
 static void
@@ -406,6 +516,10 @@ gensio_sound_alsa_api_set_read(struct sound_info *si, bool enable)
 	if (a->fds[i].events & POLLERR)
 	    o->set_except_handler(a->iods[i], enable);
     }
+    if (enable && a->tsched && !a->tsched_run) {
+	a->tsched_run = true;
+	gensio_sound_alsa_tsched_start(si);
+    }
     if (enable && !si->ready)
 	gensio_sound_alsa_do_read(si);
 }
@@ -425,6 +539,10 @@ gensio_sound_alsa_api_set_write(struct sound_info *si, bool enable)
 	if (a->fds[i].events & POLLERR)
 	    o->set_except_handler(a->iods[i], enable);
     }
+    if (enable && a->tsched && !a->tsched_run) {
+	a->tsched_run = true;
+	gensio_sound_alsa_tsched_start(si);
+    }
 }
 
 static void
@@ -521,11 +639,7 @@ gensio_sound_alsa_cleared_handler(struct gensio_iod *iod, void *cb_data)
     struct sound_ll *soundll = si->soundll;
 
     gensio_sound_ll_lock(soundll);
-    soundll->nr_waiting_close--;
-    if (soundll->nr_waiting_close == 0) {
-	soundll->do_close_now = true;
-	gensio_sound_sched_deferred_op(soundll);
-    }
+    gensio_sound_alsa_close_one(soundll);
     gensio_sound_ll_unlock(soundll);
 }
 
@@ -559,6 +673,21 @@ gensio_sound_alsa_api_start_close(struct sound_info *si)
     gensio_time timeout;
     snd_pcm_sframes_t frames_left = 0;
     uint64_t drain_time;
+    unsigned int count = a->nrfds;
+    int rv;
+
+    if (a->tsched_run) {
+	a->tsched_run = false;
+	a->tsched_closing = true;
+	/*
+	 * If the timer is already running, the timeout handler will
+	 * see tsched_run is false and finish the close.
+	 */
+	rv = o->stop_timer_with_done(a->tsched_timer,
+				     gensio_sound_alsa_tsched_stopped, si);
+	assert(rv == 0 || rv == GE_TIMEDOUT);
+	count++;
+    }
 
     if (!si->is_input && a->nrfds > 0) {
 	/* Wait for output to drain. */
@@ -570,7 +699,7 @@ gensio_sound_alsa_api_start_close(struct sound_info *si)
     } else if (a->nrfds > 0) {
 	gensio_sound_alsa_timeout(NULL, si);
     }
-    return a->nrfds;
+    return count;
 }
 
 static int
@@ -581,7 +710,10 @@ gensio_sound_alsa_api_write(struct sound_info *out, const unsigned char *buf,
     snd_pcm_sframes_t rv;
 
  retry:
-    rv = snd_pcm_writei(a->pcm, buf, buflen);
+    if (a->mmap)
+	rv = snd_pcm_mmap_writei(a->pcm, buf, buflen);
+    else
+	rv = snd_pcm_writei(a->pcm, buf, buflen);
     if (rv < 0) {
 	if (rv == -EBUSY || rv == -EAGAIN) {
 	    out->ready = false;
@@ -680,6 +812,23 @@ gensio_sound_alsa_api_open_dev(struct sound_info *si)
     return 0;
 }
 
+static int
+gensio_sound_alsa_api_latency(struct sound_info *si, gensiods *period,
+			      gensiods *buffer, long *delay)
+{
+    struct alsa_info *a = si->pinfo;
+    snd_pcm_sframes_t frames = 0;
+
+    if (!a->pcm)
+	return GE_NOTREADY;
+    if (snd_pcm_delay(a->pcm, &frames) < 0)
+	frames = 0;
+    *period = a->period_size;
+    *buffer = a->buffer_size;
+    *delay = frames;
+    return 0;
+}
+
 static int
 gensio_sound_alsa_api_devices(char ***rnames, char ***rspecs, gensiods *rcount)
 {
@@ -787,17 +936,29 @@ gensio_sound_alsa_api_setup(struct gensio_pparm_info *p,
 	return GE_NOMEM;
     }
     a = si->pinfo;
+    a->mmap = io->mmap;
 
     a->close_timer = o->alloc_timer(o, gensio_sound_alsa_timeout, si);
-    if (!a->close_timer) {
-	o->free(o, si->pinfo);
-	si->pinfo = NULL;
-	o->free(o, si->cardname);
-	si->cardname = NULL;
-	return GE_NOMEM;
+    if (!a->close_timer)
+	goto out_nomem;
+
+    if (a->mmap) {
+	a->tsched_timer = o->alloc_timer(o, gensio_sound_alsa_tsched_timeout,
+					 si);
+	if (!a->tsched_timer)
+	    goto out_nomem;
     }
 
     return 0;
+
+ out_nomem:
+    if (a->close_timer)
+	o->free_timer(a->close_timer);
+    o->free(o, si->pinfo);
+    si->pinfo = NULL;
+    o->free(o, si->cardname);
+    si->cardname = NULL;
+    return GE_NOMEM;
 }
 
 static void
@@ -809,6 +970,8 @@ gensio_sound_alsa_api_cleanup(struct sound_info *si)
     if (a) {
 	if (a->close_timer)
 	    o->free_timer(a->close_timer);
+	if (a->tsched_timer)
+	    o->free_timer(a->tsched_timer);
 	o->free(o, a);
 	si->pinfo = NULL;
     }
@@ -826,6 +989,7 @@ static struct sound_type alsa_sound_type = {
     .set_read_enable = gensio_sound_alsa_api_set_read,
     .start_close = gensio_sound_alsa_api_start_close,
     .drain_count = gensio_sound_alsa_drain_count,
+    .latency = gensio_sound_alsa_api_latency,
     .devices = gensio_sound_alsa_api_devices
 };
 
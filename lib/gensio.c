@@ -22,10 +22,13 @@
 #include <gensio/gensio_list.h>
 #include <gensio/gensio_time.h>
 #include <gensio/gensio_osops.h>
+#include <gensio_probes.h>
 
 #include "gensio_net.h"
 
 static void check_flush_sync_io(struct gensio *io);
+static bool gensio_wref_run(struct gensio *io);
+static void gensio_wref_fail(struct gensio *io, int err);
 
 struct gensio_classobj {
     const char *name;
@@ -85,7 +88,7 @@ struct gensio {
 
     struct gensio_frdata *frdata;
 
-    const char *typename;
+    const char *type_name;
 
     struct gensio *child;
 
@@ -99,6 +102,32 @@ struct gensio {
 
     struct gensio_sync_io *sync_io;
 
+    /* The counters for this gensio's type, NULL until fully allocated. */
+    struct gensio_type_metrics *metrics;
+
+    /* Where the struct came from, see gensio_setup_zalloc(). */
+    struct gensio_arena *arena;
+
+    /*
+     * Buffers from gensio_write_ref() not written yet, and how many
+     * bytes are in them.  The write callback is on while there are
+     * any, write_cb_enabled is what the user set it to.
+     */
+    struct gensio_list wrefs;
+    gensiods wref_inflight;
+    gensiods wref_max;
+    bool wref_running;
+    bool write_cb_enabled;
+
+    struct gensio_link link;
+};
+
+struct gensio_wref {
+    const unsigned char *buf;
+    gensiods len;
+    gensiods pos;
+    gensio_write_done done;
+    void *done_data;
     struct gensio_link link;
 };
 
@@ -108,6 +137,127 @@ static struct gensio_lock *gensio_base_lock;
 static int gensio_base_init_rv;
 static gensiods num_alloced_gensios;
 
+/*
+ * Per-type counters.  Entries are added under gensio_base_lock and
+ * never removed until gensio_cleanup_mem(), so they can be walked
+ * without a lock.  The data counters are only kept while something
+ * has enabled them, they are updated with atomics so no gensio's
+ * lock is needed to collect them.
+ */
+static struct gensio_type_metrics *type_metrics;
+static unsigned int metrics_enabled;
+
+static struct gensio_type_metrics *
+gensio_find_type_metrics(const char *type_name)
+{
+    struct gensio_type_metrics *m;
+    gensiods len;
+
+    for (m = type_metrics; m; m = m->next) {
+	if (strcmp(m->type_name, type_name) == 0)
+	    return m;
+    }
+
+    len = strlen(type_name) + 1;
+    m = o_base->zalloc(o_base, sizeof(*m) + len);
+    if (!m)
+	return NULL;
+    memcpy(m + 1, type_name, len);
+    m->type_name = (const char *) (m + 1);
+    m->next = type_metrics;
+#if HAVE_GCC_ATOMICS
+    __atomic_store_n(&type_metrics, m, __ATOMIC_RELEASE);
+#else
+    type_metrics = m;
+#endif
+    return m;
+}
+
+static bool
+gensio_metrics_on(struct gensio *io)
+{
+    if (!io->metrics)
+	return false;
+#if HAVE_GCC_ATOMICS
+    return __atomic_load_n(&metrics_enabled, __ATOMIC_RELAXED);
+#else
+    return metrics_enabled;
+#endif
+}
+
+static void
+gensio_metrics_add(gensiods *v, gensiods n)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(v, n, __ATOMIC_RELAXED);
+#else
+    o_base->lock(gensio_base_lock);
+    *v += n;
+    o_base->unlock(gensio_base_lock);
+#endif
+}
+
+static gensiods
+gensio_metrics_get(gensiods *v)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+#else
+    gensiods rv;
+
+    o_base->lock(gensio_base_lock);
+    rv = *v;
+    o_base->unlock(gensio_base_lock);
+    return rv;
+#endif
+}
+
+void
+gensio_metrics_enable(bool enable)
+{
+    if (!o_base)
+	return;
+
+    o_base->lock(gensio_base_lock);
+    if (enable)
+	metrics_enabled++;
+    else if (metrics_enabled > 0)
+	metrics_enabled--;
+    o_base->unlock(gensio_base_lock);
+}
+
+int
+gensio_metrics_iterate(int (*cb)(const struct gensio_type_metrics *m,
+				 void *cb_data),
+		       void *cb_data)
+{
+    struct gensio_type_metrics *m, copy;
+    int rv = 0;
+
+    if (!o_base)
+	return 0;
+
+#if HAVE_GCC_ATOMICS
+    m = __atomic_load_n(&type_metrics, __ATOMIC_ACQUIRE);
+#else
+    o_base->lock(gensio_base_lock);
+    m = type_metrics;
+    o_base->unlock(gensio_base_lock);
+#endif
+    for (; m && !rv; m = m->next) {
+	memset(&copy, 0, sizeof(copy));
+	copy.type_name = m->type_name;
+	copy.alloced = gensio_metrics_get(&m->alloced);
+	copy.freed = gensio_metrics_get(&m->freed);
+	copy.reads = gensio_metrics_get(&m->reads);
+	copy.read_bytes = gensio_metrics_get(&m->read_bytes);
+	copy.writes = gensio_metrics_get(&m->writes);
+	copy.write_bytes = gensio_metrics_get(&m->write_bytes);
+	rv = cb(&copy, cb_data);
+    }
+    return rv;
+}
+
 gensiods
 gensio_num_alloced(void)
 {
@@ -138,30 +288,33 @@ struct gensio *
 gensio_data_alloc(struct gensio_os_funcs *o,
 		  gensio_event cb, void *user_data,
 		  gensio_func func, struct gensio *child,
-		  const char *typename, void *gensio_data)
+		  const char *type_name, void *gensio_data)
 {
     struct gensio *io;
+    struct gensio_arena *arena;
 
     o->call_once(o, &gensio_base_initialized, gensio_base_init, o);
     if (gensio_base_init_rv)
 	return NULL;
 
-    io = o->zalloc(o, sizeof(*io));
+    io = gensio_setup_zalloc(o, sizeof(*io), &arena);
     if (!io)
 	return NULL;
+    io->arena = arena;
     io->refcount = 1;
 
     io->lock = o->alloc_lock(o);
     if (!io->lock) {
-	o->free(o, io);
+	gensio_setup_free(o, arena, io);
 	return NULL;
     }
     gensio_list_init(&io->waiters);
+    gensio_list_init(&io->wrefs);
     io->o = o;
     io->cb = cb;
     io->user_data = user_data;
     io->func = func;
-    io->typename = typename;
+    io->type_name = type_name;
     io->gensio_data = gensio_data;
     io->child = child;
 
@@ -182,7 +335,11 @@ gensio_data_alloc(struct gensio_os_funcs *o,
 
     o_base->lock(gensio_base_lock);
     num_alloced_gensios++;
+    if (type_name)
+	io->metrics = gensio_find_type_metrics(type_name);
     o_base->unlock(gensio_base_lock);
+    if (io->metrics)
+	gensio_metrics_add(&io->metrics->alloced, 1);
 
     return io;
 }
@@ -193,6 +350,7 @@ gensio_data_free(struct gensio *io)
     assert(gensio_list_empty(&io->waiters));
 
     gensio_clear_sync(io);
+    gensio_wref_fail(io, GE_LOCALCLOSED);
 
     if (io->frdata && io->frdata->freed)
 	io->frdata->freed(io, io->frdata);
@@ -205,8 +363,10 @@ gensio_data_free(struct gensio *io)
 	io->classes = c->next;
 	io->o->free(io->o, c);
     }
+    if (io->metrics)
+	gensio_metrics_add(&io->metrics->freed, 1);
     io->o->free_lock(io->lock);
-    io->o->free(io->o, io);
+    gensio_setup_free(io->o, io->arena, io);
 
     o_base->lock(gensio_base_lock);
     num_alloced_gensios--;
@@ -219,6 +379,34 @@ gensio_get_gensio_data(struct gensio *io)
     return io->gensio_data;
 }
 
+struct gensio_arena *
+gensio_get_arena(struct gensio *io)
+{
+    return io->arena;
+}
+
+bool
+gensio_can_absorb(struct gensio *io, gensio_func func)
+{
+    unsigned int refcount;
+
+#if HAVE_GCC_ATOMICS
+    refcount = __atomic_load_n(&io->refcount, __ATOMIC_ACQUIRE);
+#else
+    io->o->lock(io->lock);
+    refcount = io->refcount;
+    io->o->unlock(io->lock);
+#endif
+    return (io->func == func && refcount == 1 && !io->classes &&
+	    !io->frdata && !io->sync_io);
+}
+
+void
+gensio_set_child(struct gensio *io, struct gensio *child)
+{
+    io->child = child;
+}
+
 gensio_event
 gensio_get_cb(struct gensio *io)
 {
@@ -232,12 +420,22 @@ gensio_cb(struct gensio *io, int event, int err,
     struct gensio_os_funcs *o = io->o;
     int rv;
 
+    if (event == GENSIO_EVENT_WRITE_READY && gensio_wref_run(io))
+	/* The user didn't ask for it, it was just for the queue. */
+	return 0;
     if (!io->cb)
 	return GE_NOTSUP;
     o->lock(io->lock);
     io->cb_count++;
     o->unlock(io->lock);
+    GENSIO_PROBE4(event, io, event, err, buflen ? *buflen : 0);
     rv = io->cb(io, io->user_data, event, err, buf, buflen, auxdata);
+    GENSIO_PROBE4(event_done, io, event, rv, buflen ? *buflen : 0);
+    if (event == GENSIO_EVENT_READ && !err && buflen &&
+		gensio_metrics_on(io)) {
+	gensio_metrics_add(&io->metrics->reads, 1);
+	gensio_metrics_add(&io->metrics->read_bytes, *buflen);
+    }
     o->lock(io->lock);
     assert(io->cb_count > 0);
     io->cb_count--;
@@ -335,7 +533,7 @@ struct gensio_accepter {
 
     struct gensio_acc_frdata *frdata;
 
-    const char *typename;
+    const char *type_name;
 
     struct gensio_accepter *child;
 
@@ -362,7 +560,7 @@ struct gensio_accepter *
 gensio_acc_data_alloc(struct gensio_os_funcs *o,
 		      gensio_accepter_event cb, void *user_data,
 		      gensio_acc_func func, struct gensio_accepter *child,
-		      const char *typename, void *gensio_acc_data)
+		      const char *type_name, void *gensio_acc_data)
 {
     struct gensio_accepter *acc = o->zalloc(o, sizeof(*acc));
 
@@ -378,7 +576,7 @@ gensio_acc_data_alloc(struct gensio_os_funcs *o,
     acc->cb = cb;
     acc->user_data = user_data;
     acc->func = func;
-    acc->typename = typename;
+    acc->type_name = type_name;
     acc->child = child;
     acc->gensio_acc_data = gensio_acc_data;
     gensio_list_init(&acc->pending_ios);
@@ -487,7 +685,7 @@ gensio_acc_get_type(struct gensio_accepter *acc, unsigned int depth)
 	depth--;
 	c = c->child;
     }
-    return c->typename;
+    return c->type_name;
 }
 
 void
@@ -555,12 +753,20 @@ gensio_call_func(struct gensio *io, int func, gensiods *count,
     return io->func(io, func, count, cbuf, buflen, buf, auxdata);
 }
 
+static void
+gensio_count_write(struct gensio *io, gensiods count)
+{
+    gensio_metrics_add(&io->metrics->writes, 1);
+    gensio_metrics_add(&io->metrics->write_bytes, count);
+}
+
 int
 gensio_write(struct gensio *io, gensiods *count,
 	     const void *buf, gensiods buflen,
 	     const char *const *auxdata)
 {
     struct gensio_sg sg;
+    int rv;
 
     if (buflen == 0) {
 	if (count)
@@ -569,7 +775,12 @@ gensio_write(struct gensio *io, gensiods *count,
     }
     sg.buf = buf;
     sg.buflen = buflen;
-    return io->func(io, GENSIO_FUNC_WRITE_SG, count, &sg, 1, NULL, auxdata);
+    gensio_alloc_datapath_enter();
+    rv = io->func(io, GENSIO_FUNC_WRITE_SG, count, &sg, 1, NULL, auxdata);
+    gensio_alloc_datapath_exit();
+    if (!rv && count && gensio_metrics_on(io))
+	gensio_count_write(io, *count);
+    return rv;
 }
 
 int
@@ -577,12 +788,161 @@ gensio_write_sg(struct gensio *io, gensiods *count,
 		const struct gensio_sg *sg, gensiods sglen,
 		const char *const *auxdata)
 {
+    int rv;
+
     if (sglen == 0) {
 	if (count)
 	    *count = 0;
 	return 0;
     }
-    return io->func(io, GENSIO_FUNC_WRITE_SG, count, sg, sglen, NULL, auxdata);
+    gensio_alloc_datapath_enter();
+    rv = io->func(io, GENSIO_FUNC_WRITE_SG, count, sg, sglen, NULL, auxdata);
+    gensio_alloc_datapath_exit();
+    if (!rv && count && gensio_metrics_on(io))
+	gensio_count_write(io, *count);
+    return rv;
+}
+
+/*
+ * Fail all the queued write buffers, called when the gensio can't
+ * write any more.
+ */
+static void
+gensio_wref_fail(struct gensio *io, int err)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_list fail;
+    struct gensio_link *l, *l2;
+
+    gensio_list_init(&fail);
+    o->lock(io->lock);
+    gensio_list_for_each_safe(&io->wrefs, l, l2) {
+	gensio_list_rm(&io->wrefs, l);
+	gensio_list_add_tail(&fail, l);
+    }
+    io->wref_inflight = 0;
+    o->unlock(io->lock);
+
+    gensio_list_for_each_safe(&fail, l, l2) {
+	struct gensio_wref *w = gensio_container_of(l, struct gensio_wref,
+						    link);
+
+	gensio_list_rm(&fail, l);
+	w->done(io, err, w->done_data);
+	o->free(o, w);
+    }
+}
+
+/*
+ * Write what we can of the queued buffers from a write ready event.
+ * Returns true if the user doesn't want the write ready event.
+ */
+static bool
+gensio_wref_run(struct gensio *io)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_link *l;
+    struct gensio_wref *w;
+    gensiods count;
+    bool user_cb;
+    int err;
+
+    o->lock(io->lock);
+    if (gensio_list_empty(&io->wrefs) || io->wref_running) {
+	o->unlock(io->lock);
+	return false;
+    }
+    io->wref_running = true;
+    while (!gensio_list_empty(&io->wrefs)) {
+	l = gensio_list_first(&io->wrefs);
+	w = gensio_container_of(l, struct gensio_wref, link);
+	if (w->pos < w->len) {
+	    o->unlock(io->lock);
+	    err = gensio_write(io, &count, w->buf + w->pos, w->len - w->pos,
+			       NULL);
+	    if (err) {
+		gensio_wref_fail(io, err);
+		o->lock(io->lock);
+		break;
+	    }
+	    o->lock(io->lock);
+	    w->pos += count;
+	    io->wref_inflight -= count;
+	    if (w->pos < w->len)
+		break; /* Wait for the next write ready. */
+	}
+	gensio_list_rm(&io->wrefs, l);
+	o->unlock(io->lock);
+	w->done(io, 0, w->done_data);
+	o->free(o, w);
+	o->lock(io->lock);
+    }
+    io->wref_running = false;
+    user_cb = io->write_cb_enabled;
+    if (gensio_list_empty(&io->wrefs) && !user_cb) {
+	o->unlock(io->lock);
+	io->func(io, GENSIO_FUNC_SET_WRITE_CALLBACK, NULL, NULL, false, NULL,
+		 NULL);
+    } else {
+	o->unlock(io->lock);
+    }
+    return !user_cb;
+}
+
+int
+gensio_write_ref(struct gensio *io, const void *buf, gensiods buflen,
+		 gensio_write_done done, void *done_data)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_wref *w;
+    bool start;
+
+    if (!done || !buflen)
+	return GE_INVAL;
+
+    w = o->zalloc(o, sizeof(*w));
+    if (!w)
+	return GE_NOMEM;
+    w->buf = buf;
+    w->len = buflen;
+    w->done = done;
+    w->done_data = done_data;
+
+    o->lock(io->lock);
+    if (io->wref_max && io->wref_inflight + buflen > io->wref_max) {
+	o->unlock(io->lock);
+	o->free(o, w);
+	return buflen > io->wref_max ? GE_TOOBIG : GE_INUSE;
+    }
+    start = gensio_list_empty(&io->wrefs);
+    gensio_list_add_tail(&io->wrefs, &w->link);
+    io->wref_inflight += buflen;
+    o->unlock(io->lock);
+
+    /* The writing is all done from the write ready handler. */
+    if (start)
+	io->func(io, GENSIO_FUNC_SET_WRITE_CALLBACK, NULL, NULL, true, NULL,
+		 NULL);
+    return 0;
+}
+
+void
+gensio_write_ref_set_max(struct gensio *io, gensiods max)
+{
+    io->o->lock(io->lock);
+    io->wref_max = max;
+    io->o->unlock(io->lock);
+}
+
+gensiods
+gensio_write_ref_inflight(struct gensio *io)
+{
+    gensiods rv;
+
+    io->o->lock(io->lock);
+    rv = io->wref_inflight;
+    io->o->unlock(io->lock);
+    return rv;
 }
 
 int
@@ -744,6 +1104,108 @@ gensio_control(struct gensio *io, int depth, bool get,
     return c->func(c, GENSIO_FUNC_CONTROL, datalen, &get, option, data, NULL);
 }
 
+struct gensio_rbuf {
+    struct gensio_os_funcs *o;
+#if !HAVE_GCC_ATOMICS
+    struct gensio_lock *lock;
+#endif
+    unsigned int refcount;
+    unsigned char *mem;
+    unsigned char *data;
+    gensiods len;
+};
+
+struct gensio_rbuf *
+gensio_rbuf_alloc(struct gensio_os_funcs *o, unsigned char *mem,
+		  unsigned char *data, gensiods len)
+{
+    struct gensio_rbuf *rbuf;
+
+    rbuf = o->zalloc(o, sizeof(*rbuf));
+    if (!rbuf)
+	return NULL;
+#if !HAVE_GCC_ATOMICS
+    rbuf->lock = o->alloc_lock(o);
+    if (!rbuf->lock) {
+	o->free(o, rbuf);
+	return NULL;
+    }
+#endif
+    rbuf->o = o;
+    rbuf->refcount = 1;
+    rbuf->mem = mem;
+    rbuf->data = data;
+    rbuf->len = len;
+    return rbuf;
+}
+
+int
+gensio_take_read_buf(struct gensio *io,
+		     const unsigned char *buf, gensiods buflen,
+		     struct gensio_rbuf **rbuf)
+{
+    struct gensio_take_read_buf d;
+    gensiods len = sizeof(d);
+    int rv;
+
+    d.buf = buf;
+    d.buflen = buflen;
+    d.rbuf = NULL;
+    rv = gensio_control(io, GENSIO_CONTROL_DEPTH_FIRST, GENSIO_CONTROL_GET,
+			GENSIO_CONTROL_TAKE_READ_BUF, (char *) &d, &len);
+    if (rv == GE_NOTFOUND)
+	rv = GE_NOTSUP;
+    if (!rv)
+	*rbuf = d.rbuf;
+    return rv;
+}
+
+unsigned char *
+gensio_rbuf_data(struct gensio_rbuf *rbuf)
+{
+    return rbuf->data;
+}
+
+gensiods
+gensio_rbuf_len(struct gensio_rbuf *rbuf)
+{
+    return rbuf->len;
+}
+
+void
+gensio_rbuf_ref(struct gensio_rbuf *rbuf)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(&rbuf->refcount, 1, __ATOMIC_SEQ_CST);
+#else
+    rbuf->o->lock(rbuf->lock);
+    rbuf->refcount++;
+    rbuf->o->unlock(rbuf->lock);
+#endif
+}
+
+void
+gensio_rbuf_deref(struct gensio_rbuf *rbuf)
+{
+    struct gensio_os_funcs *o = rbuf->o;
+    unsigned int count;
+
+#if HAVE_GCC_ATOMICS
+    count = __atomic_sub_fetch(&rbuf->refcount, 1, __ATOMIC_SEQ_CST);
+#else
+    o->lock(rbuf->lock);
+    count = --rbuf->refcount;
+    o->unlock(rbuf->lock);
+#endif
+    if (count > 0)
+	return;
+#if !HAVE_GCC_ATOMICS
+    o->free_lock(rbuf->lock);
+#endif
+    gensio_os_buf_free(o, rbuf->mem);
+    o->free(o, rbuf);
+}
+
 const char *
 gensio_get_type(struct gensio *io, unsigned int depth)
 {
@@ -755,7 +1217,7 @@ gensio_get_type(struct gensio *io, unsigned int depth)
 	depth--;
 	c = c->child;
     }
-    return c->typename;
+    return c->type_name;
 }
 
 struct gensio *
@@ -779,8 +1241,10 @@ gensio_close(struct gensio *io, gensio_done close_done, void *close_data)
 
     rv = io->func(io, GENSIO_FUNC_CLOSE, NULL, close_done, 0, close_data,
 		  NULL);
-    if (!rv)
+    if (!rv) {
 	check_flush_sync_io(io);
+	gensio_wref_fail(io, GE_LOCALCLOSED);
+    }
     return rv;
 }
 
@@ -815,6 +1279,132 @@ gensio_close_s(struct gensio *io)
     return err;
 }
 
+/*
+ * Everything for gensio_close_multiple() is in one piece, the
+ * gensios all report to it and only the last one does anything.
+ */
+struct gensio_close_multi {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_runner *runner;
+    gensiods pending;
+    bool free_ios;
+    gensio_multi_done close_done;
+    void *close_data;
+};
+
+static void
+gensio_close_multi_finish(struct gensio_close_multi *m)
+{
+    struct gensio_os_funcs *o = m->o;
+
+    if (m->close_done)
+	m->close_done(o, m->close_data);
+    o->free_runner(m->runner);
+    o->free_lock(m->lock);
+    o->free(o, m);
+}
+
+static void
+gensio_close_multi_runner(struct gensio_runner *runner, void *cb_data)
+{
+    gensio_close_multi_finish(cb_data);
+}
+
+/* Returns true if this was the last one. */
+static bool
+gensio_close_multi_deref(struct gensio_close_multi *m)
+{
+    gensiods count;
+
+    m->o->lock(m->lock);
+    count = --m->pending;
+    m->o->unlock(m->lock);
+    return count == 0;
+}
+
+static void
+gensio_close_multi_done(struct gensio *io, void *cb_data)
+{
+    struct gensio_close_multi *m = cb_data;
+
+    if (m->free_ios)
+	gensio_free(io);
+    if (gensio_close_multi_deref(m))
+	gensio_close_multi_finish(m);
+}
+
+static void
+gensio_close_multi_s_done(struct gensio_os_funcs *o, void *cb_data)
+{
+    struct gensio_close_s_data *data = cb_data;
+
+    o->wake(data->waiter);
+}
+
+int
+gensio_close_multiple(struct gensio_os_funcs *o,
+		      struct gensio **ios, gensiods count, bool free_ios,
+		      gensio_multi_done close_done, void *close_data)
+{
+    struct gensio_close_multi *m;
+    gensiods i;
+
+    m = o->zalloc(o, sizeof(*m));
+    if (!m)
+	return GE_NOMEM;
+    m->o = o;
+    m->lock = o->alloc_lock(o);
+    if (!m->lock)
+	goto out_nomem;
+    m->runner = o->alloc_runner(o, gensio_close_multi_runner, m);
+    if (!m->runner)
+	goto out_nomem;
+    m->free_ios = free_ios;
+    m->close_done = close_done;
+    m->close_data = close_data;
+
+    /* Hold one for ourself so it can't finish while we are starting. */
+    m->pending = count + 1;
+    for (i = 0; i < count; i++) {
+	if (gensio_close(ios[i], gensio_close_multi_done, m) == 0)
+	    continue;
+	/* Already closed or closing, nothing to wait for. */
+	if (free_ios)
+	    gensio_free(ios[i]);
+	gensio_close_multi_deref(m);
+    }
+    if (gensio_close_multi_deref(m))
+	/* Don't call the done from here, the user may hold locks. */
+	o->run(m->runner);
+    return 0;
+
+ out_nomem:
+    if (m->lock)
+	o->free_lock(m->lock);
+    o->free(o, m);
+    return GE_NOMEM;
+}
+
+int
+gensio_close_multiple_s(struct gensio_os_funcs *o,
+			struct gensio **ios, gensiods count, bool free_ios)
+{
+    struct gensio_close_s_data data;
+    int err;
+
+    data.o = o;
+    data.waiter = o->alloc_waiter(o);
+    if (!data.waiter)
+	return GE_NOMEM;
+    err = gensio_close_multiple(o, ios, count, free_ios,
+				gensio_close_multi_s_done, &data);
+    if (!err)
+	o->wait(data.waiter, 1, NULL);
+    o->free_waiter(data.waiter);
+    return err;
+}
+
 void
 gensio_disable(struct gensio *io)
 {
@@ -829,12 +1419,17 @@ gensio_disable(struct gensio *io)
 void
 gensio_free(struct gensio *io)
 {
-    struct gensio_os_funcs *o = io->o;
     unsigned int count;
 
+#if HAVE_GCC_ATOMICS
+    count = __atomic_sub_fetch(&io->refcount, 1, __ATOMIC_ACQ_REL);
+#else
+    struct gensio_os_funcs *o = io->o;
+
     o->lock(io->lock);
     count = --io->refcount;
     o->unlock(io->lock);
+#endif
     if (count == 0) {
 	check_flush_sync_io(io);
 	io->func(io, GENSIO_FUNC_FREE, NULL, NULL, 0, NULL, NULL);
@@ -851,6 +1446,12 @@ gensio_set_read_callback_enable(struct gensio *io, bool enabled)
 void
 gensio_set_write_callback_enable(struct gensio *io, bool enabled)
 {
+    io->o->lock(io->lock);
+    io->write_cb_enabled = enabled;
+    /* Keep it on while gensio_write_ref() has data queued. */
+    if (!gensio_list_empty(&io->wrefs))
+	enabled = true;
+    io->o->unlock(io->lock);
     io->func(io, GENSIO_FUNC_SET_WRITE_CALLBACK, NULL, NULL, enabled, NULL,
 	     NULL);
 }
@@ -858,11 +1459,15 @@ gensio_set_write_callback_enable(struct gensio *io, bool enabled)
 void
 gensio_ref(struct gensio *io)
 {
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(&io->refcount, 1, __ATOMIC_RELAXED);
+#else
     struct gensio_os_funcs *o = io->o;
 
     o->lock(io->lock);
     io->refcount++;
     o->unlock(io->lock);
+#endif
 }
 
 bool
@@ -1219,7 +1824,7 @@ gensio_acc_str_to_gensio(struct gensio_accepter *accepter, const char *addr,
 bool
 gensio_acc_exit_on_close(struct gensio_accepter *accepter)
 {
-    return strcmp(accepter->typename, "stdio") == 0;
+    return strcmp(accepter->type_name, "stdio") == 0;
 }
 
 bool
@@ -1275,25 +1880,89 @@ struct registered_gensio_accepter {
     str_to_gensio_acc_handler handler;
     gensio_terminal_acc_alloch terminal_alloc;
     gensio_filter_acc_alloch filter_alloc;
+    unsigned int hash;
     struct registered_gensio_accepter *next;
 };
 
 static struct gensio_os_funcs *reg_o;
 
-static struct registered_gensio *reg_gensios;
+/*
+ * The registries are hashed by name.  Entries are only added (at the
+ * head of a bucket, so a later registration overrides an earlier one)
+ * and are not removed until gensio_cleanup_mem(), so the lock is only
+ * taken by writers.  Readers walk the buckets without a lock, the
+ * bucket head is published with release semantics after the entry is
+ * filled in.  Without GCC atomics the readers take the lock, too.
+ */
+#define REG_GENSIO_HASH_SIZE 64
+
+static struct registered_gensio *reg_gensios[REG_GENSIO_HASH_SIZE];
 static struct gensio_lock *reg_gensio_lock;
 
-static struct registered_gensio_accepter *reg_gensio_accs;
+static struct registered_gensio_accepter *reg_gensio_accs[REG_GENSIO_HASH_SIZE];
 static struct gensio_lock *reg_gensio_acc_lock;
 
+static unsigned int
+reg_name_hash(const char *s, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    while (len--)
+	h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+/* The length of the gensio name at the start of a gensio string. */
+static size_t
+reg_name_len(const char *str)
+{
+    return strcspn(str, ",(");
+}
+
+static struct registered_gensio_accepter *
+reg_gensio_acc_find(const char *name, size_t len)
+{
+    unsigned int hash = reg_name_hash(name, len);
+    struct registered_gensio_accepter *r;
+
+#if HAVE_GCC_ATOMICS
+    r = __atomic_load_n(&reg_gensio_accs[hash % REG_GENSIO_HASH_SIZE],
+			__ATOMIC_ACQUIRE);
+#else
+    reg_o->lock(reg_gensio_acc_lock);
+    r = reg_gensio_accs[hash % REG_GENSIO_HASH_SIZE];
+#endif
+    for (; r; r = r->next) {
+	if (r->hash == hash && strncmp(r->name, name, len) == 0 &&
+		!r->name[len])
+	    break;
+    }
+#if !HAVE_GCC_ATOMICS
+    reg_o->unlock(reg_gensio_acc_lock);
+#endif
+    return r;
+}
+
 static struct gensio_class_cleanup *cleanups;
 static struct gensio_lock *cleanups_lock;
 
 static struct gensio_once gensio_str_initialized;
 static int reg_gensio_rv;
 
+/*
+ * Builtin gensios are initialized on first lookup of one of their
+ * names, not all at startup.  builtin_lock serializes the inits and
+ * each builtin's builtin_loaded_<name> tracks whether it has been
+ * done.  While a builtin is being initialized its registrations go at
+ * the end of the hash buckets so they don't override anything the
+ * user already registered with the same name.
+ */
+static struct gensio_lock *builtin_lock;
+static bool reg_builtin_loading;
+
 #define INIT_GENSIO(name)				\
-    int gensio_init_##name(struct gensio_os_funcs *o);
+    int gensio_init_##name(struct gensio_os_funcs *o);	\
+    static bool builtin_loaded_##name
 #include "builtin_gensios.h"
 #undef INIT_GENSIO
 
@@ -1319,15 +1988,44 @@ add_default_gensios(void *cb_data)
 	reg_gensio_rv = GE_NOMEM;
 	return;
     }
+    builtin_lock = o->alloc_lock(o);
+    if (!builtin_lock) {
+	reg_gensio_rv = GE_NOMEM;
+	return;
+    }
+}
 
-#define INIT_GENSIO(name)				\
-    do {						\
-	reg_gensio_rv = gensio_init_##name(o);		\
-	if (reg_gensio_rv)				\
-	    return;					\
+/*
+ * Initialize the builtin gensio named modname, if there is one and it
+ * hasn't been done yet.  Returns true if something new was registered.
+ */
+static bool
+gensio_builtin_load(struct gensio_os_funcs *o, const char *modname)
+{
+    bool rv = false;
+
+    o->lock(builtin_lock);
+    reg_builtin_loading = true;
+#define INIT_GENSIO(name)						\
+    do {								\
+	if (!builtin_loaded_##name && strcmp(modname, #name) == 0) {	\
+	    int err;							\
+								\
+	    builtin_loaded_##name = true;				\
+	    err = gensio_init_##name(o);				\
+	    if (err)							\
+		gensio_log(o, GENSIO_LOG_ERR,				\
+			   "Unable to initialize gensio %s: %s",	\
+			   #name, gensio_err_to_str(err));		\
+	    rv = true;							\
+	}								\
     } while(0)
 #include "builtin_gensios.h"
 #undef INIT_GENSIO
+    reg_builtin_loading = false;
+    o->unlock(builtin_lock);
+
+    return rv;
 }
 
 int
@@ -1351,9 +2049,28 @@ register_base_gensio_accepter(struct gensio_os_funcs *o,
     n->handler = handler;
     n->terminal_alloc = terminal_alloc;
     n->filter_alloc = filter_alloc;
+    n->hash = reg_name_hash(name, strlen(name));
     o->lock(reg_gensio_acc_lock);
-    n->next = reg_gensio_accs;
-    reg_gensio_accs = n;
+    if (reg_builtin_loading) {
+	struct registered_gensio_accepter **p;
+
+	p = &reg_gensio_accs[n->hash % REG_GENSIO_HASH_SIZE];
+	while (*p)
+	    p = &(*p)->next;
+#if HAVE_GCC_ATOMICS
+	__atomic_store_n(p, n, __ATOMIC_RELEASE);
+#else
+	*p = n;
+#endif
+    } else {
+	n->next = reg_gensio_accs[n->hash % REG_GENSIO_HASH_SIZE];
+#if HAVE_GCC_ATOMICS
+	__atomic_store_n(&reg_gensio_accs[n->hash % REG_GENSIO_HASH_SIZE], n,
+			 __ATOMIC_RELEASE);
+#else
+	reg_gensio_accs[n->hash % REG_GENSIO_HASH_SIZE] = n;
+#endif
+    }
     o->unlock(reg_gensio_acc_lock);
     return 0;
 }
@@ -1394,10 +2111,83 @@ gensio_loadlib(struct gensio_os_funcs *o, const char *str)
 	strncpy(name, "net", sizeof(name));
     if (strcmp(name, "dev") == 0 || strcmp(name, "sdev") == 0)
 	strncpy(name, "serialdev", sizeof(name));
+    if (strcmp(name, "sink") == 0)
+	strncpy(name, "source", sizeof(name));
 
+    if (gensio_builtin_load(o, name))
+	return true;
     return gensio_os_loadlib(o, name);
 }
 
+/*
+ * Options handled generically for all accepters, they are taken out
+ * of the arguments and set with controls after the accepter is
+ * allocated.
+ */
+static const struct {
+    const char *name;
+    unsigned int option;
+} acc_admit_opts[] = {
+    { "maxconn", GENSIO_ACC_CONTROL_MAXCONN },
+    { "acceptrate", GENSIO_ACC_CONTROL_ACCEPTRATE },
+};
+#define NR_ACC_ADMIT_OPTS \
+    (sizeof(acc_admit_opts) / sizeof(acc_admit_opts[0]))
+
+struct acc_admit_vals {
+    char val[NR_ACC_ADMIT_OPTS][16];
+};
+
+static int
+acc_admit_args_take(struct gensio_os_funcs *o, const char **args,
+		    struct acc_admit_vals *vals)
+{
+    unsigned int i, j, k;
+    const char *val;
+    int err = 0;
+
+    memset(vals, 0, sizeof(*vals));
+    if (!args)
+	return 0;
+
+    for (i = 0, j = 0; args[i]; i++) {
+	for (k = 0; k < NR_ACC_ADMIT_OPTS; k++) {
+	    if (gensio_check_keyvalue(args[i], acc_admit_opts[k].name,
+				      &val) > 0)
+		break;
+	}
+	if (k == NR_ACC_ADMIT_OPTS || strlen(val) >= sizeof(vals->val[k])) {
+	    if (k != NR_ACC_ADMIT_OPTS)
+		err = GE_INVAL;
+	    args[j++] = args[i];
+	    continue;
+	}
+	strcpy(vals->val[k], val);
+	o->free(o, (void *) args[i]);
+    }
+    args[j] = NULL;
+
+    return err;
+}
+
+static int
+acc_admit_args_apply(struct gensio_accepter *acc,
+		     struct acc_admit_vals *vals)
+{
+    unsigned int k;
+    int err;
+
+    for (k = 0; k < NR_ACC_ADMIT_OPTS; k++) {
+	if (!vals->val[k][0])
+	    continue;
+	err = gensio_acc_control(acc, 0, false, acc_admit_opts[k].option,
+				 vals->val[k], NULL);
+	if (err)
+	    return err;
+    }
+    return 0;
+}
+
 int
 str_to_gensio_accepter(const char *str,
 		       struct gensio_os_funcs *o,
@@ -1409,6 +2199,7 @@ str_to_gensio_accepter(const char *str,
     int protocol = 0;
     const char **args = NULL;
     struct registered_gensio_accepter *r;
+    struct acc_admit_vals admit;
     size_t len;
     bool retried = false;
 
@@ -1418,20 +2209,24 @@ str_to_gensio_accepter(const char *str,
 
     while (isspace(*str))
 	str++;
+    len = reg_name_len(str);
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != ',' && str[len] != '(' && str[len]))
-	    continue;
-
+    r = reg_gensio_acc_find(str, len);
+    if (r) {
 	str += len;
 	err = gensio_scan_args(o, &str, NULL, &args);
+	if (!err)
+	    err = acc_admit_args_take(o, args, &admit);
 	if (!err) {
 	    while (isspace(*str))
 		str++;
 	    err = r->handler(str, args, o, cb, user_data, accepter);
 	}
+	if (!err) {
+	    err = acc_admit_args_apply(*accepter, &admit);
+	    if (err)
+		gensio_acc_free(*accepter);
+	}
 	if (args)
 	    gensio_argv_free(o, args);
 	return err;
@@ -1451,6 +2246,10 @@ str_to_gensio_accepter(const char *str,
 	    GENSIO_DECLARE_PPACCEPTER(p, o, cb, "base", user_data);
 	    gensio_pparm_log(&p, "Unknown gensio type: %s", str);
 	} else {
+	    err = acc_admit_args_take(o, args, &admit);
+	    if (err)
+		goto out_free_addr;
+
 	    if (protocol == GENSIO_NET_PROTOCOL_UDP) {
 		err = gensio_terminal_acc_alloc("udp", ai, args, o, cb,
 						user_data, accepter);
@@ -1463,7 +2262,13 @@ str_to_gensio_accepter(const char *str,
 	    } else {
 		err = GE_INVAL;
 	    }
+	    if (!err) {
+		err = acc_admit_args_apply(*accepter, &admit);
+		if (err)
+		    gensio_acc_free(*accepter);
+	    }
 
+	out_free_addr:
 	    gensio_addr_free(ai);
 	}
     }
@@ -1489,12 +2294,10 @@ gensio_terminal_acc_alloc(const char *gensiotype, const void *gdata,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
+    r = reg_gensio_acc_find(gensiotype, strlen(gensiotype));
+    if (r) {
 	if (!r->terminal_alloc)
-	    break;
+	    return GE_NOTSUP;
 
 	return r->terminal_alloc(gdata, args, o, cb, user_data, accepter);
     }
@@ -1521,12 +2324,10 @@ gensio_filter_acc_alloc(const char *gensiotype,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
+    r = reg_gensio_acc_find(gensiotype, strlen(gensiotype));
+    if (r) {
 	if (!r->filter_alloc)
-	    break;
+	    return GE_NOTSUP;
 
 	return r->filter_alloc(child, args, o, cb, user_data, accepter);
     }
@@ -1555,19 +2356,24 @@ str_to_gensio_accepter_child(struct gensio_accepter *child,
 
     while (isspace(*str))
 	str++;
+    len = reg_name_len(str);
  retry:
-    for (r = reg_gensio_accs; r; r = r->next) {
+    r = reg_gensio_acc_find(str, len);
+    if (r) {
 	const char **args = NULL;
-
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != ',' && str[len] != '(' && str[len]))
-	    continue;
+	struct acc_admit_vals admit;
 
 	str += len;
 	err = gensio_scan_args(o, &str, NULL, &args);
+	if (!err)
+	    err = acc_admit_args_take(o, args, &admit);
 	if (!err)
 	    err = r->filter_alloc(child, args, o, cb, user_data, accepter);
+	if (!err) {
+	    err = acc_admit_args_apply(*accepter, &admit);
+	    if (err)
+		gensio_acc_free(*accepter);
+	}
 	if (args)
 	    gensio_argv_free(o, args);
 	return err;
@@ -1585,9 +2391,34 @@ struct registered_gensio {
     str_to_gensio_handler handler;
     gensio_terminal_alloch terminal_alloc;
     gensio_filter_alloch filter_alloc;
+    unsigned int hash;
     struct registered_gensio *next;
 };
 
+static struct registered_gensio *
+reg_gensio_find(const char *name, size_t len)
+{
+    unsigned int hash = reg_name_hash(name, len);
+    struct registered_gensio *r;
+
+#if HAVE_GCC_ATOMICS
+    r = __atomic_load_n(&reg_gensios[hash % REG_GENSIO_HASH_SIZE],
+			__ATOMIC_ACQUIRE);
+#else
+    reg_o->lock(reg_gensio_lock);
+    r = reg_gensios[hash % REG_GENSIO_HASH_SIZE];
+#endif
+    for (; r; r = r->next) {
+	if (r->hash == hash && strncmp(r->name, name, len) == 0 &&
+		!r->name[len])
+	    break;
+    }
+#if !HAVE_GCC_ATOMICS
+    reg_o->unlock(reg_gensio_lock);
+#endif
+    return r;
+}
+
 static int
 register_base_gensio(struct gensio_os_funcs *o,
 		     const char *name,
@@ -1609,9 +2440,28 @@ register_base_gensio(struct gensio_os_funcs *o,
     n->handler = handler;
     n->terminal_alloc = terminal_alloc;
     n->filter_alloc = filter_alloc;
+    n->hash = reg_name_hash(name, strlen(name));
     o->lock(reg_gensio_lock);
-    n->next = reg_gensios;
-    reg_gensios = n;
+    if (reg_builtin_loading) {
+	struct registered_gensio **p;
+
+	p = &reg_gensios[n->hash % REG_GENSIO_HASH_SIZE];
+	while (*p)
+	    p = &(*p)->next;
+#if HAVE_GCC_ATOMICS
+	__atomic_store_n(p, n, __ATOMIC_RELEASE);
+#else
+	*p = n;
+#endif
+    } else {
+	n->next = reg_gensios[n->hash % REG_GENSIO_HASH_SIZE];
+#if HAVE_GCC_ATOMICS
+	__atomic_store_n(&reg_gensios[n->hash % REG_GENSIO_HASH_SIZE], n,
+			 __ATOMIC_RELEASE);
+#else
+	reg_gensios[n->hash % REG_GENSIO_HASH_SIZE] = n;
+#endif
+    }
     o->unlock(reg_gensio_lock);
     return 0;
 }
@@ -1643,11 +2493,11 @@ is_serialdev_default_gensio(const char *str)
 #endif
 }
 
-int
-str_to_gensio(const char *str,
-	      struct gensio_os_funcs *o,
-	      gensio_event cb, void *user_data,
-	      struct gensio **gensio)
+static int
+i_str_to_gensio(const char *str,
+		struct gensio_os_funcs *o,
+		gensio_event cb, void *user_data,
+		struct gensio **gensio)
 {
     int err = 0;
     struct gensio_addr *ai = NULL;
@@ -1664,13 +2514,10 @@ str_to_gensio(const char *str,
 
     while (isspace(*str))
 	str++;
+    len = reg_name_len(str);
  retry:
-    for (r = reg_gensios; r; r = r->next) {
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != ',' && str[len] != '(' && str[len]))
-	    continue;
-
+    r = reg_gensio_find(str, len);
+    if (r) {
 	str += len;
 	err = gensio_scan_args(o, &str, NULL, &args);
 	if (!err) {
@@ -1693,7 +2540,7 @@ str_to_gensio(const char *str,
 	if (!nstr)
 	    return GE_NOMEM;
 	
-	err = str_to_gensio(nstr, o, cb, user_data, gensio);
+	err = i_str_to_gensio(nstr, o, cb, user_data, gensio);
 	o->free(o, nstr);
 	goto out;
     }
@@ -1729,6 +2576,25 @@ str_to_gensio(const char *str,
     return err;
 }
 
+/*
+ * The whole stack is allocated in one setup scope, so the layers
+ * share an arena.  The filter handlers call back into here for their
+ * children, those just nest in the scope.
+ */
+int
+str_to_gensio(const char *str,
+	      struct gensio_os_funcs *o,
+	      gensio_event cb, void *user_data,
+	      struct gensio **gensio)
+{
+    int err;
+
+    gensio_setup_scope_start(o, NULL);
+    err = i_str_to_gensio(str, o, cb, user_data, gensio);
+    gensio_setup_scope_end();
+    return err;
+}
+
 int
 gensio_terminal_alloc(const char *gensiotype, const void *gdata,
 		      const char * const args[],
@@ -1744,94 +2610,305 @@ gensio_terminal_alloc(const char *gensiotype, const void *gdata,
 	return reg_gensio_rv;
 
  retry:
-    for (r = reg_gensios; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
-
+    r = reg_gensio_find(gensiotype, strlen(gensiotype));
+    if (r) {
 	if (!r->terminal_alloc)
-	    break;
+	    return GE_NOTSUP;
 	return r->terminal_alloc(gdata, args, o, cb, user_data, new_gensio);
     }
     if (!retried && gensio_loadlib(o, gensiotype)) {
 	retried = true;
 	goto retry;
     }
-    return GE_NOTSUP;
+    return GE_NOTSUP;
+}
+
+int
+gensio_filter_alloc(const char *gensiotype,
+		    struct gensio *child,
+		    const char * const args[],
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **new_gensio)
+{
+    struct registered_gensio *r;
+    bool retried = false;
+
+    o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
+    if (reg_gensio_rv)
+	return reg_gensio_rv;
+
+ retry:
+    r = reg_gensio_find(gensiotype, strlen(gensiotype));
+    if (r) {
+	if (!r->filter_alloc)
+	    return GE_NOTSUP;
+	return r->filter_alloc(child, args, o, cb, user_data, new_gensio);
+    }
+    if (!retried && gensio_loadlib(o, gensiotype)) {
+	retried = true;
+	goto retry;
+    }
+    return GE_NOTSUP;
+}
+
+int
+str_to_gensio_child(struct gensio *child,
+		    const char *str,
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **gensio)
+{
+    int err = 0;
+    const char **args = NULL;
+    struct registered_gensio *r;
+    size_t len;
+    bool retried = false;
+
+    while (isspace(*str))
+	str++;
+    len = reg_name_len(str);
+ retry:
+    r = str[len] == ',' ? NULL : reg_gensio_find(str, len);
+    if (r) {
+	if (!r->filter_alloc)
+	    return GE_INVAL;
+
+	str += len;
+	err = gensio_scan_args(o, &str, NULL, &args);
+	if (!err) {
+	    gensio_setup_scope_start(o, child->arena);
+	    err = r->filter_alloc(child, args, o, cb, user_data, gensio);
+	    gensio_setup_scope_end();
+	}
+	if (args)
+	    gensio_argv_free(o, args);
+	return err;
+    }
+    if (!retried && gensio_loadlib(o, str)) {
+	retried = true;
+	goto retry;
+    } else {
+	GENSIO_DECLARE_PPGENSIO(p, o, cb, "base", user_data);
+	gensio_pparm_log(&p, "Unknown gensio type: %s", str);
+    }
+
+    return GE_NOTSUP;
+}
+
+/*
+ * A compiled gensio stack.  The layers are kept outermost first.
+ * Filter layers hold the registered class and the parsed arguments,
+ * the bottom layer is either a registered gensio with the string
+ * that follows its arguments, or a pre-scanned network address that
+ * is handed directly to the terminal allocator.
+ */
+struct gensio_template_layer {
+    struct registered_gensio *r;
+    const char **args;
+    char *str;
+    struct gensio_addr *ai;
+    struct gensio_template_layer *next;
+};
+
+struct gensio_template {
+    struct gensio_os_funcs *o;
+    struct gensio_template_layer *layers;
+};
+
+void
+gensio_template_free(struct gensio_template *tmpl)
+{
+    struct gensio_os_funcs *o = tmpl->o;
+    struct gensio_template_layer *l;
+
+    while (tmpl->layers) {
+	l = tmpl->layers;
+	tmpl->layers = l->next;
+	if (l->args)
+	    gensio_argv_free(o, l->args);
+	if (l->str)
+	    o->free(o, l->str);
+	if (l->ai)
+	    gensio_addr_free(l->ai);
+	o->free(o, l);
+    }
+    o->free(o, tmpl);
+}
+
+static int
+gensio_template_add_layer(struct gensio_template *tmpl,
+			  struct gensio_template_layer ***last,
+			  struct gensio_template_layer **rl)
+{
+    struct gensio_os_funcs *o = tmpl->o;
+    struct gensio_template_layer *l;
+
+    l = o->zalloc(o, sizeof(*l));
+    if (!l)
+	return GE_NOMEM;
+    **last = l;
+    *last = &l->next;
+    *rl = l;
+    return 0;
+}
+
+static int
+gensio_template_compile(struct gensio_template *tmpl,
+			struct gensio_template_layer **last,
+			const char *str)
+{
+    struct gensio_os_funcs *o = tmpl->o;
+    struct gensio_template_layer *l;
+    struct registered_gensio *r;
+    const char **args = NULL;
+    bool is_port_set;
+    int protocol = 0;
+    size_t len;
+    bool retried;
+    const char *tname = NULL;
+    char *nstr;
+    int err;
+
+ next_layer:
+    retried = false;
+    while (isspace(*str))
+	str++;
+    len = reg_name_len(str);
+ retry:
+    r = reg_gensio_find(str, len);
+    if (r) {
+	err = gensio_template_add_layer(tmpl, &last, &l);
+	if (err)
+	    return err;
+	l->r = r;
+	str += len;
+	err = gensio_scan_args(o, &str, NULL, &l->args);
+	if (err)
+	    return err;
+	/*
+	 * keepopen needs the child's string to create standby
+	 * connections, so let its handler parse the rest of the
+	 * stack like a terminal.
+	 */
+	if (r->filter_alloc && strcmp(r->name, "keepopen") != 0)
+	    goto next_layer;
+
+	/* The handler parses whatever is left. */
+	while (isspace(*str))
+	    str++;
+	l->str = gensio_strdup(o, str);
+	if (!l->str)
+	    return GE_NOMEM;
+	return 0;
+    }
+    if (!retried && gensio_loadlib(o, str)) {
+	retried = true;
+	goto retry;
+    }
+
+    if (is_serialdev_default_gensio(str)) {
+	nstr = gensio_alloc_sprintf(o, "serialdev,%s", str);
+	if (!nstr)
+	    return GE_NOMEM;
+	err = gensio_template_compile(tmpl, last, nstr);
+	o->free(o, nstr);
+	return err;
+    }
+
+    err = gensio_template_add_layer(tmpl, &last, &l);
+    if (err)
+	return err;
+    err = gensio_scan_network_port(o, str, false, &l->ai, &protocol,
+				   &is_port_set, NULL, &args);
+    if (err) {
+	GENSIO_DECLARE_PPGENSIO(p, o, NULL, "base", NULL);
+	gensio_pparm_log(&p, "Unknown gensio type: %s", str);
+	return err;
+    }
+    l->args = args;
+    if (!is_port_set)
+	return GE_INVAL;
+    if (protocol == GENSIO_NET_PROTOCOL_UDP)
+	tname = "udp";
+    else if (protocol == GENSIO_NET_PROTOCOL_TCP)
+	tname = "tcp";
+    else if (protocol == GENSIO_NET_PROTOCOL_SCTP)
+	tname = "sctp";
+    else
+	return GE_INVAL;
+    l->r = reg_gensio_find(tname, strlen(tname));
+    if (!l->r && gensio_loadlib(o, tname))
+	l->r = reg_gensio_find(tname, strlen(tname));
+    if (!l->r || !l->r->terminal_alloc)
+	return GE_NOTSUP;
+
+    return 0;
 }
 
 int
-gensio_filter_alloc(const char *gensiotype,
-		    struct gensio *child,
-		    const char * const args[],
-		    struct gensio_os_funcs *o,
-		    gensio_event cb, void *user_data,
-		    struct gensio **new_gensio)
+str_to_gensio_template(const char *str, struct gensio_os_funcs *o,
+		       struct gensio_template **rtmpl)
 {
-    struct registered_gensio *r;
-    bool retried = false;
+    struct gensio_template *tmpl;
+    int err;
 
     o->call_once(o, &gensio_str_initialized, add_default_gensios, o);
     if (reg_gensio_rv)
 	return reg_gensio_rv;
 
- retry:
-    for (r = reg_gensios; r; r = r->next) {
-	if (strcmp(r->name, gensiotype) != 0)
-	    continue;
+    tmpl = o->zalloc(o, sizeof(*tmpl));
+    if (!tmpl)
+	return GE_NOMEM;
+    tmpl->o = o;
 
-	if (!r->filter_alloc)
-	    break;
-	return r->filter_alloc(child, args, o, cb, user_data, new_gensio);
-    }
-    if (!retried && gensio_loadlib(o, gensiotype)) {
-	retried = true;
-	goto retry;
+    err = gensio_template_compile(tmpl, &tmpl->layers, str);
+    if (err) {
+	gensio_template_free(tmpl);
+	return err;
     }
-    return GE_NOTSUP;
+
+    *rtmpl = tmpl;
+    return 0;
 }
 
-int
-str_to_gensio_child(struct gensio *child,
-		    const char *str,
-		    struct gensio_os_funcs *o,
-		    gensio_event cb, void *user_data,
-		    struct gensio **gensio)
+static int
+gensio_template_alloc_layer(struct gensio_template *tmpl,
+			    struct gensio_template_layer *l,
+			    gensio_event cb, void *user_data,
+			    struct gensio **rio)
 {
-    int err = 0;
-    const char **args = NULL;
-    struct registered_gensio *r;
-    size_t len;
-    bool retried = false;
-
-    while (isspace(*str))
-	str++;
- retry:
-    for (r = reg_gensios; r; r = r->next) {
-	len = strlen(r->name);
-	if (strncmp(r->name, str, len) != 0 ||
-			(str[len] != '(' && str[len]))
-	    continue;
+    struct gensio_os_funcs *o = tmpl->o;
+    struct gensio *child;
+    int err;
 
-	if (!r->filter_alloc)
-	    return GE_INVAL;
+    if (l->ai)
+	return l->r->terminal_alloc(l->ai, l->args, o, cb, user_data, rio);
+    if (l->str)
+	return l->r->handler(l->str, l->args, o, cb, user_data, rio);
 
-	str += len;
-	err = gensio_scan_args(o, &str, NULL, &args);
-	if (!err)
-	    err = r->filter_alloc(child, args, o, cb, user_data, gensio);
-	if (args)
-	    gensio_argv_free(o, args);
+    /* cb is passed in for parmerr handling, it will be overriden later. */
+    err = gensio_template_alloc_layer(tmpl, l->next, cb, user_data, &child);
+    if (err)
 	return err;
-    }
-    if (!retried && gensio_loadlib(o, str)) {
-	retried = true;
-	goto retry;
-    } else {
-	GENSIO_DECLARE_PPGENSIO(p, o, cb, "base", user_data);
-	gensio_pparm_log(&p, "Unknown gensio type: %s", str);
-    }
+    err = l->r->filter_alloc(child, l->args, o, cb, user_data, rio);
+    if (err)
+	gensio_free(child);
+    return err;
+}
 
-    return GE_NOTSUP;
+int
+gensio_template_alloc(struct gensio_template *tmpl,
+		      gensio_event cb, void *user_data,
+		      struct gensio **gensio)
+{
+    int err;
+
+    gensio_setup_scope_start(tmpl->o, NULL);
+    err = gensio_template_alloc_layer(tmpl, tmpl->layers, cb, user_data,
+				      gensio);
+    gensio_setup_scope_end();
+    return err;
 }
 
 int
@@ -2422,7 +3499,22 @@ gensio_acc_log(struct gensio_accepter *acc, enum gensio_log_levels level,
 
 static struct gensio_once gensio_default_initialized;
 
-static struct gensio_lock *deflock;
+/*
+ * Defaults are kept in a hash table keyed by name.  Each bucket has
+ * its own lock, so lookups of different defaults don't contend with
+ * each other and a lookup only walks the few entries in its bucket.
+ */
+#define GENSIO_DEF_HASH_SIZE 64
+
+struct gensio_def_entry;
+
+struct gensio_def_bucket {
+    struct gensio_lock *lock;
+    struct gensio_def_entry *entries;
+};
+
+static struct gensio_def_bucket def_hash[GENSIO_DEF_HASH_SIZE];
+static bool def_hash_built;
 
 struct gensio_def_val {
     char *strval;
@@ -2445,6 +3537,8 @@ struct gensio_def_entry {
     struct gensio_def_val def;
     const struct gensio_enum_val *enums;
     struct gensio_class_def *classvals;
+    unsigned int hash;
+    bool builtin;
     struct gensio_def_entry *next;
 };
 
@@ -2499,10 +3593,12 @@ struct gensio_def_entry builtin_defaults[] = {
     { "custspeed",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     { "rs485",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
     { "nouucplock",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "flock",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     { "drain_time",	GENSIO_DEFAULT_INT,	.min = -1, .max = INT_MAX,
 						.def.intval = -1, },
     { "char_drain_wait",GENSIO_DEFAULT_INT,	.min = -1, .max = INT_MAX,
 						.def.intval = 50, },
+    { "async-open",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     /* serialdev and SOL */
     { "speed",		GENSIO_DEFAULT_STR,	.def.strval = "9600N81" },
     { "nobreak",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
@@ -2560,25 +3656,75 @@ struct gensio_def_entry builtin_defaults[] = {
     { NULL }
 };
 
-static struct gensio_def_entry *defaults;
 static int gensio_def_init_rv;
 static int l_gensio_set_default(struct gensio_os_funcs *o,
 				const char *class, const char *name,
 				const char *strval, int intval);
 static void l_gensio_reset_defaults(struct gensio_os_funcs *o);
 
+static unsigned int
+gensio_def_hash(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s)
+	h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+static struct gensio_def_bucket *
+gensio_def_bucket(unsigned int hash)
+{
+    return &def_hash[hash % GENSIO_DEF_HASH_SIZE];
+}
+
+static void
+gensio_def_free_locks(struct gensio_os_funcs *o)
+{
+    unsigned int i;
+
+    for (i = 0; i < GENSIO_DEF_HASH_SIZE; i++) {
+	if (def_hash[i].lock)
+	    o->free_lock(def_hash[i].lock);
+	def_hash[i].lock = NULL;
+    }
+}
+
 static void
 gensio_default_init(void *cb_data)
 {
     struct gensio_os_funcs *o = cb_data;
+    struct gensio_def_bucket *b;
+    struct gensio_def_entry *d;
+    unsigned int i;
 
-    deflock = o->alloc_lock(o);
-    if (!deflock)
-	gensio_def_init_rv = GE_NOMEM;
-    else
-	/* Default reuseaddr to false for UDP. */
-	gensio_def_init_rv = l_gensio_set_default(o, "udp", "reuseaddr",
-						  NULL, 0);
+    for (i = 0; i < GENSIO_DEF_HASH_SIZE; i++) {
+	def_hash[i].lock = o->alloc_lock(o);
+	if (!def_hash[i].lock) {
+	    gensio_def_free_locks(o);
+	    gensio_def_init_rv = GE_NOMEM;
+	    return;
+	}
+    }
+
+    /*
+     * Added defaults survive gensio_cleanup_mem(), so the table is
+     * only built the first time.
+     */
+    if (!def_hash_built) {
+	for (i = 0; builtin_defaults[i].name; i++) {
+	    d = &builtin_defaults[i];
+	    d->hash = gensio_def_hash(d->name);
+	    d->builtin = true;
+	    b = gensio_def_bucket(d->hash);
+	    d->next = b->entries;
+	    b->entries = d;
+	}
+	def_hash_built = true;
+    }
+
+    /* Default reuseaddr to false for UDP. */
+    gensio_def_init_rv = l_gensio_set_default(o, "udp", "reuseaddr", NULL, 0);
 }
 
 void
@@ -2599,40 +3745,49 @@ gensio_cleanup_mem(struct gensio_os_funcs *o)
     struct registered_gensio_accepter *n, *n2;
     struct registered_gensio *g, *g2;
     struct gensio_class_cleanup *cl = cleanups;
+    unsigned int i;
 
     if (gensio_base_lock)
 	o->free_lock(gensio_base_lock);
     gensio_base_lock = NULL;
 
-    l_gensio_reset_defaults(o);
+    while (type_metrics) {
+	struct gensio_type_metrics *m = type_metrics;
+
+	type_metrics = m->next;
+	o->free(o, m);
+    }
 
-    if (deflock)
-	o->free_lock(deflock);
-    deflock = NULL;
+    l_gensio_reset_defaults(o);
+    gensio_def_free_locks(o);
 
     if (reg_gensio_acc_lock)
 	o->free_lock(reg_gensio_acc_lock);
     reg_gensio_acc_lock = NULL;
 
-    n = reg_gensio_accs;
-    while (n) {
-	n2 = n->next;
-	o->free(o, n);
-	n = n2;
+    for (i = 0; i < REG_GENSIO_HASH_SIZE; i++) {
+	n = reg_gensio_accs[i];
+	while (n) {
+	    n2 = n->next;
+	    o->free(o, n);
+	    n = n2;
+	}
+	reg_gensio_accs[i] = NULL;
     }
-    reg_gensio_accs = NULL;
 
     if (reg_gensio_lock)
 	o->free_lock(reg_gensio_lock);
     reg_gensio_lock = NULL;
 
-    g = reg_gensios;
-    while (g) {
-	g2 = g->next;
-	o->free(o, g);
-	g = g2;
+    for (i = 0; i < REG_GENSIO_HASH_SIZE; i++) {
+	g = reg_gensios[i];
+	while (g) {
+	    g2 = g->next;
+	    o->free(o, g);
+	    g = g2;
+	}
+	reg_gensios[i] = NULL;
     }
-    reg_gensios = NULL;
 
     memset(&gensio_default_initialized, 0, sizeof(gensio_default_initialized));
     memset(&gensio_base_initialized, 0, sizeof(gensio_base_initialized));
@@ -2647,6 +3802,13 @@ gensio_cleanup_mem(struct gensio_os_funcs *o)
 	o->free_lock(cleanups_lock);
     cleanups_lock = NULL;
 
+    if (builtin_lock)
+	o->free_lock(builtin_lock);
+    builtin_lock = NULL;
+#define INIT_GENSIO(name) builtin_loaded_##name = false
+#include "builtin_gensios.h"
+#undef INIT_GENSIO
+
     reg_o = NULL;
 }
 
@@ -2677,13 +3839,13 @@ l_gensio_reset_defaults(struct gensio_os_funcs *o)
     struct gensio_def_entry *d;
     unsigned int i;
 
-    if (deflock) {
-	o->lock(deflock);
-	for (i = 0; builtin_defaults[i].name; i++)
-	    gensio_reset_default(o, &builtin_defaults[i]);
-	for (d = defaults; d; d = d->next)
+    for (i = 0; i < GENSIO_DEF_HASH_SIZE; i++) {
+	if (!def_hash[i].lock)
+	    continue;
+	o->lock(def_hash[i].lock);
+	for (d = def_hash[i].entries; d; d = d->next)
 	    gensio_reset_default(o, d);
-	o->unlock(deflock);
+	o->unlock(def_hash[i].lock);
     }
 }
 
@@ -2698,28 +3860,17 @@ gensio_reset_defaults(struct gensio_os_funcs *o)
     return 0;
 }
 
+/* Must be called with the bucket's lock held. */
 static struct gensio_def_entry *
-gensio_lookup_default(const char *name, struct gensio_def_entry **prev,
-		      bool *isdefault)
+gensio_lookup_default(struct gensio_def_bucket *b, const char *name,
+		      unsigned int hash, struct gensio_def_entry **prev)
 {
     struct gensio_def_entry *d, *p = NULL;
-    unsigned int i;
 
-    for (i = 0; builtin_defaults[i].name; i++) {
-	if (strcmp(builtin_defaults[i].name, name) == 0) {
-	    if (prev)
-		*prev = NULL;
-	    if (isdefault)
-		*isdefault = true;
-	    return &builtin_defaults[i];
-	}
-    }
-    for (d = defaults; d; d = d->next) {
-	if (strcmp(d->name, name) == 0) {
+    for (d = b->entries; d; d = d->next) {
+	if (d->hash == hash && strcmp(d->name, name) == 0) {
 	    if (prev)
 		*prev = p;
-	    if (isdefault)
-		*isdefault = false;
 	    return d;
 	}
 	p = d;
@@ -2755,13 +3906,15 @@ gensio_add_default(struct gensio_os_funcs *o,
 {
     int err = 0;
     struct gensio_def_entry *d;
+    unsigned int hash = gensio_def_hash(name);
+    struct gensio_def_bucket *b = gensio_def_bucket(hash);
 
     o->call_once(o, &gensio_default_initialized, gensio_default_init, o);
     if (gensio_def_init_rv)
 	return gensio_def_init_rv;
 
-    o->lock(deflock);
-    d = gensio_lookup_default(name, NULL, NULL);
+    o->lock(b->lock);
+    d = gensio_lookup_default(b, name, hash, NULL);
     if (d) {
 	err = GE_EXISTS;
 	goto out_unlock;
@@ -2779,6 +3932,7 @@ gensio_add_default(struct gensio_os_funcs *o,
 	err = GE_NOMEM;
 	goto out_unlock;
     }
+    d->hash = hash;
     d->type = type;
     d->min = minval;
     d->max = maxval;
@@ -2802,11 +3956,11 @@ gensio_add_default(struct gensio_os_funcs *o,
 	}
     }
 
-    d->next = defaults;
-    defaults = d;
+    d->next = b->entries;
+    b->entries = d;
 
  out_unlock:
-    o->unlock(deflock);
+    o->unlock(b->lock);
     return err;
 }
 
@@ -2819,9 +3973,11 @@ l_gensio_set_default(struct gensio_os_funcs *o,
     struct gensio_def_entry *d;
     char *new_strval = NULL, *end;
     unsigned int i;
+    unsigned int hash = gensio_def_hash(name);
+    struct gensio_def_bucket *b = gensio_def_bucket(hash);
 
-    o->lock(deflock);
-    d = gensio_lookup_default(name, NULL, NULL);
+    o->lock(b->lock);
+    d = gensio_lookup_default(b, name, hash, NULL);
     if (!d) {
 	err = GE_NOTFOUND;
 	goto out_unlock;
@@ -2947,7 +4103,7 @@ l_gensio_set_default(struct gensio_os_funcs *o,
  out_unlock:
     if (new_strval)
 	o->free(o, new_strval);
-    o->unlock(deflock);
+    o->unlock(b->lock);
     return err;
 }
 
@@ -2974,13 +4130,15 @@ gensio_get_default(struct gensio_os_funcs *o,
     struct gensio_def_val *val;
     int err = 0;
     char *str;
+    unsigned int hash = gensio_def_hash(name);
+    struct gensio_def_bucket *b = gensio_def_bucket(hash);
 
     o->call_once(o, &gensio_default_initialized, gensio_default_init, o);
     if (gensio_def_init_rv)
 	return gensio_def_init_rv;
 
-    o->lock(deflock);
-    d = gensio_lookup_default(name, NULL, NULL);
+    o->lock(b->lock);
+    d = gensio_lookup_default(b, name, hash, NULL);
     if (!d) {
 	err = GE_NOTFOUND;
 	goto out_unlock;
@@ -3047,7 +4205,7 @@ gensio_get_default(struct gensio_os_funcs *o,
     }
 
  out_unlock:
-    o->unlock(deflock);
+    o->unlock(b->lock);
 
     return err;
 }
@@ -3058,15 +4216,16 @@ gensio_del_default(struct gensio_os_funcs *o,
 {
     struct gensio_def_entry *d, *prev;
     struct gensio_class_def *c = NULL, *prevc;
-    bool isdefault;
     int err = 0;
+    unsigned int hash = gensio_def_hash(name);
+    struct gensio_def_bucket *b = gensio_def_bucket(hash);
 
     o->call_once(o, &gensio_default_initialized, gensio_default_init, o);
     if (gensio_def_init_rv)
 	return gensio_def_init_rv;
 
-    o->lock(deflock);
-    d = gensio_lookup_default(name, &prev, &isdefault);
+    o->lock(b->lock);
+    d = gensio_lookup_default(b, name, hash, &prev);
     if (!d) {
 	err = GE_NOTFOUND;
 	goto out_unlock;
@@ -3090,7 +4249,7 @@ gensio_del_default(struct gensio_os_funcs *o,
 	goto out_unlock;
     }
 
-    if (isdefault) {
+    if (d->builtin) {
 	err = GE_NOTSUP;
 	goto out_unlock;
     }
@@ -3103,7 +4262,7 @@ gensio_del_default(struct gensio_os_funcs *o,
     if (prev)
 	prev->next = d->next;
     else
-	defaults = d->next;
+	b->entries = d->next;
 
     while (d->classvals) {
 	c = d->classvals;
@@ -3120,7 +4279,7 @@ gensio_del_default(struct gensio_os_funcs *o,
     o->free(o, d);
 
  out_unlock:
-    o->unlock(deflock);
+    o->unlock(b->lock);
 
     return err;
 }
@@ -3197,8 +4356,108 @@ struct gensio_sync_op {
     int err;
     struct gensio_waiter *waiter;
     struct gensio_link link;
+
+    /*
+     * For gensio_read_sv() and gensio_write_sv(), NULL otherwise.
+     * sgpos and sgoff are the current entry and the offset in it.  A
+     * vectored read stays on the list after the waiter is woken, so
+     * data that comes in before the waiting thread runs is added to
+     * it, too.
+     */
+    const struct gensio_sg *sg;
+    gensiods sglen;
+    gensiods sgpos;
+    gensiods sgoff;
+    gensiods *msglens;
+    gensiods total;
+    bool woken;
 };
 
+/*
+ * Copy read data into a vectored read and return how much was taken.
+ * For packet gensios each entry gets one message, otherwise the
+ * entries are filled in order.
+ */
+static gensiods
+gensio_sync_sv_fill(struct gensio_sync_op *op, const unsigned char *buf,
+		    gensiods buflen, bool packet)
+{
+    gensiods taken = 0, len;
+    unsigned char *dest;
+
+    while (op->sgpos < op->sglen) {
+	dest = (unsigned char *) op->sg[op->sgpos].buf + op->sgoff;
+	len = op->sg[op->sgpos].buflen - op->sgoff;
+	if (len > buflen)
+	    len = buflen;
+	memcpy(dest, buf, len);
+	buf += len;
+	buflen -= len;
+	taken += len;
+	op->sgoff += len;
+	if (packet) {
+	    if (op->msglens)
+		op->msglens[op->sgpos] = op->sgoff;
+	    op->sgpos++;
+	    op->sgoff = 0;
+	    break;
+	}
+	if (op->sgoff < op->sg[op->sgpos].buflen)
+	    break;
+	op->sgpos++;
+	op->sgoff = 0;
+    }
+    op->total += taken;
+
+    return taken;
+}
+
+#define GENSIO_SYNC_SV_CHUNK 16
+
+/*
+ * Write as much of a vectored write as the gensio will take, a chunk
+ * of entries at a time.  On a packet gensio each entry is its own
+ * message, so they are written one at a time.
+ */
+static int
+gensio_sync_sv_write(struct gensio *io, struct gensio_sync_op *op)
+{
+    struct gensio_sg sg[GENSIO_SYNC_SV_CHUNK];
+    gensiods i, n, len;
+    int err;
+
+    while (op->sgpos < op->sglen) {
+	n = op->sglen - op->sgpos;
+	if (gensio_is_packet(io))
+	    n = 1;
+	else if (n > GENSIO_SYNC_SV_CHUNK)
+	    n = GENSIO_SYNC_SV_CHUNK;
+	memcpy(sg, op->sg + op->sgpos, n * sizeof(*sg));
+	sg[0].buf = (const unsigned char *) sg[0].buf + op->sgoff;
+	sg[0].buflen -= op->sgoff;
+
+	len = 0;
+	err = gensio_write_sg(io, &len, sg, n, NULL);
+	if (err)
+	    return err;
+	op->total += len;
+
+	for (i = 0; i < n; i++) {
+	    if (len < sg[i].buflen) {
+		op->sgoff += len;
+		break;
+	    }
+	    len -= sg[i].buflen;
+	    op->sgpos++;
+	    op->sgoff = 0;
+	}
+	if (i < n)
+	    break; /* Partial write, wait for the next write ready. */
+    }
+
+    return 0;
+}
+
 struct gensio_sync_io {
     gensio_event old_cb;
 
@@ -3280,13 +4539,32 @@ gensio_syncio_event(struct gensio *io, void *user_data,
 	    goto read_unlock;
 	}
 	done_len = *buflen;
-	while (*buflen && !gensio_list_empty(&sync_io->readops)) {
+	while (done_len && !gensio_list_empty(&sync_io->readops)) {
 	    struct gensio_link *l = gensio_list_first(&sync_io->readops);
 	    struct gensio_sync_op *op = gensio_container_of(l,
 							struct gensio_sync_op,
 							link);
 	    gensiods len = done_len;
 
+	    if (op->sg) {
+		bool packet = gensio_is_packet(io);
+
+		len = gensio_sync_sv_fill(op, buf, done_len, packet);
+		buf += len;
+		done_len -= len;
+		if (!op->woken) {
+		    op->woken = true;
+		    o->wake(op->waiter);
+		}
+		if (op->sgpos >= op->sglen) {
+		    gensio_list_rm(&sync_io->readops, l);
+		    op->queued = false;
+		}
+		if (packet)
+		    break; /* One message per read event. */
+		continue;
+	    }
+
 	    if (len > op->len)
 		len = op->len;
 	    memcpy(op->buf, buf, len);
@@ -3294,10 +4572,11 @@ gensio_syncio_event(struct gensio *io, void *user_data,
 	    gensio_list_rm(&sync_io->readops, l);
 	    op->queued = false;
 	    o->wake(op->waiter);
+	    buf += len;
 	    done_len -= len;
 	}
 	*buflen -= done_len;
-	if (done_len > 0)
+	if (done_len > 0 && gensio_list_empty(&sync_io->readops))
 	    gensio_set_read_callback_enable(io, false);
     read_unlock:
 	o->unlock(sync_io->lock);
@@ -3316,6 +4595,22 @@ gensio_syncio_event(struct gensio *io, void *user_data,
 							link);
 	    gensiods len = 0;
 
+	    if (op->sg) {
+		err = gensio_sync_sv_write(io, op);
+		if (err) {
+		    if (!sync_io->err)
+			sync_io->err = err;
+		    gensio_sync_flush_waiters(sync_io, o);
+		} else if (op->sgpos >= op->sglen) {
+		    gensio_list_rm(&sync_io->writeops, l);
+		    op->queued = false;
+		    o->wake(op->waiter);
+		} else {
+		    break;
+		}
+		continue;
+	    }
+
 	    err = gensio_write(io, &len, op->buf, op->len, NULL);
 	    if (err) {
 		if (!sync_io->err)
@@ -3427,6 +4722,7 @@ i_gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen
     op.buf = data;
     op.len = datalen;
     op.err = 0;
+    op.sg = NULL;
     op.waiter = o->alloc_waiter(o);
     if (!op.waiter)
 	return GE_NOMEM;
@@ -3504,6 +4800,7 @@ i_gensio_write_s(struct gensio *io, gensiods *count,
     op.buf = (void *) data;
     op.len = datalen;
     op.err = 0;
+    op.sg = NULL;
     op.waiter = o->alloc_waiter(o);
     if (!op.waiter)
 	return GE_NOMEM;
@@ -3555,6 +4852,121 @@ gensio_write_s_intr(struct gensio *io, gensiods *count,
     return i_gensio_write_s(io, count, data, datalen, timeout, true);
 }
 
+int
+gensio_read_sv(struct gensio *io, gensiods *count,
+	       const struct gensio_sg *sg, gensiods sglen,
+	       gensiods *msglens, gensio_time *timeout)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_sync_io *sync_io = io->sync_io;
+    struct gensio_sync_op op;
+    int rv = 0;
+
+    if (!sync_io)
+	return GE_NOTREADY;
+
+    if (count)
+	*count = 0;
+    if (msglens)
+	memset(msglens, 0, sglen * sizeof(*msglens));
+    if (sglen == 0)
+	return 0;
+
+    memset(&op, 0, sizeof(op));
+    op.queued = true;
+    op.sg = sg;
+    op.sglen = sglen;
+    op.msglens = msglens;
+    op.waiter = o->alloc_waiter(o);
+    if (!op.waiter)
+	return GE_NOMEM;
+    o->lock(sync_io->lock);
+    if (sync_io->err) {
+	rv = sync_io->err;
+	goto out_unlock;
+    }
+    gensio_set_read_callback_enable(io, true);
+    gensio_list_add_tail(&sync_io->readops, &op.link);
+
+    o->unlock(sync_io->lock);
+ retry:
+    rv = o->wait_intr(op.waiter, 1, timeout);
+    if (rv == GE_INTERRUPTED)
+	goto retry;
+    if (rv == GE_TIMEDOUT)
+	rv = 0;
+    o->lock(sync_io->lock);
+    if (op.queued)
+	gensio_list_rm(&sync_io->readops, &op.link);
+    if (op.total == 0 && op.err)
+	rv = op.err;
+    else if (count)
+	*count = op.total;
+    if (gensio_list_empty(&sync_io->readops))
+	gensio_set_read_callback_enable(io, false);
+ out_unlock:
+    o->unlock(sync_io->lock);
+    o->free_waiter(op.waiter);
+
+    return rv;
+}
+
+int
+gensio_write_sv(struct gensio *io, gensiods *count,
+		const struct gensio_sg *sg, gensiods sglen,
+		gensio_time *timeout)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_sync_io *sync_io = io->sync_io;
+    struct gensio_sync_op op;
+    int rv = 0;
+
+    if (!sync_io)
+	return GE_NOTREADY;
+
+    if (count)
+	*count = 0;
+    if (sglen == 0)
+	return 0;
+
+    memset(&op, 0, sizeof(op));
+    op.queued = true;
+    op.sg = sg;
+    op.sglen = sglen;
+    op.waiter = o->alloc_waiter(o);
+    if (!op.waiter)
+	return GE_NOMEM;
+    o->lock(sync_io->lock);
+    if (sync_io->err) {
+	rv = sync_io->err;
+	goto out_unlock;
+    }
+    gensio_set_write_callback_enable(io, true);
+    gensio_list_add_tail(&sync_io->writeops, &op.link);
+
+    o->unlock(sync_io->lock);
+ retry:
+    rv = o->wait_intr(op.waiter, 1, timeout);
+    if (rv == GE_INTERRUPTED)
+	goto retry;
+    if (rv == GE_TIMEDOUT)
+	rv = 0;
+    o->lock(sync_io->lock);
+    if (op.queued)
+	gensio_list_rm(&sync_io->writeops, &op.link);
+    if (op.err)
+	rv = op.err;
+    else if (count)
+	*count = op.total;
+    if (gensio_list_empty(&sync_io->writeops))
+	gensio_set_write_callback_enable(io, false);
+ out_unlock:
+    o->unlock(sync_io->lock);
+    o->free_waiter(op.waiter);
+
+    return rv;
+}
+
 int
 gensio_acc_set_sync(struct gensio_accepter *acc)
 {
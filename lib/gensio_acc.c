@@ -6,10 +6,12 @@
  */
 
 #include "config.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
@@ -46,6 +48,21 @@ struct basena_data {
     unsigned int refcount;
     unsigned int in_cb_count;
 
+    /*
+     * Admission control.  If throttled, accept callbacks are turned
+     * off in the lower layer so connections wait in the listen queue.
+     * user_cb_enabled is what the user asked for.  The rate is done
+     * with a GCRA, rate_tat is the theoretical arrival time in ns.
+     */
+    unsigned int maxconn;
+    unsigned int nr_conns;
+    unsigned int acceptrate;
+    int64_t rate_tat;
+    struct gensio_timer *rate_timer;
+    bool rate_timer_running;
+    bool user_cb_enabled;
+    bool throttled;
+
     bool freed;
     bool call_shutdown_done;
     gensio_acc_done shutdown_done;
@@ -130,6 +147,8 @@ basena_finish_free(struct basena_data *nadata)
 {
     struct gensio_os_funcs *o = nadata->o;
 
+    if (nadata->rate_timer)
+	o->free_timer(nadata->rate_timer);
     if (nadata->lock)
 	o->free_lock(nadata->lock);
     if (nadata->ops)
@@ -196,6 +215,143 @@ basena_leave_cb_unlock(struct basena_data *nadata)
 	basena_deref_and_unlock(nadata);
 }
 
+static int64_t
+basena_now_ns(struct basena_data *nadata)
+{
+    gensio_time now;
+
+    nadata->o->get_monotonic_time(nadata->o, &now);
+    return now.secs * 1000000000LL + now.nsecs;
+}
+
+/*
+ * How many nanoseconds until the next connection may be accepted
+ * under acceptrate.  A burst of up to a second's worth is allowed.
+ */
+static int64_t
+basena_rate_wait(struct basena_data *nadata, int64_t now)
+{
+    int64_t interval = 1000000000LL / nadata->acceptrate;
+    int64_t tau = (nadata->acceptrate - 1) * interval;
+
+    return nadata->rate_tat - tau - now;
+}
+
+/*
+ * Turn the lower layer's accept callbacks on or off depending on
+ * the limits.  Must be called with the lock held.
+ */
+static void
+basena_check_admit(struct basena_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    bool over = false;
+    int64_t wait;
+    gensio_time timeout;
+
+    if (nadata->maxconn && nadata->nr_conns >= nadata->maxconn)
+	over = true;
+    if (nadata->acceptrate && nadata->rate_timer) {
+	wait = basena_rate_wait(nadata, basena_now_ns(nadata));
+	if (wait > 0 && nadata->rate_timer_running) {
+	    over = true;
+	} else if (wait > 0) {
+	    timeout.secs = wait / 1000000000LL;
+	    timeout.nsecs = wait % 1000000000LL;
+	    if (!o->start_timer(nadata->rate_timer, &timeout)) {
+		nadata->rate_timer_running = true;
+		basena_ref(nadata);
+		over = true;
+	    }
+	}
+    }
+
+    if (over == nadata->throttled)
+	return;
+    nadata->throttled = over;
+    if (nadata->state == BASENA_OPEN && nadata->user_cb_enabled)
+	base_gensio_acc_set_cb_enable(nadata, !over, NULL);
+}
+
+static void
+basena_rate_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct basena_data *nadata = cb_data;
+
+    basena_lock(nadata);
+    nadata->rate_timer_running = false;
+    basena_check_admit(nadata);
+    basena_deref_and_unlock(nadata);
+}
+
+static void
+basena_admit_cleanup(struct gensio *io, void *classdata)
+{
+    struct basena_data *nadata = classdata;
+
+    basena_lock(nadata);
+    assert(nadata->nr_conns > 0);
+    nadata->nr_conns--;
+    basena_check_admit(nadata);
+    basena_deref_and_unlock(nadata);
+}
+
+static struct gensio_classops basena_admit_classops = {
+    .cleanup = basena_admit_cleanup
+};
+
+static int
+basena_set_admit(struct basena_data *nadata, unsigned int option,
+		 const char *data)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    unsigned long val;
+    char *end;
+
+    if (!data || !*data)
+	return GE_INVAL;
+    val = strtoul(data, &end, 0);
+    if (*end != '\0' || val > UINT_MAX)
+	return GE_INVAL;
+
+    basena_lock(nadata);
+    if (option == GENSIO_ACC_CONTROL_MAXCONN) {
+	nadata->maxconn = val;
+    } else {
+	if (val && !nadata->rate_timer) {
+	    nadata->rate_timer = o->alloc_timer(o, basena_rate_timeout,
+						nadata);
+	    if (!nadata->rate_timer) {
+		basena_unlock(nadata);
+		return GE_NOMEM;
+	    }
+	}
+	nadata->acceptrate = val;
+	nadata->rate_tat = 0;
+    }
+    basena_check_admit(nadata);
+    basena_unlock(nadata);
+
+    return 0;
+}
+
+static int
+basena_get_admit(struct basena_data *nadata, unsigned int option,
+		 char *data, gensiods *datalen)
+{
+    unsigned int val;
+
+    basena_lock(nadata);
+    if (option == GENSIO_ACC_CONTROL_MAXCONN)
+	val = nadata->maxconn;
+    else
+	val = nadata->acceptrate;
+    basena_unlock(nadata);
+    *datalen = snprintf(data, *datalen, "%u", val);
+
+    return 0;
+}
+
 static int
 basena_startup(struct gensio_accepter *accepter)
 {
@@ -208,9 +364,13 @@ basena_startup(struct gensio_accepter *accepter)
 	err = GE_NOTREADY;
     } else {
 	nadata->shutdown_done = NULL;
+	nadata->user_cb_enabled = true;
+	nadata->throttled = false;
 	err = base_gensio_acc_startup(nadata);
-	if (!err)
+	if (!err) {
 	    basena_set_state(nadata, BASENA_OPEN);
+	    basena_check_admit(nadata);
+	}
     }
     basena_unlock(nadata);
 
@@ -294,7 +454,11 @@ basena_set_accept_callback_enable(struct gensio_accepter *accepter,
 	ldone = basena_cb_en_done;
     }
     if (!rv)
-	rv = base_gensio_acc_set_cb_enable(nadata, enabled, ldone);
+	rv = base_gensio_acc_set_cb_enable(nadata,
+					   enabled && !nadata->throttled,
+					   ldone);
+    if (!rv)
+	nadata->user_cb_enabled = enabled;
     if (!rv && done)
 	basena_in_cb(nadata);
     basena_unlock(nadata);
@@ -310,6 +474,12 @@ basena_free(struct gensio_accepter *accepter)
     basena_lock(nadata);
     assert(!nadata->freed);
     nadata->freed = true;
+    if (nadata->rate_timer_running &&
+		nadata->o->stop_timer(nadata->rate_timer) == 0) {
+	nadata->rate_timer_running = false;
+	assert(nadata->refcount > 1);
+	nadata->refcount--;
+    }
     switch (nadata->state) {
     case BASENA_CLOSED:
 	break;
@@ -350,7 +520,16 @@ basena_control(struct gensio_accepter *accepter, bool get, unsigned int option,
 {
     struct basena_data *nadata = gensio_acc_get_gensio_data(accepter);
 
-    return base_gensio_acc_control(nadata, get, option, data, datalen);
+    switch (option) {
+    case GENSIO_ACC_CONTROL_MAXCONN:
+    case GENSIO_ACC_CONTROL_ACCEPTRATE:
+	if (get)
+	    return basena_get_admit(nadata, option, data, datalen);
+	return basena_set_admit(nadata, option, data);
+
+    default:
+	return base_gensio_acc_control(nadata, get, option, data, datalen);
+    }
 }
 
 static int
@@ -413,6 +592,11 @@ base_gensio_accepter_new_child_start(struct gensio_accepter *accepter)
 	basena_unlock(nadata);
 	return GE_NOTREADY;
     }
+    if (nadata->throttled) {
+	/* Raced with turning off the accepts, shed it. */
+	basena_unlock(nadata);
+	return GE_NOTREADY;
+    }
     return 0;
 }
 
@@ -423,6 +607,21 @@ base_gensio_accepter_new_child_end(struct gensio_accepter *accepter,
     struct basena_data *nadata = gensio_acc_get_gensio_data(accepter);
 
     if (!err) {
+	if (nadata->maxconn &&
+		!gensio_addclass(io, "basena_admit", GENSIO_CLASSOPS_VERSION,
+				 &basena_admit_classops, nadata)) {
+	    nadata->nr_conns++;
+	    basena_ref(nadata);
+	}
+	if (nadata->acceptrate) {
+	    int64_t now = basena_now_ns(nadata);
+
+	    if (nadata->rate_tat < now)
+		nadata->rate_tat = now;
+	    nadata->rate_tat += 1000000000LL / nadata->acceptrate;
+	}
+	if (nadata->maxconn || nadata->acceptrate)
+	    basena_check_admit(nadata);
 	basena_in_cb(nadata);
 	gensio_acc_add_pending_gensio(nadata->acc, io);
     }
@@ -434,11 +633,12 @@ base_gensio_server_open_done(struct gensio_accepter *accepter,
 			     struct gensio *net, int err)
 {
     struct basena_data *nadata = gensio_acc_get_gensio_data(accepter);
+    struct gensio *tofree = NULL;
 
     basena_lock(nadata);
     gensio_acc_remove_pending_gensio(nadata->acc, net);
     if (err) {
-	gensio_free(net);
+	tofree = net;
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Error accepting a gensio: %s",
 		       gensio_err_to_str(err));
@@ -449,9 +649,15 @@ base_gensio_server_open_done(struct gensio_accepter *accepter,
 	basena_lock(nadata);
 	nadata->in_cb_count--;
     } else {
-	gensio_free(net);
+	tofree = net;
     }
 
+    if (tofree) {
+	/* The free may call back into us for admission control. */
+	basena_unlock(nadata);
+	gensio_free(tofree);
+	basena_lock(nadata);
+    }
     basena_leave_cb_unlock(nadata);
 }
 
@@ -226,6 +226,8 @@ gensna_child_event(struct gensio_accepter *accepter, void *user_data,
     if (err)
 	goto out_err;
 
+    /* Put this layer in the same arena as the child. */
+    gensio_setup_scope_start(o, gensio_get_arena(child));
     err = nadata->acc_cb(nadata->acc_data, GENSIO_GENSIO_ACC_NEW_CHILD,
 			 &finish_data, &filter, child, NULL);
     if (err == GE_NOTSUP) {
@@ -242,19 +244,16 @@ gensna_child_event(struct gensio_accepter *accepter, void *user_data,
 	    base_allocated = false;
     }
 
-    if (err)
-	goto out_err_unlock;
-
-    if (filter) {
+    if (!err && filter) {
 	ll = gensio_gensio_ll_alloc(o, child);
-	if (!ll)
-	    goto out_nomem;
+	if (ll)
+	    io = base_gensio_server_alloc(o, ll, filter, child,
+					  gensio_acc_get_type(nadata->acc, 0),
+					  gensna_finish_server_open, nadata);
     }
-
-    if (filter)
-	io = base_gensio_server_alloc(o, ll, filter, child,
-				      gensio_acc_get_type(nadata->acc, 0),
-				      gensna_finish_server_open, nadata);
+    gensio_setup_scope_end();
+    if (err)
+	goto out_err_unlock;
     if (!io)
 	goto out_nomem;
 
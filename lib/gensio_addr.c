@@ -28,6 +28,14 @@ gensio_addr_equal(const struct gensio_addr *a1,
     return a1->funcs->addr_equal(a1, a2, compare_ports, compare_all);
 }
 
+unsigned int
+gensio_addr_hash(const struct gensio_addr *addr, bool hash_ports)
+{
+    if (!addr->funcs->addr_hash)
+	return 0;
+    return addr->funcs->addr_hash(addr, hash_ports);
+}
+
 int
 gensio_addr_to_str(const struct gensio_addr *addr,
 		   char *buf, gensiods *pos, gensiods buflen)
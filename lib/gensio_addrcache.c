@@ -0,0 +1,388 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A cache of address lookups for OS handlers to put in front of
+ * addr_scan_ips.  getaddrinfo() doesn't give us the DNS TTL, so
+ * entries are kept for a configured time.  Failed lookups that mean
+ * the name doesn't exist may be kept, too, for a separate time.
+ * Only connecting lookups are cached, listening addresses are local
+ * and cheap to get.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_addr.h>
+#include <gensio/gensio_err.h>
+#include <gensio/gensio_osops.h>
+#include <gensio/gensio_list.h>
+#include <pthread_handler.h>
+
+#define ADDRCACHE_DEFAULT_MAX	256
+
+struct addrcache_entry {
+    struct gensio_link link;
+    char *key;
+    unsigned int hash;
+    bool is_port_set;
+    int err; /* If non-zero, a negative entry. */
+    struct gensio_addr *addr;
+    gensio_time expires;
+};
+
+struct gensio_addrcache {
+    struct gensio_os_funcs *o;
+    gensio_addrcache_scan scan;
+
+    lock_type lock;
+    struct gensio_addrcache_config config;
+
+    /* Most recently used first. */
+    struct gensio_list entries;
+    unsigned int nr_entries;
+
+    gensiods hits;
+    gensiods neg_hits;
+    gensiods misses;
+    gensiods expired;
+};
+
+static unsigned int
+addrcache_hash(const char *s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s)
+	h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+static bool
+time_is_zero(const gensio_time *t)
+{
+    return t->secs == 0 && t->nsecs == 0;
+}
+
+static bool
+time_before(const gensio_time *t1, const gensio_time *t2)
+{
+    return t1->secs < t2->secs ||
+	(t1->secs == t2->secs && t1->nsecs < t2->nsecs);
+}
+
+static void
+time_add(gensio_time *t, const gensio_time *add)
+{
+    t->secs += add->secs;
+    t->nsecs += add->nsecs;
+    while (t->nsecs >= 1000000000) {
+	t->nsecs -= 1000000000;
+	t->secs++;
+    }
+}
+
+static void
+entry_free(struct gensio_os_funcs *o, struct addrcache_entry *e)
+{
+    if (e->addr)
+	gensio_addr_free(e->addr);
+    if (e->key)
+	o->free(o, e->key);
+    o->free(o, e);
+}
+
+/* Must be called with the lock held.  Puts the entry on the free list. */
+static void
+entry_rm(struct gensio_addrcache *c, struct addrcache_entry *e,
+	 struct gensio_list *freelist)
+{
+    gensio_list_rm(&c->entries, &e->link);
+    c->nr_entries--;
+    gensio_list_add_tail(freelist, &e->link);
+}
+
+static void
+freelist_free(struct gensio_os_funcs *o, struct gensio_list *freelist)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(freelist, l, l2) {
+	struct addrcache_entry *e = gensio_container_of(l,
+							struct addrcache_entry,
+							link);
+
+	gensio_list_rm(freelist, l);
+	entry_free(o, e);
+    }
+}
+
+/* Must be called with the lock held. */
+static void
+flush_all(struct gensio_addrcache *c, struct gensio_list *freelist)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(&c->entries, l, l2) {
+	struct addrcache_entry *e = gensio_container_of(l,
+							struct addrcache_entry,
+							link);
+
+	entry_rm(c, e, freelist);
+    }
+}
+
+struct gensio_addrcache *
+gensio_addrcache_alloc(struct gensio_os_funcs *o, gensio_addrcache_scan scan)
+{
+    struct gensio_addrcache *c;
+
+    c = o->zalloc(o, sizeof(*c));
+    if (!c)
+	return NULL;
+    c->o = o;
+    c->scan = scan;
+    c->config.max_entries = ADDRCACHE_DEFAULT_MAX;
+    LOCK_INIT(&c->lock);
+    gensio_list_init(&c->entries);
+    return c;
+}
+
+void
+gensio_addrcache_free(struct gensio_addrcache *c)
+{
+    struct gensio_os_funcs *o = c->o;
+    struct gensio_list freelist;
+
+    gensio_list_init(&freelist);
+    flush_all(c, &freelist);
+    freelist_free(o, &freelist);
+    LOCK_DESTROY(&c->lock);
+    o->free(o, c);
+}
+
+/* Must be called with the lock held. */
+static struct addrcache_entry *
+addrcache_find(struct gensio_addrcache *c, const char *key, unsigned int hash)
+{
+    struct gensio_link *l;
+
+    gensio_list_for_each(&c->entries, l) {
+	struct addrcache_entry *e = gensio_container_of(l,
+							struct addrcache_entry,
+							link);
+
+	if (e->hash == hash && strcmp(e->key, key) == 0)
+	    return e;
+    }
+    return NULL;
+}
+
+static bool
+err_is_cacheable(int err)
+{
+    /* Only cache answers, not failures to get an answer. */
+    return err == GE_NAME_ERROR || err == GE_NOTFOUND;
+}
+
+static void
+addrcache_add(struct gensio_addrcache *c, char *key, unsigned int hash,
+	      int err, const struct gensio_addr *addr, bool is_port_set,
+	      const gensio_time *now)
+{
+    struct gensio_os_funcs *o = c->o;
+    struct addrcache_entry *e, *old;
+    struct gensio_list freelist;
+
+    e = o->zalloc(o, sizeof(*e));
+    if (!e) {
+	o->free(o, key);
+	return;
+    }
+    e->key = key;
+    e->hash = hash;
+    e->err = err;
+    e->is_port_set = is_port_set;
+    if (addr) {
+	e->addr = gensio_addr_dup(addr);
+	if (!e->addr) {
+	    entry_free(o, e);
+	    return;
+	}
+    }
+
+    gensio_list_init(&freelist);
+    LOCK(&c->lock);
+    /* The config may have changed while we were looking it up. */
+    if (err)
+	e->expires = c->config.neg_ttl;
+    else
+	e->expires = c->config.ttl;
+    if (time_is_zero(&e->expires)) {
+	gensio_list_add_tail(&freelist, &e->link);
+	goto out_unlock;
+    }
+    time_add(&e->expires, now);
+
+    /* Someone else may have looked it up at the same time. */
+    old = addrcache_find(c, key, hash);
+    if (old)
+	entry_rm(c, old, &freelist);
+    gensio_list_add_head(&c->entries, &e->link);
+    c->nr_entries++;
+    while (c->nr_entries > c->config.max_entries) {
+	old = gensio_container_of(gensio_list_last(&c->entries),
+				  struct addrcache_entry, link);
+	entry_rm(c, old, &freelist);
+    }
+ out_unlock:
+    UNLOCK(&c->lock);
+    freelist_free(o, &freelist);
+}
+
+int
+gensio_addrcache_scan_ips(struct gensio_addrcache *c,
+			  struct gensio_os_funcs *o, const char *str,
+			  bool listen, int ifamily, int protocol,
+			  bool *is_port_set, bool scan_port,
+			  struct gensio_addr **raddr)
+{
+    struct addrcache_entry *e;
+    struct gensio_addr *addr = NULL;
+    struct gensio_list freelist;
+    gensio_time now;
+    bool port_set = false;
+    unsigned int hash;
+    char *key;
+    gensiods len;
+    int err;
+
+    if (listen || protocol == GENSIO_NET_PROTOCOL_UNIX)
+	return c->scan(o, str, listen, ifamily, protocol, is_port_set,
+		       scan_port, raddr);
+
+    LOCK(&c->lock);
+    if (time_is_zero(&c->config.ttl)) {
+	UNLOCK(&c->lock);
+	return c->scan(o, str, listen, ifamily, protocol, is_port_set,
+		       scan_port, raddr);
+    }
+    UNLOCK(&c->lock);
+
+    len = strlen(str) + 40;
+    key = o->zalloc(o, len);
+    if (!key)
+	return GE_NOMEM;
+    snprintf(key, len, "%d,%d,%d,%s", ifamily, protocol, scan_port, str);
+    hash = addrcache_hash(key);
+
+    o->get_monotonic_time(o, &now);
+    gensio_list_init(&freelist);
+    LOCK(&c->lock);
+    e = addrcache_find(c, key, hash);
+    if (e && time_before(&e->expires, &now)) {
+	c->expired++;
+	entry_rm(c, e, &freelist);
+	e = NULL;
+    }
+    if (e) {
+	gensio_list_rm(&c->entries, &e->link);
+	gensio_list_add_head(&c->entries, &e->link);
+	err = e->err;
+	if (err) {
+	    c->neg_hits++;
+	} else {
+	    addr = gensio_addr_dup(e->addr);
+	    if (!addr)
+		err = GE_NOMEM;
+	    port_set = e->is_port_set;
+	    c->hits++;
+	}
+	UNLOCK(&c->lock);
+	o->free(o, key);
+	goto out;
+    }
+    c->misses++;
+    UNLOCK(&c->lock);
+    freelist_free(o, &freelist);
+
+    /* Don't hold the lock over the lookup, it may take a while. */
+    err = c->scan(o, str, listen, ifamily, protocol, &port_set, scan_port,
+		  &addr);
+    if (!err || err_is_cacheable(err))
+	addrcache_add(c, key, hash, err, addr, port_set, &now);
+    else
+	o->free(o, key);
+
+ out:
+    if (!err) {
+	if (is_port_set)
+	    *is_port_set = port_set;
+	*raddr = addr;
+    }
+    return err;
+}
+
+int
+gensio_addrcache_control(struct gensio_addrcache *c, int func, void *data,
+			 gensiods *datalen)
+{
+    struct gensio_addrcache_stats *stats = data;
+    struct gensio_addrcache_config *config = data;
+    struct gensio_list freelist;
+
+    switch (func) {
+    case GENSIO_CONTROL_ADDRCACHE_SET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	gensio_list_init(&freelist);
+	LOCK(&c->lock);
+	c->config = *config;
+	if (c->config.max_entries == 0)
+	    c->config.max_entries = ADDRCACHE_DEFAULT_MAX;
+	/* Anything in there was kept under the old times. */
+	flush_all(c, &freelist);
+	UNLOCK(&c->lock);
+	freelist_free(c->o, &freelist);
+	return 0;
+
+    case GENSIO_CONTROL_ADDRCACHE_GET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	LOCK(&c->lock);
+	*config = c->config;
+	UNLOCK(&c->lock);
+	*datalen = sizeof(*config);
+	return 0;
+
+    case GENSIO_CONTROL_ADDRCACHE_STATS:
+	if (!datalen || *datalen < sizeof(*stats))
+	    return GE_INVAL;
+	LOCK(&c->lock);
+	stats->hits = c->hits;
+	stats->neg_hits = c->neg_hits;
+	stats->misses = c->misses;
+	stats->expired = c->expired;
+	stats->entries = c->nr_entries;
+	UNLOCK(&c->lock);
+	*datalen = sizeof(*stats);
+	return 0;
+
+    case GENSIO_CONTROL_ADDRCACHE_FLUSH:
+	gensio_list_init(&freelist);
+	LOCK(&c->lock);
+	flush_all(c, &freelist);
+	UNLOCK(&c->lock);
+	freelist_free(c->o, &freelist);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
@@ -51,6 +51,22 @@ struct gensio_addr_addrinfo {
     int *refcount;
 #endif
     bool is_getaddrinfo; /* Allocated with getaddrinfo()? */
+    bool is_recvfrom; /* Storage is reused for each receive. */
+    bool is_inline; /* A single address in a gensio_addr_inline. */
+};
+
+/*
+ * A single address with the addrinfo and the socket address in the
+ * same allocation as the gensio_addr.  Most addresses (accepted
+ * connections, received packets, getpeername) are a single address,
+ * this takes one allocation instead of four.  These are never shared
+ * with a refcount, since the addrinfo goes away with the first one
+ * freed, a duplicate is just another copy.
+ */
+struct gensio_addr_inline {
+    struct gensio_addr_addrinfo a;
+    struct addrinfo ai;
+    struct sockaddr_storage ss;
 };
 
 static struct gensio_addr_funcs addrinfo_funcs;
@@ -83,13 +99,35 @@ gensio_addr_addrinfo_set(struct gensio_addr *aaddr,
     addr->curr = ai;
 }
 
+static struct gensio_addr_addrinfo *
+gensio_addrinfo_make_inline(struct gensio_os_funcs *o, unsigned int size)
+{
+    struct gensio_addr_inline *iaddr = o->zalloc(o, sizeof(*iaddr));
+
+    if (!iaddr)
+	return NULL;
+    iaddr->ai.ai_addr = (struct sockaddr *) &iaddr->ss;
+    iaddr->ai.ai_addrlen = size;
+    iaddr->a.o = o;
+    iaddr->a.r.funcs = &addrinfo_funcs;
+    iaddr->a.a = &iaddr->ai;
+    iaddr->a.curr = &iaddr->ai;
+    iaddr->a.is_inline = true;
+
+    return &iaddr->a;
+}
+
 static struct gensio_addr_addrinfo *
 gensio_addrinfo_make(struct gensio_os_funcs *o, unsigned int size,
 		     bool is_recvfrom)
 {
-    struct gensio_addr_addrinfo *addr = o->zalloc(o, sizeof(*addr));
+    struct gensio_addr_addrinfo *addr;
     struct addrinfo *ai = NULL, *nai;
 
+    if (!is_recvfrom && size > 0 && size <= sizeof(struct sockaddr_storage))
+	return gensio_addrinfo_make_inline(o, size);
+
+    addr = o->zalloc(o, sizeof(*addr));
     if (!addr)
 	return NULL;
 
@@ -131,6 +169,7 @@ gensio_addrinfo_make(struct gensio_os_funcs *o, unsigned int size,
     addr->r.funcs = &addrinfo_funcs;
     addr->a = ai;
     addr->curr = ai;
+    addr->is_recvfrom = is_recvfrom;
 
     return addr;
  out_err:
@@ -362,6 +401,85 @@ sockaddr_equal(const struct sockaddr *a1, socklen_t l1,
     return true;
 }
 
+/*
+ * FNV-1a hash.  Address hashes only need to be consistent with
+ * sockaddr_equal() for a single current address.
+ */
+static unsigned int
+sockaddr_hash_bytes(unsigned int hash, const void *data, size_t len)
+{
+    const unsigned char *d = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	hash ^= d[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned int
+sockaddr_hash(const struct sockaddr *a, bool hash_ports)
+{
+    unsigned int hash = 2166136261u;
+
+    switch (a->sa_family) {
+    case AF_INET:
+	{
+	    struct sockaddr_in *s = (struct sockaddr_in *) a;
+
+	    hash = sockaddr_hash_bytes(hash, &s->sin_addr.s_addr,
+				       sizeof(s->sin_addr.s_addr));
+	    if (hash_ports)
+		hash = sockaddr_hash_bytes(hash, &s->sin_port,
+					   sizeof(s->sin_port));
+	}
+	break;
+
+#ifdef AF_INET6
+    case AF_INET6:
+	{
+	    struct sockaddr_in6 *s = (struct sockaddr_in6 *) a;
+
+	    /* V4 mapped addresses compare equal to the V4 address. */
+	    if (IN6_IS_ADDR_V4MAPPED(&s->sin6_addr))
+		hash = sockaddr_hash_bytes(hash, s->sin6_addr.s6_addr + 12, 4);
+	    else
+		hash = sockaddr_hash_bytes(hash, s->sin6_addr.s6_addr,
+					   sizeof(s->sin6_addr.s6_addr));
+	    if (hash_ports)
+		hash = sockaddr_hash_bytes(hash, &s->sin6_port,
+					   sizeof(s->sin6_port));
+	}
+	break;
+#endif
+
+#if HAVE_UNIX
+    case AF_UNIX:
+	{
+	    struct sockaddr_un *s = (struct sockaddr_un *) a;
+
+	    hash = sockaddr_hash_bytes(hash, s->sun_path, strlen(s->sun_path));
+	}
+	break;
+#endif
+
+    default:
+	/* Unknown family, these never compare equal. */
+	break;
+    }
+
+    return hash;
+}
+
+static unsigned int
+gensio_addr_addrinfo_hash(const struct gensio_addr *aaddr, bool hash_ports)
+{
+    struct gensio_addr_addrinfo *addr = a_to_info(aaddr);
+
+    return sockaddr_hash(addr->curr->ai_addr, hash_ports);
+}
+
 static bool
 gensio_addr_addrinfo_equal(const struct gensio_addr *aa1,
 			   const struct gensio_addr *aa2,
@@ -960,6 +1078,29 @@ gensio_addr_addrinfo_dup(const struct gensio_addr *iaaddr)
 	return NULL;
     iaddr = a_to_info(iaaddr);
     o = iaddr->o;
+
+    /*
+     * A single address, or the source address of a received packet
+     * (the other entries there are information about the receive),
+     * just gets copied inline.
+     */
+    if ((iaddr->is_inline || iaddr->is_recvfrom ||
+		(iaddr->a && !iaddr->a->ai_next)) &&
+	    iaddr->a && !iaddr->a->ai_canonname &&
+	    iaddr->a->ai_addrlen <= sizeof(struct sockaddr_storage)) {
+	struct addrinfo *ai = iaddr->a;
+
+	addr = gensio_addrinfo_make_inline(o, ai->ai_addrlen);
+	if (!addr)
+	    return NULL;
+	addr->a->ai_flags = ai->ai_flags;
+	addr->a->ai_family = ai->ai_family;
+	addr->a->ai_socktype = ai->ai_socktype;
+	addr->a->ai_protocol = ai->ai_protocol;
+	memcpy(addr->a->ai_addr, ai->ai_addr, ai->ai_addrlen);
+	return &addr->r;
+    }
+
     addr = o->zalloc(o, sizeof(*addr));
     if (!addr)
 	return NULL;
@@ -1061,6 +1202,12 @@ gensio_addr_addrinfo_free(struct gensio_addr *aaddr)
     struct gensio_addr_addrinfo *addr = a_to_info(aaddr);
     struct gensio_os_funcs *o = addr->o;
 
+    if (addr->is_inline) {
+	/* The addrinfo and address are part of the same allocation. */
+	o->free(o, addr);
+	return;
+    }
+
 #if HAVE_GCC_ATOMICS
     if (addr->refcount) {
 	if (__atomic_sub_fetch(addr->refcount, 1, __ATOMIC_SEQ_CST) != 0) {
@@ -1148,7 +1295,8 @@ static struct gensio_addr_funcs addrinfo_funcs = {
     .addr_rewind = gensio_addr_addrinfo_rewind,
     .addr_get_nettype = gensio_addr_addrinfo_get_nettype,
     .addr_family_supports = gensio_addr_addrinfo_family_supports,
-    .addr_getaddr = gensio_addr_addrinfo_getaddr
+    .addr_getaddr = gensio_addr_addrinfo_getaddr,
+    .addr_hash = gensio_addr_addrinfo_hash
 };
 
 void
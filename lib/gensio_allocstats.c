@@ -0,0 +1,191 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Allocation accounting for OS handlers.  When turned on, every
+ * allocation is counted by the address it was called from, and
+ * allocations done while a thread is moving data (inside a write or
+ * the delivery of read data) are counted separately, so a steady
+ * state with no allocations per message can be checked.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_err.h>
+#include <gensio/gensio_osops.h>
+#include <pthread_handler.h>
+
+#ifdef _MSC_VER
+#define ALLOCSTATS_THREAD_LOCAL __declspec(thread)
+#else
+#define ALLOCSTATS_THREAD_LOCAL __thread
+#endif
+
+/* Open addressed, twice the reported sites to keep chains short. */
+#define ALLOCSTATS_HASH_SIZE (GENSIO_ALLOC_STATS_MAX_SITES * 2)
+
+struct gensio_allocstats {
+    bool enabled;
+    lock_type lock;
+    struct gensio_alloc_stats stats;
+    struct gensio_alloc_site sites[ALLOCSTATS_HASH_SIZE];
+};
+
+/* How deep the calling thread is in data path operations. */
+static ALLOCSTATS_THREAD_LOCAL unsigned int datapath_depth;
+
+/* Set by wrappers like gensio_os_buf_alloc() to report their caller. */
+static ALLOCSTATS_THREAD_LOCAL void *alloc_caller;
+
+void
+gensio_allocstats_set_caller(void *site)
+{
+    alloc_caller = site;
+}
+
+void
+gensio_alloc_datapath_enter(void)
+{
+    datapath_depth++;
+}
+
+void
+gensio_alloc_datapath_exit(void)
+{
+    datapath_depth--;
+}
+
+struct gensio_allocstats *
+gensio_allocstats_alloc(void)
+{
+    struct gensio_allocstats *s;
+
+    s = malloc(sizeof(*s));
+    if (!s)
+	return NULL;
+    memset(s, 0, sizeof(*s));
+    LOCK_INIT(&s->lock);
+    return s;
+}
+
+void
+gensio_allocstats_free(struct gensio_allocstats *s)
+{
+    LOCK_DESTROY(&s->lock);
+    free(s);
+}
+
+static struct gensio_alloc_site *
+allocstats_find_site(struct gensio_allocstats *s, void *site)
+{
+    unsigned int i, h;
+
+    h = (unsigned int) (((uintptr_t) site >> 4) % ALLOCSTATS_HASH_SIZE);
+    for (i = 0; i < ALLOCSTATS_HASH_SIZE; i++) {
+	struct gensio_alloc_site *e = &s->sites[h];
+
+	if (e->site == site)
+	    return e;
+	if (!e->site) {
+	    if (s->stats.nr_sites >= GENSIO_ALLOC_STATS_MAX_SITES)
+		return NULL;
+	    s->stats.nr_sites++;
+	    e->site = site;
+	    return e;
+	}
+	h = (h + 1) % ALLOCSTATS_HASH_SIZE;
+    }
+    return NULL;
+}
+
+void
+gensio_allocstats_alloced(struct gensio_allocstats *s, void *site,
+			  gensiods size)
+{
+    struct gensio_alloc_site *e;
+    bool datapath = datapath_depth > 0;
+
+    if (alloc_caller) {
+	site = alloc_caller;
+	alloc_caller = NULL;
+    }
+    if (!s || !s->enabled)
+	return;
+
+    LOCK(&s->lock);
+    s->stats.allocs++;
+    s->stats.bytes += size;
+    if (datapath) {
+	s->stats.datapath_allocs++;
+	s->stats.datapath_bytes += size;
+    }
+    e = allocstats_find_site(s, site);
+    if (e) {
+	e->allocs++;
+	e->bytes += size;
+	if (datapath)
+	    e->datapath_allocs++;
+    } else {
+	s->stats.other_site_allocs++;
+    }
+    UNLOCK(&s->lock);
+}
+
+void
+gensio_allocstats_freed(struct gensio_allocstats *s)
+{
+    if (!s || !s->enabled)
+	return;
+
+    LOCK(&s->lock);
+    s->stats.frees++;
+    UNLOCK(&s->lock);
+}
+
+int
+gensio_allocstats_control(struct gensio_allocstats *s, int func, void *data,
+			  gensiods *datalen)
+{
+    struct gensio_alloc_stats_config *config = data;
+    struct gensio_alloc_stats *stats = data;
+    unsigned int i, j;
+
+    if (!s)
+	return GE_NOTSUP;
+
+    switch (func) {
+    case GENSIO_CONTROL_ALLOC_STATS_SET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	LOCK(&s->lock);
+	/* Start over on every set. */
+	memset(&s->stats, 0, sizeof(s->stats));
+	memset(s->sites, 0, sizeof(s->sites));
+	s->enabled = config->enable;
+	UNLOCK(&s->lock);
+	return 0;
+
+    case GENSIO_CONTROL_ALLOC_STATS:
+	if (!datalen || *datalen < sizeof(*stats))
+	    return GE_INVAL;
+	LOCK(&s->lock);
+	*stats = s->stats;
+	for (i = 0, j = 0; i < ALLOCSTATS_HASH_SIZE; i++) {
+	    if (s->sites[i].site)
+		stats->sites[j++] = s->sites[i];
+	}
+	UNLOCK(&s->lock);
+	*datalen = sizeof(*stats);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Arenas for the allocations done while setting up a gensio stack.
+ * Setting up a connection does a lot of small allocations that are
+ * all freed when the connection goes away.  Inside a setup scope
+ * (see gensio_setup_scope_start()) those come from an arena instead,
+ * a few chunks carved up in order and never reused.  Each allocation
+ * holds a reference on the arena, the chunks are freed together when
+ * the last one is freed.
+ *
+ * Only the thread in the scope allocates from an arena, the frees
+ * may come from anywhere, so only the refcount needs protection.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+
+#ifdef _MSC_VER
+#define ARENA_THREAD_LOCAL __declspec(thread)
+#else
+#define ARENA_THREAD_LOCAL __thread
+#endif
+
+#define ARENA_CHUNK_SIZE	4096
+#define ARENA_ALIGN(s)		(((s) + 15) & ~((gensiods) 15))
+/* Bigger than this goes to o->zalloc so it doesn't waste a chunk. */
+#define ARENA_MAX_ALLOC		(ARENA_CHUNK_SIZE / 4)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+};
+#define ARENA_CHUNK_HDR		ARENA_ALIGN(sizeof(struct arena_chunk))
+
+struct gensio_arena {
+    struct gensio_os_funcs *o;
+
+    /* Allocations from the arena plus open scopes using it. */
+    unsigned int refcount;
+#if !HAVE_GCC_ATOMICS
+    struct gensio_lock *lock;
+#endif
+
+    /* The arena itself is at the start of the first chunk. */
+    struct arena_chunk *chunks;
+    unsigned char *pos;
+    gensiods left;
+};
+#define ARENA_HDR		ARENA_ALIGN(sizeof(struct gensio_arena))
+
+static ARENA_THREAD_LOCAL struct {
+    unsigned int depth;
+    struct gensio_os_funcs *o;
+    struct gensio_arena *arena;
+} setup_scope;
+
+static struct gensio_arena *
+arena_alloc(struct gensio_os_funcs *o)
+{
+    struct arena_chunk *c;
+    struct gensio_arena *a;
+
+    /* Memory debugging wants to see each allocation. */
+    if (getenv("GENSIO_MEMTRACK"))
+	return NULL;
+
+    c = o->zalloc(o, ARENA_CHUNK_SIZE);
+    if (!c)
+	return NULL;
+    a = (struct gensio_arena *) (((unsigned char *) c) + ARENA_CHUNK_HDR);
+#if !HAVE_GCC_ATOMICS
+    a->lock = o->alloc_lock(o);
+    if (!a->lock) {
+	o->free(o, c);
+	return NULL;
+    }
+#endif
+    a->o = o;
+    a->refcount = 1;
+    a->chunks = c;
+    a->pos = ((unsigned char *) a) + ARENA_HDR;
+    a->left = ARENA_CHUNK_SIZE - ARENA_CHUNK_HDR - ARENA_HDR;
+    return a;
+}
+
+static void
+arena_ref(struct gensio_arena *a)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(&a->refcount, 1, __ATOMIC_RELAXED);
+#else
+    a->o->lock(a->lock);
+    a->refcount++;
+    a->o->unlock(a->lock);
+#endif
+}
+
+static void
+arena_deref(struct gensio_arena *a)
+{
+    struct gensio_os_funcs *o = a->o;
+    struct arena_chunk *c, *next;
+    unsigned int count;
+
+#if HAVE_GCC_ATOMICS
+    count = __atomic_sub_fetch(&a->refcount, 1, __ATOMIC_ACQ_REL);
+#else
+    o->lock(a->lock);
+    count = --a->refcount;
+    o->unlock(a->lock);
+#endif
+    if (count > 0)
+	return;
+
+#if !HAVE_GCC_ATOMICS
+    o->free_lock(a->lock);
+#endif
+    /* The first chunk holds the arena, so it goes last. */
+    for (c = a->chunks; c; c = next) {
+	next = c->next;
+	o->free(o, c);
+    }
+}
+
+static void *
+arena_get(struct gensio_arena *a, gensiods size)
+{
+    struct gensio_os_funcs *o = a->o;
+    struct arena_chunk *c;
+    void *rv;
+
+    size = ARENA_ALIGN(size);
+    if (size > ARENA_MAX_ALLOC)
+	return NULL;
+    if (size > a->left) {
+	c = o->zalloc(o, ARENA_CHUNK_SIZE);
+	if (!c)
+	    return NULL;
+	/* Keep the first chunk at the end of the list. */
+	c->next = a->chunks;
+	a->chunks = c;
+	a->pos = ((unsigned char *) c) + ARENA_CHUNK_HDR;
+	a->left = ARENA_CHUNK_SIZE - ARENA_CHUNK_HDR;
+    }
+    rv = a->pos;
+    a->pos += size;
+    a->left -= size;
+    arena_ref(a);
+    /* The chunks are zeroed and never reused, nothing to clear. */
+    return rv;
+}
+
+void
+gensio_setup_scope_start(struct gensio_os_funcs *o, struct gensio_arena *join)
+{
+    if (setup_scope.depth++ > 0)
+	return;
+    setup_scope.o = o;
+    setup_scope.arena = join;
+    if (join)
+	arena_ref(join);
+}
+
+void
+gensio_setup_scope_end(void)
+{
+    if (--setup_scope.depth > 0)
+	return;
+    if (setup_scope.arena)
+	arena_deref(setup_scope.arena);
+    setup_scope.arena = NULL;
+    setup_scope.o = NULL;
+}
+
+void *
+gensio_setup_zalloc(struct gensio_os_funcs *o, gensiods size,
+		    struct gensio_arena **arena)
+{
+    void *rv = NULL;
+
+    *arena = NULL;
+    if (setup_scope.depth > 0 && setup_scope.o == o) {
+	if (!setup_scope.arena)
+	    setup_scope.arena = arena_alloc(o);
+	if (setup_scope.arena)
+	    rv = arena_get(setup_scope.arena, size);
+	if (rv)
+	    *arena = setup_scope.arena;
+    }
+    if (!rv)
+	rv = o->zalloc(o, size);
+    return rv;
+}
+
+void
+gensio_setup_free(struct gensio_os_funcs *o, struct gensio_arena *arena,
+		  void *data)
+{
+    if (arena)
+	arena_deref(arena);
+    else
+	o->free(o, data);
+}
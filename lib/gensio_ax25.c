@@ -32,9 +32,11 @@
  *   byte 2 - The lower 8 bits of the maximum message size.
  *   byte 3 - Unused flags, should all be zero.
  *
- * This code does not currently send an SREJ.  That's pretty
- * complicated, but could be valuable in some situations.  This may be
- * added in the future.  It will handle a received SREJ.
+ * SREJ is sent only if the remote end advertises it in its XID
+ * optional functions and the srej option is set (the default).  Out
+ * of sequence frames in the receive window are then held and only
+ * the missing frame is requested, one SREJ at a time.  Otherwise a
+ * REJ is sent.  A received SREJ is always handled.
  *
  * Flow-control enable/disable is not done immediately, it is delayed
  * until an ack is sent.  That way momentary enable/disable operations
@@ -129,54 +131,6 @@
 #include "utils.h"
 #endif
 
-/* See rfc1549 */
-static const unsigned short ccitt_table[256] = {
-   0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-   0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-   0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-   0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-   0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-   0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-   0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-   0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-   0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-   0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-   0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-   0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-   0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-   0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-   0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-   0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-   0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-   0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-   0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-   0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-   0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-   0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-   0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-   0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-   0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-   0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-   0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-   0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-   0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-   0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-   0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-   0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
-
-static void
-crc16_ccitt(const unsigned char *buf, unsigned int len, uint16_t *icrc)
-{
-	unsigned int i;
-	unsigned short crc = *icrc;
-
-	for (i = 0; i < len; i++)
-	    crc = (crc >> 8) ^ ccitt_table[(crc ^ buf[i]) & 0xff];
-
-	*icrc = crc;
-}
-
 enum x25_cmds {
     X25_SABME = 0x6f,
     X25_SABM = 0x2f,
@@ -473,6 +427,13 @@ struct ax25_base_cmdrsp {
 };
 #define AX25_BASE_MAX_CMDRSP 16
 
+/*
+ * Initial number of channel address hash buckets, must be a power of
+ * two.  The table doubles when it averages more than two channels per
+ * bucket.
+ */
+#define AX25_CHAN_HASH_INIT_SIZE 16
+
 struct ax25_conf_data {
     gensiods max_read_size;
     gensiods max_write_size;
@@ -484,6 +445,7 @@ struct ax25_conf_data {
     unsigned int t3v;
     unsigned int max_retries;
     unsigned int extended;
+    bool srej;
     bool do_crc;
     bool ignore_embedded_ua;
     struct gensio_ax25_subaddr *my_addrs;
@@ -521,6 +483,18 @@ struct ax25_base {
     /* Channels in all other states, they can receive messages. */
     struct gensio_list chans;
 
+    /*
+     * Every channel with an address is in this hash, hash_link
+     * element, whatever list it is in.  Received frames look up their
+     * channel here.
+     */
+    struct gensio_list *chan_hash;
+    unsigned int chan_hash_size;
+    unsigned int chan_hash_count;
+
+    /* Channels with report_ui set, ui_link element. */
+    struct gensio_list ui_chans;
+
     /*
      * If a channel has data to write, it will be in this, linksend element.
      */
@@ -593,6 +567,13 @@ struct ax25_chan {
     struct gensio_link link;
     struct gensio_os_funcs *o;
 
+    /* For the address hash in the base, hash of conf.addr. */
+    struct gensio_link hash_link;
+    unsigned int addr_hash;
+
+    /* In the base's ui_chans if report_ui is set. */
+    struct gensio_link ui_link;
+
     struct ax25_base *base;
 
     bool locked;
@@ -699,9 +680,26 @@ struct ax25_chan {
     bool data_p_sent; /* Sent a P=1 in data. */
 
     /*
-     * SREJ is not currently implemented on the send side, just the receive.
-     * uint8_t srej_count;
+     * The peer told us in its XID that it handles SREJ, so out of
+     * sequence frames are held in read_data past read_len and only
+     * the missing frame is requested.  in_srej is set while an SREJ
+     * is outstanding.
      */
+    bool peer_srej;
+    bool in_srej;
+
+    /* Statistics, reported by GENSIO_CONTROL_CONN_STATS. */
+    struct {
+	unsigned long long i_sent;
+	unsigned long long i_resent;
+	unsigned long long i_rcvd;
+	unsigned long long out_of_seq;
+	unsigned long long rej_sent;
+	unsigned long long srej_sent;
+	unsigned long long rej_rcvd;
+	unsigned long long srej_rcvd;
+	unsigned long long t1_timeouts;
+    } stats;
 
     struct ax25_conf_data conf;
 
@@ -860,6 +858,8 @@ static void
 ax25_base_finish_free(struct ax25_base *base)
 {
     ax25_cleanup_conf(base->o, &base->conf);
+    if (base->chan_hash)
+	base->o->free(base->o, base->chan_hash);
     if (base->lock)
 	base->o->free_lock(base->lock);
     if (base->child)
@@ -913,6 +913,59 @@ i_ax25_chan_unlock(struct ax25_chan *chan)
 	i_ax25_chan_unlock((chan));		\
     } while(false)
 
+static void
+ax25_base_hash_grow(struct ax25_base *base)
+{
+    struct gensio_os_funcs *o = base->o;
+    struct gensio_list *nhash;
+    struct gensio_link *l, *l2;
+    unsigned int i, nsize = base->chan_hash_size * 2;
+
+    nhash = o->zalloc(o, sizeof(*nhash) * nsize);
+    if (!nhash)
+	return; /* Just run with longer chains. */
+    for (i = 0; i < nsize; i++)
+	gensio_list_init(&nhash[i]);
+
+    for (i = 0; i < base->chan_hash_size; i++) {
+	gensio_list_for_each_safe(&base->chan_hash[i], l, l2) {
+	    struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan,
+							 hash_link);
+
+	    gensio_list_rm(&base->chan_hash[i], l);
+	    gensio_list_add_tail(&nhash[chan->addr_hash & (nsize - 1)], l);
+	}
+    }
+    o->free(o, base->chan_hash);
+    base->chan_hash = nhash;
+    base->chan_hash_size = nsize;
+}
+
+/* Must hold the base lock, the channel's address must be set. */
+static void
+ax25_base_hash_add_chan(struct ax25_base *base, struct ax25_chan *chan)
+{
+    if (base->chan_hash_count >= base->chan_hash_size * 2)
+	ax25_base_hash_grow(base);
+    chan->addr_hash = gensio_addr_hash(chan->conf.addr, true);
+    gensio_list_add_tail(&base->chan_hash[chan->addr_hash &
+					  (base->chan_hash_size - 1)],
+			 &chan->hash_link);
+    base->chan_hash_count++;
+}
+
+/* Must hold the base lock. */
+static void
+ax25_base_hash_rm_chan(struct ax25_base *base, struct ax25_chan *chan)
+{
+    if (!gensio_list_link_inlist(&chan->hash_link))
+	return;
+    gensio_list_rm(&base->chan_hash[chan->addr_hash &
+				    (base->chan_hash_size - 1)],
+		   &chan->hash_link);
+    base->chan_hash_count--;
+}
+
 static void
 ax25_chan_finish_free(struct ax25_chan *chan, bool baselocked)
 {
@@ -941,6 +994,9 @@ ax25_chan_finish_free(struct ax25_chan *chan, bool baselocked)
 	    ax25_base_lock(base);
 	if (gensio_list_link_inlist(&chan->sendlink))
 	    gensio_list_rm(&base->send_list, &chan->sendlink);
+	ax25_base_hash_rm_chan(base, chan);
+	if (gensio_list_link_inlist(&chan->ui_link))
+	    gensio_list_rm(&base->ui_chans, &chan->ui_link);
 	gensio_list_rm(&base->chans_closed, &chan->link);
 	if (baselocked)
 	    ax25_base_deref(base);
@@ -1370,6 +1426,12 @@ ax25_chan_send_ack(struct ax25_chan *chan, uint8_t pf, bool is_cmd)
 
     if (!pf && !is_cmd && chan->send_len > 0)
 	return; /* Just let an I frame ack it. */
+    if (pf && !is_cmd && chan->in_srej) {
+	/* Still missing a frame, ask for it again in the response. */
+	chan->stats.srej_sent++;
+	ax25_chan_send_rsp(chan, X25_SREJ, pf);
+	return;
+    }
     for (pos = chan->cmdrsp_pos, i = 0; i < chan->cmdrsp_len; i++) {
 	struct ax25_chan_cmdrsp *cr= &(chan->cmdrsp[pos]);
 
@@ -1529,19 +1591,19 @@ ax25_chan_sched_deferred_op(struct ax25_chan *chan)
 static struct ax25_chan *
 ax25_base_lookup_chan_by_addr(struct ax25_base *base, struct gensio_addr *addr)
 {
+    unsigned int hash = gensio_addr_hash(addr, true);
+    struct gensio_list *bucket;
     struct gensio_link *l;
 
-    gensio_list_for_each(&base->chans, l) {
-	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan, link);
-
-	if (chan->conf.addr &&
-		gensio_addr_equal(addr, chan->conf.addr, true, false))
-	    return chan;
-    }
-    gensio_list_for_each(&base->chans_waiting_open, l) {
-	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan, link);
+    bucket = &base->chan_hash[hash & (base->chan_hash_size - 1)];
+    gensio_list_for_each(bucket, l) {
+	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan,
+						     hash_link);
 
-	if (chan->conf.addr &&
+	/* Closed channels stay in the hash, skip those. */
+	if (chan->addr_hash == hash &&
+		!gensio_list_link_in_this_list(&chan->link,
+					       &base->chans_closed) &&
 		gensio_addr_equal(addr, chan->conf.addr, true, false))
 	    return chan;
     }
@@ -1746,6 +1808,8 @@ ax25_proto_err(struct ax25_base *base, struct ax25_chan *chan,
 static void
 ax25_chan_reset_data(struct ax25_chan *chan)
 {
+    unsigned int i;
+
     chan->vs = 0;
     chan->va = 0;
     chan->vr = 0;
@@ -1759,6 +1823,11 @@ ax25_chan_reset_data(struct ax25_chan *chan)
     chan->cmdrsp_pos = 0;
     chan->cmdrsp_len = 0;
     chan->in_rej = false;
+    chan->peer_srej = false;
+    chan->in_srej = false;
+    for (i = 0; i < chan->conf.readwindow; i++)
+	chan->read_data[i].present = false;
+    memset(&chan->stats, 0, sizeof(chan->stats));
     chan->ack_pending = 0;
     chan->poll_pending = false;
     chan->data_p_sent = false;
@@ -1943,7 +2012,7 @@ ax25_get_abs_timeout(struct gensio_os_funcs *o, unsigned int val,
 {
     int64_t v;
 
-    o->get_monotonic_time(o, now);
+    gensio_os_funcs_get_loop_time(o, now);
     v = gensio_time_to_msecs(now);
     v += val;
     return v;
@@ -2016,7 +2085,7 @@ ax25_chan_recalc_t1(struct ax25_chan *chan, bool t1_expiry)
     int64_t diff;
 
     /* Calculate how much time is left on t1. */
-    o->get_monotonic_time(o, &now);
+    gensio_os_funcs_get_loop_time(o, &now);
     diff = gensio_time_to_msecs(&now);
     diff = chan->t1 - diff;
     if (diff < 0)
@@ -2042,6 +2111,7 @@ ax25_t1_timeout(struct ax25_chan *chan)
 {
     struct ax25_base *base = chan->base;
 
+    chan->stats.t1_timeouts++;
     switch (chan->state) {
     case AX25_CHAN_IN_OPEN:
 	if (chan->retry_count >= chan->max_retries) {
@@ -2144,7 +2214,7 @@ ax25_chan_timeout(struct gensio_timer *timer, void *cb_data)
     gensio_time t;
     int64_t now;
 
-    o->get_monotonic_time(o, &t);
+    gensio_os_funcs_get_loop_time(o, &t);
     now = gensio_time_to_msecs(&t);
 
     ax25_chan_lock(chan);
@@ -2298,6 +2368,7 @@ ax25_chan_handle_ui(struct ax25_base *base, struct gensio_ax25_addr *addr,
     char pidstr[10];
     const char *auxdata[4] = { "oob", addrstr, pidstr, NULL };
     gensiods rcount;
+    bool for_us;
 
     if (len == 0)
 	return;
@@ -2307,14 +2378,20 @@ ax25_chan_handle_ui(struct ax25_base *base, struct gensio_ax25_addr *addr,
     len--;
     gensio_list_init(&to_deliver);
     ax25_base_lock(base);
-    gensio_list_for_each(&base->chans, l) {
-	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan, link);
+    if (gensio_list_empty(&base->ui_chans)) {
+	ax25_base_unlock(base);
+	return;
+    }
+    for_us = ax25_match_subaddr(&addr->dest, base->conf.my_addrs,
+				base->conf.num_my_addrs);
+    gensio_list_for_each(&base->ui_chans, l) {
+	struct ax25_chan *chan = gensio_container_of(l, struct ax25_chan,
+						     ui_link);
 
-	if (!chan->report_ui || !chan->read_enabled)
+	if (!gensio_list_link_in_this_list(&chan->link, &base->chans) ||
+		!chan->read_enabled)
 	    continue;
-	if (chan->report_ui < 2 &&
-		!ax25_match_subaddr(&addr->dest, chan->base->conf.my_addrs,
-				    chan->base->conf.num_my_addrs))
+	if (chan->report_ui < 2 && !for_us)
 	    continue;
 	gensio_list_add_tail(&to_deliver, &chan->base_lock_ui_link);
 	chan->base_lock_count++;
@@ -2480,6 +2557,9 @@ ax25_chan_handle_sabm(struct ax25_base *base, struct ax25_chan *chan,
 		ax25_chan_report_open(chan);
 		return NULL;
 	    }
+	    ax25_base_lock(base);
+	    ax25_base_hash_add_chan(base, chan);
+	    ax25_base_unlock(base);
 	    chan->encoded_addr_len = ax25_addr_encode(chan->encoded_addr,
 						      chan->conf.addr);
 	    ax25_chan_set_extended(chan, extended, data, len);
@@ -2854,7 +2934,8 @@ ax25_chan_handle_xid(struct ax25_base *base, struct ax25_chan *chan,
 	    break;
 
 	case 3: /* PI HDLC Optional Functions */
-	    /* Ignore this, we only send REJ. */
+	    /* Only use SREJ if the peer says it can handle it. */
+	    chan->peer_srej = chan->conf.srej && (val & 0x040000);
 	    break;
 
 	case 6: /* PI I Field Length RX */
@@ -2865,7 +2946,7 @@ ax25_chan_handle_xid(struct ax25_base *base, struct ax25_chan *chan,
 		break;
 	    if (val > chan->conf.max_write_size)
 		val = chan->conf.max_write_size;
-	    chan->writewindow = val;
+	    chan->max_write_size = val;
 	    break;
 
 	case 8: /* PI Window Size RX */
@@ -2891,6 +2972,14 @@ ax25_chan_handle_xid(struct ax25_base *base, struct ax25_chan *chan,
 	    break;
 	}
     }
+
+    /*
+     * Our XID advertises the full configured read window, so the
+     * peer may use it now even if SABME limited us to 7.
+     */
+    if (chan->extended)
+	chan->readwindow = chan->conf.readwindow;
+
     if (is_cmd)
 	ax25_chan_send_rsp(chan, X25_XID, pf);
 }
@@ -2969,6 +3058,76 @@ ax25_chan_seq_in_range(struct ax25_chan *chan, uint8_t nr)
     return true;
 }
 
+/*
+ * Hold an out of sequence frame in the read queue past the in-order
+ * data so it does not have to be resent after an SREJ.  If it won't
+ * fit, just drop it, it will be resent later.
+ */
+static void
+ax25_chan_hold_data(struct ax25_chan *chan, uint8_t ns, uint8_t pid,
+		    unsigned char *data, unsigned int len)
+{
+    unsigned int off = sub_seq(ns, chan->vr, chan->modulo);
+    struct ax25_data *d;
+
+    if (chan->read_len + off >= chan->conf.readwindow)
+	return;
+    d = &(chan->read_data[add_seq(chan->read_pos, chan->read_len + off,
+				  chan->conf.readwindow)]);
+    memcpy(d->data, data, len);
+    d->pid = pid;
+    d->len = len;
+    d->pos = 0;
+    d->seq = ns;
+    d->present = true;
+}
+
+/*
+ * Move held frames that are now in sequence into the in-order part of
+ * the read queue.  Returns true if any were moved.
+ */
+static bool
+ax25_chan_take_held(struct ax25_chan *chan)
+{
+    struct ax25_data *d;
+    bool rv = false;
+
+    while (chan->read_len < chan->conf.readwindow) {
+	d = &(chan->read_data[add_seq(chan->read_pos, chan->read_len,
+				      chan->conf.readwindow)]);
+	if (!d->present || d->seq != chan->vr)
+	    break;
+	chan->read_len++;
+	chan->vr = add_seq(chan->vr, 1, chan->modulo);
+	rv = true;
+    }
+    return rv;
+}
+
+/* Is there a held frame after a gap at vr? */
+static bool
+ax25_chan_have_held(struct ax25_chan *chan)
+{
+    struct ax25_data *d;
+    unsigned int off;
+
+    for (off = 1; chan->read_len + off < chan->conf.readwindow; off++) {
+	d = &(chan->read_data[add_seq(chan->read_pos, chan->read_len + off,
+				      chan->conf.readwindow)]);
+	if (d->present && d->seq == add_seq(chan->vr, off, chan->modulo))
+	    return true;
+    }
+    return false;
+}
+
+static void
+ax25_chan_send_srej(struct ax25_chan *chan, uint8_t pf)
+{
+    chan->in_srej = true;
+    chan->stats.srej_sent++;
+    ax25_chan_send_rsp(chan, X25_SREJ, pf);
+}
+
 static int
 ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
 		      unsigned char *data, unsigned int len)
@@ -2990,7 +3149,10 @@ ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
     pid = *data;
     data++;
     len--;
+    chan->stats.i_rcvd++;
     if (ns == chan->vr) {
+	bool took_held;
+
 	/* It's what we expect, just deliver it. */
 	if (chan->read_len >= chan->conf.readwindow) {
 	    /* read window violation. */
@@ -3007,11 +3169,19 @@ ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
 	d->seq = ns;
 	d->present = true;
 	chan->read_len++;
-	ax25_chan_deliver_read(chan);
 	chan->vr = add_seq(chan->vr, 1, chan->modulo);
+	took_held = ax25_chan_take_held(chan);
+	if (chan->in_srej) {
+	    chan->in_srej = false;
+	    if (ax25_chan_have_held(chan))
+		/* Another gap after the held frames, request it. */
+		ax25_chan_send_srej(chan, 0);
+	}
+	ax25_chan_deliver_read(chan);
 
 	/* We got some data, handle acks. */
-	if (pf) {
+	if (pf || took_held) {
+	    /* Ack held frames right away to open the peer's window. */
 	    ax25_chan_send_ack(chan, pf, false);
 	} else if (chan->ack_pending > (chan->readwindow / 2)) {
 	    /* More than half the window is used, send an ack now. */
@@ -3025,16 +3195,29 @@ ax25_chan_handle_data(struct ax25_chan *chan, uint8_t ns, uint8_t pf,
     } else {
 	uint8_t end = add_seq(chan->vr, chan->readwindow - 1, chan->modulo);
 
+	chan->stats.out_of_seq++;
 	/*
 	 * Only consider sequences in our window for resends, ignore
 	 * everything else.
 	 */
 	if (seq_in_range(chan->vr, end, ns, chan->modulo)) {
-	    if (chan->in_rej) {
+	    if (chan->peer_srej) {
+		/*
+		 * Keep the frame and ask for just the missing one.
+		 * Only one SREJ is outstanding at a time, a new one
+		 * is sent when the gap is filled.
+		 */
+		ax25_chan_hold_data(chan, ns, pid, data, len);
+		if (!chan->in_srej)
+		    ax25_chan_send_srej(chan, pf);
+		else if (pf)
+		    ax25_chan_send_ack(chan, pf, false);
+	    } else if (chan->in_rej) {
 		if (pf)
 		    ax25_chan_send_ack(chan, pf, false);
 	    } else {
 		chan->in_rej = true;
+		chan->stats.rej_sent++;
 		ax25_chan_send_rsp(chan, X25_REJ, pf);
 		ax25_chan_stop_t2(chan);
 		chan->ack_pending = 0;
@@ -3160,6 +3343,8 @@ ax25_chan_rewind_seq(struct ax25_chan *chan, uint8_t nr, bool selective)
     }
     pos = sub_seq(chan->write_pos, diff, chan->conf.writewindow);
     for (i = 0; i < diff; i++) {
+	if (!chan->write_data[pos].present)
+	    chan->stats.i_resent++;
 	chan->write_data[pos].present = true;
 	if (selective)
 	    /* In selective reject, we only mark the one. */
@@ -3479,7 +3664,7 @@ ax25_child_read(struct ax25_base *base, int ierr,
 	    return 0;
 	msgcrc = (buf[buflen - 1] << 8) | buf[buflen - 2];
 	crc = 0xffff;
-	crc16_ccitt(buf, buflen - 2, &crc);
+	gensio_crc16_ccitt(buf, buflen - 2, &crc);
 	crc ^= 0xffff;
 	if (msgcrc != crc)
 	    return 0;
@@ -3632,10 +3817,12 @@ ax25_child_read(struct ax25_base *base, int ierr,
 	break;
 
     case X25_REJ:
+	chan->stats.rej_rcvd++;
 	err = ax25_chan_handle_rej(base, chan, nr, pf, is_cmd);
 	break;
 
     case X25_SREJ:
+	chan->stats.srej_rcvd++;
 	err = ax25_chan_handle_srej(base, chan, nr, pf, is_cmd);
 	break;
 
@@ -3664,7 +3851,7 @@ crc16_sg(const struct gensio_sg *sg, gensiods sglen, unsigned char *outcrc)
     gensiods i;
 
     for (i = 0; i < sglen; i++)
-	crc16_ccitt(sg[i].buf, sg[i].buflen, &crc);
+	gensio_crc16_ccitt(sg[i].buf, sg[i].buflen, &crc);
     crc ^= 0xffff;
     outcrc[0] = crc & 0xff;
     outcrc[1] = (crc >> 8) & 0xff;
@@ -3745,6 +3932,8 @@ ax25_child_write_ready(struct ax25_base *base)
 		 */
 		else if (ccr->cr == X25_REJ && !chan->in_rej)
 		    goto skip_cmdrsp;
+		else if (ccr->cr == X25_SREJ && !chan->in_srej)
+		    goto skip_cmdrsp;
 
 		/* Supervisory message, put ack value into it. */
 		if (chan->extended) {
@@ -3871,6 +4060,7 @@ ax25_child_write_ready(struct ax25_base *base)
 		rv = GE_IOERR;
 		goto out_err_chan;
 	    }
+	    chan->stats.i_sent++;
 	    chan->send_len--;
 	    if (!chan->t1) {
 		ax25_chan_stop_t3(chan);
@@ -4010,7 +4200,7 @@ ax25_add_crc(unsigned char *buf, gensiods len)
 {
     uint16_t crc = 0xffff;
 
-    crc16_ccitt(buf, len, &crc);
+    gensio_crc16_ccitt(buf, len, &crc);
     crc ^= 0xffff;
     buf[len++] = crc & 0xff;
     buf[len++] = (crc >> 8) & 0xff;
@@ -4460,10 +4650,18 @@ ax25_chan_control(struct ax25_chan *chan, bool get, int option,
 
     switch (option) {
     case GENSIO_CONTROL_ENABLE_OOB:
-	if (get)
+	if (get) {
 	    *datalen = snprintf(data, *datalen, "%u", chan->report_ui);
-	else
+	} else {
+	    ax25_base_lock(base);
 	    chan->report_ui = strtoul(data, NULL, 0);
+	    if (chan->report_ui && !gensio_list_link_inlist(&chan->ui_link))
+		gensio_list_add_tail(&base->ui_chans, &chan->ui_link);
+	    else if (!chan->report_ui &&
+		     gensio_list_link_inlist(&chan->ui_link))
+		gensio_list_rm(&base->ui_chans, &chan->ui_link);
+	    ax25_base_unlock(base);
+	}
 	break;
 
     case GENSIO_CONTROL_MAX_WRITE_PACKET:
@@ -4506,6 +4704,27 @@ ax25_chan_control(struct ax25_chan *chan, bool get, int option,
 	gensio_addr_getaddr(chan->conf.addr, data, datalen);
 	break;
 
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	ax25_chan_lock(chan);
+	*datalen = snprintf(data, *datalen,
+			    "modulo=%u readwindow=%u writewindow=%u"
+			    " max_write_size=%u srej=%d srt=%u t1=%u"
+			    " i_sent=%llu i_resent=%llu i_rcvd=%llu"
+			    " out_of_seq=%llu rej_sent=%llu srej_sent=%llu"
+			    " rej_rcvd=%llu srej_rcvd=%llu t1_timeouts=%llu",
+			    chan->modulo, chan->readwindow, chan->writewindow,
+			    chan->max_write_size, chan->peer_srej,
+			    chan->srt, chan->t1v,
+			    chan->stats.i_sent, chan->stats.i_resent,
+			    chan->stats.i_rcvd, chan->stats.out_of_seq,
+			    chan->stats.rej_sent, chan->stats.srej_sent,
+			    chan->stats.rej_rcvd, chan->stats.srej_rcvd,
+			    chan->stats.t1_timeouts);
+	ax25_chan_unlock(chan);
+	break;
+
     default:
 	rv = GE_NOTSUP;
 	break;
@@ -4659,6 +4878,8 @@ ax25_readconf(struct gensio_pparm_info *p,
 	    continue;
 	if (gensio_pparm_uint(p, args[i], "retries", &conf->max_retries) > 0)
 	    continue;
+	if (gensio_pparm_bool(p, args[i], "srej", &conf->srej))
+	    continue;
 	/* Undocumented, used for testing. */
 	if (gensio_pparm_uint(p, args[i], "drop", &conf->drop_pos) > 0)
 	    continue;
@@ -4729,6 +4950,7 @@ ax25_defconf(struct ax25_conf_data *conf)
     conf->readwindow = 7;
     conf->writewindow = 7;
     conf->extended = 1;
+    conf->srej = true;
     conf->ignore_embedded_ua = true;
     conf->srtv = 4000; /* 4 seconds (t1 is 8 seconds). */
     conf->t2v = 2000; /* 2 seconds. */
@@ -4846,6 +5068,8 @@ ax25_chan_alloc(struct ax25_base *base, const char *const args[],
 	gensio_list_add_tail(&base->chans_closed, &chan->link);
     else
 	gensio_list_add_tail(&base->chans, &chan->link);
+    if (chan->conf.addr)
+	ax25_base_hash_add_chan(base, chan);
     ax25_base_unlock(base);
 
     *rchan = chan;
@@ -4873,7 +5097,7 @@ ax25_gensio_alloc_base(struct gensio *child, const char *const args[],
     struct ax25_base *base;
     struct ax25_chan *chan;
     struct gensio_ax25_subaddr *my_addrs = NULL;
-    unsigned int num_my_addrs = 0;
+    unsigned int num_my_addrs = 0, i;
 
     base = o->zalloc(o, sizeof(*base));
     if (!base)
@@ -4885,6 +5109,7 @@ ax25_gensio_alloc_base(struct gensio *child, const char *const args[],
     gensio_list_init(&base->chans_waiting_open);
     gensio_list_init(&base->chans_closed);
     gensio_list_init(&base->send_list);
+    gensio_list_init(&base->ui_chans);
     base->refcount = 1;
     base->conf = *conf;
     if (conf->my_addrs) {
@@ -4903,6 +5128,14 @@ ax25_gensio_alloc_base(struct gensio *child, const char *const args[],
     if (!base->lock)
 	goto out_nomem;
 
+    base->chan_hash = o->zalloc(o, (sizeof(*base->chan_hash) *
+				    AX25_CHAN_HASH_INIT_SIZE));
+    if (!base->chan_hash)
+	goto out_nomem;
+    base->chan_hash_size = AX25_CHAN_HASH_INIT_SIZE;
+    for (i = 0; i < base->chan_hash_size; i++)
+	gensio_list_init(&base->chan_hash[i]);
+
     base->child = child;
 
     rv = ax25_chan_alloc(base, args, cb, user_data, AX25_CHAN_CLOSED,
@@ -50,6 +50,42 @@ static bool ax25_addr_equal(const struct gensio_addr *ia1,
     return true;
 }
 
+/* FNV-1a, see ax25_addr_hash(). */
+static unsigned int
+ax25_hash_bytes(unsigned int hash, const void *data, size_t len)
+{
+    const unsigned char *d = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	hash ^= d[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Only the source and destination take part, like ax25_addr_equal()
+ * with compare_all false.
+ */
+static unsigned int
+ax25_addr_hash(const struct gensio_addr *iaddr, bool hash_ports)
+{
+    struct gensio_ax25_addr *addr = addr_to_ax25(iaddr);
+    unsigned int hash = 2166136261u;
+    uint8_t ssid;
+
+    if (hash_ports)
+	hash = ax25_hash_bytes(hash, &addr->tnc_port, 1);
+    hash = ax25_hash_bytes(hash, addr->dest.addr, strlen(addr->dest.addr));
+    ssid = addr->dest.ssid;
+    hash = ax25_hash_bytes(hash, &ssid, 1);
+    hash = ax25_hash_bytes(hash, addr->src.addr, strlen(addr->src.addr));
+    ssid = addr->src.ssid;
+    hash = ax25_hash_bytes(hash, &ssid, 1);
+    return hash;
+}
+
 int
 ax25_subaddr_to_str(const struct gensio_ax25_subaddr *a,
 		    char *buf, gensiods *pos, gensiods buflen,
@@ -167,7 +203,8 @@ const static struct gensio_addr_funcs ax25_addr_funcs = {
     .addr_rewind = ax25_addr_rewind,
     .addr_get_nettype = ax25_addr_get_nettype,
     .addr_family_supports = ax25_addr_family_supports,
-    .addr_getaddr = ax25_addr_getaddr
+    .addr_getaddr = ax25_addr_getaddr,
+    .addr_hash = ax25_addr_hash
 };
 
 int
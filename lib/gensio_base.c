@@ -16,6 +16,9 @@
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_base.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_osops.h>
+#include <gensio_probes.h>
+#include "gensio_filter_chain.h"
 
 #ifdef DEBUG_DATA
 #define ENABLE_PRBUF 1
@@ -144,9 +147,59 @@ static void i_basen_add_trace(struct basen_data *ndata,
 #define i_basen_add_trace(ndata, new_state, line)
 #endif
 
+/* Tracks how long data sits in the filter. */
+struct basen_qstat {
+    bool queued;
+    gensio_time start;
+    gensiods count;
+    int64_t total_ns;
+    int64_t max_ns;
+};
+
+/* I/O counters, enabled with GENSIO_CONTROL_STATS. */
+struct basen_stats {
+    gensiods ul_writes;
+    gensiods ul_write_bytes;
+    gensiods ul_write_partial;
+    gensiods ll_writes;
+    gensiods ll_write_bytes;
+    gensiods ll_write_partial;
+    gensiods ul_reads;
+    gensiods ul_read_bytes;
+    gensiods ll_reads;
+    gensiods ll_read_bytes;
+    gensiods write_ready;
+
+    /* Data waiting in the filter to go to the lower layer. */
+    struct basen_qstat wq;
+    /* Data waiting in the filter for the user to read it. */
+    struct basen_qstat rq;
+};
+
+/*
+ * Sampled write latency, enabled with GENSIO_CONTROL_WRITE_LATENCY.
+ * Bucket i counts samples under 2^i microseconds, the last bucket
+ * gets everything longer.
+ */
+#define BASEN_LAT_BUCKETS 21
+struct basen_latency {
+    unsigned int every;
+    unsigned int countdown;
+
+    /* Only one sampled write is followed at a time. */
+    bool in_flight;
+    gensio_time start;
+
+    gensiods samples;
+    int64_t total_ns;
+    int64_t max_ns;
+    gensiods hist[BASEN_LAT_BUCKETS];
+};
+
 struct basen_data {
     struct gensio *io;
     struct gensio *child;
+    struct gensio_arena *arena;
 
     struct gensio_os_funcs *o;
     struct gensio_filter *filter;
@@ -201,6 +254,23 @@ struct basen_data {
     bool deferred_open;
     bool deferred_close;
 
+    /*
+     * From GENSIO_CONTROL_INLINE_EVENTS, deliver read and write ready
+     * from the enable calls when it's safe instead of the runner.
+     */
+    bool inline_events;
+
+    /*
+     * Allocated on the first enable and kept until free, so it can
+     * be checked while unlocked.
+     */
+    struct basen_stats *stats;
+    bool stats_enabled;
+
+    /* Like stats, kept until free once allocated. */
+    struct basen_latency *latency;
+    bool latency_enabled;
+
 #ifdef DEBUG_STATE
     struct basen_state_trace state_trace[STATE_TRACE_LEN];
     unsigned int state_trace_pos;
@@ -209,6 +279,7 @@ struct basen_data {
 
 struct gensio_ll {
     struct gensio_os_funcs *o;
+    struct gensio_arena *arena;
     struct basen_data  *ndata;
     gensio_ll_func func;
     void *user_data;
@@ -216,6 +287,7 @@ struct gensio_ll {
 
 struct gensio_filter {
     struct gensio_os_funcs *o;
+    struct gensio_arena *arena;
     struct basen_data  *ndata;
     gensio_filter_func func;
     void *user_data;
@@ -261,7 +333,11 @@ basen_finish_free(struct basen_data *ndata)
 	gensio_filter_free(ndata->filter);
     if (ndata->ll)
 	gensio_ll_free(ndata->ll);
-    ndata->o->free(ndata->o, ndata);
+    if (ndata->stats)
+	ndata->o->free(ndata->o, ndata->stats);
+    if (ndata->latency)
+	ndata->o->free(ndata->o, ndata->latency);
+    gensio_setup_free(ndata->o, ndata->arena, ndata);
 }
 
 static void
@@ -392,6 +468,14 @@ filter_ul_can_write(struct basen_data *ndata)
     return ndata->ll_can_write;
 }
 
+static bool
+filter_ll_can_read(struct basen_data *ndata)
+{
+    if (ndata->filter)
+	return gensio_filter_ll_can_read(ndata->filter);
+    return true;
+}
+
 static bool
 filter_ll_read_needed(struct basen_data *ndata)
 {
@@ -469,6 +553,369 @@ filter_cleanup(struct basen_data *ndata)
 	gensio_filter_cleanup(ndata->filter);
 }
 
+static void
+basen_qstat_update(struct basen_data *ndata, struct basen_qstat *q,
+		   bool queued)
+{
+    gensio_time now;
+    int64_t ns;
+
+    if (q->queued == queued)
+	return;
+    ndata->o->get_monotonic_time(ndata->o, &now);
+    q->queued = queued;
+    if (queued) {
+	q->start = now;
+	return;
+    }
+    ns = ((now.secs - q->start.secs) * 1000000000LL +
+	  (now.nsecs - q->start.nsecs));
+    q->count++;
+    q->total_ns += ns;
+    if (ns > q->max_ns)
+	q->max_ns = ns;
+}
+
+/*
+ * Possibly start following a write, called before the write is given
+ * to the filter.  Returns true if this write is sampled.
+ */
+static bool
+basen_latency_start(struct basen_data *ndata)
+{
+    struct basen_latency *l = ndata->latency;
+
+    if (l->in_flight)
+	return false;
+    if (--l->countdown > 0)
+	return false;
+    l->countdown = l->every;
+    l->in_flight = true;
+    ndata->o->get_monotonic_time(ndata->o, &l->start);
+    return true;
+}
+
+/*
+ * A sampled write is done with this layer when the filter has nothing
+ * left for the layer below, so everything up to and including the
+ * sampled write has been accepted by it.
+ */
+static void
+basen_latency_check(struct basen_data *ndata)
+{
+    struct basen_latency *l = ndata->latency;
+    gensio_time now;
+    int64_t ns, us;
+    unsigned int i;
+
+    if (!ndata->latency_enabled || !l->in_flight)
+	return;
+    if (ndata->state != BASEN_OPEN && ndata->state != BASEN_CLOSE_WAIT_DRAIN) {
+	l->in_flight = false;
+	return;
+    }
+    if (filter_ll_write_queued(ndata))
+	return;
+    ndata->o->get_monotonic_time(ndata->o, &now);
+    l->in_flight = false;
+    ns = ((now.secs - l->start.secs) * 1000000000LL +
+	  (now.nsecs - l->start.nsecs));
+    l->samples++;
+    l->total_ns += ns;
+    if (ns > l->max_ns)
+	l->max_ns = ns;
+    for (i = 0, us = ns / 1000; i < BASEN_LAT_BUCKETS - 1 && us >= 1; i++)
+	us >>= 1;
+    l->hist[i]++;
+}
+
+/*
+ * Must be called with the lock held.  The filter may be cleaned up
+ * once a close gets past draining, so only look while that can't
+ * have happened.
+ */
+static void
+basen_stats_check_queues(struct basen_data *ndata)
+{
+    basen_latency_check(ndata);
+    if (!ndata->stats_enabled || !ndata->filter)
+	return;
+    if (ndata->state != BASEN_OPEN && ndata->state != BASEN_CLOSE_WAIT_DRAIN)
+	return;
+    basen_qstat_update(ndata, &ndata->stats->wq,
+		       filter_ll_write_queued(ndata));
+    basen_qstat_update(ndata, &ndata->stats->rq,
+		       filter_ul_read_pending(ndata));
+}
+
+/*
+ * Get the size of one part of the layer from GENSIO_CONTROL_MEM,
+ * zero if it doesn't report it.
+ */
+static gensiods
+basen_part_mem(int rv, const char *buf)
+{
+    if (rv)
+	return 0;
+    return strtoul(buf, NULL, 0);
+}
+
+static int
+basen_mem_control(struct basen_data *ndata, bool get, char *data,
+		  gensiods *datalen)
+{
+    char buf[30];
+    gensiods len, size = sizeof(*ndata);
+    int rv;
+
+    if (!get) {
+	/* Tell the filter and ll to compact, whichever can. */
+	if (ndata->filter)
+	    gensio_filter_control(ndata->filter, false, GENSIO_CONTROL_MEM,
+				  data, datalen);
+	gensio_ll_control(ndata->ll, false, GENSIO_CONTROL_MEM, data,
+			  datalen);
+	return 0;
+    }
+
+    if (ndata->filter) {
+	len = sizeof(buf);
+	rv = gensio_filter_control(ndata->filter, true, GENSIO_CONTROL_MEM,
+				   buf, &len);
+	size += basen_part_mem(rv, buf);
+    }
+    len = sizeof(buf);
+    rv = gensio_ll_control(ndata->ll, true, GENSIO_CONTROL_MEM, buf, &len);
+    size += basen_part_mem(rv, buf);
+    *datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+    return 0;
+}
+
+static int
+basen_inline_control(struct basen_data *ndata, bool get, char *data,
+		     gensiods *datalen)
+{
+    basen_lock(ndata);
+    if (get)
+	*datalen = snprintf(data, *datalen, "%d", ndata->inline_events);
+    else
+	ndata->inline_events = !!strtoul(data, NULL, 0);
+    basen_unlock(ndata);
+    return 0;
+}
+
+static int
+basen_latency_control(struct basen_data *ndata, bool get, char *data,
+		      gensiods *datalen)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct basen_latency *l;
+    unsigned int every, i;
+    gensiods pos;
+    int rv = 0;
+
+    basen_lock(ndata);
+    if (!get) {
+	every = strtoul(data, NULL, 0);
+	if (every) {
+	    if (!ndata->latency) {
+		ndata->latency = o->zalloc(o, sizeof(*ndata->latency));
+		if (!ndata->latency) {
+		    rv = GE_NOMEM;
+		    goto out_unlock;
+		}
+	    }
+	    memset(ndata->latency, 0, sizeof(*ndata->latency));
+	    ndata->latency->every = every;
+	    ndata->latency->countdown = 1;
+	    ndata->latency_enabled = true;
+	} else {
+	    ndata->latency_enabled = false;
+	}
+	goto out_unlock;
+    }
+
+    if (!ndata->latency_enabled) {
+	rv = GE_NOTREADY;
+	goto out_unlock;
+    }
+    l = ndata->latency;
+    pos = snprintf(data, *datalen,
+		   "samples=%llu total_us=%lld max_us=%lld hist=",
+		   (unsigned long long) l->samples,
+		   (long long) (l->total_ns / 1000),
+		   (long long) (l->max_ns / 1000));
+    for (i = 0; i < BASEN_LAT_BUCKETS; i++)
+	pos += snprintf(data + (pos < *datalen ? pos : *datalen),
+			pos < *datalen ? *datalen - pos : 0,
+			"%s%llu", i ? "," : "",
+			(unsigned long long) l->hist[i]);
+    *datalen = pos;
+ out_unlock:
+    basen_unlock(ndata);
+    return rv;
+}
+
+static int
+basen_stats_control(struct basen_data *ndata, bool get, char *data,
+		    gensiods *datalen)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct basen_stats *st;
+    int rv = 0;
+
+    basen_lock(ndata);
+    if (!get) {
+	if (strtoul(data, NULL, 0)) {
+	    if (!ndata->stats) {
+		ndata->stats = o->zalloc(o, sizeof(*ndata->stats));
+		if (!ndata->stats) {
+		    rv = GE_NOMEM;
+		    goto out_unlock;
+		}
+	    }
+	    memset(ndata->stats, 0, sizeof(*ndata->stats));
+	    ndata->stats_enabled = true;
+	    basen_stats_check_queues(ndata);
+	} else {
+	    ndata->stats_enabled = false;
+	}
+	goto out_unlock;
+    }
+
+    if (!ndata->stats_enabled) {
+	rv = GE_NOTREADY;
+	goto out_unlock;
+    }
+    st = ndata->stats;
+    *datalen = snprintf(data, *datalen,
+			"ul_writes=%llu ul_write_bytes=%llu"
+			" ul_write_partial=%llu"
+			" ll_writes=%llu ll_write_bytes=%llu"
+			" ll_write_partial=%llu"
+			" ul_reads=%llu ul_read_bytes=%llu"
+			" ll_reads=%llu ll_read_bytes=%llu write_ready=%llu"
+			" wq_count=%llu wq_total_us=%lld wq_max_us=%lld"
+			" rq_count=%llu rq_total_us=%lld rq_max_us=%lld",
+			(unsigned long long) st->ul_writes,
+			(unsigned long long) st->ul_write_bytes,
+			(unsigned long long) st->ul_write_partial,
+			(unsigned long long) st->ll_writes,
+			(unsigned long long) st->ll_write_bytes,
+			(unsigned long long) st->ll_write_partial,
+			(unsigned long long) st->ul_reads,
+			(unsigned long long) st->ul_read_bytes,
+			(unsigned long long) st->ll_reads,
+			(unsigned long long) st->ll_read_bytes,
+			(unsigned long long) st->write_ready,
+			(unsigned long long) st->wq.count,
+			(long long) (st->wq.total_ns / 1000),
+			(long long) (st->wq.max_ns / 1000),
+			(unsigned long long) st->rq.count,
+			(long long) (st->rq.total_ns / 1000),
+			(long long) (st->rq.max_ns / 1000));
+ out_unlock:
+    basen_unlock(ndata);
+    return rv;
+}
+
+static int gensio_base_func(struct gensio *io, int func, gensiods *count,
+			    const void *cbuf, gensiods buflen, void *buf,
+			    const char *const *auxdata);
+static gensiods gensio_ll_base_cb(void *cb_data, int op, int val,
+				  void *buf, gensiods buflen,
+				  const char *const *auxdata);
+static int gensio_base_filter_cb(void *cb_data, int op, void *data);
+
+/*
+ * Take over the filter and ll of a base gensio child, so its filter
+ * runs in this gensio and the child goes away.  Both must be closed
+ * and nothing else may be holding the child.
+ */
+static int
+basen_fuse_child(struct basen_data *ndata)
+{
+    struct gensio *child = ndata->child, *grandchild;
+    struct basen_data *cndata;
+    struct gensio_filter *chain;
+    unsigned int i;
+    int rv;
+
+    if (!child || !gensio_can_absorb(child, gensio_base_func))
+	return GE_NOTSUP;
+    cndata = gensio_get_gensio_data(child);
+    if (!cndata->filter || cndata->state != BASEN_CLOSED ||
+		cndata->refcount != 1)
+	return GE_NOTSUP;
+    rv = gensio_ll_detach_child(ndata->ll, NULL);
+    if (rv)
+	return rv;
+
+    rv = gensio_filter_chain_alloc(ndata->o, ndata->filter, cndata->filter,
+				   &chain);
+    if (rv)
+	return rv;
+    ndata->filter = chain;
+    cndata->filter = NULL;
+    for (i = 0; i < gensio_filter_chain_nr_members(chain); i++)
+	gensio_filter_chain_member(chain, i)->ndata = ndata;
+    chain->ndata = ndata;
+    gensio_filter_set_callback(chain, gensio_base_filter_cb, ndata);
+
+    /* The old ll only held the child, the child's ll does the work now. */
+    gensio_ll_detach_child(ndata->ll, &child);
+    gensio_ll_free(ndata->ll);
+    ndata->ll = cndata->ll;
+    cndata->ll = NULL;
+    ndata->ll->ndata = ndata;
+    gensio_ll_set_callback(ndata->ll, gensio_ll_base_cb, ndata);
+
+    grandchild = cndata->child;
+    ndata->child = grandchild;
+    gensio_set_child(ndata->io, grandchild);
+    basen_finish_free(cndata);
+    return 0;
+}
+
+static int
+basen_fuse_control(struct basen_data *ndata, bool get, char *data,
+		   gensiods *datalen)
+{
+    unsigned int nr_filters = 0;
+    int rv = 0;
+
+    basen_lock(ndata);
+    if (get) {
+	if (ndata->filter && gensio_filter_is_chain(ndata->filter))
+	    nr_filters = gensio_filter_chain_nr_members(ndata->filter);
+	else if (ndata->filter)
+	    nr_filters = 1;
+	*datalen = snprintf(data, *datalen, "%u", nr_filters);
+	goto out_unlock;
+    }
+
+    if (!ndata->filter || !gensio_is_client(ndata->io)) {
+	rv = GE_NOTSUP;
+	goto out_unlock;
+    }
+    if (ndata->state != BASEN_CLOSED) {
+	rv = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (!strtoul(data, NULL, 0))
+	goto out_unlock;
+
+    /* Pull in layers until one can't be. */
+    do {
+	rv = basen_fuse_child(ndata);
+    } while (!rv);
+    if (rv == GE_NOTSUP)
+	rv = 0;
+ out_unlock:
+    basen_unlock(ndata);
+    return rv;
+}
+
 
 static int
 ll_write(struct basen_data *ndata, gensiods *rcount,
@@ -592,7 +1039,7 @@ basen_set_ll_enables(struct basen_data *ndata)
 	    basen_sched_deferred_op(ndata);
 	    enabled = false;
 	} else {
-	    enabled = ndata->read_enabled;
+	    enabled = ndata->read_enabled && filter_ll_can_read(ndata);
 	}
 	/* Fallthrough */
     case BASEN_CLOSE_WAIT_DRAIN:
@@ -625,6 +1072,12 @@ basen_write_data_handler(void *cb_data, gensiods *rcount,
     rv = ll_write(ndata, &count, sg, sglen, auxdata);
     if (!rv && count < total)
 	ndata->ll_can_write = false;
+    if (ndata->stats_enabled) {
+	ndata->stats->ll_writes++;
+	ndata->stats->ll_write_bytes += count;
+	if (!rv && count < total)
+	    ndata->stats->ll_write_partial++;
+    }
     if (rcount)
 	*rcount = count;
     return rv;
@@ -661,8 +1114,11 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
 	    const struct gensio_sg *sg, gensiods sglen,
 	    const char *const *auxdata)
 {
+    gensiods i, total = 0, count = 0;
+    bool sampled = false;
     int err = 0;
 
+    GENSIO_PROBE2(base_write, ndata->io, sglen);
     basen_lock(ndata);
     if (ndata->state != BASEN_OPEN) {
 	err = GE_NOTREADY;
@@ -673,14 +1129,36 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
 	goto out_unlock;
     }
     ndata->in_write_count++;
+    if (ndata->latency_enabled)
+	sampled = basen_latency_start(ndata);
 
-    err = filter_ul_write(ndata, basen_write_data_handler, rcount, sg, sglen,
+    err = filter_ul_write(ndata, basen_write_data_handler, &count, sg, sglen,
 			  auxdata);
+    if (rcount)
+	*rcount = count;
+    if (ndata->latency_enabled) {
+	if (sampled && count == 0) {
+	    /* Nothing was taken, sample the next write instead. */
+	    ndata->latency->in_flight = false;
+	    ndata->latency->countdown = 1;
+	}
+	basen_latency_check(ndata);
+    }
 
     ndata->in_write_count--;
     if (err)
 	handle_ioerr(ndata, err);
 
+    if (ndata->stats_enabled) {
+	for (i = 0; i < sglen; i++)
+	    total += sg[i].buflen;
+	ndata->stats->ul_writes++;
+	ndata->stats->ul_write_bytes += count;
+	if (!err && count < total)
+	    ndata->stats->ul_write_partial++;
+	basen_stats_check_queues(ndata);
+    }
+
     /*
      * We make sure that nothing is in a write call before starting a
      * close.  So if anything wants to call ll_close() and
@@ -716,6 +1194,7 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
  out_unlock:
     basen_set_ll_enables(ndata);
     basen_unlock(ndata);
+    GENSIO_PROBE3(base_write_done, ndata->io, count, err);
 
     return err;
 }
@@ -736,7 +1215,7 @@ basen_read_data_handler(void *cb_data,
 			const char *const *auxdata)
 {
     struct basen_data *ndata = cb_data;
-    gensiods count = 0, rval;
+    gensiods count = 0, rval, nreads = 0;
     int err = 0;
 
     basen_lock(ndata);
@@ -771,11 +1250,18 @@ basen_read_data_handler(void *cb_data,
 		rval = buflen - count;
 #endif
 	    count += rval;
-	    if (count >= buflen)
+	    nreads++;
+	    if (count >= buflen && !ndata->stats_enabled)
 		goto out; /* Don't claim the lock if I don't have to. */
 	    basen_lock(ndata);
+	    if (count >= buflen)
+		break;
 	}
     }
+    if (ndata->stats_enabled && nreads) {
+	ndata->stats->ul_reads += nreads;
+	ndata->stats->ul_read_bytes += count;
+    }
  out_unlock:
     basen_unlock(ndata);
 
@@ -971,11 +1457,64 @@ basen_in_write_callbackable_state(struct basen_data *ndata)
 	    ndata->state == BASEN_IO_ERR_CLOSE);
 }
 
+/* Deliver pending read data to the user.  Call with the lock held. */
+static void
+basen_deliver_read(struct basen_data *ndata)
+{
+    int err;
+
+    ndata->in_read = true;
+    do {
+	if (ndata->ll_err && !filter_ul_read_pending(ndata)) {
+	    /* Automatically disable read on an error. */
+	    ndata->read_enabled = false;
+	    basen_unlock(ndata);
+	    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, ndata->ll_err,
+			    NULL, NULL, NULL);
+	    basen_lock(ndata);
+	} else {
+	    basen_unlock(ndata);
+	    err = filter_ll_write(ndata, basen_read_data_handler,
+				  NULL, NULL, 0, NULL);
+	    basen_lock(ndata);
+	}
+	if (err) {
+	    handle_ioerr(ndata, err);
+	    break;
+	}
+    } while (ndata->read_enabled &&
+	     (ndata->ll_err || filter_ul_read_pending(ndata)));
+    ndata->in_read = false;
+}
+
+/* Call write ready while the user can write.  Call with the lock held. */
+static void
+basen_deliver_write_ready(struct basen_data *ndata)
+{
+    int err;
+
+    ndata->in_xmit_ready = true;
+    while (basen_in_write_callbackable_state(ndata) &&
+	   (filter_ul_can_write(ndata) || ndata->ll_err)
+	   && ndata->xmit_enabled) {
+	basen_unlock(ndata);
+	err = gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0, NULL,
+			0, NULL);
+	basen_lock(ndata);
+	if (ndata->stats_enabled)
+	    ndata->stats->write_ready++;
+	if (err) {
+	    handle_ioerr(ndata, err);
+	    break;
+	}
+    }
+    ndata->in_xmit_ready = false;
+}
+
 static void
 basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 {
     struct basen_data *ndata = cbdata;
-    int err;
 
     basen_lock(ndata);
     ndata->deferred_op_pending = false;
@@ -990,28 +1529,7 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 	if (ndata->in_read || !ndata->read_enabled)
 	    goto skip_read;
 	ndata->deferred_read = false;
-	ndata->in_read = true;
-	do {
-	    if (ndata->ll_err && !filter_ul_read_pending(ndata)) {
-		/* Automatically disable read on an error. */
-		ndata->read_enabled = false;
-		basen_unlock(ndata);
-		err = gensio_cb(ndata->io, GENSIO_EVENT_READ, ndata->ll_err,
-				NULL, NULL, NULL);
-		basen_lock(ndata);
-	    } else {
-		basen_unlock(ndata);
-		err = filter_ll_write(ndata, basen_read_data_handler,
-				      NULL, NULL, 0, NULL);
-		basen_lock(ndata);
-	    }
-	    if (err) {
-		handle_ioerr(ndata, err);
-		break;
-	    }
-	} while (ndata->read_enabled &&
-		 (ndata->ll_err || filter_ul_read_pending(ndata)));
-	ndata->in_read = false;
+	basen_deliver_read(ndata);
     }
 
  skip_read:
@@ -1020,20 +1538,7 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 	ndata->deferred_write = false;
 	if (ndata->in_xmit_ready)
 	    goto skip_write;
-	ndata->in_xmit_ready = true;
-	while (basen_in_write_callbackable_state(ndata) &&
-	       (filter_ul_can_write(ndata) || ndata->ll_err)
-	       && ndata->xmit_enabled) {
-	    basen_unlock(ndata);
-	    err = gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0, NULL,
-			    0, NULL);
-	    basen_lock(ndata);
-	    if (err) {
-		handle_ioerr(ndata, err);
-		break;
-	    }
-	}
-	ndata->in_xmit_ready = false;
+	basen_deliver_write_ready(ndata);
     }
 
  skip_write:
@@ -1049,9 +1554,42 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 	basen_filter_ul_push(ndata, true);
 	basen_set_ll_enables(ndata);
     }
+    basen_stats_check_queues(ndata);
     basen_deref_and_unlock(ndata); /* Ref from basen_sched_deferred_op */
 }
 
+/*
+ * Can a read or write ready be delivered straight from the user's
+ * enable call instead of going through the runner?  Only if asked
+ * for, and only if no callback for this gensio is running (on any
+ * thread) or queued, so the user is never called recursively and
+ * events stay in order.
+ */
+static bool
+basen_can_deliver_inline(struct basen_data *ndata)
+{
+    return (ndata->inline_events && !ndata->deferred_op_pending &&
+	    !ndata->in_read && !ndata->in_xmit_ready);
+}
+
+static void basen_check_open_close_ops(struct basen_data *ndata);
+
+/*
+ * Clean up after an inline delivery, like the deferred op does.
+ * Releases the lock and the ref taken before the delivery.
+ */
+static void
+basen_finish_inline(struct basen_data *ndata)
+{
+    basen_check_open_close_ops(ndata);
+    if (ndata->state != BASEN_CLOSED) {
+	basen_filter_ul_push(ndata, true);
+	basen_set_ll_enables(ndata);
+    }
+    basen_stats_check_queues(ndata);
+    basen_deref_and_unlock(ndata);
+}
+
 static void
 basen_sched_deferred_op(struct basen_data *ndata)
 {
@@ -1462,6 +2000,12 @@ basen_set_read_callback_enable(struct basen_data *ndata, bool enabled)
 	ndata->deferred_read = true;
     } else if (enabled && (read_pending || ndata->ll_err) &&
 	       ndata->state == BASEN_OPEN) {
+	if (basen_can_deliver_inline(ndata)) {
+	    basen_ref(ndata);
+	    basen_deliver_read(ndata);
+	    basen_finish_inline(ndata);
+	    return;
+	}
 	ndata->deferred_read = true;
 	basen_sched_deferred_op(ndata);
     } else {
@@ -1488,6 +2032,12 @@ basen_set_write_callback_enable(struct basen_data *ndata, bool enabled)
 	goto out_unlock;
     ndata->xmit_enabled = enabled;
     if (enabled && (filter_ul_can_write(ndata) || ndata->ll_err)) {
+	if (basen_can_deliver_inline(ndata)) {
+	    basen_ref(ndata);
+	    basen_deliver_write_ready(ndata);
+	    basen_finish_inline(ndata);
+	    return;
+	}
 	/* We can write, schedule the callback as a deferred op. */
 	ndata->deferred_write = true;
 	basen_sched_deferred_op(ndata);
@@ -1530,10 +2080,26 @@ gensio_base_func(struct gensio *io, int func, gensiods *count,
 	return 0;
 
     case GENSIO_FUNC_CONTROL:
+	if (buflen == GENSIO_CONTROL_STATS)
+	    return basen_stats_control(ndata, *((bool *) cbuf), buf, count);
+	if (buflen == GENSIO_CONTROL_WRITE_LATENCY)
+	    return basen_latency_control(ndata, *((bool *) cbuf), buf, count);
+	if (buflen == GENSIO_CONTROL_INLINE_EVENTS)
+	    return basen_inline_control(ndata, *((bool *) cbuf), buf, count);
+	if (buflen == GENSIO_CONTROL_MEM)
+	    return basen_mem_control(ndata, *((bool *) cbuf), buf, count);
+	if (buflen == GENSIO_CONTROL_FUSE)
+	    return basen_fuse_control(ndata, *((bool *) cbuf), buf, count);
 	rv = GE_NOTSUP;
 	if (ndata->filter) {
 	    rv = gensio_filter_control(ndata->filter, *((bool *) cbuf), buflen,
 				       buf, count);
+	    /*
+	     * The data on the ll's fd isn't the user's data, only the
+	     * filter can say if the fd can be used.
+	     */
+	    if (buflen == GENSIO_CONTROL_RAW_FD)
+		return rv;
 	    if (rv && rv != GE_NOTSUP)
 		return rv;
 	}
@@ -1555,6 +2121,14 @@ gensio_base_func(struct gensio *io, int func, gensiods *count,
 	}
 	return 0;
 
+    case GENSIO_FUNC_ALLOC_CHANNEL:
+	if (ndata->filter) {
+	    rv = gensio_filter_alloc_channel(ndata->filter, buf);
+	    if (rv != GE_NOTSUP)
+		return rv;
+	}
+	return gensio_ll_alloc_channel(ndata->ll, buf);
+
     default:
 	return GE_NOTSUP;
     }
@@ -1596,6 +2170,8 @@ basen_ll_read(void *cb_data, int readerr,
     printf("LL read:");
     prbuf(buf, buflen);
 #endif
+    GENSIO_PROBE3(base_ll_read, ndata->io, buflen, readerr);
+    gensio_alloc_datapath_enter();
     basen_lock_and_ref(ndata);
     if (readerr) {
 	handle_ioerr(ndata, readerr);
@@ -1608,7 +2184,8 @@ basen_ll_read(void *cb_data, int readerr,
     }
 
     while (buflen > 0 &&
-	   (ndata->read_enabled || filter_ll_read_needed(ndata))) {
+	   (ndata->read_enabled || filter_ll_read_needed(ndata)) &&
+	   filter_ll_can_read(ndata)) {
 
 	if (ndata->in_read) {
 	    /* Currently in a deferred read, just let that handle it. */
@@ -1649,7 +2226,8 @@ basen_ll_read(void *cb_data, int readerr,
 		buf += wrlen;
 		buflen -= wrlen;
 	    }
-	} while (ndata->read_enabled && buflen > 0);
+	} while (ndata->read_enabled && buflen > 0 &&
+		 filter_ll_can_read(ndata));
 	ndata->in_read = false;
 
 	basen_filter_ul_push(ndata, true);
@@ -1663,6 +2241,8 @@ basen_ll_read(void *cb_data, int readerr,
 	    err = gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0, NULL,
 			    0, NULL);
 	    basen_lock(ndata);
+	    if (ndata->stats_enabled)
+		ndata->stats->write_ready++;
 	    if (err) {
 		handle_ioerr(ndata, err);
 		break;
@@ -1673,11 +2253,18 @@ basen_ll_read(void *cb_data, int readerr,
  out_finish:
     basen_set_ll_enables(ndata);
  out_unlock:
+    if (ndata->stats_enabled) {
+	ndata->stats->ll_reads++;
+	ndata->stats->ll_read_bytes += buf - ibuf;
+    }
+    basen_stats_check_queues(ndata);
     basen_deref_and_unlock(ndata);
 
 #ifdef DEBUG_DATA
     printf("LL read returns %ld\n", buf - ibuf);
 #endif
+    gensio_alloc_datapath_exit();
+    GENSIO_PROBE2(base_ll_read_done, io, buf - ibuf);
     return buf - ibuf;
 }
 
@@ -1725,6 +2312,8 @@ basen_ll_write_ready(void *cb_data)
 	basen_unlock(ndata);
 	err = gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0, NULL, 0, NULL);
 	basen_lock(ndata);
+	if (ndata->stats_enabled)
+	    ndata->stats->write_ready++;
 	if (err) {
 	    handle_ioerr(ndata, err);
 	    goto out_setnotready;
@@ -1744,6 +2333,7 @@ basen_ll_write_ready(void *cb_data)
     if (ndata->deferred_write)
 	/* Could have gotten a deferred write while we were unlocked. */
 	basen_sched_deferred_op(ndata);
+    basen_stats_check_queues(ndata);
  out:
     basen_deref_and_unlock(ndata);
 }
@@ -1873,11 +2463,13 @@ gensio_i_alloc(struct gensio_os_funcs *o,
 	       gensio_done_err open_done, void *open_data,
 	       gensio_event cb, void *user_data)
 {
-    struct basen_data *ndata = o->zalloc(o, sizeof(*ndata));
+    struct gensio_arena *arena;
+    struct basen_data *ndata = gensio_setup_zalloc(o, sizeof(*ndata), &arena);
 
     if (!ndata)
 	return NULL;
 
+    ndata->arena = arena;
     ndata->o = o;
     ndata->refcount = 1;
 
@@ -2053,6 +2645,28 @@ gensio_filter_ll_write_queued(struct gensio_filter *filter)
     return val;
 }
 
+bool
+gensio_filter_ll_can_read(struct gensio_filter *filter)
+{
+    bool val = true;
+    int err;
+
+    /* If not implemented, this will just be ignored. */
+    err = filter->func(filter, GENSIO_FILTER_FUNC_LL_CAN_READ,
+		       NULL, &val, NULL, NULL, NULL, 0, NULL);
+    if (err)
+	return true;
+    return val;
+}
+
+int
+gensio_filter_alloc_channel(struct gensio_filter *filter,
+			    struct gensio_func_alloc_channel_data *data)
+{
+    return filter->func(filter, GENSIO_FILTER_FUNC_ALLOC_CHANNEL,
+			NULL, data, NULL, NULL, NULL, 0, NULL);
+}
+
 void
 gensio_filter_io_err(struct gensio_filter *filter, int err)
 {
@@ -2171,21 +2785,30 @@ struct gensio_filter *
 gensio_filter_alloc_data(struct gensio_os_funcs *o,
 			 gensio_filter_func func, void *user_data)
 {
-    struct gensio_filter *filter = o->zalloc(o, sizeof(*filter));
+    struct gensio_arena *arena;
+    struct gensio_filter *filter;
 
+    filter = gensio_setup_zalloc(o, sizeof(*filter), &arena);
     if (!filter)
 	return NULL;
 
     filter->o = o;
+    filter->arena = arena;
     filter->func = func;
     filter->user_data = user_data;
     return filter;
 }
 
+gensio_filter_func
+gensio_filter_get_func(struct gensio_filter *filter)
+{
+    return filter->func;
+}
+
 void
 gensio_filter_free_data(struct gensio_filter *filter)
 {
-    filter->o->free(filter->o, filter);
+    gensio_setup_free(filter->o, filter->arena, filter);
 }
 
 void *
@@ -2252,6 +2875,21 @@ gensio_ll_disable(struct gensio_ll *ll)
     ll->func(ll, GENSIO_LL_FUNC_DISABLE, NULL, NULL, NULL, 0, NULL);
 }
 
+int
+gensio_ll_alloc_channel(struct gensio_ll *ll,
+			struct gensio_func_alloc_channel_data *data)
+{
+    return ll->func(ll, GENSIO_LL_FUNC_ALLOC_CHANNEL, NULL, data, NULL, 0,
+		    NULL);
+}
+
+int
+gensio_ll_detach_child(struct gensio_ll *ll, struct gensio **child)
+{
+    return ll->func(ll, GENSIO_LL_FUNC_DETACH_CHILD, NULL, child, NULL, 0,
+		    NULL);
+}
+
 int
 gensio_ll_control(struct gensio_ll *ll, bool get, int option, char *data,
 		  gensiods *datalen)
@@ -2274,12 +2912,14 @@ struct gensio_ll *
 gensio_ll_alloc_data(struct gensio_os_funcs *o,
 		     gensio_ll_func func, void *user_data)
 {
-    struct gensio_ll *ll = o->zalloc(o, sizeof(*ll));
+    struct gensio_arena *arena;
+    struct gensio_ll *ll = gensio_setup_zalloc(o, sizeof(*ll), &arena);
 
     if (!ll)
 	return NULL;
 
     ll->o = o;
+    ll->arena = arena;
     ll->func = func;
     ll->user_data = user_data;
     return ll;
@@ -2288,7 +2928,7 @@ gensio_ll_alloc_data(struct gensio_os_funcs *o,
 void
 gensio_ll_free_data(struct gensio_ll *ll)
 {
-    ll->o->free(ll->o, ll);
+    gensio_setup_free(ll->o, ll->arena, ll);
 }
 
 void *
@@ -0,0 +1,929 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A broadcast accepter sits on top of another accepter.  Connections
+ * from the child accepter are readers.  When the accepter is started
+ * up, it reports a single new connection, the writer.  Data written
+ * to the writer goes into one ring buffer and each reader has its own
+ * position in the ring, so the data is only stored once no matter how
+ * many readers there are.  Data from the readers is thrown away.
+ *
+ * Positions in the ring are absolute byte counts, the ring holds the
+ * data from head - ringsize to head.  The policy tells what to do
+ * when a reader falls more than ringsize behind: block the writer,
+ * move the reader up to the oldest data in the ring, or disconnect
+ * the reader.
+ *
+ * Everything is protected by the accepter's lock.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+
+enum bcast_policy {
+    BCAST_BLOCK,
+    BCAST_DROPOLDEST,
+    BCAST_DISCONNECT
+};
+
+static struct gensio_enum_val bcast_policy_enums[] = {
+    { "block",		BCAST_BLOCK },
+    { "dropoldest",	BCAST_DROPOLDEST },
+    { "disconnect",	BCAST_DISCONNECT },
+    { NULL }
+};
+
+enum bcastna_state {
+    BCASTNA_DISABLED,
+    BCASTNA_ENABLED,
+    BCASTNA_IN_SHUTDOWN
+};
+
+enum bcast_wstate {
+    BCAST_W_CLOSED,
+    BCAST_W_OPEN,
+    BCAST_W_IN_CLOSE
+};
+
+struct bcastna_data;
+
+struct bcast_reader {
+    struct bcastna_data *nadata;
+    struct gensio *io;
+    struct gensio_link link;
+
+    /* The next byte to send to this reader. */
+    uint64_t pos;
+
+    /* The child's write callback is enabled. */
+    bool write_pending;
+
+    /* Off the readers list, waiting for the close to finish. */
+    bool closing;
+};
+
+struct bcastna_data {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_accepter *acc;
+    struct gensio_accepter *child;
+    unsigned int refcount;
+    enum bcastna_state state;
+
+    enum bcast_policy policy;
+    gensiods ringsize;
+    unsigned char *ring;
+    /* The total number of bytes ever written to the ring. */
+    uint64_t head;
+
+    struct gensio_list readers;
+    /* Readers that are being closed. */
+    unsigned int nr_closing;
+    uint64_t dropped;
+    uint64_t disconnects;
+
+    /* The writer, NULL if not allocated. */
+    struct gensio *wio;
+    enum bcast_wstate wstate;
+    bool wxmit_enabled;
+    bool writer_pending;
+    gensio_done wclose_done;
+    void *wclose_data;
+
+    bool accept_enabled;
+    bool child_shutdown_pending;
+
+    bool deferred_pending;
+    struct gensio_runner *deferred_runner;
+
+    gensio_acc_done shutdown_done;
+    void *shutdown_data;
+
+    gensio_acc_done enabled_done;
+    void *enabled_data;
+};
+
+static void bcastna_deferred_op(struct bcastna_data *nadata);
+
+static void
+bcastna_lock(struct bcastna_data *nadata)
+{
+    nadata->o->lock(nadata->lock);
+}
+
+static void
+bcastna_unlock(struct bcastna_data *nadata)
+{
+    nadata->o->unlock(nadata->lock);
+}
+
+static void
+bcastna_finish_free(struct bcastna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+
+    if (nadata->child)
+	gensio_acc_free(nadata->child);
+    if (nadata->acc)
+	gensio_acc_data_free(nadata->acc);
+    if (nadata->deferred_runner)
+	o->free_runner(nadata->deferred_runner);
+    if (nadata->ring)
+	o->free(o, nadata->ring);
+    if (nadata->lock)
+	o->free_lock(nadata->lock);
+    o->free(o, nadata);
+}
+
+static void
+bcastna_ref(struct bcastna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    nadata->refcount++;
+}
+
+static void
+bcastna_deref_and_unlock(struct bcastna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    nadata->refcount--;
+    if (nadata->refcount == 0) {
+	bcastna_unlock(nadata);
+	bcastna_finish_free(nadata);
+    } else {
+	bcastna_unlock(nadata);
+    }
+}
+
+/* The oldest position any reader still needs. */
+static uint64_t
+bcast_min_pos(struct bcastna_data *nadata)
+{
+    uint64_t min = nadata->head;
+    struct gensio_link *l;
+
+    gensio_list_for_each(&nadata->readers, l) {
+	struct bcast_reader *r = gensio_container_of(l, struct bcast_reader,
+						     link);
+
+	if (r->pos < min)
+	    min = r->pos;
+    }
+    return min;
+}
+
+static gensiods
+bcast_room(struct bcastna_data *nadata)
+{
+    if (nadata->policy != BCAST_BLOCK)
+	return nadata->ringsize;
+    return nadata->ringsize - (nadata->head - bcast_min_pos(nadata));
+}
+
+static void
+bcast_reader_close_done(struct gensio *io, void *close_data)
+{
+    struct bcast_reader *r = close_data;
+    struct bcastna_data *nadata = r->nadata;
+
+    gensio_free(io);
+    bcastna_lock(nadata);
+    nadata->o->free(nadata->o, r);
+    assert(nadata->nr_closing > 0);
+    nadata->nr_closing--;
+    if (nadata->state == BCASTNA_IN_SHUTDOWN)
+	bcastna_deferred_op(nadata);
+    bcastna_deref_and_unlock(nadata);
+}
+
+/* Must be called with the lock held. */
+static void
+bcast_reader_close(struct bcast_reader *r)
+{
+    struct bcastna_data *nadata = r->nadata;
+    int err;
+
+    if (r->closing)
+	return;
+    r->closing = true;
+    gensio_list_rm(&nadata->readers, &r->link);
+    nadata->nr_closing++;
+    err = gensio_close(r->io, bcast_reader_close_done, r);
+    if (err) {
+	/* Already closed, just get rid of it. */
+	nadata->nr_closing--;
+	gensio_free(r->io);
+	nadata->o->free(nadata->o, r);
+	nadata->refcount--; /* There's always the accepter's ref. */
+    }
+    /* The writer may be able to go now. */
+    if (nadata->policy == BCAST_BLOCK && nadata->wxmit_enabled)
+	bcastna_deferred_op(nadata);
+}
+
+/* Send what we can of the ring to the reader.  The lock must be held. */
+static void
+bcast_reader_send(struct bcast_reader *r)
+{
+    struct bcastna_data *nadata = r->nadata;
+    struct gensio_sg sg[2];
+    gensiods avail, start, count = 0;
+    unsigned int sglen = 1;
+    int err;
+
+    avail = nadata->head - r->pos;
+    if (avail > 0) {
+	start = r->pos % nadata->ringsize;
+	sg[0].buf = nadata->ring + start;
+	sg[0].buflen = nadata->ringsize - start;
+	if (sg[0].buflen >= avail) {
+	    sg[0].buflen = avail;
+	} else {
+	    sg[1].buf = nadata->ring;
+	    sg[1].buflen = avail - sg[0].buflen;
+	    sglen = 2;
+	}
+	err = gensio_write_sg(r->io, &count, sg, sglen, NULL);
+	if (err) {
+	    bcast_reader_close(r);
+	    return;
+	}
+	r->pos += count;
+	if (count && nadata->policy == BCAST_BLOCK && nadata->wxmit_enabled)
+	    bcastna_deferred_op(nadata);
+    }
+
+    if (r->pos < nadata->head && !r->write_pending) {
+	r->write_pending = true;
+	gensio_set_write_callback_enable(r->io, true);
+    } else if (r->pos == nadata->head && r->write_pending) {
+	r->write_pending = false;
+	gensio_set_write_callback_enable(r->io, false);
+    }
+}
+
+static int
+bcast_reader_event(struct gensio *io, void *user_data, int event, int err,
+		   unsigned char *buf, gensiods *buflen,
+		   const char *const *auxdata)
+{
+    struct bcast_reader *r = user_data;
+    struct bcastna_data *nadata = r->nadata;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err) {
+	    bcastna_lock(nadata);
+	    gensio_set_read_callback_enable(io, false);
+	    bcast_reader_close(r);
+	    bcastna_unlock(nadata);
+	}
+	/* Anything the readers send is ignored. */
+	return 0;
+
+    case GENSIO_EVENT_WRITE_READY:
+	bcastna_lock(nadata);
+	if (!r->closing)
+	    bcast_reader_send(r);
+	bcastna_unlock(nadata);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+bcastna_child_event(struct gensio_accepter *accepter, void *user_data,
+		    int event, void *data)
+{
+    struct bcastna_data *nadata = user_data;
+    struct gensio *io = data;
+    struct bcast_reader *r;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return gensio_acc_cb(nadata->acc, event, data);
+
+    r = nadata->o->zalloc(nadata->o, sizeof(*r));
+    if (!r) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "Out of memory allocating broadcast reader");
+	gensio_free(io);
+	return 0;
+    }
+    r->nadata = nadata;
+    r->io = io;
+
+    bcastna_lock(nadata);
+    if (nadata->state != BCASTNA_ENABLED) {
+	bcastna_unlock(nadata);
+	nadata->o->free(nadata->o, r);
+	gensio_free(io);
+	return 0;
+    }
+    /* New readers start with new data. */
+    r->pos = nadata->head;
+    bcastna_ref(nadata);
+    gensio_list_add_tail(&nadata->readers, &r->link);
+    gensio_set_callback(io, bcast_reader_event, r);
+    gensio_set_read_callback_enable(io, true);
+    bcastna_unlock(nadata);
+
+    return 0;
+}
+
+/*
+ * Copy count bytes from sg, skipping the first skip bytes, into the
+ * ring at head.
+ */
+static void
+bcast_ring_put(struct bcastna_data *nadata, const struct gensio_sg *sg,
+	       gensiods sglen, gensiods skip, gensiods count)
+{
+    gensiods i, len, start, n;
+    const unsigned char *buf;
+
+    for (i = 0; i < sglen && count > 0; i++) {
+	buf = sg[i].buf;
+	len = sg[i].buflen;
+	if (skip >= len) {
+	    skip -= len;
+	    continue;
+	}
+	buf += skip;
+	len -= skip;
+	skip = 0;
+	if (len > count)
+	    len = count;
+	count -= len;
+	while (len > 0) {
+	    start = nadata->head % nadata->ringsize;
+	    n = nadata->ringsize - start;
+	    if (n > len)
+		n = len;
+	    memcpy(nadata->ring + start, buf, n);
+	    nadata->head += n;
+	    buf += n;
+	    len -= n;
+	}
+    }
+}
+
+static int
+bcast_write(struct gensio *io, gensiods *rcount,
+	    const struct gensio_sg *sg, gensiods sglen)
+{
+    struct bcastna_data *nadata = gensio_get_gensio_data(io);
+    struct gensio_link *l, *l2;
+    gensiods i, total = 0, count, skip = 0;
+    uint64_t oldest;
+    int err = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    bcastna_lock(nadata);
+    if (nadata->wstate != BCAST_W_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+
+    count = bcast_room(nadata);
+    if (count > total)
+	count = total;
+    if (nadata->policy != BCAST_BLOCK) {
+	/* We take it all, but only the last ringsize bytes are kept. */
+	count = total;
+	if (total > nadata->ringsize) {
+	    skip = total - nadata->ringsize;
+	    nadata->head += skip;
+	}
+    }
+    bcast_ring_put(nadata, sg, sglen, skip, count - skip);
+
+    if (nadata->head > nadata->ringsize)
+	oldest = nadata->head - nadata->ringsize;
+    else
+	oldest = 0;
+    gensio_list_for_each_safe(&nadata->readers, l, l2) {
+	struct bcast_reader *r = gensio_container_of(l, struct bcast_reader,
+						     link);
+
+	if (r->pos < oldest) {
+	    if (nadata->policy == BCAST_DISCONNECT) {
+		nadata->disconnects++;
+		bcast_reader_close(r);
+		continue;
+	    }
+	    nadata->dropped += oldest - r->pos;
+	    r->pos = oldest;
+	}
+	if (!r->write_pending)
+	    bcast_reader_send(r);
+    }
+
+    if (rcount)
+	*rcount = count;
+ out_unlock:
+    bcastna_unlock(nadata);
+    return err;
+}
+
+static void
+bcast_set_write_callback_enable(struct gensio *io, bool enabled)
+{
+    struct bcastna_data *nadata = gensio_get_gensio_data(io);
+
+    bcastna_lock(nadata);
+    nadata->wxmit_enabled = enabled;
+    if (enabled && nadata->wstate == BCAST_W_OPEN)
+	bcastna_deferred_op(nadata);
+    bcastna_unlock(nadata);
+}
+
+static int
+bcast_close(struct gensio *io, gensio_done close_done, void *close_data)
+{
+    struct bcastna_data *nadata = gensio_get_gensio_data(io);
+    int err = 0;
+
+    bcastna_lock(nadata);
+    if (nadata->wstate != BCAST_W_OPEN) {
+	err = GE_NOTREADY;
+    } else {
+	nadata->wstate = BCAST_W_IN_CLOSE;
+	nadata->wclose_done = close_done;
+	nadata->wclose_data = close_data;
+	bcastna_deferred_op(nadata);
+    }
+    bcastna_unlock(nadata);
+
+    return err;
+}
+
+static void
+bcast_free(struct gensio *io)
+{
+    struct bcastna_data *nadata = gensio_get_gensio_data(io);
+
+    bcastna_lock(nadata);
+    nadata->wstate = BCAST_W_CLOSED;
+    nadata->wxmit_enabled = false;
+    nadata->wclose_done = NULL;
+    nadata->wio = NULL;
+    bcastna_unlock(nadata);
+    gensio_data_free(io);
+    bcastna_lock(nadata);
+    bcastna_deref_and_unlock(nadata);
+}
+
+static int
+bcast_control(struct gensio *io, bool get, int option, char *data,
+	      gensiods *datalen)
+{
+    struct bcastna_data *nadata = gensio_get_gensio_data(io);
+    unsigned int nr_readers = 0;
+    struct gensio_link *l;
+
+    if (!get)
+	return GE_NOTSUP;
+
+    switch (option) {
+    case GENSIO_CONTROL_RADDR:
+	if (strtoul(data, NULL, 0) > 0)
+	    return GE_NOTFOUND;
+	*datalen = gensio_pos_snprintf(data, *datalen, NULL, "broadcast");
+	return 0;
+
+    case GENSIO_CONTROL_STATS:
+	bcastna_lock(nadata);
+	gensio_list_for_each(&nadata->readers, l)
+	    nr_readers++;
+	*datalen = gensio_pos_snprintf(data, *datalen, NULL,
+				       "readers=%u dropped=%llu"
+				       " disconnects=%llu",
+				       nr_readers,
+				       (unsigned long long) nadata->dropped,
+				       (unsigned long long) nadata->disconnects);
+	bcastna_unlock(nadata);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+gensio_bcast_func(struct gensio *io, int func, gensiods *count,
+		  const void *cbuf, gensiods buflen, void *buf,
+		  const char *const *auxdata)
+{
+    switch (func) {
+    case GENSIO_FUNC_WRITE_SG:
+	return bcast_write(io, count, cbuf, buflen);
+
+    case GENSIO_FUNC_CLOSE:
+	return bcast_close(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	bcast_free(io);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	/* Nothing is ever read from the writer. */
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	bcast_set_write_callback_enable(io, buflen);
+	return 0;
+
+    case GENSIO_FUNC_CONTROL:
+	return bcast_control(io, *((bool *) cbuf), buflen, buf, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+/* Report the writer to the user.  Called and returns with the lock held. */
+static void
+bcastna_report_writer(struct bcastna_data *nadata)
+{
+    struct gensio *io;
+
+    nadata->writer_pending = false;
+    io = gensio_data_alloc(nadata->o, NULL, NULL, gensio_bcast_func, NULL,
+			   "broadcast", nadata);
+    if (!io) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "Out of memory allocating broadcast writer");
+	return;
+    }
+    gensio_set_is_reliable(io, true);
+    bcastna_ref(nadata);
+    nadata->wio = io;
+    nadata->wstate = BCAST_W_OPEN;
+    nadata->wxmit_enabled = false;
+    bcastna_unlock(nadata);
+    gensio_acc_cb(nadata->acc, GENSIO_ACC_EVENT_NEW_CONNECTION, io);
+    bcastna_lock(nadata);
+}
+
+static void
+bcastna_do_deferred(struct gensio_runner *runner, void *cb_data)
+{
+    struct bcastna_data *nadata = cb_data;
+
+    bcastna_lock(nadata);
+    nadata->deferred_pending = false;
+
+    if (nadata->writer_pending && nadata->accept_enabled &&
+		nadata->state == BCASTNA_ENABLED)
+	bcastna_report_writer(nadata);
+
+    while (nadata->wio && nadata->wstate == BCAST_W_OPEN &&
+	   nadata->wxmit_enabled && bcast_room(nadata) > 0) {
+	struct gensio *io = nadata->wio;
+	int err;
+
+	bcastna_unlock(nadata);
+	err = gensio_cb(io, GENSIO_EVENT_WRITE_READY, 0, NULL, NULL, NULL);
+	bcastna_lock(nadata);
+	if (err)
+	    break;
+    }
+
+    if (nadata->wio && nadata->wstate == BCAST_W_IN_CLOSE) {
+	gensio_done close_done = nadata->wclose_done;
+	struct gensio *io = nadata->wio;
+
+	nadata->wstate = BCAST_W_CLOSED;
+	nadata->wclose_done = NULL;
+	if (close_done) {
+	    bcastna_unlock(nadata);
+	    close_done(io, nadata->wclose_data);
+	    bcastna_lock(nadata);
+	}
+    }
+
+    if (nadata->enabled_done) {
+	gensio_acc_done enabled_done = nadata->enabled_done;
+	void *enabled_data = nadata->enabled_data;
+
+	nadata->enabled_done = NULL;
+	bcastna_unlock(nadata);
+	enabled_done(nadata->acc, enabled_data);
+	bcastna_lock(nadata);
+    }
+
+    if (nadata->state == BCASTNA_IN_SHUTDOWN &&
+		!nadata->child_shutdown_pending && nadata->nr_closing == 0) {
+	gensio_acc_done shutdown_done = nadata->shutdown_done;
+	void *shutdown_data = nadata->shutdown_data;
+
+	nadata->state = BCASTNA_DISABLED;
+	if (shutdown_done) {
+	    bcastna_unlock(nadata);
+	    shutdown_done(nadata->acc, shutdown_data);
+	    bcastna_lock(nadata);
+	}
+    }
+    bcastna_deref_and_unlock(nadata);
+}
+
+static void
+bcastna_deferred_op(struct bcastna_data *nadata)
+{
+    if (!nadata->deferred_pending) {
+	bcastna_ref(nadata);
+	nadata->o->run(nadata->deferred_runner);
+	nadata->deferred_pending = true;
+    }
+}
+
+static int
+bcastna_startup(struct gensio_accepter *accepter)
+{
+    struct bcastna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv;
+
+    bcastna_lock(nadata);
+    if (nadata->state != BCASTNA_DISABLED) {
+	bcastna_unlock(nadata);
+	return GE_NOTREADY;
+    }
+    nadata->state = BCASTNA_ENABLED;
+    bcastna_unlock(nadata);
+
+    /* Don't hold our lock, the child may report readers. */
+    rv = gensio_acc_startup(nadata->child);
+
+    bcastna_lock(nadata);
+    if (rv) {
+	nadata->state = BCASTNA_DISABLED;
+    } else {
+	nadata->accept_enabled = true;
+	if (!nadata->wio) {
+	    nadata->writer_pending = true;
+	    bcastna_deferred_op(nadata);
+	}
+    }
+    bcastna_unlock(nadata);
+    return rv;
+}
+
+static void
+bcastna_child_shutdown_done(struct gensio_accepter *accepter,
+			    void *shutdown_data)
+{
+    struct bcastna_data *nadata = shutdown_data;
+
+    bcastna_lock(nadata);
+    nadata->child_shutdown_pending = false;
+    bcastna_deferred_op(nadata);
+    bcastna_deref_and_unlock(nadata);
+}
+
+/* Close all the readers.  Must be called with the lock held. */
+static void
+bcastna_close_readers(struct bcastna_data *nadata)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(&nadata->readers, l, l2) {
+	struct bcast_reader *r = gensio_container_of(l, struct bcast_reader,
+						     link);
+
+	bcast_reader_close(r);
+    }
+}
+
+static int
+bcastna_shutdown(struct gensio_accepter *accepter,
+		 gensio_acc_done shutdown_done, void *shutdown_data)
+{
+    struct bcastna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv;
+
+    bcastna_lock(nadata);
+    if (nadata->state != BCASTNA_ENABLED) {
+	bcastna_unlock(nadata);
+	return GE_NOTREADY;
+    }
+    bcastna_ref(nadata);
+    nadata->child_shutdown_pending = true;
+    nadata->state = BCASTNA_IN_SHUTDOWN;
+    nadata->writer_pending = false;
+    nadata->shutdown_done = shutdown_done;
+    nadata->shutdown_data = shutdown_data;
+    bcastna_close_readers(nadata);
+    bcastna_unlock(nadata);
+
+    rv = gensio_acc_shutdown(nadata->child, bcastna_child_shutdown_done,
+			     nadata);
+    if (rv)
+	/* The child is already shut down, just finish. */
+	bcastna_child_shutdown_done(nadata->child, nadata);
+
+    return 0;
+}
+
+static int
+bcastna_set_accept_callback_enable(struct gensio_accepter *accepter,
+				   bool enabled,
+				   gensio_acc_done done, void *done_data)
+{
+    struct bcastna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv = 0;
+
+    bcastna_lock(nadata);
+    if (nadata->enabled_done) {
+	rv = GE_INUSE;
+    } else {
+	nadata->accept_enabled = enabled;
+	nadata->enabled_done = done;
+	nadata->enabled_data = done_data;
+	if (done || (enabled && nadata->writer_pending))
+	    bcastna_deferred_op(nadata);
+    }
+    bcastna_unlock(nadata);
+
+    return rv;
+}
+
+static void
+bcastna_disable(struct gensio_accepter *accepter)
+{
+    struct bcastna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    struct gensio_link *l, *l2;
+
+    gensio_acc_disable(nadata->child);
+    bcastna_lock(nadata);
+    gensio_list_for_each_safe(&nadata->readers, l, l2) {
+	struct bcast_reader *r = gensio_container_of(l, struct bcast_reader,
+						     link);
+
+	gensio_list_rm(&nadata->readers, &r->link);
+	gensio_disable(r->io);
+	gensio_free(r->io);
+	nadata->o->free(nadata->o, r);
+	nadata->refcount--;
+    }
+    nadata->state = BCASTNA_DISABLED;
+    nadata->writer_pending = false;
+    nadata->shutdown_done = NULL;
+    nadata->enabled_done = NULL;
+    bcastna_unlock(nadata);
+}
+
+static void
+bcastna_free(struct gensio_accepter *accepter)
+{
+    struct bcastna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    bcastna_lock(nadata);
+    if (nadata->state == BCASTNA_ENABLED)
+	nadata->state = BCASTNA_DISABLED;
+    nadata->writer_pending = false;
+    bcastna_close_readers(nadata);
+    bcastna_deref_and_unlock(nadata);
+}
+
+static int
+gensio_acc_bcast_func(struct gensio_accepter *acc, int func, int val,
+		      const char *addr, void *done, void *data,
+		      const void *data2, void *ret)
+{
+    switch (func) {
+    case GENSIO_ACC_FUNC_STARTUP:
+	return bcastna_startup(acc);
+
+    case GENSIO_ACC_FUNC_SHUTDOWN:
+	return bcastna_shutdown(acc, done, data);
+
+    case GENSIO_ACC_FUNC_SET_ACCEPT_CALLBACK:
+	return bcastna_set_accept_callback_enable(acc, val, done, data);
+
+    case GENSIO_ACC_FUNC_FREE:
+	bcastna_free(acc);
+	return 0;
+
+    case GENSIO_ACC_FUNC_DISABLE:
+	bcastna_disable(acc);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+broadcast_gensio_accepter_alloc(struct gensio_accepter *child,
+				const char * const args[],
+				struct gensio_os_funcs *o,
+				gensio_accepter_event cb, void *user_data,
+				struct gensio_accepter **accepter)
+{
+    struct bcastna_data *nadata;
+    gensiods ringsize = 65536;
+    int policy = BCAST_BLOCK;
+    int i;
+    GENSIO_DECLARE_PPACCEPTER(p, o, cb, "broadcast", user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_ds(&p, args[i], "ringsize", &ringsize) > 0)
+	    continue;
+	if (gensio_pparm_enum(&p, args[i], "policy", bcast_policy_enums,
+			      &policy) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (ringsize == 0) {
+	gensio_pparm_slog(&p, "ringsize must not be zero");
+	return GE_INVAL;
+    }
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->refcount = 1;
+    nadata->policy = policy;
+    nadata->ringsize = ringsize;
+    gensio_list_init(&nadata->readers);
+
+    nadata->ring = o->zalloc(o, ringsize);
+    if (!nadata->ring)
+	goto out_nomem;
+
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_nomem;
+
+    nadata->deferred_runner = o->alloc_runner(o, bcastna_do_deferred,
+					      nadata);
+    if (!nadata->deferred_runner)
+	goto out_nomem;
+
+    nadata->acc = gensio_acc_data_alloc(o, cb, user_data,
+					gensio_acc_bcast_func,
+					child, "broadcast", nadata);
+    if (!nadata->acc)
+	goto out_nomem;
+    gensio_acc_set_is_reliable(nadata->acc, true);
+
+    /* The child is ours now. */
+    nadata->child = child;
+    gensio_acc_set_callback(child, bcastna_child_event, nadata);
+
+    *accepter = nadata->acc;
+    return 0;
+
+ out_nomem:
+    bcastna_finish_free(nadata);
+    return GE_NOMEM;
+}
+
+static int
+str_to_broadcast_gensio_accepter(const char *str, const char * const args[],
+				 struct gensio_os_funcs *o,
+				 gensio_accepter_event cb,
+				 void *user_data,
+				 struct gensio_accepter **acc)
+{
+    int err;
+    struct gensio_accepter *acc2 = NULL;
+
+    /* cb is passed in for parmerr handling, it will be overriden later. */
+    err = str_to_gensio_accepter(str, o, cb, user_data, &acc2);
+    if (!err) {
+	err = broadcast_gensio_accepter_alloc(acc2, args, o, cb, user_data,
+					      acc);
+	if (err)
+	    gensio_acc_free(acc2);
+    }
+
+    return err;
+}
+
+int
+gensio_init_broadcast(struct gensio_os_funcs *o)
+{
+    return register_filter_gensio_accepter(o, "broadcast",
+					   str_to_broadcast_gensio_accepter,
+					   broadcast_gensio_accepter_alloc);
+}
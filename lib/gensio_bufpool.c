@@ -0,0 +1,560 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A pool of I/O buffers for OS handlers to provide buf_alloc and
+ * buf_free.  Buffers are kept in power of two sized bins, with a
+ * small cache of free buffers per thread in front of a shared free
+ * list per bin so most allocations do not take a lock or call
+ * malloc().
+ *
+ * Optionally a region of huge pages can be mapped and buffers carved
+ * out of it on a miss, to cut TLB misses when lots of buffer memory
+ * is in use.  Carved buffers never go back to malloc, they stay on
+ * the free lists until the pool is freed.  When the region runs out
+ * buffers come from malloc again.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include <gensio/gensio_err.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_osops.h>
+#include <gensio/gensio_list.h>
+#include <pthread_handler.h>
+
+#include "errtrig.h"
+
+#if defined(USE_PTHREADS) && !defined(_WIN32)
+#define BUFPOOL_THREAD_CACHE
+#endif
+
+#define BUFPOOL_MIN_SHIFT	9	/* Smallest bin is 512 bytes. */
+#define BUFPOOL_NR_BINS		8	/* Largest bin is 64K. */
+#define BUFPOOL_OVERSIZE	BUFPOOL_NR_BINS
+#define BUFPOOL_MAX_FREE	64	/* Free buffers kept per bin. */
+#define BUFPOOL_CACHE_SIZE	8	/* Free buffers kept per bin per thread. */
+#define BUFPOOL_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+struct bufpool_hdr {
+    union {
+	struct bufpool_hdr *next;	/* When on a free list. */
+	gensiods size;			/* For oversize buffers. */
+    };
+    unsigned int bin;
+    bool carved;		/* From the huge page region. */
+};
+
+/* Keep the data after the header aligned. */
+#define BUFPOOL_HDR_SIZE ((sizeof(struct bufpool_hdr) + 15) & ~15)
+#define hdr_to_buf(h) ((void *) (((unsigned char *) (h)) + BUFPOOL_HDR_SIZE))
+#define buf_to_hdr(b) ((struct bufpool_hdr *) (((unsigned char *) (b)) - \
+					       BUFPOOL_HDR_SIZE))
+
+struct bufpool_bin {
+    struct bufpool_hdr *free;
+    unsigned int count;
+};
+
+#ifdef BUFPOOL_THREAD_CACHE
+struct bufpool_cache {
+    struct gensio_bufpool *p;
+    struct gensio_link link;
+    struct bufpool_bin bins[BUFPOOL_NR_BINS];
+    gensiods hits;
+};
+#endif
+
+struct gensio_bufpool {
+    struct gensio_memtrack *mtrack;
+
+    lock_type lock;
+    struct bufpool_bin bins[BUFPOOL_NR_BINS];
+    gensiods hits;
+    gensiods misses;
+    gensiods oversize;
+
+    /* Bytes in buffers handed out and not yet put back. */
+    gensiods in_use;
+
+    /* The huge page region, carving stops when hp_enabled is off. */
+    unsigned char *hp_base;
+    gensiods hp_size;
+    gensiods hp_pos;
+    bool hp_hugetlb;
+    bool hp_enabled;
+
+#ifdef BUFPOOL_THREAD_CACHE
+    pthread_key_t cache_key;
+    struct gensio_list caches;
+#endif
+};
+
+static gensiods
+bin_size(unsigned int bin)
+{
+    return ((gensiods) 1) << (BUFPOOL_MIN_SHIFT + bin);
+}
+
+static unsigned int
+size_to_bin(gensiods size)
+{
+    unsigned int bin;
+
+    for (bin = 0; bin < BUFPOOL_NR_BINS; bin++) {
+	if (size <= bin_size(bin))
+	    break;
+    }
+    return bin;
+}
+
+static void
+bufpool_in_use_add(struct gensio_bufpool *p, gensiods size)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(&p->in_use, size, __ATOMIC_RELAXED);
+#else
+    LOCK(&p->lock);
+    p->in_use += size;
+    UNLOCK(&p->lock);
+#endif
+}
+
+static void
+bufpool_in_use_sub(struct gensio_bufpool *p, gensiods size)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_sub_fetch(&p->in_use, size, __ATOMIC_RELAXED);
+#else
+    LOCK(&p->lock);
+    p->in_use -= size;
+    UNLOCK(&p->lock);
+#endif
+}
+
+static void
+bin_free_all(struct bufpool_bin *b)
+{
+    struct bufpool_hdr *h;
+
+    while (b->free) {
+	h = b->free;
+	b->free = h->next;
+	if (!h->carved)
+	    free(h);
+    }
+    b->count = 0;
+}
+
+/* Must be called with the pool lock held. */
+static void
+bin_put(struct gensio_bufpool *p, struct bufpool_hdr *h)
+{
+    struct bufpool_bin *b = &p->bins[h->bin];
+
+    /* Carved buffers can't be freed, always keep them. */
+    if (b->count >= BUFPOOL_MAX_FREE && !h->carved) {
+	free(h);
+	return;
+    }
+    h->next = b->free;
+    b->free = h;
+    b->count++;
+}
+
+#ifdef BUFPOOL_THREAD_CACHE
+static void
+bufpool_cache_flush(struct bufpool_cache *c)
+{
+    struct gensio_bufpool *p = c->p;
+    struct bufpool_hdr *h;
+    unsigned int i;
+
+    LOCK(&p->lock);
+    for (i = 0; i < BUFPOOL_NR_BINS; i++) {
+	while (c->bins[i].free) {
+	    h = c->bins[i].free;
+	    c->bins[i].free = h->next;
+	    bin_put(p, h);
+	}
+	c->bins[i].count = 0;
+    }
+    p->hits += c->hits;
+    gensio_list_rm(&p->caches, &c->link);
+    UNLOCK(&p->lock);
+}
+
+static void
+bufpool_thread_exit(void *data)
+{
+    struct bufpool_cache *c = data;
+
+    bufpool_cache_flush(c);
+    free(c);
+}
+
+static struct bufpool_cache *
+bufpool_get_cache(struct gensio_bufpool *p)
+{
+    struct bufpool_cache *c = pthread_getspecific(p->cache_key);
+
+    if (c)
+	return c;
+
+    c = malloc(sizeof(*c));
+    if (!c)
+	return NULL;
+    memset(c, 0, sizeof(*c));
+    c->p = p;
+    if (pthread_setspecific(p->cache_key, c)) {
+	free(c);
+	return NULL;
+    }
+    LOCK(&p->lock);
+    gensio_list_add_tail(&p->caches, &c->link);
+    UNLOCK(&p->lock);
+    return c;
+}
+#endif
+
+struct gensio_bufpool *
+gensio_bufpool_alloc(struct gensio_memtrack *mtrack)
+{
+    struct gensio_bufpool *p;
+
+    p = malloc(sizeof(*p));
+    if (!p)
+	return NULL;
+    memset(p, 0, sizeof(*p));
+    p->mtrack = mtrack;
+    LOCK_INIT(&p->lock);
+#ifdef BUFPOOL_THREAD_CACHE
+    gensio_list_init(&p->caches);
+    if (pthread_key_create(&p->cache_key, bufpool_thread_exit)) {
+	LOCK_DESTROY(&p->lock);
+	free(p);
+	return NULL;
+    }
+#endif
+    return p;
+}
+
+void
+gensio_bufpool_free(struct gensio_bufpool *p)
+{
+    unsigned int i;
+#ifdef BUFPOOL_THREAD_CACHE
+    struct gensio_link *l, *l2;
+
+    pthread_key_delete(p->cache_key);
+    gensio_list_for_each_safe(&p->caches, l, l2) {
+	struct bufpool_cache *c = gensio_container_of(l, struct bufpool_cache,
+						      link);
+
+	gensio_list_rm(&p->caches, l);
+	for (i = 0; i < BUFPOOL_NR_BINS; i++)
+	    bin_free_all(&c->bins[i]);
+	free(c);
+    }
+#endif
+    for (i = 0; i < BUFPOOL_NR_BINS; i++)
+	bin_free_all(&p->bins[i]);
+#ifndef _WIN32
+    if (p->hp_base)
+	munmap(p->hp_base, p->hp_size);
+#endif
+    LOCK_DESTROY(&p->lock);
+    free(p);
+}
+
+/* Must be called with the pool lock held. */
+static struct bufpool_hdr *
+bufpool_carve(struct gensio_bufpool *p, unsigned int bin)
+{
+    gensiods size = BUFPOOL_HDR_SIZE + bin_size(bin);
+    struct bufpool_hdr *h;
+
+    if (!p->hp_enabled || p->hp_size - p->hp_pos < size)
+	return NULL;
+    h = (struct bufpool_hdr *) (p->hp_base + p->hp_pos);
+    p->hp_pos += size;
+    h->carved = true;
+    return h;
+}
+
+#ifndef _WIN32
+/*
+ * Map size bytes on a huge page boundary.  Try explicit huge pages
+ * first, they have to be reserved by the admin, then normal pages
+ * with a request for transparent huge pages.
+ */
+static unsigned char *
+bufpool_map(gensiods size, bool *hugetlb)
+{
+    unsigned char *m, *a;
+    gensiods extra;
+
+#ifdef MAP_HUGETLB
+    m = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (m != MAP_FAILED) {
+	*hugetlb = true;
+	return m;
+    }
+#endif
+
+    /* Map extra so it can be trimmed to an aligned region. */
+    m = mmap(NULL, size + BUFPOOL_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+	return NULL;
+    a = (unsigned char *) (((uintptr_t) m + BUFPOOL_HUGEPAGE_SIZE - 1) &
+			   ~((uintptr_t) BUFPOOL_HUGEPAGE_SIZE - 1));
+    extra = a - m;
+    if (extra)
+	munmap(m, extra);
+    if (BUFPOOL_HUGEPAGE_SIZE - extra)
+	munmap(a + size, BUFPOOL_HUGEPAGE_SIZE - extra);
+#ifdef MADV_HUGEPAGE
+    /* Just advice, if it fails we still have the memory. */
+    madvise(a, size, MADV_HUGEPAGE);
+#endif
+    *hugetlb = false;
+    return a;
+}
+#endif
+
+int
+gensio_bufpool_set_hugepages(struct gensio_bufpool *p, gensiods size)
+{
+#ifdef _WIN32
+    return GE_NOTSUP;
+#else
+    unsigned char *m;
+    bool hugetlb;
+
+    if (p->mtrack)
+	return GE_NOTSUP;
+
+    if (size == 0) {
+	LOCK(&p->lock);
+	p->hp_enabled = false;
+	UNLOCK(&p->lock);
+	return 0;
+    }
+
+    size = ((size + BUFPOOL_HUGEPAGE_SIZE - 1) &
+	    ~((gensiods) BUFPOOL_HUGEPAGE_SIZE - 1));
+    LOCK(&p->lock);
+    if (p->hp_base) {
+	/* Buffers may be out, it can't be replaced. */
+	bool same = p->hp_size == size;
+
+	if (same)
+	    p->hp_enabled = true;
+	UNLOCK(&p->lock);
+	return same ? 0 : GE_INUSE;
+    }
+    UNLOCK(&p->lock);
+
+    m = bufpool_map(size, &hugetlb);
+    if (!m)
+	return GE_NOMEM;
+
+    LOCK(&p->lock);
+    if (p->hp_base) {
+	/* Lost a race with another set. */
+	UNLOCK(&p->lock);
+	munmap(m, size);
+	return GE_INUSE;
+    }
+    p->hp_base = m;
+    p->hp_size = size;
+    p->hp_pos = 0;
+    p->hp_hugetlb = hugetlb;
+    p->hp_enabled = true;
+    UNLOCK(&p->lock);
+    return 0;
+#endif
+}
+
+void
+gensio_bufpool_get_hugepages(struct gensio_bufpool *p,
+			     struct gensio_bufpool_hugepage_config *c)
+{
+    memset(c, 0, sizeof(*c));
+    LOCK(&p->lock);
+    if (p->hp_enabled)
+	c->size = p->hp_size;
+    c->hugetlb = p->hp_hugetlb;
+    c->mapped = p->hp_size;
+    c->carved = p->hp_pos;
+    UNLOCK(&p->lock);
+}
+
+void *
+gensio_bufpool_get(struct gensio_bufpool *p, gensiods size)
+{
+    unsigned int bin = size_to_bin(size);
+    struct bufpool_hdr *h;
+    struct bufpool_bin *b;
+#ifdef BUFPOOL_THREAD_CACHE
+    struct bufpool_cache *c;
+#endif
+
+    if (p->mtrack) {
+	/* Don't hide anything from memory tracking. */
+	LOCK(&p->lock);
+	p->misses++;
+	UNLOCK(&p->lock);
+	return gensio_i_zalloc(p->mtrack, size);
+    }
+
+    if (do_errtrig())
+	return NULL;
+
+    if (bin == BUFPOOL_OVERSIZE) {
+	LOCK(&p->lock);
+	p->oversize++;
+	UNLOCK(&p->lock);
+	h = malloc(BUFPOOL_HDR_SIZE + size);
+	if (!h)
+	    return NULL;
+	h->size = size;
+	h->bin = bin;
+	h->carved = false;
+	bufpool_in_use_add(p, size);
+	return hdr_to_buf(h);
+    }
+
+#ifdef BUFPOOL_THREAD_CACHE
+    c = bufpool_get_cache(p);
+    if (c && c->bins[bin].free) {
+	b = &c->bins[bin];
+	h = b->free;
+	b->free = h->next;
+	b->count--;
+	c->hits++;
+	bufpool_in_use_add(p, bin_size(bin));
+	return hdr_to_buf(h);
+    }
+#endif
+
+    LOCK(&p->lock);
+    b = &p->bins[bin];
+    if (b->free) {
+	h = b->free;
+	b->free = h->next;
+	b->count--;
+	p->hits++;
+	UNLOCK(&p->lock);
+	bufpool_in_use_add(p, bin_size(bin));
+	return hdr_to_buf(h);
+    }
+    p->misses++;
+    h = bufpool_carve(p, bin);
+    UNLOCK(&p->lock);
+
+    if (!h) {
+	h = malloc(BUFPOOL_HDR_SIZE + bin_size(bin));
+	if (!h)
+	    return NULL;
+	h->carved = false;
+    }
+    h->bin = bin;
+    bufpool_in_use_add(p, bin_size(bin));
+    return hdr_to_buf(h);
+}
+
+void
+gensio_bufpool_put(struct gensio_bufpool *p, void *buf)
+{
+    struct bufpool_hdr *h;
+#ifdef BUFPOOL_THREAD_CACHE
+    struct bufpool_cache *c;
+    struct bufpool_bin *b;
+#endif
+
+    if (p->mtrack) {
+	gensio_i_free(p->mtrack, buf);
+	return;
+    }
+
+    h = buf_to_hdr(buf);
+    if (h->bin == BUFPOOL_OVERSIZE) {
+	bufpool_in_use_sub(p, h->size);
+	free(h);
+	return;
+    }
+    bufpool_in_use_sub(p, bin_size(h->bin));
+
+#ifdef BUFPOOL_THREAD_CACHE
+    c = bufpool_get_cache(p);
+    if (c && c->bins[h->bin].count < BUFPOOL_CACHE_SIZE) {
+	b = &c->bins[h->bin];
+	h->next = b->free;
+	b->free = h;
+	b->count++;
+	return;
+    }
+#endif
+
+    LOCK(&p->lock);
+    bin_put(p, h);
+    UNLOCK(&p->lock);
+}
+
+void
+gensio_bufpool_get_stats(struct gensio_bufpool *p,
+			 struct gensio_bufpool_stats *stats)
+{
+    unsigned int i;
+#ifdef BUFPOOL_THREAD_CACHE
+    struct gensio_link *l;
+#endif
+
+    memset(stats, 0, sizeof(*stats));
+    LOCK(&p->lock);
+    stats->hits = p->hits;
+    stats->misses = p->misses;
+    stats->oversize = p->oversize;
+    for (i = 0; i < BUFPOOL_NR_BINS; i++)
+	stats->free += p->bins[i].count;
+#ifdef BUFPOOL_THREAD_CACHE
+    /* The per-thread numbers may be slightly stale, that's ok. */
+    gensio_list_for_each(&p->caches, l) {
+	struct bufpool_cache *c = gensio_container_of(l, struct bufpool_cache,
+						      link);
+
+	stats->hits += c->hits;
+	for (i = 0; i < BUFPOOL_NR_BINS; i++)
+	    stats->free += c->bins[i].count;
+    }
+#endif
+    UNLOCK(&p->lock);
+}
+
+gensiods
+gensio_bufpool_in_use(struct gensio_bufpool *p)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_load_n(&p->in_use, __ATOMIC_RELAXED);
+#else
+    gensiods rv;
+
+    LOCK(&p->lock);
+    rv = p->in_use;
+    UNLOCK(&p->lock);
+    return rv;
+#endif
+}
@@ -5,8 +5,15 @@
  *  SPDX-License-Identifier: LGPL-2.1-only
  */
 
+#define _GNU_SOURCE /* Get memfd_create(). */
+#include "config.h"
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include <gensio/gensio_circbuf.h>
 #include <gensio/gensio_os_funcs.h>
 
@@ -16,8 +23,74 @@ struct gensio_circbuf {
     gensiods size;
     gensiods bufsize;
     unsigned char *cbuf;
+
+    /*
+     * The buffer is mapped twice back to back, so any span of up to
+     * bufsize bytes starting inside the buffer is contiguous.
+     */
+    bool mirrored;
 };
 
+#ifdef HAVE_MEMFD_CREATE
+void *
+gensio_mirror_buf_alloc(struct gensio_os_funcs *o, gensiods size)
+{
+    long pgsize = sysconf(_SC_PAGESIZE);
+    unsigned char *base;
+    void *m;
+    int fd;
+
+    if (size == 0 || pgsize <= 0 || size % pgsize != 0 ||
+		size > SIZE_MAX / 2)
+	return NULL;
+
+    fd = memfd_create("gensio_circbuf", MFD_CLOEXEC);
+    if (fd == -1)
+	return NULL;
+    if (ftruncate(fd, size) == -1)
+	goto out_close;
+
+    /* Reserve the address space for both copies, then map over it. */
+    base = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		-1, 0);
+    if (base == MAP_FAILED)
+	goto out_close;
+    m = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	     fd, 0);
+    if (m == MAP_FAILED)
+	goto out_unmap;
+    m = mmap(base + size, size, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_FIXED, fd, 0);
+    if (m == MAP_FAILED)
+	goto out_unmap;
+    close(fd);
+    return base;
+
+ out_unmap:
+    munmap(base, size * 2);
+ out_close:
+    close(fd);
+    return NULL;
+}
+
+void
+gensio_mirror_buf_free(struct gensio_os_funcs *o, void *buf, gensiods size)
+{
+    munmap(buf, size * 2);
+}
+#else
+void *
+gensio_mirror_buf_alloc(struct gensio_os_funcs *o, gensiods size)
+{
+    return NULL;
+}
+
+void
+gensio_mirror_buf_free(struct gensio_os_funcs *o, void *buf, gensiods size)
+{
+}
+#endif
+
 gensiods
 gensio_circbuf_room_left(struct gensio_circbuf *c)
 {
@@ -33,6 +106,9 @@ gensio_circbuf_next_write_area(struct gensio_circbuf *c,
     end = (c->pos + c->size) % c->bufsize;
     if (c->size == c->bufsize)
 	*size = 0;
+    else if (c->mirrored)
+	/* The second mapping covers the wrap, take all the room. */
+	*size = c->bufsize - c->size;
     else if (end >= c->pos)
 	/* Unwrapped or empty buffer, write to the end. */
 	*size = c->bufsize - end;
@@ -58,7 +134,7 @@ gensio_circbuf_next_read_area(struct gensio_circbuf *c,
     end = (c->pos + c->size) % c->bufsize;
     if (c->size == 0)
 	*size = 0;
-    else if (end > c->pos)
+    else if (c->mirrored || end > c->pos)
 	/* Unwrapped buffer, read the whole thing. */
 	*size = c->size;
     else
@@ -117,6 +193,26 @@ gensio_circbuf_sg_write(struct gensio_circbuf *c,
 	*rcount = count;
 }
 
+void
+gensio_circbuf_sg_read(struct gensio_circbuf *c,
+		       struct gensio_sg *sg, gensiods *sglen)
+{
+    gensiods n = 0, size;
+    void *pos;
+
+    gensio_circbuf_next_read_area(c, &pos, &size);
+    if (size > 0) {
+	sg[n].buf = pos;
+	sg[n++].buflen = size;
+	if (size < c->size) {
+	    /* Wrapped, the rest is at the start of the buffer. */
+	    sg[n].buf = c->cbuf;
+	    sg[n++].buflen = c->size - size;
+	}
+    }
+    *sglen = n;
+}
+
 void
 gensio_circbuf_read(struct gensio_circbuf *c,
 		    void *ibuf, gensiods buflen, gensiods *rcount)
@@ -159,9 +255,38 @@ gensio_circbuf_alloc(struct gensio_os_funcs *o, gensiods size)
     return c;
 }
 
+struct gensio_circbuf *
+gensio_circbuf_alloc_mirrored(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_circbuf *c;
+
+    c = o->zalloc(o, sizeof(*c));
+    if (!c)
+	return NULL;
+    c->o = o;
+    c->cbuf = gensio_mirror_buf_alloc(o, size);
+    if (!c->cbuf) {
+	o->free(o, c);
+	/* Not available here or size isn't usable, use a normal one. */
+	return gensio_circbuf_alloc(o, size);
+    }
+    c->bufsize = size;
+    c->mirrored = true;
+    return c;
+}
+
+bool
+gensio_circbuf_is_mirrored(struct gensio_circbuf *c)
+{
+    return c->mirrored;
+}
+
 void
 gensio_circbuf_free(struct gensio_circbuf *c)
 {
-    c->o->free(c->o, c->cbuf);
+    if (c->mirrored)
+	gensio_mirror_buf_free(c->o, c->cbuf, c->bufsize);
+    else
+	c->o->free(c->o, c->cbuf);
     c->o->free(c->o, c);
 }
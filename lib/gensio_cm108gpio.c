@@ -15,6 +15,7 @@
 #include <gensio/gensio_class.h>
 #include <gensio/argvutils.h>
 #include <gensio/gensio_circbuf.h>
+#include <gensio/gensio_list.h>
 
 #if HAVE_UDEV == 1
 #include <sys/types.h>
@@ -41,9 +42,15 @@ my_strrstr(const char *haystack, const char *needle)
     }
 }
 
+/*
+ * Find the hidraw device for the sound card given by idnum.  On
+ * success, devpath is set to the /dev path and syspfx is set to the
+ * sysfs path prefix of the USB interface the sound card and the HID
+ * device are on, which can be used to check the devpath later.
+ */
 static int
 find_hid_device(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
-		const char *idnum, char **devpath)
+		const char *idnum, char **devpath, char **syspfx)
 {
     struct udev *udev;
     struct udev_enumerate *e = NULL;
@@ -186,6 +193,12 @@ find_hid_device(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
 		err = GE_NOMEM;
 		goto out_err;
 	    }
+	    *syspfx = gensio_strdup(o, basepath);
+	    if (!*syspfx) {
+		o->free(o, n);
+		err = GE_NOMEM;
+		goto out_err;
+	    }
 	    *devpath = n;
 	    err = 0;
 	    break;
@@ -201,6 +214,35 @@ find_hid_device(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
     return err;
 }
 
+/*
+ * hidraw numbers get reused when devices come and go, make sure a
+ * cached devpath is still on the same USB device.  This is a single
+ * lookup, not a scan.
+ */
+static bool
+hid_path_valid(const char *devpath, const char *syspfx)
+{
+    struct udev *udev;
+    struct udev_device *d;
+    const char *name, *path;
+    bool rv = false;
+
+    name = strrchr(devpath, '/');
+    if (!name)
+	return false;
+    udev = udev_new();
+    if (!udev)
+	return false;
+    d = udev_device_new_from_subsystem_sysname(udev, "hidraw", name + 1);
+    if (d) {
+	path = udev_device_get_syspath(d);
+	rv = path && strncmp(path, syspfx, strlen(syspfx)) == 0;
+	udev_device_unref(d);
+    }
+    udev_unref(udev);
+    return rv;
+}
+
 static int
 hid_write(struct gensio_os_funcs *o, int fd,
 	  unsigned char *io, unsigned int len)
@@ -335,7 +377,7 @@ find_usb_composite_parent(HDEVINFO devinfo, const SP_DEVINFO_DATA *cdev_data,
  */
 static int
 find_hid_device(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
-		const char *idnum, char **devpath)
+		const char *idnum, char **devpath, char **syspfx)
 {
     HDEVINFO devinfo;
     unsigned int i;
@@ -477,12 +519,24 @@ find_hid_device(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
  out:
     SetupDiDestroyDeviceInfoList(devinfo);
 
-    if (!err)
+    if (!err) {
 	*devpath = mypath;
+	*syspfx = NULL;
+    }
 
     return err;
 }
 
+/*
+ * Windows device paths contain the device instance, they don't get
+ * reused for another device.
+ */
+static bool
+hid_path_valid(const char *devpath, const char *syspfx)
+{
+    return true;
+}
+
 static int
 hid_write(struct gensio_os_funcs *o, struct win_hid_fd *fd,
 	  unsigned char *io, unsigned int len)
@@ -569,6 +623,132 @@ hid_close(struct win_hid_fd *fd)
 #error "cm108gpio can only be compiled on Linux or Windows"
 #endif
 
+/*
+ * Looking up the HID device is a scan of all the sound and HID
+ * devices, so the results are cached by id/number.  An entry is
+ * checked before use and dropped if the device has gone away or
+ * can't be opened.
+ */
+struct cm108gpio_devcache {
+    struct gensio_link link;
+    char *idnum;
+    char *devpath;
+    char *syspfx;
+};
+
+static struct gensio_os_funcs *cm108gpio_cache_o;
+static struct gensio_lock *cm108gpio_cache_lock;
+static struct gensio_list cm108gpio_cache;
+
+static void
+cm108gpio_devcache_free(struct cm108gpio_devcache *c)
+{
+    struct gensio_os_funcs *o = cm108gpio_cache_o;
+
+    if (c->idnum)
+	o->free(o, c->idnum);
+    if (c->devpath)
+	o->free(o, c->devpath);
+    if (c->syspfx)
+	o->free(o, c->syspfx);
+    o->free(o, c);
+}
+
+/* Must be called with cm108gpio_cache_lock held. */
+static struct cm108gpio_devcache *
+cm108gpio_devcache_find(const char *idnum)
+{
+    struct gensio_link *l;
+    struct cm108gpio_devcache *c;
+
+    gensio_list_for_each(&cm108gpio_cache, l) {
+	c = gensio_container_of(l, struct cm108gpio_devcache, link);
+	if (strcmp(c->idnum, idnum) == 0)
+	    return c;
+    }
+    return NULL;
+}
+
+static void
+cm108gpio_devcache_forget(const char *idnum)
+{
+    struct cm108gpio_devcache *c;
+
+    cm108gpio_cache_o->lock(cm108gpio_cache_lock);
+    c = cm108gpio_devcache_find(idnum);
+    if (c) {
+	gensio_list_rm(&cm108gpio_cache, &c->link);
+	cm108gpio_devcache_free(c);
+    }
+    cm108gpio_cache_o->unlock(cm108gpio_cache_lock);
+}
+
+static void
+cm108gpio_devcache_add(const char *idnum, const char *devpath,
+		       const char *syspfx)
+{
+    struct gensio_os_funcs *o = cm108gpio_cache_o;
+    struct cm108gpio_devcache *c;
+
+    /* Failures here just mean it's not cached. */
+    c = o->zalloc(o, sizeof(*c));
+    if (!c)
+	return;
+    c->idnum = gensio_strdup(o, idnum);
+    c->devpath = gensio_strdup(o, devpath);
+    if (syspfx)
+	c->syspfx = gensio_strdup(o, syspfx);
+    if (!c->idnum || !c->devpath || (syspfx && !c->syspfx)) {
+	cm108gpio_devcache_free(c);
+	return;
+    }
+    gensio_list_add_tail(&cm108gpio_cache, &c->link);
+}
+
+/*
+ * Find the HID device for idnum, from the cache if possible.  If
+ * rescan is set, the cache entry is not used and is replaced.
+ */
+static int
+cm108gpio_find_dev(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
+		   const char *idnum, bool rescan, char **devpath)
+{
+    struct cm108gpio_devcache *c;
+    char *path = NULL, *syspfx = NULL;
+    int err;
+
+    cm108gpio_cache_o->lock(cm108gpio_cache_lock);
+    c = cm108gpio_devcache_find(idnum);
+    if (c && (rescan || !hid_path_valid(c->devpath, c->syspfx))) {
+	gensio_list_rm(&cm108gpio_cache, &c->link);
+	cm108gpio_devcache_free(c);
+	c = NULL;
+    }
+    if (c) {
+	path = gensio_strdup(o, c->devpath);
+	cm108gpio_cache_o->unlock(cm108gpio_cache_lock);
+	if (!path)
+	    return GE_NOMEM;
+	*devpath = path;
+	return 0;
+    }
+    cm108gpio_cache_o->unlock(cm108gpio_cache_lock);
+
+    err = find_hid_device(p, o, idnum, &path, &syspfx);
+    if (err)
+	return err;
+
+    cm108gpio_cache_o->lock(cm108gpio_cache_lock);
+    if (!cm108gpio_devcache_find(idnum))
+	cm108gpio_devcache_add(idnum, path, syspfx);
+    cm108gpio_cache_o->unlock(cm108gpio_cache_lock);
+    if (syspfx)
+	o->free(o, syspfx);
+
+    *devpath = path;
+    return 0;
+}
+
 enum cm108gpio_state {
     CM108GPIO_CLOSED,
     CM108GPIO_IN_OPEN,
@@ -587,6 +767,11 @@ struct cm108gpio_data {
     struct gensio *io;
 
     char *devpath;
+    /*
+     * This is kept open from the first open until the gensio is freed
+     * so keying after a reopen doesn't have to find and open the
+     * device again.
+     */
     fdtype fd;
     char *idnum;
     unsigned int bit;
@@ -614,6 +799,8 @@ cm108gpio_finish_free(struct cm108gpio_data *ndata)
 
     if (ndata->io)
 	gensio_data_free(ndata->io);
+    if (ndata->fd != INVALID_FD)
+	hid_close(ndata->fd);
     if (ndata->idnum)
 	o->free(o, ndata->idnum);
     if (ndata->devpath)
@@ -689,13 +876,11 @@ cm108gpio_deferred_op(struct gensio_runner *runner, void *cb_data)
     }
 
     if (ndata->state == CM108GPIO_IN_CLOSE) {
-	hid_close(ndata->fd);
-	ndata->fd = INVALID_FD;
 	ndata->state = CM108GPIO_CLOSED;
 	if (ndata->close_done) {
 	    cm108gpio_unlock(ndata);
 	    ndata->close_done(ndata->io, ndata->close_data);
-	    cm108gpio_unlock(ndata);
+	    cm108gpio_lock(ndata);
 	}
 
 	if (ndata->state != CM108GPIO_CLOSED)
@@ -744,6 +929,37 @@ cm108gpio_hid_set(struct cm108gpio_data *ndata, int set)
     return hid_write(ndata->o, ndata->fd, io, 5);
 }
 
+/*
+ * The HID device couldn't be opened or written, it was probably
+ * unplugged and may have come back somewhere else.  Look it up
+ * again and open it.  Called with the lock held.
+ */
+static int
+cm108gpio_hid_reopen(struct cm108gpio_data *ndata)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    GENSIO_DECLARE_PPGENSIO(p, o, gensio_get_cb(ndata->io), "cm108gpio",
+			    gensio_get_user_data(ndata->io));
+    char *devpath;
+    int err;
+
+    if (ndata->fd != INVALID_FD) {
+	hid_close(ndata->fd);
+	ndata->fd = INVALID_FD;
+    }
+    err = cm108gpio_find_dev(&p, o, ndata->idnum, true, &devpath);
+    if (err)
+	return err;
+    o->free(o, ndata->devpath);
+    ndata->devpath = devpath;
+    err = hid_open(o, ndata->devpath, &ndata->fd);
+    if (err) {
+	ndata->fd = INVALID_FD;
+	cm108gpio_devcache_forget(ndata->idnum);
+    }
+    return err;
+}
+
 static int
 cm108gpio_write(struct gensio *io, gensiods *rcount,
 		 const struct gensio_sg *sg, gensiods sglen)
@@ -773,6 +989,11 @@ cm108gpio_write(struct gensio *io, gensiods *rcount,
 	if (set < 0)
 	    set = 0;
 	err = cm108gpio_hid_set(ndata, set);
+	if (err) {
+	    err = cm108gpio_hid_reopen(ndata);
+	    if (!err)
+		err = cm108gpio_hid_set(ndata, set);
+	}
     }
     cm108gpio_unlock(ndata);
     if (rcount)
@@ -791,7 +1012,11 @@ cm108gpio_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 	err = GE_NOTREADY;
 	goto out_unlock;
     }
-    err = hid_open(ndata->o, ndata->devpath, &ndata->fd);
+    if (ndata->fd == INVALID_FD) {
+	err = hid_open(ndata->o, ndata->devpath, &ndata->fd);
+	if (err)
+	    err = cm108gpio_hid_reopen(ndata);
+    }
     if (!err) {
 	ndata->state = CM108GPIO_IN_OPEN;
 	ndata->open_done = open_done;
@@ -936,7 +1161,7 @@ cm108gpio_ndata_setup(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
     if (!ndata->deferred_op_runner)
 	goto out_err;
 
-    err = find_hid_device(p, o, idnum, &ndata->devpath);
+    err = cm108gpio_find_dev(p, o, idnum, false, &ndata->devpath);
     if (err)
 	goto out_err;
 
@@ -1003,11 +1228,38 @@ str_to_cm108gpio_gensio(const char *str, const char * const args[],
     return cm108gpio_gensio_alloc(str, args, o, cb, user_data, new_gensio);
 }
 
+static void
+gensio_cm108gpio_cleanup_mem(void)
+{
+    struct gensio_link *l, *l2;
+    struct cm108gpio_devcache *c;
+
+    gensio_list_for_each_safe(&cm108gpio_cache, l, l2) {
+	c = gensio_container_of(l, struct cm108gpio_devcache, link);
+	gensio_list_rm(&cm108gpio_cache, l);
+	cm108gpio_devcache_free(c);
+    }
+    if (cm108gpio_cache_lock)
+	cm108gpio_cache_o->free_lock(cm108gpio_cache_lock);
+    cm108gpio_cache_lock = NULL;
+}
+
+static struct gensio_class_cleanup cm108gpio_class_cleanup = {
+    gensio_cm108gpio_cleanup_mem
+};
+
 int
 gensio_init_cm108gpio(struct gensio_os_funcs *o)
 {
     int rv;
 
+    cm108gpio_cache_o = o;
+    gensio_list_init(&cm108gpio_cache);
+    cm108gpio_cache_lock = o->alloc_lock(o);
+    if (!cm108gpio_cache_lock)
+	return GE_NOMEM;
+    gensio_register_class_cleanup(&cm108gpio_class_cleanup);
+
     rv = register_gensio(o, "cm108gpio",
 			 str_to_cm108gpio_gensio, cm108gpio_gensio_alloc);
     if (rv)
@@ -36,6 +36,12 @@ struct conaccn_data {
 
     struct gensio *child;
 
+    /*
+     * Opened ahead of time to be handed out when the current child
+     * closes, see the standby option.
+     */
+    bool standby;
+
     bool in_close;
     gensio_done close_done;
     void *close_data;
@@ -267,11 +273,25 @@ struct conaccna_data {
     /* Used to start the child gensio. */
     char *gensio_str;
 
+    /*
+     * If use_standby is set, a second child is opened while the
+     * current one is in use.  When the current one closes, standby
+     * becomes ndata and is reported from the deferred op if
+     * standby_promote is set, or when its open finishes otherwise.
+     */
+    bool use_standby;
+    struct conaccn_data *standby;
+    bool standby_promote;
+
     unsigned int refcount;
 };
 
 static void conacc_start(struct conaccna_data *nadata);
+static void conacc_next(struct conaccna_data *nadata);
+static void conacc_start_standby(struct conaccna_data *nadata);
+static void conacc_drop_standby(struct conaccna_data *nadata);
 static void start_retry(struct conaccna_data *nadata);
+static void conaccn_open_done(struct gensio *io, int err, void *open_data);
 
 static void
 conaccn_lock(struct conaccn_data *ndata)
@@ -416,6 +436,16 @@ conaccna_do_deferred(struct gensio_runner *runner, void *cb_data)
 
     conaccna_call_enabled(nadata);
 
+    if (nadata->standby_promote) {
+	/* An already open standby child, report it like a new open. */
+	struct conaccn_data *ndata = nadata->ndata;
+
+	nadata->standby_promote = false;
+	conaccna_unlock(nadata);
+	conaccn_open_done(ndata->child, 0, ndata);
+	conaccna_lock(nadata);
+    }
+
     switch (nadata->state) {
     case CONACCNA_SHUTDOWN:
     case CONACCNA_OPENING:
@@ -486,10 +516,7 @@ conaccn_finish_close(struct conaccn_data *ndata)
 	    break;
 
 	case CONACCNA_READY:
-	    if (!gensio_time_is_zero(nadata->retry_time))
-		start_retry(nadata);
-	    else
-		conacc_start(nadata);
+	    conacc_next(nadata);
 	}
 	conaccna_deref_and_unlock(nadata);
     }
@@ -585,11 +612,7 @@ conaccn_disable(struct conaccn_data *ndata)
     if (nadata) {
 	conaccna_lock(nadata);
 	nadata->ndata = NULL;
-	if (!gensio_time_is_zero(nadata->retry_time))
-	    start_retry(nadata);
-	else
-	    conacc_start(nadata);
-	conacc_start(nadata);
+	conacc_next(nadata);
 	conaccna_unlock(nadata);
     }
     conaccn_unlock(ndata);
@@ -651,12 +674,70 @@ start_retry(struct conaccna_data *nadata)
     conaccna_ref(nadata);
 }
 
+static void
+conaccn_standby_close_done(struct gensio *child_io, void *close_cb_data)
+{
+    struct conaccn_data *ndata = close_cb_data;
+    struct conaccna_data *nadata = ndata->nadata;
+
+    conaccn_finish_free(ndata);
+    conaccna_lock(nadata);
+    conaccna_deref_and_unlock(nadata);
+}
+
+/*
+ * Called with the lock held, ndata must not be nadata->standby.
+ * Returns true if ndata is gone and the caller must drop its nadata
+ * ref, otherwise the close done does that.
+ */
+static bool
+conaccn_standby_free(struct conaccn_data *ndata, bool is_open)
+{
+    if (is_open) {
+	ndata->child_state = CONACCN_IN_CLOSE;
+	if (!gensio_close(ndata->child, conaccn_standby_close_done, ndata))
+	    return false;
+    }
+    conaccn_finish_free(ndata);
+    return true;
+}
+
+/*
+ * A standby open finished.  Keep it open if it is still wanted,
+ * otherwise get rid of it.  Failures are not reported or retried,
+ * the next session just opens the normal way.
+ */
+static bool
+conaccn_standby_open_done(struct conaccna_data *nadata,
+			  struct conaccn_data *ndata, int err)
+{
+    if (nadata->standby == ndata) {
+	if (!err) {
+	    ndata->child_state = CONACCN_OPEN;
+	    /* Keep the nadata ref for the open child. */
+	    return false;
+	}
+	nadata->standby = NULL;
+    }
+    return conaccn_standby_free(ndata, !err);
+}
+
 static void
 conaccn_open_done(struct gensio *io, int err, void *open_data)
 {
     struct conaccn_data *ndata = open_data;
     struct conaccna_data *nadata = ndata->nadata;
 
+    conaccna_lock(nadata);
+    if (ndata->standby) {
+	if (conaccn_standby_open_done(nadata, ndata, err))
+	    conaccna_deref_and_unlock(nadata);
+	else
+	    conaccna_unlock(nadata);
+	return;
+    }
+    conaccna_unlock(nadata);
+
     if (err)
 	goto out_err;
 
@@ -701,6 +782,7 @@ conaccn_open_done(struct gensio *io, int err, void *open_data)
 	    goto out_cleanup;
 	}
 	nadata->state = CONACCNA_READY;
+	conacc_start_standby(nadata);
 	break;
 
     case CONACCNA_OPEN_SHUTDOWN:
@@ -727,24 +809,20 @@ conaccn_open_done(struct gensio *io, int err, void *open_data)
     conaccna_deref_and_unlock(nadata);
 }
 
-static void
-conacc_start(struct conaccna_data *nadata)
+/* Called with the lock held. */
+static int
+conaccn_alloc_open(struct conaccna_data *nadata, bool standby,
+		   struct conaccn_data **rndata)
 {
     struct conaccn_data *ndata;
     int err = GE_NOMEM;
 
-    if (nadata->ndata) {
-	nadata->state = CONACCNA_READY;
-	return;
-    }
-
-    nadata->state = CONACCNA_OPENING;
-
     ndata = nadata->o->zalloc(nadata->o, sizeof(*ndata));
     if (!ndata)
-	goto out_err_nofree;
+	return GE_NOMEM;
     ndata->o = nadata->o;
     ndata->nadata = nadata;
+    ndata->standby = standby;
     ndata->refcount = 1;
     ndata->lock = nadata->o->alloc_lock(nadata->o);
     if (!ndata->lock)
@@ -755,20 +833,96 @@ conacc_start(struct conaccna_data *nadata)
     if (err)
 	goto out_err;
 
-    nadata->ndata = ndata;
     conaccna_ref(nadata);
     ndata->child_state = CONACCN_IN_OPEN;
     err = gensio_open(ndata->child, conaccn_open_done, ndata);
     if (err) {
-	nadata->ndata = NULL;
 	conaccna_deref(nadata);
 	goto out_err;
     }
-    return;
+    *rndata = ndata;
+    return 0;
 
  out_err:
     conaccn_finish_free(ndata);
- out_err_nofree:
+    return err;
+}
+
+/* Called with the lock held. */
+static void
+conacc_start_standby(struct conaccna_data *nadata)
+{
+    if (!nadata->use_standby || nadata->standby)
+	return;
+    /* On failure just do without, the next close opens normally. */
+    conaccn_alloc_open(nadata, true, &nadata->standby);
+}
+
+/*
+ * Called with the lock held.  Get rid of the standby child, if it is
+ * still opening the open done will take care of it.
+ */
+static void
+conacc_drop_standby(struct conaccna_data *nadata)
+{
+    struct conaccn_data *ndata = nadata->standby;
+
+    if (!ndata)
+	return;
+    nadata->standby = NULL;
+    if (ndata->child_state == CONACCN_OPEN) {
+	if (conaccn_standby_free(ndata, true))
+	    conaccna_deref(nadata);
+    }
+}
+
+/*
+ * Called with the lock held when the current child has gone away in
+ * CONACCNA_READY.  Hand out the standby child if there is one, the
+ * retry time is skipped for that since it is already open.
+ */
+static void
+conacc_next(struct conaccna_data *nadata)
+{
+    struct conaccn_data *ndata = nadata->standby;
+
+    if (!ndata) {
+	if (!gensio_time_is_zero(nadata->retry_time))
+	    start_retry(nadata);
+	else
+	    conacc_start(nadata);
+	return;
+    }
+
+    nadata->standby = NULL;
+    nadata->ndata = ndata;
+    nadata->state = CONACCNA_OPENING;
+    ndata->standby = false;
+    if (ndata->child_state == CONACCN_OPEN) {
+	/* The open done can't be called from here, defer it. */
+	ndata->child_state = CONACCN_IN_OPEN;
+	nadata->standby_promote = true;
+	conaccna_deferred_op(nadata);
+    }
+    /* Otherwise the open done will report it when the open finishes. */
+}
+
+static void
+conacc_start(struct conaccna_data *nadata)
+{
+    int err;
+
+    if (nadata->ndata) {
+	nadata->state = CONACCNA_READY;
+	return;
+    }
+
+    nadata->state = CONACCNA_OPENING;
+
+    err = conaccn_alloc_open(nadata, false, &nadata->ndata);
+    if (!err)
+	return;
+
     if (!gensio_time_is_zero(nadata->retry_time)) {
 	start_retry(nadata);
     } else {
@@ -937,8 +1091,10 @@ conaccna_shutdown(struct gensio_accepter *accepter,
 	conaccna_deferred_op(nadata);
 	break;
     }
-    if (!rv)
+    if (!rv) {
 	nadata->shutdown_done = shutdown_done;
+	conacc_drop_standby(nadata);
+    }
     conaccna_unlock(nadata);
 
     return rv;
@@ -1023,6 +1179,8 @@ conaccna_set_accept_callback_enable(struct gensio_accepter *accepter,
     if (!rv) {
 	nadata->enabled = enabled;
 	nadata->enabled_done = done;
+	if (!enabled)
+	    conacc_drop_standby(nadata);
 	if (do_deferred)
 	    conaccna_deferred_op(nadata);
     }
@@ -1045,8 +1203,17 @@ static void
 conaccna_disable(struct gensio_accepter *accepter,
 		 struct conaccna_data *nadata)
 {
+    struct conaccn_data *ndata;
+
     conaccna_lock(nadata);
     nadata->state = CONACCNA_DEAD;
+    ndata = nadata->standby;
+    if (ndata) {
+	nadata->standby = NULL;
+	gensio_disable(ndata->child);
+	conaccn_finish_free(ndata);
+	conaccna_deref(nadata);
+    }
     conaccna_unlock(nadata);
 }
 
@@ -1125,12 +1292,15 @@ conacc_gensio_accepter_alloc(const void *gdata,
     struct conaccna_data *nadata;
     unsigned int i;
     struct gensio_time retry_time = { 0, 0 };
+    bool standby = false;
     int err;
     GENSIO_DECLARE_PPACCEPTER(p, o, cb, "conacc", user_data);
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_time(&p, args[i], "retry-time", 'm', &retry_time) > 0)
 	    continue;
+	if (gensio_pparm_bool(&p, args[i], "standby", &standby) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(&p, args[i]);
 	return GE_INVAL;
     }
@@ -1142,6 +1312,7 @@ conacc_gensio_accepter_alloc(const void *gdata,
     nadata->enabled = true;
     nadata->refcount = 1;
     nadata->retry_time = retry_time;
+    nadata->use_standby = standby;
 
     nadata->gensio_str = gensio_strdup(o, gensio_str);
     if (!nadata->gensio_str)
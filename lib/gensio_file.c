@@ -7,6 +7,7 @@
 
 /* This code is for a gensio that reads/writes files. */
 
+#define _GNU_SOURCE /* Get O_DIRECT. */
 #include "config.h"
 #include <assert.h>
 #include <string.h>
@@ -23,9 +24,36 @@
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #endif
 
+#if !USE_FILE_STDIO && defined(USE_PTHREADS)
+#include <pthread.h>
+#include <gensio/gensio_list.h>
+#define FILEN_ASYNC
+
+/*
+ * Async file I/O is done by a small pool of threads shared by all
+ * file gensios, so a slow disk only stalls the pool, not the threads
+ * running the os funcs.  At most one read and one write per gensio
+ * is outstanding.
+ */
+#define FILEN_POOL_THREADS 4
+
+struct filen_data;
+
+struct filen_job {
+    struct gensio_link link;
+    struct filen_data *ndata;
+    bool is_write;
+    bool busy;	/* Queued or running. */
+    bool done;	/* Finished, waiting for the completion runner. */
+    int err;
+    gensiods count;
+};
+#endif
+
 enum filen_state {
     FILEN_CLOSED,
     FILEN_IN_OPEN,
@@ -48,6 +76,32 @@ struct filen_data {
     gensiods data_pending_len;
     int read_err;
 
+#if !USE_FILE_STDIO
+    /* Open the input file O_DIRECT, read_data is page aligned. */
+    bool direct;
+
+    /*
+     * Map the input file and hand out the mapped pages on read
+     * instead of copying into read_data.  The mapping is private, so
+     * the user modifying the data doesn't touch the file.
+     */
+    bool use_mmap;
+    unsigned char *map;
+    gensiods map_len;
+    gensiods map_pos;
+    bool mapped;
+#endif
+
+#ifdef FILEN_ASYNC
+    bool async;
+    struct filen_job rjob;
+    struct filen_job wjob;
+    unsigned char *wbuf;
+    gensiods wbuf_len;
+    int write_err;
+    struct gensio_runner *job_done_runner;
+#endif
+
     char *infile;
     char *outfile;
     bool create;
@@ -208,6 +262,201 @@ f_open(struct gensio_os_funcs *o,
 }
 
 #define f_close(f) close(f)
+
+/*
+ * Set up the input file for streaming through it.  Anything that
+ * fails here just leaves the normal read path in place.
+ */
+static void
+f_setup_input(struct filen_data *ndata)
+{
+    struct stat st;
+    void *m;
+
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(ndata->inf, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (!ndata->use_mmap)
+	return;
+    if (fstat(ndata->inf, &st) == -1 || !S_ISREG(st.st_mode))
+	return;
+    ndata->map_pos = 0;
+    ndata->map_len = st.st_size;
+    if (ndata->map_len == 0) {
+	ndata->mapped = true;
+	return;
+    }
+    m = mmap(NULL, ndata->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	     ndata->inf, 0);
+    if (m == MAP_FAILED)
+	return;
+#ifdef MADV_SEQUENTIAL
+    madvise(m, ndata->map_len, MADV_SEQUENTIAL);
+#endif
+    ndata->map = m;
+    ndata->mapped = true;
+}
+
+static void
+f_cleanup_input(struct filen_data *ndata)
+{
+    if (ndata->map)
+	munmap(ndata->map, ndata->map_len);
+    ndata->map = NULL;
+    ndata->mapped = false;
+}
+
+static unsigned char *
+f_alloc_read_data(struct filen_data *ndata)
+{
+    long pgsize;
+    void *m;
+
+    if (!ndata->direct)
+	return ndata->o->zalloc(ndata->o, ndata->max_read_size);
+
+    /* O_DIRECT needs aligned buffers and block sized reads. */
+    pgsize = sysconf(_SC_PAGESIZE);
+    if (pgsize <= 0)
+	pgsize = 4096;
+    ndata->max_read_size = ((ndata->max_read_size + pgsize - 1)
+			    / pgsize * pgsize);
+    if (posix_memalign(&m, pgsize, ndata->max_read_size))
+	return NULL;
+    return m;
+}
+
+static void
+f_free_read_data(struct filen_data *ndata)
+{
+    if (ndata->direct)
+	free(ndata->read_data);
+    else
+	ndata->o->free(ndata->o, ndata->read_data);
+}
+#endif
+
+#ifdef FILEN_ASYNC
+static pthread_mutex_t filen_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filen_pool_cond = PTHREAD_COND_INITIALIZER;
+static struct gensio_list filen_pool_jobs;
+static pthread_t filen_pool_threads[FILEN_POOL_THREADS];
+static unsigned int filen_pool_nthreads;
+static bool filen_pool_shutdown;
+
+static void
+filen_lock(struct filen_data *ndata);
+static void
+filen_unlock(struct filen_data *ndata);
+
+static void *
+filen_pool_thread(void *data)
+{
+    struct filen_job *job;
+    struct filen_data *ndata;
+    gensiods count = 0;
+    struct gensio_sg sg;
+    int err;
+
+    pthread_mutex_lock(&filen_pool_lock);
+    for (;;) {
+	while (!filen_pool_shutdown && gensio_list_empty(&filen_pool_jobs))
+	    pthread_cond_wait(&filen_pool_cond, &filen_pool_lock);
+	if (filen_pool_shutdown)
+	    break;
+	job = gensio_container_of(gensio_list_first(&filen_pool_jobs),
+				  struct filen_job, link);
+	gensio_list_rm(&filen_pool_jobs, &job->link);
+	pthread_mutex_unlock(&filen_pool_lock);
+
+	/*
+	 * The files stay open and the buffers stay put while the job
+	 * is busy, so no lock is needed for the I/O itself.
+	 */
+	ndata = job->ndata;
+	if (job->is_write) {
+	    sg.buf = ndata->wbuf;
+	    sg.buflen = ndata->wbuf_len;
+	    err = f_writev(ndata->o, ndata->outf, &sg, 1, &count);
+	} else {
+	    err = f_read(ndata->o, ndata->inf, ndata->read_data,
+			 ndata->max_read_size, &count);
+	}
+
+	filen_lock(ndata);
+	job->err = err;
+	job->count = count;
+	job->done = true;
+	ndata->o->run(ndata->job_done_runner);
+	filen_unlock(ndata);
+
+	pthread_mutex_lock(&filen_pool_lock);
+    }
+    pthread_mutex_unlock(&filen_pool_lock);
+    return NULL;
+}
+
+/* Start the pool if it's not running.  Returns false if that fails. */
+static bool
+filen_pool_start(void)
+{
+    bool rv;
+
+    pthread_mutex_lock(&filen_pool_lock);
+    if (filen_pool_nthreads == 0) {
+	gensio_list_init(&filen_pool_jobs);
+	filen_pool_shutdown = false;
+	while (filen_pool_nthreads < FILEN_POOL_THREADS) {
+	    if (pthread_create(&filen_pool_threads[filen_pool_nthreads], NULL,
+			       filen_pool_thread, NULL))
+		break;
+	    filen_pool_nthreads++;
+	}
+    }
+    rv = filen_pool_nthreads > 0;
+    pthread_mutex_unlock(&filen_pool_lock);
+    return rv;
+}
+
+static void
+filen_pool_cleanup_mem(void)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&filen_pool_lock);
+    filen_pool_shutdown = true;
+    pthread_cond_broadcast(&filen_pool_cond);
+    pthread_mutex_unlock(&filen_pool_lock);
+    for (i = 0; i < filen_pool_nthreads; i++)
+	pthread_join(filen_pool_threads[i], NULL);
+    filen_pool_nthreads = 0;
+}
+
+static struct gensio_class_cleanup filen_pool_class_cleanup = {
+    filen_pool_cleanup_mem
+};
+
+static void filen_ref(struct filen_data *ndata);
+
+/* Must be called with the ndata lock held. */
+static void
+filen_submit_job(struct filen_data *ndata, struct filen_job *job)
+{
+    job->busy = true;
+    filen_ref(ndata); /* Released by the completion runner. */
+    pthread_mutex_lock(&filen_pool_lock);
+    gensio_list_add_tail(&filen_pool_jobs, &job->link);
+    pthread_cond_signal(&filen_pool_cond);
+    pthread_mutex_unlock(&filen_pool_lock);
+}
+
+static bool
+filen_jobs_busy(struct filen_data *ndata)
+{
+    return ndata->rjob.busy || ndata->wjob.busy;
+}
+#else
+#define filen_jobs_busy(ndata) false
 #endif
 
 static void
@@ -221,10 +470,21 @@ filen_finish_free(struct filen_data *ndata)
 	o->free(ndata->o, ndata->infile);
     if (ndata->outfile)
 	o->free(ndata->o, ndata->outfile);
-    if (ndata->read_data)
+    if (ndata->read_data) {
+#if USE_FILE_STDIO
 	o->free(o, ndata->read_data);
+#else
+	f_free_read_data(ndata);
+#endif
+    }
     if (ndata->deferred_op_runner)
 	o->free_runner(ndata->deferred_op_runner);
+#ifdef FILEN_ASYNC
+    if (ndata->wbuf)
+	o->free(o, ndata->wbuf);
+    if (ndata->job_done_runner)
+	o->free_runner(ndata->job_done_runner);
+#endif
     if (ndata->lock)
 	o->free_lock(ndata->lock);
     o->free(o, ndata);
@@ -278,6 +538,27 @@ filen_write(struct gensio *io, gensiods *count,
 	/* Just drop the data. */
 	for (total_write = 0, i = 0; i < sglen; i++)
 	    total_write += sg->buflen;
+#ifdef FILEN_ASYNC
+    } else if (ndata->async) {
+	/* Take what fits in the write buffer and hand it to the pool. */
+	if (ndata->write_err) {
+	    err = ndata->write_err;
+	} else if (!ndata->wjob.busy) {
+	    ndata->wbuf_len = 0;
+	    for (i = 0; i < sglen && ndata->wbuf_len < ndata->max_read_size;
+		 i++) {
+		gensiods len = sg[i].buflen;
+
+		if (len > ndata->max_read_size - ndata->wbuf_len)
+		    len = ndata->max_read_size - ndata->wbuf_len;
+		memcpy(ndata->wbuf + ndata->wbuf_len, sg[i].buf, len);
+		ndata->wbuf_len += len;
+	    }
+	    if (ndata->wbuf_len > 0)
+		filen_submit_job(ndata, &ndata->wjob);
+	    total_write = ndata->wbuf_len;
+	}
+#endif
     } else {
 	err = f_writev(ndata->o, ndata->outf, sg, sglen, &wcount);
 	if (!err)
@@ -315,8 +596,29 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
     while (ndata->state == FILEN_OPEN &&
 	   (f_ready(ndata->inf) || ndata->read_err) && ndata->read_enabled) {
 	gensiods count = 0;
+	unsigned char *buf = ndata->read_data;
 
+#if !USE_FILE_STDIO
+	if (ndata->mapped) {
+	    if (!ndata->read_err && ndata->map_pos >= ndata->map_len) {
+		ndata->read_enabled = false;
+		ndata->read_err = GE_REMCLOSE;
+	    }
+	    buf = ndata->map + ndata->map_pos;
+	    ndata->data_pending_len = ndata->map_len - ndata->map_pos;
+	    if (ndata->data_pending_len > ndata->max_read_size)
+		ndata->data_pending_len = ndata->max_read_size;
+	} else
+#endif
 	if (ndata->data_pending_len == 0 && !ndata->read_err) {
+#ifdef FILEN_ASYNC
+	    if (ndata->async) {
+		/* The completion runner restarts us when it's done. */
+		if (!ndata->rjob.busy)
+		    filen_submit_job(ndata, &ndata->rjob);
+		break;
+	    }
+#endif
 	    err = f_read(ndata->o, ndata->inf, ndata->read_data,
 			 ndata->max_read_size, &count);
 
@@ -332,9 +634,12 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 	    /* Just don't report anything at the end of data. */
 	    ndata->read_enabled = false;
 	} else {
+	    if (ndata->read_err)
+		/* An async read error gets here with read enabled. */
+		ndata->read_enabled = false;
 	    filen_unlock(ndata);
 	    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, ndata->read_err,
-			    ndata->read_data, &count, NULL);
+			    buf, &count, NULL);
 	    filen_lock(ndata);
 	    if (err) {
 		ndata->read_enabled = false;
@@ -342,6 +647,15 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 		break;
 	    }
 	}
+#if !USE_FILE_STDIO
+	if (ndata->mapped) {
+	    if (count > ndata->data_pending_len)
+		count = ndata->data_pending_len;
+	    ndata->map_pos += count;
+	    ndata->data_pending_len = 0;
+	    continue;
+	}
+#endif
 	if (count > 0) {
 	    if (count >= ndata->data_pending_len) {
 		ndata->data_pending_len = 0;
@@ -354,6 +668,11 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
     }
 
     while (ndata->state == FILEN_OPEN && ndata->xmit_enabled) {
+#ifdef FILEN_ASYNC
+	/* Can't take more until the write in progress finishes. */
+	if (ndata->async && ndata->wjob.busy)
+	    break;
+#endif
 	filen_unlock(ndata);
 	err = gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0,
 			NULL, NULL, NULL);
@@ -365,7 +684,7 @@ filen_deferred_op(struct gensio_runner *runner, void *cb_data)
 	}
     }
 
-    if (ndata->state == FILEN_IN_CLOSE) {
+    if (ndata->state == FILEN_IN_CLOSE && !filen_jobs_busy(ndata)) {
 	ndata->state = FILEN_CLOSED;
 	if (ndata->close_done) {
 	    filen_unlock(ndata);
@@ -428,9 +747,22 @@ filen_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 	goto out_unlock;
     }
     if (ndata->infile) {
+#if !USE_FILE_STDIO && defined(O_DIRECT)
+	if (ndata->direct) {
+	    err = f_open(ndata->o, ndata->infile, F_O_RDONLY | O_DIRECT, 0,
+			 &ndata->inf);
+	    /* Not all filesystems can do it, just read normally then. */
+	    if (err == GE_INVAL)
+		err = f_open(ndata->o, ndata->infile, F_O_RDONLY, 0,
+			     &ndata->inf);
+	} else
+#endif
 	err = f_open(ndata->o, ndata->infile, F_O_RDONLY, 0, &ndata->inf);
 	if (err)
 	    goto out_unlock;
+#if !USE_FILE_STDIO
+	f_setup_input(ndata);
+#endif
     }
     if (ndata->outfile) {
 	int flags = F_O_WRONLY;
@@ -452,6 +784,74 @@ filen_open(struct gensio *io, gensio_done_err open_done, void *open_data)
     return err;
 }
 
+static void
+filen_close_files(struct filen_data *ndata)
+{
+    if (f_ready(ndata->inf)) {
+#if !USE_FILE_STDIO
+	f_cleanup_input(ndata);
+#endif
+	f_close(ndata->inf);
+	f_set_not_ready(ndata->inf);
+    }
+    if (f_ready(ndata->outf)) {
+	f_close(ndata->outf);
+	f_set_not_ready(ndata->outf);
+    }
+}
+
+#ifdef FILEN_ASYNC
+static void
+filen_job_done(struct gensio_runner *runner, void *cb_data)
+{
+    struct filen_data *ndata = cb_data;
+    unsigned int finished = 0;
+
+    filen_lock(ndata);
+    if (ndata->rjob.done) {
+	ndata->rjob.done = false;
+	ndata->rjob.busy = false;
+	if (ndata->rjob.err)
+	    ndata->read_err = ndata->rjob.err;
+	else
+	    ndata->data_pending_len = ndata->rjob.count;
+	finished++;
+    }
+    if (ndata->wjob.done) {
+	ndata->wjob.done = false;
+	if (ndata->wjob.err) {
+	    ndata->write_err = ndata->wjob.err;
+	} else if (ndata->wjob.count < ndata->wbuf_len) {
+	    /* Short write, send the rest.  This keeps its reference. */
+	    memmove(ndata->wbuf, ndata->wbuf + ndata->wjob.count,
+		    ndata->wbuf_len - ndata->wjob.count);
+	    ndata->wbuf_len -= ndata->wjob.count;
+	    pthread_mutex_lock(&filen_pool_lock);
+	    gensio_list_add_tail(&filen_pool_jobs, &ndata->wjob.link);
+	    pthread_cond_signal(&filen_pool_cond);
+	    pthread_mutex_unlock(&filen_pool_lock);
+	    goto write_requeued;
+	}
+	ndata->wjob.busy = false;
+	finished++;
+    }
+ write_requeued:
+    if (!filen_jobs_busy(ndata)) {
+	/* A close waits for I/O in progress to finish. */
+	if (ndata->state == FILEN_IN_CLOSE)
+	    filen_close_files(ndata);
+    }
+    if (finished == 0) {
+	filen_unlock(ndata);
+	return;
+    }
+    filen_start_deferred_op(ndata);
+    if (finished > 1)
+	ndata->refcount--; /* The other job's ref still holds it. */
+    filen_unlock_and_deref(ndata);
+}
+#endif
+
 static int
 filen_close(struct gensio *io, gensio_done close_done, void *close_data)
 {
@@ -463,14 +863,8 @@ filen_close(struct gensio *io, gensio_done close_done, void *close_data)
 	err = GE_NOTREADY;
 	goto out_unlock;
     }
-    if (f_ready(ndata->inf)) {
-	f_close(ndata->inf);
-	f_set_not_ready(ndata->inf);
-    }
-    if (f_ready(ndata->outf)) {
-	f_close(ndata->outf);
-	f_set_not_ready(ndata->outf);
-    }
+    if (!filen_jobs_busy(ndata))
+	filen_close_files(ndata);
     if (ndata->state == FILEN_IN_OPEN)
 	ndata->state = FILEN_IN_OPEN_CLOSE;
     else
@@ -514,6 +908,32 @@ filen_control(struct gensio *io, bool get, int op,
 {
     struct filen_data *ndata = gensio_get_gensio_data(io);
 
+#if !USE_FILE_STDIO
+    if (op == GENSIO_CONTROL_RAW_FD) {
+	int infd = -1, outfd = -1;
+
+	if (!get)
+	    return GE_NOTSUP;
+	filen_lock(ndata);
+	if (ndata->state != FILEN_OPEN) {
+	    filen_unlock(ndata);
+	    return GE_NOTREADY;
+	}
+	/*
+	 * Without read_close the end of the input file is silently
+	 * ignored, which a user of the raw fd can't tell, so don't
+	 * offer it.
+	 */
+	if (f_ready(ndata->inf) && ndata->read_close && !ndata->mapped)
+	    infd = ndata->inf;
+	if (f_ready(ndata->outf))
+	    outfd = ndata->outf;
+	filen_unlock(ndata);
+	*datalen = snprintf(data, *datalen, "%d %d", infd, outfd);
+	return 0;
+    }
+#endif
+
     if (op != GENSIO_CONTROL_RADDR)
 	return GE_NOTSUP;
     if (!get)
@@ -577,6 +997,9 @@ struct file_ndata_data {
     bool create;
     bool read_close;
     mode_type mode;
+    bool direct;
+    bool use_mmap;
+    bool async;
 };
 
 static int
@@ -610,7 +1033,28 @@ file_ndata_setup(struct gensio_os_funcs *o, struct file_ndata_data *data,
     f_set_not_ready(ndata->outf);
 
     ndata->max_read_size = data->max_read_size;
+#if USE_FILE_STDIO
     ndata->read_data = o->zalloc(o, data->max_read_size);
+#else
+    ndata->direct = data->direct;
+    ndata->use_mmap = data->use_mmap;
+    ndata->read_data = f_alloc_read_data(ndata);
+#endif
+#ifdef FILEN_ASYNC
+    ndata->rjob.ndata = ndata;
+    ndata->wjob.ndata = ndata;
+    ndata->wjob.is_write = true;
+    /* If the pool can't be started, just do the I/O inline. */
+    if (data->async && filen_pool_start()) {
+	ndata->async = true;
+	ndata->wbuf = o->zalloc(o, ndata->max_read_size);
+	if (!ndata->wbuf)
+	    goto out_nomem;
+	ndata->job_done_runner = o->alloc_runner(o, filen_job_done, ndata);
+	if (!ndata->job_done_runner)
+	    goto out_nomem;
+    }
+#endif
     if (!ndata->read_data)
 	goto out_nomem;
 
@@ -667,6 +1111,12 @@ process_file_args(struct gensio_pparm_info *p,
 	    omode = mode & 7;
 	    continue;
 	}
+	if (gensio_pparm_bool(p, args[i], "direct", &data->direct) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "mmap", &data->use_mmap) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "async", &data->async) > 0)
+	    continue;
 #endif
 	if (gensio_pparm_bool(p, args[i], "read_close", &data->read_close) > 0)
 	    continue;
@@ -730,5 +1180,8 @@ gensio_init_file(struct gensio_os_funcs *o)
     rv = register_gensio(o, "file", str_to_file_gensio, file_gensio_alloc);
     if (rv)
 	return rv;
+#ifdef FILEN_ASYNC
+    gensio_register_class_cleanup(&filen_pool_class_cleanup);
+#endif
     return 0;
 }
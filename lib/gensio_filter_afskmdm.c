@@ -23,6 +23,9 @@
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_time.h>
 #include <gensio/gensio_ax25_addr.h>
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
 
 /*
  * This filter implements a audio frequency shift keying modem per the
@@ -154,6 +157,12 @@ struct xmit_entry {
     unsigned int size; /* in bytes. */
     bool is_mark;
 
+    /*
+     * The same samples as data, already in the output format and
+     * interleaved for all the output channels, size frames long.
+     */
+    unsigned char *frames;
+
     /*
      * If we just send this, the first two are the next entries to
      * send if the next is a space or a mark.  The second two are
@@ -165,6 +174,15 @@ struct xmit_entry {
     struct xmit_entry *next;
 };
 
+/* Sample formats we can generate directly for the sound gensio. */
+enum afskmdm_out_fmt {
+    OUT_FMT_FLOAT64,
+    OUT_FMT_FLOAT,
+    OUT_FMT_S32,
+    OUT_FMT_S16,
+    OUT_FMT_S8
+};
+
 enum afskmdm_keytype {
     KEY_RW, /* Read and write keyon/keyoff values. */
     KEY_RTS,
@@ -194,6 +212,8 @@ struct afskmdm_filter {
     unsigned int out_chans;
     unsigned int in_framesize; /* Size of a (sample * nchans) in bytes. */
     unsigned int out_framesize; /* Size of a (sample * nchans) in bytes. */
+    enum afskmdm_out_fmt out_format;
+    unsigned int out_samplesize;
     unsigned int in_chunksize; /* Frame count we get from the sound gensio. */
     unsigned int out_chunksize; /* Frame count we send to the sound gensio. */
     bool full_duplex;
@@ -274,6 +294,18 @@ struct afskmdm_filter {
     float *hzmark;
     float *hzspace;
 
+    /*
+     * With demod=goertzel, the tables above are not used.  The power
+     * at mark and space is computed with the Goertzel algorithm, these
+     * are its 2 * cos(w) coefficients.
+     */
+    bool goertzel;
+    float gcoef_mark;
+    float gcoef_space;
+
+    /* Samples for the current convolution, in_convsize + 2 * CONVEDGE. */
+    float *convsamples;
+
 /*
  * Use this to tell if we are receiving valid data, mostly to know if
  * we can transmit.  If nr_in_sync is > the given value, we are in
@@ -353,6 +385,13 @@ struct afskmdm_filter {
     unsigned int mark_xmit_len;
     unsigned int space_xmit_len;
 
+    /*
+     * mark_xmit and space_xmit converted to output frames, see
+     * afskmdm_render_frames().
+     */
+    unsigned char *mark_frames;
+    unsigned char *space_frames;
+
     /* The entry we just sent. */
     struct xmit_entry *curr_xmit_ent;
 
@@ -381,55 +420,47 @@ struct afskmdm_filter {
     char *keyoff;
     int key_err;
     bool keyed; /* Is the transmitter keyed? */
-};
-
-/* See rfc1549 */
-static const unsigned short ccitt_table[256] = {
-   0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-   0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-   0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-   0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-   0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-   0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-   0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-   0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-   0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-   0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-   0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-   0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-   0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-   0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-   0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-   0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-   0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-   0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-   0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-   0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-   0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-   0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-   0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-   0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-   0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-   0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-   0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-   0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-   0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-   0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-   0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-   0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
 
-static void
-crc16_ccitt(const unsigned char *buf, unsigned int len, uint16_t *icrc)
-{
-	unsigned int i;
-	uint16_t crc = *icrc;
+    /*
+     * Extra input channels demodulated along with in_chan.  Each one
+     * is a receive-only afskmdm filter with its own in_chan that is
+     * run over the same input buffer.  Their messages are delivered
+     * through this filter.  They are protected by this filter's lock,
+     * their own lock is not used.
+     */
+    struct afskmdm_filter **rxchans;
+    unsigned int nr_rxchans;
+    unsigned int next_rxchan; /* Where to start looking for messages. */
+    unsigned int deliver_chan; /* The input channel of deliver_data. */
+    char deliver_chanstr[20];
 
-	for (i = 0; i < len; i++)
-	    crc = (crc >> 8) ^ ccitt_table[(crc ^ buf[i]) & 0xff];
+#ifdef USE_PTHREADS
+    /*
+     * Worker threads for the extra channels.  Thread n handles every
+     * nr_rx_threads'th channel starting at n.  Work is handed out by
+     * bumping rx_work_gen, and rx_busy counts the threads not done.
+     */
+    struct afskmdm_rx_thread *rx_threads;
+    unsigned int nr_rx_threads;
+    bool rx_lock_init;
+    pthread_mutex_t rx_lock;
+    pthread_cond_t rx_work_cond;
+    pthread_cond_t rx_done_cond;
+    unsigned int rx_work_gen;
+    unsigned int rx_busy;
+    bool rx_shutdown;
+    unsigned char *rx_work_buf;
+#endif
+};
 
-	*icrc = crc;
-}
+#ifdef USE_PTHREADS
+struct afskmdm_rx_thread {
+    struct afskmdm_filter *sfilter;
+    unsigned int num;
+    pthread_t id;
+    bool started;
+};
+#endif
 
 #define filter_to_afskmdm(v) ((struct afskmdm_filter *) \
 			      gensio_filter_get_user_data(v))
@@ -446,6 +477,38 @@ afskmdm_unlock(struct afskmdm_filter *sfilter)
     sfilter->o->unlock(sfilter->lock);
 }
 
+/*
+ * If we have nothing to deliver, take a message from one of the extra
+ * input channels, round robin so one busy channel can't starve the
+ * others.
+ */
+static void
+afskmdm_pull_rxchan_data(struct afskmdm_filter *sfilter)
+{
+    struct afskmdm_filter *c;
+    unsigned char *tmp;
+    unsigned int i, n;
+
+    if (sfilter->deliver_data_len > 0)
+	return;
+
+    for (i = 0; i < sfilter->nr_rxchans; i++) {
+	n = (sfilter->next_rxchan + i) % sfilter->nr_rxchans;
+	c = sfilter->rxchans[n];
+	if (c->deliver_data_len == 0)
+	    continue;
+	tmp = c->deliver_data;
+	c->deliver_data = sfilter->deliver_data;
+	sfilter->deliver_data = tmp;
+	sfilter->deliver_data_len = c->deliver_data_len;
+	sfilter->deliver_data_pos = c->deliver_data_pos;
+	sfilter->deliver_chan = c->in_chan;
+	c->deliver_data_len = 0;
+	sfilter->next_rxchan = (n + 1) % sfilter->nr_rxchans;
+	break;
+    }
+}
+
 static void
 afskmdm_set_callbacks(struct gensio_filter *filter,
 		      gensio_filter_cb cb, void *cb_data)
@@ -463,6 +526,7 @@ afskmdm_ul_read_pending(struct gensio_filter *filter)
     bool rv;
 
     afskmdm_lock(sfilter);
+    afskmdm_pull_rxchan_data(sfilter);
     rv = sfilter->deliver_data_len > 0;
     afskmdm_unlock(sfilter);
     return rv;
@@ -913,8 +977,7 @@ afskmdm_add_wrbit(struct afskmdm_filter *sfilter)
     unsigned char bit = sfilter->wrbyte & 1;
     unsigned char level = sfilter->prev_xmit_level;
     struct xmit_entry *curr = sfilter->curr_xmit_ent;
-    unsigned int send_alt = 0, i, j;
-    float *s;
+    unsigned int send_alt = 0;
 
     if (sfilter->out_bit_adj) {
 	sfilter->out_bit_counter++;
@@ -951,16 +1014,9 @@ afskmdm_add_wrbit(struct afskmdm_filter *sfilter)
     curr = curr->next_send[level + send_alt];
     sfilter->curr_xmit_ent = curr;
 
-    s = (float *) sfilter->xmit_buf;
-    s += sfilter->xmit_buf_len * sfilter->out_nchans;
-    for (i = 0; i < curr->size; i++) {
-	for (j = 0; j < sfilter->out_nchans; j++) {
-	    if ((1 << j) & sfilter->out_chans)
-		*s++ = curr->data[i];
-	    else
-		*s++ = 0.;
-	}
-    }
+    memcpy(sfilter->xmit_buf +
+	   (gensiods) sfilter->xmit_buf_len * sfilter->out_framesize,
+	   curr->frames, (size_t) curr->size * sfilter->out_framesize);
     sfilter->xmit_buf_len += curr->size;
 }
 
@@ -1117,7 +1173,7 @@ afskmdm_ul_write(struct gensio_filter *filter,
 	/* We have two extra bytes on the end for the CRC, no check needed. */
 	crc = 0xffff;
 	len = sfilter->wrbufs[cbuf].len;
-	crc16_ccitt(sfilter->wrbufs[cbuf].data, len, &crc);
+	gensio_crc16_ccitt(sfilter->wrbufs[cbuf].data, len, &crc);
 	crc ^= 0xffff;
 	sfilter->wrbufs[cbuf].data[len++] = crc & 0xff;
 	sfilter->wrbufs[cbuf].data[len++] = (crc >> 8) & 0xff;
@@ -1175,11 +1231,7 @@ afskmdm_measure_power(struct afskmdm_filter *sfilter,
 #endif
 
 /*
- * Do a convolution.
- *
- * convdata is the sin/cosine table to convolve against, the first 2 *
- * in_convsize floats are the sin table, the second 2 * in_convsize floats
- * are the cosine table.
+ * Pull the samples for a convolution out of the input.
  *
  * The data comes in two chunks, buf1 is 2 * in_convsize frames at the
  * beginning, buf2 is chunksize frames after that.
@@ -1189,6 +1241,49 @@ afskmdm_measure_power(struct afskmdm_filter *sfilter,
  * it.  We only care about one channel.  So we have to multiply by the
  * number of channels and add the channel offset.
  *
+ * The samples are copied into convsamples so both convolutions (mark
+ * and space) can run over contiguous memory without having to check
+ * which buffer each sample comes from.  count samples starting at
+ * curpos are copied.
+ */
+static void
+afskmdm_get_conv_samples(struct afskmdm_filter *sfilter, unsigned int curpos,
+			 unsigned int count,
+			 unsigned char *buf1, unsigned char *buf2)
+{
+    float *s1 = (float *) buf1 + sfilter->in_chan;
+    float *s2 = (float *) buf2 + sfilter->in_chan;
+    float *out = sfilter->convsamples;
+    unsigned int i = 0, nchans = sfilter->in_nchans;
+
+    /* Make sure we don't go past the end of the buffer. */
+    assert(curpos + count <= sfilter->prevread_size + sfilter->in_chunksize);
+
+    if (curpos < sfilter->prevread_size) {
+	s1 += curpos * nchans;
+	for (; i < count && curpos < sfilter->prevread_size; i++, curpos++) {
+	    out[i] = *s1;
+	    s1 += nchans;
+	}
+    } else {
+	s2 += (curpos - sfilter->prevread_size) * nchans;
+    }
+    for (; i < count; i++) {
+	out[i] = *s2;
+	s2 += nchans;
+    }
+}
+
+/*
+ * Do a convolution.
+ *
+ * convdata is the sin/cosine table to convolve against, the first 2 *
+ * in_convsize floats are the sin table, the second 2 * in_convsize floats
+ * are the cosine table.
+ *
+ * s is the data from afskmdm_get_conv_samples(), it must hold
+ * in_convsize + (edge * 2) values.
+ *
  * Each convolution is done on in_convsize frames of data.  The first
  * in_convsize bytes is processed and put into p[0] (power at the given
  * frequency).  If edge > 0, then frames 1-(in_convsize+1) are processed
@@ -1201,67 +1296,89 @@ afskmdm_measure_power(struct afskmdm_filter *sfilter,
  *
  * Multiple values lets you scan for data or align data.
  *
- * dummyp must be [edge * 4].  p must be [(edge * 2) + 1].
+ * p must be [(edge * 2) + 1].
  */
 static void
 afskmdm_convolve(struct afskmdm_filter *sfilter, float *convdata,
-		 unsigned int edge,
-		 unsigned int curpos, unsigned char *buf1, unsigned char *buf2,
-		 float p[], float dummyp[])
+		 unsigned int edge, const float *s, float p[])
 {
-    /* There will always be one byte before the data, so the -1 ok. */
-    float *s1 = (float *) buf1 + sfilter->in_chan;
-    float *s2 = (float *) buf2 + sfilter->in_chan;
-    float *csin = convdata;
-    float *ccos = convdata + 2 * sfilter->in_convsize;
-    float v;
-    float psin = 0, pcos = 0;
-    unsigned int i, ppos = 0, spos;
-
-    if (curpos < sfilter->prevread_size)
-	s1 += curpos * sfilter->in_nchans;
-    else
-	s2 += (curpos - sfilter->prevread_size) * sfilter->in_nchans;
-
-    for (i = 0; i < sfilter->in_convsize; i++, curpos++) {
-	if (curpos < sfilter->prevread_size) {
-	    v = *s1;
-	    s1 += sfilter->in_nchans;
-	} else {
-	    v = *s2;
-	    s2 += sfilter->in_nchans;
-	}
-	psin += *csin * v;
-	pcos += *ccos * v;
-	if (i < edge * 2) {
-	    dummyp[i * 2] = *csin * v;
-	    dummyp[i * 2 + 1] = *ccos * v;
-	}
-	csin++;
-	ccos++;
-    }
+    const float *csin = convdata;
+    const float *ccos = convdata + 2 * sfilter->in_convsize;
+    float psin, pcos, psin2 = 0, pcos2 = 0;
+    unsigned int i, n = sfilter->in_convsize, ppos = 0;
+
+    psin = 0;
+    pcos = 0;
+    for (i = 0; i + 1 < n; i += 2) {
+	psin += csin[i] * s[i];
+	pcos += ccos[i] * s[i];
+	psin2 += csin[i + 1] * s[i + 1];
+	pcos2 += ccos[i + 1] * s[i + 1];
+    }
+    if (i < n) {
+	psin += csin[i] * s[i];
+	pcos += ccos[i] * s[i];
+    }
+    psin += psin2;
+    pcos += pcos2;
     p[ppos++] = psin * psin + pcos * pcos;
 
-    for (spos = 0; i < sfilter->in_convsize + (edge * 2);
-	 i++, curpos++, spos++) {
+    for (i = n; i < n + (edge * 2); i++) {
+	psin += csin[i] * s[i] - csin[i - n] * s[i - n];
+	pcos += ccos[i] * s[i] - ccos[i - n] * s[i - n];
+	p[ppos++] = psin * psin + pcos * pcos;
+    }
+}
 
-	/* Make sure we don't go past the end of the buffer. */
-	assert(curpos <= sfilter->prevread_size ||
-	       curpos - sfilter->prevread_size < sfilter->in_chunksize);
+/*
+ * Compute the power at one frequency over in_convsize values of s with
+ * the Goertzel algorithm, coef is 2 * cos(w).  This is one multiply
+ * per sample instead of two and needs no tables, but unlike
+ * afskmdm_convolve() the window can't be slid cheaply.
+ */
+static float
+afskmdm_goertzel(struct afskmdm_filter *sfilter, float coef, const float *s)
+{
+    float s0, s1 = 0, s2 = 0;
+    unsigned int i;
 
-	if (curpos < sfilter->prevread_size) {
-	    v = *s1;
-	    s1 += sfilter->in_nchans;
-	} else {
-	    v = *s2;
-	    s2 += sfilter->in_nchans;
-	}
-	psin -= dummyp[spos * 2];
-	pcos -= dummyp[spos * 2 + 1];
-	psin += *csin++ * v;
-	pcos += *ccos++ * v;
-	p[ppos++] = psin * psin + pcos * pcos;
+    for (i = 0; i < sfilter->in_convsize; i++) {
+	s0 = s[i] + coef * s1 - s2;
+	s2 = s1;
+	s1 = s0;
     }
+    return s1 * s1 + s2 * s2 - coef * s1 * s2;
+}
+
+/*
+ * Get the powers for process_powers() with Goertzel.  Only the middle
+ * window is done normally.  The data is only re-aligned on a level
+ * change, so only then are windows CONVEDGE early and late done to
+ * see which way to move.  Unused positions are left zero, which
+ * process_powers() never picks.
+ */
+static void
+afskmdm_goertzel_powers(struct afskmdm_filter *sfilter, const float *s,
+			float pmark[CONVEXTRA], float pspace[CONVEXTRA])
+{
+    unsigned char level;
+
+    memset(pmark, 0, sizeof(float) * CONVEXTRA);
+    memset(pspace, 0, sizeof(float) * CONVEXTRA);
+    pmark[CONVMIDDLE] = afskmdm_goertzel(sfilter, sfilter->gcoef_mark,
+					 s + CONVEDGE);
+    pspace[CONVMIDDLE] = afskmdm_goertzel(sfilter, sfilter->gcoef_space,
+					  s + CONVEDGE);
+    level = pspace[CONVMIDDLE] > pmark[CONVMIDDLE] ? 0 : 1;
+    if (level == sfilter->prev_recv_level)
+	return;
+
+    pmark[0] = afskmdm_goertzel(sfilter, sfilter->gcoef_mark, s);
+    pspace[0] = afskmdm_goertzel(sfilter, sfilter->gcoef_space, s);
+    pmark[CONVEXTRA - 1] = afskmdm_goertzel(sfilter, sfilter->gcoef_mark,
+					    s + 2 * CONVEDGE);
+    pspace[CONVEXTRA - 1] = afskmdm_goertzel(sfilter, sfilter->gcoef_space,
+					     s + 2 * CONVEDGE);
 }
 
 static void
@@ -1342,7 +1459,7 @@ afskmdm_handle_new_message(struct afskmdm_filter *sfilter, unsigned int pos,
 
     if (sfilter->do_crc) {
 	crc = 0xffff;
-	crc16_ccitt(w->read_data, w->read_data_len - 2, &crc);
+	gensio_crc16_ccitt(w->read_data, w->read_data_len - 2, &crc);
 	crc ^= 0xffff;
 	msgcrc = ((w->read_data[w->read_data_len - 1] << 8) |
 		  w->read_data[w->read_data_len - 2]);
@@ -1384,6 +1501,7 @@ afskmdm_handle_new_message(struct afskmdm_filter *sfilter, unsigned int pos,
 	sfilter->deliver_data = tmp;
 	sfilter->deliver_data_len = w->read_data_len;
 	sfilter->deliver_data_pos = 0;
+	sfilter->deliver_chan = sfilter->in_chan;
     }
 
     /* Cancel all working messages. */
@@ -1611,15 +1729,20 @@ afskmdm_check_for_data(struct afskmdm_filter *sfilter, unsigned int *curpos,
 {
     float pmark[CONVEXTRA], pspace[CONVEXTRA];
     float pmark2[CONVEXTRA], pspace2[CONVEXTRA];
-    float dummyp[CONVEDGE * 4];
     unsigned char level = sfilter->prev_recv_level;
     unsigned int i, best_pos = 0, wset;
     float certainty = 0.0, m;
 
-    afskmdm_convolve(sfilter, sfilter->hzmark, CONVEDGE, (*curpos) - CONVEDGE,
-		     buf1, buf2, pmark, dummyp);
-    afskmdm_convolve(sfilter, sfilter->hzspace, CONVEDGE, (*curpos) - CONVEDGE,
-		     buf1, buf2, pspace, dummyp);
+    afskmdm_get_conv_samples(sfilter, (*curpos) - CONVEDGE,
+			     sfilter->in_convsize + (CONVEDGE * 2), buf1, buf2);
+    if (sfilter->goertzel) {
+	afskmdm_goertzel_powers(sfilter, sfilter->convsamples, pmark, pspace);
+    } else {
+	afskmdm_convolve(sfilter, sfilter->hzmark, CONVEDGE,
+			 sfilter->convsamples, pmark);
+	afskmdm_convolve(sfilter, sfilter->hzspace, CONVEDGE,
+			 sfilter->convsamples, pspace);
+    }
 
     process_powers(sfilter, pmark, pspace, &best_pos, &certainty, &level);
     if (sfilter->debug & 2) {
@@ -1720,20 +1843,12 @@ afskmdm_calc_iir_coefs(float samplerate, float cutoff,
     coefb[2] = coefb[0];
 }
 
-static float
-get_fir_val(unsigned int i, unsigned int holdsize, float *inbuf, float *hold,
-	    unsigned int nchans, unsigned int chan)
-{
-    if (i < holdsize)
-	return hold[i];
-    i -= holdsize;
-    i = (i * nchans) + chan;
-    return inbuf[i];
-}
-
 /*
  * Process a buffer with a fir filter.  h and n come from
- * afskmdm_calc_fir_coefs(), hold must be of size n * 2.
+ * afskmdm_calc_fir_coefs(), hold must be of size (n * 2) + nsamples.
+ * The first n * 2 values of hold are the end of the previous buffer,
+ * the channel's samples are gathered after that so the filter runs
+ * over contiguous memory.
  */
 static void
 afskmdm_fir_filter(float *inbuf, float *outbuf, unsigned int nsamples,
@@ -1742,32 +1857,33 @@ afskmdm_fir_filter(float *inbuf, float *outbuf, unsigned int nsamples,
 {
     unsigned int i, j, k;
     unsigned int holdsize = n * 2;
-    float tmp;
+    float *x = hold + holdsize;
+    float tmp0, tmp1, tmp2, tmp3;
 
-    for (i = 0; i < nsamples; i++) {
-
-	/* Get the middle value, it's always multiplied by 1. */
-	tmp = get_fir_val(n + i, holdsize, inbuf, hold, nchans, chan);
+    for (i = 0; i < nsamples; i++)
+	x[i] = inbuf[i * nchans + chan];
 
+    for (i = 0, x = hold; i < nsamples; i++, x++) {
 	/*
 	 * The h array is half of a symmetric waveform.  That waveform
 	 * is always an odd number of values, but we don't include the
-	 * middle value (it's always one, handled above) and h only
-	 * holds the left half of the waveform.
+	 * middle value (it's always one, added last) and h only holds
+	 * the left half of the waveform.  Use a few independent sums
+	 * so the compiler can pipeline and vectorize the loop.
 	 */
-	for (j = 0, k = holdsize; j < n; j++, k--) {
-	    tmp += h[j] * (get_fir_val(i + j, holdsize, inbuf, hold,
-				       nchans, chan) +
-			   get_fir_val(i + k, holdsize, inbuf, hold,
-				       nchans, chan));
+	tmp0 = tmp1 = tmp2 = tmp3 = 0.0;
+	for (j = 0, k = holdsize; j + 3 < n; j += 4, k -= 4) {
+	    tmp0 += h[j] * (x[j] + x[k]);
+	    tmp1 += h[j + 1] * (x[j + 1] + x[k - 1]);
+	    tmp2 += h[j + 2] * (x[j + 2] + x[k - 2]);
+	    tmp3 += h[j + 3] * (x[j + 3] + x[k - 3]);
 	}
+	for (; j < n; j++, k--)
+	    tmp0 += h[j] * (x[j] + x[k]);
 
-	outbuf[i * nchans + chan] = tmp;
-    }
-    for (i = 0; i < holdsize; i++) {
-	unsigned int pos = nsamples - holdsize + i;
-	hold[i] = inbuf[pos * nchans + chan];
+	outbuf[i * nchans + chan] = x[n] + (tmp0 + tmp1) + (tmp2 + tmp3);
     }
+    memmove(hold, hold + nsamples, holdsize * sizeof(float));
 }
 
 /*
@@ -1824,34 +1940,15 @@ afskmdm_calc_fir_coefs(struct gensio_os_funcs *o,
     return h;
 }
 
-static int
-afskmdm_ll_write(struct gensio_filter *filter,
-		 gensio_ll_filter_data_handler handler, void *cb_data,
-		 gensiods *rcount,
-		 unsigned char *buf, gensiods buflen,
-		 const char *const *auxdata)
+/*
+ * Run the demodulator for in_chan over a chunk of input.  buf is not
+ * modified, so this may be run on multiple channels of the same
+ * buffer at the same time.
+ */
+static void
+afskmdm_demod(struct afskmdm_filter *sfilter, unsigned char *buf)
 {
-    struct afskmdm_filter *sfilter = filter_to_afskmdm(filter);
     unsigned int pos = sfilter->curr_in_pos;
-    int err = 0;
-
-    if (gensio_str_in_auxdata(auxdata, "oob")) {
-	/* Ignore oob data. */
-	if (rcount)
-	    *rcount = buflen;
-	return 0;
-    }
-
-    afskmdm_lock(sfilter);
-    if (sfilter->err) {
-	err = sfilter->err;
-	goto out_err;
-    }
-    if (buflen == 0)
-	goto try_deliver;
-
-    if (buflen != (gensiods) sfilter->in_chunksize * sfilter->in_framesize)
-	return GE_INVAL;
 
     if (sfilter->filteredbuf) {
 	if (sfilter->fir_h) {
@@ -1925,16 +2022,165 @@ afskmdm_ll_write(struct gensio_filter *filter,
 	   buf + (sfilter->in_framesize *
 		  (sfilter->in_chunksize - sfilter->prevread_size)),
 	   (size_t) sfilter->prevread_size * sfilter->in_framesize);
+}
+
+#ifdef USE_PTHREADS
+static void *
+afskmdm_rx_worker(void *data)
+{
+    struct afskmdm_rx_thread *t = data;
+    struct afskmdm_filter *sfilter = t->sfilter;
+    unsigned int gen = 0, i;
+    unsigned char *buf;
+
+    pthread_mutex_lock(&sfilter->rx_lock);
+    for (;;) {
+	while (!sfilter->rx_shutdown && gen == sfilter->rx_work_gen)
+	    pthread_cond_wait(&sfilter->rx_work_cond, &sfilter->rx_lock);
+	if (sfilter->rx_shutdown)
+	    break;
+	gen = sfilter->rx_work_gen;
+	buf = sfilter->rx_work_buf;
+	pthread_mutex_unlock(&sfilter->rx_lock);
+
+	for (i = t->num; i < sfilter->nr_rxchans; i += sfilter->nr_rx_threads)
+	    afskmdm_demod(sfilter->rxchans[i], buf);
+
+	pthread_mutex_lock(&sfilter->rx_lock);
+	if (--sfilter->rx_busy == 0)
+	    pthread_cond_signal(&sfilter->rx_done_cond);
+    }
+    pthread_mutex_unlock(&sfilter->rx_lock);
+    return NULL;
+}
+
+static void
+afskmdm_stop_rx_threads(struct afskmdm_filter *sfilter)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&sfilter->rx_lock);
+    sfilter->rx_shutdown = true;
+    pthread_cond_broadcast(&sfilter->rx_work_cond);
+    pthread_mutex_unlock(&sfilter->rx_lock);
+    for (i = 0; i < sfilter->nr_rx_threads; i++) {
+	if (sfilter->rx_threads[i].started)
+	    pthread_join(sfilter->rx_threads[i].id, NULL);
+    }
+}
+
+static int
+afskmdm_start_rx_threads(struct afskmdm_filter *sfilter, unsigned int count)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned int i;
+
+    if (pthread_mutex_init(&sfilter->rx_lock, NULL))
+	return GE_NOMEM;
+    if (pthread_cond_init(&sfilter->rx_work_cond, NULL)) {
+	pthread_mutex_destroy(&sfilter->rx_lock);
+	return GE_NOMEM;
+    }
+    if (pthread_cond_init(&sfilter->rx_done_cond, NULL)) {
+	pthread_cond_destroy(&sfilter->rx_work_cond);
+	pthread_mutex_destroy(&sfilter->rx_lock);
+	return GE_NOMEM;
+    }
+    sfilter->rx_lock_init = true;
+
+    sfilter->rx_threads = o->zalloc(o, sizeof(*sfilter->rx_threads) * count);
+    if (!sfilter->rx_threads)
+	return GE_NOMEM;
+    sfilter->nr_rx_threads = count;
+    for (i = 0; i < count; i++) {
+	sfilter->rx_threads[i].sfilter = sfilter;
+	sfilter->rx_threads[i].num = i;
+	if (pthread_create(&sfilter->rx_threads[i].id, NULL,
+			   afskmdm_rx_worker, &sfilter->rx_threads[i]))
+	    return GE_NOMEM;
+	sfilter->rx_threads[i].started = true;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Demodulate all our input channels.  The extra channels are run in
+ * the worker threads, if there are any, while we do our own channel.
+ */
+static void
+afskmdm_demod_all(struct afskmdm_filter *sfilter, unsigned char *buf)
+{
+    unsigned int i;
+
+#ifdef USE_PTHREADS
+    if (sfilter->nr_rx_threads > 0) {
+	pthread_mutex_lock(&sfilter->rx_lock);
+	sfilter->rx_work_buf = buf;
+	sfilter->rx_busy = sfilter->nr_rx_threads;
+	sfilter->rx_work_gen++;
+	pthread_cond_broadcast(&sfilter->rx_work_cond);
+	pthread_mutex_unlock(&sfilter->rx_lock);
+
+	afskmdm_demod(sfilter, buf);
+
+	pthread_mutex_lock(&sfilter->rx_lock);
+	while (sfilter->rx_busy > 0)
+	    pthread_cond_wait(&sfilter->rx_done_cond, &sfilter->rx_lock);
+	pthread_mutex_unlock(&sfilter->rx_lock);
+	return;
+    }
+#endif
+
+    afskmdm_demod(sfilter, buf);
+    for (i = 0; i < sfilter->nr_rxchans; i++)
+	afskmdm_demod(sfilter->rxchans[i], buf);
+}
+
+static int
+afskmdm_ll_write(struct gensio_filter *filter,
+		 gensio_ll_filter_data_handler handler, void *cb_data,
+		 gensiods *rcount,
+		 unsigned char *buf, gensiods buflen,
+		 const char *const *auxdata)
+{
+    struct afskmdm_filter *sfilter = filter_to_afskmdm(filter);
+    const char *chanaux[2] = { sfilter->deliver_chanstr, NULL };
+    int err = 0;
+
+    if (gensio_str_in_auxdata(auxdata, "oob")) {
+	/* Ignore oob data. */
+	if (rcount)
+	    *rcount = buflen;
+	return 0;
+    }
+
+    afskmdm_lock(sfilter);
+    if (sfilter->err) {
+	err = sfilter->err;
+	goto out_err;
+    }
+    if (buflen == 0)
+	goto try_deliver;
+
+    if (buflen != (gensiods) sfilter->in_chunksize * sfilter->in_framesize)
+	return GE_INVAL;
+
+    afskmdm_demod_all(sfilter, buf);
 
  try_deliver:
+    afskmdm_pull_rxchan_data(sfilter);
     if (sfilter->deliver_data_len > 0) {
 	gensiods count = 0;
 
+	/* Only report the channel if there is more than one. */
+	snprintf(sfilter->deliver_chanstr, sizeof(sfilter->deliver_chanstr),
+		 "chan:%u", sfilter->deliver_chan);
 	afskmdm_unlock(sfilter);
 	err = handler(cb_data, &count,
 		      sfilter->deliver_data + sfilter->deliver_data_pos,
 		      sfilter->deliver_data_len - sfilter->deliver_data_pos,
-		      NULL);
+		      sfilter->nr_rxchans ? chanaux : NULL);
 	afskmdm_lock(sfilter);
 	if (!err) {
 	    if (count + sfilter->deliver_data_pos >= sfilter->deliver_data_len)
@@ -1985,6 +2231,9 @@ afskmdm_cleanup(struct gensio_filter *filter)
     sfilter->nr_wrbufs = 0;
     sfilter->in_conv_counter = 0;
     sfilter->out_bit_counter = 0;
+    sfilter->next_rxchan = 0;
+    for (i = 0; i < sfilter->nr_rxchans; i++)
+	afskmdm_cleanup(sfilter->rxchans[i]->filter);
 }
 
 static void
@@ -1994,6 +2243,25 @@ afskmdm_sfilter_free(struct afskmdm_filter *sfilter)
     unsigned int i, j;
     struct xmit_entry *e = sfilter->xmit_ent_list, *n;
 
+#ifdef USE_PTHREADS
+    if (sfilter->rx_threads) {
+	afskmdm_stop_rx_threads(sfilter);
+	o->free(o, sfilter->rx_threads);
+    }
+    if (sfilter->rx_lock_init) {
+	pthread_cond_destroy(&sfilter->rx_done_cond);
+	pthread_cond_destroy(&sfilter->rx_work_cond);
+	pthread_mutex_destroy(&sfilter->rx_lock);
+    }
+#endif
+    if (sfilter->rxchans) {
+	for (i = 0; i < sfilter->nr_rxchans; i++) {
+	    if (sfilter->rxchans[i])
+		afskmdm_sfilter_free(sfilter->rxchans[i]);
+	}
+	o->free(o, sfilter->rxchans);
+    }
+
     while (e) {
 	n = e->next;
 	o->free(o, e);
@@ -2003,6 +2271,10 @@ afskmdm_sfilter_free(struct afskmdm_filter *sfilter)
 	o->free(o, sfilter->mark_xmit);
     if (sfilter->space_xmit)
 	o->free(o, sfilter->space_xmit);
+    if (sfilter->mark_frames)
+	o->free(o, sfilter->mark_frames);
+    if (sfilter->space_frames)
+	o->free(o, sfilter->space_frames);
     if (sfilter->key_io)
 	gensio_free(sfilter->key_io);
     if (sfilter->key)
@@ -2017,6 +2289,8 @@ afskmdm_sfilter_free(struct afskmdm_filter *sfilter)
 	o->free(o, sfilter->hzmark);
     if (sfilter->hzspace)
 	o->free(o, sfilter->hzspace);
+    if (sfilter->convsamples)
+	o->free(o, sfilter->convsamples);
     if (sfilter->prevread)
 	o->free(o, sfilter->prevread);
     if (sfilter->wmsgsets) {
@@ -2176,6 +2450,11 @@ afskmdm_create_xmit_ent(struct afskmdm_filter *sfilter, bool is_mark,
     if (!e)
 	return NULL;
     e->data = data;
+    if (is_mark)
+	e->frames = sfilter->mark_frames;
+    else
+	e->frames = sfilter->space_frames;
+    e->frames += (gensiods) pos * sfilter->out_framesize;
     e->size = size;
     e->is_mark = is_mark;
     e->next = sfilter->xmit_ent_list;
@@ -2288,6 +2567,10 @@ struct gensio_afskmdm_data {
     unsigned int lpcutoff;
     unsigned int transition_freq;
 
+    int demod;
+#define DEMOD_CORRELATE 0
+#define DEMOD_GOERTZEL 1
+
     unsigned int tx_preamble_time;
     unsigned int tx_postamble_time;
     unsigned int tx_predelay_time;
@@ -2298,8 +2581,87 @@ struct gensio_afskmdm_data {
     const char *keyon;
     const char *keyoff;
     bool full_duplex;
+    int out_format;
 };
 
+static void
+afskmdm_put_int(float v, float scale, unsigned int size, unsigned char *out)
+{
+    double d = floor(v * scale + .5);
+    int32_t i32;
+    int16_t i16;
+    int8_t i8;
+
+    if (d > scale - 1)
+	d = scale - 1;
+    else if (d < -scale)
+	d = -scale;
+    switch (size) {
+    case 4:
+	i32 = d;
+	memcpy(out, &i32, size);
+	break;
+    case 2:
+	i16 = d;
+	memcpy(out, &i16, size);
+	break;
+    default:
+	i8 = d;
+	memcpy(out, &i8, size);
+	break;
+    }
+}
+
+/*
+ * Convert a transmit wave into frames in the output format, with the
+ * sample on every channel in out_chans and zero (from zalloc) on the
+ * others, so a bit can be sent with a single copy and the sound
+ * gensio doesn't have to convert anything if its user format matches
+ * the PCM format.  Integer samples are rounded and clamped.
+ */
+static unsigned char *
+afskmdm_render_frames(struct afskmdm_filter *sfilter, const float *wave,
+		      unsigned int len)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned char *frames, *f;
+    unsigned int i, j;
+    double d;
+
+    frames = o->zalloc(o, (gensiods) len * sfilter->out_framesize);
+    if (!frames)
+	return NULL;
+
+    for (i = 0, f = frames; i < len; i++) {
+	for (j = 0; j < sfilter->out_nchans; j++) {
+	    if (!((1 << j) & sfilter->out_chans)) {
+		f += sfilter->out_samplesize;
+		continue;
+	    }
+	    switch (sfilter->out_format) {
+	    case OUT_FMT_FLOAT64:
+		d = wave[i];
+		memcpy(f, &d, sizeof(d));
+		break;
+	    case OUT_FMT_FLOAT:
+		memcpy(f, &wave[i], sizeof(float));
+		break;
+	    case OUT_FMT_S32:
+		afskmdm_put_int(wave[i], 2147483648., 4, f);
+		break;
+	    case OUT_FMT_S16:
+		afskmdm_put_int(wave[i], 32768., 2, f);
+		break;
+	    case OUT_FMT_S8:
+		afskmdm_put_int(wave[i], 128., 1, f);
+		break;
+	    }
+	    f += sfilter->out_samplesize;
+	}
+    }
+    return frames;
+}
+
 static int
 afskmdm_setup_transmit(struct afskmdm_filter *sfilter,
 		       struct gensio_afskmdm_data *data,
@@ -2331,11 +2693,21 @@ afskmdm_setup_transmit(struct afskmdm_filter *sfilter,
 	sfilter->space_xmit[i] = sin(v / fbitsize) * data->volume;
     }
 
+    sfilter->mark_frames = afskmdm_render_frames(sfilter, sfilter->mark_xmit,
+						 sfilter->mark_xmit_len);
+    if (!sfilter->mark_frames)
+	return GE_NOMEM;
+    sfilter->space_frames = afskmdm_render_frames(sfilter, sfilter->space_xmit,
+						  sfilter->space_xmit_len);
+    if (!sfilter->space_frames)
+	return GE_NOMEM;
+
     /* Set up the first entry, just start with a space at zero phase. */
     e = o->zalloc(o, sizeof(*e));
     if (!e)
 	return GE_NOMEM;
     e->data = sfilter->space_xmit;
+    e->frames = sfilter->space_frames;
     e->size = sfilter->out_bitsize;
     e->is_mark = false;
     e->next = NULL;
@@ -2365,7 +2737,25 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_pparm_info *p,
     sfilter->in_chan = data->in_chan;
     sfilter->out_chans = data->out_chans;
     sfilter->in_framesize = sizeof(float) * data->in_nchans;
-    sfilter->out_framesize = sizeof(float) * data->out_nchans;
+    sfilter->out_format = data->out_format;
+    switch (sfilter->out_format) {
+    case OUT_FMT_FLOAT64:
+	sfilter->out_samplesize = sizeof(double);
+	break;
+    case OUT_FMT_FLOAT:
+	sfilter->out_samplesize = sizeof(float);
+	break;
+    case OUT_FMT_S32:
+	sfilter->out_samplesize = 4;
+	break;
+    case OUT_FMT_S16:
+	sfilter->out_samplesize = 2;
+	break;
+    case OUT_FMT_S8:
+	sfilter->out_samplesize = 1;
+	break;
+    }
+    sfilter->out_framesize = sfilter->out_samplesize * data->out_nchans;
     sfilter->max_write_size = data->max_write_size;
     sfilter->max_read_size = data->max_read_size + 2; /* Extra 2 for the CRC. */
     sfilter->debug = data->debug;
@@ -2477,6 +2867,15 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_pparm_info *p,
     if (!sfilter->lock)
 	goto out_nomem;
 
+    if (data->demod == DEMOD_GOERTZEL) {
+	sfilter->goertzel = true;
+	sfilter->gcoef_mark =
+	    2 * cos(2 * M_PI * (data->mark_freq / data->data_rate) / fconvsize);
+	sfilter->gcoef_space =
+	    2 * cos(2 * M_PI * (data->space_freq / data->data_rate) / fconvsize);
+	goto skip_tables;
+    }
+
     sfilter->hzmark = o->zalloc(o, sizeof(float) * 4 * sfilter->in_convsize);
     if (!sfilter->hzmark)
 	goto out_nomem;
@@ -2494,6 +2893,12 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_pparm_info *p,
 	sfilter->hzspace[i] = sin(v / fconvsize);
 	sfilter->hzspace[i + 2 * sfilter->in_convsize] = cos(v / fconvsize);
     }
+ skip_tables:
+
+    sfilter->convsamples = o->zalloc(o, sizeof(float) *
+				     (sfilter->in_convsize + 2 * CONVEDGE));
+    if (!sfilter->convsamples)
+	goto out_nomem;
 
     if (data->lpcutoff && data->filt_type != NO_FILT) {
 	if (data->filt_type == IIR_FILT) {
@@ -2507,7 +2912,8 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_pparm_info *p,
 	    if (!sfilter->fir_h)
 		goto out_nomem;
 	    sfilter->firhold = o->zalloc(o,
-					 2 * sfilter->fir_h_n * sizeof(float));
+			((gensiods) 2 * sfilter->fir_h_n + sfilter->in_chunksize)
+			* sizeof(float));
 	    if (!sfilter->firhold)
 		goto out_nomem;
 	}
@@ -2627,6 +3033,55 @@ gensio_afskmdm_filter_raw_alloc(struct gensio_pparm_info *p,
     return NULL;
 }
 
+/*
+ * Allocate a receive-only filter for each extra channel in in_chans.
+ * They share all the parameters of the main filter except in_chan,
+ * and never transmit.
+ */
+static int
+afskmdm_alloc_rxchans(struct gensio_pparm_info *p,
+		      struct gensio_os_funcs *o,
+		      struct gensio *child,
+		      struct afskmdm_filter *sfilter,
+		      struct gensio_afskmdm_data *data,
+		      unsigned int in_chans, unsigned int rxthreads)
+{
+    struct gensio_afskmdm_data cdata = *data;
+    struct gensio_filter *cfilter;
+    unsigned int i, count = 0;
+
+    for (i = 0; i < data->in_nchans; i++) {
+	if (in_chans & (1U << i))
+	    count++;
+    }
+    sfilter->rxchans = o->zalloc(o, sizeof(*sfilter->rxchans) * count);
+    if (!sfilter->rxchans)
+	return GE_NOMEM;
+
+    cdata.key = NULL;
+    cdata.keytype = KEY_RW;
+    cdata.keyon = NULL;
+    cdata.keyoff = NULL;
+    cdata.full_duplex = true;
+    for (i = 0; i < data->in_nchans; i++) {
+	if (!(in_chans & (1U << i)))
+	    continue;
+	cdata.in_chan = i;
+	cfilter = gensio_afskmdm_filter_raw_alloc(p, o, child, &cdata);
+	if (!cfilter)
+	    return GE_NOMEM;
+	sfilter->rxchans[sfilter->nr_rxchans++] = filter_to_afskmdm(cfilter);
+    }
+
+#ifdef USE_PTHREADS
+    if (rxthreads > count)
+	rxthreads = count;
+    if (rxthreads)
+	return afskmdm_start_rx_threads(sfilter, rxthreads);
+#endif
+    return 0;
+}
+
 static int
 afskmdm_child_getuint(struct gensio *child, int option, unsigned int *val)
 {
@@ -2650,6 +3105,21 @@ static struct gensio_enum_val filttype_enums[] = {
     { }
 };
 
+static struct gensio_enum_val demod_enums[] = {
+    { .name = "correlate", .val = DEMOD_CORRELATE },
+    { .name = "goertzel", .val = DEMOD_GOERTZEL },
+    { }
+};
+
+static struct gensio_enum_val outfmt_enums[] = {
+    { .name = "float64", .val = OUT_FMT_FLOAT64 },
+    { .name = "float", .val = OUT_FMT_FLOAT },
+    { .name = "s32", .val = OUT_FMT_S32 },
+    { .name = "s16", .val = OUT_FMT_S16 },
+    { .name = "s8", .val = OUT_FMT_S8 },
+    { }
+};
+
 static struct gensio_enum_val keytype_enums[] = {
     { .name = "rw", .val = KEY_RW },
     { .name = "rts", .val = KEY_RTS },
@@ -2706,6 +3176,8 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
     gensiods cdata_len;
     unsigned int chan;
     unsigned int wmsg_extra = 1;
+    unsigned int in_chans = 0, rxthreads = 0;
+    struct afskmdm_filter *sfilter;
 
     err = afskmdm_child_getuint(child, GENSIO_CONTROL_IN_BUFSIZE,
 				&data.in_chunksize);
@@ -2754,10 +3226,16 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
 			  " is it a sound device?");
 	return GE_INCONSISTENT;
     }
-    if (strcmp(cdata, "float") != 0) {
-	gensio_pparm_slog(p, "Child output format is not float");
+    for (i = 0; outfmt_enums[i].name; i++) {
+	if (strcmp(cdata, outfmt_enums[i].name) == 0)
+	    break;
+    }
+    if (!outfmt_enums[i].name) {
+	gensio_pparm_slog(p, "Child output format is not float64, float,"
+			  " s32, s16 or s8");
 	return GE_INCONSISTENT;
     }
+    data.out_format = outfmt_enums[i].val;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(p, args[i], "readbuf", &data.max_read_size) > 0)
@@ -2778,6 +3256,10 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
 	}
 	if (gensio_pparm_uint(p, args[i], "in_chan", &data.in_chan) > 0)
 	    continue;
+	if (gensio_pparm_uint(p, args[i], "in_chans", &in_chans) > 0)
+	    continue;
+	if (gensio_pparm_uint(p, args[i], "rxthreads", &rxthreads) > 0)
+	    continue;
 	if (gensio_pparm_uint(p, args[i], "out_chans", &data.out_chans) > 0)
 	    continue;
 	if (gensio_pparm_uint(p, args[i], "out_chan", &chan) > 0) {
@@ -2827,6 +3309,9 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
 	if (gensio_pparm_enum(p, args[i], "keytype", keytype_enums,
 			      &data.keytype) > 0)
 	    continue;
+	if (gensio_pparm_enum(p, args[i], "demod", demod_enums,
+			      &data.demod) > 0)
+	    continue;
 	if (gensio_pparm_uint(p, args[i], "keybit", &data.keybit) > 0)
 	    continue;
 	if (gensio_pparm_value(p, args[i], "keyon", &data.keyon) > 0)
@@ -2861,6 +3346,16 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
     CHECK_VAL(in_chan, >=, data.in_nchans);
     CHECK_VAL(out_chans, >=, (1U << data.out_nchans))
     CHECK_VAL(max_wmsgs, ==, 0);
+    if (data.in_nchans < 32 && in_chans >= (1U << data.in_nchans)) {
+	gensio_pparm_slog(p, "in_chans has channels past in_nchans");
+	return GE_INVAL;
+    }
+#ifndef USE_PTHREADS
+    if (rxthreads) {
+	gensio_pparm_slog(p, "rxthreads requires thread support");
+	return GE_NOTSUP;
+    }
+#endif
 
     /*
      * For lower sample rates a FIR filter doesn't use as much CPU and
@@ -2868,7 +3363,10 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
      * filter uses a lot less CPU and works just as well.
      */
     if (!data.filt_type_set) {
-	if (data.in_framerate < 30000)
+	if (data.demod == DEMOD_GOERTZEL)
+	    /* Going for low CPU, the Goertzel window is a filter itself. */
+	    data.filt_type = NO_FILT;
+	else if (data.in_framerate < 30000)
 	    data.filt_type = FIR_FILT;
 	else
 	    data.filt_type = IIR_FILT;
@@ -2879,6 +3377,17 @@ gensio_afskmdm_filter_alloc(struct gensio_pparm_info *p,
     filter = gensio_afskmdm_filter_raw_alloc(p, o, child, &data);
     if (!filter)
 	return GE_NOMEM;
+    sfilter = filter_to_afskmdm(filter);
+
+    in_chans &= ~(1U << data.in_chan);
+    if (in_chans) {
+	err = afskmdm_alloc_rxchans(p, o, child, sfilter, &data, in_chans,
+				    rxthreads);
+	if (err) {
+	    afskmdm_sfilter_free(sfilter);
+	    return err;
+	}
+    }
 
     *rfilter = filter;
     return 0;
@@ -10,6 +10,7 @@
 #include "gensio_filter_certauth.h"
 #include <gensio/gensio_err.h>
 #include <gensio/gensio_time.h>
+#include <gensio/gensio_list.h>
 
 #ifdef _WIN32
 #define DIRSEP '\\'
@@ -36,6 +37,27 @@ struct gensio_certauth_filter_data {
     /* Amount of time in which the connection process must complete. */
     gensio_time con_timeout;
 
+    /* How long to remember a good certificate verify, zero is off. */
+    gensio_time verify_cache_time;
+
+    /* Client: send the password with the challenge response. */
+    bool pipeline;
+
+    /* Client: keep resume tokens from the server and use them. */
+    bool resume;
+
+    /* Server: how long resume tokens are good for, zero is off. */
+    gensio_time resume_time;
+    unsigned char resume_secret[32];
+
+    /*
+     * The CA store is loaded the first time a filter is allocated and
+     * shared, along with its verify cache, by every filter allocated
+     * after that.  Protected by lock.
+     */
+    struct gensio_lock *lock;
+    struct certauth_vstore *vstore;
+
     /*
      * The following is only used for testing. so certauth can be run
      * over stdio for fuzz testing.  Do not document.
@@ -52,6 +74,8 @@ struct gensio_certauth_filter_data {
 #include <openssl/pem.h>
 #include <openssl/rand.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
@@ -181,11 +205,433 @@ static void EVP_MD_CTX_free(EVP_MD_CTX *c)
 {
     OPENSSL_free(c);
 }
+#define X509_STORE_up_ref(x) CRYPTO_add(&x->references, 1, \
+					CRYPTO_LOCK_X509_STORE)
 #endif
 
+/* A SHA1 fingerprint from gensio_cert_fingerprint(), with the nil. */
+#define CERTAUTH_FINGERPRINT_LEN	60
+#define CERTAUTH_VCACHE_MAX		256
+
+struct certauth_vcache_entry {
+    struct gensio_link link;
+    char fingerprint[CERTAUTH_FINGERPRINT_LEN];
+    gensio_time expires; /* Monotonic time. */
+};
+
+/*
+ * A loaded CA store and a cache of the certificates that have
+ * verified against it, keyed by fingerprint.  Shared between the
+ * config data and all the filters created from it, so it is
+ * refcounted.  A reload creates a new one, so the cache never holds
+ * results from an old store.
+ */
+struct certauth_vstore {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
+    X509_STORE *store;
+
+    gensio_time cache_time;
+    /*
+     * The earliest next update time of the CRLs in the store, entries
+     * never live past this.  Zero if there are no CRLs.
+     */
+    gensio_time crl_limit;
+
+    /* Most recently used first. */
+    struct gensio_list entries;
+    unsigned int nr_entries;
+};
+
+/*
+ * Convert an ASN1 time to the monotonic clock.  Returns false if the
+ * time is already past.
+ */
+static bool
+certauth_asn1_to_mono(struct gensio_os_funcs *o, const ASN1_TIME *t,
+		      gensio_time *rtime)
+{
+    int days, secs;
+    gensio_time now;
+
+    if (!ASN1_TIME_diff(&days, &secs, NULL, t))
+	return false;
+    if (days < 0 || secs < 0 || (days == 0 && secs == 0))
+	return false;
+    o->get_monotonic_time(o, &now);
+    gensio_time_add_nsecs(&now, GENSIO_SECS_TO_NSECS((int64_t) days * 86400
+						      + secs));
+    *rtime = now;
+    return true;
+}
+
+static bool
+certauth_time_before(gensio_time *t1, gensio_time *t2)
+{
+    return gensio_time_diff_nsecs(t1, t2) < 0;
+}
+
+static void
+certauth_vstore_find_crl_limit(struct certauth_vstore *vs)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    STACK_OF(X509_OBJECT) *objs = X509_STORE_get0_objects(vs->store);
+    int i;
+
+    for (i = 0; i < sk_X509_OBJECT_num(objs); i++) {
+	X509_OBJECT *obj = sk_X509_OBJECT_value(objs, i);
+	const ASN1_TIME *next;
+	gensio_time t;
+
+	if (X509_OBJECT_get_type(obj) != X509_LU_CRL)
+	    continue;
+	next = X509_CRL_get0_nextUpdate(X509_OBJECT_get0_X509_CRL(obj));
+	if (!next)
+	    continue;
+	if (!certauth_asn1_to_mono(vs->o, next, &t))
+	    /* Already out of date, don't cache anything. */
+	    vs->o->get_monotonic_time(vs->o, &t);
+	if (gensio_time_is_zero(vs->crl_limit) ||
+		certauth_time_before(&t, &vs->crl_limit))
+	    vs->crl_limit = t;
+    }
+#endif
+}
+
+static void
+certauth_vstore_free(struct certauth_vstore *vs)
+{
+    struct gensio_os_funcs *o = vs->o;
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(&vs->entries, l, l2) {
+	gensio_list_rm(&vs->entries, l);
+	o->free(o, gensio_container_of(l, struct certauth_vcache_entry, link));
+    }
+    if (vs->store)
+	X509_STORE_free(vs->store);
+    if (vs->lock)
+	o->free_lock(vs->lock);
+    o->free(o, vs);
+}
+
+static void
+certauth_vstore_ref(struct certauth_vstore *vs)
+{
+    vs->o->lock(vs->lock);
+    vs->refcount++;
+    vs->o->unlock(vs->lock);
+}
+
+static void
+certauth_vstore_deref(struct certauth_vstore *vs)
+{
+    unsigned int refcount;
+
+    vs->o->lock(vs->lock);
+    refcount = --vs->refcount;
+    vs->o->unlock(vs->lock);
+    if (refcount == 0)
+	certauth_vstore_free(vs);
+}
+
+static int
+certauth_vstore_alloc(struct gensio_certauth_filter_data *data,
+		      struct certauth_vstore **rvs)
+{
+    struct gensio_os_funcs *o = data->o;
+    struct certauth_vstore *vs;
+
+    vs = o->zalloc(o, sizeof(*vs));
+    if (!vs)
+	return GE_NOMEM;
+    vs->o = o;
+    vs->refcount = 1;
+    vs->cache_time = data->verify_cache_time;
+    gensio_list_init(&vs->entries);
+
+    vs->lock = o->alloc_lock(o);
+    if (!vs->lock)
+	goto out_nomem;
+
+    vs->store = X509_STORE_new();
+    if (!vs->store)
+	goto out_nomem;
+
+    if (data->CAfilepath && data->CAfilepath[0]) {
+	char *CAfile = NULL, *CApath = NULL;
+
+	if (data->CAfilepath[strlen(data->CAfilepath) - 1] == DIRSEP)
+	    CApath = data->CAfilepath;
+	else
+	    CAfile = data->CAfilepath;
+	if (!X509_STORE_load_locations(vs->store, CAfile, CApath)) {
+	    certauth_vstore_free(vs);
+	    return GE_CERTNOTFOUND;
+	}
+    }
+    certauth_vstore_find_crl_limit(vs);
+
+    *rvs = vs;
+    return 0;
+
+ out_nomem:
+    certauth_vstore_free(vs);
+    return GE_NOMEM;
+}
+
+static bool
+certauth_vcache_lookup(struct certauth_vstore *vs, const char *fingerprint)
+{
+    struct gensio_link *l, *l2;
+    gensio_time now;
+    bool found = false;
+
+    vs->o->get_monotonic_time(vs->o, &now);
+    vs->o->lock(vs->lock);
+    gensio_list_for_each_safe(&vs->entries, l, l2) {
+	struct certauth_vcache_entry *e =
+	    gensio_container_of(l, struct certauth_vcache_entry, link);
+
+	if (strcmp(e->fingerprint, fingerprint) != 0)
+	    continue;
+	if (!certauth_time_before(&now, &e->expires)) {
+	    gensio_list_rm(&vs->entries, l);
+	    vs->nr_entries--;
+	    vs->o->free(vs->o, e);
+	} else {
+	    gensio_list_rm(&vs->entries, l);
+	    gensio_list_add_head(&vs->entries, l);
+	    found = true;
+	}
+	break;
+    }
+    vs->o->unlock(vs->lock);
+    return found;
+}
+
+/*
+ * Remember that the certificate verified.  The entry expires after
+ * the cache time, or when the first certificate in the chain or a
+ * CRL in the store runs out, whichever comes first.
+ */
+static void
+certauth_vcache_add(struct certauth_vstore *vs, const char *fingerprint,
+		    X509_STORE_CTX *ctx)
+{
+    struct gensio_os_funcs *o = vs->o;
+    struct certauth_vcache_entry *e;
+    STACK_OF(X509) *chain;
+    gensio_time expires, t;
+    size_t len;
+    int i;
+
+    /* Don't cache a fingerprint that doesn't fit, it would be truncated. */
+    len = strlen(fingerprint);
+    if (len >= sizeof(e->fingerprint))
+	return;
+
+    o->get_monotonic_time(o, &expires);
+    gensio_time_add(&expires, &vs->cache_time);
+    if (!gensio_time_is_zero(vs->crl_limit) &&
+		certauth_time_before(&vs->crl_limit, &expires))
+	expires = vs->crl_limit;
+
+    chain = X509_STORE_CTX_get1_chain(ctx);
+    if (!chain)
+	return;
+    for (i = 0; i < sk_X509_num(chain); i++) {
+	if (!certauth_asn1_to_mono(o, X509_get_notAfter(sk_X509_value(chain,
+								      i)),
+				   &t)) {
+	    sk_X509_pop_free(chain, X509_free);
+	    return;
+	}
+	if (certauth_time_before(&t, &expires))
+	    expires = t;
+    }
+    sk_X509_pop_free(chain, X509_free);
+
+    e = o->zalloc(o, sizeof(*e));
+    if (!e)
+	return;
+    memcpy(e->fingerprint, fingerprint, len + 1);
+    e->expires = expires;
+
+    o->lock(vs->lock);
+    gensio_list_add_head(&vs->entries, &e->link);
+    if (vs->nr_entries >= CERTAUTH_VCACHE_MAX) {
+	struct gensio_link *l = gensio_list_last(&vs->entries);
+
+	gensio_list_rm(&vs->entries, l);
+	o->free(o, gensio_container_of(l, struct certauth_vcache_entry, link));
+    } else {
+	vs->nr_entries++;
+    }
+    o->unlock(vs->lock);
+}
+
+/*
+ * A resume token is an 8 byte expiry time, in seconds of the server's
+ * monotonic clock, followed by a HMAC-SHA256 over the expiry, the
+ * certificate fingerprint, the username, and the service, keyed by a
+ * random secret made when the server's config is parsed.  The server
+ * keeps no state for them, so a server that forks per connection
+ * still takes tokens issued by another child.
+ */
+#define CERTAUTH_TOKEN_LEN		40
+#define CERTAUTH_TOKEN_STORE_MAX	64
+
+/*
+ * Client side, tokens received from servers, keyed by the remote
+ * address, username, service, and our certificate fingerprint.  Most
+ * recently used first.  Shared by every certauth gensio in the
+ * program.
+ */
+struct certauth_token_entry {
+    struct gensio_link link;
+    char *key;
+    unsigned char token[CERTAUTH_TOKEN_LEN];
+};
+
+static struct gensio_os_funcs *certauth_token_o;
+static struct gensio_lock *certauth_token_lock;
+static struct gensio_list certauth_token_list;
+static unsigned int certauth_token_count;
+
+static void
+certauth_token_entry_free(struct certauth_token_entry *e)
+{
+    gensio_list_rm(&certauth_token_list, &e->link);
+    certauth_token_count--;
+    OPENSSL_cleanse(e->token, sizeof(e->token));
+    certauth_token_o->free(certauth_token_o, e->key);
+    certauth_token_o->free(certauth_token_o, e);
+}
+
+static void
+gensio_certauth_cleanup_mem(void)
+{
+    struct gensio_link *l, *l2;
+
+    if (!certauth_token_lock)
+	return;
+    gensio_list_for_each_safe(&certauth_token_list, l, l2)
+	certauth_token_entry_free(gensio_container_of(l,
+					struct certauth_token_entry, link));
+    certauth_token_o->free_lock(certauth_token_lock);
+    certauth_token_lock = NULL;
+}
+
+static struct gensio_class_cleanup certauth_class_cleanup = {
+    gensio_certauth_cleanup_mem
+};
+
+static void
+gensio_do_certauth_token_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&certauth_token_list);
+    certauth_token_o = o;
+    /* If this fails, clients just don't resume. */
+    certauth_token_lock = o->alloc_lock(o);
+    if (certauth_token_lock)
+	gensio_register_class_cleanup(&certauth_class_cleanup);
+}
+
+static struct gensio_once gensio_certauth_token_init_once;
+
+static void
+certauth_token_initialize(struct gensio_os_funcs *o)
+{
+    o->call_once(o, &gensio_certauth_token_init_once,
+		 gensio_do_certauth_token_init, o);
+}
+
+/* Must be called with certauth_token_lock held. */
+static struct certauth_token_entry *
+certauth_token_find(const char *key)
+{
+    struct gensio_link *l;
+
+    gensio_list_for_each(&certauth_token_list, l) {
+	struct certauth_token_entry *e =
+	    gensio_container_of(l, struct certauth_token_entry, link);
+
+	if (strcmp(e->key, key) == 0)
+	    return e;
+    }
+    return NULL;
+}
+
+/* Fetch the saved token for key.  Returns false if there isn't one. */
+static bool
+certauth_token_get(const char *key, unsigned char *token)
+{
+    struct certauth_token_entry *e;
+
+    if (!certauth_token_lock)
+	return false;
+
+    certauth_token_o->lock(certauth_token_lock);
+    e = certauth_token_find(key);
+    if (e) {
+	memcpy(token, e->token, CERTAUTH_TOKEN_LEN);
+	gensio_list_rm(&certauth_token_list, &e->link);
+	gensio_list_add_head(&certauth_token_list, &e->link);
+    }
+    certauth_token_o->unlock(certauth_token_lock);
+    return e != NULL;
+}
+
+/* Save a token for key, or remove the saved one if token is NULL. */
+static void
+certauth_token_put(const char *key, const unsigned char *token)
+{
+    struct gensio_os_funcs *o = certauth_token_o;
+    struct certauth_token_entry *e;
+    struct gensio_link *l;
+
+    if (!certauth_token_lock)
+	return;
+
+    o->lock(certauth_token_lock);
+    e = certauth_token_find(key);
+    if (!token) {
+	if (e)
+	    certauth_token_entry_free(e);
+	goto out_unlock;
+    }
+    if (e) {
+	gensio_list_rm(&certauth_token_list, &e->link);
+    } else {
+	e = o->zalloc(o, sizeof(*e));
+	if (!e)
+	    goto out_unlock;
+	e->key = gensio_strdup(o, key);
+	if (!e->key) {
+	    o->free(o, e);
+	    goto out_unlock;
+	}
+	if (certauth_token_count >= CERTAUTH_TOKEN_STORE_MAX) {
+	    l = gensio_list_last(&certauth_token_list);
+	    certauth_token_entry_free(gensio_container_of(l,
+					struct certauth_token_entry, link));
+	}
+	certauth_token_count++;
+    }
+    memcpy(e->token, token, CERTAUTH_TOKEN_LEN);
+    gensio_list_add_head(&certauth_token_list, &e->link);
+ out_unlock:
+    o->unlock(certauth_token_lock);
+}
+
 #define GENSIO_CERTAUTH_DATA_SIZE	2048
 #define GENSIO_CERTAUTH_CHALLENGE_SIZE	32
-#define GENSIO_CERTAUTH_VERSION		4
+#define GENSIO_CERTAUTH_VERSION		5
 
 /*
  * Passwords are always sent in this size buffer to keep an attacker
@@ -230,6 +676,12 @@ enum certauth_state {
      *
      * Message contains a VERSION element, an optional USERNAME
      * element, and an optional SERVICE element.
+     *
+     * In version 5 it may also contain an OPTIONS element asking for
+     * a pipelined exchange.  A client that has a resume token from
+     * the server also sends the token and its CERTIFICATE here.  If
+     * the token is good, the certificate verifies, and nothing else
+     * is needed, the server sends the SERVERDONE right away.
      */
     CERTAUTH_CLIENTHELLO = 1,
 
@@ -245,6 +697,16 @@ enum certauth_state {
      * Message contains a VERSION element, a CHALLENGE_DATA element,
      * and an optional AUX_DATA element.  AUX_DATA is version 2 or
      * later.
+     *
+     * If the client asked for pipelining and the server supports it,
+     * this also contains an OPTIONS element saying so and the
+     * PASSWORD_TYPE element that would be in the PASSWORD_REQUEST.
+     * The client then sends its password data and 2FA data with the
+     * challenge response, and the server sends SERVERDONE to that,
+     * or a PASSWORD_REQUEST if it needs a password the client held
+     * back.  This saves a round trip.  If the resume token was
+     * accepted, OPTIONS says that, too, and the client doesn't sign
+     * the challenge.
      */
     CERTAUTH_SERVERHELLO = 2,
 
@@ -346,7 +808,10 @@ enum certauth_elements {
     CERTAUTH_USERNAME		= 101,
 
     /*
-     * Currently not used.
+     * 102 2 <option bits>
+     *
+     * See CERTAUTH_OPTION_xxx below.  Added in version 5, older
+     * versions ignore it.
      */
     CERTAUTH_OPTIONS		= 102,
 
@@ -419,6 +884,14 @@ enum certauth_elements {
      */
     CERTAUTH_AUX_DATA		= 112,
 
+    /*
+     * 113 40 <token>
+     *
+     * A resume token, sent by the server in SERVERDONE and given back
+     * by the client in a later CLIENTHELLO.  Added in version 5.
+     */
+    CERTAUTH_RESUME_TOKEN	= 113,
+
     /*
      * 200
      *
@@ -427,7 +900,7 @@ enum certauth_elements {
     CERTAUTH_END		= 200
 };
 #define CERTAUTH_MIN_ELEMENT CERTAUTH_VERSION
-#define CERTAUTH_MAX_ELEMENT CERTAUTH_AUX_DATA
+#define CERTAUTH_MAX_ELEMENT CERTAUTH_RESUME_TOKEN
 
 #define CERTAUTH_RESULT_SUCCESS	1
 #define CERTAUTH_RESULT_FAILURE	2
@@ -444,6 +917,13 @@ enum certauth_elements {
  */
 #define CERTAUTH_PASSWORD_TYPE_BIT_2FA	(1 << 8)
 
+/* Client asks for, or server agrees to, the pipelined exchange. */
+#define CERTAUTH_OPTION_PIPELINE	(1 << 0)
+/* Server accepted the resume token, don't sign the challenge. */
+#define CERTAUTH_OPTION_RESUMED		(1 << 1)
+/* Client wants a resume token in the SERVERDONE. */
+#define CERTAUTH_OPTION_RESUME		(1 << 2)
+
 struct certauth_filter {
     struct gensio_filter *filter;
     struct gensio_os_funcs *o;
@@ -484,6 +964,40 @@ struct certauth_filter {
     /* try_connect() has been called at least once. */
     bool started;
 
+    /* Options from the remote end. */
+    unsigned int rem_options;
+
+    /* Client: ask for the pipelined exchange. */
+    bool pipeline;
+
+    /* Both ends agreed to the pipelined exchange. */
+    bool pipelined;
+
+    /* Server: asked for a password after a pipelined response. */
+    bool pw_fallback;
+
+    /* Server: certificate was checked when the CLIENTHELLO came in. */
+    bool cert_checked;
+
+    /* Client: the cert went in the CLIENTHELLO, don't send it again. */
+    bool sent_cert;
+
+    /* Client: 2FA data has been sent, don't send it again. */
+    bool sent_2fa;
+
+    /*
+     * Resume token handling.  On the client, resume_key is set if
+     * resuming is enabled and is the key to the token store.  On the
+     * server, resume_time is non-zero if tokens are issued.
+     */
+    bool resume;
+    char *resume_key;
+    gensio_time resume_time;
+    unsigned char resume_secret[32];
+    unsigned char resume_token[CERTAUTH_TOKEN_LEN];
+    bool sent_token;
+    bool got_token;
+
     /* Time to wait for the connection to complete. */
     gensio_time con_timeout;
 
@@ -518,6 +1032,12 @@ struct certauth_filter {
     EVP_PKEY *pkey;
     X509_STORE *verify_store;
 
+    /*
+     * The shared store verify_store came from, for the verify cache.
+     * NULL if the user set their own store.
+     */
+    struct certauth_vstore *vstore;
+
     bool allow_authfail;
 
     BUF_MEM cert_buf_mem;
@@ -741,6 +1261,20 @@ certauth_verify_cert(struct certauth_filter *sfilter)
     X509_STORE_CTX *cert_store_ctx = NULL;
     int rv = 0, verify_err;
     const char *auxdata[] = { NULL, NULL };
+    char fingerprint[CERTAUTH_FINGERPRINT_LEN];
+    gensiods fplen = sizeof(fingerprint);
+    bool use_cache = false;
+
+    if (sfilter->vstore && !gensio_time_is_zero(sfilter->vstore->cache_time) &&
+		gensio_cert_fingerprint(sfilter->cert, fingerprint,
+					&fplen) == 0 &&
+		fplen < sizeof(fingerprint)) {
+	use_cache = true;
+	if (certauth_vcache_lookup(sfilter->vstore, fingerprint)) {
+	    verify_err = X509_V_OK;
+	    goto verified;
+	}
+    }
 
     cert_store_ctx = X509_STORE_CTX_new();
     if (!cert_store_ctx) {
@@ -769,8 +1303,11 @@ certauth_verify_cert(struct certauth_filter *sfilter)
 	    rv = GE_CERTINVALID;
     } else {
 	verify_err = X509_V_OK;
+	if (use_cache)
+	    certauth_vcache_add(sfilter->vstore, fingerprint, cert_store_ctx);
     }
 
+ verified:
     certauth_unlock(sfilter);
     if (rv)
 	auxdata[0] = X509_verify_cert_error_string(verify_err);
@@ -797,6 +1334,186 @@ certauth_verify_cert(struct certauth_filter *sfilter)
     return rv;
 }
 
+/*
+ * Run the precert event and verify the certificate, setting the
+ * result.  Returns an error if the connection should be failed.
+ */
+static int
+certauth_check_cert(struct certauth_filter *sfilter)
+{
+    int err;
+
+    if (!sfilter->result) {
+	certauth_unlock(sfilter);
+	err = gensio_filter_do_event(sfilter->filter,
+				     GENSIO_EVENT_PRECERT_VERIFY, 0,
+				     NULL, NULL, NULL);
+	certauth_lock(sfilter);
+	if (!err) {
+	    sfilter->result = CERTAUTH_RESULT_SUCCESS;
+	} else if (err == GE_AUTHREJECT) {
+	    gca_log_err(sfilter, "precert verify rejected connection");
+	    sfilter->result = CERTAUTH_RESULT_ERR;
+	} else if (err != GE_NOTSUP) {
+	    gca_log_err(sfilter, "Error from application at precert: %s",
+			gensio_err_to_str(err));
+	    return err;
+	}
+    }
+    err = certauth_verify_cert(sfilter);
+    if (!sfilter->result) {
+	if (err == GE_AUTHREJECT) {
+	    gca_log_err(sfilter, "precert verify rejected connection");
+	    sfilter->result = CERTAUTH_RESULT_ERR;
+	} else if (err && err != GE_NOTSUP) {
+	    gca_log_err(sfilter, "Error from application at precert: %s",
+			gensio_err_to_str(err));
+	    return err;
+	}
+
+	if (sfilter->verified &&
+		sfilter->response_result == CERTAUTH_RESULT_SUCCESS) {
+	    sfilter->result = CERTAUTH_RESULT_SUCCESS;
+	}
+    }
+    return 0;
+}
+
+/* Calculate the MAC for a resume token with the given expiry. */
+static int
+certauth_token_mac(struct certauth_filter *sfilter,
+		   const unsigned char *expiry, unsigned char *mac)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    char fingerprint[CERTAUTH_FINGERPRINT_LEN];
+    gensiods fplen = sizeof(fingerprint);
+    unsigned char *buf, *p;
+    gensiods len;
+    unsigned int maclen = 32;
+
+    if (gensio_cert_fingerprint(sfilter->cert, fingerprint, &fplen) ||
+		fplen >= sizeof(fingerprint))
+	return GE_CERTINVALID;
+
+    len = 8 + fplen + 1 + sfilter->username_len + 1 + sfilter->service_len;
+    buf = o->zalloc(o, len);
+    if (!buf)
+	return GE_NOMEM;
+    p = buf;
+    memcpy(p, expiry, 8);
+    p += 8;
+    memcpy(p, fingerprint, fplen + 1);
+    p += fplen + 1;
+    if (sfilter->username_len)
+	memcpy(p, sfilter->username, sfilter->username_len);
+    p += sfilter->username_len + 1;
+    if (sfilter->service_len)
+	memcpy(p, sfilter->service, sfilter->service_len);
+
+    if (!HMAC(EVP_sha256(), sfilter->resume_secret,
+	      sizeof(sfilter->resume_secret), buf, len, mac, &maclen)) {
+	o->free(o, buf);
+	gca_logs_err(sfilter, "Unable to calculate resume token");
+	return GE_NOMEM;
+    }
+    o->free(o, buf);
+    return 0;
+}
+
+/* Add a new resume token for the current certificate. */
+static void
+certauth_add_token(struct certauth_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned char token[CERTAUTH_TOKEN_LEN];
+    gensio_time now;
+    uint64_t expiry;
+    unsigned int i;
+
+    o->get_monotonic_time(o, &now);
+    expiry = now.secs + sfilter->resume_time.secs;
+    for (i = 0; i < 8; i++)
+	token[i] = (expiry >> (56 - i * 8)) & 0xff;
+    if (certauth_token_mac(sfilter, token, token + 8))
+	/* Just don't give out a token. */
+	return;
+
+    certauth_write_byte(sfilter, CERTAUTH_RESUME_TOKEN);
+    certauth_write_u16(sfilter, sizeof(token));
+    certauth_write(sfilter, token, sizeof(token));
+}
+
+/* Is the resume token from the client good for its certificate? */
+static bool
+certauth_check_token(struct certauth_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned char mac[32];
+    gensio_time now;
+    uint64_t expiry = 0;
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+	expiry = (expiry << 8) | sfilter->resume_token[i];
+    o->get_monotonic_time(o, &now);
+    if ((uint64_t) now.secs >= expiry) {
+	gca_log_info(sfilter, "Resume token has expired");
+	return false;
+    }
+    if (certauth_token_mac(sfilter, sfilter->resume_token, mac))
+	return false;
+    if (CRYPTO_memcmp(mac, sfilter->resume_token + 8, sizeof(mac)) != 0) {
+	gca_log_info(sfilter, "Resume token is not valid");
+	return false;
+    }
+    return true;
+}
+
+/*
+ * Find the token for this connection, if there is one, and set up
+ * the key to save a new one.
+ */
+static void
+certauth_token_start(struct certauth_filter *sfilter)
+{
+    struct gensio *io = gensio_filter_get_gensio(sfilter->filter);
+    struct gensio *child = gensio_get_child(io, 1);
+    char raddr[200], fingerprint[CERTAUTH_FINGERPRINT_LEN];
+    gensiods len = sizeof(raddr), fplen = sizeof(fingerprint);
+
+    if (!child || !sfilter->cert)
+	return;
+    strcpy(raddr, "0");
+    if (gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, GENSIO_CONTROL_GET,
+		       GENSIO_CONTROL_RADDR, raddr, &len))
+	return;
+    if (gensio_cert_fingerprint(sfilter->cert, fingerprint, &fplen) ||
+		fplen >= sizeof(fingerprint))
+	return;
+    sfilter->resume_key = gensio_alloc_sprintf(sfilter->o, "%s;%s;%s;%s",
+			raddr, sfilter->username ? sfilter->username : "",
+			sfilter->service ? sfilter->service : "", fingerprint);
+    if (sfilter->resume_key)
+	sfilter->sent_token = certauth_token_get(sfilter->resume_key,
+						 sfilter->resume_token);
+}
+
+/* Save or drop the token based on how the authentication went. */
+static void
+certauth_token_finish(struct certauth_filter *sfilter)
+{
+    if (sfilter->result == CERTAUTH_RESULT_SUCCESS && sfilter->got_token) {
+	certauth_token_put(sfilter->resume_key, sfilter->resume_token);
+    } else if (sfilter->sent_token &&
+	       (sfilter->result != CERTAUTH_RESULT_SUCCESS ||
+		(sfilter->challenge_data &&
+		 !(sfilter->rem_options & CERTAUTH_OPTION_RESUMED)))) {
+	/* The server didn't take it, don't try it again. */
+	certauth_token_put(sfilter->resume_key, NULL);
+    }
+    OPENSSL_cleanse(sfilter->resume_token, sizeof(sfilter->resume_token));
+}
+
 static int
 certauth_add_cert(struct certauth_filter *sfilter)
 {
@@ -1136,6 +1853,16 @@ certauth_send_server_done(struct certauth_filter *sfilter)
     certauth_write_byte(sfilter, CERTAUTH_RESULT);
     certauth_write_u16(sfilter, 2);
     certauth_write_u16(sfilter, result);
+    /*
+     * Only hand out a token after a real signature check, so a
+     * client has to prove it has the key every resume-time.
+     */
+    if (sfilter->result == CERTAUTH_RESULT_SUCCESS && sfilter->pipelined &&
+		(sfilter->rem_options & CERTAUTH_OPTION_RESUME) &&
+		!gensio_time_is_zero(sfilter->resume_time) &&
+		sfilter->cert && sfilter->verified && !sfilter->cert_checked &&
+		sfilter->response_result == CERTAUTH_RESULT_SUCCESS)
+	certauth_add_token(sfilter);
     certauth_write_byte(sfilter, CERTAUTH_END);
 }
 
@@ -1206,6 +1933,26 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    certauth_write_u16(sfilter, sfilter->service_len);
 	    certauth_write(sfilter, sfilter->service, sfilter->service_len);
 	}
+	if (sfilter->pipeline && sfilter->my_version >= 5) {
+	    req = CERTAUTH_OPTION_PIPELINE;
+	    if (sfilter->resume) {
+		req |= CERTAUTH_OPTION_RESUME;
+		certauth_token_start(sfilter);
+	    }
+	    certauth_write_byte(sfilter, CERTAUTH_OPTIONS);
+	    certauth_write_u16(sfilter, 2);
+	    certauth_write_u16(sfilter, req);
+	}
+	if (sfilter->sent_token) {
+	    /* Only a version 5 server hands these out. */
+	    certauth_write_byte(sfilter, CERTAUTH_RESUME_TOKEN);
+	    certauth_write_u16(sfilter, CERTAUTH_TOKEN_LEN);
+	    certauth_write(sfilter, sfilter->resume_token, CERTAUTH_TOKEN_LEN);
+	    sfilter->pending_err = certauth_add_cert(sfilter);
+	    if (sfilter->pending_err)
+		goto finish_result;
+	    sfilter->sent_cert = true;
+	}
 
 	certauth_write_byte(sfilter, CERTAUTH_END);
 
@@ -1268,6 +2015,23 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    goto finish_result;
 	}
 
+	if (sfilter->version >= 5 && sfilter->my_version >= 5 &&
+		sfilter->rem_options & CERTAUTH_OPTION_PIPELINE)
+	    sfilter->pipelined = true;
+
+	if (sfilter->pipelined && sfilter->got_token && sfilter->cert &&
+		!gensio_time_is_zero(sfilter->resume_time) &&
+		certauth_check_token(sfilter)) {
+	    /* The token stands in for the challenge response. */
+	    sfilter->response_result = CERTAUTH_RESULT_SUCCESS;
+	    sfilter->cert_checked = true;
+	    sfilter->pending_err = certauth_check_cert(sfilter);
+	    if (sfilter->pending_err)
+		goto finish_result;
+	    if (sfilter->result == CERTAUTH_RESULT_SUCCESS && !sfilter->do_2fa)
+		goto finish_result;
+	}
+
 	sfilter->write_buf_len = 0;
 	certauth_write_byte(sfilter, CERTAUTH_SERVERHELLO);
 	certauth_write_byte(sfilter, CERTAUTH_VERSION);
@@ -1288,6 +2052,25 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    certauth_write_u16(sfilter, sfilter->len_aux);
 	    certauth_write(sfilter, sfilter->val_aux, sfilter->len_aux);
 	}
+	if (sfilter->pipelined) {
+	    req = CERTAUTH_OPTION_PIPELINE;
+	    if (sfilter->cert_checked)
+		req |= CERTAUTH_OPTION_RESUMED;
+	    certauth_write_byte(sfilter, CERTAUTH_OPTIONS);
+	    certauth_write_u16(sfilter, 2);
+	    certauth_write_u16(sfilter, req);
+
+	    /* Ask for the password up front. */
+	    if (!sfilter->result && sfilter->enable_password)
+		req = CERTAUTH_PASSWORD_TYPE_REQ;
+	    else
+		req = CERTAUTH_PASSWORD_TYPE_DUMMY;
+	    if (sfilter->do_2fa)
+		req |= CERTAUTH_PASSWORD_TYPE_BIT_2FA;
+	    certauth_write_byte(sfilter, CERTAUTH_PASSWORD_TYPE);
+	    certauth_write_u16(sfilter, 2);
+	    certauth_write_u16(sfilter, req);
+	}
 
 	certauth_write_byte(sfilter, CERTAUTH_END);
 
@@ -1342,7 +2125,9 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	sfilter->write_buf_len = 0;
 	certauth_write_byte(sfilter, CERTAUTH_CHALLENGE_RESPONSE);
 
-	if (sfilter->cert) {
+	if (sfilter->sent_cert) {
+	    /* The server already has it from the CLIENTHELLO. */
+	} else if (sfilter->cert) {
 	    sfilter->pending_err = certauth_add_cert(sfilter);
 	    if (sfilter->pending_err)
 		goto finish_result;
@@ -1351,7 +2136,10 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    certauth_add_dummy(sfilter, 1265);
 	}
 
-	if (sfilter->pkey) {
+	if (sfilter->rem_options & CERTAUTH_OPTION_RESUMED) {
+	    /* The server took our token, no need to sign. */
+	    certauth_add_dummy(sfilter, 256);
+	} else if (sfilter->pkey) {
 	    sfilter->pending_err = certauth_add_challenge_rsp(sfilter);
 	    if (sfilter->pending_err)
 		goto finish_result;
@@ -1365,6 +2153,13 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    certauth_write(sfilter, sfilter->val_aux, sfilter->len_aux);
 	}
 
+	if (sfilter->pipeline && sfilter->version >= 5 &&
+		sfilter->rem_options & CERTAUTH_OPTION_PIPELINE) {
+	    /* Put the password data in this message, too. */
+	    sfilter->pipelined = true;
+	    goto add_password;
+	}
+
 	certauth_write_byte(sfilter, CERTAUTH_END);
 
 	sfilter->state = CERTAUTH_PASSWORD_REQUEST;
@@ -1394,40 +2189,10 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    goto finish_result;
 	}
 
-	if (!sfilter->result) {
-	    certauth_unlock(sfilter);
-	    err = gensio_filter_do_event(sfilter->filter,
-					 GENSIO_EVENT_PRECERT_VERIFY, 0,
-					 NULL, NULL, NULL);
-	    certauth_lock(sfilter);
-	    if (!err) {
-		sfilter->result = CERTAUTH_RESULT_SUCCESS;
-	    } else if (err == GE_AUTHREJECT) {
-		gca_log_err(sfilter, "precert verify rejected connection");
-		sfilter->result = CERTAUTH_RESULT_ERR;
-	    } else if (err != GE_NOTSUP) {
-		gca_log_err(sfilter, "Error from application at precert: %s",
-			    gensio_err_to_str(err));
-		sfilter->pending_err = err;
-		goto finish_result;
-	    }
-	}
-	err = certauth_verify_cert(sfilter);
-	if (!sfilter->result) {
-	    if (err == GE_AUTHREJECT) {
-		gca_log_err(sfilter, "precert verify rejected connection");
-		sfilter->result = CERTAUTH_RESULT_ERR;
-	    } else if (err && err != GE_NOTSUP) {
-		gca_log_err(sfilter, "Error from application at precert: %s",
-			    gensio_err_to_str(err));
-		sfilter->pending_err = err;
+	if (!sfilter->cert_checked) {
+	    sfilter->pending_err = certauth_check_cert(sfilter);
+	    if (sfilter->pending_err)
 		goto finish_result;
-	    }
-
-	    if (sfilter->verified &&
-			sfilter->response_result == CERTAUTH_RESULT_SUCCESS) {
-		sfilter->result = CERTAUTH_RESULT_SUCCESS;
-	    }
 	}
 
 	/*
@@ -1437,12 +2202,19 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	 */
 
     try_password:
+	if (sfilter->pipelined) {
+	    /* The password data came with the response. */
+	    sfilter->state = CERTAUTH_PASSWORD;
+	    goto check_password;
+	}
+
+    request_password:
 	if (!sfilter->result && sfilter->enable_password)
 	    req = CERTAUTH_PASSWORD_TYPE_REQ;
 	else
 	    req = CERTAUTH_PASSWORD_TYPE_DUMMY;
-	/* Request 2 factor authentication data. */
-	if (sfilter->do_2fa)
+	/* Request 2 factor authentication data, if we don't have it. */
+	if (sfilter->do_2fa && !sfilter->val_2fa)
 	    req |= CERTAUTH_PASSWORD_TYPE_BIT_2FA;
 	sfilter->write_buf_len = 0;
 	certauth_write_byte(sfilter, CERTAUTH_PASSWORD_REQUEST);
@@ -1454,15 +2226,17 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	break;
 
     case CERTAUTH_PASSWORD_REQUEST:
+	sfilter->write_buf_len = 0;
+	certauth_write_byte(sfilter, CERTAUTH_PASSWORD);
+
+    add_password:
 	if (!sfilter->password_req_val) {
 	    gca_log_err(sfilter, "Remote client didn't send request value");
 	    sfilter->pending_err = GE_DATAMISSING;
 	    goto finish_result;
 	}
 
-	sfilter->write_buf_len = 0;
 	if (sfilter->password_req_val != CERTAUTH_PASSWORD_TYPE_REQ) {
-	    certauth_write_byte(sfilter, CERTAUTH_PASSWORD);
 	    certauth_add_dummy(sfilter, sfilter->password_len);
 	    goto password_done;
 	}
@@ -1472,7 +2246,6 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	     * If we don't have passwords enabled but the other end
 	     * requests, send all zeros.
 	     */
-	    certauth_write_byte(sfilter, CERTAUTH_PASSWORD);
 	    certauth_write_byte(sfilter, CERTAUTH_PASSWORD_DATA);
 	    certauth_write_u16(sfilter, sfilter->password_len);
 	    if (sfilter->password_len)
@@ -1480,6 +2253,17 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    goto password_done;
 	}
 
+	if (!*sfilter->password && sfilter->pipelined &&
+		sfilter->state == CERTAUTH_CLIENTDELAY && sfilter->pkey) {
+	    /*
+	     * The certificate will probably do, don't ask the user for
+	     * a password that may not be needed.  The server will ask
+	     * for it if it is.
+	     */
+	    certauth_add_dummy(sfilter, sfilter->password_len);
+	    goto password_done;
+	}
+
 	if (!*sfilter->password) {
 	    /* Empty password, ask the user. */
 	    gensiods dummy_len = sfilter->password_len;
@@ -1502,7 +2286,6 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    password_requested = true;
 	}
 
-	certauth_write_byte(sfilter, CERTAUTH_PASSWORD);
 	certauth_write_byte(sfilter, CERTAUTH_PASSWORD_DATA);
 	certauth_write_u16(sfilter, sfilter->password_len);
 	if (sfilter->password_len)
@@ -1511,6 +2294,8 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    memset(sfilter->password, 0, sfilter->password_len);
 
     password_done:
+	if (sfilter->sent_2fa)
+	    goto password_end;
 	if (sfilter->val_2fa) {
 	    if (sfilter->version < 2) {
 		gca_log_err(sfilter,
@@ -1551,6 +2336,7 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	}
 
     send_2fa:
+	sfilter->sent_2fa = true;
 	certauth_write_byte(sfilter, CERTAUTH_2FA_DATA);
 	certauth_write_u16(sfilter, sfilter->len_2fa);
 	if (sfilter->len_2fa)
@@ -1567,10 +2353,21 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
     password_end:
 	certauth_write_byte(sfilter, CERTAUTH_END);
 
-	sfilter->state = CERTAUTH_SERVERDONE;
+	if (sfilter->state == CERTAUTH_CLIENTDELAY) {
+	    /*
+	     * Pipelined, the server may still send a PASSWORD_REQUEST
+	     * if it needs a password we held back.
+	     */
+	    sfilter->password_req_val = 0;
+	    sfilter->req_2fa_val = false;
+	    sfilter->state = CERTAUTH_PASSWORD_REQUEST;
+	} else {
+	    sfilter->state = CERTAUTH_SERVERDONE;
+	}
 	break;
 
     case CERTAUTH_PASSWORD:
+    check_password:
 	if (sfilter->do_2fa && !sfilter->val_2fa) {
 	    /* Remote end didn't send a password and we requested one. */
 	    gca_log_err(sfilter, "Remote client didn't send 2fa data");
@@ -1589,6 +2386,11 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	}
 
 	if (sfilter->enable_password && !sfilter->password) {
+	    if (sfilter->pipelined && !sfilter->pw_fallback) {
+		/* The client held back its password, ask for it. */
+		sfilter->pw_fallback = true;
+		goto request_password;
+	    }
 	    /* Remote end didn't send a password and we requested one. */
 	    gca_log_err(sfilter, "Remote client didn't send password");
 	    sfilter->pending_err = GE_DATAMISSING;
@@ -1676,6 +2478,8 @@ certauth_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	}
 
     handle_server_done:
+	if (sfilter->resume_key)
+	    certauth_token_finish(sfilter);
 	if (sfilter->result != CERTAUTH_RESULT_SUCCESS) {
 	    sfilter->pending_err = GE_AUTHREJECT;
 	    goto out_finish;
@@ -1905,6 +2709,23 @@ certauth_handle_new_element(struct certauth_filter *sfilter)
 	break;
 
     case CERTAUTH_OPTIONS:
+	/* Only look at the bits we know, for later expansion. */
+	if (sfilter->curr_elem_len >= 2)
+	    sfilter->rem_options = certauth_buf_to_u16(sfilter->read_buf);
+	break;
+
+    case CERTAUTH_RESUME_TOKEN:
+	if (sfilter->got_token) {
+	    gca_log_err(sfilter, "Resume token received when already set");
+	    sfilter->pending_err = GE_PROTOERR;
+	    break;
+	}
+	if (sfilter->curr_elem_len != CERTAUTH_TOKEN_LEN) {
+	    /* Not one of ours, ignore it. */
+	    break;
+	}
+	memcpy(sfilter->resume_token, sfilter->read_buf, CERTAUTH_TOKEN_LEN);
+	sfilter->got_token = true;
 	break;
 
     case CERTAUTH_CHALLENGE_DATA:
@@ -2175,6 +2996,19 @@ certauth_cleanup(struct gensio_filter *filter)
     sfilter->result = 0;
     sfilter->response_result = 0;
     sfilter->verified = false;
+
+    sfilter->rem_options = 0;
+    sfilter->pipelined = false;
+    sfilter->pw_fallback = false;
+    sfilter->cert_checked = false;
+    sfilter->sent_cert = false;
+    sfilter->sent_2fa = false;
+    sfilter->sent_token = false;
+    sfilter->got_token = false;
+    OPENSSL_cleanse(sfilter->resume_token, sizeof(sfilter->resume_token));
+    if (sfilter->resume_key)
+	o->free(o, sfilter->resume_key);
+    sfilter->resume_key = NULL;
 }
 
 static void
@@ -2212,6 +3046,11 @@ sfilter_free(struct certauth_filter *sfilter)
 	gensio_filter_free_data(sfilter->filter);
     if (sfilter->verify_store)
 	X509_STORE_free(sfilter->verify_store);
+    if (sfilter->vstore)
+	certauth_vstore_deref(sfilter->vstore);
+    if (sfilter->resume_key)
+	o->free(o, sfilter->resume_key);
+    OPENSSL_cleanse(sfilter->resume_secret, sizeof(sfilter->resume_secret));
     o->free(o, sfilter);
 }
 
@@ -2454,6 +3293,11 @@ certauth_filter_control(struct gensio_filter *filter, bool get, int op,
 	if (sfilter->verify_store)
 	    X509_STORE_free(sfilter->verify_store);
 	sfilter->verify_store = store;
+	/* Cached results are for the old store. */
+	if (sfilter->vstore) {
+	    certauth_vstore_deref(sfilter->vstore);
+	    sfilter->vstore = NULL;
+	}
 	certauth_unlock(sfilter);
 	return 0;
 
@@ -2530,6 +3374,7 @@ int gensio_certauth_filter_func(struct gensio_filter *filter, int op,
 static int
 gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
 				 bool is_client, X509_STORE *store,
+				 struct certauth_vstore *vstore,
 				 X509 *cert, STACK_OF(X509) *sk_ca,
 				 EVP_PKEY *pkey,
 				 const char *username, const char *password,
@@ -2538,6 +3383,9 @@ gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
 				 bool allow_authfail, bool use_child_auth,
 				 bool enable_password, bool do_2fa,
 				 gensio_time con_timeout,
+				 bool pipeline, bool resume,
+				 gensio_time resume_time,
+				 const unsigned char *resume_secret,
 				 struct gensio_filter **rfilter)
 {
     struct certauth_filter *sfilter;
@@ -2554,6 +3402,11 @@ gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->enable_password = enable_password;
     sfilter->do_2fa = do_2fa;
     sfilter->con_timeout = con_timeout;
+    sfilter->pipeline = pipeline || resume;
+    sfilter->resume = resume;
+    sfilter->resume_time = resume_time;
+    memcpy(sfilter->resume_secret, resume_secret,
+	   sizeof(sfilter->resume_secret));
     sfilter->my_version = GENSIO_CERTAUTH_VERSION;
     sfilter->rsa_md5 = EVP_get_digestbyname("ssl3-md5");
     if (!sfilter->rsa_md5) {
@@ -2648,6 +3501,7 @@ gensio_certauth_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->sk_ca = sk_ca;
     sfilter->pkey = pkey;
     sfilter->verify_store = store;
+    sfilter->vstore = vstore;
 
     *rfilter = sfilter->filter;
     return 0;
@@ -2686,6 +3540,10 @@ gensio_certauth_filter_config_free(struct gensio_certauth_filter_data *data)
 	o->free(o, data->username);
     if (data->service)
 	o->free(o, data->service);
+    if (data->vstore)
+	certauth_vstore_deref(data->vstore);
+    OPENSSL_cleanse(data->resume_secret, sizeof(data->resume_secret));
+    o->free_lock(data->lock);
     o->free(o, data);
 }
 
@@ -2705,6 +3563,11 @@ gensio_certauth_filter_config(struct gensio_pparm_info *p,
     if (!data)
 	return GE_NOMEM;
     data->o = o;
+    data->lock = o->alloc_lock(o);
+    if (!data->lock) {
+	o->free(o, data);
+	return GE_NOMEM;
+    }
     data->is_client = default_is_client;
 
     rv = gensio_get_default(o, "certauth", "allow-authfail", false,
@@ -2818,6 +3681,18 @@ gensio_certauth_filter_config(struct gensio_pparm_info *p,
 	if (gensio_pparm_time(p, args[i], "con-timeout", 's',
 			      &data->con_timeout) > 0)
 	    continue;
+	if (gensio_pparm_time(p, args[i], "verify-cache-time", 's',
+			      &data->verify_cache_time) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "pipeline",
+			      &data->pipeline) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "resume",
+			      &data->resume) > 0)
+	    continue;
+	if (gensio_pparm_time(p, args[i], "resume-time", 's',
+			      &data->resume_time) > 0)
+	    continue;
 	if (gensio_pparm_bool(p, args[i], "allow-unencrypted",
 			      &data->allow_unencrypted) > 0)
 	    continue;
@@ -2906,6 +3781,13 @@ gensio_certauth_filter_config(struct gensio_pparm_info *p,
 	    rv = GE_INVAL;
 	    goto out_err;
 	}
+	if (!gensio_time_is_zero(data->resume_time)) {
+	    gensio_pparm_slog(p, "resume-time is not valid for clients");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+	if (data->resume)
+	    certauth_token_initialize(o);
     } else {
 	if (data->keyfile) {
 	    gensio_pparm_slog(p, "key is not valid for servers");
@@ -2922,6 +3804,18 @@ gensio_certauth_filter_config(struct gensio_pparm_info *p,
 	    rv = GE_INVAL;
 	    goto out_err;
 	}
+	if (data->pipeline || data->resume) {
+	    gensio_pparm_slog(p, "pipeline and resume are not valid for servers");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+	if (!gensio_time_is_zero(data->resume_time) &&
+		RAND_bytes(data->resume_secret,
+			   sizeof(data->resume_secret)) != 1) {
+	    gensio_pparm_slog(p, "Unable to get random data for resume-time");
+	    rv = GE_IOERR;
+	    goto out_err;
+	}
     }
 
     *rdata = data;
@@ -3038,29 +3932,24 @@ gensio_certauth_filter_alloc(struct gensio_certauth_filter_data *data,
     struct gensio_os_funcs *o = data->o;
     struct gensio_filter *filter;
     X509_STORE *store = NULL;
+    struct certauth_vstore *vstore = NULL;
     X509 *cert = NULL;
     EVP_PKEY *pkey = NULL;
     STACK_OF(X509) *sk_ca = NULL;
-    int rv = GE_INVAL;
-
-    store = X509_STORE_new();
-    if (!store) {
-	rv = GE_NOMEM;
-	goto err;
-    }
-
-    if (data->CAfilepath && data->CAfilepath[0]) {
-	char *CAfile = NULL, *CApath = NULL;
+    int rv = 0;
 
-	if (data->CAfilepath[strlen(data->CAfilepath) - 1] == DIRSEP)
-	    CApath = data->CAfilepath;
-	else
-	    CAfile = data->CAfilepath;
-	if (!X509_STORE_load_locations(store, CAfile, CApath)) {
-	    rv = GE_CERTNOTFOUND;
-	    goto err;
-	}
+    o->lock(data->lock);
+    if (!data->vstore)
+	rv = certauth_vstore_alloc(data, &data->vstore);
+    if (!rv) {
+	vstore = data->vstore;
+	certauth_vstore_ref(vstore);
+	store = vstore->store;
+	X509_STORE_up_ref(store);
     }
+    o->unlock(data->lock);
+    if (rv)
+	return rv;
 
     if (data->certfile && data->certfile[0]) {
 	rv = read_certificate_chain(data->certfile, &cert, &sk_ca);
@@ -3071,7 +3960,7 @@ gensio_certauth_filter_alloc(struct gensio_certauth_filter_data *data,
 	    goto err;
     }
 
-    rv = gensio_certauth_filter_raw_alloc(o, data->is_client, store,
+    rv = gensio_certauth_filter_raw_alloc(o, data->is_client, store, vstore,
 					  cert, sk_ca, pkey,
 					  data->username, data->password,
 					  data->val_2fa, data->len_2fa,
@@ -3080,6 +3969,9 @@ gensio_certauth_filter_alloc(struct gensio_certauth_filter_data *data,
 					  data->use_child_auth,
 					  data->enable_password,
 					  data->do_2fa, data->con_timeout,
+					  data->pipeline, data->resume,
+					  data->resume_time,
+					  data->resume_secret,
 					  &filter);
     if (rv)
 	goto err;
@@ -3094,7 +3986,31 @@ gensio_certauth_filter_alloc(struct gensio_certauth_filter_data *data,
 	X509_free(cert);
     if (pkey)
 	EVP_PKEY_free(pkey);
-    if (store)
-	X509_STORE_free(store);
+    X509_STORE_free(store);
+    certauth_vstore_deref(vstore);
     return rv;
 }
+
+int
+gensio_certauth_filter_reload(struct gensio_certauth_filter_data *data)
+{
+    struct gensio_os_funcs *o = data->o;
+    struct certauth_vstore *vstore, *oldvstore;
+    int rv;
+
+    rv = certauth_vstore_alloc(data, &vstore);
+    if (rv)
+	return rv;
+
+    /*
+     * Filters that are already running keep the old store and cache,
+     * only new ones get the new one.
+     */
+    o->lock(data->lock);
+    oldvstore = data->vstore;
+    data->vstore = vstore;
+    o->unlock(data->lock);
+    if (oldvstore)
+	certauth_vstore_deref(oldvstore);
+    return 0;
+}
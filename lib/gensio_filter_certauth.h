@@ -31,4 +31,10 @@ bool gensio_certauth_filter_config_is_client(
 int gensio_certauth_filter_alloc(struct gensio_certauth_filter_data *data,
 				 struct gensio_filter **rfilter);
 
+/*
+ * Re-read the CA and throw away the verify cache.  Filters allocated
+ * after this use the new store, existing filters are not affected.
+ */
+int gensio_certauth_filter_reload(struct gensio_certauth_filter_data *data);
+
 #endif /* GENSIO_FILTER_CERTAUTH_H */
@@ -0,0 +1,701 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A filter made of an ordered list of other filters, so one base
+ * gensio can run several filter layers with one lock, one state
+ * machine and one deferred op runner.  Member 0 is the top (next to
+ * the user), the last member is next to the ll.
+ *
+ * Writes go into member 0 and its output handler feeds member 1 and
+ * so on down to the base's handler.  Reads go the other way.  When
+ * the base just wants pending data pushed (no data given), every
+ * member is pushed, the ones nearest the destination first so they
+ * make room for the ones behind them.
+ *
+ * Members connect from the bottom up, so a filter only starts its
+ * handshake over a lower filter that has finished its own, and
+ * disconnect from the top down.  The base has one timer, the chain
+ * keeps a deadline for each member that asks for a timer and runs the
+ * base timer for the earliest one.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+
+#include "gensio_filter_chain.h"
+
+struct chain_member {
+    struct chain_filter *cfilter;
+    struct gensio_filter *filter;
+    bool timer_set;
+    gensio_time deadline;
+};
+
+struct chain_filter {
+    struct gensio_filter *filter;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock; /* Protects the timer deadlines. */
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    unsigned int nr_connected;	  /* Members connected, from the bottom. */
+    unsigned int nr_disconnected; /* Members disconnected, from the top. */
+
+    unsigned int nr_members;
+    struct chain_member *members;
+};
+
+#define filter_to_chain(v) ((struct chain_filter *) \
+			    gensio_filter_get_user_data(v))
+
+static int gensio_chain_filter_func(struct gensio_filter *filter, int op,
+				    void *func, void *data,
+				    gensiods *count,
+				    void *buf, const void *cbuf,
+				    gensiods buflen,
+				    const char *const *auxdata);
+
+static int64_t
+chain_time_ns(const gensio_time *t)
+{
+    return t->secs * 1000000000LL + t->nsecs;
+}
+
+/*
+ * Start the base timer for the earliest member deadline, or stop it
+ * if there are none.  Call with the chain lock held.
+ */
+static void
+chain_resched_timer(struct chain_filter *cfilter)
+{
+    gensio_time now, timeout;
+    int64_t first = 0, v;
+    bool found = false;
+    unsigned int i;
+
+    for (i = 0; i < cfilter->nr_members; i++) {
+	if (!cfilter->members[i].timer_set)
+	    continue;
+	v = chain_time_ns(&cfilter->members[i].deadline);
+	if (!found || v < first)
+	    first = v;
+	found = true;
+    }
+    if (!found) {
+	cfilter->filter_cb(cfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_STOP_TIMER, NULL);
+	return;
+    }
+    cfilter->o->get_monotonic_time(cfilter->o, &now);
+    v = first - chain_time_ns(&now);
+    if (v < 0)
+	v = 0;
+    timeout.secs = v / 1000000000;
+    timeout.nsecs = v % 1000000000;
+    cfilter->filter_cb(cfilter->filter_cb_data, GENSIO_FILTER_CB_START_TIMER,
+		       &timeout);
+}
+
+static int
+chain_member_cb(void *cb_data, int func, void *data)
+{
+    struct chain_member *m = cb_data;
+    struct chain_filter *cfilter = m->cfilter;
+    gensio_time *timeout = data;
+    int64_t v;
+
+    switch (func) {
+    case GENSIO_FILTER_CB_START_TIMER:
+	cfilter->o->lock(cfilter->lock);
+	cfilter->o->get_monotonic_time(cfilter->o, &m->deadline);
+	v = chain_time_ns(&m->deadline) + chain_time_ns(timeout);
+	m->deadline.secs = v / 1000000000;
+	m->deadline.nsecs = v % 1000000000;
+	m->timer_set = true;
+	chain_resched_timer(cfilter);
+	cfilter->o->unlock(cfilter->lock);
+	return 0;
+
+    case GENSIO_FILTER_CB_STOP_TIMER:
+	cfilter->o->lock(cfilter->lock);
+	if (m->timer_set) {
+	    m->timer_set = false;
+	    chain_resched_timer(cfilter);
+	}
+	cfilter->o->unlock(cfilter->lock);
+	return 0;
+
+    default:
+	return cfilter->filter_cb(cfilter->filter_cb_data, func, data);
+    }
+}
+
+static void
+chain_set_callbacks(struct chain_filter *cfilter,
+		    gensio_filter_cb cb, void *cb_data)
+{
+    unsigned int i;
+
+    cfilter->filter_cb = cb;
+    cfilter->filter_cb_data = cb_data;
+    for (i = 0; i < cfilter->nr_members; i++)
+	gensio_filter_set_callback(cfilter->members[i].filter,
+				   chain_member_cb, &cfilter->members[i]);
+}
+
+static bool
+chain_ul_read_pending(struct chain_filter *cfilter)
+{
+    unsigned int i;
+
+    for (i = 0; i < cfilter->nr_members; i++) {
+	if (gensio_filter_ul_read_pending(cfilter->members[i].filter))
+	    return true;
+    }
+    return false;
+}
+
+static bool
+chain_ll_write_pending(struct chain_filter *cfilter)
+{
+    unsigned int i;
+
+    for (i = 0; i < cfilter->nr_members; i++) {
+	if (gensio_filter_ll_write_pending(cfilter->members[i].filter))
+	    return true;
+    }
+    return false;
+}
+
+static bool
+chain_ll_read_needed(struct chain_filter *cfilter)
+{
+    unsigned int i;
+
+    for (i = 0; i < cfilter->nr_members; i++) {
+	if (gensio_filter_ll_read_needed(cfilter->members[i].filter))
+	    return true;
+    }
+    return false;
+}
+
+static int
+chain_ul_can_write(struct chain_filter *cfilter, bool *rv)
+{
+    unsigned int i;
+
+    *rv = true;
+    for (i = 0; *rv && i < cfilter->nr_members; i++)
+	*rv = gensio_filter_ul_can_write(cfilter->members[i].filter);
+    return 0;
+}
+
+static int
+chain_ll_write_queued(struct chain_filter *cfilter, bool *rv)
+{
+    unsigned int i;
+
+    *rv = false;
+    for (i = 0; !*rv && i < cfilter->nr_members; i++)
+	*rv = gensio_filter_ll_write_queued(cfilter->members[i].filter);
+    return 0;
+}
+
+static int
+chain_ll_can_read(struct chain_filter *cfilter, bool *rv)
+{
+    unsigned int i;
+
+    *rv = true;
+    for (i = 0; *rv && i < cfilter->nr_members; i++)
+	*rv = gensio_filter_ll_can_read(cfilter->members[i].filter);
+    return 0;
+}
+
+/* The lowest filter checks first, it is the first one that connected. */
+static int
+chain_check_open_done(struct chain_filter *cfilter, struct gensio *io)
+{
+    unsigned int i;
+    int rv;
+
+    for (i = cfilter->nr_members; i > 0; i--) {
+	rv = gensio_filter_check_open_done(cfilter->members[i - 1].filter, io);
+	if (rv)
+	    return rv;
+    }
+    return 0;
+}
+
+static int
+chain_try_connect(struct chain_filter *cfilter, gensio_time *timeout,
+		  bool was_timeout)
+{
+    struct gensio_filter *f;
+    int rv;
+
+    while (cfilter->nr_connected < cfilter->nr_members) {
+	f = cfilter->members[cfilter->nr_members - 1
+			     - cfilter->nr_connected].filter;
+	rv = gensio_filter_try_connect(f, timeout, was_timeout);
+	if (rv)
+	    return rv;
+	cfilter->nr_connected++;
+	/* The timeout was for the member that just finished. */
+	was_timeout = false;
+    }
+    return 0;
+}
+
+static int
+chain_try_disconnect(struct chain_filter *cfilter, gensio_time *timeout,
+		     bool was_timeout)
+{
+    struct gensio_filter *f;
+    int rv;
+
+    while (cfilter->nr_disconnected < cfilter->nr_members) {
+	f = cfilter->members[cfilter->nr_disconnected].filter;
+	rv = gensio_filter_try_disconnect(f, timeout, was_timeout);
+	if (rv)
+	    return rv;
+	cfilter->nr_disconnected++;
+	was_timeout = false;
+    }
+    return 0;
+}
+
+/*
+ * Passing data down, what a member outputs goes into the member below
+ * it, the last member's output goes to the base's handler.
+ */
+struct chain_ul_hop {
+    struct chain_filter *cfilter;
+    unsigned int level;
+    gensio_ul_filter_data_handler handler;
+    void *cb_data;
+};
+
+static int chain_ul_level_write(struct chain_filter *cfilter,
+				unsigned int level,
+				gensio_ul_filter_data_handler handler,
+				void *cb_data, gensiods *rcount,
+				const struct gensio_sg *sg, gensiods sglen,
+				const char *const *auxdata);
+
+static int
+chain_ul_handler(void *cb_data, gensiods *rcount,
+		 const struct gensio_sg *sg, gensiods sglen,
+		 const char *const *auxdata)
+{
+    struct chain_ul_hop *hop = cb_data;
+
+    return chain_ul_level_write(hop->cfilter, hop->level, hop->handler,
+				hop->cb_data, rcount, sg, sglen, auxdata);
+}
+
+static int
+chain_ul_level_write(struct chain_filter *cfilter, unsigned int level,
+		     gensio_ul_filter_data_handler handler, void *cb_data,
+		     gensiods *rcount,
+		     const struct gensio_sg *sg, gensiods sglen,
+		     const char *const *auxdata)
+{
+    struct chain_ul_hop hop;
+
+    if (level >= cfilter->nr_members)
+	return handler(cb_data, rcount, sg, sglen, auxdata);
+
+    hop.cfilter = cfilter;
+    hop.level = level + 1;
+    hop.handler = handler;
+    hop.cb_data = cb_data;
+    return gensio_filter_ul_write(cfilter->members[level].filter,
+				  chain_ul_handler, &hop, rcount,
+				  sg, sglen, auxdata);
+}
+
+static int
+chain_ul_write(struct chain_filter *cfilter,
+	       gensio_ul_filter_data_handler handler, void *cb_data,
+	       gensiods *rcount,
+	       const struct gensio_sg *sg, gensiods sglen,
+	       const char *const *auxdata)
+{
+    unsigned int i;
+    int rv;
+
+    /* Push anything pending in the lower members first to make room. */
+    for (i = cfilter->nr_members - 1; i > 0; i--) {
+	rv = chain_ul_level_write(cfilter, i, handler, cb_data, NULL,
+				  NULL, 0, NULL);
+	if (rv)
+	    return rv;
+    }
+    return chain_ul_level_write(cfilter, 0, handler, cb_data, rcount,
+				sg, sglen, auxdata);
+}
+
+/*
+ * Passing data up, what a member outputs goes into the member above
+ * it, the first member's output goes to the base's handler.
+ */
+struct chain_ll_hop {
+    struct chain_filter *cfilter;
+    unsigned int level; /* One more than the member to write to. */
+    gensio_ll_filter_data_handler handler;
+    void *cb_data;
+};
+
+static int chain_ll_level_write(struct chain_filter *cfilter,
+				unsigned int level,
+				gensio_ll_filter_data_handler handler,
+				void *cb_data, gensiods *rcount,
+				unsigned char *buf, gensiods buflen,
+				const char *const *auxdata);
+
+static int
+chain_ll_handler(void *cb_data, gensiods *rcount,
+		 unsigned char *buf, gensiods buflen,
+		 const char *const *auxdata)
+{
+    struct chain_ll_hop *hop = cb_data;
+
+    return chain_ll_level_write(hop->cfilter, hop->level, hop->handler,
+				hop->cb_data, rcount, buf, buflen, auxdata);
+}
+
+static int
+chain_ll_level_write(struct chain_filter *cfilter, unsigned int level,
+		     gensio_ll_filter_data_handler handler, void *cb_data,
+		     gensiods *rcount,
+		     unsigned char *buf, gensiods buflen,
+		     const char *const *auxdata)
+{
+    struct chain_ll_hop hop;
+
+    if (level == 0)
+	return handler(cb_data, rcount, buf, buflen, auxdata);
+
+    hop.cfilter = cfilter;
+    hop.level = level - 1;
+    hop.handler = handler;
+    hop.cb_data = cb_data;
+    return gensio_filter_ll_write(cfilter->members[level - 1].filter,
+				  chain_ll_handler, &hop, rcount,
+				  buf, buflen, auxdata);
+}
+
+static int
+chain_ll_write(struct chain_filter *cfilter,
+	       gensio_ll_filter_data_handler handler, void *cb_data,
+	       gensiods *rcount,
+	       unsigned char *buf, gensiods buflen,
+	       const char *const *auxdata)
+{
+    unsigned int i;
+    int rv;
+
+    /* Deliver anything pending in the upper members first. */
+    for (i = 1; i < cfilter->nr_members; i++) {
+	rv = chain_ll_level_write(cfilter, i, handler, cb_data, NULL,
+				  NULL, 0, NULL);
+	if (rv)
+	    return rv;
+    }
+    return chain_ll_level_write(cfilter, cfilter->nr_members, handler,
+				cb_data, rcount, buf, buflen, auxdata);
+}
+
+static int
+chain_timeout(struct chain_filter *cfilter)
+{
+    struct chain_member *m;
+    gensio_time now;
+    unsigned int i;
+    int rv = 0;
+
+    cfilter->o->get_monotonic_time(cfilter->o, &now);
+    for (i = 0; !rv && i < cfilter->nr_members; i++) {
+	m = &cfilter->members[i];
+	cfilter->o->lock(cfilter->lock);
+	if (!m->timer_set ||
+		chain_time_ns(&m->deadline) > chain_time_ns(&now)) {
+	    cfilter->o->unlock(cfilter->lock);
+	    continue;
+	}
+	m->timer_set = false;
+	cfilter->o->unlock(cfilter->lock);
+	rv = gensio_filter_timeout(m->filter);
+    }
+
+    cfilter->o->lock(cfilter->lock);
+    chain_resched_timer(cfilter);
+    cfilter->o->unlock(cfilter->lock);
+    return rv;
+}
+
+static int
+chain_setup(struct chain_filter *cfilter, struct gensio *io)
+{
+    unsigned int i;
+    int rv;
+
+    for (i = 0; i < cfilter->nr_members; i++) {
+	rv = gensio_filter_setup(cfilter->members[i].filter, io);
+	if (rv)
+	    return rv;
+    }
+    return 0;
+}
+
+static void
+chain_cleanup(struct chain_filter *cfilter)
+{
+    unsigned int i;
+
+    cfilter->nr_connected = 0;
+    cfilter->nr_disconnected = 0;
+    for (i = 0; i < cfilter->nr_members; i++) {
+	cfilter->members[i].timer_set = false;
+	gensio_filter_cleanup(cfilter->members[i].filter);
+    }
+}
+
+static void
+chain_io_err(struct chain_filter *cfilter, int err)
+{
+    unsigned int i;
+
+    for (i = 0; i < cfilter->nr_members; i++)
+	gensio_filter_io_err(cfilter->members[i].filter, err);
+}
+
+static void
+chain_free(struct chain_filter *cfilter)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+    unsigned int i;
+
+    for (i = 0; i < cfilter->nr_members; i++)
+	gensio_filter_free(cfilter->members[i].filter);
+    if (cfilter->members)
+	o->free(o, cfilter->members);
+    if (cfilter->lock)
+	o->free_lock(cfilter->lock);
+    if (cfilter->filter)
+	gensio_filter_free_data(cfilter->filter);
+    o->free(o, cfilter);
+}
+
+/*
+ * GENSIO_CONTROL_MEM is the sum of all the members, and a compact
+ * goes to all of them.  Anything else goes to the first member from
+ * the top that handles it.
+ */
+static int
+chain_control(struct chain_filter *cfilter, bool get, unsigned int option,
+	      char *data, gensiods *datalen)
+{
+    char buf[30];
+    gensiods len, size = 0;
+    unsigned int i;
+    int rv;
+
+    if (option == GENSIO_CONTROL_MEM) {
+	for (i = 0; i < cfilter->nr_members; i++) {
+	    if (!get) {
+		gensio_filter_control(cfilter->members[i].filter, false,
+				      option, data, datalen);
+		continue;
+	    }
+	    len = sizeof(buf);
+	    rv = gensio_filter_control(cfilter->members[i].filter, true,
+				       option, buf, &len);
+	    if (!rv)
+		size += strtoul(buf, NULL, 0);
+	}
+	if (get)
+	    *datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+	return 0;
+    }
+
+    for (i = 0; i < cfilter->nr_members; i++) {
+	rv = gensio_filter_control(cfilter->members[i].filter, get, option,
+				   data, datalen);
+	if (rv != GE_NOTSUP)
+	    return rv;
+    }
+    return GE_NOTSUP;
+}
+
+static int
+gensio_chain_filter_func(struct gensio_filter *filter, int op,
+			 void *func, void *data,
+			 gensiods *count,
+			 void *buf, const void *cbuf,
+			 gensiods buflen,
+			 const char *const *auxdata)
+{
+    struct chain_filter *cfilter = filter_to_chain(filter);
+
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	chain_set_callbacks(cfilter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return chain_ul_read_pending(cfilter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return chain_ll_write_pending(cfilter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return chain_ll_read_needed(cfilter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return chain_check_open_done(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return chain_try_connect(cfilter, data, buflen);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return chain_try_disconnect(cfilter, data, buflen);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return chain_ul_write(cfilter, func, data, count, cbuf, buflen,
+			      auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return chain_ll_write(cfilter, func, data, count, buf, buflen,
+			      auxdata);
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+	return chain_timeout(cfilter);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return chain_setup(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	chain_cleanup(cfilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	chain_free(cfilter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return chain_control(cfilter, *((bool *) cbuf), buflen, data, count);
+
+    case GENSIO_FILTER_FUNC_UL_CAN_WRITE:
+	return chain_ul_can_write(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_QUEUED:
+	return chain_ll_write_queued(cfilter, data);
+
+    case GENSIO_FILTER_FUNC_IO_ERR:
+	chain_io_err(cfilter, *((int *) data));
+	return 0;
+
+    case GENSIO_FILTER_FUNC_LL_CAN_READ:
+	return chain_ll_can_read(cfilter, data);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+bool
+gensio_filter_is_chain(struct gensio_filter *filter)
+{
+    return gensio_filter_get_func(filter) == gensio_chain_filter_func;
+}
+
+int
+gensio_filter_chain_alloc(struct gensio_os_funcs *o,
+			  struct gensio_filter *top,
+			  struct gensio_filter *bottom,
+			  struct gensio_filter **rfilter)
+{
+    struct chain_filter *cfilter, *tc = NULL, *bc = NULL;
+    unsigned int i, n = 0, ntop = 1, nbottom = 1;
+
+    if (gensio_filter_is_chain(top)) {
+	tc = filter_to_chain(top);
+	ntop = tc->nr_members;
+    }
+    if (gensio_filter_is_chain(bottom)) {
+	bc = filter_to_chain(bottom);
+	nbottom = bc->nr_members;
+    }
+
+    cfilter = o->zalloc(o, sizeof(*cfilter));
+    if (!cfilter)
+	return GE_NOMEM;
+    cfilter->o = o;
+
+    cfilter->members = o->zalloc(o, sizeof(*cfilter->members) *
+				 (ntop + nbottom));
+    if (!cfilter->members)
+	goto out_nomem;
+
+    cfilter->lock = o->alloc_lock(o);
+    if (!cfilter->lock)
+	goto out_nomem;
+
+    cfilter->filter = gensio_filter_alloc_data(o, gensio_chain_filter_func,
+					       cfilter);
+    if (!cfilter->filter)
+	goto out_nomem;
+
+    /* Nothing can fail from here, take the members. */
+    for (i = 0; i < ntop; i++)
+	cfilter->members[n++].filter = tc ? tc->members[i].filter : top;
+    for (i = 0; i < nbottom; i++)
+	cfilter->members[n++].filter = bc ? bc->members[i].filter : bottom;
+    cfilter->nr_members = n;
+    for (i = 0; i < n; i++)
+	cfilter->members[i].cfilter = cfilter;
+
+    /* The old chains are just shells now. */
+    if (tc) {
+	tc->nr_members = 0;
+	chain_free(tc);
+    }
+    if (bc) {
+	bc->nr_members = 0;
+	chain_free(bc);
+    }
+
+    *rfilter = cfilter->filter;
+    return 0;
+
+ out_nomem:
+    cfilter->nr_members = 0;
+    chain_free(cfilter);
+    return GE_NOMEM;
+}
+
+unsigned int
+gensio_filter_chain_nr_members(struct gensio_filter *filter)
+{
+    return filter_to_chain(filter)->nr_members;
+}
+
+struct gensio_filter *
+gensio_filter_chain_member(struct gensio_filter *filter, unsigned int i)
+{
+    return filter_to_chain(filter)->members[i].filter;
+}
@@ -0,0 +1,33 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIO_FILTER_CHAIN_H
+#define GENSIO_FILTER_CHAIN_H
+
+#include <gensio/gensio_base.h>
+
+/*
+ * Allocate a filter that runs top over bottom.  If either is already
+ * a chain its members are taken and the old chain is freed, so chains
+ * never nest.  On success the chain owns the filters, on failure
+ * nothing is changed.  The chain's members keep their own
+ * gensio_filter, the base gensio must point them at itself.
+ */
+int gensio_filter_chain_alloc(struct gensio_os_funcs *o,
+			      struct gensio_filter *top,
+			      struct gensio_filter *bottom,
+			      struct gensio_filter **rfilter);
+
+bool gensio_filter_is_chain(struct gensio_filter *filter);
+unsigned int gensio_filter_chain_nr_members(struct gensio_filter *filter);
+struct gensio_filter *gensio_filter_chain_member(struct gensio_filter *filter,
+						 unsigned int i);
+
+/* From gensio_base.c. */
+gensio_filter_func gensio_filter_get_func(struct gensio_filter *filter);
+
+#endif /* GENSIO_FILTER_CHAIN_H */
@@ -0,0 +1,745 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <zlib.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_time.h>
+
+#include "gensio_filter_compress.h"
+
+/*
+ * The protocol is simple.  On connect each side sends a 4 byte
+ * header: 'g', 'z', the version, and a mask of the algorithms it is
+ * willing to use.  Both sides pick the highest bit that is in both
+ * masks, so they always agree.  After that each direction is a single
+ * compressed stream, each user write is compressed and flushed
+ * (Z_SYNC_FLUSH for deflate) so the other end can decode it
+ * immediately.  The compressor's history carries over between
+ * writes, so later writes are compressed against everything sent
+ * before them.
+ *
+ * New algorithms can be added with new mask bits, an old
+ * implementation will just not offer them.
+ */
+#define COMPRESS_HDR_LEN	4
+#define COMPRESS_VERSION	1
+
+#define COMPRESS_ALG_NONE	(1 << 0)
+#define COMPRESS_ALG_DEFLATE	(1 << 1)
+#define COMPRESS_ALG_ALL	(COMPRESS_ALG_NONE | COMPRESS_ALG_DEFLATE)
+
+#define COMPRESS_DEFAULT_BUFSIZE 16384
+
+/*
+ * Adaptive level selection looks at the writes done in a window of
+ * this many bytes (or this much time, for slow writers).  If
+ * compression took more than half of the elapsed time, the CPU is
+ * the bottleneck and the level is lowered.  If the link was backed
+ * up and compression took less than an eighth of the time, the link
+ * is the bottleneck and the level is raised.
+ */
+#define COMPRESS_ADAPT_BYTES	65536
+#define COMPRESS_ADAPT_NSECS	GENSIO_NSECS_IN_SEC
+
+enum compress_state {
+    COMPRESS_CLOSED,
+    COMPRESS_IN_OPEN,
+    COMPRESS_OPEN,
+    COMPRESS_OPEN_FAIL
+};
+
+struct compress_filter {
+    struct gensio_filter *filter;
+
+    struct gensio_os_funcs *o;
+
+    struct gensio_lock *lock;
+
+    enum compress_state state;
+    int err;
+
+    unsigned char algs; /* Algorithms we offer. */
+    unsigned char alg; /* Algorithm negotiated. */
+    unsigned char hdr_in[COMPRESS_HDR_LEN];
+    unsigned int hdr_in_len;
+
+    z_stream zout;
+    bool zout_init;
+    /* deflate has output it couldn't fit in wbuf, finish the flush. */
+    bool zout_flush_pending;
+
+    z_stream zin;
+    bool zin_init;
+    /* inflate may have more output than fit in rbuf. */
+    bool zin_more;
+
+    /* Data waiting to be written to the lower layer. */
+    gensiods bufsize;
+    unsigned char *wbuf;
+    gensiods wbuf_len;
+
+    /* Decompressed data waiting to be delivered to the user. */
+    unsigned char *rbuf;
+    gensiods rbuf_pos;
+    gensiods rbuf_len;
+
+    int level;
+    int min_level;
+    int max_level;
+    bool adaptive;
+
+    /* Adaptive level statistics for the current window. */
+    gensiods adapt_in;
+    int64_t adapt_cpu_ns;
+    gensio_time adapt_start;
+    bool adapt_backlog;
+
+    /* User bytes written and bytes handed to the lower layer. */
+    uint64_t tx_in;
+    uint64_t tx_out;
+};
+
+#define filter_to_compress(v) ((struct compress_filter *) \
+			       gensio_filter_get_user_data(v))
+
+static void
+compress_lock(struct compress_filter *cfilter)
+{
+    cfilter->o->lock(cfilter->lock);
+}
+
+static void
+compress_unlock(struct compress_filter *cfilter)
+{
+    cfilter->o->unlock(cfilter->lock);
+}
+
+static voidpf
+compress_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    struct gensio_os_funcs *o = opaque;
+
+    return o->zalloc(o, (gensiods) items * size);
+}
+
+static void
+compress_zfree(voidpf opaque, voidpf address)
+{
+    struct gensio_os_funcs *o = opaque;
+
+    o->free(o, address);
+}
+
+static bool
+compress_ul_read_pending(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    return cfilter->rbuf_len > 0 || cfilter->zin_more;
+}
+
+static bool
+compress_ll_write_pending(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    return cfilter->wbuf_len > 0 || cfilter->zout_flush_pending;
+}
+
+static bool
+compress_ll_read_needed(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    return (cfilter->state == COMPRESS_IN_OPEN &&
+	    cfilter->hdr_in_len < COMPRESS_HDR_LEN);
+}
+
+static int
+compress_check_open_done(struct gensio_filter *filter, struct gensio *io)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    return cfilter->err;
+}
+
+static int
+compress_try_connect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    int err = GE_INPROGRESS;
+
+    compress_lock(cfilter);
+    switch (cfilter->state) {
+    case COMPRESS_CLOSED:
+	cfilter->wbuf[0] = 'g';
+	cfilter->wbuf[1] = 'z';
+	cfilter->wbuf[2] = COMPRESS_VERSION;
+	cfilter->wbuf[3] = cfilter->algs;
+	cfilter->wbuf_len = COMPRESS_HDR_LEN;
+	cfilter->state = COMPRESS_IN_OPEN;
+	break;
+
+    case COMPRESS_IN_OPEN:
+	if (cfilter->hdr_in_len == COMPRESS_HDR_LEN &&
+		cfilter->wbuf_len == 0) {
+	    cfilter->state = COMPRESS_OPEN;
+	    cfilter->o->get_monotonic_time(cfilter->o, &cfilter->adapt_start);
+	    err = 0;
+	}
+	break;
+
+    case COMPRESS_OPEN:
+    case COMPRESS_OPEN_FAIL:
+	err = 0;
+	break;
+    }
+    compress_unlock(cfilter);
+
+    return err;
+}
+
+static int
+compress_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    if (cfilter->state == COMPRESS_OPEN &&
+	    (cfilter->wbuf_len > 0 || cfilter->zout_flush_pending))
+	return GE_INPROGRESS;
+    return 0;
+}
+
+/*
+ * Adjust the compression level based upon the last window of writes,
+ * see COMPRESS_ADAPT_BYTES.  Only called right after a complete
+ * flush, so changing the level won't generate any output.
+ */
+static void
+compress_adapt(struct compress_filter *cfilter)
+{
+    gensio_time now;
+    int64_t elapsed;
+    int level = cfilter->level;
+
+    cfilter->o->get_monotonic_time(cfilter->o, &now);
+    elapsed = gensio_time_diff_nsecs(&now, &cfilter->adapt_start);
+    if (cfilter->adapt_in < COMPRESS_ADAPT_BYTES &&
+		elapsed < COMPRESS_ADAPT_NSECS)
+	return;
+
+    if (cfilter->adapt_cpu_ns * 2 > elapsed) {
+	if (level > cfilter->min_level)
+	    level--;
+    } else if (cfilter->adapt_backlog && cfilter->adapt_cpu_ns * 8 < elapsed) {
+	if (level < cfilter->max_level)
+	    level++;
+    }
+
+    if (level != cfilter->level) {
+	cfilter->zout.next_in = NULL;
+	cfilter->zout.avail_in = 0;
+	cfilter->zout.next_out = cfilter->wbuf + cfilter->wbuf_len;
+	cfilter->zout.avail_out = cfilter->bufsize - cfilter->wbuf_len;
+	if (deflateParams(&cfilter->zout, level, Z_DEFAULT_STRATEGY) == Z_OK) {
+	    cfilter->level = level;
+	    cfilter->wbuf_len = cfilter->bufsize - cfilter->zout.avail_out;
+	}
+    }
+
+    cfilter->adapt_start = now;
+    cfilter->adapt_in = 0;
+    cfilter->adapt_cpu_ns = 0;
+    cfilter->adapt_backlog = false;
+}
+
+/*
+ * Compress as much of the user data as will fit into wbuf.  Returns
+ * the number of user bytes consumed.
+ */
+static gensiods
+compress_data(struct compress_filter *cfilter,
+	      const struct gensio_sg *sg, gensiods sglen)
+{
+    z_stream *z = &cfilter->zout;
+    gensiods i, used = 0;
+    gensio_time start, end;
+    int flush = Z_SYNC_FLUSH;
+
+    if (cfilter->adaptive)
+	cfilter->o->get_monotonic_time(cfilter->o, &start);
+
+    z->next_out = cfilter->wbuf + cfilter->wbuf_len;
+    z->avail_out = cfilter->bufsize - cfilter->wbuf_len;
+    if (cfilter->zout_flush_pending) {
+	/* Finish the previous flush before taking anything new. */
+	z->next_in = NULL;
+	z->avail_in = 0;
+	deflate(z, Z_SYNC_FLUSH);
+	sglen = 0;
+    }
+    for (i = 0; i < sglen && z->avail_out > 0; i++) {
+	z->next_in = (Bytef *) sg[i].buf;
+	z->avail_in = sg[i].buflen;
+	flush = i == sglen - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+	deflate(z, flush);
+	used += sg[i].buflen - z->avail_in;
+	if (z->avail_in > 0)
+	    break;
+    }
+    /*
+     * If deflate ran out of output space, or we stopped before the
+     * flush, the data isn't all out, finish it later.
+     */
+    cfilter->zout_flush_pending = z->avail_out == 0 || flush != Z_SYNC_FLUSH
+	|| (sglen > 0 && i < sglen);
+    cfilter->wbuf_len = cfilter->bufsize - z->avail_out;
+
+    if (cfilter->adaptive) {
+	cfilter->o->get_monotonic_time(cfilter->o, &end);
+	cfilter->adapt_cpu_ns += gensio_time_diff_nsecs(&end, &start);
+	cfilter->adapt_in += used;
+	if (!cfilter->zout_flush_pending)
+	    compress_adapt(cfilter);
+    }
+
+    return used;
+}
+
+static int
+compress_push(struct compress_filter *cfilter,
+	      gensio_ul_filter_data_handler handler, void *cb_data,
+	      const char *const *auxdata)
+{
+    struct gensio_sg osg;
+    gensiods count = 0;
+    int err;
+
+    if (cfilter->wbuf_len == 0)
+	return 0;
+
+    osg.buf = cfilter->wbuf;
+    osg.buflen = cfilter->wbuf_len;
+    err = handler(cb_data, &count, &osg, 1, auxdata);
+    if (err)
+	return err;
+    if (cfilter->state == COMPRESS_OPEN) /* Don't count the header. */
+	cfilter->tx_out += count;
+    if (count >= cfilter->wbuf_len) {
+	cfilter->wbuf_len = 0;
+    } else {
+	cfilter->wbuf_len -= count;
+	memmove(cfilter->wbuf, cfilter->wbuf + count, cfilter->wbuf_len);
+	cfilter->adapt_backlog = true;
+    }
+    return 0;
+}
+
+static int
+compress_ul_write(struct gensio_filter *filter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  const char *const *auxdata)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    gensiods used = 0;
+    int err;
+
+    compress_lock(cfilter);
+    if (cfilter->state == COMPRESS_OPEN &&
+		cfilter->alg == COMPRESS_ALG_NONE) {
+	compress_unlock(cfilter);
+	err = handler(cb_data, &used, sg, sglen, auxdata);
+	if (!err) {
+	    compress_lock(cfilter);
+	    cfilter->tx_in += used;
+	    cfilter->tx_out += used;
+	    compress_unlock(cfilter);
+	    if (rcount)
+		*rcount = used;
+	}
+	return err;
+    }
+
+    /* Get rid of what we have first, so there's room to compress. */
+    err = compress_push(cfilter, handler, cb_data, auxdata);
+    if (err)
+	goto out;
+
+    if (cfilter->state == COMPRESS_OPEN && cfilter->wbuf_len == 0 &&
+		(sglen > 0 || cfilter->zout_flush_pending)) {
+	used = compress_data(cfilter, sg, sglen);
+	cfilter->tx_in += used;
+	err = compress_push(cfilter, handler, cb_data, auxdata);
+    }
+ out:
+    compress_unlock(cfilter);
+
+    if (!err && rcount)
+	*rcount = used;
+
+    return err;
+}
+
+static int
+compress_handle_hdr(struct compress_filter *cfilter,
+		    unsigned char *buf, gensiods buflen, gensiods *used)
+{
+    gensiods count = COMPRESS_HDR_LEN - cfilter->hdr_in_len;
+    unsigned char common;
+
+    if (count > buflen)
+	count = buflen;
+    memcpy(cfilter->hdr_in + cfilter->hdr_in_len, buf, count);
+    cfilter->hdr_in_len += count;
+    *used = count;
+    if (cfilter->hdr_in_len < COMPRESS_HDR_LEN)
+	return 0;
+
+    if (cfilter->hdr_in[0] != 'g' || cfilter->hdr_in[1] != 'z' ||
+		cfilter->hdr_in[2] < COMPRESS_VERSION)
+	return GE_PROTOERR;
+    common = cfilter->hdr_in[3] & cfilter->algs;
+    if (!common)
+	return GE_PROTOERR;
+
+    /* Pick the highest common algorithm. */
+    cfilter->alg = COMPRESS_ALG_DEFLATE;
+    while (cfilter->alg && !(cfilter->alg & common))
+	cfilter->alg >>= 1;
+    return 0;
+}
+
+static int
+compress_ll_write(struct gensio_filter *filter,
+		  gensio_ll_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  unsigned char *buf, gensiods buflen,
+		  const char *const *auxdata)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    z_stream *z = &cfilter->zin;
+    gensiods count, used = 0;
+    int err = 0, rv;
+
+    compress_lock(cfilter);
+    switch (cfilter->state) {
+    case COMPRESS_IN_OPEN:
+	if (cfilter->hdr_in_len < COMPRESS_HDR_LEN) {
+	    /* Leave anything after the header for after the open. */
+	    err = compress_handle_hdr(cfilter, buf, buflen, &used);
+	    if (err) {
+		cfilter->err = err;
+		cfilter->state = COMPRESS_OPEN_FAIL;
+		used = buflen;
+		err = 0;
+	    }
+	}
+	goto out;
+
+    case COMPRESS_OPEN:
+	break;
+
+    default:
+	err = GE_NOTREADY;
+	goto out;
+    }
+
+    if (cfilter->alg == COMPRESS_ALG_NONE) {
+	compress_unlock(cfilter);
+	return handler(cb_data, rcount, buf, buflen, auxdata);
+    }
+
+    if (cfilter->rbuf_len == 0 && (buflen > 0 || cfilter->zin_more)) {
+	z->next_in = buf;
+	z->avail_in = buflen;
+	z->next_out = cfilter->rbuf;
+	z->avail_out = cfilter->bufsize;
+	rv = inflate(z, Z_SYNC_FLUSH);
+	if (rv == Z_STREAM_END || rv == Z_DATA_ERROR || rv == Z_NEED_DICT) {
+	    err = GE_PROTOERR;
+	    goto out;
+	} else if (rv == Z_MEM_ERROR) {
+	    err = GE_NOMEM;
+	    goto out;
+	}
+	used = buflen - z->avail_in;
+	cfilter->rbuf_pos = 0;
+	cfilter->rbuf_len = cfilter->bufsize - z->avail_out;
+	cfilter->zin_more = z->avail_out == 0;
+    }
+
+    if (cfilter->rbuf_len > 0) {
+	count = 0;
+	err = handler(cb_data, &count, cfilter->rbuf + cfilter->rbuf_pos,
+		      cfilter->rbuf_len, auxdata);
+	if (!err) {
+	    if (count >= cfilter->rbuf_len) {
+		cfilter->rbuf_len = 0;
+		cfilter->rbuf_pos = 0;
+	    } else {
+		cfilter->rbuf_len -= count;
+		cfilter->rbuf_pos += count;
+	    }
+	}
+    }
+ out:
+    compress_unlock(cfilter);
+
+    if (!err && rcount)
+	*rcount = used;
+
+    return err;
+}
+
+static int
+compress_setup(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    cfilter->state = COMPRESS_CLOSED;
+    cfilter->err = 0;
+    cfilter->alg = 0;
+    cfilter->hdr_in_len = 0;
+    cfilter->wbuf_len = 0;
+    cfilter->rbuf_len = 0;
+    cfilter->rbuf_pos = 0;
+    cfilter->zout_flush_pending = false;
+    cfilter->zin_more = false;
+    cfilter->adapt_in = 0;
+    cfilter->adapt_cpu_ns = 0;
+    cfilter->adapt_backlog = false;
+    cfilter->tx_in = 0;
+    cfilter->tx_out = 0;
+    if (deflateReset(&cfilter->zout) != Z_OK)
+	return GE_NOMEM;
+    if (inflateReset(&cfilter->zin) != Z_OK)
+	return GE_NOMEM;
+    return 0;
+}
+
+static void
+compress_filter_cleanup(struct gensio_filter *filter)
+{
+}
+
+static int
+compress_control(struct compress_filter *cfilter, bool get, int op,
+		 char *data, gensiods *datalen)
+{
+    int rv = 0;
+
+    switch (op) {
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	compress_lock(cfilter);
+	if (cfilter->state != COMPRESS_OPEN) {
+	    rv = GE_NOTREADY;
+	} else {
+	    *datalen = snprintf(data, *datalen,
+				"alg=%s level=%d in=%llu out=%llu",
+				cfilter->alg == COMPRESS_ALG_NONE ?
+				"none" : "deflate", cfilter->level,
+				(unsigned long long) cfilter->tx_in,
+				(unsigned long long) cfilter->tx_out);
+	}
+	compress_unlock(cfilter);
+	return rv;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+cfilter_free(struct compress_filter *cfilter)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+
+    if (cfilter->zout_init)
+	deflateEnd(&cfilter->zout);
+    if (cfilter->zin_init)
+	inflateEnd(&cfilter->zin);
+    if (cfilter->wbuf)
+	o->free(o, cfilter->wbuf);
+    if (cfilter->rbuf)
+	o->free(o, cfilter->rbuf);
+    if (cfilter->lock)
+	o->free_lock(cfilter->lock);
+    if (cfilter->filter)
+	gensio_filter_free_data(cfilter->filter);
+    o->free(o, cfilter);
+}
+
+static void
+compress_free(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    cfilter_free(cfilter);
+}
+
+static int gensio_compress_filter_func(struct gensio_filter *filter, int op,
+				       void *func, void *data,
+				       gensiods *count,
+				       void *buf, const void *cbuf,
+				       gensiods buflen,
+				       const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return compress_ul_read_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return compress_ll_write_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return compress_ll_read_needed(filter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return compress_check_open_done(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return compress_try_connect(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return compress_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return compress_ul_write(filter, func, data, count, cbuf, buflen,
+				 auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return compress_ll_write(filter, func, data, count, buf, buflen,
+				 auxdata);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return compress_setup(filter);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	compress_filter_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	compress_free(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return compress_control(filter_to_compress(filter), *((bool *) cbuf),
+				buflen, data, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_compress_filter_alloc(struct gensio_pparm_info *p,
+			     struct gensio_os_funcs *o,
+			     const char * const args[],
+			     struct gensio_filter **rfilter)
+{
+    struct compress_filter *cfilter;
+    unsigned int i;
+    int rv = GE_INVAL, level = -1, min_level = 1, max_level = 9;
+    gensiods bufsize = COMPRESS_DEFAULT_BUFSIZE;
+    bool adaptive = true, enable = true;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_int(p, args[i], "level", &level) > 0)
+	    continue;
+	if (gensio_pparm_int(p, args[i], "min-level", &min_level) > 0)
+	    continue;
+	if (gensio_pparm_int(p, args[i], "max-level", &max_level) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "adaptive", &adaptive) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "enable", &enable) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "bufsize", &bufsize) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (min_level < 1 || max_level > 9 || min_level > max_level) {
+	gensio_pparm_slog(p, "Levels must be 1-9 and min-level <= max-level");
+	return GE_INVAL;
+    }
+    if (level == -1)
+	level = adaptive ? min_level : 6;
+    if (level < min_level || level > max_level) {
+	gensio_pparm_slog(p, "level must be between min-level and max-level");
+	return GE_INVAL;
+    }
+    if (bufsize < 64) {
+	gensio_pparm_slog(p, "bufsize must be at least 64");
+	return GE_INVAL;
+    }
+
+    cfilter = o->zalloc(o, sizeof(*cfilter));
+    if (!cfilter)
+	return GE_NOMEM;
+
+    cfilter->o = o;
+    cfilter->bufsize = bufsize;
+    cfilter->level = level;
+    cfilter->min_level = min_level;
+    cfilter->max_level = max_level;
+    cfilter->adaptive = adaptive;
+    cfilter->algs = enable ? COMPRESS_ALG_ALL : COMPRESS_ALG_NONE;
+
+    rv = GE_NOMEM;
+    cfilter->wbuf = o->zalloc(o, bufsize);
+    if (!cfilter->wbuf)
+	goto out_err;
+    cfilter->rbuf = o->zalloc(o, bufsize);
+    if (!cfilter->rbuf)
+	goto out_err;
+
+    cfilter->lock = o->alloc_lock(o);
+    if (!cfilter->lock)
+	goto out_err;
+
+    /* Raw deflate, the header above takes care of identification. */
+    cfilter->zout.zalloc = compress_zalloc;
+    cfilter->zout.zfree = compress_zfree;
+    cfilter->zout.opaque = o;
+    if (deflateInit2(&cfilter->zout, level, Z_DEFLATED, -15, 8,
+		     Z_DEFAULT_STRATEGY) != Z_OK)
+	goto out_err;
+    cfilter->zout_init = true;
+
+    cfilter->zin.zalloc = compress_zalloc;
+    cfilter->zin.zfree = compress_zfree;
+    cfilter->zin.opaque = o;
+    if (inflateInit2(&cfilter->zin, -15) != Z_OK)
+	goto out_err;
+    cfilter->zin_init = true;
+
+    cfilter->filter = gensio_filter_alloc_data(o, gensio_compress_filter_func,
+					       cfilter);
+    if (!cfilter->filter)
+	goto out_err;
+
+    *rfilter = cfilter->filter;
+    return 0;
+
+ out_err:
+    cfilter_free(cfilter);
+    return rv;
+}
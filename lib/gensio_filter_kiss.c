@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <assert.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
@@ -55,6 +56,72 @@ struct kiss_filter {
     uint8_t curr_tnc;
     unsigned char startdata[320];
     unsigned char startdata_len;
+
+    /* The filter and each channel hold a ref, protected by lock. */
+    unsigned int refcount;
+    bool open;
+
+    /*
+     * Channels for TNCs, indexed by TNC number.  A TNC with an open
+     * channel has its data go to the channel, not the main gensio.
+     * If a received message is for a channel with no room, it's held
+     * in read_data and reading from below stops until the channel
+     * takes data.
+     */
+    struct kiss_chan *chans[16];
+    unsigned int nopen_chans;
+    unsigned int chan_wr_pending; /* Packets queued on all channels. */
+    uint8_t next_wr_tnc; /* Where to start looking for channel writes. */
+    bool last_wr_main; /* Take turns between the main gensio and channels. */
+};
+
+enum kiss_chan_state {
+    KISS_CHAN_CLOSED,
+    KISS_CHAN_OPEN,
+    KISS_CHAN_IN_CLOSE
+};
+
+/*
+ * A gensio for a single TNC on a kiss connection.  It has its own
+ * queues of read and write packets, so a TNC that isn't reading or
+ * has a lot to send doesn't hold up the others.
+ */
+struct kiss_chan {
+    struct gensio_os_funcs *o;
+    struct kiss_filter *kfilter;
+    struct gensio *io;
+    unsigned int refcount;
+
+    uint8_t tnc;
+    enum kiss_chan_state state;
+    bool attached; /* In kfilter->chans. */
+
+    /* Received packets, nrpkts slots of max_read_size bytes. */
+    unsigned char *rpkts;
+    gensiods *rlens;
+    unsigned int nrpkts;
+    unsigned int rhead;
+    unsigned int rcount;
+    gensiods rpos; /* Amount of the first packet already delivered. */
+
+    /* Packets waiting to be written, nwpkts slots of max_write_size. */
+    unsigned char *wpkts;
+    gensiods *wlens;
+    unsigned int nwpkts;
+    unsigned int whead;
+    unsigned int wcount;
+
+    int read_err;
+    bool read_enabled;
+    bool xmit_enabled;
+
+    gensio_done_err open_done;
+    void *open_data;
+    gensio_done close_done;
+    void *close_data;
+
+    bool deferred_op_pending;
+    struct gensio_runner *deferred_op_runner;
 };
 
 #define filter_to_kiss(v) ((struct kiss_filter *) \
@@ -72,12 +139,21 @@ kiss_unlock(struct kiss_filter *kfilter)
     kfilter->o->unlock(kfilter->lock);
 }
 
+static void
+kiss_set_callbacks(struct kiss_filter *kfilter,
+		   gensio_filter_cb cb, void *cb_data)
+{
+    kfilter->filter_cb = cb;
+    kfilter->filter_cb_data = cb_data;
+}
+
+/* A message is waiting in read_data for the main gensio. */
 static bool
 kiss_ul_read_pending(struct gensio_filter *filter)
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
 
-    return kfilter->in_msg_complete;
+    return kfilter->in_msg_complete && !kfilter->chans[kfilter->curr_tnc];
 }
 
 static bool
@@ -85,20 +161,40 @@ kiss_ll_write_pending(struct gensio_filter *filter)
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
 
-    return kfilter->out_msg_ready ||
+    return kfilter->out_msg_ready || kfilter->chan_wr_pending ||
 	kfilter->setupstr_pos < kfilter->setupstr_len;
 }
 
+/*
+ * Channels need data from below even if the main gensio isn't
+ * reading.
+ */
 static bool
 kiss_ll_read_needed(struct gensio_filter *filter)
 {
-    return false;
+    struct kiss_filter *kfilter = filter_to_kiss(filter);
+
+    return kfilter->nopen_chans > 0 && !kfilter->in_msg_complete;
+}
+
+static void
+kiss_ll_can_read(struct gensio_filter *filter, bool *val)
+{
+    struct kiss_filter *kfilter = filter_to_kiss(filter);
+
+    /* With channels, stop reading while a message is held. */
+    *val = !(kfilter->nopen_chans > 0 && kfilter->in_msg_complete);
 }
 
 static int
 kiss_check_open_done(struct gensio_filter *filter, struct gensio *io)
 {
+    struct kiss_filter *kfilter = filter_to_kiss(filter);
+
     gensio_set_is_packet(io, true);
+    kiss_lock(kfilter);
+    kfilter->open = true;
+    kiss_unlock(kfilter);
     return 0;
 }
 
@@ -116,6 +212,131 @@ kiss_add_wrbyte(struct kiss_filter *kfilter, unsigned char byte)
     }
 }
 
+/*
+ * Return the number of bytes at the start of buf that are not a
+ * frame end (0xc0) or escape (0xdb).  This checks a word at a time,
+ * special characters are rare in most data.
+ */
+static gensiods
+kiss_scan_special(const unsigned char *buf, gensiods len)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = ones * 0x80;
+    uint64_t w, a, b;
+    gensiods i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+	memcpy(&w, buf + i, 8);
+	/* A byte of a or b is zero where w has a special character. */
+	a = w ^ (ones * 0xc0);
+	b = w ^ (ones * 0xdb);
+	if (((a - ones) & ~a & highs) | ((b - ones) & ~b & highs))
+	    break;
+    }
+    for (; i < len; i++) {
+	if (buf[i] == 0xc0 || buf[i] == 0xdb)
+	    break;
+    }
+    return i;
+}
+
+/* Escape the user data into the write buffer. */
+static void
+kiss_add_wrdata(struct kiss_filter *kfilter,
+		const unsigned char *buf, gensiods len)
+{
+    gensiods run;
+
+    while (len > 0) {
+	run = kiss_scan_special(buf, len);
+	memcpy(kfilter->write_data + kfilter->write_data_len, buf, run);
+	kfilter->write_data_len += run;
+	buf += run;
+	len -= run;
+	if (len > 0) {
+	    kiss_add_wrbyte(kfilter, *buf++);
+	    len--;
+	}
+    }
+}
+
+static void kiss_chan_sched_deferred_op(struct kiss_chan *chan);
+
+/* Tell the base it may be able to read from below again. */
+static void
+kiss_input_ready(struct kiss_filter *kfilter)
+{
+    kfilter->filter_cb(kfilter->filter_cb_data,
+		       GENSIO_FILTER_CB_INPUT_READY, NULL);
+}
+
+/*
+ * Must be called with the lock held.  If the message in read_data is
+ * for this channel and the channel has room, move it to the channel.
+ * Returns true if it was moved.
+ */
+static bool
+kiss_chan_take_held(struct kiss_chan *chan)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+    unsigned int slot;
+
+    if (!kfilter->in_msg_complete ||
+		kfilter->chans[kfilter->curr_tnc] != chan)
+	return false;
+    if (chan->rcount >= chan->nrpkts)
+	return false;
+
+    slot = (chan->rhead + chan->rcount) % chan->nrpkts;
+    memcpy(chan->rpkts + slot * kfilter->max_read_size,
+	   kfilter->read_data + kfilter->read_data_pos,
+	   kfilter->read_data_len);
+    chan->rlens[slot] = kfilter->read_data_len;
+    chan->rcount++;
+    kfilter->in_msg_complete = false;
+    kfilter->read_data_len = 0;
+    kfilter->read_data_pos = 0;
+    if (chan->read_enabled)
+	kiss_chan_sched_deferred_op(chan);
+    return true;
+}
+
+/*
+ * Must be called with the lock held.  Put the next packet queued on
+ * a channel into write_data, going around the channels in turn.
+ */
+static void
+kiss_frame_chan(struct kiss_filter *kfilter)
+{
+    struct kiss_chan *chan = NULL;
+    unsigned int i, tnc = 0;
+
+    for (i = 0; i < 16; i++) {
+	tnc = (kfilter->next_wr_tnc + i) % 16;
+	chan = kfilter->chans[tnc];
+	if (chan && chan->wcount > 0)
+	    break;
+    }
+    if (i == 16)
+	return;
+    kfilter->next_wr_tnc = (tnc + 1) % 16;
+
+    kfilter->write_data[kfilter->write_data_len++] = 0xc0;
+    kiss_add_wrbyte(kfilter, tnc << 4);
+    kiss_add_wrdata(kfilter,
+		    chan->wpkts + chan->whead * kfilter->max_write_size,
+		    chan->wlens[chan->whead]);
+    kfilter->write_data[kfilter->write_data_len++] = 0xc0;
+    kfilter->out_msg_ready = true;
+    kfilter->last_wr_main = false;
+
+    chan->whead = (chan->whead + 1) % chan->nwpkts;
+    chan->wcount--;
+    kfilter->chan_wr_pending--;
+    if (chan->xmit_enabled)
+	kiss_chan_sched_deferred_op(chan);
+}
+
 static int
 kiss_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 {
@@ -158,6 +379,7 @@ kiss_ul_write(struct gensio_filter *filter,
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
     unsigned int i, tnc = 0;
+    gensiods total = 0;
     int rv = 0;
 
     if (auxdata) {
@@ -173,9 +395,14 @@ kiss_ul_write(struct gensio_filter *filter,
 	    }
 	}
     }
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
     kiss_lock(kfilter);
     if (!kfilter->tncs[tnc]) {
 	rv = GE_INVAL;
+    } else if (total && kfilter->chans[tnc]) {
+	/* The TNC belongs to a channel now. */
+	rv = GE_INUSE;
     } else if (kfilter->setupstr_pos < kfilter->setupstr_len) {
 	struct gensio_sg sg[1];
 	gensiods count;
@@ -190,36 +417,40 @@ kiss_ul_write(struct gensio_filter *filter,
 	    if (rcount)
 		*rcount = 0;
 	}
-    } else if (kfilter->out_msg_ready) {
-	if (rcount)
-	    *rcount = 0;
     } else {
-	gensiods i, j, writelen = 0;
+	if (!kfilter->out_msg_ready && kfilter->chan_wr_pending &&
+		(!total || kfilter->last_wr_main))
+	    kiss_frame_chan(kfilter);
 
-	kfilter->write_data[kfilter->write_data_len++] = 0xc0;
-	kiss_add_wrbyte(kfilter, tnc << 4);
-	for (i = 0; i < sglen; i++) {
-	    gensiods inlen = sg[i].buflen;
-	    const unsigned char *buf = sg[i].buf;
+	if (kfilter->out_msg_ready || !total) {
+	    if (rcount)
+		*rcount = 0;
+	} else {
+	    gensiods i, len;
 
-	    for (j = 0; j < inlen; j++) {
-		if (kfilter->user_write_pos >= kfilter->max_write_size)
-		    break;
-		kfilter->user_write_pos++;
-		kiss_add_wrbyte(kfilter, buf[j]);
+	    kfilter->write_data[kfilter->write_data_len++] = 0xc0;
+	    kiss_add_wrbyte(kfilter, tnc << 4);
+	    for (i = 0; i < sglen; i++) {
+		gensiods inlen = sg[i].buflen;
+		const unsigned char *buf = sg[i].buf;
+
+		/* Anything past the maximum message size is dropped. */
+		len = kfilter->max_write_size - kfilter->user_write_pos;
+		if (len > inlen)
+		    len = inlen;
+		kiss_add_wrdata(kfilter, buf, len);
+		kfilter->user_write_pos += len;
 	    }
-	    writelen += inlen;
-	}
-	if (rcount)
-	    *rcount = writelen;
+	    if (rcount)
+		*rcount = total;
 
-	if (kfilter->user_write_pos > 0) {
 	    kfilter->out_msg_ready = true;
+	    kfilter->last_wr_main = true;
 	    kfilter->write_data[kfilter->write_data_len++] = 0xc0;
 	}
     }
 
-    if (kfilter->out_msg_ready) {
+    while (kfilter->out_msg_ready) {
 	struct gensio_sg sg[1];
 	gensiods len = kfilter->write_data_len - kfilter->write_data_pos;
 	gensiods count;
@@ -238,8 +469,12 @@ kiss_ul_write(struct gensio_filter *filter,
 		kfilter->write_data_pos = 0;
 		kfilter->out_msg_ready = false;
 		kfilter->user_write_pos = 0;
+		/* Nothing else will push channel data, keep going. */
+		if (kfilter->chan_wr_pending)
+		    kiss_frame_chan(kfilter);
 	    } else {
 		kfilter->write_data_pos += count;
+		break;
 	    }
 	}
     }
@@ -256,7 +491,7 @@ kiss_ll_write(struct gensio_filter *filter,
 		const char *const *auxdata)
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
-    gensiods in_buflen = buflen, count = 0;
+    gensiods in_buflen = buflen, count = 0, run, left;
     int err = 0;
 
     kiss_lock(kfilter);
@@ -265,8 +500,34 @@ kiss_ll_write(struct gensio_filter *filter,
 	    *rcount = 0;
     } else {
 	while (buflen && !kfilter->in_msg_complete) {
-	    unsigned char b = *buf++;
+	    unsigned char b;
+
+	    if (kfilter->in_bad_packet) {
+		/* Ignore input until a frame end. */
+		const unsigned char *p = memchr(buf, 0xc0, buflen);
+
+		run = p ? (gensiods) (p - buf) : buflen;
+		buf += run;
+		buflen -= run;
+		if (!buflen)
+		    break;
+	    } else if (!kfilter->in_esc) {
+		/* Copy normal characters in one piece. */
+		run = kiss_scan_special(buf, buflen);
+		left = kfilter->max_read_size - kfilter->read_data_len;
+		if (run > left) {
+		    run = left;
+		    kfilter->in_bad_packet = true;
+		}
+		memcpy(kfilter->read_data + kfilter->read_data_len, buf, run);
+		kfilter->read_data_len += run;
+		buf += run;
+		buflen -= run;
+		if (!buflen || kfilter->in_bad_packet)
+		    continue;
+	    }
 
+	    b = *buf++;
 	    buflen--;
 
 	    if (b == 0xc0) { /* Frame end char */
@@ -325,6 +586,11 @@ kiss_ll_write(struct gensio_filter *filter,
 	    kfilter->read_data_pos = 1;
 	    kfilter->read_data_len--;
 	}
+	if (kfilter->chans[kfilter->curr_tnc]) {
+	    /* If the channel is full, this waits for it to take data. */
+	    kiss_chan_take_held(kfilter->chans[kfilter->curr_tnc]);
+	    goto out_unlock;
+	}
 	snprintf(tncbuf, sizeof(tncbuf), "tnc:%u", kfilter->curr_tnc);
 	kiss_unlock(kfilter);
 	err = handler(cb_data, &count,
@@ -354,11 +620,64 @@ kiss_setup(struct gensio_filter *filter)
     return 0;
 }
 
+/*
+ * Must be called with the lock held.  Take the channel out of the
+ * filter, anything it has queued to write is dropped.  Returns true
+ * if a held message was dropped and the base should check if it can
+ * read again.
+ */
+static bool
+kiss_chan_detach(struct kiss_chan *chan)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+    bool rv = false;
+
+    if (!chan->attached)
+	return false;
+    if (kfilter->in_msg_complete && kfilter->curr_tnc == chan->tnc) {
+	/* Nobody is left to take this. */
+	kfilter->in_msg_complete = false;
+	kfilter->read_data_len = 0;
+	kfilter->read_data_pos = 0;
+	rv = true;
+    }
+    kfilter->chans[chan->tnc] = NULL;
+    kfilter->nopen_chans--;
+    kfilter->chan_wr_pending -= chan->wcount;
+    chan->wcount = 0;
+    chan->attached = false;
+    return rv;
+}
+
+/*
+ * Called with the lock held when the main gensio closes or fails, all
+ * the channels get the error and will not get any more data.
+ */
+static void
+kiss_chans_fail(struct kiss_filter *kfilter, int err)
+{
+    struct kiss_chan *chan;
+    unsigned int i;
+
+    for (i = 0; i < 16; i++) {
+	chan = kfilter->chans[i];
+	if (!chan)
+	    continue;
+	kiss_chan_detach(chan);
+	if (!chan->read_err)
+	    chan->read_err = err;
+	kiss_chan_sched_deferred_op(chan);
+    }
+}
+
 static void
 kiss_filter_cleanup(struct gensio_filter *filter)
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
 
+    kiss_lock(kfilter);
+    kiss_chans_fail(kfilter, GE_LOCALCLOSED);
+    kfilter->open = false;
     kfilter->read_data_len = 0;
     kfilter->read_data_pos = 0;
     kfilter->write_data_len = 0;
@@ -367,6 +686,17 @@ kiss_filter_cleanup(struct gensio_filter *filter)
     kfilter->in_msg_complete = false;
     kfilter->in_esc = false;
     kfilter->out_msg_ready = false;
+    kiss_unlock(kfilter);
+}
+
+static void
+kiss_io_err(struct gensio_filter *filter, int err)
+{
+    struct kiss_filter *kfilter = filter_to_kiss(filter);
+
+    kiss_lock(kfilter);
+    kiss_chans_fail(kfilter, err);
+    kiss_unlock(kfilter);
 }
 
 static void
@@ -387,12 +717,436 @@ kfilter_free(struct kiss_filter *kfilter)
     o->free(o, kfilter);
 }
 
+/* Must be called with the lock held, it's released. */
+static void
+kiss_deref_and_unlock(struct kiss_filter *kfilter)
+{
+    unsigned int count;
+
+    assert(kfilter->refcount > 0);
+    count = --kfilter->refcount;
+    kiss_unlock(kfilter);
+    if (count == 0)
+	kfilter_free(kfilter);
+}
+
 static void
 kiss_free(struct gensio_filter *filter)
 {
     struct kiss_filter *kfilter = filter_to_kiss(filter);
 
-    kfilter_free(kfilter);
+    kiss_lock(kfilter);
+    kiss_chans_fail(kfilter, GE_LOCALCLOSED);
+    kfilter->open = false;
+    kiss_deref_and_unlock(kfilter);
+}
+
+static void
+kiss_chan_finish_free(struct kiss_chan *chan)
+{
+    struct gensio_os_funcs *o = chan->o;
+
+    if (chan->rpkts)
+	o->free(o, chan->rpkts);
+    if (chan->rlens)
+	o->free(o, chan->rlens);
+    if (chan->wpkts)
+	o->free(o, chan->wpkts);
+    if (chan->wlens)
+	o->free(o, chan->wlens);
+    if (chan->deferred_op_runner)
+	o->free_runner(chan->deferred_op_runner);
+    if (chan->io)
+	gensio_data_free(chan->io);
+    o->free(o, chan);
+}
+
+/* Must be called with the lock held, it's released. */
+static void
+kiss_chan_deref_and_unlock(struct kiss_chan *chan)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+
+    assert(chan->refcount > 0);
+    if (--chan->refcount > 0) {
+	kiss_unlock(kfilter);
+	return;
+    }
+    kiss_chan_finish_free(chan);
+    kiss_deref_and_unlock(kfilter);
+}
+
+static void
+kiss_chan_sched_deferred_op(struct kiss_chan *chan)
+{
+    if (!chan->deferred_op_pending) {
+	chan->deferred_op_pending = true;
+	chan->refcount++;
+	chan->o->run(chan->deferred_op_runner);
+    }
+}
+
+static void
+kiss_chan_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct kiss_chan *chan = cb_data;
+    struct kiss_filter *kfilter = chan->kfilter;
+    gensio_done_err open_done;
+    gensio_done close_done;
+    unsigned char *buf;
+    gensiods len, count;
+    int err;
+
+    kiss_lock(kfilter);
+    if (chan->open_done) {
+	open_done = chan->open_done;
+	chan->open_done = NULL;
+	kiss_unlock(kfilter);
+	open_done(chan->io, 0, chan->open_data);
+	kiss_lock(kfilter);
+    }
+
+    while (chan->state == KISS_CHAN_OPEN && chan->read_enabled) {
+	if (chan->rcount > 0) {
+	    buf = chan->rpkts + chan->rhead * kfilter->max_read_size;
+	    buf += chan->rpos;
+	    len = chan->rlens[chan->rhead] - chan->rpos;
+	    count = len;
+	    kiss_unlock(kfilter);
+	    err = gensio_cb(chan->io, GENSIO_EVENT_READ, 0, buf, &count, NULL);
+	    kiss_lock(kfilter);
+	    if (err) {
+		chan->read_enabled = false;
+		if (!chan->read_err)
+		    chan->read_err = err;
+		break;
+	    }
+	    if (count < len) {
+		chan->rpos += count;
+		continue;
+	    }
+	    chan->rpos = 0;
+	    chan->rhead = (chan->rhead + 1) % chan->nrpkts;
+	    chan->rcount--;
+	    if (kiss_chan_take_held(chan)) {
+		kiss_unlock(kfilter);
+		kiss_input_ready(kfilter);
+		kiss_lock(kfilter);
+	    }
+	} else if (chan->read_err) {
+	    chan->read_enabled = false;
+	    count = 0;
+	    kiss_unlock(kfilter);
+	    gensio_cb(chan->io, GENSIO_EVENT_READ, chan->read_err,
+		      NULL, &count, NULL);
+	    kiss_lock(kfilter);
+	} else {
+	    break;
+	}
+    }
+
+    while (chan->state == KISS_CHAN_OPEN && chan->xmit_enabled &&
+	   (chan->wcount < chan->nwpkts || !chan->attached)) {
+	kiss_unlock(kfilter);
+	err = gensio_cb(chan->io, GENSIO_EVENT_WRITE_READY, 0,
+			NULL, NULL, NULL);
+	kiss_lock(kfilter);
+	if (err) {
+	    chan->read_enabled = false;
+	    if (!chan->read_err)
+		chan->read_err = err;
+	    break;
+	}
+    }
+
+    if (chan->state == KISS_CHAN_IN_CLOSE) {
+	chan->state = KISS_CHAN_CLOSED;
+	if (chan->close_done) {
+	    close_done = chan->close_done;
+	    chan->close_done = NULL;
+	    kiss_unlock(kfilter);
+	    close_done(chan->io, chan->close_data);
+	    kiss_lock(kfilter);
+	}
+    }
+
+    chan->deferred_op_pending = false;
+    if (chan->open_done)
+	/* Reopened from the close callback. */
+	kiss_chan_sched_deferred_op(chan);
+    kiss_chan_deref_and_unlock(chan);
+}
+
+static int
+kiss_chan_write(struct kiss_chan *chan, gensiods *rcount,
+		const struct gensio_sg *sg, gensiods sglen,
+		const char *const *auxdata)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+    unsigned char *pkt;
+    gensiods i, len, pos = 0, total = 0;
+    bool kick = false;
+    int err = 0;
+
+    /* The channel is the TNC, no auxdata is needed. */
+    if (auxdata && auxdata[0])
+	return GE_INVAL;
+
+    kiss_lock(kfilter);
+    if (chan->state != KISS_CHAN_OPEN) {
+	err = GE_NOTREADY;
+    } else if (!chan->attached) {
+	err = chan->read_err ? chan->read_err : GE_NOTREADY;
+    } else if (chan->wcount < chan->nwpkts) {
+	pkt = chan->wpkts + (((chan->whead + chan->wcount) % chan->nwpkts)
+			     * kfilter->max_write_size);
+	for (i = 0; i < sglen; i++) {
+	    /* Anything past the maximum message size is dropped. */
+	    len = kfilter->max_write_size - pos;
+	    if (len > sg[i].buflen)
+		len = sg[i].buflen;
+	    memcpy(pkt + pos, sg[i].buf, len);
+	    pos += len;
+	    total += sg[i].buflen;
+	}
+	if (pos > 0) {
+	    chan->wlens[(chan->whead + chan->wcount) % chan->nwpkts] = pos;
+	    chan->wcount++;
+	    kfilter->chan_wr_pending++;
+	    kick = true;
+	}
+    }
+    kiss_unlock(kfilter);
+
+    if (kick)
+	kfilter->filter_cb(kfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    if (!err && rcount)
+	*rcount = total;
+    return err;
+}
+
+static int
+kiss_chan_open(struct kiss_chan *chan, gensio_done_err open_done,
+	       void *open_data)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+    bool input_ready = false;
+    int err = 0;
+
+    kiss_lock(kfilter);
+    if (chan->state != KISS_CHAN_CLOSED) {
+	err = GE_NOTREADY;
+    } else if (!kfilter->open) {
+	/* The main gensio must be open. */
+	err = GE_NOTREADY;
+    } else if (kfilter->chans[chan->tnc]) {
+	err = GE_INUSE;
+    } else {
+	kfilter->chans[chan->tnc] = chan;
+	kfilter->nopen_chans++;
+	chan->attached = true;
+	chan->state = KISS_CHAN_OPEN;
+	chan->read_err = 0;
+	chan->rhead = 0;
+	chan->rcount = 0;
+	chan->rpos = 0;
+	chan->whead = 0;
+	chan->wcount = 0;
+	chan->open_done = open_done;
+	chan->open_data = open_data;
+	kiss_chan_sched_deferred_op(chan);
+	/* The base may need to start reading for the channel. */
+	kiss_chan_take_held(chan);
+	input_ready = true;
+    }
+    kiss_unlock(kfilter);
+
+    if (input_ready)
+	kiss_input_ready(kfilter);
+    return err;
+}
+
+static int
+kiss_chan_close(struct kiss_chan *chan, gensio_done close_done,
+		void *close_data)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+    bool input_ready = false;
+    int err = 0;
+
+    kiss_lock(kfilter);
+    if (chan->state != KISS_CHAN_OPEN) {
+	err = GE_NOTREADY;
+    } else {
+	input_ready = kiss_chan_detach(chan);
+	chan->state = KISS_CHAN_IN_CLOSE;
+	chan->close_done = close_done;
+	chan->close_data = close_data;
+	kiss_chan_sched_deferred_op(chan);
+    }
+    kiss_unlock(kfilter);
+
+    if (input_ready)
+	kiss_input_ready(kfilter);
+    return err;
+}
+
+static void
+kiss_chan_free(struct kiss_chan *chan)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+    bool input_ready;
+
+    kiss_lock(kfilter);
+    input_ready = kiss_chan_detach(chan);
+    if (chan->state == KISS_CHAN_OPEN)
+	chan->state = KISS_CHAN_CLOSED;
+    chan->open_done = NULL;
+    chan->close_done = NULL;
+    if (input_ready) {
+	kiss_unlock(kfilter);
+	kiss_input_ready(kfilter);
+	kiss_lock(kfilter);
+    }
+    kiss_chan_deref_and_unlock(chan);
+}
+
+static void
+kiss_chan_set_read_callback_enable(struct kiss_chan *chan, bool enabled)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+
+    kiss_lock(kfilter);
+    chan->read_enabled = enabled;
+    if (enabled && chan->state == KISS_CHAN_OPEN)
+	kiss_chan_sched_deferred_op(chan);
+    kiss_unlock(kfilter);
+}
+
+static void
+kiss_chan_set_write_callback_enable(struct kiss_chan *chan, bool enabled)
+{
+    struct kiss_filter *kfilter = chan->kfilter;
+
+    kiss_lock(kfilter);
+    chan->xmit_enabled = enabled;
+    if (enabled && chan->state == KISS_CHAN_OPEN)
+	kiss_chan_sched_deferred_op(chan);
+    kiss_unlock(kfilter);
+}
+
+static int
+kiss_chan_func(struct gensio *io, int func, gensiods *count,
+	       const void *cbuf, gensiods buflen, void *buf,
+	       const char *const *auxdata)
+{
+    struct kiss_chan *chan = gensio_get_gensio_data(io);
+
+    switch (func) {
+    case GENSIO_FUNC_WRITE_SG:
+	return kiss_chan_write(chan, count, cbuf, buflen, auxdata);
+
+    case GENSIO_FUNC_OPEN:
+	return kiss_chan_open(chan, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return kiss_chan_close(chan, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	kiss_chan_free(chan);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	kiss_chan_set_read_callback_enable(chan, buflen);
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	kiss_chan_set_write_callback_enable(chan, buflen);
+	return 0;
+
+    case GENSIO_FUNC_DISABLE:
+	kiss_lock(chan->kfilter);
+	kiss_chan_detach(chan);
+	chan->state = KISS_CHAN_CLOSED;
+	kiss_unlock(chan->kfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+kiss_alloc_channel(struct kiss_filter *kfilter,
+		   struct gensio_func_alloc_channel_data *d)
+{
+    struct gensio_os_funcs *o = kfilter->o;
+    struct kiss_chan *chan;
+    unsigned int tnc = 16, readpkts = 8, writepkts = 4, i;
+    GENSIO_DECLARE_PPGENSIO(p, o, d->cb, "kiss", d->user_data);
+
+    for (i = 0; d->args && d->args[i]; i++) {
+	if (gensio_pparm_uint(&p, d->args[i], "tnc", &tnc) > 0)
+	    continue;
+	if (gensio_pparm_uint(&p, d->args[i], "readpkts", &readpkts) > 0)
+	    continue;
+	if (gensio_pparm_uint(&p, d->args[i], "writepkts", &writepkts) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, d->args[i]);
+	return GE_INVAL;
+    }
+
+    if (tnc > 15 || !kfilter->tncs[tnc]) {
+	gensio_pparm_slog(&p, "tnc must be given and be a configured tnc");
+	return GE_INVAL;
+    }
+    if (readpkts == 0 || writepkts == 0) {
+	gensio_pparm_slog(&p, "readpkts and writepkts must be at least 1");
+	return GE_INVAL;
+    }
+
+    chan = o->zalloc(o, sizeof(*chan));
+    if (!chan)
+	return GE_NOMEM;
+    chan->o = o;
+    chan->kfilter = kfilter;
+    chan->refcount = 1;
+    chan->tnc = tnc;
+    chan->nrpkts = readpkts;
+    chan->nwpkts = writepkts;
+
+    chan->rpkts = o->zalloc(o, (gensiods) readpkts * kfilter->max_read_size);
+    if (!chan->rpkts)
+	goto out_nomem;
+    chan->rlens = o->zalloc(o, sizeof(gensiods) * readpkts);
+    if (!chan->rlens)
+	goto out_nomem;
+    chan->wpkts = o->zalloc(o, (gensiods) writepkts * kfilter->max_write_size);
+    if (!chan->wpkts)
+	goto out_nomem;
+    chan->wlens = o->zalloc(o, sizeof(gensiods) * writepkts);
+    if (!chan->wlens)
+	goto out_nomem;
+    chan->deferred_op_runner = o->alloc_runner(o, kiss_chan_deferred_op, chan);
+    if (!chan->deferred_op_runner)
+	goto out_nomem;
+    chan->io = gensio_data_alloc(o, d->cb, d->user_data, kiss_chan_func,
+				 NULL, "kiss", chan);
+    if (!chan->io)
+	goto out_nomem;
+    gensio_set_is_packet(chan->io, true);
+
+    kiss_lock(kfilter);
+    kfilter->refcount++;
+    kiss_unlock(kfilter);
+
+    d->new_io = chan->io;
+    return 0;
+
+ out_nomem:
+    kiss_chan_finish_free(chan);
+    return GE_NOMEM;
 }
 
 static int gensio_kiss_filter_func(struct gensio_filter *filter, int op,
@@ -403,6 +1157,10 @@ static int gensio_kiss_filter_func(struct gensio_filter *filter, int op,
 				     const char *const *auxdata)
 {
     switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	kiss_set_callbacks(filter_to_kiss(filter), func, data);
+	return 0;
+
     case GENSIO_FILTER_FUNC_UL_READ_PENDING:
 	return kiss_ul_read_pending(filter);
 
@@ -438,6 +1196,17 @@ static int gensio_kiss_filter_func(struct gensio_filter *filter, int op,
 	kiss_free(filter);
 	return 0;
 
+    case GENSIO_FILTER_FUNC_IO_ERR:
+	kiss_io_err(filter, *((int *) data));
+	return 0;
+
+    case GENSIO_FILTER_FUNC_LL_CAN_READ:
+	kiss_ll_can_read(filter, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_ALLOC_CHANNEL:
+	return kiss_alloc_channel(filter_to_kiss(filter), data);
+
     default:
 	return GE_NOTSUP;
     }
@@ -567,6 +1336,7 @@ gensio_kiss_filter_alloc(struct gensio_pparm_info *p,
 	return GE_NOMEM;
 
     kfilter->o = o;
+    kfilter->refcount = 1;
     kfilter->max_write_size = max_write_size;
     kfilter->max_read_size = max_read_size;
     kfilter->server = server;
@@ -0,0 +1,585 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdio.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+
+#include "gensio_filter_lenframe.h"
+
+/*
+ * Each write becomes a frame on the wire.  A frame is a header, which
+ * is a varint (7 bits per byte, low bits first, high bit set if more
+ * bytes follow) holding the payload length shifted left one with the
+ * low bit set if the frame ends a message, then the payload.  Nothing
+ * in the payload is touched, so on the write side the header and the
+ * user's data are handed down together and on the read side the
+ * payload is delivered straight out of the lower layer's buffer when
+ * the whole frame is there.  If the lower layer only has part of a
+ * frame, it is collected in the read buffer and delivered from there
+ * when complete, so each write comes out as one read.
+ */
+#define LENFRAME_MAX_HDR	5 /* 32 bits worth of varint. */
+
+/*
+ * Writes with more pieces than this are copied into the write buffer
+ * instead of being handed down directly.
+ */
+#define LENFRAME_MAX_SG		8
+
+struct lenframe_filter {
+    struct gensio_filter *filter;
+
+    struct gensio_os_funcs *o;
+
+    struct gensio_lock *lock;
+
+    /*
+     * Only used to hold the rest of a frame the lower layer did not
+     * take, the user's data has been consumed at that point.
+     */
+    unsigned char *write_data;
+    gensiods max_write_size; /* Maximum payload of one frame. */
+    gensiods write_data_pos;
+    gensiods write_data_len;
+
+    /*
+     * Holds a frame that came in pieces.  Frames larger than this are
+     * delivered in pieces as they arrive.
+     */
+    unsigned char *read_data;
+    gensiods max_read_size;
+    gensiods read_data_pos;
+    gensiods read_data_len;
+    bool rd_ready; /* read_data holds a whole frame to deliver. */
+
+    /* Read header parsing state. */
+    uint32_t rd_hdr;
+    unsigned int rd_hdr_shift;
+    bool rd_in_frame;
+    bool rd_eom;
+    bool rd_collect; /* Current frame fits in read_data. */
+    gensiods rd_left; /* Payload bytes left in the current frame. */
+};
+
+#define filter_to_lenframe(v) ((struct lenframe_filter *) \
+			       gensio_filter_get_user_data(v))
+
+static void
+lenframe_lock(struct lenframe_filter *lfilter)
+{
+    lfilter->o->lock(lfilter->lock);
+}
+
+static void
+lenframe_unlock(struct lenframe_filter *lfilter)
+{
+    lfilter->o->unlock(lfilter->lock);
+}
+
+static bool
+lenframe_ul_read_pending(struct gensio_filter *filter)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+
+    return lfilter->rd_ready;
+}
+
+static bool
+lenframe_ll_write_pending(struct gensio_filter *filter)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+
+    return lfilter->write_data_len > 0;
+}
+
+static bool
+lenframe_ll_read_needed(struct gensio_filter *filter)
+{
+    return false;
+}
+
+static int
+lenframe_check_open_done(struct gensio_filter *filter, struct gensio *io)
+{
+    gensio_set_is_message(io, true);
+    return 0;
+}
+
+static int
+lenframe_try_connect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    return 0;
+}
+
+static int
+lenframe_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+
+    if (lfilter->write_data_len == 0)
+	return 0;
+    else
+	return GE_INPROGRESS;
+}
+
+static unsigned int
+lenframe_put_hdr(unsigned char *hdr, uint32_t val)
+{
+    unsigned int len = 0;
+
+    while (val >= 0x80) {
+	hdr[len++] = (val & 0x7f) | 0x80;
+	val >>= 7;
+    }
+    hdr[len++] = val;
+    return len;
+}
+
+/*
+ * Send what is left of a frame the lower layer didn't take all of
+ * before.
+ */
+static int
+lenframe_push_pending(struct lenframe_filter *lfilter,
+		      gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    struct gensio_sg sg;
+    gensiods count = 0;
+    int err;
+
+    sg.buf = lfilter->write_data + lfilter->write_data_pos;
+    sg.buflen = lfilter->write_data_len - lfilter->write_data_pos;
+    lenframe_unlock(lfilter);
+    err = handler(cb_data, &count, &sg, 1, NULL);
+    lenframe_lock(lfilter);
+    if (err) {
+	lfilter->write_data_len = 0;
+	lfilter->write_data_pos = 0;
+    } else if (count >= sg.buflen) {
+	lfilter->write_data_len = 0;
+	lfilter->write_data_pos = 0;
+    } else {
+	lfilter->write_data_pos += count;
+    }
+    return err;
+}
+
+/*
+ * Add up to max bytes of the data in sg, starting at offset skip, to
+ * the write buffer.
+ */
+static void
+lenframe_add_wrdata(struct lenframe_filter *lfilter,
+		    const struct gensio_sg *sg, gensiods sglen,
+		    gensiods skip, gensiods max)
+{
+    gensiods i, len;
+
+    for (i = 0; i < sglen && max > 0; i++) {
+	len = sg[i].buflen;
+	if (skip >= len) {
+	    skip -= len;
+	    continue;
+	}
+	len -= skip;
+	if (len > max)
+	    len = max;
+	memcpy(lfilter->write_data + lfilter->write_data_len,
+	       ((const unsigned char *) sg[i].buf) + skip, len);
+	lfilter->write_data_len += len;
+	max -= len;
+	skip = 0;
+    }
+}
+
+static int
+lenframe_ul_write(struct gensio_filter *filter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  const char *const *auxdata)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+    struct gensio_sg isg[LENFRAME_MAX_SG + 1];
+    unsigned char hdr[LENFRAME_MAX_HDR];
+    gensiods i, isglen, len, total = 0, count = 0;
+    bool eom = true;
+    int err = 0;
+
+    lenframe_lock(lfilter);
+    if (lfilter->write_data_len > 0) {
+	err = lenframe_push_pending(lfilter, handler, cb_data);
+	if (err || lfilter->write_data_len > 0)
+	    goto out;
+    }
+
+    /* Build the frame, limiting it to the maximum size. */
+    isglen = 1;
+    for (i = 0; i < sglen; i++) {
+	len = sg[i].buflen;
+	if (len == 0)
+	    continue;
+	if (len > lfilter->max_write_size - total) {
+	    len = lfilter->max_write_size - total;
+	    eom = false;
+	}
+	if (len == 0)
+	    break;
+	if (isglen <= LENFRAME_MAX_SG) {
+	    isg[isglen].buf = sg[i].buf;
+	    isg[isglen].buflen = len;
+	}
+	isglen++;
+	total += len;
+    }
+    if (total == 0)
+	goto out;
+    eom = eom && gensio_str_in_auxdata(auxdata, "eom");
+
+    isg[0].buf = hdr;
+    isg[0].buflen = lenframe_put_hdr(hdr, (total << 1) | eom);
+
+    if (isglen > LENFRAME_MAX_SG + 1) {
+	/* Too many pieces, copy it all and send it from our buffer. */
+	memcpy(lfilter->write_data, hdr, isg[0].buflen);
+	lfilter->write_data_len = isg[0].buflen;
+	lenframe_add_wrdata(lfilter, sg, sglen, 0, total);
+	err = lenframe_push_pending(lfilter, handler, cb_data);
+	goto out_consumed;
+    }
+
+    lenframe_unlock(lfilter);
+    err = handler(cb_data, &count, isg, isglen, NULL);
+    lenframe_lock(lfilter);
+    if (err)
+	goto out;
+    if (count < total + isg[0].buflen)
+	/*
+	 * The frame length has been committed to, so keep the rest
+	 * of the frame and send it before anything else.
+	 */
+	lenframe_add_wrdata(lfilter, isg, isglen, count,
+			    total + isg[0].buflen - count);
+
+ out_consumed:
+    if (!err)
+	count = total;
+ out:
+    lenframe_unlock(lfilter);
+
+    if (!err && rcount)
+	*rcount = count;
+
+    return err;
+}
+
+static const char *lenframe_eomaux[2] = { "eom", NULL };
+
+/* Deliver the frame held in the read buffer. */
+static int
+lenframe_deliver_rddata(struct lenframe_filter *lfilter,
+			gensio_ll_filter_data_handler handler, void *cb_data)
+{
+    gensiods count = 0, len;
+    int err;
+
+    len = lfilter->read_data_len - lfilter->read_data_pos;
+    lenframe_unlock(lfilter);
+    err = handler(cb_data, &count, lfilter->read_data + lfilter->read_data_pos,
+		  len, lfilter->rd_eom ? lenframe_eomaux : NULL);
+    lenframe_lock(lfilter);
+    if (err)
+	return err;
+    if (count >= len) {
+	lfilter->read_data_len = 0;
+	lfilter->read_data_pos = 0;
+	lfilter->rd_ready = false;
+    } else {
+	lfilter->read_data_pos += count;
+    }
+    return 0;
+}
+
+static int
+lenframe_ll_write(struct gensio_filter *filter,
+		  gensio_ll_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  unsigned char *buf, gensiods buflen,
+		  const char *const *auxdata)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+    gensiods in_buflen = buflen, len, count;
+    const char *const *aux;
+    int err = 0;
+
+    lenframe_lock(lfilter);
+    if (lfilter->rd_ready) {
+	err = lenframe_deliver_rddata(lfilter, handler, cb_data);
+	if (err || lfilter->rd_ready)
+	    goto out;
+    }
+
+    while (buflen > 0) {
+	if (!lfilter->rd_in_frame) {
+	    unsigned char b = *buf++;
+
+	    buflen--;
+	    if (lfilter->rd_hdr_shift >= 7 * (LENFRAME_MAX_HDR - 1) && b >> 4) {
+		/* Too big to fit in 32 bits. */
+		err = GE_PROTOERR;
+		break;
+	    }
+	    lfilter->rd_hdr |= (uint32_t) (b & 0x7f) << lfilter->rd_hdr_shift;
+	    lfilter->rd_hdr_shift += 7;
+	    if (b & 0x80)
+		continue;
+
+	    lfilter->rd_left = lfilter->rd_hdr >> 1;
+	    lfilter->rd_eom = lfilter->rd_hdr & 1;
+	    lfilter->rd_hdr = 0;
+	    lfilter->rd_hdr_shift = 0;
+	    lfilter->rd_in_frame = lfilter->rd_left > 0;
+	    lfilter->rd_collect = lfilter->rd_left <= lfilter->max_read_size;
+	    continue;
+	}
+
+	if (lfilter->rd_collect &&
+		(lfilter->read_data_len > 0 || buflen < lfilter->rd_left)) {
+	    /* Only part of the frame is here, save it for the rest. */
+	    len = lfilter->rd_left;
+	    if (len > buflen)
+		len = buflen;
+	    memcpy(lfilter->read_data + lfilter->read_data_len, buf, len);
+	    lfilter->read_data_len += len;
+	    buf += len;
+	    buflen -= len;
+	    lfilter->rd_left -= len;
+	    if (lfilter->rd_left > 0)
+		continue;
+	    lfilter->rd_in_frame = false;
+	    lfilter->rd_ready = true;
+	    err = lenframe_deliver_rddata(lfilter, handler, cb_data);
+	    if (err || lfilter->rd_ready)
+		break;
+	    continue;
+	}
+
+	/* Hand the payload up directly from the lower layer's buffer. */
+	len = lfilter->rd_left;
+	if (len > buflen)
+	    len = buflen;
+	aux = lfilter->rd_eom && len == lfilter->rd_left ?
+	    lenframe_eomaux : NULL;
+	count = 0;
+	lenframe_unlock(lfilter);
+	err = handler(cb_data, &count, buf, len, aux);
+	lenframe_lock(lfilter);
+	if (err)
+	    break;
+	if (count > len)
+	    count = len;
+	buf += count;
+	buflen -= count;
+	lfilter->rd_left -= count;
+	if (lfilter->rd_left == 0)
+	    lfilter->rd_in_frame = false;
+	if (count < len)
+	    /* User didn't take it all, the rest stays down below. */
+	    break;
+    }
+ out:
+    lenframe_unlock(lfilter);
+
+    if (!err && rcount)
+	*rcount = in_buflen - buflen;
+
+    return err;
+}
+
+static int
+lenframe_setup(struct gensio_filter *filter)
+{
+    return 0;
+}
+
+static void
+lenframe_filter_cleanup(struct gensio_filter *filter)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+
+    lfilter->write_data_len = 0;
+    lfilter->write_data_pos = 0;
+    lfilter->rd_hdr = 0;
+    lfilter->rd_hdr_shift = 0;
+    lfilter->rd_in_frame = false;
+    lfilter->rd_collect = false;
+    lfilter->rd_left = 0;
+    lfilter->read_data_len = 0;
+    lfilter->read_data_pos = 0;
+    lfilter->rd_ready = false;
+}
+
+static void
+lfilter_free(struct lenframe_filter *lfilter)
+{
+    if (lfilter->lock)
+	lfilter->o->free_lock(lfilter->lock);
+    if (lfilter->write_data)
+	lfilter->o->free(lfilter->o, lfilter->write_data);
+    if (lfilter->read_data)
+	lfilter->o->free(lfilter->o, lfilter->read_data);
+    if (lfilter->filter)
+	gensio_filter_free_data(lfilter->filter);
+    lfilter->o->free(lfilter->o, lfilter);
+}
+
+static void
+lenframe_free(struct gensio_filter *filter)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+
+    lfilter_free(lfilter);
+}
+
+static int
+lenframe_control(struct gensio_filter *filter, bool get, int op, char *data,
+		 gensiods *datalen)
+{
+    struct lenframe_filter *lfilter = filter_to_lenframe(filter);
+
+    switch (op) {
+    case GENSIO_CONTROL_MAX_WRITE_PACKET:
+	if (!get)
+	    return GE_NOTSUP;
+	*datalen = snprintf(data, *datalen, "%lu",
+			    (unsigned long) lfilter->max_write_size);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int gensio_lenframe_filter_func(struct gensio_filter *filter, int op,
+				       void *func, void *data,
+				       gensiods *count,
+				       void *buf, const void *cbuf,
+				       gensiods buflen,
+				       const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return lenframe_ul_read_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return lenframe_ll_write_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return lenframe_ll_read_needed(filter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return lenframe_check_open_done(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return lenframe_try_connect(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return lenframe_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return lenframe_ul_write(filter, func, data, count, cbuf, buflen,
+				 auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return lenframe_ll_write(filter, func, data, count, buf, buflen,
+				 auxdata);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return lenframe_setup(filter);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	lenframe_filter_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	lenframe_free(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return lenframe_control(filter, *((bool *) cbuf), buflen, data, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_lenframe_filter_alloc(struct gensio_pparm_info *p,
+			     struct gensio_os_funcs *o,
+			     const char * const args[],
+			     struct gensio_filter **rfilter)
+{
+    struct lenframe_filter *lfilter;
+    unsigned int i;
+    gensiods max_write_size = 65536;
+    gensiods max_read_size = 65536;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_ds(p, args[i], "writebuf", &max_write_size) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "readbuf", &max_read_size) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (max_write_size == 0 || max_write_size > 0x7fffffff) {
+	gensio_pparm_slog(p, "writebuf must be between 1 and 2^31 - 1");
+	return GE_INVAL;
+    }
+    if (max_read_size == 0) {
+	gensio_pparm_slog(p, "readbuf must not be zero");
+	return GE_INVAL;
+    }
+
+    lfilter = o->zalloc(o, sizeof(*lfilter));
+    if (!lfilter)
+	return GE_NOMEM;
+
+    lfilter->o = o;
+    lfilter->max_write_size = max_write_size;
+    lfilter->max_read_size = max_read_size;
+
+    lfilter->lock = o->alloc_lock(o);
+    if (!lfilter->lock)
+	goto out_nomem;
+
+    lfilter->write_data = o->zalloc(o, max_write_size + LENFRAME_MAX_HDR);
+    if (!lfilter->write_data)
+	goto out_nomem;
+
+    lfilter->read_data = o->zalloc(o, max_read_size);
+    if (!lfilter->read_data)
+	goto out_nomem;
+
+    lfilter->filter = gensio_filter_alloc_data(o, gensio_lenframe_filter_func,
+					       lfilter);
+    if (!lfilter->filter)
+	goto out_nomem;
+
+    *rfilter = lfilter->filter;
+    return 0;
+
+ out_nomem:
+    lfilter_free(lfilter);
+    return GE_NOMEM;
+}
@@ -15,53 +15,6 @@
 
 #include "gensio_filter_msgdelim.h"
 
-static const uint16_t crc16_table[256] = {
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
-};
-
-static void
-crc16(const unsigned char *buf, unsigned int len, uint16_t *icrc)
-{
-    unsigned int i;
-    uint16_t crc = *icrc;
-
-    for (i = 0; i < len; i++)
-	crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ buf[i]) & 0xff];
-
-    *icrc = crc;
-}
-
 struct msgdelim_filter {
     struct gensio_filter *filter;
 
@@ -168,6 +121,50 @@ msgdelim_add_wrbyte(struct msgdelim_filter *mfilter, unsigned char byte)
 	mfilter->write_data[mfilter->write_data_len++] = 0;
 }
 
+/*
+ * Add len bytes of user data, escaping any 254s.  The data between
+ * 254s is copied in one piece, most data doesn't have any.
+ */
+static void
+msgdelim_add_wrdata(struct msgdelim_filter *mfilter,
+		    const unsigned char *buf, gensiods len)
+{
+    const unsigned char *p;
+    gensiods run;
+
+    while (len > 0) {
+	p = memchr(buf, 254, len);
+	run = p ? (gensiods) (p - buf) : len;
+	memcpy(mfilter->write_data + mfilter->write_data_len, buf, run);
+	mfilter->write_data_len += run;
+	buf += run;
+	len -= run;
+	if (p) {
+	    msgdelim_add_wrbyte(mfilter, 254);
+	    buf++;
+	    len--;
+	}
+    }
+}
+
+/*
+ * Add received message data.  If it doesn't fit, the message is
+ * thrown away.
+ */
+static void
+msgdelim_add_rddata(struct msgdelim_filter *mfilter,
+		    const unsigned char *buf, gensiods len)
+{
+    gensiods left = mfilter->max_read_size - mfilter->read_data_len;
+
+    if (len > left) {
+	len = left;
+	mfilter->in_msg = false;
+    }
+    memcpy(mfilter->read_data + mfilter->read_data_len, buf, len);
+    mfilter->read_data_len += len;
+}
+
 static int
 msgdelim_ul_write(struct gensio_filter *filter,
 		  gensio_ul_filter_data_handler handler, void *cb_data,
@@ -183,25 +180,23 @@ msgdelim_ul_write(struct gensio_filter *filter,
 	if (rcount)
 	    *rcount = 0;
     } else {
-	gensiods i, j, writelen = 0;
+	gensiods i, writelen = 0;
 	uint16_t crc = 0;
 
 	for (i = 0; i < sglen; i++) {
 	    gensiods inlen = sg[i].buflen;
 	    const unsigned char *buf = sg[i].buf;
 
-	    crc16(buf, inlen, &crc);
-	    for (j = 0; j < inlen; j++) {
-		if (mfilter->user_write_pos >= mfilter->max_write_size) {
-		    err = GE_TOOBIG;
-		    mfilter->user_write_pos = 0;
-		    mfilter->write_data_len = 0;
-		    mfilter->write_data_pos = 0;
-		    goto out_err;
-		}
-		mfilter->user_write_pos++;
-		msgdelim_add_wrbyte(mfilter, buf[j]);
+	    if (inlen > mfilter->max_write_size - mfilter->user_write_pos) {
+		err = GE_TOOBIG;
+		mfilter->user_write_pos = 0;
+		mfilter->write_data_len = 0;
+		mfilter->write_data_pos = 0;
+		goto out_err;
 	    }
+	    gensio_crc16(buf, inlen, &crc);
+	    msgdelim_add_wrdata(mfilter, buf, inlen);
+	    mfilter->user_write_pos += inlen;
 	    writelen += inlen;
 	}
 	if (rcount)
@@ -248,6 +243,35 @@ msgdelim_ul_write(struct gensio_filter *filter,
     return err;
 }
 
+/*
+ * See if the message data starting at buf is a whole message in the
+ * ll's buffer, run bytes with no 254s followed by a separator, with
+ * a good CRC and not too big.  If so it can be delivered from there
+ * without copying it into read_data.
+ */
+static bool
+msgdelim_msg_in_buf(struct msgdelim_filter *mfilter,
+		    const unsigned char *buf, gensiods run, gensiods buflen,
+		    gensiods *msglen)
+{
+    uint16_t crc = 0;
+
+    if (run + 1 >= buflen || buf[run + 1] != 1)
+	return false;
+    if (run > mfilter->max_read_size)
+	return false; /* Let the normal path throw it away. */
+    if (mfilter->crc) {
+	if (run <= 2)
+	    return false;
+	gensio_crc16(buf, run, &crc);
+	if (crc != 0)
+	    return false;
+	run -= 2;
+    }
+    *msglen = run;
+    return true;
+}
+
 static int
 msgdelim_ll_write(struct gensio_filter *filter,
 		gensio_ll_filter_data_handler handler, void *cb_data,
@@ -267,49 +291,76 @@ msgdelim_ll_write(struct gensio_filter *filter,
 	    *rcount = 0;
     } else {
 	while (buflen && !mfilter->in_msg_complete) {
-	    unsigned char b = *buf++;
-
-	    buflen--;
-
-	    if (mfilter->in_cmd) {
-		mfilter->in_cmd = false;
-		switch (b) {
-		case 0: /* 254 0 is one 254 */
-		    b = 254;
-		    goto handle_data;
-
-		case 1: /* 254 1 is message separator */
-		    if (mfilter->in_msg) {
-			if (mfilter->crc) {
-			    if (mfilter->read_data_len <= 2)
-				break;
-			    crc = 0;
-			    crc16(mfilter->read_data, mfilter->read_data_len,
-				  &crc);
-			    if (crc != 0)
-				break;
-			    mfilter->read_data_len -= 2; /* Remove the CRC */
-			}
+	    unsigned char b;
+
+	    if (!mfilter->in_cmd) {
+		/* Take everything up to the next 254 in one piece. */
+		const unsigned char *p = memchr(buf, 254, buflen);
+		gensiods run = p ? (gensiods) (p - buf) : buflen;
+		gensiods msglen, count = 0;
+
+		if (mfilter->in_msg && !mfilter->read_data_len &&
+			msgdelim_msg_in_buf(mfilter, buf, run, buflen,
+					    &msglen)) {
+		    /* Skip the message and the separator. */
+		    buflen -= run + 2;
+		    if (rcount)
+			*rcount = in_buflen - buflen;
+		    msgdelim_unlock(mfilter);
+		    err = handler(cb_data, &count, buf, msglen, eomaux);
+		    msgdelim_lock(mfilter);
+		    if (!err && count < msglen) {
+			/* The ll buffer goes away, keep the rest. */
+			memcpy(mfilter->read_data, buf + count,
+			       msglen - count);
+			mfilter->read_data_len = msglen - count;
+			mfilter->read_data_pos = 0;
 			mfilter->in_msg_complete = true;
 		    }
-		    mfilter->in_msg = true;
-		    break;
-
-		default:
-		    mfilter->in_msg = false;
-		    break;
+		    goto out_unlock;
 		}
-	    } else if (b == 254) {
-		mfilter->in_cmd = true;
-	    } else {
-	    handle_data:
-		if (!mfilter->in_msg)
-		    continue;
-		if (mfilter->read_data_len >= mfilter->max_read_size) {
-		    mfilter->in_msg = false;
-		    continue;
+		if (mfilter->in_msg)
+		    msgdelim_add_rddata(mfilter, buf, run);
+		buf += run;
+		buflen -= run;
+		if (p) {
+		    mfilter->in_cmd = true;
+		    buf++;
+		    buflen--;
 		}
-		mfilter->read_data[mfilter->read_data_len++] = b;
+		continue;
+	    }
+
+	    b = *buf++;
+	    buflen--;
+	    mfilter->in_cmd = false;
+	    switch (b) {
+	    case 0: /* 254 0 is one 254 */
+		b = 254;
+		if (mfilter->in_msg)
+		    msgdelim_add_rddata(mfilter, &b, 1);
+		break;
+
+	    case 1: /* 254 1 is message separator */
+		if (mfilter->in_msg) {
+		    if (mfilter->crc) {
+			if (mfilter->read_data_len <= 2)
+			    break;
+			crc = 0;
+			gensio_crc16(mfilter->read_data,
+				     mfilter->read_data_len, &crc);
+			if (crc != 0)
+			    break;
+			mfilter->read_data_len -= 2; /* Remove the CRC */
+		    }
+		    mfilter->in_msg_complete = true;
+		}
+		mfilter->in_msg = true;
+		break;
+
+	    default:
+		mfilter->in_msg = false;
+		break;
 	    }
 	}
 
@@ -336,6 +387,7 @@ msgdelim_ll_write(struct gensio_filter *filter,
 	    }
 	}
     }
+ out_unlock:
     msgdelim_unlock(mfilter);
 
     return err;
@@ -8,6 +8,7 @@
 #include "config.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
@@ -15,6 +16,37 @@
 
 #include "gensio_filter_perf.h"
 
+/* Per-second rate samples kept for percentiles, the last ones are kept. */
+#define PERF_MAX_SAMPLES 1024
+
+struct perf_samples {
+    gensiods vals[PERF_MAX_SAMPLES];
+    unsigned int pos;
+    unsigned int count;
+};
+
+/*
+ * A log-linear histogram of round trip times in nanoseconds, like
+ * HdrHistogram.  Values below 64 get their own bucket, above that
+ * each power of two is split into 32 buckets, so it's accurate to
+ * about 3%.  This covers up to 2^45ns, about 9 hours.
+ */
+#define PERF_HIST_SUB		32
+#define PERF_HIST_SHIFTS	40
+#define PERF_HIST_BUCKETS	(2 * PERF_HIST_SUB + \
+				 PERF_HIST_SHIFTS * PERF_HIST_SUB)
+
+struct perf_hist {
+    uint64_t counts[PERF_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+/* A probe starts with a sequence number and send time, both 8 bytes. */
+#define PERF_PROBE_HDR_SIZE 16
+
 struct perf_filter {
     struct gensio_filter *filter;
     gensio_filter_cb filter_cb;
@@ -43,6 +75,32 @@ struct perf_filter {
     gensiods read_since_last_timeout;
     gensiods write_since_last_timeout;
 
+    struct perf_samples read_samples;
+    struct perf_samples write_samples;
+
+    /*
+     * Latency mode, if probe_size is set.  Send a probe, wait for it
+     * to be echoed back, record the time, and repeat.
+     */
+    gensiods probe_size;
+    gensiods nr_probes; /* Zero means don't stop. */
+    unsigned char *probe_buf;
+    gensiods probe_pos; /* How much of the probe has been written. */
+    gensiods probe_rpos; /* How much of the echo has been read. */
+    unsigned char probe_rhdr[PERF_PROBE_HDR_SIZE];
+    bool probe_outstanding;
+    uint64_t probe_seq;
+    gensiods probe_errs; /* Echoes that didn't match the probe. */
+    struct perf_hist hist;
+    struct perf_hist ihist; /* Since the last interval print. */
+
+    /* Print JSON lines instead of text. */
+    bool json;
+
+    /* If set, print the stats here instead of to the upper layer. */
+    char *statsfile;
+    FILE *statsf;
+
     gensiods print_pending;
     gensiods print_pos;
     char print_buffer[1024];
@@ -64,6 +122,186 @@ perf_unlock(struct perf_filter *pfilter)
     pfilter->o->unlock(pfilter->lock);
 }
 
+static void
+perf_add_sample(struct perf_samples *s, gensiods val)
+{
+    s->vals[s->pos] = val;
+    s->pos = (s->pos + 1) % PERF_MAX_SAMPLES;
+    if (s->count < PERF_MAX_SAMPLES)
+	s->count++;
+}
+
+static int
+perf_cmp_ds(const void *a, const void *b)
+{
+    gensiods v1 = *((const gensiods *) a), v2 = *((const gensiods *) b);
+
+    return v1 < v2 ? -1 : v1 > v2;
+}
+
+/*
+ * Fill in the min, 50th, 90th, 99th percentile and max of the
+ * samples, in that order.  All zero if there are no samples.
+ */
+static void
+perf_percentiles(const struct perf_samples *s, gensiods pcts[5])
+{
+    gensiods sorted[PERF_MAX_SAMPLES];
+    unsigned int n = s->count;
+
+    memset(pcts, 0, sizeof(gensiods) * 5);
+    if (n == 0)
+	return;
+    memcpy(sorted, s->vals, sizeof(gensiods) * n);
+    qsort(sorted, n, sizeof(gensiods), perf_cmp_ds);
+    pcts[0] = sorted[0];
+    pcts[1] = sorted[(n - 1) * 50 / 100];
+    pcts[2] = sorted[(n - 1) * 90 / 100];
+    pcts[3] = sorted[(n - 1) * 99 / 100];
+    pcts[4] = sorted[n - 1];
+}
+
+/*
+ * The stats line is in print_buffer with the given length.  Send it to
+ * the stats file or queue it for the upper layer.
+ */
+static void
+perf_emit(struct perf_filter *pfilter, int len)
+{
+    if (len < 0)
+	len = 0;
+    if ((gensiods) len >= sizeof(pfilter->print_buffer))
+	len = sizeof(pfilter->print_buffer) - 1;
+
+    pfilter->print_pos = 0;
+    if (pfilter->statsfile) {
+	if (!pfilter->statsf)
+	    pfilter->statsf = fopen(pfilter->statsfile, "a");
+	if (pfilter->statsf) {
+	    fwrite(pfilter->print_buffer, 1, len, pfilter->statsf);
+	    fflush(pfilter->statsf);
+	}
+	pfilter->print_pending = 0;
+    } else {
+	pfilter->print_pending = len;
+    }
+}
+
+static unsigned int
+perf_hist_idx(uint64_t v)
+{
+    unsigned int shift = 0;
+
+    if (v < 2 * PERF_HIST_SUB)
+	return v;
+    while ((v >> shift) >= 2 * PERF_HIST_SUB)
+	shift++;
+    if (shift > PERF_HIST_SHIFTS)
+	return PERF_HIST_BUCKETS - 1;
+    return 2 * PERF_HIST_SUB + (shift - 1) * PERF_HIST_SUB +
+	((v >> shift) - PERF_HIST_SUB);
+}
+
+/* The highest value that goes into the bucket. */
+static uint64_t
+perf_hist_val(unsigned int idx)
+{
+    unsigned int shift;
+    uint64_t sub;
+
+    if (idx < 2 * PERF_HIST_SUB)
+	return idx;
+    idx -= 2 * PERF_HIST_SUB;
+    shift = idx / PERF_HIST_SUB + 1;
+    sub = idx % PERF_HIST_SUB + PERF_HIST_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void
+perf_hist_add(struct perf_hist *h, uint64_t v)
+{
+    if (h->count == 0 || v < h->min)
+	h->min = v;
+    if (v > h->max)
+	h->max = v;
+    h->count++;
+    h->sum += v;
+    h->counts[perf_hist_idx(v)]++;
+}
+
+/* Percentile in tenths of a percent, returned in microseconds. */
+static double
+perf_hist_pct(const struct perf_hist *h, unsigned int pct)
+{
+    uint64_t target, total = 0, v;
+    unsigned int i;
+
+    if (h->count == 0)
+	return 0;
+    target = (h->count * pct + 999) / 1000;
+    if (target == 0)
+	target = 1;
+    for (i = 0; i < PERF_HIST_BUCKETS; i++) {
+	total += h->counts[i];
+	if (total >= target)
+	    break;
+    }
+    v = perf_hist_val(i);
+    if (v > h->max)
+	v = h->max;
+    if (v < h->min)
+	v = h->min;
+    return (double) v / 1000.0;
+}
+
+static double
+perf_hist_us(const struct perf_hist *h, uint64_t v)
+{
+    return h->count ? (double) v / 1000.0 : 0;
+}
+
+static double
+perf_hist_mean(const struct perf_hist *h)
+{
+    return h->count ? (double) h->sum / (double) h->count / 1000.0 : 0;
+}
+
+static uint64_t
+perf_now_ns(struct perf_filter *pfilter)
+{
+    gensio_time t;
+
+    pfilter->o->get_monotonic_time(pfilter->o, &t);
+    return (uint64_t) t.secs * 1000000000 + t.nsecs;
+}
+
+static void
+perf_put_u64(unsigned char *p, uint64_t v)
+{
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+	p[i] = v >> (56 - i * 8);
+}
+
+static uint64_t
+perf_get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+	v = (v << 8) | p[i];
+    return v;
+}
+
+static bool
+perf_probes_done(struct perf_filter *pfilter)
+{
+    return (pfilter->nr_probes && !pfilter->probe_outstanding &&
+	    pfilter->hist.count + pfilter->probe_errs >= pfilter->nr_probes);
+}
+
 static bool
 perf_ul_read_pending(struct gensio_filter *filter)
 {
@@ -77,6 +315,14 @@ perf_ll_write_pending(struct gensio_filter *filter)
 {
     struct perf_filter *pfilter = filter_to_perf(filter);
 
+    if (pfilter->probe_size) {
+	/* Like below, get REMCLOSE reported after the stats are out. */
+	if (perf_probes_done(pfilter))
+	    return pfilter->print_pending == 0;
+	return (!pfilter->probe_outstanding ||
+		pfilter->probe_pos < pfilter->probe_size);
+    }
+
     /*
      * Always return true if we are supplying data.  We want it to
      * supply data and then return a GE_REMCLOSE when out of data.
@@ -149,6 +395,54 @@ set_write_end_time(struct perf_filter *pfilter)
     }
 }
 
+/*
+ * Format latency stats into print_buffer, either the total or an
+ * interval of secs seconds.
+ */
+static int
+perf_format_latency(struct perf_filter *pfilter, const struct perf_hist *h,
+		    bool total, unsigned int secs)
+{
+    char *buf = pfilter->print_buffer;
+    gensiods size = sizeof(pfilter->print_buffer);
+
+    if (pfilter->json)
+	return snprintf(buf, size,
+			"{\"type\":\"%s\",\"secs\":%u,\"probes\":%lu,"
+			"\"probe_size\":%lu,\"errors\":%lu,"
+			"\"min_us\":%.1lf,\"mean_us\":%.1lf,"
+			"\"p50_us\":%.1lf,\"p90_us\":%.1lf,"
+			"\"p99_us\":%.1lf,\"p999_us\":%.1lf,"
+			"\"max_us\":%.1lf}\n",
+			total ? "latency_total" : "latency_interval", secs,
+			(unsigned long) h->count,
+			(unsigned long) pfilter->probe_size,
+			(unsigned long) pfilter->probe_errs,
+			perf_hist_us(h, h->min), perf_hist_mean(h),
+			perf_hist_pct(h, 500), perf_hist_pct(h, 900),
+			perf_hist_pct(h, 990), perf_hist_pct(h, 999),
+			perf_hist_us(h, h->max));
+    if (total)
+	return snprintf(buf, size,
+			"TOTAL: %lu probes of %lu bytes, %lu errors\n"
+			"         min %.1lf mean %.1lf max %.1lf usecs\n"
+			"         p50 %.1lf p90 %.1lf p99 %.1lf"
+			" p99.9 %.1lf usecs\n",
+			(unsigned long) h->count,
+			(unsigned long) pfilter->probe_size,
+			(unsigned long) pfilter->probe_errs,
+			perf_hist_us(h, h->min), perf_hist_mean(h),
+			perf_hist_us(h, h->max),
+			perf_hist_pct(h, 500), perf_hist_pct(h, 900),
+			perf_hist_pct(h, 990), perf_hist_pct(h, 999));
+    return snprintf(buf, size,
+		    "%lu probes in %u second%s, p50 %.1lf p99 %.1lf"
+		    " max %.1lf usecs\n",
+		    (unsigned long) h->count, secs, secs == 1 ? "" : "s",
+		    perf_hist_pct(h, 500), perf_hist_pct(h, 990),
+		    perf_hist_us(h, h->max));
+}
+
 static int
 perf_handle_end_check(struct perf_filter *pfilter)
 {
@@ -162,6 +456,7 @@ perf_handle_end_check(struct perf_filter *pfilter)
 	gensiods write_count;
 	double total_read_time;
 	double total_write_time;
+	int len;
 
 	pfilter->read_end_time.secs -= pfilter->start_time.secs;
 	pfilter->read_end_time.nsecs -= pfilter->start_time.nsecs;
@@ -186,7 +481,35 @@ perf_handle_end_check(struct perf_filter *pfilter)
 			    1000000000.0));
 
 	/* Flip read and write, this is from the user's perspective. */
-	pfilter->print_pending = snprintf(pfilter->print_buffer,
+	if (pfilter->probe_size) {
+	    len = perf_format_latency(pfilter, &pfilter->hist, true, 0);
+	} else if (pfilter->json) {
+	    gensiods wp[5], rp[5];
+
+	    perf_percentiles(&pfilter->write_samples, wp);
+	    perf_percentiles(&pfilter->read_samples, rp);
+	    len = snprintf(pfilter->print_buffer,
+			   sizeof(pfilter->print_buffer),
+			   "{\"type\":\"total\",\"wrote\":%lu,"
+			   "\"write_secs\":%lf,\"write_rate\":%lf,"
+			   "\"read\":%lu,\"read_secs\":%lf,"
+			   "\"read_rate\":%lf,\"intervals\":%u,"
+			   "\"write_rate_pct\":[%lu,%lu,%lu,%lu,%lu],"
+			   "\"read_rate_pct\":[%lu,%lu,%lu,%lu,%lu]}\n",
+			   (unsigned long) write_count, total_write_time,
+			   (double) write_count / total_write_time,
+			   (unsigned long) pfilter->read_count,
+			   total_read_time,
+			   (double) pfilter->read_count / total_read_time,
+			   pfilter->read_samples.count,
+			   (unsigned long) wp[0], (unsigned long) wp[1],
+			   (unsigned long) wp[2], (unsigned long) wp[3],
+			   (unsigned long) wp[4],
+			   (unsigned long) rp[0], (unsigned long) rp[1],
+			   (unsigned long) rp[2], (unsigned long) rp[3],
+			   (unsigned long) rp[4]);
+	} else {
+	    len = snprintf(pfilter->print_buffer,
 			  sizeof(pfilter->print_buffer),
 			  "TOTAL: Wrote %ld in %llu.%3.3u seconds\n"
 			  "         %lf write bytes/sec\n"
@@ -200,8 +523,9 @@ perf_handle_end_check(struct perf_filter *pfilter)
 			  (unsigned long long) pfilter->read_end_time.secs,
 			  (pfilter->read_end_time.nsecs + 500000) / 1000000,
 			  (double) pfilter->read_count / total_read_time);
+	}
 	pfilter->final_started = true;
-	pfilter->print_pos = 0;
+	perf_emit(pfilter, len);
     }
     return GE_INPROGRESS;
 }
@@ -212,6 +536,122 @@ perf_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
     return 0;
 }
 
+/*
+ * Keep writing until the lower layer doesn't take it all.  Nothing
+ * else will call this again until the lower layer write is ready.
+ * Called and returns with the lock held.
+ */
+static int
+perf_push_data(struct perf_filter *pfilter,
+	       gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    int err = 0;
+
+    while (pfilter->write_data_left > 0) {
+	gensiods count = pfilter->write_data_left, ocount;
+	struct gensio_sg sg = { pfilter->write_data, 0 };
+
+	if (count > pfilter->writebuf_size)
+	    count = pfilter->writebuf_size;
+	sg.buflen = count;
+	ocount = count;
+
+	perf_unlock(pfilter);
+	err = handler(cb_data, &count, &sg, 1, NULL);
+	perf_lock(pfilter);
+	if (err)
+	    break;
+	if (count > ocount)
+	    count = ocount;
+
+	pfilter->write_since_last_timeout += count;
+	pfilter->write_data_left -= count;
+	if (pfilter->write_data_left == 0)
+	    set_write_end_time(pfilter);
+	if (count < ocount)
+	    break;
+    }
+
+    return err;
+}
+
+/*
+ * Start a new probe if the last one came back, and write what we can
+ * of the current one.  Called and returns with the lock held.
+ */
+static int
+perf_push_probe(struct perf_filter *pfilter,
+		gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    int err = 0;
+
+    if (!pfilter->probe_outstanding) {
+	pfilter->probe_seq++;
+	perf_put_u64(pfilter->probe_buf, pfilter->probe_seq);
+	perf_put_u64(pfilter->probe_buf + 8, perf_now_ns(pfilter));
+	pfilter->probe_pos = 0;
+	pfilter->probe_rpos = 0;
+	pfilter->probe_outstanding = true;
+    }
+
+    while (pfilter->probe_pos < pfilter->probe_size) {
+	gensiods count = pfilter->probe_size - pfilter->probe_pos, ocount;
+	struct gensio_sg sg = { pfilter->probe_buf + pfilter->probe_pos,
+				count };
+
+	ocount = count;
+	perf_unlock(pfilter);
+	err = handler(cb_data, &count, &sg, 1, NULL);
+	perf_lock(pfilter);
+	if (err)
+	    break;
+	if (count > ocount)
+	    count = ocount;
+	pfilter->write_since_last_timeout += count;
+	pfilter->probe_pos += count;
+	if (count < ocount)
+	    break;
+    }
+
+    return err;
+}
+
+/* Handle echoed probe data from the lower layer. */
+static void
+perf_handle_echo(struct perf_filter *pfilter, unsigned char *buf,
+		 gensiods buflen)
+{
+    gensiods n, hn;
+    uint64_t now, sent;
+
+    while (buflen > 0 && pfilter->probe_outstanding) {
+	n = pfilter->probe_size - pfilter->probe_rpos;
+	if (n > buflen)
+	    n = buflen;
+	if (pfilter->probe_rpos < PERF_PROBE_HDR_SIZE) {
+	    hn = PERF_PROBE_HDR_SIZE - pfilter->probe_rpos;
+	    if (hn > n)
+		hn = n;
+	    memcpy(pfilter->probe_rhdr + pfilter->probe_rpos, buf, hn);
+	}
+	pfilter->probe_rpos += n;
+	buf += n;
+	buflen -= n;
+	if (pfilter->probe_rpos < pfilter->probe_size)
+	    break;
+
+	pfilter->probe_outstanding = false;
+	if (perf_get_u64(pfilter->probe_rhdr) != pfilter->probe_seq) {
+	    pfilter->probe_errs++;
+	    continue;
+	}
+	now = perf_now_ns(pfilter);
+	sent = perf_get_u64(pfilter->probe_rhdr + 8);
+	perf_hist_add(&pfilter->hist, now - sent);
+	perf_hist_add(&pfilter->ihist, now - sent);
+    }
+}
+
 static int
 perf_ul_write(struct gensio_filter *filter,
 	      gensio_ul_filter_data_handler handler, void *cb_data,
@@ -230,27 +670,15 @@ perf_ul_write(struct gensio_filter *filter,
 	*rcount = writelen;
 
     perf_lock(pfilter);
-    if (pfilter->write_data_left > 0) {
-	gensiods count = pfilter->write_data_left, ocount;
-	struct gensio_sg sg = { pfilter->write_data, 0 };
-
-	if (count > pfilter->writebuf_size)
-	    count = pfilter->writebuf_size;
-	sg.buflen = count;
-	ocount = count;
-
-	perf_unlock(pfilter);
-	err = handler(cb_data, &count, &sg, 1, NULL);
-	perf_lock(pfilter);
-	if (!err) {
-	    if (count > ocount)
-		count = ocount;
-
-	    pfilter->write_since_last_timeout += count;
-	    pfilter->write_data_left -= count;
-	    if (pfilter->write_data_left == 0)
-		set_write_end_time(pfilter);
-	}
+    if (pfilter->probe_size) {
+	if (!perf_probes_done(pfilter))
+	    err = perf_push_probe(pfilter, handler, cb_data);
+	else if (!pfilter->final_started)
+	    perf_handle_end_check(pfilter);
+	else if (pfilter->print_pending == 0)
+	    err = GE_REMCLOSE;
+    } else if (pfilter->write_data_left > 0) {
+	err = perf_push_data(pfilter, handler, cb_data);
     } else if (pfilter->write_len || pfilter->orig_expect_len) {
 	if (!pfilter->final_started && pfilter->expect_len == 0)
 	    /* We were supplying data and we are out of data. */
@@ -280,6 +708,8 @@ perf_ll_write(struct gensio_filter *filter,
     perf_lock(pfilter);
     pfilter->read_count += buflen;
     pfilter->read_since_last_timeout += buflen;
+    if (pfilter->probe_size)
+	perf_handle_echo(pfilter, buf, buflen);
     if (buflen > pfilter->expect_len)
 	pfilter->expect_len = 0;
     else
@@ -317,17 +747,35 @@ perf_filter_timeout(struct gensio_filter *filter)
     perf_lock(pfilter);
     pfilter->timeouts_since_print++;
     if (!pfilter->print_pending) {
-	pfilter->print_pending = snprintf(pfilter->print_buffer,
+	unsigned int secs = pfilter->timeouts_since_print;
+	int len;
+
+	perf_add_sample(&pfilter->write_samples,
+			pfilter->write_since_last_timeout / secs);
+	perf_add_sample(&pfilter->read_samples,
+			pfilter->read_since_last_timeout / secs);
+	if (pfilter->probe_size)
+	    len = perf_format_latency(pfilter, &pfilter->ihist, false, secs);
+	else if (pfilter->json)
+	    len = snprintf(pfilter->print_buffer,
+			   sizeof(pfilter->print_buffer),
+			   "{\"type\":\"interval\",\"secs\":%u,"
+			   "\"wrote\":%lu,\"read\":%lu}\n",
+			   secs,
+			   (unsigned long) pfilter->write_since_last_timeout,
+			   (unsigned long) pfilter->read_since_last_timeout);
+	else
+	    len = snprintf(pfilter->print_buffer,
 			  sizeof(pfilter->print_buffer),
 			  "Wrote %ld, Read %ld in %u second%s\n",
 			  pfilter->write_since_last_timeout,
 			  pfilter->read_since_last_timeout,
-			  pfilter->timeouts_since_print,
-			  pfilter->timeouts_since_print == 1 ? "" : "s");
+			  secs, secs == 1 ? "" : "s");
 	pfilter->write_since_last_timeout = 0;
 	pfilter->read_since_last_timeout = 0;
 	pfilter->timeouts_since_print = 0;
-	pfilter->print_pos = 0;
+	memset(&pfilter->ihist, 0, sizeof(pfilter->ihist));
+	perf_emit(pfilter, len);
     }
     perf_filter_start_timer(pfilter);
     perf_unlock(pfilter);
@@ -351,6 +799,61 @@ perf_setup(struct gensio_filter *filter)
     return 0;
 }
 
+static int
+perf_filter_control(struct perf_filter *pfilter, bool get, int op,
+		    char *data, gensiods *datalen)
+{
+    gensiods wp[5], rp[5], size = *datalen;
+
+    switch (op) {
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	perf_lock(pfilter);
+	perf_percentiles(&pfilter->write_samples, wp);
+	perf_percentiles(&pfilter->read_samples, rp);
+	/* Flip read and write, this is from the user's perspective. */
+	*datalen = snprintf(data, *datalen,
+			    "wrote=%lu read=%lu intervals=%u"
+			    " write_rate_min=%lu write_rate_p50=%lu"
+			    " write_rate_p90=%lu write_rate_p99=%lu"
+			    " write_rate_max=%lu"
+			    " read_rate_min=%lu read_rate_p50=%lu"
+			    " read_rate_p90=%lu read_rate_p99=%lu"
+			    " read_rate_max=%lu",
+			    (unsigned long) (pfilter->write_len -
+					     pfilter->write_data_left),
+			    (unsigned long) pfilter->read_count,
+			    pfilter->read_samples.count,
+			    (unsigned long) wp[0], (unsigned long) wp[1],
+			    (unsigned long) wp[2], (unsigned long) wp[3],
+			    (unsigned long) wp[4],
+			    (unsigned long) rp[0], (unsigned long) rp[1],
+			    (unsigned long) rp[2], (unsigned long) rp[3],
+			    (unsigned long) rp[4]);
+	if (pfilter->probe_size && *datalen < size) {
+	    const struct perf_hist *h = &pfilter->hist;
+
+	    *datalen += snprintf(data + *datalen, size - *datalen,
+			" probes=%lu probe_errors=%lu lat_min_us=%.1lf"
+			" lat_mean_us=%.1lf lat_p50_us=%.1lf"
+			" lat_p90_us=%.1lf lat_p99_us=%.1lf"
+			" lat_p999_us=%.1lf lat_max_us=%.1lf",
+			(unsigned long) h->count,
+			(unsigned long) pfilter->probe_errs,
+			perf_hist_us(h, h->min), perf_hist_mean(h),
+			perf_hist_pct(h, 500), perf_hist_pct(h, 900),
+			perf_hist_pct(h, 990), perf_hist_pct(h, 999),
+			perf_hist_us(h, h->max));
+	}
+	perf_unlock(pfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static void
 perf_filter_cleanup(struct gensio_filter *filter)
 {
@@ -366,6 +869,16 @@ perf_filter_cleanup(struct gensio_filter *filter)
     pfilter->timeouts_since_print = 0;
     pfilter->print_pending = 0;
     pfilter->final_started = false;
+    memset(&pfilter->read_samples, 0, sizeof(pfilter->read_samples));
+    memset(&pfilter->hist, 0, sizeof(pfilter->hist));
+    memset(&pfilter->ihist, 0, sizeof(pfilter->ihist));
+    pfilter->probe_outstanding = false;
+    pfilter->probe_errs = 0;
+    memset(&pfilter->write_samples, 0, sizeof(pfilter->write_samples));
+    if (pfilter->statsf) {
+	fclose(pfilter->statsf);
+	pfilter->statsf = NULL;
+    }
 }
 
 static void
@@ -375,6 +888,12 @@ pfilter_free(struct perf_filter *pfilter)
 	pfilter->o->free_lock(pfilter->lock);
     if (pfilter->write_data)
 	pfilter->o->free(pfilter->o, pfilter->write_data);
+    if (pfilter->probe_buf)
+	pfilter->o->free(pfilter->o, pfilter->probe_buf);
+    if (pfilter->statsf)
+	fclose(pfilter->statsf);
+    if (pfilter->statsfile)
+	pfilter->o->free(pfilter->o, pfilter->statsfile);
     if (pfilter->filter)
 	gensio_filter_free_data(pfilter->filter);
     pfilter->o->free(pfilter->o, pfilter);
@@ -438,6 +957,10 @@ static int gensio_perf_filter_func(struct gensio_filter *filter, int op,
 	perf_filter_io_err(filter, *((int *) data));
 	return 0;
 
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return perf_filter_control(filter_to_perf(filter), *((bool *) cbuf),
+				   buflen, data, count);
+
     case GENSIO_FILTER_FUNC_FREE:
 	perf_free(filter);
 	return 0;
@@ -450,7 +973,9 @@ static int gensio_perf_filter_func(struct gensio_filter *filter, int op,
 static struct gensio_filter *
 gensio_perf_filter_raw_alloc(struct gensio_os_funcs *o,
 			     gensiods writebuf_size, gensiods write_len,
-			     gensiods expect_len)
+			     gensiods expect_len, bool json,
+			     const char *statsfile, gensiods probe_size,
+			     gensiods nr_probes)
 {
     struct perf_filter *pfilter;
 
@@ -464,6 +989,21 @@ gensio_perf_filter_raw_alloc(struct gensio_os_funcs *o,
     pfilter->write_data_left = write_len;
     pfilter->expect_len = expect_len;
     pfilter->orig_expect_len = expect_len;
+    pfilter->json = json;
+    pfilter->probe_size = probe_size;
+    pfilter->nr_probes = nr_probes;
+
+    if (probe_size) {
+	pfilter->probe_buf = o->zalloc(o, probe_size);
+	if (!pfilter->probe_buf)
+	    goto out_nomem;
+    }
+
+    if (statsfile) {
+	pfilter->statsfile = gensio_strdup(o, statsfile);
+	if (!pfilter->statsfile)
+	    goto out_nomem;
+    }
 
     pfilter->lock = o->alloc_lock(o);
     if (!pfilter->lock)
@@ -495,6 +1035,11 @@ gensio_perf_filter_alloc(struct gensio_pparm_info *p,
     gensiods writebuf_size = 1024;
     gensiods write_len = 0;
     gensiods expect_len = 0;
+    const char *statsfile = NULL;
+    const char *format = "text";
+    gensiods probe_size = 0;
+    gensiods nr_probes = 0;
+    bool json;
     unsigned int i;
 
     for (i = 0; args && args[i]; i++) {
@@ -504,12 +1049,33 @@ gensio_perf_filter_alloc(struct gensio_pparm_info *p,
 	    continue;
 	if (gensio_pparm_ds(p, args[i], "expect_len", &expect_len) > 0)
 	    continue;
+	if (gensio_pparm_value(p, args[i], "format", &format) > 0)
+	    continue;
+	if (gensio_pparm_value(p, args[i], "statsfile", &statsfile) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "latency", &probe_size) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "probes", &nr_probes) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(p, args[i]);
 	return GE_INVAL;
     }
 
+    if (strcmp(format, "json") == 0) {
+	json = true;
+    } else if (strcmp(format, "text") == 0) {
+	json = false;
+    } else {
+	gensio_pparm_log(p, "format must be text or json, not %s", format);
+	return GE_INVAL;
+    }
+
+    if (probe_size && probe_size < PERF_PROBE_HDR_SIZE)
+	probe_size = PERF_PROBE_HDR_SIZE;
+
     filter = gensio_perf_filter_raw_alloc(o, writebuf_size, write_len,
-					  expect_len);
+					  expect_len, json, statsfile,
+					  probe_size, nr_probes);
     if (!filter)
 	return GE_NOMEM;
 
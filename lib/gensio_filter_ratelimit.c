@@ -8,12 +8,67 @@
 #include "config.h"
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
 
 #include "gensio_filter_ratelimit.h"
 
+#define RL_NSEC_PER_SEC 1000000000ULL
+
+/*
+ * When a bucket runs dry, wait until it has refilled by this fraction
+ * of a second's worth of data (or the whole burst if that is smaller)
+ * before sending again.  This bounds the number of timer wakeups.
+ */
+#define RL_WAKEUPS_PER_SEC 50
+
+/* Max number of sg entries passed down in one write in token mode. */
+#define RL_MAX_SG 16
+
+/*
+ * A token bucket.  Tokens are bytes, they are added at rate bytes per
+ * second up to burst.  A rate of zero means no limit.
+ */
+struct ratelimit_bucket {
+    gensiods rate;
+    gensiods burst;
+    gensiods tokens;
+    uint64_t last; /* Monotonic time of the last refill, in nsecs. */
+    unsigned int waiters; /* Group buckets, members held back by it. */
+};
+
+/*
+ * A named group.  Every filter in the group with the same os funcs
+ * draws from the group's buckets as well as its own.  Groups are
+ * created by the first filter that names them and go away with the
+ * last one.  All group data is protected by rl_group_lock; the lock
+ * order is a filter's lock, then rl_group_lock.
+ */
+struct ratelimit_group {
+    struct gensio_link link;
+    struct gensio_os_funcs *o;
+    char *name;
+    unsigned int refcount;
+    struct ratelimit_bucket xmit;
+    struct ratelimit_bucket recv;
+};
+
+static struct gensio_os_funcs *rl_group_o;
+static struct gensio_lock *rl_group_lock;
+static struct gensio_list rl_groups;
+
+/* One direction of a filter in token bucket mode. */
+struct ratelimit_dir {
+    struct ratelimit_bucket b;	 /* Our own limit, rate is 0 if none. */
+    struct ratelimit_bucket *gb; /* The group's bucket, or NULL. */
+    bool blocked;  /* Ran dry, waiting for the timer to refill. */
+    bool gwaiting; /* Counted in gb->waiters. */
+    bool gheld;    /* The last dir_available() was cut short by gb. */
+};
+
 struct ratelimit_filter {
     struct gensio_filter *filter;
 
@@ -24,11 +79,19 @@ struct ratelimit_filter {
     gensio_filter_cb filter_cb;
     void *filter_cb_data;
 
+    /* Fixed mode, xmit_len bytes every delay.  Unused if delay is 0. */
     gensiods xmit_buf_len;
     unsigned char *xmit_buf;
     gensio_time delay;
 
     bool xmit_ready;
+
+    /* Token bucket mode, both directions share the one timer. */
+    struct ratelimit_group *group;
+    struct ratelimit_dir xmit;
+    struct ratelimit_dir recv;
+    bool timer_running;
+    uint64_t timer_when;
 };
 
 #define filter_to_ratelimit(v) ((struct ratelimit_filter *) \
@@ -53,6 +116,285 @@ ratelimit_filter_start_timer(struct ratelimit_filter *rfilter)
 		       GENSIO_FILTER_CB_START_TIMER, &rfilter->delay);
 }
 
+static bool
+ratelimit_fixed_mode(struct ratelimit_filter *rfilter)
+{
+    return rfilter->delay.secs != 0 || rfilter->delay.nsecs != 0;
+}
+
+static uint64_t
+ratelimit_now(struct ratelimit_filter *rfilter)
+{
+    gensio_time t;
+
+    rfilter->o->get_monotonic_time(rfilter->o, &t);
+    return t.secs * RL_NSEC_PER_SEC + t.nsecs;
+}
+
+static void
+bucket_reset(struct ratelimit_bucket *b, uint64_t now)
+{
+    b->tokens = b->burst;
+    b->last = now;
+}
+
+static void
+bucket_refill(struct ratelimit_bucket *b, uint64_t now)
+{
+    uint64_t elapsed, secs, add;
+
+    if (!b->rate || now <= b->last)
+	return;
+    elapsed = now - b->last;
+    secs = elapsed / RL_NSEC_PER_SEC;
+    if (b->tokens >= b->burst || secs > b->burst / b->rate) {
+	b->tokens = b->burst;
+	b->last = now;
+	return;
+    }
+    add = secs * b->rate + (elapsed % RL_NSEC_PER_SEC) * b->rate
+	/ RL_NSEC_PER_SEC;
+    if (add >= b->burst - b->tokens) {
+	b->tokens = b->burst;
+	b->last = now;
+    } else {
+	b->tokens += add;
+	/* Only advance by the time the tokens account for. */
+	b->last += (add / b->rate) * RL_NSEC_PER_SEC +
+	    (add % b->rate) * RL_NSEC_PER_SEC / b->rate;
+    }
+}
+
+static gensiods
+bucket_wake_level(struct ratelimit_bucket *b)
+{
+    gensiods level = b->rate / RL_WAKEUPS_PER_SEC;
+
+    if (level == 0)
+	level = 1;
+    if (level > b->burst)
+	level = b->burst;
+    return level;
+}
+
+/*
+ * A member waiting on a group only needs its part of the wake level,
+ * otherwise the first one to wake takes most of every refill.
+ */
+static gensiods
+group_wake_level(struct ratelimit_bucket *b)
+{
+    gensiods level = bucket_wake_level(b);
+
+    if (b->waiters > 1)
+	level /= b->waiters;
+    if (level == 0)
+	level = 1;
+    return level;
+}
+
+/* Time in nsecs until the bucket reaches level. */
+static uint64_t
+bucket_wait_time(struct ratelimit_bucket *b, gensiods level)
+{
+    gensiods need;
+
+    if (!b->rate || b->tokens >= level)
+	return 0;
+    need = level - b->tokens;
+    return (need / b->rate) * RL_NSEC_PER_SEC +
+	((need % b->rate) * RL_NSEC_PER_SEC + b->rate - 1) / b->rate;
+}
+
+static void
+rl_group_lock_on(void)
+{
+    rl_group_o->lock(rl_group_lock);
+}
+
+static void
+rl_group_unlock(void)
+{
+    rl_group_o->unlock(rl_group_lock);
+}
+
+static bool
+dir_limited(struct ratelimit_dir *d)
+{
+    return d->b.rate || d->gb;
+}
+
+/* Must be called with rl_group_lock held. */
+static void
+dir_unwait(struct ratelimit_dir *d)
+{
+    if (d->gwaiting) {
+	d->gb->waiters--;
+	d->gwaiting = false;
+    }
+}
+
+/*
+ * How many of the want bytes may go through now.  If others are held
+ * back by the group, only take our part of what it has so the members
+ * get a fair share.  Must be called with the filter lock held.
+ */
+static gensiods
+dir_available(struct ratelimit_dir *d, uint64_t now, gensiods want)
+{
+    gensiods avail = (gensiods) -1, share;
+
+    if (d->b.rate) {
+	bucket_refill(&d->b, now);
+	avail = d->b.tokens;
+    }
+    d->gheld = false;
+    if (d->gb) {
+	rl_group_lock_on();
+	if (d->gb->rate) {
+	    bucket_refill(d->gb, now);
+	    /* gb->waiters already counts us if we are waiting. */
+	    share = d->gb->tokens / (d->gb->waiters + !d->gwaiting);
+	    if (share == 0)
+		share = d->gb->tokens;
+	    if (share < want && share <= avail)
+		d->gheld = true;
+	    if (share < avail)
+		avail = share;
+	}
+	rl_group_unlock();
+    }
+    if (avail > want)
+	avail = want;
+    return avail;
+}
+
+/*
+ * Account for count bytes going through.  Returns true if a bucket
+ * ran dry or the group held us back and the direction has to wait.
+ * A member held back by the group stays counted in the group's
+ * waiters until it gets all it asks for, so the others keep leaving
+ * it its share.  Must be called with the filter lock held.
+ */
+static bool
+dir_consume(struct ratelimit_dir *d, gensiods count)
+{
+    bool dry = false;
+
+    if (d->b.rate) {
+	if (count > d->b.tokens)
+	    count = d->b.tokens;
+	d->b.tokens -= count;
+	dry = d->b.tokens == 0;
+    }
+    if (d->gb) {
+	rl_group_lock_on();
+	if (d->gb->rate) {
+	    if (count > d->gb->tokens)
+		d->gb->tokens = 0;
+	    else
+		d->gb->tokens -= count;
+	    if (d->gb->tokens == 0 || d->gheld) {
+		dry = true;
+		if (!d->gwaiting) {
+		    d->gwaiting = true;
+		    d->gb->waiters++;
+		}
+	    } else {
+		dir_unwait(d);
+	    }
+	}
+	rl_group_unlock();
+    }
+    return dry;
+}
+
+/* Must be called with the filter lock held. */
+static uint64_t
+dir_wait_time(struct ratelimit_dir *d, uint64_t now)
+{
+    uint64_t wait = 0, t;
+
+    if (d->b.rate)
+	wait = bucket_wait_time(&d->b, bucket_wake_level(&d->b));
+    if (d->gb) {
+	rl_group_lock_on();
+	bucket_refill(d->gb, now);
+	t = bucket_wait_time(d->gb, group_wake_level(d->gb));
+	rl_group_unlock();
+	if (t > wait)
+	    wait = t;
+    }
+    return wait;
+}
+
+/*
+ * Check if a blocked direction has refilled enough to go again.  Must
+ * be called with the filter lock held.
+ */
+static bool
+dir_ready(struct ratelimit_dir *d, uint64_t now)
+{
+    bool ready = true;
+
+    if (d->b.rate) {
+	bucket_refill(&d->b, now);
+	ready = d->b.tokens >= bucket_wake_level(&d->b);
+    }
+    if (d->gb) {
+	rl_group_lock_on();
+	if (d->gb->rate) {
+	    bucket_refill(d->gb, now);
+	    if (d->gb->tokens < group_wake_level(d->gb))
+		ready = false;
+	}
+	rl_group_unlock();
+    }
+    if (ready)
+	d->blocked = false;
+    return ready;
+}
+
+/*
+ * Run the timer for the earliest time a blocked bucket can go again.
+ * Must be called with the lock held.
+ */
+static void
+ratelimit_sched_timer(struct ratelimit_filter *rfilter, uint64_t now)
+{
+    uint64_t wait = UINT64_MAX, t;
+    gensio_time timeout;
+
+    if (rfilter->xmit.blocked)
+	wait = dir_wait_time(&rfilter->xmit, now);
+    if (rfilter->recv.blocked) {
+	t = dir_wait_time(&rfilter->recv, now);
+	if (t < wait)
+	    wait = t;
+    }
+    if (wait == UINT64_MAX)
+	return;
+    if (wait == 0)
+	wait = 1;
+
+    if (rfilter->timer_running) {
+	if (rfilter->timer_when <= now + wait)
+	    return;
+	/*
+	 * If this fails the timeout is already on its way and will
+	 * reschedule as needed.
+	 */
+	rfilter->filter_cb(rfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_STOP_TIMER, NULL);
+    }
+    timeout.secs = wait / RL_NSEC_PER_SEC;
+    timeout.nsecs = wait % RL_NSEC_PER_SEC;
+    rfilter->timer_running = true;
+    rfilter->timer_when = now + wait;
+    rfilter->filter_cb(rfilter->filter_cb_data,
+		       GENSIO_FILTER_CB_START_TIMER, &timeout);
+}
+
 static void
 ratelimit_set_callbacks(struct ratelimit_filter *rfilter,
 			gensio_filter_cb cb, void *cb_data)
@@ -76,7 +418,21 @@ ratelimit_ll_write_pending(struct ratelimit_filter *rfilter)
 static bool
 ratelimit_ul_can_write(struct ratelimit_filter *rfilter, bool *rv)
 {
-    *rv = rfilter->xmit_ready;
+    ratelimit_lock(rfilter);
+    if (ratelimit_fixed_mode(rfilter))
+	*rv = rfilter->xmit_ready;
+    else
+	*rv = !rfilter->xmit.blocked;
+    ratelimit_unlock(rfilter);
+    return 0;
+}
+
+static int
+ratelimit_ll_can_read(struct ratelimit_filter *rfilter, bool *rv)
+{
+    ratelimit_lock(rfilter);
+    *rv = !rfilter->recv.blocked;
+    ratelimit_unlock(rfilter);
     return 0;
 }
 
@@ -96,7 +452,15 @@ static int
 ratelimit_try_connect(struct ratelimit_filter *rfilter, gensio_time *timeout,
 		      bool was_timeout)
 {
+    uint64_t now = ratelimit_now(rfilter);
+
+    ratelimit_lock(rfilter);
     rfilter->xmit_ready = true;
+    bucket_reset(&rfilter->xmit.b, now);
+    bucket_reset(&rfilter->recv.b, now);
+    rfilter->xmit.blocked = false;
+    rfilter->recv.blocked = false;
+    ratelimit_unlock(rfilter);
     return 0;
 }
 
@@ -107,6 +471,55 @@ ratelimit_try_disconnect(struct ratelimit_filter *rfilter, gensio_time *timeout,
     return 0;
 }
 
+static int
+ratelimit_bucket_ul_write(struct ratelimit_filter *rfilter,
+			  gensio_ul_filter_data_handler handler, void *cb_data,
+			  gensiods *rcount,
+			  const struct gensio_sg *sg, gensiods sglen,
+			  const char *const *auxdata)
+{
+    struct gensio_sg xsg[RL_MAX_SG];
+    gensiods i, n, count = 0, allow, want = 0;
+    uint64_t now;
+    int err = 0;
+
+    ratelimit_lock(rfilter);
+    if (rfilter->xmit.blocked || sglen == 0)
+	goto out;
+    now = ratelimit_now(rfilter);
+
+    /* Pass down as much of the user's sg as we have tokens for. */
+    for (i = 0; i < sglen; i++)
+	want += sg[i].buflen;
+    allow = dir_available(&rfilter->xmit, now, want);
+    for (i = 0, n = 0; i < sglen && n < RL_MAX_SG && allow > 0; i++) {
+	if (sg[i].buflen == 0)
+	    continue;
+	xsg[n].buf = sg[i].buf;
+	xsg[n].buflen = sg[i].buflen;
+	if (xsg[n].buflen > allow)
+	    xsg[n].buflen = allow;
+	allow -= xsg[n].buflen;
+	n++;
+    }
+    if (n > 0) {
+	ratelimit_unlock(rfilter);
+	err = handler(cb_data, &count, xsg, n, auxdata);
+	ratelimit_lock(rfilter);
+	if (err)
+	    goto out;
+    }
+    if (dir_consume(&rfilter->xmit, count)) {
+	rfilter->xmit.blocked = true;
+	ratelimit_sched_timer(rfilter, now);
+    }
+ out:
+    ratelimit_unlock(rfilter);
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
 static int
 ratelimit_ul_write(struct ratelimit_filter *rfilter,
 		   gensio_ul_filter_data_handler handler, void *cb_data,
@@ -118,6 +531,13 @@ ratelimit_ul_write(struct ratelimit_filter *rfilter,
     struct gensio_sg xsg;
     int err = 0;
 
+    if (!ratelimit_fixed_mode(rfilter)) {
+	if (!dir_limited(&rfilter->xmit))
+	    return handler(cb_data, rcount, sg, sglen, auxdata);
+	return ratelimit_bucket_ul_write(rfilter, handler, cb_data, rcount,
+					 sg, sglen, auxdata);
+    }
+
     ratelimit_lock(rfilter);
     if (!rfilter->xmit_ready)
 	goto out;
@@ -153,7 +573,41 @@ ratelimit_ll_write(struct ratelimit_filter *rfilter,
 		unsigned char *buf, gensiods buflen,
 		const char *const *auxdata)
 {
-    return handler(cb_data, rcount, buf, buflen, auxdata);
+    gensiods count = 0;
+    uint64_t now;
+    int err;
+
+    if (!dir_limited(&rfilter->recv) || buflen == 0)
+	return handler(cb_data, rcount, buf, buflen, auxdata);
+
+    ratelimit_lock(rfilter);
+    if (rfilter->recv.blocked) {
+	ratelimit_unlock(rfilter);
+	goto out;
+    }
+    now = ratelimit_now(rfilter);
+    buflen = dir_available(&rfilter->recv, now, buflen);
+    ratelimit_unlock(rfilter);
+
+    if (buflen > 0) {
+	err = handler(cb_data, &count, buf, buflen, auxdata);
+	if (err)
+	    return err;
+	if (count > buflen)
+	    count = buflen;
+    }
+
+    ratelimit_lock(rfilter);
+    if (dir_consume(&rfilter->recv, count)) {
+	/* The base stops reading from below until the timer goes off. */
+	rfilter->recv.blocked = true;
+	ratelimit_sched_timer(rfilter, now);
+    }
+    ratelimit_unlock(rfilter);
+ out:
+    if (rcount)
+	*rcount = count;
+    return 0;
 }
 
 static int
@@ -165,6 +619,97 @@ ratelimit_setup(struct ratelimit_filter *rfilter)
 static void
 ratelimit_filter_cleanup(struct ratelimit_filter *rfilter)
 {
+    rfilter->timer_running = false;
+    rfilter->xmit.blocked = false;
+    rfilter->recv.blocked = false;
+    if (rfilter->group) {
+	rl_group_lock_on();
+	dir_unwait(&rfilter->xmit);
+	dir_unwait(&rfilter->recv);
+	rl_group_unlock();
+    }
+}
+
+static void
+ratelimit_group_put(struct ratelimit_filter *rfilter)
+{
+    struct ratelimit_group *g = rfilter->group;
+
+    rl_group_lock_on();
+    dir_unwait(&rfilter->xmit);
+    dir_unwait(&rfilter->recv);
+    if (--g->refcount == 0) {
+	gensio_list_rm(&rl_groups, &g->link);
+	g->o->free(g->o, g->name);
+	g->o->free(g->o, g);
+    }
+    rl_group_unlock();
+}
+
+/*
+ * Find a group or create it.  Rates of zero leave the group's current
+ * values alone, otherwise the newest filter's values are used.
+ */
+static int
+ratelimit_group_get(struct gensio_pparm_info *p,
+		    struct ratelimit_filter *rfilter, const char *name,
+		    gensiods xmit_rate, gensiods xmit_burst,
+		    gensiods recv_rate, gensiods recv_burst)
+{
+    struct gensio_os_funcs *o = rfilter->o;
+    struct ratelimit_group *g = NULL;
+    struct gensio_link *l;
+    uint64_t now = ratelimit_now(rfilter);
+    int rv = 0;
+
+    rl_group_lock_on();
+    gensio_list_for_each(&rl_groups, l) {
+	struct ratelimit_group *g2 = gensio_container_of(l,
+						struct ratelimit_group, link);
+
+	if (g2->o == o && strcmp(g2->name, name) == 0) {
+	    g = g2;
+	    break;
+	}
+    }
+    if (!g) {
+	if (!xmit_rate && !recv_rate) {
+	    gensio_pparm_slog(p, "group %s does not exist and no group rate"
+			      " was given", name);
+	    rv = GE_INVAL;
+	    goto out_unlock;
+	}
+	g = o->zalloc(o, sizeof(*g));
+	if (!g) {
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+	g->name = gensio_strdup(o, name);
+	if (!g->name) {
+	    o->free(o, g);
+	    rv = GE_NOMEM;
+	    goto out_unlock;
+	}
+	g->o = o;
+	gensio_list_add_tail(&rl_groups, &g->link);
+    }
+    if (xmit_rate) {
+	g->xmit.rate = xmit_rate;
+	g->xmit.burst = xmit_burst;
+	bucket_reset(&g->xmit, now);
+    }
+    if (recv_rate) {
+	g->recv.rate = recv_rate;
+	g->recv.burst = recv_burst;
+	bucket_reset(&g->recv, now);
+    }
+    g->refcount++;
+    rfilter->group = g;
+    rfilter->xmit.gb = &g->xmit;
+    rfilter->recv.gb = &g->recv;
+ out_unlock:
+    rl_group_unlock();
+    return rv;
 }
 
 static void
@@ -172,6 +717,9 @@ ratelimit_free(struct ratelimit_filter *rfilter)
 {
     struct gensio_os_funcs *o = rfilter->o;
 
+    if (rfilter->group)
+	ratelimit_group_put(rfilter);
+
     if (rfilter->lock)
 	o->free_lock(rfilter->lock);
     if (rfilter->xmit_buf)
@@ -184,10 +732,26 @@ ratelimit_free(struct ratelimit_filter *rfilter)
 static int
 ratelimit_filter_timeout(struct ratelimit_filter *rfilter)
 {
+    uint64_t now;
+
     ratelimit_lock(rfilter);
-    rfilter->xmit_ready = true;
-    rfilter->filter_cb(rfilter->filter_cb_data,
-		       GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    if (ratelimit_fixed_mode(rfilter)) {
+	rfilter->xmit_ready = true;
+	rfilter->filter_cb(rfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+	goto out_unlock;
+    }
+
+    rfilter->timer_running = false;
+    now = ratelimit_now(rfilter);
+    if (rfilter->xmit.blocked && dir_ready(&rfilter->xmit, now))
+	rfilter->filter_cb(rfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    /* The base re-evaluates the read enables after a timeout. */
+    if (rfilter->recv.blocked)
+	dir_ready(&rfilter->recv, now);
+    ratelimit_sched_timer(rfilter, now);
+ out_unlock:
     ratelimit_unlock(rfilter);
     return 0;
 }
@@ -218,6 +782,9 @@ static int gensio_ratelimit_filter_func(struct gensio_filter *filter, int op,
     case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
 	return ratelimit_ll_read_needed(rfilter);
 
+    case GENSIO_FILTER_FUNC_LL_CAN_READ:
+	return ratelimit_ll_can_read(rfilter, data);
+
     case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
 	return ratelimit_check_open_done(rfilter, data);
 
@@ -254,10 +821,12 @@ static int gensio_ratelimit_filter_func(struct gensio_filter *filter, int op,
     }
 }
 
-static struct gensio_filter *
+static struct ratelimit_filter *
 gensio_ratelimit_filter_raw_alloc(struct gensio_os_funcs *o,
 				  gensiods xmit_size,
-				  struct gensio_time xmit_delay)
+				  struct gensio_time xmit_delay,
+				  gensiods xmit_rate, gensiods xmit_burst,
+				  gensiods recv_rate, gensiods recv_burst)
 {
     struct ratelimit_filter *rfilter;
 
@@ -268,10 +837,16 @@ gensio_ratelimit_filter_raw_alloc(struct gensio_os_funcs *o,
     rfilter->o = o;
     rfilter->xmit_buf_len = xmit_size;
     rfilter->delay = xmit_delay;
-
-    rfilter->xmit_buf = o->zalloc(o, xmit_size);
-    if (!rfilter->xmit_buf)
-	goto out_nomem;
+    rfilter->xmit.b.rate = xmit_rate;
+    rfilter->xmit.b.burst = xmit_burst;
+    rfilter->recv.b.rate = recv_rate;
+    rfilter->recv.b.burst = recv_burst;
+
+    if (ratelimit_fixed_mode(rfilter)) {
+	rfilter->xmit_buf = o->zalloc(o, xmit_size);
+	if (!rfilter->xmit_buf)
+	    goto out_nomem;
+    }
 
     rfilter->lock = o->alloc_lock(o);
     if (!rfilter->lock)
@@ -282,7 +857,7 @@ gensio_ratelimit_filter_raw_alloc(struct gensio_os_funcs *o,
     if (!rfilter->filter)
 	goto out_nomem;
 
-    return rfilter->filter;
+    return rfilter;
 
  out_nomem:
     ratelimit_free(rfilter);
@@ -295,29 +870,127 @@ gensio_ratelimit_filter_alloc(struct gensio_pparm_info *p,
 			      const char * const args[],
 			      struct gensio_filter **rfilter)
 {
-    struct gensio_filter *filter;
+    struct ratelimit_filter *rf;
     unsigned int i;
     gensiods xmit_len = 1;
     struct gensio_time xmit_delay = { 0, 0 };
+    gensiods xmit_rate = 0, xmit_burst = 0, recv_rate = 0, recv_burst = 0;
+    const char *group = NULL;
+    gensiods gxmit_rate = 0, grecv_rate = 0, gburst = 0;
+    int rv;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(p, args[i], "xmit_len", &xmit_len) > 0)
 	    continue;
 	if (gensio_pparm_time(p, args[i], "xmit_delay", 0, &xmit_delay) > 0)
 	    continue;
+	if (gensio_pparm_ds(p, args[i], "rate", &xmit_rate) > 0) {
+	    recv_rate = xmit_rate;
+	    continue;
+	}
+	if (gensio_pparm_ds(p, args[i], "burst", &xmit_burst) > 0) {
+	    recv_burst = xmit_burst;
+	    continue;
+	}
+	if (gensio_pparm_ds(p, args[i], "xmit_rate", &xmit_rate) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "xmit_burst", &xmit_burst) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "recv_rate", &recv_rate) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "recv_burst", &recv_burst) > 0)
+	    continue;
+	if (gensio_pparm_value(p, args[i], "group", &group) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "group_rate", &gxmit_rate) > 0) {
+	    grecv_rate = gxmit_rate;
+	    continue;
+	}
+	if (gensio_pparm_ds(p, args[i], "group_xmit_rate", &gxmit_rate) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "group_recv_rate", &grecv_rate) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "group_burst", &gburst) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(p, args[i]);
 	return GE_INVAL;
     }
 
-    if (xmit_delay.secs == 0 && xmit_delay.nsecs == 0) {
-	gensio_pparm_slog(p, "xmit_delay cannot be zero");
+    if ((gxmit_rate || grecv_rate || gburst) && !group) {
+	gensio_pparm_slog(p, "group rates given without a group");
+	return GE_INVAL;
+    }
+
+    if (xmit_delay.secs != 0 || xmit_delay.nsecs != 0) {
+	if (xmit_rate || recv_rate || group) {
+	    gensio_pparm_slog(p, "xmit_delay cannot be used with a rate");
+	    return GE_INVAL;
+	}
+    } else if (!xmit_rate && !recv_rate && !group) {
+	gensio_pparm_slog(p, "xmit_delay or a rate must be given");
 	return GE_INVAL;
     }
 
-    filter = gensio_ratelimit_filter_raw_alloc(o, xmit_len, xmit_delay);
-    if (!filter)
+    /* Default to a tenth of a second's worth of burst. */
+    if (xmit_rate && !xmit_burst)
+	xmit_burst = xmit_rate / 10;
+    if (xmit_rate && !xmit_burst)
+	xmit_burst = 1;
+    if (recv_rate && !recv_burst)
+	recv_burst = recv_rate / 10;
+    if (recv_rate && !recv_burst)
+	recv_burst = 1;
+
+    rf = gensio_ratelimit_filter_raw_alloc(o, xmit_len, xmit_delay,
+					   xmit_rate, xmit_burst,
+					   recv_rate, recv_burst);
+    if (!rf)
 	return GE_NOMEM;
 
-    *rfilter = filter;
+    if (group) {
+	gensiods xburst = gburst, rburst = gburst;
+
+	if (!xburst)
+	    xburst = gxmit_rate / 10;
+	if (!xburst)
+	    xburst = 1;
+	if (!rburst)
+	    rburst = grecv_rate / 10;
+	if (!rburst)
+	    rburst = 1;
+	rv = ratelimit_group_get(p, rf, group, gxmit_rate, xburst,
+				 grecv_rate, rburst);
+	if (rv) {
+	    ratelimit_free(rf);
+	    return rv;
+	}
+    }
+
+    *rfilter = rf->filter;
+    return 0;
+}
+
+static void
+gensio_ratelimit_cleanup_mem(void)
+{
+    /* Groups go away with their last filter, only the lock is left. */
+    if (rl_group_lock)
+	rl_group_o->free_lock(rl_group_lock);
+    rl_group_lock = NULL;
+}
+
+static struct gensio_class_cleanup ratelimit_class_cleanup = {
+    gensio_ratelimit_cleanup_mem
+};
+
+int
+gensio_ratelimit_filter_init(struct gensio_os_funcs *o)
+{
+    rl_group_o = o;
+    gensio_list_init(&rl_groups);
+    rl_group_lock = o->alloc_lock(o);
+    if (!rl_group_lock)
+	return GE_NOMEM;
+    gensio_register_class_cleanup(&ratelimit_class_cleanup);
     return 0;
 }
@@ -16,4 +16,6 @@ int gensio_ratelimit_filter_alloc(struct gensio_pparm_info *p,
 				  const char * const args[],
 				  struct gensio_filter **rfilter);
 
+int gensio_ratelimit_filter_init(struct gensio_os_funcs *o);
+
 #endif /* GENSIO_FILTER_RATELIMIT_H */
@@ -6,21 +6,20 @@
  */
 
 #include "config.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_time.h>
+#include <gensio_probes.h>
 
 #include "gensio_filter_relpkt.h"
 #if 0
 #define DEBUG_MSG 1
 #define ENABLE_PRBUF 1
 #endif
-#if 0
-#define DROP_NR	8
-unsigned int curr_drop;
-#endif
 #include "utils.h"
 
 enum relpkt_msgs {
@@ -34,6 +33,35 @@ enum relpkt_msgs {
      * | pktlen msb     |    pktlen lsb  |
      * +----------------+----------------+
      * A - response bit, 1 if a response, 0 if not.
+     *
+     * Version 1 adds a wider receive window:
+     *
+     * +----------------+----------------+
+     * | recv win msb   | recv win lsb   |
+     * +----------------+----------------+
+     *
+     * Version 2 adds the FEC group size the sender of the init will
+     * use, 0 if it doesn't send FEC messages:
+     *
+     * +----------------+
+     * |  fec group     |
+     * +----------------+
+     *
+     * Version 3 adds how the sender of the init acks data.  It acks
+     * after every "ack every" packets it delivers, or after at most
+     * "ack delay" milliseconds, whichever is first, or with data it
+     * sends.  The remote end adds the ack delay to its retransmit
+     * timeout:
+     *
+     * +----------------+----------------+----------------+
+     * |  ack every     | ack delay msb  | ack delay lsb  |
+     * +----------------+----------------+----------------+
+     *
+     * The 8-bit recv window is still set for version 0, which ignores
+     * the extra bytes.  The response carries the lowest version of
+     * the two ends and both ends use that version.  In version 1
+     * sequence numbers are 16 bits, msb first, everywhere they appear
+     * in the messages below.
      */
     RELPKT_MSG_INIT = 1,
 
@@ -66,9 +94,91 @@ enum relpkt_msgs {
      * |   4   |reserved|   error msb    |   error lsb    |
      * +----------------+----------------+----------------+
      */
-    RELPKT_MSG_CLOSE = 4
+    RELPKT_MSG_CLOSE = 4,
+
+    /*
+     * Selective ack, version 1 only.  Ranges of packets that have
+     * been received past a missing packet, from the first sequence
+     * number up to and including the last sequence number.  These
+     * don't need to be resent, and the missing ones before them
+     * can be resent right away.
+     *
+     * +----------------+----------------+----------------+
+     * |   5   |reserved| first seq msb  | first seq lsb  |
+     * +----------------+----------------+----------------+
+     * +----------------+----------------+
+     * | last seq msb   | last seq lsb   |  ... more pairs
+     * +----------------+----------------+
+     */
+    RELPKT_MSG_SACK = 5,
+
+    /*
+     * Forward error correction, version 2 only.  Groups of packets
+     * are aligned on the sequence number, a group of n holds the
+     * packets with seq / n the same.  The data is the XOR of the
+     * packets in the group from the first up to and including the
+     * last seq below.  Each packet's data is preceeded by its length,
+     * msb first, and padded with zeros to the longest one.  The
+     * receiver can rebuild one missing packet from the others.
+     *
+     * +----------------+----------------+----------------+
+     * |   6   |reserv|E| last seq msb   | last seq lsb   |
+     * +----------------+----------------+----------------+
+     * +----------------+----------------+----------------+
+     * |  xor len msb   |  xor len lsb   |  xor data ...  |
+     * +----------------+----------------+----------------+
+     * E - the XOR of the eom bits of the packets.
+     */
+    RELPKT_MSG_FEC = 6
 };
 
+/* The highest protocol version we support. */
+#define RELPKT_VERSION		3
+
+/* Largest FEC group, the received packets are tracked in a bitmask. */
+#define RELPKT_MAX_FEC		64
+
+/*
+ * Windows must be less than half the sequence space so old packets
+ * can be told from new ones.
+ */
+#define RELPKT_V0_MAX_WINDOW	127
+#define RELPKT_MAX_WINDOW	16384
+
+/* Largest data header, for version 1. */
+#define RELPKT_MAX_HDR		5
+
+/* The packet size if the lower layer doesn't say. */
+#define RELPKT_DEFAULT_PKTSIZE	123
+#define RELPKT_DEFAULT_PACKETS	16
+
+/*
+ * If the lower layer takes large packets (like UDP), use packets that
+ * fit in a 1500 byte MTU with IPv6 and UDP headers, and a window big
+ * enough for a long fast path.
+ */
+#define RELPKT_PATH_PKTSIZE	(1500 - 40 - 8 - RELPKT_MAX_HDR)
+#define RELPKT_PATH_PACKETS	1024
+
+#define RELPKT_MAX_SACK_BLOCKS	16
+
+/* Congestion window limits, in packets. */
+#define RELPKT_INIT_CWND	16
+#define RELPKT_MIN_CWND		2
+
+/* Retransmit timeout limits and starting value (RFC 6298). */
+#define RELPKT_MIN_RTO		GENSIO_MSECS_TO_NSECS(200)
+#define RELPKT_MAX_RTO		GENSIO_SECS_TO_NSECS(60)
+#define RELPKT_INIT_RTO		GENSIO_SECS_TO_NSECS(1)
+
+/* Delayed acks, the most packets and time an ack may be held. */
+#define RELPKT_MAX_ACK_EVERY	255
+#define RELPKT_MAX_ACK_DELAY_MS	500
+#define RELPKT_DEF_ACK_DELAY	GENSIO_MSECS_TO_NSECS(25)
+
+/* Pacing lets this much time worth of data out at once. */
+#define RELPKT_PACE_BURST	GENSIO_MSECS_TO_NSECS(2)
+
 enum relpkt_state {
     /*
      * relpkt is not operational.
@@ -244,13 +354,83 @@ struct pkt {
     uint16_t start; /* For partial acceptance by user */
 
     bool sent; /* If true, packet does not need to be sent. */
+    bool sacked; /* If true, the remote end has it but has not acked it. */
 
     bool ready; /* If true, packet is ready to deliver to the user. */
     bool eom; /* If true, report end of message. */
 
+    /*
+     * For transmit packets, when it was last sent (-1 if never) and
+     * the delivery count and time then, for rate estimates.
+     */
+    bool retransmitted;
+    int64_t send_time;
+    uint64_t delivered;
+    int64_t delivered_time;
+
+    unsigned char *data;
+};
+
+/*
+ * The running XOR of a group of packets for forward error correction.
+ * data holds the length and data of each packet XORed together, len
+ * is the longest so far plus 2 for the length.
+ */
+struct relpkt_fec {
+    bool valid;
+    uint32_t first; /* Seq of the first packet in the group. */
+    uint64_t have; /* Bit n is set if first + n is in the XOR. */
+    unsigned int count;
+    bool eom;
+    gensiods len;
     unsigned char *data;
 };
 
+struct relpkt_filter;
+
+/*
+ * A congestion controller.  It sets cwnd and pacing_rate in the
+ * filter as acks and losses come in.
+ */
+struct relpkt_cc {
+    const char *name;
+    void (*init)(struct relpkt_filter *rfilter);
+
+    /*
+     * count packets were acked.  rate is the delivery rate in bytes
+     * per second seen by the last of those, or 0 if not known.  rtt is
+     * an rtt sample in nanoseconds, or -1 if there isn't a valid one.
+     * round_start is true if this starts a new round trip.
+     */
+    void (*acked)(struct relpkt_filter *rfilter, uint32_t count,
+		  uint64_t rate, int64_t rtt, bool round_start);
+
+    /*
+     * Packets were lost.  timeout is true if the retransmit timer went
+     * off, false if the remote end reported it.
+     */
+    void (*loss)(struct relpkt_filter *rfilter, bool timeout);
+};
+
+enum relpkt_bbr_mode {
+    RELPKT_BBR_STARTUP,
+    RELPKT_BBR_DRAIN,
+    RELPKT_BBR_PROBE_BW
+};
+
+/* State for the BBR-like controller. */
+struct relpkt_bbr {
+    enum relpkt_bbr_mode mode;
+    uint64_t btl_bw; /* Max recent delivery rate, bytes per second. */
+    uint64_t btl_bw_round; /* Round that btl_bw was seen in. */
+    int64_t min_rtt; /* -1 if not known. */
+    int64_t min_rtt_time;
+    uint64_t full_bw; /* Startup keeps going while this grows. */
+    unsigned int full_bw_count;
+    unsigned int cycle_idx;
+    int64_t cycle_time;
+};
+
 struct relpkt_filter {
     struct gensio_filter *filter;
 
@@ -267,12 +447,30 @@ struct relpkt_filter {
 
     bool server; /* True if server mode. */
 
+    /* What the user asked for, zero if not set. */
+    gensiods cfg_pktsize;
+    gensiods cfg_packets;
+
     gensiods max_pktsize;
-    unsigned int max_pkt; /* Our set value. */
+    unsigned int max_pkt; /* Size of the packet arrays. */
+    unsigned int window; /* Our set value. */
+    unsigned int recv_window; /* Packets the remote end may send us. */
 
-    uint8_t next_expected_seq; /* Next seq we expect from the remote. */
-    uint8_t next_deliver_seq; /* Next seq we will deliver to the user. */
-    uint8_t deliver_recvpkt; /* Pos in recvpkts of next_deliver_seq. */
+    /*
+     * The protocol version in use.  Sequence numbers are kept as 32
+     * bits here, only the low 8 (version 0) or 16 (version 1) bits
+     * go on the wire.  cfg_version is the highest version we will
+     * offer or accept.
+     */
+    unsigned int cfg_version;
+    unsigned int version;
+    uint32_t seq_mask;
+    unsigned int seq_bytes;
+    unsigned int hdr_len; /* Size of a data packet header. */
+
+    uint32_t next_expected_seq; /* Next seq we expect from the remote. */
+    uint32_t next_deliver_seq; /* Next seq we will deliver to the user. */
+    unsigned int deliver_recvpkt; /* Pos in recvpkts of next_deliver_seq. */
     struct pkt *recvpkts;
 
     /*
@@ -285,13 +483,16 @@ struct relpkt_filter {
 
     unsigned int max_xmit_pktsize;
     unsigned int max_xmitpkt; /* Set from remote end by init packet. */
-    uint8_t next_acked_seq; /* Seq for next packet that is unacked. */
-    uint8_t next_send_seq; /* Seq for next packet we will send. */
-    uint8_t first_xmitpkt; /* Pos in xmitpkts of where next_ack_seq is. */
+    uint32_t next_acked_seq; /* Seq for next packet that is unacked. */
+    uint32_t next_send_seq; /* Seq for next packet we will send. */
+    unsigned int first_xmitpkt; /* Pos in xmitpkts of where next_ack_seq is. */
     struct pkt *xmitpkts;
     unsigned int nr_waiting_xmitpkt; /* nr in xmitpkt unsent */
+    unsigned int nr_resend; /* nr of those that were sent before */
+    uint32_t next_unsent_seq; /* No unsent packets before this. */
 
-    char init_pkt[5];
+    char init_pkt[11];
+    unsigned int init_pkt_len;
     bool send_init_pkt;
     unsigned int init_retry_count;
 
@@ -299,15 +500,98 @@ struct relpkt_filter {
     bool send_close_pkt;
     unsigned int close_retry_count;
 
-    char ack_pkt[3];
+    char ack_pkt[RELPKT_MAX_HDR];
     bool send_ack_pkt;
 
+    /*
+     * Delayed acks.  cfg_ack_every and cfg_ack_delay are what we were
+     * asked to do, ack_every is what we do, 1 (ack every packet) if
+     * the remote end can't take delayed acks.  unacked is the number
+     * of packets delivered since the last ack, and the ack is sent at
+     * ack_time if it isn't sent before.  remote_ack_delay is how long
+     * the remote end may hold its acks.
+     */
+    unsigned int cfg_ack_every;
+    int64_t cfg_ack_delay;
+    unsigned int ack_every;
+    unsigned int unacked;
+    bool ack_armed;
+    int64_t ack_time;
+    int64_t remote_ack_delay;
+
     char resend_pkt[51];
     bool send_resend_pkt;
     uint16_t resend_pkt_len;
 
-    uint8_t last_timeout_ack; /* next_acked_seq on the last timeout. */
-    unsigned int timeout_ack_count; /* nr timeouts last_timeout_ack same. */
+    unsigned char sack_pkt[1 + RELPKT_MAX_SACK_BLOCKS * 4];
+    bool send_sack_pkt;
+
+    /*
+     * Forward error correction.  cfg_fec is the group size we were
+     * asked to send with, fec_size is what we are sending with (zero
+     * if the remote end can't take it) and fec_recv_size is what the
+     * remote end is sending with.  fec_recv is a ring of groups being
+     * received, enough to cover the receive window.
+     */
+    unsigned int cfg_fec;
+    unsigned int fec_size;
+    struct relpkt_fec fec_xmit;
+    unsigned char *fec_pkt;
+    gensiods fec_pkt_len;
+    bool send_fec_pkt;
+    unsigned int fec_recv_size;
+    unsigned int nr_fec_recv;
+    struct relpkt_fec *fec_recv;
+
+    /*
+     * Congestion control, so a big window doesn't just overrun the
+     * buffers along the way.  cwnd limits the packets in flight (sent
+     * and not acked or sacked) and pacing_rate, in bytes per second,
+     * limits how fast they go out.  No pacing is done if it is zero.
+     * The controller sets these.
+     */
+    const struct relpkt_cc *cc;
+    unsigned int inflight;
+    unsigned int cwnd;
+    unsigned int ssthresh;
+    unsigned int cwnd_acked; /* Packets acked since the last increase. */
+    bool in_recovery;
+    uint32_t recover_seq; /* Recovery is done when this is acked. */
+    uint32_t sent_high_seq; /* One past the highest seq sent. */
+    uint64_t pacing_rate;
+    int64_t pace_tokens; /* Bytes that may be sent now, may be negative. */
+    int64_t pace_time; /* When pace_tokens was last updated. */
+    struct relpkt_bbr bbr;
+
+    /* For delivery rate estimates and round trip counts. */
+    uint64_t delivered; /* Data bytes acked. */
+    int64_t delivered_time; /* When delivered last changed. */
+    uint64_t round_delivered; /* The next round starts after this. */
+    uint64_t round_count;
+
+    /* Round trip time estimates and the retransmit timer, in nsecs. */
+    int64_t srtt; /* -1 if no rtt sample yet. */
+    int64_t rttvar;
+    int64_t rto;
+    bool rto_armed;
+    int64_t rto_time;
+
+    /* When the once a second keepalive and dead peer check is due. */
+    int64_t tick_time;
+
+    /* When the filter timer will go off, if it's running. */
+    bool timer_running;
+    int64_t timer_time;
+
+    /* For testing, throw away every drop_nr'th data packet sent. */
+    unsigned int drop_nr;
+    unsigned int curr_drop;
+
+    /* Statistics. */
+    uint64_t retransmits;
+    uint64_t rto_count;
+    uint64_t fec_sent;
+    uint64_t fec_recovered;
 };
 
 #define filter_to_relpkt(v) ((struct relpkt_filter *) \
@@ -315,6 +599,7 @@ struct relpkt_filter {
 #define link_to_pkt(v) gensio_container_of(v, struct pkt, link);
 
 static int i_relpkt_filter_timeout(struct relpkt_filter *rfilter);
+static void relpkt_filter_start_timer(struct relpkt_filter *rfilter);
 
 static void
 relpkt_lock(struct relpkt_filter *rfilter)
@@ -328,75 +613,663 @@ relpkt_unlock(struct relpkt_filter *rfilter)
     rfilter->o->unlock(rfilter->lock);
 }
 
+static void
+set_version(struct relpkt_filter *rfilter, unsigned int version)
+{
+    rfilter->version = version;
+    if (version == 0) {
+	rfilter->seq_mask = 0xff;
+	rfilter->seq_bytes = 1;
+	rfilter->recv_window = rfilter->window;
+	if (rfilter->recv_window > RELPKT_V0_MAX_WINDOW)
+	    rfilter->recv_window = RELPKT_V0_MAX_WINDOW;
+    } else {
+	rfilter->seq_mask = 0xffff;
+	rfilter->seq_bytes = 2;
+	rfilter->recv_window = rfilter->window;
+    }
+    rfilter->hdr_len = 1 + 2 * rfilter->seq_bytes;
+}
+
+static void
+put_seq(struct relpkt_filter *rfilter, void *vbuf, uint32_t seq)
+{
+    unsigned char *buf = vbuf;
+
+    if (rfilter->seq_bytes == 1) {
+	buf[0] = seq & 0xff;
+    } else {
+	buf[0] = (seq >> 8) & 0xff;
+	buf[1] = seq & 0xff;
+    }
+}
+
+static uint32_t
+get_seq(struct relpkt_filter *rfilter, const unsigned char *buf)
+{
+    if (rfilter->seq_bytes == 1)
+	return buf[0];
+    return buf[0] << 8 | buf[1];
+}
+
 /*
- * Returns true if seq >= first and seq < next, taking into account
- * wrapping.  If first == next, this will always return false.
+ * Return how far the sequence number from the wire is past base.
+ * Sequence numbers before base come out as large values.
  */
-static bool
-seq_inside(uint8_t seq, uint8_t first, uint8_t next)
+static uint32_t
+seq_off(struct relpkt_filter *rfilter, uint32_t wireseq, uint32_t base)
 {
-    if (first <= next)
-	/* not wrapped */
-	return seq >= first && seq < next;
-    else
-	/* wrapped */
-	return seq >= first || seq < next;
+    return (wireseq - base) & rfilter->seq_mask;
 }
 
-static uint8_t
-recvpkt_pos(struct relpkt_filter *rfilter, uint8_t pos)
+static unsigned int
+recvpkt_pos(struct relpkt_filter *rfilter, uint32_t pos)
 {
     return (rfilter->deliver_recvpkt + pos) % rfilter->max_pkt;
 }
 
-static uint8_t
-xmitpkt_pos(struct relpkt_filter *rfilter, uint8_t pos)
+static unsigned int
+xmitpkt_pos(struct relpkt_filter *rfilter, uint32_t pos)
 {
-    return (rfilter->first_xmitpkt + pos) % rfilter->max_xmitpkt;
+    return (rfilter->first_xmitpkt + pos) % rfilter->max_pkt;
+}
+
+static int64_t
+relpkt_now(struct relpkt_filter *rfilter)
+{
+    gensio_time t;
+
+    gensio_os_funcs_get_loop_time(rfilter->o, &t);
+    return t.secs * GENSIO_NSECS_IN_SEC + t.nsecs;
 }
 
 static void
-resend_packets(struct relpkt_filter *rfilter, uint8_t first, uint8_t last)
+cwnd_limit(struct relpkt_filter *rfilter)
 {
-    uint8_t seq;
-    unsigned int i, pos;
+    if (rfilter->cwnd > rfilter->max_xmitpkt)
+	rfilter->cwnd = rfilter->max_xmitpkt;
+    if (rfilter->cwnd < RELPKT_MIN_CWND)
+	rfilter->cwnd = RELPKT_MIN_CWND;
+}
 
-    for (seq = first, i = first - rfilter->next_acked_seq; seq != last; i++) {
-	pos = xmitpkt_pos(rfilter, i);
-	if (rfilter->xmitpkts[pos].sent) {
-	    rfilter->xmitpkts[pos].sent = false;
-	    rfilter->nr_waiting_xmitpkt++;
+/*
+ * NewReno style.  The window grows by a packet for every packet acked
+ * up to ssthresh, then by a packet per window.  It is halved when the
+ * remote end reports a loss and starts over on a retransmit timeout.
+ */
+static void
+newreno_init(struct relpkt_filter *rfilter)
+{
+    rfilter->cwnd = RELPKT_INIT_CWND;
+    rfilter->ssthresh = rfilter->max_pkt;
+    rfilter->cwnd_acked = 0;
+    rfilter->pacing_rate = 0;
+}
+
+static void
+newreno_acked(struct relpkt_filter *rfilter, uint32_t count,
+	      uint64_t rate, int64_t rtt, bool round_start)
+{
+    if (rfilter->in_recovery)
+	return;
+    if (rfilter->cwnd < rfilter->ssthresh) {
+	rfilter->cwnd += count;
+    } else {
+	rfilter->cwnd_acked += count;
+	if (rfilter->cwnd_acked >= rfilter->cwnd) {
+	    rfilter->cwnd_acked -= rfilter->cwnd;
+	    rfilter->cwnd++;
+	}
+    }
+    cwnd_limit(rfilter);
+}
+
+static void
+newreno_loss(struct relpkt_filter *rfilter, bool timeout)
+{
+    if (timeout) {
+	rfilter->ssthresh = rfilter->cwnd / 2;
+	rfilter->cwnd = RELPKT_MIN_CWND;
+    } else {
+	/* Half of everything sent, not what is left in the pipe. */
+	rfilter->ssthresh = (rfilter->sent_high_seq -
+			     rfilter->next_acked_seq) / 2;
+	rfilter->cwnd = rfilter->ssthresh;
+    }
+    if (rfilter->ssthresh < RELPKT_MIN_CWND)
+	rfilter->ssthresh = RELPKT_MIN_CWND;
+    rfilter->cwnd_acked = 0;
+    cwnd_limit(rfilter);
+}
+
+static const struct relpkt_cc relpkt_newreno = {
+    .name = "newreno",
+    .init = newreno_init,
+    .acked = newreno_acked,
+    .loss = newreno_loss
+};
+
+/*
+ * BBR-like.  This paces at the measured bottleneck bandwidth and
+ * keeps about two bandwidth-delay products in flight, ignoring
+ * losses.  It starts by doubling the rate every round trip until the
+ * bandwidth stops growing, drains the queue that built up, then
+ * cycles the pacing gain to probe for more bandwidth.  Gains are in
+ * 1/256ths.
+ */
+#define BBR_UNIT		256
+#define BBR_HIGH_GAIN		739	/* 2.89, 2/ln(2) */
+#define BBR_DRAIN_GAIN		89	/* 1/2.89 */
+#define BBR_CWND_GAIN		512
+#define BBR_BW_ROUNDS		10	/* Rounds a bandwidth sample lasts. */
+#define BBR_MIN_RTT_TIME	GENSIO_SECS_TO_NSECS(10)
+#define BBR_CYCLE_LEN		8
+
+static const unsigned int bbr_cycle_gain[BBR_CYCLE_LEN] = {
+    320, 192, 256, 256, 256, 256, 256, 256
+};
+
+static void
+bbr_init(struct relpkt_filter *rfilter)
+{
+    struct relpkt_bbr *b = &rfilter->bbr;
+
+    memset(b, 0, sizeof(*b));
+    b->mode = RELPKT_BBR_STARTUP;
+    b->min_rtt = -1;
+    rfilter->cwnd = RELPKT_INIT_CWND;
+    rfilter->ssthresh = rfilter->max_pkt;
+    rfilter->pacing_rate = 0; /* Until there is a bandwidth estimate. */
+}
+
+static void
+bbr_acked(struct relpkt_filter *rfilter, uint32_t count,
+	  uint64_t rate, int64_t rtt, bool round_start)
+{
+    struct relpkt_bbr *b = &rfilter->bbr;
+    int64_t now = relpkt_now(rfilter);
+    uint64_t bdp_pkts = 0;
+    unsigned int gain = BBR_UNIT, cwnd_gain = BBR_CWND_GAIN;
+
+    if (rtt >= 0 && (b->min_rtt < 0 || rtt <= b->min_rtt ||
+		     now - b->min_rtt_time > BBR_MIN_RTT_TIME)) {
+	b->min_rtt = rtt;
+	b->min_rtt_time = now;
+    }
+    if (rate >= b->btl_bw ||
+		rfilter->round_count - b->btl_bw_round > BBR_BW_ROUNDS) {
+	b->btl_bw = rate;
+	b->btl_bw_round = rfilter->round_count;
+    }
+
+    if (round_start && b->mode == RELPKT_BBR_STARTUP) {
+	/* Keep going until three rounds without 25% growth. */
+	if (b->btl_bw >= b->full_bw + b->full_bw / 4) {
+	    b->full_bw = b->btl_bw;
+	    b->full_bw_count = 0;
+	} else if (++b->full_bw_count >= 3) {
+	    b->mode = RELPKT_BBR_DRAIN;
 	}
-	seq++;
     }
+
+    if (b->btl_bw && b->min_rtt > 0)
+	bdp_pkts = (b->btl_bw * b->min_rtt / GENSIO_NSECS_IN_SEC /
+		    (rfilter->max_xmit_pktsize + rfilter->hdr_len));
+
+    if (b->mode == RELPKT_BBR_DRAIN && rfilter->inflight <= bdp_pkts) {
+	b->mode = RELPKT_BBR_PROBE_BW;
+	b->cycle_idx = 0;
+	b->cycle_time = now;
+    }
+    if (b->mode == RELPKT_BBR_PROBE_BW && b->min_rtt > 0 &&
+		now - b->cycle_time > b->min_rtt) {
+	b->cycle_idx = (b->cycle_idx + 1) % BBR_CYCLE_LEN;
+	b->cycle_time = now;
+    }
+
+    switch (b->mode) {
+    case RELPKT_BBR_STARTUP:
+	gain = BBR_HIGH_GAIN;
+	cwnd_gain = BBR_HIGH_GAIN;
+	break;
+    case RELPKT_BBR_DRAIN:
+	gain = BBR_DRAIN_GAIN;
+	cwnd_gain = BBR_HIGH_GAIN;
+	break;
+    case RELPKT_BBR_PROBE_BW:
+	gain = bbr_cycle_gain[b->cycle_idx];
+	break;
+    }
+
+    rfilter->pacing_rate = b->btl_bw * gain / BBR_UNIT;
+    if (bdp_pkts) {
+	rfilter->cwnd = bdp_pkts * cwnd_gain / BBR_UNIT;
+	if (rfilter->cwnd < 4)
+	    rfilter->cwnd = 4;
+    } else {
+	/* No estimate yet, grow like slow start. */
+	rfilter->cwnd += count;
+    }
+    cwnd_limit(rfilter);
+}
+
+static void
+bbr_loss(struct relpkt_filter *rfilter, bool timeout)
+{
+    /* Losses don't reduce the rate, but a timeout means start over. */
+    if (timeout)
+	rfilter->cwnd = RELPKT_MIN_CWND;
+}
+
+static const struct relpkt_cc relpkt_bbr = {
+    .name = "bbr",
+    .init = bbr_init,
+    .acked = bbr_acked,
+    .loss = bbr_loss
+};
+
+static const struct relpkt_cc *relpkt_ccs[] = {
+    &relpkt_newreno,
+    &relpkt_bbr,
+    NULL
+};
+
+static void
+cc_acked(struct relpkt_filter *rfilter, uint32_t count,
+	 uint64_t rate, int64_t rtt, bool round_start)
+{
+    if (rfilter->in_recovery &&
+	    (int32_t) (rfilter->next_acked_seq - rfilter->recover_seq) >= 0)
+	rfilter->in_recovery = false;
+    rfilter->cc->acked(rfilter, count, rate, rtt, round_start);
+}
+
+static void
+cc_loss(struct relpkt_filter *rfilter, bool timeout)
+{
+    /* Only report a reported loss once per window of data. */
+    if (!timeout && rfilter->in_recovery)
+	return;
+    rfilter->cc->loss(rfilter, timeout);
+    rfilter->in_recovery = true;
+    rfilter->recover_seq = rfilter->sent_high_seq;
+}
+
+static void
+cc_init(struct relpkt_filter *rfilter)
+{
+    int64_t now = relpkt_now(rfilter);
+
+    rfilter->inflight = 0;
+    rfilter->in_recovery = false;
+    rfilter->sent_high_seq = rfilter->next_send_seq;
+    rfilter->pace_tokens = 0;
+    rfilter->pace_time = now;
+    rfilter->delivered = 0;
+    rfilter->delivered_time = now;
+    rfilter->round_delivered = 0;
+    rfilter->round_count = 0;
+    rfilter->srtt = -1;
+    rfilter->rttvar = 0;
+    rfilter->rto = RELPKT_INIT_RTO;
+    rfilter->rto_armed = false;
+    rfilter->tick_time = now + GENSIO_SECS_TO_NSECS(1);
+    rfilter->retransmits = 0;
+    rfilter->rto_count = 0;
+    rfilter->cc->init(rfilter);
+}
+
+/* Update the rtt estimates and retransmit timeout, per RFC 6298. */
+static void
+rtt_sample(struct relpkt_filter *rfilter, int64_t rtt)
+{
+    int64_t diff;
+
+    if (rfilter->srtt < 0) {
+	rfilter->srtt = rtt;
+	rfilter->rttvar = rtt / 2;
+    } else {
+	diff = rfilter->srtt - rtt;
+	if (diff < 0)
+	    diff = -diff;
+	rfilter->rttvar = (3 * rfilter->rttvar + diff) / 4;
+	rfilter->srtt = (7 * rfilter->srtt + rtt) / 8;
+    }
+    rfilter->rto = rfilter->srtt + 4 * rfilter->rttvar;
+    if (rfilter->rto < RELPKT_MIN_RTO)
+	rfilter->rto = RELPKT_MIN_RTO;
+    /* The remote end may hold the ack this long. */
+    rfilter->rto += rfilter->remote_ack_delay;
+    if (rfilter->rto > RELPKT_MAX_RTO)
+	rfilter->rto = RELPKT_MAX_RTO;
+}
+
+/*
+ * Can a data packet go out now?  This checks the congestion window
+ * and, if pacing, refills the pacing budget.  Resends are always
+ * first in line and are let past the window, otherwise a full window
+ * of packets received past a hole would keep the hole from being
+ * filled until the retransmit timeout.
+ */
+static bool
+xmit_ok(struct relpkt_filter *rfilter)
+{
+    int64_t now, burst, elapsed;
+
+    if (rfilter->inflight >= rfilter->cwnd && !rfilter->nr_resend)
+	return false;
+    if (!rfilter->pacing_rate)
+	return true;
+
+    now = relpkt_now(rfilter);
+    elapsed = now - rfilter->pace_time;
+    if (elapsed > GENSIO_NSECS_IN_SEC)
+	elapsed = GENSIO_NSECS_IN_SEC;
+    rfilter->pace_time = now;
+    rfilter->pace_tokens += (elapsed * (int64_t) rfilter->pacing_rate /
+			     GENSIO_NSECS_IN_SEC);
+    burst = RELPKT_PACE_BURST * (int64_t) rfilter->pacing_rate /
+	GENSIO_NSECS_IN_SEC;
+    if (burst < 2 * (int64_t) (rfilter->max_xmit_pktsize + rfilter->hdr_len))
+	burst = 2 * (rfilter->max_xmit_pktsize + rfilter->hdr_len);
+    if (rfilter->pace_tokens > burst)
+	rfilter->pace_tokens = burst;
+    return rfilter->pace_tokens > 0;
+}
+
+/* Mark the packet at offset off from next_acked_seq to be sent again. */
+static void
+mark_unsent(struct relpkt_filter *rfilter, uint32_t off)
+{
+    struct pkt *p = &(rfilter->xmitpkts[xmitpkt_pos(rfilter, off)]);
+    uint32_t nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    uint32_t unsent = rfilter->next_unsent_seq - rfilter->next_acked_seq;
+
+    if (!p->sent || p->sacked)
+	return;
+    p->sent = false;
+    rfilter->nr_waiting_xmitpkt++;
+    rfilter->nr_resend++;
+    assert(rfilter->inflight > 0);
+    rfilter->inflight--;
+    if (unsent <= nrqueued && off < unsent)
+	rfilter->next_unsent_seq = rfilter->next_acked_seq + off;
+}
+
+/* Resend packets from offset first up to offset end from next_acked_seq. */
+static void
+resend_packets(struct relpkt_filter *rfilter, uint32_t first, uint32_t end)
+{
+    uint32_t i;
+
+    for (i = first; i < end; i++)
+	mark_unsent(rfilter, i);
 }
 
 static struct pkt *
 first_xmitpkt_to_send(struct relpkt_filter *rfilter)
 {
-    uint8_t seq = rfilter->next_acked_seq;
-    unsigned int i, pos;
+    uint32_t nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    uint32_t i = rfilter->next_unsent_seq - rfilter->next_acked_seq;
+    unsigned int pos;
 
-    for (i = 0; seq != rfilter->next_send_seq; i++, seq++) {
+    if (i > nrqueued)
+	i = 0;
+    for (; i < nrqueued; i++) {
 	pos = xmitpkt_pos(rfilter, i);
-	if (!rfilter->xmitpkts[pos].sent)
+	if (!rfilter->xmitpkts[pos].sent) {
+	    rfilter->next_unsent_seq = rfilter->next_acked_seq + i;
 	    return &(rfilter->xmitpkts[pos]);
+	}
     }
     assert(0);
     return NULL;
 }
 
+/* XOR a packet into an FEC group.  size is the size of the buffer. */
+static int
+fec_add(struct relpkt_filter *rfilter, struct relpkt_fec *f, gensiods size,
+	const unsigned char *data, gensiods len, bool eom)
+{
+    gensiods i;
+
+    if (!f->data) {
+	f->data = gensio_os_buf_alloc(rfilter->o, size);
+	if (!f->data)
+	    return GE_NOMEM;
+    }
+    if (f->len < len + 2) {
+	memset(f->data + f->len, 0, len + 2 - f->len);
+	f->len = len + 2;
+    }
+    f->data[0] ^= len >> 8;
+    f->data[1] ^= len & 0xff;
+    for (i = 0; i < len; i++)
+	f->data[i + 2] ^= data[i];
+    f->eom ^= eom;
+    return 0;
+}
+
+static void
+fec_start(struct relpkt_fec *f, uint32_t first)
+{
+    f->valid = true;
+    f->first = first;
+    f->have = 0;
+    f->count = 0;
+    f->eom = false;
+    f->len = 0;
+}
+
+static void
+fec_recv_free(struct relpkt_filter *rfilter)
+{
+    unsigned int i;
+
+    if (!rfilter->fec_recv)
+	return;
+    for (i = 0; i < rfilter->nr_fec_recv; i++) {
+	if (rfilter->fec_recv[i].data)
+	    gensio_os_buf_free(rfilter->o, rfilter->fec_recv[i].data);
+    }
+    rfilter->o->free(rfilter->o, rfilter->fec_recv);
+    rfilter->fec_recv = NULL;
+    rfilter->nr_fec_recv = 0;
+}
+
+/*
+ * Packet seq is being sent for the first time, add it to the group.
+ * At the end of the group, queue the FEC message for it.  First sends
+ * are always in sequence order.
+ */
+static void
+fec_sent(struct relpkt_filter *rfilter, uint32_t seq, struct pkt *p)
+{
+    struct relpkt_fec *f = &rfilter->fec_xmit;
+    unsigned int n = rfilter->fec_size, hdr = 1 + rfilter->seq_bytes;
+
+    if (!n)
+	return;
+    if (seq % n == 0)
+	fec_start(f, seq);
+    else if (!f->valid || f->first != seq - seq % n)
+	return;
+    if (fec_add(rfilter, f, rfilter->max_xmit_pktsize + 2,
+		p->data + rfilter->hdr_len, p->len - rfilter->hdr_len,
+		p->eom)) {
+	f->valid = false;
+	return;
+    }
+    f->count++;
+    if (f->count < n)
+	return;
+
+    f->valid = false;
+    if (!rfilter->fec_pkt) {
+	rfilter->fec_pkt = gensio_os_buf_alloc(rfilter->o,
+					rfilter->max_xmit_pktsize + 2 + hdr);
+	if (!rfilter->fec_pkt)
+	    return;
+    }
+    rfilter->fec_pkt[0] = (RELPKT_MSG_FEC << 4) | (uint8_t) f->eom;
+    put_seq(rfilter, rfilter->fec_pkt + 1, seq);
+    memcpy(rfilter->fec_pkt + hdr, f->data, f->len);
+    rfilter->fec_pkt_len = hdr + f->len;
+    rfilter->send_fec_pkt = true;
+}
+
+/* A new packet was received, add it to its group. */
+static void
+fec_received(struct relpkt_filter *rfilter, uint32_t seq,
+	     const unsigned char *data, gensiods len, bool eom)
+{
+    unsigned int n = rfilter->fec_recv_size;
+    struct relpkt_fec *f;
+    uint64_t bit;
+
+    if (!n)
+	return;
+    f = &rfilter->fec_recv[(seq / n) % rfilter->nr_fec_recv];
+    if (!f->valid || f->first != seq - seq % n)
+	fec_start(f, seq - seq % n);
+    bit = (uint64_t) 1 << (seq % n);
+    if (f->have & bit)
+	return;
+    if (fec_add(rfilter, f, rfilter->max_pktsize + 2, data, len, eom)) {
+	f->valid = false;
+	return;
+    }
+    f->have |= bit;
+    f->count++;
+}
+
+/*
+ * Is the only hole up to seq one packet in seq's group?  If so an FEC
+ * message should fill it soon, so don't ask for a resend yet.
+ */
+static bool
+fec_may_fill(struct relpkt_filter *rfilter, uint32_t seq)
+{
+    unsigned int n = rfilter->fec_recv_size;
+    uint32_t i, end = seq - rfilter->next_deliver_seq, first;
+    bool found = false;
+
+    if (!n)
+	return false;
+    first = seq - seq % n;
+    for (i = 0; i < end; i++) {
+	if (rfilter->recvpkts[recvpkt_pos(rfilter, i)].ready)
+	    continue;
+	if (found || rfilter->next_deliver_seq + i - first >= n)
+	    return false;
+	found = true;
+    }
+    return true;
+}
+
 static void
 send_init(struct relpkt_filter *rfilter, bool response)
 {
+    unsigned int v0_window = rfilter->window;
+    unsigned int version = rfilter->cfg_version;
+
+    if (v0_window > RELPKT_V0_MAX_WINDOW)
+	v0_window = RELPKT_V0_MAX_WINDOW;
+    if (response)
+	version = rfilter->version;
+
     rfilter->init_pkt[0] = (RELPKT_MSG_INIT << 4) | (uint8_t) response;
-    rfilter->init_pkt[1] = 0; /* version */
-    rfilter->init_pkt[2] = rfilter->max_pkt;
+    rfilter->init_pkt[1] = version;
+    rfilter->init_pkt[2] = v0_window;
     rfilter->init_pkt[3] = rfilter->max_pktsize >> 8;
     rfilter->init_pkt[4] = rfilter->max_pktsize & 0xff;
+    rfilter->init_pkt_len = 5;
+    if (version >= 1) {
+	rfilter->init_pkt[5] = rfilter->window >> 8;
+	rfilter->init_pkt[6] = rfilter->window & 0xff;
+	rfilter->init_pkt_len = 7;
+    }
+    if (version >= 2) {
+	rfilter->init_pkt[7] = rfilter->cfg_fec;
+	rfilter->init_pkt_len = 8;
+    }
+    if (version >= 3) {
+	unsigned int ms = GENSIO_NSECS_TO_MSECS(rfilter->cfg_ack_delay);
+
+	rfilter->init_pkt[8] = rfilter->cfg_ack_every;
+	rfilter->init_pkt[9] = ms >> 8;
+	rfilter->init_pkt[10] = ms & 0xff;
+	rfilter->init_pkt_len = 11;
+    }
     rfilter->send_init_pkt = true;
 }
 
+/*
+ * Pick the version and set the transmit limits from the remote end's
+ * init message.  Returns an error string on a protocol error.
+ */
+static const char *
+handle_init(struct relpkt_filter *rfilter, const unsigned char *buf,
+	    gensiods buflen)
+{
+    unsigned int version = buf[1], window = buf[2], fec = 0;
+
+    if (version > rfilter->cfg_version)
+	version = rfilter->cfg_version;
+    if (version >= 1) {
+	if (buflen < 7)
+	    return "version 1 init < 7";
+	window = buf[5] << 8 | buf[6];
+    }
+    if (version >= 2) {
+	if (buflen < 8)
+	    return "version 2 init < 8";
+	fec = buf[7];
+	if (fec == 1 || fec > RELPKT_MAX_FEC)
+	    return "invalid fec group size";
+    }
+    rfilter->remote_ack_delay = 0;
+    if (version >= 3) {
+	if (buflen < 11)
+	    return "version 3 init < 11";
+	if (buf[8] > 1)
+	    rfilter->remote_ack_delay =
+		GENSIO_MSECS_TO_NSECS((int64_t) (buf[9] << 8 | buf[10]));
+    }
+
+    /* Only hold acks if the other end allows for it in its timeout. */
+    rfilter->ack_every = version >= 3 ? rfilter->cfg_ack_every : 1;
+    if (window == 0)
+	return "rfilter->max_xmitpkt == 0";
+
+    /* Only send FEC messages if the other end knows what they are. */
+    rfilter->fec_size = version >= 2 ? rfilter->cfg_fec : 0;
+    rfilter->fec_xmit.valid = false;
+
+    /* If this fails, lost packets are just resent. */
+    rfilter->fec_recv_size = 0;
+    if (fec && rfilter->nr_fec_recv != rfilter->max_pkt / fec + 2) {
+	fec_recv_free(rfilter);
+	rfilter->fec_recv = rfilter->o->zalloc(rfilter->o,
+			sizeof(struct relpkt_fec) * (rfilter->max_pkt / fec + 2));
+	if (rfilter->fec_recv)
+	    rfilter->nr_fec_recv = rfilter->max_pkt / fec + 2;
+    }
+    if (fec && rfilter->fec_recv)
+	rfilter->fec_recv_size = fec;
+
+    set_version(rfilter, version);
+    if (window > rfilter->max_pkt)
+	window = rfilter->max_pkt;
+    if (version == 0 && window > RELPKT_V0_MAX_WINDOW)
+	window = RELPKT_V0_MAX_WINDOW;
+    rfilter->max_xmitpkt = window;
+    rfilter->max_xmit_pktsize = buf[3] << 8 | buf[4];
+    if (rfilter->max_xmit_pktsize > rfilter->max_pktsize)
+	rfilter->max_xmit_pktsize = rfilter->max_pktsize;
+    return NULL;
+}
+
 static void
 send_close(struct relpkt_filter *rfilter)
 {
@@ -406,70 +1279,280 @@ send_close(struct relpkt_filter *rfilter)
     rfilter->send_close_pkt = true;
 }
 
+/* Nothing is owed an ack any more, it's going out. */
+static void
+ack_sent(struct relpkt_filter *rfilter)
+{
+    rfilter->unacked = 0;
+    rfilter->ack_armed = false;
+}
+
 static void
 send_ack(struct relpkt_filter *rfilter)
 {
     rfilter->ack_pkt[0] = RELPKT_MSG_DATA << 4;
     /* seq will be filled in at send time. */
-    rfilter->ack_pkt[2] = 0;
+    put_seq(rfilter, rfilter->ack_pkt + 1 + rfilter->seq_bytes, 0);
     rfilter->send_ack_pkt = true;
+    ack_sent(rfilter);
+}
+
+/*
+ * A packet was delivered to the user.  Ack it now, or hold the ack
+ * until ack_every packets are delivered, ack_delay passes, or data
+ * goes out to carry it.  Don't hold more than half the receive window
+ * or the remote end could stall waiting for the ack.
+ */
+static void
+ack_delivered(struct relpkt_filter *rfilter)
+{
+    rfilter->unacked++;
+    if (rfilter->unacked >= rfilter->ack_every ||
+		rfilter->unacked >= rfilter->recv_window / 2) {
+	send_ack(rfilter);
+    } else if (!rfilter->ack_armed) {
+	rfilter->ack_armed = true;
+	rfilter->ack_time = relpkt_now(rfilter) + rfilter->cfg_ack_delay;
+	relpkt_filter_start_timer(rfilter);
+    }
 }
 
 static void
-request_resend(struct relpkt_filter *rfilter, uint8_t first, uint8_t last)
+request_resend(struct relpkt_filter *rfilter, uint32_t first, uint32_t last)
 {
     if (!rfilter->send_resend_pkt) {
 	rfilter->resend_pkt_len = 1;
 	rfilter->resend_pkt[0] = RELPKT_MSG_RESEND << 4;
 	rfilter->send_resend_pkt = true;
     }
-    if (rfilter->resend_pkt_len + 1U >= sizeof(rfilter->resend_pkt))
+    if (rfilter->resend_pkt_len + 2 * rfilter->seq_bytes >
+		sizeof(rfilter->resend_pkt))
 	return; /* No space left, let transmit timeout get it. */
-    rfilter->resend_pkt[rfilter->resend_pkt_len++] = first;
-    rfilter->resend_pkt[rfilter->resend_pkt_len++] = last;
-    rfilter->timeout_ack_count = 0;
+    put_seq(rfilter, rfilter->resend_pkt + rfilter->resend_pkt_len, first);
+    rfilter->resend_pkt_len += rfilter->seq_bytes;
+    put_seq(rfilter, rfilter->resend_pkt + rfilter->resend_pkt_len, last);
+    rfilter->resend_pkt_len += rfilter->seq_bytes;
+}
+
+/*
+ * Fill in the selective ack with the packets we have past the first
+ * missing one.  This is done at send time so it is current.  Returns
+ * the length, 0 if nothing is missing.
+ */
+static unsigned int
+build_sack(struct relpkt_filter *rfilter)
+{
+    uint32_t i, start = 0;
+    uint32_t n = rfilter->next_expected_seq - rfilter->next_deliver_seq;
+    unsigned int len = 1;
+    bool in_block = false, hole = false, ready;
+
+    rfilter->sack_pkt[0] = RELPKT_MSG_SACK << 4;
+    for (i = 0; i <= n && len < sizeof(rfilter->sack_pkt); i++) {
+	ready = i < n && rfilter->recvpkts[recvpkt_pos(rfilter, i)].ready;
+	if (ready && !in_block) {
+	    start = i;
+	    in_block = true;
+	} else if (!ready && in_block) {
+	    put_seq(rfilter, rfilter->sack_pkt + len,
+		    rfilter->next_deliver_seq + start);
+	    put_seq(rfilter, rfilter->sack_pkt + len + 2,
+		    rfilter->next_deliver_seq + i - 1);
+	    len += 4;
+	    in_block = false;
+	}
+	if (!ready && i < n)
+	    hole = true;
+    }
+    if (!hole)
+	return 0;
+    return len;
 }
 
 /* Returns true on a protocol error. */
 static bool
-handle_ack(struct relpkt_filter *rfilter, uint8_t seq)
+handle_ack(struct relpkt_filter *rfilter, const unsigned char *buf)
 {
-    unsigned int pos;
+    uint32_t nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    uint32_t off = seq_off(rfilter, get_seq(rfilter, buf),
+			   rfilter->next_acked_seq), nracked;
+    struct pkt *p, *last = NULL;
+    int64_t now, rtt = -1;
+    uint64_t rate = 0;
+    bool round_start = false;
 
     /*
      * The last received message on the other end is in seq, but we
      * keep the next thing that should be acked, thus the +1.
      */
-    if (!seq_inside(seq, rfilter->next_acked_seq,
-		    rfilter->next_send_seq + 1))
+    if (off > nrqueued) {
+	if (off > rfilter->seq_mask / 2)
+	    /* An old ack that came in late, the rest is still good. */
+	    return false;
 	return true;
-    while (rfilter->next_acked_seq != seq) {
-	pos = rfilter->first_xmitpkt;
-	if (!rfilter->xmitpkts[pos].sent) {
+    }
+    nracked = off;
+    GENSIO_PROBE3(relpkt_ack, rfilter, nracked, nrqueued);
+    if (nracked)
+	now = relpkt_now(rfilter);
+    while (off--) {
+	p = &(rfilter->xmitpkts[rfilter->first_xmitpkt]);
+	if (!p->sent) {
 	    /*
 	     * Packets wasn't sent yet, but we got an ack.  Could
 	     * happen on a retransmit or some other error.  Just act
 	     * like it was transmitted.
 	     */
-	    rfilter->xmitpkts[pos].sent = true;
+	    p->sent = true;
 	    assert(rfilter->nr_waiting_xmitpkt > 0);
 	    rfilter->nr_waiting_xmitpkt--;
+	    if (p->send_time >= 0)
+		rfilter->nr_resend--;
+	} else if (!p->sacked) {
+	    assert(rfilter->inflight > 0);
+	    rfilter->inflight--;
+	}
+	if (p->send_time >= 0) {
+	    rfilter->delivered += p->len - rfilter->hdr_len;
+	    last = p;
+	}
+	if (p->data) {
+	    gensio_os_buf_free(rfilter->o, p->data);
+	    p->data = NULL;
 	}
 	rfilter->first_xmitpkt = xmitpkt_pos(rfilter, 1);
 	rfilter->next_acked_seq++;
     }
+    if (nracked) {
+	if (last) {
+	    /* No rtt from a resent packet, the ack may be for either. */
+	    if (!last->retransmitted) {
+		rtt = now - last->send_time;
+		rtt_sample(rfilter, rtt);
+	    }
+	    if (now > last->delivered_time)
+		rate = ((rfilter->delivered - last->delivered) *
+			GENSIO_NSECS_IN_SEC / (now - last->delivered_time));
+	    if (last->delivered >= rfilter->round_delivered) {
+		rfilter->round_delivered = rfilter->delivered;
+		rfilter->round_count++;
+		round_start = true;
+	    }
+	}
+	rfilter->delivered_time = now;
+	cc_acked(rfilter, nracked, rate, rtt, round_start);
+
+	if (rfilter->next_acked_seq != rfilter->next_send_seq) {
+	    rfilter->rto_armed = true;
+	    rfilter->rto_time = now + rfilter->rto;
+	} else {
+	    rfilter->rto_armed = false;
+	}
+    }
     rfilter->timeouts_since_ack = 0;
 
     return false;
 }
 
+/*
+ * The remote end has the packets in the sack, don't send those again.
+ * Anything missing before the last one it has was probably lost, so
+ * resend those now instead of waiting for a timeout.  Holes that were
+ * already resent are left to the timeout, in case the resend was lost.
+ */
+static void
+handle_sack(struct relpkt_filter *rfilter, const unsigned char *buf,
+	    gensiods buflen)
+{
+    uint32_t nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+    uint32_t first, last, off, high = 0;
+    unsigned int nr_resend = rfilter->nr_resend;
+    int64_t latest = -1;
+    struct pkt *p;
+    gensiods i;
+
+    for (i = 0; i + 4 <= buflen; i += 4) {
+	first = seq_off(rfilter, get_seq(rfilter, buf + i),
+			rfilter->next_acked_seq);
+	last = seq_off(rfilter, get_seq(rfilter, buf + i + 2),
+		       rfilter->next_acked_seq);
+	if (first > last || last >= nrqueued)
+	    continue; /* Old or bogus, ignore it. */
+	for (off = first; off <= last; off++) {
+	    p = &(rfilter->xmitpkts[xmitpkt_pos(rfilter, off)]);
+	    if (!p->sent) {
+		p->sent = true;
+		assert(rfilter->nr_waiting_xmitpkt > 0);
+		rfilter->nr_waiting_xmitpkt--;
+		if (p->send_time >= 0)
+		    rfilter->nr_resend--;
+	    } else if (!p->sacked) {
+		assert(rfilter->inflight > 0);
+		rfilter->inflight--;
+	    }
+	    if (p->send_time > latest)
+		latest = p->send_time;
+	    p->sacked = true;
+	}
+	if (last + 1 > high)
+	    high = last + 1;
+    }
+
+    /*
+     * A hole sent before something that has arrived was lost.  This
+     * also catches a lost resend, without resending holes that were
+     * just resent.
+     */
+    for (off = 0; off < high; off++) {
+	p = &(rfilter->xmitpkts[xmitpkt_pos(rfilter, off)]);
+	if (p->sent && !p->sacked && p->send_time < latest)
+	    mark_unsent(rfilter, off);
+    }
+    if (rfilter->nr_resend != nr_resend)
+	cc_loss(rfilter, false);
+    rfilter->timeouts_since_ack = 0;
+}
+
+/*
+ * Run the timer for the earliest of the once a second check, the
+ * retransmit timeout, a held ack, and when pacing will let the next
+ * packet go.
+ */
 static void
 relpkt_filter_start_timer(struct relpkt_filter *rfilter)
 {
-    gensio_time timeout = { 1, 0 };
+    int64_t now = relpkt_now(rfilter), when = rfilter->tick_time, wait;
+    gensio_time timeout;
+
+    if (rfilter->rto_armed && rfilter->rto_time < when)
+	when = rfilter->rto_time;
+    if (rfilter->ack_armed && rfilter->ack_time < when)
+	when = rfilter->ack_time;
+    if (rfilter->nr_waiting_xmitpkt && rfilter->pacing_rate &&
+		rfilter->pace_tokens <= 0 &&
+		(rfilter->inflight < rfilter->cwnd || rfilter->nr_resend)) {
+	wait = rfilter->pace_time + (1 - rfilter->pace_tokens) *
+	    GENSIO_NSECS_IN_SEC / (int64_t) rfilter->pacing_rate;
+	if (wait < when)
+	    when = wait;
+    }
+
+    if (rfilter->timer_running) {
+	if (when >= rfilter->timer_time)
+	    return;
+	rfilter->filter_cb(rfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_STOP_TIMER, NULL);
+    }
 
+    wait = when - now;
+    if (wait < 0)
+	wait = 0;
+    timeout.secs = wait / GENSIO_NSECS_IN_SEC;
+    timeout.nsecs = wait % GENSIO_NSECS_IN_SEC;
     rfilter->filter_cb(rfilter->filter_cb_data,
 		       GENSIO_FILTER_CB_START_TIMER, &timeout);
+    rfilter->timer_running = true;
+    rfilter->timer_time = when;
 }
 
 static void
@@ -491,9 +1574,11 @@ relpkt_ul_read_pending(struct relpkt_filter *rfilter)
 static bool
 relpkt_ll_write_pending(struct relpkt_filter *rfilter)
 {
-    return rfilter->nr_waiting_xmitpkt || rfilter->send_init_pkt ||
+    return (rfilter->nr_waiting_xmitpkt && xmit_ok(rfilter)) ||
+	rfilter->send_init_pkt ||
 	rfilter->send_close_pkt || rfilter->send_resend_pkt ||
-	rfilter->send_ack_pkt;
+	rfilter->send_ack_pkt || rfilter->send_sack_pkt ||
+	rfilter->send_fec_pkt;
 }
 
 static bool
@@ -701,10 +1786,21 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
 	gensiods i, writelen = 0;
 	bool trunc = false;
 	unsigned int pos = xmitpkt_pos(rfilter, nrqueued);
+	unsigned int hdr_len = rfilter->hdr_len;
 	struct pkt *p = &(rfilter->xmitpkts[pos]);
 
+	if (!p->data) {
+	    p->data = gensio_os_buf_alloc(rfilter->o,
+					  rfilter->max_xmit_pktsize + hdr_len);
+	    if (!p->data) {
+		err = GE_NOMEM;
+		goto out_unlock;
+	    }
+	}
+
 	/* FIXME - if previous packet is not full and not eom, can append */
 	p->len = 0;
+	p->eom = false;
 	for (i = 0; i < sglen; i++) {
 	    gensiods inlen = sg[i].buflen;
 	    const unsigned char *buf = sg[i].buf;
@@ -713,7 +1809,7 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
 		inlen = rfilter->max_xmit_pktsize - p->len;
 		trunc = true;
 	    }
-	    memcpy(p->data + p->len + 3, buf, inlen);
+	    memcpy(p->data + p->len + hdr_len, buf, inlen);
 	    writelen += inlen;
 	    p->len += inlen;
 	    if (p->len == rfilter->max_xmit_pktsize)
@@ -726,91 +1822,252 @@ relpkt_ul_write(struct relpkt_filter *rfilter,
 	    if (!trunc && gensio_str_in_auxdata(auxdata, "eom"))
 		p->eom = true;
 	    p->data[0] = (RELPKT_MSG_DATA << 4) | (uint8_t) p->eom;
-	    /* Ack (byte 1) will be filled in on transmit. */
-	    p->data[2] = rfilter->next_send_seq;
+	    /* Ack will be filled in on transmit. */
+	    put_seq(rfilter, p->data + 1 + rfilter->seq_bytes,
+		    rfilter->next_send_seq);
 	    rfilter->next_send_seq++;
 	    p->sent = false;
-	    p->len += 3; /* For the header. */
+	    p->sacked = false;
+	    p->retransmitted = false;
+	    p->send_time = -1;
+	    p->len += hdr_len; /* For the header. */
 	    rfilter->nr_waiting_xmitpkt++;
 	}
     }
 
-    p = NULL;
-    if (rfilter->send_init_pkt) {
-	rsg.buf = rfilter->init_pkt;
-	rsg.buflen = 5;
-	endbool = &rfilter->send_init_pkt;
-    } else if (rfilter->nr_waiting_xmitpkt) {
-	p = first_xmitpkt_to_send(rfilter);
-	rsg.buf = p->data;
-	rsg.buflen = p->len;
-	p->data[1] = rfilter->next_deliver_seq; /* Add the ack */
-	rfilter->send_ack_pkt = false;
-    } else if (rfilter->send_resend_pkt) {
-	rsg.buf = rfilter->resend_pkt;
-	rsg.buflen = rfilter->resend_pkt_len;
-	endbool = &rfilter->send_resend_pkt;
-    } else if (rfilter->send_ack_pkt) {
-	rfilter->ack_pkt[1] = rfilter->next_deliver_seq;
-	rsg.buf = rfilter->ack_pkt;
-	rsg.buflen = 3;
-	endbool = &rfilter->send_ack_pkt;
-    } else if (rfilter->send_close_pkt) {
-	rsg.buf = rfilter->close_pkt;
-	rsg.buflen = 3;
-	endbool = &rfilter->send_close_pkt;
-	if (rfilter->state == RELPKT_REMCLOSED)
-	    finish_close = true;
-    }
-
-    if (rsg.buflen) {
+    /*
+     * Send all we can.  The base gensio only asks again when the
+     * child stops taking data, anything left here would wait for the
+     * next ack or timeout to go out.
+     */
+    for (;;) {
 	gensiods count;
 
+	p = NULL;
+	endbool = NULL;
+	rsg.buflen = 0;
+	if (rfilter->send_sack_pkt) {
+	    rsg.buflen = build_sack(rfilter);
+	    if (!rsg.buflen)
+		rfilter->send_sack_pkt = false;
+	}
+	if (rfilter->send_sack_pkt) {
+	    /* Send this ahead of data, the other end needs it to resend. */
+	    rsg.buf = rfilter->sack_pkt;
+	    endbool = &rfilter->send_sack_pkt;
+	} else if (rfilter->send_init_pkt) {
+	    rsg.buf = rfilter->init_pkt;
+	    rsg.buflen = rfilter->init_pkt_len;
+	    endbool = &rfilter->send_init_pkt;
+	} else if (rfilter->send_fec_pkt) {
+	    /* Right after its group, before anything that would sack it. */
+	    rsg.buf = rfilter->fec_pkt;
+	    rsg.buflen = rfilter->fec_pkt_len;
+	    endbool = &rfilter->send_fec_pkt;
+	} else if (rfilter->nr_waiting_xmitpkt && xmit_ok(rfilter)) {
+	    p = first_xmitpkt_to_send(rfilter);
+	    rsg.buf = p->data;
+	    rsg.buflen = p->len;
+	    /* The ack */
+	    put_seq(rfilter, p->data + 1, rfilter->next_deliver_seq);
+	    rfilter->send_ack_pkt = false;
+	    ack_sent(rfilter);
+	} else if (rfilter->send_resend_pkt) {
+	    rsg.buf = rfilter->resend_pkt;
+	    rsg.buflen = rfilter->resend_pkt_len;
+	    endbool = &rfilter->send_resend_pkt;
+	} else if (rfilter->send_ack_pkt) {
+	    put_seq(rfilter, rfilter->ack_pkt + 1, rfilter->next_deliver_seq);
+	    rsg.buf = rfilter->ack_pkt;
+	    rsg.buflen = rfilter->hdr_len;
+	    endbool = &rfilter->send_ack_pkt;
+	} else if (rfilter->send_close_pkt) {
+	    rsg.buf = rfilter->close_pkt;
+	    rsg.buflen = 3;
+	    endbool = &rfilter->send_close_pkt;
+	    if (rfilter->state == RELPKT_REMCLOSED)
+		finish_close = true;
+	}
+	if (!rsg.buflen)
+	    break;
+
 #ifdef DEBUG_MSG
 	printf("Writing(%p):", rfilter);
 	prbuf(rsg.buf, rsg.buflen);
 #endif
-#ifdef DROP_NR
-	if (p && curr_drop % DROP_NR == 0) {
+	if (p && rfilter->drop_nr && ++rfilter->curr_drop == rfilter->drop_nr) {
+	    /* Pretend it was sent, for testing resends. */
+	    rfilter->curr_drop = 0;
 	    err = 0;
 	    count = rsg.buflen;
-	} else
-#endif
+	} else {
 	    err = handler(cb_data, &count, &rsg, 1, NULL);
+	}
+	if (err || count == 0)
+	    break;
+	if (count != rsg.buflen) {
+	    /*
+	     * Is this right?  Lower layer should take whole packets
+	     * or nothing.
+	     */
+	    err = GE_TOOBIG;
+	    break;
+	}
 
-#ifdef DROP_NR
-	if (p)
-	    curr_drop++;
-#endif
-	if (!err) {
-	    if (count != 0 && count != rsg.buflen) {
-		/*
-		 * Is this right?  Lower layer should take whole packets
-		 * or nothing.
-		 */
-		err = GE_TOOBIG;
-	    } else if (count != 0) {
-		if (p) {
-		    p->sent = true;
-		    assert(rfilter->nr_waiting_xmitpkt);
-		    rfilter->nr_waiting_xmitpkt--;
-		    rfilter->send_since_timeout = true;
-		} else {
-		    if (endbool)
-			*endbool = false;
-		    if (finish_close) {
-			rfilter->err = GE_REMCLOSE;
-			err = GE_REMCLOSE;
-		    }
-		}
+	GENSIO_PROBE3(relpkt_send, rfilter,
+		      ((const unsigned char *) rsg.buf)[0] >> 4,
+		      rsg.buflen);
+	if (p) {
+	    int64_t now = relpkt_now(rfilter);
+
+	    p->sent = true;
+	    assert(rfilter->nr_waiting_xmitpkt);
+	    rfilter->nr_waiting_xmitpkt--;
+	    if (rfilter->inflight == 0)
+		/* Don't count idle time against the delivery rate. */
+		rfilter->delivered_time = now;
+	    rfilter->inflight++;
+	    rfilter->send_since_timeout = true;
+	    if (p->send_time >= 0) {
+		p->retransmitted = true;
+		assert(rfilter->nr_resend > 0);
+		rfilter->nr_resend--;
+		rfilter->retransmits++;
+	    } else {
+		fec_sent(rfilter, rfilter->next_unsent_seq, p);
+	    }
+	    p->send_time = now;
+	    /* first_xmitpkt_to_send() set this to p's seq. */
+	    if ((int32_t) (rfilter->next_unsent_seq + 1 -
+			   rfilter->sent_high_seq) > 0)
+		rfilter->sent_high_seq = rfilter->next_unsent_seq + 1;
+	    p->delivered = rfilter->delivered;
+	    p->delivered_time = rfilter->delivered_time;
+	    if (rfilter->pacing_rate)
+		rfilter->pace_tokens -= p->len;
+	    if (!rfilter->rto_armed) {
+		rfilter->rto_armed = true;
+		rfilter->rto_time = now + rfilter->rto;
+	    }
+	    relpkt_filter_start_timer(rfilter);
+	} else {
+	    if (endbool == &rfilter->send_fec_pkt)
+		rfilter->fec_sent++;
+	    *endbool = false;
+	    if (finish_close) {
+		rfilter->err = GE_REMCLOSE;
+		err = GE_REMCLOSE;
+		break;
 	    }
 	}
     }
+ out_unlock:
     relpkt_unlock(rfilter);
 
     return err;
 }
 
+/*
+ * Store a data packet pos past next_deliver_seq.  recovered is true
+ * if it was rebuilt from an FEC message.
+ */
+static void
+recv_data(struct relpkt_filter *rfilter, uint32_t pos,
+	  const unsigned char *data, gensiods len, bool eom, bool recovered)
+{
+    uint32_t seq;
+    struct pkt *p;
+
+    if (pos >= rfilter->recv_window)
+	return; /* Ignore it */
+    seq = rfilter->next_deliver_seq + pos;
+    if (seq == rfilter->next_expected_seq) {
+	rfilter->next_expected_seq++;
+    } else if (pos > rfilter->next_expected_seq -
+				rfilter->next_deliver_seq) {
+	/* Something was lost. */
+	if (rfilter->version == 0)
+	    request_resend(rfilter, rfilter->next_expected_seq, seq - 1);
+	else if (!fec_may_fill(rfilter, seq))
+	    rfilter->send_sack_pkt = true;
+	rfilter->next_expected_seq = seq + 1;
+    }
+    p = &(rfilter->recvpkts[recvpkt_pos(rfilter, pos)]);
+    if (!p->ready) {
+	if (!p->data) {
+	    p->data = gensio_os_buf_alloc(rfilter->o, rfilter->max_pktsize);
+	    if (!p->data)
+		return; /* Drop it, it will be resent. */
+	}
+	memcpy(p->data, data, len);
+	p->len = len;
+	p->start = 0;
+	p->ready = true;
+	p->eom = eom;
+	if (recovered)
+	    rfilter->fec_recovered++;
+	else
+	    fec_received(rfilter, seq, data, len, eom);
+    }
+    /*
+     * Keep the other end up to date while a hole is present,
+     * each packet past it tells it more about what was lost.
+     */
+    if (rfilter->version >= 1 && pos != 0 &&
+		!rfilter->recvpkts[recvpkt_pos(rfilter, 0)].ready &&
+		!fec_may_fill(rfilter, seq))
+	rfilter->send_sack_pkt = true;
+}
+
+/*
+ * An FEC message came in.  If exactly one of the packets it covers
+ * is missing, rebuild it.
+ */
+static void
+recv_fec(struct relpkt_filter *rfilter, const unsigned char *buf,
+	 gensiods buflen)
+{
+    unsigned int n = rfilter->fec_recv_size, hdr = 1 + rfilter->seq_bytes;
+    uint32_t off, last, first, m, covered;
+    struct relpkt_fec *f;
+    gensiods i, len;
+
+    if (!n)
+	return;
+    off = seq_off(rfilter, get_seq(rfilter, buf + 1),
+		  rfilter->next_deliver_seq);
+    last = rfilter->next_deliver_seq + off;
+    if (off > rfilter->seq_mask / 2)
+	/* Before next_deliver_seq, it's still good. */
+	last -= rfilter->seq_mask + 1;
+    first = last - last % n;
+    covered = last % n + 1;
+    f = &rfilter->fec_recv[(last / n) % rfilter->nr_fec_recv];
+    if (!f->valid || f->first != first || f->count + 1 != covered ||
+		f->len > buflen - hdr)
+	return;
+    for (m = 0; m < covered; m++) {
+	if (!(f->have & ((uint64_t) 1 << m)))
+	    break;
+    }
+    if (m == covered || f->have >> covered)
+	return; /* Nothing missing, or has packets the message doesn't. */
+
+    /* The group is used up, rebuild the missing packet in place. */
+    f->valid = false;
+    if (f->len < buflen - hdr) {
+	memset(f->data + f->len, 0, buflen - hdr - f->len);
+	f->len = buflen - hdr;
+    }
+    for (i = 0; i < f->len; i++)
+	f->data[i] ^= buf[hdr + i];
+    len = f->data[0] << 8 | f->data[1];
+    if (len == 0 || len > rfilter->max_pktsize || len + 2 > f->len)
+	return;
+    recv_data(rfilter, first + m - rfilter->next_deliver_seq, f->data + 2,
+	      len, f->eom ^ (buf[0] & 1), true);
+}
+
 static int
 relpkt_ll_write(struct relpkt_filter *rfilter,
 		gensio_ll_filter_data_handler handler, void *cb_data,
@@ -821,7 +2078,7 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
     int err = 0;
     static const char *eomaux[2] = { "eom", NULL };
     bool response;
-    uint8_t seq, endseq, pos, ppos;
+    uint32_t seq, endseq, pos, nrqueued;
     unsigned int i;
     struct pkt *p;
     const char *proto_err_str = NULL;
@@ -867,16 +2124,9 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 
 	case RELPKT_WAITING_INIT:
 	    if (!response) {
-		rfilter->max_xmitpkt = buf[2];
-		if (rfilter->max_xmitpkt == 0) {
-		    proto_err_str = "rfilter->max_xmitpkt == 0";
+		proto_err_str = handle_init(rfilter, buf, buflen);
+		if (proto_err_str)
 		    goto protocol_err;
-		}
-		if (rfilter->max_xmitpkt > rfilter->max_pkt)
-		    rfilter->max_xmitpkt = rfilter->max_pkt;
-		rfilter->max_xmit_pktsize = buf[3] << 8 | buf[4];
-		if (rfilter->max_xmit_pktsize > rfilter->max_pktsize)
-		    rfilter->max_xmit_pktsize = rfilter->max_pktsize;
 		send_init(rfilter, true);
 		rfilter->state = RELPKT_OPEN;
 		relpkt_filter_start_timer(rfilter);
@@ -885,12 +2135,9 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 
 	case RELPKT_WAITING_INIT_RSP:
 	    if (response) {
-		rfilter->max_xmitpkt = buf[2];
-		if (rfilter->max_xmitpkt > rfilter->max_pkt)
-		    rfilter->max_xmitpkt = rfilter->max_pkt;
-		rfilter->max_xmit_pktsize = buf[3] << 8 | buf[4];
-		if (rfilter->max_xmit_pktsize > rfilter->max_pktsize)
-		    rfilter->max_xmit_pktsize = rfilter->max_pktsize;
+		proto_err_str = handle_init(rfilter, buf, buflen);
+		if (proto_err_str)
+		    goto protocol_err;
 		rfilter->state = RELPKT_OPEN;
 		relpkt_filter_start_timer(rfilter);
 	    }
@@ -900,8 +2147,8 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	case RELPKT_WAITING_CLOSE_CLEAR:
 	    if (!response) {
 		send_init(rfilter, true);
-		resend_packets(rfilter, rfilter->next_acked_seq,
-			       rfilter->next_send_seq);
+		resend_packets(rfilter, 0,
+			       rfilter->next_send_seq - rfilter->next_acked_seq);
 	    }
 	    break;
 
@@ -921,11 +2168,15 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 
 	case RELPKT_OPEN:
 	case RELPKT_WAITING_CLOSE_CLEAR:
-	    if (buflen > rfilter->max_pktsize + 3) {
-		proto_err_str = "buflen > rfilter->max_pktsize + 3";
+	    if (buflen < rfilter->hdr_len) {
+		proto_err_str = "buflen < hdr_len";
+		goto protocol_err;
+	    }
+	    if (buflen > rfilter->max_pktsize + rfilter->hdr_len) {
+		proto_err_str = "buflen > rfilter->max_pktsize + hdr_len";
 		goto protocol_err;
 	    }
-	    if (handle_ack(rfilter, buf[1]))
+	    if (handle_ack(rfilter, buf + 1))
 		goto out_unlock;
 	    if (rfilter->state != RELPKT_OPEN) {
 		/* Only deliver data in open state */
@@ -937,28 +2188,12 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 		}
 		break;
 	    }
-	    if (buflen == 3) /* Just an ack */
+	    if (buflen == rfilter->hdr_len) /* Just an ack */
 		break;
-	    seq = buf[2];
-	    pos = seq - rfilter->next_deliver_seq;
-	    if ((uint8_t) (seq - rfilter->next_deliver_seq) > rfilter->max_pkt)
-		break; /* Ignore it */
-	    ppos = recvpkt_pos(rfilter, pos);
-	    if (seq == rfilter->next_expected_seq) {
-		rfilter->next_expected_seq++;
-	    } else if (!seq_inside(seq, rfilter->next_deliver_seq,
-				  rfilter->next_expected_seq)) {
-		request_resend(rfilter, rfilter->next_expected_seq, seq - 1);
-		rfilter->next_expected_seq = seq + 1;
-	    }
-	    p = &(rfilter->recvpkts[ppos]);
-	    if (!p->ready) {
-		memcpy(p->data, buf + 3, buflen - 3);
-		p->len = buflen - 3;
-		p->start = 0;
-		p->ready = true;
-		p->eom = buf[0] & 1;
-	    }
+	    pos = seq_off(rfilter, get_seq(rfilter, buf + 1 + rfilter->seq_bytes),
+			  rfilter->next_deliver_seq);
+	    recv_data(rfilter, pos, buf + rfilter->hdr_len,
+		      buflen - rfilter->hdr_len, buf[0] & 1, false);
 	    break;
 
 	default:
@@ -979,23 +2214,27 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	case RELPKT_WAITING_CLOSE_RSP:
 	    buf++;
 	    buflen--;
-	    if (buflen % 2 != 0) { /* Should be pairs of sequence numbers. */
+	    /* Should be pairs of sequence numbers. */
+	    if (buflen % (2 * rfilter->seq_bytes) != 0) {
 		proto_err_str = "buflen % 2 != 0";
 		goto protocol_err;
 	    }
-	    for (i = 0; i < buflen; i += 2) {
-		seq = buf[i];
-		endseq = buf[i + 1];
-		if (!seq_inside(seq, rfilter->next_acked_seq,
-				rfilter->next_send_seq)) {
+	    nrqueued = rfilter->next_send_seq - rfilter->next_acked_seq;
+	    for (i = 0; i < buflen; i += 2 * rfilter->seq_bytes) {
+		seq = seq_off(rfilter, get_seq(rfilter, buf + i),
+			      rfilter->next_acked_seq);
+		endseq = seq_off(rfilter,
+				 get_seq(rfilter, buf + i + rfilter->seq_bytes),
+				 rfilter->next_acked_seq);
+		if (seq >= nrqueued) {
 		    proto_err_str = "seq_inside A";
 		    goto protocol_err;
 		}
-		if (!seq_inside(endseq, rfilter->next_acked_seq,
-				rfilter->next_send_seq)) {
+		if (endseq >= nrqueued) {
 		    proto_err_str = "seq_inside B";
 		    goto protocol_err;
 		}
+		cc_loss(rfilter, false);
 		resend_packets(rfilter, seq, endseq + 1);
 	    }
 	    break;
@@ -1005,6 +2244,43 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	}
 	break;
 
+    case RELPKT_MSG_FEC:
+	switch (rfilter->state) {
+	case RELPKT_OPEN:
+	    if (rfilter->version < 2) {
+		proto_err_str = "fec before version 2";
+		goto protocol_err;
+	    }
+	    if (buflen < 1 + rfilter->seq_bytes + 3 ||
+			buflen > rfilter->max_pktsize + rfilter->hdr_len) {
+		proto_err_str = "bad fec length";
+		goto protocol_err;
+	    }
+	    recv_fec(rfilter, buf, buflen);
+	    break;
+
+	default:
+	    break;
+	}
+	break;
+
+    case RELPKT_MSG_SACK:
+	switch (rfilter->state) {
+	case RELPKT_OPEN:
+	case RELPKT_WAITING_CLOSE_CLEAR:
+	case RELPKT_WAITING_CLOSE_RSP:
+	    if (rfilter->version == 0) {
+		proto_err_str = "sack in version 0";
+		goto protocol_err;
+	    }
+	    handle_sack(rfilter, buf + 1, buflen - 1);
+	    break;
+
+	default:
+	    break;
+	}
+	break;
+
     case RELPKT_MSG_CLOSE:
 	switch (rfilter->state) {
 	case RELPKT_CLOSED:
@@ -1048,9 +2324,11 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 	if (!err) {
 	    if (count >= (uint16_t) (p->len - p->start)) {
 		p->ready = false;
+		gensio_os_buf_free(rfilter->o, p->data);
+		p->data = NULL;
 		rfilter->deliver_recvpkt = recvpkt_pos(rfilter, 1);
 		rfilter->next_deliver_seq++;
-		send_ack(rfilter);
+		ack_delivered(rfilter);
 	    } else {
 		p->start += count;
 	    }
@@ -1068,8 +2346,36 @@ relpkt_ll_write(struct relpkt_filter *rfilter,
 }
 
 static int
-relpkt_setup(struct relpkt_filter *rfilter)
+relpkt_setup(struct relpkt_filter *rfilter, struct gensio *io)
 {
+    struct gensio *child = gensio_get_child(io, 1);
+    char buf[30];
+    gensiods len = sizeof(buf), lower_size = 0;
+
+    /* Size packets to what the layer below can take if not given. */
+    if (child && !gensio_control(child, 0, GENSIO_CONTROL_GET,
+				 GENSIO_CONTROL_MAX_WRITE_PACKET, buf, &len))
+	lower_size = strtoul(buf, NULL, 0);
+
+    rfilter->max_pktsize = rfilter->cfg_pktsize;
+    if (!rfilter->max_pktsize) {
+	if (lower_size > RELPKT_PATH_PKTSIZE + RELPKT_MAX_HDR)
+	    rfilter->max_pktsize = RELPKT_PATH_PKTSIZE;
+	else if (lower_size > RELPKT_MAX_HDR)
+	    rfilter->max_pktsize = lower_size - RELPKT_MAX_HDR;
+	else
+	    rfilter->max_pktsize = RELPKT_DEFAULT_PKTSIZE;
+    }
+
+    rfilter->window = rfilter->cfg_packets;
+    if (!rfilter->window) {
+	if (rfilter->max_pktsize >= RELPKT_PATH_PKTSIZE)
+	    rfilter->window = RELPKT_PATH_PACKETS;
+	else
+	    rfilter->window = RELPKT_DEFAULT_PACKETS;
+    }
+    set_version(rfilter, 0);
+    cc_init(rfilter);
     return 0;
 }
 
@@ -1088,16 +2394,46 @@ relpkt_filter_cleanup(struct relpkt_filter *rfilter)
     rfilter->next_send_seq = 0;
     rfilter->first_xmitpkt = 0;
     rfilter->nr_waiting_xmitpkt = 0;
+    rfilter->nr_resend = 0;
     rfilter->send_init_pkt = false;
     rfilter->init_retry_count = 0;
     rfilter->send_close_pkt = false;
     rfilter->close_retry_count = 0;
     rfilter->send_resend_pkt = false;
     rfilter->send_ack_pkt = false;
+    rfilter->send_sack_pkt = false;
+    rfilter->ack_every = 1;
+    rfilter->unacked = 0;
+    rfilter->ack_armed = false;
+    rfilter->remote_ack_delay = 0;
+    rfilter->next_unsent_seq = 0;
+    rfilter->timer_running = false;
+    rfilter->fec_size = 0;
+    rfilter->fec_recv_size = 0;
+    rfilter->send_fec_pkt = false;
+    rfilter->fec_xmit.valid = false;
+    /* These depend on the packet sizes, which may change. */
+    if (rfilter->fec_xmit.data)
+	gensio_os_buf_free(rfilter->o, rfilter->fec_xmit.data);
+    rfilter->fec_xmit.data = NULL;
+    if (rfilter->fec_pkt)
+	gensio_os_buf_free(rfilter->o, rfilter->fec_pkt);
+    rfilter->fec_pkt = NULL;
+    fec_recv_free(rfilter);
+    set_version(rfilter, 0);
+    cc_init(rfilter);
     for (i = 0; i < rfilter->max_pkt; i++) {
 	struct pkt *p = &rfilter->recvpkts[i];
 
 	p->ready = false;
+	if (p->data)
+	    gensio_os_buf_free(rfilter->o, p->data);
+	p->data = NULL;
+
+	p = &rfilter->xmitpkts[i];
+	if (p->data)
+	    gensio_os_buf_free(rfilter->o, p->data);
+	p->data = NULL;
     }
 }
 
@@ -1112,18 +2448,22 @@ relpkt_free(struct relpkt_filter *rfilter)
     if (rfilter->recvpkts) {
 	for (i = 0; i < rfilter->max_pkt; i++) {
 	    if (rfilter->recvpkts[i].data)
-		o->free(o, rfilter->recvpkts[i].data);
+		gensio_os_buf_free(o, rfilter->recvpkts[i].data);
 	}
 	o->free(o, rfilter->recvpkts);
     }
     if (rfilter->xmitpkts) {
-	/* Yes, the below is max_pkt for xmit.  That's the array size. */
 	for (i = 0; i < rfilter->max_pkt; i++) {
 	    if (rfilter->xmitpkts[i].data)
-		o->free(o, rfilter->xmitpkts[i].data);
+		gensio_os_buf_free(o, rfilter->xmitpkts[i].data);
 	}
 	o->free(o, rfilter->xmitpkts);
     }
+    if (rfilter->fec_xmit.data)
+	gensio_os_buf_free(o, rfilter->fec_xmit.data);
+    if (rfilter->fec_pkt)
+	gensio_os_buf_free(o, rfilter->fec_pkt);
+    fec_recv_free(rfilter);
     if (rfilter->filter)
 	gensio_filter_free_data(rfilter->filter);
     rfilter->o->free(rfilter->o, rfilter);
@@ -1132,32 +2472,46 @@ relpkt_free(struct relpkt_filter *rfilter)
 static int
 i_relpkt_filter_timeout(struct relpkt_filter *rfilter)
 {
-    rfilter->timeouts_since_ack++;
-    if (rfilter->timeouts_since_ack > 5) {
-	rfilter->err = GE_TIMEDOUT;
-	return GE_TIMEDOUT;
+    int64_t now = relpkt_now(rfilter);
+
+    if (now >= rfilter->tick_time) {
+	rfilter->tick_time = now + GENSIO_SECS_TO_NSECS(1);
+	rfilter->timeouts_since_ack++;
+	if (rfilter->timeouts_since_ack > 5) {
+	    rfilter->err = GE_TIMEDOUT;
+	    return GE_TIMEDOUT;
+	}
+
+	if (rfilter->send_since_timeout)
+	    rfilter->send_since_timeout = false;
+	else
+	    send_ack(rfilter);
+
+	if (rfilter->version >= 1 &&
+		rfilter->next_expected_seq != rfilter->next_deliver_seq)
+	    /* In case the last sack was lost. */
+	    rfilter->send_sack_pkt = true;
     }
 
-    if (rfilter->send_since_timeout)
-	rfilter->send_since_timeout = false;
-    else
+    if (rfilter->ack_armed && now >= rfilter->ack_time)
 	send_ack(rfilter);
 
-    if (rfilter->next_acked_seq != rfilter->next_send_seq) {
-	if (rfilter->next_acked_seq == rfilter->last_timeout_ack) {
-	    rfilter->timeout_ack_count++;
-	    if (rfilter->timeout_ack_count > 1) {
-		/*
-		 * We haven't received an ack for something we sent.
-		 * The packet must have been dropped.  Resend.
-		 */
-		resend_packets(rfilter, rfilter->next_acked_seq,
-			       rfilter->next_send_seq);
-		rfilter->timeout_ack_count = 0;
-	    }
+    if (rfilter->rto_armed && now >= rfilter->rto_time) {
+	if (rfilter->next_acked_seq != rfilter->next_send_seq) {
+	    /*
+	     * We haven't received an ack for something we sent.
+	     * The packet must have been dropped.  Resend.
+	     */
+	    resend_packets(rfilter, 0,
+			   rfilter->next_send_seq - rfilter->next_acked_seq);
+	    cc_loss(rfilter, true);
+	    rfilter->rto_count++;
+	    rfilter->rto *= 2;
+	    if (rfilter->rto > RELPKT_MAX_RTO)
+		rfilter->rto = RELPKT_MAX_RTO;
+	    rfilter->rto_time = now + rfilter->rto;
 	} else {
-	    rfilter->timeout_ack_count = 0;
-	    rfilter->last_timeout_ack = rfilter->next_acked_seq;
+	    rfilter->rto_armed = false;
 	}
     }
     relpkt_filter_start_timer(rfilter);
@@ -1170,11 +2524,46 @@ relpkt_filter_timeout(struct relpkt_filter *rfilter)
     int err;
 
     relpkt_lock(rfilter);
+    rfilter->timer_running = false;
     err = i_relpkt_filter_timeout(rfilter);
     relpkt_unlock(rfilter);
     return err;
 }
 
+static int
+relpkt_filter_control(struct relpkt_filter *rfilter, bool get, int op,
+		      char *data, gensiods *datalen)
+{
+    switch (op) {
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	relpkt_lock(rfilter);
+	*datalen = snprintf(data, *datalen,
+			    "version=%u cc=%s cwnd=%u ssthresh=%u inflight=%u"
+			    " srtt=%lld rttvar=%lld rto=%lld pacing_rate=%llu"
+			    " retransmits=%llu timeouts=%llu"
+			    " fec_sent=%llu fec_recovered=%llu",
+			    rfilter->version, rfilter->cc->name,
+			    rfilter->cwnd, rfilter->ssthresh,
+			    rfilter->inflight,
+			    (long long) (rfilter->srtt < 0 ? -1 :
+					 rfilter->srtt / 1000),
+			    (long long) (rfilter->rttvar / 1000),
+			    (long long) (rfilter->rto / 1000),
+			    (unsigned long long) rfilter->pacing_rate,
+			    (unsigned long long) rfilter->retransmits,
+			    (unsigned long long) rfilter->rto_count,
+			    (unsigned long long) rfilter->fec_sent,
+			    (unsigned long long) rfilter->fec_recovered);
+	relpkt_unlock(rfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static int gensio_relpkt_filter_func(struct gensio_filter *filter, int op,
 				     void *func, void *data,
 				     gensiods *count,
@@ -1222,7 +2611,7 @@ static int gensio_relpkt_filter_func(struct gensio_filter *filter, int op,
 			       auxdata);
 
     case GENSIO_FILTER_FUNC_SETUP:
-	return relpkt_setup(rfilter);
+	return relpkt_setup(rfilter, data);
 
     case GENSIO_FILTER_FUNC_CLEANUP:
 	relpkt_filter_cleanup(rfilter);
@@ -1235,6 +2624,10 @@ static int gensio_relpkt_filter_func(struct gensio_filter *filter, int op,
     case GENSIO_FILTER_FUNC_TIMEOUT:
 	return relpkt_filter_timeout(rfilter);
 
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return relpkt_filter_control(rfilter, *((bool *) cbuf), buflen, data,
+				     count);
+
     default:
 	return GE_NOTSUP;
     }
@@ -1243,10 +2636,12 @@ static int gensio_relpkt_filter_func(struct gensio_filter *filter, int op,
 static struct gensio_filter *
 gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
 			       gensiods max_pktsize, gensiods max_packets,
+			       const struct relpkt_cc *cc, unsigned int fec,
+			       unsigned int ack_every, int64_t ack_delay,
+			       unsigned int version, unsigned int drop_nr,
 			       bool server)
 {
     struct relpkt_filter *rfilter;
-    gensiods i;
 
     rfilter = o->zalloc(o, sizeof(*rfilter));
     if (!rfilter)
@@ -1254,31 +2649,36 @@ gensio_relpkt_filter_raw_alloc(struct gensio_os_funcs *o,
 
     rfilter->o = o;
     rfilter->server = server;
+    rfilter->cc = cc;
+    rfilter->cfg_version = version;
+    rfilter->drop_nr = drop_nr;
+    rfilter->cfg_fec = fec;
+    rfilter->cfg_ack_every = ack_every;
+    rfilter->cfg_ack_delay = ack_delay;
+    rfilter->ack_every = 1;
 
     rfilter->lock = o->alloc_lock(o);
     if (!rfilter->lock)
 	goto out_nomem;
 
+    /*
+     * The packet size and window may depend on the child, so they are
+     * set at setup time.  Packet data is allocated as it is used.
+     */
+    rfilter->cfg_pktsize = max_pktsize;
+    rfilter->cfg_packets = max_packets;
     rfilter->max_pkt = max_packets;
-    rfilter->max_pktsize = max_pktsize;
+    if (!rfilter->max_pkt)
+	rfilter->max_pkt = RELPKT_PATH_PACKETS;
+    set_version(rfilter, 0);
 
-    rfilter->recvpkts = o->zalloc(o, sizeof(struct pkt) * max_packets);
+    rfilter->recvpkts = o->zalloc(o, sizeof(struct pkt) * rfilter->max_pkt);
     if (!rfilter->recvpkts)
 	goto out_nomem;
-    for (i = 0; i < max_packets; i++) {
-	rfilter->recvpkts[i].data = o->zalloc(o, max_pktsize);
-	if (!rfilter->recvpkts[i].data)
-	    goto out_nomem;
-    }
 
-    rfilter->xmitpkts = o->zalloc(o, sizeof(struct pkt) * max_packets);
+    rfilter->xmitpkts = o->zalloc(o, sizeof(struct pkt) * rfilter->max_pkt);
     if (!rfilter->xmitpkts)
 	goto out_nomem;
-    for (i = 0; i < max_packets; i++) {
-	rfilter->xmitpkts[i].data = o->zalloc(o, max_pktsize + 3);
-	if (!rfilter->xmitpkts[i].data)
-	    goto out_nomem;
-    }
 
     rfilter->filter = gensio_filter_alloc_data(o, gensio_relpkt_filter_func,
 					       rfilter);
@@ -1300,8 +2700,16 @@ gensio_relpkt_filter_alloc(struct gensio_pparm_info *p,
 {
     struct gensio_filter *filter;
     unsigned int i;
-    gensiods max_pktsize = 123; /* FIXME - magic number. */
-    gensiods max_packets = 16;
+    gensiods max_pktsize = 0; /* Set from the child if not given. */
+    gensiods max_packets = 0;
+    const struct relpkt_cc *cc = &relpkt_newreno;
+    const char *ccstr = NULL;
+    unsigned int fec = 0;
+    unsigned int ack_every = 1;
+    gensio_time ack_delay = { 0, RELPKT_DEF_ACK_DELAY };
+    unsigned int version = RELPKT_VERSION;
+    unsigned int drop_nr = 0;
+    int64_t ack_delay_ns;
     char *str = NULL;
     int rv;
 
@@ -1332,12 +2740,68 @@ gensio_relpkt_filter_alloc(struct gensio_pparm_info *p,
 	if (gensio_pparm_boolv(p, args[i], "mode", "server", "client",
 			       &server) > 0)
 	    continue;
+	if (gensio_pparm_value(p, args[i], "cc", &ccstr) > 0)
+	    continue;
+	if (gensio_pparm_uint(p, args[i], "fec", &fec) > 0)
+	    continue;
+	if (gensio_pparm_uint(p, args[i], "ack_every", &ack_every) > 0)
+	    continue;
+	if (gensio_pparm_time(p, args[i], "ack_delay", 'm', &ack_delay) > 0)
+	    continue;
+	if (gensio_pparm_uint(p, args[i], "version", &version) > 0)
+	    continue;
+	/* Undocumented, used for testing. */
+	if (gensio_pparm_uint(p, args[i], "drop", &drop_nr) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(p, args[i]);
 	return GE_INVAL;
     }
 
-    filter = gensio_relpkt_filter_raw_alloc(o, max_pktsize, max_packets,
-					    server);
+    if (ccstr) {
+	for (i = 0; relpkt_ccs[i]; i++) {
+	    if (strcasecmp(ccstr, relpkt_ccs[i]->name) == 0)
+		break;
+	}
+	if (!relpkt_ccs[i]) {
+	    gensio_pparm_log(p, "Unknown congestion control: %s", ccstr);
+	    return GE_INVAL;
+	}
+	cc = relpkt_ccs[i];
+    }
+
+    if (max_pktsize > 65535 - RELPKT_MAX_HDR) {
+	gensio_pparm_log(p, "max_pktsize must be %d or less",
+			 65535 - RELPKT_MAX_HDR);
+	return GE_INVAL;
+    }
+    if (max_packets > RELPKT_MAX_WINDOW) {
+	gensio_pparm_log(p, "max_packets must be %d or less",
+			 RELPKT_MAX_WINDOW);
+	return GE_INVAL;
+    }
+    if (fec == 1 || fec > RELPKT_MAX_FEC) {
+	gensio_pparm_log(p, "fec must be 0 or 2 to %d", RELPKT_MAX_FEC);
+	return GE_INVAL;
+    }
+    if (ack_every < 1 || ack_every > RELPKT_MAX_ACK_EVERY) {
+	gensio_pparm_log(p, "ack_every must be 1 to %d", RELPKT_MAX_ACK_EVERY);
+	return GE_INVAL;
+    }
+    if (version > RELPKT_VERSION) {
+	gensio_pparm_log(p, "version must be %d or less", RELPKT_VERSION);
+	return GE_INVAL;
+    }
+    ack_delay_ns = ack_delay.secs * GENSIO_NSECS_IN_SEC + ack_delay.nsecs;
+    if (ack_delay_ns < GENSIO_MSECS_TO_NSECS(1) ||
+		ack_delay_ns > GENSIO_MSECS_TO_NSECS(RELPKT_MAX_ACK_DELAY_MS)) {
+	gensio_pparm_log(p, "ack_delay must be 1ms to %dms",
+			 RELPKT_MAX_ACK_DELAY_MS);
+	return GE_INVAL;
+    }
+
+    filter = gensio_relpkt_filter_raw_alloc(o, max_pktsize, max_packets, cc,
+					    fec, ack_every, ack_delay_ns,
+					    version, drop_nr, server);
     if (!filter)
 	return GE_NOMEM;
 
@@ -0,0 +1,692 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Replay the reads or writes from a binary trace (see
+ * gensio_filter_trace.c for the format) to the lower layer with the
+ * same sizes and timing they were recorded with.
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+
+#include "gensio_filter_replay.h"
+
+#define GTRACE_MAGIC		"GENSIOTR"
+#define GTRACE_MAGIC_LEN	8
+#define GTRACE_HDR_LEN		24
+
+#define GTRACE_START		0
+#define GTRACE_READ		1
+#define GTRACE_WRITE		2
+
+/* Used for the part of a record that wasn't captured. */
+#define REPLAY_FILL_SIZE	1024
+static const unsigned char replay_fill[REPLAY_FILL_SIZE];
+
+struct replay_rec {
+    uint64_t when; /* Nanoseconds from the trace start. */
+    gensiods len;
+    gensiods caplen;
+    const unsigned char *data;
+};
+
+struct replay_filter {
+    struct gensio_filter *filter;
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    struct gensio_os_funcs *o;
+
+    struct gensio_lock *lock;
+
+    /* The whole trace file, recs point into it. */
+    unsigned char *tracebuf;
+    struct replay_rec *recs;
+    gensiods nr_recs;
+
+    /* Times are divided by this, 0 means don't wait at all. */
+    float speed;
+
+    uint64_t start_time;
+    gensiods next; /* The record being written. */
+    gensiods pos; /* How much of the next record has been written. */
+    bool timer_running;
+
+    gensiods write_count;
+    gensiods read_count;
+    gensiods blocked; /* Number of times the lower layer didn't take it all. */
+    uint64_t late_max; /* Nanoseconds a record finished after its time. */
+    uint64_t late_sum;
+    uint64_t end_time;
+
+    gensiods print_pending;
+    gensiods print_pos;
+    char print_buffer[512];
+    bool final_started;
+};
+
+#define filter_to_replay(v) ((struct replay_filter *) \
+			     gensio_filter_get_user_data(v))
+
+static void
+replay_lock(struct replay_filter *rfilter)
+{
+    rfilter->o->lock(rfilter->lock);
+}
+
+static void
+replay_unlock(struct replay_filter *rfilter)
+{
+    rfilter->o->unlock(rfilter->lock);
+}
+
+static uint64_t
+get_le(const unsigned char *p, unsigned int len)
+{
+    uint64_t v = 0;
+
+    while (len > 0)
+	v = (v << 8) | p[--len];
+    return v;
+}
+
+static uint64_t
+replay_now_ns(struct replay_filter *rfilter)
+{
+    gensio_time t;
+
+    rfilter->o->get_monotonic_time(rfilter->o, &t);
+    return (uint64_t) t.secs * 1000000000 + t.nsecs;
+}
+
+/* When the given record should go out, in monotonic nanoseconds. */
+static uint64_t
+replay_due_time(struct replay_filter *rfilter, gensiods rec)
+{
+    if (rfilter->speed == 0)
+	return rfilter->start_time;
+    return rfilter->start_time +
+	(uint64_t) ((double) rfilter->recs[rec].when / rfilter->speed);
+}
+
+static bool
+replay_done(struct replay_filter *rfilter)
+{
+    return rfilter->next >= rfilter->nr_recs;
+}
+
+static bool
+replay_ul_read_pending(struct gensio_filter *filter)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+
+    return rfilter->print_pending;
+}
+
+static bool
+replay_ll_write_pending(struct gensio_filter *filter)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+    bool rv;
+
+    replay_lock(rfilter);
+    if (replay_done(rfilter))
+	/* Get the stats out before reporting GE_REMCLOSE. */
+	rv = rfilter->print_pending == 0;
+    else
+	rv = replay_now_ns(rfilter) >= replay_due_time(rfilter, rfilter->next);
+    replay_unlock(rfilter);
+
+    return rv;
+}
+
+static bool
+replay_ll_read_needed(struct gensio_filter *filter)
+{
+    return false;
+}
+
+/* Start the timer for the next record.  Called with the lock held. */
+static void
+replay_start_timer(struct replay_filter *rfilter, uint64_t now)
+{
+    uint64_t due;
+    gensio_time timeout;
+
+    if (rfilter->timer_running || replay_done(rfilter))
+	return;
+    due = replay_due_time(rfilter, rfilter->next);
+    if (due < now)
+	due = now;
+    timeout.secs = (due - now) / 1000000000;
+    timeout.nsecs = (due - now) % 1000000000;
+    rfilter->timer_running = true;
+    rfilter->filter_cb(rfilter->filter_cb_data,
+		       GENSIO_FILTER_CB_START_TIMER, &timeout);
+}
+
+static void
+replay_set_callbacks(struct gensio_filter *filter,
+		     gensio_filter_cb cb, void *cb_data)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+
+    rfilter->filter_cb = cb;
+    rfilter->filter_cb_data = cb_data;
+}
+
+static int
+replay_check_open_done(struct gensio_filter *filter, struct gensio *io)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+
+    replay_lock(rfilter);
+    rfilter->start_time = replay_now_ns(rfilter);
+    replay_start_timer(rfilter, rfilter->start_time);
+    replay_unlock(rfilter);
+    return 0;
+}
+
+static int
+replay_try_connect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    return 0;
+}
+
+static int
+replay_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    return 0;
+}
+
+/* Called with the lock held. */
+static void
+replay_format_final(struct replay_filter *rfilter)
+{
+    uint64_t elapsed = 0, late_mean = 0;
+    gensiods nrecs = rfilter->next;
+    int len;
+
+    if (rfilter->end_time > rfilter->start_time)
+	elapsed = rfilter->end_time - rfilter->start_time;
+    if (nrecs)
+	late_mean = rfilter->late_sum / nrecs;
+    len = snprintf(rfilter->print_buffer, sizeof(rfilter->print_buffer),
+		   "TOTAL: Replayed %lu records, %lu bytes in %llu.%3.3u"
+		   " seconds\n"
+		   "         late mean %.1lf max %.1lf usecs, blocked %lu"
+		   " times\n"
+		   "       Read %lu\n",
+		   (unsigned long) nrecs, (unsigned long) rfilter->write_count,
+		   (unsigned long long) (elapsed / 1000000000),
+		   (unsigned int) ((elapsed % 1000000000 + 500000) / 1000000),
+		   (double) late_mean / 1000.0,
+		   (double) rfilter->late_max / 1000.0,
+		   (unsigned long) rfilter->blocked,
+		   (unsigned long) rfilter->read_count);
+    if (len < 0)
+	len = 0;
+    if ((gensiods) len >= sizeof(rfilter->print_buffer))
+	len = sizeof(rfilter->print_buffer) - 1;
+    rfilter->print_pos = 0;
+    rfilter->print_pending = len;
+    rfilter->final_started = true;
+}
+
+/*
+ * Write all the records that are due.  Called and returns with the
+ * lock held.
+ */
+static int
+replay_push(struct replay_filter *rfilter,
+	    gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    struct replay_rec *rec;
+    uint64_t now = replay_now_ns(rfilter), due;
+    int err = 0;
+
+    while (!replay_done(rfilter)) {
+	gensiods count, ocount;
+	struct gensio_sg sg;
+
+	due = replay_due_time(rfilter, rfilter->next);
+	if (now < due)
+	    break;
+
+	rec = &rfilter->recs[rfilter->next];
+	if (rfilter->pos < rec->caplen) {
+	    sg.buf = rec->data + rfilter->pos;
+	    count = rec->caplen - rfilter->pos;
+	} else {
+	    sg.buf = replay_fill;
+	    count = rec->len - rfilter->pos;
+	    if (count > REPLAY_FILL_SIZE)
+		count = REPLAY_FILL_SIZE;
+	}
+	sg.buflen = count;
+	ocount = count;
+
+	replay_unlock(rfilter);
+	err = handler(cb_data, &count, &sg, 1, NULL);
+	replay_lock(rfilter);
+	if (err)
+	    break;
+	if (count > ocount)
+	    count = ocount;
+
+	rfilter->write_count += count;
+	rfilter->pos += count;
+	now = replay_now_ns(rfilter);
+	if (rfilter->pos >= rec->len) {
+	    if (now - due > rfilter->late_max)
+		rfilter->late_max = now - due;
+	    rfilter->late_sum += now - due;
+	    rfilter->pos = 0;
+	    rfilter->next++;
+	    if (replay_done(rfilter))
+		rfilter->end_time = now;
+	}
+	if (count < ocount) {
+	    /* Write ready will call us again. */
+	    rfilter->blocked++;
+	    return 0;
+	}
+    }
+
+    if (!err)
+	replay_start_timer(rfilter, now);
+    return err;
+}
+
+static int
+replay_ul_write(struct gensio_filter *filter,
+		gensio_ul_filter_data_handler handler, void *cb_data,
+		gensiods *rcount,
+		const struct gensio_sg *sg, gensiods sglen,
+		const char *const *auxdata)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+    int err = 0;
+    gensiods i, writelen = 0;
+
+    /* Just ignore data from the upper layer. */
+    for (i = 0; i < sglen; i++)
+	writelen += sg[i].buflen;
+    if (rcount)
+	*rcount = writelen;
+
+    replay_lock(rfilter);
+    if (!replay_done(rfilter))
+	err = replay_push(rfilter, handler, cb_data);
+    if (!err && replay_done(rfilter)) {
+	if (!rfilter->final_started)
+	    replay_format_final(rfilter);
+	else if (rfilter->print_pending == 0)
+	    err = GE_REMCLOSE;
+    }
+    replay_unlock(rfilter);
+
+    return err;
+}
+
+static int
+replay_ll_write(struct gensio_filter *filter,
+		gensio_ll_filter_data_handler handler, void *cb_data,
+		gensiods *rcount,
+		unsigned char *buf, gensiods buflen,
+		const char *const *auxdata)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+    int err = 0;
+
+    if (rcount)
+	*rcount = buflen; /* Ignore data from below. */
+
+    replay_lock(rfilter);
+    rfilter->read_count += buflen;
+
+    if (rfilter->print_pending) {
+	gensiods count = rfilter->print_pending - rfilter->print_pos;
+
+	replay_unlock(rfilter);
+	err = handler(cb_data, &count,
+	      (unsigned char *) rfilter->print_buffer + rfilter->print_pos,
+	      count, NULL);
+	replay_lock(rfilter);
+	if (!err) {
+	    if (count > rfilter->print_pending - rfilter->print_pos)
+		count = rfilter->print_pending - rfilter->print_pos;
+	    rfilter->print_pos += count;
+	    if (rfilter->print_pos == rfilter->print_pending)
+		rfilter->print_pending = 0;
+	}
+    }
+    replay_unlock(rfilter);
+
+    return err;
+}
+
+static int
+replay_filter_timeout(struct gensio_filter *filter)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+
+    /* The base code will call ul_write since a record is now due. */
+    replay_lock(rfilter);
+    rfilter->timer_running = false;
+    replay_unlock(rfilter);
+
+    return 0;
+}
+
+static int
+replay_setup(struct gensio_filter *filter)
+{
+    return 0;
+}
+
+static int
+replay_filter_control(struct replay_filter *rfilter, bool get, int op,
+		      char *data, gensiods *datalen)
+{
+    switch (op) {
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	replay_lock(rfilter);
+	*datalen = snprintf(data, *datalen,
+			    "records=%lu replayed=%lu wrote=%lu read=%lu"
+			    " blocked=%lu late_max_us=%.1lf",
+			    (unsigned long) rfilter->nr_recs,
+			    (unsigned long) rfilter->next,
+			    (unsigned long) rfilter->write_count,
+			    (unsigned long) rfilter->read_count,
+			    (unsigned long) rfilter->blocked,
+			    (double) rfilter->late_max / 1000.0);
+	replay_unlock(rfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+replay_filter_cleanup(struct gensio_filter *filter)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+
+    rfilter->next = 0;
+    rfilter->pos = 0;
+    rfilter->timer_running = false;
+    rfilter->write_count = 0;
+    rfilter->read_count = 0;
+    rfilter->blocked = 0;
+    rfilter->late_max = 0;
+    rfilter->late_sum = 0;
+    rfilter->end_time = 0;
+    rfilter->print_pending = 0;
+    rfilter->final_started = false;
+}
+
+static void
+rfilter_free(struct replay_filter *rfilter)
+{
+    if (rfilter->lock)
+	rfilter->o->free_lock(rfilter->lock);
+    if (rfilter->recs)
+	rfilter->o->free(rfilter->o, rfilter->recs);
+    if (rfilter->tracebuf)
+	rfilter->o->free(rfilter->o, rfilter->tracebuf);
+    if (rfilter->filter)
+	gensio_filter_free_data(rfilter->filter);
+    rfilter->o->free(rfilter->o, rfilter);
+}
+
+static void
+replay_free(struct gensio_filter *filter)
+{
+    struct replay_filter *rfilter = filter_to_replay(filter);
+
+    rfilter_free(rfilter);
+}
+
+static int gensio_replay_filter_func(struct gensio_filter *filter, int op,
+				     void *func, void *data,
+				     gensiods *count,
+				     void *buf, const void *cbuf,
+				     gensiods buflen,
+				     const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	replay_set_callbacks(filter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return replay_ul_read_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return replay_ll_write_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return replay_ll_read_needed(filter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return replay_check_open_done(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return replay_try_connect(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return replay_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return replay_ul_write(filter, func, data, count, cbuf, buflen,
+			       auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return replay_ll_write(filter, func, data, count, buf, buflen,
+			       auxdata);
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+	return replay_filter_timeout(filter);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return replay_setup(filter);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	replay_filter_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return replay_filter_control(filter_to_replay(filter),
+				     *((bool *) cbuf), buflen, data, count);
+
+    case GENSIO_FILTER_FUNC_FREE:
+	replay_free(filter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+/*
+ * Read the trace file and index the records of the given type from
+ * the first connection in it.  Record times are relative to the start
+ * record.
+ */
+static int
+replay_load(struct gensio_pparm_info *p, struct replay_filter *rfilter,
+	    const char *filename, unsigned int type)
+{
+    struct gensio_os_funcs *o = rfilter->o;
+    FILE *f;
+    long size;
+    unsigned char *pos, *end;
+    uint64_t t, base = 0;
+    bool have_base = false;
+    gensiods nrecs = 0;
+    unsigned int pass, rtype;
+    uint32_t caplen;
+    int err = 0;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+	gensio_pparm_log(p, "unable to open %s", filename);
+	return GE_NOTFOUND;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+		fseek(f, 0, SEEK_SET) != 0) {
+	err = GE_IOERR;
+	goto out;
+    }
+    rfilter->tracebuf = o->zalloc(o, size + 1);
+    if (!rfilter->tracebuf) {
+	err = GE_NOMEM;
+	goto out;
+    }
+    if (fread(rfilter->tracebuf, 1, size, f) != (size_t) size) {
+	err = GE_IOERR;
+	goto out;
+    }
+    if (size < GTRACE_MAGIC_LEN ||
+		memcmp(rfilter->tracebuf, GTRACE_MAGIC, GTRACE_MAGIC_LEN)) {
+	gensio_pparm_log(p, "%s is not a binary gensio trace", filename);
+	err = GE_INVAL;
+	goto out;
+    }
+
+    /* Count the records on the first pass, fill them in on the second. */
+    for (pass = 0; pass < 2; pass++) {
+	pos = rfilter->tracebuf + GTRACE_MAGIC_LEN;
+	end = rfilter->tracebuf + size;
+	have_base = false;
+	nrecs = 0;
+	while (end - pos >= GTRACE_HDR_LEN) {
+	    rtype = get_le(pos, 2);
+	    caplen = get_le(pos + 4, 4);
+	    t = get_le(pos + 16, 8) * 1000000000 + get_le(pos + 12, 4);
+	    if ((gensiods) (end - pos - GTRACE_HDR_LEN) < caplen)
+		break; /* Truncated, just use what's there. */
+	    if (rtype == GTRACE_START) {
+		if (have_base)
+		    break; /* Only replay the first connection. */
+		base = t;
+		have_base = true;
+	    } else if (rtype == type) {
+		if (!have_base) {
+		    base = t;
+		    have_base = true;
+		}
+		if (pass == 1) {
+		    struct replay_rec *rec = &rfilter->recs[nrecs];
+
+		    rec->when = t > base ? t - base : 0;
+		    rec->len = get_le(pos + 8, 4);
+		    rec->caplen = caplen;
+		    if (rec->caplen > rec->len)
+			rec->caplen = rec->len;
+		    rec->data = pos + GTRACE_HDR_LEN;
+		}
+		nrecs++;
+	    }
+	    pos += GTRACE_HDR_LEN + caplen;
+	}
+	if (pass == 0) {
+	    if (nrecs == 0) {
+		gensio_pparm_log(p, "%s has nothing to replay", filename);
+		err = GE_INVAL;
+		goto out;
+	    }
+	    rfilter->recs = o->zalloc(o, nrecs * sizeof(*rfilter->recs));
+	    if (!rfilter->recs) {
+		err = GE_NOMEM;
+		goto out;
+	    }
+	}
+    }
+    rfilter->nr_recs = nrecs;
+
+ out:
+    fclose(f);
+    return err;
+}
+
+static struct gensio_enum_val replay_dir_enum[] = {
+    { "read",	GTRACE_READ },
+    { "write",	GTRACE_WRITE },
+    { NULL }
+};
+
+int
+gensio_replay_filter_alloc(struct gensio_pparm_info *p,
+			   struct gensio_os_funcs *o,
+			   const char * const args[],
+			   struct gensio_filter **rfilter)
+{
+    struct replay_filter *rf;
+    const char *filename = NULL;
+    int dir = GTRACE_WRITE;
+    float speed = 1.0;
+    unsigned int i;
+    int err;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_value(p, args[i], "file", &filename) > 0)
+	    continue;
+	if (gensio_pparm_enum(p, args[i], "dir", replay_dir_enum, &dir) > 0)
+	    continue;
+	if (gensio_pparm_float(p, args[i], "speed", &speed) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (!filename) {
+	gensio_pparm_slog(p, "file must be given");
+	return GE_INVAL;
+    }
+    if (speed < 0) {
+	gensio_pparm_slog(p, "speed can't be negative");
+	return GE_INVAL;
+    }
+
+    rf = o->zalloc(o, sizeof(*rf));
+    if (!rf)
+	return GE_NOMEM;
+    rf->o = o;
+    rf->speed = speed;
+
+    err = replay_load(p, rf, filename, dir);
+    if (err)
+	goto out_err;
+
+    err = GE_NOMEM;
+    rf->lock = o->alloc_lock(o);
+    if (!rf->lock)
+	goto out_err;
+
+    rf->filter = gensio_filter_alloc_data(o, gensio_replay_filter_func, rf);
+    if (!rf->filter)
+	goto out_err;
+
+    *rfilter = rf->filter;
+    return 0;
+
+ out_err:
+    rfilter_free(rf);
+    return err;
+}
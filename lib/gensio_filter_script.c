@@ -11,13 +11,55 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_time.h>
 
 #include "gensio_filter_script.h"
 
+/*
+ * The built-in expect engine.  A script is a sequence of steps, each
+ * step sends some (optional) data and then waits for one of a set of
+ * patterns to show up in the incoming data.  The patterns for a step,
+ * plus the global fail patterns, are compiled into an Aho-Corasick
+ * automaton when the options are parsed, so matching is one table
+ * lookup per incoming byte no matter how many patterns there are.
+ */
+#define SCRIPT_MAX_PATTERN_CHARS 1024
+
+#define SCRIPT_BUFSIZE 1024
+
+struct script_step {
+    unsigned char *send;
+    gensiods sendlen;
+
+    /* If nstates is zero, this step has nothing to expect. */
+    unsigned int nstates;
+    uint16_t (*next)[256];
+    /* 1 if the state ends an expect pattern, -1 for a fail pattern. */
+    signed char *match;
+};
+
+struct script_prog {
+    struct gensio_os_funcs *o;
+    unsigned int refcount;
+#if !HAVE_GCC_ATOMICS
+    struct gensio_lock *lock; /* Protects refcount. */
+#endif
+    gensio_time timeout;
+    unsigned int nsteps;
+    struct script_step *steps;
+};
+
+struct gensio_script_filter_data {
+    struct gensio_os_funcs *o;
+    char *str;
+    struct script_prog *prog;
+};
+
 enum script_state {
     SCRIPT_CLOSED,
     SCRIPT_IN_SUB_OPEN,
@@ -44,7 +86,7 @@ struct script_filter {
      * Script to gensio buffer, handles data coming from the script
      * gensio and out the main gensio.
      */
-    unsigned char scrtog_buf[1024];
+    unsigned char scrtog_buf[SCRIPT_BUFSIZE];
     gensiods scrtog_pos;
     gensiods scrtog_len;
 
@@ -52,12 +94,19 @@ struct script_filter {
      * Gensio to script buffer, handles data coming from the main gensio
      * and out to the script.
      */
-    unsigned char gtoscr_buf[1024];
+    unsigned char gtoscr_buf[SCRIPT_BUFSIZE];
     gensiods gtoscr_pos;
     gensiods gtoscr_len;
 
     char *str;
     struct gensio *io;
+
+    /* For the built-in expect engine. */
+    struct script_prog *prog;
+    unsigned int step;
+    unsigned int dfa_state;
+    bool waiting;
+    gensio_time deadline;
 };
 
 #define filter_to_script(v) ((struct script_filter *) \
@@ -75,6 +124,117 @@ script_unlock(struct script_filter *sfilter)
     sfilter->o->unlock(sfilter->lock);
 }
 
+static void
+script_prog_ref(struct script_prog *prog)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(&prog->refcount, 1, __ATOMIC_SEQ_CST);
+#else
+    prog->o->lock(prog->lock);
+    prog->refcount++;
+    prog->o->unlock(prog->lock);
+#endif
+}
+
+static void
+script_prog_deref(struct script_prog *prog)
+{
+    struct gensio_os_funcs *o = prog->o;
+    unsigned int i, count;
+
+#if HAVE_GCC_ATOMICS
+    count = __atomic_sub_fetch(&prog->refcount, 1, __ATOMIC_SEQ_CST);
+#else
+    o->lock(prog->lock);
+    count = --prog->refcount;
+    o->unlock(prog->lock);
+#endif
+    if (count != 0)
+	return;
+
+    for (i = 0; i < prog->nsteps; i++) {
+	if (prog->steps[i].send)
+	    o->free(o, prog->steps[i].send);
+	if (prog->steps[i].next)
+	    o->free(o, prog->steps[i].next);
+	if (prog->steps[i].match)
+	    o->free(o, prog->steps[i].match);
+    }
+    if (prog->steps)
+	o->free(o, prog->steps);
+#if !HAVE_GCC_ATOMICS
+    o->free_lock(prog->lock);
+#endif
+    o->free(o, prog);
+}
+
+/*
+ * Start sending the data for the current step and set up the wait
+ * for its patterns.  Steps without patterns are run through
+ * immediately.  The total send data is limited to the size of
+ * scrtog_buf at config time, so this always fits.
+ */
+static void
+script_run_steps(struct script_filter *sfilter)
+{
+    struct script_prog *prog = sfilter->prog;
+    struct script_step *step;
+
+    sfilter->waiting = false;
+    for (; sfilter->step < prog->nsteps; sfilter->step++) {
+	step = &prog->steps[sfilter->step];
+	if (step->sendlen > 0) {
+	    if (sfilter->scrtog_pos > 0) {
+		memmove(sfilter->scrtog_buf,
+			sfilter->scrtog_buf + sfilter->scrtog_pos,
+			sfilter->scrtog_len);
+		sfilter->scrtog_pos = 0;
+	    }
+	    memcpy(sfilter->scrtog_buf + sfilter->scrtog_len,
+		   step->send, step->sendlen);
+	    sfilter->scrtog_len += step->sendlen;
+	}
+	if (step->nstates > 0) {
+	    sfilter->dfa_state = 0;
+	    sfilter->waiting = true;
+	    sfilter->o->get_monotonic_time(sfilter->o, &sfilter->deadline);
+	    gensio_time_add(&sfilter->deadline, &prog->timeout);
+	    return;
+	}
+    }
+}
+
+/*
+ * Run incoming data through the current step's automaton.  Returns
+ * the number of bytes consumed; anything after the final match is
+ * left for the user.
+ */
+static gensiods
+script_expect(struct script_filter *sfilter,
+	      const unsigned char *buf, gensiods buflen)
+{
+    struct script_step *step;
+    gensiods i = 0;
+    int match;
+
+    while (sfilter->waiting && i < buflen) {
+	step = &sfilter->prog->steps[sfilter->step];
+	sfilter->dfa_state = step->next[sfilter->dfa_state][buf[i++]];
+	match = step->match[sfilter->dfa_state];
+	if (match < 0) {
+	    sfilter->waiting = false;
+	    sfilter->err = GE_LOCALCLOSED;
+	    sfilter->state = SCRIPT_OPEN_FAIL;
+	    return buflen;
+	} else if (match > 0) {
+	    sfilter->step++;
+	    script_run_steps(sfilter);
+	}
+    }
+
+    return i;
+}
+
 static bool
 script_ul_read_pending(struct gensio_filter *filter)
 {
@@ -101,8 +261,12 @@ script_ll_read_needed(struct gensio_filter *filter)
     bool rv = false;
 
     script_lock(sfilter);
-    if (sfilter->state == SCRIPT_IN_OPEN)
-	rv = sfilter->gtoscr_len == 0;
+    if (sfilter->state == SCRIPT_IN_OPEN) {
+	if (sfilter->prog)
+	    rv = sfilter->waiting;
+	else
+	    rv = sfilter->gtoscr_len == 0;
+    }
     script_unlock(sfilter);
     return rv;
 }
@@ -277,9 +441,39 @@ script_try_connect(struct gensio_filter *filter, gensio_time *timeout)
     int err = GE_INPROGRESS;
 
     script_lock(sfilter);
+    if (sfilter->prog && sfilter->state == SCRIPT_CLOSED) {
+	sfilter->state = SCRIPT_IN_OPEN;
+	sfilter->step = 0;
+	script_run_steps(sfilter);
+    }
     switch(sfilter->state) {
     case SCRIPT_IN_SUB_OPEN:
+	break;
+
     case SCRIPT_IN_OPEN:
+	if (!sfilter->prog)
+	    break;
+	if (sfilter->waiting) {
+	    gensio_time now;
+	    int64_t timeout_ns;
+
+	    sfilter->o->get_monotonic_time(sfilter->o, &now);
+	    timeout_ns = gensio_time_diff_nsecs(&sfilter->deadline, &now);
+	    if (timeout_ns <= 0) {
+		sfilter->waiting = false;
+		sfilter->err = GE_TIMEDOUT;
+		sfilter->state = SCRIPT_OPEN_FAIL;
+		err = 0;
+	    } else {
+		timeout->secs = timeout_ns / GENSIO_NSECS_IN_SEC;
+		timeout->nsecs = timeout_ns % GENSIO_NSECS_IN_SEC;
+		err = GE_RETRY;
+	    }
+	} else if (sfilter->step >= sfilter->prog->nsteps &&
+		   sfilter->scrtog_len == 0) {
+	    sfilter->state = SCRIPT_OPEN;
+	    err = 0;
+	}
 	break;
 
     case SCRIPT_CLOSED:
@@ -318,8 +512,11 @@ script_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
     switch(sfilter->state) {
     case SCRIPT_IN_SUB_OPEN:
     case SCRIPT_IN_OPEN:
-	gensio_free(sfilter->io);
-	sfilter->io = NULL;
+	if (sfilter->io) {
+	    gensio_free(sfilter->io);
+	    sfilter->io = NULL;
+	}
+	sfilter->waiting = false;
 	/* fallthrough */
 
     case SCRIPT_OPEN:
@@ -369,7 +566,8 @@ script_ul_write(struct gensio_filter *filter,
 	    if (count >= sfilter->scrtog_len) {
 		sfilter->scrtog_len = 0;
 		sfilter->scrtog_pos = 0;
-		gensio_set_read_callback_enable(sfilter->io, true);
+		if (sfilter->io)
+		    gensio_set_read_callback_enable(sfilter->io, true);
 	    } else {
 		sfilter->scrtog_len -= count;
 		sfilter->scrtog_pos += count;
@@ -412,7 +610,9 @@ script_ll_write(struct gensio_filter *filter,
 	break;
 
     case SCRIPT_IN_OPEN:
-	if (sfilter->gtoscr_len == 0 && buflen > 0) {
+	if (sfilter->prog) {
+	    count = script_expect(sfilter, buf, buflen);
+	} else if (sfilter->gtoscr_len == 0 && buflen > 0) {
 	    if (buflen > sizeof(sfilter->gtoscr_buf))
 		buflen = sizeof(sfilter->gtoscr_buf);
 
@@ -445,6 +645,9 @@ script_setup(struct gensio_filter *filter)
     sfilter->scrtog_pos = 0;
     sfilter->gtoscr_len = 0;
     sfilter->gtoscr_pos = 0;
+    sfilter->step = 0;
+    sfilter->dfa_state = 0;
+    sfilter->waiting = false;
     sfilter->state = SCRIPT_CLOSED;
     return 0;
 }
@@ -469,6 +672,8 @@ sfilter_free(struct script_filter *sfilter)
 	gensio_filter_free_data(sfilter->filter);
     if (sfilter->str)
 	sfilter->o->free(sfilter->o, sfilter->str);
+    if (sfilter->prog)
+	script_prog_deref(sfilter->prog);
     sfilter->o->free(sfilter->o, sfilter);
 }
 
@@ -548,7 +753,8 @@ static int gensio_script_filter_func(struct gensio_filter *filter, int op,
 }
 
 static struct gensio_filter *
-gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str)
+gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str,
+			       struct script_prog *prog)
 {
     struct script_filter *sfilter;
 
@@ -568,6 +774,11 @@ gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str)
     if (!sfilter->filter)
 	goto out_nomem;
 
+    if (prog) {
+	script_prog_ref(prog);
+	sfilter->prog = prog;
+    }
+
     return sfilter->filter;
 
  out_nomem:
@@ -575,40 +786,336 @@ gensio_script_filter_raw_alloc(struct gensio_os_funcs *o, char *str)
     return NULL;
 }
 
+static void
+script_add_pattern(struct script_step *step, unsigned int *nstates,
+		   const char *pat, signed char val)
+{
+    unsigned int s = 0;
+    unsigned char c;
+
+    for (; *pat; pat++) {
+	c = *pat;
+	if (!step->next[s][c])
+	    step->next[s][c] = (*nstates)++;
+	s = step->next[s][c];
+    }
+    /* If a pattern is both expected and a failure, fail wins. */
+    if (val < 0 || !step->match[s])
+	step->match[s] = val;
+}
+
+/*
+ * Build the automaton for a step.  First build a trie of all the
+ * patterns (state 0 is the root, so a zero entry means "no edge"
+ * while building), then go breadth-first computing the failure links
+ * and filling in the missing transitions from the failure state, so
+ * the result is a complete DFA.
+ */
+static int
+script_compile_step(struct gensio_os_funcs *o, struct script_step *step,
+		    const char **pats, unsigned int npats,
+		    const char **fails, unsigned int nfails)
+{
+    unsigned int i, c, s, t, maxstates = 1, nstates = 1;
+    unsigned int qhead = 0, qtail = 0;
+    uint16_t *fail = NULL, *queue = NULL;
+    int err = GE_NOMEM;
+
+    for (i = 0; i < npats; i++)
+	maxstates += strlen(pats[i]);
+    for (i = 0; i < nfails; i++)
+	maxstates += strlen(fails[i]);
+    if (maxstates > SCRIPT_MAX_PATTERN_CHARS + 1)
+	return GE_TOOBIG;
+
+    step->next = o->zalloc(o, sizeof(*step->next) * maxstates);
+    if (!step->next)
+	goto out;
+    step->match = o->zalloc(o, sizeof(*step->match) * maxstates);
+    if (!step->match)
+	goto out;
+    fail = o->zalloc(o, sizeof(*fail) * maxstates);
+    if (!fail)
+	goto out;
+    queue = o->zalloc(o, sizeof(*queue) * maxstates);
+    if (!queue)
+	goto out;
+
+    for (i = 0; i < npats; i++)
+	script_add_pattern(step, &nstates, pats[i], 1);
+    for (i = 0; i < nfails; i++)
+	script_add_pattern(step, &nstates, fails[i], -1);
+
+    for (c = 0; c < 256; c++) {
+	t = step->next[0][c];
+	if (t)
+	    queue[qtail++] = t;
+    }
+    while (qhead < qtail) {
+	s = queue[qhead++];
+	if (!step->match[s])
+	    step->match[s] = step->match[fail[s]];
+	for (c = 0; c < 256; c++) {
+	    t = step->next[s][c];
+	    if (t) {
+		fail[t] = step->next[fail[s]][c];
+		queue[qtail++] = t;
+	    } else {
+		step->next[s][c] = step->next[fail[s]][c];
+	    }
+	}
+    }
+
+    step->nstates = nstates;
+    err = 0;
+ out:
+    if (fail)
+	o->free(o, fail);
+    if (queue)
+	o->free(o, queue);
+    return err;
+}
+
+static int
+script_prog_alloc(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
+		  const char * const args[], struct script_prog **rprog)
+{
+    struct script_prog *prog;
+    struct script_step *step = NULL;
+    const char **pats = NULL, **fails = NULL, *val;
+    unsigned int *pat_first = NULL, *pat_count = NULL;
+    unsigned int i, nargs, npats = 0, nfails = 0;
+    gensiods sendlen, total_send = 0;
+    unsigned char *nsend;
+    int err = GE_NOMEM;
+
+    for (nargs = 0; args[nargs]; nargs++)
+	;
+
+    prog = o->zalloc(o, sizeof(*prog));
+    if (!prog)
+	return GE_NOMEM;
+    prog->o = o;
+    prog->refcount = 1;
+    prog->timeout.secs = 10;
+#if !HAVE_GCC_ATOMICS
+    prog->lock = o->alloc_lock(o);
+    if (!prog->lock) {
+	o->free(o, prog);
+	return GE_NOMEM;
+    }
+#endif
+
+    prog->steps = o->zalloc(o, sizeof(*prog->steps) * nargs);
+    pats = o->zalloc(o, sizeof(*pats) * nargs);
+    fails = o->zalloc(o, sizeof(*fails) * nargs);
+    pat_first = o->zalloc(o, sizeof(*pat_first) * nargs);
+    pat_count = o->zalloc(o, sizeof(*pat_count) * nargs);
+    if (!prog->steps || !pats || !fails || !pat_first || !pat_count)
+	goto out_err;
+
+    err = GE_INVAL;
+    for (i = 0; args[i]; i++) {
+	if (gensio_pparm_time(p, args[i], "expect-timeout", 's',
+			      &prog->timeout) > 0)
+	    continue;
+	if (gensio_pparm_value(p, args[i], "send", &val) > 0) {
+	    if (!step || pat_count[step - prog->steps] > 0)
+		step = &prog->steps[prog->nsteps++];
+	    sendlen = strlen(val);
+	    total_send += sendlen;
+	    if (total_send > SCRIPT_BUFSIZE) {
+		gensio_pparm_slog(p, "Total send data is too long");
+		goto out_err;
+	    }
+	    nsend = o->zalloc(o, step->sendlen + sendlen + 1);
+	    if (!nsend) {
+		err = GE_NOMEM;
+		goto out_err;
+	    }
+	    if (step->send) {
+		memcpy(nsend, step->send, step->sendlen);
+		o->free(o, step->send);
+	    }
+	    memcpy(nsend + step->sendlen, val, sendlen);
+	    step->send = nsend;
+	    step->sendlen += sendlen;
+	    continue;
+	}
+	if (gensio_pparm_value(p, args[i], "expect", &val) > 0) {
+	    if (!step || pat_count[step - prog->steps] > 0)
+		step = &prog->steps[prog->nsteps++];
+	    pat_first[step - prog->steps] = npats;
+	    goto add_pattern;
+	}
+	if (gensio_pparm_value(p, args[i], "expect-or", &val) > 0) {
+	    if (!step || pat_count[step - prog->steps] == 0) {
+		gensio_pparm_slog(p, "expect-or must follow an expect");
+		goto out_err;
+	    }
+	add_pattern:
+	    if (!*val) {
+		gensio_pparm_slog(p, "Empty expect pattern");
+		goto out_err;
+	    }
+	    pats[npats++] = val;
+	    pat_count[step - prog->steps]++;
+	    continue;
+	}
+	if (gensio_pparm_value(p, args[i], "fail", &val) > 0) {
+	    if (!*val) {
+		gensio_pparm_slog(p, "Empty fail pattern");
+		goto out_err;
+	    }
+	    fails[nfails++] = val;
+	    continue;
+	}
+	gensio_pparm_unknown_parm(p, args[i]);
+	goto out_err;
+    }
+
+    if (prog->nsteps == 0) {
+	gensio_pparm_slog(p, "No send or expect given");
+	goto out_err;
+    }
+
+    for (i = 0; i < prog->nsteps; i++) {
+	if (pat_count[i] == 0)
+	    continue;
+	err = script_compile_step(o, &prog->steps[i], pats + pat_first[i],
+				  pat_count[i], fails, nfails);
+	if (err == GE_TOOBIG)
+	    gensio_pparm_slog(p, "Expect and fail patterns too long");
+	if (err)
+	    goto out_err;
+    }
+
+    *rprog = prog;
+    err = 0;
+    goto out;
+
+ out_err:
+    script_prog_deref(prog);
+ out:
+    if (pats)
+	o->free(o, pats);
+    if (fails)
+	o->free(o, fails);
+    if (pat_first)
+	o->free(o, pat_first);
+    if (pat_count)
+	o->free(o, pat_count);
+    return err;
+}
+
+static bool
+script_is_prog_arg(const char *arg)
+{
+    static const char *prog_args[] = { "send=", "expect=", "expect-or=",
+				       "fail=", "expect-timeout=", NULL };
+    unsigned int i;
+
+    for (i = 0; prog_args[i]; i++) {
+	if (strncmp(arg, prog_args[i], strlen(prog_args[i])) == 0)
+	    return true;
+    }
+    return false;
+}
+
 int
-gensio_script_filter_alloc(struct gensio_pparm_info *p,
-			   struct gensio_os_funcs *o,
-			   const char * const args[],
-			   struct gensio_filter **rfilter)
+gensio_script_filter_config(struct gensio_pparm_info *p,
+			    struct gensio_os_funcs *o,
+			    const char * const args[],
+			    struct gensio_script_filter_data **rdata)
 {
-    struct gensio_filter *filter;
+    struct gensio_script_filter_data *data;
     const char *scr = NULL;
     const char *gensioscr = NULL;
-    char *str;
+    bool use_prog = false;
     unsigned int i;
+    int err;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_value(p, args[i], "script", &scr) > 0)
 	    continue;
 	if (gensio_pparm_value(p, args[i], "gensio", &gensioscr) > 0)
 	    continue;
+	if (script_is_prog_arg(args[i])) {
+	    use_prog = true;
+	    continue;
+	}
 	gensio_pparm_unknown_parm(p, args[i]);
 	return GE_INVAL;
     }
 
-    if (!scr && !gensioscr) {
-	gensio_pparm_slog(p, "You must specify either script or gensio");
+    if (use_prog && (scr || gensioscr)) {
+	gensio_pparm_slog(p, "script and gensio cannot be used with expect");
 	return GE_INVAL;
     }
 
-    if (scr)
-	str = gensio_alloc_sprintf(o, "stdio(noredir-stderr),%s", scr);
-    else
-	str = gensio_strdup(o, gensioscr);
+    if (!scr && !gensioscr && !use_prog) {
+	gensio_pparm_slog(p, "You must specify either script, gensio,"
+			  " or an expect script");
+	return GE_INVAL;
+    }
+
+    data = o->zalloc(o, sizeof(*data));
+    if (!data)
+	return GE_NOMEM;
+    data->o = o;
+
+    if (use_prog) {
+	err = script_prog_alloc(p, o, args, &data->prog);
+	if (err) {
+	    o->free(o, data);
+	    return err;
+	}
+    } else {
+	if (scr)
+	    data->str = gensio_alloc_sprintf(o, "stdio(noredir-stderr),%s",
+					     scr);
+	else
+	    data->str = gensio_strdup(o, gensioscr);
+	if (!data->str) {
+	    o->free(o, data);
+	    return GE_NOMEM;
+	}
+    }
+
+    *rdata = data;
+    return 0;
+}
+
+void
+gensio_script_filter_config_free(struct gensio_script_filter_data *data)
+{
+    struct gensio_os_funcs *o = data->o;
+
+    if (data->str)
+	o->free(o, data->str);
+    if (data->prog)
+	script_prog_deref(data->prog);
+    o->free(o, data);
+}
+
+int
+gensio_script_filter_alloc(struct gensio_script_filter_data *data,
+			   struct gensio_filter **rfilter)
+{
+    struct gensio_os_funcs *o = data->o;
+    struct gensio_filter *filter;
+    char *str = NULL;
+
+    if (data->str) {
+	str = gensio_strdup(o, data->str);
+	if (!str)
+	    return GE_NOMEM;
+    }
 
-    filter = gensio_script_filter_raw_alloc(o, str);
+    filter = gensio_script_filter_raw_alloc(o, str, data->prog);
     if (!filter) {
-	o->free(o, str);
+	if (str)
+	    o->free(o, str);
 	return GE_NOMEM;
     }
 
@@ -11,9 +11,21 @@
 #include <gensio/gensio_base.h>
 #include <gensio/gensio_class.h>
 
-int gensio_script_filter_alloc(struct gensio_pparm_info *p,
-			       struct gensio_os_funcs *o,
-			       const char * const args[],
+struct gensio_script_filter_data;
+
+/*
+ * Parse the options and, for an expect script, compile the patterns.
+ * The result may be used to allocate any number of filters.
+ */
+int gensio_script_filter_config(struct gensio_pparm_info *p,
+				struct gensio_os_funcs *o,
+				const char * const args[],
+				struct gensio_script_filter_data **rdata);
+
+void
+gensio_script_filter_config_free(struct gensio_script_filter_data *data);
+
+int gensio_script_filter_alloc(struct gensio_script_filter_data *data,
 			       struct gensio_filter **rfilter);
 
 #endif /* GENSIO_FILTER_SCRIPT_H */
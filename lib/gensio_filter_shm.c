@@ -0,0 +1,823 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#include "config.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_utils.h>
+
+#include "gensio_filter_shm.h"
+
+#if !HAVE_GCC_ATOMICS
+/* configure turns shm off without atomics, see the ring comment below. */
+#error "The shm gensio requires GCC atomics"
+#endif
+
+/*
+ * Moves data between two processes on the same machine through a
+ * pair of rings in shared memory.  The gensio below (normally a unix
+ * socket) is only used to set things up and to wake the other end.
+ *
+ * On open the client creates a shared memory object holding both
+ * rings and sends its name and the ring size to the server:
+ *
+ *   "GSHM" <version> <size, 4 bytes msb first> <name length> <name>
+ *
+ * The server maps it and replies:
+ *
+ *   "GSHM" <version> <status, 0 if ok>
+ *
+ * and the client then unlinks the name, so the memory goes away when
+ * both ends unmap it.  After that every byte received from below is
+ * a doorbell, it carries no data and just means "look at the rings".
+ *
+ * Each ring has a head written by the producer and a tail written by
+ * the consumer, both free running counters.  A consumer that finds
+ * its ring empty sets reader_waiting and checks again, and a
+ * producer that adds data clears reader_waiting and sends a doorbell
+ * if it was set.  The same is done with writer_waiting for a
+ * producer that finds the ring full.  So while both ends are busy
+ * data moves with a memcpy and no system calls.
+ */
+
+#define SHM_MAGIC		"GSHM"
+#define SHM_VERSION		1
+#define SHM_REQ_HDR_LEN		10 /* magic, version, size, name length */
+#define SHM_RSP_LEN		6  /* magic, version, status */
+#define SHM_NAME_MAX		31 /* The smallest limit, from MacOS. */
+#define SHM_MSG_MAX		(SHM_REQ_HDR_LEN + SHM_NAME_MAX)
+
+#define SHM_MIN_SIZE		4096
+#define SHM_MAX_SIZE		(1U << 30)
+#define SHM_DEFAULT_SIZE	(1U << 18)
+
+#define SHM_CACHELINE		64
+
+/*
+ * The control part of a ring, at the start of the shared memory.
+ * The producer and consumer fields are on separate cache lines.
+ */
+struct shm_ring {
+    uint32_t head;
+    uint32_t reader_waiting;
+    unsigned char pad1[SHM_CACHELINE - 8];
+    uint32_t tail;
+    uint32_t writer_waiting;
+    unsigned char pad2[SHM_CACHELINE - 8];
+};
+
+enum shm_state {
+    SHM_CLOSED,
+    SHM_IN_OPEN,
+    SHM_OPEN,
+    SHM_FAILED
+};
+
+struct shm_filter {
+    struct gensio_filter *filter;
+
+    struct gensio_os_funcs *o;
+
+    struct gensio_lock *lock;
+
+    bool is_client;
+    enum shm_state state;
+    int open_err;
+
+    /* Size of one ring, a power of two. */
+    uint32_t cfg_size;
+    uint32_t size;
+
+    char name[SHM_NAME_MAX + 1];
+    bool shm_created; /* Client, the name needs to be unlinked. */
+
+    unsigned char *map;
+    size_t map_len;
+
+    struct shm_ring *tx;
+    unsigned char *txdata;
+    struct shm_ring *rx;
+    unsigned char *rxdata;
+
+    /* A doorbell needs to be sent to the other end. */
+    bool send_doorbell;
+
+    /* Statistics, reported by GENSIO_CONTROL_CONN_STATS. */
+    uint64_t doorbells_sent;
+    uint64_t doorbells_rcvd;
+    uint64_t tx_full; /* Times the writer found the ring full. */
+
+    /* Write a bad head to test the peer's checks. */
+    bool corrupt;
+
+    /* Setup message being sent. */
+    unsigned char wmsg[SHM_MSG_MAX];
+    unsigned int wmsg_pos;
+    unsigned int wmsg_len;
+
+    /* Setup message being received. */
+    unsigned char rmsg[SHM_MSG_MAX];
+    unsigned int rmsg_len;
+};
+
+#define filter_to_shm(v) ((struct shm_filter *) \
+			  gensio_filter_get_user_data(v))
+
+static void
+shm_lock(struct shm_filter *sfilter)
+{
+    sfilter->o->lock(sfilter->lock);
+}
+
+static void
+shm_unlock(struct shm_filter *sfilter)
+{
+    sfilter->o->unlock(sfilter->lock);
+}
+
+/*
+ * Return the number of bytes in the receive ring, or more than the
+ * ring size if the other end has corrupted it.
+ */
+static uint32_t
+shm_rx_avail(struct shm_filter *sfilter)
+{
+    return (__atomic_load_n(&sfilter->rx->head, __ATOMIC_SEQ_CST) -
+	    sfilter->rx->tail);
+}
+
+/* Return the number of bytes in the transmit ring, like above. */
+static uint32_t
+shm_tx_used(struct shm_filter *sfilter)
+{
+    return (sfilter->tx->head -
+	    __atomic_load_n(&sfilter->tx->tail, __ATOMIC_SEQ_CST));
+}
+
+static bool
+shm_tx_space(struct shm_filter *sfilter)
+{
+    uint32_t used = shm_tx_used(sfilter);
+
+    if (used < sfilter->size)
+	return true;
+    if (used > sfilter->size)
+	/* Corrupted, report it on the next write. */
+	return true;
+
+    /* Full, have the other end tell us when it has taken something. */
+    sfilter->tx_full++;
+    __atomic_store_n(&sfilter->tx->writer_waiting, 1, __ATOMIC_SEQ_CST);
+    return shm_tx_used(sfilter) != sfilter->size;
+}
+
+static bool
+shm_ul_read_pending(struct gensio_filter *filter)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+    uint32_t avail;
+
+    if (sfilter->state != SHM_OPEN)
+	return false;
+    avail = shm_rx_avail(sfilter);
+    return avail > 0 && avail <= sfilter->size;
+}
+
+static bool
+shm_ll_write_pending(struct gensio_filter *filter)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+
+    return sfilter->wmsg_pos < sfilter->wmsg_len || sfilter->send_doorbell;
+}
+
+static bool
+shm_ll_read_needed(struct gensio_filter *filter)
+{
+    /*
+     * Doorbells for transmit space have to be seen even if the user
+     * has read disabled.
+     */
+    return true;
+}
+
+static int
+shm_ul_can_write(struct gensio_filter *filter, bool *val)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+
+    shm_lock(sfilter);
+    *val = sfilter->state == SHM_OPEN && shm_tx_space(sfilter);
+    shm_unlock(sfilter);
+    return 0;
+}
+
+static int
+shm_check_open_done(struct gensio_filter *filter, struct gensio *io)
+{
+    return 0;
+}
+
+static void
+shm_setup_rings(struct shm_filter *sfilter)
+{
+    struct shm_ring *rings = (struct shm_ring *) sfilter->map;
+    unsigned char *data = sfilter->map + 2 * sizeof(struct shm_ring);
+
+    /* Ring 0 is client to server, ring 1 is server to client. */
+    if (sfilter->is_client) {
+	sfilter->tx = &rings[0];
+	sfilter->txdata = data;
+	sfilter->rx = &rings[1];
+	sfilter->rxdata = data + sfilter->size;
+    } else {
+	sfilter->tx = &rings[1];
+	sfilter->txdata = data + sfilter->size;
+	sfilter->rx = &rings[0];
+	sfilter->rxdata = data;
+    }
+}
+
+static int
+shm_map(struct shm_filter *sfilter, int fd)
+{
+    void *map;
+
+    map = mmap(NULL, sfilter->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+	       fd, 0);
+    if (map == MAP_FAILED)
+	return gensio_os_err_to_err(sfilter->o, errno);
+    sfilter->map = map;
+    shm_setup_rings(sfilter);
+    return 0;
+}
+
+static int
+shm_create(struct shm_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    static unsigned int shm_count;
+    unsigned int count, randv = 0, len;
+    int fd, err;
+
+    count = __atomic_add_fetch(&shm_count, 1, __ATOMIC_SEQ_CST);
+    o->get_random(o, &randv, sizeof(randv));
+    snprintf(sfilter->name, sizeof(sfilter->name), "/gshm%x.%x.%x",
+	     (unsigned int) getpid(), count, randv);
+
+    sfilter->size = sfilter->cfg_size;
+    sfilter->map_len = 2 * sizeof(struct shm_ring) + 2 * (size_t) sfilter->size;
+
+    fd = shm_open(sfilter->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1)
+	return gensio_os_err_to_err(o, errno);
+    sfilter->shm_created = true;
+    if (ftruncate(fd, sfilter->map_len) == -1)
+	err = gensio_os_err_to_err(o, errno);
+    else
+	err = shm_map(sfilter, fd);
+    close(fd);
+    if (err)
+	return err;
+
+    /* Both ends start out waiting for data. */
+    sfilter->tx->reader_waiting = 1;
+    sfilter->rx->reader_waiting = 1;
+
+    len = strlen(sfilter->name);
+    memcpy(sfilter->wmsg, SHM_MAGIC, 4);
+    sfilter->wmsg[4] = SHM_VERSION;
+    gensio_u32_to_buf(sfilter->wmsg + 5, sfilter->size);
+    sfilter->wmsg[9] = len;
+    memcpy(sfilter->wmsg + SHM_REQ_HDR_LEN, sfilter->name, len);
+    sfilter->wmsg_len = SHM_REQ_HDR_LEN + len;
+    sfilter->wmsg_pos = 0;
+    return 0;
+}
+
+/* Server side, map the memory the client asked for. */
+static int
+shm_attach(struct shm_filter *sfilter)
+{
+    struct gensio_os_funcs *o = sfilter->o;
+    unsigned char *m = sfilter->rmsg;
+    unsigned int len = m[9];
+    struct stat st;
+    int fd, err;
+
+    if (memcmp(m, SHM_MAGIC, 4) != 0 || m[4] != SHM_VERSION)
+	return GE_PROTOERR;
+    sfilter->size = gensio_buf_to_u32(m + 5);
+    if (sfilter->size < SHM_MIN_SIZE || sfilter->size > SHM_MAX_SIZE ||
+		sfilter->size & (sfilter->size - 1))
+	return GE_PROTOERR;
+    sfilter->map_len = 2 * sizeof(struct shm_ring) + 2 * (size_t) sfilter->size;
+    memcpy(sfilter->name, m + SHM_REQ_HDR_LEN, len);
+    sfilter->name[len] = '\0';
+    if (sfilter->name[0] != '/' || strchr(sfilter->name + 1, '/'))
+	return GE_PROTOERR;
+
+    fd = shm_open(sfilter->name, O_RDWR, 0);
+    if (fd == -1)
+	return gensio_os_err_to_err(o, errno);
+    if (fstat(fd, &st) == -1)
+	err = gensio_os_err_to_err(o, errno);
+    else if ((size_t) st.st_size != sfilter->map_len)
+	err = GE_PROTOERR;
+    else
+	err = shm_map(sfilter, fd);
+    close(fd);
+    return err;
+}
+
+/*
+ * Take bytes from below while the setup is going on.  Returns the
+ * number of bytes used.
+ */
+static gensiods
+shm_handle_setup(struct shm_filter *sfilter, unsigned char *buf,
+		 gensiods buflen)
+{
+    gensiods used = 0, len;
+    unsigned int need;
+    int err;
+
+    if (!sfilter->is_client && sfilter->rmsg_len < SHM_REQ_HDR_LEN) {
+	len = SHM_REQ_HDR_LEN - sfilter->rmsg_len;
+	if (len > buflen)
+	    len = buflen;
+	memcpy(sfilter->rmsg + sfilter->rmsg_len, buf, len);
+	sfilter->rmsg_len += len;
+	used = len;
+	if (sfilter->rmsg_len < SHM_REQ_HDR_LEN)
+	    return used;
+	if (sfilter->rmsg[9] == 0 || sfilter->rmsg[9] > SHM_NAME_MAX) {
+	    err = GE_PROTOERR;
+	    goto out_server;
+	}
+    }
+
+    if (sfilter->is_client)
+	need = SHM_RSP_LEN;
+    else
+	need = SHM_REQ_HDR_LEN + sfilter->rmsg[9];
+    len = need - sfilter->rmsg_len;
+    if (len > buflen - used)
+	len = buflen - used;
+    memcpy(sfilter->rmsg + sfilter->rmsg_len, buf + used, len);
+    sfilter->rmsg_len += len;
+    used += len;
+    if (sfilter->rmsg_len < need)
+	return used;
+
+    if (sfilter->is_client) {
+	unsigned char *m = sfilter->rmsg;
+
+	if (memcmp(m, SHM_MAGIC, 4) != 0 || m[4] != SHM_VERSION) {
+	    sfilter->open_err = GE_PROTOERR;
+	    sfilter->state = SHM_FAILED;
+	} else if (m[5] != 0) {
+	    /* The server couldn't map it, probably not the same machine. */
+	    sfilter->open_err = GE_NOTSUP;
+	    sfilter->state = SHM_FAILED;
+	} else {
+	    sfilter->state = SHM_OPEN;
+	}
+	shm_unlink(sfilter->name);
+	sfilter->shm_created = false;
+	return used;
+    }
+
+    err = shm_attach(sfilter);
+ out_server:
+    memcpy(sfilter->wmsg, SHM_MAGIC, 4);
+    sfilter->wmsg[4] = SHM_VERSION;
+    sfilter->wmsg[5] = !!err;
+    sfilter->wmsg_len = SHM_RSP_LEN;
+    sfilter->wmsg_pos = 0;
+    if (err) {
+	sfilter->open_err = err;
+	sfilter->state = SHM_FAILED;
+    } else {
+	sfilter->state = SHM_OPEN;
+    }
+    return used;
+}
+
+static int
+shm_try_connect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+    int err = GE_INPROGRESS;
+
+    shm_lock(sfilter);
+    if (sfilter->state == SHM_CLOSED) {
+	sfilter->state = SHM_IN_OPEN;
+	if (sfilter->is_client) {
+	    err = shm_create(sfilter);
+	    if (err) {
+		sfilter->state = SHM_FAILED;
+		goto out_unlock;
+	    }
+	    err = GE_INPROGRESS;
+	}
+    }
+    if (sfilter->wmsg_pos < sfilter->wmsg_len)
+	goto out_unlock;
+    if (sfilter->state == SHM_OPEN)
+	err = 0;
+    else if (sfilter->state == SHM_FAILED)
+	err = sfilter->open_err;
+ out_unlock:
+    shm_unlock(sfilter);
+    return err;
+}
+
+static int
+shm_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+
+    /* Make sure the other end knows about the last data. */
+    if (sfilter->send_doorbell)
+	return GE_INPROGRESS;
+    return 0;
+}
+
+static int
+shm_send(struct shm_filter *sfilter, gensio_ul_filter_data_handler handler,
+	 void *cb_data, unsigned char *buf, gensiods len, gensiods *rcount)
+{
+    struct gensio_sg sg = { buf, len };
+    int err;
+
+    *rcount = 0;
+    shm_unlock(sfilter);
+    err = handler(cb_data, rcount, &sg, 1, NULL);
+    shm_lock(sfilter);
+    return err;
+}
+
+static int
+shm_ring_doorbell(struct shm_filter *sfilter,
+		  gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    unsigned char b = 0;
+    gensiods count;
+    int err;
+
+    err = shm_send(sfilter, handler, cb_data, &b, 1, &count);
+    if (!err && count == 1) {
+	sfilter->send_doorbell = false;
+	sfilter->doorbells_sent++;
+    }
+    return err;
+}
+
+static int
+shm_ul_write(struct gensio_filter *filter,
+	     gensio_ul_filter_data_handler handler, void *cb_data,
+	     gensiods *rcount,
+	     const struct gensio_sg *sg, gensiods sglen,
+	     const char *const *auxdata)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+    struct shm_ring *tx = sfilter->tx;
+    gensiods i, count = 0, len, pos, part;
+    uint32_t used, head;
+    int err = 0;
+
+    shm_lock(sfilter);
+    if (sfilter->wmsg_pos < sfilter->wmsg_len) {
+	err = shm_send(sfilter, handler, cb_data,
+		       sfilter->wmsg + sfilter->wmsg_pos,
+		       sfilter->wmsg_len - sfilter->wmsg_pos, &len);
+	if (err)
+	    goto out;
+	sfilter->wmsg_pos += len;
+    }
+    if (sfilter->send_doorbell) {
+	err = shm_ring_doorbell(sfilter, handler, cb_data);
+	if (err)
+	    goto out;
+    }
+
+    if (sglen == 0 || sfilter->state != SHM_OPEN)
+	goto out;
+
+    used = shm_tx_used(sfilter);
+    if (used > sfilter->size) {
+	err = GE_PROTOERR;
+	goto out;
+    }
+    head = tx->head;
+    for (i = 0; i < sglen && used < sfilter->size; i++) {
+	len = sg[i].buflen;
+	if (len > sfilter->size - used)
+	    len = sfilter->size - used;
+	pos = head & (sfilter->size - 1);
+	part = sfilter->size - pos;
+	if (part > len)
+	    part = len;
+	memcpy(sfilter->txdata + pos, sg[i].buf, part);
+	if (part < len)
+	    memcpy(sfilter->txdata, ((const unsigned char *) sg[i].buf) + part,
+		   len - part);
+	head += len;
+	used += len;
+	count += len;
+    }
+    if (count == 0)
+	goto out;
+
+    if (sfilter->corrupt)
+	head += 2 * sfilter->size;
+    __atomic_store_n(&tx->head, head, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&tx->reader_waiting, 0, __ATOMIC_SEQ_CST)) {
+	sfilter->send_doorbell = true;
+	err = shm_ring_doorbell(sfilter, handler, cb_data);
+    }
+
+ out:
+    shm_unlock(sfilter);
+
+    if (!err && rcount)
+	*rcount = count;
+
+    return err;
+}
+
+/* Hand what is in the receive ring up to the user. */
+static int
+shm_deliver(struct shm_filter *sfilter,
+	    gensio_ll_filter_data_handler handler, void *cb_data)
+{
+    struct shm_ring *rx = sfilter->rx;
+    uint32_t avail, tail, pos;
+    gensiods len, count;
+    int err = 0;
+
+    for (;;) {
+	avail = shm_rx_avail(sfilter);
+	if (avail == 0) {
+	    __atomic_store_n(&rx->reader_waiting, 1, __ATOMIC_SEQ_CST);
+	    avail = shm_rx_avail(sfilter);
+	    if (avail == 0)
+		break;
+	}
+	if (avail > sfilter->size)
+	    return GE_PROTOERR;
+
+	tail = rx->tail;
+	pos = tail & (sfilter->size - 1);
+	len = sfilter->size - pos;
+	if (len > avail)
+	    len = avail;
+	count = 0;
+	shm_unlock(sfilter);
+	err = handler(cb_data, &count, sfilter->rxdata + pos, len, NULL);
+	shm_lock(sfilter);
+	if (err)
+	    break;
+	if (count > len)
+	    count = len;
+	if (count > 0) {
+	    __atomic_store_n(&rx->tail, tail + count, __ATOMIC_SEQ_CST);
+	    if (__atomic_exchange_n(&rx->writer_waiting, 0, __ATOMIC_SEQ_CST))
+		sfilter->send_doorbell = true;
+	}
+	if (count < len)
+	    /* User didn't take it all, the rest stays in the ring. */
+	    break;
+    }
+
+    return err;
+}
+
+static int
+shm_ll_write(struct gensio_filter *filter,
+	     gensio_ll_filter_data_handler handler, void *cb_data,
+	     gensiods *rcount,
+	     unsigned char *buf, gensiods buflen,
+	     const char *const *auxdata)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+    gensiods used = 0;
+    int err = 0;
+
+    shm_lock(sfilter);
+    if (sfilter->state == SHM_IN_OPEN && buflen > 0)
+	used = shm_handle_setup(sfilter, buf, buflen);
+    /*
+     * Anything after the setup is a doorbell, there's nothing to do
+     * with it, so all the data is always used.
+     */
+    if (sfilter->state == SHM_OPEN)
+	sfilter->doorbells_rcvd += buflen - used;
+
+    if (sfilter->state == SHM_OPEN)
+	err = shm_deliver(sfilter, handler, cb_data);
+    shm_unlock(sfilter);
+
+    if (!err && rcount)
+	*rcount = buflen;
+
+    return err;
+}
+
+static int
+shm_setup(struct gensio_filter *filter)
+{
+    return 0;
+}
+
+static void
+shm_filter_cleanup(struct gensio_filter *filter)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+
+    if (sfilter->shm_created)
+	shm_unlink(sfilter->name);
+    sfilter->shm_created = false;
+    if (sfilter->map)
+	munmap(sfilter->map, sfilter->map_len);
+    sfilter->map = NULL;
+    sfilter->tx = NULL;
+    sfilter->rx = NULL;
+    sfilter->state = SHM_CLOSED;
+    sfilter->open_err = 0;
+    sfilter->send_doorbell = false;
+    sfilter->wmsg_pos = 0;
+    sfilter->wmsg_len = 0;
+    sfilter->rmsg_len = 0;
+    sfilter->doorbells_sent = 0;
+    sfilter->doorbells_rcvd = 0;
+    sfilter->tx_full = 0;
+}
+
+static int
+shm_filter_control(struct shm_filter *sfilter, bool get, int op,
+		   char *data, gensiods *datalen)
+{
+    switch (op) {
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	shm_lock(sfilter);
+	*datalen = snprintf(data, *datalen,
+			    "size=%lu doorbells_sent=%llu doorbells_rcvd=%llu"
+			    " tx_full=%llu",
+			    (unsigned long) sfilter->size,
+			    (unsigned long long) sfilter->doorbells_sent,
+			    (unsigned long long) sfilter->doorbells_rcvd,
+			    (unsigned long long) sfilter->tx_full);
+	shm_unlock(sfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+sfilter_free(struct shm_filter *sfilter)
+{
+    if (sfilter->lock)
+	sfilter->o->free_lock(sfilter->lock);
+    if (sfilter->filter)
+	gensio_filter_free_data(sfilter->filter);
+    sfilter->o->free(sfilter->o, sfilter);
+}
+
+static void
+shm_free(struct gensio_filter *filter)
+{
+    struct shm_filter *sfilter = filter_to_shm(filter);
+
+    shm_filter_cleanup(filter);
+    sfilter_free(sfilter);
+}
+
+static int gensio_shm_filter_func(struct gensio_filter *filter, int op,
+				  void *func, void *data,
+				  gensiods *count,
+				  void *buf, const void *cbuf,
+				  gensiods buflen,
+				  const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return shm_ul_read_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE_PENDING:
+	return shm_ll_write_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return shm_ll_read_needed(filter);
+
+    case GENSIO_FILTER_FUNC_UL_CAN_WRITE:
+	return shm_ul_can_write(filter, data);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return shm_check_open_done(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return shm_try_connect(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return shm_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return shm_ul_write(filter, func, data, count, cbuf, buflen, auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return shm_ll_write(filter, func, data, count, buf, buflen, auxdata);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return shm_setup(filter);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	shm_filter_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return shm_filter_control(filter_to_shm(filter), *((bool *) cbuf),
+				  buflen, data, count);
+
+    case GENSIO_FILTER_FUNC_FREE:
+	shm_free(filter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_shm_filter_alloc(struct gensio_pparm_info *p,
+			struct gensio_os_funcs *o,
+			const char * const args[],
+			bool is_client,
+			struct gensio_filter **rfilter)
+{
+    struct shm_filter *sfilter;
+    unsigned int i;
+    gensiods size = SHM_DEFAULT_SIZE, s;
+    bool corrupt = false;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_ds(p, args[i], "size", &size) > 0)
+	    continue;
+	/* Undocumented, used for testing. */
+	if (gensio_pparm_bool(p, args[i], "corrupt", &corrupt) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (size > SHM_MAX_SIZE) {
+	gensio_pparm_slog(p, "size must be at most 2^30");
+	return GE_INVAL;
+    }
+    /* Round up to a power of two. */
+    for (s = SHM_MIN_SIZE; s < size; s <<= 1)
+	;
+
+    sfilter = o->zalloc(o, sizeof(*sfilter));
+    if (!sfilter)
+	return GE_NOMEM;
+
+    sfilter->o = o;
+    sfilter->is_client = is_client;
+    sfilter->cfg_size = s;
+    sfilter->corrupt = corrupt;
+
+    sfilter->lock = o->alloc_lock(o);
+    if (!sfilter->lock)
+	goto out_nomem;
+
+    sfilter->filter = gensio_filter_alloc_data(o, gensio_shm_filter_func,
+					       sfilter);
+    if (!sfilter->filter)
+	goto out_nomem;
+
+    *rfilter = sfilter->filter;
+    return 0;
+
+ out_nomem:
+    sfilter_free(sfilter);
+    return GE_NOMEM;
+}
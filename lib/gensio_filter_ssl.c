@@ -13,15 +13,20 @@
 #include "gensio_filter_ssl.h"
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_time.h>
+#include <gensio/gensio_list.h>
 
 #ifdef _WIN32
 #define DIRSEP '\\'
@@ -29,6 +34,30 @@
 #define DIRSEP '/'
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+/* DTLS needs DTLS_method() and BIO_set_callback_ex(). */
+#define GENSIO_SSL_DTLS
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+#endif
+
+#if defined(HAVE_LINUX_TLS_H) && defined(TLS1_3_VERSION)
+#define GENSIO_SSL_KTLS
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 struct gensio_ssl_filter_data {
     struct gensio_os_funcs *o;
     bool is_client;
@@ -37,17 +66,174 @@ struct gensio_ssl_filter_data {
     char *certfile;
     gensiods max_read_size;
     gensiods max_write_size;
+    gensiods record_size;
     bool allow_authfail;
     bool clientauth;
+    bool ktls;
+    bool resume;
+    gensiods session_cache;
+    gensio_time session_timeout;
+
+    /* Run DTLS over a packet gensio instead of TLS over a stream. */
+    bool datagram;
+    gensiods mtu;
 
     /* Amount of time in which the connection process must complete. */
     gensio_time con_timeout;
+
+    /* Run handshakes on the worker pool if not zero, the pool size. */
+    unsigned int handshake_threads;
+
+    /* Server, the most TLS 1.3 early data to take, zero is off. */
+    gensiods early_data;
+
+    /*
+     * The SSL context is built from the above the first time a filter
+     * is allocated and shared by every filter allocated after that,
+     * so an accepter doesn't read the key, cert and CA for each
+     * connection.  Each filter holds a reference to the context it
+     * was created with.  Protected by lock.
+     */
+    struct gensio_lock *lock;
+    SSL_CTX *ctx;
+};
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define SSL_CTX_up_ref(ctx) CRYPTO_add(&(ctx)->references, 1, \
+				       CRYPTO_LOCK_SSL_CTX)
+#endif
+
+/*
+ * Sessions saved by clients for resumption.  This is shared by all
+ * the ssl gensios in the process so a new gensio to the same place
+ * can resume a session from an old one.  Entries are keyed by the
+ * remote address and the CA, cert and key in use, and the most
+ * recently used is first in the list.
+ */
+#define SSL_SESS_STORE_MAX 64
+
+/*
+ * DTLS servers send a cookie made from the remote address and this
+ * secret before creating any handshake state, so a spoofed address
+ * can't get far.  It's made once per process.
+ */
+#define SSL_COOKIE_SECRET_LEN 32
+static unsigned char ssl_cookie_secret[SSL_COOKIE_SECRET_LEN];
+static bool ssl_cookie_secret_ok;
+
+/*
+ * The most datagrams from SSL that will be kept separate waiting to
+ * go to the lower layer.  If more than this get queued, the last ones
+ * are sent together.
+ */
+#define SSL_MAX_DGRAMS 32
+
+struct ssl_sess_entry {
+    struct gensio_link link;
+    char *key;
+    SSL_SESSION *sess;
+};
+
+static struct gensio_os_funcs *ssl_sess_o;
+static struct gensio_lock *ssl_sess_lock;
+static struct gensio_list ssl_sess_list;
+static unsigned int ssl_sess_count;
+
+static void
+ssl_sess_entry_free(struct ssl_sess_entry *e)
+{
+    gensio_list_rm(&ssl_sess_list, &e->link);
+    ssl_sess_count--;
+    SSL_SESSION_free(e->sess);
+    ssl_sess_o->free(ssl_sess_o, e->key);
+    ssl_sess_o->free(ssl_sess_o, e);
+}
+
+/*
+ * Handshake workers, for handshake-threads.  Filters with a handshake
+ * step to run are queued on ssl_hs_queue and a worker runs
+ * SSL_connect() or SSL_accept() for them, so the public key crypto
+ * doesn't hold up the thread handling the connection.  The pool is
+ * shared by all the ssl gensios in the program and grows to the
+ * largest handshake-threads asked for.  Protected by ssl_hs_lock.
+ */
+static struct gensio_lock *ssl_hs_lock;
+static struct gensio_waiter *ssl_hs_waiter;
+static struct gensio_list ssl_hs_queue;
+static struct gensio_thread **ssl_hs_threads;
+static unsigned int ssl_hs_nthreads;
+static bool ssl_hs_stopping;
+
+static void
+ssl_hs_pool_stop(void)
+{
+    struct gensio_os_funcs *o = ssl_sess_o;
+    unsigned int i;
+
+    o->lock(ssl_hs_lock);
+    ssl_hs_stopping = true;
+    o->unlock(ssl_hs_lock);
+    for (i = 0; i < ssl_hs_nthreads; i++)
+	o->wake(ssl_hs_waiter);
+    for (i = 0; i < ssl_hs_nthreads; i++)
+	gensio_os_wait_thread(ssl_hs_threads[i]);
+    if (ssl_hs_threads)
+	o->free(o, ssl_hs_threads);
+    ssl_hs_threads = NULL;
+    ssl_hs_nthreads = 0;
+    o->free_waiter(ssl_hs_waiter);
+    ssl_hs_waiter = NULL;
+    o->free_lock(ssl_hs_lock);
+    ssl_hs_lock = NULL;
+}
+
+static void
+gensio_ssl_cleanup_mem(void)
+{
+    struct gensio_link *l, *l2;
+
+    if (ssl_hs_lock)
+	ssl_hs_pool_stop();
+    if (!ssl_sess_lock)
+	return;
+    gensio_list_for_each_safe(&ssl_sess_list, l, l2)
+	ssl_sess_entry_free(gensio_container_of(l, struct ssl_sess_entry,
+						link));
+    ssl_sess_o->free_lock(ssl_sess_lock);
+    ssl_sess_lock = NULL;
+}
+
+static struct gensio_class_cleanup ssl_class_cleanup = {
+    gensio_ssl_cleanup_mem
 };
 
 static void
 gensio_do_ssl_init(void *cb_data)
 {
+    struct gensio_os_funcs *o = cb_data;
+
     SSL_library_init();
+
+    ssl_cookie_secret_ok = RAND_bytes(ssl_cookie_secret,
+				      sizeof(ssl_cookie_secret)) == 1;
+
+    gensio_list_init(&ssl_sess_list);
+    ssl_sess_o = o;
+    ssl_sess_lock = o->alloc_lock(o);
+
+    /* If these fail, clients just don't resume and handshakes run inline. */
+    gensio_list_init(&ssl_hs_queue);
+    ssl_hs_lock = o->alloc_lock(o);
+    if (ssl_hs_lock) {
+	ssl_hs_waiter = o->alloc_waiter(o);
+	if (!ssl_hs_waiter) {
+	    o->free_lock(ssl_hs_lock);
+	    ssl_hs_lock = NULL;
+	}
+    }
+
+    if (ssl_sess_lock || ssl_hs_lock)
+	gensio_register_class_cleanup(&ssl_class_cleanup);
 }
 
 static struct gensio_once gensio_ssl_init_once;
@@ -55,9 +241,56 @@ static struct gensio_once gensio_ssl_init_once;
 static void
 gensio_ssl_initialize(struct gensio_os_funcs *o)
 {
-    o->call_once(o, &gensio_ssl_init_once, gensio_do_ssl_init, NULL);
+    o->call_once(o, &gensio_ssl_init_once, gensio_do_ssl_init, o);
+}
+
+/* Must be called with ssl_sess_lock held. */
+static struct ssl_sess_entry *
+ssl_sess_find(const char *key)
+{
+    struct gensio_link *l;
+
+    gensio_list_for_each(&ssl_sess_list, l) {
+	struct ssl_sess_entry *e = gensio_container_of(l,
+						       struct ssl_sess_entry,
+						       link);
+
+	if (strcmp(e->key, key) == 0)
+	    return e;
+    }
+    return NULL;
+}
+
+/* Set the saved session for key on ssl, if there is one. */
+static void
+ssl_sess_use(SSL *ssl, const char *key)
+{
+    struct ssl_sess_entry *e;
+
+    if (!ssl_sess_lock)
+	return;
+
+    ssl_sess_o->lock(ssl_sess_lock);
+    e = ssl_sess_find(key);
+    if (e) {
+	if (time(NULL) - SSL_SESSION_get_time(e->sess) >=
+		SSL_SESSION_get_timeout(e->sess)) {
+	    ssl_sess_entry_free(e);
+	} else {
+	    SSL_set_session(ssl, e->sess);
+	    gensio_list_rm(&ssl_sess_list, &e->link);
+	    gensio_list_add_head(&ssl_sess_list, &e->link);
+	}
+    }
+    ssl_sess_o->unlock(ssl_sess_lock);
 }
 
+enum ssl_ktls_state {
+    SSL_KTLS_OFF,	/* Not in use, everything goes through SSL. */
+    SSL_KTLS_WAIT,	/* Waiting for the handshake to finish. */
+    SSL_KTLS_TX		/* The kernel encrypts transmitted data. */
+};
+
 struct ssl_filter {
     struct gensio_filter *filter;
     struct gensio_os_funcs *o;
@@ -80,6 +313,44 @@ struct ssl_filter {
     /* try_connect() has been called at least once. */
     bool started;
 
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    /*
+     * Handshake steps run on the worker pool.  While hs_running is
+     * set the worker owns the SSL and its BIOs, nothing else may
+     * touch them.  When the worker finishes, the result is in hs_rv
+     * and hs_done is set, and try_connect() is called again to pick
+     * it up.  hs_input is set when data from the remote end has
+     * arrived since the last step, if SSL wants to read nothing is
+     * run until it is.  If the filter is cleaned up while the worker
+     * has the SSL, hs_cleanup is set and the worker does it.
+     */
+    bool hs_async;
+    bool hs_running;
+    bool hs_done;
+    bool hs_input;
+    bool hs_cleanup;
+    int hs_rv;
+    struct gensio_link hs_link;
+
+    /*
+     * TLS 1.3 early data.  A server with early_max set reads early
+     * data into read_data before finishing the handshake, early_read
+     * is set while the data there came early so it is reported with
+     * the "early" auxdata.  On a client, early_data is what the user
+     * set to go early.  It goes with the first flight if the session
+     * being resumed allows it, otherwise, or if the server rejects
+     * it, it is sent as normal data after the handshake.  early_done
+     * is set when the early step of the handshake is finished.
+     */
+    gensiods early_max;
+    bool early_done;
+    bool early_read;
+    unsigned char *early_data;
+    gensiods early_len;
+    bool early_accepted;
+
     /* Time to wait for the connection to complete. */
     gensio_time con_timeout;
 
@@ -95,19 +366,24 @@ struct ssl_filter {
     bool in_ul_handler;
 
     /*
-     * This is data from the user waiting to be sent to SSL_write().  This
-     * is required because if SSL_write() return that it needs I/O, it must
-     * be called again with exactly the same data.
+     * User data is normally passed straight to SSL_write(), and the
+     * encrypted data goes straight from the BIO to the lower layer.
+     * But if SSL_write() returns that it needs I/O, it must be called
+     * again with the same data, so it is copied here.  This is also
+     * the most data passed to one SSL_write() call.
      */
     unsigned char *write_data;
     gensiods max_write_size;
     gensiods write_data_len;
 
-    /* This is data from BIO_read() waiting to be sent to the lower layer. */
-    unsigned char *xmit_buf;
-    gensiods xmit_buf_pos;
-    gensiods xmit_buf_len;
-    gensiods max_xmit_buf;
+    /*
+     * Compaction was turned on with GENSIO_CONTROL_MEM, read_data and
+     * write_data are only held while they have data in them.
+     */
+    bool compact;
+
+    /* Size of each half of the BIO pair, for GENSIO_CONTROL_MEM. */
+    gensiods bio_size;
 
     /*
      * SSL has asked for something.
@@ -121,10 +397,116 @@ struct ssl_filter {
      * and consistency with certauth.
      */
     char *username;
+
+    /*
+     * For clients that resume sessions, the part of the session store
+     * key that comes from the config, and the full key with the
+     * remote address once the connection has started.
+     */
+    char *sess_prefix;
+    char *sess_key;
+
+    /*
+     * DTLS.  Instead of a BIO pair, io_bio is a memory BIO SSL writes
+     * to and in_bio is a memory BIO SSL reads from, SSL owns both.
+     * Each write SSL does to io_bio is a datagram, the lengths are
+     * saved in dgram_lens so they can be sent separately.
+     * dgram_sent is how much of the data in io_bio has already been
+     * sent, io_bio is reset once it has all been sent.
+     */
+    bool datagram;
+    gensiods mtu;
+    BIO *in_bio;
+    gensiods dgram_lens[SSL_MAX_DGRAMS];
+    unsigned int dgram_first;
+    unsigned int dgram_count;
+    gensiods dgram_sent;
+
+    /*
+     * Kernel TLS.  Once the handshake is done the transmit key is
+     * given to the kernel and user data is passed straight to the
+     * lower layer, which the kernel encrypts.  Received data is
+     * still decrypted by SSL.
+     */
+    bool ktls;
+    enum ssl_ktls_state ktls_state;
+    int ktls_fd;
+    struct gensio *io;
+#ifdef GENSIO_SSL_KTLS
+    unsigned char ktls_secret[EVP_MAX_MD_SIZE];
+    unsigned int ktls_secret_len;
+#endif
 };
 
 #define filter_to_ssl(v) ((struct ssl_filter *) gensio_filter_get_user_data(v))
 
+/*
+ * A client got a session it can resume, save it.  With TLS 1.3 this
+ * happens after the handshake, when the server's ticket arrives.
+ */
+static int
+ssl_new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    struct ssl_filter *sfilter = SSL_get_app_data(ssl);
+    struct gensio_os_funcs *o = ssl_sess_o;
+    struct ssl_sess_entry *e;
+    struct gensio_link *l;
+
+    if (!sfilter || !sfilter->sess_key || !ssl_sess_lock)
+	return 0;
+
+    o->lock(ssl_sess_lock);
+    e = ssl_sess_find(sfilter->sess_key);
+    if (e) {
+	SSL_SESSION_free(e->sess);
+	gensio_list_rm(&ssl_sess_list, &e->link);
+    } else {
+	e = o->zalloc(o, sizeof(*e));
+	if (!e)
+	    goto out_fail;
+	e->key = gensio_strdup(o, sfilter->sess_key);
+	if (!e->key) {
+	    o->free(o, e);
+	    goto out_fail;
+	}
+	if (ssl_sess_count >= SSL_SESS_STORE_MAX) {
+	    l = gensio_list_last(&ssl_sess_list);
+	    ssl_sess_entry_free(gensio_container_of(l, struct ssl_sess_entry,
+						    link));
+	}
+	ssl_sess_count++;
+    }
+    e->sess = sess;
+    gensio_list_add_head(&ssl_sess_list, &e->link);
+    o->unlock(ssl_sess_lock);
+
+    return 1; /* We keep the reference to the session. */
+
+ out_fail:
+    o->unlock(ssl_sess_lock);
+    return 0;
+}
+
+/* Find a session to resume for a client. */
+static void
+ssl_sess_start(struct ssl_filter *sfilter)
+{
+    struct gensio *child = gensio_get_child(sfilter->io, 1);
+    char raddr[200];
+    gensiods len = sizeof(raddr);
+
+    if (!child)
+	return;
+    strcpy(raddr, "0");
+    if (gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, GENSIO_CONTROL_GET,
+		       GENSIO_CONTROL_RADDR, raddr, &len))
+	return;
+    sfilter->sess_key = gensio_alloc_sprintf(sfilter->o, "%s;%s", raddr,
+					     sfilter->sess_prefix);
+    if (sfilter->sess_key)
+	ssl_sess_use(sfilter->ssl, sfilter->sess_key);
+}
+
 static void
 gssl_vlog(struct ssl_filter *f, enum gensio_log_levels l,
 	  bool do_ssl_err, char *fmt, va_list ap)
@@ -198,7 +580,10 @@ static void
 ssl_set_callbacks(struct gensio_filter *filter,
 		  gensio_filter_cb cb, void *cb_data)
 {
-    /* We don't currently use callbacks. */
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+
+    sfilter->filter_cb = cb;
+    sfilter->filter_cb_data = cb_data;
 }
 
 static bool
@@ -209,7 +594,10 @@ ssl_ul_read_pending(struct gensio_filter *filter)
     bool rv;
 
     ssl_lock(sfilter);
-    rv = sfilter->read_data_len || SSL_peek(sfilter->ssl, buf, 1) > 0;
+    if (sfilter->hs_running)
+	rv = false;
+    else
+	rv = sfilter->read_data_len || SSL_peek(sfilter->ssl, buf, 1) > 0;
     ssl_unlock(sfilter);
     return rv;
 }
@@ -221,8 +609,11 @@ ssl_ll_write_pending(struct gensio_filter *filter)
     bool rv;
 
     ssl_lock(sfilter);
-    rv = BIO_pending(sfilter->io_bio) || sfilter->write_data_len ||
-	sfilter->xmit_buf_len || sfilter->want_write;
+    if (sfilter->hs_running)
+	rv = false;
+    else
+	rv = BIO_pending(sfilter->io_bio) || sfilter->write_data_len ||
+	    sfilter->want_write;
     ssl_unlock(sfilter);
     return rv;
 }
@@ -234,7 +625,13 @@ ssl_ll_read_needed(struct gensio_filter *filter)
     bool rv;
 
     ssl_lock(sfilter);
-    rv = BIO_should_read(sfilter->io_bio) || sfilter->want_read;
+    if (sfilter->hs_running)
+	/* Input waits until the worker is done with the BIO. */
+	rv = false;
+    else if (sfilter->datagram)
+	rv = BIO_should_read(sfilter->in_bio) || sfilter->want_read;
+    else
+	rv = BIO_should_read(sfilter->io_bio) || sfilter->want_read;
     ssl_unlock(sfilter);
     return rv;
 }
@@ -245,7 +642,8 @@ ssl_ul_can_write(struct gensio_filter *filter, bool *val)
     struct ssl_filter *sfilter = filter_to_ssl(filter);
 
     ssl_lock(sfilter);
-    *val = sfilter->write_data_len == 0 && sfilter->xmit_buf_len == 0;
+    *val = (!sfilter->hs_running && sfilter->write_data_len == 0 &&
+	    !BIO_pending(sfilter->io_bio));
     ssl_unlock(sfilter);
 
     return 0;
@@ -324,29 +722,146 @@ ssl_start_con_timeout(struct ssl_filter *sfilter)
     gensio_time_add(&sfilter->contime_done, &sfilter->con_timeout);
 }
 
+/*
+ * Run one step of the handshake.  Returns 0 when it is done,
+ * GE_INPROGRESS if SSL needs I/O, or an error.  This is called without
+ * the lock from a handshake worker, which owns the SSL then.
+ */
+/* Allocate a buffer freed by compaction if it's not there. */
 static int
-ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout,
-		bool was_timeout)
+ssl_buf_get(struct ssl_filter *sfilter, unsigned char **buf, gensiods size)
 {
-    struct ssl_filter *sfilter = filter_to_ssl(filter);
-    int rv, success, err;
-    int64_t timeout_ns;
-    gensio_time time_now;
+    if (!*buf) {
+	*buf = gensio_os_buf_alloc(sfilter->o, size);
+	if (!*buf)
+	    return GE_NOMEM;
+    }
+    return 0;
+}
 
-    ssl_lock(sfilter);
-    if (!sfilter->started) {
-	ssl_start_con_timeout(sfilter);
-	sfilter->started = true;
+#ifdef TLS1_3_VERSION
+static int
+ssl_early_err(struct ssl_filter *sfilter, int ret, const char *op)
+{
+    switch (SSL_get_error(sfilter->ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+	sfilter->want_read = true;
+	return GE_INPROGRESS;
+
+    case SSL_ERROR_WANT_WRITE:
+	sfilter->want_write = true;
+	return GE_INPROGRESS;
+
+    case SSL_ERROR_ZERO_RETURN:
+	return GE_REMCLOSE;
+
+    default:
+	gssl_logs_err(sfilter, "Failed SSL %s", op);
+	return GE_PROTOERR;
     }
+}
 
-    if (was_timeout) {
-	gssl_log_err(sfilter, "Timed out waiting for connection to complete");
-	rv = GE_TIMEDOUT;
-	goto out;
+/*
+ * Server, read the early data from the client.  It waits in
+ * read_data until the open is done.
+ */
+static int
+ssl_read_early(struct ssl_filter *sfilter)
+{
+    size_t count;
+    int rv;
+
+    rv = ssl_buf_get(sfilter, &sfilter->read_data, sfilter->max_read_size);
+    if (rv)
+	return rv;
+    for (;;) {
+	if (sfilter->read_data_len >= sfilter->max_read_size)
+	    /* early-data is limited to readbuf, this shouldn't happen. */
+	    return GE_TOOBIG;
+	count = 0;
+	rv = SSL_read_early_data(sfilter->ssl,
+				 sfilter->read_data + sfilter->read_data_len,
+				 sfilter->max_read_size - sfilter->read_data_len,
+				 &count);
+	if (rv == SSL_READ_EARLY_DATA_ERROR)
+	    return ssl_early_err(sfilter, rv, "early data read");
+	if (count) {
+	    sfilter->read_data_len += count;
+	    sfilter->early_read = true;
+	}
+	if (rv == SSL_READ_EARLY_DATA_FINISH)
+	    break;
+    }
+    sfilter->early_done = true;
+    return 0;
+}
+
+/*
+ * Client, send the early data with the first flight if the session
+ * being resumed takes that much.
+ */
+static int
+ssl_write_early(struct ssl_filter *sfilter)
+{
+    SSL_SESSION *sess = SSL_get0_session(sfilter->ssl);
+    size_t count;
+    int rv;
+
+    if (sess && SSL_SESSION_get_max_early_data(sess) >= sfilter->early_len) {
+	rv = SSL_write_early_data(sfilter->ssl, sfilter->early_data,
+				  sfilter->early_len, &count);
+	if (!rv)
+	    return ssl_early_err(sfilter, rv, "early data write");
+    }
+    sfilter->early_done = true;
+    return 0;
+}
+
+/*
+ * Client, the handshake is done.  If the early data didn't make it,
+ * send it like it was written after the open.
+ */
+static int
+ssl_early_finish(struct ssl_filter *sfilter)
+{
+    int rv;
+
+    if (SSL_get_early_data_status(sfilter->ssl) == SSL_EARLY_DATA_ACCEPTED) {
+	sfilter->early_accepted = true;
+    } else {
+	rv = ssl_buf_get(sfilter, &sfilter->write_data,
+			 sfilter->max_write_size);
+	if (rv)
+	    return rv;
+	memcpy(sfilter->write_data, sfilter->early_data, sfilter->early_len);
+	sfilter->write_data_len = sfilter->early_len;
     }
+    sfilter->o->free(sfilter->o, sfilter->early_data);
+    sfilter->early_data = NULL;
+    sfilter->early_len = 0;
+    return 0;
+}
+#endif
+
+static int
+ssl_handshake(struct ssl_filter *sfilter)
+{
+    int rv, success, err;
 
     sfilter->want_read = false;
     sfilter->want_write = false;
+#ifdef TLS1_3_VERSION
+    if (!sfilter->early_done) {
+	if (sfilter->early_max)
+	    rv = ssl_read_early(sfilter);
+	else if (sfilter->early_len)
+	    rv = ssl_write_early(sfilter);
+	else
+	    rv = 0;
+	if (rv)
+	    return rv;
+    }
+#endif
     if (sfilter->is_client)
 	success = SSL_connect(sfilter->ssl);
     else
@@ -358,6 +873,10 @@ ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout,
     } else if (success == 1) {
 	sfilter->connected = true;
 	rv = 0;
+#ifdef TLS1_3_VERSION
+	if (sfilter->early_len)
+	    rv = ssl_early_finish(sfilter);
+#endif
     } else {
 	err = SSL_get_error(sfilter->ssl, success);
 	switch (err) {
@@ -386,70 +905,536 @@ ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout,
 	    rv = GE_COMMERR;
 	}
     }
-    if (rv == GE_INPROGRESS) {
-	sfilter->o->get_monotonic_time(sfilter->o, &time_now);
-	timeout_ns = gensio_time_diff_nsecs(&sfilter->contime_done, &time_now);
-	if (timeout_ns < 0)
-	    timeout_ns = 0;
-	timeout->secs = timeout_ns / GENSIO_NSECS_IN_SEC;
-	timeout->nsecs = timeout_ns % GENSIO_NSECS_IN_SEC;
-	rv = GE_RETRY;
-    }
- out:
-    ssl_unlock(sfilter);
     return rv;
 }
 
-static int
-ssl_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+static void ssl_do_cleanup(struct ssl_filter *sfilter);
+
+static void
+ssl_hs_run(struct ssl_filter *sfilter)
 {
-    struct ssl_filter *sfilter = filter_to_ssl(filter);
-    int success, rv = GE_INPROGRESS, shutdown, err;
+    struct gensio *io = sfilter->io;
+    bool cleanup;
+    int rv;
 
-    ssl_lock(sfilter);
-    sfilter->connected = false;
+    rv = ssl_handshake(sfilter);
 
-    shutdown = SSL_get_shutdown(sfilter->ssl);
-    shutdown &= SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN;
-    if (shutdown == (SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN)) {
-	/* Shutdown is complete. */
-	rv = 0;
-	goto out_unlock;
+    ssl_lock(sfilter);
+    sfilter->hs_running = false;
+    cleanup = sfilter->hs_cleanup;
+    if (cleanup) {
+	sfilter->hs_cleanup = false;
+	ssl_do_cleanup(sfilter);
+    } else {
+	sfilter->hs_rv = rv;
+	sfilter->hs_done = true;
     }
+    ssl_unlock(sfilter);
 
-    sfilter->want_read = false;
-    sfilter->want_write = false;
+    if (!cleanup)
+	sfilter->filter_cb(sfilter->filter_cb_data, GENSIO_FILTER_CB_OPEN_DONE,
+			   NULL);
+    /* Drop the reference ssl_hs_start() took. */
+    gensio_free(io);
+}
 
-    if (!sfilter->shutdown_success) {
-	success = SSL_shutdown(sfilter->ssl);
-	if (success >= 0) {
-	    sfilter->shutdown_success = true;
-	    if (success == 1)
-		rv = 0;
-	    else
-		sfilter->want_read = true;
-	    goto out_unlock;
+static void
+ssl_hs_worker(void *data)
+{
+    struct gensio_os_funcs *o = ssl_sess_o;
+    struct gensio_link *l;
+
+    o->lock(ssl_hs_lock);
+    while (!ssl_hs_stopping) {
+	if (gensio_list_empty(&ssl_hs_queue)) {
+	    o->unlock(ssl_hs_lock);
+	    o->wait(ssl_hs_waiter, 1, NULL);
+	    o->lock(ssl_hs_lock);
+	    continue;
 	}
+	l = gensio_list_first(&ssl_hs_queue);
+	gensio_list_rm(&ssl_hs_queue, l);
+	o->unlock(ssl_hs_lock);
+	ssl_hs_run(gensio_container_of(l, struct ssl_filter, hs_link));
+	o->lock(ssl_hs_lock);
+    }
+    o->unlock(ssl_hs_lock);
+}
 
-	err = SSL_get_error(sfilter->ssl, success);
-	switch (err) {
-	case SSL_ERROR_WANT_READ:
-	    sfilter->want_read = true;
-	    break;
+/*
+ * Make sure there are at least nthreads handshake workers.  Returns
+ * GE_NOTSUP if the os handler can't wake a thread waiting on it from
+ * another thread, workers can't be used then.
+ */
+static int
+ssl_hs_pool_grow(unsigned int nthreads)
+{
+    struct gensio_os_funcs *o = ssl_sess_o;
+    struct gensio_thread **threads;
+    int rv = 0;
 
-	case SSL_ERROR_WANT_WRITE:
-	    sfilter->want_write = true;
-	    break;
+    if (!ssl_hs_lock)
+	return GE_NOTSUP;
+    if (o->get_wake_sig && o->get_wake_sig(o) == 0)
+	return GE_NOTSUP;
 
-	case SSL_ERROR_SSL:
-	    gssl_logs_err(sfilter, "Failed SSL shutdown");
-	    rv = GE_PROTOERR;
-	    break;
+    o->lock(ssl_hs_lock);
+    if (nthreads <= ssl_hs_nthreads)
+	goto out_unlock;
+    threads = o->zalloc(o, nthreads * sizeof(*threads));
+    if (!threads) {
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
+    if (ssl_hs_threads) {
+	memcpy(threads, ssl_hs_threads, ssl_hs_nthreads * sizeof(*threads));
+	o->free(o, ssl_hs_threads);
+    }
+    ssl_hs_threads = threads;
+    while (ssl_hs_nthreads < nthreads) {
+	rv = gensio_os_new_thread(o, ssl_hs_worker, NULL,
+				  &ssl_hs_threads[ssl_hs_nthreads]);
+	if (rv)
+	    break;
+	ssl_hs_nthreads++;
+    }
+    /* Any workers that did start can be used. */
+    if (ssl_hs_nthreads)
+	rv = 0;
+ out_unlock:
+    o->unlock(ssl_hs_lock);
+    return rv;
+}
+
+/*
+ * Hand the next handshake step to a worker, with the lock held.
+ * Returns GE_INPROGRESS while the step is running or SSL is waiting
+ * for data, otherwise the result of the last step.  The worker calls
+ * GENSIO_FILTER_CB_OPEN_DONE when it is done to get here again.
+ */
+static int
+ssl_hs_start(struct ssl_filter *sfilter)
+{
+    struct gensio_os_funcs *o = ssl_sess_o;
+
+    if (sfilter->hs_running)
+	return GE_INPROGRESS;
+    if (sfilter->hs_done) {
+	sfilter->hs_done = false;
+	return sfilter->hs_rv;
+    }
+    if (sfilter->want_read && !sfilter->hs_input)
+	/* Nothing new from the remote end to work on. */
+	return GE_INPROGRESS;
+
+    sfilter->hs_input = false;
+    sfilter->hs_running = true;
+    /* Keep the gensio, and the base under it, around for the worker. */
+    gensio_ref(sfilter->io);
+    o->lock(ssl_hs_lock);
+    gensio_list_add_tail(&ssl_hs_queue, &sfilter->hs_link);
+    o->unlock(ssl_hs_lock);
+    o->wake(ssl_hs_waiter);
+    return GE_INPROGRESS;
+}
+
+static int
+ssl_try_connect(struct gensio_filter *filter, gensio_time *timeout,
+		bool was_timeout)
+{
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+    int rv;
+    int64_t timeout_ns;
+    gensio_time time_now;
+
+    ssl_lock(sfilter);
+    if (!sfilter->started) {
+	ssl_start_con_timeout(sfilter);
+	sfilter->started = true;
+	if (sfilter->sess_prefix)
+	    ssl_sess_start(sfilter);
+    }
+
+    if (was_timeout) {
+	sfilter->o->get_monotonic_time(sfilter->o, &time_now);
+	if (!sfilter->datagram ||
+		gensio_time_diff_nsecs(&sfilter->contime_done, &time_now) <= 0) {
+	    gssl_log_err(sfilter,
+			 "Timed out waiting for connection to complete");
+	    rv = GE_TIMEDOUT;
+	    goto out;
+	}
+#ifdef GENSIO_SSL_DTLS
+	/* A DTLS retransmit timer went off, resend the last flight. */
+	DTLSv1_handle_timeout(sfilter->ssl);
+#endif
+    }
+
+    if (sfilter->hs_async)
+	rv = ssl_hs_start(sfilter);
+    else
+	rv = ssl_handshake(sfilter);
+    if (rv == GE_INPROGRESS) {
+	sfilter->o->get_monotonic_time(sfilter->o, &time_now);
+	timeout_ns = gensio_time_diff_nsecs(&sfilter->contime_done, &time_now);
+	if (timeout_ns < 0)
+	    timeout_ns = 0;
+#ifdef GENSIO_SSL_DTLS
+	if (sfilter->datagram) {
+	    struct timeval tv;
+
+	    /* Wake up for DTLS retransmits, too. */
+	    if (DTLSv1_get_timeout(sfilter->ssl, &tv) > 0) {
+		int64_t dtls_ns = ((int64_t) tv.tv_sec * GENSIO_NSECS_IN_SEC +
+				   (int64_t) tv.tv_usec * 1000);
+
+		if (dtls_ns < timeout_ns)
+		    timeout_ns = dtls_ns;
+	    }
+	}
+#endif
+	timeout->secs = timeout_ns / GENSIO_NSECS_IN_SEC;
+	timeout->nsecs = timeout_ns % GENSIO_NSECS_IN_SEC;
+	rv = GE_RETRY;
+    }
+ out:
+    ssl_unlock(sfilter);
+    return rv;
+}
+
+#ifdef GENSIO_SSL_KTLS
+/*
+ * Save the secret SSL will send with once the handshake is done, the
+ * kernel needs the keys derived from it.
+ */
+static void
+ssl_ktls_keylog(const SSL *ssl, const char *line)
+{
+    struct ssl_filter *sfilter = SSL_get_app_data(ssl);
+    const char *label;
+    unsigned int len = 0;
+    int hi, lo;
+
+    if (!sfilter || sfilter->ktls_state != SSL_KTLS_WAIT)
+	return;
+
+    if (sfilter->is_client)
+	label = "CLIENT_TRAFFIC_SECRET_0 ";
+    else
+	label = "SERVER_TRAFFIC_SECRET_0 ";
+    if (strncmp(line, label, strlen(label)) != 0)
+	return;
+
+    /* Skip the client random. */
+    line = strchr(line + strlen(label), ' ');
+    if (!line)
+	return;
+    for (line++; len < sizeof(sfilter->ktls_secret); line += 2) {
+	hi = OPENSSL_hexchar2int(line[0]);
+	if (hi < 0)
+	    break;
+	lo = OPENSSL_hexchar2int(line[1]);
+	if (lo < 0)
+	    break;
+	sfilter->ktls_secret[len++] = (hi << 4) | lo;
+    }
+    sfilter->ktls_secret_len = len;
+}
+
+/* HKDF-Expand-Label from RFC 8446 with an empty context. */
+static bool
+ssl_ktls_expand(const EVP_MD *md, const unsigned char *secret,
+		unsigned int secret_len, const char *label,
+		unsigned char *out, size_t outlen)
+{
+    unsigned char info[64];
+    size_t llen = strlen(label), ilen = 0;
+    EVP_PKEY_CTX *pctx;
+    bool rv = false;
+
+    info[ilen++] = outlen >> 8;
+    info[ilen++] = outlen & 0xff;
+    info[ilen++] = 6 + llen;
+    memcpy(info + ilen, "tls13 ", 6);
+    ilen += 6;
+    memcpy(info + ilen, label, llen);
+    ilen += llen;
+    info[ilen++] = 0;
+
+    pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if (!pctx)
+	return false;
+    if (EVP_PKEY_derive_init(pctx) > 0 &&
+	EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+	EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0 &&
+	EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secret_len) > 0 &&
+	EVP_PKEY_CTX_add1_hkdf_info(pctx, info, ilen) > 0 &&
+	EVP_PKEY_derive(pctx, out, &outlen) > 0)
+	rv = true;
+    EVP_PKEY_CTX_free(pctx);
+    return rv;
+}
+
+/*
+ * Get the socket under us.  The lower gensio must read and write one
+ * file descriptor for kTLS to work.
+ */
+static int
+ssl_ktls_get_fd(struct ssl_filter *sfilter)
+{
+    struct gensio *child = gensio_get_child(sfilter->io, 1);
+    char buf[30], *end;
+    gensiods len = sizeof(buf);
+    long rfd, wfd;
+
+    if (!child)
+	return -1;
+    if (gensio_control(child, 0, GENSIO_CONTROL_GET, GENSIO_CONTROL_RAW_FD,
+		       buf, &len))
+	return -1;
+    rfd = strtol(buf, &end, 0);
+    wfd = strtol(end, NULL, 0);
+    if (rfd != wfd || wfd < 0)
+	return -1;
+    return wfd;
+}
+
+/*
+ * Hand transmit encryption over to the kernel.  This must be done
+ * after everything SSL has written for the handshake has gone to the
+ * lower layer and before any user data has been encrypted.  If this
+ * returns false, kTLS could not be enabled and SSL keeps on doing the
+ * encryption.
+ */
+static bool
+ssl_ktls_start(struct ssl_filter *sfilter)
+{
+    union {
+	struct tls_crypto_info info;
+	struct tls12_crypto_info_aes_gcm_128 gcm128;
+	struct tls12_crypto_info_aes_gcm_256 gcm256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+    } ci;
+    unsigned char key[32], iv[12];
+    const EVP_MD *md;
+    unsigned int keylen;
+    socklen_t cilen;
+    bool rv = false;
+    int fd;
+
+    if (SSL_version(sfilter->ssl) != TLS1_3_VERSION) {
+	gssl_log_info(sfilter, "kTLS requires TLS 1.3, not using it");
+	goto out;
+    }
+
+    memset(&ci, 0, sizeof(ci));
+    ci.info.version = TLS_1_3_VERSION;
+    switch (SSL_CIPHER_get_protocol_id(SSL_get_current_cipher(sfilter->ssl))) {
+    case 0x1301: /* TLS_AES_128_GCM_SHA256 */
+	md = EVP_sha256();
+	keylen = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+	ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+	cilen = sizeof(ci.gcm128);
+	break;
+
+    case 0x1302: /* TLS_AES_256_GCM_SHA384 */
+	md = EVP_sha384();
+	keylen = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+	ci.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+	cilen = sizeof(ci.gcm256);
+	break;
+
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case 0x1303: /* TLS_CHACHA20_POLY1305_SHA256 */
+	md = EVP_sha256();
+	keylen = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+	ci.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+	cilen = sizeof(ci.chacha);
+	break;
+#endif
+
+    default:
+	gssl_log_info(sfilter, "Cipher %s not supported by kTLS, not using it",
+		      SSL_get_cipher_name(sfilter->ssl));
+	goto out;
+    }
+
+    if (sfilter->ktls_secret_len != (unsigned int) EVP_MD_size(md)) {
+	gssl_log_info(sfilter, "No kTLS traffic secret, not using it");
+	goto out;
+    }
+
+    fd = ssl_ktls_get_fd(sfilter);
+    if (fd < 0) {
+	gssl_log_info(sfilter, "Lower layer is not a socket, not using kTLS");
+	goto out;
+    }
+
+    if (!ssl_ktls_expand(md, sfilter->ktls_secret, sfilter->ktls_secret_len,
+			 "key", key, keylen) ||
+	!ssl_ktls_expand(md, sfilter->ktls_secret, sfilter->ktls_secret_len,
+			 "iv", iv, sizeof(iv))) {
+	gssl_logs_info(sfilter, "Unable to derive kTLS keys, not using it");
+	goto out;
+    }
+
+    /* The record sequence number is zero, no data has been sent yet. */
+    switch (ci.info.cipher_type) {
+    case TLS_CIPHER_AES_GCM_128:
+	memcpy(ci.gcm128.key, key, keylen);
+	memcpy(ci.gcm128.salt, iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	memcpy(ci.gcm128.iv, iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	break;
+
+    case TLS_CIPHER_AES_GCM_256:
+	memcpy(ci.gcm256.key, key, keylen);
+	memcpy(ci.gcm256.salt, iv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+	memcpy(ci.gcm256.iv, iv + TLS_CIPHER_AES_GCM_256_SALT_SIZE,
+	       TLS_CIPHER_AES_GCM_256_IV_SIZE);
+	break;
+
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case TLS_CIPHER_CHACHA20_POLY1305:
+	memcpy(ci.chacha.key, key, keylen);
+	memcpy(ci.chacha.iv, iv, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+	break;
+#endif
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == -1 ||
+	setsockopt(fd, SOL_TLS, TLS_TX, &ci, cilen) == -1) {
+	gssl_log_info(sfilter, "Kernel TLS not available, not using it: %s",
+		      strerror(errno));
+	goto out_cleanse;
+    }
+
+    sfilter->ktls_fd = fd;
+    rv = true;
+ out_cleanse:
+    OPENSSL_cleanse(&ci, sizeof(ci));
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(iv, sizeof(iv));
+ out:
+    OPENSSL_cleanse(sfilter->ktls_secret, sizeof(sfilter->ktls_secret));
+    sfilter->ktls_secret_len = 0;
+    return rv;
+}
+
+/*
+ * SSL can't send the close alert once the kernel has the transmit
+ * key, send it through the kernel.
+ */
+static bool
+ssl_ktls_send_close(struct ssl_filter *sfilter)
+{
+    unsigned char alert[2] = { 1, 0 }; /* warning, close_notify */
+    char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = alert;
+    iov.iov_len = sizeof(alert);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = SSL3_RT_ALERT;
+
+    return sendmsg(sfilter->ktls_fd, &msg, MSG_DONTWAIT) == sizeof(alert);
+}
+#else
+static bool
+ssl_ktls_start(struct ssl_filter *sfilter)
+{
+    gssl_log_info(sfilter, "kTLS not supported in this build, not using it");
+    return false;
+}
+
+static bool
+ssl_ktls_send_close(struct ssl_filter *sfilter)
+{
+    return false;
+}
+#endif
+
+static int
+ssl_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
+{
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+    int success, rv = GE_INPROGRESS, shutdown, err;
+
+    ssl_lock(sfilter);
+    sfilter->connected = false;
+
+    shutdown = SSL_get_shutdown(sfilter->ssl);
+    shutdown &= SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN;
+    if (shutdown == (SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN)) {
+	/* Shutdown is complete. */
+	rv = 0;
+	goto out_unlock;
+    }
+
+    sfilter->want_read = false;
+    sfilter->want_write = false;
+
+    if (!sfilter->shutdown_success &&
+		sfilter->ktls_state == SSL_KTLS_TX) {
+	if (!ssl_ktls_send_close(sfilter))
+	    gssl_log_info(sfilter, "Unable to send close through kTLS");
+	SSL_set_shutdown(sfilter->ssl,
+			 SSL_get_shutdown(sfilter->ssl) | SSL_SENT_SHUTDOWN);
+	sfilter->shutdown_success = true;
+	if (shutdown & SSL_RECEIVED_SHUTDOWN)
+	    rv = 0;
+	else
+	    sfilter->want_read = true;
+    } else if (!sfilter->shutdown_success) {
+	success = SSL_shutdown(sfilter->ssl);
+	if (success >= 0) {
+	    sfilter->shutdown_success = true;
+	    if (success == 1)
+		rv = 0;
+	    else if (!sfilter->datagram)
+		sfilter->want_read = true;
+	    goto out_unlock;
+	}
+
+	err = SSL_get_error(sfilter->ssl, success);
+	switch (err) {
+	case SSL_ERROR_WANT_READ:
+	    sfilter->want_read = true;
+	    break;
+
+	case SSL_ERROR_WANT_WRITE:
+	    sfilter->want_write = true;
+	    break;
+
+	case SSL_ERROR_SSL:
+	    gssl_logs_err(sfilter, "Failed SSL shutdown");
+	    rv = GE_PROTOERR;
+	    break;
 
 	default:
 	    gssl_log_err(sfilter, "Failed SSL shutdown");
 	    rv = GE_COMMERR;
 	}
+    } else if (sfilter->datagram) {
+	/*
+	 * The remote end's close_notify may be lost on a datagram
+	 * link, so just wait for ours to go out.
+	 */
+	if (!BIO_pending(sfilter->io_bio))
+	    rv = 0;
     } else {
 	/* Waiting to receive the shutdown from the other end. */
 	sfilter->want_read = true;
@@ -462,6 +1447,228 @@ ssl_try_disconnect(struct gensio_filter *filter, gensio_time *timeout)
     return rv;
 }
 
+/*
+ * Call SSL_write() on the data.  If SSL needs I/O, *retry is set
+ * and SSL_write() must be called again later with the same data.
+ */
+static int
+ssl_do_write(struct ssl_filter *sfilter, const void *buf, gensiods len,
+	     bool *retry)
+{
+    int rv;
+
+    *retry = false;
+    sfilter->want_read = false;
+    sfilter->want_write = false;
+    rv = SSL_write(sfilter->ssl, buf, len);
+    if (rv > 0) {
+	assert((gensiods) rv == len);
+	return 0;
+    }
+
+    rv = SSL_get_error(sfilter->ssl, rv);
+    switch (rv) {
+    case SSL_ERROR_WANT_READ:
+	sfilter->want_read = true;
+	*retry = true;
+	return 0;
+
+    case SSL_ERROR_WANT_WRITE:
+	sfilter->want_write = true;
+	*retry = true;
+	return 0;
+
+    case SSL_ERROR_SSL:
+	gssl_logs_err(sfilter, "Failed SSL write");
+	return GE_PROTOERR;
+
+    case SSL_ERROR_ZERO_RETURN:
+	return GE_REMCLOSE;
+
+    default:
+	gssl_log_err(sfilter, "Failed SSL write: %d", rv);
+	return GE_COMMERR;
+    }
+}
+
+#ifdef GENSIO_SSL_DTLS
+/* Record each datagram SSL writes so they can be sent separately. */
+static long
+ssl_dgram_bio_cb(BIO *b, int oper, const char *argp, size_t len,
+		 int argi, long argl, int ret, size_t *processed)
+{
+    struct ssl_filter *sfilter = (struct ssl_filter *) BIO_get_callback_arg(b);
+    unsigned int last;
+
+    if (oper != (BIO_CB_WRITE | BIO_CB_RETURN) || ret <= 0 || !processed ||
+		*processed == 0)
+	return ret;
+
+    if (sfilter->dgram_count < SSL_MAX_DGRAMS) {
+	last = (sfilter->dgram_first + sfilter->dgram_count) % SSL_MAX_DGRAMS;
+	sfilter->dgram_lens[last] = *processed;
+	sfilter->dgram_count++;
+    } else {
+	last = ((sfilter->dgram_first + sfilter->dgram_count - 1) %
+		SSL_MAX_DGRAMS);
+	sfilter->dgram_lens[last] += *processed;
+    }
+    return ret;
+}
+#endif
+
+/*
+ * Send each datagram SSL has written to the lower layer as its own
+ * packet, straight out of the memory BIO.  A packet gensio takes all
+ * of a packet or nothing.
+ */
+static int
+ssl_flush_dgrams(struct ssl_filter *sfilter,
+		 gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    struct gensio_sg sg;
+    gensiods written;
+    char *buf;
+    int err;
+
+    if (BIO_get_mem_data(sfilter->io_bio, &buf) <= 0)
+	return 0;
+
+    while (sfilter->dgram_count > 0) {
+	sg.buf = buf + sfilter->dgram_sent;
+	sg.buflen = sfilter->dgram_lens[sfilter->dgram_first];
+	written = 0;
+	err = handler(cb_data, &written, &sg, 1, NULL);
+	if (err)
+	    return err;
+	if (written == 0)
+	    return 0;
+	sfilter->dgram_sent += sg.buflen;
+	sfilter->dgram_first = (sfilter->dgram_first + 1) % SSL_MAX_DGRAMS;
+	sfilter->dgram_count--;
+    }
+
+    /* Everything is out, empty the BIO. */
+    (void) BIO_reset(sfilter->io_bio);
+    sfilter->dgram_first = 0;
+    sfilter->dgram_sent = 0;
+    return 0;
+}
+
+/*
+ * Send encrypted data to the lower layer straight out of the BIO's
+ * buffer until the BIO is empty or the lower layer won't take any
+ * more.
+ */
+static int
+ssl_flush_xmit(struct ssl_filter *sfilter,
+	       gensio_ul_filter_data_handler handler, void *cb_data)
+{
+    struct gensio_sg sg;
+    gensiods written;
+    char *buf;
+    int len, err;
+
+    if (sfilter->datagram)
+	return ssl_flush_dgrams(sfilter, handler, cb_data);
+
+    for (;;) {
+	len = BIO_nread0(sfilter->io_bio, &buf);
+	if (len <= 0)
+	    return 0;
+
+	if (sfilter->ktls_state == SSL_KTLS_TX) {
+	    /* Key updates and such can't be done with kTLS. */
+	    gssl_log_err(sfilter, "SSL tried to send data while using kTLS");
+	    return GE_PROTOERR;
+	}
+
+	sg.buf = buf;
+	sg.buflen = len;
+	err = handler(cb_data, &written, &sg, 1, NULL);
+	if (err)
+	    return err;
+	if (written > 0)
+	    BIO_nread(sfilter->io_bio, &buf, written);
+	if (written < (gensiods) len)
+	    return 0;
+    }
+}
+
+/* With compaction on, give up the buffers if they are empty. */
+static void
+ssl_compact(struct ssl_filter *sfilter)
+{
+    if (!sfilter->compact)
+	return;
+    if (sfilter->read_data && !sfilter->read_data_len &&
+		!sfilter->in_ul_handler) {
+	memset(sfilter->read_data, 0, sfilter->max_read_size);
+	gensio_os_buf_free(sfilter->o, sfilter->read_data);
+	sfilter->read_data = NULL;
+    }
+    if (sfilter->write_data && !sfilter->write_data_len) {
+	gensio_os_buf_free(sfilter->o, sfilter->write_data);
+	sfilter->write_data = NULL;
+    }
+}
+
+/*
+ * Encrypt one user packet into one record.  Data past what fits in
+ * one datagram is dropped, like other packet gensios.
+ */
+static int
+ssl_write_dgram(struct ssl_filter *sfilter,
+		const struct gensio_sg *sg, gensiods sglen, gensiods *rlen)
+{
+    const unsigned char *buf;
+    gensiods i, len = 0, plen, max = sfilter->max_write_size;
+    bool retry;
+    int err;
+
+#ifdef GENSIO_SSL_DTLS
+    plen = DTLS_get_data_mtu(sfilter->ssl);
+    if (plen && plen < max)
+	max = plen;
+#endif
+
+    if (sglen == 1) {
+	/* The usual case, encrypt from the user's buffer. */
+	buf = sg[0].buf;
+	len = sg[0].buflen;
+	if (len > max)
+	    len = max;
+    } else {
+	err = ssl_buf_get(sfilter, &sfilter->write_data,
+			  sfilter->max_write_size);
+	if (err)
+	    return err;
+	for (i = 0; i < sglen && len < max; i++) {
+	    plen = sg[i].buflen;
+	    if (plen > max - len)
+		plen = max - len;
+	    memcpy(sfilter->write_data + len, sg[i].buf, plen);
+	    len += plen;
+	}
+	buf = sfilter->write_data;
+    }
+
+    *rlen = len;
+    if (len == 0)
+	return 0;
+
+    err = ssl_do_write(sfilter, buf, len, &retry);
+    if (!err && retry)
+	err = ssl_buf_get(sfilter, &sfilter->write_data,
+			  sfilter->max_write_size);
+    if (!err && retry) {
+	if (buf != sfilter->write_data)
+	    memcpy(sfilter->write_data, buf, len);
+	sfilter->write_data_len = len;
+    }
+    return err;
+}
+
 static int
 ssl_ul_write(struct gensio_filter *filter,
 	     gensio_ul_filter_data_handler handler, void *cb_data,
@@ -470,8 +1677,10 @@ ssl_ul_write(struct gensio_filter *filter,
 	     const char *const *auxdata)
 {
     struct ssl_filter *sfilter = filter_to_ssl(filter);
+    gensiods i, pos, len, count = 0;
+    const unsigned char *buf;
+    bool retry;
     int err = 0;
-    gensiods i;
 
     ssl_lock(sfilter);
     if (sfilter->err) {
@@ -484,107 +1693,104 @@ ssl_ul_write(struct gensio_filter *filter,
 	goto out_unlock;
     }
 
-    if (!sfilter->connected) {
-	/* No new data after a close. */
-	if (rcount) {
-	    *rcount = 0;
-	    for (i = 0; i < sglen; i++)
-		*rcount += sg[i].buflen;
-	}
-    } else if (sfilter->write_data_len) {
-	/* Ignore any incoming data if we already have some. */
+    if (sfilter->hs_running) {
+	/* Nothing can go out until the worker is done with the BIO. */
 	if (rcount)
 	    *rcount = 0;
-    } else {
-	for (i = 0; i < sglen; i++) {
-	    gensiods buflen = sg[i].buflen;
-
-	    if (buflen > sfilter->max_write_size - sfilter->write_data_len)
-		buflen = sfilter->max_write_size - sfilter->write_data_len;
-	    memcpy(sfilter->write_data + sfilter->write_data_len,
-		   sg[i].buf, buflen);
-	    sfilter->write_data_len += buflen;
-	}
-	if (rcount)
-	    *rcount = sfilter->write_data_len;
+	goto out_unlock;
     }
 
- restart:
-    if (sfilter->xmit_buf_len) {
-	gensiods written;
-	struct gensio_sg sg = { sfilter->xmit_buf + sfilter->xmit_buf_pos,
-				sfilter->xmit_buf_len - sfilter->xmit_buf_pos };
-
-	err = handler(cb_data, &written, &sg, 1, NULL);
-	if (err) {
-	    sfilter->xmit_buf_len = 0;
-	    sfilter->write_data_len = 0;
-	} else {
-	    sfilter->xmit_buf_pos += written;
-	    if (sfilter->xmit_buf_pos >= sfilter->xmit_buf_len)
-		sfilter->xmit_buf_len = 0;
-	}
+    if (!sfilter->connected) {
+	/* No new data after a close. */
+	for (i = 0; i < sglen; i++)
+	    count += sg[i].buflen;
+	sglen = 0;
     }
 
-    if (!err && sfilter->xmit_buf_len == 0 && sfilter->write_data_len > 0) {
-	sfilter->want_read = false;
-	sfilter->want_write = false;
-	err = SSL_write(sfilter->ssl, sfilter->write_data,
-			sfilter->write_data_len);
-	if (err <= 0) {
-	    err = SSL_get_error(sfilter->ssl, err);
-	    switch (err) {
-	    case SSL_ERROR_WANT_READ:
-		sfilter->want_read = true;
-		err = 0;
-		break;
+    err = ssl_flush_xmit(sfilter, handler, cb_data);
 
-	    case SSL_ERROR_WANT_WRITE:
-		sfilter->want_write = true;
-		err = 0;
-		break;
+    if (!err && sfilter->ktls_state == SSL_KTLS_WAIT && sfilter->connected &&
+		!sfilter->write_data_len && !BIO_pending(sfilter->io_bio)) {
+	if (ssl_ktls_start(sfilter))
+	    sfilter->ktls_state = SSL_KTLS_TX;
+	else
+	    sfilter->ktls_state = SSL_KTLS_OFF;
+    }
 
-	    case SSL_ERROR_SSL:
-		gssl_logs_err(sfilter, "Failed SSL write");
-		err = GE_PROTOERR;
-		sfilter->write_data_len = 0;
-		break;
+    if (!err && sfilter->ktls_state == SSL_KTLS_TX) {
+	/* The kernel does the encryption, pass the data straight down. */
+	if (sglen) {
+	    err = handler(cb_data, &len, sg, sglen, NULL);
+	    if (!err)
+		count += len;
+	}
+	goto out_count;
+    }
 
-	    case SSL_ERROR_ZERO_RETURN:
-		err = GE_REMCLOSE;
-		sfilter->write_data_len = 0;
-		break;
+    /* Finish any write SSL asked to have retried first. */
+    if (!err && sfilter->write_data_len && !BIO_pending(sfilter->io_bio)) {
+	err = ssl_do_write(sfilter, sfilter->write_data,
+			   sfilter->write_data_len, &retry);
+	if (!err && !retry)
+	    sfilter->write_data_len = 0;
+	if (!err)
+	    err = ssl_flush_xmit(sfilter, handler, cb_data);
+    }
 
-	    default:
-		gssl_log_err(sfilter, "Failed SSL write: %d", err);
-		err = GE_COMMERR;
-		sfilter->write_data_len = 0;
+    if (sfilter->datagram) {
+	if (!err && sglen && !sfilter->write_data_len &&
+		!BIO_pending(sfilter->io_bio)) {
+	    err = ssl_write_dgram(sfilter, sg, sglen, &len);
+	    if (!err) {
+		count += len;
+		err = ssl_flush_xmit(sfilter, handler, cb_data);
 	    }
-	} else {
-	    assert((gensiods) err == sfilter->write_data_len);
-	    sfilter->write_data_len = 0;
-	    err = 0;
 	}
+	goto out_count;
     }
 
-    if (!err && sfilter->xmit_buf_len == 0) {
-	int rdlen = BIO_read(sfilter->io_bio, sfilter->xmit_buf,
-			     sfilter->max_xmit_buf);
+    /*
+     * Encrypt directly from the user's buffers.  Only copy the data
+     * if SSL needs the write retried, it must get the same data then.
+     * Stop when the lower layer is full.
+     */
+    for (i = 0, pos = 0; !err && i < sglen && !sfilter->write_data_len; ) {
+	if (pos >= sg[i].buflen) {
+	    i++;
+	    pos = 0;
+	    continue;
+	}
+	if (BIO_pending(sfilter->io_bio))
+	    break;
 
-	if (rdlen <= 0) {
-	    if (!BIO_should_retry(sfilter->io_bio)) {
-		gssl_log_err(sfilter, "Failed BIO read");
-		err = GE_COMMERR;
-	    }
-	} else {
-	    sfilter->xmit_buf_len = rdlen;
-	    sfilter->xmit_buf_pos = 0;
-	    goto restart;
+	buf = ((const unsigned char *) sg[i].buf) + pos;
+	len = sg[i].buflen - pos;
+	if (len > sfilter->max_write_size)
+	    len = sfilter->max_write_size;
+	err = ssl_do_write(sfilter, buf, len, &retry);
+	if (!err && retry)
+	    err = ssl_buf_get(sfilter, &sfilter->write_data,
+			      sfilter->max_write_size);
+	if (err)
+	    break;
+	if (retry) {
+	    memcpy(sfilter->write_data, buf, len);
+	    sfilter->write_data_len = len;
 	}
+	count += len;
+	pos += len;
+	err = ssl_flush_xmit(sfilter, handler, cb_data);
     }
-    if (err)
+
+ out_count:
+    if (rcount)
+	*rcount = count;
+    if (err) {
+	sfilter->write_data_len = 0;
 	sfilter->err = err;
+    }
  out_unlock:
+    ssl_compact(sfilter);
     ssl_unlock(sfilter);
 
     return err;
@@ -615,11 +1821,20 @@ ssl_ll_write(struct gensio_filter *filter,
 	goto out_unlock;
     }
 
+    if (sfilter->hs_running) {
+	/* Leave the data below until the worker is done with the BIO. */
+	if (rcount)
+	    *rcount = 0;
+	goto out_unlock;
+    }
+
     if (buflen > 0) {
-	int wrlen = BIO_write(sfilter->io_bio, buf, buflen);
+	/* A datagram goes into the memory BIO whole. */
+	BIO *bio = sfilter->datagram ? sfilter->in_bio : sfilter->io_bio;
+	int wrlen = BIO_write(bio, buf, buflen);
 
 	if (wrlen <= 0) {
-	    if (!BIO_should_retry(sfilter->io_bio)) {
+	    if (!BIO_should_retry(bio)) {
 		gssl_log_err(sfilter, "Failed BIO write");
 		err = GE_COMMERR;
 		wrlen = buflen;
@@ -629,14 +1844,31 @@ ssl_ll_write(struct gensio_filter *filter,
 	}
 	if (rcount)
 	    *rcount = wrlen;
+	if (wrlen > 0)
+	    sfilter->hs_input = true;
     }
 
+    if (sfilter->hs_async && !sfilter->connected)
+	/* Reading would run the handshake here, leave it to a worker. */
+	goto out_err;
+
+    if (sfilter->early_max && !sfilter->connected)
+	/*
+	 * Reading would run the handshake here and skip the early
+	 * data, the handshake must go through try_connect.
+	 */
+	goto out_err;
+
  process_more:
     if (!sfilter->read_data_len) {
 	int rlen;
 
 	sfilter->want_read = false;
 	sfilter->want_write = false;
+	err = ssl_buf_get(sfilter, &sfilter->read_data,
+			  sfilter->max_read_size);
+	if (err)
+	    goto out_err;
 	rlen = SSL_read(sfilter->ssl, sfilter->read_data,
 			sfilter->max_read_size);
 	if (rlen <= 0) {
@@ -685,18 +1917,22 @@ ssl_ll_write(struct gensio_filter *filter,
     if (!err && sfilter->read_data_len) {
 	gensiods count = 0;
 
+	static const char *const early_auxdata[] = { "early", NULL };
+
 	assert(!sfilter->in_ul_handler);
 	sfilter->in_ul_handler = true;
 	ssl_unlock(sfilter);
 	err = handler(cb_data, &count,
 		      sfilter->read_data + sfilter->read_data_pos,
-		      sfilter->read_data_len, NULL);
+		      sfilter->read_data_len,
+		      sfilter->early_read ? early_auxdata : NULL);
 	ssl_lock(sfilter);
 	sfilter->in_ul_handler = false;
 	if (!err) {
 	    if (count >= sfilter->read_data_len) {
 		sfilter->read_data_len = 0;
 		sfilter->read_data_pos = 0;
+		sfilter->early_read = false;
 		if (!sfilter->err && sfilter->connected)
 		    goto process_more;
 	    } else {
@@ -705,30 +1941,108 @@ ssl_ll_write(struct gensio_filter *filter,
 	    }
 	}
     }
+ out_err:
     if (err && !sfilter->err)
 	sfilter->err = err;
  out_unlock:
+    ssl_compact(sfilter);
     ssl_unlock(sfilter);
 
     return err;
 }
 
+static int
+ssl_setup_dgram(struct ssl_filter *sfilter, struct gensio *io)
+{
+#ifdef GENSIO_SSL_DTLS
+    /*
+     * A BIO pair is a stream, it would lose the datagram boundaries,
+     * so use memory BIOs and track the boundaries as SSL writes.
+     */
+    sfilter->io_bio = BIO_new(BIO_s_mem());
+    sfilter->in_bio = BIO_new(BIO_s_mem());
+    if (!sfilter->io_bio || !sfilter->in_bio) {
+	if (sfilter->io_bio)
+	    BIO_free(sfilter->io_bio);
+	if (sfilter->in_bio)
+	    BIO_free(sfilter->in_bio);
+	sfilter->io_bio = NULL;
+	sfilter->in_bio = NULL;
+	SSL_free(sfilter->ssl);
+	sfilter->ssl = NULL;
+	return GE_NOMEM;
+    }
+    BIO_set_mem_eof_return(sfilter->in_bio, -1);
+    BIO_set_callback_ex(sfilter->io_bio, ssl_dgram_bio_cb);
+    BIO_set_callback_arg(sfilter->io_bio, (char *) sfilter);
+    sfilter->dgram_first = 0;
+    sfilter->dgram_count = 0;
+    sfilter->dgram_sent = 0;
+
+    /* SSL owns both BIOs after this. */
+    SSL_set_bio(sfilter->ssl, sfilter->in_bio, sfilter->io_bio);
+
+    /* There's no socket to ask, use the configured MTU. */
+    SSL_set_options(sfilter->ssl, SSL_OP_NO_QUERY_MTU);
+    SSL_set_mtu(sfilter->ssl, sfilter->mtu);
+
+    sfilter->io = io;
+    SSL_set_app_data(sfilter->ssl, sfilter);
+
+    if (sfilter->is_client)
+	SSL_set_connect_state(sfilter->ssl);
+    else
+	SSL_set_accept_state(sfilter->ssl);
+
+    return 0;
+#else
+    SSL_free(sfilter->ssl);
+    sfilter->ssl = NULL;
+    return GE_NOTSUP;
+#endif
+}
+
 static int
 ssl_setup(struct gensio_filter *filter, struct gensio *io)
 {
     struct ssl_filter *sfilter = filter_to_ssl(filter);
     int success;
     gensiods bio_size = sfilter->max_read_size * 2;
+    bool busy;
+
+    ssl_lock(sfilter);
+    /* A worker may still be finishing a handshake from the last open. */
+    busy = sfilter->hs_running;
+    ssl_unlock(sfilter);
+    if (busy)
+	return GE_INUSE;
 
     sfilter->ssl = SSL_new(sfilter->ctx);
     if (!sfilter->ssl)
 	return GE_NOMEM;
 
+    /* Retried writes come from write_data, not the user's buffer. */
+    SSL_set_mode(sfilter->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    if (sfilter->compact)
+	/* Have OpenSSL free its record buffers when they are empty, too. */
+	SSL_set_mode(sfilter->ssl, SSL_MODE_RELEASE_BUFFERS);
+
+    if (sfilter->datagram)
+	return ssl_setup_dgram(sfilter, io);
+
+    /*
+     * Make room for all the records from a full write, so they can go
+     * to the lower layer in one write.
+     */
+    if (bio_size < sfilter->max_write_size * 2)
+	bio_size = sfilter->max_write_size * 2;
+
     /* The BIO has to be large enough to hold a full SSL key transaction. */
     if (bio_size < 4096)
 	bio_size = 4096;
     success = BIO_new_bio_pair(&sfilter->ssl_bio, bio_size,
 			       &sfilter->io_bio, bio_size);
+    sfilter->bio_size = bio_size;
     if (!success) {
 	SSL_free(sfilter->ssl);
 	sfilter->ssl = NULL;
@@ -737,6 +2051,20 @@ ssl_setup(struct gensio_filter *filter, struct gensio *io)
 
     SSL_set_bio(sfilter->ssl, sfilter->ssl_bio, sfilter->ssl_bio);
 
+    sfilter->io = io;
+    SSL_set_app_data(sfilter->ssl, sfilter);
+    if (sfilter->ktls) {
+	sfilter->ktls_state = SSL_KTLS_WAIT;
+#ifdef GENSIO_SSL_KTLS
+	/*
+	 * Session tickets would be sent after the handshake, and the
+	 * kernel must start with the first application record.
+	 */
+	if (!sfilter->is_client)
+	    SSL_set_num_tickets(sfilter->ssl, 0);
+#endif
+    }
+
     if (sfilter->is_client)
 	SSL_set_connect_state(sfilter->ssl);
     else
@@ -746,32 +2074,76 @@ ssl_setup(struct gensio_filter *filter, struct gensio *io)
 }
 
 static void
-ssl_cleanup(struct gensio_filter *filter)
+ssl_do_cleanup(struct ssl_filter *sfilter)
 {
-    struct ssl_filter *sfilter = filter_to_ssl(filter);
-
     if (sfilter->verify_store)
 	X509_STORE_free(sfilter->verify_store);
     sfilter->verify_store = NULL;
     if (sfilter->remcert)
 	X509_free(sfilter->remcert);
     sfilter->remcert = NULL;
-    if (sfilter->ssl)
+    if (sfilter->ssl) {
+	/*
+	 * If the remote end closed cleanly the session is still good,
+	 * but SSL_free() throws a session out of the cache if we never
+	 * sent our close.  That breaks resumption with the stateful
+	 * tickets used when early data is on.
+	 */
+	if (SSL_get_shutdown(sfilter->ssl) & SSL_RECEIVED_SHUTDOWN)
+	    SSL_set_shutdown(sfilter->ssl,
+			     SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
 	SSL_free(sfilter->ssl);
+    }
     sfilter->ssl = NULL;
-    if (sfilter->io_bio)
+    if (sfilter->io_bio && !sfilter->datagram)
 	/* Just free one BIO to free both parts of the pair. */
 	BIO_free(sfilter->io_bio);
     sfilter->ssl_bio = NULL;
     sfilter->io_bio = NULL;
+    sfilter->in_bio = NULL;
+    sfilter->dgram_first = 0;
+    sfilter->dgram_count = 0;
+    sfilter->dgram_sent = 0;
     sfilter->err = 0;
     sfilter->read_data_len = 0;
     sfilter->read_data_pos = 0;
-    sfilter->xmit_buf_len = 0;
-    sfilter->xmit_buf_pos = 0;
     sfilter->write_data_len = 0;
     sfilter->connected = false;
     sfilter->shutdown_success = false;
+    sfilter->started = false;
+    if (sfilter->sess_key)
+	sfilter->o->free(sfilter->o, sfilter->sess_key);
+    sfilter->sess_key = NULL;
+    sfilter->ktls_state = SSL_KTLS_OFF;
+#ifdef GENSIO_SSL_KTLS
+    OPENSSL_cleanse(sfilter->ktls_secret, sizeof(sfilter->ktls_secret));
+    sfilter->ktls_secret_len = 0;
+#endif
+    sfilter->want_read = false;
+    sfilter->want_write = false;
+    sfilter->hs_done = false;
+    sfilter->hs_input = false;
+    sfilter->early_done = false;
+    sfilter->early_read = false;
+    sfilter->early_accepted = false;
+    if (sfilter->early_data)
+	sfilter->o->free(sfilter->o, sfilter->early_data);
+    sfilter->early_data = NULL;
+    sfilter->early_len = 0;
+}
+
+static void
+ssl_cleanup(struct gensio_filter *filter)
+{
+    struct ssl_filter *sfilter = filter_to_ssl(filter);
+
+    ssl_lock(sfilter);
+    if (sfilter->hs_running)
+	/* The worker has the SSL, it will clean up when it is done. */
+	sfilter->hs_cleanup = true;
+    else
+	ssl_do_cleanup(sfilter);
+    ssl_unlock(sfilter);
 }
 
 static void
@@ -783,21 +2155,25 @@ sfilter_free(struct ssl_filter *sfilter)
 	X509_free(sfilter->remcert);
     if (sfilter->ssl)
 	SSL_free(sfilter->ssl);
-    if (sfilter->io_bio)
+    if (sfilter->io_bio && !sfilter->datagram)
 	/* Just free one BIO to free both parts of the pair. */
 	BIO_free(sfilter->io_bio);
     if (sfilter->ctx)
 	SSL_CTX_free(sfilter->ctx);
+    if (sfilter->sess_prefix)
+	sfilter->o->free(sfilter->o, sfilter->sess_prefix);
+    if (sfilter->sess_key)
+	sfilter->o->free(sfilter->o, sfilter->sess_key);
     if (sfilter->lock)
 	sfilter->o->free_lock(sfilter->lock);
     if (sfilter->read_data) {
 	memset(sfilter->read_data, 0, sfilter->max_read_size);
-	sfilter->o->free(sfilter->o, sfilter->read_data);
+	gensio_os_buf_free(sfilter->o, sfilter->read_data);
     }
-    if (sfilter->xmit_buf)
-	sfilter->o->free(sfilter->o, sfilter->xmit_buf);
     if (sfilter->write_data)
-	sfilter->o->free(sfilter->o, sfilter->write_data);
+	gensio_os_buf_free(sfilter->o, sfilter->write_data);
+    if (sfilter->early_data)
+	sfilter->o->free(sfilter->o, sfilter->early_data);
     if (sfilter->filter)
 	gensio_filter_free_data(sfilter->filter);
     sfilter->o->free(sfilter->o, sfilter);
@@ -921,6 +2297,79 @@ gensio_cert_fingerprint(X509 *cert, char *buf, gensiods *buflen)
     return 0;
 }
 
+/*
+ * Report the buffers held, or turn on compaction.  OpenSSL's own
+ * allocations aren't counted, the BIO pair is counted once set up.
+ */
+static int
+ssl_mem_control(struct ssl_filter *sfilter, bool get, char *data,
+		gensiods *datalen)
+{
+    gensiods size = sizeof(*sfilter);
+
+    ssl_lock(sfilter);
+    if (!get) {
+	if (strtoul(data, NULL, 0)) {
+	    sfilter->compact = true;
+	    if (sfilter->ssl)
+		SSL_set_mode(sfilter->ssl, SSL_MODE_RELEASE_BUFFERS);
+	    ssl_compact(sfilter);
+	}
+	ssl_unlock(sfilter);
+	return 0;
+    }
+    if (sfilter->read_data)
+	size += sfilter->max_read_size;
+    if (sfilter->write_data)
+	size += sfilter->max_write_size;
+    if (sfilter->io_bio && !sfilter->datagram)
+	size += sfilter->bio_size * 2;
+    ssl_unlock(sfilter);
+    *datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+    return 0;
+}
+
+static int
+ssl_early_control(struct ssl_filter *sfilter, bool get, char *data,
+		  gensiods *datalen)
+{
+#ifdef TLS1_3_VERSION
+    unsigned char *early;
+    int rv = 0;
+
+    if (get) {
+	*datalen = snprintf(data, *datalen, "%d", sfilter->early_accepted);
+	return 0;
+    }
+
+    if (!sfilter->is_client || sfilter->datagram)
+	return GE_NOTSUP;
+    if (*datalen > sfilter->max_write_size)
+	return GE_TOOBIG;
+
+    early = sfilter->o->zalloc(sfilter->o, *datalen ? *datalen : 1);
+    if (!early)
+	return GE_NOMEM;
+    memcpy(early, data, *datalen);
+
+    ssl_lock(sfilter);
+    if (sfilter->started) {
+	/* The first flight is already gone. */
+	rv = GE_NOTREADY;
+	sfilter->o->free(sfilter->o, early);
+    } else {
+	if (sfilter->early_data)
+	    sfilter->o->free(sfilter->o, sfilter->early_data);
+	sfilter->early_data = early;
+	sfilter->early_len = *datalen;
+    }
+    ssl_unlock(sfilter);
+    return rv;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
 static int
 ssl_filter_control(struct gensio_filter *filter, bool get, int op, char *data,
 		   gensiods *datalen)
@@ -1007,6 +2456,42 @@ ssl_filter_control(struct gensio_filter *filter, bool get, int op, char *data,
 			    (unsigned long) sfilter->max_write_size);
 	return 0;
 
+    case GENSIO_CONTROL_MEM:
+	return ssl_mem_control(sfilter, get, data, datalen);
+
+    case GENSIO_CONTROL_EARLY_DATA:
+	return ssl_early_control(sfilter, get, data, datalen);
+
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	ssl_lock(sfilter);
+	if (!sfilter->ssl || sfilter->hs_running) {
+	    ssl_unlock(sfilter);
+	    return GE_NOTREADY;
+	}
+	*datalen = snprintf(data, *datalen, "version=%s resumed=%d",
+			    SSL_get_version(sfilter->ssl),
+			    SSL_session_reused(sfilter->ssl));
+	ssl_unlock(sfilter);
+	return 0;
+
+    case GENSIO_CONTROL_RAW_FD: {
+	int fd = -1;
+
+	/* With kTLS, plaintext written to the socket gets encrypted. */
+	if (!get)
+	    return GE_NOTSUP;
+	ssl_lock(sfilter);
+	if (sfilter->ktls_state == SSL_KTLS_TX)
+	    fd = sfilter->ktls_fd;
+	ssl_unlock(sfilter);
+	if (fd < 0)
+	    return GE_NOTSUP;
+	*datalen = snprintf(data, *datalen, "-1 %d", fd);
+	return 0;
+    }
+
     default:
 	return GE_NOTSUP;
     }
@@ -1080,7 +2565,10 @@ static int gensio_ssl_filter_func(struct gensio_filter *filter, int op,
 static int
 gensio_ssl_cert_verify(X509_STORE_CTX *ctx, void *cb_data)
 {
-    struct ssl_filter *sfilter = cb_data;
+    int ssl_ex_idx = SSL_get_ex_data_X509_STORE_CTX_idx();
+    SSL *s = X509_STORE_CTX_get_ex_data(ctx, ssl_ex_idx);
+    /* The context is shared, so get the filter from the connection. */
+    struct ssl_filter *sfilter = SSL_get_app_data(s);
     X509_STORE_CTX *nctx = NULL;
     X509 *cert = X509_STORE_CTX_get0_cert(ctx);
     int rv;
@@ -1100,8 +2588,6 @@ gensio_ssl_cert_verify(X509_STORE_CTX *ctx, void *cb_data)
 
     if (sfilter->verify_store) {
 	STACK_OF(X509) *cert_chain = X509_STORE_CTX_get0_chain(ctx);
-	int ssl_ex_idx = SSL_get_ex_data_X509_STORE_CTX_idx();
-	SSL *s = X509_STORE_CTX_get_ex_data(ctx, ssl_ex_idx);
 	X509_VERIFY_PARAM *param;
 
 	rv = -1;
@@ -1149,7 +2635,13 @@ gensio_ssl_filter_raw_alloc(struct gensio_os_funcs *o,
 			    bool allow_authfail,
 			    gensiods max_read_size,
 			    gensiods max_write_size,
-			    gensio_time con_timeout)
+			    bool ktls,
+			    char *sess_prefix,
+			    gensio_time con_timeout,
+			    bool datagram,
+			    gensiods mtu,
+			    bool hs_async,
+			    gensiods early_max)
 {
     struct ssl_filter *sfilter;
 
@@ -1164,28 +2656,25 @@ gensio_ssl_filter_raw_alloc(struct gensio_os_funcs *o,
     sfilter->expect_peer_cert = expect_peer_cert;
     sfilter->allow_authfail = allow_authfail;
     sfilter->con_timeout = con_timeout;
-
-    SSL_CTX_set_cert_verify_callback(ctx, gensio_ssl_cert_verify, sfilter);
+    sfilter->ktls = ktls;
+    sfilter->ktls_fd = -1;
+    sfilter->datagram = datagram;
+    sfilter->mtu = mtu;
+    sfilter->hs_async = hs_async;
+    sfilter->early_max = early_max;
 
     sfilter->lock = o->alloc_lock(o);
     if (!sfilter->lock)
 	goto out_nomem;
 
-    sfilter->read_data = o->zalloc(o, sfilter->max_read_size);
+    sfilter->read_data = gensio_os_buf_alloc(o, sfilter->max_read_size);
     if (!sfilter->read_data)
 	goto out_nomem;
 
-    sfilter->write_data = o->zalloc(o, sfilter->max_write_size);
+    sfilter->write_data = gensio_os_buf_alloc(o, sfilter->max_write_size);
     if (!sfilter->write_data)
 	goto out_nomem;
 
-    sfilter->max_xmit_buf = sfilter->max_write_size + 128;
-    if (sfilter->max_xmit_buf < 1024)
-	sfilter->max_xmit_buf = 1024; /* Enough room for the protocol. */
-    sfilter->xmit_buf = o->zalloc(o, sfilter->max_xmit_buf);
-    if (!sfilter->xmit_buf)
-	goto out_nomem;
-
     sfilter->filter = gensio_filter_alloc_data(o, gensio_ssl_filter_func,
 					       sfilter);
     if (!sfilter->filter)
@@ -1193,9 +2682,11 @@ gensio_ssl_filter_raw_alloc(struct gensio_os_funcs *o,
 
     /*
      * Delay setting this so that it's not freed if there is a memory
-     * allocation error.  The caller passed it in, they should free it.
+     * allocation error.  The caller passed in a reference, they should
+     * free it.  Same with sess_prefix.
      */
     sfilter->ctx = ctx;
+    sfilter->sess_prefix = sess_prefix;
     return sfilter->filter;
 
  out_nomem:
@@ -1203,25 +2694,36 @@ gensio_ssl_filter_raw_alloc(struct gensio_os_funcs *o,
     return NULL;
 }
 
-int
-gensio_ssl_filter_config(struct gensio_pparm_info *p,
-			 struct gensio_os_funcs *o,
-			 const char * const args[],
-			 bool default_is_client,
-			 struct gensio_ssl_filter_data **rdata)
+static int
+ssl_filter_config(struct gensio_pparm_info *p,
+		  struct gensio_os_funcs *o,
+		  const char * const args[],
+		  bool default_is_client,
+		  bool datagram,
+		  struct gensio_ssl_filter_data **rdata)
 {
     unsigned int i;
     struct gensio_ssl_filter_data *data = o->zalloc(o, sizeof(*data));
     int rv = GE_NOMEM, ival;
     char *str;
     const char *cstr;
+    bool session_cache_set = false;
 
     if (!data)
 	return GE_NOMEM;
     data->o = o;
+    data->lock = o->alloc_lock(o);
+    if (!data->lock) {
+	o->free(o, data);
+	return GE_NOMEM;
+    }
     data->is_client = default_is_client;
     data->max_write_size = SSL3_RT_MAX_PLAIN_LENGTH;
     data->max_read_size = SSL3_RT_MAX_PLAIN_LENGTH;
+    data->session_cache = SSL_SESSION_CACHE_MAX_SIZE_DEFAULT;
+    data->session_timeout.secs = 300;
+    data->datagram = datagram;
+    data->mtu = 1200;
 
     rv = gensio_get_default(o, "ssl", "allow-authfail", false,
 			    GENSIO_DEFAULT_BOOL, NULL, &ival);
@@ -1285,6 +2787,8 @@ gensio_ssl_filter_config(struct gensio_pparm_info *p,
 	    continue;
 	if (gensio_pparm_ds(p, args[i], "writebuf", &data->max_write_size) > 0)
 	    continue;
+	if (gensio_pparm_ds(p, args[i], "record-size", &data->record_size) > 0)
+	    continue;
 	if (gensio_pparm_boolv(p, args[i], "mode", "client", "server",
 				  &data->is_client) > 0)
 	    continue;
@@ -1294,9 +2798,29 @@ gensio_ssl_filter_config(struct gensio_pparm_info *p,
 	if (gensio_pparm_bool(p, args[i], "clientauth",
 				 &data->clientauth) > 0)
 	    continue;
+	if (gensio_pparm_bool(p, args[i], "ktls", &data->ktls) > 0)
+	    continue;
+	if (gensio_pparm_bool(p, args[i], "resume", &data->resume) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "session-cache",
+			    &data->session_cache) > 0) {
+	    session_cache_set = true;
+	    continue;
+	}
+	if (gensio_pparm_time(p, args[i], "session-timeout", 's',
+			      &data->session_timeout) > 0)
+	    continue;
 	if (gensio_pparm_time(p, args[i], "con-timeout", 's',
 			      &data->con_timeout) > 0)
 	    continue;
+	if (datagram && gensio_pparm_ds(p, args[i], "mtu", &data->mtu) > 0)
+	    continue;
+	if (!datagram && gensio_pparm_uint(p, args[i], "handshake-threads",
+					   &data->handshake_threads) > 0)
+	    continue;
+	if (!datagram && gensio_pparm_ds(p, args[i], "early-data",
+					 &data->early_data) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(p, args[i]);
 	rv = GE_INVAL;
 	goto out_err;
@@ -1321,6 +2845,46 @@ gensio_ssl_filter_config(struct gensio_pparm_info *p,
 	    goto out_err;
     }
 
+    /*
+     * A resumed session skips certificate verification, including the
+     * PRECERT_VERIFY event, so don't resume authenticated clients
+     * unless asked to.
+     */
+    if (data->clientauth && !session_cache_set)
+	data->session_cache = 0;
+
+    if (data->max_write_size == 0) {
+	gensio_pparm_slog(p, "writebuf cannot be zero");
+	rv = GE_INVAL;
+	goto out_err;
+    }
+
+    if (datagram) {
+#ifndef GENSIO_SSL_DTLS
+	gensio_pparm_slog(p, "DTLS requires OpenSSL 1.1.1 or later");
+	rv = GE_NOTSUP;
+	goto out_err;
+#endif
+	if (data->ktls || data->resume) {
+	    gensio_pparm_slog(p, "ktls and resume are not supported on DTLS");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+	if (data->mtu < 256 || data->mtu > 65535) {
+	    gensio_pparm_slog(p, "mtu must be from 256 to 65535");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+    }
+
+    if (data->record_size && (data->record_size < 512 ||
+			      data->record_size > SSL3_RT_MAX_PLAIN_LENGTH)) {
+	gensio_pparm_slog(p, "record-size must be from 512 to %d",
+			  SSL3_RT_MAX_PLAIN_LENGTH);
+	rv = GE_INVAL;
+	goto out_err;
+    }
+
     if (!data->is_client) {
 	if (!data->keyfile) {
 	    gensio_pparm_slog(p, "key must be specified for clients");
@@ -1329,6 +2893,30 @@ gensio_ssl_filter_config(struct gensio_pparm_info *p,
 	}
     }
 
+    if (data->early_data) {
+#ifndef TLS1_3_VERSION
+	gensio_pparm_slog(p, "early-data requires TLS 1.3");
+	rv = GE_NOTSUP;
+	goto out_err;
+#endif
+	if (data->is_client) {
+	    gensio_pparm_slog(p, "early-data is only for servers, clients"
+			      " use GENSIO_CONTROL_EARLY_DATA");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+	if (!data->session_cache) {
+	    gensio_pparm_slog(p, "early-data requires a session-cache");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+	if (data->early_data > data->max_read_size) {
+	    gensio_pparm_slog(p, "early-data cannot be larger than readbuf");
+	    rv = GE_INVAL;
+	    goto out_err;
+	}
+    }
+
     if (data->keyfile && !data->certfile) {
 	data->certfile = gensio_strdup(o, data->keyfile);
 	if (!data->certfile) {
@@ -1347,10 +2935,31 @@ gensio_ssl_filter_config(struct gensio_pparm_info *p,
 	o->free(o, data->keyfile);
     if (data->certfile)
 	o->free(o, data->certfile);
+    o->free_lock(data->lock);
     o->free(o, data);
     return rv;
 }
 
+int
+gensio_ssl_filter_config(struct gensio_pparm_info *p,
+			 struct gensio_os_funcs *o,
+			 const char * const args[],
+			 bool default_is_client,
+			 struct gensio_ssl_filter_data **rdata)
+{
+    return ssl_filter_config(p, o, args, default_is_client, false, rdata);
+}
+
+int
+gensio_dtls_filter_config(struct gensio_pparm_info *p,
+			  struct gensio_os_funcs *o,
+			  const char * const args[],
+			  bool default_is_client,
+			  struct gensio_ssl_filter_data **rdata)
+{
+    return ssl_filter_config(p, o, args, default_is_client, true, rdata);
+}
+
 void
 gensio_ssl_filter_config_free(struct gensio_ssl_filter_data *data)
 {
@@ -1366,32 +2975,129 @@ gensio_ssl_filter_config_free(struct gensio_ssl_filter_data *data)
 	o->free(o, data->keyfile);
     if (data->certfile)
 	o->free(o, data->certfile);
+    if (data->ctx)
+	SSL_CTX_free(data->ctx);
+    o->free_lock(data->lock);
     o->free(o, data);
 }
 
-int
-gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
-			struct gensio_filter **rfilter)
+#ifdef GENSIO_SSL_DTLS
+/*
+ * The cookie is an HMAC of the remote address, so only something that
+ * can receive at that address can continue the handshake.
+ */
+static int
+ssl_dtls_cookie_calc(SSL *ssl, unsigned char *cookie, unsigned int *cookie_len)
+{
+    struct ssl_filter *sfilter = SSL_get_app_data(ssl);
+    struct gensio *child;
+    char raddr[200];
+    gensiods len = sizeof(raddr);
+
+    if (!sfilter || !ssl_cookie_secret_ok)
+	return 0;
+    child = gensio_get_child(sfilter->io, 1);
+    if (!child)
+	return 0;
+    strcpy(raddr, "0");
+    if (gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST, GENSIO_CONTROL_GET,
+		       GENSIO_CONTROL_RADDR, raddr, &len))
+	return 0;
+    if (!HMAC(EVP_sha256(), ssl_cookie_secret, sizeof(ssl_cookie_secret),
+	      (unsigned char *) raddr, strlen(raddr), cookie, cookie_len))
+	return 0;
+    return 1;
+}
+
+static int
+ssl_dtls_cookie_generate(SSL *ssl, unsigned char *cookie,
+			 unsigned int *cookie_len)
+{
+    return ssl_dtls_cookie_calc(ssl, cookie, cookie_len);
+}
+
+static int
+ssl_dtls_cookie_verify(SSL *ssl, const unsigned char *cookie,
+		       unsigned int cookie_len)
+{
+    unsigned char expected[EVP_MAX_MD_SIZE];
+    unsigned int expected_len;
+
+    if (!ssl_dtls_cookie_calc(ssl, expected, &expected_len))
+	return 0;
+    return (cookie_len == expected_len &&
+	    CRYPTO_memcmp(cookie, expected, expected_len) == 0);
+}
+#endif
+
+static int
+gensio_ssl_ctx_alloc(struct gensio_ssl_filter_data *data, SSL_CTX **rctx)
 {
-    struct gensio_os_funcs *o = data->o;
     SSL_CTX *ctx = NULL;
-    struct gensio_filter *filter;
-    bool expect_peer_cert;
     int rv = GE_INVAL;
 
-    gensio_ssl_initialize(o);
-
-    if (data->is_client) {
-	expect_peer_cert = true;
+#ifdef GENSIO_SSL_DTLS
+    if (data->datagram) {
+	if (data->is_client)
+	    ctx = SSL_CTX_new(DTLS_client_method());
+	else
+	    ctx = SSL_CTX_new(DTLS_server_method());
+    } else
+#endif
+    if (data->is_client)
 	ctx = SSL_CTX_new(SSLv23_client_method());
-    } else {
-	expect_peer_cert = data->clientauth;
+    else
 	ctx = SSL_CTX_new(SSLv23_server_method());
-    }
     if (!ctx)
 	return GE_NOMEM;
 
-    if (!data->is_client && expect_peer_cert)
+#ifdef GENSIO_SSL_DTLS
+    if (data->datagram && !data->is_client) {
+	SSL_CTX_set_cookie_generate_cb(ctx, ssl_dtls_cookie_generate);
+	SSL_CTX_set_cookie_verify_cb(ctx, ssl_dtls_cookie_verify);
+	SSL_CTX_set_options(ctx, SSL_OP_COOKIE_EXCHANGE);
+    }
+#endif
+
+    SSL_CTX_set_cert_verify_callback(ctx, gensio_ssl_cert_verify, NULL);
+
+    if (!data->is_client) {
+	/* Required for resumption if the client is verified. */
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "gensio",
+				       6);
+	SSL_CTX_set_timeout(ctx, data->session_timeout.secs);
+	if (data->session_cache) {
+	    SSL_CTX_sess_set_cache_size(ctx, data->session_cache);
+	} else {
+	    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+#ifdef TLS1_3_VERSION
+	    SSL_CTX_set_num_tickets(ctx, 0);
+#endif
+	}
+#ifdef TLS1_3_VERSION
+	if (data->early_data) {
+	    SSL_CTX_set_max_early_data(ctx, data->early_data);
+	    SSL_CTX_set_recv_max_early_data(ctx, data->early_data);
+	}
+#endif
+    } else if (data->resume) {
+	/* Sessions are kept in our store so they outlive the gensio. */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+				       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, ssl_new_session_cb);
+    }
+
+    if (data->record_size)
+	SSL_CTX_set_max_send_fragment(ctx, data->record_size);
+
+#ifdef GENSIO_SSL_KTLS
+    if (data->ktls)
+	/* The traffic secrets are needed to set up the kernel. */
+	SSL_CTX_set_keylog_callback(ctx, ssl_ktls_keylog);
+#endif
+
+    if (!data->is_client && data->clientauth)
 	/*
 	 * In server mode, the certificate will not be requested unless
 	 * mode is SSL_VERIFY_PEER.  But in that mode, it terminates
@@ -1432,22 +3138,112 @@ gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
 	}
     }
 
+    *rctx = ctx;
+    return 0;
+
+ err:
+    SSL_CTX_free(ctx);
+    return rv;
+}
+
+int
+gensio_ssl_filter_reload(struct gensio_ssl_filter_data *data)
+{
+    struct gensio_os_funcs *o = data->o;
+    SSL_CTX *ctx, *oldctx;
+    int rv;
+
+    gensio_ssl_initialize(o);
+
+    rv = gensio_ssl_ctx_alloc(data, &ctx);
+    if (rv)
+	return rv;
+
+    /*
+     * Filters that are already running keep their reference to the
+     * old context, only new ones get the new one.
+     */
+    o->lock(data->lock);
+    oldctx = data->ctx;
+    data->ctx = ctx;
+    o->unlock(data->lock);
+    if (oldctx)
+	SSL_CTX_free(oldctx);
+    return 0;
+}
+
+int
+gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
+			struct gensio_filter **rfilter)
+{
+    struct gensio_os_funcs *o = data->o;
+    SSL_CTX *ctx = NULL;
+    struct gensio_filter *filter;
+    bool expect_peer_cert;
+    char *sess_prefix = NULL;
+    bool hs_async = false;
+    int rv = 0;
+
+    gensio_ssl_initialize(o);
+
+    if (data->is_client)
+	expect_peer_cert = true;
+    else
+	expect_peer_cert = data->clientauth;
+
+    o->lock(data->lock);
+    if (!data->ctx)
+	rv = gensio_ssl_ctx_alloc(data, &data->ctx);
+    if (!rv) {
+	ctx = data->ctx;
+	SSL_CTX_up_ref(ctx);
+    }
+    o->unlock(data->lock);
+    if (rv)
+	return rv;
+
+    if (data->is_client && data->resume) {
+	sess_prefix = gensio_alloc_sprintf(o, "%s;%s;%s",
+			data->CAfilepath ? data->CAfilepath : "",
+			data->certfile ? data->certfile : "",
+			data->keyfile ? data->keyfile : "");
+	if (!sess_prefix) {
+	    SSL_CTX_free(ctx);
+	    return GE_NOMEM;
+	}
+    }
+
+    if (data->handshake_threads) {
+	rv = ssl_hs_pool_grow(data->handshake_threads);
+	if (rv == GE_NOTSUP) {
+	    /* No workers with this os handler, just do it inline. */
+	    rv = 0;
+	} else if (rv) {
+	    if (sess_prefix)
+		o->free(o, sess_prefix);
+	    SSL_CTX_free(ctx);
+	    return rv;
+	} else {
+	    hs_async = true;
+	}
+    }
+
     filter = gensio_ssl_filter_raw_alloc(o, data->is_client, ctx,
 					 expect_peer_cert,
 					 data->allow_authfail,
 					 data->max_read_size,
 					 data->max_write_size,
-					 data->con_timeout);
+					 data->ktls, sess_prefix,
+					 data->con_timeout,
+					 data->datagram, data->mtu,
+					 hs_async, data->early_data);
     if (!filter) {
-	rv = GE_NOMEM;
-	goto err;
+	if (sess_prefix)
+	    o->free(o, sess_prefix);
+	SSL_CTX_free(ctx);
+	return GE_NOMEM;
     }
 
-
     *rfilter = filter;
     return 0;
-
- err:
-    SSL_CTX_free(ctx);
-    return rv;
 }
@@ -19,9 +19,25 @@ int gensio_ssl_filter_config(struct gensio_pparm_info *p,
 			     bool default_is_client,
 			     struct gensio_ssl_filter_data **data);
 
+/*
+ * Like the above, but for DTLS over a packet gensio.  The filter
+ * allocated from this keeps packet boundaries.
+ */
+int gensio_dtls_filter_config(struct gensio_pparm_info *p,
+			      struct gensio_os_funcs *o,
+			      const char * const args[],
+			      bool default_is_client,
+			      struct gensio_ssl_filter_data **data);
+
 void gensio_ssl_filter_config_free(struct gensio_ssl_filter_data *data);
 
 int gensio_ssl_filter_alloc(struct gensio_ssl_filter_data *data,
 			    struct gensio_filter **rfilter);
 
+/*
+ * Re-read the key, cert and CA files.  Filters allocated after this
+ * use the new values, existing filters are not affected.
+ */
+int gensio_ssl_filter_reload(struct gensio_ssl_filter_data *data);
+
 #endif /* GENSIO_FILTER_SSL_H */
@@ -58,6 +58,9 @@ struct telnet_filter {
      */
     enum telnet_write_state write_state;
 
+    /* If non-zero, don't write telnet commands, see hold_output. */
+    unsigned int output_held;
+
     struct telnet_data_s tn_data;
 
     /* Data waiting to be delivered to the user. */
@@ -132,7 +135,8 @@ telnet_ll_write_pending(struct gensio_filter *filter)
 
     telnet_lock(tfilter);
     rv = tfilter->write_data_len ||
-	gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd);
+	(!tfilter->output_held &&
+	 gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd));
     telnet_unlock(tfilter);
     return rv;
 }
@@ -218,22 +222,39 @@ telnet_ul_write(struct gensio_filter *filter,
     int err = 0;
 
     telnet_lock(tfilter);
-    if (tfilter->write_data_len) {
+    if (tfilter->write_data_len &&
+		gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd)) {
+	/* Don't hold off telnet commands by adding more user data. */
 	if (rcount)
 	    *rcount = 0;
     } else {
-	gensiods i, writelen = 0;
+	gensiods i, room, writelen = 0;
 
+	/*
+	 * Add the new data after anything the lower layer hasn't
+	 * taken yet, so a series of small writes while the lower
+	 * layer is busy goes out in one write instead of each
+	 * becoming its own.
+	 */
+	if (sglen && tfilter->write_data_pos) {
+	    memmove(tfilter->write_data,
+		    tfilter->write_data + tfilter->write_data_pos,
+		    tfilter->write_data_len);
+	    tfilter->write_data_pos = 0;
+	}
 	for (i = 0; i < sglen; i++) {
 	    size_t inlen = sg[i].buflen;
 	    const unsigned char *buf = sg[i].buf;
 
-	    tfilter->write_data_len =
-		process_telnet_xmit(tfilter->write_data,
-				    tfilter->max_write_size,
+	    room = tfilter->max_write_size - tfilter->write_data_len;
+	    if (room == 0)
+		break;
+	    tfilter->write_data_len +=
+		process_telnet_xmit(tfilter->write_data +
+				    tfilter->write_data_len, room,
 				    &buf, &inlen);
 	    writelen += sg[i].buflen - inlen;
-	    if (inlen != sg[i].buflen)
+	    if (inlen != 0)
 		break;
 	}
 	if (rcount)
@@ -241,6 +262,7 @@ telnet_ul_write(struct gensio_filter *filter,
     }
 
     if (tfilter->write_state != TELNET_IN_USER_WRITE &&
+		!tfilter->output_held &&
 		gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd)) {
 	struct telnet_buffer_data data = { handler, cb_data, auxdata };
 
@@ -655,8 +677,9 @@ static void telnet_filter_send_option(struct gensio_filter *filter,
 
     telnet_lock(tfilter);
     telnet_send_option(&tfilter->tn_data, buf, len);
-    tfilter->filter_cb(tfilter->filter_cb_data,
-		       GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    if (!tfilter->output_held)
+	tfilter->filter_cb(tfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
     telnet_unlock(tfilter);
 }
 
@@ -668,8 +691,26 @@ static void telnet_filter_send_cmd(struct gensio_filter *filter,
 
     telnet_lock(tfilter);
     telnet_cmd_send(&tfilter->tn_data, buf, len);
-    tfilter->filter_cb(tfilter->filter_cb_data,
-		       GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    if (!tfilter->output_held)
+	tfilter->filter_cb(tfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    telnet_unlock(tfilter);
+}
+
+static void telnet_filter_hold_output(struct gensio_filter *filter, bool hold)
+{
+    struct telnet_filter *tfilter = filter_to_telnet(filter);
+
+    telnet_lock(tfilter);
+    if (hold) {
+	tfilter->output_held++;
+    } else if (tfilter->output_held) {
+	tfilter->output_held--;
+	if (!tfilter->output_held &&
+		gensio_buffer_cursize(&tfilter->tn_data.out_telnet_cmd))
+	    tfilter->filter_cb(tfilter->filter_cb_data,
+			       GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+    }
     telnet_unlock(tfilter);
 }
 
@@ -685,6 +726,7 @@ static void telnet_filter_start_timer(struct gensio_filter *filter,
 const struct gensio_telnet_filter_rops telnet_filter_rops = {
     .send_option = telnet_filter_send_option,
     .send_cmd = telnet_filter_send_cmd,
+    .hold_output = telnet_filter_hold_output,
     .start_timer = telnet_filter_start_timer
 };
 
@@ -30,6 +30,12 @@ struct gensio_telnet_filter_rops {
     void (*send_cmd)(struct gensio_filter *filter,
 		     const unsigned char *buf, unsigned int len);
     void (*start_timer)(struct gensio_filter *filter, gensio_time *timeout);
+    /*
+     * While held, options and commands are queued but not written,
+     * so a group of them goes out together when released.  Holds
+     * nest.
+     */
+    void (*hold_output)(struct gensio_filter *filter, bool hold);
 };
 
 int gensio_telnet_filter_alloc(struct gensio_pparm_info *p,
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <time.h>
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
@@ -40,8 +41,71 @@ struct trace_filter {
     const char *modeflag;
 
     FILE *tr;
+
+    /*
+     * For binary mode.  Records are put into the ring with the lock
+     * held and written to the file from a runner, so the data path
+     * never waits on the file.  flush_lock keeps only one thing
+     * writing to the file at a time, it is never held with lock.
+     * head and tail only increase, the ring position is taken modulo
+     * the size.
+     */
+    bool binary;
+    gensiods snaplen;
+    unsigned char *ring;
+    gensiods ring_size;
+    gensiods head;
+    gensiods tail;
+    gensiods dropped;
+    struct gensio_lock *flush_lock;
+    struct gensio_runner *flush_runner;
+    bool flush_pending;
+    bool freed;
 };
 
+/*
+ * The binary format, all values are little endian.  A new file starts
+ * with GTRACE_MAGIC.  Then come records, each with a header of:
+ *
+ *   16 bits: record type
+ *   16 bits: flags, currently 0
+ *   32 bits: caplen, the number of data bytes following the header
+ *   32 bits: origlen, see below
+ *   32 bits: nanoseconds of the monotonic time of the record
+ *   64 bits: seconds of the monotonic time of the record
+ *
+ * For read and write records, origlen is the number of bytes that
+ * went through, caplen is less if snaplen cut it off.  For errors it
+ * is the gensio error and for dropped records it is the number of
+ * records that didn't fit in the ring.  A start record is written on
+ * every open with 32 bits of version, 32 bits of snaplen, and 64 bits
+ * of wall clock seconds matching the monotonic time in the header.
+ *
+ * Read and write blocked records mark flow control, the layer below
+ * (for writes) or above (for reads) didn't take all the data it was
+ * offered and will have to be called again when it's ready.  origlen
+ * is the number of bytes that were refused, caplen is always 0.
+ * These were added in version 2.
+ */
+#define GTRACE_MAGIC		"GENSIOTR"
+#define GTRACE_MAGIC_LEN	8
+#define GTRACE_VERSION		2
+#define GTRACE_HDR_LEN		24
+#define GTRACE_START_LEN	16
+
+#define GTRACE_START		0
+#define GTRACE_READ		1
+#define GTRACE_WRITE		2
+#define GTRACE_READ_ERR		3
+#define GTRACE_WRITE_ERR	4
+#define GTRACE_DROPPED		5
+#define GTRACE_READ_BLOCKED	6
+#define GTRACE_WRITE_BLOCKED	7
+
+#define GTRACE_DEFAULT_RINGSIZE	(1024 * 1024)
+
+static void tfilter_free(struct trace_filter *tfilter);
+
 #define filter_to_trace(v) ((struct trace_filter *) \
 			    gensio_filter_get_user_data(v))
 
@@ -57,6 +121,176 @@ trace_unlock(struct trace_filter *tfilter)
     tfilter->o->unlock(tfilter->lock);
 }
 
+static void
+put_le(unsigned char *p, uint64_t v, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++, v >>= 8)
+	p[i] = v & 0xff;
+}
+
+/* Must be called with the lock held and with enough space. */
+static void
+ring_put(struct trace_filter *tfilter, const unsigned char *data,
+	 gensiods len)
+{
+    gensiods pos = tfilter->head % tfilter->ring_size;
+    gensiods n = tfilter->ring_size - pos;
+
+    if (n > len)
+	n = len;
+    memcpy(tfilter->ring + pos, data, n);
+    if (n < len)
+	memcpy(tfilter->ring, data + n, len - n);
+    tfilter->head += len;
+}
+
+static void
+ring_put_hdr(struct trace_filter *tfilter, unsigned int type,
+	     gensiods caplen, gensiods origlen, gensio_time *time)
+{
+    unsigned char hdr[GTRACE_HDR_LEN];
+
+    put_le(hdr, type, 2);
+    put_le(hdr + 2, 0, 2);
+    put_le(hdr + 4, caplen, 4);
+    put_le(hdr + 8, origlen, 4);
+    put_le(hdr + 12, time->nsecs, 4);
+    put_le(hdr + 16, time->secs, 8);
+    ring_put(tfilter, hdr, sizeof(hdr));
+}
+
+/* Must be called with the lock held. */
+static void
+ring_put_start(struct trace_filter *tfilter)
+{
+    unsigned char start[GTRACE_START_LEN];
+    gensio_time now;
+
+    tfilter->o->get_monotonic_time(tfilter->o, &now);
+    put_le(start, GTRACE_VERSION, 4);
+    put_le(start + 4, tfilter->snaplen, 4);
+    put_le(start + 8, (uint64_t) time(NULL), 8);
+    ring_put_hdr(tfilter, GTRACE_START, sizeof(start), 0, &now);
+    ring_put(tfilter, start, sizeof(start));
+}
+
+/*
+ * Write the ring out to f.  Must be called with flush_lock held and
+ * lock not held.
+ */
+static void
+trace_flush(struct trace_filter *tfilter, FILE *f)
+{
+    gensiods pos, len;
+
+    trace_lock(tfilter);
+    while (tfilter->tail != tfilter->head) {
+	pos = tfilter->tail % tfilter->ring_size;
+	len = tfilter->head - tfilter->tail;
+	if (len > tfilter->ring_size - pos)
+	    len = tfilter->ring_size - pos;
+	/* Nothing writes to this space until tail passes it. */
+	trace_unlock(tfilter);
+	fwrite(tfilter->ring + pos, 1, len, f);
+	trace_lock(tfilter);
+	tfilter->tail += len;
+    }
+    trace_unlock(tfilter);
+    fflush(f);
+}
+
+static void
+trace_flush_runner(struct gensio_runner *runner, void *cb_data)
+{
+    struct trace_filter *tfilter = cb_data;
+    bool do_free;
+    FILE *f;
+
+    tfilter->o->lock(tfilter->flush_lock);
+    trace_lock(tfilter);
+    f = tfilter->tr;
+    trace_unlock(tfilter);
+    if (f)
+	trace_flush(tfilter, f);
+    tfilter->o->unlock(tfilter->flush_lock);
+
+    trace_lock(tfilter);
+    tfilter->flush_pending = false;
+    if (tfilter->tr && tfilter->head != tfilter->tail) {
+	/* More came in while flushing. */
+	tfilter->flush_pending = true;
+	tfilter->o->run(tfilter->flush_runner);
+    }
+    do_free = tfilter->freed && !tfilter->flush_pending;
+    trace_unlock(tfilter);
+
+    if (do_free)
+	tfilter_free(tfilter);
+}
+
+/* Must be called with the lock held. */
+static void
+trace_bin_data(struct trace_filter *tfilter, bool read, int err,
+	       gensiods written, const struct gensio_sg *sg, gensiods sglen)
+{
+    gensiods i, len, caplen = 0, origlen = written, need, offered = 0;
+    unsigned int type = 0;
+    gensio_time time;
+
+    for (i = 0; i < sglen; i++)
+	offered += sg[i].buflen;
+
+    if (err) {
+	type = read ? GTRACE_READ_ERR : GTRACE_WRITE_ERR;
+	origlen = err;
+	offered = 0;
+    } else if (written > 0) {
+	type = read ? GTRACE_READ : GTRACE_WRITE;
+	caplen = written;
+	if (tfilter->snaplen && caplen > tfilter->snaplen)
+	    caplen = tfilter->snaplen;
+    } else if (offered == 0) {
+	return;
+    }
+
+    /* A partial write gets a data record and a blocked record. */
+    need = GTRACE_HDR_LEN + caplen;
+    if (tfilter->dropped)
+	need += GTRACE_HDR_LEN;
+    if (written < offered && written > 0)
+	need += GTRACE_HDR_LEN;
+    if (need > tfilter->ring_size - (tfilter->head - tfilter->tail)) {
+	tfilter->dropped++;
+	return;
+    }
+
+    tfilter->o->get_monotonic_time(tfilter->o, &time);
+    if (tfilter->dropped) {
+	ring_put_hdr(tfilter, GTRACE_DROPPED, 0, tfilter->dropped, &time);
+	tfilter->dropped = 0;
+    }
+    if (err || written > 0) {
+	ring_put_hdr(tfilter, type, caplen, origlen, &time);
+	for (i = 0; i < sglen && caplen > 0; i++, caplen -= len) {
+	    len = sg[i].buflen;
+	    if (len > caplen)
+		len = caplen;
+	    ring_put(tfilter, sg[i].buf, len);
+	}
+    }
+    if (!err && written < offered)
+	ring_put_hdr(tfilter,
+		     read ? GTRACE_READ_BLOCKED : GTRACE_WRITE_BLOCKED,
+		     0, offered - written, &time);
+
+    if (!tfilter->flush_pending) {
+	tfilter->flush_pending = true;
+	tfilter->o->run(tfilter->flush_runner);
+    }
+}
+
 static bool
 trace_ul_read_pending(struct gensio_filter *filter)
 {
@@ -95,6 +329,18 @@ trace_try_connect(struct gensio_filter *filter, gensio_time *timeout)
 	if (!tfilter->tr)
 	    return GE_PERM;
     }
+    if (tfilter->binary && tfilter->tr) {
+	/* Stdout and stderr are always treated as new files. */
+	if (!tfilter->filename || tfilter->tr_stdout || tfilter->tr_stderr ||
+		fseek(tfilter->tr, 0, SEEK_END) != 0 ||
+		ftell(tfilter->tr) <= 0) {
+	    fwrite(GTRACE_MAGIC, 1, GTRACE_MAGIC_LEN, tfilter->tr);
+	    fflush(tfilter->tr);
+	}
+	trace_lock(tfilter);
+	ring_put_start(tfilter);
+	trace_unlock(tfilter);
+    }
     return 0;
 }
 
@@ -168,7 +414,9 @@ trace_ul_write(struct gensio_filter *filter,
     err = handler(cb_data, &count, sg, sglen, auxdata);
     if (tfilter->dir == DIR_WRITE || tfilter->dir == DIR_BOTH) {
 	trace_lock(tfilter);
-	if (tfilter->tr)
+	if (tfilter->tr && tfilter->binary)
+	    trace_bin_data(tfilter, false, err, count, sg, sglen);
+	else if (tfilter->tr)
 	    trace_data("Write", tfilter->o, tfilter->tr, tfilter->raw, err,
 		       count, sg, sglen);
 	trace_unlock(tfilter);
@@ -201,7 +449,9 @@ trace_ll_write(struct gensio_filter *filter,
 	struct gensio_sg sg = {buf, buflen};
 
 	trace_lock(tfilter);
-	if (tfilter->tr)
+	if (tfilter->tr && tfilter->binary)
+	    trace_bin_data(tfilter, true, err, count, &sg, 1);
+	else if (tfilter->tr)
 	    trace_data("Read", tfilter->o, tfilter->tr, tfilter->raw, err,
 		       count, &sg, 1);
 	trace_unlock(tfilter);
@@ -222,15 +472,45 @@ static void
 trace_filter_cleanup(struct gensio_filter *filter)
 {
     struct trace_filter *tfilter = filter_to_trace(filter);
+    FILE *f;
 
-    if (!tfilter->tr_stdout && !tfilter->tr_stderr && tfilter->tr)
-	fclose(tfilter->tr);
+    if (tfilter->binary)
+	tfilter->o->lock(tfilter->flush_lock);
+    trace_lock(tfilter);
+    f = tfilter->tr;
     tfilter->tr = NULL;
+    if (f && tfilter->binary && tfilter->dropped) {
+	gensio_time now;
+
+	/* Flushing below makes the space for this. */
+	tfilter->o->get_monotonic_time(tfilter->o, &now);
+	trace_unlock(tfilter);
+	trace_flush(tfilter, f);
+	trace_lock(tfilter);
+	ring_put_hdr(tfilter, GTRACE_DROPPED, 0, tfilter->dropped, &now);
+	tfilter->dropped = 0;
+    }
+    trace_unlock(tfilter);
+    if (tfilter->binary) {
+	if (f)
+	    trace_flush(tfilter, f);
+	tfilter->head = tfilter->tail = 0;
+	tfilter->o->unlock(tfilter->flush_lock);
+    }
+
+    if (!tfilter->tr_stdout && !tfilter->tr_stderr && f)
+	fclose(f);
 }
 
 static void
 tfilter_free(struct trace_filter *tfilter)
 {
+    if (tfilter->flush_runner)
+	tfilter->o->free_runner(tfilter->flush_runner);
+    if (tfilter->flush_lock)
+	tfilter->o->free_lock(tfilter->flush_lock);
+    if (tfilter->ring)
+	tfilter->o->free(tfilter->o, tfilter->ring);
     if (tfilter->lock)
 	tfilter->o->free_lock(tfilter->lock);
     if (tfilter->filter)
@@ -245,6 +525,14 @@ trace_free(struct gensio_filter *filter)
 {
     struct trace_filter *tfilter = filter_to_trace(filter);
 
+    trace_lock(tfilter);
+    if (tfilter->flush_pending) {
+	/* The runner will free it. */
+	tfilter->freed = true;
+	trace_unlock(tfilter);
+	return;
+    }
+    trace_unlock(tfilter);
     tfilter_free(tfilter);
 }
 
@@ -305,7 +593,8 @@ static struct gensio_filter *
 gensio_trace_filter_raw_alloc(struct gensio_os_funcs *o, enum trace_dir dir,
 			      enum trace_dir block,
 			      bool raw, const char *filename, bool tr_stdout,
-			      bool tr_stderr, const char *modeflag)
+			      bool tr_stderr, const char *modeflag,
+			      bool binary, gensiods ringsize, gensiods snaplen)
 {
     struct trace_filter *tfilter;
 
@@ -333,6 +622,22 @@ gensio_trace_filter_raw_alloc(struct gensio_os_funcs *o, enum trace_dir dir,
     if (!tfilter->lock)
 	goto out_nomem;
 
+    if (binary && dir != DIR_NONE) {
+	tfilter->binary = true;
+	tfilter->snaplen = snaplen;
+	tfilter->ring_size = ringsize;
+	tfilter->ring = o->zalloc(o, ringsize);
+	if (!tfilter->ring)
+	    goto out_nomem;
+	tfilter->flush_lock = o->alloc_lock(o);
+	if (!tfilter->flush_lock)
+	    goto out_nomem;
+	tfilter->flush_runner = o->alloc_runner(o, trace_flush_runner,
+						tfilter);
+	if (!tfilter->flush_runner)
+	    goto out_nomem;
+    }
+
     tfilter->filter = gensio_filter_alloc_data(o, gensio_trace_filter_func,
 					       tfilter);
     if (!tfilter->filter)
@@ -363,9 +668,11 @@ gensio_trace_filter_alloc(struct gensio_pparm_info *p,
     int dir = DIR_NONE;
     int block = DIR_NONE;
     bool raw = false, tr_stdout = false, tr_stderr = false, tbool;
+    bool binary = false, delold = false;
+    gensiods ringsize = GTRACE_DEFAULT_RINGSIZE, snaplen = 0;
     const char *filename = NULL;
     unsigned int i;
-    const char *modeflag = "a";
+    const char *modeflag;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_enum(p, args[i], "dir", trace_dir_enum, &dir) > 0)
@@ -382,18 +689,45 @@ gensio_trace_filter_alloc(struct gensio_pparm_info *p,
 	    continue;
 	if (gensio_pparm_bool(p, args[i], "delold", &tbool) > 0) {
 	    if (tbool)
-		modeflag = "w";
+		delold = true;
 	    continue;
 	}
+	if (gensio_pparm_bool(p, args[i], "binary", &binary) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "ringsize", &ringsize) > 0)
+	    continue;
+	if (gensio_pparm_ds(p, args[i], "snaplen", &snaplen) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(p, args[i]);
 	return GE_INVAL;
     }
 
+    if (binary) {
+	modeflag = delold ? "wb" : "ab";
+	/* A record must always fit, even with a dropped record. */
+	if (ringsize < 4 * GTRACE_HDR_LEN + snaplen ||
+		(!snaplen && ringsize < 4096)) {
+	    gensio_pparm_slog(p, "ringsize is too small");
+	    return GE_INVAL;
+	}
+    } else {
+	modeflag = delold ? "w" : "a";
+    }
+
     filter = gensio_trace_filter_raw_alloc(o, dir, block, raw, filename,
-					   tr_stdout, tr_stderr, modeflag);
+					   tr_stdout, tr_stderr, modeflag,
+					   binary, ringsize, snaplen);
     if (!filter)
 	return GE_NOMEM;
 
     *rfilter = filter;
     return 0;
 }
+
+bool
+gensio_trace_filter_is_passthrough(struct gensio_filter *filter)
+{
+    struct trace_filter *tfilter = filter_to_trace(filter);
+
+    return tfilter->dir == DIR_NONE && tfilter->block == DIR_NONE;
+}
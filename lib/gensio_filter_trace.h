@@ -16,4 +16,10 @@ int gensio_trace_filter_alloc(struct gensio_pparm_info *p,
 			      const char * const args[],
 			      struct gensio_filter **rfilter);
 
+/*
+ * Returns true if the filter doesn't trace or block anything, so it
+ * can be left out.
+ */
+bool gensio_trace_filter_is_passthrough(struct gensio_filter *filter);
+
 #endif /* GENSIO_FILTER_TRACE_H */
@@ -18,19 +18,39 @@
 
 #include "gensio_filter_xlt.h"
 
+/*
+ * If only this many characters or fewer are translated, copy the
+ * data as a block and fix up the translated characters with
+ * memchr(), which is vectorized in any decent libc.  That's the
+ * usual case, crnl and friends translate one character.
+ */
+#define XLT_MAX_SPARSE 4
+
+#define XLT_DEFAULT_BUFSIZE 4096
+
 struct xlt_filter {
     struct gensio_filter *filter;
 
     struct gensio_lock *lock;
 
+    gensiods bufsize;
+
     unsigned char inxlt[256];
-    unsigned char inbuf[256];
+    unsigned char in_changed[XLT_MAX_SPARSE];
+    unsigned int in_nchanged;
+    unsigned char *inbuf;
     gensiods inlen;
 
     unsigned char outxlt[256];
-    unsigned char outbuf[256];
+    unsigned char out_changed[XLT_MAX_SPARSE];
+    unsigned int out_nchanged;
+    unsigned char *outbuf;
     gensiods outlen;
 
+    /* No translations in that direction, the data is passed as is. */
+    bool in_identity;
+    bool out_identity;
+
     struct gensio_os_funcs *o;
 };
 
@@ -49,6 +69,35 @@ xlt_unlock(struct xlt_filter *tfilter)
     tfilter->o->unlock(tfilter->lock);
 }
 
+/*
+ * Translate len bytes from src into dst.  changed holds the characters
+ * that xlt does not map to themselves if there are few enough of them.
+ */
+static void
+xlt_translate(const unsigned char *xlt,
+	      const unsigned char *changed, unsigned int nchanged,
+	      unsigned char *dst, const unsigned char *src, gensiods len)
+{
+    const unsigned char *p, *end = src + len;
+    gensiods i;
+    unsigned int k;
+
+    if (nchanged > XLT_MAX_SPARSE) {
+	for (i = 0; i < len; i++)
+	    dst[i] = xlt[src[i]];
+	return;
+    }
+
+    memcpy(dst, src, len);
+    /* Search the source, a translated character may match another. */
+    for (k = 0; k < nchanged; k++) {
+	unsigned char c = changed[k];
+
+	for (p = src; (p = memchr(p, c, end - p)); p++)
+	    dst[p - src] = xlt[c];
+    }
+}
+
 static bool
 xlt_ul_read_pending(struct gensio_filter *filter)
 {
@@ -98,15 +147,24 @@ xlt_ul_write(struct gensio_filter *filter,
 {
     struct xlt_filter *tfilter = filter_to_xlt(filter);
     int err = 0;
-    gensiods i, j, pos = tfilter->outlen;
+    gensiods i, len, pos, used = 0;
     gensiods count = 0;
 
     xlt_lock(tfilter);
-    for (i = 0; pos < sizeof(tfilter->outbuf) && i < sglen; i++) {
-	const unsigned char *buf = sg[i].buf;
-
-	for (j = 0; pos < sizeof(tfilter->outbuf) && j < sg[i].buflen; j++)
-	    tfilter->outbuf[pos++] = tfilter->outxlt[buf[j]];
+    if (tfilter->out_identity && tfilter->outlen == 0) {
+	xlt_unlock(tfilter);
+	return handler(cb_data, rcount, sg, sglen, auxdata);
+    }
+    pos = tfilter->outlen;
+    for (i = 0; pos < tfilter->bufsize && i < sglen; i++) {
+	len = sg[i].buflen;
+	if (len > tfilter->bufsize - pos)
+	    len = tfilter->bufsize - pos;
+	xlt_translate(tfilter->outxlt, tfilter->out_changed,
+		      tfilter->out_nchanged, tfilter->outbuf + pos,
+		      sg[i].buf, len);
+	pos += len;
+	used += len;
     }
     tfilter->outlen = pos;
 
@@ -129,7 +187,7 @@ xlt_ul_write(struct gensio_filter *filter,
     xlt_unlock(tfilter);
 
     if (!err && rcount)
-	*rcount = pos;
+	*rcount = used;
 
     return err;
 }
@@ -143,13 +201,20 @@ xlt_ll_write(struct gensio_filter *filter,
 {
     struct xlt_filter *tfilter = filter_to_xlt(filter);
     int err = 0;
-    gensiods i, pos = tfilter->inlen;
+    gensiods used;
     gensiods count = 0;
 
     xlt_lock(tfilter);
-    for (i = 0; pos < sizeof(tfilter->inbuf) && i < buflen; i++)
-	tfilter->inbuf[pos++] = tfilter->inxlt[buf[i]];
-    tfilter->inlen = pos;
+    if (tfilter->in_identity && tfilter->inlen == 0) {
+	xlt_unlock(tfilter);
+	return handler(cb_data, rcount, buf, buflen, auxdata);
+    }
+    used = tfilter->bufsize - tfilter->inlen;
+    if (used > buflen)
+	used = buflen;
+    xlt_translate(tfilter->inxlt, tfilter->in_changed, tfilter->in_nchanged,
+		  tfilter->inbuf + tfilter->inlen, buf, used);
+    tfilter->inlen += used;
 
     if (tfilter->inlen > 0) {
 	err = handler(cb_data, &count, tfilter->inbuf, tfilter->inlen, auxdata);
@@ -166,7 +231,7 @@ xlt_ll_write(struct gensio_filter *filter,
     xlt_unlock(tfilter);
 
     if (!err && rcount)
-	*rcount = pos;
+	*rcount = used;
 
     return err;
 }
@@ -185,6 +250,10 @@ xlt_filter_cleanup(struct gensio_filter *filter)
 static void
 tfilter_free(struct xlt_filter *tfilter)
 {
+    if (tfilter->inbuf)
+	tfilter->o->free(tfilter->o, tfilter->inbuf);
+    if (tfilter->outbuf)
+	tfilter->o->free(tfilter->o, tfilter->outbuf);
     if (tfilter->lock)
 	tfilter->o->free_lock(tfilter->lock);
     if (tfilter->filter)
@@ -287,6 +356,7 @@ gensio_xlt_filter_alloc(struct gensio_pparm_info *p,
 	return GE_NOMEM;
 
     tfilter->o = o;
+    tfilter->bufsize = XLT_DEFAULT_BUFSIZE;
 
     for (i = 0; i < 256; i++) {
 	tfilter->inxlt[i] = i;
@@ -319,6 +389,14 @@ gensio_xlt_filter_alloc(struct gensio_pparm_info *p,
 		goto out_err;
 	    continue;
 	}
+	if (gensio_pparm_ds(p, args[i], "bufsize", &tfilter->bufsize) > 0) {
+	    if (tfilter->bufsize == 0) {
+		gensio_pparm_slog(p, "bufsize must not be zero");
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
 	if (gensio_pparm_bool(p, args[i], "crlf", &bval) > 0) {
 	    tfilter->inxlt['\r'] = '\n';
 	    tfilter->outxlt['\n'] = '\r';
@@ -343,6 +421,36 @@ gensio_xlt_filter_alloc(struct gensio_pparm_info *p,
 	goto out_err;
     }
 
+    for (i = 0; i < 256; i++) {
+	if (tfilter->inxlt[i] != i) {
+	    if (tfilter->in_nchanged < XLT_MAX_SPARSE)
+		tfilter->in_changed[tfilter->in_nchanged] = i;
+	    tfilter->in_nchanged++;
+	}
+	if (tfilter->outxlt[i] != i) {
+	    if (tfilter->out_nchanged < XLT_MAX_SPARSE)
+		tfilter->out_changed[tfilter->out_nchanged] = i;
+	    tfilter->out_nchanged++;
+	}
+    }
+    tfilter->in_identity = tfilter->in_nchanged == 0;
+    tfilter->out_identity = tfilter->out_nchanged == 0;
+
+    if (!tfilter->in_identity) {
+	tfilter->inbuf = o->zalloc(o, tfilter->bufsize);
+	if (!tfilter->inbuf) {
+	    rv = GE_NOMEM;
+	    goto out_err;
+	}
+    }
+    if (!tfilter->out_identity) {
+	tfilter->outbuf = o->zalloc(o, tfilter->bufsize);
+	if (!tfilter->outbuf) {
+	    rv = GE_NOMEM;
+	    goto out_err;
+	}
+    }
+
     *rfilter = tfilter->filter;
     return 0;
 
@@ -350,3 +458,11 @@ gensio_xlt_filter_alloc(struct gensio_pparm_info *p,
     tfilter_free(tfilter);
     return rv;
 }
+
+bool
+gensio_xlt_filter_is_passthrough(struct gensio_filter *filter)
+{
+    struct xlt_filter *tfilter = filter_to_xlt(filter);
+
+    return tfilter->in_identity && tfilter->out_identity;
+}
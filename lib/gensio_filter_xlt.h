@@ -5,8 +5,8 @@
  *  SPDX-License-Identifier: LGPL-2.1-only
  */
 
-#ifndef GENSIO_FILTER_TRACE_H
-#define GENSIO_FILTER_TRACE_H
+#ifndef GENSIO_FILTER_XLT_H
+#define GENSIO_FILTER_XLT_H
 
 #include <gensio/gensio_base.h>
 #include <gensio/gensio_class.h>
@@ -16,4 +16,10 @@ int gensio_xlt_filter_alloc(struct gensio_pparm_info *p,
 			    const char * const args[],
 			    struct gensio_filter **rfilter);
 
-#endif /* GENSIO_FILTER_TRACE_H */
+/*
+ * Returns true if the filter doesn't translate anything, so it can be
+ * left out.
+ */
+bool gensio_xlt_filter_is_passthrough(struct gensio_filter *filter);
+
+#endif /* GENSIO_FILTER_XLT_H */
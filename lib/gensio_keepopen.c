@@ -128,6 +128,17 @@
  *         else
  *             ->KEEPN_OPEN
  *
+ * The retry time doubles each time the timer is started, up to
+ * retry_max, and goes back to retry_time when the child opens.
+ *
+ * With a standby, a second child is kept open while the main one is
+ * open.  It has its own state (KEEPN_SB_xxx), it is opened when the
+ * main child opens and is retried with sb_timer.  If the main child
+ * fails while the standby is open, they are swapped and the old one
+ * is closed in the background, to be re-opened as the standby.  If
+ * the standby comes up while waiting to retry the main child, they are
+ * swapped at the retry timeout.  The user's close is not reported
+ * until the standby is closed, too.
  */
 
 enum keepn_state {
@@ -142,6 +153,13 @@ enum keepn_state {
     KEEPN_CHILD_CLOSED_IN_OPEN,
 };
 
+enum keepn_sb_state {
+    KEEPN_SB_CLOSED,
+    KEEPN_SB_IN_OPEN,
+    KEEPN_SB_OPEN,
+    KEEPN_SB_IN_CLOSE,
+};
+
 struct keepn_data {
     struct gensio_os_funcs *o;
     struct gensio_lock *lock;
@@ -163,6 +181,16 @@ struct keepn_data {
 
     struct gensio_timer *retry_timer;
     struct gensio_time retry_time;
+    struct gensio_time retry_max;
+    struct gensio_time retry_curr;
+    bool retry_jitter;
+
+    /* The standby child, NULL if not using one. */
+    struct gensio *standby;
+    enum keepn_sb_state sb_state;
+    struct gensio_timer *sb_timer;
+    bool sb_timer_running;
+    bool close_wait_standby;
 
     bool read_enabled;
     bool xmit_enabled;
@@ -183,8 +211,12 @@ keepn_finish_free(struct keepn_data *ndata)
 	gensio_data_free(ndata->io);
     if (ndata->child)
 	gensio_free(ndata->child);
+    if (ndata->standby)
+	gensio_free(ndata->standby);
     if (ndata->retry_timer)
 	o->free_timer(ndata->retry_timer);
+    if (ndata->sb_timer)
+	o->free_timer(ndata->sb_timer);
     if (ndata->lock)
 	o->free_lock(ndata->lock);
     o->free(o, ndata);
@@ -240,11 +272,51 @@ keepn_start_zero_timer(struct keepn_data *ndata)
 	assert(0);
 }
 
+static int64_t
+keepn_time_to_ns(const gensio_time *t)
+{
+    return t->secs * 1000000000LL + t->nsecs;
+}
+
+static void
+keepn_ns_to_time(gensio_time *t, int64_t ns)
+{
+    t->secs = ns / 1000000000LL;
+    t->nsecs = ns % 1000000000LL;
+}
+
 static void
 keepn_start_timer(struct keepn_data *ndata)
 {
+    int64_t curr = keepn_time_to_ns(&ndata->retry_curr);
+    int64_t max = keepn_time_to_ns(&ndata->retry_max);
+    gensio_time timeout = ndata->retry_curr;
+
+    if (ndata->retry_jitter && curr > 1) {
+	uint64_t randv = 0;
+
+	/* Somewhere from half to all of the time, so clients spread out. */
+	ndata->o->get_random(ndata->o, &randv, sizeof(randv));
+	keepn_ns_to_time(&timeout, curr / 2 + randv % (curr - curr / 2));
+    }
+    if (curr < max) {
+	curr *= 2;
+	if (curr > max)
+	    curr = max;
+	keepn_ns_to_time(&ndata->retry_curr, curr);
+    }
+
     keepn_ref(ndata);
-    if (ndata->o->start_timer(ndata->retry_timer, &ndata->retry_time) != 0)
+    if (ndata->o->start_timer(ndata->retry_timer, &timeout) != 0)
+	assert(0);
+}
+
+static void
+keepn_start_sb_timer(struct keepn_data *ndata)
+{
+    keepn_ref(ndata);
+    ndata->sb_timer_running = true;
+    if (ndata->o->start_timer(ndata->sb_timer, &ndata->retry_time) != 0)
 	assert(0);
 }
 
@@ -297,6 +369,158 @@ keepn_check_close_done(struct keepn_data *ndata)
     keepn_lock(ndata);
 }
 
+static void keepn_sb_open_done(struct gensio *io, int err, void *open_data);
+static void keepn_sb_close_done(struct gensio *io, void *open_data);
+
+/* Open the standby if it should be open. */
+static void
+keepn_check_standby(struct keepn_data *ndata)
+{
+    int err;
+
+    if (!ndata->standby || ndata->state != KEEPN_OPEN ||
+		ndata->sb_state != KEEPN_SB_CLOSED || ndata->sb_timer_running)
+	return;
+
+    err = gensio_open(ndata->standby, keepn_sb_open_done, ndata);
+    if (err) {
+	keepn_start_sb_timer(ndata);
+    } else {
+	ndata->sb_state = KEEPN_SB_IN_OPEN;
+	keepn_ref(ndata);
+    }
+}
+
+static void
+keepn_close_standby(struct keepn_data *ndata)
+{
+    int err;
+
+    if (!ndata->standby)
+	return;
+
+    switch (ndata->sb_state) {
+    case KEEPN_SB_IN_OPEN:
+    case KEEPN_SB_OPEN:
+	err = gensio_close(ndata->standby, keepn_sb_close_done, ndata);
+	if (err) {
+	    ndata->sb_state = KEEPN_SB_CLOSED;
+	} else {
+	    ndata->sb_state = KEEPN_SB_IN_CLOSE;
+	    keepn_ref(ndata);
+	}
+	break;
+
+    case KEEPN_SB_CLOSED:
+	/*
+	 * If the stop fails the handler is running, it won't do
+	 * anything since we are closing.
+	 */
+	if (ndata->sb_timer_running &&
+		ndata->o->stop_timer(ndata->sb_timer) == 0) {
+	    ndata->sb_timer_running = false;
+	    keepn_deref(ndata);
+	}
+	break;
+
+    case KEEPN_SB_IN_CLOSE:
+	break;
+    }
+}
+
+/*
+ * Make the open standby the main child.  The old main child becomes
+ * the standby, close it if it's not closed already.
+ */
+static void
+keepn_switch_to_standby(struct keepn_data *ndata, bool close_old)
+{
+    struct gensio *old = ndata->child;
+    int err;
+
+    ndata->child = ndata->standby;
+    ndata->standby = old;
+    ndata->sb_state = KEEPN_SB_CLOSED;
+    ndata->state = KEEPN_OPEN;
+    ndata->retry_curr = ndata->retry_time;
+    gensio_log(ndata->o, GENSIO_LOG_INFO, "switched to standby child gensio");
+    gensio_set_write_callback_enable(ndata->child, ndata->tx_enable);
+    gensio_set_read_callback_enable(ndata->child, ndata->rx_enable);
+
+    if (close_old) {
+	err = gensio_close(old, keepn_sb_close_done, ndata);
+	if (!err) {
+	    ndata->sb_state = KEEPN_SB_IN_CLOSE;
+	    keepn_ref(ndata);
+	}
+    }
+    keepn_check_standby(ndata);
+}
+
+/* Report the user's close, unless we have to wait for the standby. */
+static void
+keepn_finish_close(struct keepn_data *ndata)
+{
+    if (ndata->sb_state == KEEPN_SB_IN_CLOSE) {
+	ndata->close_wait_standby = true;
+	return;
+    }
+    keepn_check_open_done(ndata);
+    ndata->state = KEEPN_CLOSED;
+    keepn_check_close_done(ndata);
+}
+
+static void
+keepn_sb_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct keepn_data *ndata = open_data;
+
+    keepn_lock(ndata);
+    if (ndata->sb_state != KEEPN_SB_IN_OPEN) {
+	/* Closed while opening, the close done will handle it. */
+    } else if (err) {
+	gensio_log(ndata->o, GENSIO_LOG_INFO,
+		   "Error opening standby child gensio: %s",
+		   gensio_err_to_str(err));
+	ndata->sb_state = KEEPN_SB_CLOSED;
+	if (ndata->state == KEEPN_OPEN)
+	    keepn_start_sb_timer(ndata);
+    } else {
+	/* Nothing should come from it until it is in use. */
+	gensio_set_read_callback_enable(io, false);
+	gensio_set_write_callback_enable(io, false);
+	ndata->sb_state = KEEPN_SB_OPEN;
+    }
+    keepn_unlock_and_deref(ndata);
+}
+
+static void
+keepn_sb_close_done(struct gensio *io, void *open_data)
+{
+    struct keepn_data *ndata = open_data;
+
+    keepn_lock(ndata);
+    ndata->sb_state = KEEPN_SB_CLOSED;
+    if (ndata->close_wait_standby) {
+	ndata->close_wait_standby = false;
+	keepn_finish_close(ndata);
+    } else {
+	keepn_check_standby(ndata);
+    }
+    keepn_unlock_and_deref(ndata);
+}
+
+static void
+keepn_sb_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct keepn_data *ndata = cb_data;
+
+    keepn_lock(ndata);
+    ndata->sb_timer_running = false;
+    keepn_check_standby(ndata);
+    keepn_unlock_and_deref(ndata);
+}
+
 static void
 keepn_open_done(struct gensio *io, int err, void *open_data)
 {
@@ -324,6 +548,8 @@ keepn_open_done(struct gensio *io, int err, void *open_data)
 	    gensio_set_write_callback_enable(ndata->child, ndata->tx_enable);
 	    gensio_set_read_callback_enable(ndata->child, ndata->rx_enable);
 	    ndata->state = KEEPN_OPEN;
+	    ndata->retry_curr = ndata->retry_time;
+	    keepn_check_standby(ndata);
 	}
 	if (ndata->open_done) {
 	    gensio_done_err open_done = ndata->open_done;
@@ -355,9 +581,7 @@ keepn_close_done(struct gensio *io, void *open_data)
     keepn_lock(ndata);
     switch (ndata->state) {
     case KEEPN_IN_CLOSE:
-	keepn_check_open_done(ndata);
-	ndata->state = KEEPN_CLOSED;
-	keepn_check_close_done(ndata);
+	keepn_finish_close(ndata);
 	break;
 
     case KEEPN_CHILD_ERR_CLOSE:
@@ -372,17 +596,22 @@ keepn_close_done(struct gensio *io, void *open_data)
 }
 
 static int
-keepn_handle_io_err(struct keepn_data *ndata, int err)
+keepn_handle_io_err(struct keepn_data *ndata, struct gensio *child, int err)
 {
 
     keepn_lock(ndata);
-    if (ndata->state != KEEPN_OPEN)
+    if (ndata->state != KEEPN_OPEN || child != ndata->child)
 	goto out_unlock;
 
     ndata->last_child_err = err;
     gensio_log(ndata->o, GENSIO_LOG_INFO, "I/O error from child gensio: %s",
 	       gensio_err_to_str(err));
 
+    if (ndata->standby && ndata->sb_state == KEEPN_SB_OPEN) {
+	keepn_switch_to_standby(ndata, true);
+	goto out_unlock;
+    }
+
     err = gensio_close(ndata->child, keepn_close_done, ndata);
     if (err) {
 	keepn_start_timer(ndata);
@@ -404,9 +633,22 @@ keepn_event(struct gensio *io, void *user_data,
 	    const char *const *auxdata)
 {
     struct keepn_data *ndata = user_data;
+    bool is_standby;
+
+    keepn_lock(ndata);
+    is_standby = io != ndata->child;
+    if (is_standby && err && event == GENSIO_EVENT_READ &&
+		ndata->sb_state == KEEPN_SB_OPEN) {
+	/* The standby went away, get a new one. */
+	keepn_close_standby(ndata);
+    }
+    keepn_unlock(ndata);
+    if (is_standby)
+	/* Nobody is using it, just throw things away. */
+	return event == GENSIO_EVENT_READ ? 0 : GE_NOTSUP;
 
     if (err && event == GENSIO_EVENT_READ) {
-	keepn_handle_io_err(ndata, err);
+	keepn_handle_io_err(ndata, io, err);
 	return 0;
     }
 
@@ -431,6 +673,12 @@ keepn_retry_timeout(struct gensio_timer *t, void *cb_data)
 	break;
 
     case KEEPN_CHILD_CLOSED:
+	if (ndata->standby && ndata->sb_state == KEEPN_SB_OPEN) {
+	    gensio_log(ndata->o, GENSIO_LOG_INFO,
+		       "child gensio open restored");
+	    keepn_switch_to_standby(ndata, false);
+	    break;
+	}
 	err = gensio_open(ndata->child, keepn_open_done, ndata);
 	if (err)
 	    keepn_start_timer(ndata);
@@ -439,9 +687,7 @@ keepn_retry_timeout(struct gensio_timer *t, void *cb_data)
 	break;
 
     case KEEPN_CLOSE_STOP_TIMER:
-	keepn_check_open_done(ndata);
-	ndata->state = KEEPN_CLOSED;
-	keepn_check_close_done(ndata);
+	keepn_finish_close(ndata);
 	break;
 
     default:
@@ -485,6 +731,20 @@ keepn_close(struct gensio *io, gensio_done close_done, void *close_data)
     int err = 0;
 
     keepn_lock(ndata);
+    switch (ndata->state) {
+    case KEEPN_OPEN:
+    case KEEPN_IN_OPEN:
+    case KEEPN_OPEN_INIT_FAIL:
+    case KEEPN_CHILD_ERR_CLOSE:
+    case KEEPN_CHILD_CLOSED:
+    case KEEPN_CHILD_CLOSED_IN_OPEN:
+	keepn_close_standby(ndata);
+	break;
+
+    default:
+	break;
+    }
+
     switch (ndata->state) {
     case KEEPN_OPEN:
     case KEEPN_IN_OPEN:
@@ -540,6 +800,17 @@ keepn_free(struct gensio *io)
     struct keepn_data *ndata = gensio_get_gensio_data(io);
 
     keepn_lock(ndata);
+    switch(ndata->state) {
+    case KEEPN_OPEN_INIT_FAIL:
+    case KEEPN_CHILD_ERR_CLOSE:
+    case KEEPN_CHILD_CLOSED:
+	keepn_close_standby(ndata);
+	break;
+
+    default:
+	break;
+    }
+
     switch(ndata->state) {
     case KEEPN_CLOSED:
     case KEEPN_IN_CLOSE:
@@ -588,14 +859,19 @@ keepn_gensio_func(struct gensio *io, int func, gensiods *count,
 		  const char *const *auxdata)
 {
     struct keepn_data *ndata = gensio_get_gensio_data(io);
+    struct gensio *child;
     int err;
 
+    /* The standby may be swapped in at any time, get the current one. */
+    keepn_lock(ndata);
+    child = ndata->child;
+    keepn_unlock(ndata);
+
     switch (func) {
     case GENSIO_FUNC_WRITE_SG:
-	err = gensio_call_func(ndata->child,
-			       func, count, cbuf, buflen, buf, auxdata);
+	err = gensio_call_func(child, func, count, cbuf, buflen, buf, auxdata);
 	if (err) {
-	    keepn_handle_io_err(ndata, err);
+	    keepn_handle_io_err(ndata, child, err);
 	    if (ndata->discard_badwrites) {
 		gensiods i, amt = 0;
 		const struct gensio_sg *sg = cbuf;
@@ -637,32 +913,53 @@ keepn_gensio_func(struct gensio *io, int func, gensiods *count,
     default:
     passon:
 	/* Everything but the above just passes through. */
-	return gensio_call_func(ndata->child,
-				func, count, cbuf, buflen, buf, auxdata);
+	return gensio_call_func(child, func, count, cbuf, buflen, buf, auxdata);
     }
 }
 
+/*
+ * A standby needs another copy of the child, so it can only be done
+ * if we have the string for the child in child_str.
+ */
 static int
-keepopen_gensio_alloc(struct gensio *child, const char * const args[],
-		      struct gensio_os_funcs *o,
-		      gensio_event cb, void *user_data,
-		      struct gensio **new_gensio)
+keepn_alloc(struct gensio *child, const char *child_str,
+	    const char * const args[],
+	    struct gensio_os_funcs *o,
+	    gensio_event cb, void *user_data,
+	    struct gensio **new_gensio)
 {
     struct keepn_data *ndata = NULL;
-    int i;
+    int i, err;
     struct gensio_time retry_time = { 1, 0 };
+    struct gensio_time retry_max = { 0, 0 };
+    bool retry_jitter = false;
     bool discard_badwrites = false;
+    bool standby = false;
     GENSIO_DECLARE_PPGENSIO(p, o, cb, "keepopen", user_data);
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_time(&p, args[i], "retry-time", 'm', &retry_time) > 0)
 	    continue;
+	if (gensio_pparm_time(&p, args[i], "retry-max-time", 'm',
+			      &retry_max) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "retry-jitter", &retry_jitter) > 0)
+	    continue;
 	if (gensio_pparm_bool(&p, args[i], "discard-badwrites",
 			      &discard_badwrites) > 0)
 	    continue;
+	if (gensio_pparm_bool(&p, args[i], "standby", &standby) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
+    if (standby && !child_str) {
+	gensio_pparm_slog(&p, "standby requires the child as a string");
+	return GE_INVAL;
+    }
+    if (keepn_time_to_ns(&retry_max) < keepn_time_to_ns(&retry_time))
+	retry_max = retry_time;
+
     ndata = o->zalloc(o, sizeof(*ndata));
     if (!ndata)
 	return GE_NOMEM;
@@ -677,8 +974,23 @@ keepopen_gensio_alloc(struct gensio *child, const char * const args[],
     if (!ndata->lock)
 	goto out_nomem;
 
+    if (standby) {
+	ndata->sb_timer = o->alloc_timer(o, keepn_sb_timeout, ndata);
+	if (!ndata->sb_timer)
+	    goto out_nomem;
+	err = str_to_gensio(child_str, o, cb, user_data, &ndata->standby);
+	if (err) {
+	    keepn_finish_free(ndata);
+	    return err;
+	}
+	gensio_set_callback(ndata->standby, keepn_event, ndata);
+    }
+
     ndata->child = child;
     ndata->retry_time = retry_time;
+    ndata->retry_max = retry_max;
+    ndata->retry_curr = retry_time;
+    ndata->retry_jitter = retry_jitter;
     ndata->discard_badwrites = discard_badwrites;
     gensio_set_callback(child, keepn_event, ndata);
 
@@ -697,6 +1009,15 @@ keepopen_gensio_alloc(struct gensio *child, const char * const args[],
     return GE_NOMEM;
 }
 
+static int
+keepopen_gensio_alloc(struct gensio *child, const char * const args[],
+		      struct gensio_os_funcs *o,
+		      gensio_event cb, void *user_data,
+		      struct gensio **new_gensio)
+{
+    return keepn_alloc(child, NULL, args, o, cb, user_data, new_gensio);
+}
+
 static int
 str_to_keepopen_gensio(const char *str, const char * const args[],
 		       struct gensio_os_funcs *o,
@@ -711,7 +1032,7 @@ str_to_keepopen_gensio(const char *str, const char * const args[],
     if (err)
 	return err;
 
-    err = keepopen_gensio_alloc(io2, args, o, cb, user_data, new_gensio);
+    err = keepn_alloc(io2, str, args, o, cb, user_data, new_gensio);
     if (err)
 	gensio_free(io2);
 
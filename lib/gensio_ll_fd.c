@@ -8,11 +8,14 @@
 #include "config.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include <gensio/gensio.h>
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_err.h>
 #include <gensio/gensio_ll_fd.h>
+#include <gensio/gensio_osops.h>
 
 enum fd_state {
     /*
@@ -50,6 +53,24 @@ enum fd_state {
      */
     FD_IN_OPEN_RETRY,
 
+    /*
+     * An open has been requested, but sub_open() is waiting on
+     * something other than the fd (like an address lookup) and there
+     * is no fd yet.
+     *
+     * open continue
+     *   if still waiting
+     *     -> FD_IN_OPEN_WAIT
+     *   else if open in progress
+     *     -> FD_IN_OPEN (set fds)
+     *   else if open success
+     *     -> FD_OPEN
+     *   else
+     *     -> FD_CLOSED (report open err)
+     * close -> FD_IN_CLOSE
+     */
+    FD_IN_OPEN_WAIT,
+
     /*
      * The fd is operational
      *
@@ -135,6 +156,47 @@ struct fd_ll {
     gensiods read_data_pos;
     const char *const *auxdata;
 
+    /* The most reads per read event, see gensio_fd_ll_set_read_budget(). */
+    unsigned int read_budget;
+
+    /*
+     * An adaptive read buffer, see gensio_fd_ll_set_readbuf_min().  If
+     * read_buf_min is not zero, read_data is only allocated while
+     * reading and read_buf_next is the size to allocate next time.
+     * read_buf_small counts reads that used little of the buffer.
+     */
+    gensiods read_buf_min;
+    gensiods read_buf_max;
+    gensiods read_buf_next;
+    unsigned int read_buf_small;
+
+    /*
+     * Read coalescing, see gensio_fd_ll_set_read_coalesce().  While
+     * coalescing is set, read_data holds a short read that is being
+     * held back waiting for more data or for coalesce_timer.
+     */
+    gensiods coalesce_bytes;
+    gensio_time coalesce_time;
+    struct gensio_timer *coalesce_timer;
+    bool coalesce_timer_running;
+    bool coalescing;
+
+    /*
+     * Low priority, see gensio_fd_ll_set_lowprio().  Reads stop while
+     * the os funcs is overloaded, while throttle_timer is running the
+     * ll is throttled and waiting to look again.
+     */
+    bool lowprio;
+    struct gensio_timer *throttle_timer;
+    bool throttle_timer_running;
+
+    /*
+     * In the user's read callback, and the user took read_data with
+     * GENSIO_CONTROL_TAKE_READ_BUF during it.
+     */
+    bool in_read_cb;
+    bool read_data_lent;
+
     bool in_read;
     bool in_write;
 
@@ -150,6 +212,23 @@ struct fd_ll {
     bool deferred_close;
     bool deferred_except;
 
+    /*
+     * The iod is edge triggered, see GENSIO_IOD_CONTROL_EDGE.  We get
+     * every event and have to remember if the iod is readable or
+     * writable.  The seq values count events, so a read or write
+     * that got nothing doesn't clear the ready from an event that
+     * came in while it was running.
+     */
+    bool edge;
+    bool read_ready;
+    bool write_ready;
+    bool except_ready;
+    unsigned int read_seq;
+    unsigned int write_seq;
+    bool deferred_edge_read;
+    bool deferred_edge_write;
+    bool deferred_edge_except;
+
 #ifdef DEBUG_STATE
     struct fd_state_trace trace[STATE_TRACE_LEN];
     unsigned int trace_pos;
@@ -159,6 +238,9 @@ struct fd_ll {
 #define ll_to_fd(v) ((struct fd_ll *) gensio_ll_get_user_data(v))
 
 static void fd_handle_write_ready(struct fd_ll *fdll, struct gensio_iod *iod);
+static void fd_do_read_ready(struct fd_ll *fdll);
+static void fd_sched_deferred_op(struct fd_ll *fdll);
+static void fd_except_ready(struct gensio_iod *iod, void *cbdata);
 
 static void fd_finish_free(struct fd_ll *fdll)
 {
@@ -168,10 +250,17 @@ static void fd_finish_free(struct fd_ll *fdll)
 	fdll->o->free_lock(fdll->lock);
     if (fdll->close_timer)
 	fdll->o->free_timer(fdll->close_timer);
+    if (fdll->coalesce_timer)
+	fdll->o->free_timer(fdll->coalesce_timer);
+    if (fdll->throttle_timer)
+	fdll->o->free_timer(fdll->throttle_timer);
     if (fdll->deferred_op_runner)
 	fdll->o->free_runner(fdll->deferred_op_runner);
-    if (fdll->read_data)
-	fdll->o->free(fdll->o, fdll->read_data);
+    if (fdll->read_data) {
+	gensio_os_buf_free(fdll->o, fdll->read_data);
+	if (fdll->read_buf_min)
+	    gensio_os_readbuf_release(fdll->o, fdll->read_data_size);
+    }
     if (fdll->ops)
 	fdll->ops->free(fdll->handler_data);
     fdll->o->free(fdll->o, fdll);
@@ -337,12 +426,198 @@ fd_write(struct gensio_ll *ll, gensiods *rcount,
 	 const char *const *auxdata)
 {
     struct fd_ll *fdll = ll_to_fd(ll);
+    unsigned int seq = 0;
+    gensiods i, count = 0, total = 0;
+    int err;
+
+    if (fdll->edge) {
+	fd_lock(fdll);
+	seq = fdll->write_seq;
+	fd_unlock(fdll);
+    }
 
     if (fdll->ops->write)
-	return fdll->ops->write(fdll->handler_data, fdll->iod,
-				rcount, sg, sglen, auxdata);
+	err = fdll->ops->write(fdll->handler_data, fdll->iod,
+			       &count, sg, sglen, auxdata);
+    else
+	err = fdll->o->write(fdll->iod, sg, sglen, &count);
+    if (err)
+	return err;
+
+    if (fdll->edge) {
+	for (i = 0; i < sglen; i++)
+	    total += sg[i].buflen;
+	if (count < total) {
+	    /* It's full, wait for the next write event. */
+	    fd_lock(fdll);
+	    if (seq == fdll->write_seq)
+		fdll->write_ready = false;
+	    fd_unlock(fdll);
+	}
+    }
+    if (rcount)
+	*rcount = count;
+    return 0;
+}
+
+/*
+ * With an edge triggered iod, nothing will call us if the iod was
+ * already readable or writable when it was enabled, so do it from
+ * the deferred op.  Must be called with the lock held.
+ */
+static void
+fd_edge_check(struct fd_ll *fdll)
+{
+    if (!fdll->edge || fdll->state != FD_OPEN)
+	return;
+
+    /* A throttled ll comes back from the throttle timer. */
+    if (fdll->read_enabled && fdll->read_ready && !fdll->in_read &&
+		!fdll->throttle_timer_running)
+	fdll->deferred_edge_read = true;
+    if (fdll->write_enabled && fdll->write_ready && !fdll->in_write)
+	fdll->deferred_edge_write = true;
+    if (fdll->except_ready && (fdll->read_enabled || fdll->write_enabled))
+	fdll->deferred_edge_except = true;
+    if (fdll->deferred_edge_read || fdll->deferred_edge_write ||
+		fdll->deferred_edge_except)
+	fd_sched_deferred_op(fdll);
+}
+
+/*
+ * Grow an adaptive read buffer when reads fill it, shrink it after
+ * this many reads in a row use a quarter of it or less.
+ */
+#define FD_READBUF_SHRINK_READS 8
+
+static int
+fd_readbuf_get(struct fd_ll *fdll)
+{
+    gensiods size;
+
+    size = gensio_os_readbuf_reserve(fdll->o, fdll->read_buf_next,
+				     fdll->read_buf_min);
+    fdll->read_data = gensio_os_buf_alloc(fdll->o, size);
+    if (!fdll->read_data) {
+	gensio_os_readbuf_release(fdll->o, size);
+	return GE_NOMEM;
+    }
+    fdll->read_data_size = size;
+    return 0;
+}
+
+/* Give up an adaptive read buffer if nothing is using it. */
+static void
+fd_readbuf_put(struct fd_ll *fdll)
+{
+    if (!fdll->read_buf_min || !fdll->read_data || fdll->read_data_len ||
+		fdll->in_read)
+	return;
+    gensio_os_buf_free(fdll->o, fdll->read_data);
+    gensio_os_readbuf_release(fdll->o, fdll->read_data_size);
+    fdll->read_data = NULL;
+    fdll->read_data_size = 0;
+}
+
+static void
+fd_readbuf_adapt(struct fd_ll *fdll, gensiods count)
+{
+    if (count == fdll->read_data_size) {
+	fdll->read_buf_small = 0;
+	if (fdll->read_data_size < fdll->read_buf_max) {
+	    fdll->read_buf_next = fdll->read_data_size * 2;
+	    if (fdll->read_buf_next > fdll->read_buf_max)
+		fdll->read_buf_next = fdll->read_buf_max;
+	}
+    } else if (count > fdll->read_data_size / 4) {
+	fdll->read_buf_small = 0;
+    } else if (++fdll->read_buf_small >= FD_READBUF_SHRINK_READS) {
+	fdll->read_buf_small = 0;
+	fdll->read_buf_next /= 2;
+	if (fdll->read_buf_next < fdll->read_buf_min)
+	    fdll->read_buf_next = fdll->read_buf_min;
+    }
+}
+
+/*
+ * Decide whether to hold a short read back to coalesce it with the
+ * reads that follow.  Only data that was just read is held, not data
+ * the user left behind.  Must be called with the lock held.
+ */
+static bool
+fd_coalesce_hold(struct fd_ll *fdll, bool did_read, bool full)
+{
+    if (!fdll->coalesce_bytes || !fdll->read_data_len || fdll->auxdata)
+	return false;
+    if (fdll->coalescing && !fdll->read_enabled)
+	/* Keep it until reads are enabled again. */
+	return true;
+    if (!did_read || full || fdll->read_data_len >= fdll->coalesce_bytes ||
+		fdll->state != FD_OPEN || !fdll->read_enabled)
+	return false;
+
+    fdll->coalescing = true;
+    if (!fdll->coalesce_timer_running) {
+	if (fdll->o->start_timer(fdll->coalesce_timer,
+				 &fdll->coalesce_time) != 0)
+	    return false;
+	fdll->coalesce_timer_running = true;
+	fd_ref(fdll);
+    }
+    return true;
+}
+
+static void
+fd_coalesce_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct fd_ll *fdll = cb_data;
+
+    fd_lock(fdll);
+    fdll->coalesce_timer_running = false;
+    if (fdll->coalescing && fdll->state == FD_OPEN) {
+	/* Deliver what we have from the deferred op. */
+	fdll->coalescing = false;
+	fdll->deferred_read = true;
+	fd_sched_deferred_op(fdll);
+    }
+    fd_deref_and_unlock(fdll); /* Lose the timer ref. */
+}
+
+/*
+ * For a low priority ll, decide whether to hold off reading because
+ * the os funcs is overloaded.  Must be called with the lock held.
+ */
+static bool
+fd_throttle(struct fd_ll *fdll)
+{
+    gensio_time recheck;
+
+    if (fdll->throttle_timer_running)
+	return true;
+    if (!gensio_os_overloaded(fdll->o, GENSIO_OVERLOAD_THROTTLE_READS,
+			      &recheck))
+	return false;
+    if (fdll->o->start_timer(fdll->throttle_timer, &recheck) != 0)
+	return false;
+    fdll->throttle_timer_running = true;
+    fd_ref(fdll);
+    return true;
+}
 
-    return fdll->o->write(fdll->iod, sg, sglen, rcount);
+static void
+fd_throttle_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct fd_ll *fdll = cb_data;
+
+    fd_lock(fdll);
+    fdll->throttle_timer_running = false;
+    if (fdll->state == FD_OPEN && fdll->read_enabled) {
+	/* The deferred op turns the read handler back on. */
+	if (fdll->edge)
+	    fdll->deferred_edge_read = true;
+	fd_sched_deferred_op(fdll);
+    }
+    fd_deref_and_unlock(fdll); /* Lose the timer ref. */
 }
 
 static void
@@ -351,12 +626,20 @@ fd_deliver_read_data(struct fd_ll *fdll, int err)
     if (err || fdll->read_data_len) {
 	gensiods count;
 
+	fdll->coalescing = false;
     retry:
+	fdll->in_read_cb = true;
 	fd_unlock(fdll);
 	count = gensio_fd_ll_callback(fdll->ll, GENSIO_LL_CB_READ, err,
 				      fdll->read_data + fdll->read_data_pos,
 				      fdll->read_data_len, fdll->auxdata);
 	fd_lock(fdll);
+	fdll->in_read_cb = false;
+	if (fdll->read_data_lent) {
+	    /* The user owns the old buffer, it's all consumed. */
+	    fdll->read_data_lent = false;
+	    count = fdll->read_data_len;
+	}
 	if (err || count >= fdll->read_data_len) {
 	    fdll->read_data_pos = 0;
 	    fdll->read_data_len = 0;
@@ -393,6 +676,7 @@ fd_finish_open(struct fd_ll *fdll, int err)
 	    fdll->o->set_write_handler(fdll->iod, true);
 	fdll->o->set_except_handler(fdll->iod,
 				    fdll->read_enabled || fdll->write_enabled);
+	fd_edge_check(fdll);
     }
 }
 
@@ -434,6 +718,33 @@ fd_deferred_op(struct gensio_runner *runner, void *cbdata)
 	while (fdll->read_enabled && fdll->read_data_len)
 	    fd_deliver_read_data(fdll, 0);
 	fdll->in_read = false;
+	fd_readbuf_put(fdll);
+    }
+
+    if (fdll->deferred_edge_write) {
+	fdll->deferred_edge_write = false;
+	if (fdll->state == FD_OPEN && fdll->write_ready)
+	    fd_handle_write_ready(fdll, fdll->iod);
+    }
+
+    if (fdll->deferred_edge_read) {
+	fdll->deferred_edge_read = false;
+	if (fdll->state == FD_OPEN && fdll->read_enabled &&
+		fdll->read_ready && !fdll->in_read) {
+	    fd_unlock(fdll);
+	    fd_do_read_ready(fdll);
+	    fd_lock(fdll);
+	}
+    }
+
+    if (fdll->deferred_edge_except) {
+	fdll->deferred_edge_except = false;
+	if (fdll->state == FD_OPEN && fdll->except_ready) {
+	    fdll->except_ready = false;
+	    fd_unlock(fdll);
+	    fd_except_ready(fdll->iod, fdll);
+	    fd_lock(fdll);
+	}
     }
 
     if (fdll->deferred_close) {
@@ -442,6 +753,10 @@ fd_deferred_op(struct gensio_runner *runner, void *cbdata)
     }
 
     fdll->deferred_op_pending = false;
+    if (fdll->deferred_edge_read || fdll->deferred_edge_write ||
+		fdll->deferred_edge_except)
+	/* These came in while we were running, do them next time. */
+	fd_sched_deferred_op(fdll);
     if (fdll->state == FD_OPEN) {
 	fdll->o->set_read_handler(fdll->iod, fdll->read_enabled);
 	fdll->o->set_except_handler(fdll->iod,
@@ -487,30 +802,78 @@ fd_handle_incoming(struct fd_ll *fdll,
 {
     int err = 0;
     gensiods count;
+    unsigned int seq, reads = 0;
+    bool full, did_read;
 
     fd_lock_and_ref(fdll);
     if (fdll->in_read || fdll->state == FD_ERR_WAIT ||
 		fdll->state == FD_OPEN_ERR_WAIT)
 	goto out_disable;
+    if (fdll->lowprio && fdll->state == FD_OPEN && fd_throttle(fdll))
+	goto out_disable;
     fdll->in_read = true;
+    gensio_alloc_datapath_enter();
 
-    if (!fdll->read_data_len) {
+    /*
+     * Keep reading while the reads fill the buffer and the user takes
+     * all the data, up to the budget.  A short read means it's empty
+     * (for streams, anyway).
+     */
+ read_more:
+    full = false;
+    did_read = false;
+    if (!fdll->read_data_len && fdll->read_buf_min) {
+	if (fdll->read_data && fdll->read_data_size != fdll->read_buf_next) {
+	    /* Resize it, nothing is in it now. */
+	    gensio_os_buf_free(fdll->o, fdll->read_data);
+	    gensio_os_readbuf_release(fdll->o, fdll->read_data_size);
+	    fdll->read_data = NULL;
+	}
+	if (!fdll->read_data)
+	    err = fd_readbuf_get(fdll);
+    }
+    if (!err && (!fdll->read_data_len ||
+		 (fdll->coalescing && fdll->read_enabled))) {
+	/* When coalescing, add to the data being held. */
+	gensiods pos = fdll->read_data_len;
+
+	seq = fdll->read_seq;
 	fd_unlock(fdll);
-	err = doread(fdll->iod, fdll->read_data, fdll->read_data_size, &count,
-		     &auxdata, cb_data);
+	err = doread(fdll->iod, fdll->read_data + pos,
+		     fdll->read_data_size - pos, &count, &auxdata, cb_data);
 	fd_lock(fdll);
+	did_read = true;
 	if (!err) {
-	    fdll->read_data_len = count;
+	    fdll->read_data_len = pos + count;
 	    fdll->auxdata = auxdata;
+	    if (count == 0 && seq == fdll->read_seq)
+		/* Nothing there, wait for the next read event. */
+		fdll->read_ready = false;
+	    full = fdll->read_data_len == fdll->read_data_size;
+	    if (fdll->read_buf_min && count)
+		fd_readbuf_adapt(fdll, count);
 	}
     }
 
+    if (!err && fd_coalesce_hold(fdll, did_read, full)) {
+	full = false;
+	goto out_read;
+    }
+    if (err && fdll->coalescing)
+	/* Get the held data to the user before the error. */
+	fd_deliver_read_data(fdll, 0);
     fd_deliver_read_data(fdll, err);
 
+    if (!err && full && ++reads < fdll->read_budget &&
+		fdll->state == FD_OPEN && fdll->read_enabled &&
+		!fdll->read_data_len)
+	goto read_more;
+
     if (err) {
 	switch(fdll->state) {
 	case FD_IN_OPEN:
 	case FD_IN_OPEN_RETRY:
+	case FD_IN_OPEN_WAIT:
 	case FD_OPEN_ERR_WAIT:
 	case FD_CLOSED:
 	    assert(0); /* Should not be possible. */
@@ -527,7 +890,12 @@ fd_handle_incoming(struct fd_ll *fdll,
 	    break;
 	}
     }
+ out_read:
+    gensio_alloc_datapath_exit();
     fdll->in_read = false;
+    if (!full)
+	/* Probably nothing more for a while, don't hold the buffer. */
+	fd_readbuf_put(fdll);
     /*
      * We could turn off read when there is pending data, but
      * if the user is doing their job right, it shouldn't matter.
@@ -540,6 +908,8 @@ fd_handle_incoming(struct fd_ll *fdll,
 	fdll->o->set_read_handler(fdll->iod, false);
 	fdll->o->set_except_handler(fdll->iod, fdll->write_enabled);
     }
+    /* An edge triggered iod may still have data, come back for it. */
+    fd_edge_check(fdll);
     fd_deref_and_unlock(fdll);
 }
 
@@ -565,10 +935,8 @@ gensio_ll_fd_read(struct gensio_iod *iod, void *buf, gensiods count, gensiods *r
 }
 
 static void
-fd_read_ready(struct gensio_iod *iod, void *cbdata)
+fd_do_read_ready(struct fd_ll *fdll)
 {
-    struct fd_ll *fdll = cbdata;
-
     if (fdll->ops->read_ready) {
 	fdll->ops->read_ready(fdll->handler_data, fdll->iod);
 	return;
@@ -577,6 +945,28 @@ fd_read_ready(struct gensio_iod *iod, void *cbdata)
     fd_handle_incoming(fdll, gensio_ll_fd_read, NULL, fdll);
 }
 
+static void
+fd_read_ready(struct gensio_iod *iod, void *cbdata)
+{
+    struct fd_ll *fdll = cbdata;
+
+    if (fdll->edge) {
+	bool do_read;
+
+	fd_lock(fdll);
+	fdll->read_ready = true;
+	fdll->read_seq++;
+	/* If not, it's done when enabled or when the current read is done. */
+	do_read = (fdll->state == FD_OPEN && fdll->read_enabled &&
+		   !fdll->in_read);
+	fd_unlock(fdll);
+	if (!do_read)
+	    return;
+    }
+
+    fd_do_read_ready(fdll);
+}
+
 static int fd_setup_handlers(struct fd_ll *fdll);
 
 static void
@@ -627,6 +1017,7 @@ fd_handle_write_ready(struct fd_ll *fdll, struct gensio_iod *iod)
 	    fdll->o->set_write_handler(iod, false);
 	    fdll->o->set_except_handler(iod, fdll->read_enabled);
 	}
+	fd_edge_check(fdll);
     } else {
 	fdll->o->set_write_handler(iod, false);
 	fdll->o->set_except_handler(iod, fdll->read_enabled);
@@ -639,7 +1030,15 @@ fd_write_ready(struct gensio_iod *iod, void *cbdata)
     struct fd_ll *fdll = cbdata;
 
     fd_lock_and_ref(fdll);
+    if (fdll->edge) {
+	fdll->write_ready = true;
+	fdll->write_seq++;
+	if (fdll->state == FD_OPEN && (!fdll->write_enabled || fdll->in_write))
+	    /* Done when enabled or when the current write is done. */
+	    goto out;
+    }
     fd_handle_write_ready(fdll, iod);
+ out:
     fd_deref_and_unlock(fdll);
 }
 
@@ -650,6 +1049,13 @@ fd_except_ready(struct gensio_iod *iod, void *cbdata)
     int rv = 0;
 
     fd_lock(fdll);
+    if (fdll->edge && fdll->state == FD_OPEN && !fdll->read_enabled &&
+		!fdll->write_enabled) {
+	/* Nobody wants it now, handle it when something is enabled. */
+	fdll->except_ready = true;
+	fd_unlock(fdll);
+	return;
+    }
     /*
      * In some cases, if a connect() call fails, we get an exception,
      * not a write ready.  So in the open case, call write ready.
@@ -782,7 +1188,17 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
     fdll->read_data_pos = 0;
 
     err = fdll->ops->sub_open(fdll->handler_data, &fdll->iod);
-    if (err == GE_INPROGRESS || err == 0) {
+    if (err == GE_INPROGRESS && !fdll->iod) {
+	/*
+	 * Waiting on something besides the fd.  Hold an extra ref
+	 * until gensio_fd_ll_open_continue() gets called.
+	 */
+	fdll->open_done = done;
+	fdll->open_data = open_data;
+	fd_set_state(fdll, FD_IN_OPEN_WAIT);
+	fd_ref(fdll);
+	fd_ref(fdll);
+    } else if (err == GE_INPROGRESS || err == 0) {
 	int err2 = fd_setup_handlers(fdll);
 	if (err2) {
 	    err = err2;
@@ -807,6 +1223,43 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
     return err;
 }
 
+void
+gensio_fd_ll_open_continue(struct gensio_ll *ll)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    int err;
+
+    fd_lock(fdll);
+    if (fdll->state != FD_IN_OPEN_WAIT)
+	/* Closed while waiting, or a later open got there first. */
+	goto out;
+
+    err = fdll->ops->sub_open(fdll->handler_data, &fdll->iod);
+    if (err == GE_INPROGRESS && !fdll->iod) {
+	/* Waiting on something else now, keep the wait ref. */
+	fd_unlock(fdll);
+	return;
+    }
+    if (err == GE_INPROGRESS || err == 0) {
+	int err2 = fd_setup_handlers(fdll);
+	if (err2) {
+	    err = err2;
+	    fdll->o->close(&fdll->iod);
+	}
+    }
+    if (err == GE_INPROGRESS) {
+	fd_set_state(fdll, FD_IN_OPEN);
+	fdll->o->set_write_handler(fdll->iod, true);
+	fdll->o->set_except_handler(fdll->iod, true);
+    } else {
+	if (err)
+	    fd_deref(fdll); /* Lose the open ref. */
+	fd_finish_open(fdll, err);
+    }
+ out:
+    fd_deref_and_unlock(fdll); /* Lose the wait ref. */
+}
+
 static int
 fd_setup_handlers(struct fd_ll *fdll)
 {
@@ -814,6 +1267,13 @@ fd_setup_handlers(struct fd_ll *fdll)
 				 fd_write_ready, fd_except_ready,
 				 fd_cleared))
 	return GE_NOMEM;
+
+    /* Use edge triggering if the OS handler is set up for it. */
+    fdll->read_ready = false;
+    fdll->write_ready = false;
+    fdll->except_ready = false;
+    fdll->edge = fdll->o->iod_control(fdll->iod, GENSIO_IOD_CONTROL_EDGE,
+				      false, 0) == 0;
     return 0;
 }
 
@@ -829,6 +1289,7 @@ static int fd_close(struct gensio_ll *ll, gensio_ll_close_done done,
     switch(fdll->state) {
     case FD_IN_OPEN:
     case FD_IN_OPEN_RETRY:
+    case FD_IN_OPEN_WAIT:
 	fdll->open_err = GE_LOCALCLOSED;
 	/* Fallthrough */
     case FD_OPEN_ERR_WAIT:
@@ -864,6 +1325,9 @@ fd_set_read_callback_enable(struct gensio_ll *ll, bool enabled)
     fd_lock(fdll);
     if (fdll->write_only)
 	goto out_unlock;
+    if (enabled && fdll->read_enabled && fdll->coalescing)
+	/* Nothing changes, don't cut the coalescing short. */
+	goto out_unlock;
     fdll->read_enabled = enabled;
 
     if (fdll->in_read || fdll->state != FD_OPEN ||
@@ -876,6 +1340,7 @@ fd_set_read_callback_enable(struct gensio_ll *ll, bool enabled)
     } else {
 	fdll->o->set_read_handler(fdll->iod, enabled);
 	fdll->o->set_except_handler(fdll->iod, enabled || fdll->write_enabled);
+	fd_edge_check(fdll);
     }
  out_unlock:
     fd_unlock(fdll);
@@ -894,6 +1359,7 @@ fd_set_write_callback_enable(struct gensio_ll *ll, bool enabled)
 		fdll->state == FD_IN_OPEN_RETRY) {
 	fdll->o->set_write_handler(fdll->iod, enabled);
 	fdll->o->set_except_handler(fdll->iod, enabled || fdll->read_enabled);
+	fd_edge_check(fdll);
     } else if (fdll->deferred_except) {
 	fd_sched_deferred_op(fdll);
     }
@@ -927,11 +1393,95 @@ static void fd_free(struct gensio_ll *ll)
     fd_deref_and_unlock(fdll);
 }
 
+static int
+fd_take_read_buf(struct fd_ll *fdll, struct gensio_take_read_buf *d)
+{
+    struct gensio_os_funcs *o = fdll->o;
+    unsigned char *nbuf;
+    int rv = 0;
+
+    fd_lock(fdll);
+    if (!fdll->in_read_cb || fdll->read_data_lent || !fdll->read_data_len ||
+		d->buf != fdll->read_data + fdll->read_data_pos ||
+		d->buflen != fdll->read_data_len) {
+	/* Not our buffer, maybe a filter is delivering its own data. */
+	rv = GE_NOTSUP;
+	goto out_unlock;
+    }
+
+    nbuf = gensio_os_buf_alloc(o, fdll->read_data_size);
+    if (!nbuf) {
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
+    d->rbuf = gensio_rbuf_alloc(o, fdll->read_data,
+				fdll->read_data + fdll->read_data_pos,
+				fdll->read_data_len);
+    if (!d->rbuf) {
+	gensio_os_buf_free(o, nbuf);
+	rv = GE_NOMEM;
+	goto out_unlock;
+    }
+    fdll->read_data = nbuf;
+    fdll->read_data_lent = true;
+
+ out_unlock:
+    fd_unlock(fdll);
+    return rv;
+}
+
+/* The smallest read buffer when compaction is turned on. */
+#define FD_COMPACT_READBUF_MIN 1024
+
+/* Report the memory held, or turn on compaction of the read buffer. */
+static int
+fd_mem_control(struct gensio_ll *ll, bool get, char *data, gensiods *datalen)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    gensiods size = sizeof(*fdll);
+
+    if (!get) {
+	if (strtoul(data, NULL, 0))
+	    gensio_fd_ll_set_readbuf_min(ll, FD_COMPACT_READBUF_MIN);
+	return 0;
+    }
+    fd_lock(fdll);
+    if (fdll->read_data)
+	size += fdll->read_data_size;
+    fd_unlock(fdll);
+    *datalen = snprintf(data, *datalen, "%lu", (unsigned long) size);
+    return 0;
+}
+
 static int fd_control(struct gensio_ll *ll, bool get, unsigned int option,
 		      char *data, gensiods *datalen)
 {
     struct fd_ll *fdll = ll_to_fd(ll);
 
+    if (option == GENSIO_CONTROL_MEM)
+	return fd_mem_control(ll, get, data, datalen);
+
+    if (option == GENSIO_CONTROL_TAKE_READ_BUF) {
+	if (!get || *datalen != sizeof(struct gensio_take_read_buf))
+	    return GE_INVAL;
+	return fd_take_read_buf(fdll, (struct gensio_take_read_buf *) data);
+    }
+
+#ifndef _WIN32
+    if (option == GENSIO_CONTROL_RAW_FD) {
+	int fd;
+
+	/* Gensios with their own read handling (pty, sctp) can't do this. */
+	if (!get || fdll->ops->read_ready)
+	    return GE_NOTSUP;
+	if (!fdll->iod)
+	    return GE_NOTREADY;
+	fd = fdll->o->iod_get_fd(fdll->iod);
+	*datalen = snprintf(data, *datalen, "%d %d", fd, fd);
+	return 0;
+    }
+#endif
+
     if (!fdll->ops->control)
 	return GE_NOTSUP;
 
@@ -987,11 +1537,106 @@ gensio_ll_fd_func(struct gensio_ll *ll, int op, gensiods *count,
 	fd_disable(ll);
 	return 0;
 
+    case GENSIO_LL_FUNC_ALLOC_CHANNEL:
+    {
+	struct fd_ll *fdll = ll_to_fd(ll);
+
+	if (!fdll->ops->alloc_channel)
+	    return GE_NOTSUP;
+	return fdll->ops->alloc_channel(fdll->handler_data, buf);
+    }
+
     default:
 	return GE_NOTSUP;
     }
 }
 
+void
+gensio_fd_ll_set_read_budget(struct gensio_ll *ll, unsigned int budget)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    fdll->read_budget = budget ? budget : 1;
+    fd_unlock(fdll);
+}
+
+void
+gensio_fd_ll_set_readbuf_min(struct gensio_ll *ll, gensiods min)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    if (fdll->read_buf_min || !fdll->read_buf_max ||
+		min >= fdll->read_buf_max)
+	goto out_unlock;
+    if (fdll->read_data && (fdll->in_read || fdll->read_data_len))
+	/* Already reading, too late to switch. */
+	goto out_unlock;
+    if (min == 0)
+	min = 1;
+
+    if (fdll->read_data) {
+	gensio_os_buf_free(fdll->o, fdll->read_data);
+	fdll->read_data = NULL;
+	fdll->read_data_size = 0;
+    }
+    fdll->read_buf_min = min;
+    fdll->read_buf_next = min;
+ out_unlock:
+    fd_unlock(fdll);
+}
+
+int
+gensio_fd_ll_set_read_coalesce(struct gensio_ll *ll, gensiods bytes,
+			       gensio_time *time)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    int err = 0;
+
+    fd_lock(fdll);
+    if (fdll->read_buf_min || fdll->in_read || fdll->read_data_len) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (bytes > fdll->read_buf_max)
+	bytes = fdll->read_buf_max;
+    if (bytes && !fdll->coalesce_timer) {
+	fdll->coalesce_timer = fdll->o->alloc_timer(fdll->o,
+						    fd_coalesce_timeout, fdll);
+	if (!fdll->coalesce_timer) {
+	    err = GE_NOMEM;
+	    goto out_unlock;
+	}
+    }
+    fdll->coalesce_bytes = bytes;
+    fdll->coalesce_time = *time;
+ out_unlock:
+    fd_unlock(fdll);
+    return err;
+}
+
+int
+gensio_fd_ll_set_lowprio(struct gensio_ll *ll, bool lowprio)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    int err = 0;
+
+    fd_lock(fdll);
+    if (lowprio && !fdll->throttle_timer) {
+	fdll->throttle_timer = fdll->o->alloc_timer(fdll->o,
+						    fd_throttle_timeout, fdll);
+	if (!fdll->throttle_timer) {
+	    err = GE_NOMEM;
+	    goto out_unlock;
+	}
+    }
+    fdll->lowprio = lowprio;
+ out_unlock:
+    fd_unlock(fdll);
+    return err;
+}
+
 void *
 gensio_fd_ll_get_handler_data(struct gensio_ll *ll)
 {
@@ -1040,8 +1685,10 @@ fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 	goto out_nomem;
 
     fdll->read_data_size = max_read_size;
+    fdll->read_buf_max = max_read_size;
+    fdll->read_budget = 1;
     if (max_read_size > 0) {
-	fdll->read_data = o->zalloc(o, max_read_size);
+	fdll->read_data = gensio_os_buf_alloc(o, max_read_size);
 	if (!fdll->read_data)
 	    goto out_nomem;
     }
@@ -16,6 +16,7 @@
 struct gensio_ll_child {
     struct gensio_ll *ll;
     struct gensio_os_funcs *o;
+    struct gensio_arena *arena;
     gensio_ll_cb cb;
     void *cb_data;
 
@@ -103,13 +104,28 @@ static void child_set_write_callback_enable(struct gensio_ll *ll, bool enabled)
     gensio_set_write_callback_enable(cdata->child, enabled);
 }
 
+static int
+child_detach(struct gensio_ll *ll, struct gensio **child)
+{
+    struct gensio_ll_child *cdata = ll_to_child(ll);
+
+    if (!cdata->child)
+	return GE_NOTSUP;
+    if (!child)
+	return 0;
+    *child = cdata->child;
+    cdata->child = NULL;
+    return 0;
+}
+
 static void child_free(struct gensio_ll *ll)
 {
     struct gensio_ll_child *cdata = ll_to_child(ll);
 
-    gensio_free(cdata->child);
+    if (cdata->child)
+	gensio_free(cdata->child);
     gensio_ll_free_data(cdata->ll);
-    cdata->o->free(cdata->o, cdata);
+    gensio_setup_free(cdata->o, cdata->arena, cdata);
 }
 
 static int
@@ -143,6 +159,9 @@ gensio_ll_child_func(struct gensio_ll *ll, int op, gensiods *count,
 	child_free(ll);
 	return 0;
 
+    case GENSIO_LL_FUNC_DETACH_CHILD:
+	return child_detach(ll, buf);
+
     default:
 	return GE_NOTSUP;
     }
@@ -177,15 +196,17 @@ gensio_gensio_ll_alloc(struct gensio_os_funcs *o,
 		       struct gensio *child)
 {
     struct gensio_ll_child *cdata;
+    struct gensio_arena *arena;
 
-    cdata = o->zalloc(o, sizeof(*cdata));
+    cdata = gensio_setup_zalloc(o, sizeof(*cdata), &arena);
     if (!cdata)
 	return NULL;
 
     cdata->o = o;
+    cdata->arena = arena;
     cdata->ll = gensio_ll_alloc_data(o, gensio_ll_child_func, cdata);
     if (!cdata->ll) {
-	o->free(o, cdata);
+	gensio_setup_free(o, arena, cdata);
 	return NULL;
     }
 
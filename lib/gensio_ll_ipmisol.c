@@ -581,6 +581,15 @@ struct sol_ll {
     struct gensio_buffer read_data;
     gensiods max_write_size;
 
+    /*
+     * The most to hand to OpenIPMI in one write.  OpenIPMI packs
+     * queued data into packets of the size the BMC gives, so bigger
+     * writes just mean fewer completions to handle.  This starts at
+     * max_write_size and is cut down if OpenIPMI can't take that much
+     * at once.
+     */
+    gensiods write_chunk;
+
     /*
      * If the connection is closed or goes down from the remote end,
      * this hold the error to return (if non-zero);
@@ -630,6 +639,9 @@ struct sol_ll {
     struct sol_op_done *ri_done;
 };
 
+/* Don't cut write_chunk down below this. */
+#define SOL_MIN_WRITE_CHUNK 255
+
 /* Used to hold information about pending transmits. */
 struct sol_tc {
     unsigned int size;
@@ -930,6 +942,7 @@ sol_write(struct gensio_ll *ll, gensiods *rcount,
     struct sol_tc *tc;
     gensiods left, i, total_write = 0, pos = 0;
     unsigned char *buf = NULL;
+    const unsigned char *wbuf;
 
     sol_lock(solll);
     if (solll->state != SOL_OPEN) {
@@ -948,19 +961,25 @@ sol_write(struct gensio_ll *ll, gensiods *rcount,
 	goto out_finish;
     }
 
-    buf = solll->o->zalloc(solll->o, total_write);
-    if (!buf) {
-	err = GE_NOMEM;
-	goto out_unlock;
-    }
-    for (i = 0; i < sglen; i++) {
-	if (sg[i].buflen >= total_write - pos) {
-	    memcpy(buf + pos, sg[i].buf, total_write - pos);
-	    break;
-	} else {
-	    memcpy(buf + pos, sg[i].buf, sg[i].buflen);
-	    pos += sg[i].buflen;
+    if (sg[0].buflen >= total_write) {
+	/* OpenIPMI copies the data, no need to make our own copy. */
+	wbuf = sg[0].buf;
+    } else {
+	buf = solll->o->zalloc(solll->o, total_write);
+	if (!buf) {
+	    err = GE_NOMEM;
+	    goto out_unlock;
+	}
+	for (i = 0; i < sglen; i++) {
+	    if (sg[i].buflen >= total_write - pos) {
+		memcpy(buf + pos, sg[i].buf, total_write - pos);
+		break;
+	    } else {
+		memcpy(buf + pos, sg[i].buf, sg[i].buflen);
+		pos += sg[i].buflen;
+	    }
 	}
+	wbuf = buf;
     }
 
     pos = 0;
@@ -974,13 +993,22 @@ sol_write(struct gensio_ll *ll, gensiods *rcount,
 	    }
 	    goto out_finish;
 	}
-	if (total_write - pos > 255)
-	    tc->size = 255;
+	if (total_write - pos > solll->write_chunk)
+	    tc->size = solll->write_chunk;
 	else
 	    tc->size = total_write - pos;
 	tc->solll = solll;
-	err = ipmi_sol_write(solll->sol, buf + pos, tc->size,
+	err = ipmi_sol_write(solll->sol, wbuf + pos, tc->size,
 			     transmit_complete, tc);
+	if (err == EAGAIN && solll->write_outstanding == 0 &&
+		tc->size > SOL_MIN_WRITE_CHUNK) {
+	    /* Nothing pending and it's full, it can't take this much. */
+	    solll->write_chunk = tc->size / 2;
+	    if (solll->write_chunk < SOL_MIN_WRITE_CHUNK)
+		solll->write_chunk = SOL_MIN_WRITE_CHUNK;
+	    solll->o->free(solll->o, tc);
+	    continue;
+	}
 	if (err) {
 	    solll->o->free(solll->o, tc);
 	    if (pos == 0 && err != EAGAIN) {
@@ -2039,6 +2067,9 @@ ipmisol_gensio_ll_alloc(struct gensio_pparm_info *p,
 	goto out_nomem;
 
     solll->max_write_size = max_write_size;
+    solll->write_chunk = max_write_size;
+    if (solll->write_chunk < SOL_MIN_WRITE_CHUNK)
+	solll->write_chunk = SOL_MIN_WRITE_CHUNK;
 
     solll->ll = gensio_ll_alloc_data(o, gensio_ll_sol_func, solll);
     if (!solll->ll)
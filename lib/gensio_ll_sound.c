@@ -311,7 +311,7 @@ get_int(const unsigned char **in, unsigned int size,
     case 2:
 	v = *((int16_t *) *in);
 	if (host_bswap)
-	    v = bswap_16(v);
+	    v = (int16_t) bswap_16(v);
 	(*in) += 2;
 	break;
 
@@ -465,6 +465,15 @@ struct sound_cnv_info {
 		   struct sound_cnv_info *info);
     void (*convout)(const unsigned char **in, unsigned char **out,
 		    struct sound_cnv_info *info);
+    /*
+     * Convert a whole buffer of nsamples samples at once.  These are
+     * specialized for the common formats and fall back to calling
+     * convin/convout for each sample.
+     */
+    void (*convin_block)(const unsigned char *in, unsigned char *out,
+			 gensiods nsamples, struct sound_cnv_info *info);
+    void (*convout_block)(const unsigned char *in, unsigned char *out,
+			  gensiods nsamples, struct sound_cnv_info *info);
     unsigned char *buf; /* PCM buffer(s) */
 };
 
@@ -548,6 +557,112 @@ conv_float_to_float_out(const unsigned char **in, unsigned char **out,
     put_float(v, out, info->psize, info->host_bswap);
 }
 
+static void
+conv_generic_in_block(const unsigned char *in, unsigned char *out,
+		      gensiods nsamples, struct sound_cnv_info *info)
+{
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	info->convin(&in, &out, info);
+}
+
+static void
+conv_generic_out_block(const unsigned char *in, unsigned char *out,
+		       gensiods nsamples, struct sound_cnv_info *info)
+{
+    gensiods i;
+
+    for (i = 0; i < nsamples; i++)
+	info->convout(&in, &out, info);
+}
+
+/*
+ * Whole-buffer converters for the common cases of a float user
+ * format with a signed 16 or 32 bit PCM format.  These are written
+ * as simple loops with the byteswap test hoisted out so the compiler
+ * can vectorize them.  They give the same results as the per-sample
+ * converters above.
+ */
+static void
+conv_s16_to_float_in_block(const unsigned char *in, unsigned char *out,
+			   gensiods nsamples, struct sound_cnv_info *info)
+{
+    const int16_t *s = (const int16_t *) in;
+    float *d = (float *) out;
+    float scale = info->scale_in;
+    gensiods i;
+
+    if (info->host_bswap) {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = (int16_t) bswap_16((uint16_t) s[i]) * scale;
+    } else {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = s[i] * scale;
+    }
+}
+
+static void
+conv_float_to_s16_out_block(const unsigned char *in, unsigned char *out,
+			    gensiods nsamples, struct sound_cnv_info *info)
+{
+    const float *s = (const float *) in;
+    int16_t *d = (int16_t *) out;
+    float scale = info->scale_out;
+    gensiods i;
+
+    /*
+     * Scaling by a power of two is exact in float, and adding .5 to
+     * something less than 2^16 can't round across an integer, so
+     * single precision gives the same result as the double math used
+     * by conv_float_to_int_out().
+     */
+    if (info->host_bswap) {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = bswap_16((uint16_t) (int32_t) (s[i] * scale + .5f));
+    } else {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = (int32_t) (s[i] * scale + .5f);
+    }
+}
+
+static void
+conv_s32_to_float_in_block(const unsigned char *in, unsigned char *out,
+			   gensiods nsamples, struct sound_cnv_info *info)
+{
+    const int32_t *s = (const int32_t *) in;
+    float *d = (float *) out;
+    float scale = info->scale_in;
+    gensiods i;
+
+    if (info->host_bswap) {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = (int32_t) bswap_32((uint32_t) s[i]) * scale;
+    } else {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = s[i] * scale;
+    }
+}
+
+static void
+conv_float_to_s32_out_block(const unsigned char *in, unsigned char *out,
+			    gensiods nsamples, struct sound_cnv_info *info)
+{
+    const float *s = (const float *) in;
+    int32_t *d = (int32_t *) out;
+    double scale = info->scale_out;
+    gensiods i;
+
+    /* Needs double, float can't hold the rounding for 32-bit values. */
+    if (info->host_bswap) {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = bswap_32((uint32_t) (int32_t) (s[i] * scale + .5));
+    } else {
+	for (i = 0; i < nsamples; i++)
+	    d[i] = (int32_t) (s[i] * scale + .5);
+    }
+}
+
 struct sound_type {
     const char *name;
     int (*setup)(struct gensio_pparm_info *p,
@@ -565,6 +680,12 @@ struct sound_type {
     unsigned int (*start_close)(struct sound_info *si);
     /* Return number of frames left to send. */
     unsigned long (*drain_count)(struct sound_info *si);
+    /*
+     * Return the period and buffer size on the device and the
+     * current delay, all in frames.  Optional.
+     */
+    int (*latency)(struct sound_info *si, gensiods *period,
+		   gensiods *buffer, long *delay);
     int (*devices)(char ***rnames, char ***rspecs, gensiods *rcount);
 };
 
@@ -634,6 +755,19 @@ setup_convv(struct sound_info *si, enum gensio_sound_fmt_type pfmt)
 	si->cnv.convout = conv_int_to_int_out;
     }
 
+    si->cnv.convin_block = conv_generic_in_block;
+    si->cnv.convout_block = conv_generic_out_block;
+    if (uinfo->isfloat && uinfo->size == 4 && !pinfo->isfloat &&
+		!pinfo->offset) {
+	if (pinfo->size == 2) {
+	    si->cnv.convin_block = conv_s16_to_float_in_block;
+	    si->cnv.convout_block = conv_float_to_s16_out_block;
+	} else if (pinfo->size == 4) {
+	    si->cnv.convin_block = conv_s32_to_float_in_block;
+	    si->cnv.convout_block = conv_float_to_s32_out_block;
+	}
+    }
+
     si->cnv.enabled = true;
 }
 
@@ -847,6 +981,7 @@ static int gensio_sound_api_default_write(struct sound_info *out,
 #endif
 
 #include "file_sound.h"
+#include "share_sound.h"
 
 static void
 gensio_sound_ll_check_read(struct sound_ll *soundll)
@@ -1035,12 +1170,11 @@ gensio_sound_api_default_write(struct sound_info *out, gensiods *rcount,
 	    ibuflen = sg[i].buflen / out->framesize;
 	moredata:
 	    tbuf = out->cnv.buf;
-	    for (j = 0; j < ibuflen && j < out->bufsize; j++) {
-		gensiods k;
-
-		for (k = 0; k < out->chans; k++)
-		    out->cnv.convout(&ibuf, &tbuf, &out->cnv);
-	    }
+	    j = ibuflen;
+	    if (j > out->bufsize)
+		j = out->bufsize;
+	    out->cnv.convout_block(ibuf, tbuf, j * out->chans, &out->cnv);
+	    ibuf += j * out->framesize;
 	    if (j == ibuflen)
 		ibuf = NULL;
 	    else
@@ -1109,16 +1243,20 @@ gensio_sound_ll_open(struct sound_ll *soundll,
 	goto out_unlock;
     }
 
-    if (soundll->in.chans) {
-	err = soundll->in.type->open_dev(&soundll->in);
+    /*
+     * Do output first, a shared input's close_dev claims the lock, so
+     * it can't be backed out from here.
+     */
+    if (soundll->out.chans) {
+	err = soundll->out.type->open_dev(&soundll->out);
 	if (err)
 	    goto out_unlock;
     }
-    if (soundll->out.chans) {
-	err = soundll->out.type->open_dev(&soundll->out);
+    if (soundll->in.chans) {
+	err = soundll->in.type->open_dev(&soundll->in);
 	if (err) {
-	    if (soundll->in.chans)
-		soundll->in.type->close_dev(&soundll->in);
+	    if (soundll->out.chans)
+		soundll->out.type->close_dev(&soundll->out);
 	    goto out_unlock;
 	}
     }
@@ -1276,6 +1414,30 @@ gensio_sound_ll_control(struct sound_ll *soundll, bool get, unsigned int option,
 	return 0;
     }
 
+    case GENSIO_CONTROL_IN_LATENCY:
+    case GENSIO_CONTROL_OUT_LATENCY: {
+	gensiods period, buffer;
+	long delay;
+	int err;
+
+	if (!get)
+	    return GE_NOTSUP;
+	if (option == GENSIO_CONTROL_IN_LATENCY)
+	    si = &soundll->in;
+	else
+	    si = &soundll->out;
+	if (!si->type || !si->type->latency)
+	    return GE_NOTSUP;
+	err = si->type->latency(si, &period, &buffer, &delay);
+	if (err)
+	    return err;
+	*datalen = gensio_pos_snprintf(data, *datalen, NULL,
+			"period=%lu buffer=%lu delay=%ld latency_us=%lld",
+			(unsigned long) period, (unsigned long) buffer, delay,
+			(long long) delay * 1000000 / si->samplerate);
+	return 0;
+    }
+
     default:
 	return GE_NOTSUP;
     }
@@ -1368,8 +1530,10 @@ gensio_sound_ll_func(struct gensio_ll *ll, int op,
 
     case GENSIO_LL_FUNC_DISABLE:
 	soundll->stream_running = false;
-	soundll->in.type->close_dev(&soundll->in);
-	soundll->in.type->close_dev(&soundll->out);
+	if (soundll->in.type)
+	    soundll->in.type->close_dev(&soundll->in);
+	if (soundll->out.type)
+	    soundll->out.type->close_dev(&soundll->out);
 	soundll->state = GENSIO_SOUND_LL_CLOSED;
 	return 0;
 
@@ -1410,6 +1574,13 @@ setup_sound_info(struct gensio_pparm_info *p, const char *dir,
     }
 
     si->type = sound_types[i];
+    if (io->share) {
+	if (!isinput) {
+	    gensio_pparm_log(p, "%s: Only input can be shared", dir);
+	    return GE_INVAL;
+	}
+	si->type = &share_sound_type;
+    }
     if (!io->devname) {
 	gensio_pparm_log(p, "%s: No device name", dir);
 	return GE_INVAL;
@@ -1442,7 +1613,8 @@ setup_sound_info(struct gensio_pparm_info *p, const char *dir,
     si->chans = io->chans;
     si->samplerate = io->samplerate;
 
-    err = setup_conv(io->format, io->pformat, si);
+    /* A shared input gets data already converted by the device. */
+    err = setup_conv(io->format, io->share ? NULL : io->pformat, si);
     if (err) {
 	gensio_pparm_log(p, "%s: Unknown format", dir);
 	return err;
@@ -1456,8 +1628,8 @@ setup_sound_info(struct gensio_pparm_info *p, const char *dir,
     if (!si->devname)
 	return GE_NOMEM;
 
-    if (isinput) {
-	/* One buffer for sending to the user. */
+    if (isinput && !io->share) {
+	/* One buffer for sending to the user, shared input uses the ring. */
 	si->buf = o->zalloc(o, io->bufsize * si->framesize);
 	if (!si->buf)
 	    return GE_NOMEM;
@@ -1513,9 +1685,15 @@ gensio_sound_ll_alloc(struct gensio_pparm_info *p,
     if (!soundll->runner)
 	goto out_nomem;
 
-    soundll->lock = o->alloc_lock(o);
-    if (!soundll->lock)
-	goto out_nomem;
+    if (soundll->in.type == &share_sound_type) {
+	struct share_info *pi = soundll->in.pinfo;
+
+	soundll->lock = pi->share->lock;
+    } else {
+	soundll->lock = o->alloc_lock(o);
+	if (!soundll->lock)
+	    goto out_nomem;
+    }
 
     soundll->ll = gensio_ll_alloc_data(o, gensio_sound_ll_func, soundll);
     if (!soundll->ll)
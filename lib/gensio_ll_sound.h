@@ -20,6 +20,8 @@ struct gensio_sound_info {
     unsigned int num_bufs;
     const char *format;
     const char *pformat; /* Format on the PCM side. */
+    bool mmap; /* Use mmap access and timer wakeups if available (alsa). */
+    bool share; /* Input only, share one capture stream with others. */
 };
 
 int gensio_sound_ll_alloc(struct gensio_pparm_info *p,
@@ -28,6 +30,9 @@ int gensio_sound_ll_alloc(struct gensio_pparm_info *p,
 			  struct gensio_sound_info *out,
 			  struct gensio_ll **newll);
 
+/* Must be called before sharing input. */
+int gensio_sound_ll_init(struct gensio_os_funcs *o);
+
 void gensio_sound_devices_free(char **names, char **specs, gensiods count);
 
 int gensio_sound_devices(const char *type,
@@ -22,6 +22,8 @@
 #include <gensio/gensio_os_funcs.h>
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_mdns.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
 #include <gensio/argvutils.h>
 
 enum mdnsn_state {
@@ -29,7 +31,6 @@ enum mdnsn_state {
     MDNSN_IN_OPEN_QUERY,
     MDNSN_IN_CHILD_OPEN,
     MDNSN_OPEN,
-    MDNSN_IN_OPEN_ERR,
     MDNSN_IN_CLOSE,
 };
 
@@ -51,9 +52,18 @@ struct mdnsn_data {
     char *domain;
     char *host;
 
-    bool mdns_in_free;
-    struct gensio_mdns *mdns;
-    struct gensio_mdns_watch *watch;
+    /*
+     * The shared query we get results from.  query_pending is set
+     * while we are on the query's waiter list or query_runner is
+     * scheduled to look at the results.  on_query_list is protected
+     * by the query's lock.
+     */
+    struct mdns_query *query;
+    struct gensio_link query_link;
+    bool on_query_list;
+    bool query_pending;
+    struct gensio_runner *query_runner;
+    gensio_time cache_time;
 
     char *laddr;
     gensiods max_read_size;
@@ -61,7 +71,6 @@ struct mdnsn_data {
     bool nodelay;
     bool nodelay_set;
 
-    int open_err;
     gensio_done_err open_done;
     void *open_data;
 
@@ -76,6 +85,64 @@ struct mdnsn_data {
     struct gensio_runner *deferred_op_runner;
 };
 
+/*
+ * Queries are shared by all the mdns gensios looking for the same
+ * thing.  A query keeps one watch running and caches what it finds,
+ * so opening something that has already been found connects right
+ * away and the watch keeps the cache up to date in the background.
+ * When the last user goes away the query is kept for its cache time
+ * in case it gets used again.
+ *
+ * The query list and refcounts are protected by mdns_query_lock, the
+ * rest of a query by its own lock.  The lock order is an mdnsn lock,
+ * then mdns_query_lock, then a query lock.
+ */
+#define MDNS_DEFAULT_CACHE_TIME 60
+
+struct mdns_query_result {
+    struct gensio_link link;
+    int interface;
+    int ipdomain;
+    char *name;
+    char *type;
+    char *domain;
+    char *host;
+    struct gensio_addr *addr;
+    const char **txt;
+};
+
+struct mdns_query {
+    struct gensio_link link;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
+    int interface;
+    int nettype;
+    char *name;
+    char *type;
+    char *domain;
+    char *host;
+
+    struct gensio_mdns *mdns;
+    struct gensio_mdns_watch *watch;
+
+    struct gensio_list results;
+    bool all_for_now; /* The initial scan is finished. */
+
+    struct gensio_list waiters;
+
+    /* Keeps the query around after the last user is gone. */
+    gensio_time cache_time;
+    gensio_time expire;
+    struct gensio_timer *timer;
+    bool timer_pending;
+};
+
+static struct gensio_os_funcs *mdns_query_o;
+static struct gensio_lock *mdns_query_lock;
+static struct gensio_list mdns_queries;
+
 static void mdnsn_start_deferred_op(struct mdnsn_data *ndata);
 
 static void
@@ -97,6 +164,8 @@ mdnsn_finish_free(struct mdnsn_data *ndata)
 	o->free(o, ndata->host);
     if (ndata->deferred_op_runner)
 	o->free_runner(ndata->deferred_op_runner);
+    if (ndata->query_runner)
+	o->free_runner(ndata->query_runner);
     if (ndata->lock)
 	o->free_lock(ndata->lock);
     o->free(o, ndata);
@@ -134,6 +203,14 @@ mdnsn_deref_and_unlock(struct mdnsn_data *ndata)
     }
 }
 
+/* Only for when another reference is known to be held. */
+static void
+mdnsn_deref(struct mdnsn_data *ndata)
+{
+    assert(ndata->refcount > 1);
+    ndata->refcount--;
+}
+
 static int
 child_cb(struct gensio *io, void *user_data,
 	 int event, int err,
@@ -148,7 +225,7 @@ child_cb(struct gensio *io, void *user_data,
 static void
 mdnsn_check_close(struct mdnsn_data *ndata)
 {
-    if (!ndata->child && !ndata->mdns_in_free) {
+    if (!ndata->child && !ndata->query_pending) {
 	ndata->state = MDNSN_CLOSED;
 	mdnsn_unlock(ndata);
 
@@ -220,21 +297,6 @@ child_closed_cb(struct gensio *io, void *cb_data)
     mdnsn_deref_and_unlock(ndata);
 }
 
-static void
-mdns_freed(struct gensio_mdns *m, void *userdata)
-{
-    struct mdnsn_data *ndata = userdata;
-
-    mdnsn_lock(ndata);
-    ndata->mdns_in_free = false;
-    if (ndata->state == MDNSN_IN_OPEN_ERR) {
-	i_child_open_cb(ndata, ndata->open_err);
-    } else {
-	mdnsn_check_close(ndata);
-    }
-    mdnsn_deref_and_unlock(ndata);
-}
-
 /* Validate that the gensio stack contains only safe gensios. */
 static bool
 gensiostack_ok(const char *s)
@@ -385,143 +447,520 @@ get_mdns_gensiostack(struct mdnsn_data *ndata, const char * const *txt,
     goto out;
 }
 
+static bool
+mdns_streq(const char *s1, const char *s2)
+{
+    if (!s1 || !s2)
+	return s1 == s2;
+    return strcmp(s1, s2) == 0;
+}
+
+static int
+mdns_dupstr(struct gensio_os_funcs *o, const char *src, char **dest)
+{
+    *dest = NULL;
+    if (src) {
+	*dest = gensio_strdup(o, src);
+	if (!*dest)
+	    return GE_NOMEM;
+    }
+    return 0;
+}
+
 static void
-mdns_cb(struct gensio_mdns_watch *w,
-	enum gensio_mdns_data_state state,
-	int interface, int ipdomain,
-	const char *name, const char *type,
-	const char *domain, const char *host,
-	const struct gensio_addr *addr, const char * const *txt,
-	void *userdata)
-{
-    struct mdnsn_data *ndata = userdata;
-    const char **argv = NULL;
-    char *s, *stack = NULL;
-    int err;
+mdns_query_result_free(struct gensio_os_funcs *o, struct mdns_query_result *r)
+{
+    if (r->name)
+	o->free(o, r->name);
+    if (r->type)
+	o->free(o, r->type);
+    if (r->domain)
+	o->free(o, r->domain);
+    if (r->host)
+	o->free(o, r->host);
+    if (r->addr)
+	gensio_addr_free(r->addr);
+    if (r->txt)
+	gensio_argv_free(o, r->txt);
+    o->free(o, r);
+}
 
-    mdnsn_lock(ndata);
-    if (ndata->state != MDNSN_IN_OPEN_QUERY)
+static struct mdns_query_result *
+mdns_query_result_alloc(struct gensio_os_funcs *o,
+			int interface, int ipdomain,
+			const char *name, const char *type,
+			const char *domain, const char *host,
+			const struct gensio_addr *addr,
+			const char * const *txt)
+{
+    struct mdns_query_result *r;
+
+    r = o->zalloc(o, sizeof(*r));
+    if (!r)
+	return NULL;
+
+    r->interface = interface;
+    r->ipdomain = ipdomain;
+    if (mdns_dupstr(o, name, &r->name))
+	goto out_nomem;
+    if (mdns_dupstr(o, type, &r->type))
+	goto out_nomem;
+    if (mdns_dupstr(o, domain, &r->domain))
+	goto out_nomem;
+    if (mdns_dupstr(o, host, &r->host))
+	goto out_nomem;
+    r->addr = gensio_addr_dup(addr);
+    if (!r->addr)
+	goto out_nomem;
+    if (txt && gensio_argv_copy(o, txt, NULL, &r->txt))
+	goto out_nomem;
+
+    return r;
+
+ out_nomem:
+    mdns_query_result_free(o, r);
+    return NULL;
+}
+
+static bool
+mdns_query_result_match(struct mdns_query_result *r,
+			int interface, int ipdomain,
+			const char *name, const char *type,
+			const char *domain, const char *host,
+			const struct gensio_addr *addr)
+{
+    return (r->interface == interface && r->ipdomain == ipdomain &&
+	    mdns_streq(r->name, name) && mdns_streq(r->type, type) &&
+	    mdns_streq(r->domain, domain) && mdns_streq(r->host, host) &&
+	    gensio_addr_equal(r->addr, addr, true, false));
+}
+
+static void
+mdns_query_finish_free(struct mdns_query *q)
+{
+    struct gensio_os_funcs *o = q->o;
+    struct gensio_link *l, *l2;
+    struct mdns_query_result *r;
+
+    gensio_list_for_each_safe(&q->results, l, l2) {
+	r = gensio_container_of(l, struct mdns_query_result, link);
+	gensio_list_rm(&q->results, l);
+	mdns_query_result_free(o, r);
+    }
+    if (q->timer)
+	o->free_timer(q->timer);
+    if (q->name)
+	o->free(o, q->name);
+    if (q->type)
+	o->free(o, q->type);
+    if (q->domain)
+	o->free(o, q->domain);
+    if (q->host)
+	o->free(o, q->host);
+    if (q->lock)
+	o->free_lock(q->lock);
+    o->free(o, q);
+}
+
+static void
+mdns_query_freed(struct gensio_mdns *m, void *userdata)
+{
+    mdns_query_finish_free(userdata);
+}
+
+/* The query must not be in mdns_queries or have any users. */
+static void
+mdns_query_free(struct mdns_query *q)
+{
+    if (q->watch)
+	gensio_mdns_remove_watch(q->watch, NULL, NULL);
+    if (!q->mdns || gensio_free_mdns(q->mdns, mdns_query_freed, q))
+	mdns_query_finish_free(q);
+}
+
+static void
+mdns_query_cb(struct gensio_mdns_watch *w,
+	      enum gensio_mdns_data_state state,
+	      int interface, int ipdomain,
+	      const char *name, const char *type,
+	      const char *domain, const char *host,
+	      const struct gensio_addr *addr, const char * const *txt,
+	      void *userdata)
+{
+    struct mdns_query *q = userdata;
+    struct gensio_os_funcs *o = q->o;
+    struct gensio_link *l, *l2;
+    struct mdns_query_result *r;
+    struct mdnsn_data *ndata;
+
+    o->lock(q->lock);
+    switch (state) {
+    case GENSIO_MDNS_NEW_DATA:
+	r = mdns_query_result_alloc(o, interface, ipdomain, name, type,
+				    domain, host, addr, txt);
+	if (!r) {
+	    gensio_log(o, GENSIO_LOG_ERR, "mdns: Out of memory caching result");
+	    goto out_unlock;
+	}
+	gensio_list_add_tail(&q->results, &r->link);
+	break;
+
+    case GENSIO_MDNS_DATA_GONE:
+	gensio_list_for_each_safe(&q->results, l, l2) {
+	    r = gensio_container_of(l, struct mdns_query_result, link);
+	    if (mdns_query_result_match(r, interface, ipdomain, name, type,
+					domain, host, addr)) {
+		gensio_list_rm(&q->results, l);
+		mdns_query_result_free(o, r);
+		break;
+	    }
+	}
 	goto out_unlock;
 
-    if (state == GENSIO_MDNS_ALL_FOR_NOW) {
-	/* Didn't find what we were looking for. */
-	ndata->open_err = GE_NOTFOUND;
-	goto out_err;
+    case GENSIO_MDNS_ALL_FOR_NOW:
+	q->all_for_now = true;
+	break;
     }
 
-    if (state == GENSIO_MDNS_NEW_DATA) {
-	gensiods args = 0, argc = 0;
+    /* Have everything waiting on the query look at the results. */
+    gensio_list_for_each_safe(&q->waiters, l, l2) {
+	ndata = gensio_container_of(l, struct mdnsn_data, query_link);
+	gensio_list_rm(&q->waiters, l);
+	ndata->on_query_list = false;
+	o->run(ndata->query_runner);
+    }
+ out_unlock:
+    o->unlock(q->lock);
+}
 
-	if (!ndata->nostack) {
-	    ndata->open_err = get_mdns_gensiostack(ndata, txt, addr, &stack);
-	    if (ndata->open_err)
-		goto out_err;
+static void
+mdns_query_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct mdns_query *q = cb_data;
+    struct gensio_os_funcs *o = q->o;
+    gensio_time now;
+
+    mdns_query_o->lock(mdns_query_lock);
+    q->timer_pending = false;
+    if (q->refcount > 0)
+	goto out_unlock;
+
+    o->get_monotonic_time(o, &now);
+    if (gensio_time_diff_nsecs(&q->expire, &now) > 0) {
+	/* Someone used it and let it go again since we were started. */
+	if (o->start_timer_abs(q->timer, &q->expire) == 0) {
+	    q->timer_pending = true;
+	    goto out_unlock;
 	}
+    }
+    gensio_list_rm(&mdns_queries, &q->link);
+    mdns_query_o->unlock(mdns_query_lock);
+    mdns_query_free(q);
+    return;
 
-	if (stack) {
-	    ndata->open_err = str_to_gensio(stack, ndata->o,
-					    child_cb, ndata, &ndata->child);
-	    ndata->o->free(ndata->o, stack);
-	} else  {
-	    /* Look for the trailing protocol type. */
-	    s = strrchr(type, '.');
-	    if (!s)
-		goto out_unlock;
-	    s++;
+ out_unlock:
+    mdns_query_o->unlock(mdns_query_lock);
+}
 
-	    if (ndata->readbuf_set) {
-		ndata->open_err = gensio_argv_sappend(ndata->o, &argv, &args,
-					&argc, "readbuf=%lu",
-					(unsigned long) ndata->max_read_size);
-		if (ndata->open_err)
-		    goto out_err;
-	    }
+static int
+mdns_query_alloc(struct mdnsn_data *ndata, struct mdns_query **rq)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct mdns_query *q;
+    int err = GE_NOMEM;
 
-	    if (ndata->nodelay_set && strcmp(s, "_udp") != 0) {
-		/* Don't add nodelay for udp. */
-		ndata->open_err = gensio_argv_sappend(ndata->o, &argv, &args,
-						      &argc, "nodelay=%d",
-						      ndata->nodelay);
-		if (ndata->open_err)
-		    goto out_err;
-	    }
+    q = o->zalloc(o, sizeof(*q));
+    if (!q)
+	return GE_NOMEM;
 
-	    if (ndata->laddr) {
-		ndata->open_err = gensio_argv_sappend(ndata->o, &argv, &args,
-						      &argc, "laddr=%s",
-						      ndata->laddr);
-		if (ndata->open_err)
-		    goto out_err;
-	    }
+    q->o = o;
+    q->interface = ndata->interface;
+    q->nettype = ndata->nettype;
+    gensio_list_init(&q->results);
+    gensio_list_init(&q->waiters);
 
-	    ndata->open_err = gensio_argv_append(ndata->o, &argv, NULL,
-						 &args, &argc, false);
-	    if (ndata->open_err)
-		goto out_err;
-
-	    if (strcmp(s, "_tcp") == 0) {
-		ndata->open_err = gensio_terminal_alloc("tcp",
-						addr, argv, ndata->o,
-						child_cb, ndata,
-						&ndata->child);
-	    } else if (strcmp(s, "_udp") == 0) {
-		ndata->open_err = gensio_terminal_alloc("udp",
-						addr, argv, ndata->o,
-						child_cb, ndata,
-						&ndata->child);
-	    } else {
-		goto out_unlock;
-	    }
+    q->lock = o->alloc_lock(o);
+    if (!q->lock)
+	goto out_err;
+    q->timer = o->alloc_timer(o, mdns_query_timeout, q);
+    if (!q->timer)
+	goto out_err;
+    if (mdns_dupstr(o, ndata->name, &q->name))
+	goto out_err;
+    if (mdns_dupstr(o, ndata->type, &q->type))
+	goto out_err;
+    if (mdns_dupstr(o, ndata->domain, &q->domain))
+	goto out_err;
+    if (mdns_dupstr(o, ndata->host, &q->host))
+	goto out_err;
+
+    err = gensio_alloc_mdns(o, &q->mdns);
+    if (err)
+	goto out_err;
+    err = gensio_mdns_add_watch(q->mdns, q->interface, q->nettype,
+				q->name, q->type, q->domain, q->host,
+				mdns_query_cb, q, &q->watch);
+    if (err)
+	goto out_err;
+
+    *rq = q;
+    return 0;
+
+ out_err:
+    mdns_query_free(q);
+    return err;
+}
+
+/* Find a query for what ndata is looking for, or start a new one. */
+static int
+mdns_query_get(struct mdnsn_data *ndata, struct mdns_query **rq)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct gensio_link *l;
+    struct mdns_query *q;
+    int err = 0;
+
+    mdns_query_o->lock(mdns_query_lock);
+    gensio_list_for_each(&mdns_queries, l) {
+	q = gensio_container_of(l, struct mdns_query, link);
+	if (q->o == o && q->interface == ndata->interface &&
+		q->nettype == ndata->nettype &&
+		mdns_streq(q->name, ndata->name) &&
+		mdns_streq(q->type, ndata->type) &&
+		mdns_streq(q->domain, ndata->domain) &&
+		mdns_streq(q->host, ndata->host)) {
+	    /*
+	     * If the stop fails the timeout handler is running and
+	     * will see that the query is in use again.
+	     */
+	    if (q->timer_pending && o->stop_timer(q->timer) == 0)
+		q->timer_pending = false;
+	    goto found;
 	}
-	if (ndata->open_err)
-	    goto out_err;
+    }
 
-	ndata->open_err = gensio_open(ndata->child, child_open_cb, ndata);
-	if (ndata->open_err) {
-	    gensio_free(ndata->child);
-	    ndata->child = NULL;
-	    goto out_err;
+    err = mdns_query_alloc(ndata, &q);
+    if (err)
+	goto out_unlock;
+    gensio_list_add_tail(&mdns_queries, &q->link);
+
+ found:
+    q->refcount++;
+    *rq = q;
+ out_unlock:
+    mdns_query_o->unlock(mdns_query_lock);
+    return err;
+}
+
+/*
+ * Drop a user of the query.  The last user's cache time says how
+ * long the query and its results are kept around for the next open.
+ */
+static void
+mdns_query_put(struct mdns_query *q, gensio_time *cache_time)
+{
+    struct gensio_os_funcs *o = q->o;
+
+    mdns_query_o->lock(mdns_query_lock);
+    assert(q->refcount > 0);
+    if (--q->refcount > 0)
+	goto out_unlock;
+
+    o->get_monotonic_time(o, &q->expire);
+    gensio_time_add(&q->expire, cache_time);
+    if (q->timer_pending)
+	/* The timeout handler is running, it will restart the timer. */
+	goto out_unlock;
+
+    if (!gensio_time_is_zero(*cache_time) &&
+		o->start_timer_abs(q->timer, &q->expire) == 0) {
+	q->timer_pending = true;
+	goto out_unlock;
+    }
+
+    gensio_list_rm(&mdns_queries, &q->link);
+    mdns_query_o->unlock(mdns_query_lock);
+    mdns_query_free(q);
+    return;
+
+ out_unlock:
+    mdns_query_o->unlock(mdns_query_lock);
+}
+
+/*
+ * Try to connect to a query result.  Returns GE_NOTSUP if the result
+ * isn't something we can connect to.  Called with the ndata and
+ * query locks held.
+ */
+static int
+mdnsn_connect(struct mdnsn_data *ndata, struct mdns_query_result *r)
+{
+    const char **argv = NULL;
+    gensiods args = 0, argc = 0;
+    char *s, *stack = NULL;
+    int err = 0;
+
+    if (!ndata->nostack && r->txt) {
+	err = get_mdns_gensiostack(ndata, r->txt, r->addr, &stack);
+	if (err)
+	    return err;
+    }
+
+    if (stack) {
+	err = str_to_gensio(stack, ndata->o, child_cb, ndata, &ndata->child);
+	ndata->o->free(ndata->o, stack);
+    } else  {
+	/* Look for the trailing protocol type. */
+	s = r->type ? strrchr(r->type, '.') : NULL;
+	if (!s)
+	    return GE_NOTSUP;
+	s++;
+	if (strcmp(s, "_tcp") != 0 && strcmp(s, "_udp") != 0)
+	    return GE_NOTSUP;
+
+	if (ndata->readbuf_set) {
+	    err = gensio_argv_sappend(ndata->o, &argv, &args, &argc,
+				      "readbuf=%lu",
+				      (unsigned long) ndata->max_read_size);
+	    if (err)
+		goto out;
 	}
 
-	ndata->state = MDNSN_IN_CHILD_OPEN;
-	if (ndata->watch)
-	    gensio_mdns_remove_watch(ndata->watch, NULL, NULL);
-	err = gensio_free_mdns(ndata->mdns, mdns_freed, ndata);
-	if (!err) {
-	    mdnsn_ref(ndata);
-	    ndata->mdns_in_free = true;
-	} else {
-	    ndata->mdns = NULL;
+	if (ndata->nodelay_set && strcmp(s, "_udp") != 0) {
+	    /* Don't add nodelay for udp. */
+	    err = gensio_argv_sappend(ndata->o, &argv, &args, &argc,
+				      "nodelay=%d", ndata->nodelay);
+	    if (err)
+		goto out;
+	}
+
+	if (ndata->laddr) {
+	    err = gensio_argv_sappend(ndata->o, &argv, &args, &argc,
+				      "laddr=%s", ndata->laddr);
+	    if (err)
+		goto out;
 	}
+
+	err = gensio_argv_append(ndata->o, &argv, NULL, &args, &argc, false);
+	if (err)
+	    goto out;
+
+	err = gensio_terminal_alloc(strcmp(s, "_tcp") == 0 ? "tcp" : "udp",
+				    r->addr, argv, ndata->o,
+				    child_cb, ndata, &ndata->child);
+    }
+    if (err)
+	goto out;
+
+    err = gensio_open(ndata->child, child_open_cb, ndata);
+    if (err) {
+	gensio_free(ndata->child);
+	ndata->child = NULL;
+	goto out;
     }
+    ndata->state = MDNSN_IN_CHILD_OPEN;
 
- out_unlock:
-    mdnsn_unlock(ndata);
  out:
     if (argv)
 	gensio_argv_free(ndata->o, argv);
-    return;
+    return err;
+}
 
- out_err:
-    ndata->state = MDNSN_IN_OPEN_ERR;
-    if (ndata->watch)
-	gensio_mdns_remove_watch(ndata->watch, NULL, NULL);
-    err = gensio_free_mdns(ndata->mdns, mdns_freed, ndata);
-    if (!err) {
-	ndata->mdns_in_free = true;
+/*
+ * Connect to the first usable result.  If there isn't one and the
+ * initial scan isn't done, go back on the waiter list and return
+ * GE_INPROGRESS.  Called with the ndata lock held.
+ */
+static int
+mdnsn_try_results(struct mdnsn_data *ndata)
+{
+    struct mdns_query *q = ndata->query;
+    struct gensio_link *l;
+    struct mdns_query_result *r;
+    int err = GE_NOTFOUND;
+
+    q->o->lock(q->lock);
+    gensio_list_for_each(&q->results, l) {
+	r = gensio_container_of(l, struct mdns_query_result, link);
+	err = mdnsn_connect(ndata, r);
+	if (err != GE_NOTSUP)
+	    goto out_unlock;
+    }
+    if (q->all_for_now) {
+	/* Didn't find what we were looking for. */
+	err = GE_NOTFOUND;
     } else {
-	ndata->mdns = NULL;
-	i_child_open_cb(ndata, ndata->open_err);
-	mdnsn_deref_and_unlock(ndata);
-	goto out;
+	gensio_list_add_tail(&q->waiters, &ndata->query_link);
+	ndata->on_query_list = true;
+	err = GE_INPROGRESS;
+    }
+ out_unlock:
+    q->o->unlock(q->lock);
+    return err;
+}
+
+static void
+mdnsn_query_ready(struct gensio_runner *runner, void *cb_data)
+{
+    struct mdnsn_data *ndata = cb_data;
+    struct mdns_query *q;
+    int err;
+
+    mdnsn_lock(ndata);
+    if (ndata->state == MDNSN_IN_OPEN_QUERY) {
+	err = mdnsn_try_results(ndata);
+	if (err == GE_INPROGRESS) {
+	    /* Still waiting, we keep our reference. */
+	    mdnsn_unlock(ndata);
+	    return;
+	}
+	if (err) {
+	    i_child_open_cb(ndata, err);
+	    mdnsn_deref(ndata); /* Lose the open's reference. */
+	}
+    }
+
+    q = ndata->query;
+    ndata->query = NULL;
+    ndata->query_pending = false;
+    mdns_query_put(q, &ndata->cache_time);
+    if (ndata->state == MDNSN_IN_CLOSE)
+	mdnsn_check_close(ndata);
+    mdnsn_deref_and_unlock(ndata);
+}
+
+/*
+ * Stop waiting on the query.  If the query runner is already
+ * scheduled it will do this when it runs.  Called with the ndata
+ * lock held.
+ */
+static void
+mdnsn_query_cancel(struct mdnsn_data *ndata)
+{
+    struct mdns_query *q = ndata->query;
+    bool removed = false;
+
+    q->o->lock(q->lock);
+    if (ndata->on_query_list) {
+	gensio_list_rm(&q->waiters, &ndata->query_link);
+	ndata->on_query_list = false;
+	removed = true;
+    }
+    q->o->unlock(q->lock);
+
+    if (removed) {
+	ndata->query = NULL;
+	ndata->query_pending = false;
+	mdns_query_put(q, &ndata->cache_time);
+	mdnsn_deref(ndata);
     }
-    goto out_unlock;
 }
 
 static int
 mdnsn_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 {
     struct mdnsn_data *ndata = gensio_get_gensio_data(io);
+    struct mdns_query *q;
     int err = 0;
 
     mdnsn_lock(ndata);
@@ -529,24 +968,28 @@ mdnsn_open(struct gensio *io, gensio_done_err open_done, void *open_data)
 	err = GE_NOTREADY;
 	goto out_unlock;
     }
-    err = gensio_alloc_mdns(ndata->o, &ndata->mdns);
+    err = mdns_query_get(ndata, &q);
     if (err)
 	goto out_unlock;
-    err = gensio_mdns_add_watch(ndata->mdns, ndata->interface,
-				ndata->nettype,
-				ndata->name, ndata->type, ndata->domain,
-				ndata->host,
-				mdns_cb, ndata, &ndata->watch);
-    if (err) {
-	gensio_free_mdns(ndata->mdns, NULL, NULL);
-	ndata->mdns = NULL;
-	goto out_unlock;
-    }
 
-    mdnsn_ref(ndata);
+    mdnsn_ref(ndata); /* For the open. */
+    mdnsn_ref(ndata); /* For the query. */
+    ndata->query = q;
+    ndata->query_pending = true;
     ndata->state = MDNSN_IN_OPEN_QUERY;
     ndata->open_done = open_done;
     ndata->open_data = open_data;
+
+    /* If the query already has something, look at it right away. */
+    q->o->lock(q->lock);
+    if (!gensio_list_empty(&q->results) || q->all_for_now) {
+	ndata->o->run(ndata->query_runner);
+    } else {
+	gensio_list_add_tail(&q->waiters, &ndata->query_link);
+	ndata->on_query_list = true;
+    }
+    q->o->unlock(q->lock);
+
     mdnsn_start_deferred_op(ndata);
  out_unlock:
     mdnsn_unlock(ndata);
@@ -572,15 +1015,13 @@ mdnsn_start_close(struct mdnsn_data *ndata)
 	break;
 
     case MDNSN_IN_OPEN_QUERY:
-	if (ndata->watch)
-	    gensio_mdns_remove_watch(ndata->watch, NULL, NULL);
-	err = gensio_free_mdns(ndata->mdns, mdns_freed, ndata);
-	if (err)
-	    ndata->mdns = NULL;
-	else {
-	    ndata->mdns_in_free = true;
-	    mdnsn_ref(ndata);
-	}
+	mdnsn_query_cancel(ndata);
+	mdnsn_deref(ndata); /* The open won't finish. */
+	ndata->state = MDNSN_IN_CLOSE;
+	/* Finish the close from the deferred op or the query runner. */
+	if (!ndata->query_pending)
+	    mdnsn_start_deferred_op(ndata);
+	err = 0;
 	break;
 
     default:
@@ -614,6 +1055,7 @@ mdnsn_free(struct gensio *io)
     struct mdnsn_data *ndata = gensio_get_gensio_data(io);
 
     mdnsn_lock(ndata);
+    ndata->close_done = NULL;
     if (ndata->state != MDNSN_CLOSED)
 	mdnsn_start_close(ndata);
     mdnsn_deref_and_unlock(ndata);
@@ -702,6 +1144,10 @@ mdns_ndata_setup(struct gensio_os_funcs *o, gensiods max_read_size,
     if (!ndata->deferred_op_runner)
 	goto out_nomem;
 
+    ndata->query_runner = o->alloc_runner(o, mdnsn_query_ready, ndata);
+    if (!ndata->query_runner)
+	goto out_nomem;
+
     ndata->lock = o->alloc_lock(o);
     if (!ndata->lock)
 	goto out_nomem;
@@ -731,6 +1177,7 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
     char *laddr = NULL, *name = NULL, *type = NULL;
     char *domain = NULL, *host = NULL, *nettype_str = NULL;
     bool nodelay = false, readbuf_set = false, nodelay_set = false;
+    gensio_time cache_time = { MDNS_DEFAULT_CACHE_TIME, 0 };
     const char *str;
     GENSIO_DECLARE_PPGENSIO(p, o, cb, "mdns", user_data);
 
@@ -796,6 +1243,8 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
 	}
 	if (gensio_pparm_bool(&p, args[i], "nostack", &nostack) > 0)
 	    continue;
+	if (gensio_pparm_time(&p, args[i], "cache-time", 's', &cache_time) > 0)
+	    continue;
 	if (gensio_pparm_value(&p, args[i], "laddr", &str) > 0) {
 	    if (laddr)
 		free(laddr);
@@ -884,6 +1333,7 @@ mdns_gensio_alloc(const void *gdata, const char * const args[],
 
     ndata->readbuf_set = readbuf_set;
     ndata->nodelay_set = nodelay_set;
+    ndata->cache_time = cache_time;
     ndata->laddr = laddr;
     ndata->name = name;
     ndata->type = type;
@@ -929,11 +1379,41 @@ str_to_mdns_gensio(const char *str, const char * const args[],
     return mdns_gensio_alloc(str, args, o, cb, user_data, new_gensio);
 }
 
+static void
+gensio_mdns_cleanup_mem(void)
+{
+    struct gensio_link *l, *l2;
+    struct mdns_query *q;
+
+    /* Anything left is only being kept for its cache time. */
+    gensio_list_for_each_safe(&mdns_queries, l, l2) {
+	q = gensio_container_of(l, struct mdns_query, link);
+	gensio_list_rm(&mdns_queries, l);
+	if (q->timer_pending)
+	    q->o->stop_timer(q->timer);
+	mdns_query_free(q);
+    }
+    if (mdns_query_lock)
+	mdns_query_o->free_lock(mdns_query_lock);
+    mdns_query_lock = NULL;
+}
+
+static struct gensio_class_cleanup mdns_class_cleanup = {
+    gensio_mdns_cleanup_mem
+};
+
 int
 gensio_init_mdns(struct gensio_os_funcs *o)
 {
     int rv;
 
+    mdns_query_o = o;
+    gensio_list_init(&mdns_queries);
+    mdns_query_lock = o->alloc_lock(o);
+    if (!mdns_query_lock)
+	return GE_NOMEM;
+    gensio_register_class_cleanup(&mdns_class_cleanup);
+
     rv = register_gensio(o, "mdns", str_to_mdns_gensio, mdns_gensio_alloc);
     if (rv)
 	return rv;
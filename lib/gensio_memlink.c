@@ -0,0 +1,1112 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * This code is for an in-memory connection between two gensios in
+ * the same process.  A memlink accepter registers a name, and a
+ * memlink gensio with that name connects to it.  Data written on one
+ * end is put into a buffer on the other end and read callbacks are
+ * done directly from that buffer, so there is one copy and no system
+ * calls.  The buffer size provides flow control.
+ *
+ * Both ends of a connection share a lock.  The lock order is the
+ * connection lock, then memlink_acc_lock, then the accepter lock.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_circbuf.h>
+#include <gensio/gensio_utils.h>
+
+enum memlink_state {
+    MEMLINK_CLOSED,
+    MEMLINK_IN_OPEN,
+    MEMLINK_OPEN,
+    MEMLINK_IN_OPEN_CLOSE,
+    MEMLINK_IN_CLOSE,
+};
+
+/* The lock shared by the ends of a connection. */
+struct memlink_shared {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+};
+
+struct memlinkna_data;
+
+struct memlink_end {
+    struct gensio_os_funcs *o;
+    struct memlink_shared *sh;
+    unsigned int refcount;
+    enum memlink_state state;
+
+    struct gensio *io;
+    bool is_server;
+    char *name;
+
+    /* The other end of the connection, NULL if not connected. */
+    struct memlink_end *peer;
+    /* Set if the other end went away. */
+    bool remclosed;
+
+    /* Data written by the peer, waiting to be read by this end. */
+    struct gensio_circbuf *buf;
+    gensiods max_read_size;
+
+    bool read_enabled;
+    bool xmit_enabled;
+
+    /* For a client waiting on the accepter to take the connection. */
+    struct gensio_link link;
+    bool open_complete;
+    int open_err;
+
+    gensio_done_err open_done;
+    void *open_data;
+
+    gensio_done close_done;
+    void *close_data;
+
+    /*
+     * Used to run callbacks from the selector to avoid running
+     * them directly from user calls.
+     */
+    bool deferred_op_pending;
+    struct gensio_runner *deferred_op_runner;
+};
+
+enum memlinkna_state {
+    MEMLINKNA_DISABLED,
+    MEMLINKNA_ENABLED,
+    MEMLINKNA_IN_SHUTDOWN
+};
+
+struct memlinkna_data {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_accepter *acc;
+    unsigned int refcount;
+    enum memlinkna_state state;
+
+    char *name;
+    gensiods max_read_size;
+
+    /* On memlink_accs while enabled. */
+    struct gensio_link link;
+    bool in_list;
+
+    bool accept_enabled;
+    /* Clients waiting to be reported as a new connection. */
+    struct gensio_list pending;
+
+    bool deferred_pending;
+    struct gensio_runner *deferred_runner;
+
+    gensio_acc_done shutdown_done;
+    void *shutdown_data;
+
+    gensio_acc_done enabled_done;
+    void *enabled_data;
+};
+
+/* The enabled accepters, by name. */
+static struct gensio_os_funcs *memlink_o;
+static struct gensio_lock *memlink_acc_lock;
+static struct gensio_list memlink_accs;
+
+static void memlinkna_deferred_op(struct memlinkna_data *nadata);
+static void memlinkna_deref(struct memlinkna_data *nadata);
+
+static void
+memlink_shared_deref(struct memlink_shared *sh)
+{
+    struct gensio_os_funcs *o = sh->o;
+    bool do_free;
+
+    o->lock(sh->lock);
+    assert(sh->refcount > 0);
+    do_free = --sh->refcount == 0;
+    o->unlock(sh->lock);
+    if (do_free) {
+	o->free_lock(sh->lock);
+	o->free(o, sh);
+    }
+}
+
+static void
+memlink_finish_free(struct memlink_end *end)
+{
+    struct gensio_os_funcs *o = end->o;
+
+    if (end->io)
+	gensio_data_free(end->io);
+    if (end->buf)
+	gensio_circbuf_free(end->buf);
+    if (end->deferred_op_runner)
+	o->free_runner(end->deferred_op_runner);
+    if (end->name)
+	o->free(o, end->name);
+    if (end->sh)
+	memlink_shared_deref(end->sh);
+    o->free(o, end);
+}
+
+static void
+memlink_lock(struct memlink_end *end)
+{
+    end->o->lock(end->sh->lock);
+}
+
+static void
+memlink_unlock(struct memlink_end *end)
+{
+    end->o->unlock(end->sh->lock);
+}
+
+static void
+memlink_ref(struct memlink_end *end)
+{
+    assert(end->refcount > 0);
+    end->refcount++;
+}
+
+static void
+memlink_unlock_and_deref(struct memlink_end *end)
+{
+    assert(end->refcount > 0);
+    if (end->refcount == 1) {
+	memlink_unlock(end);
+	memlink_finish_free(end);
+    } else {
+	end->refcount--;
+	memlink_unlock(end);
+    }
+}
+
+static void
+memlink_start_deferred_op(struct memlink_end *end)
+{
+    if (!end->deferred_op_pending) {
+	/* Call the callbacks from the selector to avoid lock nesting. */
+	end->deferred_op_pending = true;
+	end->o->run(end->deferred_op_runner);
+	memlink_ref(end);
+    }
+}
+
+/* Must be called with the lock held.  The peer sees a remote close. */
+static void
+memlink_detach(struct memlink_end *end)
+{
+    struct memlink_end *peer = end->peer;
+
+    if (!peer)
+	return;
+    end->peer = NULL;
+    peer->peer = NULL;
+    peer->remclosed = true;
+    if (peer->state == MEMLINK_OPEN && peer->read_enabled)
+	memlink_start_deferred_op(peer);
+}
+
+static int
+memlink_write(struct gensio *io, gensiods *rcount,
+	      const struct gensio_sg *sg, gensiods sglen)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+    struct memlink_end *peer;
+    gensiods count = 0;
+    int err = 0;
+
+    memlink_lock(end);
+    if (end->state != MEMLINK_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    peer = end->peer;
+    if (!peer) {
+	err = GE_REMCLOSE;
+	goto out_unlock;
+    }
+    gensio_circbuf_sg_write(peer->buf, sg, sglen, &count);
+    if (count && peer->state == MEMLINK_OPEN && peer->read_enabled)
+	memlink_start_deferred_op(peer);
+    if (rcount)
+	*rcount = count;
+ out_unlock:
+    memlink_unlock(end);
+    return err;
+}
+
+static void
+memlink_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct memlink_end *end = cb_data;
+    int err = 0;
+
+    memlink_lock(end);
+ restart:
+    if ((end->state == MEMLINK_IN_OPEN ||
+		end->state == MEMLINK_IN_OPEN_CLOSE) && end->open_complete) {
+	end->open_complete = false;
+	err = end->open_err;
+	if (end->state == MEMLINK_IN_OPEN_CLOSE) {
+	    end->state = MEMLINK_IN_CLOSE;
+	    err = GE_LOCALCLOSED;
+	} else if (err) {
+	    end->state = MEMLINK_CLOSED;
+	} else {
+	    end->state = MEMLINK_OPEN;
+	}
+	if (end->open_done) {
+	    memlink_unlock(end);
+	    end->open_done(end->io, err, end->open_data);
+	    memlink_lock(end);
+	}
+	err = 0;
+    }
+
+ more_read:
+    while (end->state == MEMLINK_OPEN && end->read_enabled &&
+	   (gensio_circbuf_datalen(end->buf) > 0 || end->remclosed)) {
+	void *data;
+	gensiods count;
+
+	if (gensio_circbuf_datalen(end->buf) == 0) {
+	    end->read_enabled = false;
+	    memlink_unlock(end);
+	    gensio_cb(end->io, GENSIO_EVENT_READ, GE_REMCLOSE,
+		      NULL, NULL, NULL);
+	    memlink_lock(end);
+	} else {
+	    gensio_circbuf_next_read_area(end->buf, &data, &count);
+	    memlink_unlock(end);
+	    err = gensio_cb(end->io, GENSIO_EVENT_READ, 0,
+			    data, &count, NULL);
+	    memlink_lock(end);
+	    if (err)
+		break;
+	    gensio_circbuf_data_removed(end->buf, count);
+	    /* There is room now, let the writer know. */
+	    if (count && end->peer && end->peer->state == MEMLINK_OPEN &&
+			end->peer->xmit_enabled)
+		memlink_start_deferred_op(end->peer);
+	}
+    }
+
+    while (end->state == MEMLINK_OPEN && end->xmit_enabled &&
+	   end->peer && gensio_circbuf_room_left(end->peer->buf) > 0) {
+	memlink_unlock(end);
+	err = gensio_cb(end->io, GENSIO_EVENT_WRITE_READY, 0,
+			NULL, NULL, NULL);
+	memlink_lock(end);
+	if (err)
+	    break;
+    }
+    if (!err && end->state == MEMLINK_OPEN && end->read_enabled &&
+		gensio_circbuf_datalen(end->buf) > 0)
+	goto more_read;
+
+    if (end->state == MEMLINK_IN_CLOSE) {
+	end->state = MEMLINK_CLOSED;
+	if (end->close_done) {
+	    memlink_unlock(end);
+	    end->close_done(end->io, end->close_data);
+	    memlink_lock(end);
+	}
+
+	if (end->state != MEMLINK_CLOSED)
+	    goto restart;
+    }
+
+    end->deferred_op_pending = false;
+
+    memlink_unlock_and_deref(end);
+}
+
+static void
+memlink_set_read_callback_enable(struct gensio *io, bool enabled)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+
+    memlink_lock(end);
+    end->read_enabled = enabled;
+    if (enabled && end->state == MEMLINK_OPEN &&
+		(gensio_circbuf_datalen(end->buf) > 0 || end->remclosed))
+	memlink_start_deferred_op(end);
+    memlink_unlock(end);
+}
+
+static void
+memlink_set_write_callback_enable(struct gensio *io, bool enabled)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+
+    memlink_lock(end);
+    end->xmit_enabled = enabled;
+    if (enabled && end->state == MEMLINK_OPEN && end->peer &&
+		gensio_circbuf_room_left(end->peer->buf) > 0)
+	memlink_start_deferred_op(end);
+    memlink_unlock(end);
+}
+
+static int gensio_memlink_func(struct gensio *io, int func, gensiods *count,
+			       const void *cbuf, gensiods buflen, void *buf,
+			       const char *const *auxdata);
+
+/* Find the accepter and queue the client on it. */
+static int
+memlink_connect(struct memlink_end *end)
+{
+    struct gensio_os_funcs *o = end->o;
+    struct memlinkna_data *nadata = NULL;
+    struct memlink_end *send;
+    struct gensio_link *l;
+    int err = GE_NOMEM;
+
+    o->lock(memlink_acc_lock);
+    gensio_list_for_each(&memlink_accs, l) {
+	struct memlinkna_data *n = gensio_container_of(l,
+						       struct memlinkna_data,
+						       link);
+
+	if (strcmp(n->name, end->name) == 0) {
+	    nadata = n;
+	    o->lock(nadata->lock);
+	    nadata->refcount++;
+	    o->unlock(nadata->lock);
+	    break;
+	}
+    }
+    o->unlock(memlink_acc_lock);
+    if (!nadata)
+	return GE_CONNREFUSE;
+
+    send = o->zalloc(o, sizeof(*send));
+    if (!send)
+	goto out_err;
+    send->o = o;
+    send->refcount = 1;
+    send->is_server = true;
+    send->sh = end->sh;
+    end->sh->refcount++; /* We hold the lock already. */
+    send->max_read_size = nadata->max_read_size;
+    send->buf = gensio_circbuf_alloc(o, send->max_read_size);
+    if (!send->buf)
+	goto out_err_free;
+    send->deferred_op_runner = o->alloc_runner(o, memlink_deferred_op, send);
+    if (!send->deferred_op_runner)
+	goto out_err_free;
+    send->io = gensio_data_alloc(o, NULL, NULL, gensio_memlink_func, NULL,
+				 "memlink", send);
+    if (!send->io)
+	goto out_err_free;
+    gensio_set_is_reliable(send->io, true);
+    send->state = MEMLINK_IN_OPEN;
+
+    gensio_circbuf_reset(end->buf);
+    end->remclosed = false;
+    end->peer = send;
+    send->peer = end;
+
+    o->lock(nadata->lock);
+    if (nadata->state != MEMLINKNA_ENABLED) {
+	o->unlock(nadata->lock);
+	end->peer = NULL;
+	err = GE_CONNREFUSE;
+	goto out_err_free;
+    }
+    memlink_ref(end);
+    gensio_list_add_tail(&nadata->pending, &end->link);
+    if (nadata->accept_enabled)
+	memlinkna_deferred_op(nadata);
+    o->unlock(nadata->lock);
+    /* The pending list holds the ref on the accepter. */
+    return 0;
+
+ out_err_free:
+    if (send->sh) {
+	/* Can't take the shared lock here, we already hold it. */
+	end->sh->refcount--;
+	send->sh = NULL;
+    }
+    memlink_finish_free(send);
+ out_err:
+    memlinkna_deref(nadata);
+    return err;
+}
+
+static int
+memlink_open(struct gensio *io, gensio_done_err open_done, void *open_data)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+    int err = 0;
+
+    memlink_lock(end);
+    if (end->is_server) {
+	err = GE_NOTSUP;
+	goto out_unlock;
+    }
+    if (end->state != MEMLINK_CLOSED) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    err = memlink_connect(end);
+    if (err)
+	goto out_unlock;
+    end->state = MEMLINK_IN_OPEN;
+    end->open_complete = false;
+    end->open_err = 0;
+    end->open_done = open_done;
+    end->open_data = open_data;
+ out_unlock:
+    memlink_unlock(end);
+
+    return err;
+}
+
+static int
+memlink_close(struct gensio *io, gensio_done close_done, void *close_data)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+    int err = 0;
+
+    memlink_lock(end);
+    if (end->state != MEMLINK_OPEN && end->state != MEMLINK_IN_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    end->close_done = close_done;
+    end->close_data = close_data;
+    if (end->state == MEMLINK_IN_OPEN) {
+	/* The accepter will finish this when it gets to it. */
+	end->state = MEMLINK_IN_OPEN_CLOSE;
+    } else {
+	end->state = MEMLINK_IN_CLOSE;
+	memlink_detach(end);
+	memlink_start_deferred_op(end);
+    }
+ out_unlock:
+    memlink_unlock(end);
+
+    return err;
+}
+
+static void
+memlink_free(struct gensio *io)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+
+    memlink_lock(end);
+    /*
+     * If the client is still waiting on the accepter, the accepter
+     * will see it is closed and clean up the other end.
+     */
+    if (end->state != MEMLINK_IN_OPEN && end->state != MEMLINK_IN_OPEN_CLOSE)
+	memlink_detach(end);
+    end->state = MEMLINK_CLOSED;
+    memlink_unlock_and_deref(end);
+}
+
+static int
+memlink_disable(struct gensio *io)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+
+    memlink_lock(end);
+    if (end->state != MEMLINK_IN_OPEN && end->state != MEMLINK_IN_OPEN_CLOSE)
+	memlink_detach(end);
+    end->state = MEMLINK_CLOSED;
+    memlink_unlock(end);
+
+    return 0;
+}
+
+static int
+memlink_control(struct gensio *io, bool get, int option, char *data,
+		gensiods *datalen)
+{
+    struct memlink_end *end = gensio_get_gensio_data(io);
+
+    if (option != GENSIO_CONTROL_RADDR)
+	return GE_NOTSUP;
+    if (!get)
+	return GE_NOTSUP;
+    if (strtoul(data, NULL, 0) > 0)
+	return GE_NOTFOUND;
+    *datalen = gensio_pos_snprintf(data, *datalen, NULL, "memlink,%s",
+				   end->is_server ? "server" : end->name);
+    return 0;
+}
+
+static int
+gensio_memlink_func(struct gensio *io, int func, gensiods *count,
+		    const void *cbuf, gensiods buflen, void *buf,
+		    const char *const *auxdata)
+{
+    switch (func) {
+    case GENSIO_FUNC_WRITE_SG:
+	return memlink_write(io, count, cbuf, buflen);
+
+    case GENSIO_FUNC_OPEN:
+	return memlink_open(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return memlink_close(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	memlink_free(io);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	memlink_set_read_callback_enable(io, buflen);
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	memlink_set_write_callback_enable(io, buflen);
+	return 0;
+
+    case GENSIO_FUNC_DISABLE:
+	return memlink_disable(io);
+
+    case GENSIO_FUNC_CONTROL:
+	return memlink_control(io, *((bool *) cbuf), buflen, buf, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+memlink_gensio_alloc(const void *gdata,
+		     const char * const args[],
+		     struct gensio_os_funcs *o,
+		     gensio_event cb, void *user_data,
+		     struct gensio **new_gensio)
+{
+    const char *name = gdata;
+    struct memlink_end *end;
+    gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    int i;
+    GENSIO_DECLARE_PPGENSIO(p, o, cb, "memlink", user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (!name || !*name) {
+	gensio_pparm_slog(&p, "No name given");
+	return GE_INVAL;
+    }
+
+    end = o->zalloc(o, sizeof(*end));
+    if (!end)
+	return GE_NOMEM;
+    end->o = o;
+    end->refcount = 1;
+    end->max_read_size = max_read_size;
+
+    end->name = gensio_strdup(o, name);
+    if (!end->name)
+	goto out_nomem;
+
+    end->sh = o->zalloc(o, sizeof(*end->sh));
+    if (!end->sh)
+	goto out_nomem;
+    end->sh->o = o;
+    end->sh->refcount = 1;
+    end->sh->lock = o->alloc_lock(o);
+    if (!end->sh->lock) {
+	o->free(o, end->sh);
+	end->sh = NULL;
+	goto out_nomem;
+    }
+
+    end->buf = gensio_circbuf_alloc(o, max_read_size);
+    if (!end->buf)
+	goto out_nomem;
+
+    end->deferred_op_runner = o->alloc_runner(o, memlink_deferred_op, end);
+    if (!end->deferred_op_runner)
+	goto out_nomem;
+
+    end->io = gensio_data_alloc(o, cb, user_data, gensio_memlink_func, NULL,
+				"memlink", end);
+    if (!end->io)
+	goto out_nomem;
+    gensio_set_is_client(end->io, true);
+    gensio_set_is_reliable(end->io, true);
+
+    *new_gensio = end->io;
+
+    return 0;
+
+ out_nomem:
+    memlink_finish_free(end);
+    return GE_NOMEM;
+}
+
+static int
+str_to_memlink_gensio(const char *str, const char * const args[],
+		      struct gensio_os_funcs *o,
+		      gensio_event cb, void *user_data,
+		      struct gensio **new_gensio)
+{
+    return memlink_gensio_alloc(str, args, o, cb, user_data, new_gensio);
+}
+
+static void
+memlinkna_lock(struct memlinkna_data *nadata)
+{
+    nadata->o->lock(nadata->lock);
+}
+
+static void
+memlinkna_unlock(struct memlinkna_data *nadata)
+{
+    nadata->o->unlock(nadata->lock);
+}
+
+static void
+memlinkna_finish_free(struct memlinkna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+
+    if (nadata->acc)
+	gensio_acc_data_free(nadata->acc);
+    if (nadata->deferred_runner)
+	o->free_runner(nadata->deferred_runner);
+    if (nadata->name)
+	o->free(o, nadata->name);
+    if (nadata->lock)
+	o->free_lock(nadata->lock);
+    o->free(o, nadata);
+}
+
+static void
+memlinkna_ref(struct memlinkna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    nadata->refcount++;
+}
+
+static void
+memlinkna_deref_and_unlock(struct memlinkna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    nadata->refcount--;
+    if (nadata->refcount == 0) {
+	memlinkna_unlock(nadata);
+	memlinkna_finish_free(nadata);
+    } else {
+	memlinkna_unlock(nadata);
+    }
+}
+
+static void
+memlinkna_deref(struct memlinkna_data *nadata)
+{
+    memlinkna_lock(nadata);
+    memlinkna_deref_and_unlock(nadata);
+}
+
+/* Must be called with memlink_acc_lock held. */
+static void
+memlinkna_rm_from_list(struct memlinkna_data *nadata)
+{
+    if (nadata->in_list) {
+	gensio_list_rm(&memlink_accs, &nadata->link);
+	nadata->in_list = false;
+    }
+}
+
+/*
+ * Hand a waiting client's connection to the user, or refuse it if
+ * the accepter is going away.
+ */
+static void
+memlinkna_handle_pending(struct memlinkna_data *nadata,
+			 struct memlink_end *end, bool accept)
+{
+    struct memlink_end *send;
+
+    memlink_lock(end);
+    send = end->peer;
+    if (end->state != MEMLINK_IN_OPEN || !accept) {
+	/* Closed or freed while waiting, or refused. */
+	if (end->state == MEMLINK_IN_OPEN)
+	    end->open_err = GE_CONNREFUSE;
+	end->peer = NULL;
+	send->peer = NULL;
+	end->open_complete = true;
+	memlink_start_deferred_op(end);
+	memlink_unlock(end);
+	gensio_free(send->io);
+	memlink_lock(end);
+	goto out;
+    }
+
+    send->state = MEMLINK_OPEN;
+    /* The user may free it in the callback. */
+    memlink_ref(send);
+    memlink_unlock(end);
+    gensio_acc_cb(nadata->acc, GENSIO_ACC_EVENT_NEW_CONNECTION, send->io);
+    memlink_lock(end);
+    end->open_complete = true;
+    memlink_start_deferred_op(end);
+    /* The user may have started things before the client was ready. */
+    if (send->peer == end && send->state == MEMLINK_OPEN &&
+		send->xmit_enabled)
+	memlink_start_deferred_op(send);
+    memlink_unlock_and_deref(send);
+    memlink_lock(end);
+ out:
+    memlink_unlock_and_deref(end);
+}
+
+static void
+memlinkna_do_deferred(struct gensio_runner *runner, void *cb_data)
+{
+    struct memlinkna_data *nadata = cb_data;
+    struct memlink_end *end;
+    bool accept;
+
+    memlinkna_lock(nadata);
+    nadata->deferred_pending = false;
+
+    while (!gensio_list_empty(&nadata->pending)) {
+	accept = nadata->state == MEMLINKNA_ENABLED;
+	if (accept && !nadata->accept_enabled)
+	    break;
+	end = gensio_container_of(gensio_list_first(&nadata->pending),
+				  struct memlink_end, link);
+	gensio_list_rm(&nadata->pending, &end->link);
+	memlinkna_unlock(nadata);
+	memlinkna_handle_pending(nadata, end, accept);
+	memlinkna_lock(nadata);
+	/* From the pending list. */
+	assert(nadata->refcount > 1);
+	nadata->refcount--;
+    }
+
+    if (nadata->enabled_done) {
+	gensio_acc_done enabled_done = nadata->enabled_done;
+	void *enabled_data = nadata->enabled_data;
+
+	nadata->enabled_done = NULL;
+	memlinkna_unlock(nadata);
+	enabled_done(nadata->acc, enabled_data);
+	memlinkna_lock(nadata);
+    }
+
+    if (nadata->state == MEMLINKNA_IN_SHUTDOWN) {
+	gensio_acc_done shutdown_done = nadata->shutdown_done;
+	void *shutdown_data = nadata->shutdown_data;
+
+	nadata->state = MEMLINKNA_DISABLED;
+	if (shutdown_done) {
+	    memlinkna_unlock(nadata);
+	    shutdown_done(nadata->acc, shutdown_data);
+	    memlinkna_lock(nadata);
+	}
+    }
+    memlinkna_deref_and_unlock(nadata);
+}
+
+static void
+memlinkna_deferred_op(struct memlinkna_data *nadata)
+{
+    if (!nadata->deferred_pending) {
+	memlinkna_ref(nadata);
+	nadata->o->run(nadata->deferred_runner);
+	nadata->deferred_pending = true;
+    }
+}
+
+static int
+memlinkna_startup(struct gensio_accepter *accepter)
+{
+    struct memlinkna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_link *l;
+    int rv = 0;
+
+    o->lock(memlink_acc_lock);
+    memlinkna_lock(nadata);
+    if (nadata->state != MEMLINKNA_DISABLED) {
+	rv = GE_NOTREADY;
+	goto out_unlock;
+    }
+
+    gensio_list_for_each(&memlink_accs, l) {
+	struct memlinkna_data *n = gensio_container_of(l,
+						       struct memlinkna_data,
+						       link);
+
+	if (strcmp(n->name, nadata->name) == 0) {
+	    rv = GE_ADDRINUSE;
+	    break;
+	}
+    }
+    if (rv)
+	goto out_unlock;
+
+    gensio_list_add_tail(&memlink_accs, &nadata->link);
+    nadata->in_list = true;
+    nadata->state = MEMLINKNA_ENABLED;
+    nadata->accept_enabled = true;
+ out_unlock:
+    memlinkna_unlock(nadata);
+    o->unlock(memlink_acc_lock);
+    return rv;
+}
+
+static int
+memlinkna_shutdown(struct gensio_accepter *accepter,
+		   gensio_acc_done shutdown_done, void *shutdown_data)
+{
+    struct memlinkna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv = 0;
+
+    nadata->o->lock(memlink_acc_lock);
+    memlinkna_lock(nadata);
+    if (nadata->state != MEMLINKNA_ENABLED) {
+	rv = GE_NOTREADY;
+    } else {
+	memlinkna_rm_from_list(nadata);
+	nadata->state = MEMLINKNA_IN_SHUTDOWN;
+	nadata->shutdown_done = shutdown_done;
+	nadata->shutdown_data = shutdown_data;
+	/* This also refuses anything pending. */
+	memlinkna_deferred_op(nadata);
+    }
+    memlinkna_unlock(nadata);
+    nadata->o->unlock(memlink_acc_lock);
+
+    return rv;
+}
+
+static int
+memlinkna_set_accept_callback_enable(struct gensio_accepter *accepter,
+				     bool enabled,
+				     gensio_acc_done done, void *done_data)
+{
+    struct memlinkna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv = 0;
+
+    memlinkna_lock(nadata);
+    if (nadata->enabled_done) {
+	rv = GE_INUSE;
+    } else {
+	nadata->accept_enabled = enabled;
+	nadata->enabled_done = done;
+	nadata->enabled_data = done_data;
+	if (done || (enabled && !gensio_list_empty(&nadata->pending)))
+	    memlinkna_deferred_op(nadata);
+    }
+    memlinkna_unlock(nadata);
+
+    return rv;
+}
+
+static void
+memlinkna_disable(struct gensio_accepter *accepter)
+{
+    struct memlinkna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    nadata->o->lock(memlink_acc_lock);
+    memlinkna_lock(nadata);
+    memlinkna_rm_from_list(nadata);
+    nadata->o->unlock(memlink_acc_lock);
+    nadata->state = MEMLINKNA_DISABLED;
+    nadata->shutdown_done = NULL;
+    nadata->enabled_done = NULL;
+    if (!gensio_list_empty(&nadata->pending))
+	memlinkna_deferred_op(nadata);
+    memlinkna_unlock(nadata);
+}
+
+static void
+memlinkna_free(struct gensio_accepter *accepter)
+{
+    struct memlinkna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    nadata->o->lock(memlink_acc_lock);
+    memlinkna_lock(nadata);
+    memlinkna_rm_from_list(nadata);
+    nadata->o->unlock(memlink_acc_lock);
+    if (nadata->state == MEMLINKNA_ENABLED)
+	nadata->state = MEMLINKNA_DISABLED;
+    if (!gensio_list_empty(&nadata->pending))
+	memlinkna_deferred_op(nadata);
+    memlinkna_deref_and_unlock(nadata);
+}
+
+static int
+memlinkna_control(struct gensio_accepter *accepter, bool get,
+		  unsigned int option, char *data, gensiods *datalen)
+{
+    struct memlinkna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    if (option != GENSIO_ACC_CONTROL_LADDR)
+	return GE_NOTSUP;
+    if (!get)
+	return GE_NOTSUP;
+    if (strtoul(data, NULL, 0) > 0)
+	return GE_NOTFOUND;
+    *datalen = gensio_pos_snprintf(data, *datalen, NULL, "memlink,%s",
+				   nadata->name);
+    return 0;
+}
+
+static int
+gensio_acc_memlink_func(struct gensio_accepter *acc, int func, int val,
+			const char *addr, void *done, void *data,
+			const void *data2, void *ret)
+{
+    switch (func) {
+    case GENSIO_ACC_FUNC_STARTUP:
+	return memlinkna_startup(acc);
+
+    case GENSIO_ACC_FUNC_SHUTDOWN:
+	return memlinkna_shutdown(acc, done, data);
+
+    case GENSIO_ACC_FUNC_SET_ACCEPT_CALLBACK:
+	return memlinkna_set_accept_callback_enable(acc, val, done, data);
+
+    case GENSIO_ACC_FUNC_FREE:
+	memlinkna_free(acc);
+	return 0;
+
+    case GENSIO_ACC_FUNC_CONTROL:
+	return memlinkna_control(acc, val, *((unsigned int *) done), data, ret);
+
+    case GENSIO_ACC_FUNC_DISABLE:
+	memlinkna_disable(acc);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+memlink_gensio_accepter_alloc(const void *gdata,
+			      const char * const args[],
+			      struct gensio_os_funcs *o,
+			      gensio_accepter_event cb, void *user_data,
+			      struct gensio_accepter **accepter)
+{
+    const char *name = gdata;
+    struct memlinkna_data *nadata;
+    gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    int i;
+    GENSIO_DECLARE_PPACCEPTER(p, o, cb, "memlink", user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (!name || !*name) {
+	gensio_pparm_slog(&p, "No name given");
+	return GE_INVAL;
+    }
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->refcount = 1;
+    nadata->max_read_size = max_read_size;
+    gensio_list_init(&nadata->pending);
+
+    nadata->name = gensio_strdup(o, name);
+    if (!nadata->name)
+	goto out_nomem;
+
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_nomem;
+
+    nadata->deferred_runner = o->alloc_runner(o, memlinkna_do_deferred,
+					      nadata);
+    if (!nadata->deferred_runner)
+	goto out_nomem;
+
+    nadata->acc = gensio_acc_data_alloc(o, cb, user_data,
+					gensio_acc_memlink_func,
+					NULL, "memlink", nadata);
+    if (!nadata->acc)
+	goto out_nomem;
+    gensio_acc_set_is_reliable(nadata->acc, true);
+
+    *accepter = nadata->acc;
+    return 0;
+
+ out_nomem:
+    memlinkna_finish_free(nadata);
+    return GE_NOMEM;
+}
+
+static int
+str_to_memlink_gensio_accepter(const char *str, const char * const args[],
+			       struct gensio_os_funcs *o,
+			       gensio_accepter_event cb,
+			       void *user_data,
+			       struct gensio_accepter **acc)
+{
+    return memlink_gensio_accepter_alloc(str, args, o, cb, user_data, acc);
+}
+
+static void
+gensio_memlink_cleanup_mem(void)
+{
+    if (memlink_acc_lock)
+	memlink_o->free_lock(memlink_acc_lock);
+    memlink_acc_lock = NULL;
+}
+
+static struct gensio_class_cleanup memlink_class_cleanup = {
+    gensio_memlink_cleanup_mem
+};
+
+int
+gensio_init_memlink(struct gensio_os_funcs *o)
+{
+    int rv;
+
+    memlink_o = o;
+    gensio_list_init(&memlink_accs);
+    memlink_acc_lock = o->alloc_lock(o);
+    if (!memlink_acc_lock)
+	return GE_NOMEM;
+    gensio_register_class_cleanup(&memlink_class_cleanup);
+
+    rv = register_gensio(o, "memlink", str_to_memlink_gensio,
+			 memlink_gensio_alloc);
+    if (rv)
+	return rv;
+    rv = register_gensio_accepter(o, "memlink",
+				  str_to_memlink_gensio_accepter,
+				  memlink_gensio_accepter_alloc);
+    if (rv)
+	return rv;
+    return 0;
+}
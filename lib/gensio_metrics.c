@@ -0,0 +1,921 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * A metrics accepter sits on top of another accepter and serves the
+ * gensio counters (see gensio_metrics_iterate()) and the os funcs
+ * statistics over HTTP in OpenMetrics text format.  Each connection
+ * from the child accepter is handled here, it reads a request, sends
+ * the current metrics, and closes.  Nothing is reported to the user.
+ *
+ * Everything is protected by the accepter's lock.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+
+/* The most of a request we keep, the rest is ignored. */
+#define METRICS_MAX_REQUEST 1024
+
+enum metricsna_state {
+    METRICSNA_DISABLED,
+    METRICSNA_ENABLED,
+    METRICSNA_IN_SHUTDOWN
+};
+
+struct metricsna_data;
+
+struct metrics_conn {
+    struct metricsna_data *nadata;
+    struct gensio *io;
+    struct gensio_link link;
+
+    char req[METRICS_MAX_REQUEST];
+    gensiods reqlen;
+
+    char *out;
+    gensiods outlen;
+    gensiods outpos;
+
+    /* Off the conns list, waiting for the close to finish. */
+    bool closing;
+};
+
+struct metricsna_data {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_accepter *acc;
+    struct gensio_accepter *child;
+    unsigned int refcount;
+    enum metricsna_state state;
+
+    bool loop_stats;
+
+    struct gensio_list conns;
+    /* Connections that are being closed. */
+    unsigned int nr_closing;
+    gensiods requests;
+
+    bool accept_enabled;
+    bool child_shutdown_pending;
+
+    bool deferred_pending;
+    struct gensio_runner *deferred_runner;
+
+    gensio_acc_done shutdown_done;
+    void *shutdown_data;
+
+    gensio_acc_done enabled_done;
+    void *enabled_data;
+};
+
+/* A growing buffer for building the response. */
+struct metrics_buf {
+    struct gensio_os_funcs *o;
+    char *buf;
+    gensiods len;
+    gensiods size;
+    bool nomem;
+};
+
+static void metricsna_deferred_op(struct metricsna_data *nadata);
+
+static void
+metricsna_lock(struct metricsna_data *nadata)
+{
+    nadata->o->lock(nadata->lock);
+}
+
+static void
+metricsna_unlock(struct metricsna_data *nadata)
+{
+    nadata->o->unlock(nadata->lock);
+}
+
+static void
+metricsna_finish_free(struct metricsna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+
+    if (nadata->child)
+	gensio_acc_free(nadata->child);
+    if (nadata->acc)
+	gensio_acc_data_free(nadata->acc);
+    if (nadata->deferred_runner)
+	o->free_runner(nadata->deferred_runner);
+    if (nadata->lock)
+	o->free_lock(nadata->lock);
+    o->free(o, nadata);
+}
+
+static void
+metricsna_ref(struct metricsna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    nadata->refcount++;
+}
+
+static void
+metricsna_deref_and_unlock(struct metricsna_data *nadata)
+{
+    assert(nadata->refcount > 0);
+    nadata->refcount--;
+    if (nadata->refcount == 0) {
+	metricsna_unlock(nadata);
+	metricsna_finish_free(nadata);
+    } else {
+	metricsna_unlock(nadata);
+    }
+}
+
+static void
+metrics_printf(struct metrics_buf *b, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (b->nomem)
+	return;
+ retry:
+    va_start(ap, fmt);
+    len = vsnprintf(b->buf + b->len, b->size - b->len, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+	return;
+    if ((gensiods) len >= b->size - b->len) {
+	gensiods newsize = b->size * 2;
+	char *newbuf;
+
+	while (newsize - b->len <= (gensiods) len)
+	    newsize *= 2;
+	newbuf = b->o->zalloc(b->o, newsize);
+	if (!newbuf) {
+	    b->nomem = true;
+	    return;
+	}
+	memcpy(newbuf, b->buf, b->len);
+	b->o->free(b->o, b->buf);
+	b->buf = newbuf;
+	b->size = newsize;
+	goto retry;
+    }
+    b->len += len;
+}
+
+static void
+metrics_family(struct metrics_buf *b, const char *name, const char *type,
+	       const char *help)
+{
+    metrics_printf(b, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static double
+metrics_secs(gensio_time *t)
+{
+    return (double) t->secs + (double) t->nsecs / 1000000000.0;
+}
+
+/*
+ * The gensio type counters, each family is printed with a line per
+ * type, so walk the types once for each.
+ */
+struct metrics_type_pass {
+    struct metrics_buf *b;
+    const char *name;
+    unsigned int field;
+};
+
+enum {
+    MF_ALLOCED,
+    MF_OPEN,
+    MF_READS,
+    MF_READ_BYTES,
+    MF_WRITES,
+    MF_WRITE_BYTES
+};
+
+static int
+metrics_type_cb(const struct gensio_type_metrics *m, void *cb_data)
+{
+    struct metrics_type_pass *p = cb_data;
+    gensiods v = 0;
+
+    switch (p->field) {
+    case MF_ALLOCED:
+	v = m->alloced;
+	break;
+
+    case MF_OPEN:
+	/* These are read separately, a free may be counted in between. */
+	if (m->alloced > m->freed)
+	    v = m->alloced - m->freed;
+	break;
+
+    case MF_READS:
+	v = m->reads;
+	break;
+
+    case MF_READ_BYTES:
+	v = m->read_bytes;
+	break;
+
+    case MF_WRITES:
+	v = m->writes;
+	break;
+
+    case MF_WRITE_BYTES:
+	v = m->write_bytes;
+	break;
+    }
+    metrics_printf(p->b, "%s{type=\"%s\"} %lu\n", p->name, m->type_name,
+		   (unsigned long) v);
+    return 0;
+}
+
+static const struct {
+    const char *family;
+    const char *type;
+    const char *help;
+    unsigned int field;
+} metrics_type_families[] = {
+    { "gensio_allocs", "counter", "Gensios allocated.", MF_ALLOCED },
+    { "gensio_current", "gauge", "Gensios currently allocated.", MF_OPEN },
+    { "gensio_reads", "counter", "Read events delivered.", MF_READS },
+    { "gensio_read_bytes", "counter", "Bytes taken from read events.",
+      MF_READ_BYTES },
+    { "gensio_writes", "counter", "Writes done.", MF_WRITES },
+    { "gensio_write_bytes", "counter", "Bytes accepted by writes.",
+      MF_WRITE_BYTES },
+    { NULL }
+};
+
+static void
+metrics_format_os(struct metricsna_data *nadata, struct metrics_buf *b)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_loop_stats ls;
+    struct gensio_bufpool_stats bs;
+    struct gensio_addrcache_stats as;
+    struct gensio_busy_poll_stats ps;
+    struct gensio_readbuf_budget_config rb;
+    gensiods len;
+
+    len = sizeof(ls);
+    if (o->control(o, GENSIO_CONTROL_LOOP_STATS, &ls, &len) == 0) {
+	metrics_family(b, "gensio_loop_wakeups", "counter",
+		       "Waits for I/O that returned events.");
+	metrics_printf(b, "gensio_loop_wakeups_total %lu\n",
+		       (unsigned long) ls.wakeups);
+	metrics_family(b, "gensio_loop_fds_dispatched", "counter",
+		       "File descriptor handlers called.");
+	metrics_printf(b, "gensio_loop_fds_dispatched_total %lu\n",
+		       (unsigned long) ls.fds_dispatched);
+	metrics_family(b, "gensio_loop_timers_fired", "counter",
+		       "Timer handlers called.");
+	metrics_printf(b, "gensio_loop_timers_fired_total %lu\n",
+		       (unsigned long) ls.timers_fired);
+	metrics_family(b, "gensio_loop_runners_run", "counter",
+		       "Runners called.");
+	metrics_printf(b, "gensio_loop_runners_run_total %lu\n",
+		       (unsigned long) ls.runners_run);
+	metrics_family(b, "gensio_loop_dispatch_latency_seconds", "counter",
+		       "Total time from a wakeup to the handlers running.");
+	metrics_printf(b, "gensio_loop_dispatch_latency_seconds_total %.9f\n",
+		       metrics_secs(&ls.total_dispatch_latency));
+	metrics_family(b, "gensio_loop_max_dispatch_latency_seconds", "gauge",
+		       "Longest time from a wakeup to a handler running.");
+	metrics_printf(b, "gensio_loop_max_dispatch_latency_seconds %.9f\n",
+		       metrics_secs(&ls.max_dispatch_latency));
+	metrics_family(b, "gensio_loop_max_handler_seconds", "gauge",
+		       "Longest single handler.");
+	metrics_printf(b, "gensio_loop_max_handler_seconds %.9f\n",
+		       metrics_secs(&ls.max_handler_time));
+	metrics_family(b, "gensio_loop_timer_late_seconds", "counter",
+		       "Total time timers ran after their expiry.");
+	metrics_printf(b, "gensio_loop_timer_late_seconds_total %.9f\n",
+		       metrics_secs(&ls.total_timer_late));
+    }
+
+    len = sizeof(bs);
+    if (o->control(o, GENSIO_CONTROL_BUFPOOL_STATS, &bs, &len) == 0) {
+	metrics_family(b, "gensio_bufpool_hits", "counter",
+		       "Buffers allocated from the pool.");
+	metrics_printf(b, "gensio_bufpool_hits_total %lu\n",
+		       (unsigned long) bs.hits);
+	metrics_family(b, "gensio_bufpool_misses", "counter",
+		       "Buffer allocations that called malloc.");
+	metrics_printf(b, "gensio_bufpool_misses_total %lu\n",
+		       (unsigned long) bs.misses);
+	metrics_family(b, "gensio_bufpool_free", "gauge",
+		       "Free buffers held by the pool.");
+	metrics_printf(b, "gensio_bufpool_free %lu\n",
+		       (unsigned long) bs.free);
+    }
+
+    len = sizeof(as);
+    if (o->control(o, GENSIO_CONTROL_ADDRCACHE_STATS, &as, &len) == 0) {
+	metrics_family(b, "gensio_addrcache_hits", "counter",
+		       "Address lookups answered from the cache.");
+	metrics_printf(b, "gensio_addrcache_hits_total %lu\n",
+		       (unsigned long) (as.hits + as.neg_hits));
+	metrics_family(b, "gensio_addrcache_misses", "counter",
+		       "Address lookups that asked the resolver.");
+	metrics_printf(b, "gensio_addrcache_misses_total %lu\n",
+		       (unsigned long) as.misses);
+	metrics_family(b, "gensio_addrcache_entries", "gauge",
+		       "Entries in the address cache.");
+	metrics_printf(b, "gensio_addrcache_entries %lu\n",
+		       (unsigned long) as.entries);
+    }
+
+    len = sizeof(ps);
+    if (o->control(o, GENSIO_CONTROL_BUSY_POLL_STATS, &ps, &len) == 0) {
+	metrics_family(b, "gensio_busy_poll_hits", "counter",
+		       "Waits where something came in while polling.");
+	metrics_printf(b, "gensio_busy_poll_hits_total %lu\n",
+		       (unsigned long) ps.spin_hits);
+	metrics_family(b, "gensio_busy_poll_sleeps", "counter",
+		       "Waits that blocked after polling.");
+	metrics_printf(b, "gensio_busy_poll_sleeps_total %lu\n",
+		       (unsigned long) ps.sleeps);
+    }
+
+    len = sizeof(rb);
+    if (o->control(o, GENSIO_CONTROL_READBUF_BUDGET_GET_CONFIG,
+		   &rb, &len) == 0) {
+	metrics_family(b, "gensio_readbuf_bytes", "gauge",
+		       "Memory used by adaptive read buffers.");
+	metrics_printf(b, "gensio_readbuf_bytes %lu\n",
+		       (unsigned long) rb.in_use);
+    }
+}
+
+/*
+ * Build the HTTP response in conn->out.  The metrics are gathered
+ * without the lock, nothing here touches the accepter.
+ */
+static int
+metrics_build_response(struct metricsna_data *nadata,
+		       struct metrics_conn *conn)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct metrics_buf b, hdr;
+    struct metrics_type_pass p;
+    char name[64];
+    unsigned int i;
+    bool is_get;
+
+    memset(&b, 0, sizeof(b));
+    b.o = o;
+    b.size = 4096;
+    b.buf = o->zalloc(o, b.size);
+    if (!b.buf)
+	return GE_NOMEM;
+    hdr = b;
+    hdr.size = 256;
+    hdr.buf = o->zalloc(o, hdr.size);
+    if (!hdr.buf) {
+	o->free(o, b.buf);
+	return GE_NOMEM;
+    }
+
+    is_get = strncmp(conn->req, "GET ", 4) == 0;
+    if (is_get) {
+	p.b = &b;
+	p.name = name;
+	for (i = 0; metrics_type_families[i].family; i++) {
+	    metrics_family(&b, metrics_type_families[i].family,
+			   metrics_type_families[i].type,
+			   metrics_type_families[i].help);
+	    /* Samples of a counter family end in _total. */
+	    snprintf(name, sizeof(name), "%s%s",
+		     metrics_type_families[i].family,
+		     strcmp(metrics_type_families[i].type, "counter") == 0 ?
+		     "_total" : "");
+	    p.field = metrics_type_families[i].field;
+	    gensio_metrics_iterate(metrics_type_cb, &p);
+	}
+	metrics_format_os(nadata, &b);
+	metrics_printf(&b, "# EOF\n");
+
+	metrics_printf(&hdr, "HTTP/1.1 200 OK\r\n"
+		       "Content-Type: application/openmetrics-text;"
+		       " version=1.0.0; charset=utf-8\r\n");
+    } else {
+	metrics_printf(&b, "Only GET is supported\n");
+	metrics_printf(&hdr, "HTTP/1.1 405 Method Not Allowed\r\n"
+		       "Allow: GET\r\n"
+		       "Content-Type: text/plain\r\n");
+    }
+    metrics_printf(&hdr, "Content-Length: %lu\r\nConnection: close\r\n\r\n",
+		   (unsigned long) b.len);
+
+    if (b.nomem || hdr.nomem) {
+	o->free(o, b.buf);
+	o->free(o, hdr.buf);
+	return GE_NOMEM;
+    }
+
+    /* Put the header in front of the body. */
+    conn->out = o->zalloc(o, hdr.len + b.len);
+    if (!conn->out) {
+	o->free(o, b.buf);
+	o->free(o, hdr.buf);
+	return GE_NOMEM;
+    }
+    memcpy(conn->out, hdr.buf, hdr.len);
+    memcpy(conn->out + hdr.len, b.buf, b.len);
+    conn->outlen = hdr.len + b.len;
+    conn->outpos = 0;
+    o->free(o, b.buf);
+    o->free(o, hdr.buf);
+    return 0;
+}
+
+static void
+metrics_conn_free(struct metrics_conn *conn)
+{
+    struct gensio_os_funcs *o = conn->nadata->o;
+
+    if (conn->out)
+	o->free(o, conn->out);
+    o->free(o, conn);
+}
+
+static void
+metrics_conn_close_done(struct gensio *io, void *close_data)
+{
+    struct metrics_conn *conn = close_data;
+    struct metricsna_data *nadata = conn->nadata;
+
+    gensio_free(io);
+    metricsna_lock(nadata);
+    metrics_conn_free(conn);
+    assert(nadata->nr_closing > 0);
+    nadata->nr_closing--;
+    if (nadata->state == METRICSNA_IN_SHUTDOWN)
+	metricsna_deferred_op(nadata);
+    metricsna_deref_and_unlock(nadata);
+}
+
+/* Must be called with the lock held. */
+static void
+metrics_conn_close(struct metrics_conn *conn)
+{
+    struct metricsna_data *nadata = conn->nadata;
+    int err;
+
+    if (conn->closing)
+	return;
+    conn->closing = true;
+    gensio_list_rm(&nadata->conns, &conn->link);
+    nadata->nr_closing++;
+    gensio_set_read_callback_enable(conn->io, false);
+    gensio_set_write_callback_enable(conn->io, false);
+    err = gensio_close(conn->io, metrics_conn_close_done, conn);
+    if (err) {
+	/* Already closed, just get rid of it. */
+	nadata->nr_closing--;
+	gensio_free(conn->io);
+	metrics_conn_free(conn);
+	nadata->refcount--; /* There's always the accepter's ref. */
+    }
+}
+
+/* Is the whole request header in? */
+static bool
+metrics_request_done(struct metrics_conn *conn)
+{
+    conn->req[conn->reqlen] = '\0';
+    return (strstr(conn->req, "\r\n\r\n") || strstr(conn->req, "\n\n") ||
+	    conn->reqlen >= sizeof(conn->req) - 1);
+}
+
+static int
+metrics_conn_event(struct gensio *io, void *user_data, int event, int err,
+		   unsigned char *buf, gensiods *buflen,
+		   const char *const *auxdata)
+{
+    struct metrics_conn *conn = user_data;
+    struct metricsna_data *nadata = conn->nadata;
+    gensiods count;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	metricsna_lock(nadata);
+	if (conn->closing || conn->out) {
+	    /* Ignore anything after the request. */
+	    metricsna_unlock(nadata);
+	    return 0;
+	}
+	if (err) {
+	    metrics_conn_close(conn);
+	    metricsna_unlock(nadata);
+	    return 0;
+	}
+	count = *buflen;
+	if (count > sizeof(conn->req) - 1 - conn->reqlen)
+	    count = sizeof(conn->req) - 1 - conn->reqlen;
+	memcpy(conn->req + conn->reqlen, buf, count);
+	conn->reqlen += count;
+	if (metrics_request_done(conn)) {
+	    gensio_set_read_callback_enable(io, false);
+	    nadata->requests++;
+	    metricsna_unlock(nadata);
+	    err = metrics_build_response(nadata, conn);
+	    metricsna_lock(nadata);
+	    if (err || conn->closing)
+		metrics_conn_close(conn);
+	    else
+		gensio_set_write_callback_enable(io, true);
+	}
+	metricsna_unlock(nadata);
+	return 0;
+
+    case GENSIO_EVENT_WRITE_READY:
+	metricsna_lock(nadata);
+	if (conn->closing || !conn->out) {
+	    metricsna_unlock(nadata);
+	    return 0;
+	}
+	err = gensio_write(io, &count, conn->out + conn->outpos,
+			   conn->outlen - conn->outpos, NULL);
+	if (err) {
+	    metrics_conn_close(conn);
+	} else {
+	    conn->outpos += count;
+	    if (conn->outpos >= conn->outlen)
+		metrics_conn_close(conn);
+	}
+	metricsna_unlock(nadata);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+metricsna_child_event(struct gensio_accepter *accepter, void *user_data,
+		      int event, void *data)
+{
+    struct metricsna_data *nadata = user_data;
+    struct gensio *io = data;
+    struct metrics_conn *conn;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return gensio_acc_cb(nadata->acc, event, data);
+
+    conn = nadata->o->zalloc(nadata->o, sizeof(*conn));
+    if (!conn) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "Out of memory allocating metrics connection");
+	gensio_free(io);
+	return 0;
+    }
+    conn->nadata = nadata;
+    conn->io = io;
+
+    metricsna_lock(nadata);
+    if (nadata->state != METRICSNA_ENABLED || !nadata->accept_enabled) {
+	metricsna_unlock(nadata);
+	nadata->o->free(nadata->o, conn);
+	gensio_free(io);
+	return 0;
+    }
+    metricsna_ref(nadata);
+    gensio_list_add_tail(&nadata->conns, &conn->link);
+    gensio_set_callback(io, metrics_conn_event, conn);
+    gensio_set_read_callback_enable(io, true);
+    metricsna_unlock(nadata);
+
+    return 0;
+}
+
+static void
+metricsna_do_deferred(struct gensio_runner *runner, void *cb_data)
+{
+    struct metricsna_data *nadata = cb_data;
+
+    metricsna_lock(nadata);
+    nadata->deferred_pending = false;
+
+    if (nadata->enabled_done) {
+	gensio_acc_done enabled_done = nadata->enabled_done;
+	void *enabled_data = nadata->enabled_data;
+
+	nadata->enabled_done = NULL;
+	metricsna_unlock(nadata);
+	enabled_done(nadata->acc, enabled_data);
+	metricsna_lock(nadata);
+    }
+
+    if (nadata->state == METRICSNA_IN_SHUTDOWN &&
+		!nadata->child_shutdown_pending && nadata->nr_closing == 0) {
+	gensio_acc_done shutdown_done = nadata->shutdown_done;
+	void *shutdown_data = nadata->shutdown_data;
+
+	nadata->state = METRICSNA_DISABLED;
+	if (shutdown_done) {
+	    metricsna_unlock(nadata);
+	    shutdown_done(nadata->acc, shutdown_data);
+	    metricsna_lock(nadata);
+	}
+    }
+    metricsna_deref_and_unlock(nadata);
+}
+
+static void
+metricsna_deferred_op(struct metricsna_data *nadata)
+{
+    if (!nadata->deferred_pending) {
+	metricsna_ref(nadata);
+	nadata->o->run(nadata->deferred_runner);
+	nadata->deferred_pending = true;
+    }
+}
+
+static int
+metricsna_startup(struct gensio_accepter *accepter)
+{
+    struct metricsna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv;
+
+    metricsna_lock(nadata);
+    if (nadata->state != METRICSNA_DISABLED) {
+	metricsna_unlock(nadata);
+	return GE_NOTREADY;
+    }
+    nadata->state = METRICSNA_ENABLED;
+    nadata->accept_enabled = true;
+    metricsna_unlock(nadata);
+
+    /* Don't hold our lock, the child may report connections. */
+    rv = gensio_acc_startup(nadata->child);
+
+    if (rv) {
+	metricsna_lock(nadata);
+	nadata->state = METRICSNA_DISABLED;
+	metricsna_unlock(nadata);
+    }
+    return rv;
+}
+
+static void
+metricsna_child_shutdown_done(struct gensio_accepter *accepter,
+			      void *shutdown_data)
+{
+    struct metricsna_data *nadata = shutdown_data;
+
+    metricsna_lock(nadata);
+    nadata->child_shutdown_pending = false;
+    metricsna_deferred_op(nadata);
+    metricsna_deref_and_unlock(nadata);
+}
+
+/* Close all the connections.  Must be called with the lock held. */
+static void
+metricsna_close_conns(struct metricsna_data *nadata)
+{
+    struct gensio_link *l, *l2;
+
+    gensio_list_for_each_safe(&nadata->conns, l, l2) {
+	struct metrics_conn *conn = gensio_container_of(l,
+							struct metrics_conn,
+							link);
+
+	metrics_conn_close(conn);
+    }
+}
+
+static int
+metricsna_shutdown(struct gensio_accepter *accepter,
+		   gensio_acc_done shutdown_done, void *shutdown_data)
+{
+    struct metricsna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv;
+
+    metricsna_lock(nadata);
+    if (nadata->state != METRICSNA_ENABLED) {
+	metricsna_unlock(nadata);
+	return GE_NOTREADY;
+    }
+    metricsna_ref(nadata);
+    nadata->child_shutdown_pending = true;
+    nadata->state = METRICSNA_IN_SHUTDOWN;
+    nadata->shutdown_done = shutdown_done;
+    nadata->shutdown_data = shutdown_data;
+    metricsna_close_conns(nadata);
+    metricsna_unlock(nadata);
+
+    rv = gensio_acc_shutdown(nadata->child, metricsna_child_shutdown_done,
+			     nadata);
+    if (rv)
+	/* The child is already shut down, just finish. */
+	metricsna_child_shutdown_done(nadata->child, nadata);
+
+    return 0;
+}
+
+static int
+metricsna_set_accept_callback_enable(struct gensio_accepter *accepter,
+				     bool enabled,
+				     gensio_acc_done done, void *done_data)
+{
+    struct metricsna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    int rv = 0;
+
+    metricsna_lock(nadata);
+    if (nadata->enabled_done) {
+	rv = GE_INUSE;
+    } else {
+	nadata->accept_enabled = enabled;
+	nadata->enabled_done = done;
+	nadata->enabled_data = done_data;
+	if (done)
+	    metricsna_deferred_op(nadata);
+    }
+    metricsna_unlock(nadata);
+
+    return rv;
+}
+
+static void
+metricsna_disable(struct gensio_accepter *accepter)
+{
+    struct metricsna_data *nadata = gensio_acc_get_gensio_data(accepter);
+    struct gensio_link *l, *l2;
+
+    gensio_acc_disable(nadata->child);
+    metricsna_lock(nadata);
+    gensio_list_for_each_safe(&nadata->conns, l, l2) {
+	struct metrics_conn *conn = gensio_container_of(l,
+							struct metrics_conn,
+							link);
+
+	gensio_list_rm(&nadata->conns, &conn->link);
+	gensio_disable(conn->io);
+	gensio_free(conn->io);
+	metrics_conn_free(conn);
+	nadata->refcount--;
+    }
+    nadata->state = METRICSNA_DISABLED;
+    nadata->shutdown_done = NULL;
+    nadata->enabled_done = NULL;
+    metricsna_unlock(nadata);
+}
+
+static void
+metricsna_free(struct gensio_accepter *accepter)
+{
+    struct metricsna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    gensio_metrics_enable(false);
+    if (nadata->loop_stats) {
+	struct gensio_loop_stats_config c = { .enable = false };
+	gensiods len = sizeof(c);
+
+	nadata->o->control(nadata->o, GENSIO_CONTROL_LOOP_STATS_SET_CONFIG,
+			   &c, &len);
+    }
+
+    metricsna_lock(nadata);
+    if (nadata->state == METRICSNA_ENABLED)
+	nadata->state = METRICSNA_DISABLED;
+    metricsna_close_conns(nadata);
+    metricsna_deref_and_unlock(nadata);
+}
+
+static int
+gensio_acc_metrics_func(struct gensio_accepter *acc, int func, int val,
+			const char *addr, void *done, void *data,
+			const void *data2, void *ret)
+{
+    switch (func) {
+    case GENSIO_ACC_FUNC_STARTUP:
+	return metricsna_startup(acc);
+
+    case GENSIO_ACC_FUNC_SHUTDOWN:
+	return metricsna_shutdown(acc, done, data);
+
+    case GENSIO_ACC_FUNC_SET_ACCEPT_CALLBACK:
+	return metricsna_set_accept_callback_enable(acc, val, done, data);
+
+    case GENSIO_ACC_FUNC_FREE:
+	metricsna_free(acc);
+	return 0;
+
+    case GENSIO_ACC_FUNC_DISABLE:
+	metricsna_disable(acc);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+metrics_gensio_accepter_alloc(struct gensio_accepter *child,
+			      const char * const args[],
+			      struct gensio_os_funcs *o,
+			      gensio_accepter_event cb, void *user_data,
+			      struct gensio_accepter **accepter)
+{
+    struct metricsna_data *nadata;
+    bool loop_stats = false;
+    int i;
+    GENSIO_DECLARE_PPACCEPTER(p, o, cb, "metrics", user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_bool(&p, args[i], "loop-stats", &loop_stats) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->refcount = 1;
+    gensio_list_init(&nadata->conns);
+
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_nomem;
+
+    nadata->deferred_runner = o->alloc_runner(o, metricsna_do_deferred,
+					      nadata);
+    if (!nadata->deferred_runner)
+	goto out_nomem;
+
+    nadata->acc = gensio_acc_data_alloc(o, cb, user_data,
+					gensio_acc_metrics_func,
+					child, "metrics", nadata);
+    if (!nadata->acc)
+	goto out_nomem;
+    gensio_acc_set_is_reliable(nadata->acc, gensio_acc_is_reliable(child));
+
+    /* The child is ours now. */
+    nadata->child = child;
+    gensio_acc_set_callback(child, metricsna_child_event, nadata);
+
+    gensio_metrics_enable(true);
+    if (loop_stats) {
+	struct gensio_loop_stats_config c = { .enable = true };
+	gensiods len = sizeof(c);
+
+	if (o->control(o, GENSIO_CONTROL_LOOP_STATS_SET_CONFIG,
+		       &c, &len) == 0)
+	    nadata->loop_stats = true;
+    }
+
+    *accepter = nadata->acc;
+    return 0;
+
+ out_nomem:
+    metricsna_finish_free(nadata);
+    return GE_NOMEM;
+}
+
+static int
+str_to_metrics_gensio_accepter(const char *str, const char * const args[],
+			       struct gensio_os_funcs *o,
+			       gensio_accepter_event cb,
+			       void *user_data,
+			       struct gensio_accepter **acc)
+{
+    int err;
+    struct gensio_accepter *acc2 = NULL;
+
+    /* cb is passed in for parmerr handling, it will be overriden later. */
+    err = str_to_gensio_accepter(str, o, cb, user_data, &acc2);
+    if (!err) {
+	err = metrics_gensio_accepter_alloc(acc2, args, o, cb, user_data,
+					    acc);
+	if (err)
+	    gensio_acc_free(acc2);
+    }
+
+    return err;
+}
+
+int
+gensio_init_metrics(struct gensio_os_funcs *o)
+{
+    return register_filter_gensio_accepter(o, "metrics",
+					   str_to_metrics_gensio_accepter,
+					   metrics_gensio_accepter_alloc);
+}
@@ -16,6 +16,8 @@
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_acc_gensio.h>
 #include <gensio/gensio_list.h>
+#include <gensio/gensio_circbuf.h>
+#include <gensio_probes.h>
 
 /*
  * The protocol consists of messages.  The first byte of a message
@@ -58,11 +60,24 @@ enum mux_msgs {
      * version adds data after the version, older version should
      * ignore it.
      *
-     * This is version 1 of the protocol.
+     * This is version 2 of the protocol.  Version 2 only changes the
+     * data size in data messages and the flow control accounting for
+     * them, see MUX_DATA.
      *
      * +----------------+--------+-------+----------------+----------------+
      * |   1   |size(1) |    reserved    |    version     |   reserved     |
      * +----------------+--------+-------+----------------+----------------+
+     *
+     * Version 4 adds the byte count window that the sender gives to
+     * channels the remote end opens.  That lets the remote end send
+     * data on a new channel before the new channel response comes
+     * back, see MUX_DATA.
+     *
+     * +----------------+--------+-------+----------------+----------------+
+     * |   1   |size(2) |    reserved    |    version     |   reserved     |
+     * +----------------+--------+-------+----------------+----------------+
+     * |                  new channel byte count window                    |
+     * +----------------+----------------+----------------+----------------+
      */
     MUX_INIT		= 1,
 
@@ -136,20 +151,87 @@ enum mux_msgs {
      * +----------------+----------------+----------------+----------------+
      * |                               data...                             |
      * +----------------+----------------+----------------+----------------+
+     *
+     * In version 2 the data size is 32 bits, so a message can be
+     * larger than 64K, and it is 4 bytes of each message for flow
+     * control:
+     *
+     * +----------------+----------------+----------------+----------------+
+     * |                             data size                             |
+     * +----------------+----------------+----------------+----------------+
+     * |                               data...                             |
+     * +----------------+----------------+----------------+----------------+
+     *
+     * In version 4, the opener of a channel may send data after the
+     * new channel message without waiting for the response, using
+     * the new channel window from the remote end's init message.
+     * Until the response comes back the opener doesn't know the
+     * remote channel id, so it sets MUX_FLAG_EARLY and puts its own
+     * channel id in the message.  The receiver finds the channel by
+     * its remote id and drops the data if the channel was refused.
      */
     MUX_DATA		= 5,
+
+    /*
+     * Version 3 only.  Tell the remote end it may now have a new
+     * byte count window outstanding on the channel.  This is sent
+     * when the receive window is auto-tuned larger.
+     *
+     * +----------------+----------------+----------------+----------------+
+     * |   6   |size(2) |    reserved    |      remote channel id          |
+     * +----------------+----------------+----------------+----------------+
+     * |                          byte count window                        |
+     * +----------------+----------------+----------------+----------------+
+     */
+    MUX_WINDOW		= 6,
 };
 
-#define MUX_MAX_MSG_NUM MUX_DATA
+#define MUX_MAX_MSG_NUM MUX_WINDOW
 
-static unsigned int mux_msg_hdr_sizes[] = { 0, 1, 2, 3, 2, 2 };
+static unsigned int mux_msg_hdr_sizes[] = { 0, 1, 2, 3, 2, 2, 2 };
 
 /* External flags for MUX_DATA */
 #define MUX_FLAG_END_OF_MESSAGE		(1 << 0)
 #define MUX_FLAG_OUT_OF_BOUND		(1 << 1)
 
+/*
+ * Internal flag for MUX_DATA in version 3, the sender had data held
+ * back by the window since the last data it sent.  This is stripped
+ * on receipt.
+ */
+#define MUX_FLAG_WINDOW_LIMITED		(1 << 2)
+
+/*
+ * Internal flag for MUX_DATA in version 4, the channel id is the
+ * sender's id because the new channel response has not been received
+ * yet.  This is stripped on receipt.
+ */
+#define MUX_FLAG_EARLY			(1 << 3)
+
 #define MUX_MAX_HDR_SIZE	12
 #define MUX_MIN_SEND_WINDOW_SIZE	128
+#define MUX_PROTO_VERSION	4
+
+/*
+ * Default limit on the total receive buffer memory of all channels
+ * in a mux when auto-tuning grows receive windows.
+ */
+#define MUX_DEFAULT_MAX_MEM	(64 * 1024 * 1024)
+#define MUX_MAX_WINDOW		0x7fffffff
+
+/*
+ * Up to this many channel messages are written to the child in one
+ * gensio_write_sg().
+ */
+#define MUX_MAX_BATCH		16
+
+/*
+ * Channels waiting to write are served highest priority first.
+ * Channels at the same priority share the link by deficit round
+ * robin, each gets weight * MUX_DRR_QUANTUM bytes per round.
+ */
+#define MUX_DRR_QUANTUM		1024
+#define MUX_MAX_WEIGHT		1000
 
 #ifdef ENABLE_INTERNAL_TRACE
 #define MUX_TRACING
@@ -213,10 +295,20 @@ struct mux_inst {
     gensiods read_data_pos;
     gensiods read_data_len;
     gensiods max_read_size;
+    bool read_mirrored; /* read_data is mapped twice, never wraps. */
     bool read_enabled;
     bool in_read_report;
     int in_newchannel;
 
+    /*
+     * Receive window auto-tuning.  The read buffer may grow up to
+     * max_readbuf, see chan_autotune().  tune_bytes counts bytes
+     * received since the last tuning decision.
+     */
+    gensiods max_readbuf;
+    gensiods tune_bytes;
+    bool send_window;
+
     /* Number of bytes we need to send an ack for. */
     gensiods received_unacked;
 
@@ -236,6 +328,9 @@ struct mux_inst {
      */
     unsigned int send_window_size;
 
+    /* Data was held back by the send window, tell the remote end. */
+    bool window_limited;
+
     bool deferred_op_pending;
     struct gensio_runner *deferred_op_runner;
 
@@ -256,7 +351,16 @@ struct mux_inst {
 
     /* Link for list of channels waiting write. */
     struct gensio_link wrlink;
-    bool wr_ready; /* Also true if chan == muxdata->sending_chan. */
+    bool wr_ready; /* Also true if chan is in muxdata->sendq. */
+
+    /* Link for muxdata->sendq, chan has a message being sent. */
+    struct gensio_link sendlink;
+    bool in_sendq;
+
+    /* Write scheduling, see MUX_DRR_QUANTUM. */
+    unsigned int priority;
+    unsigned int weight;
+    int deficit; /* Bytes this channel may still send this round. */
 
     bool in_wrlist;
     bool in_open_chan;
@@ -349,10 +453,16 @@ struct gensio_mux_config {
     struct gensio_os_funcs *o;
     gensiods max_read_size;
     gensiods max_write_size;
+    gensiods max_readbuf;
+    gensiods max_mem;
     char *service;
     size_t service_len;
     unsigned int max_channels;
+    unsigned int priority;
+    unsigned int weight;
+    unsigned int version;
     bool is_client;
+    bool dispatch_runner;
 };
 
 enum mux_state {
@@ -420,6 +530,19 @@ struct mux_data {
     gensiods max_read_size;
     gensiods max_write_size;
 
+    /*
+     * Receive window auto-tuning, read_mem is the total size of the
+     * read buffers of all channels.  Windows are not grown past
+     * max_mem total.
+     */
+    gensiods max_readbuf;
+    gensiods max_mem;
+    gensiods read_mem;
+
+    /* Scheduling for channels the remote end opens. */
+    unsigned int priority;
+    unsigned int weight;
+
     int exit_err;
     enum mux_state exit_state;
 
@@ -430,6 +553,14 @@ struct mux_data {
 
     bool is_client;
 
+    /*
+     * Deliver channel read and write ready callbacks from the
+     * channel's runner instead of from the child's read callback.
+     * The runners may run in any thread calling the os handler's
+     * service function, so channels are handled in parallel.
+     */
+    bool dispatch_runner;
+
     /*
      * Small piece of data for sending new channel responses.  It's
      * separate in case the channel data could not be allocated.  The
@@ -447,9 +578,23 @@ struct mux_data {
     void *acc_open_data;
 
     /*
-     * Channel I am currently sending data on.
+     * Channels with a message set up to send, in the order they go
+     * out.  The first one may be partially sent.
      */
-    struct mux_inst *sending_chan;
+    struct gensio_list sendq;
+
+    /* The protocol version in use, the lower of the two ends. */
+    unsigned int version;
+
+    /* The highest version we will offer or accept. */
+    unsigned int cfg_version;
+
+    /*
+     * The byte count window the remote end gives new channels we
+     * open, from its init message.  Zero if the remote end doesn't
+     * support sending data before the new channel response.
+     */
+    unsigned int early_window;
 
     enum mux_state state;
 
@@ -504,6 +649,55 @@ struct mux_data {
 #endif
 };
 
+/*
+ * Data messages are stored in the read and write buffers as flags
+ * then the data size as sent on the wire, then the data.
+ */
+static unsigned int
+chan_size_len(struct mux_inst *chan)
+{
+    return chan->mux->version >= 2 ? 4 : 2;
+}
+
+static unsigned int
+chan_msg_hdr_len(struct mux_inst *chan)
+{
+    return 1 + chan_size_len(chan);
+}
+
+static gensiods
+chan_get_rdsize(struct mux_inst *chan)
+{
+    unsigned int i, n = chan_size_len(chan);
+    gensiods len = 0;
+
+    for (i = 0; i < n; i++)
+	len = (len << 8) | chan->read_data[chan_next_read_pos(chan, i + 1)];
+    return len;
+}
+
+static void
+chan_put_rdsize(struct mux_inst *chan, gensiods len)
+{
+    unsigned int i, n = chan_size_len(chan);
+
+    for (i = n; i > 0; i--) {
+	chan->read_data[chan_next_read_pos(chan, i)] = len & 0xff;
+	len >>= 8;
+    }
+}
+
+static gensiods
+chan_get_wrsize(struct mux_inst *chan)
+{
+    unsigned int i, n = chan_size_len(chan);
+    gensiods len = 0;
+
+    for (i = 0; i < n; i++)
+	len = (len << 8) | chan->write_data[chan_next_write_pos(chan, i + 1)];
+    return len;
+}
+
 static void
 i_mux_set_state(struct mux_data *mux, enum mux_state state)
 {
@@ -661,6 +855,31 @@ static bool i_mux_deref_and_unlock(struct mux_data *mux)
 #define mux_deref i_mux_deref
 #endif
 
+/*
+ * Read buffers are mirrored when possible so a message that wraps
+ * the end of the ring can still be handed to the user in one piece.
+ */
+static unsigned char *
+chan_rdbuf_alloc(struct gensio_os_funcs *o, gensiods size, bool *mirrored)
+{
+    unsigned char *buf;
+
+    buf = gensio_mirror_buf_alloc(o, size);
+    *mirrored = !!buf;
+    if (!buf)
+	buf = gensio_os_buf_alloc(o, size);
+    return buf;
+}
+
+static void
+chan_rdbuf_free(struct mux_inst *chan)
+{
+    if (chan->read_mirrored)
+	gensio_mirror_buf_free(chan->o, chan->read_data, chan->max_read_size);
+    else
+	gensio_os_buf_free(chan->o, chan->read_data);
+}
+
 static void
 chan_free(struct mux_inst *chan)
 {
@@ -668,10 +887,12 @@ chan_free(struct mux_inst *chan)
 
     if (chan->io)
 	gensio_data_free(chan->io);
-    if (chan->read_data)
-	o->free(o, chan->read_data);
+    if (chan->read_data) {
+	chan->mux->read_mem -= chan->max_read_size;
+	chan_rdbuf_free(chan);
+    }
     if (chan->write_data)
-	o->free(o, chan->write_data);
+	gensio_os_buf_free(o, chan->write_data);
     if (chan->service)
 	o->free(o, chan->service);
     if (chan->deferred_op_runner)
@@ -873,12 +1094,20 @@ mux_send_new_channel_rsp(struct mux_data *muxdata, unsigned int remote_id,
 static void
 mux_send_init(struct mux_data *muxdata)
 {
-    muxdata->xmit_data[0] = (MUX_INIT << 4) | 0x1;
     muxdata->xmit_data[1] = 0;
-    muxdata->xmit_data[2] = 1;
+    muxdata->xmit_data[2] = muxdata->cfg_version;
     muxdata->xmit_data[3] = 0;
     muxdata->xmit_data_pos = 0;
-    muxdata->xmit_data_len = 4;
+    if (muxdata->cfg_version < 4) {
+	/* Send it like an older version would, with no window. */
+	muxdata->xmit_data[0] = (MUX_INIT << 4) | 0x1;
+	muxdata->xmit_data_len = 4;
+	return;
+    }
+    muxdata->xmit_data[0] = (MUX_INIT << 4) | 0x2;
+    /* New channels from the remote end get max_read_size. */
+    gensio_u32_to_buf(&muxdata->xmit_data[4], muxdata->max_read_size);
+    muxdata->xmit_data_len = 8;
 }
 
 /*
@@ -894,8 +1123,9 @@ chan_check_send_more(struct mux_inst *chan)
 	return;
     chan->in_write_ready = true;
 
-    /* Need at least 4 bytes to write a message. */
-    while (chan->max_write_size - chan->write_data_len >= 4 &&
+    /* Need room for a header and a byte to write a message. */
+    while (chan->max_write_size - chan->write_data_len >=
+		chan_msg_hdr_len(chan) + 1 &&
 	   chan->write_ready_enabled && chan->state == MUX_INST_OPEN) {
 	chan_ref(chan);
 	mux_unlock(chan->mux);
@@ -920,15 +1150,82 @@ full_msg_ready(struct mux_inst *chan, gensiods *rlen)
     if (chan->read_data_len == 0)
 	return false;
 
-    assert(chan->read_data_len >= 3);
-    len = chan->read_data[chan_next_read_pos(chan, 1)] << 8;
-    len |= chan->read_data[chan_next_read_pos(chan, 2)];
+    assert(chan->read_data_len >= chan_msg_hdr_len(chan));
+    len = chan_get_rdsize(chan);
     assert(len > 0);
 
     if (rlen)
 	*rlen = len;
 
-    return len + 3 <= chan->read_data_len;
+    return len + chan_msg_hdr_len(chan) <= chan->read_data_len;
+}
+
+/*
+ * The remote end says its data was held back by our receive window.
+ * If the user is keeping up with the data, the window is what limits
+ * the throughput (the link has a lot of data in flight), so double
+ * the read buffer and tell the remote end about the new window.
+ *
+ * Only one decision is made per window of data received so the last
+ * change has time to take effect.  The total read buffer memory of
+ * the mux is limited to max_mem, growth stops when that is reached.
+ * The window is never shrunk again, the remote end may already have
+ * data in flight for it; the memory is returned when the channel is
+ * freed.
+ */
+static void
+chan_autotune(struct mux_inst *chan)
+{
+    struct mux_data *muxdata = chan->mux;
+    struct gensio_os_funcs *o = chan->o;
+    gensiods size, len;
+    unsigned char *buf;
+    bool mirrored;
+
+    if (chan->tune_bytes < chan->max_read_size)
+	return;
+    chan->tune_bytes = 0;
+
+    if (muxdata->version < 3 || chan->state != MUX_INST_OPEN ||
+		chan->max_read_size >= chan->max_readbuf ||
+		chan->read_data_len > chan->max_read_size / 2)
+	return;
+
+    /* The user may be looking at the buffer. */
+    if (chan->in_read_report)
+	return;
+
+    size = chan->max_read_size * 2;
+    if (size > chan->max_readbuf)
+	size = chan->max_readbuf;
+    if (muxdata->read_mem - chan->max_read_size + size > muxdata->max_mem) {
+	/* Memory pressure, only take what is left, if it's worth it. */
+	if (muxdata->read_mem >= muxdata->max_mem)
+	    return;
+	size = chan->max_read_size + muxdata->max_mem - muxdata->read_mem;
+	if (size < chan->max_read_size + chan->max_read_size / 4)
+	    return;
+    }
+
+    buf = chan_rdbuf_alloc(o, size, &mirrored);
+    if (!buf)
+	return;
+
+    /* Copy the ring buffer contents to the start of the new one. */
+    len = chan->max_read_size - chan->read_data_pos;
+    if (len > chan->read_data_len)
+	len = chan->read_data_len;
+    memcpy(buf, chan->read_data + chan->read_data_pos, len);
+    memcpy(buf + len, chan->read_data, chan->read_data_len - len);
+    chan_rdbuf_free(chan);
+    chan->read_data = buf;
+    chan->read_mirrored = mirrored;
+    chan->read_data_pos = 0;
+    muxdata->read_mem += size - chan->max_read_size;
+    chan->max_read_size = size;
+
+    chan->send_window = true;
+    muxc_add_to_wrlist(chan);
 }
 
 /*
@@ -962,7 +1259,7 @@ chan_check_read(struct mux_inst *chan)
 	}
 
 	flags = chan->read_data[chan->read_data_pos];
-	pos = chan_next_read_pos(chan, 3);
+	pos = chan_next_read_pos(chan, chan_msg_hdr_len(chan));
 	to_ack = 0;
 	olen = 0;
 
@@ -977,7 +1274,7 @@ chan_check_read(struct mux_inst *chan)
 	    flstr[i++] = "oob";
 	}
 	flstr[i] = NULL;
-	if (pos + len > chan->max_read_size) {
+	if (pos + len > chan->max_read_size && !chan->read_mirrored) {
 	    /* Buffer wraps, deliver in two parts. */
 	    rcount = chan->max_read_size - pos;
 	    orcount = rcount;
@@ -1022,16 +1319,16 @@ chan_check_read(struct mux_inst *chan)
 	chan->in_read_report = false;
 
 	if (len > 0) {
-	    /* Partial read, create a new 3-byte header over the data left. */
+	    /* Partial read, create a new header over the data left. */
 	    chan->read_data_pos = chan_next_read_pos(chan, olen);
 	    chan->read_data_len -= olen;
 	    chan->read_data[chan->read_data_pos] = flags;
-	    chan->read_data[chan_next_read_pos(chan, 1)] = len >> 8;
-	    chan->read_data[chan_next_read_pos(chan, 2)] = len & 0xff;
+	    chan_put_rdsize(chan, len);
 	} else {
-	    chan->read_data_pos = chan_next_read_pos(chan, olen + 3);
-	    chan->read_data_len -= olen + 3;
-	    to_ack += 3;
+	    chan->read_data_pos = chan_next_read_pos(chan,
+					olen + chan_msg_hdr_len(chan));
+	    chan->read_data_len -= olen + chan_msg_hdr_len(chan);
+	    to_ack += chan_msg_hdr_len(chan);
 	}
 	chan->received_unacked += to_ack;
     }
@@ -1091,6 +1388,8 @@ muxc_add_to_wrlist(struct mux_inst *chan)
 	gensio_list_add_tail(&muxdata->wrchans, &chan->wrlink);
 	chan->wr_ready = true;
 	chan->in_wrlist = true;
+	/* An idle channel doesn't save up credit. */
+	chan->deficit = 0;
 	if (muxdata->state != MUX_CLOSED)
 	    gensio_set_write_callback_enable(muxdata->child, true);
     }
@@ -1103,7 +1402,8 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 {
     struct mux_data *muxdata = chan->mux;
     gensiods rcount, i, tot_len = 0;
-    unsigned char hdr[3];
+    unsigned char hdr[5];
+    unsigned int hdr_len;
     gensiods len;
     bool truncated = false;
 
@@ -1113,13 +1413,22 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 	*count = 0;
 	return 0;
     }
-    tot_len += 3; /* Add the header. */
 
     mux_lock(muxdata);
-    if (chan->state != MUX_INST_OPEN) {
+    if (chan->state == MUX_INST_IN_OPEN && muxdata->state == MUX_OPEN &&
+		muxdata->early_window) {
+	/*
+	 * Data may go after the new channel message, before the
+	 * response, up to the window the remote end gives all new
+	 * channels.
+	 */
+	chan->send_window_size = muxdata->early_window;
+    } else if (chan->state != MUX_INST_OPEN) {
 	mux_unlock(muxdata);
 	return GE_NOTREADY;
     }
+    hdr_len = chan_msg_hdr_len(chan);
+    tot_len += hdr_len; /* Add the header. */
 
     if (chan->errcode) {
 	int err = chan->errcode;
@@ -1149,10 +1458,10 @@ muxc_write(struct mux_inst *chan, gensiods *count,
     }
 
     /*
-     * Just return on buffer full.  We need 3 bytes for the header and at
-     * least a byte of data.
+     * Just return on buffer full.  We need the header and at least a
+     * byte of data.
      */
-    if (chan->max_write_size - chan->write_data_len < 4) {
+    if (chan->max_write_size - chan->write_data_len < hdr_len + 1) {
     out_unlock_nosend:
 	mux_unlock(muxdata);
 	if (count)
@@ -1163,7 +1472,7 @@ muxc_write(struct mux_inst *chan, gensiods *count,
     if (tot_len > chan->max_write_size - chan->write_data_len) {
 	/* Can only send as much as we have buffer for. */
 	tot_len = chan->max_write_size - chan->write_data_len;
-	if (tot_len <= 3)
+	if (tot_len <= hdr_len)
 	    goto out_unlock_nosend;
 	truncated = true;
     }
@@ -1171,11 +1480,17 @@ muxc_write(struct mux_inst *chan, gensiods *count,
     if (tot_len > chan->send_window_size / 2) {
 	/* Only allow sends to 1/2 the window size. */
 	tot_len = chan->send_window_size / 2;
-	if (tot_len <= 3)
+	if (tot_len <= hdr_len)
 	    goto out_unlock_nosend;
 	truncated = true;
     }
 
+    if (muxdata->version < 2 && tot_len > 0xffff + hdr_len) {
+	/* The size is only 16 bits in version 1. */
+	tot_len = 0xffff + hdr_len;
+	truncated = true;
+    }
+
     /* FIXME - consolidate writes if possible. */
 
     /* Construct the header and put it in first. */
@@ -1184,9 +1499,12 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 	hdr[0] |= MUX_FLAG_END_OF_MESSAGE;
     if (gensio_str_in_auxdata(auxdata, "oob"))
 	hdr[0] |= MUX_FLAG_OUT_OF_BOUND;
-    gensio_u16_to_buf(hdr + 1, tot_len - 3);
-    chan_addwrbuf(chan, hdr, 3);
-    tot_len -= 3;
+    if (hdr_len == 5)
+	gensio_u32_to_buf(hdr + 1, tot_len - hdr_len);
+    else
+	gensio_u16_to_buf(hdr + 1, tot_len - hdr_len);
+    chan_addwrbuf(chan, hdr, hdr_len);
+    tot_len -= hdr_len;
 
     rcount = 0;
     for (i = 0; i < sglen && tot_len; i++) {
@@ -1198,7 +1516,9 @@ muxc_write(struct mux_inst *chan, gensiods *count,
 	tot_len -= len;
     }
 
-    muxc_add_to_wrlist(chan);
+    if (!chan->in_open_chan)
+	/* Otherwise it's sent after the new channel message goes. */
+	muxc_add_to_wrlist(chan);
     mux_unlock(muxdata);
 
     if (count)
@@ -1396,10 +1716,15 @@ mux_new_channel(struct mux_data *muxdata, gensio_event cb, void *user_data,
     chan->is_client = is_client;
     chan->max_read_size = muxdata->max_read_size;
     chan->max_write_size = muxdata->max_write_size;
-    chan->read_data = o->zalloc(o, chan->max_read_size);
+    chan->priority = muxdata->priority;
+    chan->weight = muxdata->weight;
+    chan->max_readbuf = muxdata->max_readbuf;
+    chan->read_data = chan_rdbuf_alloc(o, chan->max_read_size,
+				       &chan->read_mirrored);
     if (!chan->read_data)
 	goto out_free;
-    chan->write_data = o->zalloc(o, chan->max_write_size);
+    muxdata->read_mem += chan->max_read_size;
+    chan->write_data = gensio_os_buf_alloc(o, chan->max_write_size);
     if (!chan->write_data)
 	goto out_free;
 
@@ -1483,6 +1808,9 @@ muxc_alloc_channel_data(struct mux_data *muxdata,
 	}
 	chan->service_len = data->service_len;
     }
+    chan->priority = data->priority;
+    chan->weight = data->weight;
+    chan->max_readbuf = data->max_readbuf;
 
     muxc_set_state(chan, MUX_INST_CLOSED);
 
@@ -1513,9 +1841,22 @@ gensio_mux_config(struct gensio_pparm_info *p,
 	    continue;
 	if (gensio_pparm_ds(p, args[i], "writebuf", &data->max_write_size) > 0)
 	    continue;
+	if (gensio_pparm_ds(p, args[i], "max_readbuf",
+			    &data->max_readbuf) > 0) {
+	    if (data->max_readbuf > MUX_MAX_WINDOW) {
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_ds(p, args[i], "max_mem", &data->max_mem) > 0)
+	    continue;
 	if (gensio_pparm_boolv(p, args[i], "mode", "client", "server",
 			       &data->is_client) > 0)
 	    continue;
+	if (gensio_pparm_boolv(p, args[i], "dispatch", "runner", "inline",
+			       &data->dispatch_runner) > 0)
+	    continue;
 	if (gensio_pparm_uint(p, args[i], "max_channels",
 			      &data->max_channels) > 0) {
 	    if (data->max_channels > 65536 || data->max_channels < 1) {
@@ -1524,6 +1865,24 @@ gensio_mux_config(struct gensio_pparm_info *p,
 	    }
 	    continue;
 	}
+	if (gensio_pparm_uint(p, args[i], "priority", &data->priority) > 0)
+	    continue;
+	if (gensio_pparm_uint(p, args[i], "version", &data->version) > 0) {
+	    if (data->version > MUX_PROTO_VERSION || data->version < 1) {
+		gensio_pparm_log(p, "version must be 1 to %d",
+				 MUX_PROTO_VERSION);
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_uint(p, args[i], "weight", &data->weight) > 0) {
+	    if (data->weight > MUX_MAX_WEIGHT || data->weight < 1) {
+		rv = GE_INVAL;
+		goto out_err;
+	    }
+	    continue;
+	}
 	if (gensio_pparm_value(p, args[i], "service", &str) > 0) {
 	    data->service = gensio_strdup(o, str);
 	    if (!data->service)
@@ -1600,7 +1959,12 @@ muxc_alloc_channel(struct mux_data *muxdata,
     memset(&data, 0, sizeof(data));
     data.max_read_size = muxdata->max_read_size;
     data.max_write_size = muxdata->max_write_size;
+    data.max_readbuf = muxdata->max_readbuf;
+    data.max_mem = muxdata->max_mem;
     data.max_channels = muxdata->max_channels;
+    data.version = muxdata->cfg_version;
+    data.priority = muxdata->priority;
+    data.weight = muxdata->weight;
     data.is_client = true;
     err = get_default_mode(muxdata->o, &data.is_client);
     if (err)
@@ -1682,6 +2046,22 @@ muxc_reinit(struct mux_inst *chan)
     chan->close_called = false;
 }
 
+/* Drop any partially sent messages, for a new start of the mux. */
+static void
+mux_clear_sendq(struct mux_data *muxdata)
+{
+    struct gensio_link *l, *l2;
+    struct mux_inst *chan;
+
+    gensio_list_for_each_safe(&muxdata->sendq, l, l2) {
+	chan = gensio_container_of(l, struct mux_inst, sendlink);
+	gensio_list_rm(&muxdata->sendq, &chan->sendlink);
+	chan->in_sendq = false;
+	chan->sgpos = 0;
+	chan->sglen = 0;
+    }
+}
+
 static int
 muxc_open(struct mux_inst *chan, gensio_done_err open_done, void *open_data,
 	  bool do_child)
@@ -1691,13 +2071,14 @@ muxc_open(struct mux_inst *chan, gensio_done_err open_done, void *open_data,
 
     mux_lock(muxdata);
     if (muxdata->state == MUX_CLOSED) {
-	muxdata->sending_chan = NULL;
+	mux_clear_sendq(muxdata);
 	muxdata->in_hdr = true;
 	muxdata->hdr_pos = 0;
 	muxdata->hdr_size = 0;
 	muxdata->exit_err = 0;
 	muxdata->err_shutdown = 0;
 	muxdata->do_normal_close = false;
+	muxdata->early_window = 0;
 	muxc_reinit(chan);
 	if (muxdata->is_client) {
 	    if (!chan->in_open_chan) {
@@ -1810,6 +2191,30 @@ muxc_control(struct mux_inst *chan, bool get, int op,
 	    chan->do_oob = !!strtoul(data, NULL, 0);
 	break;
 
+    case GENSIO_CONTROL_MEM:
+	/* The channel buffers are fixed, so no compaction. */
+	if (!get) {
+	    err = GE_NOTSUP;
+	    goto out;
+	}
+	*datalen = snprintf(data, *datalen, "%lu",
+			    (unsigned long) (sizeof(*chan) + chan->service_len
+					     + (chan->read_data ?
+						chan->max_read_size : 0)
+					     + (chan->write_data ?
+						chan->max_write_size : 0)));
+	break;
+
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get) {
+	    err = GE_NOTSUP;
+	    goto out;
+	}
+	*datalen = snprintf(data, *datalen, "version=%u readbuf=%lu",
+			    muxdata->version,
+			    (unsigned long) chan->max_read_size);
+	break;
+
     default:
 	err = GE_NOTSUP;
 	break;
@@ -1896,6 +2301,10 @@ mux_shutdown_channels(struct mux_data *muxdata, int err)
 	    chan->in_wrlist = false;
 	}
 	chan->wr_ready = false;
+	if (chan->in_sendq) {
+	    gensio_list_rm(&muxdata->sendq, &chan->sendlink);
+	    chan->in_sendq = false;
+	}
 	if (chan->in_open_chan) {
 	    gensio_list_rm(&muxdata->openchans, &chan->wrlink);
 	    chan->in_open_chan = false;
@@ -1968,17 +2377,37 @@ chan_setup_send_new_channel(struct mux_inst *chan)
     chan->cur_msg_len = 0; /* Data isn't in chan->write_data. */
 }
 
+static void
+chan_setup_send_window(struct mux_inst *chan)
+{
+    assert(chan->sglen == 0);
+    chan->hdr[0] = (MUX_WINDOW << 4) | 0x2;
+    chan->hdr[1] = 0;
+    gensio_u16_to_buf(&chan->hdr[2], chan->remote_id);
+    gensio_u32_to_buf(&chan->hdr[4], chan->max_read_size);
+    chan->sg[0].buf = chan->hdr;
+    chan->sg[0].buflen = 8;
+    chan->sglen = 1;
+    chan->cur_msg_len = 0; /* Data isn't in chan->write_data. */
+}
+
 static bool
 chan_setup_send_data(struct mux_inst *chan)
 {
     unsigned char flags = 0;
-    gensiods pos;
     gensiods window_left = chan->send_window_size - chan->sent_unacked;
 
+    bool early = (chan->state == MUX_INST_IN_OPEN ||
+		  chan->state == MUX_INST_IN_OPEN_CLOSE);
+
     assert(chan->sglen == 0);
     chan->hdr[0] = (MUX_DATA << 4) | 0x2;
     chan->hdr[1] = 0;
-    gensio_u16_to_buf(chan->hdr + 2, chan->remote_id);
+    if (early)
+	/* No response yet, so no remote id, see MUX_DATA. */
+	gensio_u16_to_buf(chan->hdr + 2, chan->id);
+    else
+	gensio_u16_to_buf(chan->hdr + 2, chan->remote_id);
     gensio_u32_to_buf(chan->hdr + 4, chan->received_unacked);
 
     chan->sg[0].buf = chan->hdr;
@@ -1990,23 +2419,24 @@ chan_setup_send_data(struct mux_inst *chan)
 	    return false;
 	chan->received_unacked = 0;
 	/* Just sending an ack. */
-	gensio_u16_to_buf(chan->hdr + 8, 0);
-	chan->sg[0].buflen = 10;
+	if (chan_size_len(chan) == 4)
+	    gensio_u32_to_buf(chan->hdr + 8, 0);
+	else
+	    gensio_u16_to_buf(chan->hdr + 8, 0);
+	chan->sg[0].buflen = 8 + chan_size_len(chan);
 	chan->sglen = 1;
 	return true;
     }
-    assert(chan->write_data_len > 3);
+    assert(chan->write_data_len > chan_msg_hdr_len(chan));
 
-    pos = chan_next_write_pos(chan, 1);
-    chan->cur_msg_len = chan->write_data[pos] << 8;
-    pos = chan_next_write_pos(chan, 2);
-    chan->cur_msg_len |= chan->write_data[pos];
+    chan->cur_msg_len = chan_get_wrsize(chan);
     assert(chan->cur_msg_len > 0);
-    chan->cur_msg_len += 2;
+    chan->cur_msg_len += chan_size_len(chan);
 
     /* Make sure to add 1 for the flags */
     if (chan->cur_msg_len + 1 > window_left) {
 	chan->cur_msg_len = 0;
+	chan->window_limited = true;
 	goto check_send_ack;
     }
 
@@ -2015,6 +2445,11 @@ chan_setup_send_data(struct mux_inst *chan)
     flags = chan->write_data[chan->write_data_pos];
     chan_incr_write_pos(chan, 1);
     chan->hdr[1] = flags;
+    if (chan->window_limited && chan->mux->version >= 3)
+	chan->hdr[1] |= MUX_FLAG_WINDOW_LIMITED;
+    if (early)
+	chan->hdr[1] |= MUX_FLAG_EARLY;
+    chan->window_limited = false;
     chan->sent_unacked++; /* Flags is stored as delivered data on remote end. */
 
     if (chan->write_data_pos + chan->cur_msg_len > chan->max_write_size) {
@@ -2047,30 +2482,117 @@ mux_on_err_close(struct gensio *child, void *close_data)
     mux_deref_and_unlock(muxdata); /* Lose the open ref. */
 }
 
+/*
+ * Pick the next channel to write from the wrlist and remove it.  The
+ * highest priority channels go first.  Among those, the first one in
+ * the list with credit left goes, if none have any they all get
+ * another round of credit.
+ *
+ * A channel only has one message in a batch, so every waiting channel
+ * would get into each batch no matter what its priority.  To avoid
+ * that, if use_min_prio is set channels below *min_prio are left for a
+ * later batch.  *min_prio is set to the priority of the returned
+ * channel.  Returns NULL if there is nothing to pick.
+ */
+static struct mux_inst *
+mux_next_wrchan(struct mux_data *muxdata, bool use_min_prio,
+		unsigned int *min_prio)
+{
+    struct gensio_link *l;
+    struct mux_inst *chan, *found = NULL;
+    unsigned int prio = 0;
+    bool first = true;
+
+    gensio_list_for_each(&muxdata->wrchans, l) {
+	chan = gensio_container_of(l, struct mux_inst, wrlink);
+	if (first || chan->priority > prio) {
+	    prio = chan->priority;
+	    first = false;
+	}
+    }
+    if (first || (use_min_prio && prio < *min_prio))
+	return NULL;
+    *min_prio = prio;
+
+    while (!found) {
+	gensio_list_for_each(&muxdata->wrchans, l) {
+	    chan = gensio_container_of(l, struct mux_inst, wrlink);
+	    if (chan->priority == prio && chan->deficit > 0) {
+		found = chan;
+		break;
+	    }
+	}
+	if (found)
+	    break;
+	gensio_list_for_each(&muxdata->wrchans, l) {
+	    chan = gensio_container_of(l, struct mux_inst, wrlink);
+	    if (chan->priority == prio)
+		chan->deficit += chan->weight * MUX_DRR_QUANTUM;
+	}
+    }
+
+    gensio_list_rm(&muxdata->wrchans, &found->wrlink);
+    found->in_wrlist = false;
+    return found;
+}
+
+/* The message being sent on chan is done, take it off the send queue. */
+static void
+chan_msg_sent(struct mux_data *muxdata, struct mux_inst *chan)
+{
+    GENSIO_PROBE3(mux_send, chan->io, chan->id, chan->cur_msg_len);
+    chan->write_data_pos = chan_next_write_pos(chan, chan->cur_msg_len);
+    chan->write_data_len -= chan->cur_msg_len;
+    chan->cur_msg_len = 0;
+    chan->sgpos = 0;
+    chan->sglen = 0;
+    gensio_list_rm(&muxdata->sendq, &chan->sendlink);
+    chan->in_sendq = false;
+    if (chan->write_data_len > 0 || chan->send_new_channel ||
+		chan->send_window || chan->send_close) {
+	/* More messages to send, add it to the tail for fairness. */
+	gensio_list_add_tail(&muxdata->wrchans, &chan->wrlink);
+	chan->in_wrlist = true;
+    } else {
+	chan->wr_ready = false;
+    }
+    /*
+     * Maybe the user can write.  Also, if a close is pending,
+     * handle it there, too.
+     */
+    chan_sched_deferred_op(chan);
+}
+
+/*
+ * Write everything on the send queue to the child in one write.
+ * all_sent is set to false if the child didn't take it all.
+ */
 static int
-mux_child_write_ready(struct mux_data *muxdata)
+mux_write_sendq(struct mux_data *muxdata, bool *all_sent)
 {
-    int err = 0;
+    struct gensio_sg sg[MUX_MAX_BATCH * 3];
+    gensiods sglen = 0, rcount;
+    struct gensio_link *l, *l2;
     struct mux_inst *chan;
-    gensiods rcount;
+    unsigned int i;
+    int err;
 
-    mux_lock_and_ref(muxdata);
-    if (muxdata->state == MUX_IN_CLOSE || muxdata->state == MUX_CLOSED) {
-	gensio_set_read_callback_enable(muxdata->child, false);
-	gensio_set_write_callback_enable(muxdata->child, false);
-	mux_deref_and_unlock(muxdata);
-	return 0;
+    *all_sent = true;
+    gensio_list_for_each(&muxdata->sendq, l) {
+	chan = gensio_container_of(l, struct mux_inst, sendlink);
+	assert(chan->sglen > 0 && chan->sgpos < chan->sglen);
+	for (i = chan->sgpos; i < chan->sglen; i++)
+	    sg[sglen++] = chan->sg[i];
     }
+    if (sglen == 0)
+	return 0;
 
-    /* Finish any pending channel data. */
-    if (muxdata->sending_chan) {
-	chan = muxdata->sending_chan;
-    next_channel:
-	assert(chan->sglen > 0 && chan->sgpos < chan->sglen);
-	err = gensio_write_sg(muxdata->child, &rcount, chan->sg + chan->sgpos,
-			      chan->sglen - chan->sgpos, NULL);
-	if (err)
-	    goto out_write_err;
+    err = gensio_write_sg(muxdata->child, &rcount, sg, sglen, NULL);
+    if (err)
+	return err;
+
+    gensio_list_for_each_safe(&muxdata->sendq, l, l2) {
+	chan = gensio_container_of(l, struct mux_inst, sendlink);
 	while (rcount > 0 && chan->sgpos < chan->sglen) {
 	    if (chan->sg[chan->sgpos].buflen <= rcount) {
 		rcount -= chan->sg[chan->sgpos].buflen;
@@ -2083,103 +2605,133 @@ mux_child_write_ready(struct mux_data *muxdata)
 		rcount = 0;
 	    }
 	}
-	if (chan->sgpos >= chan->sglen) {
-	    /* Finished sending one message. */
-	    chan->write_data_pos = chan_next_write_pos(chan, chan->cur_msg_len);
-	    chan->write_data_len -= chan->cur_msg_len;
-	    chan->cur_msg_len = 0;
-	    chan->sgpos = 0;
-	    chan->sglen = 0;
-	    muxdata->sending_chan = NULL;
-	    if (chan->write_data_len > 0 || chan->send_new_channel ||
-			chan->send_close) {
-		/* More messages to send, add it to the tail for fairness. */
-		gensio_list_add_tail(&muxdata->wrchans, &chan->wrlink);
-		chan->in_wrlist = true;
-	    } else {
-		chan->wr_ready = false;
-	    }
-	    /*
-	     * Maybe the user can write.  Also, if a close is pending,
-	     * handle it there, too.
-	     */
-	    chan_sched_deferred_op(chan);
-	} else {
+	if (chan->sgpos < chan->sglen) {
 	    /* Couldn't send all the data. */
-	    goto out;
+	    *all_sent = false;
+	    break;
 	}
+	chan_msg_sent(muxdata, chan);
     }
+    return 0;
+}
 
-    /* Handle data not associated with an existing channel. */
-    if (muxdata->xmit_data_len) {
-	struct gensio_sg sg[1];
+/*
+ * Set up the next message from chan and add it to the send queue.
+ * Returns false if chan had nothing to send.
+ */
+static bool
+chan_queue_msg(struct mux_data *muxdata, struct mux_inst *chan)
+{
+    unsigned int i;
 
-	sg[0].buf = muxdata->xmit_data + muxdata->xmit_data_pos;
-	sg[0].buflen = muxdata->xmit_data_len;
-	err = gensio_write_sg(muxdata->child, &rcount, sg, 1, NULL);
+    if (chan->send_new_channel) {
+	chan_setup_send_new_channel(chan);
+	chan->send_new_channel = false;
+    } else if (chan->send_window && !chan->close_sent) {
+	/* Window updates go ahead of data so the remote can use it. */
+	chan_setup_send_window(chan);
+	chan->send_window = false;
+    } else if ((chan->write_data_len || chan->received_unacked) &&
+	       !chan->close_sent) {
+	/*
+	 * Send a data packet, either for data delivery or an ack.
+	 * Once we send a close, we cannot send any more data,
+	 * thus the check in the if statement above.
+	 */
+	if (!chan_setup_send_data(chan))
+	    return false;
+    } else if (chan->send_close &&
+	       (chan->read_data_len == 0 ||
+		chan->state == MUX_INST_IN_CLOSE ||
+		chan->state == MUX_INST_IN_CLOSE_FINAL)) {
+	/*
+	 * Do the close last so all data is sent.  The state
+	 * checks above are there because we want to delay the
+	 * send close if we are in MUX_INST_IN_REM_CLOSE to
+	 * deliver all the data the remote end sent before
+	 * reporting the close, but if our end requested the
+	 * close, send it after all local data has been sent.
+	 */
+	chan_send_close(chan);
+	chan->send_close = false;
+	chan->close_sent = true;
+    } else {
+	return false;
+    }
+
+    for (i = 0; i < chan->sglen; i++)
+	chan->deficit -= chan->sg[i].buflen;
+    gensio_list_add_tail(&muxdata->sendq, &chan->sendlink);
+    chan->in_sendq = true;
+    return true;
+}
+
+static int
+mux_child_write_ready(struct mux_data *muxdata)
+{
+    int err = 0;
+    struct mux_inst *chan;
+    gensiods rcount;
+    unsigned int nr, prio = 0;
+    bool all_sent;
+
+    mux_lock_and_ref(muxdata);
+    if (muxdata->state == MUX_IN_CLOSE || muxdata->state == MUX_CLOSED) {
+	gensio_set_read_callback_enable(muxdata->child, false);
+	gensio_set_write_callback_enable(muxdata->child, false);
+	mux_deref_and_unlock(muxdata);
+	return 0;
+    }
+
+    for (;;) {
+	/* Finish any pending channel data. */
+	err = mux_write_sendq(muxdata, &all_sent);
 	if (err)
 	    goto out_write_err;
-	if (rcount >= muxdata->xmit_data_len) {
-	    muxdata->xmit_data_len = 0;
-	    muxdata->xmit_data_pos = 0;
-	} else {
-	    /* Partial write, can't write anything else. */
-	    muxdata->xmit_data_len -= rcount;
-	    muxdata->xmit_data_pos += rcount;
+	if (!all_sent)
 	    goto out;
+
+	/* Handle data not associated with an existing channel. */
+	if (muxdata->xmit_data_len) {
+	    struct gensio_sg sg[1];
+
+	    sg[0].buf = muxdata->xmit_data + muxdata->xmit_data_pos;
+	    sg[0].buflen = muxdata->xmit_data_len;
+	    err = gensio_write_sg(muxdata->child, &rcount, sg, 1, NULL);
+	    if (err)
+		goto out_write_err;
+	    if (rcount >= muxdata->xmit_data_len) {
+		muxdata->xmit_data_len = 0;
+		muxdata->xmit_data_pos = 0;
+	    } else {
+		/* Partial write, can't write anything else. */
+		muxdata->xmit_data_len -= rcount;
+		muxdata->xmit_data_pos += rcount;
+		goto out;
+	    }
 	}
-    }
 
-    /* Now look for a new channel to send. */
- check_next_channel:
-    if (!gensio_list_empty(&muxdata->wrchans)) {
-	assert(muxdata->sending_chan == NULL);
-	chan = gensio_container_of(gensio_list_first(&muxdata->wrchans),
-				   struct mux_inst, wrlink);
-	gensio_list_rm(&muxdata->wrchans, &chan->wrlink);
-	chan->in_wrlist = false;
-
-	if (chan->send_new_channel) {
-	    chan_setup_send_new_channel(chan);
-	    chan->send_new_channel = false;
-	    muxdata->sending_chan = chan;
-	} else if ((chan->write_data_len || chan->received_unacked) &&
-		   !chan->close_sent) {
-	    /*
-	     * Send a data packet, either for data delivery or an ack.
-	     * Once we send a close, we cannot send any more data,
-	     * thus the check in the if statement above.
-	     */
-	    if (!chan_setup_send_data(chan)) {
+	/*
+	 * Now set up messages from the channels waiting to send and
+	 * write them all together.
+	 */
+	nr = 0;
+	while (nr < MUX_MAX_BATCH) {
+	    chan = mux_next_wrchan(muxdata, nr > 0, &prio);
+	    if (!chan)
+		break;
+	    if (chan_queue_msg(muxdata, chan))
+		nr++;
+	    else
 		chan->wr_ready = false;
-		goto check_next_channel;
-	    }
-	    muxdata->sending_chan = chan;
-	} else if (chan->send_close &&
-		   (chan->read_data_len == 0 ||
-		    chan->state == MUX_INST_IN_CLOSE ||
-		    chan->state == MUX_INST_IN_CLOSE_FINAL)) {
-	    /*
-	     * Do the close last so all data is sent.  The state
-	     * checks above are there because we want to delay the
-	     * send close if we are in MUX_INST_IN_REM_CLOSE to
-	     * deliver all the data the remote end sent before
-	     * reporting the close, but if our end requested the
-	     * close, send it after all local data has been sent.
-	     */
-	    chan_send_close(chan);
-	    chan->send_close = false;
-	    chan->close_sent = true;
-	    muxdata->sending_chan = chan;
-	} else {
-	    chan->wr_ready = false;
-	    goto check_next_channel;
 	}
-	goto next_channel;
+	if (nr == 0)
+	    break;
     }
  out:
     gensio_set_write_callback_enable(muxdata->child,
-		muxdata->sending_chan || !gensio_list_empty(&muxdata->wrchans));
+				     !gensio_list_empty(&muxdata->sendq) ||
+				     !gensio_list_empty(&muxdata->wrchans));
     mux_deref_and_unlock(muxdata);
     return 0;
 
@@ -2211,6 +2763,28 @@ mux_get_channel(struct mux_data *muxdata)
     return NULL;
 }
 
+/*
+ * Find the channel for data sent before the new channel response,
+ * the id in the header is the remote end's id.  Channels that are
+ * closing aren't returned, the data for them is dropped.
+ */
+static struct mux_inst *
+mux_get_early_channel(struct mux_data *muxdata)
+{
+    struct gensio_link *l;
+    unsigned int id = gensio_buf_to_u16(muxdata->hdr + 2);
+
+    gensio_list_for_each(&muxdata->chans, l) {
+	struct mux_inst *chan = gensio_container_of(l, struct mux_inst, link);
+
+	if (chan->remote_id == id &&
+		(chan->state == MUX_INST_OPEN ||
+		 chan->state == MUX_INST_IN_CLOSE))
+	    return chan;
+    }
+    return NULL;
+}
+
 static bool
 mux_find_remote_id(struct mux_data *muxdata, unsigned int id)
 {
@@ -2235,6 +2809,7 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 	       const char *const *nauxdata)
 {
     gensiods processed = 0, used, acked, buflen;
+    unsigned int i, size_len, window;
     int err = 0;
     struct mux_inst *chan;
     const char *auxdata[2] = { NULL, NULL };
@@ -2302,6 +2877,16 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		    proto_err_str = "Init when already initialized";
 		    goto protocol_err;
 		}
+		muxdata->version = muxdata->hdr[2];
+		if (muxdata->version > muxdata->cfg_version)
+		    muxdata->version = muxdata->cfg_version;
+		else if (muxdata->version < 1)
+		    muxdata->version = 1;
+		if (muxdata->version >= 4 && muxdata->hdr_size >= 8) {
+		    window = gensio_buf_to_u32(muxdata->hdr + 4);
+		    if (window > MUX_MIN_SEND_WINDOW_SIZE)
+			muxdata->early_window = window;
+		}
 		if (gensio_list_empty(&muxdata->openchans)) {
 		    mux_set_state(muxdata, MUX_WAITING_OPEN);
 		    goto more_data;
@@ -2382,7 +2967,6 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		    goto protocol_err;
 		}
 		chan->errcode = gensio_buf_to_u16(muxdata->hdr + 10);
-		muxdata->sending_chan = NULL;
 
 		assert(muxdata->opencount > 0);
 		muxdata->opencount--;
@@ -2390,6 +2974,8 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		if (chan->errcode) {
 		    enum mux_inst_state old_state = chan->state;
 
+		    /* Drop data written early, except a message going out. */
+		    chan->write_data_len = chan->cur_msg_len;
 		    muxc_set_state(chan, MUX_INST_CLOSED);
 		    mux_call_open_done(muxdata, chan, chan->errcode);
 		    if (old_state == MUX_INST_IN_OPEN_CLOSE)
@@ -2458,6 +3044,17 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		break;
 
 	    case MUX_DATA:
+		if (muxdata->version >= 4 &&
+			muxdata->hdr[1] & MUX_FLAG_EARLY) {
+		    chan = mux_get_early_channel(muxdata);
+		    muxdata->curr_chan = chan;
+		    muxdata->data_pos = 0;
+		    muxdata->in_hdr = false;
+		    if (!chan)
+			/* The channel was refused or closed, drop it. */
+			break;
+		    goto early_data;
+		}
 		chan = mux_get_channel(muxdata);
 		if (!chan) {
 		    proto_err_str = "No channel on data";
@@ -2471,12 +3068,15 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		    proto_err_str = "Invalid channel state on data";
 		    goto protocol_err;
 		}
+	    early_data:
 		acked = gensio_buf_to_u32(muxdata->hdr + 4);
 		if (acked > chan->sent_unacked) {
 		    proto_err_str = "acked > chan->sent_unacked";
 		    goto protocol_err;
 		}
 		chan->sent_unacked -= acked;
+		GENSIO_PROBE4(mux_ack, chan->io, chan->id, acked,
+			      chan->sent_unacked);
 		if (acked > 0 && chan->write_data_len)
 		    muxc_add_to_wrlist(chan);
 		muxdata->curr_chan = chan;
@@ -2484,6 +3084,30 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		muxdata->in_hdr = false; /* Receive the data */
 		break;
 
+	    case MUX_WINDOW:
+		chan = mux_get_channel(muxdata);
+		if (!chan) {
+		    proto_err_str = "No channel on window update";
+		    goto protocol_err;
+		}
+		if (chan->state == MUX_INST_CLOSED ||
+			chan->state == MUX_INST_IN_OPEN ||
+			chan->state == MUX_INST_IN_OPEN_CLOSE ||
+			chan->state == MUX_INST_IN_CLOSE_FINAL ||
+			chan->state == MUX_INST_IN_REM_CLOSE) {
+		    proto_err_str = "Invalid channel state on window update";
+		    goto protocol_err;
+		}
+		window = gensio_buf_to_u32(muxdata->hdr + 4);
+		if (window <= MUX_MIN_SEND_WINDOW_SIZE) {
+		    proto_err_str = "Invalid send window size";
+		    goto protocol_err;
+		}
+		chan->send_window_size = window;
+		if (chan->write_data_len)
+		    muxc_add_to_wrlist(chan);
+		break;
+
 	    default:
 		abort();
 	    }
@@ -2495,17 +3119,23 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 	} else {
 	    /*
 	     * We are receiving data from the remote end, either service
-	     * or payload.  The first two bytes is always the data length.
+	     * or payload.  The first two bytes is always the data length,
+	     * or four for data in version 2.
 	     */
-	    if (muxdata->data_pos == 0) {
-		muxdata->data_size = *buf << 8;
+	    size_len = 2;
+	    if (muxdata->msgid == MUX_DATA && muxdata->version >= 2)
+		size_len = 4;
+	    if (muxdata->data_pos == 0)
+		muxdata->data_size = 0;
+	    if (muxdata->data_pos < size_len - 1) {
+		muxdata->data_size = (muxdata->data_size << 8) | *buf;
 		muxdata->data_pos++;
 		used = 1;
 		goto more_data;
 	    }
 	    chan = muxdata->curr_chan;
-	    if (muxdata->data_pos == 1) {
-		muxdata->data_size |= *buf;
+	    if (muxdata->data_pos == size_len - 1) {
+		muxdata->data_size = (muxdata->data_size << 8) | *buf;
 		muxdata->data_pos++;
 		used = 1;
 		switch (muxdata->msgid) {
@@ -2526,17 +3156,30 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		    break;
 
 		case MUX_DATA:
-		    assert(chan);
+		    if (!chan) {
+			/* Dropping early data, see MUX_DATA. */
+			if (muxdata->data_size == 0)
+			    muxdata->in_hdr = true;
+			break;
+		    }
 		    if (muxdata->data_size == 0)
 			goto handle_read_no_data;
-		    if (chan_rdbufleft(chan) < muxdata->data_size + 3) {
+		    chan->tune_bytes += muxdata->data_size + 1 + size_len;
+		    if (muxdata->hdr[1] & MUX_FLAG_WINDOW_LIMITED)
+			chan_autotune(chan);
+		    if (chan_rdbufleft(chan) <
+			    (gensiods) muxdata->data_size + 1 + size_len) {
 			proto_err_str = "Too much data from remote end";
 			goto protocol_err;
 		    }
 		    /* Add the message flags first. */
-		    chan_addrdbyte(chan, muxdata->hdr[1]);
-		    chan_addrdbyte(chan, muxdata->data_size >> 8);
-		    chan_addrdbyte(chan, muxdata->data_size & 0xff);
+		    chan_addrdbyte(chan,
+				   muxdata->hdr[1] & ~(MUX_FLAG_WINDOW_LIMITED |
+						       MUX_FLAG_EARLY));
+		    for (i = size_len; i > 0; i--)
+			chan_addrdbyte(chan,
+				       (muxdata->data_size >> ((i - 1) * 8)) &
+				       0xff);
 		    break;
 
 		default:
@@ -2645,23 +3288,36 @@ mux_child_read(struct mux_data *muxdata, int ierr,
 		goto more_data;
 
 	    case MUX_DATA:
-		assert(chan);
-		if (buflen + muxdata->data_pos < muxdata->data_size + 2) {
+		if (buflen + muxdata->data_pos <
+			(gensiods) muxdata->data_size + size_len) {
 		    /* Not all data received yet. */
-		    chan_addrdbuf(chan, buf, buflen);
+		    if (chan)
+			chan_addrdbuf(chan, buf, buflen);
 		    muxdata->data_pos += buflen;
 		    processed += buflen;
 		    goto out_unlock;
 		}
-		used = muxdata->data_size + 2 - muxdata->data_pos;
+		used = muxdata->data_size + size_len - muxdata->data_pos;
+		if (!chan) {
+		    muxdata->in_hdr = true;
+		    goto more_data;
+		}
 		chan_addrdbuf(chan, buf, used);
 
 	    handle_read_no_data:
-		chan_ref(chan);
-		chan_check_send_more(chan);
-		if (muxdata->data_size)
-		    chan_check_read(chan);
-		chan_deref(chan);
+		if (muxdata->dispatch_runner) {
+		    /*
+		     * Let the channel's runner deliver it, so a slow
+		     * channel doesn't hold up reading for the others.
+		     */
+		    chan_sched_deferred_op(chan);
+		} else {
+		    chan_ref(chan);
+		    chan_check_send_more(chan);
+		    if (muxdata->data_size)
+			chan_check_read(chan);
+		    chan_deref(chan);
+		}
 		muxdata->in_hdr = true;
 		goto more_data;
 
@@ -2748,14 +3404,22 @@ mux_gensio_alloc_data(struct gensio *child, struct gensio_mux_config *data,
     muxdata->o = o;
     muxdata->refcount = 1;
     muxdata->is_client = data->is_client;
+    muxdata->dispatch_runner = data->dispatch_runner;
     muxdata->child = child;
     muxdata->in_hdr = true;
     muxdata->max_write_size = data->max_write_size;
     muxdata->max_read_size = data->max_read_size;
+    muxdata->max_readbuf = data->max_readbuf;
+    muxdata->max_mem = data->max_mem;
     muxdata->max_channels = data->max_channels;
+    muxdata->priority = data->priority;
+    muxdata->weight = data->weight;
     gensio_list_init(&muxdata->chans);
     gensio_list_init(&muxdata->openchans);
     gensio_list_init(&muxdata->wrchans);
+    gensio_list_init(&muxdata->sendq);
+    muxdata->version = 1;
+    muxdata->cfg_version = data->version;
     muxdata->lock = o->alloc_lock(o);
     if (!muxdata->lock)
 	goto out_nomem;
@@ -2805,7 +3469,10 @@ mux_gensio_alloc(struct gensio *child, const char *const args[],
     memset(&data, 0, sizeof(data));
     data.max_read_size = GENSIO_DEFAULT_BUF_SIZE * 16;
     data.max_write_size = GENSIO_DEFAULT_BUF_SIZE * 2;
+    data.max_mem = MUX_DEFAULT_MAX_MEM;
     data.max_channels = 1000;
+    data.weight = 1;
+    data.version = MUX_PROTO_VERSION;
     err = gensio_get_default(o, "mux", "max-channels", false,
 			     GENSIO_DEFAULT_INT, NULL, &ival);
     if (err)
@@ -2952,7 +3619,10 @@ mux_gensio_accepter_alloc(struct gensio_accepter *child,
 
     nadata->data.max_read_size = GENSIO_DEFAULT_BUF_SIZE;
     nadata->data.max_write_size = GENSIO_DEFAULT_BUF_SIZE;
+    nadata->data.max_mem = MUX_DEFAULT_MAX_MEM;
     nadata->data.max_channels = 1000;
+    nadata->data.weight = 1;
+    nadata->data.version = MUX_PROTO_VERSION;
     err = gensio_get_default(o, "mux", "max-channels", false,
 			     GENSIO_DEFAULT_INT, NULL, &ival);
     if (err) {
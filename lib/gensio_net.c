@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 #if HAVE_UNIX
@@ -31,6 +32,7 @@
 #include <gensio/gensio_ll_fd.h>
 #include <gensio/argvutils.h>
 #include <gensio/gensio_osops.h>
+#include <gensio/gensio_list.h>
 
 #include "gensio_net.h"
 
@@ -44,12 +46,106 @@ struct net_data {
 
     bool nodelay;
 
+    /* Use TCP fast open on connect. */
+    bool fastopen;
+
+    /*
+     * If not zero, TCP_NOTSENT_LOWAT is set to this so the socket
+     * only reports writable when less than this much is unsent.
+     */
+    unsigned int notsent_lowat;
+
     bool istcp;
 
     int last_err;
 
+    /* Deliver receive timestamps in the read auxdata. */
+    bool timestamps;
+    char ts_sw[40];
+    char ts_hw[40];
+    const char *ts_auxdata[3];
+
     bool do_oob;
     int oob_char;
+
+    /*
+     * For async-resolve, the address string is looked up in a thread
+     * at each open so the open doesn't block on DNS.
+     */
+    char *resolve_str;
+    struct gensio_lock *resolve_lock;
+    struct gensio_runner *resolve_runner;
+    struct gensio_thread *resolve_thread;
+    unsigned int resolve_waiters;
+    bool resolve_done;
+    int resolve_err;
+    struct gensio_addr *resolve_ai;
+
+    /*
+     * For happy-eyeballs, connects to the addresses are started
+     * attempt_delay apart, alternating address families, and the
+     * first one to connect wins (RFC 8305).  The race runs with its
+     * own handlers on the sockets, the fd ll waits for it.
+     */
+    bool happy_eyeballs;
+    gensio_time attempt_delay;
+    struct gensio_lock *he_lock;
+    struct gensio_timer *he_timer;
+    struct gensio_list he_attempts;
+    unsigned int *he_order; /* Address indexes in the order to try. */
+    unsigned int he_norder;
+    unsigned int he_next; /* Next entry in he_order to try. */
+    unsigned int he_nactive; /* Attempts still trying to connect. */
+    unsigned int he_pending; /* Attempts not yet cleared, plus the timer. */
+    bool he_timer_running;
+    bool he_running; /* No winner or final failure yet. */
+    unsigned int he_waiters; /* Opens waiting on the race to finish. */
+    bool he_done; /* Result is in he_iod or he_err. */
+    struct gensio_iod *he_iod;
+    unsigned int he_idx;
+    int he_err;
+
+    /*
+     * For coalesce, writes smaller than co_size are collected in
+     * co_buf and sent together when it fills or co_time after the
+     * first one went in.  Send errors are sticky and are returned on
+     * the next write.
+     */
+    gensiods co_size;
+    gensio_time co_time;
+    unsigned char *co_buf;
+    gensiods co_len;
+    struct gensio_lock *co_lock;
+    struct gensio_timer *co_timer;
+    bool co_timer_running;
+    struct gensio_iod *co_iod;
+    int co_err;
+
+    /*
+     * For zerocopy, writes with "zerocopy" auxdata are sent with
+     * MSG_ZEROCOPY and the user's data stays in use until the kernel
+     * says it is done.  zc_start holds the stream offset each of
+     * those sends started at, by send number.  Everything before the
+     * oldest one not done, or everything written if none are left,
+     * is free.  zc_on is set if the socket can do it, otherwise the
+     * data is just copied.
+     */
+    bool zerocopy;
+    bool zc_on;
+    struct gensio_lock *zc_lock;
+    uint64_t *zc_start;
+    uint64_t zc_written;
+    uint32_t zc_next;
+    uint32_t zc_done;
+};
+
+struct net_attempt {
+    struct gensio_link link;
+    struct net_data *tdata;
+    struct gensio_iod *iod;
+    unsigned int idx; /* Index of the address in tdata->ai. */
+    bool clearing;
+    bool connected;
 };
 
 static int net_check_open(void *handler_data, struct gensio_iod *iod)
@@ -61,13 +157,9 @@ static int net_check_open(void *handler_data, struct gensio_iod *iod)
     return tdata->last_err;
 }
 
-static int
-net_try_open(struct net_data *tdata, struct gensio_iod **iod)
+static unsigned int
+net_sock_setup(struct net_data *tdata)
 {
-    struct gensio_iod *new_iod = NULL;
-    int err = GE_INUSE;
-    int protocol = tdata->istcp ? GENSIO_NET_PROTOCOL_TCP
-				: GENSIO_NET_PROTOCOL_UNIX;
     unsigned int setup = (GENSIO_SET_OPENSOCK_REUSEADDR |
 			  GENSIO_OPENSOCK_REUSEADDR |
 			  GENSIO_SET_OPENSOCK_KEEPALIVE |
@@ -77,6 +169,63 @@ net_try_open(struct net_data *tdata, struct gensio_iod **iod)
 	setup |= GENSIO_OPENSOCK_KEEPALIVE;
     if (tdata->nodelay)
 	setup |= GENSIO_OPENSOCK_NODELAY;
+    if (tdata->fastopen)
+	setup |= GENSIO_SET_OPENSOCK_FASTOPEN | GENSIO_OPENSOCK_FASTOPEN;
+    return setup;
+}
+
+static int
+net_sock_timestamps(struct net_data *tdata, struct gensio_iod *iod)
+{
+    unsigned int val = 1;
+    gensiods size = sizeof(val);
+
+    if (!tdata->timestamps)
+	return 0;
+    return tdata->o->sock_control(iod, GENSIO_SOCKCTL_SET_TIMESTAMPS,
+				  &val, &size);
+}
+
+static int
+net_sock_notsent_lowat(struct net_data *tdata, struct gensio_iod *iod)
+{
+    gensiods size = sizeof(tdata->notsent_lowat);
+
+    if (!tdata->notsent_lowat)
+	return 0;
+    return tdata->o->sock_control(iod, GENSIO_SOCKCTL_SET_NOTSENT_LOWAT,
+				  &tdata->notsent_lowat, &size);
+}
+
+static int
+net_sock_zerocopy(struct net_data *tdata, struct gensio_iod *iod)
+{
+    unsigned int val = 1;
+    gensiods size = sizeof(val);
+
+    if (!tdata->zerocopy)
+	return 0;
+
+    /* Send numbers start over with each socket. */
+    tdata->zc_written = 0;
+    tdata->zc_next = 0;
+    tdata->zc_done = 0;
+
+    /* If the socket can't do it, the data is just copied. */
+    tdata->zc_on = tdata->o->sock_control(iod, GENSIO_SOCKCTL_SET_ZEROCOPY,
+					  &val, &size) == 0;
+    return 0;
+}
+
+static int
+net_try_open(struct net_data *tdata, struct gensio_iod **iod)
+{
+    struct gensio_iod *new_iod = NULL;
+    int err = GE_INUSE;
+    int protocol = tdata->istcp ? GENSIO_NET_PROTOCOL_TCP
+				: GENSIO_NET_PROTOCOL_UNIX;
+    unsigned int setup = net_sock_setup(tdata);
+
  retry:
     err = tdata->o->socket_open(tdata->o, tdata->ai, protocol, &new_iod);
     if (err)
@@ -86,54 +235,811 @@ net_try_open(struct net_data *tdata, struct gensio_iod **iod)
     if (err)
 	goto out;
 
-    err = tdata->o->connect(new_iod, tdata->ai);
-    if (err == GE_INPROGRESS) {
-	*iod = new_iod;
-	goto out_return;
-    }
+    err = net_sock_timestamps(tdata, new_iod);
+    if (!err)
+	err = net_sock_notsent_lowat(tdata, new_iod);
+    if (!err)
+	err = net_sock_zerocopy(tdata, new_iod);
+    if (err)
+	goto out;
+
+    err = tdata->o->connect(new_iod, tdata->ai);
+    if (err == GE_INPROGRESS) {
+	*iod = new_iod;
+	goto out_return;
+    }
+
+    /*
+     * The GE_NOMEM check is strange here, but it really has more to
+     * do with testing.  connect() is not going to return GE_NOMEM
+     * unless it's an error trigger failure, and we really want to
+     * fail in that case or we will get a "error triggered but no
+     * failure" in the test.
+     */
+    if (err && err != GE_NOMEM) {
+	if (gensio_addr_next(tdata->ai)) {
+	    tdata->o->close(&new_iod);
+	    goto retry;
+	}
+    }
+ out:
+    if (err) {
+	if (new_iod)
+	    tdata->o->close(&new_iod);
+    } else {
+	*iod = new_iod;
+    }
+
+ out_return:
+    return err;
+}
+
+static int
+net_retry_open(void *handler_data, struct gensio_iod **iod)
+{
+    struct net_data *tdata = handler_data;
+
+    if (!gensio_addr_next(tdata->ai))
+	return tdata->last_err;
+    return net_try_open(tdata, iod);
+}
+
+static void
+net_resolve_thread(void *data)
+{
+    struct net_data *tdata = data;
+    struct gensio_addr *ai = NULL;
+    int err;
+
+    err = gensio_os_scan_netaddr(tdata->o, tdata->resolve_str, false,
+				 GENSIO_NET_PROTOCOL_TCP, &ai);
+    tdata->o->lock(tdata->resolve_lock);
+    tdata->resolve_err = err;
+    tdata->resolve_ai = ai;
+    tdata->resolve_done = true;
+    tdata->o->unlock(tdata->resolve_lock);
+    tdata->o->run(tdata->resolve_runner);
+}
+
+static void
+net_resolve_done(struct gensio_runner *runner, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+    struct gensio_ll *ll = tdata->ll;
+    unsigned int waiters;
+
+    gensio_os_wait_thread(tdata->resolve_thread);
+    tdata->o->lock(tdata->resolve_lock);
+    tdata->resolve_thread = NULL;
+    waiters = tdata->resolve_waiters;
+    tdata->resolve_waiters = 0;
+    tdata->o->unlock(tdata->resolve_lock);
+
+    /* The last of these may free tdata, don't touch it after this. */
+    while (waiters--)
+	gensio_fd_ll_open_continue(ll);
+}
+
+/*
+ * Get the address to connect to for async-resolve.  Returns
+ * GE_INPROGRESS if a lookup is running, net_resolve_done() will
+ * continue the open when it finishes.
+ */
+static int
+net_resolve(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    struct gensio_addr *ai;
+    int err;
+
+    o->lock(tdata->resolve_lock);
+    if (tdata->resolve_thread) {
+	tdata->resolve_waiters++;
+	err = GE_INPROGRESS;
+    } else if (tdata->resolve_done) {
+	tdata->resolve_done = false;
+	err = tdata->resolve_err;
+	if (!err) {
+	    if (tdata->ai)
+		gensio_addr_free(tdata->ai);
+	    tdata->ai = tdata->resolve_ai;
+	}
+	tdata->resolve_ai = NULL;
+    } else {
+	/*
+	 * The lookup thread finishes with a runner, which needs the
+	 * os handler to be able to wake a selector thread from
+	 * another thread.  Without a wake signal it can't.
+	 */
+	if (o->get_wake_sig && o->get_wake_sig(o) == 0)
+	    err = GE_NOTSUP;
+	else
+	    err = gensio_os_new_thread(o, net_resolve_thread, tdata,
+				       &tdata->resolve_thread);
+	if (!err) {
+	    tdata->resolve_waiters++;
+	    err = GE_INPROGRESS;
+	} else if (err == GE_NOTSUP) {
+	    /* Can't use a thread, just do it here. */
+	    err = gensio_os_scan_netaddr(o, tdata->resolve_str, false,
+					 GENSIO_NET_PROTOCOL_TCP, &ai);
+	    if (!err) {
+		if (tdata->ai)
+		    gensio_addr_free(tdata->ai);
+		tdata->ai = ai;
+	    }
+	}
+    }
+    o->unlock(tdata->resolve_lock);
+
+    return err;
+}
+
+/* Point the iterator in addr at the idx'th address. */
+static void
+net_addr_seek(struct gensio_addr *addr, unsigned int idx)
+{
+    gensio_addr_rewind(addr);
+    while (idx--)
+	gensio_addr_next(addr);
+}
+
+/*
+ * Figure out the order to try the addresses in.  Keep the resolver's
+ * order within a family, but alternate families starting with the
+ * first address's family.
+ */
+static int
+net_he_setup_order(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    unsigned int n = 0, i, j, k, first_family;
+    unsigned int *order = NULL;
+    int *families;
+
+    gensio_addr_rewind(tdata->ai);
+    do {
+	n++;
+    } while (gensio_addr_next(tdata->ai));
+
+    if (n < 2)
+	goto out;
+
+    families = o->zalloc(o, sizeof(int) * n);
+    if (!families)
+	return GE_NOMEM;
+    order = o->zalloc(o, sizeof(unsigned int) * n);
+    if (!order) {
+	o->free(o, families);
+	return GE_NOMEM;
+    }
+
+    gensio_addr_rewind(tdata->ai);
+    for (i = 0; i < n; i++) {
+	families[i] = gensio_addr_get_nettype(tdata->ai);
+	gensio_addr_next(tdata->ai);
+    }
+    first_family = families[0];
+
+    /* j walks the first family, k walks the others. */
+    for (i = 0, j = 0, k = 0; i < n; i++) {
+	bool want_first = (i % 2) == 0;
+
+	while (j < n && families[j] != first_family)
+	    j++;
+	while (k < n && families[k] == first_family)
+	    k++;
+	if ((want_first && j < n) || k >= n)
+	    order[i] = j++;
+	else
+	    order[i] = k++;
+    }
+    o->free(o, families);
+
+ out:
+    if (tdata->he_order)
+	o->free(o, tdata->he_order);
+    tdata->he_order = order;
+    tdata->he_norder = order ? n : 0;
+    return 0;
+}
+
+static void net_he_write_ready(struct gensio_iod *iod, void *cb_data);
+static void net_he_cleared(struct gensio_iod *iod, void *cb_data);
+
+/*
+ * Stop the race, clearing the handlers on everything still running.
+ * Must be called with he_lock held.
+ */
+static void
+net_he_finish(struct net_data *tdata, int err)
+{
+    struct gensio_link *l;
+
+    tdata->he_running = false;
+    tdata->he_done = true;
+    if (err)
+	tdata->he_err = err;
+    if (tdata->he_timer_running &&
+		tdata->o->stop_timer(tdata->he_timer) == 0) {
+	tdata->he_timer_running = false;
+	tdata->he_pending--;
+    }
+    gensio_list_for_each(&tdata->he_attempts, l) {
+	struct net_attempt *a = gensio_container_of(l, struct net_attempt,
+						    link);
+
+	if (!a->clearing) {
+	    a->clearing = true;
+	    tdata->he_nactive--;
+	    tdata->o->clear_fd_handlers(a->iod);
+	}
+    }
+}
+
+/*
+ * Start connecting to the next address that will take it.  Must be
+ * called with he_lock held.
+ */
+static void
+net_he_start_next(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    int protocol = tdata->istcp ? GENSIO_NET_PROTOCOL_TCP
+				: GENSIO_NET_PROTOCOL_UNIX;
+    struct gensio_iod *iod = NULL;
+    struct net_attempt *a;
+    struct gensio_addr *addr;
+    unsigned int idx;
+    int err;
+
+    while (tdata->he_running && tdata->he_next < tdata->he_norder) {
+	idx = tdata->he_order[tdata->he_next++];
+
+	addr = gensio_addr_dup(tdata->ai);
+	if (!addr) {
+	    tdata->he_err = GE_NOMEM;
+	    continue;
+	}
+	net_addr_seek(addr, idx);
+	err = o->socket_open(o, addr, protocol, &iod);
+	if (!err)
+	    err = o->socket_set_setup(iod, net_sock_setup(tdata), tdata->lai);
+	if (!err)
+	    err = net_sock_timestamps(tdata, iod);
+	if (!err)
+	    err = net_sock_notsent_lowat(tdata, iod);
+	if (!err)
+	    err = net_sock_zerocopy(tdata, iod);
+	if (!err)
+	    err = o->connect(iod, addr);
+	gensio_addr_free(addr);
+
+	if (!err) {
+	    /* Connected right away, no need to wait. */
+	    tdata->he_iod = iod;
+	    tdata->he_idx = idx;
+	    net_he_finish(tdata, 0);
+	    return;
+	}
+	if (err != GE_INPROGRESS) {
+	    if (iod)
+		o->close(&iod);
+	    tdata->he_err = err;
+	    continue;
+	}
+
+	a = o->zalloc(o, sizeof(*a));
+	if (!a) {
+	    o->close(&iod);
+	    tdata->he_err = GE_NOMEM;
+	    continue;
+	}
+	a->tdata = tdata;
+	a->iod = iod;
+	a->idx = idx;
+	if (o->set_fd_handlers(iod, a, NULL, net_he_write_ready,
+			       net_he_write_ready, net_he_cleared)) {
+	    o->close(&iod);
+	    o->free(o, a);
+	    tdata->he_err = GE_NOMEM;
+	    continue;
+	}
+	gensio_list_add_tail(&tdata->he_attempts, &a->link);
+	tdata->he_nactive++;
+	tdata->he_pending++;
+	o->set_write_handler(iod, true);
+	o->set_except_handler(iod, true);
+	return;
+    }
+
+    if (tdata->he_running && tdata->he_nactive == 0)
+	/* Nothing left to try. */
+	net_he_finish(tdata, 0);
+}
+
+/* Must be called with he_lock held. */
+static void
+net_he_start_timer(struct net_data *tdata)
+{
+    if (!tdata->he_running || tdata->he_timer_running ||
+		tdata->he_next >= tdata->he_norder)
+	return;
+    if (tdata->o->start_timer(tdata->he_timer, &tdata->attempt_delay) == 0) {
+	tdata->he_timer_running = true;
+	tdata->he_pending++;
+    }
+}
+
+/*
+ * If the race is completely finished, return the number of times
+ * the fd ll needs to be told.  Must be called with he_lock held.
+ */
+static unsigned int
+net_he_check_done(struct net_data *tdata)
+{
+    unsigned int waiters = tdata->he_waiters;
+
+    if (tdata->he_running || tdata->he_pending > 0)
+	return 0;
+    tdata->he_waiters = 0;
+    return waiters;
+}
+
+/* Called when the gensio is closed, drop any race in progress. */
+static void
+net_he_cancel(struct net_data *tdata)
+{
+    struct gensio_link *l;
+
+    tdata->o->lock(tdata->he_lock);
+    if (tdata->he_running)
+	net_he_finish(tdata, GE_LOCALCLOSED);
+    gensio_list_for_each(&tdata->he_attempts, l) {
+	struct net_attempt *a = gensio_container_of(l, struct net_attempt,
+						    link);
+
+	a->connected = false;
+    }
+    if (tdata->he_iod)
+	tdata->o->close(&tdata->he_iod);
+    tdata->he_done = false;
+    tdata->o->unlock(tdata->he_lock);
+}
+
+static void
+net_he_write_ready(struct gensio_iod *iod, void *cb_data)
+{
+    struct net_attempt *a = cb_data;
+    struct net_data *tdata = a->tdata;
+    struct gensio_os_funcs *o = tdata->o;
+    int err;
+
+    o->lock(tdata->he_lock);
+    o->set_write_handler(iod, false);
+    o->set_except_handler(iod, false);
+    if (a->clearing)
+	goto out_unlock;
+
+    err = o->sock_control(iod, GENSIO_SOCKCTL_CHECK_OPEN, NULL, NULL);
+    if (!err) {
+	a->connected = true;
+	tdata->he_idx = a->idx;
+	net_he_finish(tdata, 0);
+	goto out_unlock;
+    }
+
+    tdata->he_err = err;
+    a->clearing = true;
+    tdata->he_nactive--;
+    o->clear_fd_handlers(iod);
+    /* Don't wait for the timer to try the next one. */
+    if (tdata->he_timer_running && o->stop_timer(tdata->he_timer) == 0) {
+	tdata->he_timer_running = false;
+	tdata->he_pending--;
+    }
+    net_he_start_next(tdata);
+    net_he_start_timer(tdata);
+ out_unlock:
+    o->unlock(tdata->he_lock);
+}
+
+static void
+net_he_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    struct net_attempt *a = cb_data;
+    struct net_data *tdata = a->tdata;
+    struct gensio_os_funcs *o = tdata->o;
+    struct gensio_ll *ll = tdata->ll;
+    unsigned int waiters;
+
+    o->lock(tdata->he_lock);
+    gensio_list_rm(&tdata->he_attempts, &a->link);
+    if (a->connected)
+	tdata->he_iod = iod;
+    else
+	o->close(&iod);
+    o->free(o, a);
+    tdata->he_pending--;
+    waiters = net_he_check_done(tdata);
+    o->unlock(tdata->he_lock);
+
+    /* The last of these may free tdata, don't touch it after this. */
+    while (waiters--)
+	gensio_fd_ll_open_continue(ll);
+}
+
+static void
+net_he_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+    struct gensio_ll *ll = tdata->ll;
+    unsigned int waiters;
+
+    tdata->o->lock(tdata->he_lock);
+    tdata->he_timer_running = false;
+    tdata->he_pending--;
+    net_he_start_next(tdata);
+    net_he_start_timer(tdata);
+    waiters = net_he_check_done(tdata);
+    tdata->o->unlock(tdata->he_lock);
+
+    while (waiters--)
+	gensio_fd_ll_open_continue(ll);
+}
+
+/*
+ * Start a race, or fetch the result of one that is done.  Returns
+ * GE_INPROGRESS with *iod NULL if the race is running, the fd ll will
+ * be continued when it's done.  Returns GE_NOTSUP if there are not
+ * enough addresses to race.
+ */
+static int
+net_he_open(struct net_data *tdata, struct gensio_iod **iod)
+{
+    int err;
+
+    tdata->o->lock(tdata->he_lock);
+    if (!tdata->he_done) {
+	err = net_he_setup_order(tdata);
+	if (err)
+	    goto out_unlock;
+	if (tdata->he_norder == 0) {
+	    err = GE_NOTSUP;
+	    goto out_unlock;
+	}
+
+	tdata->he_running = true;
+	tdata->he_next = 0;
+	tdata->he_err = GE_NOTFOUND;
+	net_he_start_next(tdata);
+	net_he_start_timer(tdata);
+	if (tdata->he_running || tdata->he_pending > 0) {
+	    tdata->he_waiters++;
+	    err = GE_INPROGRESS;
+	    goto out_unlock;
+	}
+	/* Finished or failed without having to wait. */
+    }
+
+    tdata->he_done = false;
+    if (tdata->he_iod) {
+	*iod = tdata->he_iod;
+	tdata->he_iod = NULL;
+	/* So the remote address is reported correctly. */
+	net_addr_seek(tdata->ai, tdata->he_idx);
+	tdata->last_err = 0;
+	err = 0;
+    } else {
+	err = tdata->he_err;
+	tdata->last_err = err;
+    }
+ out_unlock:
+    tdata->o->unlock(tdata->he_lock);
+    return err;
+}
+
+static int
+net_sub_open(void *handler_data, struct gensio_iod **iod)
+{
+    struct net_data *tdata = handler_data;
+    int err;
+
+    /* Nothing is left over from a previous open. */
+    tdata->co_err = 0;
+    tdata->co_len = 0;
+
+    if (tdata->resolve_str) {
+	err = net_resolve(tdata);
+	if (err)
+	    return err;
+    }
+
+    if (tdata->happy_eyeballs) {
+	err = net_he_open(tdata, iod);
+	if (err != GE_NOTSUP)
+	    return err;
+    }
+
+    gensio_addr_rewind(tdata->ai);
+    return net_try_open(tdata, iod);
+}
+
+static void
+net_co_free(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+
+    if (tdata->co_timer)
+	o->free_timer(tdata->co_timer);
+    if (tdata->co_lock)
+	o->free_lock(tdata->co_lock);
+    if (tdata->co_buf)
+	o->free(o, tdata->co_buf);
+}
+
+/* Send what is in co_buf.  Must be called with co_lock held. */
+static int
+net_co_flush(struct net_data *tdata)
+{
+    struct gensio_sg sg = { tdata->co_buf, tdata->co_len };
+    gensiods count = 0;
+    int err;
+
+    if (tdata->co_len == 0)
+	return 0;
+
+    err = tdata->o->send(tdata->co_iod, &sg, 1, &count, 0);
+    if (err) {
+	tdata->co_err = err;
+	tdata->co_len = 0;
+	return err;
+    }
+    if (count < tdata->co_len)
+	memmove(tdata->co_buf, tdata->co_buf + count, tdata->co_len - count);
+    tdata->co_len -= count;
+    return 0;
+}
+
+/*
+ * Start the flush timer if there is something to send.  If retry is
+ * set, the socket was full, so don't spin if co_time is zero.  Must
+ * be called with co_lock held.
+ */
+static void
+net_co_start_timer(struct net_data *tdata, bool retry)
+{
+    gensio_time timeout = tdata->co_time;
+
+    if (tdata->co_timer_running || tdata->co_len == 0)
+	return;
+    if (retry && timeout.secs == 0 && timeout.nsecs < 1000000)
+	timeout.nsecs = 1000000;
+    if (tdata->o->start_timer(tdata->co_timer, &timeout) == 0)
+	tdata->co_timer_running = true;
+}
+
+static void
+net_co_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+
+    tdata->o->lock(tdata->co_lock);
+    tdata->co_timer_running = false;
+    if (tdata->co_iod && !net_co_flush(tdata))
+	net_co_start_timer(tdata, true);
+    tdata->o->unlock(tdata->co_lock);
+}
+
+static int
+net_co_alloc(struct net_data *tdata, gensiods size, gensio_time *time)
+{
+    struct gensio_os_funcs *o = tdata->o;
+
+    tdata->co_buf = o->zalloc(o, size);
+    if (!tdata->co_buf)
+	return GE_NOMEM;
+    tdata->co_lock = o->alloc_lock(o);
+    if (!tdata->co_lock)
+	return GE_NOMEM;
+    tdata->co_timer = o->alloc_timer(o, net_co_timeout, tdata);
+    if (!tdata->co_timer)
+	return GE_NOMEM;
+    tdata->co_size = size;
+    tdata->co_time = *time;
+    return 0;
+}
+
+static int
+net_co_write(struct net_data *tdata, struct gensio_iod *iod,
+	     gensiods *rcount, const struct gensio_sg *sg, gensiods sglen,
+	     int flags)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    gensiods i, total = 0;
+    int err = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    o->lock(tdata->co_lock);
+    tdata->co_iod = iod;
+    if (tdata->co_err) {
+	err = tdata->co_err;
+	goto out_unlock;
+    }
+
+    if (flags || tdata->co_len + total > tdata->co_size) {
+	/* Get the old data out first to keep things in order. */
+	err = net_co_flush(tdata);
+	if (err)
+	    goto out_unlock;
+	if (tdata->co_len) {
+	    *rcount = 0;
+	    net_co_start_timer(tdata, true);
+	    goto out_unlock;
+	}
+    }
+
+    if (flags || (tdata->co_len == 0 && total >= tdata->co_size)) {
+	/* Nothing to gain from buffering it. */
+	err = o->send(iod, sg, sglen, rcount, flags);
+	goto out_unlock;
+    }
+
+    for (i = 0; i < sglen; i++) {
+	memcpy(tdata->co_buf + tdata->co_len, sg[i].buf, sg[i].buflen);
+	tdata->co_len += sg[i].buflen;
+    }
+    *rcount = total;
+    if (tdata->co_len == tdata->co_size)
+	net_co_flush(tdata);
+    net_co_start_timer(tdata, false);
+
+ out_unlock:
+    o->unlock(tdata->co_lock);
+    return err;
+}
+
+static int
+net_send(struct net_data *tdata, struct gensio_iod *iod, gensiods *rcount,
+	 const struct gensio_sg *sg, gensiods sglen, int flags)
+{
+    if (tdata->co_size)
+	return net_co_write(tdata, iod, rcount, sg, sglen, flags);
+
+    return tdata->o->send(iod, sg, sglen, rcount, flags);
+}
+
+/*
+ * Push out what is left in the coalesce buffer at close.  Returns
+ * GE_INPROGRESS with a timeout if it couldn't all be sent yet or the
+ * timer is still running.
+ */
+static int
+net_co_close(struct net_data *tdata, gensio_time *timeout)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    int err = 0;
 
-    /*
-     * The GE_NOMEM check is strange here, but it really has more to
-     * do with testing.  connect() is not going to return GE_NOMEM
-     * unless it's an error trigger failure, and we really want to
-     * fail in that case or we will get a "error triggered but no
-     * failure" in the test.
-     */
-    if (err && err != GE_NOMEM) {
-	if (gensio_addr_next(tdata->ai)) {
-	    tdata->o->close(&new_iod);
-	    goto retry;
+    if (!tdata->co_lock)
+	return 0;
+
+    o->lock(tdata->co_lock);
+    if (tdata->co_timer_running && o->stop_timer(tdata->co_timer) == 0)
+	tdata->co_timer_running = false;
+    net_co_flush(tdata);
+    if (tdata->co_len || tdata->co_timer_running) {
+	err = GE_INPROGRESS;
+	if (timeout) {
+	    timeout->secs = 0;
+	    timeout->nsecs = 1000000;
 	}
-    }
- out:
-    if (err) {
-	if (new_iod)
-	    tdata->o->close(&new_iod);
     } else {
-	*iod = new_iod;
+	tdata->co_iod = NULL;
     }
+    o->unlock(tdata->co_lock);
 
- out_return:
     return err;
 }
 
+/* Zero copy sends that may be in the kernel at once. */
+#define NET_ZC_MAX 256
+
 static int
-net_retry_open(void *handler_data, struct gensio_iod **iod)
+net_zc_alloc(struct net_data *tdata)
 {
-    struct net_data *tdata = handler_data;
+    struct gensio_os_funcs *o = tdata->o;
 
-    if (!gensio_addr_next(tdata->ai))
-	return tdata->last_err;
-    return net_try_open(tdata, iod);
+    tdata->zc_start = o->zalloc(o, NET_ZC_MAX * sizeof(*tdata->zc_start));
+    if (!tdata->zc_start)
+	return GE_NOMEM;
+    tdata->zc_lock = o->alloc_lock(o);
+    if (!tdata->zc_lock)
+	return GE_NOMEM;
+    tdata->zerocopy = true;
+    return 0;
+}
+
+static void
+net_zc_free(struct net_data *tdata)
+{
+    struct gensio_os_funcs *o = tdata->o;
+
+    if (tdata->zc_lock)
+	o->free_lock(tdata->zc_lock);
+    if (tdata->zc_start)
+	o->free(o, tdata->zc_start);
+}
+
+/* Collect the sends the kernel is done with. */
+static void
+net_zc_check(struct net_data *tdata, struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    struct gensio_sockctl_zcdone d;
+    gensiods size = sizeof(d);
+
+    o->lock(tdata->zc_lock);
+    while (o->sock_control(iod, GENSIO_SOCKCTL_GET_ZEROCOPY_DONE,
+			   &d, &size) == 0) {
+	/*
+	 * TCP finishes them in order, so everything up to hi is done.
+	 * Ignore anything that isn't past what is already done.
+	 */
+	if ((int32_t) (d.hi + 1 - tdata->zc_done) > 0 &&
+		(int32_t) (tdata->zc_next - (d.hi + 1)) >= 0)
+	    tdata->zc_done = d.hi + 1;
+    }
+    o->unlock(tdata->zc_lock);
 }
 
 static int
-net_sub_open(void *handler_data, struct gensio_iod **iod)
+net_zc_write(struct net_data *tdata, struct gensio_iod *iod,
+	     gensiods *rcount, const struct gensio_sg *sg, gensiods sglen,
+	     int flags, bool zerocopy)
 {
-    struct net_data *tdata = handler_data;
+    struct gensio_os_funcs *o = tdata->o;
+    gensiods count = 0;
+    int err;
 
-    gensio_addr_rewind(tdata->ai);
-    return net_try_open(tdata, iod);
+    o->lock(tdata->zc_lock);
+    if (zerocopy && tdata->zc_on &&
+		tdata->zc_next - tdata->zc_done < NET_ZC_MAX) {
+	err = net_send(tdata, iod, &count, sg, sglen,
+		       flags | GENSIO_MSG_ZEROCOPY);
+	if (err == GE_NOMEM) {
+	    /* Out of memory to pin the pages, just copy it. */
+	    zerocopy = false;
+	    err = net_send(tdata, iod, &count, sg, sglen, flags);
+	}
+    } else {
+	zerocopy = false;
+	err = net_send(tdata, iod, &count, sg, sglen, flags);
+    }
+    if (!err && count) {
+	if (zerocopy)
+	    tdata->zc_start[tdata->zc_next++ % NET_ZC_MAX] = tdata->zc_written;
+	tdata->zc_written += count;
+    }
+    o->unlock(tdata->zc_lock);
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
+static uint64_t
+net_zc_done_offset(struct net_data *tdata)
+{
+    uint64_t rv;
+
+    tdata->o->lock(tdata->zc_lock);
+    if (tdata->zc_done == tdata->zc_next)
+	rv = tdata->zc_written;
+    else
+	rv = tdata->zc_start[tdata->zc_done % NET_ZC_MAX];
+    tdata->o->unlock(tdata->zc_lock);
+    return rv;
 }
 
 static void
@@ -141,6 +1047,24 @@ net_free(void *handler_data)
 {
     struct net_data *tdata = handler_data;
 
+    if (tdata->he_iod)
+	tdata->o->close(&tdata->he_iod);
+    if (tdata->he_order)
+	tdata->o->free(tdata->o, tdata->he_order);
+    if (tdata->he_timer)
+	tdata->o->free_timer(tdata->he_timer);
+    if (tdata->he_lock)
+	tdata->o->free_lock(tdata->he_lock);
+    net_co_free(tdata);
+    net_zc_free(tdata);
+    if (tdata->resolve_ai)
+	gensio_addr_free(tdata->resolve_ai);
+    if (tdata->resolve_runner)
+	tdata->o->free_runner(tdata->resolve_runner);
+    if (tdata->resolve_lock)
+	tdata->o->free_lock(tdata->resolve_lock);
+    if (tdata->resolve_str)
+	tdata->o->free(tdata->o, tdata->resolve_str);
     if (tdata->ai)
 	gensio_addr_free(tdata->ai);
     if (tdata->lai)
@@ -148,6 +1072,56 @@ net_free(void *handler_data)
     tdata->o->free(tdata->o, tdata);
 }
 
+/*
+ * A connection handed off to another process is sent as this message
+ * with the socket attached:
+ *
+ *   "GNHO" <version> <flags>
+ */
+#define NET_HANDOFF_MAGIC	"GNHO"
+#define NET_HANDOFF_VERSION	1
+#define NET_HANDOFF_MSG_LEN	6
+#define NET_HANDOFF_TCP		(1 << 0)
+#define NET_HANDOFF_NODELAY	(1 << 1)
+#define NET_HANDOFF_TIMESTAMPS	(1 << 2)
+
+static int
+net_handoff(struct net_data *tdata, struct gensio_iod *iod, const char *str)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    unsigned char msg[NET_HANDOFF_MSG_LEN];
+    struct gensio_sockctl_fdmsg m;
+    struct gensio_iod *uiod;
+    char *end;
+    long fd;
+    int rv;
+
+    fd = strtol(str, &end, 0);
+    if (end == str || *end || fd < 0 || fd > INT_MAX)
+	return GE_INVAL;
+
+    memcpy(msg, NET_HANDOFF_MAGIC, 4);
+    msg[4] = NET_HANDOFF_VERSION;
+    msg[5] = 0;
+    if (tdata->istcp)
+	msg[5] |= NET_HANDOFF_TCP;
+    if (tdata->nodelay)
+	msg[5] |= NET_HANDOFF_NODELAY;
+    if (tdata->timestamps)
+	msg[5] |= NET_HANDOFF_TIMESTAMPS;
+
+    rv = o->add_iod(o, GENSIO_IOD_SOCKET, fd, &uiod);
+    if (rv)
+	return rv;
+    memset(&m, 0, sizeof(m));
+    m.buf = msg;
+    m.len = sizeof(msg);
+    m.iod = iod;
+    rv = o->sock_control(uiod, GENSIO_SOCKCTL_SEND_FD, &m, NULL);
+    o->release_iod(uiod);
+    return rv;
+}
+
 static int
 net_control(void *handler_data, struct gensio_iod *iod, bool get,
 	    unsigned int option, char *data, gensiods *datalen)
@@ -215,6 +1189,8 @@ net_control(void *handler_data, struct gensio_iod *iod, bool get,
 	if (strtoul(data, NULL, 0) > 0)
 	    return GE_NOTFOUND;
 
+	if (!tdata->ai)
+	    return GE_NOTREADY;
 	pos = 0;
 	rv = gensio_addr_to_str(tdata->ai, data, &pos, *datalen);
 	if (rv)
@@ -226,6 +1202,8 @@ net_control(void *handler_data, struct gensio_iod *iod, bool get,
     case GENSIO_CONTROL_RADDR_BIN:
 	if (!get)
 	    return GE_NOTSUP;
+	if (!tdata->ai)
+	    return GE_NOTREADY;
 	gensio_addr_getaddr(tdata->ai, data, datalen);
 	return 0;
 
@@ -246,6 +1224,22 @@ net_control(void *handler_data, struct gensio_iod *iod, bool get,
 	    tdata->do_oob = !!strtoul(data, NULL, 0);
 	return 0;
 
+    case GENSIO_CONTROL_HANDOFF:
+	if (get)
+	    return GE_NOTSUP;
+	if (!iod)
+	    return GE_NOTREADY;
+	return net_handoff(tdata, iod, data);
+
+    case GENSIO_CONTROL_ZEROCOPY_DONE:
+	if (!get || !tdata->zerocopy)
+	    return GE_NOTSUP;
+	if (iod && tdata->zc_on)
+	    net_zc_check(tdata, iod);
+	*datalen = snprintf(data, *datalen, "%llu",
+			    (unsigned long long) net_zc_done_offset(tdata));
+	return 0;
+
     default:
 	return GE_NOTSUP;
     }
@@ -276,6 +1270,62 @@ net_except_read(struct gensio_iod *iod, void *data, gensiods count,
     return tdata->o->recv(iod, data, count, rcount, 0);
 }
 
+static void
+net_fmt_time(char *buf, gensiods len, const char *name, gensio_time *t)
+{
+    snprintf(buf, len, "%s=%lld.%9.9ld", name, (long long) t->secs,
+	     (long) t->nsecs);
+}
+
+static int
+net_do_read(struct gensio_iod *iod, void *data, gensiods count,
+	    gensiods *rcount, const char ***auxdata, void *cb_data)
+{
+    struct net_data *tdata = cb_data;
+    struct gensio_sockctl_timestamp ts;
+    gensiods size = sizeof(ts);
+    unsigned int i = 0;
+    int rv;
+
+    rv = tdata->o->recv(iod, data, count, rcount, 0);
+    if (rv || *rcount == 0)
+	return rv;
+
+    if (tdata->o->sock_control(iod, GENSIO_SOCKCTL_GET_RX_TIMESTAMP,
+			       &ts, &size) == 0) {
+	if (ts.sw_valid) {
+	    net_fmt_time(tdata->ts_sw, sizeof(tdata->ts_sw), "timestamp",
+			 &ts.sw);
+	    tdata->ts_auxdata[i++] = tdata->ts_sw;
+	}
+	if (ts.hw_valid) {
+	    net_fmt_time(tdata->ts_hw, sizeof(tdata->ts_hw), "hwtimestamp",
+			 &ts.hw);
+	    tdata->ts_auxdata[i++] = tdata->ts_hw;
+	}
+    }
+    tdata->ts_auxdata[i] = NULL;
+    *auxdata = i ? tdata->ts_auxdata : NULL;
+    return 0;
+}
+
+static int
+net_gen_read(struct gensio_iod *iod, void *data, gensiods count,
+	     gensiods *rcount, const char ***auxdata, void *cb_data)
+{
+    return iod->f->read(iod, data, count, rcount);
+}
+
+static void
+net_read_ready(void *handler_data, struct gensio_iod *iod)
+{
+    struct net_data *tdata = handler_data;
+
+    gensio_fd_ll_handle_incoming(tdata->ll,
+				 tdata->timestamps ? net_do_read : net_gen_read,
+				 NULL, tdata);
+}
+
 static int
 net_except_ready(void *handler_data, struct gensio_iod *iod)
 {
@@ -287,6 +1337,10 @@ net_except_ready(void *handler_data, struct gensio_iod *iod)
     if (!tdata->istcp)
 	return GE_NOTSUP;
 
+    /* Zero copy completions come in on the error queue. */
+    if (tdata->zc_on)
+	net_zc_check(tdata, iod);
+
     rv = tdata->o->recv(iod, &urgdata, 1, &rcount, GENSIO_MSG_OOB);
     if (rv || rcount == 0)
 	return GE_NOTSUP;
@@ -302,6 +1356,7 @@ net_write(void *handler_data, struct gensio_iod *iod, gensiods *rcount,
 	  const char *const *auxdata)
 {
     struct net_data *tdata = handler_data;
+    bool zerocopy = false;
     int flags = 0;
 
     if (auxdata) {
@@ -312,12 +1367,17 @@ net_write(void *handler_data, struct gensio_iod *iod, gensiods *rcount,
 		flags |= GENSIO_MSG_OOB;
 	    else if (strcasecmp(auxdata[i], "oobtcp") == 0)
 		flags |= GENSIO_MSG_OOB;
+	    else if (strcasecmp(auxdata[i], "zerocopy") == 0)
+		zerocopy = true;
 	    else
 		return GE_INVAL;
 	}
     }
 
-    return tdata->o->send(iod, sg, sglen, rcount, flags);
+    if (tdata->zerocopy)
+	return net_zc_write(tdata, iod, rcount, sg, sglen, flags, zerocopy);
+
+    return net_send(tdata, iod, rcount, sg, sglen, flags);
 }
 
 static int
@@ -328,8 +1388,15 @@ net_check_close(void *handler_data, struct gensio_iod *iod,
     struct net_data *tdata = handler_data;
     int err;
 
-    if (state == GENSIO_LL_CLOSE_STATE_START)
+    if (state == GENSIO_LL_CLOSE_STATE_START) {
+	if (tdata->happy_eyeballs)
+	    net_he_cancel(tdata);
 	return 0;
+    }
+
+    err = net_co_close(tdata, timeout);
+    if (err)
+	return err;
 
     err = tdata->o->graceful_close(&iod);
     if (err == GE_INPROGRESS && timeout) {
@@ -345,13 +1412,19 @@ static const struct gensio_fd_ll_ops net_fd_ll_ops = {
     .retry_open = net_retry_open,
     .free = net_free,
     .control = net_control,
+    .read_ready = net_read_ready,
     .except_ready = net_except_ready,
     .write = net_write,
     .check_close = net_check_close
 };
 
+/*
+ * If str is not NULL, iai is ignored and str is looked up here, or
+ * at open time if async-resolve is set.
+ */
 static int
-net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
+net_gensio_alloc(const struct gensio_addr *iai, const char *str,
+		 const char * const args[],
 		 struct gensio_os_funcs *o,
 		 gensio_event cb, void *user_data, const char *type,
 		 struct gensio **new_gensio)
@@ -360,7 +1433,15 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
     struct gensio_addr *laddr = NULL, *laddr2, *addr = NULL;
     struct gensio *io;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
-    bool nodelay = false;
+    bool nodelay = false, async_resolve = false, happy_eyeballs = false;
+    bool timestamps = false, fastopen = false, zerocopy = false;
+    gensio_time attempt_delay = { 0, 250000000 };
+    gensiods co_size = 0;
+    gensio_time co_time = { 0, 0 };
+    unsigned int read_budget = 1;
+    gensiods readbuf_min = 0;
+    unsigned int notsent_lowat = 0;
+    bool lowprio = false;
     unsigned int i;
     int ival;
     int err;
@@ -390,6 +1471,12 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_pparm_uint(&p, args[i], "read-budget", &read_budget) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, args[i], "readbuf-min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "lowprio", &lowprio) > 0)
+	    continue;
 	if (istcp && gensio_pparm_addrs(&p, args[i], "laddr",
 					GENSIO_NET_PROTOCOL_TCP,
 					true, false, &laddr2) > 0) {
@@ -400,6 +1487,32 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 	}
 	if (istcp && gensio_pparm_bool(&p, args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "async-resolve",
+				       &async_resolve) > 0)
+	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "happy-eyeballs",
+				       &happy_eyeballs) > 0)
+	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "timestamps",
+				       &timestamps) > 0)
+	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "tfo",
+				       &fastopen) > 0)
+	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "zerocopy",
+				       &zerocopy) > 0)
+	    continue;
+	if (istcp && gensio_pparm_uint(&p, args[i], "notsent-lowat",
+				       &notsent_lowat) > 0)
+	    continue;
+	if (istcp && gensio_pparm_time(&p, args[i], "attempt-delay", 'm',
+				       &attempt_delay) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, args[i], "coalesce", &co_size) > 0)
+	    continue;
+	if (gensio_pparm_time(&p, args[i], "coalesce-time", 'm',
+			      &co_time) > 0)
+	    continue;
 
 	if (laddr)
 	    gensio_addr_free(laddr);
@@ -407,24 +1520,75 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
 	return GE_INVAL;
     }
 
+    if (str && !async_resolve) {
+	err = gensio_os_scan_netaddr(o, str, false,
+				     istcp ? GENSIO_NET_PROTOCOL_TCP
+					   : GENSIO_NET_PROTOCOL_UNIX,
+				     &addr);
+	if (err) {
+	    gensio_pparm_log(&p, "Invalid network address: %s", str);
+	    if (laddr)
+		gensio_addr_free(laddr);
+	    return err;
+	}
+    }
+
     tdata = o->zalloc(o, sizeof(*tdata));
     if (!tdata)
 	goto out_nomem;
 
     tdata->istcp = istcp;
     tdata->oob_char = -1;
+    gensio_list_init(&tdata->he_attempts);
+
+    if (happy_eyeballs) {
+	tdata->happy_eyeballs = true;
+	tdata->attempt_delay = attempt_delay;
+	tdata->he_lock = o->alloc_lock(o);
+	if (!tdata->he_lock)
+	    goto out_nomem;
+	tdata->he_timer = o->alloc_timer(o, net_he_timeout, tdata);
+	if (!tdata->he_timer)
+	    goto out_nomem;
+    }
 
-    addr = gensio_addr_dup(iai);
-    if (!addr)
-	goto out_nomem;
+    if (str && async_resolve) {
+	tdata->resolve_str = gensio_strdup(o, str);
+	if (!tdata->resolve_str)
+	    goto out_nomem;
+	tdata->resolve_lock = o->alloc_lock(o);
+	if (!tdata->resolve_lock)
+	    goto out_nomem;
+	tdata->resolve_runner = o->alloc_runner(o, net_resolve_done, tdata);
+	if (!tdata->resolve_runner)
+	    goto out_nomem;
+    } else if (!str) {
+	addr = gensio_addr_dup(iai);
+	if (!addr)
+	    goto out_nomem;
+    }
 
     tdata->o = o;
     tdata->nodelay = nodelay;
+    tdata->fastopen = fastopen;
+    tdata->timestamps = timestamps;
+    tdata->notsent_lowat = notsent_lowat;
+
+    if (co_size && net_co_alloc(tdata, co_size, &co_time))
+	goto out_nomem;
+
+    if (zerocopy && net_zc_alloc(tdata))
+	goto out_nomem;
 
     tdata->ll = fd_gensio_ll_alloc(o, NULL, &net_fd_ll_ops, tdata,
 				   max_read_size, false, false);
     if (!tdata->ll)
 	goto out_nomem;
+    gensio_fd_ll_set_read_budget(tdata->ll, read_budget);
+    if (readbuf_min)
+	gensio_fd_ll_set_readbuf_min(tdata->ll, readbuf_min);
+    if (lowprio && gensio_fd_ll_set_lowprio(tdata->ll, true))
+	goto out_nomem;
 
     io = base_gensio_alloc(o, tdata->ll, NULL, NULL, type, cb, user_data);
     if (!io)
@@ -445,38 +1609,37 @@ net_gensio_alloc(const struct gensio_addr *iai, const char * const args[],
     if (addr)
 	gensio_addr_free(addr);
     if (tdata) {
-	if (tdata->ll)
+	if (tdata->ll) {
 	    gensio_ll_free(tdata->ll);
-	else
+	} else {
 	    /* gensio_ll_free() frees it otherwise. */
+	    if (tdata->he_timer)
+		o->free_timer(tdata->he_timer);
+	    if (tdata->he_lock)
+		o->free_lock(tdata->he_lock);
+	    if (tdata->resolve_runner)
+		o->free_runner(tdata->resolve_runner);
+	    if (tdata->resolve_lock)
+		o->free_lock(tdata->resolve_lock);
+	    if (tdata->resolve_str)
+		o->free(o, tdata->resolve_str);
+	    net_co_free(tdata);
+	    net_zc_free(tdata);
 	    o->free(o, tdata);
+	}
     }
     return GE_NOMEM;
 }
 
 static int
 str_to_net_gensio(const char *str, const char * const args[],
-		  int protocol, const char *typestr,
+		  const char *typestr,
 		  struct gensio_os_funcs *o,
 		  gensio_event cb, void *user_data,
 		  struct gensio **new_gensio)
 {
-    struct gensio_addr *addr;
-    int err;
-
-    err = gensio_os_scan_netaddr(o, str, false, protocol, &addr);
-    if (err) {
-	bool istcp = strcmp(typestr, "tcp") == 0;
-	GENSIO_DECLARE_PPGENSIO(p, o, cb, istcp ? "tcp" : "unix", user_data);
-
-	gensio_pparm_log(&p, "Invalid network address: %s", str);
-	return err;
-    }
-
-    err = net_gensio_alloc(addr, args, o, cb, user_data, typestr, new_gensio);
-    gensio_addr_free(addr);
-
-    return err;
+    return net_gensio_alloc(NULL, str, args, o, cb, user_data, typestr,
+			    new_gensio);
 }
 
 static int
@@ -487,7 +1650,8 @@ tcp_gensio_alloc(const void *gdata, const char * const args[],
 {
     const struct gensio_addr *iai = gdata;
 
-    return net_gensio_alloc(iai, args, o, cb, user_data, "tcp", new_gensio);
+    return net_gensio_alloc(iai, NULL, args, o, cb, user_data, "tcp",
+			    new_gensio);
 }
 
 static int
@@ -496,7 +1660,7 @@ str_to_tcp_gensio(const char *str, const char * const args[],
 		  gensio_event cb, void *user_data,
 		  struct gensio **new_gensio)
 {
-    return str_to_net_gensio(str, args, GENSIO_NET_PROTOCOL_TCP, "tcp",
+    return str_to_net_gensio(str, args, "tcp",
 			     o, cb, user_data, new_gensio);
 }
 
@@ -509,7 +1673,8 @@ unix_gensio_alloc(const void *gdata, const char * const args[],
 #if HAVE_UNIX
     const struct gensio_addr *iai = gdata;
 
-    return net_gensio_alloc(iai, args, o, cb, user_data, "unix", new_gensio);
+    return net_gensio_alloc(iai, NULL, args, o, cb, user_data, "unix",
+			    new_gensio);
 #else
     return GE_NOTSUP;
 #endif
@@ -521,7 +1686,7 @@ str_to_unix_gensio(const char *str, const char * const args[],
 		   gensio_event cb, void *user_data,
 		   struct gensio **new_gensio)
 {
-    return str_to_net_gensio(str, args, GENSIO_NET_PROTOCOL_UNIX, "unix",
+    return str_to_net_gensio(str, args, "unix",
 			     o, cb, user_data, new_gensio);
 }
 
@@ -535,7 +1700,14 @@ struct netna_data {
     struct gensio_runner *cb_en_done_runner;
 
     gensiods max_read_size;
+    unsigned int read_budget;
+    gensiods readbuf_min;
     bool nodelay;
+    bool timestamps;
+    bool zerocopy;
+    unsigned int notsent_lowat;
+    gensiods co_size;
+    gensio_time co_time;
 
     gensio_acc_done shutdown_done;
     gensio_acc_done cb_en_done;
@@ -560,29 +1732,72 @@ struct netna_data {
     unsigned int   nr_accept_close_waiting;
 
     unsigned int opensock_flags;
+    unsigned int reuseport; /* Number of listen sockets per address. */
+    unsigned int accept_budget; /* Max accepts per readiness event. */
+    bool accept_enabled;
+
+    /*
+     * Accepts are paused because the os funcs is overloaded, see
+     * GENSIO_OVERLOAD_PAUSE_ACCEPTS.  overload_timer turns them back
+     * on.  If a shutdown stops the pause while the timer is going
+     * off, overload_wait is set and the shutdown waits for the timer.
+     * lowprio makes new connections low priority.
+     */
+    struct gensio_timer *overload_timer;
+    bool overload_paused;
+    bool overload_wait;
+    bool lowprio;
+
+    /*
+     * How to pick the shard for a new connection, everything for the
+     * connection is then done there.  next_shard is for round robin.
+     */
+    int affinity;
+    unsigned int next_shard;
 
     bool istcp;
+
+    /*
+     * For a handoff accepter, the unix socket that connections handed
+     * off by another process come in on.  There are no accept fds.
+     */
+    struct gensio_iod *handoff_iod;
 };
 
+static int
+net_server_check_close(void *handler_data, struct gensio_iod *iod,
+		       enum gensio_ll_close_state state,
+		       gensio_time *timeout)
+{
+    struct net_data *tdata = handler_data;
+    int err;
+
+    if (state == GENSIO_LL_CLOSE_STATE_START)
+	return 0;
+
+    err = net_co_close(tdata, timeout);
+    if (!err)
+	tdata->o->close(&iod);
+    return err;
+}
+
 static const struct gensio_fd_ll_ops net_server_fd_ll_ops = {
     .free = net_free,
     .control = net_control,
+    .read_ready = net_read_ready,
     .except_ready = net_except_ready,
-    .write = net_write
+    .write = net_write,
+    .check_close = net_server_check_close
 };
 
+/*
+ * An accept fd (or the overload timer) is done, report the shutdown
+ * when the last one is.
+ */
 static void
-netna_fd_cleared(struct gensio_iod *iod, void *cbdata)
+netna_close_waiting_done(struct netna_data *nadata)
 {
-    struct netna_data *nadata = cbdata;
-    unsigned int num_left, i;
-
-    for (i = 0; i < nadata->nr_acceptfds; i++) {
-	if (iod == nadata->acceptfds[i].iod)
-	    break;
-    }
-    assert(i < nadata->nr_acceptfds);
-    nadata->o->close(&nadata->acceptfds[i].iod);
+    unsigned int num_left;
 
     nadata->o->lock(nadata->lock);
     assert(nadata->nr_accept_close_waiting > 0);
@@ -597,6 +1812,22 @@ netna_fd_cleared(struct gensio_iod *iod, void *cbdata)
 	nadata->shutdown_done(nadata->acc, NULL);
 }
 
+static void
+netna_fd_cleared(struct gensio_iod *iod, void *cbdata)
+{
+    struct netna_data *nadata = cbdata;
+    unsigned int i;
+
+    for (i = 0; i < nadata->nr_acceptfds; i++) {
+	if (iod == nadata->acceptfds[i].iod)
+	    break;
+    }
+    assert(i < nadata->nr_acceptfds);
+    nadata->o->close(&nadata->acceptfds[i].iod);
+
+    netna_close_waiting_done(nadata);
+}
+
 static void
 netna_set_fd_enables(struct netna_data *nadata, bool enable)
 {
@@ -606,26 +1837,122 @@ netna_set_fd_enables(struct netna_data *nadata, bool enable)
 	nadata->o->set_read_handler(nadata->acceptfds[i].iod, enable);
 }
 
+/*
+ * Stop accepting while the os funcs is overloaded.  Returns false if
+ * the timer to turn accepts back on can't be started, accept anyway
+ * then.
+ */
+static bool
+netna_overload_pause(struct netna_data *nadata, gensio_time *recheck)
+{
+    bool rv = true;
+
+    nadata->o->lock(nadata->lock);
+    if (!nadata->overload_paused) {
+	if (nadata->o->start_timer(nadata->overload_timer, recheck) != 0) {
+	    rv = false;
+	    goto out_unlock;
+	}
+	nadata->overload_paused = true;
+    }
+    /* Someone may have turned them on since we paused. */
+    netna_set_fd_enables(nadata, false);
+ out_unlock:
+    nadata->o->unlock(nadata->lock);
+    return rv;
+}
+
+static void
+netna_overload_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct netna_data *nadata = cb_data;
+
+    nadata->o->lock(nadata->lock);
+    if (nadata->overload_paused) {
+	nadata->overload_paused = false;
+	/* The readhandler pauses again if it's still overloaded. */
+	if (nadata->accept_enabled)
+	    netna_set_fd_enables(nadata, true);
+    } else if (nadata->overload_wait) {
+	nadata->overload_wait = false;
+	nadata->o->unlock(nadata->lock);
+	netna_close_waiting_done(nadata);
+	return;
+    }
+    nadata->o->unlock(nadata->lock);
+}
+
+/*
+ * Stop an overload pause on shutdown or disable.  A shutdown has to
+ * wait for the timer if it is already going off.
+ */
+static void
+netna_overload_stop(struct netna_data *nadata, bool shutdown)
+{
+    nadata->o->lock(nadata->lock);
+    if (nadata->overload_paused) {
+	nadata->overload_paused = false;
+	if (nadata->o->stop_timer(nadata->overload_timer) == GE_TIMEDOUT &&
+		shutdown) {
+	    nadata->overload_wait = true;
+	    nadata->nr_accept_close_waiting++;
+	}
+    }
+    nadata->o->unlock(nadata->lock);
+}
+
 static void
 netna_finish_server_open(struct gensio *net, int err, void *cb_data)
 {
-    struct netna_data *nadata = cb_data;
-
-    base_gensio_server_open_done(nadata->acc, net, err);
+    struct netna_data *nadata = cb_data;
+
+    base_gensio_server_open_done(nadata->acc, net, err);
+}
+
+enum net_affinity {
+    NET_AFFINITY_OFF,
+    NET_AFFINITY_CPU,
+    NET_AFFINITY_RR
+};
+
+/*
+ * Put a new connection on a shard by the CPU that handled its
+ * packets, or round robin.
+ */
+static void
+netna_set_affinity(struct netna_data *nadata, struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    unsigned int cpu;
+    gensiods size = sizeof(cpu);
+    intptr_t shard;
+
+    if (nadata->affinity == NET_AFFINITY_CPU &&
+		o->sock_control(iod, GENSIO_SOCKCTL_GET_INCOMING_CPU,
+				&cpu, &size) == 0) {
+	shard = cpu;
+    } else {
+	o->lock(nadata->lock);
+	shard = nadata->next_shard++ & INT_MAX;
+	o->unlock(nadata->lock);
+    }
+    o->iod_control(iod, GENSIO_IOD_CONTROL_SHARD, false, shard);
 }
 
-static void
-netna_readhandler(struct gensio_iod *iod, void *cbdata)
+static void netna_new_conn(struct netna_data *nadata,
+			   struct gensio_iod *new_iod,
+			   struct gensio_addr *raddr, bool istcp, bool nodelay,
+			   bool timestamps);
+
+/*
+ * Accept one connection.  Returns an error if nothing more should be
+ * accepted on this readiness event.
+ */
+static int
+netna_accept_one(struct netna_data *nadata, struct gensio_iod *iod)
 {
-    struct netna_data *nadata = cbdata;
     struct gensio_iod *new_iod = NULL;
     struct gensio_addr *raddr;
-    struct net_data *tdata = NULL;
-    struct gensio *io = NULL;
-    unsigned int setup = (GENSIO_SET_OPENSOCK_REUSEADDR |
-			  GENSIO_OPENSOCK_REUSEADDR |
-			  GENSIO_SET_OPENSOCK_KEEPALIVE |
-			  GENSIO_SET_OPENSOCK_NODELAY);
     int err;
 
     err = nadata->o->accept(iod, &raddr, &new_iod);
@@ -635,16 +1962,29 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
 	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 			   "Error accepting net gensio: %s",
 			   gensio_err_to_str(err));
-	return;
+	return err;
     }
 
     err = base_gensio_accepter_new_child_start(nadata->acc);
     if (err) {
 	gensio_addr_free(raddr);
 	nadata->o->close(&new_iod);
-	return;
+	return err;
+    }
+
+    if (nadata->reuseport > 1) {
+	intptr_t shard;
+
+	/* Keep the connection on the shard the kernel picked for it. */
+	if (!nadata->o->iod_control(iod, GENSIO_IOD_CONTROL_SHARD, true,
+				    (intptr_t) &shard))
+	    nadata->o->iod_control(new_iod, GENSIO_IOD_CONTROL_SHARD, false,
+				   shard);
     }
 
+    if (nadata->affinity != NET_AFFINITY_OFF)
+	netna_set_affinity(nadata, new_iod);
+
 #ifdef HAVE_TCPD_H
     if (nadata->istcp && nadata->tcpd != GENSIO_TCPD_OFF) {
 	const char *msg = gensio_os_check_tcpd_ok(new_iod,
@@ -657,12 +1997,44 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
 	    }
 	    gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
 			   "Error accepting net gensio: tcpd check failed");
-	    err = GE_INVAL;
-	    goto out_err;
+	    base_gensio_accepter_new_child_end(nadata->acc, NULL, GE_INVAL);
+	    gensio_addr_free(raddr);
+	    nadata->o->close(&new_iod);
+	    return 0;
 	}
     }
 #endif
 
+    netna_new_conn(nadata, new_iod, raddr, nadata->istcp, nadata->nodelay,
+		   nadata->timestamps);
+    return 0;
+}
+
+/*
+ * Set up a gensio for a new connection and report it.  Called between
+ * base_gensio_accepter_new_child_start() and _end(), this does the
+ * end.  Takes over new_iod and raddr.
+ */
+static void
+netna_new_conn(struct netna_data *nadata, struct gensio_iod *new_iod,
+	       struct gensio_addr *raddr, bool istcp, bool nodelay,
+	       bool timestamps)
+{
+    struct net_data *tdata = NULL;
+    struct gensio *io = NULL;
+    unsigned int setup = (GENSIO_SET_OPENSOCK_REUSEADDR |
+			  GENSIO_OPENSOCK_REUSEADDR |
+			  GENSIO_SET_OPENSOCK_KEEPALIVE |
+			  GENSIO_SET_OPENSOCK_NODELAY);
+    bool alloc_shard = false;
+    int err;
+
+    /* Put the connection's timers and runners on its fd's shard, too. */
+    if (nadata->affinity != NET_AFFINITY_OFF)
+	alloc_shard = nadata->o->iod_control(new_iod,
+					     GENSIO_IOD_CONTROL_ALLOC_SHARD,
+					     false, 1) == 0;
+
     tdata = nadata->o->zalloc(nadata->o, sizeof(*tdata));
     if (!tdata) {
 	gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
@@ -674,47 +2046,92 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
     tdata->o = nadata->o;
     tdata->oob_char = -1;
     tdata->ai = raddr;
-    tdata->istcp = nadata->istcp;
-    tdata->nodelay = nadata->nodelay;
+    tdata->istcp = istcp;
+    tdata->nodelay = nodelay;
+    tdata->timestamps = timestamps;
+    tdata->notsent_lowat = nadata->notsent_lowat;
     raddr = NULL;
 
+    if (nadata->co_size) {
+	err = net_co_alloc(tdata, nadata->co_size, &nadata->co_time);
+	if (err) {
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+			   "Error accepting net gensio: out of memory");
+	    goto out_err;
+	}
+    }
+
+    if (nadata->zerocopy && istcp) {
+	err = net_zc_alloc(tdata);
+	if (err) {
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+			   "Error accepting net gensio: out of memory");
+	    goto out_err;
+	}
+    }
+
     if (tdata->istcp)
 	setup |= GENSIO_OPENSOCK_KEEPALIVE;
     if (tdata->nodelay)
 	setup |= GENSIO_OPENSOCK_NODELAY;
     err = tdata->o->socket_set_setup(new_iod, setup, NULL);
+    if (!err)
+	err = net_sock_timestamps(tdata, new_iod);
+    if (!err)
+	err = net_sock_notsent_lowat(tdata, new_iod);
+    if (!err)
+	err = net_sock_zerocopy(tdata, new_iod);
     if (err) {
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Error setting up net port: %s", gensio_err_to_str(err));
 	goto out_err;
     }
 
+    /* Start the connection's setup arena, filters above will join it. */
+    gensio_setup_scope_start(nadata->o, NULL);
     tdata->ll = fd_gensio_ll_alloc(nadata->o, new_iod, &net_server_fd_ll_ops,
 				   tdata, nadata->max_read_size, false, false);
+    if (tdata->ll)
+	io = base_gensio_server_alloc(nadata->o, tdata->ll, NULL, NULL,
+				      istcp ? "tcp" : "unix",
+				      netna_finish_server_open, nadata);
+    gensio_setup_scope_end();
     if (!tdata->ll) {
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Out of memory allocating net ll");
 	err = GE_NOMEM;
 	goto out_err;
     }
+    gensio_fd_ll_set_read_budget(tdata->ll, nadata->read_budget);
+    if (nadata->readbuf_min)
+	gensio_fd_ll_set_readbuf_min(tdata->ll, nadata->readbuf_min);
 
-    io = base_gensio_server_alloc(nadata->o, tdata->ll, NULL, NULL,
-				  nadata->istcp ? "tcp" : "unix",
-				  netna_finish_server_open, nadata);
     if (!io) {
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Out of memory allocating net base");
 	err = GE_NOMEM;
 	goto out_err;
     }
+    if (nadata->lowprio) {
+	err = gensio_fd_ll_set_lowprio(tdata->ll, true);
+	if (err)
+	    goto out_err;
+    }
     gensio_set_is_reliable(io, true);
     err = base_gensio_server_start(io);
     if (err)
 	goto out_err;
+    if (alloc_shard)
+	nadata->o->iod_control(new_iod, GENSIO_IOD_CONTROL_ALLOC_SHARD,
+			       false, 0);
     base_gensio_accepter_new_child_end(nadata->acc, io, 0);
     return;
 
  out_err:
+    if (alloc_shard)
+	nadata->o->iod_control(new_iod, GENSIO_IOD_CONTROL_ALLOC_SHARD,
+			       false, 0);
+    /* A failure setting up one connection doesn't stop the others. */
     base_gensio_accepter_new_child_end(nadata->acc, NULL, err);
     if (io) {
 	gensio_free(io);
@@ -735,6 +2152,110 @@ netna_readhandler(struct gensio_iod *iod, void *cbdata)
 	nadata->o->close(&new_iod);
 }
 
+/*
+ * Drain up to accept_budget pending connections per readiness event
+ * so a burst of connections doesn't take a wakeup for each one.
+ */
+static void
+netna_readhandler(struct gensio_iod *iod, void *cbdata)
+{
+    struct netna_data *nadata = cbdata;
+    gensio_time recheck;
+    unsigned int i;
+
+    if (gensio_os_overloaded(nadata->o, GENSIO_OVERLOAD_PAUSE_ACCEPTS,
+			     &recheck) &&
+		netna_overload_pause(nadata, &recheck))
+	/* Leave them in the listen backlog for now. */
+	return;
+
+    for (i = 0; i < nadata->accept_budget && nadata->accept_enabled; i++) {
+	if (netna_accept_one(nadata, iod))
+	    break;
+    }
+}
+
+/*
+ * Receive one connection handed off by another process.  Returns an
+ * error if nothing more should be received on this readiness event.
+ */
+static int
+netna_handoff_one(struct netna_data *nadata, struct gensio_iod *iod)
+{
+    unsigned char msg[NET_HANDOFF_MSG_LEN];
+    struct gensio_sockctl_fdmsg m;
+    struct gensio_addr *raddr;
+    int err;
+
+    memset(&m, 0, sizeof(m));
+    m.buf = msg;
+    m.len = sizeof(msg);
+    err = nadata->o->sock_control(iod, GENSIO_SOCKCTL_RECV_FD, &m, NULL);
+    if (err) {
+	if (err != GE_NODATA) {
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			   "Error receiving handed off connection: %s",
+			   gensio_err_to_str(err));
+	    nadata->o->set_read_handler(iod, false);
+	}
+	return err;
+    }
+    if (!m.iod)
+	/* Just data, nothing to do. */
+	return 0;
+
+    if (m.len != NET_HANDOFF_MSG_LEN ||
+		memcmp(msg, NET_HANDOFF_MAGIC, 4) != 0 ||
+		msg[4] != NET_HANDOFF_VERSION) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "Invalid handed off connection message");
+	nadata->o->close(&m.iod);
+	return 0;
+    }
+
+    err = nadata->o->sock_control(m.iod, GENSIO_SOCKCTL_GET_PEERNAME,
+				  &raddr, NULL);
+    if (err) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+		       "Error getting handed off connection address: %s",
+		       gensio_err_to_str(err));
+	nadata->o->close(&m.iod);
+	return 0;
+    }
+
+    err = base_gensio_accepter_new_child_start(nadata->acc);
+    if (err) {
+	gensio_addr_free(raddr);
+	nadata->o->close(&m.iod);
+	return err;
+    }
+
+    netna_new_conn(nadata, m.iod, raddr, msg[5] & NET_HANDOFF_TCP,
+		   msg[5] & NET_HANDOFF_NODELAY,
+		   msg[5] & NET_HANDOFF_TIMESTAMPS);
+    return 0;
+}
+
+static void
+netna_handoff_readhandler(struct gensio_iod *iod, void *cbdata)
+{
+    struct netna_data *nadata = cbdata;
+    unsigned int i;
+
+    for (i = 0; i < nadata->accept_budget && nadata->accept_enabled; i++) {
+	if (netna_handoff_one(nadata, iod))
+	    break;
+    }
+}
+
+static void
+netna_handoff_cleared(struct gensio_iod *iod, void *cbdata)
+{
+    struct netna_data *nadata = cbdata;
+
+    nadata->shutdown_done(nadata->acc, NULL);
+}
+
 #if HAVE_UNIX
 #define MAX_UNIX_ADDR_PATH (sizeof(((struct sockaddr_un *) 0)->sun_path) + 1)
 static void
@@ -849,8 +2370,10 @@ netna_startup(struct gensio_accepter *accepter, struct netna_data *nadata)
 			       NULL, netna_fd_cleared, netna_b4_listen, nadata,
 			       nadata->opensock_flags,
 			       &nadata->acceptfds, &nadata->nr_acceptfds);
-    if (!rv)
+    if (!rv) {
+	nadata->accept_enabled = true;
 	netna_set_fd_enables(nadata, true);
+    }
     return rv;
 }
 
@@ -863,6 +2386,7 @@ netna_shutdown(struct gensio_accepter *accepter,
 
     nadata->shutdown_done = shutdown_done;
     nadata->nr_accept_close_waiting = nadata->nr_acceptfds;
+    netna_overload_stop(nadata, true);
     for (i = 0; i < nadata->nr_acceptfds; i++)
 	nadata->o->clear_fd_handlers(nadata->acceptfds[i].iod);
 
@@ -895,8 +2419,11 @@ netna_set_accept_callback_enable(struct gensio_accepter *accepter,
 	return GE_INUSE;
 
     nadata->cb_en_done = done;
+    nadata->accept_enabled = enabled;
     for (i = 0; i < nadata->nr_acceptfds; i++)
 	nadata->o->set_read_handler(nadata->acceptfds[i].iod, enabled);
+    if (nadata->handoff_iod)
+	nadata->o->set_read_handler(nadata->handoff_iod, enabled);
 
     if (done)
 	nadata->o->run(nadata->cb_en_done_runner);
@@ -906,12 +2433,17 @@ netna_set_accept_callback_enable(struct gensio_accepter *accepter,
 static void
 netna_free(struct gensio_accepter *accepter, struct netna_data *nadata)
 {
+    if (nadata->overload_timer)
+	nadata->o->free_timer(nadata->overload_timer);
     if (nadata->lock)
 	nadata->o->free_lock(nadata->lock);
     if (nadata->cb_en_done_runner)
 	nadata->o->free_runner(nadata->cb_en_done_runner);
     if (nadata->ai)
 	gensio_addr_free(nadata->ai);
+    if (nadata->handoff_iod)
+	/* The fd belongs to the user, don't close it. */
+	nadata->o->release_iod(nadata->handoff_iod);
 #if HAVE_UNIX
     if (nadata->owner)
 	nadata->o->free(nadata->o, nadata->owner);
@@ -931,16 +2463,18 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
 		    gensio_event cb, void *user_data, struct gensio **new_io)
 {
     int err;
-    const char *args[4] = { NULL, NULL, NULL, NULL };
-    char buf[100];
+    const char *args[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    char buf[100], rbbuf[40], rmbuf[40];
     unsigned int i;
     gensiods max_read_size = nadata->max_read_size;
+    unsigned int read_budget = nadata->read_budget;
+    gensiods readbuf_min = nadata->readbuf_min;
     const char **iargs;
     struct gensio_addr *ai;
     const char *laddr = NULL, *dummy;
     bool is_port_set;
     int protocol = 0;
-    bool nodelay = false;
+    bool nodelay = false, timestamps = false;
     GENSIO_DECLARE_PPGENSIO(p, nadata->o, cb,
 			    nadata->istcp ? "tcp" : "unix", user_data);
 
@@ -963,6 +2497,10 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
     for (i = 0; iargs && iargs[i]; i++) {
 	if (gensio_pparm_ds(&p, iargs[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_pparm_uint(&p, iargs[i], "read-budget", &read_budget) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, iargs[i], "readbuf-min", &readbuf_min) > 0)
+	    continue;
 	if (nadata->istcp &&
 		gensio_pparm_value(&p, iargs[i], "laddr", &dummy) > 0) {
 	    laddr = iargs[i];
@@ -971,6 +2509,9 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
 	if (nadata->istcp &&
 		gensio_pparm_bool(&p, args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (nadata->istcp &&
+		gensio_pparm_bool(&p, iargs[i], "timestamps", &timestamps) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(&p, args[i]);
 	goto out_err;
     }
@@ -982,13 +2523,27 @@ netna_str_to_gensio(struct gensio_accepter *accepter,
 	args[i++] = buf;
     }
 
+    if (read_budget > 1) {
+	snprintf(rbbuf, sizeof(rbbuf), "read-budget=%u", read_budget);
+	args[i++] = rbbuf;
+    }
+
+    if (readbuf_min) {
+	snprintf(rmbuf, sizeof(rmbuf), "readbuf-min=%lu",
+		 (unsigned long) readbuf_min);
+	args[i++] = rmbuf;
+    }
+
     if (laddr)
 	args[i++] = laddr;
 
     if (nodelay)
 	args[i++] = "nodelay";
 
-    err = net_gensio_alloc(ai, args, nadata->o, cb, user_data,
+    if (timestamps)
+	args[i++] = "timestamps";
+
+    err = net_gensio_alloc(ai, NULL, args, nadata->o, cb, user_data,
 			   nadata->istcp ? "tcp" : "unix", new_io);
 
  out_err:
@@ -1095,6 +2650,7 @@ netna_disable(struct gensio_accepter *accepter, struct netna_data *nadata)
 {
     unsigned int i;
 
+    netna_overload_stop(nadata, false);
     for (i = 0; i < nadata->nr_acceptfds; i++)
 	nadata->o->clear_fd_handlers_norpt(nadata->acceptfds[i].iod);
     for (i = 0; i < nadata->nr_acceptfds; i++)
@@ -1137,6 +2693,57 @@ netna_base_acc_op(struct gensio_accepter *acc, int op,
     }
 }
 
+/*
+ * The handoff accepter has no listen sockets, just the unix socket
+ * connections come in on, so most of the operations are simpler.
+ */
+static int
+netna_handoff_acc_op(struct gensio_accepter *acc, int op,
+		     void *acc_op_data, void *done, int val1,
+		     void *data, void *data2, void *ret)
+{
+    struct netna_data *nadata = acc_op_data;
+    int rv;
+
+    switch(op) {
+    case GENSIO_BASE_ACC_STARTUP:
+	rv = nadata->o->set_fd_handlers(nadata->handoff_iod, nadata,
+					netna_handoff_readhandler, NULL, NULL,
+					netna_handoff_cleared);
+	if (!rv) {
+	    nadata->accept_enabled = true;
+	    nadata->o->set_read_handler(nadata->handoff_iod, true);
+	}
+	return rv;
+
+    case GENSIO_BASE_ACC_SHUTDOWN:
+	nadata->shutdown_done = done;
+	nadata->o->clear_fd_handlers(nadata->handoff_iod);
+	return 0;
+
+    case GENSIO_BASE_ACC_SET_CB_ENABLE:
+	return netna_set_accept_callback_enable(acc, nadata, val1, done);
+
+    case GENSIO_BASE_ACC_FREE:
+	netna_free(acc, nadata);
+	return 0;
+
+    case GENSIO_BASE_ACC_DISABLE:
+	nadata->o->clear_fd_handlers_norpt(nadata->handoff_iod);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct gensio_enum_val affinity_enums[] = {
+    { "off",	NET_AFFINITY_OFF },
+    { "cpu",	NET_AFFINITY_CPU },
+    { "rr",	NET_AFFINITY_RR },
+    { NULL }
+};
+
 #ifdef HAVE_TCPD_H
 static struct gensio_enum_val tcpd_enums[] = {
     { "on",	GENSIO_TCPD_ON },
@@ -1156,9 +2763,20 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
 {
     struct netna_data *nadata;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
-    bool nodelay = false;
+    bool nodelay = false, timestamps = false, fastopen = false;
+    bool zerocopy = false;
     bool istcp = strcmp(type, "tcp") == 0;
     bool reuseaddr = istcp ? true : false;
+    unsigned int reuseport = 0;
+    unsigned int fastopen_qlen = 0;
+    unsigned int notsent_lowat = 0;
+    int affinity = NET_AFFINITY_OFF;
+    unsigned int accept_budget = 16;
+    unsigned int read_budget = 1;
+    gensiods readbuf_min = 0;
+    gensiods co_size = 0;
+    gensio_time co_time = { 0, 0 };
+    bool lowprio = false;
 #if HAVE_UNIX
     unsigned int umode = 6, gmode = 6, omode = 6, mode;
     bool mode_set = false;
@@ -1196,14 +2814,64 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_pparm_uint(&p, args[i], "accept-budget",
+			      &accept_budget) > 0) {
+	    if (accept_budget == 0) {
+		gensio_pparm_slog(&p, "accept-budget cannot be zero");
+		return GE_INVAL;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_uint(&p, args[i], "read-budget", &read_budget) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, args[i], "readbuf-min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "lowprio", &lowprio) > 0)
+	    continue;
 	if (istcp && gensio_pparm_bool(&p, args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "timestamps",
+				       &timestamps) > 0)
+	    continue;
+	if (istcp && gensio_pparm_bool(&p, args[i], "tfo",
+				       &fastopen) > 0)
+	    continue;
+	if (istcp && gensio_pparm_uint(&p, args[i], "tfo-qlen",
+				       &fastopen_qlen) > 0) {
+	    if (fastopen_qlen > 65535) {
+		gensio_pparm_slog(&p, "tfo-qlen must be 65535 or less");
+		return GE_INVAL;
+	    }
+	    continue;
+	}
+	if (istcp && gensio_pparm_bool(&p, args[i], "zerocopy",
+				       &zerocopy) > 0)
+	    continue;
+	if (istcp && gensio_pparm_uint(&p, args[i], "notsent-lowat",
+				       &notsent_lowat) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, args[i], "coalesce", &co_size) > 0)
+	    continue;
+	if (gensio_pparm_time(&p, args[i], "coalesce-time", 'm',
+			      &co_time) > 0)
+	    continue;
 	if (!istcp &&
 		gensio_pparm_bool(&p, args[i], "delsock", &reuseaddr) > 0)
 	    continue;
 	if (istcp &&
 		gensio_pparm_bool(&p, args[i], "reuseaddr", &reuseaddr) > 0)
 	    continue;
+	if (gensio_pparm_enum(&p, args[i], "affinity", affinity_enums,
+			      &affinity) > 0)
+	    continue;
+	if (istcp &&
+		gensio_pparm_uint(&p, args[i], "reuseport", &reuseport) > 0) {
+	    if (reuseport > 255) {
+		gensio_pparm_slog(&p, "reuseport must be 255 or less");
+		return GE_INVAL;
+	    }
+	    continue;
+	}
 #ifdef HAVE_TCPD_H
 	if (istcp && gensio_pparm_value(&p, args[i], "tcpdname", &tcpdname))
 	    continue;
@@ -1250,6 +2918,17 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     err = GE_NOMEM;
     if (reuseaddr)
 	nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEADDR;
+    nadata->reuseport = reuseport;
+    nadata->affinity = affinity;
+    nadata->accept_budget = accept_budget;
+    nadata->read_budget = read_budget;
+    nadata->readbuf_min = readbuf_min;
+    nadata->lowprio = lowprio;
+    if (reuseport)
+	nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEPORT(reuseport);
+    if (fastopen || fastopen_qlen)
+	nadata->opensock_flags |= (GENSIO_OPENSOCK_FASTOPEN |
+				   GENSIO_OPENSOCK_FASTOPEN_QLEN(fastopen_qlen));
 #if HAVE_UNIX
     nadata->mode_set = mode_set;
     nadata->mode = umode << 6 | gmode << 3 | omode;
@@ -1283,6 +2962,11 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     if (!nadata->cb_en_done_runner)
 	goto out_err;
 
+    nadata->overload_timer = o->alloc_timer(o, netna_overload_timeout,
+					    nadata);
+    if (!nadata->overload_timer)
+	goto out_err;
+
     nadata->istcp = istcp;
 
     err = base_gensio_accepter_alloc(NULL, netna_base_acc_op, nadata,
@@ -1294,6 +2978,11 @@ net_gensio_accepter_alloc(const struct gensio_addr *iai,
     gensio_acc_set_is_reliable(nadata->acc, true);
     nadata->max_read_size = max_read_size;
     nadata->nodelay = nodelay;
+    nadata->timestamps = timestamps;
+    nadata->zerocopy = zerocopy;
+    nadata->notsent_lowat = notsent_lowat;
+    nadata->co_size = co_size;
+    nadata->co_time = co_time;
 
     return 0;
 
@@ -1380,6 +3069,121 @@ str_to_unix_gensio_accepter(const char *str, const char * const args[],
 				      "unix", o, cb, user_data, acc);
 }
 
+static int
+handoff_gensio_accepter_alloc(const void *gdata,
+			      const char * const args[],
+			      struct gensio_os_funcs *o,
+			      gensio_accepter_event cb, void *user_data,
+			      struct gensio_accepter **accepter)
+{
+#if HAVE_UNIX
+    int fd = *((const int *) gdata);
+    struct netna_data *nadata;
+    gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    unsigned int accept_budget = 16;
+    unsigned int read_budget = 1;
+    gensiods readbuf_min = 0;
+    gensiods co_size = 0;
+    gensio_time co_time = { 0, 0 };
+    bool zerocopy = false, lowprio = false;
+    unsigned int i;
+    int err;
+    GENSIO_DECLARE_PPACCEPTER(p, o, cb, "handoff", user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
+	    continue;
+	if (gensio_pparm_uint(&p, args[i], "accept-budget",
+			      &accept_budget) > 0) {
+	    if (accept_budget == 0) {
+		gensio_pparm_slog(&p, "accept-budget cannot be zero");
+		return GE_INVAL;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_uint(&p, args[i], "read-budget", &read_budget) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, args[i], "readbuf-min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "zerocopy", &zerocopy) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "lowprio", &lowprio) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, args[i], "coalesce", &co_size) > 0)
+	    continue;
+	if (gensio_pparm_time(&p, args[i], "coalesce-time", 'm',
+			      &co_time) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    nadata = o->zalloc(o, sizeof(*nadata));
+    if (!nadata)
+	return GE_NOMEM;
+    nadata->o = o;
+    nadata->accept_budget = accept_budget;
+    nadata->read_budget = read_budget;
+    nadata->readbuf_min = readbuf_min;
+    nadata->lowprio = lowprio;
+
+    err = o->add_iod(o, GENSIO_IOD_SOCKET, fd, &nadata->handoff_iod);
+    if (err)
+	goto out_err;
+    err = o->set_non_blocking(nadata->handoff_iod);
+    if (err)
+	goto out_err;
+
+    err = GE_NOMEM;
+    nadata->lock = o->alloc_lock(o);
+    if (!nadata->lock)
+	goto out_err;
+
+    nadata->cb_en_done_runner = o->alloc_runner(o, netna_cb_en_done, nadata);
+    if (!nadata->cb_en_done_runner)
+	goto out_err;
+
+    err = base_gensio_accepter_alloc(NULL, netna_handoff_acc_op, nadata,
+				     o, "handoff", cb, user_data, accepter);
+    if (err)
+	goto out_err;
+
+    nadata->acc = *accepter;
+    gensio_acc_set_is_reliable(nadata->acc, true);
+    nadata->max_read_size = max_read_size;
+    nadata->zerocopy = zerocopy;
+    nadata->co_size = co_size;
+    nadata->co_time = co_time;
+
+    return 0;
+
+ out_err:
+    netna_free(NULL, nadata);
+    return err;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+static int
+str_to_handoff_gensio_accepter(const char *str, const char * const args[],
+			       struct gensio_os_funcs *o,
+			       gensio_accepter_event cb,
+			       void *user_data,
+			       struct gensio_accepter **acc)
+{
+    char *end;
+    long fd;
+    int ifd;
+
+    fd = strtol(str, &end, 0);
+    if (end == str || *end || fd < 0 || fd > INT_MAX)
+	return GE_INVAL;
+    ifd = fd;
+
+    return handoff_gensio_accepter_alloc(&ifd, args, o, cb, user_data, acc);
+}
+
 int
 gensio_init_net(struct gensio_os_funcs *o)
 {
@@ -1399,5 +3203,9 @@ gensio_init_net(struct gensio_os_funcs *o)
 				  unix_gensio_accepter_alloc);
     if (rv)
 	return rv;
+    rv = register_gensio_accepter(o, "handoff", str_to_handoff_gensio_accepter,
+				  handoff_gensio_accepter_alloc);
+    if (rv)
+	return rv;
     return 0;
 }
@@ -58,9 +58,13 @@ const char *gensio_get_progname(void)
 #include <errno.h>
 #include <ifaddrs.h>
 #include <netinet/in.h>
+#include <gensio/gensio_unix.h>
 #include <net/if.h>
 #include <limits.h>
 #include <dlfcn.h>
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
 
 int
 gensio_unix_os_setupnewprog(void)
@@ -143,6 +147,7 @@ gensio_os_open_listen_sockets(struct gensio_os_funcs *o,
 {
     struct gensio_opensocks *fds;
     unsigned int nr_fds, i;
+    unsigned int copies = GENSIO_OPENSOCK_GET_REUSEPORT(opensock_flags);
     int rv;
 
     rv = o->open_listen_sockets(o, addr, call_b4_listen, data,
@@ -151,6 +156,13 @@ gensio_os_open_listen_sockets(struct gensio_os_funcs *o,
 	return rv;
 
     for (i = 0; i < nr_fds; i++) {
+	/*
+	 * Put each reuseport copy of an address on its own shard.
+	 * Failure just means the os funcs aren't sharded.
+	 */
+	if (copies > 1)
+	    o->iod_control(fds[i].iod, GENSIO_IOD_CONTROL_SHARD, false,
+			   i % copies);
 	rv = o->set_fd_handlers(fds[i].iod, data,
 				readhndlr, writehndlr, NULL,
 				fd_handler_cleared);
@@ -966,9 +978,17 @@ gensio_win_commport_control(struct gensio_os_funcs *o, int op, bool get,
 	break;
 
     case GENSIO_IOD_CONTROL_RS485:
+    case GENSIO_IOD_CONTROL_MODEMSTATE_WAIT:
+    case GENSIO_IOD_CONTROL_LOW_LATENCY:
 	rv = GE_NOTSUP;
 	break;
 
+    case GENSIO_IOD_CONTROL_EXCL_LOCK:
+	/* COM ports are opened without sharing, they are already locked. */
+	if (get)
+	    *((int *) val) = 1;
+	break;
+
     case GENSIO_IOD_CONTROL_IXONXOFF:
 	if (get) {
 	    *((int *) val) = t->fInX;
@@ -2338,6 +2358,7 @@ gensio_os_loadlib(struct gensio_os_funcs *o, const char *name)
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 
 struct stdio_mode {
     int orig_file_flags;
@@ -2385,7 +2406,7 @@ gensio_unix_do_cleanup_nonblock(struct gensio_os_funcs *o, int fd,
     *m = NULL;
 }
 
-#if HAVE_DECL_TIOCSRS485
+#if HAVE_DECL_TIOCSRS485 || defined(__linux__)
 #include <linux/serial.h>
 #endif
 
@@ -2399,15 +2420,27 @@ typedef struct termios2 g_termios;
 typedef struct termios g_termios;
 #endif
 
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+#define HAVE_SERIAL_LOW_LATENCY 1
+#include <sys/sysmacros.h>
+#endif
+
 struct gensio_unix_termios {
     g_termios orig_termios;
     int orig_mctl;
     g_termios curr_termios;
     bool break_set;
+    bool excl_set; /* flock and TIOCEXCL are held. */
 #if HAVE_DECL_TIOCSRS485
     bool rs485_applied;
     struct serial_rs485 rs485;
 #endif
+#ifdef HAVE_SERIAL_LOW_LATENCY
+    /* Restored at cleanup if low_latency_set is true. */
+    bool low_latency_set;
+    int orig_serial_flags;
+    int orig_rx_trig; /* -1 if the rx trigger can't be set. */
+#endif
 };
 
 #ifdef HAVE_TERMIOS2
@@ -2557,12 +2590,120 @@ gensio_unix_setup_termios(struct gensio_os_funcs *o, int fd,
     return 0;
 }
 
+#ifdef HAVE_SERIAL_LOW_LATENCY
+/*
+ * The UART receive FIFO trigger level is only available through
+ * sysfs on Linux, find it from the device number.
+ */
+static void
+rx_trig_path(int fd, char *path, size_t len)
+{
+    struct stat st;
+
+    path[0] = '\0';
+    if (fstat(fd, &st) == -1 || !S_ISCHR(st.st_mode))
+	return;
+    snprintf(path, len, "/sys/dev/char/%u:%u/rx_trig_bytes",
+	     major(st.st_rdev), minor(st.st_rdev));
+}
+
+static int
+get_rx_trig(int fd)
+{
+    char path[64], buf[16];
+    int tfd, val = -1;
+    ssize_t len;
+
+    rx_trig_path(fd, path, sizeof(path));
+    if (!path[0])
+	return -1;
+    tfd = open(path, O_RDONLY);
+    if (tfd == -1)
+	return -1;
+    len = read(tfd, buf, sizeof(buf) - 1);
+    if (len > 0) {
+	buf[len] = '\0';
+	val = strtol(buf, NULL, 10);
+    }
+    close(tfd);
+    return val;
+}
+
+static void
+set_rx_trig(int fd, int val)
+{
+    char path[64], buf[16];
+    int tfd, len;
+
+    rx_trig_path(fd, path, sizeof(path));
+    if (!path[0])
+	return;
+    tfd = open(path, O_WRONLY);
+    if (tfd == -1)
+	return;
+    len = snprintf(buf, sizeof(buf), "%d", val);
+    /* The driver rounds this to a level the UART supports. */
+    if (write(tfd, buf, len) == -1)
+	;
+    close(tfd);
+}
+
+static int
+set_low_latency(struct gensio_os_funcs *o, struct gensio_unix_termios *t,
+		int fd, bool enable)
+{
+    struct serial_struct ss;
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) == -1) {
+	if (errno == ENOTTY || errno == EINVAL)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, errno);
+    }
+    if (!t->low_latency_set) {
+	t->orig_serial_flags = ss.flags;
+	t->orig_rx_trig = get_rx_trig(fd);
+	t->low_latency_set = true;
+    }
+    if (enable)
+	ss.flags |= ASYNC_LOW_LATENCY;
+    else
+	ss.flags &= ~ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &ss) == -1)
+	return gensio_os_err_to_err(o, errno);
+    if (t->orig_rx_trig > 0)
+	set_rx_trig(fd, enable ? 1 : t->orig_rx_trig);
+    return 0;
+}
+
+static void
+restore_low_latency(struct gensio_unix_termios *t, int fd)
+{
+    struct serial_struct ss;
+
+    if (!t->low_latency_set)
+	return;
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+	ss.flags &= ~ASYNC_LOW_LATENCY;
+	ss.flags |= t->orig_serial_flags & ASYNC_LOW_LATENCY;
+	ioctl(fd, TIOCSSERIAL, &ss);
+    }
+    if (t->orig_rx_trig > 0)
+	set_rx_trig(fd, t->orig_rx_trig);
+}
+#endif
+
 void
 gensio_unix_cleanup_termios(struct gensio_os_funcs *o,
 			    struct gensio_unix_termios **it, int fd)
 {
     if (!*it)
 	return;
+#ifdef HAVE_SERIAL_LOW_LATENCY
+    restore_low_latency(*it, fd);
+#endif
+    if ((*it)->excl_set)
+	/* The flock goes away with the close, but TIOCEXCL may not. */
+	ioctl(fd, TIOCNXCL);
     ioctl(fd, TIOCMSET, &(*it)->orig_mctl);
     set_termios(fd, &(*it)->orig_termios);
     o->free(o, *it);
@@ -2770,6 +2911,8 @@ gensio_unix_termios_control(struct gensio_os_funcs *o, int op, bool get,
     case GENSIO_IOD_CONTROL_RS485:
     case GENSIO_IOD_CONTROL_APPLY:
     case GENSIO_IOD_CONTROL_SET_BREAK:
+    case GENSIO_IOD_CONTROL_LOW_LATENCY:
+    case GENSIO_IOD_CONTROL_EXCL_LOCK:
 	rv = gensio_unix_setup_termios(o, fd, it);
 	if (rv)
 	    return rv;
@@ -2976,6 +3119,49 @@ gensio_unix_termios_control(struct gensio_os_funcs *o, int op, bool get,
 	rv = process_rs485(o, t, fd, (const char *) val);
 	break;
 
+    case GENSIO_IOD_CONTROL_LOW_LATENCY:
+#ifdef HAVE_SERIAL_LOW_LATENCY
+	if (get) {
+	    struct serial_struct ss;
+
+	    if (ioctl(fd, TIOCGSERIAL, &ss) == -1) {
+		if (errno == ENOTTY || errno == EINVAL)
+		    return GE_NOTSUP;
+		return gensio_os_err_to_err(o, errno);
+	    }
+	    *((int *) val) = !!(ss.flags & ASYNC_LOW_LATENCY);
+	} else {
+	    rv = set_low_latency(o, t, fd, val);
+	}
+#else
+	rv = GE_NOTSUP;
+#endif
+	break;
+
+    case GENSIO_IOD_CONTROL_EXCL_LOCK:
+	if (get) {
+	    *((int *) val) = t->excl_set;
+	} else if (!val) {
+	    if (t->excl_set) {
+		ioctl(fd, TIOCNXCL);
+		flock(fd, LOCK_UN);
+		t->excl_set = false;
+	    }
+	} else if (!t->excl_set) {
+	    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		if (errno == EWOULDBLOCK)
+		    return GE_INUSE;
+		return gensio_os_err_to_err(o, errno);
+	    }
+	    if (ioctl(fd, TIOCEXCL) == -1) {
+		rv = gensio_os_err_to_err(o, errno);
+		flock(fd, LOCK_UN);
+		return rv;
+	    }
+	    t->excl_set = true;
+	}
+	break;
+
     case GENSIO_IOD_CONTROL_APPLY:
 	rv = set_termios(fd, &t->curr_termios);
 	if (rv) {
@@ -3136,6 +3322,89 @@ gensio_unix_get_bufcount(struct gensio_os_funcs *o,
 
 extern char **environ;
 
+/*
+ * posix_spawn() can only be used if it can close everything but
+ * stdio in the child like the fork code does.
+ */
+#if defined(HAVE_POSIX_SPAWN) && \
+	(defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP) || \
+	 defined(POSIX_SPAWN_CLOEXEC_DEFAULT))
+#define GENSIO_USE_POSIX_SPAWN
+#endif
+
+#ifdef GENSIO_USE_POSIX_SPAWN
+/*
+ * Start the program with posix_spawn() if the child doesn't need
+ * anything it can't do.  posix_spawn() uses vfork() or
+ * clone(CLONE_VM | CLONE_VFORK), so the page tables of a large
+ * process are not copied and other threads are not held up like with
+ * fork().  Returns false if the fork code must be used.  That
+ * includes when the spawn fails, the fork code then reports the
+ * failure the way it always has.
+ */
+static bool
+unix_spawn_exec(const char *argv[], const char **env, const char *start_dir,
+		unsigned int flags, int stdinpipe[2], int stdoutpipe[2],
+		int stderrpipe[2], bool do_stderr, int *rpid)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int rv;
+
+    if (getuid() != geteuid())
+	/* Needs gensio_unix_os_setupnewprog(). */
+	return false;
+    if (env && !strchr(argv[0], '/'))
+	/*
+	 * execvp() searches the PATH in the new environment,
+	 * posix_spawnp() searches ours.
+	 */
+	return false;
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+    if (start_dir)
+	return false;
+#endif
+
+    if (posix_spawn_file_actions_init(&fa))
+	return false;
+    if (posix_spawnattr_init(&attr)) {
+	posix_spawn_file_actions_destroy(&fa);
+	return false;
+    }
+    rv = posix_spawn_file_actions_adddup2(&fa, stdinpipe[0], 0);
+    if (!rv)
+	rv = posix_spawn_file_actions_adddup2(&fa, stdoutpipe[1], 1);
+    if (!rv) {
+	if (flags & GENSIO_EXEC_STDERR_TO_STDOUT)
+	    rv = posix_spawn_file_actions_adddup2(&fa, stdoutpipe[1], 2);
+	else if (do_stderr)
+	    rv = posix_spawn_file_actions_adddup2(&fa, stderrpipe[1], 2);
+    }
+    /* Close everything but stdio. */
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+    if (!rv)
+	rv = posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+#else
+    if (!rv)
+	rv = posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT);
+#endif
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+    if (!rv && start_dir)
+	rv = posix_spawn_file_actions_addchdir_np(&fa, start_dir);
+#endif
+    if (!rv)
+	rv = posix_spawnp(&pid, argv[0], &fa, &attr, (char * const *) argv,
+			  env ? (char * const *) env : environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (rv)
+	return false;
+    *rpid = pid;
+    return true;
+}
+#endif
+
 int
 gensio_unix_do_exec(struct gensio_os_funcs *o,
 		    const char *argv[], const char **env,
@@ -3173,6 +3442,12 @@ gensio_unix_do_exec(struct gensio_os_funcs *o,
 	}
     }
 
+#ifdef GENSIO_USE_POSIX_SPAWN
+    if (unix_spawn_exec(argv, env, start_dir, flags, stdinpipe, stdoutpipe,
+			stderrpipe, rerr != NULL, &pid))
+	goto started;
+#endif
+
     pid = fork();
     if (pid < 0) {
 	err = errno;
@@ -3215,6 +3490,9 @@ gensio_unix_do_exec(struct gensio_os_funcs *o,
 	exit(1); /* Only reached on error. */
     }
 
+#ifdef GENSIO_USE_POSIX_SPAWN
+ started:
+#endif
     close(stdinpipe[0]);
     close(stdoutpipe[1]);
     if (rerr)
@@ -3749,6 +4027,57 @@ gensio_i_free(struct gensio_memtrack *m, void *data)
 
 #endif /* ENABLE_INTERNAL_TRACE */
 
+/* Count allocations from the wrappers below for their callers. */
+#if _MSC_VER
+#define alloc_set_caller() gensio_allocstats_set_caller(_ReturnAddress())
+#else
+#define alloc_set_caller() \
+    gensio_allocstats_set_caller(__builtin_return_address(0))
+#endif
+
+void *
+gensio_os_buf_alloc(struct gensio_os_funcs *o, gensiods size)
+{
+    alloc_set_caller();
+    if (o->buf_alloc)
+	return o->buf_alloc(o, size);
+    return o->zalloc(o, size);
+}
+
+void
+gensio_os_buf_free(struct gensio_os_funcs *o, void *buf)
+{
+    if (o->buf_free)
+	o->buf_free(o, buf);
+    else
+	o->free(o, buf);
+}
+
+gensiods
+gensio_os_readbuf_reserve(struct gensio_os_funcs *o, gensiods size,
+			  gensiods min)
+{
+    if (o->readbuf_reserve)
+	return o->readbuf_reserve(o, size, min);
+    return size;
+}
+
+void
+gensio_os_readbuf_release(struct gensio_os_funcs *o, gensiods size)
+{
+    if (o->readbuf_release)
+	o->readbuf_release(o, size);
+}
+
+bool
+gensio_os_overloaded(struct gensio_os_funcs *o, unsigned int policy,
+		     gensio_time *recheck)
+{
+    if (o->overloaded)
+	return o->overloaded(o, policy, recheck);
+    return false;
+}
+
 void
 gensio_os_funcs_set_vlog(struct gensio_os_funcs *o, gensio_vlog_func func)
 {
@@ -3770,6 +4099,7 @@ gensio_os_funcs_free(struct gensio_os_funcs *o)
 void *
 gensio_os_funcs_zalloc(struct gensio_os_funcs *o, gensiods size)
 {
+    alloc_set_caller();
     return o->zalloc(o, size);
 }
 
@@ -3859,6 +4189,15 @@ gensio_os_funcs_get_monotonic_time(struct gensio_os_funcs *o,
     o->get_monotonic_time(o, time);
 }
 
+void
+gensio_os_funcs_get_loop_time(struct gensio_os_funcs *o, gensio_time *time)
+{
+    if (o->get_loop_time)
+	o->get_loop_time(o, time);
+    else
+	o->get_monotonic_time(o, time);
+}
+
 struct gensio_timer *
 gensio_os_funcs_alloc_timer(struct gensio_os_funcs *o,
 			    void (*handler)(struct gensio_timer *t,
@@ -3890,6 +4229,17 @@ int gensio_os_funcs_start_timer_abs(struct gensio_os_funcs *o,
     return o->start_timer_abs(timer, timeout);
 }
 
+int
+gensio_os_funcs_start_timer_slack(struct gensio_os_funcs *o,
+				  struct gensio_timer *timer,
+				  gensio_time *timeout,
+				  gensio_time *slack)
+{
+    if (o->start_timer_slack)
+	return o->start_timer_slack(timer, timeout, slack);
+    return o->start_timer(timer, timeout);
+}
+
 int
 gensio_os_funcs_stop_timer(struct gensio_os_funcs *o,
 			   struct gensio_timer *timer)
@@ -3936,6 +4286,111 @@ gensio_os_funcs_service(struct gensio_os_funcs *o, gensio_time *timeout)
     return o->service(o, timeout);
 }
 
+struct gensio_os_pool_thread {
+    struct gensio_os_funcs *o;
+    unsigned int idx;
+    struct gensio_thread *tid;
+    struct gensio_waiter *waiter;
+};
+
+struct gensio_os_thread_pool {
+    struct gensio_os_funcs *o;
+    unsigned int nr_threads;
+    struct gensio_os_pool_thread *threads;
+};
+
+static void
+gensio_os_pool_thread_func(void *data)
+{
+    struct gensio_os_pool_thread *t = data;
+
+#ifndef _WIN32
+    /*
+     * With sharded unix os funcs, thread i services shard i, so its
+     * shard is known and matches the CPU it is pinned to.
+     */
+    gensio_unix_funcs_bind_shard(t->o, t->idx);
+#endif
+
+    /* Service until gensio_os_thread_pool_stop() wakes us. */
+    t->o->wait(t->waiter, 1, NULL);
+}
+
+void
+gensio_os_thread_pool_stop(struct gensio_os_thread_pool *pool)
+{
+    struct gensio_os_funcs *o = pool->o;
+    struct gensio_os_pool_thread *t;
+    unsigned int i;
+
+    for (i = 0; i < pool->nr_threads; i++) {
+	t = &pool->threads[i];
+	if (t->tid)
+	    o->wake(t->waiter);
+    }
+    for (i = 0; i < pool->nr_threads; i++) {
+	t = &pool->threads[i];
+	if (t->tid)
+	    gensio_os_wait_thread(t->tid);
+	if (t->waiter)
+	    o->free_waiter(t->waiter);
+    }
+    o->free(o, pool->threads);
+    o->free(o, pool);
+}
+
+int
+gensio_os_thread_pool_start(struct gensio_os_funcs *o,
+			    unsigned int nr_threads,
+			    const unsigned int *cpus, unsigned int nr_cpus,
+			    struct gensio_os_thread_pool **rpool)
+{
+    struct gensio_os_thread_pool *pool;
+    struct gensio_os_pool_thread *t;
+    unsigned int i;
+    int rv;
+
+    if (nr_threads == 0 || (cpus && nr_cpus == 0))
+	return GE_INVAL;
+
+    pool = o->zalloc(o, sizeof(*pool));
+    if (!pool)
+	return GE_NOMEM;
+    pool->o = o;
+    pool->threads = o->zalloc(o, sizeof(*pool->threads) * nr_threads);
+    if (!pool->threads) {
+	o->free(o, pool);
+	return GE_NOMEM;
+    }
+    pool->nr_threads = nr_threads;
+
+    for (i = 0; i < nr_threads; i++) {
+	t = &pool->threads[i];
+	t->o = o;
+	t->idx = i;
+	t->waiter = o->alloc_waiter(o);
+	if (!t->waiter) {
+	    rv = GE_NOMEM;
+	    goto out_err;
+	}
+	rv = gensio_os_new_thread(o, gensio_os_pool_thread_func, t, &t->tid);
+	if (rv)
+	    goto out_err;
+	if (cpus) {
+	    rv = gensio_os_thread_set_cpu(t->tid, cpus[i % nr_cpus]);
+	    if (rv)
+		goto out_err;
+	}
+    }
+
+    *rpool = pool;
+    return 0;
+
+ out_err:
+    gensio_os_thread_pool_stop(pool);
+    return rv;
+}
+
 int
 gensio_os_funcs_handle_fork(struct gensio_os_funcs *o)
 {
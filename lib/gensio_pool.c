@@ -0,0 +1,787 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * This code is for a gensio that keeps closed connections open in a
+ * pool so the next open of the same child string can reuse them
+ * without connecting and doing the handshake again.
+ *
+ * There is one pool for each os funcs and child string.  A pooled
+ * child has its read callback enabled; if anything comes in on it
+ * (data, a remote close, an error) it is no longer clean and is closed
+ * and dropped from the pool.  An open takes the most recently used
+ * child from the pool or opens a new one.  A close puts the child back
+ * in the pool if no errors were seen on it and the pool is not full,
+ * otherwise the child is really closed.  Pooled children that are not
+ * used within the idle timeout are closed.
+ *
+ * The pools are protected by pool_lock.  The lock order is the pool
+ * gensio's lock, then pool_lock.
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_list.h>
+#include <gensio/gensio_time.h>
+
+struct pool_child {
+    struct gensio_link link;
+    struct gensio *io;
+    /* When to close this child if it hasn't been used. */
+    gensio_time expire;
+};
+
+struct pool_entry {
+    struct gensio_link link;
+    struct gensio_os_funcs *o;
+    char *str;
+
+    /* Idle children, the most recently used at the end. */
+    struct gensio_list idle;
+    unsigned int nr_idle;
+
+    struct gensio_timer *timer;
+    bool timer_running;
+};
+
+static struct gensio_os_funcs *pool_o;
+static struct gensio_lock *pool_lock;
+static struct gensio_list pool_entries;
+
+enum pooln_state {
+    POOLN_CLOSED,
+    POOLN_IN_OPEN,
+    POOLN_IN_OPEN_CLOSE,
+    POOLN_OPEN,
+    POOLN_IN_CLOSE
+};
+
+struct pooln_data {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio *io;
+    unsigned int refcount;
+    enum pooln_state state;
+
+    char *str;
+    unsigned int max;
+    gensio_time idle_time;
+
+    /* The current child, only set while open or opening. */
+    struct gensio *child;
+    /* The child had an error, don't reuse it. */
+    bool child_err;
+
+    bool read_enabled;
+    bool xmit_enabled;
+
+    gensio_done_err open_done;
+    void *open_data;
+    bool open_report;
+
+    gensio_done close_done;
+    void *close_data;
+    bool close_report;
+
+    bool deferred_pending;
+    struct gensio_runner *deferred_runner;
+};
+
+static void
+pool_child_close_done(struct gensio *io, void *close_data)
+{
+    gensio_free(io);
+}
+
+/* Get rid of a child that isn't going back in a pool. */
+static void
+pool_close_child(struct gensio *io)
+{
+    gensio_set_read_callback_enable(io, false);
+    gensio_set_write_callback_enable(io, false);
+    if (gensio_close(io, pool_child_close_done, NULL))
+	gensio_free(io);
+}
+
+static void
+pool_start_timer(struct pool_entry *e, gensio_time *now)
+{
+    struct gensio_link *l;
+    gensio_time timeout = { 0, 0 };
+    int64_t diff, min = -1;
+
+    gensio_list_for_each(&e->idle, l) {
+	struct pool_child *pc = gensio_container_of(l, struct pool_child,
+						    link);
+
+	diff = gensio_time_diff_nsecs(&pc->expire, now);
+	if (min < 0 || diff < min)
+	    min = diff;
+    }
+    if (min < 0)
+	return;
+    if (min > 0)
+	gensio_time_add_nsecs(&timeout, min);
+    if (e->o->start_timer(e->timer, &timeout) == 0)
+	e->timer_running = true;
+}
+
+static void
+pool_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct pool_entry *e = cb_data;
+    struct gensio_link *l, *l2;
+    gensio_time now;
+
+    e->o->get_monotonic_time(e->o, &now);
+    e->o->lock(pool_lock);
+    e->timer_running = false;
+    gensio_list_for_each_safe(&e->idle, l, l2) {
+	struct pool_child *pc = gensio_container_of(l, struct pool_child,
+						    link);
+
+	if (gensio_time_diff_nsecs(&pc->expire, &now) <= 0) {
+	    gensio_list_rm(&e->idle, &pc->link);
+	    e->nr_idle--;
+	    pool_close_child(pc->io);
+	    e->o->free(e->o, pc);
+	}
+    }
+    pool_start_timer(e, &now);
+    e->o->unlock(pool_lock);
+}
+
+/*
+ * Something came in on an idle child, it is stale.  If it's not in
+ * the pool any more it was just taken, leave the data for the new
+ * owner.
+ */
+static int
+pool_idle_event(struct gensio *io, void *user_data, int event, int err,
+		unsigned char *buf, gensiods *buflen,
+		const char *const *auxdata)
+{
+    struct pool_entry *e = user_data;
+    struct gensio_link *l;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    e->o->lock(pool_lock);
+    gensio_list_for_each(&e->idle, l) {
+	struct pool_child *pc = gensio_container_of(l, struct pool_child,
+						    link);
+
+	if (pc->io == io) {
+	    gensio_list_rm(&e->idle, &pc->link);
+	    e->nr_idle--;
+	    e->o->free(e->o, pc);
+	    pool_close_child(io);
+	    e->o->unlock(pool_lock);
+	    return 0;
+	}
+    }
+    e->o->unlock(pool_lock);
+    if (buflen)
+	*buflen = 0;
+    return 0;
+}
+
+/* Find the pool for the string, or make one.  pool_lock must be held. */
+static struct pool_entry *
+pool_get_entry(struct gensio_os_funcs *o, const char *str)
+{
+    struct pool_entry *e;
+    struct gensio_link *l;
+
+    gensio_list_for_each(&pool_entries, l) {
+	e = gensio_container_of(l, struct pool_entry, link);
+	if (e->o == o && strcmp(e->str, str) == 0)
+	    return e;
+    }
+
+    e = o->zalloc(o, sizeof(*e));
+    if (!e)
+	return NULL;
+    e->o = o;
+    gensio_list_init(&e->idle);
+    e->str = gensio_strdup(o, str);
+    if (!e->str)
+	goto out_nomem;
+    e->timer = o->alloc_timer(o, pool_timeout, e);
+    if (!e->timer)
+	goto out_nomem;
+    gensio_list_add_tail(&pool_entries, &e->link);
+    return e;
+
+ out_nomem:
+    if (e->str)
+	o->free(o, e->str);
+    o->free(o, e);
+    return NULL;
+}
+
+/* Take a child from the pool, NULL if there isn't one. */
+static struct gensio *
+pool_take(struct pooln_data *ndata, gensio_event cb)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct pool_entry *e;
+    struct pool_child *pc;
+    struct gensio *io = NULL;
+
+    o->lock(pool_lock);
+    e = pool_get_entry(o, ndata->str);
+    if (e && e->nr_idle > 0) {
+	pc = gensio_container_of(gensio_list_last(&e->idle),
+				 struct pool_child, link);
+	gensio_list_rm(&e->idle, &pc->link);
+	e->nr_idle--;
+	io = pc->io;
+	o->free(o, pc);
+	gensio_set_read_callback_enable(io, false);
+	gensio_set_callback(io, cb, ndata);
+    }
+    o->unlock(pool_lock);
+
+    return io;
+}
+
+/* Put a child in the pool.  Returns false if it can't go in. */
+static bool
+pool_return(struct pooln_data *ndata, struct gensio *io)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct pool_entry *e;
+    struct pool_child *pc;
+    gensio_time now;
+    bool rv = false;
+
+    o->get_monotonic_time(o, &now);
+    o->lock(pool_lock);
+    e = pool_get_entry(o, ndata->str);
+    if (!e || e->nr_idle >= ndata->max)
+	goto out_unlock;
+    pc = o->zalloc(o, sizeof(*pc));
+    if (!pc)
+	goto out_unlock;
+    pc->io = io;
+    pc->expire = now;
+    gensio_time_add(&pc->expire, &ndata->idle_time);
+    gensio_set_write_callback_enable(io, false);
+    gensio_set_callback(io, pool_idle_event, e);
+    gensio_list_add_tail(&e->idle, &pc->link);
+    e->nr_idle++;
+    gensio_set_read_callback_enable(io, true);
+    if (!e->timer_running)
+	pool_start_timer(e, &now);
+    rv = true;
+ out_unlock:
+    o->unlock(pool_lock);
+
+    return rv;
+}
+
+static void
+pooln_finish_free(struct pooln_data *ndata)
+{
+    struct gensio_os_funcs *o = ndata->o;
+
+    if (ndata->io)
+	gensio_data_free(ndata->io);
+    if (ndata->child)
+	gensio_free(ndata->child);
+    if (ndata->deferred_runner)
+	o->free_runner(ndata->deferred_runner);
+    if (ndata->str)
+	o->free(o, ndata->str);
+    if (ndata->lock)
+	o->free_lock(ndata->lock);
+    o->free(o, ndata);
+}
+
+static void
+pooln_lock(struct pooln_data *ndata)
+{
+    ndata->o->lock(ndata->lock);
+}
+
+static void
+pooln_unlock(struct pooln_data *ndata)
+{
+    ndata->o->unlock(ndata->lock);
+}
+
+static void
+pooln_ref(struct pooln_data *ndata)
+{
+    assert(ndata->refcount > 0);
+    ndata->refcount++;
+}
+
+static void
+pooln_unlock_and_deref(struct pooln_data *ndata)
+{
+    assert(ndata->refcount > 0);
+    if (ndata->refcount == 1) {
+	pooln_unlock(ndata);
+	pooln_finish_free(ndata);
+    } else {
+	ndata->refcount--;
+	pooln_unlock(ndata);
+    }
+}
+
+static void
+pooln_start_deferred_op(struct pooln_data *ndata)
+{
+    if (!ndata->deferred_pending) {
+	ndata->deferred_pending = true;
+	pooln_ref(ndata);
+	ndata->o->run(ndata->deferred_runner);
+    }
+}
+
+static void
+pooln_call_open_done(struct pooln_data *ndata, int err)
+{
+    gensio_done_err open_done = ndata->open_done;
+
+    ndata->open_done = NULL;
+    if (open_done) {
+	pooln_unlock(ndata);
+	open_done(ndata->io, err, ndata->open_data);
+	pooln_lock(ndata);
+    }
+}
+
+static void
+pooln_call_close_done(struct pooln_data *ndata)
+{
+    gensio_done close_done = ndata->close_done;
+
+    ndata->state = POOLN_CLOSED;
+    ndata->close_done = NULL;
+    if (close_done) {
+	pooln_unlock(ndata);
+	close_done(ndata->io, ndata->close_data);
+	pooln_lock(ndata);
+    }
+}
+
+static void
+pooln_child_close_done(struct gensio *io, void *close_data)
+{
+    struct pooln_data *ndata = close_data;
+
+    pooln_lock(ndata);
+    gensio_free(io);
+    ndata->child = NULL;
+    pooln_call_close_done(ndata);
+    pooln_unlock_and_deref(ndata);
+}
+
+/*
+ * Start the close of an open child, back to the pool if we can.
+ * Must be called with the lock held.
+ */
+static void
+pooln_start_close(struct pooln_data *ndata)
+{
+    struct gensio *child = ndata->child;
+
+    ndata->state = POOLN_IN_CLOSE;
+    if (!ndata->child_err && pool_return(ndata, child)) {
+	ndata->child = NULL;
+	ndata->close_report = true;
+	pooln_start_deferred_op(ndata);
+	return;
+    }
+
+    gensio_set_read_callback_enable(child, false);
+    gensio_set_write_callback_enable(child, false);
+    if (gensio_close(child, pooln_child_close_done, ndata)) {
+	gensio_free(child);
+	ndata->child = NULL;
+	ndata->close_report = true;
+	pooln_start_deferred_op(ndata);
+    } else {
+	pooln_ref(ndata);
+    }
+}
+
+/* The child is open, report it.  Must be called with the lock held. */
+static void
+pooln_child_ready(struct pooln_data *ndata)
+{
+    if (ndata->state == POOLN_IN_OPEN_CLOSE) {
+	pooln_call_open_done(ndata, GE_LOCALCLOSED);
+	pooln_start_close(ndata);
+	return;
+    }
+    ndata->state = POOLN_OPEN;
+    gensio_set_attr_from_child(ndata->io, ndata->child);
+    gensio_set_read_callback_enable(ndata->child, ndata->read_enabled);
+    gensio_set_write_callback_enable(ndata->child, ndata->xmit_enabled);
+    pooln_call_open_done(ndata, 0);
+}
+
+static void
+pooln_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct pooln_data *ndata = cb_data;
+
+    pooln_lock(ndata);
+    ndata->deferred_pending = false;
+
+    if (ndata->open_report) {
+	ndata->open_report = false;
+	pooln_child_ready(ndata);
+    }
+
+    if (ndata->close_report) {
+	ndata->close_report = false;
+	pooln_call_close_done(ndata);
+    }
+
+    pooln_unlock_and_deref(ndata);
+}
+
+static int
+pooln_event(struct gensio *io, void *user_data, int event, int err,
+	    unsigned char *buf, gensiods *buflen,
+	    const char *const *auxdata)
+{
+    struct pooln_data *ndata = user_data;
+
+    if (event == GENSIO_EVENT_READ && err) {
+	pooln_lock(ndata);
+	ndata->child_err = true;
+	pooln_unlock(ndata);
+    }
+
+    return gensio_cb(ndata->io, event, err, buf, buflen, auxdata);
+}
+
+static void
+pooln_child_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct pooln_data *ndata = open_data;
+
+    pooln_lock(ndata);
+    if (err) {
+	gensio_free(io);
+	ndata->child = NULL;
+	if (ndata->state == POOLN_IN_OPEN_CLOSE) {
+	    pooln_call_open_done(ndata, GE_LOCALCLOSED);
+	    pooln_call_close_done(ndata);
+	} else {
+	    ndata->state = POOLN_CLOSED;
+	    pooln_call_open_done(ndata, err);
+	}
+    } else {
+	pooln_child_ready(ndata);
+    }
+    pooln_unlock_and_deref(ndata);
+}
+
+static int
+pooln_open(struct gensio *io, gensio_done_err open_done, void *open_data)
+{
+    struct pooln_data *ndata = gensio_get_gensio_data(io);
+    struct gensio *child;
+    int err = 0;
+
+    pooln_lock(ndata);
+    if (ndata->state != POOLN_CLOSED) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+
+    ndata->open_done = open_done;
+    ndata->open_data = open_data;
+    ndata->child_err = false;
+
+    child = pool_take(ndata, pooln_event);
+    if (child) {
+	ndata->child = child;
+	ndata->state = POOLN_IN_OPEN;
+	ndata->open_report = true;
+	pooln_start_deferred_op(ndata);
+	goto out_unlock;
+    }
+
+    err = str_to_gensio(ndata->str, ndata->o, pooln_event, ndata, &child);
+    if (err)
+	goto out_unlock;
+    err = gensio_open(child, pooln_child_open_done, ndata);
+    if (err) {
+	gensio_free(child);
+	goto out_unlock;
+    }
+    ndata->child = child;
+    ndata->state = POOLN_IN_OPEN;
+    pooln_ref(ndata);
+ out_unlock:
+    pooln_unlock(ndata);
+
+    return err;
+}
+
+static int
+pooln_close(struct gensio *io, gensio_done close_done, void *close_data)
+{
+    struct pooln_data *ndata = gensio_get_gensio_data(io);
+    int err = 0;
+
+    pooln_lock(ndata);
+    switch (ndata->state) {
+    case POOLN_IN_OPEN:
+	/* Finish the open first. */
+	ndata->state = POOLN_IN_OPEN_CLOSE;
+	ndata->close_done = close_done;
+	ndata->close_data = close_data;
+	break;
+
+    case POOLN_OPEN:
+	ndata->close_done = close_done;
+	ndata->close_data = close_data;
+	pooln_start_close(ndata);
+	break;
+
+    default:
+	err = GE_NOTREADY;
+    }
+    pooln_unlock(ndata);
+
+    return err;
+}
+
+static void
+pooln_free(struct gensio *io)
+{
+    struct pooln_data *ndata = gensio_get_gensio_data(io);
+
+    pooln_lock(ndata);
+    switch (ndata->state) {
+    case POOLN_IN_OPEN:
+    case POOLN_OPEN:
+	/* The close holds a ref until it is done. */
+	pooln_unlock(ndata);
+	pooln_close(io, NULL, NULL);
+	pooln_lock(ndata);
+	/* fallthrough */
+    case POOLN_IN_OPEN_CLOSE:
+	ndata->open_done = NULL;
+	/* fallthrough */
+    case POOLN_IN_CLOSE:
+	ndata->close_done = NULL;
+	break;
+
+    default:
+	break;
+    }
+    pooln_unlock_and_deref(ndata);
+}
+
+static int
+pooln_disable(struct gensio *io)
+{
+    struct pooln_data *ndata = gensio_get_gensio_data(io);
+
+    pooln_lock(ndata);
+    if (ndata->child) {
+	gensio_disable(ndata->child);
+	ndata->state = POOLN_CLOSED;
+    }
+    pooln_unlock(ndata);
+
+    return 0;
+}
+
+static int
+pool_gensio_func(struct gensio *io, int func, gensiods *count,
+		 const void *cbuf, gensiods buflen, void *buf,
+		 const char *const *auxdata)
+{
+    struct pooln_data *ndata = gensio_get_gensio_data(io);
+    struct gensio *child;
+    int err;
+
+    switch (func) {
+    case GENSIO_FUNC_OPEN:
+	return pooln_open(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return pooln_close(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	pooln_free(io);
+	return 0;
+
+    case GENSIO_FUNC_DISABLE:
+	return pooln_disable(io);
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	pooln_lock(ndata);
+	if (func == GENSIO_FUNC_SET_READ_CALLBACK)
+	    ndata->read_enabled = buflen;
+	else
+	    ndata->xmit_enabled = buflen;
+	if (ndata->state == POOLN_OPEN)
+	    gensio_call_func(ndata->child, func, count, cbuf, buflen, buf,
+			     auxdata);
+	pooln_unlock(ndata);
+	return 0;
+
+    default:
+	pooln_lock(ndata);
+	child = ndata->state == POOLN_OPEN ? ndata->child : NULL;
+	pooln_unlock(ndata);
+	if (!child)
+	    return func == GENSIO_FUNC_WRITE_SG ? GE_NOTREADY : GE_NOTSUP;
+	/* The user can't free us while they're in a call, so child stays. */
+	if (func == GENSIO_FUNC_CONTROL)
+	    /* We have no fixed child, so look through the child's stack. */
+	    return gensio_control(child, GENSIO_CONTROL_DEPTH_FIRST,
+				  *((bool *) cbuf), buflen, buf, count);
+	err = gensio_call_func(child, func, count, cbuf, buflen, buf, auxdata);
+	if (err && func == GENSIO_FUNC_WRITE_SG) {
+	    pooln_lock(ndata);
+	    ndata->child_err = true;
+	    pooln_unlock(ndata);
+	}
+	return err;
+    }
+}
+
+static int
+pool_gensio_alloc(struct gensio *child, const char * const args[],
+		  struct gensio_os_funcs *o,
+		  gensio_event cb, void *user_data,
+		  struct gensio **new_gensio)
+{
+    GENSIO_DECLARE_PPGENSIO(p, o, cb, "pool", user_data);
+
+    /* We need the string to make new children and find the pool. */
+    gensio_pparm_slog(&p, "pool requires the child as a string");
+    return GE_NOTSUP;
+}
+
+static int
+str_to_pool_gensio(const char *str, const char * const args[],
+		   struct gensio_os_funcs *o,
+		   gensio_event cb, void *user_data,
+		   struct gensio **new_gensio)
+{
+    struct pooln_data *ndata;
+    struct gensio *io2;
+    unsigned int max = 4;
+    gensio_time idle_time = { 60, 0 };
+    int i, err;
+    GENSIO_DECLARE_PPGENSIO(p, o, cb, "pool", user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_pparm_uint(&p, args[i], "max", &max) > 0)
+	    continue;
+	if (gensio_pparm_time(&p, args[i], "idle-timeout", 's',
+			      &idle_time) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    /* Report a bad child string now, not at open time. */
+    err = str_to_gensio(str, o, cb, user_data, &io2);
+    if (err)
+	return err;
+    gensio_free(io2);
+
+    ndata = o->zalloc(o, sizeof(*ndata));
+    if (!ndata)
+	return GE_NOMEM;
+    ndata->o = o;
+    ndata->refcount = 1;
+    ndata->max = max;
+    ndata->idle_time = idle_time;
+
+    ndata->str = gensio_strdup(o, str);
+    if (!ndata->str)
+	goto out_nomem;
+
+    ndata->lock = o->alloc_lock(o);
+    if (!ndata->lock)
+	goto out_nomem;
+
+    ndata->deferred_runner = o->alloc_runner(o, pooln_deferred_op, ndata);
+    if (!ndata->deferred_runner)
+	goto out_nomem;
+
+    ndata->io = gensio_data_alloc(o, cb, user_data, pool_gensio_func, NULL,
+				  "pool", ndata);
+    if (!ndata->io)
+	goto out_nomem;
+    gensio_set_is_client(ndata->io, true);
+
+    *new_gensio = ndata->io;
+    return 0;
+
+ out_nomem:
+    pooln_finish_free(ndata);
+    return GE_NOMEM;
+}
+
+static void
+gensio_pool_cleanup_mem(void)
+{
+    struct gensio_link *l, *l2, *cl, *cl2;
+
+    gensio_list_for_each_safe(&pool_entries, l, l2) {
+	struct pool_entry *e = gensio_container_of(l, struct pool_entry, link);
+
+	if (e->timer_running)
+	    e->o->stop_timer(e->timer);
+	gensio_list_for_each_safe(&e->idle, cl, cl2) {
+	    struct pool_child *pc = gensio_container_of(cl, struct pool_child,
+							link);
+
+	    gensio_list_rm(&e->idle, &pc->link);
+	    gensio_free(pc->io);
+	    e->o->free(e->o, pc);
+	}
+	gensio_list_rm(&pool_entries, &e->link);
+	e->o->free_timer(e->timer);
+	e->o->free(e->o, e->str);
+	e->o->free(e->o, e);
+    }
+    if (pool_lock)
+	pool_o->free_lock(pool_lock);
+    pool_lock = NULL;
+}
+
+static struct gensio_class_cleanup pool_class_cleanup = {
+    gensio_pool_cleanup_mem
+};
+
+int
+gensio_init_pool(struct gensio_os_funcs *o)
+{
+    pool_o = o;
+    gensio_list_init(&pool_entries);
+    pool_lock = o->alloc_lock(o);
+    if (!pool_lock)
+	return GE_NOMEM;
+    gensio_register_class_cleanup(&pool_class_cleanup);
+
+    return register_filter_gensio(o, "pool",
+				  str_to_pool_gensio, pool_gensio_alloc);
+}
@@ -35,6 +35,13 @@
 #include <windows.h>
 #endif
 
+/*
+ * Defaults for output coalescing, see the coalesce option.  The read
+ * buffer is bigger when coalescing so a burst fits in one read.
+ */
+#define PTY_DEFAULT_COALESCE_NSECS	2000000 /* 2ms */
+#define PTY_COALESCE_BUF_SIZE		16384
+
 struct pty_data {
     struct gensio_os_funcs *o;
 
@@ -631,7 +638,9 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
     const char * const *argv = gdata;
     struct pty_data *tdata = NULL;
     struct gensio *io;
-    gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods max_read_size = 0;
+    gensiods coalesce = 0;
+    gensio_time coalesce_time = { 0, PTY_DEFAULT_COALESCE_NSECS };
     unsigned int i;
 #if HAVE_PTSNAME_R
     unsigned int umode = 6, gmode = 6, omode = 6, mode;
@@ -650,6 +659,11 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_pparm_ds(&p, args[i], "coalesce", &coalesce) > 0)
+	    continue;
+	if (gensio_pparm_time(&p, args[i], "coalesce-time", 'u',
+			      &coalesce_time) > 0)
+	    continue;
 	if (gensio_pparm_value(&p, args[i], "start-dir", &start_dir) > 0)
 	    continue;
 #if HAVE_PTSNAME_R
@@ -710,6 +724,14 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
     }
 #endif
 
+    if (!max_read_size) {
+	/* Coalescing is for lots of output, give it more room. */
+	if (coalesce)
+	    max_read_size = PTY_COALESCE_BUF_SIZE;
+	else
+	    max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    }
+
     tdata = o->zalloc(o, sizeof(*tdata));
     if (!tdata)
 	return GE_NOMEM;
@@ -786,6 +808,13 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
     if (!tdata->ll)
 	goto out_nomem;
 
+    if (coalesce) {
+	err = gensio_fd_ll_set_read_coalesce(tdata->ll, coalesce,
+					     &coalesce_time);
+	if (err)
+	    goto out_err_ll;
+    }
+
     io = base_gensio_alloc(o, tdata->ll, NULL, NULL, "pty", cb, user_data);
     if (!io)
 	goto out_nomem;
@@ -800,6 +829,7 @@ pty_gensio_alloc(const void *gdata, const char * const args[],
 #if HAVE_PTSNAME_R
  out_err:
 #endif
+ out_err_ll:
     if (tdata->ll)
 	gensio_ll_free(tdata->ll);
     else
@@ -46,6 +46,8 @@ ratelimit_gensio_alloc(struct gensio *child, const char *const args[],
 	return GE_NOMEM;
     }
 
+    gensio_set_is_reliable(io, gensio_is_reliable(child));
+
     gensio_free(child); /* Lose the ref we acquired. */
 
     *net = io;
@@ -114,6 +116,9 @@ ratelimitna_new_child(void *acc_data, void **finish_data,
 static int
 ratelimitna_finish_parent(void *acc_data, void *finish_data, struct gensio *io)
 {
+    struct gensio *child = gensio_get_child(io, 0);
+
+    gensio_set_is_reliable(io, gensio_is_reliable(child));
     return 0;
 }
 
@@ -169,6 +174,7 @@ ratelimit_gensio_accepter_alloc(struct gensio_accepter *child,
 				       &nadata->acc);
     if (err)
 	goto out_err;
+    gensio_acc_set_is_reliable(nadata->acc, gensio_acc_is_reliable(child));
     *accepter = nadata->acc;
 
     return 0;
@@ -205,6 +211,9 @@ gensio_init_ratelimit(struct gensio_os_funcs *o)
 {
     int rv;
 
+    rv = gensio_ratelimit_filter_init(o);
+    if (rv)
+	return rv;
     rv = register_filter_gensio(o, "ratelimit",
 				str_to_ratelimit_gensio,
 				ratelimit_gensio_alloc);
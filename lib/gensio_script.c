@@ -12,7 +12,6 @@
 #include <gensio/gensio_class.h>
 #include <gensio/gensio_ll_gensio.h>
 #include <gensio/gensio_acc_gensio.h>
-#include <gensio/argvutils.h>
 
 #include "gensio_filter_script.h"
 
@@ -26,9 +25,15 @@ script_gensio_alloc(struct gensio *child, const char *const args[],
     struct gensio_filter *filter;
     struct gensio_ll *ll;
     struct gensio *io;
+    struct gensio_script_filter_data *data;
     GENSIO_DECLARE_PPGENSIO(p, o, cb, "script", user_data);
 
-    err = gensio_script_filter_alloc(&p, o, args, &filter);
+    err = gensio_script_filter_config(&p, o, args, &data);
+    if (err)
+	return err;
+
+    err = gensio_script_filter_alloc(data, &filter);
+    gensio_script_filter_config_free(data);
     if (err)
 	return err;
 
@@ -77,10 +82,8 @@ str_to_script_gensio(const char *str, const char * const args[],
 
 struct scriptna_data {
     struct gensio_accepter *acc;
-    const char **args;
+    struct gensio_script_filter_data *data;
     struct gensio_os_funcs *o;
-    gensio_accepter_event cb;
-    void *user_data;
 };
 
 static void
@@ -88,8 +91,8 @@ scriptna_free(void *acc_data)
 {
     struct scriptna_data *nadata = acc_data;
 
-    if (nadata->args)
-	gensio_argv_free(nadata->o, nadata->args);
+    if (nadata->data)
+	gensio_script_filter_config_free(nadata->data);
     nadata->o->free(nadata->o, nadata);
 }
 
@@ -107,10 +110,8 @@ scriptna_new_child(void *acc_data, void **finish_data,
 		   struct gensio_filter **filter)
 {
     struct scriptna_data *nadata = acc_data;
-    GENSIO_DECLARE_PPACCEPTER(p, nadata->o, nadata->cb, "script",
-			      nadata->user_data);
 
-    return gensio_script_filter_alloc(&p, nadata->o, nadata->args, filter);
+    return gensio_script_filter_alloc(nadata->data, filter);
 }
 
 static int
@@ -152,20 +153,19 @@ script_gensio_accepter_alloc(struct gensio_accepter *child,
 {
     struct scriptna_data *nadata;
     int err;
+    GENSIO_DECLARE_PPACCEPTER(p, o, cb, "script", user_data);
 
     nadata = o->zalloc(o, sizeof(*nadata));
     if (!nadata)
 	return GE_NOMEM;
 
-    err = gensio_argv_copy(o, args, NULL, &nadata->args);
+    err = gensio_script_filter_config(&p, o, args, &nadata->data);
     if (err) {
 	o->free(o, nadata);
 	return err;
     }
 
     nadata->o = o;
-    nadata->cb = cb;
-    nadata->user_data = user_data;
 
     err = gensio_gensio_accepter_alloc(child, o, "script", cb, user_data,
 				       gensio_gensio_acc_script_cb, nadata,
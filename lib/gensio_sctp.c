@@ -25,12 +25,22 @@
 #include <gensio/gensio_ll_fd.h>
 #include <gensio/argvutils.h>
 #include <gensio/gensio_osops.h>
+#include <gensio/gensio_circbuf.h>
+
+struct sctp_chan;
 
 struct sctp_data {
     struct gensio_os_funcs *o;
 
     struct gensio_ll *ll;
 
+    /*
+     * Protects the refcount and the stream channels, both the ones
+     * here and the data in each channel.
+     */
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
     struct gensio_iod *iod;
 
     struct gensio_addr *addr;
@@ -47,8 +57,70 @@ struct sctp_data {
     char **strind;
 
     const char *auxdata[3];
+
+    gensiods max_read_size;
+
+    /*
+     * Channels opened on streams, indexed by stream number.  Stream 0
+     * always goes to the main gensio, as does any stream without an
+     * open channel.  While a channel is open, messages are read here
+     * and sorted, a message for a channel with a full buffer is held
+     * in rbuf and the socket isn't read until it fits.
+     */
+    struct sctp_chan **chans;
+    unsigned int nchans;
+    unsigned int nopen_chans;
+    bool sock_closed;
+    unsigned char *rbuf;
+    bool held;
+    unsigned int held_stream;
+    gensiods held_len;
+    struct sctp_sndrcvinfo held_sinfo;
 };
 
+enum sctp_chan_state {
+    SCTP_CHAN_CLOSED,
+    SCTP_CHAN_OPEN,
+    SCTP_CHAN_IN_CLOSE
+};
+
+/*
+ * A gensio for a single stream on an sctp connection.  Data for the
+ * stream is buffered here, so a channel that isn't reading doesn't
+ * stop the other streams until its buffer fills.
+ */
+struct sctp_chan {
+    struct gensio_os_funcs *o;
+    struct sctp_data *tdata;
+    struct gensio *io;
+    unsigned int refcount;
+
+    unsigned int stream;
+    enum sctp_chan_state state;
+    bool attached; /* In tdata->chans. */
+
+    struct gensio_circbuf *rbuf;
+    int read_err;
+    bool read_enabled;
+    bool xmit_enabled;
+    bool write_blocked;
+    bool timer_running;
+
+    gensio_done_err open_done;
+    void *open_data;
+    gensio_done close_done;
+    void *close_data;
+
+    bool deferred_op_pending;
+    struct gensio_runner *deferred_op_runner;
+    struct gensio_timer *write_timer;
+};
+
+/* How long to wait to retry a channel write when the socket is full. */
+#define SCTP_CHAN_WRITE_RETRY_MS 10
+
+static void sctp_chans_fail(struct sctp_data *tdata, int err);
+
 static int
 sctp_setup(struct sctp_data *tdata)
 {
@@ -75,6 +147,20 @@ sctp_setup(struct sctp_data *tdata)
 	snprintf(tdata->strind[i], 17, "stream=%d", i);
     }
 
+    o->lock(tdata->lock);
+    /* Any channels were detached when the last connection closed. */
+    if (tdata->chans)
+	o->free(o, tdata->chans);
+    tdata->nchans = tdata->instreams;
+    if (tdata->ostreams > tdata->nchans)
+	tdata->nchans = tdata->ostreams;
+    tdata->chans = o->zalloc(o, sizeof(struct sctp_chan *) * tdata->nchans);
+    tdata->sock_closed = false;
+    tdata->held = false;
+    o->unlock(tdata->lock);
+    if (!tdata->chans)
+	return GE_NOMEM;
+
     return 0;
 }
 
@@ -155,10 +241,8 @@ sctp_sub_open(void *handler_data, struct gensio_iod **iod)
 }
 
 static void
-sctp_free(void *handler_data)
+sctp_finish_free(struct sctp_data *tdata)
 {
-    struct sctp_data *tdata = handler_data;
-
     if (tdata->addr)
 	gensio_addr_free(tdata->addr);
     if (tdata->laddr)
@@ -172,9 +256,58 @@ sctp_free(void *handler_data)
 	}
 	tdata->o->free(tdata->o, tdata->strind);
     }
+    if (tdata->chans)
+	tdata->o->free(tdata->o, tdata->chans);
+    if (tdata->rbuf)
+	tdata->o->free(tdata->o, tdata->rbuf);
+    if (tdata->lock)
+	tdata->o->free_lock(tdata->lock);
     tdata->o->free(tdata->o, tdata);
 }
 
+/* Must be called with the lock held, it's released. */
+static void
+sctp_deref_and_unlock(struct sctp_data *tdata)
+{
+    unsigned int count;
+
+    assert(tdata->refcount > 0);
+    count = --tdata->refcount;
+    tdata->o->unlock(tdata->lock);
+    if (count == 0)
+	sctp_finish_free(tdata);
+}
+
+static void
+sctp_free(void *handler_data)
+{
+    struct sctp_data *tdata = handler_data;
+
+    if (!tdata->lock) {
+	/* Failed during allocation, there can't be any channels. */
+	sctp_finish_free(tdata);
+	return;
+    }
+    tdata->o->lock(tdata->lock);
+    sctp_deref_and_unlock(tdata);
+}
+
+static int
+sctp_check_close(void *handler_data, struct gensio_iod *iod,
+		 enum gensio_ll_close_state state,
+		 gensio_time *next_timeout)
+{
+    struct sctp_data *tdata = handler_data;
+
+    if (state == GENSIO_LL_CLOSE_STATE_START) {
+	tdata->o->lock(tdata->lock);
+	tdata->sock_closed = true;
+	sctp_chans_fail(tdata, GE_LOCALCLOSED);
+	tdata->o->unlock(tdata->lock);
+    }
+    return 0;
+}
+
 static int
 sctp_control(void *handler_data, struct gensio_iod *iod, bool get, unsigned int option,
 	     char *data, gensiods *datalen)
@@ -327,6 +460,34 @@ sctp_write(void *handler_data, struct gensio_iod *iod, gensiods *rcount,
     return tdata->o->sctp_send(tdata->iod, sg, sglen, rcount, &sinfo, 0);
 }
 
+/*
+ * Fill in the auxdata for a message to the main gensio.  Returns
+ * false if the message should be dropped.
+ */
+static bool
+sctp_msg_auxdata(struct sctp_data *tdata, struct sctp_sndrcvinfo *sinfo,
+		 const char **auxdata)
+{
+    unsigned int stream = sinfo->sinfo_stream;
+    unsigned int i = 0;
+
+    /* Shouldn't happen, but just in case. */
+    assert(stream < tdata->instreams);
+
+    if (tdata->strind[stream])
+	auxdata[i++] = tdata->strind[stream];
+
+    if (sinfo->sinfo_flags && SCTP_UNORDERED) {
+	if (!tdata->do_oob)
+	    return false;
+	auxdata[i++] = "oob";
+    }
+
+    auxdata[i] = NULL;
+
+    return true;
+}
+
 static int
 sctp_do_read(struct gensio_iod *iod, void *data, gensiods count, gensiods *rcount,
 	     const char ***auxdata, void *cb_data)
@@ -335,8 +496,6 @@ sctp_do_read(struct gensio_iod *iod, void *data, gensiods count, gensiods *rcoun
     int rv;
     struct sctp_sndrcvinfo sinfo;
     int flags = 0;
-    unsigned int stream;
-    unsigned int i;
 
  restart:
     rv = tdata->o->sctp_recvmsg(iod, data, count, rcount, &sinfo, &flags);
@@ -344,41 +503,629 @@ sctp_do_read(struct gensio_iod *iod, void *data, gensiods count, gensiods *rcoun
     if (rv || *rcount == 0)
 	return rv;
 
-    stream = sinfo.sinfo_stream;
-    /* Shouldn't happen, but just in case. */
-    assert(stream < tdata->instreams);
+    if (!sctp_msg_auxdata(tdata, &sinfo, *auxdata))
+	goto restart;
 
-    i = 0;
-    if (tdata->strind[stream])
-	(*auxdata)[i++] = tdata->strind[stream];
+    return rv;
+}
 
-    if (sinfo.sinfo_flags && SCTP_UNORDERED) {
-	if (!tdata->do_oob)
-	    goto restart;
-	(*auxdata)[i++] = "oob";
-    }
+static void sctp_chan_sched_deferred_op(struct sctp_chan *chan);
 
-    (*auxdata)[i] = NULL;
+/* Must be called with the lock held. */
+static bool
+sctp_held_blocked(struct sctp_data *tdata)
+{
+    struct sctp_chan *chan;
 
-    return rv;
+    if (!tdata->held)
+	return false;
+    chan = tdata->chans[tdata->held_stream];
+    return chan && gensio_circbuf_room_left(chan->rbuf) < tdata->held_len;
+}
+
+/*
+ * Call with the lock held when a channel has taken data or gone
+ * away, if the message waiting on it can go now, start reading again.
+ */
+static void
+sctp_chan_check_unhold(struct sctp_chan *chan)
+{
+    struct sctp_data *tdata = chan->tdata;
+
+    if (tdata->held && tdata->held_stream == chan->stream &&
+		!tdata->sock_closed && !sctp_held_blocked(tdata))
+	tdata->o->set_read_handler(tdata->iod, true);
+}
+
+/* Don't sort more than this many messages into channels at a time. */
+#define SCTP_CHAN_MAX_READS 16
+
+/*
+ * Used for reading while channels are open.  Messages for channels
+ * go into the channel's buffer, the first message for the main
+ * gensio is returned.
+ */
+static int
+sctp_chan_do_read(struct gensio_iod *iod, void *data, gensiods count,
+		  gensiods *rcount, const char ***auxdata, void *cb_data)
+{
+    struct sctp_data *tdata = cb_data;
+    struct gensio_os_funcs *o = tdata->o;
+    struct sctp_sndrcvinfo sinfo;
+    struct sctp_chan *chan;
+    struct gensio_sg sg;
+    gensiods len;
+    unsigned int i, stream;
+    int rv, flags;
+
+    o->lock(tdata->lock);
+    for (i = 0; i < SCTP_CHAN_MAX_READS; i++) {
+	if (tdata->held) {
+	    len = tdata->held_len;
+	    sinfo = tdata->held_sinfo;
+	} else {
+	    o->unlock(tdata->lock);
+	    flags = 0;
+	    rv = o->sctp_recvmsg(iod, tdata->rbuf, tdata->max_read_size,
+				 &len, &sinfo, &flags);
+	    o->lock(tdata->lock);
+	    if (rv) {
+		sctp_chans_fail(tdata, rv);
+		o->unlock(tdata->lock);
+		return rv;
+	    }
+	    if (len == 0)
+		break;
+	}
+
+	stream = sinfo.sinfo_stream;
+	chan = NULL;
+	if (stream < tdata->nchans)
+	    chan = tdata->chans[stream];
+
+	if (!chan) {
+	    /* For the main gensio. */
+	    tdata->held = false;
+	    if (!sctp_msg_auxdata(tdata, &sinfo, *auxdata))
+		continue;
+	    if (len > count) {
+		/* Won't all fit, keep the rest for next time. */
+		memcpy(data, tdata->rbuf, count);
+		memmove(tdata->rbuf, tdata->rbuf + count, len - count);
+		tdata->held = true;
+		tdata->held_stream = stream;
+		tdata->held_len = len - count;
+		tdata->held_sinfo = sinfo;
+		len = count;
+	    } else {
+		memcpy(data, tdata->rbuf, len);
+	    }
+	    o->unlock(tdata->lock);
+	    *rcount = len;
+	    return 0;
+	}
+
+	if (gensio_circbuf_room_left(chan->rbuf) < len) {
+	    /* The channel is full, this waits for it to drain. */
+	    tdata->held = true;
+	    tdata->held_stream = stream;
+	    tdata->held_len = len;
+	    tdata->held_sinfo = sinfo;
+	    break;
+	}
+	tdata->held = false;
+
+	/* Channels don't do oob, unordered data goes in line. */
+	if ((sinfo.sinfo_flags & SCTP_UNORDERED) && !tdata->do_oob)
+	    continue;
+
+	sg.buf = tdata->rbuf;
+	sg.buflen = len;
+	gensio_circbuf_sg_write(chan->rbuf, &sg, 1, NULL);
+	sctp_chan_sched_deferred_op(chan);
+    }
+    o->unlock(tdata->lock);
+    *rcount = 0;
+    return 0;
 }
 
 static void
 sctp_read_ready(void *handler_data, struct gensio_iod *iod)
 {
     struct sctp_data *tdata = handler_data;
+    struct gensio_os_funcs *o = tdata->o;
+    bool use_chans;
+
+    o->lock(tdata->lock);
+    use_chans = tdata->nopen_chans > 0 || tdata->held;
+    o->unlock(tdata->lock);
+
+    if (!use_chans) {
+	gensio_fd_ll_handle_incoming(tdata->ll, sctp_do_read, tdata->auxdata,
+				     tdata);
+	return;
+    }
+
+    gensio_fd_ll_handle_incoming(tdata->ll, sctp_chan_do_read,
+				 tdata->auxdata, tdata);
+
+    o->lock(tdata->lock);
+    /* Don't spin on the socket while waiting for a channel. */
+    if (sctp_held_blocked(tdata))
+	o->set_read_handler(iod, false);
+    o->unlock(tdata->lock);
+}
+
+/*
+ * Called with the lock held when the connection goes away, all the
+ * channels get the error and will not get any more data.
+ */
+static void
+sctp_chans_fail(struct sctp_data *tdata, int err)
+{
+    struct sctp_chan *chan;
+    unsigned int i;
+
+    for (i = 0; i < tdata->nchans; i++) {
+	chan = tdata->chans[i];
+	if (!chan)
+	    continue;
+	tdata->chans[i] = NULL;
+	chan->attached = false;
+	if (!chan->read_err)
+	    chan->read_err = err;
+	sctp_chan_sched_deferred_op(chan);
+    }
+    tdata->nopen_chans = 0;
+    tdata->held = false;
+}
+
+static void
+sctp_chan_finish_free(struct sctp_chan *chan)
+{
+    struct gensio_os_funcs *o = chan->o;
+
+    if (chan->rbuf)
+	gensio_circbuf_free(chan->rbuf);
+    if (chan->deferred_op_runner)
+	o->free_runner(chan->deferred_op_runner);
+    if (chan->write_timer)
+	o->free_timer(chan->write_timer);
+    if (chan->io)
+	gensio_data_free(chan->io);
+    o->free(o, chan);
+}
+
+/* Must be called with the lock held, it's released. */
+static void
+sctp_chan_deref_and_unlock(struct sctp_chan *chan)
+{
+    struct sctp_data *tdata = chan->tdata;
+
+    assert(chan->refcount > 0);
+    if (--chan->refcount > 0) {
+	chan->o->unlock(tdata->lock);
+	return;
+    }
+    sctp_chan_finish_free(chan);
+    sctp_deref_and_unlock(tdata);
+}
 
-    gensio_fd_ll_handle_incoming(tdata->ll, sctp_do_read, tdata->auxdata,
-				 tdata);
+static void
+sctp_chan_sched_deferred_op(struct sctp_chan *chan)
+{
+    if (!chan->deferred_op_pending) {
+	chan->deferred_op_pending = true;
+	chan->refcount++;
+	chan->o->run(chan->deferred_op_runner);
+    }
+}
+
+static void
+sctp_chan_detach(struct sctp_chan *chan)
+{
+    struct sctp_data *tdata = chan->tdata;
+
+    if (!chan->attached)
+	return;
+    tdata->chans[chan->stream] = NULL;
+    tdata->nopen_chans--;
+    chan->attached = false;
+    /* A message held for this channel goes to the main gensio now. */
+    sctp_chan_check_unhold(chan);
+}
+
+static void
+sctp_chan_stop_timer(struct sctp_chan *chan)
+{
+    if (chan->timer_running &&
+		chan->o->stop_timer(chan->write_timer) == 0) {
+	chan->timer_running = false;
+	chan->refcount--; /* The caller holds a ref, this can't be last. */
+    }
+}
+
+static void
+sctp_chan_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct sctp_chan *chan = cb_data;
+    struct sctp_data *tdata = chan->tdata;
+    struct gensio_os_funcs *o = chan->o;
+    gensio_done_err open_done;
+    gensio_done close_done;
+    void *buf;
+    gensiods len, count;
+    int err;
+
+    o->lock(tdata->lock);
+    if (chan->open_done) {
+	open_done = chan->open_done;
+	chan->open_done = NULL;
+	o->unlock(tdata->lock);
+	open_done(chan->io, 0, chan->open_data);
+	o->lock(tdata->lock);
+    }
+
+    while (chan->state == SCTP_CHAN_OPEN && chan->read_enabled) {
+	if (gensio_circbuf_datalen(chan->rbuf) > 0) {
+	    gensio_circbuf_next_read_area(chan->rbuf, &buf, &len);
+	    count = len;
+	    o->unlock(tdata->lock);
+	    err = gensio_cb(chan->io, GENSIO_EVENT_READ, 0, buf, &count, NULL);
+	    o->lock(tdata->lock);
+	    if (err) {
+		chan->read_enabled = false;
+		if (!chan->read_err)
+		    chan->read_err = err;
+		break;
+	    }
+	    if (count > len)
+		count = len;
+	    gensio_circbuf_data_removed(chan->rbuf, count);
+	    sctp_chan_check_unhold(chan);
+	} else if (chan->read_err) {
+	    chan->read_enabled = false;
+	    count = 0;
+	    o->unlock(tdata->lock);
+	    gensio_cb(chan->io, GENSIO_EVENT_READ, chan->read_err,
+		      NULL, &count, NULL);
+	    o->lock(tdata->lock);
+	} else {
+	    break;
+	}
+    }
+
+    while (chan->state == SCTP_CHAN_OPEN && chan->xmit_enabled &&
+	   !chan->write_blocked) {
+	o->unlock(tdata->lock);
+	err = gensio_cb(chan->io, GENSIO_EVENT_WRITE_READY, 0,
+			NULL, NULL, NULL);
+	o->lock(tdata->lock);
+	if (err) {
+	    chan->read_enabled = false;
+	    if (!chan->read_err)
+		chan->read_err = err;
+	    break;
+	}
+    }
+
+    if (chan->state == SCTP_CHAN_IN_CLOSE) {
+	chan->state = SCTP_CHAN_CLOSED;
+	if (chan->close_done) {
+	    close_done = chan->close_done;
+	    chan->close_done = NULL;
+	    o->unlock(tdata->lock);
+	    close_done(chan->io, chan->close_data);
+	    o->lock(tdata->lock);
+	}
+    }
+
+    chan->deferred_op_pending = false;
+    if (chan->open_done)
+	/* Reopened from the close callback. */
+	sctp_chan_sched_deferred_op(chan);
+    sctp_chan_deref_and_unlock(chan);
+}
+
+static void
+sctp_chan_write_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct sctp_chan *chan = cb_data;
+
+    chan->o->lock(chan->tdata->lock);
+    chan->timer_running = false;
+    chan->write_blocked = false;
+    if (chan->state == SCTP_CHAN_OPEN)
+	sctp_chan_sched_deferred_op(chan);
+    sctp_chan_deref_and_unlock(chan);
+}
+
+static int
+sctp_chan_write(struct sctp_chan *chan, gensiods *rcount,
+		const struct gensio_sg *sg, gensiods sglen,
+		const char *const *auxdata)
+{
+    struct sctp_data *tdata = chan->tdata;
+    struct gensio_os_funcs *o = chan->o;
+    struct sctp_sndrcvinfo sinfo;
+    gensiods i, count = 0, total = 0;
+    gensio_time timeout = { 0, SCTP_CHAN_WRITE_RETRY_MS * 1000000 };
+    int err;
+
+    memset(&sinfo, 0, sizeof(sinfo));
+    for (i = 0; auxdata && auxdata[i]; i++) {
+	if (strcasecmp(auxdata[i], "oob") == 0) {
+	    sinfo.sinfo_flags |= SCTP_UNORDERED;
+	    continue;
+	}
+	return GE_INVAL;
+    }
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    o->lock(tdata->lock);
+    if (chan->state != SCTP_CHAN_OPEN) {
+	err = GE_NOTREADY;
+    } else if (!chan->attached) {
+	err = chan->read_err ? chan->read_err : GE_NOTREADY;
+    } else {
+	sinfo.sinfo_stream = chan->stream;
+	err = o->sctp_send(tdata->iod, sg, sglen, &count, &sinfo, 0);
+	if (!err && count < total && !chan->timer_running) {
+	    /*
+	     * The socket's full.  The socket's write readiness belongs
+	     * to the main gensio, so just try again in a bit.
+	     */
+	    chan->write_blocked = true;
+	    chan->timer_running = true;
+	    chan->refcount++;
+	    o->start_timer(chan->write_timer, &timeout);
+	}
+    }
+    o->unlock(tdata->lock);
+    if (!err && rcount)
+	*rcount = count;
+    return err;
+}
+
+static int
+sctp_chan_open(struct sctp_chan *chan, gensio_done_err open_done,
+	       void *open_data)
+{
+    struct sctp_data *tdata = chan->tdata;
+    struct gensio_os_funcs *o = chan->o;
+    int err = 0;
+
+    o->lock(tdata->lock);
+    if (chan->state != SCTP_CHAN_CLOSED) {
+	err = GE_NOTREADY;
+    } else if (!tdata->chans || tdata->sock_closed) {
+	/* The main gensio must be open. */
+	err = GE_NOTREADY;
+    } else if (chan->stream >= tdata->nchans) {
+	err = GE_INVAL;
+    } else if (tdata->chans[chan->stream]) {
+	err = GE_INUSE;
+    } else {
+	if (!tdata->rbuf) {
+	    tdata->rbuf = o->zalloc(o, tdata->max_read_size);
+	    if (!tdata->rbuf) {
+		err = GE_NOMEM;
+		goto out_unlock;
+	    }
+	}
+	tdata->chans[chan->stream] = chan;
+	tdata->nopen_chans++;
+	chan->attached = true;
+	chan->state = SCTP_CHAN_OPEN;
+	chan->read_err = 0;
+	chan->write_blocked = false;
+	gensio_circbuf_reset(chan->rbuf);
+	chan->open_done = open_done;
+	chan->open_data = open_data;
+	sctp_chan_sched_deferred_op(chan);
+    }
+ out_unlock:
+    o->unlock(tdata->lock);
+    return err;
+}
+
+static int
+sctp_chan_close(struct sctp_chan *chan, gensio_done close_done,
+		void *close_data)
+{
+    struct sctp_data *tdata = chan->tdata;
+    int err = 0;
+
+    chan->o->lock(tdata->lock);
+    if (chan->state != SCTP_CHAN_OPEN) {
+	err = GE_NOTREADY;
+    } else {
+	sctp_chan_detach(chan);
+	sctp_chan_stop_timer(chan);
+	chan->state = SCTP_CHAN_IN_CLOSE;
+	chan->close_done = close_done;
+	chan->close_data = close_data;
+	sctp_chan_sched_deferred_op(chan);
+    }
+    chan->o->unlock(tdata->lock);
+    return err;
+}
+
+static void
+sctp_chan_free(struct sctp_chan *chan)
+{
+    chan->o->lock(chan->tdata->lock);
+    sctp_chan_detach(chan);
+    sctp_chan_stop_timer(chan);
+    if (chan->state == SCTP_CHAN_OPEN)
+	chan->state = SCTP_CHAN_CLOSED;
+    chan->open_done = NULL;
+    chan->close_done = NULL;
+    sctp_chan_deref_and_unlock(chan);
+}
+
+static void
+sctp_chan_set_read_callback_enable(struct sctp_chan *chan, bool enabled)
+{
+    chan->o->lock(chan->tdata->lock);
+    chan->read_enabled = enabled;
+    if (enabled && chan->state == SCTP_CHAN_OPEN)
+	sctp_chan_sched_deferred_op(chan);
+    chan->o->unlock(chan->tdata->lock);
+}
+
+static void
+sctp_chan_set_write_callback_enable(struct sctp_chan *chan, bool enabled)
+{
+    chan->o->lock(chan->tdata->lock);
+    chan->xmit_enabled = enabled;
+    if (enabled && chan->state == SCTP_CHAN_OPEN)
+	sctp_chan_sched_deferred_op(chan);
+    chan->o->unlock(chan->tdata->lock);
+}
+
+static int
+sctp_chan_control(struct sctp_chan *chan, bool get, unsigned int option,
+		  char *data, gensiods *datalen)
+{
+    struct sctp_data *tdata = chan->tdata;
+    int err;
+
+    if (option == GENSIO_CONTROL_STREAMS) {
+	if (!get)
+	    return GE_INVAL;
+	*datalen = snprintf(data, *datalen, "stream=%u", chan->stream);
+	return 0;
+    }
+
+    /* Everything else is about the connection. */
+    chan->o->lock(tdata->lock);
+    if (!chan->attached)
+	err = GE_NOTREADY;
+    else
+	err = sctp_control(tdata, tdata->iod, get, option, data, datalen);
+    chan->o->unlock(tdata->lock);
+    return err;
+}
+
+static int
+sctp_chan_func(struct gensio *io, int func, gensiods *count,
+	       const void *cbuf, gensiods buflen, void *buf,
+	       const char *const *auxdata)
+{
+    struct sctp_chan *chan = gensio_get_gensio_data(io);
+
+    switch (func) {
+    case GENSIO_FUNC_WRITE_SG:
+	return sctp_chan_write(chan, count, cbuf, buflen, auxdata);
+
+    case GENSIO_FUNC_OPEN:
+	return sctp_chan_open(chan, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return sctp_chan_close(chan, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	sctp_chan_free(chan);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	sctp_chan_set_read_callback_enable(chan, buflen);
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	sctp_chan_set_write_callback_enable(chan, buflen);
+	return 0;
+
+    case GENSIO_FUNC_CONTROL:
+	return sctp_chan_control(chan, *((bool *) cbuf), buflen, buf, count);
+
+    case GENSIO_FUNC_DISABLE:
+	chan->o->lock(chan->tdata->lock);
+	sctp_chan_detach(chan);
+	chan->state = SCTP_CHAN_CLOSED;
+	chan->o->unlock(chan->tdata->lock);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+sctp_alloc_channel(void *handler_data,
+		   struct gensio_func_alloc_channel_data *d)
+{
+    struct sctp_data *tdata = handler_data;
+    struct gensio_os_funcs *o = tdata->o;
+    struct sctp_chan *chan;
+    unsigned int stream = 0, i;
+    gensiods max_read_size = tdata->max_read_size * 4;
+    GENSIO_DECLARE_PPGENSIO(p, o, d->cb, "sctp", d->user_data);
+
+    for (i = 0; d->args && d->args[i]; i++) {
+	if (gensio_pparm_uint(&p, d->args[i], "stream", &stream) > 0)
+	    continue;
+	if (gensio_pparm_ds(&p, d->args[i], "readbuf", &max_read_size) > 0)
+	    continue;
+	gensio_pparm_unknown_parm(&p, d->args[i]);
+	return GE_INVAL;
+    }
+
+    /* Stream 0 stays with the main gensio. */
+    if (stream == 0) {
+	gensio_pparm_log(&p, "stream must be given and not %u", stream);
+	return GE_INVAL;
+    }
+    /* Must be able to hold any single read. */
+    if (max_read_size < tdata->max_read_size)
+	max_read_size = tdata->max_read_size;
+
+    chan = o->zalloc(o, sizeof(*chan));
+    if (!chan)
+	return GE_NOMEM;
+    chan->o = o;
+    chan->tdata = tdata;
+    chan->refcount = 1;
+    chan->stream = stream;
+
+    chan->rbuf = gensio_circbuf_alloc(o, max_read_size);
+    if (!chan->rbuf)
+	goto out_nomem;
+    chan->deferred_op_runner = o->alloc_runner(o, sctp_chan_deferred_op, chan);
+    if (!chan->deferred_op_runner)
+	goto out_nomem;
+    chan->write_timer = o->alloc_timer(o, sctp_chan_write_timeout, chan);
+    if (!chan->write_timer)
+	goto out_nomem;
+    chan->io = gensio_data_alloc(o, d->cb, d->user_data, sctp_chan_func,
+				 NULL, "sctp", chan);
+    if (!chan->io)
+	goto out_nomem;
+    gensio_set_is_reliable(chan->io, true);
+
+    o->lock(tdata->lock);
+    tdata->refcount++;
+    o->unlock(tdata->lock);
+
+    d->new_io = chan->io;
+    return 0;
+
+ out_nomem:
+    sctp_chan_finish_free(chan);
+    return GE_NOMEM;
 }
 
 static const struct gensio_fd_ll_ops sctp_fd_ll_ops = {
     .sub_open = sctp_sub_open,
     .check_open = sctp_check_open,
     .free = sctp_free,
+    .check_close = sctp_check_close,
     .control = sctp_control,
     .write = sctp_write,
-    .read_ready = sctp_read_ready
+    .read_ready = sctp_read_ready,
+    .alloc_channel = sctp_alloc_channel
 };
 
 static int
@@ -469,6 +1216,11 @@ sctp_gensio_alloc(const void *gdata, const char * const args[],
 	goto out_nomem;
 
     tdata->o = o;
+    tdata->refcount = 1;
+    tdata->max_read_size = max_read_size;
+    tdata->lock = o->alloc_lock(o);
+    if (!tdata->lock)
+	goto out_nomem;
     tdata->addr = addr;
     tdata->laddr = laddr;
     tdata->initmsg.sinit_max_instreams = instreams;
@@ -504,6 +1256,8 @@ sctp_gensio_alloc(const void *gdata, const char * const args[],
 	} else {
 	    if (tdata->addr)
 		gensio_addr_free(tdata->addr);
+	    if (tdata->lock)
+		o->free_lock(tdata->lock);
 	    o->free(o, tdata);
 	}
     }
@@ -562,9 +1316,11 @@ struct sctpna_data {
 
 static const struct gensio_fd_ll_ops sctp_server_fd_ll_ops = {
     .free = sctp_free,
+    .check_close = sctp_check_close,
     .control = sctp_control,
     .write = sctp_write,
-    .read_ready = sctp_read_ready
+    .read_ready = sctp_read_ready,
+    .alloc_channel = sctp_alloc_channel
 };
 
 static void
@@ -644,6 +1400,15 @@ sctpna_readhandler(struct gensio_iod *iod, void *cbdata)
     }
 
     tdata->o = nadata->o;
+    tdata->refcount = 1;
+    tdata->max_read_size = nadata->max_read_size;
+    tdata->lock = nadata->o->alloc_lock(nadata->o);
+    if (!tdata->lock) {
+	gensio_acc_log(nadata->acc, GENSIO_LOG_INFO,
+		       "Error accepting net gensio: out of memory");
+	err = GE_NOMEM;
+	goto out_err;
+    }
     tdata->iod = new_iod;
     tdata->nodelay = nadata->nodelay;
     tdata->initmsg = nadata->initmsg;
@@ -78,7 +78,7 @@ sound_gensio_alloc(const void *gdata, const char * const args[],
     struct gensio *io;
     gensiods dsval;
     unsigned int uival;
-    bool list = false;
+    bool list = false, bval;
     int i;
     GENSIO_DECLARE_PPGENSIO(p, o, cb, "sound", user_data);
 
@@ -152,6 +152,17 @@ sound_gensio_alloc(const void *gdata, const char * const args[],
 	}
 	if (gensio_pparm_bool(&p, args[i], "list", &list) > 0)
 	    continue;
+	if (gensio_pparm_bool(&p, args[i], "inmmap", &in.mmap) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "outmmap", &out.mmap) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "mmap", &bval) > 0) {
+	    in.mmap = bval;
+	    out.mmap = bval;
+	    continue;
+	}
+	if (gensio_pparm_bool(&p, args[i], "inshare", &in.share) > 0)
+	    continue;
 	if (gensio_pparm_value(&p, args[i], "intype", &in.type) > 0)
 	    continue;
 	if (gensio_pparm_value(&p, args[i], "outtype", &out.type) > 0)
@@ -218,6 +229,9 @@ gensio_init_sound(struct gensio_os_funcs *o)
 {
     int rv;
 
+    rv = gensio_sound_ll_init(o);
+    if (rv)
+	return rv;
     rv = register_gensio(o, "sound", str_to_sound_gensio, sound_gensio_alloc);
     if (rv)
 	return rv;
@@ -0,0 +1,596 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * This code is for the source and sink gensios, endpoints that cost
+ * nothing for benchmarking stacks.  A source generates read data as
+ * fast as it is taken, a sink throws away everything written to it.
+ * Both count the bytes that go through them.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "config.h"
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_class.h>
+
+enum srcsnk_state {
+    SRCSNK_CLOSED,
+    SRCSNK_IN_OPEN,
+    SRCSNK_OPEN,
+    SRCSNK_IN_OPEN_CLOSE,
+    SRCSNK_IN_CLOSE,
+};
+
+struct srcsnk_data {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+
+    unsigned int refcount;
+    enum srcsnk_state state;
+
+    struct gensio *io;
+
+    bool is_source;
+
+    /*
+     * The source's read data.  It holds a whole number of copies of
+     * the pattern, so wrapping around keeps the pattern going.
+     */
+    unsigned char *buf;
+    gensiods bufsize;
+    gensiods pos;
+
+    /* Regenerate buf from rstate every time it's used up. */
+    bool random;
+    uint64_t rstate;
+
+    /* If limited, report end of data after left more bytes. */
+    bool limited;
+    gensiods left;
+
+    gensiods read_count;
+    gensiods write_count;
+
+    bool read_enabled;
+    bool xmit_enabled;
+
+    gensio_done_err open_done;
+    void *open_data;
+
+    gensio_done close_done;
+    void *close_data;
+
+    /*
+     * Used to run callbacks from the selector to avoid running them
+     * directly from user calls.
+     */
+    bool deferred_op_pending;
+    struct gensio_runner *deferred_op_runner;
+};
+
+static void srcsnk_start_deferred_op(struct srcsnk_data *ndata);
+
+static void
+srcsnk_finish_free(struct srcsnk_data *ndata)
+{
+    struct gensio_os_funcs *o = ndata->o;
+
+    if (ndata->io)
+	gensio_data_free(ndata->io);
+    if (ndata->buf)
+	o->free(o, ndata->buf);
+    if (ndata->deferred_op_runner)
+	o->free_runner(ndata->deferred_op_runner);
+    if (ndata->lock)
+	o->free_lock(ndata->lock);
+    o->free(o, ndata);
+}
+
+static void
+srcsnk_lock(struct srcsnk_data *ndata)
+{
+    ndata->o->lock(ndata->lock);
+}
+
+static void
+srcsnk_unlock(struct srcsnk_data *ndata)
+{
+    ndata->o->unlock(ndata->lock);
+}
+
+static void
+srcsnk_ref(struct srcsnk_data *ndata)
+{
+    assert(ndata->refcount > 0);
+    ndata->refcount++;
+}
+
+static void
+srcsnk_unlock_and_deref(struct srcsnk_data *ndata)
+{
+    assert(ndata->refcount > 0);
+    if (ndata->refcount == 1) {
+	srcsnk_unlock(ndata);
+	srcsnk_finish_free(ndata);
+    } else {
+	ndata->refcount--;
+	srcsnk_unlock(ndata);
+    }
+}
+
+/* xorshift64*, random enough for test data and much cheaper than rand. */
+static void
+source_fill_random(struct srcsnk_data *ndata)
+{
+    uint64_t x = ndata->rstate, v;
+    gensiods i, len;
+
+    for (i = 0; i < ndata->bufsize; i += len) {
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	v = x * 0x2545f4914f6cdd1dULL;
+	len = ndata->bufsize - i;
+	if (len > sizeof(v))
+	    len = sizeof(v);
+	memcpy(ndata->buf + i, &v, len);
+    }
+    ndata->rstate = x;
+}
+
+static void
+source_data_removed(struct srcsnk_data *ndata, gensiods count)
+{
+    ndata->pos += count;
+    ndata->read_count += count;
+    if (ndata->limited)
+	ndata->left -= count;
+    if (ndata->pos == ndata->bufsize) {
+	ndata->pos = 0;
+	if (ndata->random)
+	    source_fill_random(ndata);
+    }
+}
+
+static int
+srcsnk_write(struct gensio *io, gensiods *rcount,
+	     const struct gensio_sg *sg, gensiods sglen)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+    gensiods i, count = 0;
+
+    srcsnk_lock(ndata);
+    if (ndata->state != SRCSNK_OPEN) {
+	srcsnk_unlock(ndata);
+	return GE_NOTREADY;
+    }
+    for (i = 0; i < sglen; i++)
+	count += sg[i].buflen;
+    ndata->write_count += count;
+    srcsnk_unlock(ndata);
+    if (rcount)
+	*rcount = count;
+    return 0;
+}
+
+static bool
+srcsnk_has_work(struct srcsnk_data *ndata)
+{
+    return ndata->state == SRCSNK_OPEN &&
+	((ndata->is_source && ndata->read_enabled) || ndata->xmit_enabled);
+}
+
+static void
+srcsnk_deferred_op(struct gensio_runner *runner, void *cb_data)
+{
+    struct srcsnk_data *ndata = cb_data;
+    int err = 0;
+
+    srcsnk_lock(ndata);
+ restart:
+    if (ndata->state == SRCSNK_IN_OPEN ||
+		ndata->state == SRCSNK_IN_OPEN_CLOSE) {
+	if (ndata->state == SRCSNK_IN_OPEN_CLOSE) {
+	    ndata->state = SRCSNK_IN_CLOSE;
+	    err = GE_LOCALCLOSED;
+	} else {
+	    ndata->state = SRCSNK_OPEN;
+	}
+	if (ndata->open_done) {
+	    srcsnk_unlock(ndata);
+	    ndata->open_done(ndata->io, err, ndata->open_data);
+	    srcsnk_lock(ndata);
+	}
+    }
+
+    /*
+     * Only one read and one write ready per pass, so a source or sink
+     * running flat out doesn't starve everything else.
+     */
+    if (ndata->state == SRCSNK_OPEN && ndata->is_source &&
+		ndata->read_enabled) {
+	gensiods count;
+
+	if (ndata->limited && ndata->left == 0) {
+	    ndata->read_enabled = false;
+	    srcsnk_unlock(ndata);
+	    gensio_cb(ndata->io, GENSIO_EVENT_READ, GE_REMCLOSE,
+		      NULL, NULL, NULL);
+	    srcsnk_lock(ndata);
+	} else {
+	    gensiods avail = ndata->bufsize - ndata->pos;
+
+	    if (ndata->limited && avail > ndata->left)
+		avail = ndata->left;
+	    count = avail;
+	    srcsnk_unlock(ndata);
+	    err = gensio_cb(ndata->io, GENSIO_EVENT_READ, 0,
+			    ndata->buf + ndata->pos, &count, NULL);
+	    srcsnk_lock(ndata);
+	    if (!err) {
+		if (count > avail)
+		    count = avail;
+		source_data_removed(ndata, count);
+	    }
+	}
+    }
+
+    if (ndata->state == SRCSNK_OPEN && ndata->xmit_enabled) {
+	srcsnk_unlock(ndata);
+	gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0, NULL, NULL, NULL);
+	srcsnk_lock(ndata);
+    }
+
+    if (ndata->state == SRCSNK_IN_CLOSE) {
+	ndata->state = SRCSNK_CLOSED;
+	if (ndata->close_done) {
+	    srcsnk_unlock(ndata);
+	    ndata->close_done(ndata->io, ndata->close_data);
+	    srcsnk_lock(ndata);
+	}
+
+	if (ndata->state != SRCSNK_CLOSED)
+	    goto restart;
+    }
+
+    ndata->deferred_op_pending = false;
+    if (srcsnk_has_work(ndata))
+	srcsnk_start_deferred_op(ndata);
+
+    srcsnk_unlock_and_deref(ndata);
+}
+
+static void
+srcsnk_start_deferred_op(struct srcsnk_data *ndata)
+{
+    if (!ndata->deferred_op_pending) {
+	/* Call the read from the selector to avoid lock nesting issues. */
+	ndata->deferred_op_pending = true;
+	ndata->o->run(ndata->deferred_op_runner);
+	srcsnk_ref(ndata);
+    }
+}
+
+static void
+srcsnk_set_read_callback_enable(struct gensio *io, bool enabled)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+
+    srcsnk_lock(ndata);
+    ndata->read_enabled = enabled;
+    if (srcsnk_has_work(ndata))
+	srcsnk_start_deferred_op(ndata);
+    srcsnk_unlock(ndata);
+}
+
+static void
+srcsnk_set_write_callback_enable(struct gensio *io, bool enabled)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+
+    srcsnk_lock(ndata);
+    ndata->xmit_enabled = enabled;
+    if (srcsnk_has_work(ndata))
+	srcsnk_start_deferred_op(ndata);
+    srcsnk_unlock(ndata);
+}
+
+static int
+srcsnk_open(struct gensio *io, gensio_done_err open_done, void *open_data)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+    int err = 0;
+
+    srcsnk_lock(ndata);
+    if (ndata->state != SRCSNK_CLOSED) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    ndata->state = SRCSNK_IN_OPEN;
+    ndata->open_done = open_done;
+    ndata->open_data = open_data;
+    srcsnk_start_deferred_op(ndata);
+ out_unlock:
+    srcsnk_unlock(ndata);
+
+    return err;
+}
+
+static int
+srcsnk_close(struct gensio *io, gensio_done close_done, void *close_data)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+    int err = 0;
+
+    srcsnk_lock(ndata);
+    if (ndata->state != SRCSNK_OPEN && ndata->state != SRCSNK_IN_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (ndata->state == SRCSNK_IN_OPEN)
+	ndata->state = SRCSNK_IN_OPEN_CLOSE;
+    else
+	ndata->state = SRCSNK_IN_CLOSE;
+    ndata->close_done = close_done;
+    ndata->close_data = close_data;
+    srcsnk_start_deferred_op(ndata);
+ out_unlock:
+    srcsnk_unlock(ndata);
+
+    return err;
+}
+
+static void
+srcsnk_free(struct gensio *io)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+
+    srcsnk_lock(ndata);
+    ndata->state = SRCSNK_CLOSED;
+    srcsnk_unlock_and_deref(ndata);
+}
+
+static int
+srcsnk_disable(struct gensio *io)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+
+    srcsnk_lock(ndata);
+    ndata->state = SRCSNK_CLOSED;
+    srcsnk_unlock(ndata);
+
+    return 0;
+}
+
+static int
+srcsnk_control(struct gensio *io, bool get, int option, char *data,
+	       gensiods *datalen)
+{
+    struct srcsnk_data *ndata = gensio_get_gensio_data(io);
+
+    switch (option) {
+    case GENSIO_CONTROL_RADDR:
+	if (!get)
+	    return GE_NOTSUP;
+	if (strtoul(data, NULL, 0) > 0)
+	    return GE_NOTFOUND;
+	*datalen = gensio_pos_snprintf(data, *datalen, NULL,
+				       ndata->is_source ? "source" : "sink");
+	return 0;
+
+    case GENSIO_CONTROL_CONN_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	srcsnk_lock(ndata);
+	*datalen = snprintf(data, *datalen, "wrote=%lu read=%lu",
+			    (unsigned long) ndata->write_count,
+			    (unsigned long) ndata->read_count);
+	srcsnk_unlock(ndata);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+gensio_srcsnk_func(struct gensio *io, int func, gensiods *count,
+		   const void *cbuf, gensiods buflen, void *buf,
+		   const char *const *auxdata)
+{
+    switch (func) {
+    case GENSIO_FUNC_WRITE_SG:
+	return srcsnk_write(io, count, cbuf, buflen);
+
+    case GENSIO_FUNC_OPEN:
+	return srcsnk_open(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_CLOSE:
+	return srcsnk_close(io, (void *) cbuf, buf);
+
+    case GENSIO_FUNC_FREE:
+	srcsnk_free(io);
+	return 0;
+
+    case GENSIO_FUNC_SET_READ_CALLBACK:
+	srcsnk_set_read_callback_enable(io, buflen);
+	return 0;
+
+    case GENSIO_FUNC_SET_WRITE_CALLBACK:
+	srcsnk_set_write_callback_enable(io, buflen);
+	return 0;
+
+    case GENSIO_FUNC_DISABLE:
+	return srcsnk_disable(io);
+
+    case GENSIO_FUNC_CONTROL:
+	return srcsnk_control(io, *((bool *) cbuf), buflen, buf, count);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+srcsnk_gensio_alloc(struct gensio_os_funcs *o, bool is_source,
+		    const char * const args[],
+		    gensio_event cb, void *user_data,
+		    struct gensio **new_gensio)
+{
+    struct srcsnk_data *ndata = NULL;
+    const char *typename = is_source ? "source" : "sink";
+    int i, err;
+    gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE, size = 0, len = 0;
+    bool random = false;
+    const char *data = NULL;
+    GENSIO_DECLARE_PPGENSIO(p, o, cb, typename, user_data);
+
+    for (i = 0; args && args[i]; i++) {
+	if (is_source) {
+	    if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
+		continue;
+	    if (gensio_pparm_value(&p, args[i], "data", &data) > 0)
+		continue;
+	    if (gensio_pparm_bool(&p, args[i], "random", &random) > 0)
+		continue;
+	    if (gensio_pparm_ds(&p, args[i], "size", &size) > 0)
+		continue;
+	}
+	gensio_pparm_unknown_parm(&p, args[i]);
+	return GE_INVAL;
+    }
+
+    if (data) {
+	len = strlen(data);
+	if (len == 0) {
+	    gensio_pparm_slog(&p, "data must not be empty");
+	    return GE_INVAL;
+	}
+    }
+    if (max_read_size == 0)
+	max_read_size = 1;
+
+    ndata = o->zalloc(o, sizeof(*ndata));
+    if (!ndata)
+	return GE_NOMEM;
+    ndata->o = o;
+    ndata->refcount = 1;
+    ndata->is_source = is_source;
+
+    if (is_source) {
+	ndata->bufsize = max_read_size;
+	if (data) {
+	    /* A whole number of copies of the data, at least one. */
+	    ndata->bufsize -= ndata->bufsize % len;
+	    if (ndata->bufsize == 0)
+		ndata->bufsize = len;
+	}
+	ndata->buf = o->zalloc(o, ndata->bufsize);
+	if (!ndata->buf)
+	    goto out_nomem;
+	if (data) {
+	    gensiods pos;
+
+	    for (pos = 0; pos < ndata->bufsize; pos += len)
+		memcpy(ndata->buf + pos, data, len);
+	} else if (random) {
+	    ndata->random = true;
+	    err = o->get_random(o, &ndata->rstate, sizeof(ndata->rstate));
+	    if (err) {
+		srcsnk_finish_free(ndata);
+		return err;
+	    }
+	    if (ndata->rstate == 0)
+		ndata->rstate = 1;
+	    source_fill_random(ndata);
+	}
+	if (size) {
+	    ndata->limited = true;
+	    ndata->left = size;
+	}
+    }
+
+    ndata->deferred_op_runner = o->alloc_runner(o, srcsnk_deferred_op, ndata);
+    if (!ndata->deferred_op_runner)
+	goto out_nomem;
+
+    ndata->lock = o->alloc_lock(o);
+    if (!ndata->lock)
+	goto out_nomem;
+
+    ndata->io = gensio_data_alloc(o, cb, user_data, gensio_srcsnk_func,
+				  NULL, typename, ndata);
+    if (!ndata->io)
+	goto out_nomem;
+    gensio_set_is_client(ndata->io, true);
+    gensio_set_is_reliable(ndata->io, true);
+
+    *new_gensio = ndata->io;
+
+    return 0;
+
+ out_nomem:
+    srcsnk_finish_free(ndata);
+    return GE_NOMEM;
+}
+
+static int
+source_gensio_alloc(const void *gdata,
+		    const char * const args[],
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    struct gensio **new_gensio)
+{
+    return srcsnk_gensio_alloc(o, true, args, cb, user_data, new_gensio);
+}
+
+static int
+str_to_source_gensio(const char *str, const char * const args[],
+		     struct gensio_os_funcs *o,
+		     gensio_event cb, void *user_data,
+		     struct gensio **new_gensio)
+{
+    return source_gensio_alloc(NULL, args, o, cb, user_data, new_gensio);
+}
+
+static int
+sink_gensio_alloc(const void *gdata,
+		  const char * const args[],
+		  struct gensio_os_funcs *o,
+		  gensio_event cb, void *user_data,
+		  struct gensio **new_gensio)
+{
+    return srcsnk_gensio_alloc(o, false, args, cb, user_data, new_gensio);
+}
+
+static int
+str_to_sink_gensio(const char *str, const char * const args[],
+		   struct gensio_os_funcs *o,
+		   gensio_event cb, void *user_data,
+		   struct gensio **new_gensio)
+{
+    return sink_gensio_alloc(NULL, args, o, cb, user_data, new_gensio);
+}
+
+int
+gensio_init_source(struct gensio_os_funcs *o)
+{
+    int rv;
+
+    rv = register_gensio(o, "source", str_to_source_gensio,
+			 source_gensio_alloc);
+    if (rv)
+	return rv;
+    rv = register_gensio(o, "sink", str_to_sink_gensio, sink_gensio_alloc);
+    if (rv)
+	return rv;
+    return 0;
+}
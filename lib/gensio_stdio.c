@@ -86,6 +86,9 @@ struct stdiona_data {
     bool stderr_to_stdout;
     bool noredir_stderr;
 
+    /* Kernel buffer size for the subprogram's pipes, 0 for the default. */
+    gensiods pipe_size;
+
     unsigned int refcount;
 
     int argc;
@@ -636,6 +639,21 @@ setup_child_proc(struct stdiona_data *nadata)
 			 &nadata->opid, &nadata->io.in_iod,
 			 &nadata->io.out_iod,
 			 nadata->noredir_stderr ? NULL : &nadata->err.out_iod);
+    if (!rv && nadata->pipe_size) {
+	int size = nadata->pipe_size;
+
+	/*
+	 * Best effort, if the system can't do it or the size is over
+	 * its limit the pipes just keep the default size.
+	 */
+	o->iod_control(nadata->io.in_iod, GENSIO_IOD_CONTROL_PIPE_SIZE,
+		       false, (intptr_t) &size);
+	o->iod_control(nadata->io.out_iod, GENSIO_IOD_CONTROL_PIPE_SIZE,
+		       false, (intptr_t) &size);
+	if (nadata->err.out_iod)
+	    o->iod_control(nadata->err.out_iod, GENSIO_IOD_CONTROL_PIPE_SIZE,
+			   false, (intptr_t) &size);
+    }
     return rv;
 }
 
@@ -1033,6 +1051,28 @@ stdion_control(struct gensio *io, bool get, unsigned int option,
 	    return GE_INVAL;
 	return 0;
 
+#ifndef _WIN32
+    case GENSIO_CONTROL_RAW_FD: {
+	int rfd = -1, wfd = -1;
+
+	if (!get)
+	    return GE_NOTSUP;
+	stdiona_lock(nadata);
+	if (schan->closed || schan->in_close || !schan->out_iod) {
+	    stdiona_unlock(nadata);
+	    return GE_NOTREADY;
+	}
+	/* Data still in our buffer would be skipped by a user of the fd. */
+	if (!schan->data_pending_len)
+	    rfd = o->iod_get_fd(schan->out_iod);
+	if (schan->in_iod)
+	    wfd = o->iod_get_fd(schan->in_iod);
+	stdiona_unlock(nadata);
+	*datalen = snprintf(data, *datalen, "%d %d", rfd, wfd);
+	return 0;
+    }
+#endif
+
     case GENSIO_CONTROL_START_DIRECTORY:
 	if (get) {
 	    *datalen = snprintf(data, *datalen, "%s", nadata->start_dir);
@@ -1187,11 +1227,14 @@ stdio_gensio_alloc(const void *gdata, const char * const args[],
     bool noredir_stderr = false;
     bool raw = false;
     const char *start_dir = NULL;
+    gensiods pipe_size = 0;
     GENSIO_DECLARE_PPGENSIO(p, o, cb, "stdio", user_data);
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_pparm_ds(&p, args[i], "pipe-size", &pipe_size) > 0)
+	    continue;
 	if (gensio_pparm_bool(&p, args[i], "console", &console) > 0)
 	    continue;
 	if (gensio_pparm_bool(&p, args[i], "self", &self) > 0)
@@ -1224,6 +1267,7 @@ stdio_gensio_alloc(const void *gdata, const char * const args[],
 
     nadata->stderr_to_stdout = stderr_to_stdout;
     nadata->noredir_stderr = noredir_stderr;
+    nadata->pipe_size = pipe_size;
     if (start_dir) {
 	nadata->start_dir = gensio_strdup(o, start_dir);
 	if (!nadata->start_dir) {
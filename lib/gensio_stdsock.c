@@ -32,8 +32,10 @@ typedef int sockret;
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 typedef socklen_t taddrlen;
 typedef ssize_t sockret;
 #define sock_errno errno
@@ -69,6 +71,34 @@ typedef ssize_t sockret;
 #define AI_V4MAPPED 0
 #endif
 
+#if defined(HAVE_RECVMSG) && defined(HAVE_LINUX_NET_TSTAMP_H)
+#include <linux/net_tstamp.h>
+#ifdef SO_TIMESTAMPING
+#define GENSIO_STDSOCK_TIMESTAMPS
+#endif
+#endif
+
+/* UDP segmentation and receive offload, Linux only. */
+#if defined(HAVE_SENDMSG) && defined(UDP_SEGMENT)
+#define GENSIO_STDSOCK_UDP_GSO
+#endif
+#if defined(HAVE_RECVMSG) && defined(UDP_GRO)
+#define GENSIO_STDSOCK_UDP_GRO
+#endif
+
+/* Zero copy TCP sends, Linux only. */
+#if defined(HAVE_SENDMSG) && defined(HAVE_RECVMSG) && \
+	defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY) && \
+	defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define GENSIO_STDSOCK_ZEROCOPY
+#endif
+
+/* Passing sockets between processes. */
+#if defined(HAVE_SENDMSG) && defined(HAVE_RECVMSG) && defined(SCM_RIGHTS)
+#define GENSIO_STDSOCK_FDPASS
+#endif
+
 struct gensio_stdsock_info {
     int protocol;
     int family;
@@ -84,6 +114,18 @@ struct gensio_stdsock_info {
     /* Is the extrainfo flag set? */
     bool extrainfo;
 #endif
+
+#ifdef GENSIO_STDSOCK_TIMESTAMPS
+    /* Receive timestamps are on, and the ones from the last read. */
+    bool timestamps;
+    struct gensio_sockctl_timestamp rx_ts;
+#endif
+
+#ifdef GENSIO_STDSOCK_UDP_GRO
+    /* Receive offload is on, and the segment size from the last read. */
+    bool gro;
+    gensiods rx_segsize;
+#endif
 };
 
 struct gensio_listen_scan_info {
@@ -728,6 +770,62 @@ check_ipv6_only(int family, int protocol, int flags, int fd)
     return 0;
 }
 
+#ifdef GENSIO_STDSOCK_TIMESTAMPS
+/* Pull the SO_TIMESTAMPING times out of the control messages. */
+static void
+gensio_stdsock_save_rx_ts(struct gensio_stdsock_info *gsi, struct msghdr *hdr)
+{
+    struct cmsghdr *cmsg;
+    struct timespec ts[3];
+
+    gsi->rx_ts.sw_valid = false;
+    gsi->rx_ts.hw_valid = false;
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+	if (cmsg->cmsg_level != SOL_SOCKET ||
+		cmsg->cmsg_type != SCM_TIMESTAMPING)
+	    continue;
+	/* ts[0] is software, ts[1] is deprecated, ts[2] is raw hardware. */
+	memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+	if (ts[0].tv_sec || ts[0].tv_nsec) {
+	    gsi->rx_ts.sw_valid = true;
+	    gsi->rx_ts.sw.secs = ts[0].tv_sec;
+	    gsi->rx_ts.sw.nsecs = ts[0].tv_nsec;
+	}
+	if (ts[2].tv_sec || ts[2].tv_nsec) {
+	    gsi->rx_ts.hw_valid = true;
+	    gsi->rx_ts.hw.secs = ts[2].tv_sec;
+	    gsi->rx_ts.hw.nsecs = ts[2].tv_nsec;
+	}
+    }
+}
+
+/* recv() with timestamps, which needs recvmsg() to get them. */
+static int
+gensio_stdsock_recv_ts(struct gensio_iod *iod, struct gensio_stdsock_info *gsi,
+		       void *buf, gensiods buflen, gensiods *rcount, int flags)
+{
+    struct gensio_os_funcs *o = iod->f;
+    sockret rv;
+    struct msghdr hdr;
+    struct iovec iov;
+    unsigned char ctrlinfo[128];
+
+ retry:
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = buf;
+    iov.iov_len = buflen;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrlinfo;
+    hdr.msg_controllen = sizeof(ctrlinfo);
+    rv = recvmsg(o->iod_get_fd(iod), &hdr, flags);
+    if (rv > 0)
+	gensio_stdsock_save_rx_ts(gsi, &hdr);
+    ERRHANDLE();
+    return rv;
+}
+#endif
+
 static int
 gensio_stdsock_recv(struct gensio_iod *iod, void *buf, gensiods buflen,
 		    gensiods *rcount, int gflags)
@@ -735,10 +833,20 @@ gensio_stdsock_recv(struct gensio_iod *iod, void *buf, gensiods buflen,
     struct gensio_os_funcs *o = iod->f;
     sockret rv;
     int flags = (gflags & GENSIO_MSG_OOB) ? MSG_OOB : 0;
+#ifdef GENSIO_STDSOCK_TIMESTAMPS
+    struct gensio_stdsock_info *gsi;
+#endif
 
     if (do_errtrig())
 	return GE_NOMEM;
 
+#ifdef GENSIO_STDSOCK_TIMESTAMPS
+    if (!(gflags & GENSIO_MSG_OOB) &&
+		o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			       (intptr_t) &gsi) == 0 && gsi->timestamps)
+	return gensio_stdsock_recv_ts(iod, gsi, buf, buflen, rcount, flags);
+#endif
+
  retry:
     rv = recv(o->iod_get_fd(iod), buf, buflen, flags);
     ERRHANDLE();
@@ -778,6 +886,11 @@ gensio_stdsock_send(struct gensio_iod *iod,
     if (do_errtrig())
 	return GE_NOMEM;
 
+#ifdef GENSIO_STDSOCK_ZEROCOPY
+    if (gflags & GENSIO_MSG_ZEROCOPY)
+	flags |= MSG_ZEROCOPY;
+#endif
+
     {
 #ifdef HAVE_SENDMSG
 	struct msghdr hdr;
@@ -851,6 +964,138 @@ gensio_stdsock_sendto(struct gensio_iod *iod,
     return rv;
 }
 
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+/* Max packets to handle per system call, to keep the stack usage sane. */
+#define GENSIO_STDSOCK_MMSG_MAX	64
+
+static int
+gensio_stdsock_recvmmsg(struct gensio_iod *iod,
+			struct gensio_sockctl_mmsg *msgs, gensiods *count)
+{
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    struct mmsghdr hdrs[GENSIO_STDSOCK_MMSG_MAX];
+    struct iovec iovs[GENSIO_STDSOCK_MMSG_MAX];
+    struct addrinfo *ai;
+    unsigned int i, n;
+    int rv, err;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+    if (gsi->extrainfo)
+	/* Let recvfrom() handle the control messages. */
+	return GE_NOTSUP;
+#ifdef GENSIO_STDSOCK_TIMESTAMPS
+    if (gsi->timestamps)
+	return GE_NOTSUP;
+#endif
+#ifdef GENSIO_STDSOCK_UDP_GRO
+    if (gsi->gro)
+	return GE_NOTSUP;
+#endif
+
+    n = *count;
+    if (n > GENSIO_STDSOCK_MMSG_MAX)
+	n = GENSIO_STDSOCK_MMSG_MAX;
+
+    memset(hdrs, 0, sizeof(hdrs[0]) * n);
+    for (i = 0; i < n; i++) {
+	gensio_addr_rewind(msgs[i].addr);
+	ai = gensio_addr_addrinfo_get_curr(msgs[i].addr);
+	iovs[i].iov_base = msgs[i].buf;
+	iovs[i].iov_len = msgs[i].buflen;
+	hdrs[i].msg_hdr.msg_name = ai->ai_addr;
+	hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+	hdrs[i].msg_hdr.msg_iov = &iovs[i];
+	hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+ retry:
+    rv = recvmmsg(o->iod_get_fd(iod), hdrs, n, 0, NULL);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN) {
+	    *count = 0;
+	    return 0;
+	}
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+
+    for (i = 0; i < (unsigned int) rv; i++) {
+	ai = gensio_addr_addrinfo_get_curr(msgs[i].addr);
+	ai->ai_addrlen = hdrs[i].msg_hdr.msg_namelen;
+	ai->ai_family = ai->ai_addr->sa_family;
+	msgs[i].len = hdrs[i].msg_len;
+    }
+    *count = rv;
+    return 0;
+}
+
+static int
+gensio_stdsock_sendmmsg(struct gensio_iod *iod,
+			struct gensio_sockctl_mmsg *msgs, gensiods *count)
+{
+    struct gensio_os_funcs *o = iod->f;
+    struct mmsghdr hdrs[GENSIO_STDSOCK_MMSG_MAX];
+    struct iovec iovs[GENSIO_STDSOCK_MMSG_MAX];
+    struct addrinfo *ai;
+    unsigned int i, n;
+    int rv;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    n = *count;
+    if (n > GENSIO_STDSOCK_MMSG_MAX)
+	n = GENSIO_STDSOCK_MMSG_MAX;
+
+    memset(hdrs, 0, sizeof(hdrs[0]) * n);
+    for (i = 0; i < n; i++) {
+	ai = gensio_addr_addrinfo_get_curr(msgs[i].addr);
+	iovs[i].iov_base = msgs[i].buf;
+	iovs[i].iov_len = msgs[i].len;
+	hdrs[i].msg_hdr.msg_name = ai->ai_addr;
+	hdrs[i].msg_hdr.msg_namelen = ai->ai_addrlen;
+	hdrs[i].msg_hdr.msg_iov = &iovs[i];
+	hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+ retry:
+    rv = sendmmsg(o->iod_get_fd(iod), hdrs, n, 0);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN) {
+	    *count = 0;
+	    return 0;
+	}
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    *count = rv;
+    return 0;
+}
+#else
+static int
+gensio_stdsock_recvmmsg(struct gensio_iod *iod,
+			struct gensio_sockctl_mmsg *msgs, gensiods *count)
+{
+    return GE_NOTSUP;
+}
+
+static int
+gensio_stdsock_sendmmsg(struct gensio_iod *iod,
+			struct gensio_sockctl_mmsg *msgs, gensiods *count)
+{
+    return GE_NOTSUP;
+}
+#endif
+
 static struct gensio_addr *
 gensio_addr_addrinfo_alloc_recvfrom(struct gensio_os_funcs *o)
 {
@@ -877,7 +1122,7 @@ gensio_stdsock_recvfrom(struct gensio_iod *iod,
     struct gensio_stdsock_info *gsi;
     struct msghdr hdr;
     struct iovec iov;
-    unsigned char ctrlinfo[128];
+    unsigned char ctrlinfo[256];
 #endif
 
     if (do_errtrig())
@@ -918,6 +1163,26 @@ gensio_stdsock_recvfrom(struct gensio_iod *iod,
 	else
 	    err = sock_errno;
     }
+#ifdef GENSIO_STDSOCK_TIMESTAMPS
+    if (!err && rv > 0 && gsi->timestamps)
+	gensio_stdsock_save_rx_ts(gsi, &hdr);
+#endif
+#ifdef GENSIO_STDSOCK_UDP_GRO
+    if (!err && gsi->gro) {
+	struct cmsghdr *cmsg;
+	int segsize;
+
+	gsi->rx_segsize = 0;
+	for (cmsg = CMSG_FIRSTHDR(&hdr); rv > 0 && cmsg;
+	     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+		memcpy(&segsize, CMSG_DATA(cmsg), sizeof(segsize));
+		if (segsize > 0 && segsize < rv)
+		    gsi->rx_segsize = segsize;
+	    }
+	}
+    }
+#endif
 #ifdef HAVE_RECVMSG
     if (!err && gsi->extrainfo) {
 	struct cmsghdr *cmsg;
@@ -1059,7 +1324,12 @@ gensio_stdsock_accept(struct gensio_iod *iod,
 	len = sizeof(sadata);
     }
 
+#if HAVE_ACCEPT4
+    /* Saves the fcntl calls to set non-blocking below. */
+    rv = accept4(o->iod_get_fd(iod), sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
     rv = accept(o->iod_get_fd(iod), sa, &len);
+#endif
 
     if (rv >= 0) {
 	gsi = o->zalloc(o, sizeof(*gsi));
@@ -1075,9 +1345,11 @@ gensio_stdsock_accept(struct gensio_iod *iod,
 	    goto out;
 	}
 
+#if !HAVE_ACCEPT4
 	err = o->set_non_blocking(riod);
 	if (err)
 	    goto out;
+#endif
 
 	o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
 		       (intptr_t) &ogsi);
@@ -1094,7 +1366,7 @@ gensio_stdsock_accept(struct gensio_iod *iod,
 	*newiod = riod;
     } else {
 	rv = sock_errno;
-	if (rv == SOCK_EAGAIN && rv == SOCK_EWOULDBLOCK)
+	if (rv == SOCK_EAGAIN || rv == SOCK_EWOULDBLOCK)
 	    err = GE_NODATA;
 	else
 	    err = gensio_os_err_to_err(o, rv);
@@ -1254,6 +1526,34 @@ gensio_stdsock_socket_set_setup(struct gensio_iod *iod,
 	    return gensio_os_err_to_err(o, sock_errno);
     }
 
+    if (opensock_flags & GENSIO_SET_OPENSOCK_FASTOPEN) {
+	if (!gsi) {
+	    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+				 (intptr_t) &gsi);
+	    if (err)
+		return err;
+	}
+
+	val = !!(opensock_flags & GENSIO_OPENSOCK_FASTOPEN);
+	if (gsi->protocol != GENSIO_NET_PROTOCOL_TCP) {
+	    if (val)
+		return GE_NOTSUP;
+	} else {
+#ifdef TCP_FASTOPEN_CONNECT
+	    /*
+	     * connect() returns right away if the kernel has a cookie
+	     * for the server, the SYN goes out with the first write.
+	     */
+	    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+			   (void *) &val, sizeof(val)) == -1)
+		return gensio_os_err_to_err(o, sock_errno);
+#else
+	    if (val)
+		return GE_NOTSUP;
+#endif
+	}
+    }
+
     if (opensock_flags & GENSIO_SET_OPENSOCK_REUSEADDR) {
 	val = !!(opensock_flags & GENSIO_OPENSOCK_REUSEADDR);
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
@@ -1345,6 +1645,27 @@ gensio_stdsock_socket_get_setup(struct gensio_iod *iod,
 	    opensock_flags |= GENSIO_OPENSOCK_NODELAY;
     }
 
+    if (*iopensock_flags & GENSIO_SET_OPENSOCK_FASTOPEN) {
+	if (!gsi) {
+	    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+				 (intptr_t) &gsi);
+	    if (err)
+		return err;
+	}
+	val = 0;
+#ifdef TCP_FASTOPEN_CONNECT
+	if (gsi->protocol == GENSIO_NET_PROTOCOL_TCP) {
+	    len = sizeof(val);
+	    if (getsockopt(o->iod_get_fd(iod), IPPROTO_TCP,
+			   TCP_FASTOPEN_CONNECT, (void *) &val, &len) == -1)
+		return gensio_os_err_to_err(o, sock_errno);
+	}
+#endif
+	opensock_flags |= GENSIO_SET_OPENSOCK_FASTOPEN;
+	if (val)
+	    opensock_flags |= GENSIO_OPENSOCK_FASTOPEN;
+    }
+
     if (*iopensock_flags & GENSIO_SET_OPENSOCK_REUSEADDR) {
 	len = sizeof(val);
 	if (getsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_REUSEADDR,
@@ -1955,89 +2276,682 @@ gensio_stdsock_get_extrainfo(struct gensio_iod *iod, unsigned int *val)
 }
 
 static int
-gensio_stdsock_control(struct gensio_iod *iod, int func,
-		       void *data, gensiods *datalen)
+gensio_stdsock_set_timestamps(struct gensio_iod *iod, unsigned int val)
 {
-    switch (func) {
-    case GENSIO_SOCKCTL_SET_MCAST_LOOP:
-	if (*datalen != sizeof(bool))
-	    return GE_INVAL;
-	return gensio_stdsock_set_mcast_loop(iod, *((bool *) data));
-    case GENSIO_SOCKCTL_GET_MCAST_LOOP:
-	if (*datalen != sizeof(bool))
-	    return GE_INVAL;
-	return gensio_stdsock_get_mcast_loop(iod, ((bool *) data));
-    case GENSIO_SOCKCTL_GET_SOCKNAME:
-	return gensio_stdsock_getsockname(iod, data);
-    case GENSIO_SOCKCTL_GET_PEERNAME:
-	return gensio_stdsock_getpeername(iod, data);
-    case GENSIO_SOCKCTL_GET_PEERRAW:
-	return gensio_stdsock_getpeerraw(iod, data, datalen);
-    case GENSIO_SOCKCTL_GET_PORT:
-	if (*datalen != sizeof(unsigned int))
-	    return GE_INVAL;
-	return gensio_stdsock_get_port(iod, ((unsigned int *) data));
-    case GENSIO_SOCKCTL_CHECK_OPEN:
-	return gensio_stdsock_check_socket_open(iod);
-    case GENSIO_SOCKCTL_SET_MCAST_TTL:
-	if (*datalen != sizeof(unsigned int))
-	    return GE_INVAL;
-	return gensio_stdsock_set_mcast_ttl(iod, *((unsigned int *) data));
-    case GENSIO_SOCKCTL_GET_MCAST_TTL:
-	if (*datalen != sizeof(unsigned int))
-	    return GE_INVAL;
-	return gensio_stdsock_get_mcast_ttl(iod, ((unsigned int *) data));
-    case GENSIO_SOCKCTL_SET_EXTRAINFO:
-	if (*datalen != sizeof(unsigned int))
-	    return GE_INVAL;
-	return gensio_stdsock_set_extrainfo(iod, *((unsigned int *) data));
-    case GENSIO_SOCKCTL_GET_EXTRAINFO:
-	if (*datalen != sizeof(unsigned int))
-	    return GE_INVAL;
-	return gensio_stdsock_get_extrainfo(iod, ((unsigned int *) data));
-    default:
-	return GE_NOTSUP;
-    }
-}
+#ifndef GENSIO_STDSOCK_TIMESTAMPS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err, flags = 0;
 
-/*
- * For assigning zero ports.
- */
-#define IP_DYNRANGE_START	49152
-#define IP_DYNRANGE_END		65535
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
 
-static unsigned int
-gensio_dyn_scan_next(unsigned int port)
-{
-    if (port == IP_DYNRANGE_END)
-	return IP_DYNRANGE_START;
-    else
-	return port + 1;
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_UDP &&
+		gsi->protocol != GENSIO_NET_PROTOCOL_TCP)
+	return GE_INVAL;
+
+    /*
+     * Ask for both, hardware timestamps only show up if the interface
+     * has them turned on (with SIOCSHWTSTAMP, hwstamp_ctl, etc.).
+     */
+    if (val)
+	flags = (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		 SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE);
+    if (setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_TIMESTAMPING,
+		   &flags, sizeof(flags)) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+    gsi->timestamps = val;
+    gsi->rx_ts.sw_valid = false;
+    gsi->rx_ts.hw_valid = false;
+    return 0;
+#endif
 }
 
 static int
-gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
-		       struct gensio_addr *addr,
-		       int (*call_b4_listen)(struct gensio_iod *, void *),
-		       void *data, unsigned int opensock_flags,
-		       struct gensio_opensocks **rfds, unsigned int *nr_fds)
+gensio_stdsock_get_rx_timestamp(struct gensio_iod *iod,
+				struct gensio_sockctl_timestamp *ts)
 {
-    struct addrinfo *rp;
-    int family;
-    struct gensio_opensocks *fds;
-    unsigned int curr_fd = 0, i;
-    unsigned int max_fds = 0;
-    struct addrinfo *ai;
-    int rv = 0;
-    struct gensio_listen_scan_info scaninfo;
+#ifndef GENSIO_STDSOCK_TIMESTAMPS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err;
 
-    if (do_errtrig())
-	return GE_NOMEM;
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
 
-    ai = gensio_addr_addrinfo_get(addr);
-#if HAVE_LIBSCTP
-    if (ai->ai_protocol == IPPROTO_SCTP)
-	return gensio_os_sctp_open_sockets(o, addr, call_b4_listen, data,
+    if (!gsi->timestamps)
+	return GE_NOTREADY;
+    *ts = gsi->rx_ts;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_sendseg(struct gensio_iod *iod, struct gensio_sockctl_seg *seg)
+{
+#ifndef GENSIO_STDSOCK_UDP_GSO
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    struct addrinfo *ai;
+    struct msghdr hdr;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+	unsigned char buf[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr align;
+    } ctrl;
+    uint16_t segsize;
+    sockret rv;
+    int err;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_UDP)
+	return GE_INVAL;
+    if (seg->segsize == 0 || seg->segsize > 65535)
+	return GE_INVAL;
+
+    segsize = seg->segsize;
+    ai = gensio_addr_addrinfo_get_curr(seg->addr);
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = (void *) seg->buf;
+    iov.iov_len = seg->len;
+    hdr.msg_name = (void *) ai->ai_addr;
+    hdr.msg_namelen = ai->ai_addrlen;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(segsize));
+    memcpy(CMSG_DATA(cmsg), &segsize, sizeof(segsize));
+
+ retry:
+    rv = sendmsg(o->iod_get_fd(iod), &hdr, 0);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN) {
+	    seg->sent = 0;
+	    return 0;
+	}
+	/* Older kernels don't know about UDP_SEGMENT. */
+	if (sock_errno == ENOPROTOOPT)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    seg->sent = rv;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_gro(struct gensio_iod *iod, unsigned int val)
+{
+#ifndef GENSIO_STDSOCK_UDP_GRO
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err, ival = !!val;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_UDP)
+	return GE_INVAL;
+
+    if (setsockopt(o->iod_get_fd(iod), SOL_UDP, UDP_GRO,
+		   &ival, sizeof(ival)) == -1) {
+	if (sock_errno == ENOPROTOOPT)
+	    return GE_NOTSUP;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    gsi->gro = ival;
+    gsi->rx_segsize = 0;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_get_rx_segsize(struct gensio_iod *iod, gensiods *segsize)
+{
+#ifndef GENSIO_STDSOCK_UDP_GRO
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (!gsi->gro)
+	return GE_NOTREADY;
+    *segsize = gsi->rx_segsize;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_zerocopy(struct gensio_iod *iod, unsigned int val)
+{
+#ifndef GENSIO_STDSOCK_ZEROCOPY
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err, ival = !!val;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_TCP)
+	return GE_INVAL;
+
+    if (setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_ZEROCOPY,
+		   &ival, sizeof(ival)) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_get_zerocopy_done(struct gensio_iod *iod,
+				 struct gensio_sockctl_zcdone *d)
+{
+#ifndef GENSIO_STDSOCK_ZEROCOPY
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    union {
+	struct cmsghdr align;
+	unsigned char buf[CMSG_SPACE(sizeof(struct sock_extended_err) +
+				     sizeof(struct sockaddr_in6))];
+    } ctrl;
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *ee;
+    int rv;
+
+ retry:
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+    rv = recvmsg(o->iod_get_fd(iod), &hdr, MSG_ERRQUEUE);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN)
+	    return GE_NODATA;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+	      (cmsg->cmsg_level == SOL_IPV6 &&
+	       cmsg->cmsg_type == IPV6_RECVERR)))
+	    continue;
+	ee = (struct sock_extended_err *) CMSG_DATA(cmsg);
+	if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+	    continue;
+	d->lo = ee->ee_info;
+	d->hi = ee->ee_data;
+	d->copied = !!(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+	return 0;
+    }
+
+    /* Something else was on the error queue, look for more. */
+    goto retry;
+#endif
+}
+
+static int
+gensio_stdsock_get_incoming_cpu(struct gensio_iod *iod, unsigned int *cpu)
+{
+#ifndef SO_INCOMING_CPU
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    int val;
+    socklen_t len = sizeof(val);
+
+    if (getsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_INCOMING_CPU,
+		   &val, &len) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+    if (val < 0)
+	return GE_NODATA;
+    *cpu = val;
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_notsent_lowat(struct gensio_iod *iod, unsigned int val)
+{
+#ifndef TCP_NOTSENT_LOWAT
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int err;
+
+    err = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			 (intptr_t) &gsi);
+    if (err)
+	return err;
+
+    if (gsi->protocol != GENSIO_NET_PROTOCOL_TCP)
+	return GE_INVAL;
+
+    if (setsockopt(o->iod_get_fd(iod), IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+		   (void *) &val, sizeof(val)) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+    return 0;
+#endif
+}
+
+static int
+gensio_stdsock_set_rcvbuf(struct gensio_iod *iod, unsigned int ival)
+{
+    struct gensio_os_funcs *o = iod->f;
+    int val = ival;
+
+    if ((int) ival < 0)
+	return GE_INVAL;
+
+#ifdef SO_RCVBUFFORCE
+    /* Try to go over rmem_max first, this only works with privileges. */
+    if (setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_RCVBUFFORCE,
+		   (void *) &val, sizeof(val)) == 0)
+	return 0;
+#endif
+    if (setsockopt(o->iod_get_fd(iod), SOL_SOCKET, SO_RCVBUF,
+		   (void *) &val, sizeof(val)) == -1)
+	return gensio_os_err_to_err(o, sock_errno);
+    return 0;
+}
+
+static int
+gensio_stdsock_set_mcast_all(struct gensio_iod *iod, unsigned int ival)
+{
+#ifndef IP_MULTICAST_ALL
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    struct gensio_stdsock_info *gsi;
+    int rv, val = !!ival;
+
+    rv = o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, true,
+			(intptr_t) &gsi);
+    if (rv)
+	return rv;
+    switch (gsi->family) {
+#if defined(AF_INET6) && defined(IPV6_MULTICAST_ALL)
+    case AF_INET6:
+	rv = setsockopt(o->iod_get_fd(iod), IPPROTO_IPV6, IPV6_MULTICAST_ALL,
+			(void *) &val, sizeof(val));
+	if (rv == -1)
+	    return gensio_os_err_to_err(o, sock_errno);
+	/* Fallthrough, a dual stack socket gets IPv4 multicasts, too. */
+#endif
+    case AF_INET:
+	rv = setsockopt(o->iod_get_fd(iod), IPPROTO_IP, IP_MULTICAST_ALL,
+			(void *) &val, sizeof(val));
+	if (rv == -1 && gsi->family == AF_INET)
+	    return gensio_os_err_to_err(o, sock_errno);
+	break;
+
+    default:
+	return GE_INVAL;
+    }
+    return 0;
+#endif
+}
+
+#ifdef GENSIO_STDSOCK_FDPASS
+union gensio_stdsock_fdctrl {
+    struct cmsghdr align;
+    unsigned char buf[CMSG_SPACE(sizeof(int))];
+};
+#endif
+
+static int
+gensio_stdsock_send_fd(struct gensio_iod *iod, struct gensio_sockctl_fdmsg *m)
+{
+#ifndef GENSIO_STDSOCK_FDPASS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    union gensio_stdsock_fdctrl ctrl;
+    struct msghdr hdr;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    sockret rv;
+    int fd;
+
+    if (!m->iod || m->len == 0)
+	return GE_INVAL;
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    fd = o->iod_get_fd(m->iod);
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = m->buf;
+    iov.iov_len = m->len;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+ retry:
+    rv = sendmsg(o->iod_get_fd(iod), &hdr, 0);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN)
+	    return GE_NODATA;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    if ((gensiods) rv != m->len)
+	/* The socket went with the first byte, the rest is lost. */
+	return GE_COMMERR;
+    return 0;
+#endif
+}
+
+#ifdef GENSIO_STDSOCK_FDPASS
+/* Set up a socket received from another process like accept() does. */
+static int
+gensio_stdsock_import_fd(struct gensio_os_funcs *o, int fd,
+			 struct gensio_sockctl_fdmsg *m)
+{
+    struct gensio_stdsock_info *gsi;
+    struct sockaddr_storage sa;
+    taddrlen len = sizeof(sa);
+    struct gensio_iod *iod;
+    int err, type;
+
+    if (getsockname(fd, (struct sockaddr *) &sa, &len) == -1) {
+	err = gensio_os_err_to_err(o, sock_errno);
+	close_socket(o, fd);
+	return err;
+    }
+    len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1) {
+	err = gensio_os_err_to_err(o, sock_errno);
+	close_socket(o, fd);
+	return err;
+    }
+    if (type != SOCK_STREAM) {
+	close_socket(o, fd);
+	return GE_INVAL;
+    }
+
+    gsi = o->zalloc(o, sizeof(*gsi));
+    if (!gsi) {
+	close_socket(o, fd);
+	return GE_NOMEM;
+    }
+    gsi->family = sa.ss_family;
+    if (sa.ss_family == AF_UNIX)
+	gsi->protocol = GENSIO_NET_PROTOCOL_UNIX;
+    else
+	gsi->protocol = GENSIO_NET_PROTOCOL_TCP;
+    gsi->connected = true;
+
+    err = o->add_iod(o, GENSIO_IOD_SOCKET, fd, &iod);
+    if (err) {
+	o->free(o, gsi);
+	close_socket(o, fd);
+	return err;
+    }
+    err = o->set_non_blocking(iod);
+    if (err) {
+	o->free(o, gsi);
+	o->close(&iod);
+	return err;
+    }
+    o->iod_control(iod, GENSIO_IOD_CONTROL_SOCKINFO, false, (intptr_t) gsi);
+
+    m->iod = iod;
+    m->family = sa.ss_family;
+    return 0;
+}
+#endif
+
+static int
+gensio_stdsock_recv_fd(struct gensio_iod *iod, struct gensio_sockctl_fdmsg *m)
+{
+#ifndef GENSIO_STDSOCK_FDPASS
+    return GE_NOTSUP;
+#else
+    struct gensio_os_funcs *o = iod->f;
+    union gensio_stdsock_fdctrl ctrl;
+    struct msghdr hdr;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    unsigned int i, nfds;
+    int fd, newfd = -1, flags = 0;
+    sockret rv;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    m->iod = NULL;
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = m->buf;
+    iov.iov_len = m->len;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    hdr.msg_controllen = sizeof(ctrl.buf);
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+ retry:
+    rv = recvmsg(o->iod_get_fd(iod), &hdr, flags);
+    if (rv < 0) {
+	if (sock_errno == SOCK_EINTR)
+	    goto retry;
+	if (sock_errno == SOCK_EWOULDBLOCK || sock_errno == SOCK_EAGAIN)
+	    return GE_NODATA;
+	return gensio_os_err_to_err(o, sock_errno);
+    }
+    if (rv == 0)
+	return GE_REMCLOSE;
+    m->len = rv;
+
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+	    continue;
+	nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	for (i = 0; i < nfds; i++) {
+	    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+	    if (newfd == -1)
+		newfd = fd;
+	    else
+		close_socket(o, fd); /* Only one is expected. */
+	}
+    }
+    if (newfd == -1)
+	return 0;
+#ifndef MSG_CMSG_CLOEXEC
+    fcntl(newfd, F_SETFD, FD_CLOEXEC);
+#endif
+
+    return gensio_stdsock_import_fd(o, newfd, m);
+#endif
+}
+
+static int
+gensio_stdsock_control(struct gensio_iod *iod, int func,
+		       void *data, gensiods *datalen)
+{
+    switch (func) {
+    case GENSIO_SOCKCTL_SET_MCAST_LOOP:
+	if (*datalen != sizeof(bool))
+	    return GE_INVAL;
+	return gensio_stdsock_set_mcast_loop(iod, *((bool *) data));
+    case GENSIO_SOCKCTL_GET_MCAST_LOOP:
+	if (*datalen != sizeof(bool))
+	    return GE_INVAL;
+	return gensio_stdsock_get_mcast_loop(iod, ((bool *) data));
+    case GENSIO_SOCKCTL_GET_SOCKNAME:
+	return gensio_stdsock_getsockname(iod, data);
+    case GENSIO_SOCKCTL_GET_PEERNAME:
+	return gensio_stdsock_getpeername(iod, data);
+    case GENSIO_SOCKCTL_GET_PEERRAW:
+	return gensio_stdsock_getpeerraw(iod, data, datalen);
+    case GENSIO_SOCKCTL_GET_PORT:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_get_port(iod, ((unsigned int *) data));
+    case GENSIO_SOCKCTL_CHECK_OPEN:
+	return gensio_stdsock_check_socket_open(iod);
+    case GENSIO_SOCKCTL_SET_MCAST_TTL:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_mcast_ttl(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_GET_MCAST_TTL:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_get_mcast_ttl(iod, ((unsigned int *) data));
+    case GENSIO_SOCKCTL_SET_EXTRAINFO:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_extrainfo(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_GET_EXTRAINFO:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_get_extrainfo(iod, ((unsigned int *) data));
+    case GENSIO_SOCKCTL_RECVMMSG:
+	return gensio_stdsock_recvmmsg(iod, data, datalen);
+    case GENSIO_SOCKCTL_SENDMMSG:
+	return gensio_stdsock_sendmmsg(iod, data, datalen);
+    case GENSIO_SOCKCTL_SET_TIMESTAMPS:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_timestamps(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_GET_RX_TIMESTAMP:
+	if (*datalen != sizeof(struct gensio_sockctl_timestamp))
+	    return GE_INVAL;
+	return gensio_stdsock_get_rx_timestamp(iod, data);
+    case GENSIO_SOCKCTL_SENDSEG:
+	if (*datalen != sizeof(struct gensio_sockctl_seg))
+	    return GE_INVAL;
+	return gensio_stdsock_sendseg(iod, data);
+    case GENSIO_SOCKCTL_SET_GRO:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_gro(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_GET_RX_SEGSIZE:
+	if (*datalen != sizeof(gensiods))
+	    return GE_INVAL;
+	return gensio_stdsock_get_rx_segsize(iod, data);
+    case GENSIO_SOCKCTL_SEND_FD:
+	return gensio_stdsock_send_fd(iod, data);
+    case GENSIO_SOCKCTL_RECV_FD:
+	return gensio_stdsock_recv_fd(iod, data);
+    case GENSIO_SOCKCTL_SET_ZEROCOPY:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_zerocopy(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_GET_ZEROCOPY_DONE:
+	if (*datalen != sizeof(struct gensio_sockctl_zcdone))
+	    return GE_INVAL;
+	return gensio_stdsock_get_zerocopy_done(iod, data);
+    case GENSIO_SOCKCTL_GET_INCOMING_CPU:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_get_incoming_cpu(iod, data);
+    case GENSIO_SOCKCTL_SET_NOTSENT_LOWAT:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_notsent_lowat(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_SET_RCVBUF:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_rcvbuf(iod, *((unsigned int *) data));
+    case GENSIO_SOCKCTL_SET_MCAST_ALL:
+	if (*datalen != sizeof(unsigned int))
+	    return GE_INVAL;
+	return gensio_stdsock_set_mcast_all(iod, *((unsigned int *) data));
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+/*
+ * For assigning zero ports.
+ */
+#define IP_DYNRANGE_START	49152
+#define IP_DYNRANGE_END		65535
+
+static unsigned int
+gensio_dyn_scan_next(unsigned int port)
+{
+    if (port == IP_DYNRANGE_END)
+	return IP_DYNRANGE_START;
+    else
+	return port + 1;
+}
+
+static int
+gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
+		       struct gensio_addr *addr,
+		       int (*call_b4_listen)(struct gensio_iod *, void *),
+		       void *data, unsigned int opensock_flags,
+		       struct gensio_opensocks **rfds, unsigned int *nr_fds)
+{
+    struct addrinfo *rp;
+    int family;
+    struct gensio_opensocks *fds;
+    unsigned int curr_fd = 0, i, j;
+    unsigned int max_fds = 0;
+    unsigned int copies = GENSIO_OPENSOCK_GET_REUSEPORT(opensock_flags);
+    struct addrinfo *ai;
+    int rv = 0;
+    struct gensio_listen_scan_info scaninfo;
+
+    if (do_errtrig())
+	return GE_NOMEM;
+
+    ai = gensio_addr_addrinfo_get(addr);
+#if HAVE_LIBSCTP
+    if (ai->ai_protocol == IPPROTO_SCTP)
+	return gensio_os_sctp_open_sockets(o, addr, call_b4_listen, data,
 					   opensock_flags, rfds, nr_fds);
 #endif
     for (rp = ai; rp != NULL; rp = rp->ai_next)
@@ -2045,6 +2959,9 @@ gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
 
     if (max_fds == 0)
 	return GE_INVAL;
+    if (copies == 0)
+	copies = 1;
+    max_fds *= copies;
 
     fds = o->zalloc(o, sizeof(*fds) * max_fds);
     if (!fds)
@@ -2077,19 +2994,26 @@ gensio_stdsock_open_listen_sockets(struct gensio_os_funcs *o,
 	if (sockaddr_in_list_b4(rp, ai))
 	    continue;
 
-	rv = gensio_setup_listen_socket(o, rp->ai_socktype == SOCK_STREAM,
-					rp->ai_family, rp->ai_socktype,
-					rp->ai_protocol, rp->ai_flags,
-					rp->ai_addr, rp->ai_addrlen,
-					call_b4_listen, data,
-					opensock_flags,
-					&fds[curr_fd].iod, &fds[curr_fd].port,
-					&scaninfo);
-	if (rv)
-	    goto out_close;
-	fds[curr_fd].family = rp->ai_family;
-	fds[curr_fd].flags = rp->ai_flags;
-	curr_fd++;
+	/*
+	 * With reuseport the copies get the same port as the first
+	 * one, scaninfo takes care of that if the port is dynamic.
+	 */
+	for (j = 0; j < copies; j++) {
+	    rv = gensio_setup_listen_socket(o, rp->ai_socktype == SOCK_STREAM,
+					    rp->ai_family, rp->ai_socktype,
+					    rp->ai_protocol, rp->ai_flags,
+					    rp->ai_addr, rp->ai_addrlen,
+					    call_b4_listen, data,
+					    opensock_flags,
+					    &fds[curr_fd].iod,
+					    &fds[curr_fd].port,
+					    &scaninfo);
+	    if (rv)
+		goto out_close;
+	    fds[curr_fd].family = rp->ai_family;
+	    fds[curr_fd].flags = rp->ai_flags;
+	    curr_fd++;
+	}
     }
 #ifdef AF_INET6
     if (family == AF_INET6) {
@@ -2233,6 +3157,36 @@ gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 	}
     }
 
+    if (GENSIO_OPENSOCK_GET_REUSEPORT(opensock_flags) &&
+		family_is_inet(family)) {
+#ifdef SO_REUSEPORT
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		       (void *) &optval, sizeof(optval)) == -1)
+	    goto out_err;
+#else
+	rv = GE_NOTSUP;
+	goto out;
+#endif
+    }
+
+    if ((opensock_flags & GENSIO_OPENSOCK_FASTOPEN) &&
+		protocol == GENSIO_NET_PROTOCOL_TCP) {
+#ifdef TCP_FASTOPEN
+	/* The most pending fast open connections without a full accept. */
+	int qlen = GENSIO_OPENSOCK_GET_FASTOPEN_QLEN(opensock_flags);
+
+	if (!qlen)
+	    qlen = 256;
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+		       (void *) &qlen, sizeof(qlen)) == -1)
+	    goto out_err;
+#else
+	rv = GE_NOTSUP;
+	goto out;
+#endif
+    }
+
     if (check_ipv6_only(family, sockproto, flags, fd) == -1)
 	goto out_err;
 #if !HAVE_WORKING_PORT0
@@ -2314,7 +3268,11 @@ gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 	    goto out;
     }
 
-    if (do_listen && listen(fd, 5) != 0)
+    /*
+     * Let the kernel queue a burst of connections, the accepter takes
+     * several per wakeup.
+     */
+    if (do_listen && listen(fd, SOMAXCONN) != 0)
 	goto out_err;
 
  out:
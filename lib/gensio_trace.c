@@ -31,10 +31,16 @@ trace_gensio_alloc(struct gensio *child, const char *const args[],
     err = gensio_trace_filter_alloc(&p, o, args, &filter);
     if (err)
 	return err;
+    if (gensio_trace_filter_is_passthrough(filter)) {
+	/* It wouldn't do anything, skip the filter and just pass data. */
+	gensio_filter_free(filter);
+	filter = NULL;
+    }
 
     ll = gensio_gensio_ll_alloc(o, child);
     if (!ll) {
-	gensio_filter_free(filter);
+	if (filter)
+	    gensio_filter_free(filter);
 	return GE_NOMEM;
     }
 
@@ -42,7 +48,8 @@ trace_gensio_alloc(struct gensio *child, const char *const args[],
     io = base_gensio_alloc(o, ll, filter, child, "trace", cb, user_data);
     if (!io) {
 	gensio_ll_free(ll);
-	gensio_filter_free(filter);
+	if (filter)
+	    gensio_filter_free(filter);
 	return GE_NOMEM;
     }
 
@@ -30,6 +30,30 @@
  */
 #define GENSIO_DEFAULT_UDP_BUF_SIZE	65536
 
+/* Limit for the rbatch and wbatch options. */
+#define GENSIO_UDP_MAX_BATCH		1024
+
+/*
+ * Size of the buffer holding queued write packets when wbatch is set.
+ * Packets larger than this are sent directly.
+ */
+#define GENSIO_UDP_WBATCH_BUF_SIZE	65536
+
+/*
+ * Initial number of remote address hash buckets, must be a power of
+ * two.  The table doubles when it averages more than two entries per
+ * bucket.
+ */
+#define GENSIO_UDP_HASH_INIT_SIZE	16
+
+/*
+ * Limits for sending queued packets as one buffer with segmentation
+ * offload.  The kernel allows 64 segments, and the whole thing has to
+ * fit in an IP packet.
+ */
+#define GENSIO_UDP_GSO_MAX_SEGS		64
+#define GENSIO_UDP_GSO_MAX_BYTES	65000
+
 struct udpna_data;
 
 enum udpn_state {
@@ -73,10 +97,16 @@ struct udpn_data {
     struct gensio_addr *raddr;		/* Points to remote, for convenience. */
 
     struct gensio_link link;
+
+    /* For the remote address hash in the udpna. */
+    struct gensio_link hash_link;
+    unsigned int hash;
 };
 
 #define gensio_link_to_ndata(l) \
     gensio_container_of(l, struct udpn_data, link);
+#define gensio_hash_link_to_ndata(l) \
+    gensio_container_of(l, struct udpn_data, hash_link);
 
 struct udpna_data;
 
@@ -104,6 +134,7 @@ struct udpna_data {
 
     gensiods max_read_size;
 
+    /* The data and address for the current received packet. */
     unsigned char *read_data;
 
     bool readhandler_read_disabled;
@@ -113,6 +144,17 @@ struct udpna_data {
 
     struct gensio_list closed_udpns;
 
+    /*
+     * Every udpn on udpns or closed_udpns is also in this hash table,
+     * keyed on the remote address, so received packets can be
+     * matched to their udpn without walking the lists.
+     */
+    struct gensio_list *udpn_hash;
+    unsigned int udpn_hash_size;
+    unsigned int udpn_hash_count;
+    unsigned long hash_lookups;
+    unsigned long hash_collisions; /* Non-matching entries compared. */
+
     /*
      * Used to run read callbacks from the selector to avoid running
      * it directly from user calls.
@@ -145,9 +187,62 @@ struct udpna_data {
 
     unsigned int extrainfo; /* Is extrainfo enabled or disabled in the iod? */
 
+    /* Receive timestamps are on, and the ones for the current packet. */
+    bool timestamps;
+    struct gensio_sockctl_timestamp curr_ts;
+
     bool nocon;		/* Disable connection-oriented handling. */
     struct gensio_addr *curr_recvaddr;	/* Address of current received packet */
 
+    /*
+     * Received packets.  Up to rbatch packets are received at once
+     * (with recvmmsg if available) and then delivered one at a time,
+     * read_data and curr_recvaddr point into this.
+     */
+    unsigned int rbatch;
+    unsigned char *rbatch_data;
+    struct gensio_sockctl_mmsg *rbatch_msgs;
+    struct gensio_iod *rbatch_iod;
+    unsigned int rbatch_count;
+    unsigned int rbatch_pos;
+
+    /*
+     * With receive offload, a received buffer may hold several
+     * packets of curr_segsize bytes.  seg_data and seg_left are the
+     * part of the current buffer not delivered yet.
+     */
+    bool gro;
+    gensiods curr_segsize;
+    unsigned char *seg_data;
+    gensiods seg_left;
+
+    /*
+     * Queued write packets if wbatch > 1.  Writes are copied here and
+     * sent together (with sendmmsg if available) from a runner, or
+     * when the queue fills up.
+     */
+    unsigned int wbatch;
+    unsigned char *wq_data;
+    gensiods wq_used;
+    struct gensio_sockctl_mmsg *wq_msgs;
+    struct gensio_iod **wq_iods;
+    unsigned int wq_count;
+    bool wq_flush_pending;
+    struct gensio_runner *wq_runner;
+
+    /* Send runs of equal size queued packets with segmentation offload. */
+    bool gso;
+
+    /* If non-zero, set SO_RCVBUF on the sockets to this. */
+    unsigned int rcvbuf;
+
+    /*
+     * Multicast groups for an accepter.  Each group is joined on one
+     * socket only, spread over the reuseport sockets, so each socket
+     * receives its own set of groups.
+     */
+    struct gensio_addr *mcast;
+
     bool in_write;
     unsigned int read_disable_count;
     bool read_disabled;
@@ -161,6 +256,13 @@ struct udpna_data {
 
 static void udpna_do_free(struct udpna_data *nadata);
 
+/* Are there received packets that have not been delivered? */
+static bool
+udpna_packets_left(struct udpna_data *nadata)
+{
+    return nadata->seg_left || nadata->rbatch_pos < nadata->rbatch_count;
+}
+
 static void
 i_udpna_lock(struct udpna_data *nadata)
 {
@@ -289,22 +391,63 @@ static void udpna_start_deferred_op(struct udpna_data *nadata)
     }
 }
 
+static void
+udpna_hash_grow(struct udpna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_list *nhash;
+    struct gensio_link *l, *l2;
+    unsigned int i, nsize = nadata->udpn_hash_size * 2;
+
+    nhash = o->zalloc(o, sizeof(*nhash) * nsize);
+    if (!nhash)
+	return; /* Just live with longer chains. */
+    for (i = 0; i < nsize; i++)
+	gensio_list_init(&nhash[i]);
+
+    for (i = 0; i < nadata->udpn_hash_size; i++) {
+	gensio_list_for_each_safe(&nadata->udpn_hash[i], l, l2) {
+	    struct udpn_data *ndata = gensio_hash_link_to_ndata(l);
+
+	    gensio_list_rm(&nadata->udpn_hash[i], l);
+	    gensio_list_add_tail(&nhash[ndata->hash & (nsize - 1)], l);
+	}
+    }
+    o->free(o, nadata->udpn_hash);
+    nadata->udpn_hash = nhash;
+    nadata->udpn_hash_size = nsize;
+}
+
 static void
 udpn_remove_from_list(struct gensio_list *list, struct udpn_data *ndata)
 {
+    struct udpna_data *nadata = ndata->nadata;
+
     gensio_list_rm(list, &ndata->link);
+    gensio_list_rm(&nadata->udpn_hash[ndata->hash &
+				      (nadata->udpn_hash_size - 1)],
+		   &ndata->hash_link);
+    nadata->udpn_hash_count--;
 }
 
 static struct udpn_data *
-udpn_find(struct gensio_list *list, struct gensio_addr *addr)
+udpn_find(struct udpna_data *nadata, struct gensio_list *list,
+	  struct gensio_addr *addr)
 {
+    unsigned int hash = gensio_addr_hash(addr, true);
+    struct gensio_list *bucket;
     struct gensio_link *l;
 
-    gensio_list_for_each(list, l) {
-	struct udpn_data *ndata = gensio_link_to_ndata(l);
+    nadata->hash_lookups++;
+    bucket = &nadata->udpn_hash[hash & (nadata->udpn_hash_size - 1)];
+    gensio_list_for_each(bucket, l) {
+	struct udpn_data *ndata = gensio_hash_link_to_ndata(l);
 
-	if (gensio_addr_equal(ndata->raddr, addr, true, false))
+	if (ndata->hash == hash &&
+		gensio_list_link_in_this_list(&ndata->link, list) &&
+		gensio_addr_equal(ndata->raddr, addr, true, false))
 	    return ndata;
+	nadata->hash_collisions++;
     }
 
     return NULL;
@@ -312,7 +455,16 @@ udpn_find(struct gensio_list *list, struct gensio_addr *addr)
 
 static void udpn_add_to_list(struct gensio_list *list, struct udpn_data *ndata)
 {
+    struct udpna_data *nadata = ndata->nadata;
+
     gensio_list_add_tail(list, &ndata->link);
+
+    if (nadata->udpn_hash_count >= nadata->udpn_hash_size * 2)
+	udpna_hash_grow(nadata);
+    gensio_list_add_tail(&nadata->udpn_hash[ndata->hash &
+					    (nadata->udpn_hash_size - 1)],
+			 &ndata->hash_link);
+    nadata->udpn_hash_count++;
 }
 
 static void
@@ -413,12 +565,31 @@ udpna_do_free(struct udpna_data *nadata)
 	nadata->o->free_runner(nadata->enable_done_runner);
     if (nadata->ai)
 	gensio_addr_free(nadata->ai);
+    if (nadata->mcast)
+	gensio_addr_free(nadata->mcast);
     if (nadata->fds)
 	nadata->o->free(nadata->o, nadata->fds);
-    if (nadata->curr_recvaddr)
-	gensio_addr_free(nadata->curr_recvaddr);
-    if (nadata->read_data)
-	nadata->o->free(nadata->o, nadata->read_data);
+    if (nadata->rbatch_msgs) {
+	for (i = 0; i < nadata->rbatch; i++) {
+	    if (nadata->rbatch_msgs[i].addr)
+		gensio_addr_free(nadata->rbatch_msgs[i].addr);
+	}
+	nadata->o->free(nadata->o, nadata->rbatch_msgs);
+    }
+    if (nadata->rbatch_data)
+	gensio_os_buf_free(nadata->o, nadata->rbatch_data);
+    for (i = 0; i < nadata->wq_count; i++)
+	gensio_addr_free(nadata->wq_msgs[i].addr);
+    if (nadata->wq_msgs)
+	nadata->o->free(nadata->o, nadata->wq_msgs);
+    if (nadata->wq_iods)
+	nadata->o->free(nadata->o, nadata->wq_iods);
+    if (nadata->wq_data)
+	gensio_os_buf_free(nadata->o, nadata->wq_data);
+    if (nadata->wq_runner)
+	nadata->o->free_runner(nadata->wq_runner);
+    if (nadata->udpn_hash)
+	nadata->o->free(nadata->o, nadata->udpn_hash);
     if (nadata->lock)
 	nadata->o->free_lock(nadata->lock);
     if (nadata->acc)
@@ -478,6 +649,200 @@ udpn_finish_free(struct udpn_data *ndata)
     udpna_check_finish_free(nadata);
 }
 
+/*
+ * Return how many of the n queued packets starting at msgs can be
+ * sent as one buffer with segmentation offload.  They must go to the
+ * same address and all be the same size, except the last may be
+ * shorter.  The packets are contiguous in wq_data.
+ */
+static unsigned int
+udpna_gso_count(struct gensio_sockctl_mmsg *msgs, unsigned int n)
+{
+    gensiods segsize = msgs[0].len, total = segsize;
+    unsigned int i;
+
+    if (n > GENSIO_UDP_GSO_MAX_SEGS)
+	n = GENSIO_UDP_GSO_MAX_SEGS;
+    for (i = 1; i < n; i++) {
+	if (msgs[i].len > segsize || total + msgs[i].len >
+			GENSIO_UDP_GSO_MAX_BYTES)
+	    break;
+	if (!gensio_addr_equal(msgs[i].addr, msgs[0].addr, true, false))
+	    break;
+	total += msgs[i].len;
+	if (msgs[i].len < segsize) {
+	    i++;
+	    break;
+	}
+    }
+    return i;
+}
+
+/*
+ * Send n packets starting at msgs with segmentation offload.  Sets
+ * count to the number sent, 0 if the send would block.
+ */
+static int
+udpna_send_gso(struct udpna_data *nadata, struct gensio_iod *iod,
+	       struct gensio_sockctl_mmsg *msgs, unsigned int n,
+	       gensiods *count)
+{
+    struct gensio_sockctl_seg seg;
+    gensiods size = sizeof(seg);
+    unsigned int i;
+    int err;
+
+    seg.buf = msgs[0].buf;
+    seg.segsize = msgs[0].len;
+    seg.addr = msgs[0].addr;
+    for (i = 0, seg.len = 0; i < n; i++)
+	seg.len += msgs[i].len;
+    err = nadata->o->sock_control(iod, GENSIO_SOCKCTL_SENDSEG, &seg, &size);
+    if (!err)
+	*count = seg.sent ? n : 0;
+    return err;
+}
+
+/*
+ * Send all the queued write packets.  Packets for the same iod are
+ * sent together.  Packets that can't be sent are dropped, as if they
+ * were lost on the network.  Must be called with the nadata lock held.
+ */
+static void
+udpna_flush_writes(struct udpna_data *nadata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct gensio_sockctl_mmsg *m;
+    struct gensio_sg sg;
+    struct gensio_iod *iod;
+    unsigned int i, j, n, k;
+    gensiods count;
+    int err;
+
+    for (i = 0; i < nadata->wq_count; i += n) {
+	iod = nadata->wq_iods[i];
+	for (n = 1; i + n < nadata->wq_count; n++) {
+	    if (nadata->wq_iods[i + n] != iod)
+		break;
+	}
+
+	for (j = 0; j < n; j += count) {
+	    count = n - j;
+	    if (nadata->gso) {
+		m = &nadata->wq_msgs[i + j];
+		k = udpna_gso_count(m, n - j);
+		if (k > 1) {
+		    err = udpna_send_gso(nadata, iod, m, k, &count);
+		    if (!err) {
+			if (count == 0)
+			    break;
+			continue;
+		    }
+		    if (err == GE_NOTSUP)
+			nadata->gso = false;
+		    /* Send this run normally. */
+		    count = k;
+		} else {
+		    /* Send up to the next run that can use offload. */
+		    for (count = 1; j + count < n; count++) {
+			if (udpna_gso_count(m + count, n - j - count) > 1)
+			    break;
+		    }
+		}
+	    }
+	    err = o->sock_control(iod, GENSIO_SOCKCTL_SENDMMSG,
+				  &nadata->wq_msgs[i + j], &count);
+	    if (err == GE_NOTSUP) {
+		/* Send one at a time. */
+		m = &nadata->wq_msgs[i + j];
+		sg.buf = m->buf;
+		sg.buflen = m->len;
+		err = o->sendto(iod, &sg, 1, NULL, 0, m->addr);
+		count = 1;
+	    }
+	    if (err || count == 0)
+		break;
+	}
+    }
+
+    for (i = 0; i < nadata->wq_count; i++)
+	gensio_addr_free(nadata->wq_msgs[i].addr);
+    nadata->wq_count = 0;
+    nadata->wq_used = 0;
+}
+
+static void
+udpna_wq_runner(struct gensio_runner *runner, void *cbdata)
+{
+    struct udpna_data *nadata = cbdata;
+
+    udpna_lock(nadata);
+    nadata->wq_flush_pending = false;
+    udpna_flush_writes(nadata);
+    udpna_deref_and_unlock(nadata);
+}
+
+/*
+ * Queue a packet for sending.  This takes ownership of addr if
+ * free_addr is set.  Returns GE_TOOBIG if the packet is too big to
+ * queue, in that case the caller must send it and still owns addr.
+ */
+static int
+udpna_queue_write(struct udpna_data *nadata, struct gensio_iod *iod,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  gensiods *count, struct gensio_addr *addr, bool free_addr)
+{
+    struct gensio_sockctl_mmsg *m;
+    gensiods i, len = 0;
+
+    for (i = 0; i < sglen; i++)
+	len += sg[i].buflen;
+
+    udpna_lock(nadata);
+    if (len > GENSIO_UDP_WBATCH_BUF_SIZE) {
+	/* Keep the packets in order. */
+	udpna_flush_writes(nadata);
+	udpna_unlock(nadata);
+	return GE_TOOBIG;
+    }
+
+    if (!free_addr) {
+	addr = gensio_addr_dup(addr);
+	if (!addr) {
+	    udpna_unlock(nadata);
+	    return GE_NOMEM;
+	}
+    }
+
+    if (nadata->wq_count == nadata->wbatch ||
+		nadata->wq_used + len > GENSIO_UDP_WBATCH_BUF_SIZE)
+	udpna_flush_writes(nadata);
+
+    m = &nadata->wq_msgs[nadata->wq_count];
+    m->buf = nadata->wq_data + nadata->wq_used;
+    m->len = len;
+    m->addr = addr;
+    for (i = 0, len = 0; i < sglen; i++) {
+	memcpy(nadata->wq_data + nadata->wq_used + len, sg[i].buf,
+	       sg[i].buflen);
+	len += sg[i].buflen;
+    }
+    nadata->wq_iods[nadata->wq_count] = iod;
+    nadata->wq_count++;
+    nadata->wq_used += len;
+
+    if (!nadata->wq_flush_pending) {
+	udpna_ref(nadata);
+	nadata->wq_flush_pending = true;
+	nadata->o->run(nadata->wq_runner);
+    }
+    udpna_unlock(nadata);
+
+    if (count)
+	*count = len;
+    return 0;
+}
+
 static int
 udpn_write(struct gensio *io, gensiods *count,
 	   const struct gensio_sg *sg, gensiods sglen,
@@ -506,6 +871,14 @@ udpn_write(struct gensio *io, gensiods *count,
     if (!addr)
 	addr = ndata->raddr;
 
+    if (ndata->nadata->wbatch > 1) {
+	err = udpna_queue_write(ndata->nadata, ndata->myiod, sg, sglen, count,
+				addr, free_addr);
+	if (err != GE_TOOBIG)
+	    return err;
+	/* Too big to queue, just send it. */
+    }
+
     err = ndata->o->sendto(ndata->myiod, sg, sglen, count, 0, addr);
     if (free_addr)
 	gensio_addr_free(addr);
@@ -536,12 +909,22 @@ udpn_finish_close(struct udpna_data *nadata, struct udpn_data *ndata)
     if (nadata->pending_data_owner == ndata) {
 	nadata->pending_data_owner = NULL;
 	nadata->data_pending_len = 0;
+	if (udpna_packets_left(nadata))
+	    /* Deliver the rest of the received packets. */
+	    udpna_start_deferred_op(nadata);
     }
 
     if (ndata->freed && !ndata->deferred_op_pending)
 	udpn_finish_free(ndata);
 }
 
+static void
+udp_fmt_time(char *buf, gensiods len, const char *name, gensio_time *t)
+{
+    snprintf(buf, len, "%s=%lld.%9.9ld", name, (long long) t->secs,
+	     (long) t->nsecs);
+}
+
 static void
 udpn_finish_read(struct udpn_data *ndata)
 {
@@ -551,7 +934,9 @@ udpn_finish_read(struct udpn_data *ndata)
     char raddrdata[200];
     char daddrdata[200];
     char ifidx[20];
-    const char *auxmem[4] = { NULL, NULL, NULL, NULL };
+    char ts_sw[40], ts_hw[40];
+    const char *auxmem[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+    unsigned int auxpos;
     const char *const *auxdata;
     int err;
     gensiods pos;
@@ -573,6 +958,7 @@ udpn_finish_read(struct udpn_data *ndata)
 	raddrdata[sizeof(raddrdata) - 1] = '\0';
     }
 
+    auxpos = 1;
     if (ndata->extrainfo) {
 	/* Get the ifidx */
 	if (gensio_addr_next(nadata->curr_recvaddr)) {
@@ -580,7 +966,7 @@ udpn_finish_read(struct udpn_data *ndata)
 	    err = gensio_addr_to_str(nadata->curr_recvaddr, ifidx, &pos,
 				     sizeof(ifidx));
 	    if (!err)
-		auxmem[1] = ifidx;
+		auxmem[auxpos++] = ifidx;
 	}
 	/* Get the destination address */
 	if (gensio_addr_next(nadata->curr_recvaddr)) {
@@ -593,11 +979,20 @@ udpn_finish_read(struct udpn_data *ndata)
 		pos -= 2;
 		if (daddrdata[pos] == ',' && daddrdata[pos + 1] == '0')
 		    daddrdata[pos] = '\0';
-		auxmem[2] = daddrdata;
+		auxmem[auxpos++] = daddrdata;
 	    }
 	}
     }
 
+    if (nadata->curr_ts.sw_valid) {
+	udp_fmt_time(ts_sw, sizeof(ts_sw), "timestamp", &nadata->curr_ts.sw);
+	auxmem[auxpos++] = ts_sw;
+    }
+    if (nadata->curr_ts.hw_valid) {
+	udp_fmt_time(ts_hw, sizeof(ts_hw), "hwtimestamp", &nadata->curr_ts.hw);
+	auxmem[auxpos++] = ts_hw;
+    }
+
     err = gensio_cb(io, GENSIO_EVENT_READ, 0, nadata->read_data,
 		    &count, auxdata);
     udpna_lock(nadata);
@@ -624,6 +1019,8 @@ udpn_finish_read(struct udpn_data *ndata)
     udpna_check_read_state(nadata);
 }
 
+static void udpna_handle_packets(struct udpna_data *nadata);
+
 static void
 udpna_deferred_op(struct gensio_runner *runner, void *cbdata)
 {
@@ -644,6 +1041,9 @@ udpna_deferred_op(struct gensio_runner *runner, void *cbdata)
 	}
     }
 
+    if (!nadata->data_pending_len && udpna_packets_left(nadata))
+	udpna_handle_packets(nadata);
+
     if (nadata->in_shutdown && !nadata->in_new_connection) {
 	struct gensio_accepter *accepter = nadata->acc;
 
@@ -1236,6 +1636,7 @@ udp_alloc_gensio(struct udpna_data *nadata, struct gensio_iod *iod,
 	nadata->o->free(nadata->o, ndata);
 	return NULL;
     }
+    ndata->hash = gensio_addr_hash(ndata->raddr, true);
 
     ndata->io = gensio_data_alloc(nadata->o, cb, user_data, gensio_udp_func,
 				  NULL, "udp", ndata);
@@ -1256,36 +1657,14 @@ udp_alloc_gensio(struct udpna_data *nadata, struct gensio_iod *iod,
     return ndata;
 }
 
+/*
+ * Deliver the current packet in read_data and curr_recvaddr, received
+ * on iod, to its gensio.
+ */
 static void
-udpna_readhandler(struct gensio_iod *iod, void *cbdata)
+udpna_handle_packet(struct udpna_data *nadata, struct gensio_iod *iod)
 {
-    struct udpna_data *nadata = cbdata;
     struct udpn_data *ndata;
-    gensiods datalen;
-    int err;
-
-    udpna_lock_and_ref(nadata);
-    if (nadata->data_pending_len) {
-	nadata->readhandler_read_disabled = true;
-	udpna_fd_read_disable(nadata);
-	goto out_unlock;
-    }
-
-    err = nadata->o->recvfrom(iod, nadata->read_data, nadata->max_read_size,
-			      &datalen, 0, nadata->curr_recvaddr);
-    if (err) {
-	if (!nadata->is_dummy)
-	    /* Don't log on dummy accepters. */
-	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
-			   "Could not accept on UDP: %s",
-			   gensio_err_to_str(err));
-	goto out_unlock;
-    }
-    if (datalen == 0)
-	goto out_unlock;
-
-    nadata->data_pending_len = datalen;
-    nadata->data_pos = 0;
 
     if (nadata->nocon) {
 	if (gensio_list_empty(&nadata->udpns)) {
@@ -1294,7 +1673,7 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 	    ndata = gensio_link_to_ndata(gensio_list_first(&nadata->udpns));
 	}
     } else {
-	ndata = udpn_find(&nadata->udpns, nadata->curr_recvaddr);
+	ndata = udpn_find(nadata, &nadata->udpns, nadata->curr_recvaddr);
     }
     if (ndata) {
 	/* Data belongs to an existing connection. */
@@ -1304,7 +1683,7 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 
     if (nadata->closed || !nadata->enabled) {
 	nadata->data_pending_len = 0;
-	goto out_unlock_enable;
+	return;
     }
 
     /* New connection. */
@@ -1349,7 +1728,7 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 
     if (ndata->state == UDPN_IN_CLOSE) {
 	udpn_finish_close(nadata, ndata);
-	goto out_unlock_enable;
+	return;
     }
 
     if (nadata->in_shutdown) {
@@ -1364,13 +1743,122 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
 	ndata->in_read = false;
     }
     udpna_check_finish_free(nadata);
-    goto out_unlock_enable;
+    return;
 
  out_nomem:
     nadata->data_pending_len = 0;
     gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		   "Out of memory allocating for udp port");
- out_unlock_enable:
+}
+
+/*
+ * Deliver received packets until they are all delivered or one is not
+ * completely consumed by its gensio.
+ */
+static void
+udpna_handle_packets(struct udpna_data *nadata)
+{
+    struct gensio_sockctl_mmsg *m;
+    gensiods len;
+
+    while (!nadata->data_pending_len && !nadata->finished_free &&
+	   udpna_packets_left(nadata)) {
+	if (!nadata->seg_left) {
+	    m = &nadata->rbatch_msgs[nadata->rbatch_pos++];
+	    if (m->len == 0)
+		continue;
+	    nadata->curr_recvaddr = m->addr;
+	    nadata->seg_data = m->buf;
+	    nadata->seg_left = m->len;
+	}
+	/* Split up buffers from receive offload into their packets. */
+	len = nadata->seg_left;
+	if (nadata->curr_segsize && len > nadata->curr_segsize)
+	    len = nadata->curr_segsize;
+	nadata->read_data = nadata->seg_data;
+	nadata->data_pending_len = len;
+	nadata->data_pos = 0;
+	nadata->seg_data += len;
+	nadata->seg_left -= len;
+	udpna_handle_packet(nadata, nadata->rbatch_iod);
+    }
+}
+
+/* Receive up to rbatch packets from iod. */
+static int
+udpna_recv(struct udpna_data *nadata, struct gensio_iod *iod)
+{
+    struct gensio_sockctl_mmsg *m = nadata->rbatch_msgs;
+    gensiods count;
+    int err;
+
+    nadata->rbatch_iod = iod;
+    nadata->rbatch_pos = 0;
+    nadata->rbatch_count = 0;
+    nadata->curr_segsize = 0;
+    /* recvmmsg can't return timestamps or segment sizes. */
+    if (nadata->rbatch > 1 && !nadata->timestamps && !nadata->gro) {
+	count = nadata->rbatch;
+	err = nadata->o->sock_control(iod, GENSIO_SOCKCTL_RECVMMSG, m, &count);
+	if (!err)
+	    nadata->rbatch_count = count;
+	if (err != GE_NOTSUP)
+	    return err;
+    }
+
+    err = nadata->o->recvfrom(iod, m->buf, m->buflen, &m->len, 0, m->addr);
+    if (!err && m->len)
+	nadata->rbatch_count = 1;
+    if (!err && nadata->timestamps) {
+	gensiods size = sizeof(nadata->curr_ts);
+
+	if (nadata->o->sock_control(iod, GENSIO_SOCKCTL_GET_RX_TIMESTAMP,
+				    &nadata->curr_ts, &size))
+	    memset(&nadata->curr_ts, 0, sizeof(nadata->curr_ts));
+    }
+    if (!err && nadata->gro) {
+	gensiods size = sizeof(nadata->curr_segsize);
+
+	if (nadata->o->sock_control(iod, GENSIO_SOCKCTL_GET_RX_SEGSIZE,
+				    &nadata->curr_segsize, &size))
+	    nadata->curr_segsize = 0;
+    }
+    return err;
+}
+
+static void
+udpna_readhandler(struct gensio_iod *iod, void *cbdata)
+{
+    struct udpna_data *nadata = cbdata;
+    int err;
+
+    udpna_lock_and_ref(nadata);
+    if (nadata->data_pending_len) {
+	nadata->readhandler_read_disabled = true;
+	udpna_fd_read_disable(nadata);
+	goto out_unlock;
+    }
+
+    if (!udpna_packets_left(nadata)) {
+	err = udpna_recv(nadata, iod);
+	if (err) {
+	    if (!nadata->is_dummy)
+		/* Don't log on dummy accepters. */
+		gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			       "Could not accept on UDP: %s",
+			       gensio_err_to_str(err));
+	    goto out_unlock;
+	}
+	if (nadata->rbatch_count == 0)
+	    goto out_unlock;
+    }
+
+    udpna_handle_packets(nadata);
+
+    /* Send any responses generated while handling the packets. */
+    if (nadata->wq_count)
+	udpna_flush_writes(nadata);
+
     if (nadata->readhandler_read_disabled) {
 	nadata->readhandler_read_disabled = false;
 	udpna_fd_read_enable(nadata);
@@ -1379,6 +1867,97 @@ udpna_readhandler(struct gensio_iod *iod, void *cbdata)
     udpna_deref_and_unlock(nadata);
 }
 
+/* Turn on a socket feature that takes an unsigned int 1 to enable. */
+static int
+udp_sock_enable(struct gensio_os_funcs *o, struct gensio_iod *iod, int func)
+{
+    unsigned int val = 1;
+    gensiods size = sizeof(val);
+
+    return o->sock_control(iod, func, &val, &size);
+}
+
+static int
+udp_setup_iod(struct gensio_os_funcs *o, struct gensio_iod *iod,
+	      bool timestamps, bool gro, unsigned int rcvbuf)
+{
+    gensiods size = sizeof(rcvbuf);
+    int err = 0;
+
+    if (timestamps)
+	err = udp_sock_enable(o, iod, GENSIO_SOCKCTL_SET_TIMESTAMPS);
+    if (!err && gro)
+	err = udp_sock_enable(o, iod, GENSIO_SOCKCTL_SET_GRO);
+    if (!err && rcvbuf)
+	err = o->sock_control(iod, GENSIO_SOCKCTL_SET_RCVBUF, &rcvbuf, &size);
+    return err;
+}
+
+static int
+udpna_setup_socket(struct gensio_iod *iod, void *data)
+{
+    struct udpna_data *nadata = data;
+    unsigned int val = 0;
+    gensiods size = sizeof(val);
+    int err;
+
+    err = udp_setup_iod(nadata->o, iod, nadata->timestamps, nadata->gro,
+			nadata->rcvbuf);
+    if (err)
+	return err;
+
+    /*
+     * Only receive the groups joined on this socket, otherwise every
+     * socket bound to the port gets every group.  If the OS can't do
+     * this each socket will get all the groups, not a disaster.
+     */
+    if (nadata->mcast &&
+		GENSIO_OPENSOCK_GET_REUSEPORT(nadata->opensock_flags) > 1) {
+	err = nadata->o->sock_control(iod, GENSIO_SOCKCTL_SET_MCAST_ALL,
+				      &val, &size);
+	if (err == GE_NOTSUP)
+	    err = 0;
+    }
+    return err;
+}
+
+/*
+ * Join each multicast group on one of the sockets that can take it,
+ * going round robin through them.
+ */
+static int
+udpna_join_mcast(struct udpna_data *nadata)
+{
+    struct gensio_addr *mcast = nadata->mcast;
+    unsigned int i, nr_usable, next = 0, pick;
+    int err;
+
+    gensio_addr_rewind(mcast);
+    do {
+	nr_usable = 0;
+	for (i = 0; i < nadata->nr_fds; i++) {
+	    if (gensio_addr_family_supports(mcast, nadata->fds[i].family,
+					    nadata->fds[i].flags))
+		nr_usable++;
+	}
+	if (nr_usable == 0)
+	    return GE_INVAL;
+	pick = next++ % nr_usable;
+	for (i = 0; i < nadata->nr_fds; i++) {
+	    if (!gensio_addr_family_supports(mcast, nadata->fds[i].family,
+					     nadata->fds[i].flags))
+		continue;
+	    if (pick-- == 0)
+		break;
+	}
+	err = nadata->o->mcast_add(nadata->fds[i].iod, mcast, 0, true);
+	if (err)
+	    return err;
+    } while (gensio_addr_next(mcast));
+
+    return 0;
+}
+
 static int
 udpna_startup(struct gensio_accepter *accepter)
 {
@@ -1389,11 +1968,26 @@ udpna_startup(struct gensio_accepter *accepter)
     if (!nadata->fds) {
 	rv = gensio_os_open_listen_sockets(nadata->o, nadata->ai,
 				   udpna_readhandler, udpna_writehandler,
-				   udpna_fd_cleared, NULL, nadata,
+				   udpna_fd_cleared, udpna_setup_socket, nadata,
 				   nadata->opensock_flags,
 				   &nadata->fds, &nadata->nr_fds);
 	if (rv)
 	    goto out_unlock;
+	if (nadata->mcast) {
+	    rv = udpna_join_mcast(nadata);
+	    if (rv) {
+		unsigned int i;
+
+		for (i = 0; i < nadata->nr_fds; i++) {
+		    nadata->o->clear_fd_handlers_norpt(nadata->fds[i].iod);
+		    nadata->o->close(&nadata->fds[i].iod);
+		}
+		nadata->o->free(nadata->o, nadata->fds);
+		nadata->fds = NULL;
+		nadata->nr_fds = 0;
+		goto out_unlock;
+	    }
+	}
     }
 
     nadata->enabled = true;
@@ -1550,9 +2144,9 @@ udpna_str_to_gensio(struct gensio_accepter *accepter, const char *addrstr,
  found:
 
     udpna_lock(nadata);
-    ndata = udpn_find(&nadata->udpns, addr);
+    ndata = udpn_find(nadata, &nadata->udpns, addr);
     if (!ndata)
-	ndata = udpn_find(&nadata->closed_udpns, addr);
+	ndata = udpn_find(nadata, &nadata->closed_udpns, addr);
     if (ndata) {
 	udpna_unlock(nadata);
 	err = GE_EXISTS;
@@ -1598,6 +2192,16 @@ udpna_control(struct gensio_accepter *acc, bool get,
     case GENSIO_ACC_CONTROL_LPORT:
 	return udpna_control_lport(nadata, get, data, datalen);
 
+    case GENSIO_ACC_CONTROL_LOOKUP_STATS:
+	if (!get)
+	    return GE_NOTSUP;
+	udpna_lock(nadata);
+	*datalen = snprintf(data, *datalen, "%lu %lu %u %u",
+			    nadata->hash_lookups, nadata->hash_collisions,
+			    nadata->udpn_hash_count, nadata->udpn_hash_size);
+	udpna_unlock(nadata);
+	return 0;
+
     default:
 	return GE_NOTSUP;
     }
@@ -1641,11 +2245,14 @@ gensio_acc_udp_func(struct gensio_accepter *acc, int func, int val,
 static int
 i_udp_gensio_accepter_alloc(const struct gensio_addr *iai,
 			    gensiods max_read_size,
-			    bool reuseaddr, struct gensio_os_funcs *o,
+			    unsigned int rbatch, unsigned int wbatch,
+			    bool reuseaddr, bool gro, struct gensio_os_funcs *o,
 			    gensio_accepter_event cb, void *user_data,
 			    struct gensio_accepter **accepter)
 {
     struct udpna_data *nadata;
+    gensiods recv_size = max_read_size;
+    unsigned int i;
 
     nadata = o->zalloc(o, sizeof(*nadata));
     if (!nadata)
@@ -1653,6 +2260,13 @@ i_udp_gensio_accepter_alloc(const struct gensio_addr *iai,
     nadata->o = o;
     gensio_list_init(&nadata->udpns);
     gensio_list_init(&nadata->closed_udpns);
+    nadata->udpn_hash_size = GENSIO_UDP_HASH_INIT_SIZE;
+    nadata->udpn_hash = o->zalloc(o, sizeof(*nadata->udpn_hash) *
+				  nadata->udpn_hash_size);
+    if (!nadata->udpn_hash)
+	goto out_nomem;
+    for (i = 0; i < nadata->udpn_hash_size; i++)
+	gensio_list_init(&nadata->udpn_hash[i]);
     nadata->refcount = 1;
     if (reuseaddr)
 	nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEADDR;
@@ -1662,9 +2276,46 @@ i_udp_gensio_accepter_alloc(const struct gensio_addr *iai,
     if (!nadata->ai && iai) /* Allow a null ai if it was passed in. */
 	goto out_nomem;
 
-    nadata->read_data = o->zalloc(o, max_read_size);
-    if (!nadata->read_data)
+    /*
+     * With receive offload a single receive can get up to a full
+     * size UDP packet worth of data, make sure it fits.
+     */
+    nadata->gro = gro;
+    if (gro && recv_size < GENSIO_DEFAULT_UDP_BUF_SIZE)
+	recv_size = GENSIO_DEFAULT_UDP_BUF_SIZE;
+
+    nadata->rbatch = rbatch;
+    nadata->rbatch_data = gensio_os_buf_alloc(o, recv_size * rbatch);
+    if (!nadata->rbatch_data)
+	goto out_nomem;
+    nadata->rbatch_msgs = o->zalloc(o, sizeof(*nadata->rbatch_msgs) * rbatch);
+    if (!nadata->rbatch_msgs)
 	goto out_nomem;
+    for (i = 0; i < rbatch; i++) {
+	nadata->rbatch_msgs[i].buf = nadata->rbatch_data + i * recv_size;
+	nadata->rbatch_msgs[i].buflen = recv_size;
+	nadata->rbatch_msgs[i].addr = o->addr_alloc_recvfrom(o);
+	if (!nadata->rbatch_msgs[i].addr)
+	    goto out_nomem;
+    }
+    nadata->read_data = nadata->rbatch_data;
+    nadata->curr_recvaddr = nadata->rbatch_msgs[0].addr;
+
+    nadata->wbatch = wbatch;
+    if (wbatch > 1) {
+	nadata->wq_data = gensio_os_buf_alloc(o, GENSIO_UDP_WBATCH_BUF_SIZE);
+	if (!nadata->wq_data)
+	    goto out_nomem;
+	nadata->wq_msgs = o->zalloc(o, sizeof(*nadata->wq_msgs) * wbatch);
+	if (!nadata->wq_msgs)
+	    goto out_nomem;
+	nadata->wq_iods = o->zalloc(o, sizeof(*nadata->wq_iods) * wbatch);
+	if (!nadata->wq_iods)
+	    goto out_nomem;
+	nadata->wq_runner = o->alloc_runner(o, udpna_wq_runner, nadata);
+	if (!nadata->wq_runner)
+	    goto out_nomem;
+    }
 
     nadata->deferred_op_runner = o->alloc_runner(o, udpna_deferred_op, nadata);
     if (!nadata->deferred_op_runner)
@@ -1680,10 +2331,6 @@ i_udp_gensio_accepter_alloc(const struct gensio_addr *iai,
     if (!nadata->lock)
 	goto out_nomem;
 
-    nadata->curr_recvaddr = o->addr_alloc_recvfrom(o);
-    if (!nadata->curr_recvaddr)
-	goto out_nomem;
-
     nadata->acc = gensio_acc_data_alloc(o, cb, user_data, gensio_acc_udp_func,
 					NULL, "udp", nadata);
     if (!nadata->acc)
@@ -1709,25 +2356,85 @@ udp_gensio_accepter_alloc(const void *gdata,
 {
     const struct gensio_addr *iai = gdata;
     gensiods max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE;
-    unsigned int i;
-    bool reuseaddr = false;
+    unsigned int i, rbatch = 1, wbatch = 1, reuseport = 0, rcvbuf = 0;
+    bool reuseaddr = false, timestamps = false, gso = false, gro = false;
+    struct gensio_addr *mcast = NULL, *tmpaddr, *tmpaddr2;
     int err, ival;
     GENSIO_DECLARE_PPACCEPTER(p, o, cb, "udp", user_data);
 
+    err = GE_INVAL;
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_pparm_uint(&p, args[i], "reuseport", &reuseport) > 0) {
+	    if (reuseport > 255) {
+		gensio_pparm_slog(&p, "reuseport must be 255 or less");
+		goto parm_err;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_uint(&p, args[i], "rcvbuf", &rcvbuf) > 0)
+	    continue;
+	if (gensio_pparm_addrs_noport(&p, args[i], "mcast",
+				      GENSIO_NET_PROTOCOL_UDP,
+				      &tmpaddr) > 0) {
+	    if (mcast) {
+		tmpaddr2 = gensio_addr_cat(mcast, tmpaddr);
+		gensio_addr_free(tmpaddr);
+		if (!tmpaddr2) {
+		    err = GE_NOMEM;
+		    goto parm_err;
+		}
+		gensio_addr_free(mcast);
+		mcast = tmpaddr2;
+	    } else {
+		mcast = tmpaddr;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_uint(&p, args[i], "rbatch", &rbatch) > 0) {
+	    if (rbatch < 1 || rbatch > GENSIO_UDP_MAX_BATCH)
+		goto parm_err;
+	    continue;
+	}
+	if (gensio_pparm_uint(&p, args[i], "wbatch", &wbatch) > 0) {
+	    if (wbatch < 1 || wbatch > GENSIO_UDP_MAX_BATCH)
+		goto parm_err;
+	    continue;
+	}
+	if (gensio_pparm_bool(&p, args[i], "timestamps", &timestamps) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "gso", &gso) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "gro", &gro) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(&p, args[i]);
-	return GE_INVAL;
+	goto parm_err;
     }
     err = gensio_get_default(o, "udp", "reuseaddr", false,
 			     GENSIO_DEFAULT_BOOL, NULL, &ival);
     if (err)
-	return err;
+	goto parm_err;
     reuseaddr = ival;
 
-    return i_udp_gensio_accepter_alloc(iai, max_read_size, reuseaddr,
-				       o, cb, user_data, accepter);
+    err = i_udp_gensio_accepter_alloc(iai, max_read_size, rbatch, wbatch,
+				      reuseaddr, gro, o, cb, user_data,
+				      accepter);
+    if (!err) {
+	struct udpna_data *nadata = gensio_acc_get_gensio_data(*accepter);
+
+	nadata->timestamps = timestamps;
+	nadata->gso = gso;
+	nadata->rcvbuf = rcvbuf;
+	nadata->mcast = mcast;
+	if (reuseport)
+	    nadata->opensock_flags |= GENSIO_OPENSOCK_REUSEPORT(reuseport);
+	return 0;
+    }
+ parm_err:
+    if (mcast)
+	gensio_addr_free(mcast);
+    return err;
 }
 
 static int
@@ -1764,9 +2471,9 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
     int err, ival;
     struct gensio_iod *new_iod;
     gensiods max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE, size;
-    unsigned int i, setup;
+    unsigned int i, setup, rbatch = 1, wbatch = 1, rcvbuf = 0;
     bool nocon = false, mcast_loop_set = false, mcast_loop = true;
-    bool reuseaddr = false;
+    bool reuseaddr = false, timestamps = false, gso = false, gro = false;
     unsigned int mttl;
     GENSIO_DECLARE_PPGENSIO(p, o, cb, "udp", user_data);
 
@@ -1832,6 +2539,28 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
 	}
 	if (gensio_pparm_bool(&p, args[i], "reuseaddr", &reuseaddr) > 0)
 	    continue;
+	if (gensio_pparm_uint(&p, args[i], "rcvbuf", &rcvbuf) > 0)
+	    continue;
+	if (gensio_pparm_uint(&p, args[i], "rbatch", &rbatch) > 0) {
+	    if (rbatch < 1 || rbatch > GENSIO_UDP_MAX_BATCH) {
+		err = GE_INVAL;
+		goto parm_err;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_uint(&p, args[i], "wbatch", &wbatch) > 0) {
+	    if (wbatch < 1 || wbatch > GENSIO_UDP_MAX_BATCH) {
+		err = GE_INVAL;
+		goto parm_err;
+	    }
+	    continue;
+	}
+	if (gensio_pparm_bool(&p, args[i], "timestamps", &timestamps) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "gso", &gso) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "gro", &gro) > 0)
+	    continue;
 	gensio_pparm_unknown_parm(&p, args[i]);
     parm_err:
 	if (laddr)
@@ -1898,9 +2627,16 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
 	}
     }
 
+    err = udp_setup_iod(o, new_iod, timestamps, gro, rcvbuf);
+    if (err) {
+	o->close(&new_iod);
+	return err;
+    }
+
     /* Allocate a dummy network accepter. */
-    err = i_udp_gensio_accepter_alloc(NULL, max_read_size, reuseaddr, o,
-				      NULL, NULL, &accepter);
+    err = i_udp_gensio_accepter_alloc(NULL, max_read_size, rbatch, wbatch,
+				      reuseaddr, gro, o, NULL, NULL,
+				      &accepter);
     if (err) {
 	o->close(&new_iod);
 	return err;
@@ -1908,6 +2644,8 @@ udp_gensio_alloc(const void *gdata, const char * const args[],
     nadata = gensio_acc_get_gensio_data(accepter);
     nadata->is_dummy = true;
     nadata->nocon = nocon;
+    nadata->timestamps = timestamps;
+    nadata->gso = gso;
 
     nadata->fds = o->zalloc(o, sizeof(*nadata->fds));
     if (!nadata->fds) {
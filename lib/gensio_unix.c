@@ -5,6 +5,7 @@
  *  SPDX-License-Identifier: LGPL-2.1-only
  */
 
+#define _GNU_SOURCE /* Get pthread_setaffinity_np(). */
 #include "config.h"
 #include <string.h>
 #include <errno.h>
@@ -27,6 +28,7 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -34,14 +36,52 @@
 #include <sys/ioctl.h>
 #include "errtrig.h"
 
+/*
+ * With sharded os funcs, each shard is a full selector (with its own
+ * epoll fd, timer heap and runner queue).  Each thread that waits is
+ * bound to one shard, file descriptors are spread over the shards.
+ */
+struct gensio_unix_shard {
+    struct gensio_data *d;
+    struct selector_s *sel;
+    unsigned int nr_fds;
+    unsigned int nr_threads;
+};
+
 struct gensio_data {
     struct selector_s *sel;
     lock_type reflock;
     unsigned int refcount;
+    lock_type mwait_lock;
     bool freesel;
     int wake_sig;
     struct gensio_os_proc_data *pdata;
     struct gensio_memtrack *mtrack;
+    struct gensio_bufpool *bufpool;
+    struct gensio_addrcache *addrcache;
+    struct gensio_allocstats *allocstats;
+
+    /* For adaptive read buffers, a budget of zero is no limit. */
+    lock_type readbuf_lock;
+    gensiods readbuf_budget;
+    gensiods readbuf_in_use;
+
+    /* See GENSIO_CONTROL_OVERLOAD_SET_CONFIG, a limit of zero is off. */
+    lock_type overload_lock;
+    struct gensio_overload_config overload;
+
+    /* If nr_shards is zero, this is not sharded and sel is used. */
+    unsigned int nr_shards;
+    struct gensio_unix_shard *shards;
+    lock_type shard_lock;
+    unsigned int next_shard;
+
+    /* From GENSIO_CONTROL_SINGLE_THREAD, new locks are no-ops. */
+    bool single_thread;
+#ifdef USE_PTHREADS
+    pthread_key_t shard_key;
+    pthread_key_t alloc_shard_key; /* From GENSIO_IOD_CONTROL_ALLOC_SHARD */
+#endif
 };
 
 static void *
@@ -49,6 +89,8 @@ gensio_unix_zalloc(struct gensio_os_funcs *o, gensiods size)
 {
     struct gensio_data *d = o->user_data;
 
+    gensio_allocstats_alloced(d->allocstats, __builtin_return_address(0),
+			      size);
     return gensio_i_zalloc(d->mtrack, size);
 }
 
@@ -57,9 +99,241 @@ gensio_unix_free(struct gensio_os_funcs *o, void *v)
 {
     struct gensio_data *d = o->user_data;
 
+    gensio_allocstats_freed(d->allocstats);
     gensio_i_free(d->mtrack, v);
 }
 
+static void *
+gensio_unix_buf_alloc(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_data *d = o->user_data;
+
+    gensio_allocstats_alloced(d->allocstats, __builtin_return_address(0),
+			      size);
+    return gensio_bufpool_get(d->bufpool, size);
+}
+
+static void
+gensio_unix_buf_free(struct gensio_os_funcs *o, void *v)
+{
+    struct gensio_data *d = o->user_data;
+
+    gensio_allocstats_freed(d->allocstats);
+    gensio_bufpool_put(d->bufpool, v);
+}
+
+static gensiods
+gensio_unix_readbuf_reserve(struct gensio_os_funcs *o, gensiods size,
+			    gensiods min)
+{
+    struct gensio_data *d = o->user_data;
+
+    LOCK(&d->readbuf_lock);
+    if (d->readbuf_budget) {
+	while (size > min && d->readbuf_in_use + size > d->readbuf_budget)
+	    size /= 2;
+	if (size < min)
+	    size = min;
+    }
+    d->readbuf_in_use += size;
+    UNLOCK(&d->readbuf_lock);
+    return size;
+}
+
+static void
+gensio_unix_readbuf_release(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_data *d = o->user_data;
+
+    LOCK(&d->readbuf_lock);
+    d->readbuf_in_use -= size;
+    UNLOCK(&d->readbuf_lock);
+}
+
+/*
+ * Update the overload state from the memory in I/O buffers.  Must be
+ * called with overload_lock held.
+ */
+static void
+gensio_unix_overload_update(struct gensio_data *d)
+{
+    struct gensio_overload_config *ov = &d->overload;
+
+    if (d->bufpool) {
+	ov->in_use = gensio_bufpool_in_use(d->bufpool);
+    } else {
+	LOCK(&d->readbuf_lock);
+	ov->in_use = d->readbuf_in_use;
+	UNLOCK(&d->readbuf_lock);
+    }
+    if (!ov->limit)
+	ov->overloaded = false;
+    else if (ov->in_use > ov->limit)
+	ov->overloaded = true;
+    else if (ov->in_use < ov->resume)
+	ov->overloaded = false;
+}
+
+static bool
+gensio_unix_overloaded(struct gensio_os_funcs *o, unsigned int policy,
+		       gensio_time *recheck)
+{
+    struct gensio_data *d = o->user_data;
+    bool rv = false;
+
+    LOCK(&d->overload_lock);
+    if (d->overload.limit && (d->overload.policies & policy)) {
+	gensio_unix_overload_update(d);
+	rv = d->overload.overloaded;
+	if (rv && recheck)
+	    *recheck = d->overload.recheck;
+    }
+    UNLOCK(&d->overload_lock);
+    return rv;
+}
+
+#ifdef USE_PTHREADS
+static void
+gensio_unix_shard_thread_exit(void *data)
+{
+    struct gensio_unix_shard *shard = data;
+
+    LOCK(&shard->d->shard_lock);
+    shard->nr_threads--;
+    UNLOCK(&shard->d->shard_lock);
+}
+
+/*
+ * Return the shard the calling thread is bound to, or NULL if it is
+ * not bound.
+ */
+static struct gensio_unix_shard *
+gensio_unix_curr_shard(struct gensio_data *d)
+{
+    return pthread_getspecific(d->shard_key);
+}
+
+/*
+ * Return the selector the calling thread should wait on.  A thread
+ * that is not yet bound to a shard is bound to the one with the fewest
+ * threads.
+ */
+static struct selector_s *
+gensio_unix_thread_sel(struct gensio_data *d)
+{
+    struct gensio_unix_shard *shard;
+    unsigned int i;
+
+    if (!d->nr_shards)
+	return d->sel;
+
+    shard = gensio_unix_curr_shard(d);
+    if (shard)
+	return shard->sel;
+
+    LOCK(&d->shard_lock);
+    shard = &d->shards[0];
+    for (i = 1; i < d->nr_shards; i++) {
+	if (d->shards[i].nr_threads < shard->nr_threads)
+	    shard = &d->shards[i];
+    }
+    shard->nr_threads++;
+    UNLOCK(&d->shard_lock);
+
+    if (pthread_setspecific(d->shard_key, shard)) {
+	/* Can't bind, just don't account for this thread. */
+	LOCK(&d->shard_lock);
+	shard->nr_threads--;
+	UNLOCK(&d->shard_lock);
+    }
+    return shard->sel;
+}
+
+/*
+ * Return the shard the calling thread should allocate timers and
+ * runners on, or NULL if it is not bound.
+ */
+static struct gensio_unix_shard *
+gensio_unix_alloc_shard(struct gensio_data *d)
+{
+    struct gensio_unix_shard *shard;
+
+    shard = pthread_getspecific(d->alloc_shard_key);
+    if (!shard)
+	shard = gensio_unix_curr_shard(d);
+    return shard;
+}
+#else
+#define gensio_unix_curr_shard(d) ((struct gensio_unix_shard *) NULL)
+#define gensio_unix_alloc_shard(d) ((struct gensio_unix_shard *) NULL)
+#define gensio_unix_thread_sel(d) ((d)->sel)
+#endif
+
+/*
+ * Choose a selector for a new timer or runner.  Use the calling
+ * thread's shard if it has one, so the object is handled by the
+ * thread that created it.  Otherwise spread them over the shards.
+ */
+static struct selector_s *
+gensio_unix_obj_sel(struct gensio_data *d)
+{
+    struct gensio_unix_shard *shard;
+
+    if (!d->nr_shards)
+	return d->sel;
+
+    shard = gensio_unix_alloc_shard(d);
+    if (!shard) {
+	LOCK(&d->shard_lock);
+	shard = &d->shards[d->next_shard];
+	d->next_shard = (d->next_shard + 1) % d->nr_shards;
+	UNLOCK(&d->shard_lock);
+    }
+    return shard->sel;
+}
+
+/*
+ * Put a new file descriptor on the requested shard, or the one with
+ * the fewest of them if req_shard is -1.
+ */
+static struct gensio_unix_shard *
+gensio_unix_get_fd_shard(struct gensio_data *d, int req_shard)
+{
+    struct gensio_unix_shard *shard;
+    unsigned int i;
+
+    if (!d->nr_shards)
+	return NULL;
+
+    LOCK(&d->shard_lock);
+    if (req_shard >= 0) {
+	shard = &d->shards[req_shard % d->nr_shards];
+    } else {
+	shard = &d->shards[0];
+	for (i = 1; i < d->nr_shards; i++) {
+	    if (d->shards[i].nr_fds < shard->nr_fds)
+		shard = &d->shards[i];
+	}
+    }
+    shard->nr_fds++;
+    UNLOCK(&d->shard_lock);
+
+    return shard;
+}
+
+static void
+gensio_unix_put_fd_shard(struct gensio_data *d,
+			 struct gensio_unix_shard *shard)
+{
+    if (!shard)
+	return;
+
+    LOCK(&d->shard_lock);
+    assert(shard->nr_fds > 0);
+    shard->nr_fds--;
+    UNLOCK(&d->shard_lock);
+}
+
 static void
 add_to_timeval(struct timeval *tv1, gensio_time *t2)
 {
@@ -101,14 +375,18 @@ timeval_to_gensio_time(gensio_time *t, struct timeval *tv)
 struct waiter_data {
     pthread_t tid;
     int wake_sig;
+    struct selector_s *sel;
     unsigned int count;
     struct waiter_data *prev;
     struct waiter_data *next;
 };
 
+/*
+ * The selector is not kept in the waiter, the waiting thread waits on
+ * whatever selector (shard) it is bound to.
+ */
 typedef struct waiter_s {
     struct gensio_os_funcs *o;
-    struct selector_s *sel;
     int wake_sig;
     unsigned int count;
     pthread_mutex_t lock;
@@ -124,7 +402,6 @@ alloc_waiter(struct gensio_os_funcs *o, struct selector_s *sel, int wake_sig)
     if (waiter) {
 	waiter->o = o;
 	waiter->wake_sig = wake_sig;
-	waiter->sel = sel;
 	pthread_mutex_init(&waiter->lock, NULL);
 	waiter->wts.next = &waiter->wts;
 	waiter->wts.prev = &waiter->wts;
@@ -166,10 +443,16 @@ i_wake_waiter(waiter_t *waiter, unsigned int count)
 	    }
 	    if (w->count == 0) {
 #ifdef BROKEN_PSELECT
-		sel_wake_one(waiter->sel, (long) w->tid,
+		sel_wake_one(w->sel, (long) w->tid,
 			     wake_thread_send_sig_waiter, w);
 #else
-		pthread_kill(w->tid, w->wake_sig);
+		/*
+		 * If it's us, we are in a handler called from the
+		 * select and it will return without waiting, no need
+		 * for a signal.
+		 */
+		if (!pthread_equal(w->tid, pthread_self()))
+		    pthread_kill(w->tid, w->wake_sig);
 #endif
 	    }
 	}
@@ -189,6 +472,7 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
 
     w.tid = pthread_self();
     w.wake_sig = waiter->wake_sig;
+    w.sel = gensio_unix_thread_sel(waiter->o->user_data);
     w.next = NULL;
     w.prev = NULL;
     w.count = count;
@@ -213,11 +497,11 @@ i_wait_for_waiter_timeout(waiter_t *waiter, unsigned int count,
     while (w.count > 0) {
 	pthread_mutex_unlock(&waiter->lock);
 	if (intr)
-	    err = sel_select_intr_sigmask(waiter->sel,
+	    err = sel_select_intr_sigmask(w.sel,
 					  wake_thread_send_sig_waiter,
 					  (long) w.tid, &w, rtv, sigmask);
 	else
-	    err = sel_select(waiter->sel, wake_thread_send_sig_waiter,
+	    err = sel_select(w.sel, wake_thread_send_sig_waiter,
 			     (long) w.tid, &w, rtv);
 	if (err < 0)
 	    err = errno;
@@ -327,19 +611,259 @@ wait_for_waiter_timeout_intr_sigmask(waiter_t *waiter, unsigned int count,
     return i_wait_for_waiter_timeout(waiter, count, timeout, true, sigmask);
 }
 
+/* Lock profiling counts with atomics, so it needs them. */
+#if defined(USE_PTHREADS) && HAVE_GCC_ATOMICS
+#define GENSIO_LOCKPROF
+#endif
+
+#ifdef GENSIO_LOCKPROF
+/*
+ * Lock contention profiling.  Locks are grouped into classes by the
+ * address they were allocated from, so all the basen locks are one
+ * class, all the mux locks another, and so on.  This is process
+ * wide, not per os funcs, since the selector's locks are allocated
+ * before the os funcs exist.  Classes are never removed, clearing
+ * just zeros the counts, so locks can keep a pointer to theirs.
+ */
+struct lockprof_class {
+    void *site;
+    gensiods locks;
+    gensiods contended;
+    uint64_t total_wait;	/* Times in nanoseconds. */
+    uint64_t max_wait;
+    uint64_t total_hold;
+    uint64_t max_hold;
+};
+
+struct lockprof {
+    void *site;
+    struct lockprof_class *class;
+    uint64_t acquired;		/* Zero if not timing the hold. */
+};
+
+#define LOCKPROF_HASH_SIZE (GENSIO_LOCK_PROFILE_MAX_CLASSES * 2)
+
+static bool lockprof_enabled;
+static lock_type lockprof_lock = LOCK_INITIALIZER;
+static unsigned int lockprof_nr_classes;
+static gensiods lockprof_other_locks;
+static struct lockprof_class lockprof_classes[LOCKPROF_HASH_SIZE];
+
+static uint64_t
+lockprof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+lockprof_max(uint64_t *max, uint64_t val)
+{
+    uint64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (val > old && !__atomic_compare_exchange_n(max, &old, val, true,
+						     __ATOMIC_RELAXED,
+						     __ATOMIC_RELAXED))
+	;
+}
+
+static struct lockprof_class *
+lockprof_find_class(void *site)
+{
+    struct lockprof_class *c = NULL;
+    unsigned int i, h;
+
+    LOCK(&lockprof_lock);
+    h = (unsigned int) (((uintptr_t) site >> 4) % LOCKPROF_HASH_SIZE);
+    for (i = 0; i < LOCKPROF_HASH_SIZE; i++) {
+	c = &lockprof_classes[h];
+	if (c->site == site)
+	    break;
+	if (!c->site) {
+	    if (lockprof_nr_classes >= GENSIO_LOCK_PROFILE_MAX_CLASSES) {
+		c = NULL;
+		break;
+	    }
+	    lockprof_nr_classes++;
+	    c->site = site;
+	    break;
+	}
+	h = (h + 1) % LOCKPROF_HASH_SIZE;
+	c = NULL;
+    }
+    UNLOCK(&lockprof_lock);
+    return c;
+}
+
+static void
+lockprof_lock_prof(struct lockprof *p, lock_type *l)
+{
+    struct lockprof_class *c = p->class;
+    uint64_t start, now;
+
+    if (!c) {
+	c = lockprof_find_class(p->site);
+	if (!c) {
+	    __atomic_add_fetch(&lockprof_other_locks, 1, __ATOMIC_RELAXED);
+	    LOCK(l);
+	    return;
+	}
+	p->class = c;
+    }
+
+    __atomic_add_fetch(&c->locks, 1, __ATOMIC_RELAXED);
+    if (pthread_mutex_trylock(l) == 0) {
+	now = lockprof_now();
+    } else {
+	start = lockprof_now();
+	LOCK(l);
+	now = lockprof_now();
+	__atomic_add_fetch(&c->contended, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->total_wait, now - start, __ATOMIC_RELAXED);
+	lockprof_max(&c->max_wait, now - start);
+    }
+    p->acquired = now;
+}
+
+/* Call with the lock held, before releasing it. */
+static void
+lockprof_unlock_prof(struct lockprof *p)
+{
+    uint64_t held;
+
+    if (!p->acquired)
+	/* Profiling was turned on while this was held. */
+	return;
+    held = lockprof_now() - p->acquired;
+    p->acquired = 0;
+    __atomic_add_fetch(&p->class->total_hold, held, __ATOMIC_RELAXED);
+    lockprof_max(&p->class->max_hold, held);
+}
+
+static void
+lockprof_do_lock(struct lockprof *p, lock_type *l)
+{
+    if (__atomic_load_n(&lockprof_enabled, __ATOMIC_RELAXED))
+	lockprof_lock_prof(p, l);
+    else
+	LOCK(l);
+}
+
+static void
+lockprof_do_unlock(struct lockprof *p, lock_type *l)
+{
+    if (p->acquired)
+	lockprof_unlock_prof(p);
+    UNLOCK(l);
+}
+
+static void
+lockprof_to_time(gensio_time *t, uint64_t ns)
+{
+    t->secs = ns / 1000000000;
+    t->nsecs = ns % 1000000000;
+}
+
+static int
+gensio_unix_lock_profile_control(int func, void *data, gensiods *datalen)
+{
+    struct gensio_lock_profile_config *config = data;
+    struct gensio_lock_profile *prof = data;
+    struct gensio_lock_class_stats *s;
+    struct lockprof_class *c;
+    unsigned int i;
+
+    switch (func) {
+    case GENSIO_CONTROL_LOCK_PROFILE_SET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	LOCK(&lockprof_lock);
+	for (i = 0; i < LOCKPROF_HASH_SIZE; i++) {
+	    c = &lockprof_classes[i];
+	    __atomic_store_n(&c->locks, 0, __ATOMIC_RELAXED);
+	    __atomic_store_n(&c->contended, 0, __ATOMIC_RELAXED);
+	    __atomic_store_n(&c->total_wait, 0, __ATOMIC_RELAXED);
+	    __atomic_store_n(&c->max_wait, 0, __ATOMIC_RELAXED);
+	    __atomic_store_n(&c->total_hold, 0, __ATOMIC_RELAXED);
+	    __atomic_store_n(&c->max_hold, 0, __ATOMIC_RELAXED);
+	}
+	lockprof_other_locks = 0;
+	__atomic_store_n(&lockprof_enabled, config->enable, __ATOMIC_RELAXED);
+	UNLOCK(&lockprof_lock);
+	return 0;
+
+    case GENSIO_CONTROL_LOCK_PROFILE:
+	if (!datalen || *datalen < sizeof(*prof))
+	    return GE_INVAL;
+	memset(prof, 0, sizeof(*prof));
+	LOCK(&lockprof_lock);
+	for (i = 0; i < LOCKPROF_HASH_SIZE; i++) {
+	    c = &lockprof_classes[i];
+	    if (!c->site)
+		continue;
+	    s = &prof->classes[prof->nr_classes++];
+	    s->site = c->site;
+	    s->locks = __atomic_load_n(&c->locks, __ATOMIC_RELAXED);
+	    s->contended = __atomic_load_n(&c->contended, __ATOMIC_RELAXED);
+	    lockprof_to_time(&s->total_wait,
+			     __atomic_load_n(&c->total_wait, __ATOMIC_RELAXED));
+	    lockprof_to_time(&s->max_wait,
+			     __atomic_load_n(&c->max_wait, __ATOMIC_RELAXED));
+	    lockprof_to_time(&s->total_hold,
+			     __atomic_load_n(&c->total_hold, __ATOMIC_RELAXED));
+	    lockprof_to_time(&s->max_hold,
+			     __atomic_load_n(&c->max_hold, __ATOMIC_RELAXED));
+	}
+	prof->other_class_locks = __atomic_load_n(&lockprof_other_locks,
+						  __ATOMIC_RELAXED);
+	UNLOCK(&lockprof_lock);
+	*datalen = sizeof(*prof);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+#define LOCKPROF_LOCK(p, l) lockprof_do_lock(p, l)
+#define LOCKPROF_UNLOCK(p, l) lockprof_do_unlock(p, l)
+#else
+struct lockprof { };
+#define LOCKPROF_LOCK(p, l) LOCK(l)
+#define LOCKPROF_UNLOCK(p, l) UNLOCK(l)
+#endif
+
 struct gensio_lock {
     struct gensio_os_funcs *f;
     lock_type lock;
+    struct lockprof prof;
+
+    /*
+     * Allocated single threaded, don't touch the mutex.  This is per
+     * lock so locks allocated before going single threaded still work.
+     */
+    bool nolock;
+#ifdef ENABLE_INTERNAL_TRACE
+    bool held;
+#endif
 };
 
 static struct gensio_lock *
 gensio_unix_alloc_lock(struct gensio_os_funcs *f)
 {
+    struct gensio_data *d = f->user_data;
     struct gensio_lock *lock = f->zalloc(f, sizeof(*lock));
 
     if (lock) {
 	lock->f = f;
-	LOCK_INIT(&lock->lock);
+#ifdef GENSIO_LOCKPROF
+	lock->prof.site = __builtin_return_address(0);
+#endif
+	lock->nolock = d->single_thread;
+	if (!lock->nolock)
+	    LOCK_INIT(&lock->lock);
     }
 
     return lock;
@@ -348,20 +872,38 @@ gensio_unix_alloc_lock(struct gensio_os_funcs *f)
 static void
 gensio_unix_free_lock(struct gensio_lock *lock)
 {
-    LOCK_DESTROY(&lock->lock);
+#ifdef ENABLE_INTERNAL_TRACE
+    assert(!lock->held);
+#endif
+    if (!lock->nolock)
+	LOCK_DESTROY(&lock->lock);
     lock->f->free(lock->f, lock);
 }
 
 static void
 gensio_unix_lock(struct gensio_lock *lock)
 {
-    LOCK(&lock->lock);
+    if (lock->nolock) {
+#ifdef ENABLE_INTERNAL_TRACE
+	assert(!lock->held);
+	lock->held = true;
+#endif
+	return;
+    }
+    LOCKPROF_LOCK(&lock->prof, &lock->lock);
 }
 
 static void
 gensio_unix_unlock(struct gensio_lock *lock)
 {
-    UNLOCK(&lock->lock);
+    if (lock->nolock) {
+#ifdef ENABLE_INTERNAL_TRACE
+	assert(lock->held);
+	lock->held = false;
+#endif
+	return;
+    }
+    LOCKPROF_UNLOCK(&lock->prof, &lock->lock);
 }
 
 struct gensio_iod_file {
@@ -384,6 +926,15 @@ struct gensio_iod_pty {
     char *start_dir;
 };
 
+struct gensio_iod_dev {
+#ifdef USE_PTHREADS
+    /* For GENSIO_IOD_CONTROL_MODEMSTATE_WAIT, under mwait_lock. */
+    pthread_t mwait_tid;
+    bool mwait_waiting;
+    bool mwait_stop;
+#endif
+};
+
 struct gensio_iod_unix {
     struct gensio_iod r;
     int orig_fd;
@@ -391,6 +942,17 @@ struct gensio_iod_unix {
     enum gensio_iod_type type;
     bool handlers_set;
     bool is_stdio;
+    bool edge; /* See GENSIO_IOD_CONTROL_EDGE. */
+    bool prio; /* See GENSIO_IOD_CONTROL_PRIORITY. */
+
+    /*
+     * The selector and shard (if sharded) the handlers are set on.
+     * sel is the main selector until the handlers are set.
+     */
+    struct selector_s *sel;
+    struct gensio_unix_shard *shard;
+    int req_shard; /* Shard requested by the user, -1 if any. */
+
     void *cb_data;
     void (*read_handler)(struct gensio_iod *iod, void *cb_data);
     void (*write_handler)(struct gensio_iod *iod, void *cb_data);
@@ -406,6 +968,7 @@ struct gensio_iod_unix {
 	struct gensio_iod_file file;
 	struct gensio_iod_socket socket;
 	struct gensio_iod_pty pty;
+	struct gensio_iod_dev dev;
     } u;
 };
 
@@ -465,12 +1028,21 @@ gensio_unix_set_fd_handlers(struct gensio_iod *iiod,
     iod->write_handler = write_handler;
     iod->except_handler = except_handler;
     iod->cleared_handler = cleared_handler;
-    if (iod->type != GENSIO_IOD_FILE)
-	rv = sel_set_fd_handlers(d->sel, iod->fd, iod,
+    iod->edge = false;
+    iod->prio = false;
+    if (iod->type != GENSIO_IOD_FILE) {
+	iod->shard = gensio_unix_get_fd_shard(d, iod->req_shard);
+	iod->sel = iod->shard ? iod->shard->sel : d->sel;
+	rv = sel_set_fd_handlers(iod->sel, iod->fd, iod,
 				 read_handler ? iod_read_handler : NULL,
 				 write_handler ? iod_write_handler : NULL,
 				 except_handler ? iod_except_handler : NULL,
 				 cleared_handler ? iod_cleared_handler : NULL);
+	if (rv) {
+	    gensio_unix_put_fd_shard(d, iod->shard);
+	    iod->shard = NULL;
+	}
+    }
     if (!rv)
 	iod->handlers_set = true;
     return gensio_os_err_to_err(f, rv);
@@ -494,7 +1066,9 @@ gensio_unix_clear_fd_handlers(struct gensio_iod *iiod)
 	}
 	f->unlock(iod->u.file.lock);
     } else {
-	sel_clear_fd_handlers(d->sel, iod->fd);
+	sel_clear_fd_handlers(iod->sel, iod->fd);
+	gensio_unix_put_fd_shard(d, iod->shard);
+	iod->shard = NULL;
     }
 }
 
@@ -507,8 +1081,11 @@ gensio_unix_clear_fd_handlers_norpt(struct gensio_iod *iiod)
 
     if (iod->handlers_set) {
 	iod->handlers_set = false;
-	if (iod->type != GENSIO_IOD_FILE)
-	    sel_clear_fd_handlers_norpt(d->sel, iod->fd);
+	if (iod->type != GENSIO_IOD_FILE) {
+	    sel_clear_fd_handlers_norpt(iod->sel, iod->fd);
+	    gensio_unix_put_fd_shard(d, iod->shard);
+	    iod->shard = NULL;
+	}
     }
 }
 
@@ -547,7 +1124,6 @@ gensio_unix_set_read_handler(struct gensio_iod *iiod, bool enable)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
     struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int op;
 
     if (iod->type == GENSIO_IOD_FILE) {
@@ -568,7 +1144,7 @@ gensio_unix_set_read_handler(struct gensio_iod *iiod, bool enable)
     else
 	op = SEL_FD_HANDLER_DISABLED;
 
-    sel_set_fd_read_handler(d->sel, iod->fd, op);
+    sel_set_fd_read_handler(iod->sel, iod->fd, op);
 }
 
 static void
@@ -576,7 +1152,6 @@ gensio_unix_set_write_handler(struct gensio_iod *iiod, bool enable)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
     struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int op;
 
     if (iod->type == GENSIO_IOD_FILE) {
@@ -597,15 +1172,13 @@ gensio_unix_set_write_handler(struct gensio_iod *iiod, bool enable)
     else
 	op = SEL_FD_HANDLER_DISABLED;
 
-    sel_set_fd_write_handler(d->sel, iod->fd, op);
+    sel_set_fd_write_handler(iod->sel, iod->fd, op);
 }
 
 static void
 gensio_unix_set_except_handler(struct gensio_iod *iiod, bool enable)
 {
     struct gensio_iod_unix *iod = i_to_sel(iiod);
-    struct gensio_os_funcs *f = iiod->f;
-    struct gensio_data *d = f->user_data;
     int op;
 
     if (iod->type == GENSIO_IOD_FILE)
@@ -616,7 +1189,7 @@ gensio_unix_set_except_handler(struct gensio_iod *iiod, bool enable)
     else
 	op = SEL_FD_HANDLER_DISABLED;
 
-    sel_set_fd_except_handler(d->sel, iod->fd, op);
+    sel_set_fd_except_handler(iod->sel, iod->fd, op);
 }
 
 struct gensio_timer {
@@ -657,8 +1230,8 @@ gensio_unix_alloc_timer(struct gensio_os_funcs *f,
     timer->cb_data = cb_data;
     LOCK_INIT(&timer->lock);
 
-    rv = sel_alloc_timer(d->sel, gensio_timeout_handler, timer,
-			 &timer->sel_timer);
+    rv = sel_alloc_timer(gensio_unix_obj_sel(d), gensio_timeout_handler,
+			 timer, &timer->sel_timer);
     if (rv) {
 	f->free(f, timer);
 	return NULL;
@@ -697,6 +1270,20 @@ gensio_unix_start_timer_abs(struct gensio_timer *timer, gensio_time *timeout)
     return gensio_os_err_to_err(timer->f, rv);
 }
 
+static int
+gensio_unix_start_timer_slack(struct gensio_timer *timer, gensio_time *timeout,
+			      gensio_time *slack)
+{
+    struct timeval tv, stv, *rstv;
+    int rv;
+
+    sel_get_monotonic_time(&tv);
+    add_to_timeval(&tv, timeout);
+    rstv = gensio_time_to_timeval(&stv, slack);
+    rv = sel_start_timer_slack(timer->sel_timer, &tv, rstv);
+    return gensio_os_err_to_err(timer->f, rv);
+}
+
 static int
 gensio_unix_stop_timer(struct gensio_timer *timer)
 {
@@ -770,7 +1357,7 @@ gensio_unix_alloc_runner(struct gensio_os_funcs *f,
     runner->handler = handler;
     runner->cb_data = cb_data;
 
-    rv = sel_alloc_runner(d->sel, &runner->sel_runner);
+    rv = sel_alloc_runner(gensio_unix_obj_sel(d), &runner->sel_runner);
     if (rv) {
 	f->free(f, runner);
 	return NULL;
@@ -904,7 +1491,8 @@ gensio_unix_service(struct gensio_os_funcs *f, gensio_time *timeout)
     w.id = pthread_self();
     w.wake_sig = d->wake_sig;
     rtv = gensio_time_to_timeval(&tv, timeout);
-    err = sel_select_intr(d->sel, wake_thread_send_sig, (long) w.id, &w, rtv);
+    err = sel_select_intr(gensio_unix_thread_sel(d), wake_thread_send_sig,
+			  (long) w.id, &w, rtv);
     if (err < 0)
 	err = gensio_os_err_to_err(f, errno);
     else if (err == 0)
@@ -982,9 +1570,26 @@ gensio_unix_free_funcs(struct gensio_os_funcs *f)
     UNLOCK(&defos_lock);
 
     gensio_stdsock_cleanup(f);
+    if (d->bufpool)
+	gensio_bufpool_free(d->bufpool);
+    if (d->addrcache)
+	gensio_addrcache_free(d->addrcache);
     gensio_memtrack_cleanup(d->mtrack);
-    if (d->freesel)
+    if (d->allocstats)
+	gensio_allocstats_free(d->allocstats);
+    if (d->nr_shards) {
+	unsigned int i;
+
+#ifdef USE_PTHREADS
+	pthread_key_delete(d->shard_key);
+	pthread_key_delete(d->alloc_shard_key);
+#endif
+	for (i = 0; i < d->nr_shards; i++)
+	    sel_free_selector(d->shards[i].sel);
+	free(d->shards);
+    } else if (d->freesel) {
 	sel_free_selector(d->sel);
+    }
     free(f->user_data);
     free(f);
 }
@@ -1014,18 +1619,41 @@ gensio_unix_get_monotonic_time(struct gensio_os_funcs *f, gensio_time *time)
     timeval_to_gensio_time(time, &tv);
 }
 
+static void
+gensio_unix_get_loop_time(struct gensio_os_funcs *f, gensio_time *time)
+{
+    struct gensio_data *d = f->user_data;
+    struct gensio_unix_shard *shard = gensio_unix_curr_shard(d);
+    struct timeval tv;
+
+    /* Use the selector this thread runs, its time is the one that moves. */
+    sel_get_loop_time(shard ? shard->sel : d->sel, &tv);
+    timeval_to_gensio_time(time, &tv);
+}
+
 static int
 gensio_handle_fork(struct gensio_os_funcs *f)
 {
     struct gensio_data *d = f->user_data;
+    unsigned int i;
+    int rv;
+
+    if (!d->nr_shards)
+	return sel_setup_forked_process(d->sel);
 
-    return sel_setup_forked_process(d->sel);
+    for (i = 0; i < d->nr_shards; i++) {
+	rv = sel_setup_forked_process(d->shards[i].sel);
+	if (rv)
+	    return rv;
+    }
+    return 0;
 }
 
 static int
 gensio_unix_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
 		    intptr_t ofd, struct gensio_iod **riod)
 {
+    struct gensio_data *d = o->user_data;
     struct gensio_iod_unix *iod = NULL;
     bool closefd = false;
     int err = GE_NOMEM, fd = ofd;
@@ -1058,6 +1686,8 @@ gensio_unix_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
     iod->r.f = o;
     iod->fd = fd;
     iod->orig_fd = ofd;
+    iod->req_shard = -1;
+    iod->sel = d->sel;
     if (type == GENSIO_IOD_STDIO) {
 	struct stat statb;
 
@@ -1219,8 +1849,18 @@ gensio_unix_close(struct gensio_iod **iodp)
 
     assert(iodp);
     assert(!iod->handlers_set);
-    if (iod->type != GENSIO_IOD_FILE)
+    /*
+     * Sockets are ours, and the file flags are shared with any
+     * forked process that still has it open.  A forked child closing
+     * its copy of a listening socket must not make the parent's
+     * blocking, the accepter takes several per wakeup.
+     */
+    if (iod->type != GENSIO_IOD_FILE && iod->type != GENSIO_IOD_SOCKET)
 	gensio_unix_do_cleanup_nonblock(o, iod->fd, &iod->mode);
+    else if (iod->mode) {
+	o->free(o, iod->mode);
+	iod->mode = NULL;
+    }
 
     if (iod->termios)
 	gensio_unix_cleanup_termios(o, &iod->termios, iod->fd);
@@ -1473,9 +2113,215 @@ gensio_unix_pty_control(struct gensio_iod_unix *iod, int op, bool get,
 }
 
 static int
-gensio_unix_iod_control(struct gensio_iod *iiod, int op, bool get, intptr_t val)
+gensio_unix_shard_control(struct gensio_iod_unix *iod, bool get, intptr_t val)
 {
-    struct gensio_iod_unix *iod = i_to_sel(iiod);
+    struct gensio_data *d = iod->r.f->user_data;
+
+    if (!d->nr_shards)
+	return GE_NOTSUP;
+
+    if (get) {
+	if (iod->shard)
+	    *((intptr_t *) val) = iod->shard - d->shards;
+	else
+	    *((intptr_t *) val) = iod->req_shard;
+	return 0;
+    }
+
+    if (iod->handlers_set)
+	return GE_INUSE;
+    if (val < -1)
+	return GE_INVAL;
+    iod->req_shard = val;
+    return 0;
+}
+
+static int
+gensio_unix_alloc_shard_control(struct gensio_iod_unix *iod, bool get,
+				intptr_t val)
+{
+#ifdef USE_PTHREADS
+    struct gensio_data *d = iod->r.f->user_data;
+    struct gensio_unix_shard *shard = NULL;
+
+    if (!d->nr_shards || get)
+	return GE_NOTSUP;
+
+    if (val) {
+	if (iod->shard)
+	    shard = iod->shard;
+	else if (iod->req_shard >= 0)
+	    shard = &d->shards[iod->req_shard % d->nr_shards];
+	else
+	    return GE_INVAL;
+    }
+    if (pthread_setspecific(d->alloc_shard_key, shard))
+	return GE_NOMEM;
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+/*
+ * Wait for a modem control line to change.  The stop is done by
+ * sending the wake signal to the waiting thread, which interrupts the
+ * ioctl.  There is a small window where the signal may come in after
+ * the stop check but before the ioctl, so the stopper may have to
+ * set the stop more than once.
+ */
+static int
+gensio_unix_modemstate_wait(struct gensio_iod_unix *iod, bool get,
+			    intptr_t val)
+{
+#if defined(USE_PTHREADS) && defined(TIOCMIWAIT)
+    struct gensio_os_funcs *o = iod->r.f;
+    struct gensio_data *d = o->user_data;
+    struct gensio_iod_dev *dev = &iod->u.dev;
+    sigset_t sigs, oldsigs;
+    int rv, err = 0;
+
+    if (!get) {
+	LOCK(&d->mwait_lock);
+	dev->mwait_stop = !!val;
+	if (dev->mwait_stop && dev->mwait_waiting)
+	    pthread_kill(dev->mwait_tid, d->wake_sig);
+	UNLOCK(&d->mwait_lock);
+	return 0;
+    }
+
+    if (!d->wake_sig)
+	return GE_NOTSUP; /* No way to interrupt it. */
+
+    LOCK(&d->mwait_lock);
+    if (dev->mwait_waiting) {
+	UNLOCK(&d->mwait_lock);
+	return GE_INUSE;
+    }
+    if (dev->mwait_stop) {
+	UNLOCK(&d->mwait_lock);
+	return GE_INTERRUPTED;
+    }
+    dev->mwait_tid = pthread_self();
+    dev->mwait_waiting = true;
+    UNLOCK(&d->mwait_lock);
+
+    sigemptyset(&sigs);
+    sigaddset(&sigs, d->wake_sig);
+    pthread_sigmask(SIG_UNBLOCK, &sigs, &oldsigs);
+    if (dev->mwait_stop) {
+	err = EINTR;
+    } else {
+	rv = ioctl(iod->fd, TIOCMIWAIT,
+		   TIOCM_CD | TIOCM_RI | TIOCM_DSR | TIOCM_CTS);
+	if (rv == -1)
+	    err = errno;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    LOCK(&d->mwait_lock);
+    dev->mwait_waiting = false;
+    if (dev->mwait_stop)
+	err = EINTR;
+    UNLOCK(&d->mwait_lock);
+
+    if (err == EINTR)
+	return GE_INTERRUPTED;
+    if (err == ENOTTY || err == EINVAL)
+	return GE_NOTSUP; /* PTYs and some drivers can't do this. */
+    if (err)
+	return gensio_os_err_to_err(o, err);
+
+    if (val)
+	return gensio_unix_termios_control(o, GENSIO_IOD_CONTROL_MODEMSTATE,
+					   true, val, &iod->termios, iod->fd);
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+static int
+gensio_unix_pipe_size_control(struct gensio_iod_unix *iod, bool get,
+			      intptr_t val)
+{
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    int rv;
+
+    if (iod->type != GENSIO_IOD_PIPE)
+	return GE_NOTSUP;
+    if (get) {
+	rv = fcntl(iod->fd, F_GETPIPE_SZ);
+	if (rv == -1)
+	    return gensio_os_err_to_err(iod->r.f, errno);
+	*((int *) val) = rv;
+    } else {
+	if (fcntl(iod->fd, F_SETPIPE_SZ, *((int *) val)) == -1)
+	    return gensio_os_err_to_err(iod->r.f, errno);
+    }
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+static int
+gensio_unix_edge_control(struct gensio_iod_unix *iod, bool get, intptr_t val)
+{
+    if (get) {
+	*((int *) val) = iod->edge;
+	return 0;
+    }
+    if (iod->type == GENSIO_IOD_FILE)
+	/* Files are always ready, they don't use the selector. */
+	return GE_NOTSUP;
+    if (!iod->handlers_set)
+	return GE_NOTREADY;
+    if (sel_set_fd_edge(iod->sel, iod->fd))
+	return GE_NOTSUP;
+    iod->edge = true;
+    return 0;
+}
+
+static int
+gensio_unix_prio_control(struct gensio_iod_unix *iod, bool get, intptr_t val)
+{
+    int prio;
+
+    if (get) {
+	*((int *) val) = iod->prio;
+	return 0;
+    }
+    if (iod->type == GENSIO_IOD_FILE)
+	return GE_NOTSUP;
+    if (!iod->handlers_set)
+	return GE_NOTREADY;
+    prio = *((int *) val);
+    if (sel_set_fd_priority(iod->sel, iod->fd, prio))
+	return GE_NOTREADY;
+    iod->prio = !!prio;
+    return 0;
+}
+
+static int
+gensio_unix_iod_control(struct gensio_iod *iiod, int op, bool get, intptr_t val)
+{
+    struct gensio_iod_unix *iod = i_to_sel(iiod);
+
+    if (op == GENSIO_IOD_CONTROL_SHARD)
+	return gensio_unix_shard_control(iod, get, val);
+
+    if (op == GENSIO_IOD_CONTROL_ALLOC_SHARD)
+	return gensio_unix_alloc_shard_control(iod, get, val);
+
+    if (op == GENSIO_IOD_CONTROL_EDGE)
+	return gensio_unix_edge_control(iod, get, val);
+
+    if (op == GENSIO_IOD_CONTROL_PRIORITY)
+	return gensio_unix_prio_control(iod, get, val);
+
+    if (op == GENSIO_IOD_CONTROL_PIPE_SIZE)
+	return gensio_unix_pipe_size_control(iod, get, val);
 
     if (iod->type == GENSIO_IOD_SOCKET) {
 	if (op != GENSIO_IOD_CONTROL_SOCKINFO)
@@ -1495,6 +2341,9 @@ gensio_unix_iod_control(struct gensio_iod *iiod, int op, bool get, intptr_t val)
     if (iod->type != GENSIO_IOD_DEV)
 	return GE_NOTSUP;
 
+    if (op == GENSIO_IOD_CONTROL_MODEMSTATE_WAIT)
+	return gensio_unix_modemstate_wait(iod, get, val);
+
     return gensio_unix_termios_control(iiod->f, op, get, val,
 				       &iod->termios, iod->fd);
 }
@@ -1558,6 +2407,256 @@ gensio_unix_get_random(struct gensio_os_funcs *o,
     return gensio_os_err_to_err(o, rv);
 }
 
+static int
+gensio_unix_addr_scan_ips(struct gensio_os_funcs *o, const char *str,
+			  bool listen, int ifamily, int protocol,
+			  bool *is_port_set, bool scan_port,
+			  struct gensio_addr **raddr)
+{
+    struct gensio_data *d = o->user_data;
+
+    return gensio_addrcache_scan_ips(d->addrcache, o, str, listen, ifamily,
+				     protocol, is_port_set, scan_port, raddr);
+}
+
+/* Busy polling is set on all the selectors, and the stats summed. */
+static int
+gensio_unix_busy_poll_control(struct gensio_data *d, int func, void *data,
+			      gensiods *datalen)
+{
+    struct gensio_busy_poll_config *config = data;
+    struct gensio_busy_poll_stats *stats = data;
+    unsigned int i, nr_sels = d->nr_shards ? d->nr_shards : 1;
+    struct selector_s *sel;
+    struct timeval tv;
+    unsigned long hits, sleeps;
+
+    switch (func) {
+    case GENSIO_CONTROL_BUSY_POLL_SET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	if (config->spin.secs < 0 || config->spin.nsecs < 0 ||
+		config->spin.nsecs >= 1000000000)
+	    return GE_INVAL;
+	tv.tv_sec = config->spin.secs;
+	tv.tv_usec = (config->spin.nsecs + 999) / 1000;
+	for (i = 0; i < nr_sels; i++) {
+	    sel = d->nr_shards ? d->shards[i].sel : d->sel;
+	    sel_set_busy_poll(sel, &tv);
+	}
+	return 0;
+
+    case GENSIO_CONTROL_BUSY_POLL_GET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	sel = d->nr_shards ? d->shards[0].sel : d->sel;
+	sel_get_busy_poll(sel, &tv, NULL, NULL);
+	config->spin.secs = tv.tv_sec;
+	config->spin.nsecs = tv.tv_usec * 1000;
+	*datalen = sizeof(*config);
+	return 0;
+
+    case GENSIO_CONTROL_BUSY_POLL_STATS:
+	if (!datalen || *datalen < sizeof(*stats))
+	    return GE_INVAL;
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < nr_sels; i++) {
+	    sel = d->nr_shards ? d->shards[i].sel : d->sel;
+	    sel_get_busy_poll(sel, NULL, &hits, &sleeps);
+	    stats->spin_hits += hits;
+	    stats->sleeps += sleeps;
+	}
+	*datalen = sizeof(*stats);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static void
+loop_stats_add_time(gensio_time *total, const struct timeval *tv)
+{
+    total->secs += tv->tv_sec;
+    total->nsecs += tv->tv_usec * 1000;
+    while (total->nsecs >= 1000000000) {
+	total->nsecs -= 1000000000;
+	total->secs++;
+    }
+}
+
+static void
+loop_stats_max_time(gensio_time *max, const struct timeval *tv)
+{
+    if (tv->tv_sec > max->secs ||
+	    (tv->tv_sec == max->secs && tv->tv_usec * 1000 > max->nsecs)) {
+	max->secs = tv->tv_sec;
+	max->nsecs = tv->tv_usec * 1000;
+    }
+}
+
+static int
+gensio_unix_loop_stats_control(struct gensio_data *d, int func, void *data,
+			       gensiods *datalen)
+{
+    struct gensio_loop_stats_config *config = data;
+    struct gensio_loop_stats *stats = data;
+    unsigned int i, nr_sels = d->nr_shards ? d->nr_shards : 1;
+    struct selector_s *sel;
+    struct sel_stats s;
+
+    switch (func) {
+    case GENSIO_CONTROL_LOOP_STATS_SET_CONFIG:
+	if (!datalen || *datalen < sizeof(*config))
+	    return GE_INVAL;
+	for (i = 0; i < nr_sels; i++) {
+	    sel = d->nr_shards ? d->shards[i].sel : d->sel;
+	    sel_set_stats(sel, config->enable);
+	}
+	return 0;
+
+    case GENSIO_CONTROL_LOOP_STATS:
+	if (!datalen || *datalen < sizeof(*stats))
+	    return GE_INVAL;
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < nr_sels; i++) {
+	    sel = d->nr_shards ? d->shards[i].sel : d->sel;
+	    sel_get_stats(sel, &s);
+	    stats->wakeups += s.wakeups;
+	    stats->fds_dispatched += s.fds_dispatched;
+	    if (s.max_fds_per_wakeup > stats->max_fds_per_wakeup)
+		stats->max_fds_per_wakeup = s.max_fds_per_wakeup;
+	    stats->timers_fired += s.timers_fired;
+	    stats->runners_run += s.runners_run;
+	    loop_stats_add_time(&stats->total_dispatch_latency,
+				&s.total_dispatch_latency);
+	    loop_stats_max_time(&stats->max_dispatch_latency,
+				&s.max_dispatch_latency);
+	    loop_stats_max_time(&stats->max_handler_time,
+				&s.max_handler_time);
+	    loop_stats_add_time(&stats->total_timer_late,
+				&s.total_timer_late);
+	    loop_stats_max_time(&stats->max_timer_late, &s.max_timer_late);
+	}
+	*datalen = sizeof(*stats);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+/* Like busy polling, the timer slack is set on all the selectors. */
+static int
+gensio_unix_timer_slack_control(struct gensio_data *d, int func, void *data,
+				gensiods *datalen)
+{
+    struct gensio_timer_slack_config *config = data;
+    unsigned int i, nr_sels = d->nr_shards ? d->nr_shards : 1;
+    struct selector_s *sel;
+    struct timeval tv;
+
+    if (!datalen || *datalen < sizeof(*config))
+	return GE_INVAL;
+
+    if (func == GENSIO_CONTROL_TIMER_SLACK_GET_CONFIG) {
+	sel = d->nr_shards ? d->shards[0].sel : d->sel;
+	sel_get_timer_slack(sel, &tv);
+	config->slack.secs = tv.tv_sec;
+	config->slack.nsecs = tv.tv_usec * 1000;
+	*datalen = sizeof(*config);
+	return 0;
+    }
+
+    if (config->slack.secs < 0 || config->slack.nsecs < 0 ||
+	    config->slack.nsecs >= 1000000000)
+	return GE_INVAL;
+    tv.tv_sec = config->slack.secs;
+    tv.tv_usec = (config->slack.nsecs + 999) / 1000;
+    for (i = 0; i < nr_sels; i++) {
+	sel = d->nr_shards ? d->shards[i].sel : d->sel;
+	sel_set_timer_slack(sel, &tv);
+    }
+    return 0;
+}
+
+static int
+gensio_unix_readbuf_budget_control(struct gensio_data *d, int func,
+				   void *data, gensiods *datalen)
+{
+    struct gensio_readbuf_budget_config *config = data;
+
+    if (!datalen || *datalen < sizeof(*config))
+	return GE_INVAL;
+
+    LOCK(&d->readbuf_lock);
+    if (func == GENSIO_CONTROL_READBUF_BUDGET_GET_CONFIG) {
+	config->budget = d->readbuf_budget;
+	config->in_use = d->readbuf_in_use;
+	*datalen = sizeof(*config);
+    } else {
+	d->readbuf_budget = config->budget;
+    }
+    UNLOCK(&d->readbuf_lock);
+    return 0;
+}
+
+static int
+gensio_unix_overload_control(struct gensio_data *d, int func,
+			     void *data, gensiods *datalen)
+{
+    struct gensio_overload_config *config = data;
+    struct gensio_overload_config *ov = &d->overload;
+
+    if (!datalen || *datalen < sizeof(*config))
+	return GE_INVAL;
+
+    if (func == GENSIO_CONTROL_OVERLOAD_SET_CONFIG) {
+	if (config->resume > config->limit)
+	    return GE_INVAL;
+	LOCK(&d->overload_lock);
+	ov->limit = config->limit;
+	ov->resume = config->resume;
+	if (!ov->resume)
+	    ov->resume = ov->limit / 4 * 3;
+	ov->policies = config->policies;
+	ov->recheck = config->recheck;
+	if (!ov->recheck.secs && !ov->recheck.nsecs)
+	    ov->recheck.nsecs = 100000000;
+	ov->overloaded = false;
+	gensio_unix_overload_update(d);
+	UNLOCK(&d->overload_lock);
+    } else {
+	LOCK(&d->overload_lock);
+	gensio_unix_overload_update(d);
+	*config = *ov;
+	UNLOCK(&d->overload_lock);
+	*datalen = sizeof(*config);
+    }
+    return 0;
+}
+
+/* Only a single selector can be run from another loop. */
+static int
+gensio_unix_poll_info(struct gensio_data *d, void *data, gensiods *datalen)
+{
+    struct gensio_poll_info *info = data;
+    struct timeval tv;
+    int rv;
+
+    if (!datalen || *datalen < sizeof(*info))
+	return GE_INVAL;
+    if (d->nr_shards)
+	return GE_NOTSUP;
+    rv = sel_get_poll_info(d->sel, &info->fd, &tv);
+    if (rv)
+	return GE_NOTSUP;
+    info->timeout.secs = tv.tv_sec;
+    info->timeout.nsecs = tv.tv_usec * 1000;
+    *datalen = sizeof(*info);
+    return 0;
+}
+
 static int
 gensio_unix_control(struct gensio_os_funcs *o, int func, void *data,
 		    gensiods *datalen)
@@ -1569,6 +2668,87 @@ gensio_unix_control(struct gensio_os_funcs *o, int func, void *data,
 	d->pdata = data;
 	return 0;
 
+    case GENSIO_CONTROL_BUFPOOL_STATS:
+	if (!d->bufpool)
+	    return GE_NOTSUP;
+	if (!datalen || *datalen < sizeof(struct gensio_bufpool_stats))
+	    return GE_INVAL;
+	gensio_bufpool_get_stats(d->bufpool, data);
+	*datalen = sizeof(struct gensio_bufpool_stats);
+	return 0;
+
+    case GENSIO_CONTROL_BUFPOOL_HUGEPAGE_SET_CONFIG:
+    case GENSIO_CONTROL_BUFPOOL_HUGEPAGE_GET_CONFIG:
+	if (!d->bufpool)
+	    return GE_NOTSUP;
+	if (!datalen ||
+		*datalen < sizeof(struct gensio_bufpool_hugepage_config))
+	    return GE_INVAL;
+	*datalen = sizeof(struct gensio_bufpool_hugepage_config);
+	if (func == GENSIO_CONTROL_BUFPOOL_HUGEPAGE_GET_CONFIG) {
+	    gensio_bufpool_get_hugepages(d->bufpool, data);
+	    return 0;
+	}
+	return gensio_bufpool_set_hugepages(d->bufpool,
+		((struct gensio_bufpool_hugepage_config *) data)->size);
+
+    case GENSIO_CONTROL_ADDRCACHE_SET_CONFIG:
+    case GENSIO_CONTROL_ADDRCACHE_GET_CONFIG:
+    case GENSIO_CONTROL_ADDRCACHE_STATS:
+    case GENSIO_CONTROL_ADDRCACHE_FLUSH:
+	if (!d->addrcache)
+	    return GE_NOTSUP;
+	return gensio_addrcache_control(d->addrcache, func, data, datalen);
+
+    case GENSIO_CONTROL_BUSY_POLL_SET_CONFIG:
+    case GENSIO_CONTROL_BUSY_POLL_GET_CONFIG:
+    case GENSIO_CONTROL_BUSY_POLL_STATS:
+	return gensio_unix_busy_poll_control(d, func, data, datalen);
+
+    case GENSIO_CONTROL_TIMER_SLACK_SET_CONFIG:
+    case GENSIO_CONTROL_TIMER_SLACK_GET_CONFIG:
+	return gensio_unix_timer_slack_control(d, func, data, datalen);
+
+    case GENSIO_CONTROL_READBUF_BUDGET_SET_CONFIG:
+    case GENSIO_CONTROL_READBUF_BUDGET_GET_CONFIG:
+	return gensio_unix_readbuf_budget_control(d, func, data, datalen);
+
+    case GENSIO_CONTROL_OVERLOAD_SET_CONFIG:
+    case GENSIO_CONTROL_OVERLOAD_GET_CONFIG:
+	return gensio_unix_overload_control(d, func, data, datalen);
+
+    case GENSIO_CONTROL_POLL_INFO:
+	return gensio_unix_poll_info(d, data, datalen);
+
+    case GENSIO_CONTROL_ALLOC_STATS_SET_CONFIG:
+    case GENSIO_CONTROL_ALLOC_STATS:
+	return gensio_allocstats_control(d->allocstats, func, data, datalen);
+
+    case GENSIO_CONTROL_LOOP_STATS_SET_CONFIG:
+    case GENSIO_CONTROL_LOOP_STATS:
+	return gensio_unix_loop_stats_control(d, func, data, datalen);
+
+#ifdef GENSIO_LOCKPROF
+    case GENSIO_CONTROL_LOCK_PROFILE_SET_CONFIG:
+    case GENSIO_CONTROL_LOCK_PROFILE:
+	return gensio_unix_lock_profile_control(func, data, datalen);
+#endif
+
+    case GENSIO_CONTROL_RUNNER_PRIORITY: {
+	struct gensio_runner_priority *rp = data;
+
+	if (!datalen || *datalen != sizeof(*rp))
+	    return GE_INVAL;
+	sel_runner_set_priority(rp->runner->sel_runner, rp->high);
+	return 0;
+    }
+
+    case GENSIO_CONTROL_SINGLE_THREAD:
+	if (d->nr_shards)
+	    return GE_INVAL;
+	d->single_thread = true;
+	return 0;
+
     default:
 	return GE_NOTSUP;
     }
@@ -1592,15 +2772,26 @@ gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
     }
     memset(d, 0, sizeof(*d));
     LOCK_INIT(&d->reflock);
+    LOCK_INIT(&d->mwait_lock);
+    LOCK_INIT(&d->shard_lock);
+    LOCK_INIT(&d->readbuf_lock);
+    LOCK_INIT(&d->overload_lock);
     d->refcount = 1;
 
     o->user_data = d;
     d->sel = sel;
     d->wake_sig = wake_sig;
     d->mtrack = gensio_memtrack_alloc();
+    d->bufpool = gensio_bufpool_alloc(d->mtrack);
+    d->allocstats = gensio_allocstats_alloc(); /* Optional */
 
     o->zalloc = gensio_unix_zalloc;
     o->free = gensio_unix_free;
+    if (d->bufpool) {
+	/* Without one we just fall back to zalloc and free. */
+	o->buf_alloc = gensio_unix_buf_alloc;
+	o->buf_free = gensio_unix_buf_free;
+    }
     o->alloc_lock = gensio_unix_alloc_lock;
     o->free_lock = gensio_unix_free_lock;
     o->lock = gensio_unix_lock;
@@ -1615,6 +2806,10 @@ gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
     o->free_timer = gensio_unix_free_timer;
     o->start_timer = gensio_unix_start_timer;
     o->start_timer_abs = gensio_unix_start_timer_abs;
+    o->start_timer_slack = gensio_unix_start_timer_slack;
+    o->readbuf_reserve = gensio_unix_readbuf_reserve;
+    o->readbuf_release = gensio_unix_readbuf_release;
+    o->overloaded = gensio_unix_overloaded;
     o->stop_timer = gensio_unix_stop_timer;
     o->stop_timer_with_done = gensio_unix_stop_timer_with_done;
     o->alloc_runner = gensio_unix_alloc_runner;
@@ -1632,6 +2827,7 @@ gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
     o->free_funcs = gensio_unix_free_funcs;
     o->call_once = gensio_unix_call_once;
     o->get_monotonic_time = gensio_unix_get_monotonic_time;
+    o->get_loop_time = gensio_unix_get_loop_time;
     o->handle_fork = gensio_handle_fork;
     o->add_iod = gensio_unix_add_iod;
     o->release_iod = gensio_unix_release_iod;
@@ -1656,6 +2852,10 @@ gensio_unix_alloc_sel(struct selector_s *sel, int wake_sig)
     o->control = gensio_unix_control;
 
     gensio_addr_addrinfo_set_os_funcs(o);
+    d->addrcache = gensio_addrcache_alloc(o, o->addr_scan_ips);
+    if (d->addrcache)
+	/* Without one lookups just go straight to the resolver. */
+	o->addr_scan_ips = gensio_unix_addr_scan_ips;
     if (gensio_stdsock_set_os_funcs(o)) {
 	free(d);
 	free(o);
@@ -2182,6 +3382,26 @@ int gensio_os_wait_thread(struct gensio_thread *tid)
 #endif
 }
 
+int
+gensio_os_thread_set_cpu(struct gensio_thread *tid, unsigned int cpu)
+{
+#if defined(USE_PTHREADS) && defined(HAVE_PTHREAD_SETAFFINITY_NP)
+    cpu_set_t set;
+    int rv;
+
+    if (cpu >= CPU_SETSIZE)
+	return GE_INVAL;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    rv = pthread_setaffinity_np(tid->id, sizeof(set), &set);
+    if (rv)
+	return gensio_os_err_to_err(tid->o, rv);
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
 
 int
 gensio_i_os_err_to_err(struct gensio_os_funcs *o,
@@ -2231,6 +3451,7 @@ gensio_i_os_err_to_err(struct gensio_os_funcs *o,
 struct sel_lock_s
 {
     lock_type lock;
+    struct lockprof prof;
 };
 
 static sel_lock_t *
@@ -2241,6 +3462,11 @@ defsel_lock_alloc(void *cb_data)
     l = malloc(sizeof(*l));
     if (!l)
 	return NULL;
+    memset(l, 0, sizeof(*l));
+#ifdef GENSIO_LOCKPROF
+    /* The selector's fd and timer locks are allocated from different places. */
+    l->prof.site = __builtin_return_address(0);
+#endif
     LOCK_INIT(&l->lock);
     return l;
 }
@@ -2255,13 +3481,13 @@ defsel_lock_free(sel_lock_t *l)
 static void
 defsel_lock(sel_lock_t *l)
 {
-    LOCK(&l->lock);
+    LOCKPROF_LOCK(&l->prof, &l->lock);
 }
 
 static void
 defsel_unlock(sel_lock_t *l)
 {
-    UNLOCK(&l->lock);
+    LOCKPROF_UNLOCK(&l->prof, &l->lock);
 }
 
 #endif
@@ -2301,6 +3527,102 @@ gensio_unix_funcs_alloc(struct selector_s *sel, int wake_sig,
     return 0;
 }
 
+int
+gensio_unix_funcs_alloc_sharded(unsigned int nr_shards, int wake_sig,
+				struct gensio_os_funcs **ro)
+{
+#ifdef USE_PTHREADS
+    struct gensio_os_funcs *o;
+    struct gensio_data *d;
+    struct gensio_unix_shard *shards;
+    unsigned int i;
+    int rv;
+
+    if (nr_shards == 0)
+	return GE_INVAL;
+    if (nr_shards == 1)
+	return gensio_unix_funcs_alloc(NULL, wake_sig, ro);
+
+    shards = calloc(nr_shards, sizeof(*shards));
+    if (!shards)
+	return GE_NOMEM;
+
+    for (i = 0; i < nr_shards; i++) {
+	rv = sel_alloc_selector_thread(&shards[i].sel, wake_sig,
+				       defsel_lock_alloc,
+				       defsel_lock_free, defsel_lock,
+				       defsel_unlock, NULL);
+	if (rv)
+	    goto out_nomem;
+    }
+
+    o = gensio_unix_alloc_sel(shards[0].sel, wake_sig);
+    if (!o)
+	goto out_nomem;
+    d = o->user_data;
+
+    if (pthread_key_create(&d->shard_key, gensio_unix_shard_thread_exit)) {
+	gensio_unix_free_funcs(o);
+	goto out_nomem;
+    }
+    if (pthread_key_create(&d->alloc_shard_key, NULL)) {
+	pthread_key_delete(d->shard_key);
+	gensio_unix_free_funcs(o);
+	goto out_nomem;
+    }
+
+    for (i = 0; i < nr_shards; i++)
+	shards[i].d = d;
+    d->shards = shards;
+    d->nr_shards = nr_shards;
+    d->freesel = true;
+
+    *ro = o;
+    return 0;
+
+ out_nomem:
+    for (i = 0; i < nr_shards; i++) {
+	if (shards[i].sel)
+	    sel_free_selector(shards[i].sel);
+    }
+    free(shards);
+    return GE_NOMEM;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
+int
+gensio_unix_funcs_bind_shard(struct gensio_os_funcs *o, unsigned int shardnum)
+{
+#ifdef USE_PTHREADS
+    struct gensio_data *d;
+    struct gensio_unix_shard *shard, *old;
+
+    if (o->service != gensio_unix_service)
+	return GE_NOTSUP;
+    d = o->user_data;
+    if (!d->nr_shards)
+	return GE_NOTSUP;
+
+    shard = &d->shards[shardnum % d->nr_shards];
+    old = gensio_unix_curr_shard(d);
+    if (old == shard)
+	return 0;
+    if (pthread_setspecific(d->shard_key, shard))
+	return GE_NOMEM;
+
+    LOCK(&d->shard_lock);
+    if (old)
+	old->nr_threads--;
+    shard->nr_threads++;
+    UNLOCK(&d->shard_lock);
+    return 0;
+#else
+    return GE_NOTSUP;
+#endif
+}
+
 struct gensio_os_funcs *
 gensio_selector_alloc(struct selector_s *sel, int wake_sig)
 {
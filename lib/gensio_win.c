@@ -124,6 +124,20 @@ struct gensio_iod_win {
     DWORD threadid;
     CRITICAL_SECTION lock;
 
+    /*
+     * Sockets and serial ports don't have their own thread, they are
+     * driven from the I/O completion port thread pool.  iocp_handler
+     * is called with the lock held for each packet for this iod, ov
+     * is NULL for a wakeup from win_iocp_kick().  iocp_pending counts
+     * packets and overlapped operations outstanding, iocp_idle is set
+     * when it is zero so shutdown can wait for them to drain.
+     */
+    void (*iocp_handler)(struct gensio_iod_win *wiod, OVERLAPPED *ov,
+			 DWORD nbytes, DWORD werr);
+    unsigned int iocp_pending;
+    BOOL iocp_kicked;
+    HANDLE iocp_idle;
+
     unsigned int in_handler_count;
     BOOL handlers_set;
     BOOL in_handlers_clear;
@@ -188,6 +202,9 @@ heap_cmp_key(heap_val_t *t1, heap_val_t *t2)
 
 #include "heap.h"
 
+/* Upper bound on the I/O completion port pool size. */
+#define WIN_IOCP_MAX_THREADS 4
+
 struct gensio_data {
     /* Used to wake me up when something is in waiting_iods. */
     HANDLE waiter;
@@ -207,9 +224,16 @@ struct gensio_data {
     DWORD timerthid;
     WSAEVENT timer_wakeev;
 
+    /* The I/O completion port and the threads servicing it. */
+    HANDLE iocp;
+    HANDLE iocp_threads[WIN_IOCP_MAX_THREADS];
+    unsigned int iocp_nthreads;
+
     struct gensio_os_proc_data *proc_data;
 
     struct gensio_memtrack *mtrack;
+    struct gensio_bufpool *bufpool;
+    struct gensio_addrcache *addrcache;
 
     int (*orig_recv)(struct gensio_iod *iod, void *buf, gensiods buflen,
 		     gensiods *rcount, int gflags);
@@ -248,6 +272,22 @@ win_free(struct gensio_os_funcs *o, void *v)
     gensio_i_free(d->mtrack, v);
 }
 
+static void *
+win_buf_alloc(struct gensio_os_funcs *o, gensiods size)
+{
+    struct gensio_data *d = o->user_data;
+
+    return gensio_bufpool_get(d->bufpool, size);
+}
+
+static void
+win_buf_free(struct gensio_os_funcs *o, void *v)
+{
+    struct gensio_data *d = o->user_data;
+
+    gensio_bufpool_put(d->bufpool, v);
+}
+
 #if 0
 static void
 print_err(char *name, DWORD val)
@@ -321,6 +361,284 @@ timer_thread(LPVOID data)
     return 0;
 }
 
+/*
+ * I/O completion port handling.  Serial ports do overlapped I/O
+ * directly on the port and sockets and other waitable handles get a
+ * thread pool wait that posts a packet to the port, so a few threads
+ * can service any number of iods.  The completion key is the iod, a
+ * zero key tells a pool thread to exit.
+ */
+
+/* Must be called with the iod lock held. */
+static void
+win_iocp_io_start(struct gensio_iod_win *wiod)
+{
+    if (wiod->iocp_pending++ == 0)
+	ResetEvent(wiod->iocp_idle);
+}
+
+/* Must be called with the iod lock held. */
+static void
+win_iocp_io_done(struct gensio_iod_win *wiod)
+{
+    assert(wiod->iocp_pending > 0);
+    if (--wiod->iocp_pending == 0)
+	SetEvent(wiod->iocp_idle);
+}
+
+static DWORD WINAPI
+iocp_thread(LPVOID data)
+{
+    struct gensio_data *d = data;
+    struct gensio_iod_win *wiod;
+    OVERLAPPED *ov;
+    ULONG_PTR key;
+    DWORD nbytes, werr;
+    BOOL rvb;
+
+    for (;;) {
+	ov = NULL;
+	key = 0;
+	rvb = GetQueuedCompletionStatus(d->iocp, &nbytes, &key, &ov, INFINITE);
+	if (!rvb && !ov)
+	    break; /* The port itself failed. */
+	if (!key)
+	    break;
+	werr = rvb ? 0 : GetLastError();
+	wiod = (struct gensio_iod_win *) key;
+
+	EnterCriticalSection(&wiod->lock);
+	wiod->iocp_handler(wiod, ov, nbytes, werr);
+	win_iocp_io_done(wiod);
+	LeaveCriticalSection(&wiod->lock);
+    }
+    return 0;
+}
+
+/*
+ * Report a fatal error on an iod serviced by the completion port.
+ * Must be called with the iod lock held.
+ */
+static void
+win_iocp_fail(struct gensio_iod_win *wiod, DWORD werr)
+{
+    if (!wiod->werr) {
+	wiod->werr = werr;
+	wiod->read.ready = TRUE;
+	wiod->write.ready = TRUE;
+    }
+    wiod->closed = TRUE;
+    queue_iod(wiod);
+}
+
+/*
+ * Post a packet for the iod to the completion port.  Must be called
+ * with the iod lock held.
+ */
+static BOOL
+win_iocp_post(struct gensio_iod_win *wiod, OVERLAPPED *ov)
+{
+    struct gensio_data *d = wiod->iod.f->user_data;
+
+    win_iocp_io_start(wiod);
+    if (!PostQueuedCompletionStatus(d->iocp, 0, (ULONG_PTR) wiod, ov)) {
+	win_iocp_io_done(wiod);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Have the iod's completion handler re-evaluate its state, this is
+ * the wake function for iods on the completion port.  Only one
+ * wakeup is queued at a time.  Must be called with the iod lock held.
+ */
+static void
+win_iocp_kick(struct gensio_iod_win *wiod)
+{
+    if (wiod->iocp_kicked || wiod->done)
+	return;
+    if (win_iocp_post(wiod, NULL))
+	wiod->iocp_kicked = TRUE;
+    else
+	win_iocp_fail(wiod, GetLastError());
+}
+
+/*
+ * Wait for all outstanding packets and operations on the iod to be
+ * handled.  The caller must have set done and stopped anything that
+ * could start new ones.
+ */
+static void
+win_iocp_drain(struct gensio_iod_win *wiod)
+{
+    EnterCriticalSection(&wiod->lock);
+    while (wiod->iocp_pending) {
+	LeaveCriticalSection(&wiod->lock);
+	WaitForSingleObject(wiod->iocp_idle, INFINITE);
+	EnterCriticalSection(&wiod->lock);
+    }
+    LeaveCriticalSection(&wiod->lock);
+}
+
+/*
+ * Set up an iod to be serviced by the completion port.  If h is not
+ * NULL it is associated with the port so overlapped operations on it
+ * complete there.
+ */
+static int
+win_iocp_iod_init(struct gensio_iod_win *wiod, HANDLE h,
+		  void (*handler)(struct gensio_iod_win *wiod, OVERLAPPED *ov,
+				  DWORD nbytes, DWORD werr))
+{
+    struct gensio_os_funcs *o = wiod->iod.f;
+    struct gensio_data *d = o->user_data;
+
+    wiod->iocp_idle = CreateEventA(NULL, TRUE, TRUE, NULL);
+    if (!wiod->iocp_idle)
+	return gensio_os_err_to_err(o, GetLastError());
+    if (h && !CreateIoCompletionPort(h, d->iocp, (ULONG_PTR) wiod, 0))
+	return gensio_os_err_to_err(o, GetLastError());
+    wiod->iocp_handler = handler;
+    return 0;
+}
+
+static void
+win_iocp_iod_clean(struct gensio_iod_win *wiod)
+{
+    if (wiod->iocp_idle) {
+	CloseHandle(wiod->iocp_idle);
+	wiod->iocp_idle = NULL;
+    }
+}
+
+/*
+ * A thread pool wait on a handle that posts a packet with ov to the
+ * completion port each time the handle is signalled.  Use it with
+ * auto-reset events or timers so the wait is consumed.
+ */
+struct win_iocp_wait {
+    struct gensio_iod_win *wiod;
+    HANDLE waith;
+    HANDLE doneh; /* Set when an unregister has finished. */
+    BOOL unregistering;
+    OVERLAPPED ov; /* Only used to identify the packet. */
+};
+
+static VOID CALLBACK
+win_iocp_wait_cb(PVOID data, BOOLEAN timed_out)
+{
+    struct win_iocp_wait *w = data;
+    struct gensio_iod_win *wiod = w->wiod;
+
+    EnterCriticalSection(&wiod->lock);
+    if (w->waith && !wiod->done) {
+	if (!win_iocp_post(wiod, &w->ov))
+	    win_iocp_fail(wiod, GetLastError());
+    }
+    LeaveCriticalSection(&wiod->lock);
+}
+
+static int
+win_iocp_wait_init(struct win_iocp_wait *w, struct gensio_iod_win *wiod)
+{
+    w->wiod = wiod;
+    w->doneh = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!w->doneh)
+	return gensio_os_err_to_err(wiod->iod.f, GetLastError());
+    return 0;
+}
+
+/* Must be called with the iod lock held. */
+static int
+win_iocp_wait_start(struct win_iocp_wait *w, HANDLE h)
+{
+    if (!RegisterWaitForSingleObject(&w->waith, h, win_iocp_wait_cb, w,
+				     INFINITE, WT_EXECUTEINWAITTHREAD)) {
+	w->waith = NULL;
+	return gensio_os_err_to_err(w->wiod->iod.f, GetLastError());
+    }
+    return 0;
+}
+
+/*
+ * Must be called with the iod lock held, this doesn't wait for a
+ * running callback to finish, use win_iocp_wait_finish() without the
+ * lock for that.
+ */
+static void
+win_iocp_wait_stop(struct win_iocp_wait *w)
+{
+    if (!w->waith)
+	return;
+    if (UnregisterWaitEx(w->waith, w->doneh) ||
+		GetLastError() == ERROR_IO_PENDING)
+	w->unregistering = TRUE;
+    w->waith = NULL;
+}
+
+static void
+win_iocp_wait_finish(struct win_iocp_wait *w)
+{
+    if (w->unregistering) {
+	WaitForSingleObject(w->doneh, INFINITE);
+	w->unregistering = FALSE;
+    }
+}
+
+static void
+win_iocp_wait_clean(struct win_iocp_wait *w)
+{
+    if (w->doneh) {
+	CloseHandle(w->doneh);
+	w->doneh = NULL;
+    }
+}
+
+static int
+win_iocp_setup(struct gensio_data *d)
+{
+    SYSTEM_INFO sinfo;
+    unsigned int nthreads;
+
+    GetSystemInfo(&sinfo);
+    nthreads = sinfo.dwNumberOfProcessors;
+    if (nthreads < 2)
+	nthreads = 2;
+    if (nthreads > WIN_IOCP_MAX_THREADS)
+	nthreads = WIN_IOCP_MAX_THREADS;
+
+    d->iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, nthreads);
+    if (!d->iocp)
+	return GE_NOMEM;
+
+    for (; d->iocp_nthreads < nthreads; d->iocp_nthreads++) {
+	d->iocp_threads[d->iocp_nthreads] = CreateThread(NULL, 0, iocp_thread,
+							 d, 0, NULL);
+	if (!d->iocp_threads[d->iocp_nthreads])
+	    return GE_NOMEM;
+    }
+    return 0;
+}
+
+static void
+win_iocp_cleanup(struct gensio_data *d)
+{
+    unsigned int i;
+
+    if (!d->iocp)
+	return;
+    for (i = 0; i < d->iocp_nthreads; i++)
+	PostQueuedCompletionStatus(d->iocp, 0, 0, NULL);
+    for (i = 0; i < d->iocp_nthreads; i++) {
+	WaitForSingleObject(d->iocp_threads[i], INFINITE);
+	CloseHandle(d->iocp_threads[i]);
+    }
+    d->iocp_nthreads = 0;
+    CloseHandle(d->iocp);
+    d->iocp = NULL;
+}
+
 static int
 win_alloc_iod(struct gensio_os_funcs *o, unsigned int size, int fd,
 	      enum gensio_iod_type type,
@@ -1179,8 +1497,8 @@ win_iod_check(struct gensio_iod_win *wiod)
 
 struct gensio_iod_win_sock {
     struct gensio_iod_win wiod;
-    WSAEVENT wakeev;
     WSAEVENT sockev;
+    struct win_iocp_wait sockwait;
     BOOL connected;
     void *sockinfo;
     enum { CL_NOT_CALLED, CL_CALLED, CL_DONE } close_state;
@@ -1189,100 +1507,97 @@ struct gensio_iod_win_sock {
 #define wiod_to_winsock(w) gensio_container_of(w, struct gensio_iod_win_sock,\
 					       wiod)
 
-static DWORD WINAPI
-winsock_func(LPVOID data)
+/*
+ * Called from the completion port pool when the socket event fires
+ * (ov is the sockwait packet) or the iod is woken (ov is NULL).
+ * Collect the network events and select the ones we are now
+ * interested in.
+ */
+static void
+winsock_iocp_handler(struct gensio_iod_win *wiod, OVERLAPPED *ov,
+		     DWORD nbytes, DWORD werr)
 {
-    struct gensio_iod_win_sock *swiod = data;
-    struct gensio_iod_win *wiod = &swiod->wiod;
-    WSAEVENT waiters[2];
-    unsigned int i;
-    DWORD rv;
+    struct gensio_iod_win_sock *swiod = wiod_to_winsock(wiod);
+    WSANETWORKEVENTS revents;
+    long events = 0;
+    BOOL queueit = FALSE;
     int irv;
 
-    EnterCriticalSection(&wiod->lock);
-    waiters[0] = swiod->wakeev;
-    waiters[1] = swiod->sockev;
-    for(;;) {
-	WSANETWORKEVENTS revents;
-	long events = 0;
-	BOOL queueit = FALSE;
-
-	if (!wiod->closed) {
-	    events = FD_CLOSE;
-	    if (wiod->read.wait && !wiod->read.ready)
-		events |= FD_READ | FD_ACCEPT;
-	    if (wiod->write.wait && !wiod->write.ready)
-		events |= FD_WRITE | FD_CONNECT;
-	    if (wiod->except.wait && !wiod->except.ready)
-		events |= FD_OOB;
-	}
-	LeaveCriticalSection(&wiod->lock);
-	i = 1;
-	if (events) {
-	    /* FIXME - check if events changed? */
-	    irv = WSAEventSelect(wiod->fd, swiod->sockev, events);
-	    if (irv == SOCKET_ERROR) {
-		EnterCriticalSection(&wiod->lock);
-		if (!wiod->werr)
-		    wiod->werr = WSAGetLastError();
+    if (!ov)
+	wiod->iocp_kicked = FALSE;
+    if (wiod->done)
+	return;
+
+    if (ov == &swiod->sockwait.ov) {
+	irv = WSAEnumNetworkEvents(wiod->fd, swiod->sockev, &revents);
+	if (irv == SOCKET_ERROR) {
+	    if (!wiod->werr)
+		wiod->werr = WSAGetLastError();
+	    wiod->closed = TRUE;
+	    queueit = TRUE;
+	} else {
+	    if (revents.lNetworkEvents & (FD_READ | FD_ACCEPT)) {
+		wiod->read.ready = TRUE;
+		if (wiod->read.wait)
+		    queueit = TRUE;
+	    }
+	    if (revents.lNetworkEvents & (FD_WRITE | FD_CONNECT)) {
+		wiod->write.ready = TRUE;
+		if (wiod->write.wait)
+		    queueit = TRUE;
+	    }
+	    if (revents.lNetworkEvents & FD_OOB) {
+		wiod->except.ready = TRUE;
+		if (wiod->except.wait)
+		    queueit = TRUE;
+	    }
+	    if (revents.lNetworkEvents & FD_CLOSE) {
 		wiod->closed = TRUE;
 		queueit = TRUE;
-		goto do_queue;
 	    }
-	    i++;
 	}
-	rv = WSAWaitForMultipleEvents(i, waiters, FALSE, INFINITE, FALSE);
-	EnterCriticalSection(&wiod->lock);
-	if (wiod->done)
-	    break;
-	if (rv == WSA_WAIT_FAILED) {
+    }
+
+    if (!wiod->closed) {
+	events = FD_CLOSE;
+	if (wiod->read.wait && !wiod->read.ready)
+	    events |= FD_READ | FD_ACCEPT;
+	if (wiod->write.wait && !wiod->write.ready)
+	    events |= FD_WRITE | FD_CONNECT;
+	if (wiod->except.wait && !wiod->except.ready)
+	    events |= FD_OOB;
+    }
+    if (events) {
+	/* FIXME - check if events changed? */
+	irv = WSAEventSelect(wiod->fd, swiod->sockev, events);
+	if (irv == SOCKET_ERROR) {
+	    if (!wiod->werr)
+		wiod->werr = WSAGetLastError();
 	    wiod->closed = TRUE;
 	    queueit = TRUE;
-	} else if (rv == WSA_WAIT_EVENT_0) {
-	    WSAResetEvent(swiod->wakeev);
-	} else if (rv == WSA_WAIT_EVENT_0 + 1) {
-	    irv = WSAEnumNetworkEvents(wiod->fd, swiod->sockev, &revents);
-	    if (irv == SOCKET_ERROR) {
-		if (!wiod->werr)
-		    wiod->werr = WSAGetLastError();
-		wiod->closed = TRUE;
-		queueit = TRUE;
-	    } else {
-		if (revents.lNetworkEvents & (FD_READ | FD_ACCEPT)) {
-		    wiod->read.ready = TRUE;
-		    if (wiod->read.wait)
-			queueit = TRUE;
-		}
-		if (revents.lNetworkEvents & (FD_WRITE | FD_CONNECT)) {
-		    wiod->write.ready = TRUE;
-		    if (wiod->write.wait)
-			queueit = TRUE;
-		}
-		if (revents.lNetworkEvents & FD_OOB) {
-		    wiod->except.ready = TRUE;
-		    if (wiod->except.wait)
-			queueit = TRUE;
-		}
-		if (revents.lNetworkEvents & FD_CLOSE) {
-		    wiod->closed = TRUE;
-		    queueit = TRUE;
-		}
-	    }
 	}
-    do_queue:
-	if (queueit)
-	    queue_iod(wiod);
     }
-    LeaveCriticalSection(&wiod->lock);
-    return 0;
+
+    if (queueit)
+	queue_iod(wiod);
 }
 
 static void
 win_iod_socket_wake(struct gensio_iod_win *wiod)
+{
+    win_iocp_kick(wiod);
+}
+
+static void
+win_iod_socket_shutdown(struct gensio_iod_win *wiod)
 {
     struct gensio_iod_win_sock *swiod = wiod_to_winsock(wiod);
 
-    assert(WSASetEvent(swiod->wakeev));
+    EnterCriticalSection(&wiod->lock);
+    win_iocp_wait_stop(&swiod->sockwait);
+    LeaveCriticalSection(&wiod->lock);
+    win_iocp_wait_finish(&swiod->sockwait);
+    win_iocp_drain(wiod);
 }
 
 static void
@@ -1290,10 +1605,10 @@ win_iod_socket_clean(struct gensio_iod_win *wiod)
 {
     struct gensio_iod_win_sock *swiod = wiod_to_winsock(wiod);
 
+    win_iocp_wait_clean(&swiod->sockwait);
+    win_iocp_iod_clean(wiod);
     if (swiod->sockev != WSA_INVALID_EVENT)
 	WSACloseEvent(swiod->sockev);
-    if (swiod->wakeev != WSA_INVALID_EVENT)
-	WSACloseEvent(swiod->wakeev);
     if (wiod->fd != -1)
 	closesocket(wiod->fd);
 }
@@ -1302,28 +1617,44 @@ static int
 win_iod_socket_init(struct gensio_iod_win *wiod, void *cb_data)
 {
     struct gensio_iod_win_sock *swiod = wiod_to_winsock(wiod);
+    int rv;
 
-    swiod->wakeev = WSA_INVALID_EVENT;
-    swiod->sockev = WSA_INVALID_EVENT;
+    /*
+     * An auto-reset event, so the thread pool wait consumes it and
+     * doesn't keep firing until the network events are collected.
+     */
+    swiod->sockev = CreateEventA(NULL, FALSE, FALSE, NULL);
+    if (swiod->sockev == WSA_INVALID_EVENT) {
+	rv = GE_NOMEM;
+	goto out_err;
+    }
 
-    swiod->wakeev = WSACreateEvent();
-    if (swiod->wakeev == WSA_INVALID_EVENT)
+    rv = win_iocp_iod_init(wiod, NULL, winsock_iocp_handler);
+    if (rv)
+	goto out_err;
+    rv = win_iocp_wait_init(&swiod->sockwait, wiod);
+    if (rv)
 	goto out_err;
 
-    swiod->sockev = WSACreateEvent();
-    if (swiod->sockev == WSA_INVALID_EVENT)
+    EnterCriticalSection(&wiod->lock);
+    rv = win_iocp_wait_start(&swiod->sockwait, swiod->sockev);
+    if (!rv)
+	/* Do the initial event select. */
+	win_iocp_kick(wiod);
+    LeaveCriticalSection(&wiod->lock);
+    if (rv)
 	goto out_err;
 
-    wiod->threadfunc = winsock_func;
     wiod->clean = win_iod_socket_clean;
     wiod->wake = win_iod_socket_wake;
     wiod->check = win_iod_check;
+    wiod->shutdown = win_iod_socket_shutdown;
 
     return 0;
 
  out_err:
     win_iod_socket_clean(wiod);
-    return GE_NOMEM;
+    return rv;
 }
 
 /* Used to pass data into the intitialization routines. */
@@ -2004,15 +2335,15 @@ win_iod_pipe_init(struct gensio_iod_win *wiod, void *cb_data)
 struct gensio_iod_win_twoway {
     struct gensio_iod_win wiod;
 
-    HANDLE wakeh;
     HANDLE ioh;
 
     /*
-     * An optional extra handle that will be added to the object wait.
-     * If it is set, call extrah_func.
+     * An optional extra handle that will be waited on.  If it is
+     * signalled, call extrah_func.
      */
     HANDLE extrah;
     DWORD (*extrah_func)(struct gensio_iod_win_twoway *);
+    struct win_iocp_wait extrawait;
 
     BOOL readable;
     BOOL writeable;
@@ -2020,164 +2351,165 @@ struct gensio_iod_win_twoway {
     struct gensio_circbuf *inbuf;
     struct gensio_circbuf *outbuf;
 
-    BOOL do_flush; /* Tell thread to flush output data. */
+    BOOL do_flush; /* Tell the handler to flush output data. */
+
+    /* Overlapped operations in progress on ioh. */
+    BOOL reading;
+    BOOL writing;
+    OVERLAPPED reado;
+    OVERLAPPED writeo;
 };
 
 #define wiod_to_win_twoway(w) gensio_container_of(w,			\
 					       struct gensio_iod_win_twoway, \
 					       wiod)
 
-static DWORD WINAPI
-win_twoway_thread(LPVOID data)
+/* Must be called with wiod lock held. */
+static void
+win_twoway_fail(struct gensio_iod_win *wiod, DWORD rvw)
 {
-    struct gensio_iod_win_twoway *twiod = data;
-    struct gensio_iod_win *wiod = &twiod->wiod;
-    DWORD rvw, nwait;
-    BOOL reading = FALSE, writing = FALSE;
-    OVERLAPPED reado, writeo;
-    HANDLE waiters[4];
-
-    memset(&reado, 0, sizeof(reado));
-    memset(&writeo, 0, sizeof(writeo));
-
-    EnterCriticalSection(&wiod->lock);
-    reado.hEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
-    if (!reado.hEvent)
-	goto out_err;
-    writeo.hEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
-    if (!writeo.hEvent)
-	goto out_err;
+    if (!wiod->werr) {
+	wiod->read.ready = TRUE;
+	wiod->write.ready = TRUE;
+	wiod->werr = rvw;
+	queue_iod(wiod);
+    }
+}
 
-    waiters[0] = twiod->wakeh;
-    waiters[1] = reado.hEvent;
-    waiters[2] = writeo.hEvent;
-    nwait = 3;
-    if (twiod->extrah)
-	waiters[nwait++] = twiod->extrah;
+/*
+ * Start a read and/or a write if there is room or data for them.
+ * Must be called with wiod lock held.
+ */
+static void
+win_twoway_start_io(struct gensio_iod_win_twoway *twiod)
+{
+    struct gensio_iod_win *wiod = &twiod->wiod;
+    DWORD rvw;
 
-    for(;;) {
-	BOOL rvb;
+    if (wiod->done || wiod->closed || wiod->werr)
+	return;
 
-	if (!reading && gensio_circbuf_room_left(twiod->inbuf) && !wiod->werr
-			&& twiod->readable) {
-	    gensiods readsize;
-	    void *readpos;
+    if (twiod->do_flush) {
+	if (twiod->writing) {
+	    CancelIoEx(twiod->ioh, &twiod->writeo);
+	} else {
+	    gensio_circbuf_reset(twiod->outbuf);
+	    twiod->do_flush = FALSE;
+	}
+    }
 
-	    gensio_circbuf_next_write_area(twiod->inbuf, &readpos, &readsize);
-	    reading = TRUE;
-	    LeaveCriticalSection(&wiod->lock);
-	    rvb = ReadFile(twiod->ioh, readpos, readsize, NULL, &reado);
-	    EnterCriticalSection(&wiod->lock);
-	    if (!rvb) {
-		rvw = GetLastError();
-		if (rvw != ERROR_IO_PENDING)
-		    goto out_err_noget;
+    if (!twiod->reading && gensio_circbuf_room_left(twiod->inbuf)
+		&& twiod->readable) {
+	gensiods readsize;
+	void *readpos;
+
+	gensio_circbuf_next_write_area(twiod->inbuf, &readpos, &readsize);
+	memset(&twiod->reado, 0, sizeof(twiod->reado));
+	twiod->reading = TRUE;
+	win_iocp_io_start(wiod);
+	if (!ReadFile(twiod->ioh, readpos, readsize, NULL, &twiod->reado)) {
+	    rvw = GetLastError();
+	    if (rvw != ERROR_IO_PENDING) {
+		twiod->reading = FALSE;
+		win_iocp_io_done(wiod);
+		win_twoway_fail(wiod, rvw);
+		return;
 	    }
-	} else if (!writing && gensio_circbuf_datalen(twiod->outbuf) > 0 &&
-		   !wiod->werr && twiod->writeable) {
-	    gensiods writelen;
-	    void *writepos;
+	}
+    }
 
-	    gensio_circbuf_next_read_area(twiod->outbuf, &writepos, &writelen);
-	    writing = TRUE;
-	    LeaveCriticalSection(&wiod->lock);
-	    rvb = WriteFile(twiod->ioh, writepos, writelen, NULL, &writeo);
-	    EnterCriticalSection(&wiod->lock);
-	    if (!rvb) {
-		rvw = GetLastError();
-		if (rvw != ERROR_IO_PENDING)
-		    goto out_err_noget;
+    if (!twiod->writing && gensio_circbuf_datalen(twiod->outbuf) > 0 &&
+		!twiod->do_flush && twiod->writeable) {
+	gensiods writelen;
+	void *writepos;
+
+	gensio_circbuf_next_read_area(twiod->outbuf, &writepos, &writelen);
+	memset(&twiod->writeo, 0, sizeof(twiod->writeo));
+	twiod->writing = TRUE;
+	win_iocp_io_start(wiod);
+	if (!WriteFile(twiod->ioh, writepos, writelen, NULL, &twiod->writeo)) {
+	    rvw = GetLastError();
+	    if (rvw != ERROR_IO_PENDING) {
+		twiod->writing = FALSE;
+		win_iocp_io_done(wiod);
+		win_twoway_fail(wiod, rvw);
+		return;
 	    }
-	} else {
-	    LeaveCriticalSection(&wiod->lock);
-	    rvw = WaitForMultipleObjects(nwait, waiters, FALSE, INFINITE);
-	    EnterCriticalSection(&wiod->lock);
-	    if (rvw == WAIT_FAILED)
-		goto out_err;
-
-	    if (rvw == WAIT_OBJECT_0 + 1) {
-		DWORD nread = 0;
-
-		/* Read event. */
-		if (!GetOverlappedResult(twiod->ioh, &reado, &nread, FALSE))
-		    goto out_err;
+	}
+    }
+}
 
-		if (nread > 0) {
-		    gensio_circbuf_data_added(twiod->inbuf, nread);
-		    if (!wiod->read.ready) {
-			wiod->read.ready = TRUE;
-			queue_iod(wiod);
-		    }
-		}
-		reading = FALSE;
-	    } else if (rvw == WAIT_OBJECT_0 + 2 ||
-		       rvw == ERROR_OPERATION_ABORTED) {
-		DWORD nwrite = 0;
-
-		/* Write event. */
-		if (!GetOverlappedResult(twiod->ioh, &writeo, &nwrite, FALSE))
-		    goto out_err;
-
-		if (twiod->do_flush || nwrite > 0) {
-		    if (twiod->do_flush) {
-			gensio_circbuf_reset(twiod->outbuf);
-			twiod->do_flush = FALSE;
-		    } else {
-			gensio_circbuf_data_removed(twiod->outbuf, nwrite);
-		    }
+/*
+ * Called from the completion port pool when a read or write
+ * finishes, the extra handle is signalled, or the iod is woken.
+ */
+static void
+win_twoway_iocp_handler(struct gensio_iod_win *wiod, OVERLAPPED *ov,
+			DWORD nbytes, DWORD werr)
+{
+    struct gensio_iod_win_twoway *twiod = wiod_to_win_twoway(wiod);
 
-		    if (!wiod->write.ready && !wiod->in_handlers_clear) {
-			wiod->write.ready = TRUE;
-			queue_iod(wiod);
-		    }
-		}
-		writing = FALSE;
-	    } else if (rvw == WAIT_OBJECT_0 + 3) {
-		rvw = twiod->extrah_func(twiod);
-		if (rvw)
-		    goto out_err_noget;
+    if (!ov) {
+	wiod->iocp_kicked = FALSE;
+    } else if (ov == &twiod->reado) {
+	twiod->reading = FALSE;
+	if (werr)
+	    goto out_err;
+	if (nbytes > 0) {
+	    gensio_circbuf_data_added(twiod->inbuf, nbytes);
+	    if (!wiod->read.ready) {
+		wiod->read.ready = TRUE;
+		queue_iod(wiod);
 	    }
 	}
-	if (wiod->done)
-	    break;
-	if (twiod->do_flush) {
-	    if (writing) {
-		CancelIoEx(twiod->ioh, &writeo);
-	    } else {
+    } else if (ov == &twiod->writeo) {
+	twiod->writing = FALSE;
+	if (werr == ERROR_OPERATION_ABORTED && twiod->do_flush)
+	    werr = 0;
+	if (werr)
+	    goto out_err;
+	if (twiod->do_flush || nbytes > 0) {
+	    if (twiod->do_flush) {
 		gensio_circbuf_reset(twiod->outbuf);
 		twiod->do_flush = FALSE;
+	    } else {
+		gensio_circbuf_data_removed(twiod->outbuf, nbytes);
+	    }
+
+	    if (!wiod->write.ready && !wiod->in_handlers_clear) {
+		wiod->write.ready = TRUE;
+		queue_iod(wiod);
 	    }
 	}
+    } else if (ov == &twiod->extrawait.ov) {
+	if (twiod->extrah) {
+	    werr = twiod->extrah_func(twiod);
+	    if (werr)
+		goto out_err;
+	}
     }
- exitth:
-    if (reading)
-	CancelIoEx(twiod->ioh, &reado);
-    if (writing)
-	CancelIoEx(twiod->ioh, &writeo);
-    if (reado.hEvent)
-	CloseHandle(reado.hEvent);
-    if (writeo.hEvent)
-	CloseHandle(writeo.hEvent);
-
-    if (!twiod->readable)
-	wiod->read.ready = TRUE;
-    if (!twiod->writeable)
-	wiod->write.ready = TRUE;
-    queue_iod(wiod);
-    LeaveCriticalSection(&wiod->lock);
 
-    return 0;
+    win_twoway_start_io(twiod);
+    return;
 
  out_err:
-    rvw = GetLastError();
- out_err_noget:
-    if (!wiod->werr) {
-	wiod->read.ready = TRUE;
-	wiod->write.ready = TRUE;
-	wiod->werr = rvw;
-	queue_iod(wiod);
-    }
-    goto exitth;
+    /* Cancelled operations at shutdown or close are not errors. */
+    if (!wiod->done && !wiod->closed)
+	win_twoway_fail(wiod, werr);
+}
+
+static void
+win_twoway_shutdown(struct gensio_iod_win *wiod)
+{
+    struct gensio_iod_win_twoway *twiod = wiod_to_win_twoway(wiod);
+
+    EnterCriticalSection(&wiod->lock);
+    win_iocp_wait_stop(&twiod->extrawait);
+    if (twiod->ioh && (twiod->reading || twiod->writing))
+	CancelIoEx(twiod->ioh, NULL);
+    LeaveCriticalSection(&wiod->lock);
+    win_iocp_wait_finish(&twiod->extrawait);
+    win_iocp_drain(wiod);
 }
 
 /* Must be called with wiod lock held. */
@@ -2218,7 +2550,7 @@ win_twoway_flush(struct gensio_iod_win *wiod)
     EnterCriticalSection(&wiod->lock);
     if (!wiod->err && !wiod->werr) {
 	twiod->do_flush = TRUE;
-	assert(SetEvent(twiod->wakeh));
+	wiod->wake(wiod);
     }
     LeaveCriticalSection(&wiod->lock);
 }
@@ -2248,11 +2580,9 @@ win_twoway_write(struct gensio_iod_win *wiod,
     gensio_circbuf_sg_write(twiod->outbuf, sg, sglen, &count);
     wiod->write.ready = (gensio_circbuf_room_left(twiod->outbuf) > 0
 			 || wiod->err || wiod->werr);
-    if (!wiod->write.ready)
+    if (!wiod->write.ready || count)
 	wiod->wake(wiod);
     LeaveCriticalSection(&wiod->lock);
-    if (count)
-	assert(SetEvent(twiod->wakeh));
  out:
     if (rcount)
 	*rcount = count;
@@ -2285,10 +2615,8 @@ win_twoway_read(struct gensio_iod_win *wiod,
     gensio_circbuf_read(twiod->inbuf, ibuf, buflen, &count);
     wiod->read.ready = (gensio_circbuf_datalen(twiod->inbuf) > 0
 			|| wiod->err || wiod->werr);
-    if (!wiod->read.ready)
+    if (!wiod->read.ready || (was_full && count))
 	wiod->wake(wiod);
-    if (was_full && count)
-	assert(SetEvent(twiod->wakeh));
  out:
     LeaveCriticalSection(&wiod->lock);
     if (rcount)
@@ -2299,9 +2627,7 @@ win_twoway_read(struct gensio_iod_win *wiod,
 static void
 win_iod_twoway_wake(struct gensio_iod_win *wiod)
 {
-    struct gensio_iod_win_twoway *twiod = wiod_to_win_twoway(wiod);
-
-    assert(SetEvent(twiod->wakeh));
+    win_iocp_kick(wiod);
 }
 
 static void
@@ -2309,8 +2635,8 @@ win_iod_twoway_clean(struct gensio_iod_win *wiod)
 {
     struct gensio_iod_win_twoway *twiod = wiod_to_win_twoway(wiod);
 
-    if (twiod->wakeh)
-	CloseHandle(twiod->wakeh);
+    win_iocp_wait_clean(&twiod->extrawait);
+    win_iocp_iod_clean(wiod);
     if (twiod->inbuf) {
 	gensio_circbuf_free(twiod->inbuf);
 	twiod->inbuf = NULL;
@@ -2340,16 +2666,7 @@ win_iod_twoway_init(struct gensio_iod_win *wiod)
     }
     wiod->write.ready = TRUE;
 
-    twiod->wakeh = CreateEventA(NULL, FALSE, FALSE, NULL);
-    if (!twiod->wakeh) {
-	gensio_circbuf_free(twiod->outbuf);
-	twiod->outbuf = NULL;
-	gensio_circbuf_free(twiod->inbuf);
-	twiod->inbuf = NULL;
-	return GE_NOMEM;
-    }
-
-    return 0;
+    return win_iocp_wait_init(&twiod->extrawait, wiod);
 }
 
 struct gensio_iod_win_dev
@@ -2423,10 +2740,12 @@ win_dev_close(struct gensio_iod_win *wiod, bool force)
     }
     rv = win_twoway_close(wiod);
     if (twiod->ioh) {
+	win_iocp_wait_stop(&twiod->extrawait);
 	twiod->extrah = NULL;
 	gensio_win_cleanup_commport(wiod->iod.f, twiod->ioh,
 				    &dtwiod->cominfo);
 	CloseHandle(twiod->ioh);
+	twiod->ioh = NULL;
     }
  out:
     LeaveCriticalSection(&wiod->lock);
@@ -2445,7 +2764,7 @@ win_iod_dev_init(struct gensio_iod_win *wiod, void *cb_data)
 
     rv = win_iod_twoway_init(wiod);
     if (rv)
-	return rv;
+	goto out_err;
 
     rv = GE_NOMEM;
     dtwiod->name = gensio_alloc_sprintf(o, "\\\\.\\%s", info->name);
@@ -2494,11 +2813,24 @@ win_iod_dev_init(struct gensio_iod_win *wiod, void *cb_data)
 	twiod->extrah_func = win_dev_break_handler;
     }
 
-    wiod->threadfunc = win_twoway_thread;
+    rv = win_iocp_iod_init(wiod, twiod->ioh, win_twoway_iocp_handler);
+    if (rv)
+	goto out_err;
+
+    EnterCriticalSection(&wiod->lock);
+    if (twiod->extrah)
+	rv = win_iocp_wait_start(&twiod->extrawait, twiod->extrah);
+    if (!rv)
+	/* Start the first read. */
+	win_iocp_kick(wiod);
+    LeaveCriticalSection(&wiod->lock);
+    if (rv)
+	goto out_err;
 
     wiod->clean = win_iod_dev_clean;
     wiod->wake = win_iod_twoway_wake;
     wiod->check = win_iod_check;
+    wiod->shutdown = win_twoway_shutdown;
 
     return 0;
 
@@ -3707,11 +4039,16 @@ win_finish_free(struct gensio_os_funcs *o)
 {
     struct gensio_data *d = o->user_data;
 
+    if (d->bufpool)
+	gensio_bufpool_free(d->bufpool);
+    if (d->addrcache)
+	gensio_addrcache_free(d->addrcache);
     gensio_memtrack_cleanup(d->mtrack);
     if (d->timerth) {
 	assert(WSASetEvent(d->timer_wakeev));
 	WaitForSingleObject(d->timerth, INFINITE);
     }
+    win_iocp_cleanup(d);
     if (d->waiter)
 	CloseHandle(d->waiter);
     if (d->timer_wakeev)
@@ -3725,6 +4062,18 @@ win_finish_free(struct gensio_os_funcs *o)
     WSACleanup();
 }
 
+static int
+gensio_win_addr_scan_ips(struct gensio_os_funcs *o, const char *str,
+			 bool listen, int ifamily, int protocol,
+			 bool *is_port_set, bool scan_port,
+			 struct gensio_addr **raddr)
+{
+    struct gensio_data *d = o->user_data;
+
+    return gensio_addrcache_scan_ips(d->addrcache, o, str, listen, ifamily,
+				     protocol, is_port_set, scan_port, raddr);
+}
+
 static int
 gensio_win_control(struct gensio_os_funcs *o, int func, void *data,
 		   gensiods *datalen)
@@ -3736,6 +4085,23 @@ gensio_win_control(struct gensio_os_funcs *o, int func, void *data,
 	d->proc_data = data;
 	return 0;
 
+    case GENSIO_CONTROL_BUFPOOL_STATS:
+	if (!d->bufpool)
+	    return GE_NOTSUP;
+	if (!datalen || *datalen < sizeof(struct gensio_bufpool_stats))
+	    return GE_INVAL;
+	gensio_bufpool_get_stats(d->bufpool, data);
+	*datalen = sizeof(struct gensio_bufpool_stats);
+	return 0;
+
+    case GENSIO_CONTROL_ADDRCACHE_SET_CONFIG:
+    case GENSIO_CONTROL_ADDRCACHE_GET_CONFIG:
+    case GENSIO_CONTROL_ADDRCACHE_STATS:
+    case GENSIO_CONTROL_ADDRCACHE_FLUSH:
+	if (!d->addrcache)
+	    return GE_NOTSUP;
+	return gensio_addrcache_control(d->addrcache, func, data, datalen);
+
     default:
 	return GE_NOTSUP;
     }
@@ -3768,6 +4134,7 @@ gensio_win_funcs_alloc(struct gensio_os_funcs **ro)
     theap_init(&d->timer_heap);
 
     d->mtrack = gensio_memtrack_alloc();
+    d->bufpool = gensio_bufpool_alloc(d->mtrack);
 
     o->user_data = d;
 
@@ -3783,8 +4150,16 @@ gensio_win_funcs_alloc(struct gensio_os_funcs **ro)
     if (!d->timerth)
 	goto out_err;
 
+    err = win_iocp_setup(d);
+    if (err)
+	goto out_err;
+
     o->zalloc = win_zalloc;
     o->free = win_free;
+    if (d->bufpool) {
+	o->buf_alloc = win_buf_alloc;
+	o->buf_free = win_buf_free;
+    }
     o->alloc_lock = win_alloc_lock;
     o->free_lock = win_free_lock;
     o->lock = win_lock;
@@ -3839,6 +4214,10 @@ gensio_win_funcs_alloc(struct gensio_os_funcs **ro)
     o->control = gensio_win_control;
 
     gensio_addr_addrinfo_set_os_funcs(o);
+    d->addrcache = gensio_addrcache_alloc(o, o->addr_scan_ips);
+    if (d->addrcache)
+	/* Without one lookups just go straight to the resolver. */
+	o->addr_scan_ips = gensio_win_addr_scan_ips;
     err = gensio_stdsock_set_os_funcs(o);
     if (err)
 	goto out_err;
@@ -4158,6 +4537,16 @@ int gensio_os_wait_thread(struct gensio_thread *tid)
     return 0;
 }
 
+int
+gensio_os_thread_set_cpu(struct gensio_thread *tid, unsigned int cpu)
+{
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+	return GE_INVAL;
+    if (!SetThreadAffinityMask(tid->handle, ((DWORD_PTR) 1) << cpu))
+	return gensio_os_err_to_err(tid->o, GetLastError());
+    return 0;
+}
+
 int
 gensio_i_os_err_to_err(struct gensio_os_funcs *o,
 		       int oserr, const char *caller, const char *file,
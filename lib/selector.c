@@ -20,6 +20,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <stdio.h>
 #include <syslog.h>
@@ -28,17 +29,83 @@
 #ifdef HAVE_EPOLL_PWAIT
 #include <sys/epoll.h>
 #else
-#define EPOLL_CTL_ADD 0
-#define EPOLL_CTL_DEL 0
-#define EPOLL_CTL_MOD 0
+/* Used as update operations by the other backends. */
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+#endif
+#include <fcntl.h>
+#if defined(HAVE_KQUEUE) && defined(HAVE_SYS_EVENT_H) && \
+	!defined(HAVE_EPOLL_PWAIT)
+#include <sys/event.h>
+#include <sys/time.h>
+/*
+ * kqueue is used in place of select() on the BSDs and MacOS, see
+ * process_fds_kqueue().
+ */
+#define SEL_HAVE_KQUEUE
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
 #endif
 #include "errtrig.h"
 
+/* The io_uring rings are shared with the kernel, that needs atomics. */
+#if defined(HAVE_EPOLL_PWAIT) && defined(HAVE_LINUX_IO_URING_H) && \
+	HAVE_GCC_ATOMICS
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <endian.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_ENTER_EXT_ARG)
+/*
+ * io_uring can be used in place of epoll if GENSIO_SEL_IO_URING is
+ * set in the environment.  See the comments before
+ * sel_uring_update_fd() for details.
+ */
+#define SEL_HAVE_IO_URING
+#endif
+#endif
+
 #ifndef EBADFD
 /* At least MacOS doesn't have EBADFD. */
 #define EBADFD EBADF
 #endif
 
+/*
+ * Initial size of the fd table, it doubles in size from here as
+ * necessary.
+ */
+#define SEL_INITIAL_FDS_SIZE	64
+
+/*
+ * The most runners run at a time before the file descriptors are
+ * checked, so a few busy runners can't hold off I/O.
+ */
+#define SEL_RUNNER_BUDGET	64
+
+/*
+ * Runners queued by a thread that is servicing the selector go on
+ * that thread's queue, one of SEL_RUNNER_SLOTS (threads share them
+ * if there are more).  The thread runs its own queue after the
+ * shared one, so it can't starve the shared runners, and a thread with
+ * nothing to do steals a queue.  When a queue gets
+ * SEL_RUNNER_STEAL_DEPTH deep a waiting thread is woken to help.
+ */
+#define SEL_RUNNER_SLOTS	16
+#define SEL_RUNNER_STEAL_DEPTH	16
+
+/* The selector this thread is servicing and its runner queue. */
+static __thread struct selector_s *sel_serving;
+static __thread struct selector_s *sel_slot_owner;
+static __thread unsigned int sel_slot;
+
+#ifdef HAVE_EPOLL_PWAIT
+/* What an fd set with sel_set_fd_edge() is registered for. */
+#define SEL_EDGE_EVENTS		(EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLET)
+#endif
+
 static void *
 sel_alloc(unsigned int size)
 {
@@ -59,6 +126,7 @@ struct sel_runner_s
     sel_runner_func_t func;
     void *cb_data;
     int in_use;
+    int prio; /* See sel_runner_set_priority(). */
     sel_runner_t *next;
 };
 
@@ -80,9 +148,6 @@ typedef struct fd_control_s
        deletion. */
     fd_state_t       *state;
 
-    /* Link in the hash list. */
-    struct fd_control_s *next;
-
     /* Handlers for various events on an fd. */
     void             *data; /* Passed to the handlers */
     sel_fd_handler_t handle_read;
@@ -96,9 +161,25 @@ typedef struct fd_control_s
     char write_enabled;
     char except_enabled;
 
+    /* Handled before other fds in the same wakeup, see sel_set_fd_priority. */
+    char prio;
+
 #ifdef HAVE_EPOLL_PWAIT
     /* See the comment in process_fds_epoll() on the use of this. */
     uint32_t saved_events;
+
+    /* Registered edge triggered, see sel_set_fd_edge(). */
+    char edge;
+#endif
+#ifdef SEL_HAVE_IO_URING
+    /* Is a poll outstanding, and the generation of the current poll. */
+    char uring_armed;
+    uint32_t uring_gen;
+#endif
+#ifdef SEL_HAVE_KQUEUE
+    /* Which oneshot kevent filters are registered for the fd. */
+    char kq_read_armed;
+    char kq_write_armed;
 #endif
 } fd_control_t;
 
@@ -131,6 +212,13 @@ typedef struct heap_val_s
 
     sel_timeout_handler_t done_handler;
     void *done_cb_data;
+
+    /* For the timer wheel, the list the timer is on and where. */
+    struct sel_timer_s *wnext, *wprev;
+    struct sel_timer_s **whead;
+    uint64_t wtick;
+    unsigned char wlevel;
+    unsigned char wslot;
 } heap_val_t;
 
 typedef struct theap_s theap_t;
@@ -166,6 +254,347 @@ heap_cmp_key(heap_val_t *v1, heap_val_t *v2)
 }
 
 #include "heap.h"
+#include <gensio_probes.h>
+
+/*
+ * A hierarchical timer wheel, used in place of the heap if
+ * GENSIO_SEL_TIMER_WHEEL is set when the selector is allocated.
+ * Starting and stopping a timer is O(1) instead of O(log n), which
+ * helps with lots of timers that are mostly restarted or stopped
+ * before they go off.  Timers are kept in 1ms ticks.  The timers in
+ * the current tick are checked against their real timeout, so they
+ * go off at the same time they would with the heap.
+ *
+ * Level 0 has a slot for each of the next 256 ticks.  Each level
+ * above has 64 slots, each covering a whole turn of the level below,
+ * and a slot is moved down (cascaded) when the level below wraps
+ * around to it.  Timers too far out for the top level go in its last
+ * slot and are put back when cascaded.  cur is the current tick;
+ * everything before it has been moved to the expired list, and the
+ * timers in it are moved as their time comes.
+ * A bitmap of the non-empty slots in each level finds the next thing
+ * to do without scanning the slots.
+ */
+#define SEL_WHEEL_L0_BITS	8
+#define SEL_WHEEL_LN_BITS	6
+#define SEL_WHEEL_LEVELS	4
+#define SEL_WHEEL_EXPIRED	0xff
+#define SEL_WHEEL_NONE		UINT64_MAX
+
+struct sel_wheel {
+    uint64_t cur;
+    uint64_t cascaded; /* One past the last tick cascades were done on. */
+    uint64_t bits[SEL_WHEEL_LEVELS][(1 << SEL_WHEEL_L0_BITS) / 64];
+    sel_timer_t *l0[1 << SEL_WHEEL_L0_BITS];
+    sel_timer_t *ln[SEL_WHEEL_LEVELS - 1][1 << SEL_WHEEL_LN_BITS];
+    sel_timer_t *expired;
+    sel_timer_t *expired_tail;
+};
+
+static unsigned int
+wheel_level_bits(unsigned int level)
+{
+    return level == 0 ? SEL_WHEEL_L0_BITS : SEL_WHEEL_LN_BITS;
+}
+
+/* How many ticks a slot in the level covers, as a shift. */
+static unsigned int
+wheel_level_shift(unsigned int level)
+{
+    if (level == 0)
+	return 0;
+    return SEL_WHEEL_L0_BITS + (level - 1) * SEL_WHEEL_LN_BITS;
+}
+
+static sel_timer_t **
+wheel_slot(struct sel_wheel *w, unsigned int level, unsigned int slot)
+{
+    if (level == 0)
+	return &w->l0[slot];
+    return &w->ln[level - 1][slot];
+}
+
+static unsigned int
+wheel_ctz(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(v);
+#else
+    unsigned int i = 0;
+
+    while (!(v & 1)) {
+	v >>= 1;
+	i++;
+    }
+    return i;
+#endif
+}
+
+/* Find the first set bit at or after start in the level, or -1. */
+static int
+wheel_find_slot(struct sel_wheel *w, unsigned int level, unsigned int start)
+{
+    unsigned int size = 1 << wheel_level_bits(level);
+    unsigned int i = start / 64;
+    uint64_t v;
+
+    if (start >= size)
+	return -1;
+    v = w->bits[level][i] & (~(uint64_t) 0 << (start % 64));
+    for (;;) {
+	if (v)
+	    return i * 64 + wheel_ctz(v);
+	if (++i >= size / 64)
+	    return -1;
+	v = w->bits[level][i];
+    }
+}
+
+static uint64_t
+wheel_tv_to_tick(const struct timeval *tv)
+{
+    return (uint64_t) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static void
+wheel_tick_to_tv(uint64_t tick, struct timeval *tv)
+{
+    tv->tv_sec = tick / 1000;
+    tv->tv_usec = (tick % 1000) * 1000;
+}
+
+static void
+wheel_list_add(sel_timer_t **head, sel_timer_t *timer)
+{
+    timer->val.whead = head;
+    timer->val.wprev = NULL;
+    timer->val.wnext = *head;
+    if (*head)
+	(*head)->val.wprev = timer;
+    *head = timer;
+}
+
+static void
+wheel_add_expired(struct sel_wheel *w, sel_timer_t *timer)
+{
+    timer->val.wlevel = SEL_WHEEL_EXPIRED;
+    timer->val.whead = &w->expired;
+    timer->val.wnext = NULL;
+    timer->val.wprev = w->expired_tail;
+    if (w->expired_tail)
+	w->expired_tail->val.wnext = timer;
+    else
+	w->expired = timer;
+    w->expired_tail = timer;
+}
+
+static void
+wheel_add_tick(struct sel_wheel *w, sel_timer_t *timer, uint64_t tick)
+{
+    uint64_t delta, place = tick;
+    unsigned int level, slot;
+
+    timer->val.wtick = tick;
+    if (tick < w->cur) {
+	wheel_add_expired(w, timer);
+	return;
+    }
+    delta = tick - w->cur;
+    for (level = 0; level < SEL_WHEEL_LEVELS; level++) {
+	if (delta < (uint64_t) 1 << (wheel_level_shift(level) +
+				     wheel_level_bits(level)))
+	    break;
+    }
+    if (level == SEL_WHEEL_LEVELS) {
+	/* Too far out, put it as far as we can and redo it later. */
+	level = SEL_WHEEL_LEVELS - 1;
+	place = w->cur + ((uint64_t) 1 << (wheel_level_shift(level) +
+					   wheel_level_bits(level))) - 1;
+    }
+    slot = (place >> wheel_level_shift(level)) &
+	((1 << wheel_level_bits(level)) - 1);
+    timer->val.wlevel = level;
+    timer->val.wslot = slot;
+    w->bits[level][slot / 64] |= (uint64_t) 1 << (slot % 64);
+    wheel_list_add(wheel_slot(w, level, slot), timer);
+}
+
+static void
+wheel_add(struct sel_wheel *w, sel_timer_t *timer)
+{
+    wheel_add_tick(w, timer, wheel_tv_to_tick(&timer->val.timeout));
+}
+
+static void
+wheel_rm(struct sel_wheel *w, sel_timer_t *timer)
+{
+    if (timer->val.wnext)
+	timer->val.wnext->val.wprev = timer->val.wprev;
+    if (timer->val.wprev)
+	timer->val.wprev->val.wnext = timer->val.wnext;
+    else
+	*timer->val.whead = timer->val.wnext;
+
+    if (timer->val.wlevel == SEL_WHEEL_EXPIRED) {
+	if (w->expired_tail == timer)
+	    w->expired_tail = timer->val.wprev;
+    } else if (!*timer->val.whead) {
+	unsigned int slot = timer->val.wslot;
+
+	w->bits[timer->val.wlevel][slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+    }
+    timer->val.wnext = timer->val.wprev = NULL;
+    timer->val.whead = NULL;
+}
+
+static bool
+wheel_above_empty(struct sel_wheel *w, unsigned int level)
+{
+    for (level++; level < SEL_WHEEL_LEVELS; level++) {
+	if (wheel_find_slot(w, level, 0) >= 0)
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Return the next tick where something needs to be done, a slot
+ * expiring or cascading.  This may be earlier than needed, but never
+ * later.  Cascading early is harmless, the timers just get put back
+ * where they belong.
+ */
+static uint64_t
+wheel_next_tick(struct sel_wheel *w)
+{
+    uint64_t t = w->cur, next;
+    unsigned int level, shift, bits, idx;
+    bool pending;
+    int slot;
+
+    for (level = 0; level < SEL_WHEEL_LEVELS; level++) {
+	shift = wheel_level_shift(level);
+	bits = wheel_level_bits(level);
+	idx = (t >> shift) & ((1 << bits) - 1);
+	/* Only the current tick may have already had its cascades done. */
+	pending = idx == 0 && !(level == 0 && w->cascaded == t + 1);
+	if (pending && !wheel_above_empty(w, level))
+	    /* t is where the level above cascades, it must be done first. */
+	    return t;
+	slot = wheel_find_slot(w, level, idx);
+	if (slot >= 0)
+	    return t + ((uint64_t) (slot - idx) << shift);
+
+	/* Nothing until this level wraps, which may be t itself. */
+	if (pending)
+	    next = t;
+	else
+	    next = ((t >> (shift + bits)) + 1) << (shift + bits);
+	if (idx > 0 && wheel_find_slot(w, level, 0) >= 0)
+	    /* Slots before idx come after the wrap, stop there. */
+	    return next;
+	t = next;
+    }
+    return SEL_WHEEL_NONE;
+}
+
+static void
+wheel_cascade(struct sel_wheel *w, unsigned int level, unsigned int slot)
+{
+    sel_timer_t **head = wheel_slot(w, level, slot), *timer;
+
+    while ((timer = *head)) {
+	wheel_rm(w, timer);
+	wheel_add_tick(w, timer, timer->val.wtick);
+    }
+}
+
+/* Do the cascades for tick t (the current tick), if not already done. */
+static void
+wheel_cascade_tick(struct sel_wheel *w, uint64_t t)
+{
+    unsigned int level, idx;
+
+    if (w->cascaded == t + 1)
+	return;
+    w->cascaded = t + 1;
+    for (level = 1; level < SEL_WHEEL_LEVELS; level++) {
+	if ((t & (((uint64_t) 1 << wheel_level_shift(level)) - 1)) != 0)
+	    break;
+	idx = ((t >> wheel_level_shift(level)) &
+	       ((1 << SEL_WHEEL_LN_BITS) - 1));
+	wheel_cascade(w, level, idx);
+    }
+}
+
+/* Move everything that has expired at now to the expired list. */
+static void
+wheel_advance(struct sel_wheel *w, const struct timeval *now)
+{
+    uint64_t limit = wheel_tv_to_tick(now), t;
+    sel_timer_t **head, *timer, *next;
+
+    /* Ticks before the one now is in have fully expired. */
+    while (w->cur < limit) {
+	t = wheel_next_tick(w);
+	if (t == SEL_WHEEL_NONE || t >= limit) {
+	    w->cur = limit;
+	    break;
+	}
+	w->cur = t;
+	wheel_cascade_tick(w, t);
+	head = &w->l0[t & ((1 << SEL_WHEEL_L0_BITS) - 1)];
+	while ((timer = *head)) {
+	    wheel_rm(w, timer);
+	    wheel_add_expired(w, timer);
+	}
+	w->cur = t + 1;
+    }
+    if (w->cur != limit)
+	return;
+
+    wheel_cascade_tick(w, w->cur);
+    head = &w->l0[w->cur & ((1 << SEL_WHEEL_L0_BITS) - 1)];
+    for (timer = *head; timer; timer = next) {
+	next = timer->val.wnext;
+	if (cmp_timeval(&timer->val.timeout, now) <= 0) {
+	    wheel_rm(w, timer);
+	    wheel_add_expired(w, timer);
+	}
+    }
+}
+
+/* Get the earliest timeout in the current tick, false if none. */
+static bool
+wheel_cur_timeout(struct sel_wheel *w, struct timeval *tv)
+{
+    sel_timer_t *timer = w->l0[w->cur & ((1 << SEL_WHEEL_L0_BITS) - 1)];
+
+    if (!timer)
+	return false;
+    *tv = timer->val.timeout;
+    for (timer = timer->val.wnext; timer; timer = timer->val.wnext) {
+	if (cmp_timeval(&timer->val.timeout, tv) < 0)
+	    *tv = timer->val.timeout;
+    }
+    return true;
+}
+
+/* Remove and return any timer in the wheel, for freeing. */
+static sel_timer_t *
+wheel_get_any(struct sel_wheel *w)
+{
+    unsigned int level;
+    int slot;
+
+    if (w->expired)
+	return w->expired;
+    for (level = 0; level < SEL_WHEEL_LEVELS; level++) {
+	slot = wheel_find_slot(w, level, 0);
+	if (slot >= 0)
+	    return *wheel_slot(w, level, slot);
+    }
+    return NULL;
+}
 
 /* Used to build a list of threads that may need to be woken if a
    timer on the top of the heap changes, or an FD is added/removed.
@@ -188,20 +617,78 @@ typedef struct sel_wait_list_s
     struct sel_wait_list_s *next, *prev;
 } sel_wait_list_t;
 
+#ifdef HAVE_EPOLL_PWAIT
+/* Maximum number of events to handle in one epoll wait. */
+#define SEL_EPOLL_MAX_BATCH	64
+#endif
+
+#ifdef SEL_HAVE_KQUEUE
+/* Maximum number of events to handle in one kevent() call. */
+#define SEL_KQUEUE_BATCH	16
+/* The ident of the EVFILT_USER event used to wake threads. */
+#define SEL_KQUEUE_WAKE_IDENT	0
+#endif
+
+#ifdef SEL_HAVE_IO_URING
+#define SEL_URING_ENTRIES	256
+/* Maximum number of completions to handle in one wait. */
+#define SEL_URING_BATCH		16
+/* user_data for removals, whose completions we don't care about. */
+#define SEL_URING_IGNORE	(~(uint64_t) 0)
+
+struct sel_uring
+{
+    int fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Entries added to the submit queue but not yet submitted. */
+    unsigned int pending;
+
+    /* Number of threads currently waiting in io_uring_enter(). */
+    unsigned int waiters;
+};
+#endif
+
 struct selector_s
 {
-    /* This is an hash table of file descriptors. */
-    fd_control_t *fds[FD_SETSIZE];
+    /*
+     * This is a table of file descriptors, indexed by the fd.  It
+     * starts small and is grown as larger fds are added, so with epoll
+     * there is no limit on the fd number besides memory.
+     */
+    fd_control_t **fds;
+    unsigned int fds_size;
 
     /* If something is deleted, we increment this count.  This way when
        a select/epoll returns a non-timeout, we know that we need to ignore
        it as it may be  from the just deleted fd. */
     unsigned long fd_del_count;
 
+    /* Number of fds with priority set, under the fd lock. */
+    unsigned int nr_prio_fds;
+
     void *fd_lock;
 
-    /* The timer heap. */
+    /* The timer heap, or the timer wheel if wheel is set. */
     theap_t timer_heap;
+    struct sel_wheel *wheel;
 
     /* This is a list of items waiting to be woken up because they are
        sitting in a select.  See i_wake_sel_thread() for more info. */
@@ -209,20 +696,113 @@ struct selector_s
 
     void *timer_lock;
 
+    /*
+     * Runners are pushed onto runner_stack without taking a lock,
+     * newest first.  Whoever runs them, with the timer lock held,
+     * moves them in order onto the runner_head list and takes them
+     * from there.
+     */
+    sel_runner_t *runner_stack;
     sel_runner_t *runner_head;
     sel_runner_t *runner_tail;
 
+    /* High priority runners, these are run before the ones above. */
+    sel_runner_t *runner_prio_head;
+    sel_runner_t *runner_prio_tail;
+
+    /*
+     * Per-thread runner queues, pushed like runner_stack.  count is
+     * approximate, it is only used to decide when to wake a helper.
+     */
+    struct {
+	sel_runner_t *stack;
+	int count;
+    } runner_slots[SEL_RUNNER_SLOTS];
+    unsigned int next_runner_slot;
+
+    /* Runners run since the fds were last checked, under the timer lock. */
+    unsigned int runs_since_poll;
+
+    /*
+     * The number of threads in the wait list, so sel_run() knows if
+     * it needs to wake anyone without taking the lock.  Changed under
+     * the timer lock, but read without it.
+     */
+    unsigned int nr_waiting;
+
+    /*
+     * Written to wake a thread when a runner comes in.  This is an
+     * eventfd (both the same) or a pipe, or -1 if there isn't one,
+     * which means the wait list is signalled under the timer lock.
+     */
+    int wake_fd[2];
+
     int wake_sig;
 
+    /*
+     * If busy_poll is not zero, poll without blocking for that long
+     * before blocking.  The counts are protected by the timer lock.
+     */
+    struct timeval busy_poll;
+    unsigned long busy_poll_hits;
+    unsigned long busy_poll_sleeps;
+
+    /*
+     * Default slack for timers, see sel_set_timer_slack().  Protected
+     * by the timer lock.
+     */
+    struct timeval timer_slack;
+
+    /*
+     * Loop statistics, see sel_set_stats().  The fd parts are kept in
+     * fd_stats under the fd lock, the timer and runner parts in
+     * timer_stats under the timer lock.  stats_enabled is read
+     * without a lock, it just turns collecting on and off.
+     */
+    int stats_enabled;
+    struct sel_stats fd_stats;
+    struct sel_stats timer_stats;
+
+    /*
+     * The monotonic time in microseconds, refreshed once per wakeup,
+     * see sel_get_loop_time().  Zero until first set.  Accessed
+     * atomically, or under the timer lock without atomics, it only
+     * moves forward.
+     */
+    int64_t loop_time;
+
 #ifdef HAVE_EPOLL_PWAIT
     int epollfd;
+
+    /* Set if GENSIO_SEL_EPOLL_EDGE allows sel_set_fd_edge(). */
+    int edge_ok;
+
+    /*
+     * Maximum events to take from one epoll_pwait(), from
+     * GENSIO_SEL_EPOLL_BATCH.  Defaults to 1.
+     */
+    int epoll_batch;
+#endif
+#ifdef SEL_HAVE_IO_URING
+    /* If uring.fd >= 0, io_uring is used for polling instead of epoll. */
+    struct sel_uring uring;
+#endif
+#ifdef SEL_HAVE_KQUEUE
+    /* If >= 0, kqueue is used for polling instead of select(). */
+    int kqfd;
+
+    /* Set if an EVFILT_USER event is used in place of wake_fd. */
+    int kq_wake;
 #endif
     sel_lock_t *(*sel_lock_alloc)(void *cb_data);
     void (*sel_lock_free)(sel_lock_t *);
     void (*sel_lock)(sel_lock_t *);
     void (*sel_unlock)(sel_lock_t *);
 
-    /* Everything below is only used for select() and ignore for epoll. */
+    /*
+     * Everything below is only used for select() and ignored for
+     * epoll and kqueue, except maxfd, which is kept for all of them.
+     */
 
     /* These are the offical fd_sets used to track what file descriptors
        need to be monitored. */
@@ -262,6 +842,30 @@ sel_fd_unlock(struct selector_s *sel)
 	sel->sel_unlock(sel->fd_lock);
 }
 
+/* Are the fd_sets used, which means select() is used to wait? */
+static int
+sel_uses_select(struct selector_s *sel)
+{
+#if defined(HAVE_EPOLL_PWAIT)
+    return sel->epollfd < 0;
+#elif defined(SEL_HAVE_KQUEUE)
+    return sel->kqfd < 0;
+#else
+    return 1;
+#endif
+}
+
+/* Is there a wakeup fd (or kqueue event) to wake a thread with? */
+static int
+sel_has_wake_fd(struct selector_s *sel)
+{
+#ifdef SEL_HAVE_KQUEUE
+    if (sel->kq_wake)
+	return 1;
+#endif
+    return sel->wake_fd[1] >= 0;
+}
+
 /* This function will wake the SEL thread.  It must be called with the
    timer lock held, because it messes with timeout.
 
@@ -275,11 +879,60 @@ sel_fd_unlock(struct selector_s *sel)
    signal send should wake it up.  We only need to do this after we
    have calculated the timeout, but before we have called select, thus
    only things in the wait list matter. */
+/*
+ * Wake whichever thread picks up the wakeup fd first.  That's all
+ * that's needed when the work can be done by any thread.
+ */
+static void
+sel_wake_fd_write(struct selector_s *sel)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    eventfd_t v = 1;
+#else
+    unsigned char v = 0;
+#endif
+    int rv;
+
+#ifdef SEL_HAVE_KQUEUE
+    if (sel->kq_wake) {
+	struct kevent ev;
+
+	EV_SET(&ev, SEL_KQUEUE_WAKE_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0,
+	       NULL);
+	kevent(sel->kqfd, &ev, 1, NULL, 0, NULL);
+	return;
+    }
+#endif
+
+    /* If it's full or the counter is maxed, it's already readable. */
+    rv = write(sel->wake_fd[1], &v, sizeof(v));
+    (void) rv;
+}
+
 static void
 i_wake_sel_thread(struct selector_s *sel, struct timeval *new_timeout)
 {
     sel_wait_list_t *item;
 
+#ifndef BROKEN_PSELECT
+    if (new_timeout && sel_has_wake_fd(sel)) {
+	/*
+	 * A new timer is run by whatever thread wakes up, it will work
+	 * out the new timeout when it waits again, so one write does
+	 * it instead of a signal for every thread.
+	 */
+	item = sel->wait_list.next;
+	while (item != &sel->wait_list) {
+	    if (cmp_timeval(new_timeout, &item->wake_time) < 0) {
+		sel_wake_fd_write(sel);
+		break;
+	    }
+	    item = item->next;
+	}
+	return;
+    }
+#endif
+
     item = sel->wait_list.next;
     while (item != &sel->wait_list) {
 	if (item->send_sig && (!new_timeout ||
@@ -346,41 +999,123 @@ sel_wake_one(struct selector_s *sel, long thread_id, sel_send_sig_cb killer,
     sel_timer_unlock(sel);
 }
 
+/* Timer queue handling, the heap or the wheel.  Call with timer_lock. */
 static void
-wake_timer_sel_thread(struct selector_s *sel, volatile sel_timer_t *old_top,
-		      struct timeval *new_timeout)
+timerq_add(struct selector_s *sel, sel_timer_t *timer)
 {
-    if (old_top != theap_get_top(&sel->timer_heap))
-	/* If the top value changed, restart the waiting threads if required. */
-	i_wake_sel_thread(sel, new_timeout);
+    if (sel->wheel)
+	wheel_add(sel->wheel, timer);
+    else
+	theap_add(&sel->timer_heap, timer);
+    timer->val.in_heap = 1;
 }
 
-/* Wait list management.  These *must* be called with the timer list
-   locked, and the values in the item *must not* change while in the
-   list. */
 static void
-add_sel_wait_list(struct selector_s *sel, sel_wait_list_t *item,
-		  sel_send_sig_cb send_sig,
-		  void            *cb_data,
-		  long thread_id,
-		  struct timeval *wake_time, struct timespec *wait_time)
+timerq_remove(struct selector_s *sel, sel_timer_t *timer)
 {
-    item->thread_id = thread_id;
-    item->send_sig = send_sig;
-    item->send_sig_cb_data = cb_data;
-    item->wake_time = *wake_time;
-#ifdef BROKEN_PSELECT
-    item->wait_time = wait_time;
-    item->signalled = false;
-#endif
-    item->next = sel->wait_list.next;
-    item->prev = &sel->wait_list;
+    if (sel->wheel)
+	wheel_rm(sel->wheel, timer);
+    else
+	theap_remove(&sel->timer_heap, timer);
+    timer->val.in_heap = 0;
+}
+
+/* Return the first timer that has expired at now, or NULL. */
+static sel_timer_t *
+timerq_get_expired(struct selector_s *sel, struct timeval *now)
+{
+    sel_timer_t *timer;
+
+    if (sel->wheel) {
+	wheel_advance(sel->wheel, now);
+	return sel->wheel->expired;
+    }
+    timer = theap_get_top(&sel->timer_heap);
+    if (timer && cmp_timeval(now, &timer->val.timeout) >= 0)
+	return timer;
+    return NULL;
+}
+
+/* Get when the next timer goes off, returns false if there is none. */
+static bool
+timerq_next_timeout(struct selector_s *sel, struct timeval *tv)
+{
+    sel_timer_t *timer;
+    uint64_t tick;
+
+    if (sel->wheel) {
+	if (sel->wheel->expired) {
+	    *tv = sel->wheel->expired->val.timeout;
+	    return true;
+	}
+	if (wheel_cur_timeout(sel->wheel, tv))
+	    return true;
+	tick = wheel_next_tick(sel->wheel);
+	if (tick == SEL_WHEEL_NONE)
+	    return false;
+	wheel_tick_to_tv(tick, tv);
+	return true;
+    }
+    timer = theap_get_top(&sel->timer_heap);
+    if (!timer)
+	return false;
+    *tv = timer->val.timeout;
+    return true;
+}
+
+static volatile sel_timer_t *
+timerq_get_top(struct selector_s *sel)
+{
+    if (sel->wheel)
+	return NULL; /* Not used, the wheel always checks the waiters. */
+    return theap_get_top(&sel->timer_heap);
+}
+
+static void
+wake_timer_sel_thread(struct selector_s *sel, volatile sel_timer_t *old_top,
+		      struct timeval *new_timeout)
+{
+    if (sel->wheel || old_top != theap_get_top(&sel->timer_heap))
+	/* If the top value changed, restart the waiting threads if required. */
+	i_wake_sel_thread(sel, new_timeout);
+}
+
+/* Wait list management.  These *must* be called with the timer list
+   locked, and the values in the item *must not* change while in the
+   list. */
+static void
+add_sel_wait_list(struct selector_s *sel, sel_wait_list_t *item,
+		  sel_send_sig_cb send_sig,
+		  void            *cb_data,
+		  long thread_id,
+		  struct timeval *wake_time, struct timespec *wait_time)
+{
+    item->thread_id = thread_id;
+    item->send_sig = send_sig;
+    item->send_sig_cb_data = cb_data;
+    item->wake_time = *wake_time;
+#ifdef BROKEN_PSELECT
+    item->wait_time = wait_time;
+    item->signalled = false;
+#endif
+    item->next = sel->wait_list.next;
+    item->prev = &sel->wait_list;
     sel->wait_list.next->prev = item;
     sel->wait_list.next = item;
+#if HAVE_GCC_ATOMICS
+    __atomic_add_fetch(&sel->nr_waiting, 1, __ATOMIC_SEQ_CST);
+#else
+    sel->nr_waiting++;
+#endif
 }
 static void
 remove_sel_wait_list(struct selector_s *sel, sel_wait_list_t *item)
 {
+#if HAVE_GCC_ATOMICS
+    __atomic_sub_fetch(&sel->nr_waiting, 1, __ATOMIC_SEQ_CST);
+#else
+    sel->nr_waiting--;
+#endif
     item->next->prev = item->prev;
     item->prev->next = item->next;
 }
@@ -397,7 +1132,234 @@ init_fd(fd_control_t *fd)
     fd->read_enabled = 0;
     fd->write_enabled = 0;
     fd->except_enabled = 0;
+#ifdef HAVE_EPOLL_PWAIT
+    fd->edge = 0;
+#endif
+}
+
+#ifdef SEL_HAVE_IO_URING
+static int
+sel_uring_enter(struct sel_uring *u, unsigned int to_submit,
+		unsigned int min_complete, struct timespec *timeout,
+		sigset_t *sigmask)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int flags = 0;
+
+    if (!min_complete)
+	return syscall(__NR_io_uring_enter, u->fd, to_submit, 0, 0, NULL, 0);
+
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask = (uintptr_t) sigmask;
+    arg.sigmask_sz = _NSIG / 8;
+    ts.tv_sec = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_nsec;
+    arg.ts = (uintptr_t) &ts;
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    return syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete,
+		   flags, &arg, sizeof(arg));
+}
+
+/* Must be called with the fd lock held. */
+static void
+sel_uring_flush(struct sel_uring *u)
+{
+    int rv;
+
+    while (u->pending) {
+	rv = sel_uring_enter(u, u->pending, 0, NULL, NULL);
+	if (rv < 0) {
+	    if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+		continue;
+	    /* Like epoll_ctl() failing, this is a system problem. */
+	    perror("io_uring_enter");
+	    assert(0);
+	}
+	u->pending -= rv;
+    }
+}
+
+/*
+ * Add an entry to the submit queue, it will be submitted by the next
+ * io_uring_enter() call.  Must be called with the fd lock held.
+ */
+static void
+sel_uring_queue(struct sel_uring *u, uint8_t opcode, int fd,
+		uint32_t events, uint64_t addr, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail, idx;
+
+    tail = *u->sq_tail;
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+	sel_uring_flush(u);
+
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->pending++;
+}
+
+/*
+ * io_uring polls are one-shot, like the EPOLLONESHOT polls used with
+ * epoll, so this works the same way as the epoll code, except that
+ * arming and disarming an fd just queues an entry in the submit queue.
+ * The entries are submitted by the thread waiting next, so the rearm
+ * after an event and the wait for the next one are one system call.
+ * If another thread is already waiting, the entries are submitted
+ * immediately so that thread can see the events.
+ *
+ * Each poll is tagged with the fd and a generation number.  Changing
+ * a poll removes the old one and adds a new one with a new generation,
+ * completions for old generations are ignored.
+ */
+static int
+sel_uring_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
+{
+    struct sel_uring *u = &sel->uring;
+    uint32_t events = 0;
+
+    if (fdc->saved_events) {
+	/* The poll has completed and is not armed, see process_fds_epoll(). */
+	if (op == EPOLL_CTL_DEL)
+	    return 0;
+	if (!fdc->read_enabled && !fdc->except_enabled)
+	    return 0;
+	fdc->saved_events = 0;
+	if (fdc->read_enabled)
+	    events |= POLLIN | POLLHUP;
+	if (fdc->except_enabled)
+	    events |= POLLERR | POLLPRI;
+    } else if (op != EPOLL_CTL_DEL) {
+	if (fdc->read_enabled)
+	    events |= POLLIN | POLLHUP;
+	if (fdc->write_enabled)
+	    events |= POLLOUT;
+	if (fdc->except_enabled)
+	    events |= POLLERR | POLLPRI;
+    }
+
+    if (fdc->uring_armed) {
+	sel_uring_queue(u, IORING_OP_POLL_REMOVE, -1, 0,
+			((uint64_t) fdc->uring_gen << 32) | fdc->fd,
+			SEL_URING_IGNORE);
+	fdc->uring_armed = 0;
+    }
+    if (op != EPOLL_CTL_DEL) {
+	fdc->uring_gen++;
+	sel_uring_queue(u, IORING_OP_POLL_ADD, fdc->fd, events, 0,
+			((uint64_t) fdc->uring_gen << 32) | fdc->fd);
+	fdc->uring_armed = 1;
+    }
+
+    if (u->waiters)
+	sel_uring_flush(u);
+    return 0;
+}
+
+static void
+sel_uring_cleanup(struct sel_uring *u)
+{
+    if (u->fd < 0)
+	return;
+    if (u->sqes)
+	munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+	munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+	munmap(u->sq_ring, u->sq_ring_size);
+    close(u->fd);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static int
+sel_uring_setup(struct sel_uring *u)
+{
+    struct io_uring_params p;
+    int rv;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, SEL_URING_ENTRIES, &p);
+    if (u->fd < 0) {
+	u->fd = -1;
+	return errno;
+    }
+
+    /*
+     * We need the wait timeout/sigmask argument and need completions
+     * to never be dropped, so we can have any number of polls.
+     */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+		!(p.features & IORING_FEAT_NODROP)) {
+	rv = ENOSYS;
+	goto out_err;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (u->cq_ring_size > u->sq_ring_size)
+	    u->sq_ring_size = u->cq_ring_size;
+	u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+	u->sq_ring = NULL;
+	rv = errno;
+	goto out_err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	u->cq_ring = u->sq_ring;
+    } else {
+	u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	if (u->cq_ring == MAP_FAILED) {
+	    u->cq_ring = NULL;
+	    rv = errno;
+	    goto out_err;
+	}
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+	u->sqes = NULL;
+	rv = errno;
+	goto out_err;
+    }
+
+    u->sq_head = (unsigned int *) ((char *) u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned int *) ((char *) u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned int *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned int *) ((char *) u->sq_ring + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned int *) ((char *) u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned int *) ((char *) u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned int *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+
+    return 0;
+
+ out_err:
+    sel_uring_cleanup(u);
+    return rv;
 }
+#endif
 
 #ifdef HAVE_EPOLL_PWAIT
 static int
@@ -406,12 +1368,23 @@ sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
     struct epoll_event event;
     int rv;
 
+#ifdef SEL_HAVE_IO_URING
+    if (sel->uring.fd >= 0)
+	return sel_uring_update_fd(sel, fdc, op);
+#endif
     if (sel->epollfd < 0)
 	return 1;
 
     memset(&event, 0, sizeof(event));
-    event.events = EPOLLONESHOT;
     event.data.fd = fdc->fd;
+    if (fdc->edge) {
+	/* Registered once for everything, enables don't change it. */
+	if (op == EPOLL_CTL_MOD)
+	    return 0;
+	event.events = SEL_EDGE_EVENTS;
+	goto do_ctl;
+    }
+    event.events = EPOLLONESHOT;
     if (fdc->saved_events) {
 	if (op == EPOLL_CTL_DEL)
 	    return 0;
@@ -433,6 +1406,7 @@ sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
     }
     /* This should only fail due to system problems, and if that's the case,
        well, we should probably terminate. */
+ do_ctl:
     rv = epoll_ctl(sel->epollfd, op, fdc->fd, &event);
     if (rv) {
 	perror("epoll_ctl");
@@ -440,6 +1414,56 @@ sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
     }
     return 0;
 }
+#elif defined(SEL_HAVE_KQUEUE)
+/*
+ * Add or remove a oneshot kevent filter.  Removing one that has
+ * already fired (and thus is gone) is not an error.
+ */
+static void
+sel_kqueue_filter(struct selector_s *sel, int fd, int filter, int add)
+{
+    struct kevent ev;
+    int rv;
+
+    EV_SET(&ev, fd, filter, add ? EV_ADD | EV_ONESHOT : EV_DELETE, 0, 0,
+	   NULL);
+    rv = kevent(sel->kqfd, &ev, 1, NULL, 0, NULL);
+    if (rv == -1 && (add || (errno != ENOENT && errno != EBADF))) {
+	/* Like epoll_ctl() failing, this is a system problem. */
+	perror("kevent");
+	assert(0);
+    }
+}
+
+/*
+ * The read and write filters are oneshot, like the EPOLLONESHOT
+ * polls used with epoll, so only one thread gets an event and the fd
+ * is rearmed after the handlers run.  kqueue has no filter for
+ * exceptional conditions, errors come in with the read and write
+ * filters (see sel_kqueue_handle_event()), so except_enabled does
+ * not register anything by itself.
+ */
+static int
+sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
+{
+    int want_read = 0, want_write = 0;
+
+    if (sel->kqfd < 0)
+	return 1;
+
+    if (op != EPOLL_CTL_DEL) {
+	want_read = fdc->read_enabled;
+	want_write = fdc->write_enabled;
+    }
+    /* Adding a filter that is already there just updates it. */
+    if (want_read || fdc->kq_read_armed)
+	sel_kqueue_filter(sel, fdc->fd, EVFILT_READ, want_read);
+    fdc->kq_read_armed = want_read;
+    if (want_write || fdc->kq_write_armed)
+	sel_kqueue_filter(sel, fdc->fd, EVFILT_WRITE, want_write);
+    fdc->kq_write_armed = want_write;
+    return 0;
+}
 #else
 static int
 sel_update_fd(struct selector_s *sel, fd_control_t *fdc, int op)
@@ -462,11 +1486,50 @@ finish_oldstate(sel_runner_t *runner, void *cbdata)
 static fd_control_t *
 get_fd(struct selector_s *sel, int fd)
 {
-    fd_control_t *fdc = sel->fds[fd % FD_SETSIZE];
+    if ((unsigned int) fd >= sel->fds_size)
+	return NULL;
+    return sel->fds[fd];
+}
+
+/*
+ * Make sure the fd table can hold the given fd.  Must be called with
+ * sel fd lock held.  Everything that looks in the table does so with
+ * the lock held, so it is safe to replace it here.
+ */
+static int
+grow_fds(struct selector_s *sel, int fd)
+{
+    fd_control_t **new_fds;
+    unsigned int new_size = sel->fds_size;
 
-    while (fdc && fdc->fd != fd)
-	fdc = fdc->next;
-    return fdc;
+    if ((unsigned int) fd < new_size)
+	return 0;
+
+    if (new_size == 0)
+	new_size = SEL_INITIAL_FDS_SIZE;
+    while ((unsigned int) fd >= new_size)
+	new_size *= 2;
+
+    new_fds = sel_alloc(new_size * sizeof(*new_fds));
+    if (!new_fds)
+	return ENOMEM;
+    if (sel->fds) {
+	memcpy(new_fds, sel->fds, sel->fds_size * sizeof(*new_fds));
+	free(sel->fds);
+    }
+    sel->fds = new_fds;
+    sel->fds_size = new_size;
+    return 0;
+}
+
+/* Must be called with the fd lock held. */
+static void
+sel_fd_clear_prio(struct selector_s *sel, fd_control_t *fdc)
+{
+    if (fdc->prio) {
+	fdc->prio = 0;
+	sel->nr_prio_fds--;
+    }
 }
 
 static void
@@ -495,10 +1558,8 @@ sel_set_fd_handlers(struct selector_s *sel,
     void         *olddata = NULL;
     int          added = 1;
 
-#ifdef HAVE_EPOLL_PWAIT
-    if (sel->epollfd < 0 && fd >= FD_SETSIZE)
+    if (sel_uses_select(sel) && fd >= FD_SETSIZE)
 	return EMFILE;
-#endif
 
     state = sel_alloc(sizeof(*state));
     if (!state)
@@ -511,6 +1572,11 @@ sel_set_fd_handlers(struct selector_s *sel,
     sel_fd_lock(sel);
     fdc = get_fd(sel, fd);
     if (!fdc) {
+	if (grow_fds(sel, fd)) {
+	    sel_fd_unlock(sel);
+	    free(state);
+	    return ENOMEM;
+	}
 	fdc = sel_alloc(sizeof(*fdc));
 	if (!fdc) {
 	    sel_fd_unlock(sel);
@@ -518,17 +1584,17 @@ sel_set_fd_handlers(struct selector_s *sel,
 	    return ENOMEM;
 	}
 	fdc->fd = fd;
-	/* Add it to the list. */
-	fdc->next = sel->fds[fd % FD_SETSIZE];
-	sel->fds[fd % FD_SETSIZE] = fdc;
+	sel->fds[fd] = fdc;
     }
 
     if (fdc->state) {
 	oldstate = fdc->state;
 	olddata = fdc->data;
 	added = 0;
+	sel_fd_clear_prio(sel, fdc);
 #ifdef HAVE_EPOLL_PWAIT
 	fdc->saved_events = 0;
+	fdc->edge = 0;
 #endif
 	sel->fd_del_count++;
     }
@@ -576,19 +1642,18 @@ i_sel_clear_fd_handler(struct selector_s *sel, int fd, int rpt)
 	oldstate = fdc->state;
 	olddata = fdc->data;
 	fdc->state = NULL;
+	sel_fd_clear_prio(sel, fdc);
 
 	sel_update_fd(sel, fdc, EPOLL_CTL_DEL);
 #ifdef HAVE_EPOLL_PWAIT
 	fdc->saved_events = 0;
+	fdc->edge = 0;
 #endif
 	sel->fd_del_count++;
     }
 
     init_fd(fdc);
-#ifdef HAVE_EPOLL_PWAIT
-    if (sel->epollfd < 0)
-#endif
-    {
+    if (sel_uses_select(sel)) {
 	FD_CLR(fd, &sel->read_set);
 	FD_CLR(fd, &sel->write_set);
 	FD_CLR(fd, &sel->except_set);
@@ -648,17 +1713,13 @@ sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
 	if (fdc->read_enabled)
 	    goto out;
 	fdc->read_enabled = 1;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_uses_select(sel))
 	    FD_SET(fd, &sel->read_set);
     } else if (state == SEL_FD_HANDLER_DISABLED) {
 	if (!fdc->read_enabled)
 	    goto out;
 	fdc->read_enabled = 0;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_uses_select(sel))
 	    FD_CLR(fd, &sel->read_set);
     }
     if (sel_update_fd(sel, fdc, EPOLL_CTL_MOD))
@@ -685,17 +1746,13 @@ sel_set_fd_write_handler(struct selector_s *sel, int fd, int state)
 	if (fdc->write_enabled)
 	    goto out;
 	fdc->write_enabled = 1;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_uses_select(sel))
 	    FD_SET(fd, &sel->write_set);
     } else if (state == SEL_FD_HANDLER_DISABLED) {
 	if (!fdc->write_enabled)
 	    goto out;
 	fdc->write_enabled = 0;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_uses_select(sel))
 	    FD_CLR(fd, &sel->write_set);
     }
     if (sel_update_fd(sel, fdc, EPOLL_CTL_MOD))
@@ -722,17 +1779,13 @@ sel_set_fd_except_handler(struct selector_s *sel, int fd, int state)
 	if (fdc->except_enabled)
 	    goto out;
 	fdc->except_enabled = 1;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_uses_select(sel))
 	    FD_SET(fd, &sel->except_set);
     } else if (state == SEL_FD_HANDLER_DISABLED) {
 	if (!fdc->except_enabled)
 	    goto out;
 	fdc->except_enabled = 0;
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd < 0)
-#endif
+	if (sel_uses_select(sel))
 	    FD_CLR(fd, &sel->except_set);
     }
     if (sel_update_fd(sel, fdc, EPOLL_CTL_MOD))
@@ -742,6 +1795,65 @@ sel_set_fd_except_handler(struct selector_s *sel, int fd, int state)
     sel_fd_unlock(sel);
 }
 
+int
+sel_set_fd_priority(struct selector_s *sel, int fd, int prio)
+{
+    fd_control_t *fdc;
+    int rv = 0;
+
+    sel_fd_lock(sel);
+    fdc = get_fd(sel, fd);
+    if (!fdc || !fdc->state) {
+	rv = EBADF;
+    } else if (prio && !fdc->prio) {
+	fdc->prio = 1;
+	sel->nr_prio_fds++;
+    } else if (!prio) {
+	sel_fd_clear_prio(sel, fdc);
+    }
+    sel_fd_unlock(sel);
+    return rv;
+}
+
+int
+sel_set_fd_edge(struct selector_s *sel, int fd)
+{
+#ifdef HAVE_EPOLL_PWAIT
+    fd_control_t *fdc;
+    struct epoll_event event;
+    int op = EPOLL_CTL_MOD, rv = 0;
+
+    if (!sel->edge_ok)
+	return ENOSYS;
+
+    sel_fd_lock(sel);
+    fdc = get_fd(sel, fd);
+    if (!fdc || !fdc->state) {
+	rv = EBADF;
+	goto out;
+    }
+    if (fdc->edge)
+	goto out;
+    if (fdc->saved_events) {
+	/* It was deleted for a HUP or error, see process_fds_epoll(). */
+	fdc->saved_events = 0;
+	op = EPOLL_CTL_ADD;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = SEL_EDGE_EVENTS;
+    event.data.fd = fd;
+    if (epoll_ctl(sel->epollfd, op, fd, &event))
+	rv = errno;
+    else
+	fdc->edge = 1;
+ out:
+    sel_fd_unlock(sel);
+    return rv;
+#else
+    return ENOSYS;
+#endif
+}
+
 static void
 diff_timeval(struct timeval *dest,
 	     struct timeval *left,
@@ -779,6 +1891,48 @@ add_timeval(struct timeval *dest,
     }
 }
 
+/*
+ * Get the time for a statistic into tv if statistics are on, returns
+ * NULL if they are not.
+ */
+static struct timeval *
+sel_stats_now(struct selector_s *sel, struct timeval *tv)
+{
+#if HAVE_GCC_ATOMICS
+    if (!__atomic_load_n(&sel->stats_enabled, __ATOMIC_RELAXED))
+	return NULL;
+#else
+    if (!sel->stats_enabled)
+	return NULL;
+#endif
+    sel_get_monotonic_time(tv);
+    return tv;
+}
+
+/* Add the time from start to end to a max and total (if not NULL). */
+static void
+sel_stats_time(struct timeval *max, struct timeval *total,
+	       const struct timeval *start, const struct timeval *end)
+{
+    struct timeval d;
+
+    /* Clamps to zero if end is before start. */
+    diff_timeval(&d, (struct timeval *) end, (struct timeval *) start);
+    if (cmp_timeval(&d, max) > 0)
+	*max = d;
+    if (total)
+	add_timeval(total, total, &d);
+}
+
+/* A wait returned nr events, call with the fd lock held. */
+static void
+sel_stats_wakeup(struct selector_s *sel, unsigned long nr)
+{
+    sel->fd_stats.wakeups++;
+    if (nr > sel->fd_stats.max_fds_per_wakeup)
+	sel->fd_stats.max_fds_per_wakeup = nr;
+}
+
 int
 sel_alloc_timer(struct selector_s     *sel,
 		sel_timeout_handler_t handler,
@@ -815,10 +1969,8 @@ sel_stop_timer_i(struct selector_s *sel, sel_timer_t *timer)
      * is used to signal a timer restart on return from a timer
      * handler.)  So make sure it's not in the heap.
      */
-    if (timer->val.in_heap) {
-	theap_remove(&sel->timer_heap, timer);
-	timer->val.in_heap = 0;
-    }
+    if (timer->val.in_heap)
+	timerq_remove(sel, timer);
     timer->val.stopped = 1;
 
     return rv;
@@ -843,9 +1995,42 @@ sel_free_timer(sel_timer_t *timer)
     return 0;
 }
 
+/*
+ * Push the timeout out to the next multiple of the slack on the
+ * monotonic clock.  Timers with the same slack that expire close
+ * together then land on the same time and are handled in one
+ * wakeup, and a timer that lands on a time something is already
+ * waiting for doesn't wake anything.  It is never early and at most
+ * the slack late.
+ */
+static void
+timer_apply_slack(struct timeval *tv, const struct timeval *slack)
+{
+    long long s, t, r;
+
+    s = (long long) slack->tv_sec * 1000000 + slack->tv_usec;
+    if (s <= 0)
+	return;
+    t = (long long) tv->tv_sec * 1000000 + tv->tv_usec;
+    r = t % s;
+    if (r == 0)
+	return;
+    t += s - r;
+    tv->tv_sec = t / 1000000;
+    tv->tv_usec = t % 1000000;
+}
+
 int
 sel_start_timer(sel_timer_t    *timer,
 		struct timeval *timeout)
+{
+    return sel_start_timer_slack(timer, timeout, NULL);
+}
+
+int
+sel_start_timer_slack(sel_timer_t    *timer,
+		      struct timeval *timeout,
+		      struct timeval *slack)
 {
     struct selector_s *sel = timer->val.sel;
     volatile sel_timer_t *old_top;
@@ -856,18 +2041,17 @@ sel_start_timer(sel_timer_t    *timer,
 	return EBUSY;
     }
 
-    old_top = theap_get_top(&sel->timer_heap);
+    old_top = timerq_get_top(sel);
 
     timer->val.timeout = *timeout;
+    timer_apply_slack(&timer->val.timeout, slack ? slack : &sel->timer_slack);
 
-    if (!timer->val.in_handler) {
+    if (!timer->val.in_handler)
 	/* Wait until the handler returns to start the timer. */
-	theap_add(&sel->timer_heap, timer);
-	timer->val.in_heap = 1;
-    }
+	timerq_add(sel, timer);
     timer->val.stopped = 0;
 
-    wake_timer_sel_thread(sel, old_top, timeout);
+    wake_timer_sel_thread(sel, old_top, &timer->val.timeout);
 
     sel_timer_unlock(sel);
 
@@ -914,13 +2098,15 @@ sel_stop_timer_with_done(sel_timer_t *timer,
      * heap with an immediate timeout so it will be processed now.
      */
     timer->val.in_handler = 1;
-    if (timer->val.in_heap) {
-	theap_remove(&sel->timer_heap, timer);
-	timer->val.in_heap = 0;
-    }
+    if (timer->val.in_heap)
+	timerq_remove(sel, timer);
     sel_get_monotonic_time(&timer->val.timeout);
-    theap_add(&sel->timer_heap, timer);
-    timer->val.in_heap = 1;
+    if (sel->wheel) {
+	wheel_add_expired(sel->wheel, timer);
+	timer->val.in_heap = 1;
+    } else {
+	timerq_add(sel, timer);
+    }
 
  out_unlock:
     sel_timer_unlock(sel);
@@ -937,6 +2123,65 @@ sel_get_monotonic_time(struct timeval *tv)
     tv->tv_usec = (ts.tv_nsec + 500) / 1000;
 }
 
+/*
+ * Store a new loop time.  Several threads may be waking up at once,
+ * don't let the time go backwards if they race.  Without atomics this
+ * must be called with the timer lock held.
+ */
+static void
+sel_set_loop_time(struct selector_s *sel, struct timeval *tv)
+{
+    int64_t t = (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+#if HAVE_GCC_ATOMICS
+    int64_t old = __atomic_load_n(&sel->loop_time, __ATOMIC_RELAXED);
+
+    while (t > old) {
+	if (__atomic_compare_exchange_n(&sel->loop_time, &old, t, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    break;
+    }
+#else
+    if (t > sel->loop_time)
+	sel->loop_time = t;
+#endif
+}
+
+static void
+sel_refresh_loop_time(struct selector_s *sel)
+{
+    struct timeval now;
+
+    sel_get_monotonic_time(&now);
+#if HAVE_GCC_ATOMICS
+    sel_set_loop_time(sel, &now);
+#else
+    sel_timer_lock(sel);
+    sel_set_loop_time(sel, &now);
+    sel_timer_unlock(sel);
+#endif
+}
+
+void
+sel_get_loop_time(struct selector_s *sel, struct timeval *tv)
+{
+    int64_t t;
+
+#if HAVE_GCC_ATOMICS
+    t = __atomic_load_n(&sel->loop_time, __ATOMIC_RELAXED);
+#else
+    sel_timer_lock(sel);
+    t = sel->loop_time;
+    sel_timer_unlock(sel);
+#endif
+
+    if (!t) {
+	sel_get_monotonic_time(tv);
+	return;
+    }
+    tv->tv_sec = t / 1000000;
+    tv->tv_usec = t % 1000000;
+}
+
 /*
  * Process timers on selector.  The timeout is always set, to a very
  * long value if no timers are waiting.  Note that this *must* be
@@ -949,14 +2194,13 @@ process_timers(struct selector_s       *sel,
 	       volatile struct timeval *timeout,
 	       struct timeval          *abstime)
 {
-    struct timeval now;
+    struct timeval now, next, start, end, *stats;
     sel_timer_t    *timer;
 
-    timer = theap_get_top(&sel->timer_heap);
     sel_get_monotonic_time(&now);
-    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
-	theap_remove(&(sel->timer_heap), timer);
-	timer->val.in_heap = 0;
+    sel_set_loop_time(sel, &now);
+    while ((timer = timerq_get_expired(sel, &now))) {
+	timerq_remove(sel, timer);
 	timer->val.stopped = 1;
 
 	/*
@@ -966,9 +2210,23 @@ process_timers(struct selector_s       *sel,
 	 */
 	if (!timer->val.in_handler) {
 	    timer->val.in_handler = 1;
+	    stats = sel_stats_now(sel, &start);
+	    if (stats) {
+		sel->timer_stats.timers_fired++;
+		sel_stats_time(&sel->timer_stats.max_timer_late,
+			       &sel->timer_stats.total_timer_late,
+			       &timer->val.timeout, &start);
+	    }
 	    sel_timer_unlock(sel);
+	    GENSIO_PROBE2(timer_fire, timer, timer->val.user_data);
 	    timer->val.handler(sel, timer, timer->val.user_data);
+	    GENSIO_PROBE1(timer_done, timer);
 	    sel_timer_lock(sel);
+	    if (stats) {
+		sel_get_monotonic_time(&end);
+		sel_stats_time(&sel->timer_stats.max_handler_time, NULL,
+			       &start, &end);
+	    }
 	}
 	(*count)++;
 	if (timer->val.done_handler) {
@@ -984,13 +2242,9 @@ process_timers(struct selector_s       *sel,
 	timer->val.in_handler = 0;
 	if (timer->val.freed)
 	    free(timer);
-	else if (!timer->val.stopped) {
+	else if (!timer->val.stopped)
 	    /* We were restarted while in the handler. */
-	    theap_add(&sel->timer_heap, timer);
-	    timer->val.in_heap = 1;
-	}
-
-	timer = theap_get_top(&sel->timer_heap);
+	    timerq_add(sel, timer);
     }
 
     if (*count) {
@@ -998,11 +2252,11 @@ process_timers(struct selector_s       *sel,
 	timeout->tv_sec = 0;
 	timeout->tv_usec = 0;
 	*abstime = now;
-    } else if (timer) {
-	diff_timeval((struct timeval *) timeout,
-		     (struct timeval *) &timer->val.timeout,
-		     &now);
-	*abstime = timer->val.timeout;
+    } else if (timerq_next_timeout(sel, &next)) {
+	if (cmp_timeval(&next, &now) < 0)
+	    next = now;
+	diff_timeval((struct timeval *) timeout, &next, &now);
+	*abstime = next;
     } else {
 	/* No timers, just set a long time. */
 	timeout->tv_sec = 100000;
@@ -1029,6 +2283,10 @@ sel_alloc_runner(struct selector_s *sel, sel_runner_t **new_runner)
 int
 sel_free_runner(sel_runner_t *runner)
 {
+#if HAVE_GCC_ATOMICS
+    if (__atomic_load_n(&runner->in_use, __ATOMIC_ACQUIRE))
+	return EBUSY;
+#else
     struct selector_s *sel = runner->sel;
 
     sel_timer_lock(sel);
@@ -1037,72 +2295,461 @@ sel_free_runner(sel_runner_t *runner)
 	return EBUSY;
     }
     sel_timer_unlock(sel);
+#endif
     free(runner);
     return 0;
 }
 
+void
+sel_runner_set_priority(sel_runner_t *runner, int prio)
+{
+    runner->prio = !!prio;
+}
+
+/*
+ * Without atomics the runner stacks and nr_waiting are only touched
+ * with the timer lock held, sel_run() takes it to queue a runner like
+ * it did before the stacks were lock-free.  The reads below are done
+ * with the lock held in that case, except where noted.
+ */
+static sel_runner_t *
+sel_runner_stack_peek(sel_runner_t **stack)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_load_n(stack, __ATOMIC_SEQ_CST);
+#else
+    return *stack;
+#endif
+}
+
+static sel_runner_t *
+sel_runner_stack_take(sel_runner_t **stack)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_exchange_n(stack, NULL, __ATOMIC_ACQUIRE);
+#else
+    sel_runner_t *runner = *stack;
+
+    *stack = NULL;
+    return runner;
+#endif
+}
+
+/* Without atomics this is a hint, it may be read without the lock. */
+static unsigned int
+sel_nr_waiting(struct selector_s *sel)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_load_n(&sel->nr_waiting, __ATOMIC_SEQ_CST);
+#else
+    return sel->nr_waiting;
+#endif
+}
+
+static int
+runners_pending(struct selector_s *sel)
+{
+    unsigned int i;
+
+    if (sel->runner_head || sel->runner_prio_head ||
+	    sel_runner_stack_peek(&sel->runner_stack))
+	return 1;
+    for (i = 0; i < SEL_RUNNER_SLOTS; i++) {
+	if (sel_runner_stack_peek(&sel->runner_slots[i].stack))
+	    return 1;
+    }
+    return 0;
+}
+
+/*
+ * A runner came in and nothing was queued.  If anything is waiting,
+ * wake one of them up to run it.  A thread that is about to wait
+ * adds itself to nr_waiting before it checks for runners, and both
+ * are sequentially consistent, so either it sees the runner or we
+ * see it.  Without atomics this is called with the timer lock held,
+ * which does the same thing.
+ */
+static void
+sel_wake_for_runner(struct selector_s *sel)
+{
+    if (sel_nr_waiting(sel) == 0)
+	return;
+
+    if (sel_has_wake_fd(sel)) {
+	sel_wake_fd_write(sel);
+    } else {
+#if HAVE_GCC_ATOMICS
+	sel_timer_lock(sel);
+	i_sel_wake_first(sel);
+	sel_timer_unlock(sel);
+#else
+	i_sel_wake_first(sel);
+#endif
+    }
+}
+
+#if HAVE_GCC_ATOMICS
+int
+sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data)
+{
+    struct selector_s *sel = runner->sel;
+    sel_runner_t *old;
+
+    if (__atomic_exchange_n(&runner->in_use, 1, __ATOMIC_ACQUIRE))
+	return EBUSY;
+
+    runner->func = func;
+    runner->cb_data = cb_data;
+
+    if (sel_serving == sel && !runner->prio) {
+	/* Keep it on this thread, see SEL_RUNNER_SLOTS. */
+	unsigned int i = sel_slot;
+
+	old = __atomic_load_n(&sel->runner_slots[i].stack, __ATOMIC_RELAXED);
+	do {
+	    runner->next = old;
+	} while (!__atomic_compare_exchange_n(&sel->runner_slots[i].stack,
+					      &old, runner, 1,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_RELAXED));
+	if (__atomic_add_fetch(&sel->runner_slots[i].count, 1,
+			       __ATOMIC_RELAXED) == SEL_RUNNER_STEAL_DEPTH)
+	    sel_wake_for_runner(sel);
+	return 0;
+    }
+
+    old = __atomic_load_n(&sel->runner_stack, __ATOMIC_RELAXED);
+    do {
+	runner->next = old;
+    } while (!__atomic_compare_exchange_n(&sel->runner_stack, &old, runner,
+					  1, __ATOMIC_SEQ_CST,
+					  __ATOMIC_RELAXED));
+
+    /* If something was already there, whoever put it there woke someone. */
+    if (!old)
+	sel_wake_for_runner(sel);
+    return 0;
+}
+#else
 int
 sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data)
 {
     struct selector_s *sel = runner->sel;
+    int wake;
 
     sel_timer_lock(sel);
     if (runner->in_use) {
 	sel_timer_unlock(sel);
 	return EBUSY;
     }
-
+    runner->in_use = 1;
     runner->func = func;
     runner->cb_data = cb_data;
-    runner->next = NULL;
-    runner->in_use = 1;
 
-    if (sel->runner_tail) {
-	sel->runner_tail->next = runner;
-	sel->runner_tail = runner;
+    if (sel_serving == sel && !runner->prio) {
+	/* Keep it on this thread, see SEL_RUNNER_SLOTS. */
+	unsigned int i = sel_slot;
+
+	runner->next = sel->runner_slots[i].stack;
+	sel->runner_slots[i].stack = runner;
+	wake = ++sel->runner_slots[i].count == SEL_RUNNER_STEAL_DEPTH;
     } else {
-	sel->runner_head = runner;
-	sel->runner_tail = runner;
+	runner->next = sel->runner_stack;
+	sel->runner_stack = runner;
+	wake = !runner->next;
     }
-    /* Make sure someone is awake to run the runner. */
-    i_sel_wake_first(sel);
+    if (wake)
+	sel_wake_for_runner(sel);
     sel_timer_unlock(sel);
     return 0;
 }
+#endif
+
+static void
+runner_list_add(sel_runner_t **head, sel_runner_t **tail, sel_runner_t *runner)
+{
+    runner->next = NULL;
+    if (*tail)
+	(*tail)->next = runner;
+    else
+	*head = runner;
+    *tail = runner;
+}
+
+/*
+ * Take up to max runners off the front of a list, return the last
+ * one taken, or NULL if the list is empty.
+ */
+static sel_runner_t *
+runner_list_take(sel_runner_t **head, sel_runner_t **tail, unsigned int max,
+		 unsigned int *count)
+{
+    sel_runner_t *runner = *head;
+
+    if (!runner || *count >= max)
+	return NULL;
+    (*count)++;
+    while (runner->next && *count < max) {
+	runner = runner->next;
+	(*count)++;
+    }
+    *head = runner->next;
+    if (!*head)
+	*tail = NULL;
+    runner->next = NULL;
+    return runner;
+}
+
+/*
+ * Take everything on a per-thread queue and put it on the end of the
+ * shared list in the order it was added.  The shared runners were
+ * queued first, and going behind them means a thread that keeps
+ * requeueing runners to its own queue can't hold them off, each call
+ * takes the shared ones before any of the new ones.  Returns false if
+ * the queue was empty.  Must be called with the timer lock held.
+ */
+static int
+runner_slot_take(struct selector_s *sel, unsigned int i)
+{
+    sel_runner_t *runner, *next_runner, *list = NULL, *last;
+    int count = 0;
+
+    runner = sel_runner_stack_take(&sel->runner_slots[i].stack);
+    if (!runner)
+	return 0;
+    last = runner;
+    while (runner) {
+	next_runner = runner->next;
+	runner->next = list;
+	list = runner;
+	runner = next_runner;
+	count++;
+    }
+#if HAVE_GCC_ATOMICS
+    __atomic_sub_fetch(&sel->runner_slots[i].count, count, __ATOMIC_RELAXED);
+#else
+    sel->runner_slots[i].count -= count;
+#endif
+    if (sel->runner_tail)
+	sel->runner_tail->next = list;
+    else
+	sel->runner_head = list;
+    sel->runner_tail = last;
+    return 1;
+}
 
+/*
+ * Run up to SEL_RUNNER_BUDGET runners, must be called with the timer
+ * lock held.  High priority runners go first, then the shared ones,
+ * then this thread's own queue.  If there is nothing else, steal
+ * another thread's queue.  Runners that come in while this is running
+ * wait for the next call.
+ */
 static unsigned int
 process_runners(struct selector_s *sel)
 {
-    sel_runner_t *runner = sel->runner_head, *next_runner;
-    int count = 0;
+    sel_runner_t *runner, *next_runner, *list, *last;
+    unsigned int count = 0;
+
+    /* Move the new ones onto the end of the lists in the order added. */
+    runner = sel_runner_stack_take(&sel->runner_stack);
+    if (runner) {
+	list = NULL;
+	while (runner) {
+	    next_runner = runner->next;
+	    runner->next = list;
+	    list = runner;
+	    runner = next_runner;
+	}
+	while (list) {
+	    next_runner = list->next;
+	    if (list->prio)
+		runner_list_add(&sel->runner_prio_head, &sel->runner_prio_tail,
+				list);
+	    else
+		runner_list_add(&sel->runner_head, &sel->runner_tail, list);
+	    list = next_runner;
+	}
+    }
+
+    if (sel_serving == sel)
+	runner_slot_take(sel, sel_slot);
+    if (!sel->runner_head && !sel->runner_prio_head) {
+	unsigned int i;
+
+	for (i = 1; i < SEL_RUNNER_SLOTS; i++) {
+	    if (runner_slot_take(sel, (sel_slot + i) % SEL_RUNNER_SLOTS))
+		break;
+	}
+    }
+
+    /* Take this call's share off the front, high priority first. */
+    list = sel->runner_prio_head;
+    last = runner_list_take(&sel->runner_prio_head, &sel->runner_prio_tail,
+			    SEL_RUNNER_BUDGET, &count);
+    runner = sel->runner_head;
+    if (runner_list_take(&sel->runner_head, &sel->runner_tail,
+			 SEL_RUNNER_BUDGET, &count)) {
+	if (last)
+	    last->next = runner;
+	else
+	    list = runner;
+    } else if (!last) {
+	return 0;
+    }
 
-    sel->runner_head = NULL;
-    sel->runner_tail = NULL;
+    count = 0;
+    runner = list;
     while (runner) {
 	sel_runner_func_t func;
 	void *cb_data;
+	struct timeval start, end, *stats;
 
 	next_runner = runner->next;
-	runner->in_use = 0;
 	func = runner->func;
 	cb_data = runner->cb_data;
+#if HAVE_GCC_ATOMICS
+	__atomic_store_n(&runner->in_use, 0, __ATOMIC_RELEASE);
+#else
+	runner->in_use = 0;
+#endif
+	stats = sel_stats_now(sel, &start);
 	sel_timer_unlock(sel);
 	func(runner, cb_data);
 	count++;
 	sel_timer_lock(sel);
+	if (stats) {
+	    sel->timer_stats.runners_run++;
+	    sel_get_monotonic_time(&end);
+	    sel_stats_time(&sel->timer_stats.max_handler_time, NULL,
+			   &start, &end);
+	}
 	runner = next_runner;
     }
+    sel->runs_since_poll += count;
 
     return count;
 }
 
+static void
+sel_wake_fd_handler(int fd, void *data)
+{
+    unsigned char buf[64];
+
+    /* Just empty it, the runners get run after the wait. */
+    while (read(fd, buf, sizeof(buf)) > 0)
+	;
+}
+
+static int
+sel_wake_fd_open(int fds[2])
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0] == -1)
+	return errno;
+    fds[1] = fds[0];
+#else
+    if (pipe(fds) == -1)
+	return errno;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+    return 0;
+}
+
+static void
+sel_wake_fd_close(int fds[2])
+{
+    close(fds[0]);
+    if (fds[1] != fds[0])
+	close(fds[1]);
+}
+
+/*
+ * Set up the fd for waking threads for runners.  If this fails, the
+ * wait list is used instead.
+ */
+static void
+sel_wake_fd_setup(struct selector_s *sel)
+{
+    int rv;
+
+    sel->wake_fd[0] = -1;
+    sel->wake_fd[1] = -1;
+    if (!sel->sel_lock_alloc)
+	/* Single threaded, nothing else can add runners. */
+	return;
+#ifdef SEL_HAVE_KQUEUE
+    if (sel->kq_wake)
+	/* The kqueue has an EVFILT_USER event for this. */
+	return;
+#endif
+
+    rv = sel_wake_fd_open(sel->wake_fd);
+    if (rv) {
+	syslog(LOG_ERR, "Unable to set up selector wakeup fd: %s",
+	       strerror(rv));
+	sel->wake_fd[0] = -1;
+	sel->wake_fd[1] = -1;
+	return;
+    }
+    rv = sel_set_fd_handlers(sel, sel->wake_fd[0], NULL, sel_wake_fd_handler,
+			     NULL, NULL, NULL);
+    if (rv) {
+	sel_wake_fd_close(sel->wake_fd);
+	sel->wake_fd[0] = -1;
+	sel->wake_fd[1] = -1;
+	return;
+    }
+    sel_set_fd_read_handler(sel, sel->wake_fd[0], SEL_FD_HANDLER_ENABLED);
+}
+
+/*
+ * The wakeup fd is shared with the parent after a fork, so a read in
+ * one would eat the other's wakeups.  Get a new one in the same fd
+ * numbers so the registration stays good.
+ */
+static int
+sel_wake_fd_reopen(struct selector_s *sel)
+{
+    int fds[2], rv;
+
+    if (sel->wake_fd[0] < 0)
+	return 0;
+    rv = sel_wake_fd_open(fds);
+    if (rv)
+	return rv;
+    if (dup2(fds[0], sel->wake_fd[0]) == -1 ||
+	    (fds[1] != fds[0] && dup2(fds[1], sel->wake_fd[1]) == -1)) {
+	rv = errno;
+	sel_wake_fd_close(fds);
+	return rv;
+    }
+    sel_wake_fd_close(fds);
+#ifdef HAVE_SYS_EVENTFD_H
+    fcntl(sel->wake_fd[0], F_SETFD, FD_CLOEXEC);
+#else
+    fcntl(sel->wake_fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sel->wake_fd[1], F_SETFD, FD_CLOEXEC);
+#endif
+    return 0;
+}
+
+/*
+ * Call an fd handler.  If woke is not NULL, statistics are on and it
+ * is the time the wait returned.
+ */
 static void
 handle_selector_call(struct selector_s *sel, fd_control_t *fdc,
 		     volatile fd_set *fdset, int enabled,
-		     sel_fd_handler_t handler)
+		     sel_fd_handler_t handler, const struct timeval *woke)
 {
     void             *data;
     fd_state_t       *state;
+    struct timeval   start, end;
 
     if (handler == NULL) {
 	/* Somehow we don't have a handler for this.
@@ -1125,9 +2772,21 @@ handle_selector_call(struct selector_s *sel, fd_control_t *fdc,
 	 */
 	return;
     state->use_count++;
+    if (woke) {
+	sel_get_monotonic_time(&start);
+	sel->fd_stats.fds_dispatched++;
+	sel_stats_time(&sel->fd_stats.max_dispatch_latency,
+		       &sel->fd_stats.total_dispatch_latency, woke, &start);
+    }
     sel_fd_unlock(sel);
+    GENSIO_PROBE2(fd_dispatch, fdc->fd, data);
     handler(fdc->fd, data);
+    GENSIO_PROBE1(fd_dispatch_done, fdc->fd);
     sel_fd_lock(sel);
+    if (woke) {
+	sel_get_monotonic_time(&end);
+	sel_stats_time(&sel->fd_stats.max_handler_time, NULL, &start, &end);
+    }
     state->use_count--;
     if (state->deleted && state->use_count == 0) {
 	fdc->state = NULL;
@@ -1173,6 +2832,7 @@ process_fds(struct selector_s	    *sel,
     sigset_t sigmask;
     unsigned long entry_fd_del_count = sel->fd_del_count;
     fd_control_t *fdc;
+    struct timeval wtime, *woke = NULL;
 
     setup_my_sigmask(&sigmask, isigmask);
  retry:
@@ -1195,9 +2855,15 @@ process_fds(struct selector_s	    *sel,
 	    goto retry;
 	goto out;
     }
+    if (err > 0) {
+	sel_refresh_loop_time(sel);
+	woke = sel_stats_now(sel, &wtime);
+    }
 
     /* We got some I/O. */
     sel_fd_lock(sel);
+    if (woke)
+	sel_stats_wakeup(sel, err);
     if (entry_fd_del_count != sel->fd_del_count)
 	/* Something was deleted from the FD set, don't process this as it
 	   may be from the old fd wakeup. */
@@ -1206,17 +2872,17 @@ process_fds(struct selector_s	    *sel,
 	if (FD_ISSET(i, &tmp_read_set)) {
 	    valid_fd(sel, i, &fdc);
 	    handle_selector_call(sel, fdc, &sel->read_set, fdc->read_enabled,
-				 fdc->handle_read);
+				 fdc->handle_read, woke);
 	}
 	if (FD_ISSET(i, &tmp_write_set)) {
 	    valid_fd(sel, i, &fdc);
 	    handle_selector_call(sel, fdc, &sel->write_set, fdc->write_enabled,
-				 fdc->handle_write);
+				 fdc->handle_write, woke);
 	}
 	if (FD_ISSET(i, &tmp_except_set)) {
 	    valid_fd(sel, i, &fdc);
 	    handle_selector_call(sel, fdc, &sel->except_set,
-				 fdc->except_enabled, fdc->handle_except);
+				 fdc->except_enabled, fdc->handle_except, woke);
 	}
     }
  out_unlock:
@@ -1226,40 +2892,49 @@ out:
 }
 
 #ifdef HAVE_EPOLL_PWAIT
-static int
-process_fds_epoll(struct selector_s *sel, struct timespec *tstimeout,
-		  sigset_t *isigmask)
+/*
+ * Handle one event from epoll_pwait().  Must be called with the fd
+ * lock held, the lock may be released in handlers.
+ */
+static void
+sel_epoll_handle_event(struct selector_s *sel, struct epoll_event *event,
+		       unsigned long entry_fd_del_count,
+		       const struct timeval *woke)
 {
-    int rv;
-    struct epoll_event event;
-    int timeout;
-    sigset_t sigmask;
     fd_control_t *fdc;
-    unsigned long entry_fd_del_count = sel->fd_del_count;
 
-    setup_my_sigmask(&sigmask, isigmask);
-
-    if (tstimeout->tv_sec > 600)
-	 /* Don't wait over 10 minutes, to work around an old epoll bug
-	    and avoid issues with timeout overflowing on 64-bit systems,
-	    which is much larger that 10 minutes, but who cares. */
-	timeout = 600 * 1000;
-    else
-	timeout = ((tstimeout->tv_sec * 1000) +
-		   (tstimeout->tv_nsec + 999999) / 1000000);
-
-    sigdelset(&sigmask, sel->wake_sig);
-    rv = epoll_pwait(sel->epollfd, &event, 1, timeout, &sigmask);
-    if (rv <= 0)
-	return rv;
-
-    sel_fd_lock(sel);
-    valid_fd(sel, event.data.fd, &fdc);
+    valid_fd(sel, event->data.fd, &fdc);
+    if (fdc->edge) {
+	/*
+	 * Edge triggered fds get every event whether the handler is
+	 * enabled or not, the user tracks readiness.  An edge can't
+	 * be dropped like below, since it will not come again, a
+	 * stale one just costs the user a read or write that gets
+	 * EAGAIN.  Nothing needs to be rearmed.  The fd may be
+	 * replaced while in a handler, so recheck edge each time.
+	 */
+	if (event->events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	    handle_selector_call(sel, fdc, NULL,
+				 fdc->edge || fdc->read_enabled,
+				 fdc->handle_read, woke);
+	if (event->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+	    handle_selector_call(sel, fdc, NULL,
+				 fdc->edge || fdc->write_enabled,
+				 fdc->handle_write, woke);
+	if (event->events & (EPOLLPRI | EPOLLERR))
+	    handle_selector_call(sel, fdc, NULL,
+				 fdc->edge || fdc->except_enabled,
+				 fdc->handle_except, woke);
+	return;
+    }
     if (entry_fd_del_count != sel->fd_del_count)
-	/* Something was deleted from the FD set, don't process this as it
-	   may be from the old fd wakeup. */
+	/*
+	 * Something was deleted from the FD set, don't process this
+	 * as it may be from the old fd wakeup.  With a batch, this
+	 * includes deletes done by handlers for earlier events.
+	 */
 	goto rearm;
-    if (event.events & (EPOLLHUP | EPOLLERR)) {
+    if (event->events & (EPOLLHUP | EPOLLERR)) {
 	/*
 	 * The crazy people that designed epoll made it so that EPOLLHUP
 	 * and EPOLLERR always wake it up, even if they are not set.  That
@@ -1271,36 +2946,250 @@ process_fds_epoll(struct selector_s *sel, struct timespec *tstimeout,
 	 * by hand.
 	 */
 	sel_update_fd(sel, fdc, EPOLL_CTL_DEL);
-	fdc->saved_events = event.events & (EPOLLHUP | EPOLLERR);
+	fdc->saved_events = event->events & (EPOLLHUP | EPOLLERR);
 	/*
 	 * Have it handle read data, too, so if there is a pending
 	 * error it will get handled.
 	 */
-	event.events |= EPOLLIN;
+	event->events |= EPOLLIN;
     }
-    if (event.events & (EPOLLIN | EPOLLHUP))
+    if (event->events & (EPOLLIN | EPOLLHUP))
 	handle_selector_call(sel, fdc, NULL, fdc->read_enabled,
-			     fdc->handle_read);
-    if (event.events & EPOLLOUT)
+			     fdc->handle_read, woke);
+    if (event->events & EPOLLOUT)
 	handle_selector_call(sel, fdc, NULL, fdc->write_enabled,
-			     fdc->handle_write);
-    if (event.events & (EPOLLPRI | EPOLLERR))
+			     fdc->handle_write, woke);
+    if (event->events & (EPOLLPRI | EPOLLERR))
 	handle_selector_call(sel, fdc, NULL, fdc->except_enabled,
-			     fdc->handle_except);
+			     fdc->handle_except, woke);
 
  rearm:
     /* Rearm the event.  Remember it could have been deleted in the handler. */
     if (fdc->state)
 	sel_update_fd(sel, fdc, EPOLL_CTL_MOD);
+}
+
+static int
+process_fds_epoll(struct selector_s *sel, struct timespec *tstimeout,
+		  sigset_t *isigmask)
+{
+    int rv, i, maxevents = sel->epoll_batch;
+    struct epoll_event events[SEL_EPOLL_MAX_BATCH];
+    int timeout;
+    sigset_t sigmask;
+    unsigned int nr_waiting;
+    unsigned long entry_fd_del_count = sel->fd_del_count;
+    struct timeval wtime, *woke;
+
+    setup_my_sigmask(&sigmask, isigmask);
+
+    if (tstimeout->tv_sec > 600)
+	 /* Don't wait over 10 minutes, to work around an old epoll bug
+	    and avoid issues with timeout overflowing on 64-bit systems,
+	    which is much larger that 10 minutes, but who cares. */
+	timeout = 600 * 1000;
+    else
+	timeout = ((tstimeout->tv_sec * 1000) +
+		   (tstimeout->tv_nsec + 999999) / 1000000);
+
+    /*
+     * Split the batch between the threads waiting, so one thread
+     * doesn't take a pile of events while others sit idle.  The fds
+     * are oneshot, so events this thread doesn't take stay ready
+     * for the others.
+     */
+    nr_waiting = sel_nr_waiting(sel);
+    if (nr_waiting > 1)
+	maxevents /= nr_waiting;
+    if (maxevents < 1)
+	maxevents = 1;
+
+    sigdelset(&sigmask, sel->wake_sig);
+    rv = epoll_pwait(sel->epollfd, events, maxevents, timeout, &sigmask);
+    if (rv <= 0)
+	return rv;
+    sel_refresh_loop_time(sel);
+    woke = sel_stats_now(sel, &wtime);
+
+    sel_fd_lock(sel);
+    if (woke)
+	sel_stats_wakeup(sel, rv);
+    if (sel->nr_prio_fds && rv > 1) {
+	/* Do the priority fds first, then the rest. */
+	char done[SEL_EPOLL_MAX_BATCH];
+	fd_control_t *fdc;
+
+	for (i = 0; i < rv; i++) {
+	    fdc = get_fd(sel, events[i].data.fd);
+	    done[i] = fdc && fdc->prio;
+	    if (done[i])
+		sel_epoll_handle_event(sel, &events[i], entry_fd_del_count,
+				       woke);
+	}
+	for (i = 0; i < rv; i++) {
+	    if (!done[i])
+		sel_epoll_handle_event(sel, &events[i], entry_fd_del_count,
+				       woke);
+	}
+    } else {
+	for (i = 0; i < rv; i++)
+	    sel_epoll_handle_event(sel, &events[i], entry_fd_del_count, woke);
+    }
     sel_fd_unlock(sel);
 
     return rv;
 }
 
+#ifdef SEL_HAVE_IO_URING
+/* Must be called with the fd lock held.  The lock may be released. */
+static void
+sel_uring_handle_cqe(struct selector_s *sel, uint64_t user_data, int res,
+		     const struct timeval *woke)
+{
+    fd_control_t *fdc;
+    uint32_t events;
+
+    if (user_data == SEL_URING_IGNORE)
+	return;
+
+    fdc = get_fd(sel, (int) (user_data & 0xffffffff));
+    if (!fdc || !fdc->uring_armed || fdc->uring_gen != user_data >> 32)
+	/* An old poll that was removed or replaced. */
+	return;
+    fdc->uring_armed = 0;
+    if (!fdc->state)
+	return;
+
+    if (res < 0)
+	events = POLLERR;
+    else
+	events = res;
+
+    if (events & (POLLHUP | POLLERR)) {
+	/*
+	 * Like epoll, poll always reports these.  See the comment in
+	 * process_fds_epoll(), the poll is already disarmed so just
+	 * save the events.
+	 */
+	fdc->saved_events = events & (POLLHUP | POLLERR);
+	events |= POLLIN;
+    }
+    if (events & (POLLIN | POLLHUP))
+	handle_selector_call(sel, fdc, NULL, fdc->read_enabled,
+			     fdc->handle_read, woke);
+    if (events & POLLOUT)
+	handle_selector_call(sel, fdc, NULL, fdc->write_enabled,
+			     fdc->handle_write, woke);
+    if (events & (POLLPRI | POLLERR))
+	handle_selector_call(sel, fdc, NULL, fdc->except_enabled,
+			     fdc->handle_except, woke);
+
+    /* Rearm the poll.  Remember it could have been deleted in the handler. */
+    if (fdc->state && !fdc->uring_armed)
+	sel_uring_update_fd(sel, fdc, EPOLL_CTL_MOD);
+}
+
+static int
+process_fds_uring(struct selector_s *sel, struct timespec *tstimeout,
+		  sigset_t *isigmask)
+{
+    struct sel_uring *u = &sel->uring;
+    struct io_uring_cqe *cqe;
+    unsigned int head, to_submit, count = 0;
+    uint64_t user_data;
+    sigset_t sigmask;
+    int rv, res, old_errno;
+    struct timeval wtime, *woke;
+
+    setup_my_sigmask(&sigmask, isigmask);
+    sigdelset(&sigmask, sel->wake_sig);
+
+    sel_fd_lock(sel);
+    to_submit = u->pending;
+    u->pending = 0;
+    u->waiters++;
+    sel_fd_unlock(sel);
+
+    rv = sel_uring_enter(u, to_submit, 1, tstimeout, &sigmask);
+    old_errno = errno;
+    sel_refresh_loop_time(sel);
+    woke = sel_stats_now(sel, &wtime);
+
+    sel_fd_lock(sel);
+    u->waiters--;
+    if (rv < 0)
+	/* Nothing was submitted, the entries are still in the queue. */
+	u->pending += to_submit;
+    else if ((unsigned int) rv < to_submit)
+	u->pending += to_submit - rv;
+
+    while (count < SEL_URING_BATCH) {
+	head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+	    break;
+	cqe = &u->cqes[head & *u->cq_mask];
+	user_data = cqe->user_data;
+	res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	count++;
+	sel_uring_handle_cqe(sel, user_data, res, woke);
+    }
+    if (woke && count)
+	sel_stats_wakeup(sel, count);
+    sel_fd_unlock(sel);
+
+    if (count)
+	return count;
+    if (rv < 0) {
+	if (old_errno == ETIME)
+	    return 0;
+	if (old_errno == EINTR) {
+	    errno = old_errno;
+	    return -1;
+	}
+    }
+    /*
+     * If entries were submitted io_uring_enter() doesn't report timeouts
+     * or signals.  Say it was interrupted so the caller checks for
+     * signals before it waits again, it may have eaten one.
+     */
+    if (to_submit) {
+	errno = EINTR;
+	return -1;
+    }
+    /* Another thread may have taken our completion. */
+    return 1;
+}
+#endif
+
 int
 sel_setup_forked_process(struct selector_s *sel)
 {
-    int i;
+    int i, rv;
+
+    rv = sel_wake_fd_reopen(sel);
+    if (rv)
+	return rv;
+
+#ifdef SEL_HAVE_IO_URING
+    if (sel->uring.fd >= 0) {
+	/* The ring is shared with the parent, like epoll, get a new one. */
+	sel_uring_cleanup(&sel->uring);
+	rv = sel_uring_setup(&sel->uring);
+	if (rv)
+	    return rv;
+	for (i = 0; i <= sel->maxfd; i++) {
+	    fd_control_t *fdc = sel->fds[i];
+
+	    if (fdc) {
+		fdc->uring_armed = 0;
+		if (fdc->state)
+		    sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+	    }
+	}
+	return 0;
+    }
+#endif
 
     /*
      * More epoll stupidity.  In a forked process we must create a new
@@ -1322,30 +3211,385 @@ sel_setup_forked_process(struct selector_s *sel)
     }
     return 0;
 }
-#else
+#elif defined(SEL_HAVE_KQUEUE)
+/*
+ * Handle one event from kevent().  Must be called with the fd lock
+ * held, the lock may be released in handlers.
+ */
+static void
+sel_kqueue_handle_event(struct selector_s *sel, struct kevent *ev,
+			unsigned long entry_fd_del_count,
+			const struct timeval *woke)
+{
+    fd_control_t *fdc;
+
+#ifdef EVFILT_USER
+    if (ev->filter == EVFILT_USER)
+	/* Just a wakeup, the runners get run after the wait. */
+	return;
+#endif
+    fdc = get_fd(sel, ev->ident);
+    if (!fdc)
+	return;
+
+    /* The filter was oneshot, it's gone now. */
+    if (ev->filter == EVFILT_READ)
+	fdc->kq_read_armed = 0;
+    else
+	fdc->kq_write_armed = 0;
+
+    if (entry_fd_del_count != sel->fd_del_count)
+	/*
+	 * Something was deleted from the FD set, don't process this
+	 * as it may be from the old fd wakeup.
+	 */
+	goto rearm;
+
+    if (ev->filter == EVFILT_READ)
+	handle_selector_call(sel, fdc, NULL, fdc->read_enabled,
+			     fdc->handle_read, woke);
+    else
+	handle_selector_call(sel, fdc, NULL, fdc->write_enabled,
+			     fdc->handle_write, woke);
+    /*
+     * A socket error comes in as EOF with the error in fflags, that's
+     * the closest thing to an exception kqueue has.
+     */
+    if ((ev->flags & EV_EOF) && ev->fflags)
+	handle_selector_call(sel, fdc, NULL, fdc->except_enabled,
+			     fdc->handle_except, woke);
+
+ rearm:
+    /* Remember it could have been deleted in the handler. */
+    if (fdc->state)
+	sel_update_fd(sel, fdc, EPOLL_CTL_MOD);
+}
+
+/*
+ * kevent() can't change the signal mask while it waits, so a wakeup
+ * signal could come in just before it blocks and be lost.  Instead,
+ * wait for the kqueue fd to become readable with pselect(), which
+ * handles the signal mask like epoll_pwait() does, then take the
+ * events without blocking.  The kqueue fd is allocated with the
+ * selector, so it's well below FD_SETSIZE.
+ */
+static int
+process_fds_kqueue(struct selector_s *sel, volatile struct timespec *tstimeout,
+		   sigset_t *isigmask)
+{
+    struct kevent events[SEL_KQUEUE_BATCH];
+    struct timespec zero = { 0, 0 };
+    struct timeval wtime, *woke, start, now, left;
+    unsigned long entry_fd_del_count = sel->fd_del_count;
+    unsigned int nr_waiting;
+    int rv, i, maxevents = SEL_KQUEUE_BATCH;
+    sigset_t sigmask;
+    fd_set kqset;
+
+    setup_my_sigmask(&sigmask, isigmask);
+    sigdelset(&sigmask, sel->wake_sig);
+
+    /* Split the batch between the waiting threads, like epoll. */
+    nr_waiting = sel_nr_waiting(sel);
+    if (nr_waiting > 1)
+	maxevents /= nr_waiting;
+    if (maxevents < 1)
+	maxevents = 1;
+
+ retry:
+    if (tstimeout->tv_sec || tstimeout->tv_nsec) {
+	FD_ZERO(&kqset);
+	FD_SET(sel->kqfd, &kqset);
+	sel_get_monotonic_time(&start);
+	rv = pselect(sel->kqfd + 1, &kqset, NULL, NULL,
+		     (struct timespec *) tstimeout, &sigmask);
+	if (rv <= 0)
+	    return rv;
+    }
+    rv = kevent(sel->kqfd, NULL, 0, events, maxevents, &zero);
+    if (rv < 0)
+	return rv;
+    if (rv == 0) {
+	if (!tstimeout->tv_sec && !tstimeout->tv_nsec)
+	    return 0;
+	/*
+	 * All the threads waiting are woken, another one took the
+	 * events.  Wait for whatever time is left.
+	 */
+	sel_get_monotonic_time(&now);
+	diff_timeval(&now, &now, &start);
+	left.tv_sec = tstimeout->tv_sec;
+	left.tv_usec = tstimeout->tv_nsec / 1000;
+	diff_timeval(&left, &left, &now);
+	if (!left.tv_sec && !left.tv_usec)
+	    return 0;
+	tstimeout->tv_sec = left.tv_sec;
+	tstimeout->tv_nsec = left.tv_usec * 1000;
+	goto retry;
+    }
+    sel_refresh_loop_time(sel);
+    woke = sel_stats_now(sel, &wtime);
+
+    sel_fd_lock(sel);
+    if (woke)
+	sel_stats_wakeup(sel, rv);
+    for (i = 0; i < rv; i++)
+	sel_kqueue_handle_event(sel, &events[i], entry_fd_del_count, woke);
+    sel_fd_unlock(sel);
+
+    return rv;
+}
+
+static int
+sel_kqueue_setup(struct selector_s *sel)
+{
+#ifdef EVFILT_USER
+    struct kevent ev;
+#endif
+
+    sel->kq_wake = 0;
+    sel->kqfd = kqueue();
+    if (sel->kqfd == -1)
+	return errno;
+    fcntl(sel->kqfd, F_SETFD, FD_CLOEXEC);
+#ifdef EVFILT_USER
+    /* Used in place of the wakeup fd, see sel_wake_fd_setup(). */
+    EV_SET(&ev, SEL_KQUEUE_WAKE_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0,
+	   NULL);
+    sel->kq_wake = kevent(sel->kqfd, &ev, 1, NULL, 0, NULL) == 0;
+#endif
+    return 0;
+}
+
 int
 sel_setup_forked_process(struct selector_s *sel)
 {
-    /* Nothing to do. */
+    int i, rv;
+
+    rv = sel_wake_fd_reopen(sel);
+    if (rv)
+	return rv;
+    if (sel->kqfd < 0)
+	return 0;
+
+    /*
+     * Unlike epoll, a kqueue is not inherited by the child at all,
+     * get a new one and register everything again.
+     */
+    close(sel->kqfd);
+    rv = sel_kqueue_setup(sel);
+    if (rv)
+	return rv;
+    for (i = 0; i <= sel->maxfd; i++) {
+	fd_control_t *fdc = sel->fds[i];
+
+	if (fdc) {
+	    fdc->kq_read_armed = 0;
+	    fdc->kq_write_armed = 0;
+	    if (fdc->state)
+		sel_update_fd(sel, fdc, EPOLL_CTL_ADD);
+	}
+    }
     return 0;
 }
+#else
+int
+sel_setup_forked_process(struct selector_s *sel)
+{
+    return sel_wake_fd_reopen(sel);
+}
+#endif
+
+static int
+process_fds_any(struct selector_s *sel, struct timespec *tstimeout,
+		sigset_t *sigmask)
+{
+#ifdef SEL_HAVE_IO_URING
+    if (sel->uring.fd >= 0)
+	return process_fds_uring(sel, tstimeout, sigmask);
+#endif
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd >= 0)
+	return process_fds_epoll(sel, tstimeout, sigmask);
+#endif
+#ifdef SEL_HAVE_KQUEUE
+    if (sel->kqfd >= 0)
+	return process_fds_kqueue(sel, tstimeout, sigmask);
+#endif
+    return process_fds(sel, tstimeout, sigmask);
+}
+
+/*
+ * Poll without blocking until something comes in or the busy poll
+ * time or the timeout runs out.  The time spent is taken off
+ * tstimeout.  Returns what the last poll returned.
+ */
+static int
+busy_poll_fds(struct selector_s *sel, struct timeval *spin,
+	      struct timespec *tstimeout, sigset_t *sigmask)
+{
+    struct timespec zero = { 0, 0 };
+    struct timeval limit, start, end, now, left;
+    int err;
+
+    limit.tv_sec = tstimeout->tv_sec;
+    limit.tv_usec = tstimeout->tv_nsec / 1000;
+    if (cmp_timeval(spin, &limit) < 0)
+	limit = *spin;
+
+    sel_get_monotonic_time(&start);
+    add_timeval(&end, &start, &limit);
+    do {
+	err = process_fds_any(sel, &zero, sigmask);
+	sel_get_monotonic_time(&now);
+    } while (err == 0 && cmp_timeval(&now, &end) < 0);
+
+    diff_timeval(&now, &now, &start);
+    limit.tv_sec = tstimeout->tv_sec;
+    limit.tv_usec = tstimeout->tv_nsec / 1000;
+    diff_timeval(&left, &limit, &now);
+    tstimeout->tv_sec = left.tv_sec;
+    tstimeout->tv_nsec = left.tv_usec * 1000;
+
+    return err;
+}
+
+void
+sel_set_busy_poll(struct selector_s *sel, struct timeval *spin)
+{
+    sel_timer_lock(sel);
+    sel->busy_poll = *spin;
+    sel_timer_unlock(sel);
+}
+
+void
+sel_get_busy_poll(struct selector_s *sel, struct timeval *spin,
+		  unsigned long *hits, unsigned long *sleeps)
+{
+    sel_timer_lock(sel);
+    if (spin)
+	*spin = sel->busy_poll;
+    if (hits)
+	*hits = sel->busy_poll_hits;
+    if (sleeps)
+	*sleeps = sel->busy_poll_sleeps;
+    sel_timer_unlock(sel);
+}
+
+void
+sel_set_timer_slack(struct selector_s *sel, struct timeval *slack)
+{
+    sel_timer_lock(sel);
+    sel->timer_slack = *slack;
+    sel_timer_unlock(sel);
+}
+
+void
+sel_get_timer_slack(struct selector_s *sel, struct timeval *slack)
+{
+    sel_timer_lock(sel);
+    *slack = sel->timer_slack;
+    sel_timer_unlock(sel);
+}
+
+void
+sel_set_stats(struct selector_s *sel, int enable)
+{
+    sel_fd_lock(sel);
+    memset(&sel->fd_stats, 0, sizeof(sel->fd_stats));
+    sel_fd_unlock(sel);
+    sel_timer_lock(sel);
+    memset(&sel->timer_stats, 0, sizeof(sel->timer_stats));
+    sel_timer_unlock(sel);
+#if HAVE_GCC_ATOMICS
+    __atomic_store_n(&sel->stats_enabled, !!enable, __ATOMIC_RELAXED);
+#else
+    sel->stats_enabled = !!enable;
 #endif
+}
+
+void
+sel_get_stats(struct selector_s *sel, struct sel_stats *stats)
+{
+    struct sel_stats t;
+
+    sel_timer_lock(sel);
+    t = sel->timer_stats;
+    sel_timer_unlock(sel);
+
+    sel_fd_lock(sel);
+    *stats = sel->fd_stats;
+    sel_fd_unlock(sel);
+
+    stats->timers_fired = t.timers_fired;
+    stats->runners_run = t.runners_run;
+    stats->total_timer_late = t.total_timer_late;
+    stats->max_timer_late = t.max_timer_late;
+    if (cmp_timeval(&t.max_handler_time, &stats->max_handler_time) > 0)
+	stats->max_handler_time = t.max_handler_time;
+}
 
 int
-sel_select_intr_sigmask(struct selector_s *sel,
-			sel_send_sig_cb send_sig,
-			long            thread_id,
-			void            *cb_data,
-			struct timeval  *timeout,
-			sigset_t        *sigmask)
+sel_get_poll_info(struct selector_s *sel, int *fd, struct timeval *timeout)
 {
-    int             err = 0, old_errno;
+#if defined(HAVE_EPOLL_PWAIT) || defined(SEL_HAVE_KQUEUE)
+    struct timeval now, next;
+
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd < 0)
+	return ENOSYS;
+#ifdef SEL_HAVE_IO_URING
+    if (sel->uring.fd >= 0)
+	return ENOSYS;
+#endif
+
+    *fd = sel->epollfd;
+#else
+    if (sel->kqfd < 0)
+	return ENOSYS;
+    *fd = sel->kqfd;
+#endif
+    sel_timer_lock(sel);
+    if (runners_pending(sel)) {
+	sel_timer_unlock(sel);
+	timeout->tv_sec = 0;
+	timeout->tv_usec = 0;
+	return 0;
+    }
+
+    if (timerq_next_timeout(sel, &next)) {
+	sel_get_monotonic_time(&now);
+	if (cmp_timeval(&next, &now) < 0)
+	    next = now;
+	diff_timeval(timeout, &next, &now);
+    } else {
+	/* No timers, just set a long time like process_timers(). */
+	timeout->tv_sec = 100000;
+	timeout->tv_usec = 0;
+    }
+    sel_timer_unlock(sel);
+    return 0;
+#else
+    return ENOSYS;
+#endif
+}
+
+static int
+i_sel_select_intr_sigmask(struct selector_s *sel,
+			  sel_send_sig_cb send_sig,
+			  long            thread_id,
+			  void            *cb_data,
+			  struct timeval  *timeout,
+			  sigset_t        *sigmask)
+{
+    int             err = 0, old_errno = 0;
     struct timeval  wake_time, tmp_timeout;
     struct timespec loc_timeout;
     sel_wait_list_t wait_entry;
     unsigned int    count;
-    struct timeval  end = { 0, 0 }, now;
+    struct timeval  end = { 0, 0 }, now, spin;
     int user_timeout = 0;
+    int spun = 0, spin_hit = 0;
 
     if (timeout) {
 	sel_get_monotonic_time(&now);
@@ -1356,7 +3600,7 @@ sel_select_intr_sigmask(struct selector_s *sel,
     count = process_runners(sel);
     process_timers(sel, &count, &tmp_timeout, &wake_time);
 
-    if (count == 0 && !sel->runner_head) {
+    if (count == 0 && !runners_pending(sel)) {
 	/* Didn't do anything and no runners waiting, wait for something. */
 	if (timeout) {
 	    if (cmp_timeval(&tmp_timeout, timeout) >= 0) {
@@ -1370,18 +3614,32 @@ sel_select_intr_sigmask(struct selector_s *sel,
 
 	add_sel_wait_list(sel, &wait_entry, send_sig, cb_data, thread_id,
 			  &wake_time, &loc_timeout);
+	if (runners_pending(sel)) {
+	    /* Came in without the lock, see sel_wake_for_runner(). */
+	    loc_timeout.tv_sec = 0;
+	    loc_timeout.tv_nsec = 0;
+	}
+	spin = sel->busy_poll;
 	sel_timer_unlock(sel);
 
-#ifdef HAVE_EPOLL_PWAIT
-	if (sel->epollfd >= 0)
-	    err = process_fds_epoll(sel, &loc_timeout, sigmask);
-	else
-#endif
-	    err = process_fds(sel, &loc_timeout, sigmask);
+	if ((spin.tv_sec || spin.tv_usec) &&
+		(loc_timeout.tv_sec || loc_timeout.tv_nsec)) {
+	    spun = 1;
+	    err = busy_poll_fds(sel, &spin, &loc_timeout, sigmask);
+	    spin_hit = err > 0;
+	    if (err == 0 && (loc_timeout.tv_sec || loc_timeout.tv_nsec))
+		err = process_fds_any(sel, &loc_timeout, sigmask);
+	} else {
+	    err = process_fds_any(sel, &loc_timeout, sigmask);
+	}
 
 	old_errno = errno;
 
 	sel_timer_lock(sel);
+	if (spin_hit)
+	    sel->busy_poll_hits++;
+	else if (spun)
+	    sel->busy_poll_sleeps++;
 	if (err == 0) {
 #ifdef BROKEN_PSELECT
 	    if (wait_entry.signalled) {
@@ -1399,6 +3657,7 @@ sel_select_intr_sigmask(struct selector_s *sel,
 	}
 
 	remove_sel_wait_list(sel, &wait_entry);
+	sel->runs_since_poll = 0;
 
 	/*
 	 * Process runners before and after the wait.  This way any
@@ -1408,6 +3667,21 @@ sel_select_intr_sigmask(struct selector_s *sel,
 	 * we timed out we want to alert the user of that.
 	 */
 	process_runners(sel);
+    } else if (sel->runs_since_poll >= SEL_RUNNER_BUDGET &&
+	       runners_pending(sel)) {
+	/*
+	 * There are more runners than the budget, or they keep
+	 * rescheduling themselves.  Don't let them hold off the file
+	 * descriptors, check those without waiting.
+	 */
+	sel->runs_since_poll = 0;
+	loc_timeout.tv_sec = 0;
+	loc_timeout.tv_nsec = 0;
+	sel_timer_unlock(sel);
+	err = process_fds_any(sel, &loc_timeout, sigmask);
+	if (err < 0)
+	    err = 0;
+	sel_timer_lock(sel);
     }
     sel_timer_unlock(sel);
     if (timeout) {
@@ -1423,6 +3697,54 @@ sel_select_intr_sigmask(struct selector_s *sel,
     return err + count;
 }
 
+int
+sel_select_intr_sigmask(struct selector_s *sel,
+			sel_send_sig_cb send_sig,
+			long            thread_id,
+			void            *cb_data,
+			struct timeval  *timeout,
+			sigset_t        *sigmask)
+{
+    struct selector_s *old_serving = sel_serving;
+    struct selector_s *old_owner = sel_slot_owner;
+    unsigned int old_slot = sel_slot, slot;
+    int rv;
+
+    if (sel_slot_owner != sel) {
+	sel_slot_owner = sel;
+#if HAVE_GCC_ATOMICS
+	sel_slot = __atomic_fetch_add(&sel->next_runner_slot, 1,
+				      __ATOMIC_RELAXED) % SEL_RUNNER_SLOTS;
+#else
+	sel_timer_lock(sel);
+	sel_slot = sel->next_runner_slot++ % SEL_RUNNER_SLOTS;
+	sel_timer_unlock(sel);
+#endif
+    }
+    slot = sel_slot;
+    sel_serving = sel;
+    rv = i_sel_select_intr_sigmask(sel, send_sig, thread_id, cb_data,
+				   timeout, sigmask);
+    if (old_serving && old_serving != sel) {
+	/* Nested service of another selector, put the outer one back. */
+	sel_slot_owner = old_owner;
+	sel_slot = old_slot;
+    }
+    sel_serving = old_serving;
+
+    /* Don't leave runners behind if this thread doesn't come back. */
+#if HAVE_GCC_ATOMICS
+    if (sel_runner_stack_peek(&sel->runner_slots[slot].stack))
+	sel_wake_for_runner(sel);
+#else
+    sel_timer_lock(sel);
+    if (sel_runner_stack_peek(&sel->runner_slots[slot].stack))
+	sel_wake_for_runner(sel);
+    sel_timer_unlock(sel);
+#endif
+    return rv;
+}
+
 int
 sel_select_intr(struct selector_s *sel,
 		sel_send_sig_cb send_sig,
@@ -1488,6 +3810,8 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     struct selector_s *sel;
     int rv;
     sigset_t sigset;
+    char *wheel_env;
+    struct timeval now;
 
     sel = sel_alloc(sizeof(*sel));
     if (!sel)
@@ -1509,19 +3833,30 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     FD_ZERO((fd_set *) &sel->write_set);
     FD_ZERO((fd_set *) &sel->except_set);
 
-    memset(sel->fds, 0, sizeof(sel->fds));
-
     theap_init(&sel->timer_heap);
+    wheel_env = getenv("GENSIO_SEL_TIMER_WHEEL");
+    if (wheel_env && *wheel_env && strcmp(wheel_env, "0") != 0) {
+	sel->wheel = sel_alloc(sizeof(*sel->wheel));
+	if (!sel->wheel) {
+	    free(sel);
+	    return ENOMEM;
+	}
+	memset(sel->wheel, 0, sizeof(*sel->wheel));
+	sel_get_monotonic_time(&now);
+	sel->wheel->cur = wheel_tv_to_tick(&now);
+    }
 
     if (sel->sel_lock_alloc) {
 	sel->timer_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->timer_lock) {
+	    free(sel->wheel);
 	    free(sel);
 	    return ENOMEM;
 	}
 	sel->fd_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->fd_lock) {
 	    sel->sel_lock_free(sel->fd_lock);
+	    free(sel->wheel);
 	    free(sel);
 	    return ENOMEM;
 	}
@@ -1536,6 +3871,7 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 	    sel->sel_lock_free(sel->fd_lock);
 		sel->sel_lock_free(sel->timer_lock);
 	}
+	free(sel->wheel);
 	free(sel);
 	return rv;
     }
@@ -1545,6 +3881,50 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     if (sel->epollfd == -1)
 	syslog(LOG_ERR, "Unable to set up epoll, falling back to select: %m");
 #endif
+#ifdef SEL_HAVE_KQUEUE
+    rv = sel_kqueue_setup(sel);
+    if (rv)
+	syslog(LOG_ERR, "Unable to set up kqueue, falling back to select: %s",
+	       strerror(rv));
+#endif
+#ifdef SEL_HAVE_IO_URING
+    sel->uring.fd = -1;
+    if (sel->epollfd >= 0) {
+	char *s = getenv("GENSIO_SEL_IO_URING");
+
+	if (s && *s && strcmp(s, "0") != 0) {
+	    rv = sel_uring_setup(&sel->uring);
+	    if (rv)
+		syslog(LOG_ERR, "Unable to set up io_uring, using epoll: %s",
+		       strerror(rv));
+	}
+    }
+#endif
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd >= 0
+#ifdef SEL_HAVE_IO_URING
+		&& sel->uring.fd < 0
+#endif
+		) {
+	char *s = getenv("GENSIO_SEL_EPOLL_EDGE");
+
+	if (s && *s && strcmp(s, "0") != 0)
+	    sel->edge_ok = 1;
+
+	sel->epoll_batch = 1;
+	s = getenv("GENSIO_SEL_EPOLL_BATCH");
+	if (s && *s) {
+	    int batch = strtol(s, NULL, 0);
+
+	    if (batch > SEL_EPOLL_MAX_BATCH)
+		batch = SEL_EPOLL_MAX_BATCH;
+	    if (batch > 1)
+		sel->epoll_batch = batch;
+	}
+    }
+#endif
+
+    sel_wake_fd_setup(sel);
 
     *new_selector = sel;
 
@@ -1564,6 +3944,13 @@ sel_free_selector(struct selector_s *sel)
     sel_timer_t *elem;
     unsigned int i;
 
+    if (sel->wheel) {
+	while ((elem = wheel_get_any(sel->wheel))) {
+	    timerq_remove(sel, elem);
+	    free(elem);
+	}
+	free(sel->wheel);
+    }
     elem = theap_get_top(&(sel->timer_heap));
     while (elem) {
 	theap_remove(&(sel->timer_heap), elem);
@@ -1575,16 +3962,26 @@ sel_free_selector(struct selector_s *sel)
     if (sel->epollfd >= 0)
 	close(sel->epollfd);
 #endif
-    for (i = 0; i < FD_SETSIZE; i++) {
-	while (sel->fds[i]) {
-	    fd_control_t *fdc = sel->fds[i];
+#ifdef SEL_HAVE_IO_URING
+    sel_uring_cleanup(&sel->uring);
+#endif
+#ifdef SEL_HAVE_KQUEUE
+    if (sel->kqfd >= 0)
+	close(sel->kqfd);
+#endif
+    if (sel->wake_fd[0] >= 0)
+	sel_wake_fd_close(sel->wake_fd);
+    for (i = 0; i < sel->fds_size; i++) {
+	fd_control_t *fdc = sel->fds[i];
 
-	    sel->fds[i] = fdc->next;
+	if (fdc) {
 	    if (fdc->state)
 		free(fdc->state);
 	    free(fdc);
 	}
     }
+    if (sel->fds)
+	free(sel->fds);
     if (sel->fd_lock)
 	sel->sel_lock_free(sel->fd_lock);
     if (sel->timer_lock)
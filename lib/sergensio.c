@@ -399,6 +399,116 @@ sergensio_send_break(struct sergensio *sio)
     return sio->func(sio, SERGENSIO_FUNC_SEND_BREAK, 0, NULL, NULL, NULL);
 }
 
+/*
+ * Tracks the ops of a sergensio_batch() call.  refcount is the number
+ * of ops outstanding plus one for the caller while it is submitting.
+ */
+struct sergensio_batch {
+    struct sergensio *sio;
+    struct sergensio_batch_op *ops;
+    unsigned int nops;
+    unsigned int refcount;
+    sergensio_batch_done done;
+    void *cb_data;
+};
+
+struct sergensio_batch_opd {
+    struct sergensio_batch *b;
+    unsigned int idx;
+};
+
+static void
+sergensio_batch_deref(struct sergensio_batch *b)
+{
+    struct sergensio *sio = b->sio;
+    struct gensio_os_funcs *o = sio->o;
+    unsigned int i, count;
+    int err = 0;
+
+    o->lock(sio->lock);
+    count = --b->refcount;
+    o->unlock(sio->lock);
+    if (count > 0)
+	return;
+
+    for (i = 0; i < b->nops; i++) {
+	if (b->ops[i].err) {
+	    err = b->ops[i].err;
+	    break;
+	}
+    }
+    if (b->done)
+	b->done(sio, err, b->ops, b->nops, b->cb_data);
+    o->free(o, b);
+}
+
+static void
+sergensio_batch_op_done(struct sergensio *sio, int err, unsigned int val,
+			void *cb_data)
+{
+    struct sergensio_batch_opd *d = cb_data;
+
+    d->b->ops[d->idx].err = err;
+    d->b->ops[d->idx].rval = val;
+    sergensio_batch_deref(d->b);
+}
+
+int
+sergensio_batch(struct sergensio *sio,
+		struct sergensio_batch_op *ops, unsigned int nops,
+		sergensio_batch_done done, void *cb_data)
+{
+    struct gensio_os_funcs *o = sio->o;
+    struct sergensio_batch *b;
+    struct sergensio_batch_opd *d;
+    unsigned int i;
+    int rv = 0;
+
+    for (i = 0; i < nops; i++) {
+	if (ops[i].op < SERGENSIO_BATCH_BAUD || ops[i].op > SERGENSIO_BATCH_RTS)
+	    return GE_INVAL;
+    }
+
+    b = o->zalloc(o, sizeof(*b) + sizeof(*d) * nops);
+    if (!b)
+	return GE_NOMEM;
+    d = (struct sergensio_batch_opd *) (b + 1);
+    b->sio = sio;
+    b->ops = ops;
+    b->nops = nops;
+    b->refcount = 1;
+    b->done = done;
+    b->cb_data = cb_data;
+
+    /* The batch op numbers are the same as the func numbers. */
+    sio->func(sio, SERGENSIO_FUNC_BATCH_START, 0, NULL, NULL, NULL);
+    for (i = 0; i < nops; i++) {
+	ops[i].err = 0;
+	ops[i].rval = 0;
+	d[i].b = b;
+	d[i].idx = i;
+	o->lock(sio->lock);
+	b->refcount++;
+	o->unlock(sio->lock);
+	rv = sio->func(sio, ops[i].op, ops[i].val, NULL,
+		       sergensio_batch_op_done, &d[i]);
+	if (rv) {
+	    o->lock(sio->lock);
+	    b->refcount--;
+	    o->unlock(sio->lock);
+	    break;
+	}
+    }
+    sio->func(sio, SERGENSIO_FUNC_BATCH_END, 0, NULL, NULL, NULL);
+
+    if (rv)
+	/* Started ops still finish, but the user gets no callback. */
+	b->done = NULL;
+    sergensio_batch_deref(b);
+
+    return rv;
+}
+
 bool
 sergensio_is_client(struct sergensio *sio)
 {
@@ -126,6 +126,23 @@ struct sterm_data {
     bool set_tty;		/* No serial settings. */
 
     bool no_uucp_lock;
+    bool flock; /* Lock the device itself, see GENSIO_IOD_CONTROL_EXCL_LOCK. */
+
+    /*
+     * For async-open, the device is locked, opened, and configured
+     * in a thread so many ports can be opened at once without
+     * blocking the caller.  aopen_abandon is set if the gensio is
+     * closed while the thread is running, the result gets thrown
+     * away in that case.
+     */
+    bool async_open;
+    struct gensio_runner *aopen_runner;
+    struct gensio_thread *aopen_thread;
+    unsigned int aopen_waiters;
+    bool aopen_abandon;
+    bool aopen_done;
+    int aopen_err;
+    struct gensio_iod *aopen_iod;
 
     void *default_sercfg;
     int def_baud;
@@ -149,10 +166,33 @@ struct sterm_data {
     struct termio_op_q *termio_q;
     bool break_set;
     bool disablebreak;
+    bool lowlatency;
     unsigned int last_modemstate;
     unsigned int modemstate_mask;
     bool handling_modemstate;
+    bool modemstate_recheck;
     bool sent_first_modemstate;
+
+    /*
+     * A thread that waits for the modem lines to change so they can
+     * be reported right away.  If the device can't do that, poll
+     * once a second.
+     */
+    struct gensio_thread *mwait_thread;
+    bool mwait_done;
+    bool mwait_poll;
+
+    /*
+     * Read coalescing.  If rdco_size is set and less than that is
+     * waiting in the device, leave it there until rdco_time passes
+     * with no new characters coming in.
+     */
+    gensiods rdco_size;
+    gensio_time rdco_time;
+    struct gensio_timer *rdco_timer;
+    bool rdco_timer_running;
+    bool rdco_timer_stopped;
+    gensiods rdco_last;
 };
 
 static int
@@ -589,12 +629,16 @@ serialdev_timeout(struct gensio_timer *t, void *cb_data)
 
     sterm_lock(sdata);
     if (sdata->handling_modemstate || !sdata->open) {
+	if (sdata->handling_modemstate)
+	    sdata->modemstate_recheck = true;
 	sterm_unlock(sdata);
 	return;
     }
     sdata->handling_modemstate = true;
+    sdata->modemstate_recheck = false;
     sterm_unlock(sdata);
 
+ recheck:
     rv = sdata->o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_MODEMSTATE,
 			       true, (intptr_t) &modemstate);
     if (rv)
@@ -621,17 +665,69 @@ serialdev_timeout(struct gensio_timer *t, void *cb_data)
     }
 
  out_restart:
-    if (sdata->modemstate_mask) {
+    sterm_lock(sdata);
+    if (sdata->modemstate_recheck && sdata->open) {
+	sdata->modemstate_recheck = false;
+	sterm_unlock(sdata);
+	goto recheck;
+    }
+    if (sdata->modemstate_mask &&
+		(!sdata->mwait_thread || sdata->mwait_poll)) {
 	gensio_time timeout = {1, 0};
 
 	sdata->o->start_timer(sdata->timer, &timeout);
     }
+    sdata->handling_modemstate = false;
+    sterm_unlock(sdata);
+}
+
+static void
+serialdev_mwait_thread(void *data)
+{
+    struct sterm_data *sdata = data;
+    struct gensio_os_funcs *o = sdata->o;
+    gensio_time timeout = {0, 0};
+    int rv;
+
+    for (;;) {
+	rv = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_MODEMSTATE_WAIT,
+			    true, 0);
+	if (rv)
+	    break;
+	sterm_lock(sdata);
+	if (sdata->open && sdata->modemstate_mask)
+	    o->start_timer(sdata->timer, &timeout);
+	sterm_unlock(sdata);
+    }
 
     sterm_lock(sdata);
-    sdata->handling_modemstate = false;
+    if (rv != GE_INTERRUPTED && sdata->open) {
+	/* Can't wait for changes, poll for them instead. */
+	sdata->mwait_poll = true;
+	o->start_timer(sdata->timer, &timeout);
+    }
+    sdata->mwait_done = true;
     sterm_unlock(sdata);
 }
 
+/* Must be called with the lock held. */
+static void
+serialdev_start_mwait(struct sterm_data *sdata)
+{
+    int rv;
+
+    if (sdata->mwait_thread || sdata->mwait_poll || !sdata->open)
+	return;
+
+    sdata->mwait_done = false;
+    rv = gensio_os_new_thread(sdata->o, serialdev_mwait_thread, sdata,
+			      &sdata->mwait_thread);
+    if (rv) {
+	sdata->mwait_thread = NULL;
+	sdata->mwait_poll = true;
+    }
+}
+
 static int
 sterm_modemstate(struct sergensio *sio, unsigned int val)
 {
@@ -641,6 +737,8 @@ sterm_modemstate(struct sergensio *sio, unsigned int val)
     sterm_lock(sdata);
     sdata->modemstate_mask = val;
     sdata->sent_first_modemstate = false;
+    if (val)
+	serialdev_start_mwait(sdata);
     sterm_unlock(sdata);
 
     /* Cause an immediate send of the modemstate. */
@@ -752,6 +850,17 @@ sterm_timer_stopped(struct gensio_timer *timer, void *cb_data)
     sdata->timer_stopped = true;
 }
 
+static void
+sterm_rdco_timer_stopped(struct gensio_timer *timer, void *cb_data)
+{
+    struct sterm_data *sdata = cb_data;
+
+    sdata->rdco_timer_stopped = true;
+}
+
+static void sterm_discard_open(struct sterm_data *sdata,
+			       struct gensio_iod **iod);
+
 static int
 sterm_check_close_drain(void *handler_data, struct gensio_iod *iod,
 			enum gensio_ll_close_state state,
@@ -769,6 +878,23 @@ sterm_check_close_drain(void *handler_data, struct gensio_iod *iod,
 					    sterm_timer_stopped, sdata);
 	if (rv)
 	    sdata->timer_stopped = true;
+	if (sdata->rdco_timer) {
+	    rv = o->stop_timer_with_done(sdata->rdco_timer,
+					 sterm_rdco_timer_stopped, sdata);
+	    if (rv)
+		sdata->rdco_timer_stopped = true;
+	}
+	if (sdata->mwait_thread)
+	    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_MODEMSTATE_WAIT,
+			   false, 1);
+	if (sdata->aopen_thread) {
+	    sdata->aopen_abandon = true;
+	} else if (sdata->aopen_done) {
+	    /* Closed between the open finishing and it being used. */
+	    sdata->aopen_done = false;
+	    if (sdata->aopen_iod)
+		sterm_discard_open(sdata, &sdata->aopen_iod);
+	}
 
 	sdata->last_close_outq_count = 0;
     }
@@ -783,9 +909,23 @@ sterm_check_close_drain(void *handler_data, struct gensio_iod *iod,
     if (!sdata->timer_stopped)
 	goto out_einprogress;
 
+    if (sdata->rdco_timer && !sdata->rdco_timer_stopped)
+	goto out_einprogress;
+
     if (sdata->handling_modemstate)
 	goto out_einprogress;
 
+    if (sdata->mwait_thread) {
+	if (!sdata->mwait_done) {
+	    /* The stop can race with the wait starting, so repeat it. */
+	    o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_MODEMSTATE_WAIT,
+			   false, 1);
+	    goto out_einprogress;
+	}
+	gensio_os_wait_thread(sdata->mwait_thread);
+	sdata->mwait_thread = NULL;
+    }
+
     rv = o->bufcount(sdata->iod, GENSIO_OUT_BUF, &count);
     if (rv || count <= 0)
 	goto out_rm_uucp;
@@ -863,13 +1003,18 @@ is_a_pty(const char *ttyname)
 #endif
 }
 
+/*
+ * Lock, open, and configure the device.  This does all the things
+ * that can block, so it may be run in its own thread for async-open
+ * and must not touch anything in sdata but the configuration.
+ */
 static int
-sterm_sub_open(void *handler_data, struct gensio_iod **riod)
+sterm_open_dev(struct sterm_data *sdata, struct gensio_iod **riod)
 {
-    struct sterm_data *sdata = handler_data;
     struct gensio_os_funcs *o = sdata->o;
+    struct gensio_iod *iod = NULL;
     int err;
-    int options;
+    int options = 0;
 
     if (!sdata->no_uucp_lock) {
 	err = uucp_mk_lock(o, sdata->devname);
@@ -877,77 +1022,84 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
 	    goto out;
     }
 
-    sdata->timer_stopped = false;
-    sdata->iod = NULL; /* If it's a re-open make sure this is clear. */
-
     if (!sdata->read_only)
 	options = GENSIO_OPEN_OPTION_WRITEABLE;
     if (!sdata->write_only)
 	options |= GENSIO_OPEN_OPTION_READABLE;
-    err = o->open_dev(o, sdata->devname, options, &sdata->iod);
+    err = o->open_dev(o, sdata->devname, options, &iod);
     if (err)
 	goto out_uucp;
 
+    if (sdata->flock) {
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_EXCL_LOCK, false, 1);
+	if (err == GE_INUSE)
+	    gensio_log(o, GENSIO_LOG_ERR,
+		       "serialdev: %s is locked by another user",
+		       sdata->devname);
+	if (err)
+	    goto out_uucp;
+    }
+
     if (sdata->set_tty) {
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_BAUD, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_BAUD, false,
 			     sdata->def_baud);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_PARITY, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_PARITY, false,
 			     sdata->def_parity);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_XONXOFF, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_XONXOFF, false,
 			     sdata->def_xonxoff);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_IXONXOFF, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_IXONXOFF, false,
 			     sdata->def_xonxoff);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RTSCTS, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_RTSCTS, false,
 			     sdata->def_rtscts);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_DATASIZE, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_DATASIZE, false,
 			     sdata->def_datasize);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_STOPBITS, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_STOPBITS, false,
 			     sdata->def_stopbits);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_LOCAL, false,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_LOCAL, false,
 			     sdata->def_local);
 	if (err)
 	    goto out_uucp;
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_HANGUP_ON_DONE,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_HANGUP_ON_DONE,
 			     false, sdata->def_hupcl);
 	if (err)
 	    goto out_uucp;
 	if (sdata->rs485) {
-	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RS485, false,
+	    err = o->iod_control(iod, GENSIO_IOD_CONTROL_RS485, false,
 				 (intptr_t) sdata->rs485);
 	    if (err)
 		goto out_uucp;
 	}
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_APPLY, false, 0);
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_APPLY, false, 0);
 	if (err)
 	    goto out_uucp;
 	if (sdata->rts_set && sdata->rts_first) {
-	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RTS, false,
+	    err = o->iod_control(iod, GENSIO_IOD_CONTROL_RTS, false,
 				 sdata->rts_val);
 	    if (err)
 		goto out_uucp;
 	}
 	if (sdata->dtr_set) {
-	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_DTR, false,
+	    err = o->iod_control(iod, GENSIO_IOD_CONTROL_DTR, false,
 				 sdata->dtr_val);
 	    if (err)
 		goto out_uucp;
 	}
 	if (sdata->rts_set && !sdata->rts_first) {
-	    err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_RTS, false,
+	    err = o->iod_control(iod, GENSIO_IOD_CONTROL_RTS, false,
 				 sdata->rts_val);
 	    if (err)
 		goto out_uucp;
@@ -955,7 +1107,7 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
     }
 
     if (sdata->set_tty && !sdata->disablebreak) {
-	err = o->iod_control(sdata->iod, GENSIO_IOD_CONTROL_SET_BREAK,
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_SET_BREAK,
 			     false, sdata->disablebreak);
 	if (err)
 	    gensio_log(o, GENSIO_LOG_WARNING,
@@ -971,16 +1123,18 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
 	 */
     }
 
-    sterm_lock(sdata);
-    sdata->open = true;
-    sdata->sent_first_modemstate = false;
-    sterm_unlock(sdata);
-
-    if (sdata->set_tty)
-	sterm_modemstate(sdata->sio, 255);
-
-    *riod = sdata->iod;
+    if (sdata->set_tty && sdata->lowlatency) {
+	err = o->iod_control(iod, GENSIO_IOD_CONTROL_LOW_LATENCY,
+			     false, 1);
+	/* Like break, many devices can't do this, so don't fail. */
+	if (err)
+	    gensio_log(o, GENSIO_LOG_WARNING,
+		       "serialdev: "
+		       "Setting low latency failed on %s: %s",
+		       sdata->devname, gensio_err_to_str(err));
+    }
 
+    *riod = iod;
     return 0;
 
  out_uucp:
@@ -991,13 +1145,141 @@ sterm_sub_open(void *handler_data, struct gensio_iod **riod)
     if (sdata->is_pty && err == GE_IOERR)
 	err = GE_REMCLOSE;
  out:
-    if (sdata->iod) {
-	o->close(&sdata->iod);
-	sdata->iod = NULL;
+    if (iod)
+	o->close(&iod);
+    return err;
+}
+
+/* Close a device opened by sterm_open_dev() that nobody wants. */
+static void
+sterm_discard_open(struct sterm_data *sdata, struct gensio_iod **iod)
+{
+    sdata->o->close(iod);
+    if (!sdata->no_uucp_lock)
+	uucp_rm_lock(sdata->devname);
+}
+
+static void
+sterm_aopen_thread(void *data)
+{
+    struct sterm_data *sdata = data;
+    struct gensio_iod *iod = NULL;
+    int err;
+
+    err = sterm_open_dev(sdata, &iod);
+    sterm_lock(sdata);
+    sdata->aopen_err = err;
+    sdata->aopen_iod = iod;
+    sdata->aopen_done = true;
+    sterm_unlock(sdata);
+    sdata->o->run(sdata->aopen_runner);
+}
+
+static void
+sterm_aopen_done(struct gensio_runner *runner, void *cb_data)
+{
+    struct sterm_data *sdata = cb_data;
+    struct gensio_ll *ll = sdata->ll;
+    unsigned int waiters;
+
+    gensio_os_wait_thread(sdata->aopen_thread);
+    sterm_lock(sdata);
+    sdata->aopen_thread = NULL;
+    if (sdata->aopen_abandon) {
+	/* Closed while opening, nobody will pick this up. */
+	sdata->aopen_abandon = false;
+	sdata->aopen_done = false;
+	if (sdata->aopen_iod)
+	    sterm_discard_open(sdata, &sdata->aopen_iod);
     }
+    waiters = sdata->aopen_waiters;
+    sdata->aopen_waiters = 0;
+    sterm_unlock(sdata);
+
+    /* The last of these may free sdata, don't touch it after this. */
+    while (waiters--)
+	gensio_fd_ll_open_continue(ll);
+}
+
+/*
+ * Open the device for async-open.  Returns GE_INPROGRESS if the open
+ * is running in a thread, sterm_aopen_done() will continue the open
+ * when it finishes.
+ */
+static int
+sterm_async_open(struct sterm_data *sdata, struct gensio_iod **riod)
+{
+    struct gensio_os_funcs *o = sdata->o;
+    int err;
+
+    sterm_lock(sdata);
+    if (sdata->aopen_thread) {
+	/* Reopened while the last open was still running, use it. */
+	sdata->aopen_abandon = false;
+	sdata->aopen_waiters++;
+	err = GE_INPROGRESS;
+    } else if (sdata->aopen_done) {
+	sdata->aopen_done = false;
+	err = sdata->aopen_err;
+	*riod = sdata->aopen_iod;
+	sdata->aopen_iod = NULL;
+    } else {
+	/*
+	 * The open thread finishes with a runner, which needs the os
+	 * handler to be able to wake a selector thread from another
+	 * thread.  Without a wake signal it can't.
+	 */
+	if (o->get_wake_sig && o->get_wake_sig(o) == 0)
+	    err = GE_NOTSUP;
+	else
+	    err = gensio_os_new_thread(o, sterm_aopen_thread, sdata,
+				       &sdata->aopen_thread);
+	if (!err) {
+	    sdata->aopen_waiters++;
+	    err = GE_INPROGRESS;
+	}
+    }
+    sterm_unlock(sdata);
+
+    if (err == GE_NOTSUP)
+	/* Can't use a thread, just do it here. */
+	err = sterm_open_dev(sdata, riod);
+
     return err;
 }
 
+static int
+sterm_sub_open(void *handler_data, struct gensio_iod **riod)
+{
+    struct sterm_data *sdata = handler_data;
+    int err;
+
+    sdata->timer_stopped = false;
+    sdata->rdco_timer_stopped = false;
+    sdata->rdco_timer_running = false;
+    sdata->mwait_poll = false;
+    sdata->iod = NULL; /* If it's a re-open make sure this is clear. */
+
+    if (sdata->async_open)
+	err = sterm_async_open(sdata, &sdata->iod);
+    else
+	err = sterm_open_dev(sdata, &sdata->iod);
+    if (err)
+	return err;
+
+    sterm_lock(sdata);
+    sdata->open = true;
+    sdata->sent_first_modemstate = false;
+    sterm_unlock(sdata);
+
+    if (sdata->set_tty)
+	sterm_modemstate(sdata->sio, 255);
+
+    *riod = sdata->iod;
+
+    return 0;
+}
+
 static void
 sterm_free(void *handler_data)
 {
@@ -1012,10 +1294,16 @@ sterm_free(void *handler_data)
 	sdata->o->free_lock(sdata->lock);
     if (sdata->timer)
 	sdata->o->free_timer(sdata->timer);
+    if (sdata->rdco_timer)
+	sdata->o->free_timer(sdata->rdco_timer);
     if (sdata->devname)
 	sdata->o->free(sdata->o, sdata->devname);
     if (sdata->deferred_op_runner)
 	sdata->o->free_runner(sdata->deferred_op_runner);
+    if (sdata->aopen_iod)
+	sterm_discard_open(sdata, &sdata->aopen_iod);
+    if (sdata->aopen_runner)
+	sdata->o->free_runner(sdata->aopen_runner);
     sdata->o->free(sdata->o, sdata);
 }
 
@@ -1190,11 +1478,72 @@ sterm_do_read(struct gensio_iod *iod, void *data, gensiods count, gensiods *rcou
     return rv;
 }
 
+static void
+sterm_rdco_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct sterm_data *sdata = cb_data;
+    struct gensio_os_funcs *o = sdata->o;
+    gensiods count;
+
+    sterm_lock(sdata);
+    if (!sdata->open) {
+	sdata->rdco_timer_running = false;
+	sterm_unlock(sdata);
+	return;
+    }
+    if (o->bufcount(sdata->iod, GENSIO_IN_BUF, &count) == 0 &&
+		count > sdata->rdco_last && count < sdata->rdco_size) {
+	/* Characters are still coming in, wait for a gap. */
+	sdata->rdco_last = count;
+	o->start_timer(sdata->rdco_timer, &sdata->rdco_time);
+	sterm_unlock(sdata);
+	return;
+    }
+    sdata->rdco_timer_running = false;
+    sterm_unlock(sdata);
+
+    gensio_fd_ll_handle_incoming(sdata->ll, sterm_do_read, NULL, sdata);
+}
+
+/*
+ * If coalescing reads and not enough is waiting, turn off the read
+ * handler and let the timer do the read later.  Returns true if the
+ * read should be done now.
+ */
+static bool
+sterm_rdco_check(struct sterm_data *sdata, struct gensio_iod *iod)
+{
+    struct gensio_os_funcs *o = sdata->o;
+    gensiods count;
+    bool rv = true;
+
+    sterm_lock(sdata);
+    if (sdata->rdco_timer_running) {
+	o->set_read_handler(iod, false);
+	rv = false;
+    } else if (sdata->open && o->bufcount(iod, GENSIO_IN_BUF, &count) == 0 &&
+	       count > 0 && count < sdata->rdco_size) {
+	/* If count is zero, let the read report the error or close. */
+	sdata->rdco_last = count;
+	if (o->start_timer(sdata->rdco_timer, &sdata->rdco_time) == 0) {
+	    sdata->rdco_timer_running = true;
+	    o->set_read_handler(iod, false);
+	    rv = false;
+	}
+    }
+    sterm_unlock(sdata);
+
+    return rv;
+}
+
 static void
 sterm_read_ready(void *handler_data, struct gensio_iod *iod)
 {
     struct sterm_data *sdata = handler_data;
 
+    if (sdata->rdco_size && !sterm_rdco_check(sdata, iod))
+	return;
+
     gensio_fd_ll_handle_incoming(sdata->ll, sterm_do_read, NULL, sdata);
 }
 
@@ -1310,6 +1659,9 @@ sergensio_process_parms(struct gensio_pparm_info *p, struct sterm_data *sdata)
 	} else if (gensio_pparm_bool(p, argv[i], "nobreak",
 				     &sdata->disablebreak) > 0) {
 	    continue;
+	} else if (gensio_pparm_bool(p, argv[i], "lowlatency",
+				     &sdata->lowlatency) > 0) {
+	    continue;
 	} else if (gensio_pparm_value(p, argv[i], "rs485", &str) > 0) {
 	    if (sdata->rs485)
 		sdata->o->free(sdata->o, sdata->rs485);
@@ -1433,6 +1785,11 @@ iodev_gensio_alloc(const void *gdata, const char * const args[],
 	if (err)
 	    goto out_err;
 	sdata->no_uucp_lock = ival;
+	err = gensio_get_default(o, "sergensio", "flock", false,
+				 GENSIO_DEFAULT_BOOL, NULL, &ival);
+	if (err)
+	    goto out_err;
+	sdata->flock = ival;
     }
     err = gensio_get_default(o, "sergensio", "drain_time", false,
 			     GENSIO_DEFAULT_INT, NULL, &sdata->drain_time);
@@ -1442,6 +1799,11 @@ iodev_gensio_alloc(const void *gdata, const char * const args[],
 			     GENSIO_DEFAULT_INT, NULL, &sdata->char_drain_wait);
     if (err)
 	goto out_err;
+    err = gensio_get_default(o, "sergensio", "async-open", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (err)
+	goto out_err;
+    sdata->async_open = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_pparm_ds(&p, args[i], "readbuf", &max_read_size) > 0)
@@ -1450,6 +1812,11 @@ iodev_gensio_alloc(const void *gdata, const char * const args[],
 	    continue;
 	if (gensio_pparm_bool(&p, args[i], "rdonly", &rdonly) > 0)
 	    continue;
+	if (gensio_pparm_ds(&p, args[i], "rdcoalesce", &sdata->rdco_size) > 0)
+	    continue;
+	if (gensio_pparm_time(&p, args[i], "rdcoalesce_time", 'u',
+			      &sdata->rdco_time) > 0)
+	    continue;
 	if (gensio_pparm_value(&p, args[i], "drain_time", &s) > 0) {
 	    if (strcmp(s, "off") == 0) {
 		sdata->drain_time = -1;
@@ -1475,6 +1842,12 @@ iodev_gensio_alloc(const void *gdata, const char * const args[],
 	    nouucplock_set = true;
 	    continue;
 	}
+	if (set_tty && gensio_pparm_bool(&p, args[i], "flock",
+					 &sdata->flock) > 0)
+	    continue;
+	if (gensio_pparm_bool(&p, args[i], "async-open",
+			      &sdata->async_open) > 0)
+	    continue;
 	/* custspeed is ignored now */
 	if (gensio_pparm_bool(&p, args[i], "custspeed", &dummy) > 0)
 	    continue;
@@ -1494,6 +1867,14 @@ iodev_gensio_alloc(const void *gdata, const char * const args[],
     if (!sdata->timer)
 	goto out_nomem;
 
+    if (sdata->rdco_size) {
+	if (sdata->rdco_time.secs == 0 && sdata->rdco_time.nsecs == 0)
+	    sdata->rdco_time.nsecs = 5000000;
+	sdata->rdco_timer = o->alloc_timer(o, sterm_rdco_timeout, sdata);
+	if (!sdata->rdco_timer)
+	    goto out_nomem;
+    }
+
     sdata->devname = gensio_strdup(o, devname);
     if (!sdata->devname)
 	goto out_nomem;
@@ -1546,6 +1927,12 @@ iodev_gensio_alloc(const void *gdata, const char * const args[],
     if (!sdata->deferred_op_runner)
 	goto out_nomem;
 
+    if (sdata->async_open) {
+	sdata->aopen_runner = o->alloc_runner(o, sterm_aopen_done, sdata);
+	if (!sdata->aopen_runner)
+	    goto out_nomem;
+    }
+
     sdata->lock = o->alloc_lock(o);
     if (!sdata->lock)
 	goto out_nomem;
@@ -466,6 +466,16 @@ sergensio_stel_func(struct sergensio *sio, int op, int val, char *buf,
     case SERGENSIO_FUNC_SEND_BREAK:
 	return stel_send_break(sio);
 
+    case SERGENSIO_FUNC_BATCH_START:
+    case SERGENSIO_FUNC_BATCH_END:
+	{
+	    struct stel_data *sdata = sergensio_get_gensio_data(sio);
+
+	    sdata->rops->hold_output(sdata->filter,
+				     op == SERGENSIO_FUNC_BATCH_START);
+	    return 0;
+	}
+
     default:
 	return GE_NOTSUP;
     }
@@ -0,0 +1,621 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * Shared capture.  All the sound gensios that ask to share input from
+ * the same device with the same parameters get it from one capture
+ * stream.  The device is run by an internal sound ll that has no
+ * gensio on top of it.  Each block it reads is converted to the user
+ * format once and put in a ring of num_bufs blocks, and each user
+ * reads blocks straight out of the ring at its own position.  A user
+ * that falls a whole ring behind loses the oldest data, like an
+ * overrun on the device.
+ *
+ * The users' sound lls all use the share's lock, so the device side
+ * can wake them up directly.  The share list and the share refcounts
+ * are protected by sound_share_list_lock.  The lock order is
+ * sound_share_list_lock, then a share's lock, then the device ll's
+ * lock.
+ */
+
+#include <gensio/gensio_list.h>
+
+enum sound_share_state {
+    SOUND_SHARE_CLOSED,
+    SOUND_SHARE_OPEN,
+    SOUND_SHARE_IN_CLOSE
+};
+
+struct sound_share {
+    struct gensio_link link;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+
+    /* These must match for a user to use this share. */
+    char *type;
+    char *devname;
+    unsigned int chans;
+    unsigned int samplerate;
+    gensiods bufsize;
+    unsigned int num_bufs;
+    char *format;
+    char *pformat;
+    bool mmap;
+
+    struct gensio_ll *devll;
+    struct sound_ll *dev;
+    enum sound_share_state state;
+    bool free_on_close;
+    int err;
+
+    unsigned char *ring;
+    gensiods blocksize; /* Size of one ring block in bytes. */
+    uint64_t produced; /* Number of blocks put in the ring. */
+    gensiods fill; /* Bytes in the block being filled. */
+    bool skip_block; /* The block being filled can't be stored. */
+
+    struct gensio_list users;
+    unsigned int nr_users;
+};
+
+/* The pinfo for a user's input. */
+struct share_info {
+    struct gensio_link link;
+    struct sound_share *share;
+    struct sound_info *si;
+    bool attached;
+    bool have_block; /* The user has a ring block in si->buf. */
+    uint64_t consumed; /* Number of the next block to read. */
+};
+
+static struct gensio_os_funcs *sound_share_o;
+static struct gensio_lock *sound_share_list_lock;
+static struct gensio_list sound_shares;
+
+static bool
+share_str_match(const char *s1, const char *s2)
+{
+    if (!s1 || !s2)
+	return s1 == s2;
+    return strcmp(s1, s2) == 0;
+}
+
+static void
+sound_share_free(struct sound_share *share)
+{
+    struct gensio_os_funcs *o = share->o;
+
+    if (share->devll)
+	gensio_ll_free(share->devll);
+    if (share->ring)
+	o->free(o, share->ring);
+    if (share->type)
+	o->free(o, share->type);
+    if (share->devname)
+	o->free(o, share->devname);
+    if (share->format)
+	o->free(o, share->format);
+    if (share->pformat)
+	o->free(o, share->pformat);
+    if (share->lock)
+	o->free_lock(share->lock);
+    o->free(o, share);
+}
+
+/*
+ * Must be called with the share lock held.  Give the user the next
+ * block from the ring, if there is one.
+ */
+static void
+sound_share_user_next(struct share_info *pi)
+{
+    struct sound_share *share = pi->share;
+    struct sound_info *si = pi->si;
+    struct sound_ll *soundll = si->soundll;
+
+    if (si->ready || soundll->err)
+	return;
+    if (share->err) {
+	soundll->err = share->err;
+	return;
+    }
+    if (pi->consumed >= share->produced)
+	return;
+    if (share->produced - pi->consumed > share->num_bufs) {
+	/* Fell too far behind, skip to the oldest block still there. */
+	pi->consumed = share->produced - share->num_bufs;
+	soundll->overflows++;
+    }
+    si->buf = share->ring + ((pi->consumed % share->num_bufs) *
+			     share->blocksize);
+    si->readpos = 0;
+    si->len = si->bufsize;
+    si->ready = true;
+    pi->have_block = true;
+}
+
+/* Must be called with the share lock held. */
+static void
+sound_share_wake_users(struct sound_share *share)
+{
+    struct gensio_link *l;
+    struct share_info *pi;
+    struct sound_ll *soundll;
+
+    gensio_list_for_each(&share->users, l) {
+	pi = gensio_container_of(l, struct share_info, link);
+	soundll = pi->si->soundll;
+	if (!soundll->read_enabled)
+	    continue;
+	sound_share_user_next(pi);
+	if (pi->si->ready || soundll->err)
+	    gensio_sound_sched_deferred_op(soundll);
+    }
+}
+
+/*
+ * Must be called with the share lock held.  Is the ring block the
+ * device is about to fill still being read by a user?  If a user is
+ * just sitting on it, take it away, that user has overrun.  It can't
+ * be taken from a user that is in its read callback.
+ */
+static bool
+sound_share_block_busy(struct sound_share *share)
+{
+    struct gensio_link *l;
+    struct share_info *pi;
+    bool busy = false;
+
+    if (share->produced < share->num_bufs)
+	return false;
+    gensio_list_for_each(&share->users, l) {
+	pi = gensio_container_of(l, struct share_info, link);
+	if (!pi->have_block ||
+		pi->consumed != share->produced - share->num_bufs)
+	    continue;
+	if (pi->si->soundll->in_read) {
+	    busy = true;
+	} else {
+	    pi->have_block = false;
+	    pi->consumed++;
+	    pi->si->ready = false;
+	    pi->si->len = 0;
+	    pi->si->readpos = 0;
+	    pi->si->soundll->overflows++;
+	}
+    }
+    return busy;
+}
+
+/* Must be called with the share lock held. */
+static void
+sound_share_dev_err(struct sound_share *share, int err)
+{
+    if (!share->err)
+	share->err = err;
+    sound_share_wake_users(share);
+}
+
+/* Data from the device, already in the user format. */
+static gensiods
+sound_share_dev_cb(void *cb_data, int op, int val,
+		   void *buf, gensiods buflen,
+		   const char *const *auxdata)
+{
+    struct sound_share *share = cb_data;
+    unsigned char *data = buf;
+    gensiods left = buflen, len;
+
+    if (op != GENSIO_LL_CB_READ)
+	return 0;
+
+    share->o->lock(share->lock);
+    if (val) {
+	sound_share_dev_err(share, val);
+	gensio_ll_set_read_callback(share->devll, false);
+	goto out_unlock;
+    }
+    while (left > 0) {
+	if (share->fill == 0)
+	    share->skip_block = sound_share_block_busy(share);
+	len = share->blocksize - share->fill;
+	if (len > left)
+	    len = left;
+	if (!share->skip_block)
+	    memcpy(share->ring + ((share->produced % share->num_bufs) *
+				  share->blocksize) + share->fill,
+		   data, len);
+	share->fill += len;
+	data += len;
+	left -= len;
+	if (share->fill == share->blocksize) {
+	    share->fill = 0;
+	    if (!share->skip_block)
+		share->produced++;
+	}
+    }
+    sound_share_wake_users(share);
+ out_unlock:
+    share->o->unlock(share->lock);
+    return buflen;
+}
+
+static void
+sound_share_dev_open_done(void *cb_data, int err, void *open_data)
+{
+    struct sound_share *share = cb_data;
+
+    share->o->lock(share->lock);
+    if (err)
+	sound_share_dev_err(share, err);
+    share->o->unlock(share->lock);
+}
+
+/* Must be called with the share lock held. */
+static int
+sound_share_dev_open(struct sound_share *share)
+{
+    int err;
+
+    share->err = 0;
+    share->fill = 0;
+    err = gensio_ll_open(share->devll, sound_share_dev_open_done, NULL);
+    if (err)
+	return err;
+    share->state = SOUND_SHARE_OPEN;
+    gensio_ll_set_read_callback(share->devll, true);
+    return 0;
+}
+
+static void
+sound_share_dev_close_done(void *cb_data, void *close_data)
+{
+    struct sound_share *share = cb_data;
+    int err;
+
+    share->o->lock(share->lock);
+    share->state = SOUND_SHARE_CLOSED;
+    if (share->free_on_close) {
+	share->o->unlock(share->lock);
+	sound_share_free(share);
+	return;
+    }
+    if (share->nr_users > 0) {
+	/* Someone opened while it was closing. */
+	err = sound_share_dev_open(share);
+	if (err)
+	    sound_share_dev_err(share, err);
+    }
+    share->o->unlock(share->lock);
+}
+
+/* Must be called with the share lock held. */
+static void
+sound_share_dev_close(struct sound_share *share)
+{
+    int err;
+
+    if (share->state != SOUND_SHARE_OPEN)
+	return;
+    err = gensio_ll_close(share->devll, sound_share_dev_close_done, NULL);
+    if (err)
+	share->state = SOUND_SHARE_CLOSED;
+    else
+	share->state = SOUND_SHARE_IN_CLOSE;
+}
+
+/* Must be called with the share lock held. */
+static void
+sound_share_detach(struct share_info *pi)
+{
+    struct sound_share *share = pi->share;
+
+    if (!pi->attached)
+	return;
+    gensio_list_rm(&share->users, &pi->link);
+    pi->attached = false;
+    pi->have_block = false;
+    pi->si->ready = false;
+    pi->si->buf = NULL;
+    pi->si->len = 0;
+    if (--share->nr_users == 0)
+	sound_share_dev_close(share);
+}
+
+static void
+sound_share_deref(struct sound_share *share)
+{
+    bool do_free = false;
+
+    sound_share_o->lock(sound_share_list_lock);
+    assert(share->refcount > 0);
+    if (--share->refcount == 0) {
+	gensio_list_rm(&sound_shares, &share->link);
+	share->o->lock(share->lock);
+	if (share->state == SOUND_SHARE_CLOSED)
+	    do_free = true;
+	else
+	    share->free_on_close = true;
+	share->o->unlock(share->lock);
+    }
+    sound_share_o->unlock(sound_share_list_lock);
+    if (do_free)
+	sound_share_free(share);
+}
+
+static struct sound_share *
+sound_share_alloc(struct gensio_pparm_info *p, struct gensio_os_funcs *o,
+		  struct gensio_sound_info *io, gensiods framesize, int *rerr)
+{
+    struct sound_share *share;
+    struct gensio_sound_info devio = *io;
+    int err = GE_NOMEM;
+
+    share = o->zalloc(o, sizeof(*share));
+    if (!share)
+	goto out_err;
+    share->o = o;
+    share->refcount = 1;
+    gensio_list_init(&share->users);
+    share->chans = io->chans;
+    share->samplerate = io->samplerate;
+    share->bufsize = io->bufsize;
+    share->num_bufs = io->num_bufs;
+    share->mmap = io->mmap;
+    share->blocksize = io->bufsize * framesize;
+
+    share->lock = o->alloc_lock(o);
+    if (!share->lock)
+	goto out_err;
+    if (io->type) {
+	share->type = gensio_strdup(o, io->type);
+	if (!share->type)
+	    goto out_err;
+    }
+    share->devname = gensio_strdup(o, io->devname);
+    if (!share->devname)
+	goto out_err;
+    share->format = gensio_strdup(o, io->format);
+    if (!share->format)
+	goto out_err;
+    if (io->pformat) {
+	share->pformat = gensio_strdup(o, io->pformat);
+	if (!share->pformat)
+	    goto out_err;
+    }
+    share->ring = o->zalloc(o, share->blocksize * share->num_bufs);
+    if (!share->ring)
+	goto out_err;
+
+    devio.share = false;
+    err = gensio_sound_ll_alloc(p, o, &devio, NULL, &share->devll);
+    if (err)
+	goto out_err;
+    share->dev = ll_to_sound(share->devll);
+    gensio_ll_set_callback(share->devll, sound_share_dev_cb, share);
+
+    return share;
+
+ out_err:
+    if (share)
+	sound_share_free(share);
+    *rerr = err;
+    return NULL;
+}
+
+static int
+gensio_sound_share_api_setup(struct gensio_pparm_info *p,
+			     struct sound_info *si,
+			     struct gensio_sound_info *io)
+{
+    struct gensio_os_funcs *o = si->soundll->o;
+    struct gensio_link *l;
+    struct sound_share *share = NULL;
+    struct share_info *pi;
+    int err = 0;
+
+    if (!sound_share_list_lock)
+	return GE_NOTSUP;
+
+    pi = o->zalloc(o, sizeof(*pi));
+    if (!pi)
+	return GE_NOMEM;
+    pi->si = si;
+
+    sound_share_o->lock(sound_share_list_lock);
+    gensio_list_for_each(&sound_shares, l) {
+	share = gensio_container_of(l, struct sound_share, link);
+	if (share->o == o &&
+		share_str_match(share->type, io->type) &&
+		strcmp(share->devname, io->devname) == 0 &&
+		share->chans == io->chans &&
+		share->samplerate == io->samplerate &&
+		share->bufsize == io->bufsize &&
+		share->num_bufs == io->num_bufs &&
+		strcmp(share->format, io->format) == 0 &&
+		share_str_match(share->pformat, io->pformat) &&
+		share->mmap == io->mmap) {
+	    share->refcount++;
+	    break;
+	}
+	share = NULL;
+    }
+    if (!share) {
+	share = sound_share_alloc(p, o, io, si->framesize, &err);
+	if (share)
+	    gensio_list_add_tail(&sound_shares, &share->link);
+    }
+    sound_share_o->unlock(sound_share_list_lock);
+    if (!share) {
+	o->free(o, pi);
+	return err;
+    }
+    pi->share = share;
+
+    if (share->dev->in.cardname) {
+	si->cardname = gensio_strdup(o, share->dev->in.cardname);
+	if (!si->cardname) {
+	    sound_share_deref(share);
+	    o->free(o, pi);
+	    return GE_NOMEM;
+	}
+    }
+
+    si->pinfo = pi;
+    return 0;
+}
+
+static void
+gensio_sound_share_api_cleanup(struct sound_info *si)
+{
+    struct share_info *pi = si->pinfo;
+    struct gensio_os_funcs *o = si->soundll->o;
+
+    if (!pi)
+	return;
+    si->buf = NULL; /* It points into the ring. */
+    /* The sound ll was using the share's lock. */
+    si->soundll->lock = NULL;
+    sound_share_deref(pi->share);
+    o->free(o, pi);
+    si->pinfo = NULL;
+}
+
+/* Called with the share lock held. */
+static int
+gensio_sound_share_api_open_dev(struct sound_info *si)
+{
+    struct share_info *pi = si->pinfo;
+    struct sound_share *share = pi->share;
+    int err;
+
+    if (share->nr_users == 0 && share->state == SOUND_SHARE_CLOSED) {
+	err = sound_share_dev_open(share);
+	if (err)
+	    return err;
+    }
+    /* Start with new data. */
+    pi->consumed = share->produced;
+    pi->have_block = false;
+    si->ready = false;
+    si->buf = NULL;
+    si->len = 0;
+    gensio_list_add_tail(&share->users, &pi->link);
+    pi->attached = true;
+    share->nr_users++;
+    return 0;
+}
+
+static void
+gensio_sound_share_api_close_dev(struct sound_info *si)
+{
+    struct share_info *pi = si->pinfo;
+
+    if (!pi)
+	return;
+    pi->share->o->lock(pi->share->lock);
+    sound_share_detach(pi);
+    pi->share->o->unlock(pi->share->lock);
+}
+
+/* Called with the share lock held. */
+static unsigned int
+gensio_sound_share_api_start_close(struct sound_info *si)
+{
+    sound_share_detach(si->pinfo);
+    return 0;
+}
+
+/* Called with the share lock held when the user is done with a block. */
+static void
+gensio_sound_share_api_next_read(struct sound_info *si)
+{
+    struct share_info *pi = si->pinfo;
+
+    if (pi->have_block) {
+	pi->have_block = false;
+	pi->consumed++;
+    }
+    if (pi->attached)
+	sound_share_user_next(pi);
+}
+
+static void
+gensio_sound_share_api_set_read(struct sound_info *si, bool enable)
+{
+    struct share_info *pi = si->pinfo;
+
+    if (enable && pi->attached)
+	sound_share_user_next(pi);
+}
+
+static void
+gensio_sound_share_api_set_write(struct sound_info *si, bool enable)
+{
+}
+
+static int
+gensio_sound_share_api_latency(struct sound_info *si, gensiods *period,
+			       gensiods *buffer, long *delay)
+{
+    struct share_info *pi = si->pinfo;
+    struct sound_share *share = pi->share;
+    struct sound_info *dsi = &share->dev->in;
+    int err;
+
+    if (!dsi->type->latency)
+	return GE_NOTSUP;
+    err = dsi->type->latency(dsi, period, buffer, delay);
+    if (err)
+	return err;
+    /* Add what's waiting in the ring for this user. */
+    share->o->lock(share->lock);
+    if (pi->attached && share->produced > pi->consumed)
+	*delay += (share->produced - pi->consumed) * share->bufsize;
+    share->o->unlock(share->lock);
+    return 0;
+}
+
+static struct sound_type share_sound_type = {
+    "share",
+    .setup = gensio_sound_share_api_setup,
+    .cleanup = gensio_sound_share_api_cleanup,
+    .open_dev = gensio_sound_share_api_open_dev,
+    .close_dev = gensio_sound_share_api_close_dev,
+    .set_write_enable = gensio_sound_share_api_set_write,
+    .set_read_enable = gensio_sound_share_api_set_read,
+    .next_read = gensio_sound_share_api_next_read,
+    .start_close = gensio_sound_share_api_start_close,
+    .latency = gensio_sound_share_api_latency
+};
+
+static void
+gensio_sound_share_cleanup_mem(void)
+{
+    if (sound_share_list_lock)
+	sound_share_o->free_lock(sound_share_list_lock);
+    sound_share_list_lock = NULL;
+}
+
+static struct gensio_class_cleanup sound_share_class_cleanup = {
+    .cleanup = gensio_sound_share_cleanup_mem
+};
+
+int
+gensio_sound_ll_init(struct gensio_os_funcs *o)
+{
+    if (sound_share_list_lock)
+	return 0;
+    sound_share_o = o;
+    gensio_list_init(&sound_shares);
+    sound_share_list_lock = o->alloc_lock(o);
+    if (!sound_share_list_lock)
+	return GE_NOMEM;
+    gensio_register_class_cleanup(&sound_share_class_cleanup);
+    return 0;
+}
@@ -245,7 +245,18 @@ process_telnet_data(unsigned char *outdata, unsigned int outlen,
 	    td->telnet_cmd[td->telnet_cmd_pos++] = TN_IAC;
 	    td->suboption_iac = 0;
 	} else {
-	    outdata[j++] = indata[i];
+	    /* Pass everything up to the next IAC through in one piece. */
+	    unsigned int len = *inlen - i;
+	    unsigned char *iac;
+
+	    if (len > outlen - j)
+		len = outlen - j;
+	    iac = memchr(indata + i, TN_IAC, len);
+	    if (iac)
+		len = iac - (indata + i);
+	    memcpy(outdata + j, indata + i, len);
+	    j += len;
+	    i += len - 1; /* The loop increments i. */
 	}
     }
 
@@ -272,10 +283,21 @@ process_telnet_xmit(unsigned char *outdata, unsigned int outlen,
 	    outdata[j++] = TN_IAC;
 	    outlen -= 2;
 	} else {
+	    /* Copy everything up to the next IAC in one piece. */
+	    unsigned int len = inlen - i;
+	    const unsigned char *iac;
+
 	    if (outlen < 1)
 		break;
-	    outdata[j++] = ibuf[i];
-	    outlen--;
+	    if (len > outlen)
+		len = outlen;
+	    iac = memchr(ibuf + i, TN_IAC, len);
+	    if (iac)
+		len = iac - (ibuf + i);
+	    memcpy(outdata + j, ibuf + i, len);
+	    j += len;
+	    outlen -= len;
+	    i += len - 1; /* The loop increments i. */
 	}
     }
 
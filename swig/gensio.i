@@ -364,6 +364,23 @@ struct waiter { };
     ~gensio_os_funcs() {
 	check_os_funcs_free(self);
     }
+
+    /* Returns the fd to poll, the timeout in milliseconds is in r_int. */
+    long get_poll_info(long *r_int) {
+	struct gensio_poll_info info;
+	gensiods len = sizeof(info);
+	int rv;
+
+	*r_int = 0;
+	rv = self->control(self, GENSIO_CONTROL_POLL_INFO, &info, &len);
+	if (rv) {
+	    err_handle("get_poll_info", rv);
+	    return -1;
+	}
+	*r_int = info.timeout.secs * 1000 +
+	    (info.timeout.nsecs + 999999) / 1000000;
+	return info.fd;
+    }
 }
 
 %constant int GE_NOTSUP = GE_NOTSUP;
@@ -400,6 +417,7 @@ struct waiter { };
 %constant int GENSIO_CONTROL_CLOSE_OUTPUT = GENSIO_CONTROL_CLOSE_OUTPUT;
 %constant int GENSIO_CONTROL_CONNECT_ADDR_STR = GENSIO_CONTROL_CONNECT_ADDR_STR;
 %constant int GENSIO_CONTROL_RADDR = GENSIO_CONTROL_RADDR;
+%constant int GENSIO_CONTROL_CONN_STATS = GENSIO_CONTROL_CONN_STATS;
 %constant int GENSIO_CONTROL_RADDR_BIN = GENSIO_CONTROL_RADDR_BIN;
 %constant int GENSIO_CONTROL_REMOTE_ID = GENSIO_CONTROL_REMOTE_ID;
 %constant int GENSIO_CONTROL_KILL_TASK = GENSIO_CONTROL_KILL_TASK;
@@ -412,6 +430,7 @@ struct waiter { };
 %constant int GENSIO_CONTROL_EXTRAINFO = GENSIO_CONTROL_EXTRAINFO;
 %constant int GENSIO_CONTROL_ENABLE_OOB = GENSIO_CONTROL_ENABLE_OOB;
 %constant int GENSIO_CONTROL_WIN_SIZE = GENSIO_CONTROL_WIN_SIZE;
+%constant int GENSIO_CONTROL_WRITE_LATENCY = GENSIO_CONTROL_WRITE_LATENCY;
 
 %constant int GENSIO_NETTYPE_UNSPEC = GENSIO_NETTYPE_UNSPEC;
 %constant int GENSIO_NETTYPE_IPV4 = GENSIO_NETTYPE_IPV4;
@@ -553,12 +572,22 @@ struct waiter { };
 
     %rename(open_s) open_st;
     void open_st() {
-	err_handle("open_s", gensio_open_s(self));
+	int rv;
+
+	GENSIO_SWIG_C_BLOCK_ENTRY
+	rv = gensio_open_s(self);
+	GENSIO_SWIG_C_BLOCK_EXIT
+	err_handle("open_s", rv);
     }
 
     %rename(open_nochild_s) open_nochild_st;
     void open_nochild_st() {
-	err_handle("open_nochild_s", gensio_open_nochild_s(self));
+	int rv;
+
+	GENSIO_SWIG_C_BLOCK_ENTRY
+	rv = gensio_open_nochild_s(self);
+	GENSIO_SWIG_C_BLOCK_EXIT
+	err_handle("open_nochild_s", rv);
     }
 
     %newobject alloc_channelt;
@@ -614,7 +643,12 @@ struct waiter { };
 
     %rename(close_s) close_st;
     void close_st() {
-	err_handle("close_s", gensio_close_s(self));
+	int rv;
+
+	GENSIO_SWIG_C_BLOCK_ENTRY
+	rv = gensio_close_s(self);
+	GENSIO_SWIG_C_BLOCK_EXIT
+	err_handle("close_s", rv);
     }
 
     %rename(write) writet;
@@ -636,6 +670,37 @@ struct waiter { };
 	gensio_set_write_callback_enable(self, enable);
     }
 
+    void set_read_memoryview(bool enable) {
+	struct gensio_data *data = (struct gensio_data *)
+	    gensio_get_user_data(self);
+
+	data->read_memoryview = enable;
+    }
+
+    void set_read_batch(bool enable) {
+	struct gensio_data *data = (struct gensio_data *)
+	    gensio_get_user_data(self);
+	struct gensio_os_funcs *o = data->o;
+
+	if (enable && !data->batch_runner) {
+	    data->batch_lock = gensio_os_funcs_alloc_lock(o);
+	    if (!data->batch_lock) {
+		err_handle("set_read_batch", GE_NOMEM);
+		return;
+	    }
+	    data->batch_runner = gensio_os_funcs_alloc_runner(o,
+						gensio_py_deliver_reads, data);
+	    if (!data->batch_runner) {
+		gensio_os_funcs_free_lock(o, data->batch_lock);
+		data->batch_lock = NULL;
+		err_handle("set_read_batch", GE_NOMEM);
+		return;
+	    }
+	}
+	data->batch_io = self;
+	data->read_batch = enable;
+    }
+
     %rename(set_sync) set_synct;
     void set_synct() {
 	int rv = gensio_set_sync(self);
@@ -664,7 +729,9 @@ struct waiter { };
 	}
 	if (timeout < 0)
 	    rtv = NULL;
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_read_s(self, &count, buf, reqlen, rtv);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	if (rv) {
 	    free(buf);
 	} else {
@@ -695,7 +762,9 @@ struct waiter { };
 	}
 	if (timeout < 0)
 	    rtv = NULL;
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_read_s_intr(self, &count, buf, reqlen, rtv);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	if (rv) {
 	    free(buf);
 	} else {
@@ -720,7 +789,9 @@ struct waiter { };
 
 	if (timeout < 0)
 	    rtv = NULL;
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_write_s(self, &count, bytestr, len, rtv);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	err_handle("write_s", rv);
 	if (rtv)
 	    *r_int = rtv->secs * 1000 + ((rtv->nsecs + 500000) / 1000000);
@@ -740,7 +811,9 @@ struct waiter { };
 
 	if (timeout < 0)
 	    rtv = NULL;
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_write_s_intr(self, &count, bytestr, len, rtv);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	err_handle("write_s_intr", rv);
 	if (rtv)
 	    *r_int = rtv->secs * 1000 + ((rtv->nsecs + 500000) / 1000000);
@@ -820,6 +893,11 @@ struct waiter { };
 	return gensio_is_reliable(self);
     }
 
+    %rename(is_message) is_messaget;
+    bool is_messaget() {
+	return gensio_is_message(self);
+    }
+
     %rename(is_authenticated) is_authenticated;
     bool is_authenticatedt() {
 	return gensio_is_authenticated(self);
@@ -876,8 +954,11 @@ struct waiter { };
 	int rv;
 
 	rv = sergensio_b_alloc(self, data->o, &b);
-	if (!rv)
+	if (!rv) {
+	    GENSIO_SWIG_C_BLOCK_ENTRY
 	    rv = sergensio_##name##_b(b, &name);
+	    GENSIO_SWIG_C_BLOCK_EXIT
+	}
 	if (rv)
 	    ser_err_handle("sg_" stringify(name)"_s", rv);
 	if (b)
@@ -1045,6 +1126,8 @@ struct waiter { };
 
 %constant int GENSIO_ACC_CONTROL_LADDR = GENSIO_ACC_CONTROL_LADDR;
 %constant int GENSIO_ACC_CONTROL_LPORT = GENSIO_ACC_CONTROL_LPORT;
+%constant int GENSIO_ACC_CONTROL_LOOKUP_STATS = GENSIO_ACC_CONTROL_LOOKUP_STATS;
+%constant int GENSIO_ACC_CONTROL_RELOAD_CERTS = GENSIO_ACC_CONTROL_RELOAD_CERTS;
 
 %extend gensio_accepter {
     gensio_accepter(struct gensio_os_funcs *o, char *str, swig_cb *handler) {
@@ -1127,7 +1210,11 @@ struct waiter { };
     }
 
     void shutdown_s() {
-	int rv = gensio_acc_shutdown_s(self);
+	int rv;
+
+	GENSIO_SWIG_C_BLOCK_ENTRY
+	rv = gensio_acc_shutdown_s(self);
+	GENSIO_SWIG_C_BLOCK_EXIT
 
 	err_handle("shutdown_s", rv);
     }
@@ -1157,7 +1244,11 @@ struct waiter { };
     }
 
     void set_accept_callback_enable_s(bool enabled) {
-	int rv = gensio_acc_set_accept_callback_enable_s(self, enabled);
+	int rv;
+
+	GENSIO_SWIG_C_BLOCK_ENTRY
+	rv = gensio_acc_set_accept_callback_enable_s(self, enabled);
+	GENSIO_SWIG_C_BLOCK_EXIT
 
 	err_handle("set_accept_callback_enable_s", rv);
     }
@@ -1177,7 +1268,9 @@ struct waiter { };
 	    rv = GE_NOMEM;
 	    goto out_err;
 	}
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_acc_accept_s(self, &tv, (struct gensio **) r_io);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	if (rv) {
 	    free_gensio_data(data);
 	    if (rv == GE_TIMEDOUT)
@@ -1199,7 +1292,9 @@ struct waiter { };
 	struct gensio_data *data = alloc_gensio_data(o, handler);
 	int rv;
 
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_acc_accept_s(self, NULL, &io);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	if (rv) {
 	    free_gensio_data(data);
 	    err_handle("accept_s", rv);
@@ -1225,7 +1320,9 @@ struct waiter { };
 	    rv = GE_NOMEM;
 	    goto out_err;
 	}
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_acc_accept_s_intr(self, &tv, (struct gensio **) r_io);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	if (rv) {
 	    free_gensio_data(data);
 	    if (rv == GE_TIMEDOUT)
@@ -1248,7 +1345,9 @@ struct waiter { };
 	struct gensio_data *data = alloc_gensio_data(o, handler);
 	int rv;
 
+	GENSIO_SWIG_C_BLOCK_ENTRY
 	rv = gensio_acc_accept_s_intr(self, NULL, &io);
+	GENSIO_SWIG_C_BLOCK_EXIT
 	if (rv) {
 	    free_gensio_data(data);
 	    err_handle("accept_s_intr", rv);
@@ -1397,6 +1496,269 @@ struct waiter { };
     }
 }
 
+%pythoncode %{
+import threading
+
+class service_threads:
+    """Run the gensio event loop in Python threads.  Each thread
+    waits on its own waiter with the interpreter lock released, so
+    other Python threads keep running and only the callbacks take the
+    lock.  Call stop() to wake the threads up and wait for them."""
+
+    def __init__(self, o, count = 1):
+        self.stopping = False
+        self.waiters = [waiter(o) for i in range(count)]
+        self.threads = [threading.Thread(target = self._run, args = (w,),
+                                         daemon = True)
+                        for w in self.waiters]
+
+    def _run(self, w):
+        while not self.stopping:
+            try:
+                w.wait(1)
+            except Exception:
+                import traceback
+                traceback.print_exc()
+
+    def start(self):
+        for t in self.threads:
+            t.start()
+
+    def stop(self):
+        self.stopping = True
+        for w in self.waiters:
+            w.wake()
+        for t in self.threads:
+            t.join()
+%}
+
+%pythoncode %{
+import asyncio
+
+class asyncio_os_funcs:
+    """Run a gensio_os_funcs from an asyncio event loop, without any
+    extra threads.  The os funcs' poll fd is added to the loop as a
+    reader and the next timer is scheduled with call_later().  Only
+    use the os funcs from the loop's thread when doing this.  If you
+    start gensio operations outside of a gensio callback without using
+    the asyncio_gensio and asyncio_accepter wrappers, call kick()
+    afterwards so the new work gets run."""
+
+    # Number of service calls to do before letting other things run.
+    batch = 64
+
+    def __init__(self, o, loop = None):
+        if loop is None:
+            loop = asyncio.get_event_loop()
+        self.o = o
+        self.loop = loop
+        self.w = waiter(o)
+        self.timer = None
+        self.kicked = False
+        (self.fd, timeout) = o.get_poll_info()
+        loop.add_reader(self.fd, self._run)
+        self.kick()
+
+    def _run(self):
+        self.kicked = False
+        for i in range(self.batch):
+            if self.w.service_now() != 0:
+                break
+        self._schedule()
+
+    def _schedule(self):
+        (fd, timeout) = self.o.get_poll_info()
+        if self.timer is not None:
+            self.timer.cancel()
+        self.timer = self.loop.call_later(timeout / 1000.0, self._run)
+
+    def kick(self):
+        """Run any pending gensio work soon."""
+        if not self.kicked:
+            self.kicked = True
+            self.loop.call_soon(self._run)
+
+    def close(self):
+        """Stop running the os funcs from the loop."""
+        self.loop.remove_reader(self.fd)
+        if self.timer is not None:
+            self.timer.cancel()
+            self.timer = None
+
+class _asyncio_handler:
+    # Routes gensio callbacks to the futures of an asyncio_gensio.
+    def __init__(self, ag):
+        self.ag = ag
+
+    def read_callback(self, io, err, data, auxdata):
+        return self.ag._read_cb(err, data)
+
+    def write_callback(self, io):
+        self.ag._write_cb()
+
+    def open_done(self, io, err):
+        self.ag._done(err)
+
+    def close_done(self, io):
+        self.ag._done(None)
+
+class asyncio_gensio:
+    """Awaitable operations on a gensio, run by an asyncio_os_funcs.
+    Either give a gensio string to allocate a new gensio, or a gensio
+    (from asyncio_accepter.accept(), for instance) in io.  Only one
+    read, one write and one open or close may be outstanding at a time.
+    Errors are raised as Exception, the end of the stream is an
+    empty bytes object from read()."""
+
+    def __init__(self, ao, gensiostr = None, io = None):
+        self.ao = ao
+        self.handler = _asyncio_handler(self)
+        if io is None:
+            io = gensio(ao.o, gensiostr, self.handler)
+        else:
+            io.set_cbs(self.handler)
+        self.io = io
+        self.rfut = None
+        self.rmax = 0
+        self.wfut = None
+        self.wdata = None
+        self.dfut = None
+
+    def _done(self, err):
+        fut = self.dfut
+        self.dfut = None
+        if fut is not None and not fut.done():
+            if err:
+                fut.set_exception(Exception("gensio: " + err))
+            else:
+                fut.set_result(None)
+
+    def _read_cb(self, err, data):
+        fut = self.rfut
+        self.rfut = None
+        self.io.read_cb_enable(False)
+        if fut is None or fut.done():
+            return 0
+        if err:
+            if err == "Remote end closed connection":
+                fut.set_result(b"")
+            else:
+                fut.set_exception(Exception("gensio: " + err))
+            return 0
+        count = min(len(data), self.rmax)
+        fut.set_result(bytes(data[:count]))
+        return count
+
+    def _write_cb(self):
+        fut = self.wfut
+        if fut is None or fut.done():
+            self.io.write_cb_enable(False)
+            return
+        try:
+            count = self.io.write(self.wdata, None)
+        except Exception as e:
+            count = None
+            exc = e
+        if count is None:
+            self.wfut = None
+            self.io.write_cb_enable(False)
+            fut.set_exception(exc)
+            return
+        self.wdata = self.wdata[count:]
+        if len(self.wdata) == 0:
+            self.wfut = None
+            self.io.write_cb_enable(False)
+            fut.set_result(None)
+
+    async def _wait_done(self, start):
+        self.dfut = self.ao.loop.create_future()
+        start(self.handler)
+        self.ao.kick()
+        await self.dfut
+
+    async def open(self):
+        await self._wait_done(self.io.open)
+
+    async def close(self):
+        await self._wait_done(self.io.close)
+
+    async def read(self, maxlen = 65536):
+        """Wait for data and return up to maxlen bytes of it."""
+        self.rfut = self.ao.loop.create_future()
+        self.rmax = maxlen
+        self.io.read_cb_enable(True)
+        self.ao.kick()
+        return await self.rfut
+
+    async def write(self, data):
+        """Write all of data, waiting for the gensio to take it."""
+        data = memoryview(data).cast("B")
+        count = self.io.write(data, None)
+        data = data[count:]
+        if len(data) == 0:
+            self.ao.kick()
+            return
+        self.wdata = data
+        self.wfut = self.ao.loop.create_future()
+        self.io.write_cb_enable(True)
+        self.ao.kick()
+        await self.wfut
+
+class _asyncio_acc_handler:
+    def __init__(self, aa):
+        self.aa = aa
+
+    def new_connection(self, acc, io):
+        self.aa._new_connection(io)
+
+    def shutdown_done(self, acc):
+        fut = self.aa.sfut
+        self.aa.sfut = None
+        if fut is not None and not fut.done():
+            fut.set_result(None)
+
+class asyncio_accepter:
+    """Awaitable accepts on a gensio accepter, run by an
+    asyncio_os_funcs.  The accepter is started and enabled when this
+    is created.  Connections that come in while nobody is waiting in
+    accept() are queued."""
+
+    def __init__(self, ao, gensiostr):
+        self.ao = ao
+        self.handler = _asyncio_acc_handler(self)
+        self.pending = []
+        self.waiters = []
+        self.sfut = None
+        self.acc = gensio_accepter(ao.o, gensiostr, self.handler)
+        self.acc.startup()
+        self.acc.set_accept_callback_enable(True)
+        ao.kick()
+
+    def _new_connection(self, io):
+        while self.waiters:
+            fut = self.waiters.pop(0)
+            if not fut.done():
+                fut.set_result(io)
+                return
+        self.pending.append(io)
+
+    async def accept(self):
+        """Wait for a connection, returns an asyncio_gensio."""
+        if self.pending:
+            io = self.pending.pop(0)
+        else:
+            fut = self.ao.loop.create_future()
+            self.waiters.append(fut)
+            io = await fut
+        return asyncio_gensio(self.ao, io = io)
+
+    async def shutdown(self):
+        self.sfut = self.ao.loop.create_future()
+        self.acc.shutdown(self.handler)
+        self.ao.kick()
+        await self.sfut
+%}
+
 %nodefaultctor mdns_watch;
 %nodefaultctor mdns_service;
 struct mdns { };
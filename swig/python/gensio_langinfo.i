@@ -90,21 +90,39 @@
     $result = add_python_seqresult($result, r);
 }
 
-%typemap(in) (char *bytestr, my_ssize_t len) {
+%typemap(in) (char *bytestr, my_ssize_t len) (Py_buffer view,
+						 bool have_view) {
+    have_view = false;
     if ($input == Py_None) {
 	$1 = NULL;
 	$2 = 0;
     } else if (OI_PI_BytesCheck($input)) {
 	OI_PI_AsBytesAndSize($input, &$1, &$2);
-    } else if (PyByteArray_Check($input)) {
-	$1 = PyByteArray_AsString($input);
-	$2 = PyByteArray_Size($input);
+    } else if (PyObject_CheckBuffer($input)) {
+	/*
+	 * Anything else with the buffer protocol (bytearray,
+	 * memoryview, array, numpy, etc.) is used in place, it must
+	 * be contiguous.  Holding the buffer keeps a bytearray from
+	 * being resized by another thread while a blocking call has
+	 * the interpreter lock released.
+	 */
+	if (PyObject_GetBuffer($input, &view, PyBUF_SIMPLE) == -1)
+	    SWIG_fail;
+	have_view = true;
+	$1 = (char *) view.buf;
+	$2 = view.len;
     } else {
-        PyErr_SetString(PyExc_TypeError, "Must be a byte string or array");
+        PyErr_SetString(PyExc_TypeError,
+			"Must be a byte string, array or buffer");
         SWIG_fail;
     }
 }
 
+%typemap(freearg) (char *bytestr, my_ssize_t len) {
+    if (have_view$argnum)
+	PyBuffer_Release(&view$argnum);
+}
+
 %typemap(in) const char ** {
     unsigned int i;
     unsigned int len;
@@ -7,6 +7,7 @@
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_swig.h>
+#include <gensio/argvutils.h>
 #include "python_swig_internals.h"
 
 typedef struct swig_ref {
@@ -206,13 +207,50 @@ os_funcs_ref(struct gensio_os_funcs *o)
     os_funcs_unlock(odata);
 }
 
+/* A read saved up for read_batch_callback. */
+struct gensio_py_read_ent {
+    struct gensio_py_read_ent *next;
+    int err;
+    const char **auxdata;
+    bool has_data;
+    gensiods len;
+    unsigned char data[];
+};
+
 struct gensio_data {
     bool tmpval; /* If true, just ignore this on destroy. */
     int refcount;
     swig_cb_val *handler_val;
     struct gensio_os_funcs *o;
+    bool read_memoryview; /* Deliver reads as a memoryview, not bytes. */
+
+    /*
+     * If read_batch is set, reads are queued here without taking the
+     * GIL and batch_runner hands them all to one read_batch_callback.
+     */
+    bool read_batch;
+    struct gensio *batch_io;
+    struct gensio_lock *batch_lock;
+    struct gensio_runner *batch_runner;
+    bool batch_run_pending;
+    struct gensio_py_read_ent *batch_head;
+    struct gensio_py_read_ent *batch_tail;
 };
 
+static void
+gensio_py_free_read_ents(struct gensio_os_funcs *o,
+			 struct gensio_py_read_ent *e)
+{
+    struct gensio_py_read_ent *next;
+
+    for (; e; e = next) {
+	next = e->next;
+	if (e->auxdata)
+	    gensio_argv_free(o, e->auxdata);
+	free(e);
+    }
+}
+
 static struct gensio_data *
 alloc_gensio_data(struct gensio_os_funcs *o, swig_cb *handler)
 {
@@ -229,6 +267,14 @@ alloc_gensio_data(struct gensio_os_funcs *o, swig_cb *handler)
 	data->handler_val = ref_swig_cb(handler, read_callback);
     os_funcs_ref(o);
     data->o = o;
+    data->read_memoryview = false;
+    data->read_batch = false;
+    data->batch_io = NULL;
+    data->batch_lock = NULL;
+    data->batch_runner = NULL;
+    data->batch_run_pending = false;
+    data->batch_head = NULL;
+    data->batch_tail = NULL;
 
     return data;
 }
@@ -236,6 +282,11 @@ alloc_gensio_data(struct gensio_os_funcs *o, swig_cb *handler)
 static void
 free_gensio_data(struct gensio_data *data)
 {
+    gensio_py_free_read_ents(data->o, data->batch_head);
+    if (data->batch_runner)
+	gensio_os_funcs_free_runner(data->o, data->batch_runner);
+    if (data->batch_lock)
+	gensio_os_funcs_free_lock(data->o, data->batch_lock);
     deref_swig_cb_val(data->handler_val);
     check_os_funcs_free(data->o);
     free(data);
@@ -555,6 +606,153 @@ gensio_py_handle_auxdata(const char *const *auxdata)
     }
 }
 
+#if PY_VERSION_HEX >= 0x03030000
+/*
+ * The memory under a read memoryview belongs to the gensio and is
+ * only good during the callback, so release the view when the
+ * callback returns.  If the user still has something exported from
+ * it the release fails; that is their problem, the doc says to copy
+ * the data if they need to keep it.
+ */
+static void
+gensio_py_release_mview(PyObject *mview)
+{
+    PyObject *t, *v, *tb, *r;
+
+    PyErr_Fetch(&t, &v, &tb);
+    r = PyObject_CallMethod(mview, "release", NULL);
+    if (r)
+	Py_DECREF(r);
+    else
+	PyErr_Clear();
+    PyErr_Restore(t, v, tb);
+    Py_DECREF(mview);
+}
+#endif
+
+/*
+ * Deliver all the reads queued since the last run in one
+ * read_batch_callback.  The runner holds a gensio_data reference.
+ */
+static void
+gensio_py_deliver_reads(struct gensio_runner *r, void *cb_data)
+{
+    struct gensio_data *data = (struct gensio_data *) cb_data;
+    struct gensio_os_funcs *o = data->o;
+    struct gensio *io = data->batch_io;
+    struct gensio_py_read_ent *list, *e;
+    swig_ref io_ref;
+    PyObject *args, *reads, *t, *v;
+    OI_PY_STATE gstate;
+    my_ssize_t i, count = 0;
+
+    gensio_os_funcs_lock(o, data->batch_lock);
+    list = data->batch_head;
+    data->batch_head = NULL;
+    data->batch_tail = NULL;
+    data->batch_run_pending = false;
+    gensio_os_funcs_unlock(o, data->batch_lock);
+
+    for (e = list; e; e = e->next)
+	count++;
+
+    gstate = OI_PY_STATE_GET();
+
+    if (!data->handler_val)
+	goto out;
+
+    reads = PyList_New(count);
+    for (i = 0, e = list; e; i++, e = e->next) {
+	t = PyTuple_New(3);
+	if (e->err) {
+	    v = OI_PI_FromString(gensio_err_to_str(e->err));
+	} else {
+	    Py_INCREF(Py_None);
+	    v = Py_None;
+	}
+	PyTuple_SET_ITEM(t, 0, v);
+	if (e->has_data) {
+	    v = PyBytes_FromStringAndSize((char *) e->data, e->len);
+	} else {
+	    Py_INCREF(Py_None);
+	    v = Py_None;
+	}
+	PyTuple_SET_ITEM(t, 1, v);
+	PyTuple_SET_ITEM(t, 2, gensio_py_handle_auxdata(e->auxdata));
+	PyList_SET_ITEM(reads, i, t);
+    }
+
+    args = PyTuple_New(2);
+    io_ref = swig_make_ref(io, gensio);
+    ref_gensio_data(data);
+    PyTuple_SET_ITEM(args, 0, io_ref.val);
+    PyTuple_SET_ITEM(args, 1, reads);
+
+    swig_finish_call(data->handler_val, "read_batch_callback", args, false);
+
+ out:
+    gensio_py_free_read_ents(o, list);
+    deref_gensio_data(data, io);
+    OI_PY_STATE_PUT(gstate);
+}
+
+/*
+ * Save a read for gensio_py_deliver_reads().  This doesn't touch
+ * Python, so no GIL is needed.  The data is always all consumed.
+ */
+static int
+gensio_py_queue_read(struct gensio_data *data, int readerr,
+		     unsigned char *buf, gensiods *buflen,
+		     const char *const *auxdata)
+{
+    struct gensio_os_funcs *o = data->o;
+    struct gensio_py_read_ent *e;
+    gensiods len = 0;
+
+    if (!data->handler_val)
+	return GE_NOTSUP;
+
+    if (buf && buflen)
+	len = *buflen;
+    e = (struct gensio_py_read_ent *) malloc(sizeof(*e) + len);
+    if (!e)
+	goto out_nomem;
+    e->next = NULL;
+    e->err = readerr;
+    e->auxdata = NULL;
+    e->has_data = buf != NULL;
+    e->len = len;
+    if (len)
+	memcpy(e->data, buf, len);
+    if (auxdata && auxdata[0]) {
+	if (gensio_argv_copy(o, (const char **) auxdata, NULL, &e->auxdata)) {
+	    free(e);
+	    goto out_nomem;
+	}
+    }
+
+    gensio_os_funcs_lock(o, data->batch_lock);
+    if (data->batch_tail)
+	data->batch_tail->next = e;
+    else
+	data->batch_head = e;
+    data->batch_tail = e;
+    if (!data->batch_run_pending) {
+	data->batch_run_pending = true;
+	ref_gensio_data(data);
+	gensio_os_funcs_run(o, data->batch_runner);
+    }
+    gensio_os_funcs_unlock(o, data->batch_lock);
+
+    return 0;
+
+ out_nomem:
+    /* Nothing consumed, it will be delivered again. */
+    if (buflen)
+	*buflen = 0;
+    return GE_NOMEM;
+}
+
 static int
 gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 		   unsigned char *buf, gensiods *buflen,
@@ -562,13 +760,16 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 {
     struct gensio_data *data = (struct gensio_data *) user_data;
     swig_ref io_ref, new_con;
-    PyObject *args, *o;
+    PyObject *args, *o, *mview = NULL;
     OI_PY_STATE gstate;
     int rv = 0;
     gensiods rsize;
     struct gensio *io2;
     struct gensio_data *iodata;
 
+    if (event == GENSIO_EVENT_READ && data->read_batch)
+	return gensio_py_queue_read(data, readerr, buf, buflen, auxdata);
+
     gstate = OI_PY_STATE_GET();
 
     if (!data->handler_val) {
@@ -593,7 +794,16 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	PyTuple_SET_ITEM(args, 1, o);
 
 	if (buf) {
-	    o = PyBytes_FromStringAndSize((char *) buf, *buflen);
+#if PY_VERSION_HEX >= 0x03030000
+	    if (data->read_memoryview) {
+		/* Keep a reference so we can release it afterwards. */
+		mview = PyMemoryView_FromMemory((char *) buf, *buflen,
+						PyBUF_READ);
+		Py_XINCREF(mview);
+		o = mview;
+	    } else
+#endif
+		o = PyBytes_FromStringAndSize((char *) buf, *buflen);
 	} else {
 	    o = Py_None;
 	    Py_INCREF(Py_None);
@@ -606,6 +816,10 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 					     "read_callback", args, false);
 	if (!PyErr_Occurred() && buflen)
 	    *buflen = rsize;
+#if PY_VERSION_HEX >= 0x03030000
+	if (mview)
+	    gensio_py_release_mview(mview);
+#endif
 	break;
 
     case GENSIO_EVENT_WRITE_READY:
@@ -25,6 +25,16 @@ class gensio_os_funcs:
     one, you might have to provide a Python/C interface to allocate it.
     """
 
+    def get_poll_info(self):
+        """Get what another event loop needs to run this os funcs, see
+        GENSIO_CONTROL_POLL_INFO in gensio_os_funcs.3.  Returns a
+        sequence of a file descriptor to poll for read and the time
+        in milliseconds to wait at most.  When either one happens,
+        call waiter.service_now() until it returns GE_TIMEDOUT and
+        get the poll info again.  asyncio_os_funcs does this for you.
+        """
+        return (0, 0)
+
 def alloc_gensio_selector(h):
     """Allocate a default gensio_os_funcs for your platform.
 
@@ -50,7 +60,12 @@ class EventHandler:
                it is a string.  Some are not really errors, for instance
                "Remote end closed connection" just means the other end
                did a close.
-        data -- A byte string holding the read data.
+        data -- A byte string holding the read data.  If
+               set_read_memoryview() is enabled on the gensio, this
+               is a read-only memoryview over the gensio's buffer
+               instead, which avoids a copy.  The memoryview is
+               released when this returns, copy anything you need
+               to keep.
         auxdata -- Auxiliary data describing the read.  This is a sequence
                of strings. Some interfaces will have an "oob" string for
                out-of-bounds data (TCP and SCTP).  SCTP can have a
@@ -62,6 +77,23 @@ class EventHandler:
         """
         return 0
 
+    def read_batch_callback(self, io, reads):
+        """Used instead of read_callback() if set_read_batch() is
+        enabled on the gensio.  Reads that came in since the last call
+        are delivered together here, so the GIL is taken and a Python
+        call made once per batch instead of once per read.
+
+        io -- The gensio object reporting the read data.
+        reads -- A list of (err, data, auxdata) tuples, in the order
+               received, each the same as the matching read_callback()
+               arguments.  data is always a byte string.
+
+        All the data is consumed, there is no return value.  To stop
+        reads, use read_cb_enable(False); reads already queued will
+        still be delivered.
+        """
+        return
+
     def write_callback(self, io):
         """Data can be written on the gensio.  You should generally
         use this for writing your data.  You can directly call the
@@ -511,7 +543,10 @@ class gensio:
     def write(self, bytestr, auxdata):
         """Write the given byte string.
 
-        bytestr -- The data to write.
+        bytestr -- The data to write.  This may be a byte string, a
+            string, or anything supporting the buffer protocol
+            (bytearray, memoryview, array, numpy arrays, etc.) as long
+            as it is contiguous.  The data is not copied.
         auxdata -- A sequence of strings holding gensio-specific auxiliary
             data.  May be None if it's not applicable.
 
@@ -534,6 +569,32 @@ class gensio:
         """
         return
 
+    def set_read_memoryview(self, enable):
+        """Deliver read data to read_callback() as a read-only
+        memoryview over the gensio's buffer instead of a new byte
+        string.  This avoids allocating and copying for every read,
+        but the memoryview is only valid during the callback.  It is
+        released when read_callback() returns, so copy out anything
+        you need to keep and don't keep objects (like numpy arrays)
+        that reference its memory.  Requires Python 3.3 or later,
+        older versions always get a byte string.
+
+        enable -- A boolean, whether to deliver memoryviews
+        """
+        return
+
+    def set_read_batch(self, enable):
+        """Queue read data without taking the GIL and hand everything
+        that arrived before the next pass of the event loop to
+        read_batch_callback() as one list, instead of calling
+        read_callback() for each read.  This cuts the per-message
+        overhead for lots of small reads.  The data is copied, so
+        set_read_memoryview() does not apply.
+
+        enable -- A boolean, whether to batch reads
+        """
+        return
+
     def write_cb_enable(self, enable):
         """Allow write ready events from the gensio.  When the gensio is
         opened write callbacks are enabled.  You should generally leave
@@ -637,6 +698,14 @@ class gensio:
         """
         return True
 
+    def is_message(self):
+        """Return whether the gensio is message oriented.  In a message
+        oriented gensio, a write with "eom" in the auxdata marks the
+        end of a message and the read of the end of that message will
+        have "eom" in its auxdata.
+        """
+        return False
+
     def is_authenticated(self):
         """Return whether the gensio has been authenticated.  This is
         primarily for ssl and certauth, if they succeed in their
@@ -1301,6 +1370,128 @@ class waiter:
         """
         return
 
+class service_threads:
+    """Run gensio event processing in Python threads.  The waits are
+    done with the interpreter lock released, the lock is only taken
+    when a callback into Python is made, so other Python threads run
+    normally while these wait.  All the blocking calls (read_s,
+    write_s, open_s, close_s, accept_s, waiter.wait, waiter.service,
+    etc.) release the interpreter lock while they block, so they may
+    be used from other threads at the same time.
+
+    An exception raised in a callback running in one of these threads
+    is printed and the thread keeps going.
+    """
+
+    def __init__(o, count = 1):
+        """Allocate the service threads.  They are not started.
+
+        o -- The gensio_os_funcs object to service.
+        count -- The number of threads to run.
+        """
+        return
+
+    def start(self):
+        """Start the threads."""
+        return
+
+    def stop(self):
+        """Stop the threads and wait for them to exit."""
+        return
+
+class asyncio_os_funcs:
+    """Run a gensio_os_funcs from an asyncio event loop in the loop's
+    own thread, so gensio can be used alongside other asyncio I/O
+    without a service thread.  The os funcs poll fd is added as a
+    reader on the loop and the next timeout is scheduled with
+    call_later().  Use the os funcs only from the loop's thread when
+    doing this.  Not available on all platforms, it raises an
+    exception if the os funcs can't be run this way.
+    """
+
+    def __init__(o, loop = None):
+        """Attach the os funcs to the loop.
+
+        o -- The gensio_os_funcs object to run.
+        loop -- The asyncio loop, the current event loop if None.
+        """
+        return
+
+    def kick(self):
+        """Run pending gensio work soon.  Call this after starting
+        gensio operations from outside of a gensio callback if you
+        aren't using the asyncio_gensio or asyncio_accepter wrappers,
+        which do it for you.
+        """
+        return
+
+    def close(self):
+        """Detach the os funcs from the loop."""
+        return
+
+class asyncio_gensio:
+    """Awaitable gensio operations, run using an asyncio_os_funcs.
+    Errors are raised as exceptions.  Only one read, one write, and
+    one open or close may be outstanding at a time.  Reads are only
+    enabled while a read() is waiting, so the gensio flow controls
+    the remote end if you stop reading.
+    """
+
+    def __init__(ao, gensiostr = None, io = None):
+        """Allocate a new gensio from gensiostr, or wrap the existing
+        gensio in io (like one from asyncio_accepter.accept()).  This
+        replaces the gensio's event handler.
+
+        ao -- The asyncio_os_funcs to use.
+        """
+        return
+
+    async def open(self):
+        """Open the gensio."""
+        return
+
+    async def close(self):
+        """Close the gensio."""
+        return
+
+    async def read(self, maxlen = 65536):
+        """Wait for data and return up to maxlen bytes of it as
+        bytes.  Data that doesn't fit is returned on the next read.
+        Returns an empty bytes object when the remote end closes.
+        """
+        return b""
+
+    async def write(self, data):
+        """Write all of data, which may be anything supporting the
+        buffer protocol, waiting for the gensio to take it if
+        necessary.
+        """
+        return
+
+class asyncio_accepter:
+    """Awaitable accepts on a gensio accepter, run using an
+    asyncio_os_funcs.  The accepter is started up and enabled when
+    created.
+    """
+
+    def __init__(ao, gensiostr):
+        """Allocate the accepter.
+
+        ao -- The asyncio_os_funcs to use.
+        gensiostr -- The accepter string.
+        """
+        return
+
+    async def accept(self):
+        """Wait for a new connection and return it as an
+        asyncio_gensio.
+        """
+        return asyncio_gensio()
+
+    async def shutdown(self):
+        """Shut down the accepter."""
+        return
+
 def gensio_set_log_mask(mask):
     """Set the logs that are delivered by the gensio system.
 
@@ -25,6 +25,16 @@
  * If you really want real threading to work, you put tcl on top of
  * gensio os funcs using Tcl_NotifierProcs.  I leave that as an
  * exercise to the reader.
+ *
+ * There is a threaded mode, though, see
+ * gensio_tcl_funcs_alloc_threaded().  In that mode a set of worker
+ * threads each run their own tcl event loop.  Every iod, timer, and
+ * runner is assigned to one of the workers and all its tcl handlers
+ * are created and fire in that worker's thread.  Operations from
+ * other threads are passed to the worker with Tcl_ThreadQueueEvent().
+ * Since the tcl handlers are per-thread, everything about a tcl
+ * handler is only touched in the thread that owns it.  That's how
+ * this avoids the limitation above.
  */
 
 #include "config.h"
@@ -56,13 +66,90 @@
 #include <string.h>
 #include <sys/ioctl.h>
 
+struct gensio_data;
+
+struct tcl_worker {
+    struct gensio_data *d;
+    Tcl_ThreadId id;
+    bool ready;
+    bool stop;
+};
+
 struct gensio_data
 {
     struct gensio_memtrack *mtrack;
     unsigned int refcount;
     struct gensio_os_proc_data *pdata;
+
+    /* Only for threaded mode. */
+    unsigned int nworkers;
+    struct tcl_worker *workers;
+    unsigned int next_worker;
+    Tcl_Mutex worker_lock;
+    Tcl_Condition worker_cond;
+};
+
+struct tcl_call_event {
+    Tcl_Event ev;
+    Tcl_IdleProc *func;
+    ClientData data;
 };
 
+static int
+tcl_call_event_proc(Tcl_Event *ev, int flags)
+{
+    struct tcl_call_event *cev = (struct tcl_call_event *) ev;
+
+    cev->func(cev->data);
+    return 1;
+}
+
+/*
+ * Run func in the worker's thread after anything already queued for
+ * it.  If not threaded (w is NULL), run it when idle.
+ */
+static void
+tcl_queue(struct tcl_worker *w, Tcl_IdleProc *func, ClientData data)
+{
+    struct tcl_call_event *cev;
+
+    if (!w) {
+	Tcl_DoWhenIdle(func, data);
+	return;
+    }
+    cev = (struct tcl_call_event *) ckalloc(sizeof(*cev));
+    cev->ev.proc = tcl_call_event_proc;
+    cev->func = func;
+    cev->data = data;
+    Tcl_ThreadQueueEvent(w->id, &cev->ev, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(w->id);
+}
+
+/*
+ * Can tcl handlers belonging to the worker be touched directly from
+ * this thread?
+ */
+static bool
+tcl_in_worker(struct tcl_worker *w)
+{
+    return !w || w->id == Tcl_GetCurrentThread();
+}
+
+static struct tcl_worker *
+tcl_pick_worker(struct gensio_os_funcs *o)
+{
+    struct gensio_data *d = o->user_data;
+    struct tcl_worker *w;
+
+    if (!d->nworkers)
+	return NULL;
+    Tcl_MutexLock(&d->worker_lock);
+    w = &d->workers[d->next_worker];
+    d->next_worker = (d->next_worker + 1) % d->nworkers;
+    Tcl_MutexUnlock(&d->worker_lock);
+    return w;
+}
+
 static void *
 gensio_tcl_zalloc(struct gensio_os_funcs *f, gensiods size)
 {
@@ -121,7 +208,11 @@ struct gensio_iod_tcl {
 
     Tcl_Mutex lock;
 
-    int mask;
+    /* The worker that owns the tcl file handler, NULL if not threaded. */
+    struct tcl_worker *w;
+
+    int mask; /* The mask we want. */
+    int set_mask; /* The mask the tcl file handler has. */
 
     bool in_clear;
     enum { CL_NOT_CALLED, CL_CALLED, CL_DONE } close_state;
@@ -162,6 +253,11 @@ tcl_file_handler(ClientData data, int mask)
 {
     struct gensio_iod_tcl *iod = data;
 
+    /* The mask may have changed but not been set in tcl yet. */
+    Tcl_MutexLock(&iod->lock);
+    mask &= iod->mask;
+    Tcl_MutexUnlock(&iod->lock);
+
     if (mask & TCL_READABLE)
 	iod->read_handler(&iod->r, iod->cb_data);
     if (mask & TCL_WRITABLE)
@@ -170,6 +266,45 @@ tcl_file_handler(ClientData data, int mask)
 	iod->except_handler(&iod->r, iod->cb_data);
 }
 
+/*
+ * Make the tcl file handler match the mask.  Must be run in the
+ * iod's worker with the iod lock held.
+ */
+static void
+tcl_iod_sync_locked(struct gensio_iod_tcl *iod)
+{
+    if (iod->mask != iod->set_mask) {
+	if (iod->mask == 0)
+	    Tcl_DeleteFileHandler(iod->fd);
+	else
+	    Tcl_CreateFileHandler(iod->fd, iod->mask, tcl_file_handler, iod);
+	iod->set_mask = iod->mask;
+    }
+}
+
+static void
+tcl_iod_sync(ClientData data)
+{
+    struct gensio_iod_tcl *iod = data;
+
+    Tcl_MutexLock(&iod->lock);
+    tcl_iod_sync_locked(iod);
+    Tcl_MutexUnlock(&iod->lock);
+}
+
+/* Set the mask and make tcl match it.  Call with the iod lock held. */
+static void
+tcl_iod_set_mask(struct gensio_iod_tcl *iod, int new_mask)
+{
+    if (new_mask == iod->mask)
+	return;
+    iod->mask = new_mask;
+    if (tcl_in_worker(iod->w))
+	tcl_iod_sync_locked(iod);
+    else
+	tcl_queue(iod->w, tcl_iod_sync, iod);
+}
+
 static void
 tcl_cleared_done(ClientData data)
 {
@@ -227,10 +362,10 @@ gensio_tcl_clear_fd_handlers(struct gensio_iod *iiod)
     Tcl_MutexLock(&iod->lock);
     if (!iod->handlers_set || iod->in_clear)
 	goto out_unlock;
-    if (iod->mask)
-	Tcl_DeleteFileHandler(iod->fd);
     iod->in_clear = true;
-    Tcl_DoWhenIdle(tcl_cleared_done, iod);
+    tcl_iod_set_mask(iod, 0);
+    /* This is queued after any pending handler changes. */
+    tcl_queue(iod->w, tcl_cleared_done, iod);
  out_unlock:
     Tcl_MutexUnlock(&iod->lock);
 }
@@ -298,15 +433,7 @@ gensio_tcl_set_read_handler(struct gensio_iod *iiod, bool enable)
 	new_mask |= TCL_READABLE;
     else
 	new_mask &= ~TCL_READABLE;
-
-    if (new_mask == iod->mask)
-	goto out_unlock;
-
-    iod->mask = new_mask;
-    if (new_mask == 0)
-	Tcl_DeleteFileHandler(iod->fd);
-    else
-	Tcl_CreateFileHandler(iod->fd, new_mask, tcl_file_handler, iod);
+    tcl_iod_set_mask(iod, new_mask);
  out_unlock:
     Tcl_MutexUnlock(&iod->lock);
 }
@@ -334,12 +461,7 @@ gensio_tcl_set_write_handler(struct gensio_iod *iiod, bool enable)
 	new_mask |= TCL_WRITABLE;
     else
 	new_mask &= ~TCL_WRITABLE;
-
-    if (new_mask == iod->mask)
-	goto out_unlock;
-
-    iod->mask = new_mask;
-    Tcl_CreateFileHandler(iod->fd, new_mask, tcl_file_handler, iod);
+    tcl_iod_set_mask(iod, new_mask);
  out_unlock:
     Tcl_MutexUnlock(&iod->lock);
 }
@@ -359,13 +481,7 @@ gensio_tcl_set_except_handler(struct gensio_iod *iiod, bool enable)
 	new_mask |= TCL_EXCEPTION;
     else
 	new_mask &= ~TCL_EXCEPTION;
-
-    if (new_mask == iod->mask)
-	goto out_unlock;
-
-    iod->mask = new_mask;
-    Tcl_CreateFileHandler(iod->fd, new_mask, tcl_file_handler, iod);
- out_unlock:
+    tcl_iod_set_mask(iod, new_mask);
     Tcl_MutexUnlock(&iod->lock);
 }
 
@@ -378,7 +494,11 @@ struct gensio_timer
 
     Tcl_Mutex lock;
 
+    /* The worker that owns the tcl timer, NULL if not threaded. */
+    struct tcl_worker *w;
+
     Tcl_TimerToken timer_id;
+    int64_t end; /* When it times out, in microseconds. */
 
     enum {
 	  TCL_TIMER_FREE,
@@ -391,6 +511,83 @@ struct gensio_timer
     void *done_cb_data;
 };
 
+/*
+ * Various time conversion routines.  Note that we always truncate up
+ * to the next time unit.  These are used for timers, and if you don't
+ * you can end up with an early timeout.
+ */
+static int64_t
+gensio_time_to_us(gensio_time *t)
+{
+    return t->secs * 1000000ULL + (t->nsecs + 999) / 1000;
+}
+
+static unsigned int
+us_time_to_ms(int64_t t)
+{
+    return (t + 999) / 1000;
+}
+
+static void
+us_time_to_gensio(int64_t t, gensio_time *gt)
+{
+    gt->secs = t / 1000000;
+    gt->nsecs = t % 1000000 * 1000;
+}
+
+static int64_t
+fetch_us_time(void)
+{
+    Tcl_Time now;
+
+    Tcl_GetTime(&now);
+    return (now.sec * 1000000ULL) + now.usec;
+}
+
+static void gensio_tcl_timeout_handler(ClientData data);
+
+/*
+ * Make the tcl timer match the timer state.  Must be run in the
+ * timer's worker with the timer lock held.
+ */
+static void
+gensio_tcl_timer_sync_locked(struct gensio_timer *t)
+{
+    int64_t now;
+
+    if (t->timer_id) {
+	Tcl_DeleteTimerHandler(t->timer_id);
+	t->timer_id = NULL;
+    }
+    if (t->state == TCL_TIMER_RUNNING) {
+	now = fetch_us_time();
+	t->timer_id = Tcl_CreateTimerHandler(
+			now < t->end ? us_time_to_ms(t->end - now) : 0,
+			gensio_tcl_timeout_handler, t);
+    }
+}
+
+static void
+gensio_tcl_timer_sync(ClientData data)
+{
+    struct gensio_timer *t = data;
+
+    Tcl_MutexLock(&t->lock);
+    if (t->state != TCL_TIMER_FREE)
+	gensio_tcl_timer_sync_locked(t);
+    Tcl_MutexUnlock(&t->lock);
+}
+
+/* Call with the timer lock held. */
+static void
+gensio_tcl_timer_update(struct gensio_timer *t)
+{
+    if (tcl_in_worker(t->w))
+	gensio_tcl_timer_sync_locked(t);
+    else
+	tcl_queue(t->w, gensio_tcl_timer_sync, t);
+}
+
 static void
 gensio_tcl_timeout_handler(ClientData data)
 {
@@ -399,11 +596,16 @@ gensio_tcl_timeout_handler(ClientData data)
     void *cb_data;
 
     Tcl_MutexLock(&t->lock);
-    if (t->timer_id) {
-	handler = t->handler;
-	cb_data = t->cb_data;
-	t->state = TCL_TIMER_STOPPED;
-	t->timer_id = 0;
+    t->timer_id = NULL;
+    if (t->state == TCL_TIMER_RUNNING) {
+	if (fetch_us_time() < t->end) {
+	    /* Restarted from another thread, not time yet. */
+	    gensio_tcl_timer_sync_locked(t);
+	} else {
+	    handler = t->handler;
+	    cb_data = t->cb_data;
+	    t->state = TCL_TIMER_STOPPED;
+	}
     }
     Tcl_MutexUnlock(&t->lock);
 
@@ -427,58 +629,49 @@ gensio_tcl_alloc_timer(struct gensio_os_funcs *o,
     t->handler = handler;
     t->cb_data = cb_data;
     t->state = TCL_TIMER_STOPPED;
+    t->w = tcl_pick_worker(o);
 
     return t;
 }
 
 static void
-gensio_tcl_free_timer(struct gensio_timer *t)
+gensio_tcl_timer_finish_free(ClientData data)
 {
-    Tcl_MutexLock(&t->lock);
-    assert(t->state != TCL_TIMER_FREE);
-    if (t->state == TCL_TIMER_RUNNING) {
+    struct gensio_timer *t = data;
+
+    if (t->timer_id)
 	Tcl_DeleteTimerHandler(t->timer_id);
-	t->timer_id = NULL;
-    }
-    t->state = TCL_TIMER_FREE;
-    Tcl_MutexUnlock(&t->lock);
+    Tcl_MutexFinalize(&t->lock);
     t->o->free(t->o, t);
 }
 
-/*
- * Various time conversion routines.  Note that we always truncate up
- * to the next time unit.  These are used for timers, and if you don't
- * you can end up with an early timeout.
- */
-static unsigned int
-gensio_time_to_ms(gensio_time *t)
-{
-    return t->secs * 1000 + (t->nsecs + 999999) / 1000000;
-}
-
-static int64_t
-gensio_time_to_us(gensio_time *t)
+static void
+gensio_tcl_free_timer(struct gensio_timer *t)
 {
-    return t->secs * 1000000ULL + (t->nsecs + 999) / 1000;
-}
+    bool in_stop;
 
-static unsigned int
-us_time_to_ms(int64_t t)
-{
-    return (t + 999) / 1000;
-}
+    Tcl_MutexLock(&t->lock);
+    assert(t->state != TCL_TIMER_FREE);
+    in_stop = t->state == TCL_TIMER_IN_STOP;
+    t->state = TCL_TIMER_FREE;
+    Tcl_MutexUnlock(&t->lock);
 
-static void
-us_time_to_gensio(int64_t t, gensio_time *gt)
-{
-    gt->secs = t / 1000000;
-    gt->nsecs = t % 1000000 * 1000;
+    /*
+     * If a stop is in progress, that will finish the free.  With a
+     * worker, the free must be queued after anything already queued
+     * for the timer.
+     */
+    if (in_stop)
+	return;
+    if (t->w)
+	tcl_queue(t->w, gensio_tcl_timer_finish_free, t);
+    else
+	gensio_tcl_timer_finish_free(t);
 }
 
 static int
-gensio_tcl_start_timer(struct gensio_timer *t, gensio_time *timeout)
+gensio_tcl_start_timer_us(struct gensio_timer *t, int64_t us)
 {
-    int msec = gensio_time_to_ms(timeout);
     int rv = 0;
 
     Tcl_MutexLock(&t->lock);
@@ -487,26 +680,26 @@ gensio_tcl_start_timer(struct gensio_timer *t, gensio_time *timeout)
 	rv = GE_INUSE;
     } else {
 	t->done_handler = NULL;
-	t->timer_id = Tcl_CreateTimerHandler(msec, gensio_tcl_timeout_handler,
-					     t);
-	if (!t->timer_id) {
-	    rv = GE_NOMEM;
-	} else {
-	    t->state = TCL_TIMER_RUNNING;
-	}
+	t->end = fetch_us_time() + us;
+	t->state = TCL_TIMER_RUNNING;
+	gensio_tcl_timer_update(t);
     }
     Tcl_MutexUnlock(&t->lock);
 
     return rv;
 }
 
+static int
+gensio_tcl_start_timer(struct gensio_timer *t, gensio_time *timeout)
+{
+    return gensio_tcl_start_timer_us(t, gensio_time_to_us(timeout));
+}
+
 static int
 gensio_tcl_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
 {
     struct timespec ts;
     int64_t tnsecs, nnsecs;
-    int msec;
-    int rv = 0;
 
     clock_gettime(CLOCK_MONOTONIC, &ts);
     tnsecs = timeout->secs * 1000000000ULL + timeout->nsecs;
@@ -515,24 +708,8 @@ gensio_tcl_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
 	tnsecs = 0;
     else
 	tnsecs -= nnsecs;
-    msec = (tnsecs + 999999ULL) / 1000000;
 
-    Tcl_MutexLock(&t->lock);
-    assert(t->state != TCL_TIMER_FREE);
-    if (t->state != TCL_TIMER_STOPPED) {
-	rv = GE_INUSE;
-    } else {
-	t->done_handler = NULL;
-	t->timer_id = Tcl_CreateTimerHandler(msec, gensio_tcl_timeout_handler,
-					     t);
-	if (!t->timer_id) {
-	    rv = GE_NOMEM;
-	} else {
-	    t->state = TCL_TIMER_RUNNING;
-	}
-    }
-    Tcl_MutexUnlock(&t->lock);
-    return rv;
+    return gensio_tcl_start_timer_us(t, (tnsecs + 999ULL) / 1000);
 }
 
 static int
@@ -546,8 +723,7 @@ gensio_tcl_stop_timer(struct gensio_timer *t)
 	rv = GE_TIMEDOUT;
     } else {
 	t->state = TCL_TIMER_STOPPED;
-	Tcl_DeleteTimerHandler(t->timer_id);
-	t->timer_id = NULL;
+	gensio_tcl_timer_update(t);
     }
     Tcl_MutexUnlock(&t->lock);
     return rv;
@@ -562,14 +738,14 @@ gensio_tcl_timeout_done(ClientData data)
 
     Tcl_MutexLock(&t->lock);
     if (t->state == TCL_TIMER_FREE) {
-	Tcl_MutexFinalize(&t->lock);
-	t->o->free(t->o, t);
-    } else {
-	t->state = TCL_TIMER_STOPPED;
-	done_handler = t->done_handler;
-	done_cb_data = t->done_cb_data;
-	t->done_handler = NULL;
+	Tcl_MutexUnlock(&t->lock);
+	gensio_tcl_timer_finish_free(t);
+	return;
     }
+    t->state = TCL_TIMER_STOPPED;
+    done_handler = t->done_handler;
+    done_cb_data = t->done_cb_data;
+    t->done_handler = NULL;
     Tcl_MutexUnlock(&t->lock);
 
     if (done_handler)
@@ -593,9 +769,8 @@ gensio_tcl_stop_timer_with_done(struct gensio_timer *t,
 	t->state = TCL_TIMER_IN_STOP;
 	t->done_handler = done_handler;
 	t->done_cb_data = cb_data;
-	Tcl_DeleteTimerHandler(t->timer_id);
-	t->timer_id = NULL;
-	Tcl_DoWhenIdle(gensio_tcl_timeout_done, t);
+	gensio_tcl_timer_update(t);
+	tcl_queue(t->w, gensio_tcl_timeout_done, t);
     }
     Tcl_MutexUnlock(&t->lock);
 
@@ -611,6 +786,9 @@ struct gensio_runner
     bool freed;
     bool in_use;
 
+    /* The worker the runner runs in, NULL if not threaded. */
+    struct tcl_worker *w;
+
     Tcl_Mutex lock;
 };
 
@@ -652,6 +830,7 @@ gensio_tcl_alloc_runner(struct gensio_os_funcs *o,
     r->o = o;
     r->handler = handler;
     r->cb_data = cb_data;
+    r->w = tcl_pick_worker(o);
 
     return r;
 }
@@ -679,7 +858,7 @@ gensio_tcl_run(struct gensio_runner *r)
     if (r->in_use) {
 	rv = GE_INUSE;
     } else {
-	Tcl_DoWhenIdle(gensio_tcl_idle_handler, r);
+	tcl_queue(r->w, gensio_tcl_idle_handler, r);
 	r->in_use = true;
     }
     Tcl_MutexUnlock(&r->lock);
@@ -691,6 +870,13 @@ struct gensio_waiter
     struct gensio_os_funcs *o;
 
     unsigned int count;
+
+    /*
+     * In threaded mode, the wakeups come from the workers, so the
+     * waiter just blocks on these.
+     */
+    Tcl_Mutex lock;
+    Tcl_Condition cond;
 };
 
 static struct gensio_waiter *
@@ -710,6 +896,8 @@ gensio_tcl_alloc_waiter(struct gensio_os_funcs *o)
 static void
 gensio_tcl_free_waiter(struct gensio_waiter *w)
 {
+    Tcl_ConditionFinalize(&w->cond);
+    Tcl_MutexFinalize(&w->lock);
     w->o->free(w->o, w);
 }
 
@@ -743,15 +931,6 @@ struct timeout_info {
     int64_t end;
 };
 
-static int64_t
-fetch_us_time(void)
-{
-    Tcl_Time now;
-
-    Tcl_GetTime(&now);
-    return (now.sec * 1000000ULL) + now.usec;
-}
-
 static void
 setup_timeout(struct timeout_info *t)
 {
@@ -820,6 +999,7 @@ gensio_tcl_wait_intr_sigmask(struct gensio_waiter *w, unsigned int count,
 			     gensio_time *timeout,
 			     struct gensio_os_proc_data *proc_data)
 {
+    struct gensio_data *d = w->o->user_data;
     struct timeout_info ti = { .timeout = timeout };
     int rv = 0;
     sigset_t origmask;
@@ -831,14 +1011,32 @@ gensio_tcl_wait_intr_sigmask(struct gensio_waiter *w, unsigned int count,
     }
     setup_timeout(&ti);
 
-    while (count > w->count && !timed_out(&ti)) {
-	timeout_wait(&ti);
-	ti.now = fetch_us_time();
+    if (d->nworkers) {
+	Tcl_Time tt;
+
+	Tcl_MutexLock(&w->lock);
+	while (count > w->count && !timed_out(&ti)) {
+	    if (ti.timeout) {
+		tt.sec = (ti.end - ti.now) / 1000000;
+		tt.usec = (ti.end - ti.now) % 1000000;
+		Tcl_ConditionWait(&w->cond, &w->lock, &tt);
+	    } else {
+		Tcl_ConditionWait(&w->cond, &w->lock, NULL);
+	    }
+	    ti.now = fetch_us_time();
+	}
+    } else {
+	while (count > w->count && !timed_out(&ti)) {
+	    timeout_wait(&ti);
+	    ti.now = fetch_us_time();
+	}
     }
     if (count > w->count)
 	rv = GE_TIMEDOUT;
     else
 	w->count -= count;
+    if (d->nworkers)
+	Tcl_MutexUnlock(&w->lock);
 
     timeout_end(&ti);
 
@@ -875,7 +1073,16 @@ gensio_tcl_wait_intr(struct gensio_waiter *w, unsigned int count,
 static void
 gensio_tcl_wake(struct gensio_waiter *w)
 {
-    w->count += 1;
+    struct gensio_data *d = w->o->user_data;
+
+    if (d->nworkers) {
+	Tcl_MutexLock(&w->lock);
+	w->count += 1;
+	Tcl_ConditionNotify(&w->cond);
+	Tcl_MutexUnlock(&w->lock);
+    } else {
+	w->count += 1;
+    }
 }
 
 static int
@@ -912,6 +1119,7 @@ gensio_tcl_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
     iod->r.f = o;
     iod->fd = fd;
     iod->orig_fd = ofd;
+    iod->w = tcl_pick_worker(o);
     if (type == GENSIO_IOD_STDIO) {
 	struct stat statb;
 
@@ -940,6 +1148,7 @@ gensio_tcl_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
 	iod->runner = o->alloc_runner(o, file_runner, iod);
 	if (!iod->runner)
 	    goto out_err;
+	iod->runner->w = iod->w;
     }
 
     *riod = &iod->r;
@@ -1408,6 +1617,54 @@ gensio_tcl_get_funcs(struct gensio_os_funcs *f)
     return f;
 }
 
+static void
+tcl_worker_stop(ClientData data)
+{
+    struct tcl_worker *w = data;
+
+    w->stop = true;
+}
+
+static Tcl_ThreadCreateType
+tcl_worker_thread(ClientData data)
+{
+    struct tcl_worker *w = data;
+    struct gensio_data *d = w->d;
+    Tcl_Interp *interp;
+
+    /* Sets up the tcl notifier for this thread. */
+    interp = Tcl_CreateInterp();
+    Tcl_DeleteInterp(interp);
+
+    Tcl_MutexLock(&d->worker_lock);
+    w->ready = true;
+    Tcl_ConditionNotify(&d->worker_cond);
+    Tcl_MutexUnlock(&d->worker_lock);
+
+    while (!w->stop)
+	Tcl_DoOneEvent(TCL_ALL_EVENTS);
+
+    Tcl_FinalizeThread();
+    TCL_THREAD_CREATE_RETURN;
+}
+
+static void
+tcl_stop_workers(struct gensio_data *d)
+{
+    unsigned int i;
+    int result;
+
+    for (i = 0; i < d->nworkers; i++) {
+	tcl_queue(&d->workers[i], tcl_worker_stop, &d->workers[i]);
+	Tcl_JoinThread(d->workers[i].id, &result);
+    }
+    free(d->workers);
+    d->workers = NULL;
+    d->nworkers = 0;
+    Tcl_ConditionFinalize(&d->worker_cond);
+    Tcl_MutexFinalize(&d->worker_lock);
+}
+
 static void
 gensio_tcl_free_funcs(struct gensio_os_funcs *f)
 {
@@ -1418,6 +1675,7 @@ gensio_tcl_free_funcs(struct gensio_os_funcs *f)
 	d->refcount--;
 	return;
     }
+    tcl_stop_workers(d);
     gensio_memtrack_cleanup(d->mtrack);
     free(d);
     free(f);
@@ -1595,3 +1853,52 @@ gensio_tcl_funcs_alloc(struct gensio_os_funcs **ro)
     *ro = o;
     return 0;
 }
+
+int
+gensio_tcl_funcs_alloc_threaded(struct gensio_os_funcs **ro,
+				unsigned int nthreads)
+{
+    struct gensio_os_funcs *o;
+    struct gensio_data *d;
+    struct tcl_worker *w;
+    unsigned int i;
+    int err;
+
+    if (nthreads == 0)
+	return GE_INVAL;
+
+    err = gensio_tcl_funcs_alloc(&o);
+    if (err)
+	return err;
+    d = o->user_data;
+
+    d->workers = calloc(nthreads, sizeof(*d->workers));
+    if (!d->workers) {
+	o->free_funcs(o);
+	return GE_NOMEM;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+	w = &d->workers[i];
+	w->d = d;
+	if (Tcl_CreateThread(&w->id, tcl_worker_thread, w,
+			     TCL_THREAD_STACK_DEFAULT,
+			     TCL_THREAD_JOINABLE) != TCL_OK) {
+	    err = GE_NOMEM;
+	    break;
+	}
+	/* Wait until it can take events. */
+	Tcl_MutexLock(&d->worker_lock);
+	while (!w->ready)
+	    Tcl_ConditionWait(&d->worker_cond, &d->worker_lock, NULL);
+	Tcl_MutexUnlock(&d->worker_lock);
+	d->nworkers++;
+    }
+    if (err) {
+	o->free_funcs(o);
+	return err;
+    }
+
+    *ro = o;
+    return 0;
+}
@@ -21,6 +21,16 @@ extern "C" {
 GENSIOTCL_DLL_PUBLIC
 int gensio_tcl_funcs_alloc(struct gensio_os_funcs **o);
 
+/*
+ * Allocate a tcl-based os funcs that runs all the gensio handling in
+ * nthreads worker threads, each with its own tcl event loop.  gensio
+ * callbacks will come from those threads, not the thread calling
+ * Tcl_DoOneEvent().
+ */
+GENSIOTCL_DLL_PUBLIC
+int gensio_tcl_funcs_alloc_threaded(struct gensio_os_funcs **o,
+				    unsigned int nthreads);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+# Keep gensio_microbench results across gensio versions and os
+# handler backends and compare them.
+#
+#   benchdb.py run [-r <n>] [-b <benchmark>] [-l <label>] -o <file>
+#                  [-- <gensio_microbench options and benches>]
+#
+# runs the benchmark n times (default 5) and writes each result with
+# the host, build and gensio version to file as JSON.  The os handler
+# backend is picked with the GENSIO_SEL_xxx environment variables,
+# those are saved with the results, too.
+#
+#   benchdb.py compare [-t <percent>] <old file> <new file>
+#
+# compares two runs.  A result is flagged as a regression if
+# throughput went down, or ns/op or allocs/op went up, by more than
+# the threshold (default 5%) and the change is significant with a
+# Welch t-test at 95%.  It exits with 1 if there are any regressions.
+
+import sys
+import os
+import re
+import json
+import math
+import time
+import socket
+import platform
+import argparse
+import subprocess
+
+FORMAT = 1
+
+report_re = re.compile(r"^(.*?)\s+([0-9.]+) (bytes/s|ops/s)\s+([0-9.]+) ns/op"
+                       r"\s+([0-9.]+) allocs/op$")
+header_re = re.compile(r"^gensio (\S+), (.*)$")
+
+# For each metric, whether bigger is better.
+metrics = (("rate", True), ("ns_per_op", False), ("allocs_per_op", False))
+
+# Two sided 95% t values by degrees of freedom, a df between entries
+# uses the lower one, and past the end the last one.
+t_table = ((1, 12.706), (2, 4.303), (3, 3.182), (4, 2.776), (5, 2.571),
+           (6, 2.447), (7, 2.365), (8, 2.306), (9, 2.262), (10, 2.228),
+           (12, 2.179), (15, 2.131), (20, 2.086), (30, 2.042),
+           (60, 2.000), (120, 1.980))
+
+def cpu_model():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for l in f:
+                if l.startswith("model name"):
+                    return l.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor()
+
+def build_info(bench):
+    """Get what we can about the build from the build directory the
+    benchmark is in."""
+    info = { }
+    topdir = os.path.join(os.path.dirname(os.path.abspath(bench)), "..")
+    try:
+        with open(os.path.join(topdir, "config.log")) as f:
+            for l in f:
+                if l.startswith("  $ "):
+                    info["configure"] = l[4:].strip()
+                    break
+    except OSError:
+        pass
+    try:
+        with open(os.path.join(topdir, "Makefile")) as f:
+            for l in f:
+                m = re.match(r"^(CC|CFLAGS) = (.*)$", l)
+                if m:
+                    info[m.group(1)] = m.group(2).strip()
+    except OSError:
+        pass
+    try:
+        info["git"] = subprocess.check_output(
+            ["git", "describe", "--always", "--dirty"],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        pass
+    return info
+
+def run_once(bench, args, results, run):
+    try:
+        out = subprocess.check_output([bench] + args)
+    except (OSError, subprocess.CalledProcessError) as e:
+        print("benchdb: %s failed: %s" % (bench, str(e)), file=sys.stderr)
+        sys.exit(1)
+    for l in out.decode().splitlines():
+        m = header_re.match(l)
+        if m:
+            run["gensio_version"] = m.group(1)
+            run["config"] = m.group(2)
+            continue
+        m = report_re.match(l)
+        if not m:
+            continue
+        r = results.setdefault(m.group(1), { "unit": m.group(3),
+                                             "rate": [ ],
+                                             "ns_per_op": [ ],
+                                             "allocs_per_op": [ ] })
+        r["rate"].append(float(m.group(2)))
+        r["ns_per_op"].append(float(m.group(4)))
+        r["allocs_per_op"].append(float(m.group(5)))
+
+def do_run(a):
+    results = { }
+    run = {
+        "format": FORMAT,
+        "time": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+        "label": a.label,
+        "gensio_version": None,
+        "config": None,
+        "bench_args": a.args,
+        "repeats": a.repeats,
+        "host": {
+            "hostname": socket.gethostname(),
+            "system": platform.system(),
+            "release": platform.release(),
+            "machine": platform.machine(),
+            "cpu": cpu_model(),
+            "cpus": os.cpu_count(),
+        },
+        "build": build_info(a.bench),
+        "env": { k: v for k, v in os.environ.items()
+                 if k.startswith("GENSIO_") },
+        "results": results,
+    }
+    for i in range(0, a.repeats):
+        run_once(a.bench, a.args, results, run)
+    if not results:
+        print("benchdb: no results from %s" % a.bench, file=sys.stderr)
+        sys.exit(1)
+    with open(a.output, "w") as f:
+        json.dump(run, f, indent=1, sort_keys=True)
+        f.write("\n")
+    print("%d results from %d runs written to %s" %
+          (len(results), a.repeats, a.output))
+
+def load(fname):
+    try:
+        with open(fname) as f:
+            run = json.load(f)
+    except (OSError, ValueError) as e:
+        print("benchdb: can't read %s: %s" % (fname, str(e)), file=sys.stderr)
+        sys.exit(2)
+    if run.get("format") != FORMAT:
+        print("benchdb: %s: unknown format" % fname, file=sys.stderr)
+        sys.exit(2)
+    return run
+
+def mean_var(v):
+    n = len(v)
+    m = sum(v) / n
+    if n < 2:
+        return m, 0.0
+    return m, sum((x - m) ** 2 for x in v) / (n - 1)
+
+def significant(old, new):
+    """Welch's t-test, true if the means differ at 95%.  With a single
+    sample there is no variance, so any difference counts."""
+    m1, v1 = mean_var(old)
+    m2, v2 = mean_var(new)
+    if m1 == m2:
+        return False
+    s1 = v1 / len(old)
+    s2 = v2 / len(new)
+    if s1 + s2 == 0:
+        return True
+    t = abs(m1 - m2) / math.sqrt(s1 + s2)
+    df = (s1 + s2) ** 2
+    d = 0.0
+    if s1:
+        d += s1 ** 2 / (len(old) - 1)
+    if s2:
+        d += s2 ** 2 / (len(new) - 1)
+    df = df / d
+    crit = t_table[0][1]
+    for tdf, tval in t_table:
+        if df >= tdf:
+            crit = tval
+    return t > crit
+
+def do_compare(a):
+    old = load(a.old)
+    new = load(a.new)
+
+    for k in ("gensio_version", "config", "label"):
+        print("%-15s %s -> %s" % (k + ":", old.get(k), new.get(k)))
+    for k in ("hostname", "cpu", "cpus"):
+        if old["host"].get(k) != new["host"].get(k):
+            print("Warning: the runs are on different hosts (%s differs)" % k)
+            break
+    if old.get("env") != new.get("env"):
+        print("Environment: %s -> %s" % (old.get("env"), new.get("env")))
+    print()
+
+    regressions = 0
+    print("%-20s %-13s %14s %14s %8s" % ("bench", "metric", "old", "new",
+                                          "change"))
+    for name in sorted(old["results"]):
+        if name not in new["results"]:
+            continue
+        o = old["results"][name]
+        n = new["results"][name]
+        for metric, bigger_better in metrics:
+            m1 = mean_var(o[metric])[0]
+            m2 = mean_var(n[metric])[0]
+            if m1:
+                change = (m2 - m1) * 100.0 / m1
+            elif m2:
+                change = math.inf
+            else:
+                change = 0.0
+            worse = change < 0 if bigger_better else change > 0
+            flag = ""
+            if abs(change) > a.threshold and significant(o[metric],
+                                                         n[metric]):
+                if worse:
+                    flag = "REGRESSION"
+                    regressions += 1
+                else:
+                    flag = "improved"
+            unit = o["unit"] if metric == "rate" else metric
+            print("%-20s %-13s %14.2f %14.2f %+7.1f%% %s" %
+                  (name, unit, m1, m2, change, flag))
+    for name in sorted(set(old["results"]) ^ set(new["results"])):
+        print("%-20s only in %s" % (name, a.old if name in old["results"]
+                                    else a.new))
+    print()
+    print("%d regressions" % regressions)
+    return 1 if regressions else 0
+
+def main():
+    p = argparse.ArgumentParser(
+        description="Store and compare gensio_microbench results")
+    sub = p.add_subparsers(dest="cmd")
+    r = sub.add_parser("run", help="Run the benchmark and save the results")
+    r.add_argument("-r", "--repeats", type=int, default=5,
+                   help="Times to run the benchmark, default 5")
+    r.add_argument("-b", "--bench", default="./gensio_microbench",
+                   help="The benchmark program, "
+                   "default ./gensio_microbench")
+    r.add_argument("-l", "--label", default=None,
+                   help="A name for the run, like the backend")
+    r.add_argument("-o", "--output", required=True,
+                   help="The file to write the results to")
+    r.add_argument("args", nargs="*",
+                   help="Options and benches for gensio_microbench, "
+                   "after --")
+    c = sub.add_parser("compare", help="Compare two saved runs")
+    c.add_argument("-t", "--threshold", type=float, default=5.0,
+                   help="Percent change to ignore, default 5")
+    c.add_argument("old")
+    c.add_argument("new")
+    a = p.parse_args()
+
+    if a.cmd == "run":
+        if a.repeats < 1:
+            p.error("repeats must be at least 1")
+        do_run(a)
+        return 0
+    if a.cmd == "compare":
+        return do_compare(a)
+    p.print_help()
+    return 2
+
+if __name__ == "__main__":
+    sys.exit(main())
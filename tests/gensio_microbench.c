@@ -0,0 +1,910 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Microbenchmarks for gensio filter stacks and the os handler
+ * selector.  Each stack benchmark pushes a fixed amount of data
+ * through a gensio stack and reports bytes per second, nanoseconds
+ * per write, and allocations per write.  Stacks with a filter on
+ * both ends are run with an accepter and connector in the same
+ * process over loopback or memlink.  The selector benchmarks time timers,
+ * runners, and fd handlers.  The startup benchmark times the first
+ * gensio allocations in the process.
+ *
+ * Run it from the tests directory (or use "make bench") so the
+ * ssl keys in ca/ are found.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+
+static struct gensio_os_funcs *o;
+static const char *keydir = "ca";
+static gensiods wsize = 1024;
+static gensiods total = 64 * 1024 * 1024;
+static unsigned long nr_ops = 1000000;
+static bool verbose;
+
+/* Count allocations by wrapping the os handler's allocators. */
+static gensiods nr_allocs;
+static void *(*orig_zalloc)(struct gensio_os_funcs *f, gensiods size);
+static void *(*orig_buf_alloc)(struct gensio_os_funcs *f, gensiods size);
+
+static void *
+count_zalloc(struct gensio_os_funcs *f, gensiods size)
+{
+    nr_allocs++;
+    return orig_zalloc(f, size);
+}
+
+static void *
+count_buf_alloc(struct gensio_os_funcs *f, gensiods size)
+{
+    nr_allocs++;
+    return orig_buf_alloc(f, size);
+}
+
+static double
+time_since(gensio_time *start)
+{
+    gensio_time now;
+
+    o->get_monotonic_time(o, &now);
+    return (double) (now.secs - start->secs) +
+	(double) (now.nsecs - start->nsecs) / 1000000000.0;
+}
+
+static void
+report(const char *name, double secs, unsigned long ops, gensiods bytes,
+       gensiods allocs)
+{
+    if (ops == 0)
+	ops = 1;
+    printf("%-24s", name);
+    if (bytes)
+	printf(" %14.0f bytes/s", bytes / secs);
+    else
+	printf(" %14.0f ops/s  ", ops / secs);
+    printf(" %10.1f ns/op %8.2f allocs/op\n", secs * 1000000000.0 / ops,
+	   (double) allocs / ops);
+}
+
+struct stack_bench {
+    struct gensio_waiter *waiter;
+    struct gensio_accepter *acc;
+    struct gensio *cio; /* Writes go here. */
+    struct gensio *sio; /* Reads are counted here, may be cio. */
+    unsigned char *buf;
+    gensiods sent;
+    gensiods received;
+    unsigned long writes;
+    int err;
+    bool done;
+};
+
+static void
+stack_finish(struct stack_bench *b, int err)
+{
+    if (b->done)
+	return;
+    b->done = true;
+    b->err = err;
+    gensio_set_write_callback_enable(b->cio, false);
+    o->wake(b->waiter);
+}
+
+static void
+stack_write(struct stack_bench *b)
+{
+    gensiods len, count;
+    int err;
+
+    while (b->sent < total) {
+	len = total - b->sent;
+	if (len > wsize)
+	    len = wsize;
+	err = gensio_write(b->cio, &count, b->buf, len, NULL);
+	if (err) {
+	    stack_finish(b, err);
+	    return;
+	}
+	if (count > 0)
+	    b->writes++;
+	b->sent += count;
+	if (count < len)
+	    return;
+    }
+    gensio_set_write_callback_enable(b->cio, false);
+}
+
+static int
+stack_event(struct gensio *io, void *user_data, int event, int err,
+	    unsigned char *buf, gensiods *buflen,
+	    const char *const *auxdata)
+{
+    struct stack_bench *b = user_data;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err) {
+	    gensio_set_read_callback_enable(io, false);
+	    stack_finish(b, err);
+	    return 0;
+	}
+	if (io == b->sio) {
+	    b->received += *buflen;
+	    if (b->received >= total)
+		stack_finish(b, 0);
+	}
+	return 0;
+
+    case GENSIO_EVENT_WRITE_READY:
+	stack_write(b);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+stack_acc_event(struct gensio_accepter *accepter, void *user_data,
+		int event, void *data)
+{
+    struct stack_bench *b = user_data;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return GE_NOTSUP;
+
+    if (b->sio) {
+	gensio_free(data);
+	return 0;
+    }
+    b->sio = data;
+    gensio_set_callback(b->sio, stack_event, b);
+    gensio_set_read_callback_enable(b->sio, true);
+    o->wake(b->waiter);
+    return 0;
+}
+
+/*
+ * Run data through a stack.  If accstr is NULL, constr must echo the
+ * data back (it's on top of echo or similar).  Otherwise an accepter
+ * is created with accstr and constr connects to it.  If constr has a
+ * "%s", the accepter's port is put there.
+ */
+static int
+stack_bench(const char *name, const char *accstr, const char *constr)
+{
+    struct stack_bench b;
+    gensio_time timeout;
+    gensio_time start;
+    gensiods allocs;
+    char port[20], str[512];
+    gensiods len;
+    double secs;
+    int err;
+
+    memset(&b, 0, sizeof(b));
+    b.waiter = o->alloc_waiter(o);
+    if (!b.waiter)
+	return GE_NOMEM;
+    b.buf = malloc(wsize);
+    if (!b.buf) {
+	err = GE_NOMEM;
+	goto out;
+    }
+    memset(b.buf, 0x5a, wsize);
+
+    if (accstr) {
+	err = str_to_gensio_accepter(accstr, o, stack_acc_event, &b, &b.acc);
+	if (err) {
+	    fprintf(stderr, "%s: accepter %s: %s\n", name, accstr,
+		    gensio_err_to_str(err));
+	    goto out;
+	}
+	err = gensio_acc_startup(b.acc);
+	if (err) {
+	    fprintf(stderr, "%s: accepter startup: %s\n", name,
+		    gensio_err_to_str(err));
+	    goto out;
+	}
+	if (strstr(constr, "%s")) {
+	    strcpy(port, "0");
+	    len = sizeof(port);
+	    err = gensio_acc_control(b.acc, GENSIO_CONTROL_DEPTH_FIRST, true,
+				     GENSIO_ACC_CONTROL_LPORT, port, &len);
+	    if (err) {
+		fprintf(stderr, "%s: accepter port: %s\n", name,
+			gensio_err_to_str(err));
+		goto out;
+	    }
+	    snprintf(str, sizeof(str), constr, port);
+	} else {
+	    snprintf(str, sizeof(str), "%s", constr);
+	}
+    } else {
+	snprintf(str, sizeof(str), "%s", constr);
+    }
+
+    err = str_to_gensio(str, o, stack_event, &b, &b.cio);
+    if (err) {
+	fprintf(stderr, "%s: gensio %s: %s\n", name, str,
+		gensio_err_to_str(err));
+	goto out;
+    }
+    err = gensio_open_s(b.cio);
+    if (err) {
+	fprintf(stderr, "%s: open %s: %s\n", name, str,
+		gensio_err_to_str(err));
+	goto out;
+    }
+
+    if (b.acc) {
+	timeout.secs = 10;
+	timeout.nsecs = 0;
+	/* The accept may have already happened, but it still wakes. */
+	err = o->wait(b.waiter, 1, &timeout);
+	if (err) {
+	    fprintf(stderr, "%s: no connection: %s\n", name,
+		    gensio_err_to_str(err));
+	    goto out;
+	}
+    } else {
+	b.sio = b.cio;
+	gensio_set_read_callback_enable(b.sio, true);
+    }
+
+    allocs = nr_allocs;
+    o->get_monotonic_time(o, &start);
+    gensio_set_write_callback_enable(b.cio, true);
+    timeout.secs = 120;
+    timeout.nsecs = 0;
+    err = o->wait(b.waiter, 1, &timeout);
+    secs = time_since(&start);
+    allocs = nr_allocs - allocs;
+    if (!err)
+	err = b.err;
+    if (err) {
+	fprintf(stderr, "%s: %s after %lu bytes\n", name,
+		gensio_err_to_str(err), (unsigned long) b.received);
+	goto out;
+    }
+    report(name, secs, b.writes, b.received, allocs);
+
+ out:
+    if (b.cio) {
+	gensio_close_s(b.cio);
+	gensio_free(b.cio);
+    }
+    if (b.sio && b.sio != b.cio) {
+	gensio_close_s(b.sio);
+	gensio_free(b.sio);
+    }
+    if (b.acc) {
+	gensio_acc_shutdown_s(b.acc);
+	gensio_acc_free(b.acc);
+    }
+    if (b.buf)
+	free(b.buf);
+    o->free_waiter(b.waiter);
+    return err;
+}
+
+struct timer_bench {
+    struct gensio_waiter *waiter;
+    unsigned long count;
+};
+
+static void
+timer_bench_handler(struct gensio_timer *t, void *cb_data)
+{
+    struct timer_bench *b = cb_data;
+    gensio_time timeout = { 0, 0 };
+
+    if (--b->count > 0)
+	o->start_timer(t, &timeout);
+    else
+	o->wake(b->waiter);
+}
+
+/*
+ * How long do the first gensio allocations in the process take?  This
+ * includes setting up the gensio registry and initializing the gensio
+ * types used, which is most of the startup cost for a short-lived
+ * program like gensiot.  It is only meaningful as the first benchmark
+ * run, so it is first in the list.
+ */
+static int
+startup_bench(void)
+{
+    static const char *strs[] = { "echo", "telnet,echo", NULL };
+    struct gensio *io;
+    gensio_time start;
+    gensiods allocs;
+    unsigned int i;
+    int err = 0;
+
+    allocs = nr_allocs;
+    o->get_monotonic_time(o, &start);
+    for (i = 0; strs[i]; i++) {
+	err = str_to_gensio(strs[i], o, NULL, NULL, &io);
+	if (err)
+	    break;
+	gensio_free(io);
+    }
+    if (!err)
+	report("startup", time_since(&start), i, 0, nr_allocs - allocs);
+    else
+	fprintf(stderr, "startup: %s\n", gensio_err_to_str(err));
+    return err;
+}
+
+/* How long does it take to start and stop a timer that won't go off? */
+static int
+timer_startstop_bench(void)
+{
+    struct gensio_timer *t;
+    gensio_time timeout = { 100, 0 };
+    gensio_time start;
+    gensiods allocs;
+    unsigned long i;
+    int err = 0;
+
+    t = o->alloc_timer(o, timer_bench_handler, NULL);
+    if (!t)
+	return GE_NOMEM;
+    allocs = nr_allocs;
+    o->get_monotonic_time(o, &start);
+    for (i = 0; i < nr_ops; i++) {
+	err = o->start_timer(t, &timeout);
+	if (err)
+	    break;
+	err = o->stop_timer(t);
+	if (err)
+	    break;
+    }
+    if (!err)
+	report("timer start/stop", time_since(&start), nr_ops, 0,
+	       nr_allocs - allocs);
+    else
+	fprintf(stderr, "timer start/stop: %s\n", gensio_err_to_str(err));
+    o->free_timer(t);
+    return err;
+}
+
+/*
+ * Like start/stop, but with a lot of other timers running, the way a
+ * server with many connections would have.
+ */
+#define TIMER_MANY_NR 20000
+static int
+timer_many_bench(void)
+{
+    struct gensio_timer **t;
+    gensio_time timeout;
+    gensio_time start;
+    gensiods allocs;
+    unsigned long i, j;
+    int err = 0;
+
+    t = calloc(TIMER_MANY_NR, sizeof(*t));
+    if (!t)
+	return GE_NOMEM;
+    for (i = 0; i < TIMER_MANY_NR; i++) {
+	t[i] = o->alloc_timer(o, timer_bench_handler, NULL);
+	if (!t[i]) {
+	    err = GE_NOMEM;
+	    goto out;
+	}
+	/* Spread them from 10 to 110 seconds. */
+	timeout.secs = 10 + i % 100;
+	timeout.nsecs = (i * 7919) % 1000000000;
+	err = o->start_timer(t[i], &timeout);
+	if (err)
+	    goto out;
+    }
+
+    allocs = nr_allocs;
+    o->get_monotonic_time(o, &start);
+    for (i = 0, j = 0; i < nr_ops; i++, j = (j + 7919) % TIMER_MANY_NR) {
+	err = o->stop_timer(t[j]);
+	if (err)
+	    break;
+	timeout.secs = 10 + i % 100;
+	timeout.nsecs = (i * 104729) % 1000000000;
+	err = o->start_timer(t[j], &timeout);
+	if (err)
+	    break;
+    }
+    if (!err)
+	report("timer many", time_since(&start), nr_ops, 0,
+	       nr_allocs - allocs);
+
+ out:
+    if (err)
+	fprintf(stderr, "timer many: %s\n", gensio_err_to_str(err));
+    for (i = 0; i < TIMER_MANY_NR && t[i]; i++) {
+	o->stop_timer(t[i]);
+	o->free_timer(t[i]);
+    }
+    free(t);
+    return err;
+}
+
+/* Timers that go off immediately and restart themselves. */
+static int
+timer_fire_bench(void)
+{
+    struct timer_bench b;
+    struct gensio_timer *t;
+    gensio_time timeout = { 0, 0 };
+    gensio_time start;
+    gensiods allocs;
+    int err;
+
+    b.waiter = o->alloc_waiter(o);
+    if (!b.waiter)
+	return GE_NOMEM;
+    b.count = nr_ops / 10;
+    if (b.count == 0)
+	b.count = 1;
+    t = o->alloc_timer(o, timer_bench_handler, &b);
+    if (!t) {
+	o->free_waiter(b.waiter);
+	return GE_NOMEM;
+    }
+    allocs = nr_allocs;
+    o->get_monotonic_time(o, &start);
+    err = o->start_timer(t, &timeout);
+    if (!err) {
+	timeout.secs = 120;
+	err = o->wait(b.waiter, 1, &timeout);
+    }
+    if (!err)
+	report("timer fire", time_since(&start), nr_ops / 10, 0,
+	       nr_allocs - allocs);
+    else
+	fprintf(stderr, "timer fire: %s\n", gensio_err_to_str(err));
+    o->stop_timer(t);
+    o->free_timer(t);
+    o->free_waiter(b.waiter);
+    return err;
+}
+
+struct runner_bench {
+    struct gensio_waiter *waiter;
+    unsigned long count;
+};
+
+static void
+runner_bench_handler(struct gensio_runner *r, void *cb_data)
+{
+    struct runner_bench *b = cb_data;
+
+    if (--b->count > 0)
+	o->run(r);
+    else
+	o->wake(b->waiter);
+}
+
+static int
+runner_bench(void)
+{
+    struct runner_bench b;
+    struct gensio_runner *r;
+    gensio_time timeout = { 120, 0 };
+    gensio_time start;
+    gensiods allocs;
+    int err;
+
+    b.waiter = o->alloc_waiter(o);
+    if (!b.waiter)
+	return GE_NOMEM;
+    b.count = nr_ops;
+    r = o->alloc_runner(o, runner_bench_handler, &b);
+    if (!r) {
+	o->free_waiter(b.waiter);
+	return GE_NOMEM;
+    }
+    allocs = nr_allocs;
+    o->get_monotonic_time(o, &start);
+    err = o->run(r);
+    if (!err)
+	err = o->wait(b.waiter, 1, &timeout);
+    if (!err)
+	report("runner", time_since(&start), nr_ops, 0, nr_allocs - allocs);
+    else
+	fprintf(stderr, "runner: %s\n", gensio_err_to_str(err));
+    o->free_runner(r);
+    o->free_waiter(b.waiter);
+    return err;
+}
+
+#ifndef _WIN32
+/*
+ * Pass a byte around a ring of pipes, each hop is a read handler
+ * call, a read, and a write.
+ */
+#define FD_RING_SIZE 16
+
+struct fd_ring_bench;
+
+struct fd_ring_pipe {
+    struct fd_ring_bench *b;
+    struct gensio_iod *rd;
+    struct gensio_iod *wr;
+    struct fd_ring_pipe *next;
+    bool cleared;
+};
+
+struct fd_ring_bench {
+    struct gensio_waiter *waiter;
+    unsigned long count;
+    int err;
+    struct fd_ring_pipe pipes[FD_RING_SIZE];
+};
+
+static void
+fd_ring_read(struct gensio_iod *iod, void *cb_data)
+{
+    struct fd_ring_pipe *p = cb_data;
+    struct fd_ring_bench *b = p->b;
+    unsigned char c;
+    struct gensio_sg sg = { &c, 1 };
+    gensiods count;
+    int err;
+
+    err = o->read(iod, &c, 1, &count);
+    if (err || count == 0) {
+	if (!err)
+	    return;
+	goto out_err;
+    }
+    if (--b->count == 0) {
+	o->wake(b->waiter);
+	return;
+    }
+    err = o->write(p->next->wr, &sg, 1, &count);
+    if (!err && count == 1)
+	return;
+    if (!err)
+	err = GE_IOERR;
+ out_err:
+    if (!b->err) {
+	b->err = err;
+	o->wake(b->waiter);
+    }
+}
+
+static void
+fd_ring_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    struct fd_ring_pipe *p = cb_data;
+
+    p->cleared = true;
+    o->wake(p->b->waiter);
+}
+
+static int
+fd_ring_bench(void)
+{
+    struct fd_ring_bench b;
+    struct fd_ring_pipe *p;
+    gensio_time timeout = { 120, 0 };
+    gensio_time start;
+    gensiods allocs, count;
+    unsigned char c = 0;
+    struct gensio_sg sg = { &c, 1 };
+    unsigned int i, nr_set = 0;
+    int fds[2], err = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.waiter = o->alloc_waiter(o);
+    if (!b.waiter)
+	return GE_NOMEM;
+    b.count = nr_ops;
+
+    for (i = 0; i < FD_RING_SIZE; i++) {
+	p = &b.pipes[i];
+	p->b = &b;
+	p->next = &b.pipes[(i + 1) % FD_RING_SIZE];
+	if (pipe(fds) == -1) {
+	    err = gensio_os_err_to_err(o, errno);
+	    goto out;
+	}
+	err = o->add_iod(o, GENSIO_IOD_PIPE, fds[0], &p->rd);
+	if (err) {
+	    close(fds[0]);
+	    close(fds[1]);
+	    goto out;
+	}
+	err = o->add_iod(o, GENSIO_IOD_PIPE, fds[1], &p->wr);
+	if (err) {
+	    close(fds[1]);
+	    goto out;
+	}
+	err = o->set_non_blocking(p->rd);
+	if (!err)
+	    err = o->set_non_blocking(p->wr);
+	if (!err)
+	    err = o->set_fd_handlers(p->rd, p, fd_ring_read, NULL, NULL,
+				     fd_ring_cleared);
+	if (err)
+	    goto out;
+	nr_set++;
+    }
+
+    allocs = nr_allocs;
+    for (i = 0; i < FD_RING_SIZE; i++)
+	o->set_read_handler(b.pipes[i].rd, true);
+    o->get_monotonic_time(o, &start);
+    err = o->write(b.pipes[0].wr, &sg, 1, &count);
+    if (!err)
+	err = o->wait(b.waiter, 1, &timeout);
+    if (!err)
+	err = b.err;
+    if (!err)
+	report("fd ring", time_since(&start), nr_ops, 0, nr_allocs - allocs);
+    else
+	fprintf(stderr, "fd ring: %s\n", gensio_err_to_str(err));
+
+ out:
+    for (i = 0; i < nr_set; i++) {
+	o->set_read_handler(b.pipes[i].rd, false);
+	o->clear_fd_handlers(b.pipes[i].rd);
+    }
+    for (i = 0; i < nr_set; i++) {
+	while (!b.pipes[i].cleared)
+	    o->wait(b.waiter, 1, NULL);
+    }
+    for (i = 0; i < FD_RING_SIZE; i++) {
+	if (b.pipes[i].rd)
+	    o->close(&b.pipes[i].rd);
+	if (b.pipes[i].wr)
+	    o->close(&b.pipes[i].wr);
+    }
+    o->free_waiter(b.waiter);
+    return err;
+}
+#endif
+
+struct bench {
+    const char *name;
+    const char *accstr;
+    const char *constr;
+    int (*func)(void);
+};
+
+static struct bench benches[] = {
+    { "startup", .func = startup_bench },
+    { "echo", NULL, "echo" },
+    { "telnet", NULL, "telnet,echo" },
+    { "msgdelim", NULL, "msgdelim(writebuf=%w,readbuf=%r),echo" },
+    { "xlt", NULL, "xlt(nlcr),echo" },
+    { "kiss", NULL, "kiss(fullduplex,writebuf=%w,readbuf=%r),echo" },
+    { "tcp", "tcp,localhost,0", "tcp,localhost,%s" },
+    { "ssl", "ssl(key=%k/key.pem,cert=%k/cert.pem),tcp,localhost,0",
+      "ssl(CA=%k/CA.pem),tcp,localhost,%s" },
+    { "mux", "mux,tcp,localhost,0", "mux,tcp,localhost,%s" },
+    { "relpkt", "relpkt,udp,localhost,0", "relpkt,udp,localhost,%s" },
+    { "memlink", "memlink,bench", "memlink,bench" },
+    { "ssl memlink", "ssl(key=%k/key.pem,cert=%k/cert.pem),memlink,bench",
+      "ssl(CA=%k/CA.pem),memlink,bench" },
+    { "mux memlink", "mux,memlink,bench", "mux,memlink,bench" },
+    { "timer start/stop", .func = timer_startstop_bench },
+    { "timer fire", .func = timer_fire_bench },
+    { "timer many", .func = timer_many_bench },
+    { "runner", .func = runner_bench },
+#ifndef _WIN32
+    { "fd ring", .func = fd_ring_bench },
+#endif
+    { NULL }
+};
+
+/*
+ * Replace %k in s with the key directory and %w with the write size,
+ * or the smallest size the packet filters allow.  %r is a read size
+ * with room for packet headers.
+ */
+static char *
+sub_str(const char *s, char *buf, size_t len)
+{
+    size_t i = 0;
+
+    while (*s && i < len - 1) {
+	if (s[0] == '%' && s[1] == 'k') {
+	    i += snprintf(buf + i, len - i, "%s", keydir);
+	    if (i >= len)
+		i = len - 1;
+	    s += 2;
+	} else if (s[0] == '%' && (s[1] == 'w' || s[1] == 'r')) {
+	    i += snprintf(buf + i, len - i, "%lu",
+			  (unsigned long) (wsize < 256 ? 256 : wsize) +
+			  (s[1] == 'r' ? 16 : 0));
+	    if (i >= len)
+		i = len - 1;
+	    s += 2;
+	} else {
+	    buf[i++] = *s++;
+	}
+    }
+    buf[i] = '\0';
+    return buf;
+}
+
+static bool
+bench_selected(const char *name, int argc, char *argv[], int arg)
+{
+    if (arg >= argc)
+	return true;
+    for (; arg < argc; arg++) {
+	if (strncmp(name, argv[arg], strlen(argv[arg])) == 0)
+	    return true;
+    }
+    return false;
+}
+
+static const char *progname;
+static char *usage_str =
+"Usage: %s [options] [bench [bench ...]]\n"
+"Run gensio microbenchmarks.  If benches are given, only run the\n"
+"ones whose names start with one of them.  Options are:\n"
+"  -s, --size <n> - The size of each write, default 1024.\n"
+"  -n, --total <n> - The number of bytes to pass, default 64M.\n"
+"  -o, --ops <n> - The number of selector operations, default 1000000.\n"
+"  -k, --keydir <dir> - Where the ssl keys are, default \"ca\".\n"
+"  -l, --list - List the benchmarks.\n"
+"  -v, --verbose - Print the gensio strings as they are run.\n"
+"  -h, --help - This help.\n";
+
+static void
+help(int err)
+{
+    printf(usage_str, progname);
+    exit(err);
+}
+
+static unsigned long
+get_num(const char *arg, const char *val)
+{
+    char *end;
+    unsigned long v;
+
+    if (!val) {
+	fprintf(stderr, "No value given for %s\n", arg);
+	help(1);
+    }
+    v = strtoul(val, &end, 0);
+    if (*end == 'k' || *end == 'K')
+	v *= 1024, end++;
+    else if (*end == 'm' || *end == 'M')
+	v *= 1024 * 1024, end++;
+    if (*end || v == 0) {
+	fprintf(stderr, "Invalid value for %s: %s\n", arg, val);
+	help(1);
+    }
+    return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct gensio_os_proc_data *proc_data;
+    char accbuf[512], conbuf[512];
+    unsigned int i;
+    int arg, err, rv = 0;
+    bool list = false;
+
+    progname = argv[0];
+
+    for (arg = 1; arg < argc; arg++) {
+	if (argv[arg][0] != '-')
+	    break;
+	if (strcmp(argv[arg], "--") == 0) {
+	    arg++;
+	    break;
+	}
+	if ((strcmp(argv[arg], "-s") == 0) ||
+		(strcmp(argv[arg], "--size") == 0)) {
+	    arg++;
+	    wsize = get_num("size", argv[arg]);
+	} else if ((strcmp(argv[arg], "-n") == 0) ||
+		(strcmp(argv[arg], "--total") == 0)) {
+	    arg++;
+	    total = get_num("total", argv[arg]);
+	} else if ((strcmp(argv[arg], "-o") == 0) ||
+		(strcmp(argv[arg], "--ops") == 0)) {
+	    arg++;
+	    nr_ops = get_num("ops", argv[arg]);
+	} else if ((strcmp(argv[arg], "-k") == 0) ||
+		(strcmp(argv[arg], "--keydir") == 0)) {
+	    arg++;
+	    if (!argv[arg]) {
+		fprintf(stderr, "No value given for keydir\n");
+		help(1);
+	    }
+	    keydir = argv[arg];
+	} else if ((strcmp(argv[arg], "-l") == 0) ||
+		(strcmp(argv[arg], "--list") == 0)) {
+	    list = true;
+	} else if ((strcmp(argv[arg], "-v") == 0) ||
+		(strcmp(argv[arg], "--verbose") == 0)) {
+	    verbose = true;
+	} else if ((strcmp(argv[arg], "-h") == 0) ||
+		(strcmp(argv[arg], "--help") == 0)) {
+	    help(0);
+	} else {
+	    fprintf(stderr, "Unknown argument: %s\n", argv[arg]);
+	    help(1);
+	}
+    }
+
+    if (list) {
+	for (i = 0; benches[i].name; i++)
+	    printf("%s\n", benches[i].name);
+	return 0;
+    }
+
+    err = gensio_default_os_hnd(GENSIO_DEF_WAKE_SIG, &o);
+    if (err) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(err));
+	return 1;
+    }
+
+    err = gensio_os_proc_setup(o, &proc_data);
+    if (err) {
+	fprintf(stderr, "Could not setup process data: %s\n",
+		gensio_err_to_str(err));
+	return 1;
+    }
+
+    orig_zalloc = o->zalloc;
+    o->zalloc = count_zalloc;
+    if (o->buf_alloc) {
+	orig_buf_alloc = o->buf_alloc;
+	o->buf_alloc = count_buf_alloc;
+    }
+
+    printf("gensio %s, write size %lu, total %lu bytes, %lu selector ops\n",
+	   gensio_version_string, (unsigned long) wsize,
+	   (unsigned long) total, nr_ops);
+    for (i = 0; benches[i].name; i++) {
+	if (!bench_selected(benches[i].name, argc, argv, arg))
+	    continue;
+	if (benches[i].func) {
+	    err = benches[i].func();
+	} else {
+	    if (benches[i].accstr)
+		sub_str(benches[i].accstr, accbuf, sizeof(accbuf));
+	    sub_str(benches[i].constr, conbuf, sizeof(conbuf));
+	    if (verbose)
+		printf("%s: %s%s%s\n", benches[i].name,
+		       benches[i].accstr ? accbuf : "",
+		       benches[i].accstr ? " <- " : "", conbuf);
+	    err = stack_bench(benches[i].name,
+			      benches[i].accstr ? accbuf : NULL, conbuf);
+	}
+	if (err && err != GE_NOTSUP)
+	    rv = 1;
+    }
+
+    o->zalloc = orig_zalloc;
+    if (orig_buf_alloc)
+	o->buf_alloc = orig_buf_alloc;
+    gensio_os_proc_cleanup(proc_data);
+    gensio_os_funcs_free(o);
+    return rv;
+}
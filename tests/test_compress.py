@@ -0,0 +1,85 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test the compress gensio.  Besides moving data, check through the
+# connection stats that the ends agreed on the right method, that
+# compressible data really goes out smaller, and that data is sent
+# as is if either end turns compression off.
+#
+
+from utils import *
+import gensio
+
+gensios_enabled.check_iostr_gensios("compress")
+
+test1 = "asdfasdf"
+test2 = "jkl;jkl;"
+# Compressible and bigger than the filter buffers, to test partial
+# compression and decompression.
+test3 = "The quick brown fox jumped over the lazy dog " * 2000
+
+def get_stats(io):
+    s = io.control(0, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+def check_xfer(io1, io2, data, alg):
+    """Send data from io1 to io2 and check how much went out below."""
+    s = get_stats(io1)
+    test_dataxfer(io1, io2, data, timeout = 10000)
+    n = get_stats(io1)
+    if n["alg"] != alg or get_stats(io2)["alg"] != alg:
+        raise Exception("Negotiated %s and %s, expected %s" %
+                        (n["alg"], get_stats(io2)["alg"], alg))
+    sent = int(n["in"]) - int(s["in"])
+    out = int(n["out"]) - int(s["out"])
+    if sent != len(data):
+        raise Exception("Wrote %d bytes, stats say %d" % (len(data), sent))
+    if alg == "none" and out != sent:
+        raise Exception("Uncompressed %d bytes went out as %d" % (sent, out))
+    # Even flushed in 64 byte writes, test3 goes out 7 times smaller.
+    if alg == "deflate" and len(data) > 1000 and out * 4 > sent:
+        raise Exception("%d compressible bytes went out as %d" % (sent, out))
+    return n
+
+def do_compress_test(io1, io2, alg = "deflate"):
+    print("  testing io1 to io2")
+    check_xfer(io1, io2, test1, alg)
+    print("  testing io2 to io1")
+    check_xfer(io2, io1, test2, alg)
+    print("  testing large io1 to io2")
+    check_xfer(io1, io2, test3, alg)
+    print("  testing large io2 to io1")
+    check_xfer(io2, io1, test3, alg)
+
+def do_none_test(io1, io2):
+    do_compress_test(io1, io2, alg = "none")
+
+def do_level_test(io1, io2):
+    do_compress_test(io1, io2)
+    # Not adaptive, so the level must not have moved.
+    level = get_stats(io1)["level"]
+    if level != "9":
+        raise Exception("Fixed level 9 is now level " + level)
+
+print("Test compress")
+TestAccept(o, "compress,tcp,localhost,", "compress,tcp,0",
+           do_compress_test, chunksize = 64)
+print("Test compress fixed level, small buffers")
+TestAccept(o, "compress(level=9,adaptive=no,bufsize=100),tcp,localhost,",
+           "compress(bufsize=64),tcp,0",
+           do_level_test, chunksize = 64)
+print("Test compress disabled on the connecting side")
+TestAccept(o, "compress(enable=no),tcp,localhost,", "compress,tcp,0",
+           do_none_test, chunksize = 64)
+print("Test compress disabled on the accepting side")
+TestAccept(o, "compress,tcp,localhost,", "compress(enable=no),tcp,0",
+           do_none_test, chunksize = 64)
+del o
+test_shutdown()
+print("Success!")
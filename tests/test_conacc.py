@@ -127,8 +127,67 @@ class TestAcceptConAcc:
         if self.waiter.wait_timeout(1, 5000) == 0:
             raise Exception("test_conacc: Timed out");
 
+class StandbyAccHandler:
+    def __init__(self, o, name, ios, waiter):
+        self.o = o
+        self.name = name
+        self.ios = ios
+        self.waiter = waiter
+
+    def new_connection(self, acc, io):
+        self.ios.append(io)
+        HandleData(self.o, None, io = io,
+                   name = "%s%d" % (self.name, len(self.ios)))
+        self.waiter.wake()
+
+    def accepter_log(self, acc, level, logstr):
+        print("***%s LOG: %s: %s" % (level, self.name, logstr))
+
+class TestConAccStandby:
+    """With standby, a second tcp connection should be made while the
+    first is in use and handed out as soon as the first closes."""
+    def __init__(self, o):
+        self.o = o
+        self.tcp_ios = []
+        self.con_ios = []
+        self.waiter = gensio.waiter(o)
+
+        self.acc = gensio.gensio_accepter(
+            o, "tcp,0", StandbyAccHandler(o, "tcp", self.tcp_ios,
+                                          self.waiter));
+        self.acc.startup()
+        port = self.acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                                gensio.GENSIO_CONTROL_GET,
+                                gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+        self.acc2 = gensio.gensio_accepter(
+            o, "conacc(standby),tcp,localhost," + port,
+            StandbyAccHandler(o, "conacc", self.con_ios, self.waiter));
+
+        print(" First connection and standby")
+        self.acc2.startup()
+        self.wait_for(2, 1)
+        do_small_test(self.con_ios[0], self.tcp_ios[0])
+
+        print(" Standby handed out on close")
+        io_close((self.con_ios[0], self.tcp_ios[0]))
+        self.wait_for(3, 2)
+        do_small_test(self.con_ios[1], self.tcp_ios[1])
+
+        self.acc2.shutdown_s()
+        self.acc.shutdown_s()
+        self.acc = None
+        self.acc2 = None
+        io_close((self.con_ios[1], self.tcp_ios[1], self.tcp_ios[2]))
+
+    def wait_for(self, ntcp, ncon):
+        while len(self.tcp_ios) < ntcp or len(self.con_ios) < ncon:
+            if self.waiter.wait_timeout(1, 5000) == 0:
+                raise Exception("test_conacc: standby timed out");
+
 print("Test conacc")
 TestAcceptConAcc(o, "tcp,0", "conacc,tcp,localhost,",
                  "conacc(retry-time=1000),tcp,localhost,", do_small_test)
+print("Test conacc standby")
+TestConAccStandby(o)
 del o
 test_shutdown()
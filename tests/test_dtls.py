@@ -0,0 +1,42 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+print("Test dtls over udp")
+TestAccept(o, "dtls(CA=%s/CA.pem),udp,localhost," % keydir,
+           "dtls(key=%s/key.pem,cert=%s/cert.pem),udp,0" % (keydir, keydir),
+           do_small_test)
+
+print("Test dtls over udp with a small mtu")
+TestAccept(o, "dtls(CA=%s/CA.pem,mtu=512),udp,localhost," % keydir,
+           "dtls(key=%s/key.pem,cert=%s/cert.pem,mtu=512),udp,0"
+           % (keydir, keydir),
+           do_small_test)
+
+print("Test dtls over udp with client auth")
+TestAccept(o,
+           "dtls(CA=%s/CA.pem,key=%s/clientkey.pem,cert=%s/clientcert.pem)"
+           ",udp,localhost," % (keydir, keydir, keydir),
+           "dtls(key=%s/key.pem,cert=%s/cert.pem,clientauth,"
+           "CA=%s/clientcert.pem),udp,0" % (keydir, keydir, keydir),
+           do_small_test)
+
+print("Test dtls refuses a stream child")
+goterr = False
+try:
+    gensio.gensio(o, "dtls(CA=%s/CA.pem),tcp,localhost,1234" % keydir, None)
+except Exception as E:
+    print("  Success: " + str(E))
+    goterr = True
+if not goterr:
+    raise Exception("dtls over tcp did not fail")
+
+del o
+test_shutdown()
+print("Success!")
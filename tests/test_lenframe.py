@@ -0,0 +1,148 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test the lenframe gensio.  Besides moving data, each write must come
+# out as exactly one read with "eom" set, even if the gensio below
+# hands the frame up in pieces.  Only frames larger than the receiver's
+# readbuf may be split.
+#
+
+from utils import *
+import gensio
+
+test1 = "asdfasdf"
+test2 = "jkl;jkl;"
+# Larger than writebuf below, so frames will be split.
+test3 = "".join(chr(ord('a') + (i % 26)) for i in range(20000))
+
+def make_msg(size):
+    return "".join(chr(ord('a') + (i % 26)) for i in range(size)).encode()
+
+# The largest is the default writebuf and readbuf.
+MSGSIZES = (1, 63, 64, 65, 100, 1000, 20000, 65536)
+
+class ReadRecorder:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.reads = []
+        self.count = 0
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            raise HandlerException("Read error: %s" % err)
+        eom = auxdata is not None and "eom" in auxdata
+        self.reads.append((bytes(buf), eom))
+        self.count += len(buf)
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+def send_msgs(io1, io2, msgs):
+    """Write each message in msgs with "eom" on io1 and return the
+    reads io2 got for them.
+    """
+    rec = ReadRecorder(o)
+    io2.set_cbs(rec)
+    io2.read_cb_enable(True)
+    total = 0
+    for m in msgs:
+        timeout = time.time() + 2.0
+        while True:
+            # The rest of an earlier frame may still be waiting to go.
+            count = io1.write(m, ["eom"])
+            if count == len(m):
+                break
+            if count != 0:
+                raise HandlerException("Only wrote %d of %d bytes" %
+                                       (count, len(m)))
+            if time.time() >= timeout:
+                raise HandlerException("Timed out writing %d bytes" % len(m))
+            rec.waiter.wait_timeout(1, 10)
+        total += len(m)
+    timeout = time.time() + 10.0
+    while rec.count < total:
+        if time.time() >= timeout:
+            raise HandlerException("Got %d of %d bytes" % (rec.count, total))
+        rec.waiter.wait_timeout(1, 10)
+    io2.read_cb_enable(False)
+    io2.set_cbs(io2.handler)
+    return rec.reads
+
+def check_one_read_per_write(io1, io2):
+    msgs = [make_msg(i) for i in MSGSIZES]
+    reads = send_msgs(io1, io2, msgs)
+    for i in range(0, min(len(reads), len(msgs))):
+        if reads[i][0] != msgs[i]:
+            raise HandlerException("Write %d of %d bytes came out as a "
+                                   "read of %d bytes" %
+                                   (i, len(msgs[i]), len(reads[i][0])))
+        if not reads[i][1]:
+            raise HandlerException("Write %d did not have eom set" % i)
+    if len(reads) != len(msgs):
+        raise HandlerException("Got %d reads for %d writes" %
+                               (len(reads), len(msgs)))
+
+def do_lenframe_test(io1, io2, timeout=2000):
+    if not io1.is_message() or not io2.is_message():
+        raise Exception("lenframe gensio is not message oriented")
+    print("  testing io1 to io2")
+    test_dataxfer(io1, io2, test1, timeout = timeout)
+    print("  testing io2 to io1")
+    test_dataxfer(io2, io1, test2, timeout = timeout)
+    print("  testing large io1 to io2")
+    test_dataxfer(io1, io2, test3, timeout = 10000)
+    print("  testing large io2 to io1")
+    test_dataxfer(io2, io1, test3, timeout = 10000)
+
+def do_frame_test(io1, io2):
+    print("  testing frames io1 to io2")
+    check_one_read_per_write(io1, io2)
+    print("  testing frames io2 to io1")
+    check_one_read_per_write(io2, io1)
+    print("  Success!")
+
+def do_readbuf_test(io1, io2):
+    # io2 can't hold this frame, so it comes in pieces, only the last
+    # one ending the message.
+    msg = make_msg(20000)
+    reads = send_msgs(io1, io2, [msg])
+    if b"".join(r[0] for r in reads) != msg:
+        raise HandlerException("Data mismatch on a frame larger than readbuf")
+    if len(reads) < 2:
+        raise HandlerException("Frame larger than readbuf was not split")
+    if [r[1] for r in reads] != [False] * (len(reads) - 1) + [True]:
+        raise HandlerException("eom not only on the last piece")
+    # Smaller frames are still put back together.
+    msgs = [make_msg(i) for i in (100, 1000)]
+    reads = send_msgs(io1, io2, msgs)
+    if reads != [(m, True) for m in msgs]:
+        raise HandlerException("Frames within readbuf were split")
+    print("  Success!")
+
+gensios_enabled.check_iostr_gensios("lenframe")
+
+print("Test lenframe")
+TestAccept(o, "lenframe,tcp,localhost,", "lenframe,tcp,0",
+           do_lenframe_test, chunksize = 64)
+print("Test lenframe small frames")
+TestAccept(o, "lenframe(writebuf=100),tcp,localhost,",
+           "lenframe(writebuf=1000),tcp,0",
+           do_lenframe_test, chunksize = 64)
+print("Test lenframe one read per write")
+TestAccept(o, "lenframe,tcp,localhost,", "lenframe,tcp,0", do_frame_test)
+print("Test lenframe frames split by short reads below")
+TestAccept(o, "lenframe,tcp(readbuf=64),localhost,",
+           "lenframe,tcp(readbuf=64),0", do_frame_test)
+print("Test lenframe frames larger than readbuf")
+TestAccept(o, "lenframe,tcp(readbuf=64),localhost,",
+           "lenframe(readbuf=1000),tcp(readbuf=64),0", do_readbuf_test)
+del o
+test_shutdown()
+print("Success!")
@@ -0,0 +1,36 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+class MetricsAccHandler:
+    def new_connection(self, acc, io):
+        raise HandlerException("metrics accepter reported a connection")
+
+print("Test metrics")
+acc = gensio.gensio_accepter(o, "metrics,tcp,localhost,0",
+                             MetricsAccHandler())
+acc.startup()
+port = acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                   gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+
+# The request itself is a tcp write, so the tcp write counters will
+# be there when the metrics are gathered.
+io = alloc_io(o, "tcp,localhost," + port)
+io.handler.set_write_data("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n")
+io.handler.set_waitfor('gensio_write_bytes_total{type="tcp"}')
+if (io.handler.wait_timeout(2000) == 0):
+    raise Exception("test_metrics: Timed out waiting for the metrics")
+io_close((io,))
+acc.shutdown_s()
+del io
+del acc
+del o
+test_shutdown()
+print("  Success!")
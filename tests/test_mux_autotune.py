@@ -0,0 +1,68 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test mux receive window auto-tuning.  The accepting end has
+# max_readbuf set, bulk data to it should grow its read buffer if both
+# ends are version 3 or later, and leave it alone otherwise.
+#
+
+from utils import *
+import gensio
+
+def get_readbuf(io):
+    s = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    stats = dict(i.split("=", 1) for i in s.split())
+    return int(stats["readbuf"])
+
+class AutotuneTest:
+    def __init__(self, max_readbuf, grow):
+        self.max_readbuf = max_readbuf
+        self.grow = grow
+
+    def test(self, io1, io2):
+        start = get_readbuf(io2)
+        sender = get_readbuf(io1)
+        test_dataxfer(io1, io2, os.urandom(1048570), timeout = 30000)
+        end = get_readbuf(io2)
+        print("  readbuf went from %d to %d" % (start, end))
+        if end > self.max_readbuf:
+            raise Exception("readbuf %d grew past max_readbuf %d" %
+                            (end, self.max_readbuf))
+        if self.grow and end <= start:
+            raise Exception("readbuf did not grow from %d" % start)
+        if not self.grow and end != start:
+            raise Exception("readbuf changed from %d to %d" % (start, end))
+        # Nothing came to the sender, its buffer is left alone.
+        if get_readbuf(io1) != sender:
+            raise Exception("sender readbuf changed from %d to %d" %
+                            (sender, get_readbuf(io1)))
+        print("  Success!")
+
+gensios_enabled.check_iostr_gensios("mux,tcp")
+
+print("Test mux window auto-tuning")
+TestAccept(o, "mux,tcp,localhost,", "mux(max_readbuf=1048576),tcp,0",
+           AutotuneTest(1048576, True).test)
+
+print("Test mux window auto-tuning with a small max_readbuf")
+TestAccept(o, "mux,tcp,localhost,", "mux(max_readbuf=100000),tcp,0",
+           AutotuneTest(100000, True).test)
+
+print("Test mux window auto-tuning against version 2")
+TestAccept(o, "mux(version=2),tcp,localhost,",
+           "mux(max_readbuf=1048576),tcp,0",
+           AutotuneTest(1048576, False).test)
+
+print("Test mux without window auto-tuning")
+TestAccept(o, "mux,tcp,localhost,", "mux,tcp,0",
+           AutotuneTest(1048576, False).test)
+
+del o
+test_shutdown()
+print("Success!")
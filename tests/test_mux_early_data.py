@@ -0,0 +1,159 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test writing data on a new mux channel right after the open call,
+# before the remote end has responded to the open.  A version 4 remote
+# end takes the data, an older one doesn't.
+#
+
+from utils import *
+import gensio
+
+class EarlyHandler:
+    def __init__(self, o, refuse = False):
+        self.waiter = gensio.waiter(o)
+        self.refuse = refuse
+        self.data = {}
+        self.open_err = {}
+        self.newchans = []
+        self.closed = 0
+
+    def service(self, io):
+        return io.control(0, gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_CONTROL_SERVICE, None)
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            if err != "Remote end closed connection":
+                raise HandlerException("Invalid error on read close: %s" %
+                                       err)
+            io.read_cb_enable(False)
+            io.close(self)
+            return 0
+        s = self.service(io)
+        self.data[s] = self.data.get(s, b"") + buf
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+    def new_channel(self, io1, io2, auxdata):
+        if self.refuse:
+            return gensio.GE_APPERR
+        self.newchans.append(io2)
+        io2.set_cbs(self)
+        io2.read_cb_enable(True)
+        self.waiter.wake()
+        return 0
+
+    def new_connection(self, acc, io):
+        self.newchans.append(io)
+        io.set_cbs(self)
+        io.read_cb_enable(True)
+        self.waiter.wake()
+
+    def open_done(self, io, err):
+        self.open_err[self.service(io)] = err
+        if not err:
+            io.read_cb_enable(True)
+        self.waiter.wake()
+
+    def close_done(self, io):
+        self.closed += 1
+        self.waiter.wake()
+
+    def wait_for(self, cond, what, timeout = 2000):
+        end = time.time() + timeout / 1000.0
+        while not cond():
+            if time.time() >= end:
+                raise HandlerException("Timeout waiting for " + what)
+            self.waiter.wait_timeout(1, 10)
+
+def do_early_test(version, refuse = False):
+    acch = EarlyHandler(o, refuse = refuse)
+    muxacc = gensio.gensio_accepter(o, "mux(version=%d),tcp,0" % version,
+                                    acch)
+    muxacc.startup()
+    port = muxacc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                          gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+
+    clh = EarlyHandler(o)
+    muxcl = gensio.gensio(o, "mux(service=main),tcp,localhost," + port, clh)
+    muxcl.open(clh)
+    clh.wait_for(lambda: "main" in clh.open_err, "mux open")
+    if clh.open_err["main"]:
+        raise HandlerException("mux open failed: " + clh.open_err["main"])
+    acch.wait_for(lambda: len(acch.newchans) == 1, "mux accept")
+
+    chan = muxcl.alloc_channel(["service=early"], clh)
+    chan.open(clh)
+    data = os.urandom(100)
+    try:
+        count = chan.write(data, None)
+    except Exception as E:
+        if version >= 4:
+            raise
+        if str(E) != "gensio:write: Object was not ready for operation":
+            raise HandlerException("Wrong early write error: " + str(E))
+        count = 0
+    else:
+        if version < 4:
+            raise HandlerException("Early write worked on version %d" %
+                                   version)
+    if "early" in clh.open_err:
+        raise HandlerException("Open completed before it could")
+    if version >= 4 and count != len(data):
+        raise HandlerException("Early write only took %d bytes" % count)
+
+    clh.wait_for(lambda: "early" in clh.open_err, "channel open")
+    if refuse:
+        if clh.open_err["early"] != "Application error":
+            raise HandlerException("Wrong refused open error: " +
+                                   str(clh.open_err["early"]))
+        # Give the data time to show up if it was going to.
+        acch.waiter.wait_timeout(1, 100)
+        if "early" in acch.data:
+            raise HandlerException("Got data on a refused channel")
+        chan = None
+    else:
+        if clh.open_err["early"]:
+            raise HandlerException("Channel open failed: " +
+                                   clh.open_err["early"])
+        if count == 0:
+            count = chan.write(data, None)
+        # Data after the open response goes in order after the early
+        # data.
+        chan.write(data, None)
+        acch.wait_for(lambda: len(acch.data.get("early", b"")) >= 200,
+                      "channel data")
+        if acch.data["early"] != data + data:
+            raise HandlerException("Channel data mismatch")
+        chan.close(clh)
+        clh.wait_for(lambda: clh.closed == 1, "channel close")
+    muxcl.close(clh)
+    clh.wait_for(lambda: clh.closed == (1 if refuse else 2), "mux close")
+    acch.wait_for(lambda: acch.closed == len(acch.newchans), "remote close")
+    muxacc.shutdown_s()
+    print("  Success!")
+
+gensios_enabled.check_iostr_gensios("mux,tcp")
+
+print("Test mux data before the open response")
+do_early_test(4)
+
+print("Test mux data before the open response against version 3")
+do_early_test(3)
+
+print("Test mux data before a refused open response")
+do_early_test(4, refuse = True)
+
+del o
+test_shutdown()
+print("Success!")
@@ -0,0 +1,173 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test mux channel priority.  A low priority channel keeps the link
+# full, then a second channel sends a block of data.  If the second
+# channel has a higher priority, little low priority data should get
+# through until it is done.  If they have the same priority they
+# share the link.
+#
+# The link is rate limited so it is the bottleneck, otherwise the mux
+# can send everything as soon as it is written and there is nothing to
+# schedule.
+#
+
+from utils import *
+import gensio
+
+HIGH_SIZE = 1000000
+
+class PrioSender:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.towrite = {}
+        self.opened = {}
+        self.closed = 0
+        self.data = b"x" * 4096
+
+    def service(self, io):
+        return io.control(0, gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_CONTROL_SERVICE, None)
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            raise HandlerException("Read error on sender: %s" % err)
+        raise HandlerException("Unexpected read on sender")
+
+    def write_callback(self, io):
+        s = self.service(io)
+        left = self.towrite.get(s, 0)
+        if left <= 0:
+            io.write_cb_enable(False)
+            return
+        # Small writes, so the channel always has a message queued.
+        count = io.write(self.data[:min(left, len(self.data))], None)
+        self.towrite[s] = left - count
+
+    def open_done(self, io, err):
+        if err:
+            raise HandlerException("Open error on sender: %s" % err)
+        self.opened[self.service(io)] = True
+        io.write_cb_enable(True)
+        self.waiter.wake()
+
+    def close_done(self, io):
+        self.closed += 1
+        self.waiter.wake()
+
+class PrioReceiver:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.chans = []
+        self.received = {}
+        self.low_at_high_start = None
+        self.low_at_high_end = None
+        self.closed = 0
+
+    def service(self, io):
+        return io.control(0, gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_CONTROL_SERVICE, None)
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            if err != "Remote end closed connection":
+                raise HandlerException("Invalid error on read close: %s" %
+                                       err)
+            io.read_cb_enable(False)
+            io.close(self)
+            return 0
+        s = self.service(io)
+        if s == "high" and self.low_at_high_start is None:
+            self.low_at_high_start = self.received.get("low", 0)
+        self.received[s] = self.received.get(s, 0) + len(buf)
+        if (s == "high" and self.received[s] >= HIGH_SIZE and
+                self.low_at_high_end is None):
+            self.low_at_high_end = self.received.get("low", 0)
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+    def new_channel(self, io1, io2, auxdata):
+        self.chans.append(io2)
+        io2.set_cbs(self)
+        io2.read_cb_enable(True)
+        return 0
+
+    def new_connection(self, acc, io):
+        self.new_channel(None, io, None)
+
+    def close_done(self, io):
+        self.closed += 1
+        self.waiter.wake()
+
+def wait_for(h, cond, what, timeout = 10000):
+    end = time.time() + timeout / 1000.0
+    while not cond():
+        if time.time() >= end:
+            raise HandlerException("Timeout waiting for " + what)
+        h.waiter.wait_timeout(1, 10)
+
+def do_priority_test(high_prio):
+    rh = PrioReceiver(o)
+    # Big windows so the channels are not held back by them.
+    muxacc = gensio.gensio_accepter(o, "mux(readbuf=1048576),tcp,0", rh)
+    muxacc.startup()
+    port = muxacc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                          gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+
+    sh = PrioSender(o)
+    muxcl = gensio.gensio(o,
+        "mux(service=main,writebuf=65536),ratelimit(xmit_rate=4000000),"
+        "tcp,localhost," + port, sh)
+    muxcl.open(sh)
+    wait_for(sh, lambda: "main" in sh.opened, "mux open")
+
+    # Keep the low priority channel busy for the whole test.
+    sh.towrite["low"] = 1000000000
+    low = muxcl.alloc_channel(["service=low", "priority=0"], sh)
+    low.open(sh)
+    wait_for(rh, lambda: rh.received.get("low", 0) >= 100000,
+             "low priority data")
+
+    sh.towrite["high"] = HIGH_SIZE
+    high = muxcl.alloc_channel(["service=high", "priority=%d" % high_prio],
+                               sh)
+    high.open(sh)
+    wait_for(rh, lambda: rh.low_at_high_end is not None, "high data",
+             timeout = 30000)
+    sh.towrite["low"] = 0
+
+    low_bytes = rh.low_at_high_end - rh.low_at_high_start
+    print("  %d low priority bytes arrived with %d high" %
+          (low_bytes, HIGH_SIZE))
+    if high_prio > 0 and low_bytes > HIGH_SIZE / 2:
+        raise HandlerException("Low priority channel was not held off")
+    if high_prio == 0 and low_bytes < HIGH_SIZE / 2:
+        raise HandlerException("Low priority channel did not get its share")
+
+    for io in (high, low, muxcl):
+        io.close(sh)
+    wait_for(sh, lambda: sh.closed == 3, "sender close", timeout = 30000)
+    wait_for(rh, lambda: rh.closed == len(rh.chans), "receiver close")
+    muxacc.shutdown_s()
+    print("  Success!")
+
+gensios_enabled.check_iostr_gensios("mux,ratelimit,tcp")
+
+print("Test mux with a higher priority channel")
+do_priority_test(10)
+
+print("Test mux with channels of the same priority")
+do_priority_test(0)
+
+del o
+test_shutdown()
+print("Success!")
@@ -0,0 +1,67 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def get_stats(io):
+    s = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+class VersionTest:
+    def __init__(self, version):
+        self.version = version
+
+    def test(self, io1, io2):
+        for io in (io1, io2):
+            v = int(get_stats(io)["version"])
+            if v != self.version:
+                raise Exception("mux negotiated version %d, expected %d" %
+                                (v, self.version))
+        # Version 1 can only send 64K messages, this has to be split.
+        do_medium_test(io1, io2)
+
+gensios_enabled.check_iostr_gensios("mux,tcp")
+
+# Each pair is the highest version of the connecting and the accepting
+# end, the lowest of the two must be used.
+for (v1, v2) in ((1, 4), (4, 1), (2, 4), (4, 2), (2, 3), (3, 2),
+                 (3, 4), (4, 3), (1, 1), (4, 4)):
+    print("Test mux version %d against version %d" % (v1, v2))
+    TestAccept(o, "mux(version=%d),tcp,localhost," % v1,
+               "mux(version=%d),tcp,0" % v2,
+               VersionTest(min(v1, v2)).test)
+
+print("Test mux default version against version 2")
+TestAccept(o, "mux,tcp,localhost,", "mux(version=2),tcp,0",
+           VersionTest(2).test)
+
+class ParmLog:
+    def __init__(self):
+        self.log = None
+
+    def parmlog(self, log):
+        self.log = log
+
+for v in (0, 5):
+    print("Test mux invalid version %d" % v)
+    p = ParmLog()
+    try:
+        gensio.gensio(o, "mux(version=%d),tcp,localhost,1234" % v, p)
+    except Exception as E:
+        if str(E) != "gensio:gensio alloc: Invalid data to parameter":
+            raise Exception("Unknown exception from bad version: " + str(E))
+    else:
+        raise Exception("Did not get an exception from a bad version")
+    if p.log != "gensio mux: version must be 1 to 4":
+        raise Exception("Invalid parm log: " + str(p.log))
+    del p
+
+del o
+test_shutdown()
+print("Success!")
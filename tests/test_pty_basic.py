@@ -20,6 +20,13 @@ io_close([io])
 del io
 print("  Success!")
 
+print("Test pty coalesce")
+io = alloc_io(o, "pty(coalesce=256,coalesce-time=10m),cat", chunksize = 64)
+test_dataxfer(io, io, "This is a test string!" * 20)
+io_close([io])
+del io
+print("  Success!")
+
 def test_with_ptsname_r():
     print("Test pty accepter")
     TestAccept(o, "serialdev,", "conacc,pty", do_small_test)
@@ -25,12 +25,118 @@ def do_ratelimit_test1(io1, io2, timeout=2000):
 def do_ratelimit_test2(io1, io2, timeout=2000):
     do_ratelimit_test1(io2, io1, timeout)
 
+# The rate and burst used in the token bucket tests, in bytes.
+BUCKET_RATE = 20000
+BUCKET_BURST = 20000
+
+def do_bucket_test1(io1, io2):
+    # A burst, then two seconds worth of data.
+    data = os.urandom(BUCKET_BURST + 2 * BUCKET_RATE)
+    start = time.time()
+    io1.handler.set_write_data(data)
+    io2.handler.set_compare(data[:BUCKET_BURST])
+    if (io2.handler.wait_timeout(500) == 0):
+        raise Exception("do_bucket_test: %s: Burst was not let through" %
+                        io2.handler.name)
+    io2.handler.set_compare(data[BUCKET_BURST:])
+    if (io2.handler.wait_timeout(4000) == 0):
+        raise Exception("do_bucket_test: %s: Data after the burst wasn't "
+                        "received" % io2.handler.name)
+    t = time.time() - start
+    if t < 1.8:
+        raise Exception("do_bucket_test: %s: Sent data too fast, %.2fs" %
+                        (io1.handler.name, t))
+    if t > 3.0:
+        raise Exception("do_bucket_test: %s: Sent data too slowly, %.2fs" %
+                        (io1.handler.name, t))
+    io1.handler.wait_timeout(1000)
+
+    # The other direction is not limited.
+    data = os.urandom(BUCKET_BURST + 2 * BUCKET_RATE)
+    start = time.time()
+    test_dataxfer(io2, io1, data)
+    t = time.time() - start
+    if t > 1.0:
+        raise Exception("do_bucket_test: %s: Unlimited direction was "
+                        "limited, %.2fs" % (io2.handler.name, t))
+
+def do_bucket_test2(io1, io2):
+    do_bucket_test1(io2, io1)
+
+# Group tests use a small burst so the rate is what is measured.
+GROUP_RATE = 20000
+GROUP_BURST = 2000
+GROUP_SIZE = 30000
+
+def do_group_xfer(pairs, same_group):
+    data = [os.urandom(GROUP_SIZE) for p in pairs]
+    done = [None for p in pairs]
+    start = time.time()
+    for (io1, io2), d in zip(pairs, data):
+        io1.handler.set_write_data(d)
+        io2.handler.set_compare(d)
+    while None in done:
+        pairs[0][1].handler.waiter.wait_timeout(1, 10)
+        t = time.time() - start
+        for i, (io1, io2) in enumerate(pairs):
+            if done[i] is None and io2.handler.to_compare is None:
+                done[i] = t
+        if t > 10.0:
+            raise Exception("do_group_test: Timed out, %s" % str(done))
+    print("  Done at %s" % ", ".join("%.2fs" % t for t in done))
+
+    if same_group:
+        # Both pairs share one budget, so neither can get done before
+        # the total has gone through at the group rate, and neither may
+        # be starved much past that.
+        total = (len(pairs) * GROUP_SIZE - GROUP_BURST) / GROUP_RATE
+        for t in done:
+            if t < total * 0.8:
+                raise Exception("do_group_test: Group sent data too fast, "
+                                "%.2fs" % t)
+            if t > total * 1.7:
+                raise Exception("do_group_test: Group member was starved, "
+                                "%.2fs" % t)
+    else:
+        # Each has its own budget, so they run in parallel.
+        single = (GROUP_SIZE - GROUP_BURST) / GROUP_RATE
+        for t in done:
+            if t > single + 0.6:
+                raise Exception("do_group_test: Separate groups were "
+                                "limited together, %.2fs" % t)
+    for io1, io2 in pairs:
+        io1.handler.wait_timeout(1000)
+
+def do_group_test(group1, group2):
+    def tester1(io1, io2):
+        def tester2(io3, io4):
+            do_group_xfer([(io1, io2), (io3, io4)], group1 == group2)
+        TestAccept(o, "ratelimit(group=%s,group_xmit_rate=%d,group_burst=%d),"
+                   "tcp,localhost," % (group2, GROUP_RATE, GROUP_BURST),
+                   "tcp,0", tester2)
+    TestAccept(o, "ratelimit(group=%s,group_xmit_rate=%d,group_burst=%d),"
+               "tcp,localhost," % (group1, GROUP_RATE, GROUP_BURST),
+               "tcp,0", tester1)
+
 print("Test ratelimit gensio")
 TestAccept(o, "ratelimit(xmit_delay=100m),tcp,localhost,", "tcp,0",
            do_ratelimit_test1, chunksize = 64)
 print("Test ratelimit accepter")
 TestAccept(o, "tcp,localhost,", "ratelimit(xmit_delay=100m),tcp,0",
            do_ratelimit_test2, chunksize = 64)
+print("Test ratelimit token bucket transmit")
+TestAccept(o, "ratelimit(xmit_rate=%d,xmit_burst=%d),tcp,localhost," %
+           (BUCKET_RATE, BUCKET_BURST), "tcp,0", do_bucket_test1)
+print("Test ratelimit token bucket receive")
+TestAccept(o, "tcp,localhost,", "ratelimit(recv_rate=%d,recv_burst=%d),tcp,0" %
+           (BUCKET_RATE, BUCKET_BURST), do_bucket_test1)
+print("Test ratelimit token bucket accepter transmit")
+TestAccept(o, "tcp,localhost,", "ratelimit(xmit_rate=%d,xmit_burst=%d),tcp,0" %
+           (BUCKET_RATE, BUCKET_BURST), do_bucket_test2)
+print("Test ratelimit gensios sharing a group")
+do_group_test("rlg1", "rlg1")
+print("Test ratelimit gensios in different groups")
+do_group_test("rlg2", "rlg3")
 del o
 test_shutdown()
 print("Success!")
@@ -0,0 +1,73 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test relpkt delayed acks with data going only one way, so there is
+# no data going back to carry the acks and the ack timer has to send
+# them.
+#
+
+from utils import *
+import gensio
+
+def get_stats(io):
+    s = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+def check_stat(io, name, value):
+    stats = get_stats(io)
+    if int(stats[name]) != value:
+        raise Exception("%s: %s was not %d, stats: %s" %
+                        (io.handler.name, name, value, str(stats)))
+
+def wait_acked(io, timeout):
+    w = gensio.waiter(o)
+    end = time.time() + timeout / 1000.0
+    while int(get_stats(io)["inflight"]) != 0:
+        if time.time() >= end:
+            raise Exception("%s: data not acked in %dms, stats: %s" %
+                            (io.handler.name, timeout,
+                             str(get_stats(io))))
+        w.service(10)
+    del w
+
+def do_delayed_ack_test(io1, io2):
+    print("  testing a single packet")
+    test_dataxfer(io1, io2, "x" * 100)
+    # Less than ack_every packets, the ack is held for ack_delay.
+    check_stat(io1, "inflight", 1)
+    wait_acked(io1, 1000)
+    # The sender must allow for the delay in its retransmit timeout.
+    check_stat(io1, "retransmits", 0)
+    check_stat(io1, "timeouts", 0)
+
+    print("  testing bulk data")
+    # Not a multiple of ack_every packets, the last ones need the timer.
+    test_dataxfer(io1, io2, os.urandom(131071), timeout = 10000)
+    wait_acked(io1, 1000)
+    print("  Success!")
+
+def do_no_delayed_ack_test(io1, io2):
+    test_dataxfer(io1, io2, "x" * 100)
+    # Version 2 can't do delayed acks, it should be acked right away.
+    wait_acked(io1, 100)
+    print("  Success!")
+
+print("Test relpkt delayed acks with one-way data")
+TestAccept(o, "relpkt,udp,localhost,",
+           "relpkt(ack_every=8,ack_delay=200m),udp,localhost,0",
+           do_delayed_ack_test)
+
+print("Test relpkt delayed acks against version 2")
+TestAccept(o, "relpkt(version=2),udp,localhost,",
+           "relpkt(ack_every=8,ack_delay=200m),udp,localhost,0",
+           do_no_delayed_ack_test)
+
+del o
+test_shutdown()
+print("Success!")
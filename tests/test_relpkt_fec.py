@@ -0,0 +1,84 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test relpkt forward error correction and congestion control with
+# bulk data.  The drop option throws away data packets so the FEC
+# messages have something to rebuild.
+#
+
+from utils import *
+import gensio
+
+def get_stats(io):
+    s = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+def check_stat(io, name, test, desc):
+    stats = get_stats(io)
+    if not test(stats[name]):
+        raise Exception("%s: %s was not %s, stats: %s" %
+                        (io.handler.name, name, desc, str(stats)))
+
+def nonzero(v):
+    return int(v) != 0
+
+def zero(v):
+    return int(v) == 0
+
+def do_fec_both_test(io1, io2):
+    do_large_test(io1, io2)
+    for io in (io1, io2):
+        check_stat(io, "cc", lambda v: v == "bbr", "bbr")
+        check_stat(io, "fec_sent", nonzero, "non-zero")
+        check_stat(io, "fec_recovered", nonzero, "non-zero")
+
+def do_fec_one_test(io1, io2):
+    do_medium_test(io1, io2)
+    check_stat(io1, "fec_sent", nonzero, "non-zero")
+    check_stat(io2, "fec_sent", zero, "zero")
+    check_stat(io2, "fec_recovered", nonzero, "non-zero")
+
+def do_fec_old_test(io1, io2):
+    do_medium_test(io1, io2)
+    # The other end can't take FEC, lost packets must be resent.
+    check_stat(io1, "version", lambda v: v == "1", "1")
+    check_stat(io1, "fec_sent", zero, "zero")
+    check_stat(io1, "retransmits", nonzero, "non-zero")
+    check_stat(io2, "fec_recovered", zero, "zero")
+
+def do_bbr_one_test(io1, io2):
+    do_large_test(io1, io2)
+    check_stat(io1, "cc", lambda v: v == "bbr", "bbr")
+    check_stat(io1, "pacing_rate", nonzero, "non-zero")
+    check_stat(io2, "cc", lambda v: v == "newreno", "newreno")
+    check_stat(io2, "pacing_rate", zero, "zero")
+
+print("Test relpkt fec and bbr on both ends")
+TestAccept(o, "relpkt(cc=bbr,fec=4,drop=10),udp,localhost,",
+           "relpkt(cc=bbr,fec=4,drop=9),udp,localhost,0",
+           do_fec_both_test)
+
+print("Test relpkt fec on one end")
+TestAccept(o, "relpkt(fec=4,drop=9),udp,localhost,",
+           "relpkt,udp,localhost,0",
+           do_fec_one_test)
+
+print("Test relpkt fec against an end without fec support")
+TestAccept(o, "relpkt(fec=4,drop=9),udp,localhost,",
+           "relpkt(version=1),udp,localhost,0",
+           do_fec_old_test)
+
+print("Test relpkt bbr on one end")
+TestAccept(o, "relpkt(cc=bbr),udp,localhost,",
+           "relpkt,udp,localhost,0",
+           do_bbr_one_test)
+
+del o
+test_shutdown()
+print("Success!")
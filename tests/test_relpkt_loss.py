@@ -0,0 +1,57 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Use the relpkt drop option to throw away data packets, leaving gaps
+# that the receiver has to report (with selective acks, or resend
+# requests in version 0) and the sender has to fill in.  The data must
+# still arrive intact and in order.
+#
+
+from utils import *
+import gensio
+
+def get_stats(io):
+    s = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+def check_resent(io):
+    stats = get_stats(io)
+    if int(stats["retransmits"]) == 0:
+        raise Exception("%s: no packets were resent, stats: %s" %
+                        (io.handler.name, str(stats)))
+
+def do_loss_test(io1, io2, size = 131071, timeout = 10000):
+    rb = os.urandom(size)
+    print("  testing io1 to io2")
+    test_dataxfer(io1, io2, rb, timeout = timeout)
+    check_resent(io1)
+    print("  testing io2 to io1")
+    test_dataxfer(io2, io1, rb, timeout = timeout)
+    check_resent(io2)
+    print("  testing bidirection between io1 and io2")
+    test_dataxfer_simul(io1, io2, rb, timeout = timeout)
+    print("  Success!")
+
+def do_small_loss_test(io1, io2):
+    do_loss_test(io1, io2, size = 40000)
+
+for version in (3, 1, 0):
+    print("Test relpkt version %d with lost packets" % version)
+    TestAccept(o, "relpkt(version=%d,drop=7),udp,localhost," % version,
+               "relpkt(version=%d,drop=5),udp,localhost,0" % version,
+               do_loss_test)
+
+print("Test relpkt with lost packets and small packets")
+TestAccept(o, "relpkt(drop=5,max_pktsize=100),udp,localhost,",
+           "relpkt(drop=6,max_pktsize=100),udp,localhost,0",
+           do_small_loss_test)
+
+del o
+test_shutdown()
+print("Success!")
@@ -0,0 +1,72 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def get_stats(io):
+    s = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+class VersionTest:
+    def __init__(self, version):
+        self.version = version
+
+    def test(self, io1, io2, timeout = 10000):
+        for io in (io1, io2):
+            v = int(get_stats(io)["version"])
+            if v != self.version:
+                raise Exception("relpkt negotiated version %d, expected %d" %
+                                (v, self.version))
+        # Enough small packets that the sequence numbers wrap in
+        # version 0.
+        rb = os.urandom(40000)
+        print("  testing io1 to io2")
+        test_dataxfer(io1, io2, rb, timeout = timeout)
+        print("  testing io2 to io1")
+        test_dataxfer(io2, io1, rb, timeout = timeout)
+        print("  testing bidirection between io1 and io2")
+        test_dataxfer_simul(io1, io2, rb, timeout = timeout)
+        print("  Success!")
+
+# Each pair is the highest version of the connecting and the accepting
+# end, the lowest of the two must be used.
+for (v1, v2) in ((0, 3), (3, 0), (0, 0), (1, 3), (3, 1), (2, 3), (3, 2),
+                 (2, 1), (3, 3)):
+    print("Test relpkt version %d against version %d" % (v1, v2))
+    TestAccept(o, "relpkt(version=%d,max_pktsize=100),udp,localhost," % v1,
+               "relpkt(version=%d,max_pktsize=100),udp,localhost,0" % v2,
+               VersionTest(min(v1, v2)).test)
+
+print("Test relpkt default version against version 0")
+TestAccept(o, "relpkt,udp,localhost,", "relpkt(version=0),udp,localhost,0",
+           VersionTest(0).test)
+
+class ParmLog:
+    def __init__(self):
+        self.log = None
+
+    def parmlog(self, log):
+        self.log = log
+
+print("Test relpkt invalid version")
+p = ParmLog()
+try:
+    gensio.gensio(o, "relpkt(version=4),udp,localhost,1234", p)
+except Exception as E:
+    if str(E) != "gensio:gensio alloc: Invalid data to parameter":
+        raise Exception("Unknown exception from bad version: " + str(E))
+else:
+    raise Exception("Did not get an exception from a bad version")
+if p.log != "gensio relpkt: version must be 3 or less":
+    raise Exception("Invalid parm log: " + str(p.log))
+del p
+
+del o
+test_shutdown()
+print("Success!")
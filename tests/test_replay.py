@@ -0,0 +1,46 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+import os
+import struct
+
+# A binary trace with the first write captured fully, the second cut
+# off by snaplen, and a read that should be ignored.
+def trace_rec(rtype, data, origlen, secs, nsecs):
+    return struct.pack("<HHIIIQ", rtype, 0, len(data), origlen,
+                       nsecs, secs) + data
+
+trace = b"GENSIOTR"
+trace += trace_rec(0, struct.pack("<IIQ", 2, 4, 0), 0, 10, 0)
+trace += trace_rec(2, b"asdfasdf", 8, 10, 1000000)
+trace += trace_rec(1, b"xxxx", 4, 10, 2000000)
+trace += trace_rec(2, b"jkl;", 10, 10, 50000000)
+expected = "asdfasdfjkl;" + "\0" * 6
+
+def do_replay_test(io1, io2, timeout=2000):
+    io1.handler.ignore_input = True
+    io1.handler.waiting_rem_close = True
+    io1.read_cb_enable(True)
+    io2.handler.set_compare(expected)
+    if (io2.handler.wait_timeout(timeout) == 0):
+        raise Exception("test_replay: io2 did not get the data in time")
+    if (io1.handler.wait_timeout(timeout) == 0):
+        raise Exception("test_replay: io1 did not finish in time")
+
+print("Test replay")
+f = open("asdf", "wb")
+f.write(trace)
+f.close()
+
+TestAccept(o, "replay(file=asdf),tcp,localhost,", "tcp,0", do_replay_test)
+
+os.remove("asdf")
+del o
+test_shutdown()
+print("  Success!")
@@ -0,0 +1,134 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+SHMSOCK = "/tmp/gensioshmtest"
+RINGSIZE = 4096
+
+test1 = "asdfasdf"
+test2 = "jkl;jkl;"
+# Larger than the ring size below, so the writer has to wait for space.
+test3 = "".join(chr(ord('a') + (i % 26)) for i in range(20000))
+
+def get_stats(io):
+    s = io.control(0, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict((k, int(v)) for k, v in (i.split("=", 1) for i in s.split()))
+
+def do_shm_test(io1, io2, timeout=2000):
+    print("  testing io1 to io2")
+    test_dataxfer(io1, io2, test1, timeout = timeout)
+    print("  testing io2 to io1")
+    test_dataxfer(io2, io1, test2, timeout = timeout)
+    print("  testing large io1 to io2")
+    test_dataxfer(io1, io2, test3, timeout = 10000)
+    print("  testing large io2 to io1")
+    test_dataxfer(io2, io1, test3, timeout = 10000)
+
+def do_doorbell_test(io1, io2):
+    # Each end is asleep waiting for data, so a write has to ring the
+    # other end's doorbell exactly once.
+    s1 = get_stats(io1)
+    s2 = get_stats(io2)
+    test_dataxfer(io1, io2, test1)
+    n1 = get_stats(io1)
+    n2 = get_stats(io2)
+    if n1["doorbells_sent"] != s1["doorbells_sent"] + 1:
+        raise Exception("Writer sent %d doorbells, expected 1" %
+                        (n1["doorbells_sent"] - s1["doorbells_sent"]))
+    if n2["doorbells_rcvd"] != s2["doorbells_rcvd"] + 1:
+        raise Exception("Reader got %d doorbells, expected 1" %
+                        (n2["doorbells_rcvd"] - s2["doorbells_rcvd"]))
+    print("  Success!")
+
+def do_full_ring_test(io1, io2):
+    s1 = get_stats(io1)
+    if s1["size"] != RINGSIZE:
+        raise Exception("Ring size is %d, expected %d" %
+                        (s1["size"], RINGSIZE))
+
+    # Nothing is reading, so the writer must stop when the ring fills.
+    io1.handler.set_write_data(test3)
+    if io1.handler.wait_timeout(200) != 0:
+        raise Exception("Write finished with the ring full")
+    if io1.handler.wrpos != RINGSIZE:
+        raise Exception("Writer stopped at %d, expected %d" %
+                        (io1.handler.wrpos, RINGSIZE))
+    n1 = get_stats(io1)
+    if n1["tx_full"] <= s1["tx_full"]:
+        raise Exception("Writer did not see the ring full")
+
+    # Reading makes space, the reader's doorbell has to wake the writer.
+    io2.handler.set_compare(test3)
+    if io1.handler.wait_timeout(10000) == 0:
+        raise Exception("Writer was not woken up at byte %d" %
+                        io1.handler.wrpos)
+    if io2.handler.wait_timeout(10000) == 0:
+        raise Exception("Reader timed out at byte %d" % io2.handler.compared)
+    if get_stats(io1)["doorbells_rcvd"] <= n1["doorbells_rcvd"]:
+        raise Exception("Writer got no doorbell for space")
+    print("  Success!")
+
+class CorruptReader:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.err = None
+        self.data = b""
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            self.err = err
+            io.read_cb_enable(False)
+            self.waiter.wake()
+            return 0
+        self.data += bytes(buf)
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+def do_corrupt_test(io1, io2):
+    # The writer puts a head index past the end of the ring in shared
+    # memory, the reader must refuse it instead of reading from it.
+    rd = CorruptReader(o)
+    io2.set_cbs(rd)
+    io2.read_cb_enable(True)
+    io1.write(test1, None)
+    if rd.waiter.wait_timeout(1, 1000) == 0:
+        raise Exception("No error for a corrupt ring")
+    io2.set_cbs(io2.handler)
+    if rd.err != "Protocol error":
+        raise Exception("Wrong error for a corrupt ring: " + rd.err)
+    if len(rd.data) != 0:
+        raise Exception("Got data from a corrupt ring")
+    print("  Success!")
+
+gensios_enabled.check_iostr_gensios("shm")
+
+print("Test shm")
+TestAccept(o, "shm,unix," + SHMSOCK, "shm,unix," + SHMSOCK,
+           do_shm_test, chunksize = 64, get_port = False)
+print("Test shm small ring")
+TestAccept(o, "shm(size=%d),unix,%s" % (RINGSIZE, SHMSOCK),
+           "shm,unix," + SHMSOCK,
+           do_shm_test, chunksize = 64, get_port = False)
+print("Test shm doorbells")
+TestAccept(o, "shm,unix," + SHMSOCK, "shm,unix," + SHMSOCK,
+           do_doorbell_test, get_port = False)
+print("Test shm writer waiting on a full ring")
+TestAccept(o, "shm(size=%d),unix,%s" % (RINGSIZE, SHMSOCK),
+           "shm,unix," + SHMSOCK,
+           do_full_ring_test, chunksize = 64, get_port = False)
+print("Test shm with a corrupt ring index")
+TestAccept(o, "shm(size=%d,corrupt),unix,%s" % (RINGSIZE, SHMSOCK),
+           "shm,unix," + SHMSOCK,
+           do_corrupt_test, get_port = False)
+del o
+test_shutdown()
+print("Success!")
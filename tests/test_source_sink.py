@@ -0,0 +1,51 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def check_stats(io, testname, expected):
+    r = io.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    if r != expected:
+        raise Exception("%s stats were not '%s', they were '%s'" %
+                        (testname, expected, r));
+
+print("Test source gensio")
+io = alloc_io(o, "source(data=abcd,size=30000,readbuf=1000)")
+check_raddr(io, "source", "source")
+io.handler.set_compare("abcd" * 7500)
+if (io.handler.wait_timeout(2000) == 0):
+    raise Exception("Timeout waiting for source data")
+check_stats(io, "source", "wrote=0 read=30000")
+io_close([io])
+del io
+
+print("Test random source gensio")
+io = alloc_io(o, "source(random,size=100000)")
+io.handler.ignore_input = True
+io.handler.waiting_rem_close = True
+io.read_cb_enable(True)
+if (io.handler.wait_timeout(2000) == 0):
+    raise Exception("Timeout waiting for source end")
+check_stats(io, "random source", "wrote=0 read=100000")
+io_close([io])
+del io
+
+print("Test sink gensio")
+io = alloc_io(o, "sink")
+check_raddr(io, "sink", "sink")
+io.handler.set_write_data("x" * 50000)
+if (io.handler.wait_timeout(2000) == 0):
+    raise Exception("Timeout writing to sink")
+check_stats(io, "sink", "wrote=50000 read=0")
+io_close([io])
+del io
+
+del o
+test_shutdown()
+print("  Success!")
@@ -0,0 +1,141 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test TLS 1.3 early data.  A resuming client's early data should be
+# taken by a server with early-data set and reported with the "early"
+# auxdata.  If it can't go early, or the server refuses it, it must
+# still arrive once, as normal data.
+#
+
+from utils import *
+import gensio
+
+EARLY = "GET /index.html\r\n"
+
+class EarlyServer:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.io = None
+        self.reads = []
+        self.closed = False
+
+    def new_connection(self, acc, io):
+        self.io = io
+        self.reads = []
+        self.closed = False
+        io.set_cbs(self)
+        io.read_cb_enable(True)
+        self.waiter.wake()
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            io.read_cb_enable(False)
+            return 0
+        self.reads.append((bytes(buf), auxdata))
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+    def close_done(self, io):
+        self.closed = True
+        self.waiter.wake()
+
+    def accepter_log(self, acc, level, logstr):
+        print("***%s LOG: ssl accepter: %s" % (level, logstr))
+
+    def wait_for(self, cond, what, timeout = 2000):
+        end = time.time() + timeout / 1000.0
+        while not cond():
+            if time.time() >= end:
+                raise Exception("Timeout waiting for " + what)
+            self.waiter.wait_timeout(1, 10)
+
+def early_connect(srvh, iostr):
+    """Connect with early data set.  Returns whether the server got it
+    as early data and whether the client says it was accepted.
+    """
+    io = alloc_io(o, iostr, do_open = False)
+    io.control(0, gensio.GENSIO_CONTROL_SET,
+               gensio.GENSIO_CONTROL_EARLY_DATA, EARLY)
+    io.open_s()
+    srvh.wait_for(lambda: srvh.io is not None, "the connection")
+    srv = srvh.io
+    srvh.io = None
+    srvh.wait_for(lambda: sum(len(r[0]) for r in srvh.reads) >= len(EARLY),
+                  "the early data")
+    data = b"".join(r[0] for r in srvh.reads)
+    if data != conv_to_bytes(EARLY):
+        raise Exception("Early data mismatch, got %s" % str(data))
+    early = [r[1] is not None and "early" in r[1] for r in srvh.reads]
+    if True in early and False in early:
+        raise Exception("Early data was split")
+
+    # Answer so the client picks up the server's session tickets.
+    io.handler.set_compare("OK")
+    srv.write("OK", None)
+    if io.handler.wait_timeout(1000) == 0:
+        raise Exception("Timed out waiting for the response")
+
+    accepted = io.control(0, gensio.GENSIO_CONTROL_GET,
+                          gensio.GENSIO_CONTROL_EARLY_DATA, "")
+
+    # It's too late to set early data once the gensio is open.
+    try:
+        io.control(0, gensio.GENSIO_CONTROL_SET,
+                   gensio.GENSIO_CONTROL_EARLY_DATA, EARLY)
+    except Exception as E:
+        if str(E) != "gensio:control: Object was not ready for operation":
+            raise
+    else:
+        raise Exception("Setting early data on an open gensio worked")
+
+    io_close((io,))
+    srv.close(srvh)
+    srvh.wait_for(lambda: srvh.closed, "the server close")
+    return (early[0], accepted == "1")
+
+def do_early_test(accargs, clargs, expect_early):
+    srvh = EarlyServer(o)
+    acc = gensio.gensio_accepter(o, "ssl(key=%s/key.pem,cert=%s/cert.pem%s),"
+                                 "tcp,localhost,0" % (keydir, keydir, accargs),
+                                 srvh)
+    acc.startup()
+    port = acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                       gensio.GENSIO_CONTROL_GET,
+                       gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+    iostr = "ssl(CA=%s/CA.pem%s),tcp,localhost,%s" % (keydir, clargs, port)
+
+    # No session to resume yet, so it can't go early.
+    if early_connect(srvh, iostr) != (False, False):
+        raise Exception("Early data went early on the first connection")
+    for i in range(0, 3):
+        (early, accepted) = early_connect(srvh, iostr)
+        if early != accepted:
+            raise Exception("Client and server disagree on early data")
+        if early != expect_early:
+            raise Exception("Connection %d early data was %s" %
+                            (i + 2, "taken" if early else "not taken"))
+    acc.shutdown_s()
+    print("  Success!")
+
+gensios_enabled.check_iostr_gensios("ssl,tcp")
+
+print("Test ssl early data")
+do_early_test(",early-data=16384", ",resume", True)
+
+print("Test ssl early data refused by the server")
+do_early_test("", ",resume", False)
+
+print("Test ssl early data without resume on the client")
+do_early_test(",early-data=16384", "", False)
+
+del o
+test_shutdown()
+print("Success!")
@@ -0,0 +1,121 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test that an ssl accepter reads its key and certificate once and
+# shares them between its connections, and that
+# GENSIO_ACC_CONTROL_RELOAD_CERTS replaces them, or keeps the old ones
+# if the new ones can't be loaded.
+#
+
+from utils import *
+import gensio
+import shutil
+import tempfile
+
+class SSLAccHandler:
+    def __init__(self, o):
+        self.o = o
+        self.waiter = gensio.waiter(o)
+        self.io = None
+
+    def new_connection(self, acc, io):
+        HandleData(self.o, None, io = io, name = "ssl server")
+        self.io = io
+        self.waiter.wake()
+
+    def accepter_log(self, acc, level, logstr):
+        print("***%s LOG: ssl accepter: %s" % (level, logstr))
+
+def ssl_connect(acch, port, ca):
+    """Connect to the accepter, check that data goes through, and
+    return the common name of the certificate the server used.
+    """
+    io = alloc_io(o, "ssl(CA=%s),tcp,localhost,%s" % (ca, port),
+                  do_open = False)
+    try:
+        io.open_s()
+    except:
+        del io.handler.io
+        del io.handler
+        raise
+    if acch.waiter.wait_timeout(1, 1000) == 0:
+        raise Exception("ssl_connect: Timed out waiting for the connection")
+    srv = acch.io
+    acch.io = None
+    test_dataxfer(io, srv, "Hello there")
+    cn = io.control(0, gensio.GENSIO_CONTROL_GET,
+                    gensio.GENSIO_CONTROL_GET_PEER_CERT_NAME, "-1,CN")
+    io_close((io, srv))
+    return cn.split(",", 2)[2]
+
+def reload_certs(acc):
+    acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST, gensio.GENSIO_CONTROL_SET,
+                gensio.GENSIO_ACC_CONTROL_RELOAD_CERTS, "")
+
+gensios_enabled.check_iostr_gensios("ssl,tcp")
+
+tmpdir = tempfile.mkdtemp()
+keyfile = os.path.join(tmpdir, "key.pem")
+certfile = os.path.join(tmpdir, "cert.pem")
+shutil.copyfile("%s/key.pem" % keydir, keyfile)
+shutil.copyfile("%s/cert.pem" % keydir, certfile)
+
+acch = SSLAccHandler(o)
+acc = gensio.gensio_accepter(o, "ssl(key=%s,cert=%s),tcp,localhost,0" %
+                             (keyfile, certfile), acch)
+acc.startup()
+port = acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                   gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+
+print("Test ssl accepter connections sharing the certificate")
+if ssl_connect(acch, port, "%s/CA.pem" % keydir) != "ser2net.org":
+    raise Exception("Wrong certificate on first connection")
+# The files were read when the accepter was set up, new connections
+# don't need them.
+os.remove(keyfile)
+os.remove(certfile)
+for i in range(0, 3):
+    if ssl_connect(acch, port, "%s/CA.pem" % keydir) != "ser2net.org":
+        raise Exception("Wrong certificate after removing the files")
+print("  Success!")
+
+print("Test ssl certificate reload with missing files")
+try:
+    reload_certs(acc)
+except Exception as E:
+    print("  Reload refused: " + str(E))
+else:
+    raise Exception("Reload with missing files succeeded")
+# The old certificate is still in use.
+if ssl_connect(acch, port, "%s/CA.pem" % keydir) != "ser2net.org":
+    raise Exception("Wrong certificate after a failed reload")
+print("  Success!")
+
+print("Test ssl certificate reload")
+shutil.copyfile("%s/clientkey.pem" % keydir, keyfile)
+shutil.copyfile("%s/clientcert.pem" % keydir, certfile)
+reload_certs(acc)
+if ssl_connect(acch, port, "%s/clientcert.pem" % keydir) != "gensio.org":
+    raise Exception("Wrong certificate after reload")
+# The new certificate is not signed by the old CA.
+try:
+    ssl_connect(acch, port, "%s/CA.pem" % keydir)
+except Exception as E:
+    print("  Old CA refused: " + str(E))
+else:
+    raise Exception("Connection with the old CA succeeded after reload")
+print("  Success!")
+
+acc.shutdown_s()
+del acc
+del acch
+shutil.rmtree(tmpdir)
+del o
+test_shutdown()
+print("Success!")
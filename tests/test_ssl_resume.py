@@ -0,0 +1,92 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test ssl session resumption.  A client with the resume option should
+# resume its session on the second and later connections to the same
+# accepter, unless the server has resumption turned off.
+#
+
+from utils import *
+import gensio
+
+class SSLAccHandler:
+    def __init__(self, o):
+        self.o = o
+        self.waiter = gensio.waiter(o)
+        self.io = None
+
+    def new_connection(self, acc, io):
+        HandleData(self.o, None, io = io, name = "ssl server")
+        self.io = io
+        self.waiter.wake()
+
+    def accepter_log(self, acc, level, logstr):
+        print("***%s LOG: ssl accepter: %s" % (level, logstr))
+
+def get_stats(io):
+    s = io.control(0, gensio.GENSIO_CONTROL_GET,
+                   gensio.GENSIO_CONTROL_CONN_STATS, "")
+    return dict(i.split("=", 1) for i in s.split())
+
+def ssl_connect(acch, iostr):
+    """Connect, pass some data both ways, and return whether the
+    client and server resumed a session.
+    """
+    io = alloc_io(o, iostr, do_open = False)
+    io.open_s()
+    if acch.waiter.wait_timeout(1, 1000) == 0:
+        raise Exception("ssl_connect: Timed out waiting for the connection")
+    srv = acch.io
+    acch.io = None
+    # Going both ways makes sure the client has the session tickets
+    # the server sends after the handshake.
+    test_dataxfer(io, srv, "Hello there")
+    test_dataxfer(srv, io, "Hello back")
+    cstats = get_stats(io)
+    sstats = get_stats(srv)
+    io_close((io, srv))
+    if cstats["resumed"] != sstats["resumed"]:
+        raise Exception("Client and server disagree on resumption: %s %s" %
+                        (cstats["resumed"], sstats["resumed"]))
+    return cstats["resumed"] == "1"
+
+def do_resume_test(accargs, clargs, expect_resume):
+    acch = SSLAccHandler(o)
+    acc = gensio.gensio_accepter(o, "ssl(key=%s/key.pem,cert=%s/cert.pem%s),"
+                                 "tcp,localhost,0" % (keydir, keydir, accargs),
+                                 acch)
+    acc.startup()
+    port = acc.control(gensio.GENSIO_CONTROL_DEPTH_FIRST,
+                       gensio.GENSIO_CONTROL_GET,
+                       gensio.GENSIO_ACC_CONTROL_LPORT, "0")
+    iostr = "ssl(CA=%s/CA.pem%s),tcp,localhost,%s" % (keydir, clargs, port)
+
+    if ssl_connect(acch, iostr):
+        raise Exception("First connection resumed a session")
+    for i in range(0, 3):
+        resumed = ssl_connect(acch, iostr)
+        if resumed != expect_resume:
+            raise Exception("Connection %d %s a session" %
+                            (i + 2, "resumed" if resumed else "did not resume"))
+    acc.shutdown_s()
+    print("  Success!")
+
+gensios_enabled.check_iostr_gensios("ssl,tcp")
+
+print("Test ssl session resumption")
+do_resume_test("", ",resume", True)
+
+print("Test ssl without resume on the client")
+do_resume_test("", "", False)
+
+print("Test ssl resume with resumption off on the server")
+do_resume_test(",session-cache=0", ",resume", False)
+
+del o
+test_shutdown()
+print("Success!")
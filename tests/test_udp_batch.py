@@ -0,0 +1,90 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test batched udp receive and send (rbatch and wbatch).  A burst of
+# packets of different sizes is written, each must come out as its
+# own read with its boundaries intact and in order.
+#
+
+from utils import *
+import gensio
+
+# Packets written before waiting for them to arrive.  This is enough
+# to fill the batches but not the socket receive buffer.
+BURST = 32
+
+class PacketRecorder:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.pkts = []
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            raise HandlerException("Read error: %s" % err)
+        self.pkts.append(bytes(buf))
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+def make_packet(i, size):
+    return ("%05d" % i).encode() + os.urandom(size - 5)
+
+def send_packets(io1, io2, pkts):
+    rec = PacketRecorder(o)
+    io2.set_cbs(rec)
+    io2.read_cb_enable(True)
+    for start in range(0, len(pkts), BURST):
+        end = min(start + BURST, len(pkts))
+        for p in pkts[start:end]:
+            count = io1.write(p, None)
+            if count != len(p):
+                raise HandlerException("Only wrote %d of %d bytes" %
+                                       (count, len(p)))
+        timeout = time.time() + 2.0
+        while len(rec.pkts) < end:
+            if time.time() >= timeout:
+                raise HandlerException("Got %d of %d packets" %
+                                       (len(rec.pkts), end))
+            rec.waiter.wait_timeout(1, 10)
+    io2.read_cb_enable(False)
+    io2.set_cbs(io2.handler)
+    for i in range(0, len(pkts)):
+        if rec.pkts[i] != pkts[i]:
+            raise HandlerException("Packet %d mismatch, got %d bytes "
+                                   "expected %d" %
+                                   (i, len(rec.pkts[i]), len(pkts[i])))
+    if len(rec.pkts) != len(pkts):
+        raise HandlerException("Got %d extra packets" %
+                               (len(rec.pkts) - len(pkts)))
+
+def do_burst_test(io1, io2):
+    pkts = [make_packet(i, (i * 37) % 1400 + 6) for i in range(0, 256)]
+    print("  testing io1 to io2")
+    send_packets(io1, io2, pkts)
+    print("  testing io2 to io1")
+    send_packets(io2, io1, pkts)
+    print("  Success!")
+
+print("Test udp with batched receive and send")
+TestAccept(o, "udp(rbatch=32,wbatch=32),ipv4,localhost,",
+           "udp(rbatch=32,wbatch=32),localhost,0",
+           do_burst_test, io1_dummy_write = "A")
+
+print("Test udp with batched receive only")
+TestAccept(o, "udp,ipv4,localhost,", "udp(rbatch=32),localhost,0",
+           do_burst_test, io1_dummy_write = "A")
+
+print("Test udp with batched send only")
+TestAccept(o, "udp,ipv4,localhost,", "udp(wbatch=32),localhost,0",
+           do_burst_test, io1_dummy_write = "A")
+
+del o
+test_shutdown()
+print("Success!")
@@ -0,0 +1,115 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+#
+# Test udp segmentation and receive offload (gso and gro).  Runs of
+# same size packets, where the kernel may send or receive them as one
+# large buffer, must still come out as one read per packet.
+#
+
+from utils import *
+import gensio
+import sys
+
+# Packets written before waiting for them to arrive, also the gso run.
+BURST = 32
+
+class PacketRecorder:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.pkts = []
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            raise HandlerException("Read error: %s" % err)
+        self.pkts.append(bytes(buf))
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+def make_packet(i, size):
+    return ("%05d" % i).encode() + os.urandom(size - 5)
+
+def send_packets(io1, io2, pkts):
+    rec = PacketRecorder(o)
+    io2.set_cbs(rec)
+    io2.read_cb_enable(True)
+    for start in range(0, len(pkts), BURST):
+        end = min(start + BURST, len(pkts))
+        for p in pkts[start:end]:
+            count = io1.write(p, None)
+            if count != len(p):
+                raise HandlerException("Only wrote %d of %d bytes" %
+                                       (count, len(p)))
+        timeout = time.time() + 2.0
+        while len(rec.pkts) < end:
+            if time.time() >= timeout:
+                raise HandlerException("Got %d of %d packets" %
+                                       (len(rec.pkts), end))
+            rec.waiter.wait_timeout(1, 10)
+    io2.read_cb_enable(False)
+    io2.set_cbs(io2.handler)
+    for i in range(0, len(pkts)):
+        if rec.pkts[i] != pkts[i]:
+            raise HandlerException("Packet %d mismatch, got %d bytes "
+                                   "expected %d" %
+                                   (i, len(rec.pkts[i]), len(pkts[i])))
+    if len(rec.pkts) != len(pkts):
+        raise HandlerException("Got %d extra packets" %
+                               (len(rec.pkts) - len(pkts)))
+
+def do_gso_test(io1, io2):
+    # Each burst is a run of full size packets ending in a short one,
+    # the last segment of a gso send may be shorter than the others.
+    pkts = []
+    for i in range(0, 8 * BURST):
+        if i % BURST == BURST - 1:
+            pkts.append(make_packet(i, 100 + i))
+        else:
+            pkts.append(make_packet(i, 1200))
+    print("  testing io1 to io2")
+    send_packets(io1, io2, pkts)
+    print("  testing io2 to io1")
+    send_packets(io2, io1, pkts)
+    print("  Success!")
+
+class ProbeAccHandler:
+    def new_connection(self, acc, io):
+        raise HandlerException("gro probe accepter got a connection")
+
+# gro is Linux only, skip if it is not there.
+try:
+    acc = gensio.gensio_accepter(o, "udp(gro),localhost,0",
+                                 ProbeAccHandler())
+    acc.startup()
+    acc.shutdown_s()
+    del acc
+except Exception as E:
+    if "not supported" in str(E):
+        print("gro not supported, skipping")
+        sys.exit(77)
+    raise
+
+print("Test udp gso to gro")
+TestAccept(o, "udp(wbatch=%d,gso,gro),ipv4,localhost," % BURST,
+           "udp(wbatch=%d,gso,gro),localhost,0" % BURST,
+           do_gso_test, io1_dummy_write = "A")
+
+print("Test udp gso to plain batched receive")
+TestAccept(o, "udp(wbatch=%d,gso),ipv4,localhost," % BURST,
+           "udp(rbatch=%d,wbatch=%d,gso),localhost,0" % (BURST, BURST),
+           do_gso_test, io1_dummy_write = "A")
+
+print("Test udp plain send to gro")
+TestAccept(o, "udp,ipv4,localhost,", "udp(gro),localhost,0",
+           do_gso_test, io1_dummy_write = "A")
+
+del o
+test_shutdown()
+print("Success!")
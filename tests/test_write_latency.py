@@ -0,0 +1,32 @@
+#
+#  gensio - A library for abstracting stream I/O
+#  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+#
+#  SPDX-License-Identifier: GPL-2.0-only
+#
+
+from utils import *
+import gensio
+
+def do_latency_test(io1, io2, timeout=2000):
+    io1.control(gensio.GENSIO_CONTROL_DEPTH_ALL, gensio.GENSIO_CONTROL_SET,
+                gensio.GENSIO_CONTROL_WRITE_LATENCY, "1")
+    test_dataxfer(io1, io2, "This is a test string!", timeout = timeout)
+    for depth in (0, 1):
+        s = io1.control(depth, gensio.GENSIO_CONTROL_GET,
+                        gensio.GENSIO_CONTROL_WRITE_LATENCY, "")
+        v = dict(i.split("=") for i in s.split())
+        if int(v["samples"]) < 1:
+            raise Exception("No samples at depth %d: %s" % (depth, s))
+        hist = [int(i) for i in v["hist"].split(",")]
+        if len(hist) != 21 or sum(hist) != int(v["samples"]):
+            raise Exception("Bad histogram at depth %d: %s" % (depth, s))
+    io1.control(gensio.GENSIO_CONTROL_DEPTH_ALL, gensio.GENSIO_CONTROL_SET,
+                gensio.GENSIO_CONTROL_WRITE_LATENCY, "0")
+    print("  Success!")
+
+print("Test write latency sampling")
+TestAccept(o, "telnet,tcp,localhost,", "telnet,tcp,localhost,0",
+           do_latency_test)
+del o
+test_shutdown()
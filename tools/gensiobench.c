@@ -0,0 +1,943 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Load generator and latency benchmark for gensio stacks.  It opens a
+ * number of connections with a gensio string, and each one sends a
+ * request and waits for the whole response before sending the next
+ * (optionally at a fixed rate).  The response size defaults to the
+ * request size, so any echo server works, or it can run its own
+ * responder on an accepter string.  At the end it reports connection
+ * setup time, throughput and round trip time percentiles.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_osops.h>
+#ifndef _WIN32
+#include <gensio/gensio_unix.h>
+#endif
+#include "utils.h"
+
+#ifdef _WIN32
+#define GENSIOSIG 0
+#else
+#define GENSIOSIG SIGUSR1
+#endif
+
+/*
+ * A log-linear histogram of nanosecond values.  Values below
+ * HIST_SUB are exact, above that each power of two is split into
+ * HIST_SUB buckets, so a bucket is within about 6% of its values.
+ */
+#define HIST_SUB_BITS	4
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static unsigned int
+hist_bucket(uint64_t v)
+{
+    unsigned int msb;
+
+    if (v < HIST_SUB)
+	return v;
+    msb = 63 - __builtin_clzll(v);
+    return ((msb - HIST_SUB_BITS + 1) * HIST_SUB +
+	    ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1)));
+}
+
+/* The smallest value that goes in bucket b. */
+static uint64_t
+hist_bucket_val(unsigned int b)
+{
+    unsigned int msb;
+
+    if (b < HIST_SUB)
+	return b;
+    msb = b / HIST_SUB + HIST_SUB_BITS - 1;
+    return (((uint64_t) 1 << msb) |
+	    ((uint64_t) (b % HIST_SUB) << (msb - HIST_SUB_BITS)));
+}
+
+static void
+hist_add(struct hist *h, uint64_t v)
+{
+    if (!h->count || v < h->min)
+	h->min = v;
+    if (v > h->max)
+	h->max = v;
+    h->count++;
+    h->sum += v;
+    h->buckets[hist_bucket(v)]++;
+}
+
+static void
+hist_merge(struct hist *h, const struct hist *from)
+{
+    unsigned int i;
+
+    if (!from->count)
+	return;
+    if (!h->count || from->min < h->min)
+	h->min = from->min;
+    if (from->max > h->max)
+	h->max = from->max;
+    h->count += from->count;
+    h->sum += from->sum;
+    for (i = 0; i < HIST_BUCKETS; i++)
+	h->buckets[i] += from->buckets[i];
+}
+
+static uint64_t
+hist_percentile(const struct hist *h, double pct)
+{
+    uint64_t want, seen = 0;
+    unsigned int i;
+
+    if (!h->count)
+	return 0;
+    want = (uint64_t) (h->count * pct / 100.0);
+    if (want >= h->count)
+	return h->max;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->buckets[i];
+	if (seen > want)
+	    break;
+    }
+    if (i >= HIST_BUCKETS)
+	return h->max;
+    /* Don't report outside what was actually seen. */
+    if (hist_bucket_val(i) < h->min)
+	return h->min;
+    return hist_bucket_val(i);
+}
+
+struct bench;
+
+struct bconn {
+    struct bench *b;
+    struct gensio *io;
+    struct gensio_lock *lock;
+    struct gensio_timer *timer;
+    bool open;
+    bool closing;
+    bool in_request;
+    gensio_time open_start;
+    gensio_time req_start;
+    gensio_time next_send;
+    gensiods to_write;
+    gensiods to_read;
+    gensiods reqs;
+    gensiods bytes_out;
+    gensiods bytes_in;
+    struct hist rtt;
+};
+
+struct bench {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio_waiter *open_waiter;
+    struct gensio_waiter *close_waiter;
+    unsigned int nr_conns;
+    unsigned int nr_opened;
+    unsigned int nr_failed;
+    unsigned int nr_live;
+    unsigned int nr_errors;
+    unsigned int nr_rconns;	/* Open responder connections. */
+    bool stopping;
+    gensiods size;
+    gensiods rsize;
+    uint64_t interval;		/* Nanoseconds between requests, 0 is none. */
+    unsigned char *buf;
+    struct hist connect;
+    struct bconn *conns;
+};
+
+static uint64_t
+time_to_ns(const gensio_time *t)
+{
+    return (uint64_t) t->secs * 1000000000 + t->nsecs;
+}
+
+static uint64_t
+time_since(struct gensio_os_funcs *o, const gensio_time *start)
+{
+    gensio_time now;
+    uint64_t s = time_to_ns(start), n;
+
+    gensio_os_funcs_get_monotonic_time(o, &now);
+    n = time_to_ns(&now);
+    return n > s ? n - s : 0;
+}
+
+/*
+ * stopping and nr_rconns are read without the lock where there are
+ * atomics, they are checked on every response.
+ */
+static bool
+bench_stopping(struct bench *b)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_load_n(&b->stopping, __ATOMIC_ACQUIRE);
+#else
+    bool rv;
+
+    gensio_os_funcs_lock(b->o, b->lock);
+    rv = b->stopping;
+    gensio_os_funcs_unlock(b->o, b->lock);
+    return rv;
+#endif
+}
+
+/* Call with b->lock held, bconn_close_done() checks it under the lock. */
+static void
+bench_set_stopping(struct bench *b)
+{
+#if HAVE_GCC_ATOMICS
+    __atomic_store_n(&b->stopping, true, __ATOMIC_RELEASE);
+#else
+    b->stopping = true;
+#endif
+}
+
+static unsigned int
+bench_rconns_add(struct bench *b, int n)
+{
+#if HAVE_GCC_ATOMICS
+    return __atomic_add_fetch(&b->nr_rconns, n, __ATOMIC_SEQ_CST);
+#else
+    unsigned int rv;
+
+    gensio_os_funcs_lock(b->o, b->lock);
+    rv = b->nr_rconns += n;
+    gensio_os_funcs_unlock(b->o, b->lock);
+    return rv;
+#endif
+}
+
+static void
+do_vlog(struct gensio_os_funcs *f, enum gensio_log_levels level,
+	const char *log, va_list args)
+{
+    fprintf(stderr, "gensio %s log: ", gensio_log_level_to_str(level));
+    vfprintf(stderr, log, args);
+    fprintf(stderr, "\n");
+}
+
+/* The test time is up, wake the main thread to shut down. */
+static void
+bench_run_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct bench *b = cb_data;
+
+    gensio_os_funcs_wake(b->o, b->close_waiter);
+}
+
+static void
+bconn_close_done(struct gensio *io, void *close_data)
+{
+    struct bconn *c = close_data;
+    struct bench *b = c->b;
+
+    gensio_os_funcs_lock(b->o, b->lock);
+    if (--b->nr_live == 0 && b->stopping)
+	gensio_os_funcs_wake(b->o, b->close_waiter);
+    gensio_os_funcs_unlock(b->o, b->lock);
+}
+
+/* Call with the connection lock held. */
+static void
+bconn_close(struct bconn *c)
+{
+    int err;
+
+    if (c->closing)
+	return;
+    c->closing = true;
+    gensio_set_read_callback_enable(c->io, false);
+    gensio_set_write_callback_enable(c->io, false);
+    err = gensio_close(c->io, bconn_close_done, c);
+    if (err)
+	bconn_close_done(c->io, c);
+}
+
+/* Call with the connection lock held. */
+static void
+bconn_send(struct bconn *c)
+{
+    struct bench *b = c->b;
+
+    gensio_os_funcs_get_monotonic_time(b->o, &c->req_start);
+    c->in_request = true;
+    c->to_write = b->size;
+    c->to_read = b->rsize;
+    gensio_set_write_callback_enable(c->io, true);
+}
+
+/* A response is complete, call with the connection lock held. */
+static void
+bconn_response_done(struct bconn *c)
+{
+    struct bench *b = c->b;
+    gensio_time now;
+    uint64_t next;
+
+    hist_add(&c->rtt, time_since(b->o, &c->req_start));
+    c->reqs++;
+    c->in_request = false;
+
+    if (bench_stopping(b)) {
+	bconn_close(c);
+	return;
+    }
+    if (!b->interval) {
+	bconn_send(c);
+	return;
+    }
+
+    /*
+     * Keep to the schedule, but if a response took longer than the
+     * interval send right away instead of trying to catch up.
+     */
+    gensio_os_funcs_get_monotonic_time(b->o, &now);
+    next = time_to_ns(&c->next_send) + b->interval;
+    if (next <= time_to_ns(&now)) {
+	c->next_send = now;
+	bconn_send(c);
+	return;
+    }
+    c->next_send.secs = next / 1000000000;
+    c->next_send.nsecs = next % 1000000000;
+    gensio_os_funcs_start_timer_abs(b->o, c->timer, &c->next_send);
+}
+
+static void
+bconn_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct bconn *c = cb_data;
+
+    gensio_os_funcs_lock(c->b->o, c->lock);
+    if (bench_stopping(c->b))
+	bconn_close(c);
+    else if (!c->closing)
+	bconn_send(c);
+    gensio_os_funcs_unlock(c->b->o, c->lock);
+}
+
+static void
+bconn_err(struct bconn *c, int err)
+{
+    struct bench *b = c->b;
+
+    if (err != GE_REMCLOSE || !b->stopping) {
+	gensio_os_funcs_lock(b->o, b->lock);
+	if (b->nr_errors++ == 0)
+	    fprintf(stderr, "Connection error: %s\n", gensio_err_to_str(err));
+	gensio_os_funcs_unlock(b->o, b->lock);
+    }
+    bconn_close(c);
+}
+
+static int
+bconn_event(struct gensio *io, void *user_data, int event, int err,
+	    unsigned char *buf, gensiods *buflen,
+	    const char *const *auxdata)
+{
+    struct bconn *c = user_data;
+    struct bench *b = c->b;
+    gensiods count;
+
+    gensio_os_funcs_lock(b->o, c->lock);
+    if (c->closing)
+	goto out;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err) {
+	    bconn_err(c, err);
+	    break;
+	}
+	c->bytes_in += *buflen;
+	if (!c->in_request)
+	    /* Extra data from the server, just drop it. */
+	    break;
+	if (*buflen >= c->to_read) {
+	    c->to_read = 0;
+	    if (!c->to_write)
+		bconn_response_done(c);
+	} else {
+	    c->to_read -= *buflen;
+	}
+	break;
+
+    case GENSIO_EVENT_WRITE_READY:
+	if (!c->to_write) {
+	    gensio_set_write_callback_enable(io, false);
+	    break;
+	}
+	err = gensio_write(io, &count, b->buf, c->to_write, NULL);
+	if (err) {
+	    bconn_err(c, err);
+	    break;
+	}
+	c->bytes_out += count;
+	c->to_write -= count;
+	if (!c->to_write) {
+	    gensio_set_write_callback_enable(io, false);
+	    if (!c->to_read)
+		/* The whole response came before the write finished. */
+		bconn_response_done(c);
+	}
+	break;
+
+    default:
+	gensio_os_funcs_unlock(b->o, c->lock);
+	return GE_NOTSUP;
+    }
+ out:
+    gensio_os_funcs_unlock(b->o, c->lock);
+    return 0;
+}
+
+static void
+bconn_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct bconn *c = open_data;
+    struct bench *b = c->b;
+    uint64_t t = time_since(b->o, &c->open_start);
+
+    gensio_os_funcs_lock(b->o, b->lock);
+    if (err) {
+	if (b->nr_failed == 0)
+	    fprintf(stderr, "Connection open failed: %s\n",
+		    gensio_err_to_str(err));
+	b->nr_failed++;
+	b->nr_live--;
+    } else {
+	c->open = true;
+	b->nr_opened++;
+	hist_add(&b->connect, t);
+    }
+    if (b->nr_opened + b->nr_failed == b->nr_conns)
+	gensio_os_funcs_wake(b->o, b->open_waiter);
+    gensio_os_funcs_unlock(b->o, b->lock);
+}
+
+/*
+ * The built-in responder.  For every size bytes it receives it sends
+ * rsize bytes back.
+ */
+struct rconn {
+    struct bench *b;
+    struct gensio_lock *lock;
+    gensiods received;
+    gensiods owed;
+};
+
+static void
+rconn_close_done(struct gensio *io, void *close_data)
+{
+    struct rconn *r = close_data;
+    struct bench *b = r->b;
+
+    gensio_free(io);
+    gensio_os_funcs_free_lock(b->o, r->lock);
+    free(r);
+    bench_rconns_add(b, -1);
+}
+
+static int
+rconn_event(struct gensio *io, void *user_data, int event, int err,
+	    unsigned char *buf, gensiods *buflen,
+	    const char *const *auxdata)
+{
+    struct rconn *r = user_data;
+    struct bench *b = r->b;
+    gensiods count;
+
+    gensio_os_funcs_lock(b->o, r->lock);
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err)
+	    goto out_close;
+	r->received += *buflen;
+	r->owed += (r->received / b->size) * b->rsize;
+	r->received %= b->size;
+	if (r->owed)
+	    gensio_set_write_callback_enable(io, true);
+	break;
+
+    case GENSIO_EVENT_WRITE_READY:
+	count = r->owed;
+	if (count > b->size && count > b->rsize)
+	    count = b->size > b->rsize ? b->size : b->rsize;
+	err = gensio_write(io, &count, b->buf, count, NULL);
+	if (err)
+	    goto out_close;
+	r->owed -= count;
+	if (!r->owed)
+	    gensio_set_write_callback_enable(io, false);
+	break;
+
+    default:
+	gensio_os_funcs_unlock(b->o, r->lock);
+	return GE_NOTSUP;
+    }
+    gensio_os_funcs_unlock(b->o, r->lock);
+    return 0;
+
+ out_close:
+    gensio_set_read_callback_enable(io, false);
+    gensio_set_write_callback_enable(io, false);
+    gensio_os_funcs_unlock(b->o, r->lock);
+    if (gensio_close(io, rconn_close_done, r))
+	rconn_close_done(io, r);
+    return 0;
+}
+
+static int
+acc_event(struct gensio_accepter *accepter, void *user_data,
+	  int event, void *data)
+{
+    struct bench *b = user_data;
+    struct gensio *io = data;
+    struct rconn *r;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return GE_NOTSUP;
+
+    r = calloc(1, sizeof(*r));
+    if (r)
+	r->lock = gensio_os_funcs_alloc_lock(b->o);
+    if (!r || !r->lock) {
+	if (r)
+	    free(r);
+	gensio_free(io);
+	return 0;
+    }
+    r->b = b;
+    bench_rconns_add(b, 1);
+    gensio_set_callback(io, rconn_event, r);
+    gensio_set_read_callback_enable(io, true);
+    return 0;
+}
+
+static double
+ns_to_us(uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+static void
+print_hist(const char *name, const struct hist *h)
+{
+    if (!h->count) {
+	printf("%s: none\n", name);
+	return;
+    }
+    printf("%s (us): min %.1f avg %.1f p50 %.1f p90 %.1f p99 %.1f "
+	   "p99.9 %.1f max %.1f\n", name,
+	   ns_to_us(h->min), ns_to_us(h->sum / h->count),
+	   ns_to_us(hist_percentile(h, 50)), ns_to_us(hist_percentile(h, 90)),
+	   ns_to_us(hist_percentile(h, 99)),
+	   ns_to_us(hist_percentile(h, 99.9)), ns_to_us(h->max));
+}
+
+static void
+print_loop_stats(struct gensio_os_funcs *o)
+{
+    struct gensio_loop_stats s;
+    gensiods len = sizeof(s);
+    int rv;
+
+    rv = o->control(o, GENSIO_CONTROL_LOOP_STATS, &s, &len);
+    if (rv) {
+	printf("Loop stats not available: %s\n", gensio_err_to_str(rv));
+	return;
+    }
+    printf("Loop: %llu wakeups, %llu fd events (max %llu per wakeup), "
+	   "%llu timers, %llu runners\n",
+	   (unsigned long long) s.wakeups,
+	   (unsigned long long) s.fds_dispatched,
+	   (unsigned long long) s.max_fds_per_wakeup,
+	   (unsigned long long) s.timers_fired,
+	   (unsigned long long) s.runners_run);
+    printf("Loop (us): max dispatch latency %.1f, max handler %.1f, "
+	   "max timer late %.1f\n",
+	   ns_to_us(time_to_ns(&s.max_dispatch_latency)),
+	   ns_to_us(time_to_ns(&s.max_handler_time)),
+	   ns_to_us(time_to_ns(&s.max_timer_late)));
+}
+
+static const char *progname;
+
+static void
+help(int err)
+{
+    printf("%s [options] <gensio>\n", progname);
+    printf("\nA program to benchmark a gensio stack.  It opens connections\n"
+	   "with the given gensio and sends requests, waiting for the\n"
+	   "response to each before sending the next.\n");
+    printf("\noptions are:\n");
+    printf("  -n, --connections <n> - The number of connections, default 1\n");
+    printf("  -s, --size <n> - The request size, default 64\n");
+    printf("  -r, --response-size <n> - The response size, defaults to the\n"
+	   "    request size.  Needs a server that sends that much back for\n"
+	   "    each request, like the one from --accepter.\n");
+    printf("  -t, --time <secs> - How long to run, default 10\n");
+    printf("  -q, --rate <n> - Requests per second for each connection,\n"
+	   "    default 0 (as fast as responses come back)\n");
+    printf("  -T, --threads <n> - Extra threads servicing the os funcs,\n"
+	   "    default 0\n");
+#ifndef _WIN32
+    printf("  -S, --shards <n> - Use sharded os funcs with n shards, the\n"
+	   "    threads are raised to at least n\n");
+#endif
+    printf("  -a, --accepter <accepter> - Run a responder on the given\n"
+	   "    accepter in this program\n");
+    printf("  -L, --loop-stats - Print os funcs event loop statistics\n");
+    printf("  -d, --debug - Enable debug.\n");
+    printf("  -h, --help - This help\n");
+    gensio_osfunc_exit(err);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rv, arg;
+    struct gensio_os_proc_data *proc_data = NULL;
+    struct gensio_os_funcs *o;
+    struct gensio_os_thread_pool *pool = NULL;
+    struct gensio_accepter *acc = NULL;
+    struct gensio_timer *run_timer = NULL;
+    struct bench b;
+    struct bconn *c;
+    unsigned int nr_conns = 1, size = 64, rsize = 0, secs = 10, rate = 0;
+    unsigned int threads = 0, shards = 0, i;
+    const char *accstr = NULL;
+    bool loop_stats = false;
+    gensio_time timeout, start;
+    struct gensio_loop_stats_config lsconfig = { .enable = true };
+    gensiods len;
+    struct hist rtt;
+    gensiods reqs = 0, bytes_out = 0, bytes_in = 0;
+    double elapsed;
+
+    progname = argv[0];
+
+    for (arg = 1; arg < argc; arg++) {
+	if (argv[arg][0] != '-')
+	    break;
+	if (strcmp(argv[arg], "--") == 0) {
+	    arg++;
+	    break;
+	}
+	if ((rv = cmparg_uint(argc, argv, &arg, "-n", "--connections",
+			      &nr_conns)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, "-s", "--size", &size)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, "-r", "--response-size",
+				   &rsize)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, "-t", "--time", &secs)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, "-q", "--rate", &rate)))
+	    ;
+	else if ((rv = cmparg_uint(argc, argv, &arg, "-T", "--threads",
+				   &threads)))
+	    ;
+#ifndef _WIN32
+	else if ((rv = cmparg_uint(argc, argv, &arg, "-S", "--shards",
+				   &shards)))
+	    ;
+#endif
+	else if ((rv = cmparg(argc, argv, &arg, "-a", "--accepter", &accstr)))
+	    ;
+	else if ((rv = cmparg(argc, argv, &arg, "-L", "--loop-stats", NULL))) {
+	    loop_stats = true;
+	} else if ((rv = cmparg(argc, argv, &arg, "-d", "--debug", NULL))) {
+	    gensio_set_log_mask(GENSIO_LOG_MASK_ALL);
+	} else if ((rv = cmparg(argc, argv, &arg, NULL, "--version", NULL))) {
+	    printf("Version %s\n", gensio_version_string);
+	    exit(0);
+	} else if ((rv = cmparg(argc, argv, &arg, "-h", "--help", NULL))) {
+	    help(0);
+	} else {
+	    fprintf(stderr, "Unknown argument: %s, use -h for help\n",
+		    argv[arg]);
+	    return 1;
+	}
+	if (rv < 0)
+	    return 1;
+    }
+
+    if (arg >= argc) {
+	fprintf(stderr, "No gensio given\n");
+	return 1;
+    }
+    if (nr_conns == 0 || size == 0) {
+	fprintf(stderr, "connections and size must be >= 1\n");
+	return 1;
+    }
+    if (!rsize)
+	rsize = size;
+
+    memset(&b, 0, sizeof(b));
+    b.size = size;
+    b.rsize = rsize;
+    b.nr_conns = nr_conns;
+    if (rate)
+	b.interval = 1000000000 / rate;
+
+#ifndef _WIN32
+    if (shards) {
+	rv = gensio_unix_funcs_alloc_sharded(shards, GENSIOSIG, &o);
+	if (threads < shards)
+	    threads = shards;
+    } else
+#endif
+	rv = gensio_default_os_hnd(GENSIOSIG, &o);
+    if (rv) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+    gensio_os_funcs_set_vlog(o, do_vlog);
+    b.o = o;
+
+    rv = gensio_os_proc_setup(o, &proc_data);
+    if (rv) {
+	fprintf(stderr, "Could not setup process data: %s\n",
+		gensio_err_to_str(rv));
+	goto out_free_o;
+    }
+
+    rv = GE_NOMEM;
+    b.buf = calloc(1, size > rsize ? size : rsize);
+    b.conns = calloc(nr_conns, sizeof(*b.conns));
+    b.lock = gensio_os_funcs_alloc_lock(o);
+    b.open_waiter = gensio_os_funcs_alloc_waiter(o);
+    b.close_waiter = gensio_os_funcs_alloc_waiter(o);
+    run_timer = gensio_os_funcs_alloc_timer(o, bench_run_timeout, &b);
+    if (!b.buf || !b.conns || !b.lock || !b.open_waiter || !b.close_waiter
+		|| !run_timer) {
+	fprintf(stderr, "Out of memory\n");
+	goto out_err;
+    }
+
+    if (loop_stats) {
+	len = sizeof(lsconfig);
+	rv = o->control(o, GENSIO_CONTROL_LOOP_STATS_SET_CONFIG,
+			&lsconfig, &len);
+	if (rv) {
+	    fprintf(stderr, "Loop stats not available: %s\n",
+		    gensio_err_to_str(rv));
+	    loop_stats = false;
+	}
+    }
+
+    if (threads) {
+	rv = gensio_os_thread_pool_start(o, threads, NULL, 0, &pool);
+	if (rv) {
+	    fprintf(stderr, "Could not start threads: %s\n",
+		    gensio_err_to_str(rv));
+	    goto out_err;
+	}
+    }
+
+    if (accstr) {
+	rv = str_to_gensio_accepter(accstr, o, acc_event, &b, &acc);
+	if (rv) {
+	    fprintf(stderr, "Could not allocate accepter %s: %s\n", accstr,
+		    gensio_err_to_str(rv));
+	    goto out_err;
+	}
+	rv = gensio_acc_startup(acc);
+	if (rv) {
+	    fprintf(stderr, "Could not start accepter %s: %s\n", accstr,
+		    gensio_err_to_str(rv));
+	    goto out_err;
+	}
+    }
+
+    for (i = 0; i < nr_conns; i++) {
+	c = &b.conns[i];
+	c->b = &b;
+	c->lock = gensio_os_funcs_alloc_lock(o);
+	c->timer = gensio_os_funcs_alloc_timer(o, bconn_timeout, c);
+	if (!c->lock || !c->timer) {
+	    rv = GE_NOMEM;
+	    fprintf(stderr, "Out of memory\n");
+	    goto out_err;
+	}
+	rv = str_to_gensio(argv[arg], o, bconn_event, c, &c->io);
+	if (rv) {
+	    fprintf(stderr, "Could not allocate %s: %s\n", argv[arg],
+		    gensio_err_to_str(rv));
+	    goto out_err;
+	}
+    }
+
+    /* Open everything at once, so setup time is measured under load. */
+    gensio_os_funcs_lock(o, b.lock);
+    b.nr_live = nr_conns;
+    gensio_os_funcs_unlock(o, b.lock);
+    for (i = 0; i < nr_conns; i++) {
+	c = &b.conns[i];
+	gensio_os_funcs_get_monotonic_time(o, &c->open_start);
+	rv = gensio_open(c->io, bconn_open_done, c);
+	if (rv)
+	    bconn_open_done(c->io, rv, c);
+    }
+    timeout.secs = 60;
+    timeout.nsecs = 0;
+    rv = gensio_os_funcs_wait(o, b.open_waiter, 1, &timeout);
+    if (rv) {
+	fprintf(stderr, "Timed out opening connections\n");
+	goto out_err;
+    }
+    if (!b.nr_opened) {
+	rv = GE_NOTREADY;
+	goto out_err;
+    }
+
+    timeout.secs = secs;
+    timeout.nsecs = 0;
+    rv = gensio_os_funcs_start_timer(o, run_timer, &timeout);
+    if (rv) {
+	fprintf(stderr, "Could not start the run timer: %s\n",
+		gensio_err_to_str(rv));
+	goto out_err;
+    }
+
+    gensio_os_funcs_get_monotonic_time(o, &start);
+    for (i = 0; i < nr_conns; i++) {
+	c = &b.conns[i];
+	gensio_os_funcs_lock(o, c->lock);
+	if (c->open) {
+	    c->next_send = start;
+	    gensio_set_read_callback_enable(c->io, true);
+	    bconn_send(c);
+	}
+	gensio_os_funcs_unlock(o, c->lock);
+    }
+
+    /*
+     * Run the loop for the test time.  A wait timeout won't do for
+     * this, it is not checked while the loop is busy, so the run
+     * timer wakes us.
+     */
+    gensio_os_funcs_wait(o, b.close_waiter, 1, NULL);
+
+    gensio_os_funcs_lock(o, b.lock);
+    elapsed = time_since(o, &start) / 1e9;
+    bench_set_stopping(&b);
+    gensio_os_funcs_unlock(o, b.lock);
+
+    /*
+     * Connections in a request close when the response comes back,
+     * ones waiting for their next send are closed here.
+     */
+    for (i = 0; i < nr_conns; i++) {
+	c = &b.conns[i];
+	gensio_os_funcs_lock(o, c->lock);
+	if (c->open && !c->in_request) {
+	    gensio_os_funcs_stop_timer(o, c->timer);
+	    bconn_close(c);
+	}
+	gensio_os_funcs_unlock(o, c->lock);
+    }
+    gensio_os_funcs_lock(o, b.lock);
+    i = b.nr_live;
+    gensio_os_funcs_unlock(o, b.lock);
+    if (i) {
+	timeout.secs = 10;
+	timeout.nsecs = 0;
+	if (gensio_os_funcs_wait(o, b.close_waiter, 1, &timeout))
+	    fprintf(stderr, "Timed out waiting for %u connections to close\n",
+		    b.nr_live);
+    }
+
+    memset(&rtt, 0, sizeof(rtt));
+    for (i = 0; i < nr_conns; i++) {
+	c = &b.conns[i];
+	gensio_os_funcs_lock(o, c->lock);
+	hist_merge(&rtt, &c->rtt);
+	reqs += c->reqs;
+	bytes_out += c->bytes_out;
+	bytes_in += c->bytes_in;
+	gensio_os_funcs_unlock(o, c->lock);
+    }
+
+    printf("Connections: %u opened, %u failed, %u errors\n",
+	   b.nr_opened, b.nr_failed, b.nr_errors);
+    print_hist("Connect", &b.connect);
+    printf("Requests: %llu in %.2f seconds, %.1f per second\n",
+	   (unsigned long long) reqs, elapsed, reqs / elapsed);
+    printf("Throughput: %.2f MB/s out, %.2f MB/s in\n",
+	   bytes_out / elapsed / 1e6, bytes_in / elapsed / 1e6);
+    print_hist("RTT", &rtt);
+    if (loop_stats)
+	print_loop_stats(o);
+    rv = b.nr_errors ? GE_IOERR : 0;
+
+ out_err:
+    if (acc) {
+	gensio_acc_shutdown_s(acc);
+	gensio_acc_free(acc);
+    }
+    /* Give the responder's connections a chance to see the closes. */
+    for (i = 0; i < 100 && b.lock && bench_rconns_add(&b, 0); i++) {
+	timeout.secs = 0;
+	timeout.nsecs = 10000000;
+	gensio_os_funcs_service(o, &timeout);
+    }
+    if (pool)
+	gensio_os_thread_pool_stop(pool);
+    for (i = 0; b.conns && i < nr_conns; i++) {
+	c = &b.conns[i];
+	if (c->io)
+	    gensio_free(c->io);
+	if (c->timer)
+	    gensio_os_funcs_free_timer(o, c->timer);
+	if (c->lock)
+	    gensio_os_funcs_free_lock(o, c->lock);
+    }
+    if (run_timer) {
+	gensio_os_funcs_stop_timer(o, run_timer);
+	gensio_os_funcs_free_timer(o, run_timer);
+    }
+    free(b.conns);
+    free(b.buf);
+    if (b.lock)
+	gensio_os_funcs_free_lock(o, b.lock);
+    if (b.open_waiter)
+	gensio_os_funcs_free_waiter(o, b.open_waiter);
+    if (b.close_waiter)
+	gensio_os_funcs_free_waiter(o, b.close_waiter);
+    gensio_os_proc_cleanup(proc_data);
+ out_free_o:
+    gensio_os_funcs_free(o);
+
+    return !!rv;
+}
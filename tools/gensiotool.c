@@ -342,6 +342,8 @@ struct gtinfo {
     const char *signature;
     bool print_laddr;
     bool print_raddr;
+    bool no_splice;
+    unsigned int bufsize;
 
     int err;
 
@@ -778,6 +780,17 @@ add_io(struct gtinfo *g, struct gensio *io, bool open_finished)
     }
 
     ioinfo_set_otherioinfo(ioinfo1, ioinfo2);
+    if (g->no_splice) {
+	ioinfo_set_splice(ioinfo1, false);
+	ioinfo_set_splice(ioinfo2, false);
+    }
+    if (g->bufsize) {
+	if (ioinfo_set_buffer(ioinfo1, g->bufsize, 0) ||
+		ioinfo_set_buffer(ioinfo2, g->bufsize, 0)) {
+	    report_err(g, "Could not allocate buffers");
+	    goto out_err;
+	}
+    }
 
     err = str_to_gensio(g->ios1, o, parmlog_eventh, ioinfo1, &gtconn1->io);
     if (err) {
@@ -846,6 +859,7 @@ i_handle_term(struct gtinfo *g)
 
 	closed_one = true;
 	if (gtconn->io) {
+	    ioinfo_set_not_ready(gensio_get_user_data(gtconn->io));
 	    gtconn->close_io = gtconn->io;
 	    gtconn->io = NULL;
 	    err = gensio_close(gtconn->close_io, io_closed, NULL);
@@ -967,6 +981,10 @@ help(int err)
     printf("  -r, --printremaddr - When the connection opens, print out all"
 	   " the remote addresses.\n");
     printf("  -v, --verbose - Print all gensio logs\n");
+    printf("  --no-splice - Always pass data through gensiot, don't move\n"
+	   "    it in the kernel when both gensios are plain fds.\n");
+    printf("  --bufsize <n> - Buffer up to <n> bytes in each direction when\n"
+	   "    the receiving side can't keep up, default is no buffering.\n");
     printf("  --signature <sig> - Set the RFC2217 server signature to <sig>\n");
 #ifndef _WIN32
     printf("  -P, --pidfile <file> - Create a pid file.\n");
@@ -1078,6 +1096,11 @@ main(int argc, char *argv[])
 	    g.print_raddr = true;
 	else if ((rv = cmparg(argc, argv, &arg, "-v", "--verbose", NULL)))
 	    gensio_set_log_mask(GENSIO_LOG_MASK_ALL);
+	else if ((rv = cmparg(argc, argv, &arg, NULL, "--no-splice", NULL)))
+	    g.no_splice = true;
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--bufsize",
+				   &g.bufsize)))
+	    ;
 	else if ((rv = cmparg_int(argc, argv, &arg, "-e", "--escchar",
 				  &g.escape_char)))
 	    esc_set = true;
@@ -1153,10 +1176,11 @@ main(int argc, char *argv[])
 	exit(1);
 #else
 	if (num_extra_threads > 0)
-	    fprintf(stderr, "Number of extra threads is %u, incompatible with"
-		    " TCL, forcing to 0\n", num_extra_threads);
+	    /* TCL runs its own threads for the event loops. */
+	    rv = gensio_tcl_funcs_alloc_threaded(&g.o, num_extra_threads);
+	else
+	    rv = gensio_tcl_funcs_alloc(&g.o);
 	num_extra_threads = 0;
-	rv = gensio_tcl_funcs_alloc(&g.o);
 #endif
     } else {
 	rv = gensio_default_os_hnd(SIGUSR1, &g.o);
@@ -400,6 +400,12 @@ help(int err)
     printf("  -R <accept addr>:<connect addr> - Like -L, except the\n"
 	   "    <accept addr> is on the remote machine and <connect addr> is\n"
 	   "    done from the local machine\n");
+    printf("  -S, --control-path <path> - If a master connection is\n"
+	   "    listening at the unix socket <path>, open a new channel on\n"
+	   "    it instead of making a new connection.  Not used with -L\n"
+	   "    or -R.\n");
+    printf("  -M, --master - Make a new connection and listen at the\n"
+	   "    --control-path for other gtlssh invocations to share it.\n");
     printf("  -4 - Do IPv4 only.\n");
     printf("  -6 - Do IPv6 only.\n");
     printf("  --version - Print the version number and exit.\n");
@@ -1237,11 +1243,25 @@ auth_event(struct gensio *io, void *user_data, int event, int ierr,
 
 static void winch_sent(void *cb_data);
 
+/*
+ * A terminal resize generates a burst of winch events.  Only one
+ * window size message is in flight at a time, and after one is sent
+ * we wait WINCH_HOLDOFF_MSECS before sending another, so a burst
+ * collapses into the final size plus at most one message per
+ * interval.  A size that matches the last one sent is not resent.
+ */
+#define WINCH_HOLDOFF_MSECS 100
+
 static unsigned char winch_buf[11];
 static struct ioinfo_oob winch_oob = { .buf = winch_buf };
 static bool winch_oob_sending;
 static bool winch_oob_pending;
+static bool winch_holdoff;
+static bool winch_have_sent;
+static struct gensio_timer *winch_timer;
 static int winch_x_chrs, winch_y_chrs, winch_x_bits, winch_y_bits;
+static int winch_sent_x_chrs, winch_sent_y_chrs;
+static int winch_sent_x_bits, winch_sent_y_bits;
 
 static void
 send_winch(struct ioinfo *ioinfo,
@@ -1257,21 +1277,54 @@ send_winch(struct ioinfo *ioinfo,
     winch_oob.len = 11;
     winch_oob.cb_data = ioinfo;
     winch_oob.send_done = winch_sent;
+    winch_sent_x_chrs = x_chrs;
+    winch_sent_y_chrs = y_chrs;
+    winch_sent_x_bits = x_bits;
+    winch_sent_y_bits = y_bits;
+    winch_have_sent = true;
     ioinfo_sendoob(ioinfo, &winch_oob);
     winch_oob_sending = true;
 }
 
+static void
+winch_flush(struct ioinfo *ioinfo)
+{
+    if (!winch_oob_pending || winch_oob_sending || winch_holdoff)
+	return;
+
+    winch_oob_pending = false;
+    if (winch_have_sent &&
+	winch_x_chrs == winch_sent_x_chrs &&
+	winch_y_chrs == winch_sent_y_chrs &&
+	winch_x_bits == winch_sent_x_bits &&
+	winch_y_bits == winch_sent_y_bits)
+	return;
+
+    send_winch(ioinfo,
+	       winch_x_chrs, winch_y_chrs, winch_x_bits, winch_y_bits);
+}
+
+static void
+winch_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct ioinfo *ioinfo = cb_data;
+
+    winch_holdoff = false;
+    winch_flush(ioinfo);
+}
+
 static void
 winch_sent(void *cb_data)
 {
     struct ioinfo *ioinfo = cb_data;
+    struct gdata *ginfo = ioinfo_userdata(ioinfo);
+    gensio_time timeout = { 0, WINCH_HOLDOFF_MSECS * 1000000 };
 
     winch_oob_sending = false;
-    if (winch_oob_pending) {
-	winch_oob_pending = false;
-	send_winch(ioinfo,
-		   winch_x_chrs, winch_y_chrs, winch_x_bits, winch_y_bits);
-    }
+    if (winch_timer && !gensio_os_funcs_start_timer(ginfo->o, winch_timer,
+						   &timeout))
+	winch_holdoff = true;
+    winch_flush(ioinfo);
 }
 
 static void
@@ -1279,16 +1332,19 @@ winch_ready(int x_chrs, int y_chrs, int x_bits, int y_bits,
 	    void *handler_data)
 {
     struct ioinfo *ioinfo = handler_data;
+    struct gdata *ginfo = ioinfo_userdata(ioinfo);
 
-    if (winch_oob_sending) {
-	winch_x_chrs = x_chrs;
-	winch_y_chrs = y_chrs;
-	winch_x_bits = x_bits;
-	winch_y_bits = y_bits;
-	winch_oob_pending = true;
-    } else {
-	send_winch(ioinfo, x_chrs, y_chrs, x_bits, y_bits);
-    }
+    if (!winch_timer)
+	/* If this fails we just don't hold off between messages. */
+	winch_timer = gensio_os_funcs_alloc_timer(ginfo->o, winch_timeout,
+						  ioinfo);
+
+    winch_x_chrs = x_chrs;
+    winch_y_chrs = y_chrs;
+    winch_x_bits = x_bits;
+    winch_y_bits = y_bits;
+    winch_oob_pending = true;
+    winch_flush(ioinfo);
 }
 
 static void
@@ -1732,6 +1788,49 @@ strdup_double_backslash(char **str, gensiods *rlen)
     return false;
 }
 
+/*
+ * Connect to a master gtlssh at the control path and ask it to open a
+ * channel on its connection with our service.
+ */
+static int
+open_control_path(struct gensio_os_funcs *o, const char *path,
+		  struct ioinfo *ioinfo, struct gdata *ginfo,
+		  const char *service, gensiods service_len)
+{
+    gensio_time timeout = {10, 0};
+    char *s;
+    int err;
+
+    s = alloc_sprintf("unix,%s", path);
+    if (!s)
+	return GE_NOMEM;
+
+    err = str_to_gensio(s, o, NULL, ioinfo, &ginfo->io);
+    if (err)
+	goto out_err;
+
+    err = gensio_open_s(ginfo->io);
+    if (err) {
+	gensio_free(ginfo->io);
+	goto out_err;
+    }
+
+    err = write_control_request(ginfo->io, service, service_len, &timeout);
+    if (err) {
+	gensio_close_s(ginfo->io);
+	gensio_free(ginfo->io);
+	goto out_err;
+    }
+
+    ginfo->ios = s;
+    return 0;
+
+ out_err:
+    ginfo->io = NULL;
+    free(s);
+    return err;
+}
+
 char *service;
 
 int
@@ -1770,6 +1869,8 @@ main(int argc, char *argv[])
     const char *iptype = ""; /* Try both IPv4 and IPv6 by default. */
     const char *mdns_type = NULL;
     const char *val_2fa = "", *pfx_2fa = "";
+    const char *control_path = NULL;
+    bool control_master = false, have_ports = false;
 
     memset(&userdata1, 0, sizeof(userdata1));
     memset(&userdata2, 0, sizeof(userdata2));
@@ -1905,8 +2006,15 @@ main(int argc, char *argv[])
 	    aux_data.flags |= GTLSSH_AUX_FLAG_PRIVILEGED;
 	} else if ((err = cmparg(argc, argv, &arg, "-L", NULL, &addr))) {
 	    err = handle_port(o, false, addr);
+	    have_ports = true;
 	} else if ((err = cmparg(argc, argv, &arg, "-R", NULL, &addr))) {
 	    err = handle_port(o, true, addr);
+	    have_ports = true;
+	} else if ((err = cmparg(argc, argv, &arg, "-S", "--control-path",
+				 &control_path))) {
+	    ;
+	} else if ((err = cmparg(argc, argv, &arg, "-M", "--master", NULL))) {
+	    control_master = true;
 	} else if ((err = cmparg(argc, argv, &arg, "-4", NULL, NULL))) {
 	    iptype = "ipv4,";
 	} else if ((err = cmparg(argc, argv, &arg, "-6", NULL, NULL))) {
@@ -1936,6 +2044,11 @@ main(int argc, char *argv[])
     if (nosctp && !user_transport)
 	transport = "tcp(readbuf=20000)";
 
+    if (control_master && (!control_path || !use_mux)) {
+	fprintf(stderr, "--master requires --control-path and mux\n");
+	return 1;
+    }
+
     if (!!certname != !!keyname) {
 	fprintf(stderr,
 		"If you specify a certname, you must specify a keyname\n");
@@ -2091,6 +2204,17 @@ main(int argc, char *argv[])
     userdata1.user_io = userdata1.io;
     userdata2.user_io = userdata1.io;
 
+    /*
+     * Port forwards are done on our own connection, the master
+     * doesn't know about them.
+     */
+    if (control_path && !control_master && !have_ports &&
+		!open_control_path(o, control_path, ioinfo2, &userdata2,
+				   service, service_len)) {
+	userdata2.can_close = true;
+	goto control_open;
+    }
+
     err = lookup_certinfo(o, tlssh_dir, username, hostname, port,
 			  &CAspec, &certspec, &keyspec);
     if (err)
@@ -2214,6 +2338,22 @@ main(int argc, char *argv[])
     if (mdns_transport)
 	gensio_os_funcs_zfree(o, (char *) transport);
 
+    if (control_master) {
+	s = alloc_sprintf("unix(delsock,perm=600),%s", control_path);
+	if (!s) {
+	    rv = 1;
+	    fprintf(stderr, "out of memory allocating control path\n");
+	    goto closeit;
+	}
+	err = add_control_port(locport, s, control_path);
+	free(s);
+	if (err) {
+	    rv = 1;
+	    goto closeit;
+	}
+    }
+
+ control_open:
     userdata1.can_close = true;
     err = gensio_open_s(userdata1.io);
     if (err) {
@@ -2235,6 +2375,12 @@ main(int argc, char *argv[])
  closeit:
     free(service);
 
+    if (winch_timer) {
+	gensio_os_funcs_stop_timer(o, winch_timer);
+	gensio_os_funcs_free_timer(o, winch_timer);
+	winch_timer = NULL;
+    }
+
     if (userdata2.can_close) {
 	err = gensio_close(userdata2.io, io_close, closewaiter);
 	if (err)
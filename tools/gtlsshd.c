@@ -81,6 +81,11 @@ static bool permit_root = false;
 static bool pw_login = false;
 static bool do_2fa = false;
 static bool ginteractive_login = true;
+/*
+ * Number of idle worker processes to keep waiting for connections,
+ * zero to fork when a connection comes in.  Not used on Windows.
+ */
+static unsigned int prefork_count;
 
 #ifndef _WIN32
 /*
@@ -539,12 +544,13 @@ closecount_decr(struct auth_data *auth)
     bool do_free;
 
     auth_lock(auth);
-    assert(gensio_list_empty(&auth->cons));
     assert(auth->closecount > 0);
     auth->closecount--;
     do_free = auth->closecount == 0;
     auth_unlock(auth);
     if (do_free) {
+	/* A client may run more than one session on the connection. */
+	assert(gensio_list_empty(&auth->cons));
 	struct gdata *ginfo = auth->ginfo;
 
 	ginfo_lock(ginfo);
@@ -1095,6 +1101,13 @@ setup_auth(struct auth_data *auth)
     return 0;
 }
 
+/*
+ * PAM is run here, after the connection is open, and not from the
+ * certauth verify events, which only save the password and 2FA token.
+ * Each connection is in its own process by now (or its own thread on
+ * Windows), so a slow PAM module only holds up the user it is
+ * authenticating and it's fine for this to block.
+ */
 static int
 finish_auth(struct auth_data *auth)
 {
@@ -2756,6 +2769,137 @@ handle_new(struct gensio *net_io)
 static struct gensio_accepter *tcp_acc, *sctp_acc, *other_acc;
 
 #ifndef _WIN32
+/*
+ * With --prefork, the main process only holds the accepters and keeps
+ * prefork_count idle workers that accept connections themselves, so
+ * the forking is done before a connection comes in instead of after.
+ * A worker handles the one connection it gets, like a forked child,
+ * and writes a byte to prefork_pipe when it gets it so the main
+ * process starts a replacement.
+ */
+static int prefork_pipe[2] = { -1, -1 };
+static bool prefork_worker;
+
+static void
+acc_set_enable(bool enabled)
+{
+    if (tcp_acc)
+	gensio_acc_set_accept_callback_enable(tcp_acc, enabled);
+    if (sctp_acc)
+	gensio_acc_set_accept_callback_enable(sctp_acc, enabled);
+    if (other_acc)
+	gensio_acc_set_accept_callback_enable(other_acc, enabled);
+}
+
+/* Returns 1 in the new worker, 0 in the main process, -1 on error. */
+static int
+start_prefork_worker(struct gensio_os_funcs *o)
+{
+    pid_t pid;
+    int err;
+
+    switch ((pid = fork())) {
+    case -1:
+	log_event(LOG_ERR, "Could not fork worker: %s", strerror(errno));
+	return -1;
+
+    case 0:
+	/* Double fork like a connection child, see setup_new_connection. */
+	err = gensio_os_funcs_handle_fork(o);
+	if (err) {
+	    log_event(LOG_ERR, "Could not fork gensio handler: %s",
+		      gensio_err_to_str(err));
+	    exit(1);
+	}
+	pid_file = NULL; /* Make sure children don't delete this. */
+
+	setsid();
+	switch (fork()) {
+	case -1:
+	    log_event(LOG_ERR, "Could not fork twice: %s", strerror(errno));
+	    exit(1);
+	case 0:
+	    break;
+	default:
+	    exit(0);
+	}
+
+	close(prefork_pipe[0]);
+	prefork_worker = true;
+	acc_set_enable(true);
+	return 1;
+
+    default:
+	waitpid(pid, NULL, 0);
+	return 0;
+    }
+}
+
+/*
+ * Start the workers and replace them as they take connections.  This
+ * only returns in a worker, the main process stays in here.
+ */
+static void
+run_prefork(struct gensio_os_funcs *o)
+{
+    unsigned int i;
+    ssize_t rv;
+    char c;
+
+    if (pipe(prefork_pipe) == -1) {
+	log_event(LOG_ERR, "Could not create worker pipe: %s",
+		  strerror(errno));
+	exit(1);
+    }
+
+    /* The workers accept, not us. */
+    acc_set_enable(false);
+
+    for (i = 0; i < prefork_count; ) {
+	rv = start_prefork_worker(o);
+	if (rv > 0)
+	    return;
+	if (rv < 0)
+	    sleep(1);
+	else
+	    i++;
+    }
+
+    for (;;) {
+	rv = read(prefork_pipe[0], &c, 1);
+	if (rv == -1 && errno == EINTR)
+	    continue;
+	if (rv <= 0) {
+	    log_event(LOG_ERR, "Error reading worker pipe: %s",
+		      rv ? strerror(errno) : "closed");
+	    exit(1);
+	}
+	while ((rv = start_prefork_worker(o)) < 0)
+	    sleep(1);
+	if (rv > 0)
+	    return;
+    }
+}
+
+/*
+ * A worker got a connection, tell the main process to start another
+ * one.  Returns false if this worker already has a connection.
+ */
+static bool
+prefork_take_connection(void)
+{
+    if (prefork_pipe[1] == -1)
+	return false;
+    /* Leave any others on the other accepters for another worker. */
+    acc_set_enable(false);
+    if (write(prefork_pipe[1], "c", 1) != 1)
+	log_event(LOG_WARNING, "Could not notify main process: %s",
+		  strerror(errno));
+    close(prefork_pipe[1]);
+    prefork_pipe[1] = -1;
+    return true;
+}
+
 static void
 handle_new_runner(struct gensio_runner *r, void *cb_data)
 {
@@ -2775,7 +2919,7 @@ setup_new_connection(struct gdata *ginfo, struct gensio *io)
     pid_t pid;
     int err;
 
-    if (oneshot)
+    if (oneshot || prefork_worker)
 	goto skip_fork;
 
     switch ((pid = fork())) {
@@ -2915,6 +3059,10 @@ sys_cleanup(void)
 
 #else
 
+#define prefork_worker false
+#define run_prefork(o) do { } while(0)
+#define prefork_take_connection() true
+
 static void
 thread_handle_new(void *data) {
     handle_new(data);
@@ -2975,6 +3123,14 @@ acc_event(struct gensio_accepter *accepter, void *user_data,
 
     io = data;
 
+    if (prefork_worker && !prefork_take_connection()) {
+	/* Only one connection per worker, another worker can take it. */
+	log_event(LOG_WARNING, "Worker got a second connection, dropping it");
+	gensio_disable(io);
+	gensio_free(io);
+	return 0;
+    }
+
     if (oneshot) {
 	if (tcp_acc) {
 	    gensio_acc_free(tcp_acc);
@@ -3012,6 +3168,10 @@ help(int err)
     printf("  --allow-password - Allow password-based logins.\n");
     printf("  --oneshot - Do not fork new connections, do one and exit.\n");
     printf("  --nodaemon - Do not daemonize.\n");
+#ifndef _WIN32
+    printf("  --prefork <n> - Keep <n> worker processes waiting for\n");
+    printf("     connections instead of forking when one comes in.\n");
+#endif
     printf("  --nointeractive - Do not do interactive login queries.\n");
     printf("  --sctp - Enable SCTP support.\n");
     printf("  --notcp - Disable TCP support.\n");
@@ -3081,6 +3241,7 @@ main(int argc, char *argv[])
     const char *iptype = ""; /* Try both IPv4 and IPv6 by default. */
     const char *other_acc_str = NULL;
     struct gensio_os_proc_data *proc_data;
+    const char *prefork_acc_opts = "";
 
     if ((progname = strrchr(argv[0], '/')) == NULL)
 	progname = argv[0];
@@ -3130,6 +3291,11 @@ main(int argc, char *argv[])
 	    oneshot = true;
 	else if ((rv = cmparg(argc, argv, &arg, NULL, "--nodaemon", NULL)))
 	    daemonize = false;
+#ifndef _WIN32
+	else if ((rv = cmparg_uint(argc, argv, &arg, NULL, "--prefork",
+				   &prefork_count)))
+	    ;
+#endif
 	else if ((rv = cmparg(argc, argv, &arg, NULL, "--nointeractive", NULL)))
 	    ginteractive_login = false;
 	else if ((rv = cmparg(argc, argv, &arg, "-4", NULL, NULL)))
@@ -3156,6 +3322,13 @@ main(int argc, char *argv[])
     start_log(debug);
     log_event(LOG_NOTICE, "gtlsshd startup");
 
+    if (prefork_count && !oneshot)
+	/*
+	 * The accepter gets connections ready before they are reported,
+	 * so keep a worker from taking more than the one it can handle.
+	 */
+	prefork_acc_opts = ",maxconn=1";
+
     if (!sctp && notcp) {
 	log_event(LOG_ERR, "You cannot disable both TCP and SCTP\n");
 	exit(1);
@@ -3219,7 +3392,8 @@ main(int argc, char *argv[])
     }
 
     if (!notcp) {
-	s = gensio_alloc_sprintf(o, "tcp(readbuf=20000),%s%d", iptype, port);
+	s = gensio_alloc_sprintf(o, "tcp(readbuf=20000%s),%s%d",
+				 prefork_acc_opts, iptype, port);
 	if (!s) {
 	    log_event(LOG_ERR, "Could not allocate tcp descriptor\n");
 	    return 1;
@@ -3242,7 +3416,8 @@ main(int argc, char *argv[])
     }
 
     if (sctp) {
-	s = gensio_alloc_sprintf(o, "sctp(readbuf=20000),%s%d", iptype, port);
+	s = gensio_alloc_sprintf(o, "sctp(readbuf=20000%s),%s%d",
+				 prefork_acc_opts, iptype, port);
 	if (!s) {
 	    log_event(LOG_ERR, "Could not allocate sctp descriptor\n");
 	    return 1;
@@ -3298,6 +3473,9 @@ main(int argc, char *argv[])
     if (!oneshot && daemonize)
 	do_daemonize(o);
 
+    if (!oneshot && prefork_count)
+	run_prefork(o);
+
     gensio_os_funcs_wait(o, ginfo.waiter, 1, NULL);
 
     /* FIXME - shutdown threads first. */
@@ -0,0 +1,248 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: GPL-2.0-only
+ */
+
+/*
+ * Decode the binary output of the trace gensio, see the format
+ * description in lib/gensio_filter_trace.c.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <gensio/gensio.h>
+#include "utils.h"
+
+#define GTRACE_MAGIC		"GENSIOTR"
+#define GTRACE_MAGIC_LEN	8
+#define GTRACE_HDR_LEN		24
+
+#define GTRACE_START		0
+#define GTRACE_READ		1
+#define GTRACE_WRITE		2
+#define GTRACE_READ_ERR		3
+#define GTRACE_WRITE_ERR	4
+#define GTRACE_DROPPED		5
+#define GTRACE_READ_BLOCKED	6
+#define GTRACE_WRITE_BLOCKED	7
+
+static const char *progname;
+static bool show_read = true, show_write = true, raw, wallclock;
+
+/* The wall clock time at the monotonic time of the last start record. */
+static int64_t base_wall, base_mono;
+
+static uint64_t
+get_le(const unsigned char *p, unsigned int len)
+{
+    uint64_t v = 0;
+
+    while (len > 0)
+	v = (v << 8) | p[--len];
+    return v;
+}
+
+static void
+print_time(int64_t secs, unsigned int nsecs)
+{
+    if (wallclock && base_wall) {
+	time_t t = base_wall + (secs - base_mono);
+	char tbuf[64];
+
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("%s.%6.6u", tbuf, (nsecs + 500) / 1000);
+    } else {
+	printf("%lld:%6.6u", (long long) secs, (nsecs + 500) / 1000);
+    }
+}
+
+static int
+dump_file(FILE *f, const char *name)
+{
+    unsigned char hdr[GTRACE_HDR_LEN], *data = NULL;
+    uint32_t caplen, origlen, nsecs, datasize = 0;
+    unsigned int type;
+    int64_t secs;
+    struct gensio_fdump h;
+    bool is_read;
+    int rv = 0;
+
+    if (fread(hdr, 1, GTRACE_MAGIC_LEN, f) != GTRACE_MAGIC_LEN ||
+		memcmp(hdr, GTRACE_MAGIC, GTRACE_MAGIC_LEN) != 0) {
+	fprintf(stderr, "%s: not a gensio trace file\n", name);
+	return 1;
+    }
+
+    while (fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr)) {
+	type = get_le(hdr, 2);
+	caplen = get_le(hdr + 4, 4);
+	origlen = get_le(hdr + 8, 4);
+	nsecs = get_le(hdr + 12, 4);
+	secs = get_le(hdr + 16, 8);
+
+	if (caplen > datasize) {
+	    unsigned char *ndata = realloc(data, caplen);
+
+	    if (!ndata) {
+		fprintf(stderr, "%s: out of memory\n", name);
+		rv = 1;
+		goto out;
+	    }
+	    data = ndata;
+	    datasize = caplen;
+	}
+	if (caplen && fread(data, 1, caplen, f) != caplen) {
+	    fprintf(stderr, "%s: truncated record\n", name);
+	    rv = 1;
+	    goto out;
+	}
+
+	is_read = (type == GTRACE_READ || type == GTRACE_READ_ERR ||
+		   type == GTRACE_READ_BLOCKED);
+	if ((is_read && !show_read) || (!is_read && !show_write))
+	    if (type != GTRACE_START && type != GTRACE_DROPPED)
+		continue;
+
+	if (raw) {
+	    if (type == GTRACE_READ || type == GTRACE_WRITE)
+		fwrite(data, 1, caplen, stdout);
+	    continue;
+	}
+
+	switch (type) {
+	case GTRACE_START:
+	    if (caplen >= 16) {
+		base_mono = secs;
+		base_wall = get_le(data + 8, 8);
+	    }
+	    print_time(secs, nsecs);
+	    printf(" Trace start\n");
+	    break;
+
+	case GTRACE_READ:
+	case GTRACE_WRITE:
+	    print_time(secs, nsecs);
+	    if (caplen < origlen)
+		printf(" %s (%lu of %lu):\n", is_read ? "Read" : "Write",
+		       (unsigned long) caplen, (unsigned long) origlen);
+	    else
+		printf(" %s (%lu):\n", is_read ? "Read" : "Write",
+		       (unsigned long) origlen);
+	    gensio_fdump_init(&h, 1);
+	    gensio_fdump_buf(stdout, data, caplen, &h);
+	    gensio_fdump_buf_finish(stdout, &h);
+	    break;
+
+	case GTRACE_READ_ERR:
+	case GTRACE_WRITE_ERR:
+	    print_time(secs, nsecs);
+	    printf(" %s error: %d %s\n", is_read ? "Read" : "Write",
+		   (int) origlen, gensio_err_to_str(origlen));
+	    break;
+
+	case GTRACE_READ_BLOCKED:
+	case GTRACE_WRITE_BLOCKED:
+	    print_time(secs, nsecs);
+	    printf(" %s blocked, %lu bytes not taken\n",
+		   is_read ? "Read" : "Write", (unsigned long) origlen);
+	    break;
+
+	case GTRACE_DROPPED:
+	    print_time(secs, nsecs);
+	    printf(" Dropped %lu records\n", (unsigned long) origlen);
+	    break;
+
+	default:
+	    print_time(secs, nsecs);
+	    printf(" Unknown record type %u (%lu bytes)\n", type,
+		   (unsigned long) caplen);
+	    break;
+	}
+    }
+
+ out:
+    free(data);
+    return rv;
+}
+
+static void
+help(int err)
+{
+    printf("%s [options] [file]\n", progname);
+    printf("\nDecode a binary trace from the trace gensio.  Reads stdin\n"
+	   "if a file isn't given.\n");
+    printf("\noptions are:\n");
+    printf("  -d, --dir read|write|both - Only show data in the given\n"
+	   "    direction, both is the default.\n");
+    printf("  -r, --raw - Just write the data bytes, no headers.\n");
+    printf("  -w, --wallclock - Print times as the date and time.\n");
+    printf("  -h, --help - This help\n");
+    exit(err);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rv, arg;
+    const char *dir = NULL;
+    FILE *f = stdin;
+    const char *name = "<stdin>";
+
+    progname = argv[0];
+
+    for (arg = 1; arg < argc; arg++) {
+	if (argv[arg][0] != '-')
+	    break;
+	if (strcmp(argv[arg], "--") == 0) {
+	    arg++;
+	    break;
+	}
+	if ((rv = cmparg(argc, argv, &arg, "-d", "--dir", &dir))) {
+	    if (rv < 0)
+		return 1;
+	    if (strcmp(dir, "read") == 0) {
+		show_write = false;
+	    } else if (strcmp(dir, "write") == 0) {
+		show_read = false;
+	    } else if (strcmp(dir, "both") != 0) {
+		fprintf(stderr, "Invalid direction: %s\n", dir);
+		return 1;
+	    }
+	} else if ((rv = cmparg(argc, argv, &arg, "-r", "--raw", NULL))) {
+	    raw = true;
+	} else if ((rv = cmparg(argc, argv, &arg, "-w", "--wallclock",
+				NULL))) {
+	    wallclock = true;
+	} else if ((rv = cmparg(argc, argv, &arg, NULL, "--version", NULL))) {
+	    printf("Version %s\n", gensio_version_string);
+	    exit(0);
+	} else if ((rv = cmparg(argc, argv, &arg, "-h", "--help", NULL))) {
+	    help(0);
+	} else {
+	    fprintf(stderr, "Unknown argument: %s, use -h for help\n",
+		    argv[arg]);
+	    return 1;
+	}
+    }
+
+    if (arg < argc) {
+	name = argv[arg];
+	f = fopen(name, "rb");
+	if (!f) {
+	    fprintf(stderr, "Unable to open %s\n", name);
+	    return 1;
+	}
+    }
+
+    rv = dump_file(f, name);
+    if (f != stdin)
+	fclose(f);
+    return rv;
+}
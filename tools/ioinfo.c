@@ -23,14 +23,29 @@
  *  release a modified version which carries forward this exception.
  */
 
+#define _GNU_SOURCE /* Get splice() and pipe2(). */
 #include "config.h"
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
 #include <string.h>
 
+#include <gensio/gensio_circbuf.h>
+
 #include "ioinfo.h"
 
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#include <gensio/gensio_os_funcs.h>
+
+struct ioinfo_splice;
+#endif
+
 struct ioinfo {
     struct gensio *io;
     struct ioinfo *otherio;
@@ -53,6 +68,28 @@ struct ioinfo {
 
     struct ioinfo_oob *oob_head;
     struct ioinfo_oob *oob_tail;
+
+    /*
+     * Data read from this gensio that the other one hasn't taken yet,
+     * see ioinfo_set_buffer().  NULL if not buffering.  This, and the
+     * pending shutdown, are protected by otherio->lock, the lock held
+     * when writing to the other gensio.
+     */
+    struct gensio_circbuf *buf;
+    gensiods buf_low;
+    bool packet;
+    bool shutdown_pending;
+    enum ioinfo_shutdown_reason pending_reason;
+
+#ifdef HAVE_SPLICE
+    /* From GENSIO_CONTROL_RAW_FD, -1 if the gensio doesn't have one. */
+    int raw_rfd;
+    int raw_wfd;
+    bool splice_ok;
+
+    /* Set when data from this gensio is spliced to the other one. */
+    struct ioinfo_splice *splice;
+#endif
 };
 
 void
@@ -185,6 +222,485 @@ handle_escapechar(struct ioinfo *ioinfo, char c)
     return rv;
 }
 
+#ifdef HAVE_SPLICE
+/*
+ * When both gensios are plain file descriptors, data from one to the
+ * other is moved in the kernel with splice() through a pipe, or with
+ * sendfile() if the source is a regular file, instead of coming up
+ * through the read callback.  The source gensio's read callback is
+ * disabled while this is going on; the fds are dup-ed so they can be
+ * put in the selector beside the gensio's own.
+ *
+ * If anything besides waiting happens (end of file, an error, or
+ * splice not being supported on the fds), the splice is stopped and
+ * the source gensio's read callback is turned back on.  The gensio
+ * then reports the end of file or error itself, or just carries on
+ * moving the data the normal way.
+ *
+ * This is separate from the ioinfo because it has to hang around
+ * until the fd handlers are cleared.  The ioinfo must stop it before
+ * the gensios are closed, and handlers only touch the ioinfo while
+ * it's attached and sp->lock is held.
+ */
+#define IOINFO_SPLICE_CHUNK	65536
+/* Number of chunks to move before going back to the selector. */
+#define IOINFO_SPLICE_BURST	16
+
+struct ioinfo_splice {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct ioinfo *ioinfo; /* NULL when stopped. */
+
+    int rfd;
+    int wfd;
+    /* NULL for regular files, they are always ready. */
+    struct gensio_iod *riod;
+    struct gensio_iod *wiod;
+
+    /*
+     * One for ioinfo->splice and one for each iod with handlers set.
+     * Whoever clears ioinfo->splice calls splice_stop().
+     */
+    unsigned int refcount;
+    bool stopped;
+
+    /* Not used if sending from a regular file with sendfile(). */
+    int pipefds[2];
+    gensiods in_pipe;
+
+    bool moved;
+    bool eof;
+};
+
+static int
+splice_dupfd(int fd, struct gensio_os_funcs *o, struct gensio_iod **iod)
+{
+    struct stat statb;
+    int nfd, err;
+
+    if (fstat(fd, &statb) == -1)
+	return -1;
+
+    nfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (nfd == -1)
+	return -1;
+
+    if (!S_ISREG(statb.st_mode)) {
+	err = o->add_iod(o, GENSIO_IOD_PIPE, nfd, iod);
+	if (err) {
+	    close(nfd);
+	    return -1;
+	}
+    }
+    return nfd;
+}
+
+/* Called with sp->lock held, releases it. */
+static void
+splice_deref(struct ioinfo_splice *sp)
+{
+    struct gensio_os_funcs *o = sp->o;
+
+    if (--sp->refcount > 0) {
+	gensio_os_funcs_unlock(o, sp->lock);
+	return;
+    }
+    gensio_os_funcs_unlock(o, sp->lock);
+
+    if (sp->riod)
+	o->close(&sp->riod);
+    else if (sp->rfd != -1)
+	close(sp->rfd);
+    if (sp->wiod)
+	o->close(&sp->wiod);
+    else if (sp->wfd != -1)
+	close(sp->wfd);
+    if (sp->pipefds[0] != -1) {
+	close(sp->pipefds[0]);
+	close(sp->pipefds[1]);
+    }
+    gensio_os_funcs_free_lock(o, sp->lock);
+    gensio_os_funcs_zfree(o, sp);
+}
+
+/* Called with sp->lock held, releases it. */
+static void
+splice_stop(struct ioinfo_splice *sp)
+{
+    struct gensio_os_funcs *o = sp->o;
+
+    sp->ioinfo = NULL;
+    if (!sp->stopped) {
+	sp->stopped = true;
+	if (sp->riod)
+	    o->clear_fd_handlers(sp->riod);
+	if (sp->wiod)
+	    o->clear_fd_handlers(sp->wiod);
+    }
+    splice_deref(sp);
+}
+
+static void
+splice_wait(struct ioinfo_splice *sp, bool for_write)
+{
+    struct gensio_os_funcs *o = sp->o;
+
+    /* Regular files never block, so wait on the other side. */
+    if (!sp->riod)
+	for_write = true;
+    else if (!sp->wiod)
+	for_write = false;
+    if (sp->riod)
+	o->set_read_handler(sp->riod, !for_write);
+    if (sp->wiod)
+	o->set_write_handler(sp->wiod, for_write);
+}
+
+static int
+splice_err(struct ioinfo_splice *sp, bool for_write)
+{
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+	splice_wait(sp, for_write);
+	return 0;
+    }
+    /* Nothing has been lost yet, let the gensio do it. */
+    if (!sp->moved && (errno == EINVAL || errno == ENOSYS ||
+		       errno == EOPNOTSUPP))
+	return GE_NOTSUP;
+    return gensio_os_err_to_err(sp->o, errno);
+}
+
+/*
+ * Move data until the fds block.  Returns 0 when waiting on the
+ * selector, GE_REMCLOSE at the end of the source data, or an error.
+ */
+static int
+splice_move(struct ioinfo_splice *sp)
+{
+    unsigned int i;
+    ssize_t rv;
+
+    for (i = 0; i < IOINFO_SPLICE_BURST; i++) {
+#ifdef HAVE_SYS_SENDFILE_H
+	if (sp->pipefds[0] == -1) {
+	    rv = sendfile(sp->wfd, sp->rfd, NULL, IOINFO_SPLICE_CHUNK);
+	    if (rv == 0)
+		return GE_REMCLOSE;
+	    if (rv < 0) {
+		if (errno == EINTR)
+		    continue;
+		return splice_err(sp, true);
+	    }
+	    sp->moved = true;
+	    continue;
+	}
+#endif
+
+	if (sp->in_pipe) {
+	    rv = splice(sp->pipefds[0], NULL, sp->wfd, NULL, sp->in_pipe,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	    if (rv < 0) {
+		if (errno == EINTR)
+		    continue;
+		return splice_err(sp, true);
+	    }
+	    sp->in_pipe -= rv;
+	    if (sp->in_pipe)
+		continue;
+	}
+	if (sp->eof)
+	    return GE_REMCLOSE;
+
+	rv = splice(sp->rfd, NULL, sp->pipefds[1], NULL, IOINFO_SPLICE_CHUNK,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (rv == 0) {
+	    sp->eof = true;
+	} else if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return splice_err(sp, false);
+	} else {
+	    sp->in_pipe += rv;
+	    sp->moved = true;
+	}
+    }
+
+    /* Let other things run, the selector will call back. */
+    splice_wait(sp, sp->in_pipe > 0);
+    return 0;
+}
+
+static void
+splice_handler(struct gensio_iod *iod, void *cb_data)
+{
+    struct ioinfo_splice *sp = cb_data;
+    struct gensio_os_funcs *o = sp->o;
+    struct ioinfo *ioinfo;
+    bool linked;
+    int err;
+
+    gensio_os_funcs_lock(o, sp->lock);
+    ioinfo = sp->ioinfo;
+    if (!ioinfo) {
+	gensio_os_funcs_unlock(o, sp->lock);
+	return;
+    }
+    err = splice_move(sp);
+    if (!err) {
+	gensio_os_funcs_unlock(o, sp->lock);
+	return;
+    }
+
+    /* Hand the fd back to the gensio. */
+    gensio_os_funcs_lock(o, ioinfo->lock);
+    linked = ioinfo->splice == sp;
+    if (linked)
+	ioinfo->splice = NULL;
+    if (err == GE_NOTSUP)
+	ioinfo->splice_ok = false;
+    if (ioinfo->ready)
+	gensio_set_read_callback_enable(ioinfo->io, true);
+    gensio_os_funcs_unlock(o, ioinfo->lock);
+    if (err != GE_NOTSUP && err != GE_REMCLOSE)
+	ioinfo_err(ioinfo, "splice error: %s", gensio_err_to_str(err));
+    if (linked) {
+	splice_stop(sp);
+    } else {
+	/* ioinfo_stop_splice() has it and will stop it. */
+	sp->ioinfo = NULL;
+	gensio_os_funcs_unlock(o, sp->lock);
+    }
+}
+
+static void
+splice_cleared(struct gensio_iod *iod, void *cb_data)
+{
+    struct ioinfo_splice *sp = cb_data;
+
+    gensio_os_funcs_lock(sp->o, sp->lock);
+    splice_deref(sp);
+}
+
+static int
+splice_set_handlers(struct ioinfo_splice *sp, struct gensio_iod *iod)
+{
+    int err;
+
+    err = sp->o->set_fd_handlers(iod, sp, splice_handler, splice_handler,
+				 NULL, splice_cleared);
+    if (!err)
+	sp->refcount++;
+    return err;
+}
+
+static struct ioinfo_splice *
+splice_alloc(struct gensio_os_funcs *o, int rfd, int wfd)
+{
+    struct ioinfo_splice *sp;
+
+    sp = gensio_os_funcs_zalloc(o, sizeof(*sp));
+    if (!sp)
+	return NULL;
+    sp->o = o;
+    sp->refcount = 1;
+    sp->pipefds[0] = -1;
+    sp->pipefds[1] = -1;
+    sp->lock = gensio_os_funcs_alloc_lock(o);
+    if (!sp->lock) {
+	gensio_os_funcs_zfree(o, sp);
+	return NULL;
+    }
+
+    sp->rfd = splice_dupfd(rfd, o, &sp->riod);
+    sp->wfd = splice_dupfd(wfd, o, &sp->wiod);
+    if (sp->rfd == -1 || sp->wfd == -1)
+	goto out_err;
+    if (!sp->riod && !sp->wiod)
+	/* Nothing to wait on, just let the gensios do it. */
+	goto out_err;
+
+#ifdef HAVE_SYS_SENDFILE_H
+    if (sp->riod)
+#endif
+    {
+	if (pipe2(sp->pipefds, O_NONBLOCK | O_CLOEXEC) == -1) {
+	    sp->pipefds[0] = -1;
+	    goto out_err;
+	}
+    }
+
+    if (sp->riod && splice_set_handlers(sp, sp->riod))
+	goto out_err;
+    if (sp->wiod && splice_set_handlers(sp, sp->wiod))
+	goto out_err;
+
+    return sp;
+
+ out_err:
+    gensio_os_funcs_lock(o, sp->lock);
+    splice_stop(sp);
+    return NULL;
+}
+
+static void
+ioinfo_get_raw_fds(struct ioinfo *ioinfo)
+{
+    char databuf[30], *end;
+    gensiods dbsize = sizeof(databuf);
+    int rv;
+
+    ioinfo->raw_rfd = -1;
+    ioinfo->raw_wfd = -1;
+    rv = gensio_control(ioinfo->io, 0, GENSIO_CONTROL_GET,
+			GENSIO_CONTROL_RAW_FD, databuf, &dbsize);
+    if (rv)
+	return;
+    ioinfo->raw_rfd = strtol(databuf, &end, 0);
+    ioinfo->raw_wfd = strtol(end, NULL, 0);
+}
+
+/*
+ * Called after all the data from a read was written to the other
+ * side, so nothing is held in either gensio and the fds can be
+ * taken over.
+ */
+static void
+ioinfo_try_splice(struct ioinfo *ioinfo)
+{
+    struct ioinfo *rioinfo = ioinfo->otherio;
+    struct gensio_os_funcs *o = ioinfo->o;
+    struct ioinfo_splice *sp;
+    int rfd = -1, wfd = -1;
+
+    gensio_os_funcs_lock(o, rioinfo->lock);
+    if (rioinfo->ready && !rioinfo->max_write)
+	wfd = rioinfo->raw_wfd;
+    gensio_os_funcs_unlock(o, rioinfo->lock);
+    if (wfd == -1)
+	return;
+
+    gensio_os_funcs_lock(o, ioinfo->lock);
+    if (ioinfo->ready && ioinfo->splice_ok && !ioinfo->splice &&
+		!ioinfo->max_write && ioinfo->escape_char < 0)
+	rfd = ioinfo->raw_rfd;
+    gensio_os_funcs_unlock(o, ioinfo->lock);
+    if (rfd == -1)
+	return;
+
+    sp = splice_alloc(o, rfd, wfd);
+
+    gensio_os_funcs_lock(o, ioinfo->lock);
+    if (!sp) {
+	ioinfo->splice_ok = false;
+	gensio_os_funcs_unlock(o, ioinfo->lock);
+	return;
+    }
+    if (!ioinfo->ready || ioinfo->splice) {
+	gensio_os_funcs_unlock(o, ioinfo->lock);
+	gensio_os_funcs_lock(o, sp->lock);
+	splice_stop(sp);
+	return;
+    }
+    gensio_set_read_callback_enable(ioinfo->io, false);
+    ioinfo->splice = sp;
+    gensio_os_funcs_lock(o, sp->lock);
+    sp->ioinfo = ioinfo;
+    splice_wait(sp, !sp->riod);
+    gensio_os_funcs_unlock(o, sp->lock);
+    gensio_os_funcs_unlock(o, ioinfo->lock);
+}
+
+static void
+ioinfo_stop_splice(struct ioinfo *ioinfo)
+{
+    struct ioinfo_splice *sp;
+
+    gensio_os_funcs_lock(ioinfo->o, ioinfo->lock);
+    sp = ioinfo->splice;
+    ioinfo->splice = NULL;
+    gensio_os_funcs_unlock(ioinfo->o, ioinfo->lock);
+    if (sp) {
+	gensio_os_funcs_lock(sp->o, sp->lock);
+	splice_stop(sp);
+    }
+}
+
+#define ioinfo_splicing(ioinfo) ((ioinfo)->splice != NULL)
+#else
+#define ioinfo_get_raw_fds(ioinfo) do { } while(0)
+#define ioinfo_try_splice(ioinfo) do { } while(0)
+#define ioinfo_stop_splice(ioinfo) do { } while(0)
+#define ioinfo_splicing(ioinfo) false
+#endif
+
+void
+ioinfo_set_splice(struct ioinfo *ioinfo, bool enable)
+{
+#ifdef HAVE_SPLICE
+    ioinfo->splice_ok = enable;
+#endif
+}
+
+int
+ioinfo_set_buffer(struct ioinfo *ioinfo, gensiods size, gensiods low)
+{
+    struct gensio_circbuf *buf;
+
+    buf = gensio_circbuf_alloc_mirrored(ioinfo->o, size);
+    if (!buf)
+	return GE_NOMEM;
+    if (ioinfo->buf)
+	gensio_circbuf_free(ioinfo->buf);
+    ioinfo->buf = buf;
+    if (low == 0 || low >= size)
+	low = size / 2;
+    ioinfo->buf_low = low;
+    return 0;
+}
+
+/*
+ * Packets have to go through one write each, and the buffer would
+ * merge them, so only plain streams get buffered.
+ */
+#define ioinfo_buffering(ioinfo) \
+    ((ioinfo)->buf && !(ioinfo)->packet && !(ioinfo)->otherio->packet)
+
+/*
+ * Write data from ioinfo's gensio to the other one.  If nothing is
+ * buffered the data is written directly, whatever the other gensio
+ * doesn't take goes into the buffer to be written from the other
+ * side's write ready callback.  Once the buffer is full, the amount
+ * taken will be short and reads stop until it drains to the low
+ * watermark.  Called with otherio->lock held.
+ */
+static int
+ioinfo_buffer_write(struct ioinfo *ioinfo, const unsigned char *buf,
+		    gensiods len, gensiods *rcount)
+{
+    struct ioinfo *rioinfo = ioinfo->otherio;
+    struct gensio_sg sg;
+    gensiods count = 0, added;
+    int rv;
+
+    if (gensio_circbuf_datalen(ioinfo->buf) == 0) {
+	sg.buf = buf;
+	sg.buflen = len;
+	if (rioinfo->max_write && sg.buflen > rioinfo->max_write)
+	    sg.buflen = rioinfo->max_write;
+	rv = gensio_write(rioinfo->io, &count, buf, sg.buflen, NULL);
+	if (rv)
+	    return rv;
+    }
+    if (count < len) {
+	sg.buf = buf + count;
+	sg.buflen = len - count;
+	gensio_circbuf_sg_write(ioinfo->buf, &sg, 1, &added);
+	count += added;
+    }
+    *rcount = count;
+    return 0;
+}
+
 static int
 io_event(struct gensio *io, void *user_data, int event, int err,
 	 unsigned char *buf, gensiods *buflen,
@@ -194,7 +710,9 @@ io_event(struct gensio *io, void *user_data, int event, int err,
     struct gensio_os_funcs *o = ioinfo->o;
     struct ioinfo *rioinfo = ioinfo->otherio;
     int rv, escapepos = -1;
+    bool all_written = false;
     gensiods count = 0;
+    enum ioinfo_shutdown_reason reason;
     static const char *oobaux[2] = { "oob", NULL };
 
     if (err) {
@@ -203,12 +721,27 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	gensio_set_write_callback_enable(ioinfo->io, false);
 	ioinfo->ready = false;
 	gensio_os_funcs_unlock(o, ioinfo->lock);
-	if (err != GE_REMCLOSE) {
+	if (err != GE_REMCLOSE)
 	    ioinfo_err(ioinfo, "read error: %s", gensio_err_to_str(err));
-	    ioinfo->uh->shutdown(ioinfo, IOINFO_SHUTDOWN_ERR);
-	} else {
-	    ioinfo->uh->shutdown(ioinfo, IOINFO_SHUTDOWN_REMCLOSE);
+	reason = IOINFO_SHUTDOWN_ERR;
+	if (err == GE_REMCLOSE)
+	    reason = IOINFO_SHUTDOWN_REMCLOSE;
+	if (ioinfo->buf) {
+	    /*
+	     * Let the other side finish writing what was already read,
+	     * it will do the shutdown when the buffer is empty.
+	     */
+	    gensio_os_funcs_lock(o, rioinfo->lock);
+	    if (rioinfo->ready && gensio_circbuf_datalen(ioinfo->buf) > 0) {
+		ioinfo->shutdown_pending = true;
+		ioinfo->pending_reason = reason;
+		gensio_set_write_callback_enable(rioinfo->io, true);
+		gensio_os_funcs_unlock(o, rioinfo->lock);
+		return 0;
+	    }
+	    gensio_os_funcs_unlock(o, rioinfo->lock);
 	}
+	ioinfo->uh->shutdown(ioinfo, reason);
 	return 0;
     }
 
@@ -252,7 +785,10 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	    if (rioinfo->max_write && wrsize > rioinfo->max_write)
 		wrsize = rioinfo->max_write;
 
-	    rv = gensio_write(rioinfo->io, &count, buf, wrsize, NULL);
+	    if (ioinfo_buffering(ioinfo))
+		rv = ioinfo_buffer_write(ioinfo, buf, *buflen, &count);
+	    else
+		rv = gensio_write(rioinfo->io, &count, buf, wrsize, NULL);
 	    if (rv) {
 		enum ioinfo_shutdown_reason reason = IOINFO_SHUTDOWN_ERR;
 		if (rv == GE_REMCLOSE)
@@ -290,8 +826,15 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	    (*buflen)++;
 	    ioinfo->in_escape = true;
 	    ioinfo->escape_pos = 0;
+	} else if (!ioinfo->buf || gensio_circbuf_datalen(ioinfo->buf) == 0) {
+	    all_written = true;
 	}
+	if (ioinfo->buf && gensio_circbuf_datalen(ioinfo->buf) > 0 &&
+		rioinfo->ready)
+	    gensio_set_write_callback_enable(rioinfo->io, true);
 	gensio_os_funcs_unlock(o, rioinfo->lock);
+	if (all_written)
+	    ioinfo_try_splice(ioinfo);
 	return 0;
 
     case GENSIO_EVENT_WRITE_READY:
@@ -332,12 +875,59 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	    gensio_os_funcs_unlock(o, ioinfo->lock);
 	    return 0;
 	}
-	if (ioinfo->ready)
+	if (rioinfo->buf && gensio_circbuf_datalen(rioinfo->buf) > 0 &&
+		ioinfo->ready) {
+	    /* Write out what the other side has buffered for us. */
+	    struct gensio_sg sg[2];
+	    gensiods sglen;
+
+	    gensio_circbuf_sg_read(rioinfo->buf, sg, &sglen);
+	    if (ioinfo->max_write && sg[0].buflen >= ioinfo->max_write) {
+		sg[0].buflen = ioinfo->max_write;
+		sglen = 1;
+	    } else if (ioinfo->max_write && sglen > 1 &&
+		       sg[0].buflen + sg[1].buflen > ioinfo->max_write) {
+		sg[1].buflen = ioinfo->max_write - sg[0].buflen;
+	    }
+	    rv = gensio_write_sg(ioinfo->io, &count, sg, sglen, NULL);
+	    if (rv) {
+		reason = IOINFO_SHUTDOWN_ERR;
+		if (rv == GE_REMCLOSE)
+		    reason = IOINFO_SHUTDOWN_REMCLOSE;
+		else
+		    ioinfo_err(ioinfo, "write error(3): %s",
+			       gensio_err_to_str(rv));
+		gensio_set_write_callback_enable(ioinfo->io, false);
+		gensio_set_read_callback_enable(ioinfo->io, false);
+		ioinfo->ready = false;
+		gensio_os_funcs_unlock(o, ioinfo->lock);
+		ioinfo->uh->shutdown(ioinfo, reason);
+		return 0;
+	    }
+	    gensio_circbuf_data_removed(rioinfo->buf, count);
+	    if (gensio_circbuf_datalen(rioinfo->buf) > rioinfo->buf_low) {
+		/* Wait for more room before reading again. */
+		gensio_os_funcs_unlock(o, ioinfo->lock);
+		return 0;
+	    }
+	}
+	if (rioinfo->buf && rioinfo->shutdown_pending &&
+		gensio_circbuf_datalen(rioinfo->buf) == 0) {
+	    /* The other side closed, and everything it sent is out. */
+	    rioinfo->shutdown_pending = false;
+	    reason = rioinfo->pending_reason;
+	    gensio_set_write_callback_enable(ioinfo->io, false);
+	    gensio_os_funcs_unlock(o, ioinfo->lock);
+	    rioinfo->uh->shutdown(rioinfo, reason);
+	    return 0;
+	}
+	if (ioinfo->ready && (!rioinfo->buf ||
+			      gensio_circbuf_datalen(rioinfo->buf) == 0))
 	    gensio_set_write_callback_enable(ioinfo->io, false);
 	gensio_os_funcs_unlock(o, ioinfo->lock);
 
 	gensio_os_funcs_lock(o, rioinfo->lock);
-	if (rioinfo->ready)
+	if (rioinfo->ready && !ioinfo_splicing(rioinfo))
 	    gensio_set_read_callback_enable(rioinfo->io, true);
 	gensio_os_funcs_unlock(o, rioinfo->lock);
 	return 0;
@@ -395,13 +985,20 @@ ioinfo_set_ready(struct ioinfo *ioinfo, struct gensio *io)
 
     gensio_os_funcs_lock(ioinfo->o, ioinfo->lock);
     ioinfo->io = io;
+    ioinfo->packet = gensio_is_packet(io);
     set_max_write(ioinfo);
+    ioinfo_get_raw_fds(ioinfo);
     gensio_set_callback(io, io_event, ioinfo);
     gensio_set_read_callback_enable(ioinfo->io, true);
     ioinfo->ready = true;
     gensio_os_funcs_unlock(ioinfo->o, ioinfo->lock);
     gensio_os_funcs_lock(rioinfo->o, rioinfo->lock);
-    if (rioinfo->ready)
+    if (ioinfo->buf) {
+	/* Anything left is from a previous gensio. */
+	gensio_circbuf_reset(ioinfo->buf);
+	ioinfo->shutdown_pending = false;
+    }
+    if (rioinfo->ready && !ioinfo_splicing(rioinfo))
 	gensio_set_read_callback_enable(rioinfo->io, true);
     gensio_os_funcs_unlock(rioinfo->o, rioinfo->lock);
 }
@@ -409,6 +1006,11 @@ ioinfo_set_ready(struct ioinfo *ioinfo, struct gensio *io)
 void
 ioinfo_set_not_ready(struct ioinfo *ioinfo)
 {
+    /* The gensios are going away, give them their fds back. */
+    ioinfo_stop_splice(ioinfo);
+    if (ioinfo->otherio)
+	ioinfo_stop_splice(ioinfo->otherio);
+
     gensio_os_funcs_lock(ioinfo->o, ioinfo->lock);
     if (ioinfo->io) {
 	gensio_set_read_callback_enable(ioinfo->io, false);
@@ -447,6 +1049,11 @@ alloc_ioinfo(struct gensio_os_funcs *o,
 	    ioinfo->subdata = subdata;
 	    ioinfo->uh = uh;
 	    ioinfo->userdata = userdata;
+#ifdef HAVE_SPLICE
+	    ioinfo->raw_rfd = -1;
+	    ioinfo->raw_wfd = -1;
+	    ioinfo->splice_ok = true;
+#endif
 	}
     }
     return ioinfo;
@@ -455,6 +1062,9 @@ alloc_ioinfo(struct gensio_os_funcs *o,
 void
 free_ioinfo(struct ioinfo *ioinfo)
 {
+    ioinfo_stop_splice(ioinfo);
+    if (ioinfo->buf)
+	gensio_circbuf_free(ioinfo->buf);
     gensio_os_funcs_free_lock(ioinfo->o, ioinfo->lock);
     gensio_os_funcs_zfree(ioinfo->o, ioinfo);
 }
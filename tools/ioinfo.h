@@ -179,6 +179,31 @@ void ioinfo_set_ready(struct ioinfo *ioinfo, struct gensio *io);
  */
 void ioinfo_set_not_ready(struct ioinfo *ioinfo);
 
+/*
+ * When both gensios are plain file descriptors (see
+ * GENSIO_CONTROL_RAW_FD), data from this gensio to the other one is
+ * moved in the kernel with splice() or sendfile() instead of through
+ * the read callback.  This is on by default, use this to turn it off
+ * for data coming from this ioinfo's gensio.  Note that
+ * ioinfo_set_not_ready() must be called before either gensio is
+ * closed so the fds are given back.
+ */
+void ioinfo_set_splice(struct ioinfo *ioinfo, bool enable);
+
+/*
+ * Buffer up to size bytes of data read from this ioinfo's gensio
+ * that the other gensio can't take yet, instead of stopping reads as
+ * soon as the other side does a partial write.  The buffered data is
+ * written out in larger chunks when the other side is ready, reads
+ * stop when the buffer is full and start again when it drains to low
+ * bytes (size / 2 if low is 0).  Data from or to packet gensios is
+ * not buffered.  If this gensio closes with data in the buffer, the
+ * shutdown is reported after the data is written.  Call this before
+ * ioinfo_set_ready().  Returns GE_NOMEM if the buffer can't be
+ * allocated.
+ */
+int ioinfo_set_buffer(struct ioinfo *ioinfo, gensiods size, gensiods low);
+
 /* Send data to the ioinfo user's out function. */
 void ioinfo_out(struct ioinfo *ioinfo, char *fmt, ...);
 
@@ -29,15 +29,22 @@
 #include <string.h>
 #include <stdbool.h>
 #include <gensio/gensio_list.h>
+#include <gensio/gensio_utils.h>
 #include "localports.h"
 #include "ioinfo.h"
 #include "utils.h"
 
+/* Per-direction buffer for forwarded connections, see portcon_setup(). */
+#define LOCALPORT_BUFSIZE	65536
+
+/* Largest service a control connection may ask for. */
+#define CONTROL_MAX_SERVICE	65536
+
 struct local_portinfo {
     struct local_ports *p;
 
     char *accepter_str;
-    char *service_str;
+    char *service_str; /* NULL for a control port. */
     char *id_str;
 
     struct gensio_accepter *accepter;
@@ -182,6 +189,14 @@ portcon_setup(struct local_ports *p, struct gensio *io, char *id_str,
 
     ioinfo_set_otherioinfo(ioinfo1, ioinfo2);
 
+    /*
+     * Port forwards are mostly bulk data, buffer it so a burst on one
+     * side doesn't stall the other.  This is just for speed, it works
+     * fine without it.
+     */
+    ioinfo_set_buffer(ioinfo1, LOCALPORT_BUFSIZE, 0);
+    ioinfo_set_buffer(ioinfo2, LOCALPORT_BUFSIZE, 0);
+
     *rioinfo1 = ioinfo1;
     *rioinfo2 = ioinfo2;
     pc->io1 = io;
@@ -194,7 +209,8 @@ portcon_setup(struct local_ports *p, struct gensio *io, char *id_str,
 }
 
 static void
-local_port_new_con(struct local_portinfo *pi, struct gensio *io)
+local_port_connect(struct local_portinfo *pi, struct gensio *io,
+		   const char *service, gensiods service_len)
 {
     struct local_ports *p = pi->p;
     struct gensio_os_funcs *o = p->o;
@@ -218,9 +234,9 @@ local_port_new_con(struct local_portinfo *pi, struct gensio *io)
     len = 1;
     gensio_control(pc->io2, 0, false, GENSIO_CONTROL_ENABLE_OOB, "1", &len);
 
-    len = strlen(pi->service_str);
+    len = service_len;
     err = gensio_control(pc->io2, 0, GENSIO_CONTROL_SET, GENSIO_CONTROL_SERVICE,
-			 pi->service_str, &len);
+			 (char *) service, &len);
     if (err) {
 	localport_pr(p, "Unable to set channel service for %s: %s\n",
 		     pi->id_str, gensio_err_to_str(err));
@@ -249,6 +265,150 @@ local_port_new_con(struct local_portinfo *pi, struct gensio *io)
 	o->free(o, pc);
 }
 
+/*
+ * A connection to a control port, the service for the channel is
+ * read from it first, see write_control_request().
+ */
+struct control_req {
+    struct local_portinfo *pi;
+    struct gensio *io;
+    unsigned char hdr[4];
+    gensiods hdr_len;
+    char *service;
+    gensiods service_len;
+    gensiods service_pos;
+};
+
+static void
+control_req_free(struct control_req *cr)
+{
+    struct gensio_os_funcs *o = cr->pi->p->o;
+
+    if (cr->service)
+	o->free(o, cr->service);
+    o->free(o, cr);
+}
+
+static int
+control_event(struct gensio *io, void *user_data, int event, int err,
+	      unsigned char *buf, gensiods *buflen,
+	      const char *const *auxdata)
+{
+    struct control_req *cr = user_data;
+    struct local_portinfo *pi = cr->pi;
+    struct gensio_os_funcs *o = pi->p->o;
+    gensiods count = 0, len;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    if (err) {
+	if (err != GE_REMCLOSE)
+	    localport_pr(pi->p, "Error reading control request on %s: %s\n",
+			 pi->id_str, gensio_err_to_str(err));
+	goto out_err;
+    }
+
+    if (cr->hdr_len < sizeof(cr->hdr)) {
+	count = sizeof(cr->hdr) - cr->hdr_len;
+	if (count > *buflen)
+	    count = *buflen;
+	memcpy(cr->hdr + cr->hdr_len, buf, count);
+	cr->hdr_len += count;
+	if (cr->hdr_len < sizeof(cr->hdr))
+	    return 0;
+
+	cr->service_len = gensio_buf_to_u32(cr->hdr);
+	if (cr->service_len == 0 || cr->service_len > CONTROL_MAX_SERVICE) {
+	    localport_pr(pi->p, "Invalid control request size on %s\n",
+			 pi->id_str);
+	    goto out_err;
+	}
+	cr->service = o->zalloc(o, cr->service_len + 1);
+	if (!cr->service) {
+	    localport_pr(pi->p, "Out of memory allocating service on %s\n",
+			 pi->id_str);
+	    goto out_err;
+	}
+    }
+
+    len = cr->service_len - cr->service_pos;
+    if (len > *buflen - count)
+	len = *buflen - count;
+    memcpy(cr->service + cr->service_pos, buf + count, len);
+    cr->service_pos += len;
+    *buflen = count + len;
+    if (cr->service_pos < cr->service_len)
+	return 0;
+
+    /* Anything after the request is for the channel, leave it. */
+    gensio_set_read_callback_enable(io, false);
+    local_port_connect(pi, io, cr->service, cr->service_len);
+    control_req_free(cr);
+    return 0;
+
+ out_err:
+    gensio_free(io);
+    control_req_free(cr);
+    return 0;
+}
+
+static void
+control_port_new_con(struct local_portinfo *pi, struct gensio *io)
+{
+    struct gensio_os_funcs *o = pi->p->o;
+    struct control_req *cr;
+
+    cr = o->zalloc(o, sizeof(*cr));
+    if (!cr) {
+	localport_pr(pi->p, "Out of memory allocating control request\n");
+	gensio_free(io);
+	return;
+    }
+    cr->pi = pi;
+    cr->io = io;
+    gensio_set_callback(io, control_event, cr);
+    gensio_set_read_callback_enable(io, true);
+}
+
+static void
+local_port_new_con(struct local_portinfo *pi, struct gensio *io)
+{
+    if (!pi->service_str)
+	control_port_new_con(pi, io);
+    else
+	local_port_connect(pi, io, pi->service_str,
+			   strlen(pi->service_str));
+}
+
+int
+write_control_request(struct gensio *io, const char *service,
+		      gensiods service_len, gensio_time *timeout)
+{
+    unsigned char *buf;
+    gensiods count, len = service_len + 4;
+    int err;
+
+    if (service_len == 0 || service_len > CONTROL_MAX_SERVICE)
+	return GE_INVAL;
+
+    buf = malloc(len);
+    if (!buf)
+	return GE_NOMEM;
+    gensio_u32_to_buf(buf, service_len);
+    memcpy(buf + 4, service, service_len);
+
+    err = gensio_set_sync(io);
+    if (!err) {
+	err = gensio_write_s(io, &count, buf, len, timeout);
+	if (!err && count != len)
+	    err = GE_TIMEDOUT;
+	gensio_clear_sync(io);
+    }
+    free(buf);
+    return err;
+}
+
 void
 remote_port_new_con(struct local_ports *p, struct gensio *io,
 		    const char *connecter_str, char *id_str)
@@ -385,8 +545,9 @@ add_local_port(struct local_ports *p,
 	goto out_err;
     }
 
-    pi->service_str = gensio_strdup(o, service_str);
-    if (!pi->service_str) {
+    if (service_str)
+	pi->service_str = gensio_strdup(o, service_str);
+    if (service_str && !pi->service_str) {
 	localport_pr(p, "Out of memory allocating connecter string: %s\n",
 		service_str);
 	goto out_err;
@@ -422,6 +583,13 @@ add_local_port(struct local_ports *p,
     return err;
 }
 
+int
+add_control_port(struct local_ports *p, const char *gensio_str,
+		 const char *id_str)
+{
+    return add_local_port(p, gensio_str, NULL, id_str);
+}
+
 void
 free_local_ports(struct local_ports *p)
 {
@@ -45,6 +45,25 @@ int add_local_port(struct local_ports *p,
 		   const char *gensio_str, const char *service_str,
 		   const char *id_str);
 
+/*
+ * Add a control port.  This is like a local port, but each
+ * connection to it says what service to open on the mux channel.
+ * The connection first sends the service length as a 4-byte big
+ * endian number, then the service, the same as would be passed to
+ * GENSIO_CONTROL_SERVICE.  After that it is connected to the new
+ * channel.  This lets other programs share the connection.
+ */
+int add_control_port(struct local_ports *p, const char *gensio_str,
+		     const char *id_str);
+
+/*
+ * Send the request on a connection to a control port, see
+ * add_control_port().  The gensio must be open, this uses sync mode
+ * to write the request and then turns it back off.
+ */
+int write_control_request(struct gensio *io, const char *service,
+			  gensiods service_len, gensio_time *timeout);
+
 void remote_port_new_con(struct local_ports *p, struct gensio *io,
 			 const char *connecter_str, char *id_str);
 
@@ -0,0 +1,1999 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+/*
+ * This library provides a gensio_os_funcs object for use by gensio.
+ * It can be used if you have a project based on libuv that you want
+ * to integrate gensio into.  The fd handlers are uv_poll handles,
+ * timers are uv_timer handles, and runners are run from a uv_async
+ * handle, all on the user's loop.
+ *
+ * libuv handles may only be touched from the thread that runs the
+ * loop, and that thread must be the one that allocates the os funcs.
+ * When something is done in the loop thread, the handle is updated
+ * directly.  Operations from other threads record what they want in
+ * the object and put the object on a queue, then wake the loop with
+ * uv_async_send().  The loop thread then makes the handle match what
+ * the object wants.  Each object is only on the queue once, and the
+ * queue is run in order, so things like the cleared handler and timer
+ * done handlers are reported after any earlier changes take effect.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <gensio/gensio_os_funcs.h>
+#include <gensio/gensio_uv.h>
+#include <gensio/gensio_err.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_osops.h>
+#include <gensio/gensio_osops_addrinfo.h>
+#include <gensio/gensio_osops_stdsock.h>
+#include <gensio/argvutils.h>
+
+#include <uv.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+/*
+ * Something to be done in the loop thread.  Each object embeds one
+ * of these and it is on the queue at most once.  The function makes
+ * the libuv handles match whatever the object's state is when it
+ * runs.
+ */
+struct uv_defer {
+    struct uv_defer *next;
+    bool queued;
+    void (*func)(struct uv_defer *df);
+};
+
+struct gensio_data
+{
+    struct gensio_memtrack *mtrack;
+    unsigned int refcount;
+    struct gensio_os_proc_data *pdata;
+
+    uv_loop_t *loop;
+    uv_thread_t loop_thread;
+
+    uv_mutex_t defer_lock;
+    struct uv_defer *defer_head;
+    struct uv_defer *defer_tail;
+    unsigned int defer_count;
+    uv_async_t async;
+
+    /* The rest is only touched in the loop thread. */
+
+    /* Number of waits/services running the loop from gensio. */
+    unsigned int loop_waiters;
+
+    /* Used to time out waits and service calls. */
+    uv_timer_t wait_timer;
+
+    /* Bumped whenever gensio handles something from the loop. */
+    unsigned long did_something;
+
+    /* Handles to close before the data can be freed. */
+    unsigned int nr_handles;
+    struct gensio_os_funcs *o;
+};
+
+static bool
+uv_in_loop(struct gensio_data *d)
+{
+    uv_thread_t self = uv_thread_self();
+
+    return uv_thread_equal(&self, &d->loop_thread);
+}
+
+/*
+ * The async handle is always active, so it is only referenced when
+ * there is something for it to do.  Otherwise it would keep the
+ * user's loop from ever finishing.  Only call from the loop thread.
+ */
+static void
+uv_async_update_ref(struct gensio_data *d)
+{
+    bool busy;
+
+    uv_mutex_lock(&d->defer_lock);
+    busy = d->defer_count || d->loop_waiters;
+    uv_mutex_unlock(&d->defer_lock);
+    if (busy)
+	uv_ref((uv_handle_t *) &d->async);
+    else
+	uv_unref((uv_handle_t *) &d->async);
+}
+
+static void
+uv_defer(struct gensio_data *d, struct uv_defer *df)
+{
+    uv_mutex_lock(&d->defer_lock);
+    if (!df->queued) {
+	df->queued = true;
+	df->next = NULL;
+	if (d->defer_tail)
+	    d->defer_tail->next = df;
+	else
+	    d->defer_head = df;
+	d->defer_tail = df;
+	d->defer_count++;
+    }
+    uv_mutex_unlock(&d->defer_lock);
+    if (uv_in_loop(d))
+	uv_ref((uv_handle_t *) &d->async);
+    uv_async_send(&d->async);
+}
+
+/* Pull df off the queue if it is there.  Only call in the loop thread. */
+static void
+uv_undefer(struct gensio_data *d, struct uv_defer *df)
+{
+    struct uv_defer **p, *prev = NULL;
+
+    uv_mutex_lock(&d->defer_lock);
+    if (df->queued) {
+	for (p = &d->defer_head; *p != df; p = &(*p)->next)
+	    prev = *p;
+	*p = df->next;
+	if (d->defer_tail == df)
+	    d->defer_tail = prev;
+	d->defer_count--;
+	df->queued = false;
+    }
+    uv_mutex_unlock(&d->defer_lock);
+}
+
+static void
+uv_async_handler(uv_async_t *a)
+{
+    struct gensio_data *d = a->data;
+    struct uv_defer *df;
+    unsigned int count;
+
+    /*
+     * Only run what is queued now.  Anything queued while running
+     * (like a runner that reruns itself) waits for the next time
+     * around the loop, so I/O and timers don't get starved.
+     */
+    uv_mutex_lock(&d->defer_lock);
+    count = d->defer_count;
+    while (count > 0 && d->defer_head) {
+	count--;
+	df = d->defer_head;
+	d->defer_head = df->next;
+	if (!d->defer_head)
+	    d->defer_tail = NULL;
+	d->defer_count--;
+	df->queued = false;
+	uv_mutex_unlock(&d->defer_lock);
+	d->did_something++;
+	df->func(df);
+	uv_mutex_lock(&d->defer_lock);
+    }
+    uv_mutex_unlock(&d->defer_lock);
+    uv_async_update_ref(d);
+}
+
+static void *
+gensio_uv_zalloc(struct gensio_os_funcs *f, gensiods size)
+{
+    struct gensio_data *d = f->user_data;
+
+    return gensio_i_zalloc(d->mtrack, size);
+}
+
+static void
+gensio_uv_free(struct gensio_os_funcs *f, void *data)
+{
+    struct gensio_data *d = f->user_data;
+
+    gensio_i_free(d->mtrack, data);
+}
+
+struct gensio_lock {
+    struct gensio_os_funcs *f;
+    uv_mutex_t mutex;
+};
+
+static struct gensio_lock *
+gensio_uv_alloc_lock(struct gensio_os_funcs *f)
+{
+    struct gensio_lock *lock;
+
+    lock = gensio_uv_zalloc(f, sizeof(*lock));
+    if (!lock)
+	return NULL;
+    lock->f = f;
+    if (uv_mutex_init(&lock->mutex)) {
+	gensio_uv_free(f, lock);
+	return NULL;
+    }
+
+    return lock;
+}
+
+static void
+gensio_uv_free_lock(struct gensio_lock *lock)
+{
+    uv_mutex_destroy(&lock->mutex);
+    gensio_uv_free(lock->f, lock);
+}
+
+static void
+gensio_uv_lock(struct gensio_lock *lock)
+{
+    uv_mutex_lock(&lock->mutex);
+}
+
+static void
+gensio_uv_unlock(struct gensio_lock *lock)
+{
+    uv_mutex_unlock(&lock->mutex);
+}
+
+struct gensio_iod_uv {
+    struct gensio_iod r;
+
+    uv_mutex_t lock;
+
+    struct uv_defer defer;
+
+    /* The poll handle is only touched in the loop thread. */
+    uv_poll_t poll;
+    bool poll_init;
+
+    int mask; /* The events we want. */
+    int set_mask; /* The events the poll handle has. */
+
+    bool in_clear;
+
+    /* Released from another thread, finish it in the loop thread. */
+    bool released;
+    bool close_fd;
+
+    int orig_fd;
+    int fd;
+    enum gensio_iod_type type;
+    void *sockinfo;
+    bool handlers_set;
+    bool is_stdio;
+    void *cb_data;
+    void (*read_handler)(struct gensio_iod *iod, void *cb_data);
+    void (*write_handler)(struct gensio_iod *iod, void *cb_data);
+    void (*except_handler)(struct gensio_iod *iod, void *cb_data);
+    void (*cleared_handler)(struct gensio_iod *iod, void *cb_data);
+
+    struct stdio_mode *mode;
+
+    struct gensio_unix_termios *termios;
+
+    /* For GENSIO_IOD_FILE */
+    struct gensio_runner *runner;
+    bool read_enabled;
+    bool write_enabled;
+    bool in_handler;
+
+    /* For GENSIO_IOD_PTY */
+    const char **argv;
+    const char **env;
+    char *start_dir;
+    int pid;
+};
+
+#define i_to_uv(i) gensio_container_of(i, struct gensio_iod_uv, r);
+
+static void uv_iod_sync_locked(struct gensio_iod_uv *iod);
+
+static void
+uv_poll_handler(uv_poll_t *h, int status, int events)
+{
+    struct gensio_iod_uv *iod = h->data;
+    struct gensio_data *d = iod->r.f->user_data;
+
+    d->did_something++;
+
+    uv_mutex_lock(&iod->lock);
+    if (status < 0) {
+	/*
+	 * libuv has stopped the handle.  Report everything wanted, the
+	 * I/O calls in the handlers will return the error.
+	 */
+	iod->set_mask = 0;
+	events = iod->mask;
+    }
+    /* The mask may have changed but not been set in the handle yet. */
+    events &= iod->mask;
+    uv_mutex_unlock(&iod->lock);
+
+    if (events & UV_READABLE)
+	iod->read_handler(&iod->r, iod->cb_data);
+    if (events & UV_WRITABLE)
+	iod->write_handler(&iod->r, iod->cb_data);
+    if (events & UV_PRIORITIZED)
+	iod->except_handler(&iod->r, iod->cb_data);
+
+    if (status < 0) {
+	uv_mutex_lock(&iod->lock);
+	uv_iod_sync_locked(iod);
+	uv_mutex_unlock(&iod->lock);
+    }
+}
+
+/*
+ * Make the poll handle match the mask.  Must be run in the loop
+ * thread with the iod lock held.
+ */
+static void
+uv_iod_sync_locked(struct gensio_iod_uv *iod)
+{
+    struct gensio_os_funcs *o = iod->r.f;
+    struct gensio_data *d = o->user_data;
+    int rv;
+
+    if (iod->mask == iod->set_mask)
+	return;
+
+    if (!iod->poll_init) {
+	rv = uv_poll_init(d->loop, &iod->poll, iod->fd);
+	if (rv) {
+	    gensio_log(o, GENSIO_LOG_ERR,
+		       "gensio_uv: Unable to poll fd %d: %s", iod->fd,
+		       gensio_err_to_str(gensio_os_err_to_err(o, -rv)));
+	    return;
+	}
+	iod->poll.data = iod;
+	iod->poll_init = true;
+    }
+
+    if (iod->mask)
+	uv_poll_start(&iod->poll, iod->mask, uv_poll_handler);
+    else
+	uv_poll_stop(&iod->poll);
+    iod->set_mask = iod->mask;
+}
+
+/* Set the mask and make the handle match it.  Call with the iod lock held. */
+static void
+uv_iod_set_mask(struct gensio_iod_uv *iod, int new_mask)
+{
+    struct gensio_data *d = iod->r.f->user_data;
+
+    if (new_mask == iod->mask)
+	return;
+    iod->mask = new_mask;
+    if (uv_in_loop(d))
+	uv_iod_sync_locked(iod);
+    else
+	uv_defer(d, &iod->defer);
+}
+
+static int uv_iod_release(struct gensio_iod_uv *iod, bool close_fd);
+
+static void
+uv_iod_deferred(struct uv_defer *df)
+{
+    struct gensio_iod_uv *iod = gensio_container_of(df, struct gensio_iod_uv,
+						    defer);
+    bool report_cleared = false;
+
+    uv_mutex_lock(&iod->lock);
+    if (iod->released) {
+	uv_mutex_unlock(&iod->lock);
+	uv_iod_release(iod, iod->close_fd);
+	return;
+    }
+    uv_iod_sync_locked(iod);
+    if (iod->in_clear) {
+	iod->handlers_set = false;
+	iod->read_handler = NULL;
+	iod->write_handler = NULL;
+	iod->except_handler = NULL;
+	iod->in_clear = false;
+	report_cleared = true;
+    }
+    uv_mutex_unlock(&iod->lock);
+
+    if (report_cleared && iod->cleared_handler)
+	iod->cleared_handler(&iod->r, iod->cb_data);
+}
+
+static int
+gensio_uv_set_fd_handlers(struct gensio_iod *iiod,
+			  void *cb_data,
+			  void (*read_handler)(struct gensio_iod *iod,
+					       void *cb_data),
+			  void (*write_handler)(struct gensio_iod *iod,
+						void *cb_data),
+			  void (*except_handler)(struct gensio_iod *iod,
+						 void *cb_data),
+			  void (*cleared_handler)(struct gensio_iod *iod,
+						  void *cb_data))
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    uv_mutex_lock(&iod->lock);
+    if (iod->handlers_set) {
+	uv_mutex_unlock(&iod->lock);
+	return GE_INUSE;
+    }
+
+    iod->handlers_set = true;
+
+    iod->cb_data = cb_data;
+    iod->read_handler = read_handler;
+    iod->write_handler = write_handler;
+    iod->except_handler = except_handler;
+    iod->cleared_handler = cleared_handler;
+
+    uv_mutex_unlock(&iod->lock);
+
+    return 0;
+}
+
+static void
+gensio_uv_clear_fd_handlers(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+    struct gensio_data *d = iiod->f->user_data;
+
+    uv_mutex_lock(&iod->lock);
+    if (!iod->handlers_set || iod->in_clear)
+	goto out_unlock;
+    iod->in_clear = true;
+    if (iod->type == GENSIO_IOD_FILE) {
+	iod->read_enabled = false;
+	iod->write_enabled = false;
+	/* If the runner is pending it reports the clear. */
+	if (iod->in_handler)
+	    goto out_unlock;
+    } else {
+	uv_iod_set_mask(iod, 0);
+    }
+    /* The cleared handler is reported from the loop after the mask change. */
+    uv_defer(d, &iod->defer);
+ out_unlock:
+    uv_mutex_unlock(&iod->lock);
+}
+
+static void
+gensio_uv_clear_fd_handlers_norpt(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    uv_mutex_lock(&iod->lock);
+    assert(iod->mask == 0);
+    iod->handlers_set = false;
+    uv_mutex_unlock(&iod->lock);
+}
+
+static void
+file_runner(struct gensio_runner *r, void *cb_data)
+{
+    struct gensio_iod_uv *iod = cb_data;
+
+    uv_mutex_lock(&iod->lock);
+    while (iod->read_enabled || iod->write_enabled) {
+	if (iod->read_enabled) {
+	    uv_mutex_unlock(&iod->lock);
+	    iod->read_handler(&iod->r, iod->cb_data);
+	    uv_mutex_lock(&iod->lock);
+	}
+	if (iod->write_enabled) {
+	    uv_mutex_unlock(&iod->lock);
+	    iod->write_handler(&iod->r, iod->cb_data);
+	    uv_mutex_lock(&iod->lock);
+	}
+    }
+    iod->in_handler = false;
+    if (iod->in_clear) {
+	iod->in_clear = false;
+	iod->handlers_set = false;
+	uv_mutex_unlock(&iod->lock);
+	iod->cleared_handler(&iod->r, iod->cb_data);
+	uv_mutex_lock(&iod->lock);
+    }
+    uv_mutex_unlock(&iod->lock);
+}
+
+static void
+gensio_uv_set_handler(struct gensio_iod *iiod, bool enable, int event,
+		      bool *file_enabled)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+    int new_mask;
+
+    uv_mutex_lock(&iod->lock);
+    if (iod->type == GENSIO_IOD_FILE) {
+	if (!file_enabled || *file_enabled == enable || iod->in_clear)
+	    goto out_unlock;
+	*file_enabled = enable;
+	if (enable && !iod->in_handler) {
+	    iod->r.f->run(iod->runner);
+	    iod->in_handler = true;
+	}
+	goto out_unlock;
+    }
+
+    new_mask = iod->mask;
+    if (enable)
+	new_mask |= event;
+    else
+	new_mask &= ~event;
+    uv_iod_set_mask(iod, new_mask);
+ out_unlock:
+    uv_mutex_unlock(&iod->lock);
+}
+
+static void
+gensio_uv_set_read_handler(struct gensio_iod *iiod, bool enable)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    gensio_uv_set_handler(iiod, enable, UV_READABLE, &iod->read_enabled);
+}
+
+static void
+gensio_uv_set_write_handler(struct gensio_iod *iiod, bool enable)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    gensio_uv_set_handler(iiod, enable, UV_WRITABLE, &iod->write_enabled);
+}
+
+static void
+gensio_uv_set_except_handler(struct gensio_iod *iiod, bool enable)
+{
+    gensio_uv_set_handler(iiod, enable, UV_PRIORITIZED, NULL);
+}
+
+struct gensio_timer
+{
+    struct gensio_os_funcs *o;
+
+    void (*handler)(struct gensio_timer *t, void *cb_data);
+    void *cb_data;
+
+    uv_mutex_t lock;
+
+    struct uv_defer defer;
+
+    /* The timer handle is only touched in the loop thread. */
+    uv_timer_t timer;
+    bool timer_init;
+
+    int64_t end; /* When it times out, in microseconds. */
+
+    enum {
+	  UV_TIMER_FREE,
+	  UV_TIMER_IN_STOP,
+	  UV_TIMER_STOPPED,
+	  UV_TIMER_RUNNING
+    } state;
+
+    void (*done_handler)(struct gensio_timer *t, void *cb_data);
+    void *done_cb_data;
+};
+
+/*
+ * Various time conversion routines.  Note that we always truncate up
+ * to the next time unit.  These are used for timers, and if you don't
+ * you can end up with an early timeout.
+ */
+static int64_t
+gensio_time_to_us(gensio_time *t)
+{
+    return t->secs * 1000000ULL + (t->nsecs + 999) / 1000;
+}
+
+static uint64_t
+us_time_to_ms(int64_t t)
+{
+    return (t + 999) / 1000;
+}
+
+static void
+us_time_to_gensio(int64_t t, gensio_time *gt)
+{
+    gt->secs = t / 1000000;
+    gt->nsecs = t % 1000000 * 1000;
+}
+
+static int64_t
+fetch_us_time(void)
+{
+    return uv_hrtime() / 1000;
+}
+
+static void gensio_uv_timeout_handler(uv_timer_t *h);
+
+/*
+ * Make the timer handle match the timer state.  Must be run in the
+ * loop thread with the timer lock held.
+ */
+static void
+gensio_uv_timer_sync_locked(struct gensio_timer *t)
+{
+    struct gensio_data *d = t->o->user_data;
+    int64_t now;
+
+    if (t->state != UV_TIMER_RUNNING) {
+	if (t->timer_init)
+	    uv_timer_stop(&t->timer);
+	return;
+    }
+
+    if (!t->timer_init) {
+	uv_timer_init(d->loop, &t->timer);
+	t->timer.data = t;
+	t->timer_init = true;
+    }
+    /*
+     * libuv times from the start of the loop iteration, so this may
+     * go off early.  The timeout handler checks for that.
+     */
+    now = fetch_us_time();
+    uv_timer_start(&t->timer, gensio_uv_timeout_handler,
+		   now < t->end ? us_time_to_ms(t->end - now) : 0, 0);
+}
+
+/* Call with the timer lock held. */
+static void
+gensio_uv_timer_update(struct gensio_timer *t)
+{
+    struct gensio_data *d = t->o->user_data;
+
+    if (uv_in_loop(d))
+	gensio_uv_timer_sync_locked(t);
+    else
+	uv_defer(d, &t->defer);
+}
+
+static void
+gensio_uv_timeout_handler(uv_timer_t *h)
+{
+    struct gensio_timer *t = h->data;
+    struct gensio_data *d = t->o->user_data;
+    void (*handler)(struct gensio_timer *t, void *cb_data) = NULL;
+    void *cb_data;
+
+    d->did_something++;
+
+    uv_mutex_lock(&t->lock);
+    if (t->state == UV_TIMER_RUNNING) {
+	if (fetch_us_time() < t->end) {
+	    /* Not time yet. */
+	    gensio_uv_timer_sync_locked(t);
+	} else {
+	    handler = t->handler;
+	    cb_data = t->cb_data;
+	    t->state = UV_TIMER_STOPPED;
+	}
+    }
+    uv_mutex_unlock(&t->lock);
+
+    if (handler)
+	handler(t, cb_data);
+}
+
+static void gensio_uv_timer_deferred(struct uv_defer *df);
+
+static struct gensio_timer *
+gensio_uv_alloc_timer(struct gensio_os_funcs *o,
+		      void (*handler)(struct gensio_timer *t,
+				      void *cb_data),
+		      void *cb_data)
+{
+    struct gensio_timer *t;
+
+    t = o->zalloc(o, sizeof(*t));
+    if (!t)
+	return NULL;
+
+    if (uv_mutex_init(&t->lock)) {
+	o->free(o, t);
+	return NULL;
+    }
+    t->o = o;
+    t->handler = handler;
+    t->cb_data = cb_data;
+    t->state = UV_TIMER_STOPPED;
+    t->defer.func = gensio_uv_timer_deferred;
+
+    return t;
+}
+
+static void
+gensio_uv_timer_closed(uv_handle_t *h)
+{
+    struct gensio_timer *t = h->data;
+
+    uv_mutex_destroy(&t->lock);
+    t->o->free(t->o, t);
+}
+
+/* Must be run in the loop thread with nothing queued for the timer. */
+static void
+gensio_uv_timer_finish_free(struct gensio_timer *t)
+{
+    if (t->timer_init) {
+	uv_close((uv_handle_t *) &t->timer, gensio_uv_timer_closed);
+    } else {
+	uv_mutex_destroy(&t->lock);
+	t->o->free(t->o, t);
+    }
+}
+
+static void
+gensio_uv_free_timer(struct gensio_timer *t)
+{
+    struct gensio_data *d = t->o->user_data;
+    bool in_stop;
+
+    uv_mutex_lock(&t->lock);
+    assert(t->state != UV_TIMER_FREE);
+    in_stop = t->state == UV_TIMER_IN_STOP;
+    t->state = UV_TIMER_FREE;
+    uv_mutex_unlock(&t->lock);
+
+    /* If a stop is in progress, that will finish the free. */
+    if (in_stop)
+	return;
+    if (uv_in_loop(d)) {
+	uv_undefer(d, &t->defer);
+	gensio_uv_timer_finish_free(t);
+    } else {
+	uv_defer(d, &t->defer);
+    }
+}
+
+static int
+gensio_uv_start_timer_us(struct gensio_timer *t, int64_t us)
+{
+    int rv = 0;
+
+    uv_mutex_lock(&t->lock);
+    assert(t->state != UV_TIMER_FREE);
+    if (t->state != UV_TIMER_STOPPED) {
+	rv = GE_INUSE;
+    } else {
+	t->done_handler = NULL;
+	t->end = fetch_us_time() + us;
+	t->state = UV_TIMER_RUNNING;
+	gensio_uv_timer_update(t);
+    }
+    uv_mutex_unlock(&t->lock);
+
+    return rv;
+}
+
+static int
+gensio_uv_start_timer(struct gensio_timer *t, gensio_time *timeout)
+{
+    return gensio_uv_start_timer_us(t, gensio_time_to_us(timeout));
+}
+
+static int
+gensio_uv_start_timer_abs(struct gensio_timer *t, gensio_time *timeout)
+{
+    int64_t tnsecs, nnsecs;
+
+    tnsecs = timeout->secs * 1000000000ULL + timeout->nsecs;
+    nnsecs = uv_hrtime();
+    if (tnsecs < nnsecs)
+	tnsecs = 0;
+    else
+	tnsecs -= nnsecs;
+
+    return gensio_uv_start_timer_us(t, (tnsecs + 999ULL) / 1000);
+}
+
+static int
+gensio_uv_stop_timer(struct gensio_timer *t)
+{
+    int rv = 0;
+
+    uv_mutex_lock(&t->lock);
+    assert(t->state != UV_TIMER_FREE);
+    if (t->state != UV_TIMER_RUNNING) {
+	rv = GE_TIMEDOUT;
+    } else {
+	t->state = UV_TIMER_STOPPED;
+	gensio_uv_timer_update(t);
+    }
+    uv_mutex_unlock(&t->lock);
+    return rv;
+}
+
+static void
+gensio_uv_timer_deferred(struct uv_defer *df)
+{
+    struct gensio_timer *t = gensio_container_of(df, struct gensio_timer,
+						 defer);
+    void (*done_handler)(struct gensio_timer *t, void *cb_data) = NULL;
+    void *done_cb_data;
+
+    uv_mutex_lock(&t->lock);
+    if (t->state == UV_TIMER_FREE) {
+	uv_mutex_unlock(&t->lock);
+	gensio_uv_timer_finish_free(t);
+	return;
+    }
+    gensio_uv_timer_sync_locked(t);
+    if (t->state == UV_TIMER_IN_STOP) {
+	t->state = UV_TIMER_STOPPED;
+	done_handler = t->done_handler;
+	done_cb_data = t->done_cb_data;
+	t->done_handler = NULL;
+    }
+    uv_mutex_unlock(&t->lock);
+
+    if (done_handler)
+	done_handler(t, done_cb_data);
+}
+
+static int
+gensio_uv_stop_timer_with_done(struct gensio_timer *t,
+			       void (*done_handler)(struct gensio_timer *t,
+						    void *cb_data),
+			       void *cb_data)
+{
+    struct gensio_data *d = t->o->user_data;
+    int rv = 0;
+
+    uv_mutex_lock(&t->lock);
+    if (t->state == UV_TIMER_IN_STOP) {
+	rv = GE_INUSE;
+    } else if (t->state != UV_TIMER_RUNNING) {
+	rv = GE_TIMEDOUT;
+    } else {
+	t->state = UV_TIMER_IN_STOP;
+	t->done_handler = done_handler;
+	t->done_cb_data = cb_data;
+	gensio_uv_timer_update(t);
+	/* The done handler is always reported from the loop. */
+	uv_defer(d, &t->defer);
+    }
+    uv_mutex_unlock(&t->lock);
+
+    return rv;
+}
+
+struct gensio_runner
+{
+    struct gensio_os_funcs *o;
+
+    void (*handler)(struct gensio_runner *r, void *cb_data);
+    void *cb_data;
+    bool freed;
+    bool in_use;
+
+    struct uv_defer defer;
+
+    uv_mutex_t lock;
+};
+
+static void
+gensio_uv_runner_deferred(struct uv_defer *df)
+{
+    struct gensio_runner *r = gensio_container_of(df, struct gensio_runner,
+						  defer);
+    void (*handler)(struct gensio_runner *r, void *cb_data) = NULL;
+    void *cb_data;
+
+    uv_mutex_lock(&r->lock);
+    if (r->freed) {
+	uv_mutex_unlock(&r->lock);
+	uv_mutex_destroy(&r->lock);
+	r->o->free(r->o, r);
+    } else {
+	handler = r->handler;
+	cb_data = r->cb_data;
+	r->in_use = false;
+	uv_mutex_unlock(&r->lock);
+    }
+
+    if (handler)
+	handler(r, cb_data);
+}
+
+static struct gensio_runner *
+gensio_uv_alloc_runner(struct gensio_os_funcs *o,
+		       void (*handler)(struct gensio_runner *r,
+				       void *cb_data),
+		       void *cb_data)
+{
+    struct gensio_runner *r;
+
+    r = o->zalloc(o, sizeof(*r));
+    if (!r)
+	return NULL;
+
+    if (uv_mutex_init(&r->lock)) {
+	o->free(o, r);
+	return NULL;
+    }
+    r->o = o;
+    r->handler = handler;
+    r->cb_data = cb_data;
+    r->defer.func = gensio_uv_runner_deferred;
+
+    return r;
+}
+
+static void
+gensio_uv_free_runner(struct gensio_runner *r)
+{
+    uv_mutex_lock(&r->lock);
+    if (r->in_use) {
+	r->freed = true;
+	uv_mutex_unlock(&r->lock);
+    } else {
+	uv_mutex_unlock(&r->lock);
+	uv_mutex_destroy(&r->lock);
+	r->o->free(r->o, r);
+    }
+}
+
+static int
+gensio_uv_run(struct gensio_runner *r)
+{
+    int rv = 0;
+
+    uv_mutex_lock(&r->lock);
+    if (r->in_use) {
+	rv = GE_INUSE;
+    } else {
+	r->in_use = true;
+	uv_defer(r->o->user_data, &r->defer);
+    }
+    uv_mutex_unlock(&r->lock);
+    return rv;
+}
+
+struct gensio_waiter
+{
+    struct gensio_os_funcs *o;
+
+    unsigned int count;
+
+    /* Set if the loop thread is running the loop waiting on this. */
+    unsigned int loop_waiting;
+
+    uv_mutex_t lock;
+    uv_cond_t cond;
+};
+
+static struct gensio_waiter *
+gensio_uv_alloc_waiter(struct gensio_os_funcs *o)
+{
+    struct gensio_waiter *w;
+
+    w = o->zalloc(o, sizeof(*w));
+    if (!w)
+	return NULL;
+
+    if (uv_mutex_init(&w->lock)) {
+	o->free(o, w);
+	return NULL;
+    }
+    if (uv_cond_init(&w->cond)) {
+	uv_mutex_destroy(&w->lock);
+	o->free(o, w);
+	return NULL;
+    }
+    w->o = o;
+
+    return w;
+}
+
+static void
+gensio_uv_free_waiter(struct gensio_waiter *w)
+{
+    uv_cond_destroy(&w->cond);
+    uv_mutex_destroy(&w->lock);
+    w->o->free(w->o, w);
+}
+
+struct timeout_info {
+    gensio_time *timeout;
+
+    /* Times below are in microseconds. */
+    int64_t start;
+    int64_t now;
+    int64_t end;
+};
+
+static void
+setup_timeout(struct timeout_info *t)
+{
+    if (t->timeout) {
+	t->start = t->now = fetch_us_time();
+	t->end = t->now + gensio_time_to_us(t->timeout);
+    } else {
+	t->start = 0;
+	t->now = 0;
+	t->end = 0;
+    }
+}
+
+static bool
+timed_out(struct timeout_info *t)
+{
+    return t->timeout && t->now >= t->end;
+}
+
+static void
+wait_timeout_handler(uv_timer_t *h)
+{
+    /* Nothing to do, this just makes uv_run() return. */
+}
+
+/*
+ * Run the loop once, for no longer than the timeout.  Only call in
+ * the loop thread, and not from a loop callback, uv_run() is not
+ * reentrant.
+ */
+static void
+timeout_wait(struct gensio_data *d, struct timeout_info *t)
+{
+    uint64_t timeout;
+
+    d->loop_waiters++;
+    uv_async_update_ref(d);
+    if (t->timeout) {
+	timeout = us_time_to_ms(t->end - t->now);
+	if (timeout) {
+	    uv_timer_start(&d->wait_timer, wait_timeout_handler, timeout, 0);
+	    uv_run(d->loop, UV_RUN_ONCE);
+	    uv_timer_stop(&d->wait_timer);
+	} else {
+	    uv_run(d->loop, UV_RUN_NOWAIT);
+	}
+    } else {
+	uv_run(d->loop, UV_RUN_ONCE);
+    }
+    d->loop_waiters--;
+    uv_async_update_ref(d);
+}
+
+static void
+timeout_end(struct timeout_info *t)
+{
+    if (t->timeout) {
+	int64_t diff = t->end - t->now;
+
+	if (diff > 0) {
+	    us_time_to_gensio(diff, t->timeout);
+	} else {
+	    t->timeout->secs = 0;
+	    t->timeout->nsecs = 0;
+	}
+    }
+}
+
+static int
+gensio_uv_wait_intr_sigmask(struct gensio_waiter *w, unsigned int count,
+			    gensio_time *timeout,
+			    struct gensio_os_proc_data *proc_data)
+{
+    struct gensio_data *d = w->o->user_data;
+    struct timeout_info ti = { .timeout = timeout };
+    bool in_loop = uv_in_loop(d);
+    int rv = 0;
+    sigset_t origmask;
+
+    if (proc_data) {
+	pthread_sigmask(SIG_SETMASK,
+			gensio_os_proc_unix_get_wait_sigset(proc_data),
+			&origmask);
+    }
+    setup_timeout(&ti);
+
+    uv_mutex_lock(&w->lock);
+    if (in_loop) {
+	/* Wakeups come from handlers run in this thread by the loop. */
+	w->loop_waiting++;
+	while (count > w->count && !timed_out(&ti)) {
+	    uv_mutex_unlock(&w->lock);
+	    timeout_wait(d, &ti);
+	    uv_mutex_lock(&w->lock);
+	    ti.now = fetch_us_time();
+	}
+	w->loop_waiting--;
+    } else {
+	while (count > w->count && !timed_out(&ti)) {
+	    if (ti.timeout)
+		uv_cond_timedwait(&w->cond, &w->lock,
+				  (ti.end - ti.now) * 1000);
+	    else
+		uv_cond_wait(&w->cond, &w->lock);
+	    ti.now = fetch_us_time();
+	}
+    }
+    if (count > w->count)
+	rv = GE_TIMEDOUT;
+    else
+	w->count -= count;
+    uv_mutex_unlock(&w->lock);
+
+    timeout_end(&ti);
+
+    if (proc_data) {
+	pthread_sigmask(SIG_SETMASK, &origmask, NULL);
+	gensio_os_proc_check_handlers(proc_data);
+    }
+
+    return rv;
+}
+
+static int
+gensio_uv_wait(struct gensio_waiter *w, unsigned int count,
+	       gensio_time *timeout)
+{
+    struct gensio_data *d = w->o->user_data;
+    int rv = GE_INTERRUPTED;
+
+    while (rv == GE_INTERRUPTED)
+	rv = gensio_uv_wait_intr_sigmask(w, count, timeout, d->pdata);
+
+    return rv;
+}
+
+static int
+gensio_uv_wait_intr(struct gensio_waiter *w, unsigned int count,
+		    gensio_time *timeout)
+{
+    struct gensio_data *d = w->o->user_data;
+
+    return gensio_uv_wait_intr_sigmask(w, count, timeout, d->pdata);
+}
+
+static void
+gensio_uv_wake(struct gensio_waiter *w)
+{
+    struct gensio_data *d = w->o->user_data;
+    bool kick_loop;
+
+    uv_mutex_lock(&w->lock);
+    w->count += 1;
+    uv_cond_broadcast(&w->cond);
+    kick_loop = w->loop_waiting > 0;
+    uv_mutex_unlock(&w->lock);
+
+    /* Make the loop thread's uv_run() return so it sees the wake. */
+    if (kick_loop && !uv_in_loop(d))
+	uv_async_send(&d->async);
+}
+
+static int
+gensio_uv_add_iod(struct gensio_os_funcs *o, enum gensio_iod_type type,
+		  intptr_t ofd, struct gensio_iod **riod)
+{
+    struct gensio_iod_uv *iod = NULL;
+    bool closefd = false;
+    int err = GE_NOMEM, fd = ofd;
+
+    if (type == GENSIO_IOD_CONSOLE) {
+       if (fd == 0)
+           fd = open("/dev/tty", O_RDONLY);
+       else if (fd == 1)
+           fd = open("/dev/tty", O_WRONLY);
+       else
+           return GE_INVAL;
+       if (fd == -1)
+           return gensio_os_err_to_err(o, errno);
+       closefd = true;
+    } else if (type == GENSIO_IOD_PTY) {
+	err = gensio_unix_pty_alloc(o, &fd);
+	if (err)
+	    return err;
+	closefd = true;
+    }
+
+    iod = o->zalloc(o, sizeof(*iod));
+    if (!iod) {
+	err = GE_NOMEM;
+	goto out_err;
+    }
+    if (uv_mutex_init(&iod->lock)) {
+	o->free(o, iod);
+	iod = NULL;
+	err = GE_NOMEM;
+	goto out_err;
+    }
+
+    iod->r.f = o;
+    iod->fd = fd;
+    iod->orig_fd = ofd;
+    iod->defer.func = uv_iod_deferred;
+    if (type == GENSIO_IOD_STDIO) {
+	struct stat statb;
+
+	iod->is_stdio = true;
+
+	err = fstat(fd, &statb);
+	if (err == -1) {
+	    err = gensio_os_err_to_err(o, errno);
+	    goto out_err;
+	}
+	switch (statb.st_mode & S_IFMT) {
+	case S_IFREG: type = GENSIO_IOD_FILE; break;
+	case S_IFCHR: type = GENSIO_IOD_DEV; break;
+	case S_IFIFO: type = GENSIO_IOD_PIPE; break;
+	case S_IFSOCK: type = GENSIO_IOD_SOCKET; break;
+	default:
+	    err = GE_INVAL;
+	    goto out_err;
+	}
+    } else if (type == GENSIO_IOD_PTY) {
+	iod->pid = -1;
+    }
+    iod->type = type;
+
+    if (type == GENSIO_IOD_FILE) {
+	iod->runner = o->alloc_runner(o, file_runner, iod);
+	if (!iod->runner) {
+	    err = GE_NOMEM;
+	    goto out_err;
+	}
+    }
+
+    *riod = &iod->r;
+
+    return 0;
+ out_err:
+    if (iod) {
+	uv_mutex_destroy(&iod->lock);
+	o->free(o, iod);
+    }
+    if (closefd)
+	close(fd);
+    return err;
+}
+
+static void
+uv_iod_free(struct gensio_iod_uv *iod)
+{
+    struct gensio_os_funcs *o = iod->r.f;
+
+    uv_mutex_destroy(&iod->lock);
+    if (iod->type == GENSIO_IOD_FILE)
+	o->free_runner(iod->runner);
+    if (iod->type == GENSIO_IOD_PTY) {
+	if (iod->argv)
+	    gensio_argv_free(o, iod->argv);
+	if (iod->env)
+	    gensio_argv_free(o, iod->env);
+	if (iod->start_dir)
+	    o->free(o, iod->start_dir);
+    }
+    o->free(o, iod);
+}
+
+static void
+uv_iod_poll_closed(uv_handle_t *h)
+{
+    uv_iod_free(h->data);
+}
+
+static int
+uv_iod_close_fd(struct gensio_iod_uv *iod)
+{
+    struct gensio_os_funcs *o = iod->r.f;
+    int err = 0;
+
+    if (iod->type == GENSIO_IOD_SOCKET) {
+	err = o->close_socket(&iod->r, false, false);
+    } else if (!iod->is_stdio) {
+	if (iod->fd != -1) {
+	    err = close(iod->fd);
+	    if (err == -1)
+		err = gensio_os_err_to_err(o, errno);
+#ifdef ENABLE_INTERNAL_TRACE
+	/* Close should never fail, but don't crash in production builds. */
+	    assert(err == 0);
+#endif
+	}
+    }
+    return err;
+}
+
+/*
+ * Free the iod, closing the fd first if close_fd is set.  The poll
+ * handle has to be closed before the fd is, and that can only be
+ * done in the loop thread, so from other threads this is passed to
+ * the loop and the fd close error is lost.  That shouldn't fail,
+ * anyway.
+ */
+static int
+uv_iod_release(struct gensio_iod_uv *iod, bool close_fd)
+{
+    struct gensio_data *d = iod->r.f->user_data;
+    bool poll_closing = false;
+    int err = 0;
+
+    if (!uv_in_loop(d)) {
+	uv_mutex_lock(&iod->lock);
+	iod->released = true;
+	iod->close_fd = close_fd;
+	uv_mutex_unlock(&iod->lock);
+	uv_defer(d, &iod->defer);
+	return 0;
+    }
+
+    uv_undefer(d, &iod->defer);
+    if (iod->poll_init) {
+	/* This stops polling now, the memory is released later. */
+	uv_close((uv_handle_t *) &iod->poll, uv_iod_poll_closed);
+	iod->poll_init = false;
+	poll_closing = true;
+    }
+    if (close_fd)
+	err = uv_iod_close_fd(iod);
+    if (!poll_closing)
+	uv_iod_free(iod);
+
+    return err;
+}
+
+static void
+gensio_uv_release_iod(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    assert(!iod->handlers_set);
+    uv_iod_release(iod, false);
+}
+
+static int
+gensio_uv_iod_get_type(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    return iod->type;
+}
+
+static int
+gensio_uv_iod_get_fd(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    return iod->fd;
+}
+
+static int
+gensio_uv_pty_control(struct gensio_iod_uv *iod, int op, bool get,
+		      intptr_t val)
+{
+    struct gensio_os_funcs *o = iod->r.f;
+    int err = 0;
+    const char **nargv;
+
+    if (get) {
+	if (op == GENSIO_IOD_CONTROL_PID) {
+	    if (iod->pid == -1)
+		return GE_NOTREADY;
+	    *((intptr_t *) val) = iod->pid;
+	    return 0;
+	}
+	return GE_NOTSUP;
+    }
+
+    switch (op) {
+    case GENSIO_IOD_CONTROL_ARGV:
+	err = gensio_argv_copy(o, (const char **) val, NULL, &nargv);
+	if (err)
+	    return err;
+	if (iod->argv)
+	    gensio_argv_free(o, iod->argv);
+	iod->argv = nargv;
+	return 0;
+
+    case GENSIO_IOD_CONTROL_ENV:
+	err = gensio_argv_copy(o, (const char **) val, NULL, &nargv);
+	if (err)
+	    return err;
+	if (iod->env)
+	    gensio_argv_free(o, iod->env);
+	iod->env = nargv;
+	return 0;
+
+    case GENSIO_IOD_CONTROL_START:
+	return gensio_unix_pty_start(o, iod->fd, iod->argv,
+				     iod->env, iod->start_dir, &iod->pid);
+
+    case GENSIO_IOD_CONTROL_STOP:
+	if (iod->fd != -1) {
+	    close(iod->fd);
+	    iod->fd = -1;
+	}
+	return 0;
+
+    case GENSIO_IOD_CONTROL_WIN_SIZE: {
+	struct winsize win;
+	struct gensio_winsize *gwin = (struct gensio_winsize *) val;
+
+	win.ws_row = gwin->ws_row;
+	win.ws_col = gwin->ws_col;
+	win.ws_xpixel = gwin->ws_xpixel;
+	win.ws_ypixel = gwin->ws_ypixel;
+	if (ioctl(iod->fd, TIOCSWINSZ, &win) == -1)
+	    err = gensio_os_err_to_err(o, errno);
+	return err;
+    }
+
+    case GENSIO_IOD_CONTROL_START_DIR: {
+	char *dir = (char *) val;
+
+	if (dir) {
+	    dir = gensio_strdup(o, dir);
+	    if (!dir)
+		return GE_NOMEM;
+	}
+
+	if (iod->start_dir)
+	    o->free(o, iod->start_dir);
+	iod->start_dir = dir;
+	return 0;
+    }
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+gensio_uv_iod_control(struct gensio_iod *iiod, int op, bool get, intptr_t val)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    if (iod->type == GENSIO_IOD_SOCKET) {
+	if (op != GENSIO_IOD_CONTROL_SOCKINFO)
+	    return GE_NOTSUP;
+
+	if (get)
+	    *((void **) val) = iod->sockinfo;
+	else
+	    iod->sockinfo = (void *) val;
+
+	return 0;
+    }
+
+    if (iod->type == GENSIO_IOD_PTY)
+	return gensio_uv_pty_control(iod, op, get, val);
+
+    if (iod->type != GENSIO_IOD_DEV)
+	return GE_NOTSUP;
+
+    return gensio_unix_termios_control(iiod->f, op, get, val, &iod->termios,
+				       iod->fd);
+}
+
+static int
+gensio_uv_set_non_blocking(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    if (iod->type == GENSIO_IOD_FILE)
+	return 0;
+
+    return gensio_unix_do_nonblock(iiod->f, iod->fd, &iod->mode);
+}
+
+static int
+gensio_uv_close(struct gensio_iod **iodp)
+{
+    struct gensio_iod *iiod = *iodp;
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+    struct gensio_os_funcs *o = iiod->f;
+    int err;
+
+    assert(iodp);
+    assert(!iod->handlers_set);
+
+    if (iod->type != GENSIO_IOD_FILE) {
+	gensio_unix_cleanup_termios(o, &iod->termios, iod->fd);
+	gensio_unix_do_cleanup_nonblock(o, iod->fd, &iod->mode);
+    }
+
+    err = uv_iod_release(iod, true);
+    *iodp = NULL;
+
+    return err;
+}
+
+#define ERRHANDLE()			\
+do {								\
+    int err = 0;						\
+    if (rv < 0) {						\
+	if (errno == EINTR)					\
+	    goto retry;						\
+	if (errno == EWOULDBLOCK || errno == EAGAIN)		\
+	    rv = 0; /* Handle like a zero-byte write. */	\
+	else {							\
+	    err = errno;					\
+	    assert(err);					\
+	}							\
+    } else if (rv == 0) {					\
+	err = EPIPE;						\
+    }								\
+    if (!err && rcount)						\
+	*rcount = rv;						\
+    rv = gensio_os_err_to_err(o, err);				\
+} while(0)
+
+static int
+gensio_uv_write(struct gensio_iod *iiod, const struct gensio_sg *sg,
+		gensiods sglen, gensiods *rcount)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+    struct gensio_os_funcs *o = iiod->f;
+    ssize_t rv;
+
+    if (sglen == 0) {
+	if (rcount)
+	    *rcount = 0;
+	return 0;
+    }
+ retry:
+    rv = writev(iod->fd, (struct iovec *) sg, sglen);
+    ERRHANDLE();
+    return rv;
+}
+
+static int
+gensio_uv_read(struct gensio_iod *iiod, void *buf, gensiods buflen,
+	       gensiods *rcount)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+    struct gensio_os_funcs *o = iiod->f;
+    ssize_t rv;
+
+    if (buflen == 0) {
+	if (rcount)
+	    *rcount = 0;
+	return 0;
+    }
+ retry:
+    rv = read(iod->fd, buf, buflen);
+    ERRHANDLE();
+    return rv;
+}
+
+static bool
+gensio_uv_is_regfile(struct gensio_os_funcs *o, intptr_t fd)
+{
+    int err;
+    struct stat statb;
+
+    err = fstat(fd, &statb);
+    if (err == -1)
+	return false;
+
+    return (statb.st_mode & S_IFMT) == S_IFREG;
+}
+
+static int
+gensio_uv_bufcount(struct gensio_iod *iiod, int whichbuf, gensiods *count)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    return gensio_unix_get_bufcount(iiod->f, iod->fd, whichbuf, count);
+}
+
+static void
+gensio_uv_flush(struct gensio_iod *iiod, int whichbuf)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    gensio_unix_do_flush(iiod->f, iod->fd, whichbuf);
+}
+
+static int
+gensio_uv_makeraw(struct gensio_iod *iiod)
+{
+    struct gensio_iod_uv *iod = i_to_uv(iiod);
+
+    if (iod->orig_fd == 1 || iod->orig_fd == 2 || iod->type == GENSIO_IOD_FILE)
+	/* Only set this for stdin or other files. */
+	return 0;
+
+    return gensio_unix_setup_termios(iiod->f, iod->fd, &iod->termios);
+}
+
+static int
+gensio_uv_open_dev(struct gensio_os_funcs *o, const char *iname, int options,
+		   struct gensio_iod **riod)
+{
+    int flags, fd, err;
+
+    flags = O_NONBLOCK | O_NOCTTY;
+    if (options & (GENSIO_OPEN_OPTION_READABLE | GENSIO_OPEN_OPTION_WRITEABLE))
+	flags |= O_RDWR;
+    else if (options & GENSIO_OPEN_OPTION_READABLE)
+	flags |= O_RDONLY;
+    else if (options & GENSIO_OPEN_OPTION_WRITEABLE)
+	flags |= O_WRONLY;
+
+    fd = open(iname, flags);
+    if (fd == -1)
+	return gensio_os_err_to_err(o, errno);
+    err = o->add_iod(o, GENSIO_IOD_DEV, fd, riod);
+    if (err)
+	close(fd);
+    return err;
+}
+
+static void
+generic_close(intptr_t fd)
+{
+    close(fd);
+}
+
+static int
+gensio_uv_exec_subprog(struct gensio_os_funcs *o,
+		       const char *argv[], const char **env,
+		       const char *start_dir,
+		       unsigned int flags,
+		       intptr_t *rpid,
+		       struct gensio_iod **rstdin,
+		       struct gensio_iod **rstdout,
+		       struct gensio_iod **rstderr)
+{
+    int err;
+    struct gensio_iod *stdiniod = NULL, *stdoutiod = NULL, *stderriod = NULL;
+    intptr_t infd = -1, outfd = -1, errfd = -1;
+    intptr_t pid = -1;
+
+    int uinfd = -1, uoutfd = -1, uerrfd = -1;
+    int upid = -1;
+
+    err = gensio_unix_do_exec(o, argv, env, start_dir, flags, &upid, &uinfd,
+			      &uoutfd, rstderr ? &uerrfd : NULL);
+    if (err)
+	return err;
+    infd = uinfd;
+    outfd = uoutfd;
+    errfd = uerrfd;
+    pid = upid;
+
+    err = o->add_iod(o, GENSIO_IOD_PIPE, infd, &stdiniod);
+    if (err)
+	goto out_err;
+    infd = -1;
+    err = o->add_iod(o, GENSIO_IOD_PIPE, outfd, &stdoutiod);
+    if (err)
+	goto out_err;
+    outfd = -1;
+    err = o->set_non_blocking(stdiniod);
+    if (err)
+	goto out_err;
+    err = o->set_non_blocking(stdoutiod);
+    if (err)
+	goto out_err;
+
+    if (rstderr) {
+	err = o->add_iod(o, GENSIO_IOD_PIPE, errfd, &stderriod);
+	if (err)
+	    goto out_err;
+	errfd = -1;
+	err = o->set_non_blocking(stderriod);
+	if (err)
+	    goto out_err;
+    }
+
+    *rpid = pid;
+    *rstdin = stdiniod;
+    *rstdout = stdoutiod;
+    if (rstderr)
+	*rstderr = stderriod;
+    return 0;
+
+ out_err:
+    if (stderriod)
+	o->close(&stderriod);
+    else if (errfd != -1)
+	generic_close(errfd);
+    if (stdiniod)
+	o->close(&stdiniod);
+    else if (infd != -1)
+	generic_close(infd);
+    if (stdoutiod)
+	o->close(&stdoutiod);
+    else if (outfd != -1)
+	generic_close(outfd);
+    return err;
+}
+
+static int
+gensio_uv_kill_subprog(struct gensio_os_funcs *o, intptr_t pid, bool force)
+{
+    int rv;
+
+    rv = kill(pid, force ? SIGKILL : SIGTERM);
+    if (rv < 0)
+	return gensio_os_err_to_err(o, errno);
+    return 0;
+}
+
+static int
+gensio_uv_wait_subprog(struct gensio_os_funcs *o, intptr_t pid, int *retcode)
+{
+    pid_t rv;
+
+    rv = waitpid(pid, retcode, WNOHANG);
+    if (rv < 0)
+	return gensio_os_err_to_err(o, errno);
+
+    if (rv == 0)
+	return GE_INPROGRESS;
+
+    return 0;
+}
+
+static int
+gensio_uv_service(struct gensio_os_funcs *o, gensio_time *timeout)
+{
+    struct gensio_data *d = o->user_data;
+    struct timeout_info ti = { .timeout = timeout };
+    unsigned long did_something = d->did_something;
+    int rv = GE_TIMEDOUT;
+
+    /* Only the loop thread may run the loop. */
+    if (!uv_in_loop(d))
+	return GE_NOTSUP;
+
+    setup_timeout(&ti);
+
+    timeout_wait(d, &ti);
+    if (did_something != d->did_something)
+	rv = 0;
+    ti.now = fetch_us_time();
+
+    timeout_end(&ti);
+
+    return rv;
+}
+
+static struct gensio_os_funcs *
+gensio_uv_get_funcs(struct gensio_os_funcs *f)
+{
+    struct gensio_data *d = f->user_data;
+
+    d->refcount++;
+    return f;
+}
+
+static void
+gensio_uv_handle_closed(uv_handle_t *h)
+{
+    struct gensio_data *d = h->data;
+    struct gensio_os_funcs *o = d->o;
+
+    assert(d->nr_handles > 0);
+    if (--d->nr_handles > 0)
+	return;
+    uv_mutex_destroy(&d->defer_lock);
+    free(d);
+    free(o);
+}
+
+static void
+gensio_uv_free_funcs(struct gensio_os_funcs *f)
+{
+    struct gensio_data *d = f->user_data;
+
+    assert(d->refcount > 0);
+    if (d->refcount > 1) {
+	d->refcount--;
+	return;
+    }
+    assert(uv_in_loop(d));
+    gensio_memtrack_cleanup(d->mtrack);
+    /* The rest is freed when the loop finishes closing these. */
+    d->nr_handles = 2;
+    uv_close((uv_handle_t *) &d->async, gensio_uv_handle_closed);
+    uv_close((uv_handle_t *) &d->wait_timer, gensio_uv_handle_closed);
+}
+
+static pthread_mutex_t once_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+gensio_uv_call_once(struct gensio_os_funcs *f, struct gensio_once *once,
+		    void (*func)(void *cb_data), void *cb_data)
+{
+    if (once->called)
+	return;
+    pthread_mutex_lock(&once_lock);
+    if (!once->called) {
+	once->called = true;
+	func(cb_data);
+    }
+    pthread_mutex_unlock(&once_lock);
+}
+
+static void
+gensio_uv_get_monotonic_time(struct gensio_os_funcs *f, gensio_time *time)
+{
+    uint64_t now = uv_hrtime();
+
+    time->secs = now / 1000000000;
+    time->nsecs = now % 1000000000;
+}
+
+static int
+gensio_uv_handle_fork(struct gensio_os_funcs *f)
+{
+    return 0;
+}
+
+static int
+gensio_uv_get_random(struct gensio_os_funcs *o, void *data, unsigned int len)
+{
+    int fd;
+    int rv;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1)
+	return gensio_os_err_to_err(o, errno);
+
+    while (len > 0) {
+	rv = read(fd, data, len);
+	if (rv < 0) {
+	    rv = errno;
+	    goto out;
+	}
+	len -= rv;
+	data += rv;
+    }
+
+    rv = 0;
+
+ out:
+    close(fd);
+    return gensio_os_err_to_err(o, rv);
+}
+
+static int
+gensio_uv_control(struct gensio_os_funcs *o, int func, void *data,
+		  gensiods *datalen)
+{
+    struct gensio_data *d = o->user_data;
+
+    switch (func) {
+    case GENSIO_CONTROL_SET_PROC_DATA:
+	d->pdata = data;
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_uv_funcs_alloc(uv_loop_t *loop, struct gensio_os_funcs **ro)
+{
+    struct gensio_data *d;
+    struct gensio_os_funcs *o;
+    int err;
+
+    o = malloc(sizeof(*o));
+    if (!o)
+	return GE_NOMEM;
+    memset(o, 0, sizeof(*o));
+
+    d = malloc(sizeof(*d));
+    if (!d) {
+	free(o);
+	return GE_NOMEM;
+    }
+    memset(d, 0, sizeof(*d));
+    d->refcount = 1;
+    d->o = o;
+    d->loop = loop;
+    d->loop_thread = uv_thread_self();
+
+    o->user_data = d;
+    d->mtrack = gensio_memtrack_alloc();
+
+    o->zalloc = gensio_uv_zalloc;
+    o->free = gensio_uv_free;
+    o->alloc_lock = gensio_uv_alloc_lock;
+    o->free_lock = gensio_uv_free_lock;
+    o->lock = gensio_uv_lock;
+    o->unlock = gensio_uv_unlock;
+    o->set_fd_handlers = gensio_uv_set_fd_handlers;
+    o->clear_fd_handlers = gensio_uv_clear_fd_handlers;
+    o->clear_fd_handlers_norpt = gensio_uv_clear_fd_handlers_norpt;
+    o->set_read_handler = gensio_uv_set_read_handler;
+    o->set_write_handler = gensio_uv_set_write_handler;
+    o->set_except_handler = gensio_uv_set_except_handler;
+    o->alloc_timer = gensio_uv_alloc_timer;
+    o->free_timer = gensio_uv_free_timer;
+    o->start_timer = gensio_uv_start_timer;
+    o->start_timer_abs = gensio_uv_start_timer_abs;
+    o->stop_timer = gensio_uv_stop_timer;
+    o->stop_timer_with_done = gensio_uv_stop_timer_with_done;
+    o->alloc_runner = gensio_uv_alloc_runner;
+    o->free_runner = gensio_uv_free_runner;
+    o->run = gensio_uv_run;
+    o->alloc_waiter = gensio_uv_alloc_waiter;
+    o->free_waiter = gensio_uv_free_waiter;
+    o->wait = gensio_uv_wait;
+    o->wait_intr = gensio_uv_wait_intr;
+    o->wait_intr_sigmask = gensio_uv_wait_intr_sigmask;
+    o->wake = gensio_uv_wake;
+    o->service = gensio_uv_service;
+    o->get_funcs = gensio_uv_get_funcs;
+    o->free_funcs = gensio_uv_free_funcs;
+    o->call_once = gensio_uv_call_once;
+    o->get_monotonic_time = gensio_uv_get_monotonic_time;
+    o->handle_fork = gensio_uv_handle_fork;
+    o->add_iod = gensio_uv_add_iod;
+    o->release_iod = gensio_uv_release_iod;
+    o->iod_get_type = gensio_uv_iod_get_type;
+    o->iod_get_fd = gensio_uv_iod_get_fd;
+
+    o->set_non_blocking = gensio_uv_set_non_blocking;
+    o->close = gensio_uv_close;
+    o->graceful_close = gensio_uv_close;
+    o->write = gensio_uv_write;
+    o->read = gensio_uv_read;
+    o->is_regfile = gensio_uv_is_regfile;
+    o->bufcount = gensio_uv_bufcount;
+    o->flush = gensio_uv_flush;
+    o->makeraw = gensio_uv_makeraw;
+    o->open_dev = gensio_uv_open_dev;
+    o->exec_subprog = gensio_uv_exec_subprog;
+    o->kill_subprog = gensio_uv_kill_subprog;
+    o->wait_subprog = gensio_uv_wait_subprog;
+    o->get_random = gensio_uv_get_random;
+    o->iod_control = gensio_uv_iod_control;
+    o->control = gensio_uv_control;
+
+    gensio_addr_addrinfo_set_os_funcs(o);
+    err = gensio_stdsock_set_os_funcs(o);
+    if (err)
+	goto out_err;
+
+    if (uv_mutex_init(&d->defer_lock)) {
+	err = GE_NOMEM;
+	goto out_err;
+    }
+    err = uv_async_init(loop, &d->async, uv_async_handler);
+    if (err) {
+	uv_mutex_destroy(&d->defer_lock);
+	err = gensio_os_err_to_err(o, -err);
+	goto out_err;
+    }
+    d->async.data = d;
+    uv_unref((uv_handle_t *) &d->async);
+    uv_timer_init(loop, &d->wait_timer);
+    d->wait_timer.data = d;
+
+    *ro = o;
+    return 0;
+
+ out_err:
+    free(o);
+    free(d);
+    return err;
+}
@@ -0,0 +1,30 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIO_UV_H
+#define GENSIO_UV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <uv.h>
+#include <gensio/gensio_uv_dllvisibility.h>
+#include <gensio/gensio_types.h>
+
+/*
+ * Allocate a libuv-based os funcs that runs on the given loop.  This
+ * must be called from the thread that runs the loop.
+ */
+GENSIOUV_DLL_PUBLIC
+int gensio_uv_funcs_alloc(uv_loop_t *loop, struct gensio_os_funcs **o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENSIO_UV_H */
@@ -0,0 +1,39 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2026  Corey Minyard <minyard@acm.org>
+ *
+ *  SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#ifndef GENSIOUV_DLLVISIBILITY
+#define GENSIOUV_DLLVISIBILITY
+
+#if defined GENSIO_LINK_STATIC
+  #define GENSIOUV_DLL_PUBLIC
+  #define GENSIOUV_DLL_LOCAL
+#elif defined _WIN32 || defined __CYGWIN__
+  #ifdef BUILDING_GENSIOUV_DLL
+    #ifdef __GNUC__
+      #define GENSIOUV_DLL_PUBLIC __attribute__ ((dllexport))
+    #else
+      #define GENSIOUV_DLL_PUBLIC __declspec(dllexport) // Note: actually gcc seems to also supports this syntax.
+    #endif
+  #else
+    #ifdef __GNUC__
+      #define GENSIOUV_DLL_PUBLIC __attribute__ ((dllimport))
+    #else
+      #define GENSIOUV_DLL_PUBLIC __declspec(dllimport) // Note: actually gcc seems to also supports this syntax.
+    #endif
+  #endif
+  #define GENSIOUV_DLL_LOCAL
+#else
+  #if __GNUC__ >= 4
+    #define GENSIOUV_DLL_PUBLIC __attribute__ ((visibility ("default")))
+    #define GENSIOUV_DLL_LOCAL  __attribute__ ((visibility ("hidden")))
+  #else
+    #define GENSIOUV_DLL_PUBLIC
+    #define GENSIOUV_DLL_LOCAL
+  #endif
+#endif
+
+#endif /* GENSIOUV_DLLVISIBILITY */